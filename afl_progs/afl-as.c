@@ -62,6 +62,12 @@ static u8   be_quiet,           /* Quiet mode (no stderr output)        */
 static u32  inst_ratio = 100,   /* Instrumentation probability (%)      */
             as_par_cnt = 1;     /* Number of params to 'as'             */
 
+static u8   no_liveness;        /* Always use the classic trampoline    */
+static u32  inline_cnt;         /* Number of inlined trampolines        */
+
+static u8** lines;              /* The input file's lines               */
+static u32  lines_cnt;          /* Number of lines                      */
+
 /* If we don't find --32 or --64 in the command line, default to 
    instrumentation for whichever mode we were compiled with. This is not
    perfect, but should do the trick for almost all use cases. */
@@ -213,17 +219,375 @@ wrap_things_up:
 }
 
 
+/* The resources that the 64-bit trampolines clobber, for the liveness scan. */
+
+#define LIVE_RDX   1
+#define LIVE_RCX   2
+#define LIVE_RAX   4
+#define LIVE_FLAGS 8
+#define LIVE_ALL   (LIVE_RDX | LIVE_RCX | LIVE_RAX | LIVE_FLAGS)
+
+/* How many instructions after an instrumented location the scan looks at. */
+
+#define LIVENESS_SCAN_MAX 16
+
+static const u8* reg_names[3][5] = {
+  { "%rdx", "%edx", "%dx", "%dl", "%dh" },
+  { "%rcx", "%ecx", "%cx", "%cl", "%ch" },
+  { "%rax", "%eax", "%ax", "%al", "%ah" }
+};
+
+
+/* Check whether an operand string mentions any part of a register. */
+
+static u8 mentions_reg(u8* ops, u8* ops_end, u32 reg) {
+
+  u32 i, len;
+  u8* pos;
+
+  for (i = 0; i < 5; i++) {
+
+    len = strlen(reg_names[reg][i]);
+
+    for (pos = ops; pos + len <= ops_end; pos++)
+      if (!strncmp(pos, reg_names[reg][i], len) &&
+          (pos + len == ops_end || !isalnum(pos[len]))) return 1;
+
+  }
+
+  return 0;
+
+}
+
+
+/* Check whether an operand is exactly the 64-bit or 32-bit name of a register,
+   which a write replaces entirely (32-bit writes zero the upper half). */
+
+static u8 is_full_reg(u8* op, u8* op_end, u32 reg) {
+
+  u32 len = op_end - op;
+
+  return (len == 4 && (!strncmp(op, reg_names[reg][0], 4) ||
+                       !strncmp(op, reg_names[reg][1], 4)));
+
+}
+
+
+/* Check whether a mnemonic is one of the names, optionally followed by an
+   AT&T operand size suffix. */
+
+static u8 mnemonic_in(u8* mn, u32 mn_len, const u8** names) {
+
+  u32 len;
+
+  for (; *names; names++) {
+
+    len = strlen(*names);
+
+    if (!strncmp(mn, *names, len) && (mn_len == len ||
+        (mn_len == len + 1 && strchr("bwlq", mn[len])))) return 1;
+
+  }
+
+  return 0;
+
+}
+
+/* Sets all of the flags, without reading them. */
+
+static const u8* flag_writers[] = {
+  "add", "sub", "and", "or", "xor", "cmp", "test", "neg", NULL
+};
+
+/* Read the flags. */
+
+static const u8* flag_readers[] = {
+  "adc", "sbb", "rcl", "rcr", "pushf", "lahf", NULL
+};
+
+/* Only touch their explicit operands, and don't read the flags. Some of them
+   leave the flags partly or sometimes unchanged, so they never kill them. */
+
+static const u8* plain_insns[] = {
+  "mov", "movabs", "lea", "push", "pop", "not", "inc", "dec", "shl", "sal",
+  "shr", "sar", "rol", "ror", "bswap", "imul",
+  "movzbw", "movzbl", "movzbq", "movzwl", "movzwq", "movsbw", "movsbl",
+  "movsbq", "movswl", "movswq", "movslq",
+  "movss", "movsd", "movaps", "movups", "movapd", "movupd", "movdqa",
+  "movdqu", "movd", "pxor", "xorps", "xorpd", "andps", "andpd", "addss",
+  "addsd", "subss", "subsd", "mulss", "mulsd", "divss", "divsd",
+  "cvtsi2ss", "cvtsi2sd", "cvtss2sd", "cvtsd2ss", "cvttss2si", "cvttsd2si",
+  NULL
+};
+
+/* Write their whole destination operand without reading it. */
+
+static const u8* full_writers[] = {
+  "mov", "movabs", "lea", "movzbl", "movzbq", "movzwl",
+  "movzwq", "movsbl", "movsbq", "movswl", "movswq", "movslq", NULL
+};
+
+static const u8* zeroing_insns[] = { "xor", "sub", NULL };
+static const u8* pop_insns[]     = { "pop", NULL };
+static const u8* imul_insns[]    = { "imul", NULL };
+
+
+/* Scan the code that follows an instrumented location for the registers and
+   flags that the trampoline needs to preserve. A resource is dead if it's
+   overwritten before anything reads it, within the same basic block. Anything
+   we can't reason about (labels, jumps, calls, inline assembly, instructions
+   with implicit operands, or anything unfamiliar) ends the scan, and whatever
+   hasn't been found dead by then is treated as live. Returns the LIVE_* mask
+   of the resources to preserve. */
+
+static u32 scan_liveness(u32 start) {
+
+  u32 live = 0, dead = 0, i, reg, insns = 0, mn_len, ops_cnt, depth;
+  u8 *line, *mn, *ops, *ops_end, *op_starts[4], *op_ends[4], *pos;
+
+  for (i = start; i < lines_cnt && insns < LIVENESS_SCAN_MAX; i++) {
+
+    line = lines[i];
+
+    while (*line == ' ' || *line == '\t') line++;
+
+    /* Blank lines, comments, and the debug info and unwind directives don't
+       change anything. Other directives, labels, and inline assembly do. */
+
+    if (!*line || *line == '\n') continue;
+    if (*line == '#' && !strstr(line, "#APP")) continue;
+
+    if (*line == '.') {
+
+      if (!strncmp(line, ".loc", 4) || !strncmp(line, ".cfi_", 5)) continue;
+      break;
+
+    }
+
+    if (lines[i][0] != '\t' || strchr(line, ';') || strchr(line, ':')) break;
+
+    mn = line;
+    while (isalnum(*line)) line++;
+    mn_len = line - mn;
+
+    if (!mn_len || (*line != ' ' && *line != '\t' && *line != '\n' && *line)) break;
+
+    /* Split the operands at the commas outside of parentheses. */
+
+    while (*line == ' ' || *line == '\t') line++;
+    ops = line;
+
+    ops_end = ops;
+    while (*ops_end && *ops_end != '\n' && *ops_end != '#') ops_end++;
+    while (ops_end > ops && isspace(ops_end[-1])) ops_end--;
+
+    ops_cnt = 0;
+    depth = 0;
+    op_starts[0] = ops;
+
+    for (pos = ops; pos < ops_end; pos++) {
+
+      if (*pos == '(') depth++;
+      else if (*pos == ')' && depth) depth--;
+      else if (*pos == ',' && !depth) {
+
+        if (ops_cnt == 3) break;
+        op_ends[ops_cnt++] = pos;
+        op_starts[ops_cnt] = pos + 1;
+        while (op_starts[ops_cnt] < ops_end && *op_starts[ops_cnt] == ' ')
+          op_starts[ops_cnt]++;
+
+      }
+
+    }
+
+    if (pos < ops_end) break;
+    if (ops < ops_end) op_ends[ops_cnt++] = ops_end;
+
+    /* Everything but a few operand-less instructions and the ones we know
+       only use their explicit operands ends the scan (jumps, calls, ret,
+       string instructions, cltq, one-operand imul / mul / div, prefixes...). */
+
+    if (!ops_cnt) {
+
+      if ((mn_len == 3 && !strncmp(mn, "nop", 3)) ||
+          (mn_len >= 4 && !strncmp(mn, "nop", 3) && strchr("wlq", mn[3])) ||
+          (mn_len == 5 && !strncmp(mn, "leave", 5)) ||
+          (mn_len == 6 && !strncmp(mn, "leaveq", 6))) {
+        insns++;
+        continue;
+      }
+
+      break;
+
+    }
+
+    if (mnemonic_in(mn, mn_len, flag_readers) ||
+        (mn_len > 3 && !strncmp(mn, "set", 3)) ||
+        (mn_len > 4 && !strncmp(mn, "cmov", 4))) {
+
+      live |= LIVE_FLAGS & ~dead;
+
+      /* cmov only conditionally writes its destination. */
+
+      for (reg = 0; reg < 3; reg++)
+        if (mentions_reg(ops, ops_end, reg)) live |= (1 << reg) & ~dead;
+
+      insns++;
+      continue;
+
+    }
+
+    if (mnemonic_in(mn, mn_len, flag_writers)) {
+
+      /* The xor / sub zeroing idiom doesn't read its register. */
+
+      if (ops_cnt == 2 && mnemonic_in(mn, mn_len, zeroing_insns) &&
+          op_ends[0] - op_starts[0] == op_ends[1] - op_starts[1] &&
+          !strncmp(op_starts[0], op_starts[1], op_ends[0] - op_starts[0])) {
+
+        for (reg = 0; reg < 3; reg++)
+          if (is_full_reg(op_starts[1], op_ends[1], reg)) dead |= (1 << reg) & ~live;
+
+      }
+
+      for (reg = 0; reg < 3; reg++)
+        if (mentions_reg(ops, ops_end, reg)) live |= (1 << reg) & ~dead;
+
+      dead |= LIVE_FLAGS & ~live;
+      insns++;
+      continue;
+
+    }
+
+    if (!mnemonic_in(mn, mn_len, plain_insns) ||
+        (mnemonic_in(mn, mn_len, imul_insns) && ops_cnt < 2))
+      break;
+
+    /* A full write of the destination kills the register, unless the source
+       operands (or the destination's addressing) read it first. */
+
+    for (reg = 0; reg < 3; reg++) {
+
+      if (mnemonic_in(mn, mn_len, full_writers) && ops_cnt == 2 &&
+          is_full_reg(op_starts[1], op_ends[1], reg) &&
+          !mentions_reg(op_starts[0], op_ends[0], reg)) {
+
+        dead |= (1 << reg) & ~live;
+
+      } else if (mnemonic_in(mn, mn_len, pop_insns) &&
+                 ops_cnt == 1 && is_full_reg(op_starts[0], op_ends[0], reg)) {
+
+        dead |= (1 << reg) & ~live;
+
+      } else if (mentions_reg(ops, ops_end, reg)) {
+
+        live |= (1 << reg) & ~dead;
+
+      }
+
+    }
+
+    insns++;
+
+    if ((dead | live) == LIVE_ALL) break;
+
+  }
+
+  return LIVE_ALL & ~dead;
+
+}
+
+
+/* Write the trampoline for an instrumented location. The location's code
+   starts at the given line, which is scanned to see what the trampoline
+   can skip preserving. */
+
+static void write_trampoline(FILE* outf, u32 next_line) {
+
+  static u32 tramp_id;
+  u8 saves[96] = "", restores[96] = "";
+  const u8 *rax_save = "", *rax_restore = "";
+  u32 live, loc = R(MAP_SIZE);
+
+  if (!use_64bit) {
+    fprintf(outf, trampoline_fmt_32, loc);
+    return;
+  }
+
+  live = no_liveness ? LIVE_ALL : scan_liveness(next_line);
+
+  if (live == LIVE_ALL) {
+    fprintf(outf, trampoline_fmt_64, loc);
+    return;
+  }
+
+  if (live & LIVE_RAX) {
+    rax_save = "movq %rax, 16(%rsp)\n";
+    rax_restore = "movq 16(%rsp), %rax\n";
+  }
+
+  /* With the flags live, the call saves rax along with the others. */
+
+  if (live & LIVE_FLAGS) strcat(restores, rax_restore);
+
+  if (live & LIVE_RDX) strcat(saves, "movq %rdx,  0(%rsp)\n");
+  if (live & LIVE_RCX) strcat(saves, "movq %rcx,  8(%rsp)\n");
+  if (live & LIVE_RCX) strcat(restores, "movq  8(%rsp), %rcx\n");
+  if (live & LIVE_RDX) strcat(restores, "movq  0(%rsp), %rdx\n");
+
+  if (live & LIVE_FLAGS) {
+
+    strcat(saves, rax_save);
+    fprintf(outf, trampoline_call_fmt_64, saves, loc, restores);
+
+  } else {
+
+    /* Only the slow path touches rax, so it saves rax itself. */
+
+    tramp_id++;
+    inline_cnt++;
+    fprintf(outf, trampoline_inline_fmt_64, saves, tramp_id, loc, tramp_id,
+            tramp_id, rax_save, loc, rax_restore, tramp_id, restores);
+
+  }
+
+}
+
+
+/* Read the input file's lines, so that the liveness scan can look ahead of
+   the line being processed. */
+
+static void read_lines(FILE* inf) {
+
+  static u8 line[MAX_LINE];
+  u32 lines_size = 0;
+
+  while (fgets(line, MAX_LINE, inf)) {
+
+    if (lines_cnt == lines_size) {
+      lines_size = lines_size ? lines_size * 2 : 1024;
+      lines = ck_realloc(lines, lines_size * sizeof(u8*));
+    }
+
+    lines[lines_cnt++] = ck_strdup(line);
+
+  }
+
+}
+
+
 /* Process input file, generate modified_file. Insert instrumentation in all
    the appropriate places. */
 
 static void add_instrumentation(void) {
 
-  static u8 line[MAX_LINE];
+  u8* line;
 
   FILE* inf;
   FILE* outf;
   s32 outfd;
-  u32 ins_lines = 0;
+  u32 ins_lines = 0, cur;
 
   u8  instr_ok = 0, skip_csect = 0, skip_next_label = 0,
       skip_intel = 0, skip_app = 0, instrument_next = 0;
@@ -249,7 +613,11 @@ static void add_instrumentation(void) {
 
   if (!outf) PFATAL("fdopen() failed");  
 
-  while (fgets(line, MAX_LINE, inf)) {
+  read_lines(inf);
+
+  for (cur = 0; cur < lines_cnt; cur++) {
+
+    line = lines[cur];
 
     /* In some cases, we want to defer writing the instrumentation trampoline
        until after all the labels, macros, comments, etc. If we're in this
@@ -259,8 +627,7 @@ static void add_instrumentation(void) {
     if (!pass_thru && !skip_intel && !skip_app && !skip_csect && instr_ok &&
         instrument_next && line[0] == '\t' && isalpha(line[1])) {
 
-      fprintf(outf, use_64bit ? trampoline_fmt_64 : trampoline_fmt_32,
-              R(MAP_SIZE));
+      write_trampoline(outf, cur);
 
       instrument_next = 0;
       ins_lines++;
@@ -365,8 +732,7 @@ static void add_instrumentation(void) {
 
       if (line[1] == 'j' && line[2] != 'm' && R(100) < inst_ratio) {
 
-        fprintf(outf, use_64bit ? trampoline_fmt_64 : trampoline_fmt_32,
-                R(MAP_SIZE));
+        write_trampoline(outf, cur + 1);
 
         ins_lines++;
 
@@ -453,8 +819,8 @@ static void add_instrumentation(void) {
 
     if (!ins_lines) WARNF("No instrumentation targets found%s.",
                           pass_thru ? " (pass-thru mode)" : "");
-    else OKF("Instrumented %u locations (%s-bit, %s mode, ratio %u%%).",
-             ins_lines, use_64bit ? "64" : "32",
+    else OKF("Instrumented %u locations, %u inlined (%s-bit, %s mode, ratio %u%%).",
+             ins_lines, inline_cnt, use_64bit ? "64" : "32",
              getenv("AFL_HARDEN") ? "hardened" : 
              (sanitizer ? "ASAN/MSAN" : "non-hardened"),
              inst_ratio);
@@ -477,6 +843,7 @@ int main(int argc, char** argv) {
   struct timezone tz;
 
   clang_mode = !!getenv(CLANG_ENV_VAR);
+  no_liveness = !!getenv("AFL_AS_NO_LIVENESS");
 
   if (isatty(2) && !getenv("AFL_QUIET")) {
 
@@ -493,7 +860,11 @@ int main(int argc, char** argv) {
 
          "Rarely, when dealing with extremely complex projects, it may be advisable to\n"
          "set AFL_INST_RATIO to a value less than 100 in order to reduce the odds of\n"
-         "instrumenting every discovered branch.\n\n");
+         "instrumenting every discovered branch.\n\n"
+
+         "On 64-bit targets, the trampolines skip saving the registers and flags that\n"
+         "the following code overwrites, and inline the counter update when they can.\n"
+         "Set AFL_AS_NO_LIVENESS to always use the classic trampolines.\n\n");
 
     exit(1);
 
@@ -44,6 +44,12 @@
 #include "types.h"
 #include "../instrumentation/forkserver_internal.h"
 
+/* How much of an inherited SHM fd (see SHM_FD_ENV_VAR) to map. It's rounded up
+   to a 2MB huge page, since a memfd backed by huge pages can only be mapped in
+   whole pages, and mapping past the end of a smaller memfd is harmless. */
+
+#define SHM_FD_MAP_LENGTH   ((MAP_SIZE + 0x1fffff) & ~0x1fffff)
+
 /* 
    ------------------
    Performances notes
@@ -155,6 +161,74 @@ static const u8* trampoline_fmt_64 =
   "/* --- END --- */\n"
   "\n";
 
+/* The 64-bit trampolines below are used when afl-as' liveness scan of the
+   code that follows an instrumented location (see scan_liveness() in afl-as.c)
+   finds that some of rdx, rcx and rax, or the flags, are dead there. The %s
+   slots are filled in with the saves and restores of the registers that are
+   live, in the same stack slots that trampoline_fmt_64 uses.
+
+   When the flags are live, the trampoline still calls __afl_maybe_log, which
+   preserves them, but skips saving the dead registers. */
+
+static const u8* trampoline_call_fmt_64 =
+
+  "\n"
+  "/* --- AFL TRAMPOLINE (64-BIT, LIVE FLAGS) --- */\n"
+  "\n"
+  ".align 4\n"
+  "\n"
+  "leaq -(128+24)(%%rsp), %%rsp\n"
+  "%s"
+  "movq $0x%08x, %%rcx\n"
+  "call __afl_maybe_log\n"
+  "%s"
+  "leaq (128+24)(%%rsp), %%rsp\n"
+  "\n"
+  "/* --- END --- */\n"
+  "\n";
+
+/* When the flags are dead, the counter update is inlined, so that once the
+   SHM region is set up there's no call, and no lahf / sahf. Only the first
+   hit in each object file, before __afl_area_ptr is set, takes the slow path
+   through __afl_maybe_log, which is the only place rax is touched. The %u
+   slots are the number of the trampoline, for its local labels. */
+
+static const u8* trampoline_inline_fmt_64 =
+
+  "\n"
+  "/* --- AFL TRAMPOLINE (64-BIT, INLINE) --- */\n"
+  "\n"
+  ".align 4\n"
+  "\n"
+  "leaq -(128+24)(%%rsp), %%rsp\n"
+  "%s"
+  "movq  __afl_area_ptr(%%rip), %%rdx\n"
+  "testq %%rdx, %%rdx\n"
+  "je    .Lafl_setup_%u\n"
+  "movq  $0x%08x, %%rcx\n"
+#ifndef COVERAGE_ONLY
+  "xorq  __afl_prev_loc(%%rip), %%rcx\n"
+  "xorq  %%rcx, __afl_prev_loc(%%rip)\n"
+  "shrq  $1, __afl_prev_loc(%%rip)\n"
+#endif /* ^!COVERAGE_ONLY */
+#ifdef SKIP_COUNTS
+  "orb   $1, (%%rdx, %%rcx, 1)\n"
+#else
+  "incb  (%%rdx, %%rcx, 1)\n"
+#endif /* ^SKIP_COUNTS */
+  "jmp   .Lafl_done_%u\n"
+  ".Lafl_setup_%u:\n"
+  "%s"
+  "movq  $0x%08x, %%rcx\n"
+  "call  __afl_maybe_log\n"
+  "%s"
+  ".Lafl_done_%u:\n"
+  "%s"
+  "leaq (128+24)(%%rsp), %%rsp\n"
+  "\n"
+  "/* --- END --- */\n"
+  "\n";
+
 static const u8* main_payload_32 = 
 
   "\n"
@@ -220,6 +294,34 @@ static const u8* main_payload_32 =
   "  pushl %eax\n"
   "  pushl %ecx\n"
   "\n"
+  "  /* The fuzzer either hands us an inherited fd to mmap, or a SysV SHM ID. */\n"
+  "\n"
+  "  pushl $.AFL_SHM_FD_ENV\n"
+  "  call  getenv\n"
+  "  addl  $4, %esp\n"
+  "\n"
+  "  testl %eax, %eax\n"
+  "  je    __afl_setup_shmat\n"
+  "\n"
+  "  pushl %eax\n"
+  "  call  atoi\n"
+  "  addl  $4, %esp\n"
+  "\n"
+  "  pushl $0          /* offset         */\n"
+  "  pushl %eax        /* fd             */\n"
+  "  pushl $1          /* MAP_SHARED     */\n"
+  "  pushl $3          /* PROT_READ | PROT_WRITE */\n"
+  "  pushl $" STRINGIFY(SHM_FD_MAP_LENGTH) " /* length */\n"
+  "  pushl $0          /* requested addr */\n"
+  "  call  mmap\n"
+  "  addl  $24, %esp\n"
+  "\n"
+  "  cmpl $-1, %eax\n"
+  "  je   __afl_setup_abort\n"
+  "  jmp  __afl_setup_mapped\n"
+  "\n"
+  "__afl_setup_shmat:\n"
+  "\n"
   "  pushl $.AFL_SHM_ENV\n"
   "  call  getenv\n"
   "  addl  $4, %esp\n"
@@ -240,6 +342,8 @@ static const u8* main_payload_32 =
   "  cmpl $-1, %eax\n"
   "  je   __afl_setup_abort\n"
   "\n"
+  "__afl_setup_mapped:\n"
+  "\n"
   "  /* Store the address of the SHM region. */\n"
   "\n"
   "  movl %eax, __afl_area_ptr\n"
@@ -259,8 +363,10 @@ static const u8* main_payload_32 =
   "  /* Phone home and tell the parent that we're OK. (Note that signals with\n"
   "     no SA_RESTART will mess it up). If this fails, assume that the fd is\n"
   "     closed because we were execve()d from an instrumented binary, or because\n" 
-  "     the parent doesn't want to use the fork server. */\n"
+  "     the parent doesn't want to use the fork server. The hello message\n"
+  "     tells the parent how big our coverage map is. */\n"
   "\n"
+  "  movl  $" STRINGIFY(FORKSERVER_HELLO_MAP_SIZE(MAP_SIZE_POW2)) ", __afl_temp\n"
   "  pushl $4          /* length    */\n"
   "  pushl $__afl_temp /* data      */\n"
   "  pushl $" STRINGIFY(FORKSRV_TO_FUZZER) "  /* file desc */\n"
@@ -385,6 +491,9 @@ static const u8* main_payload_32 =
   ".AFL_SHM_ENV:\n"
   "  .asciz \"" SHM_ENV_VAR "\"\n"
   "\n"
+  ".AFL_SHM_FD_ENV:\n"
+  "  .asciz \"" SHM_FD_ENV_VAR "\"\n"
+  "\n"
   "/* --- END --- */\n"
   "\n";
 
@@ -519,6 +628,31 @@ static const u8* main_payload_64 =
   "  subq  $16, %rsp\n"
   "  andq  $0xfffffffffffffff0, %rsp\n"
   "\n"
+  "  /* The fuzzer either hands us an inherited fd to mmap, or a SysV SHM ID. */\n"
+  "\n"
+  "  leaq .AFL_SHM_FD_ENV(%rip), %rdi\n"
+  CALL_L64("getenv")
+  "\n"
+  "  testq %rax, %rax\n"
+  "  je    __afl_setup_shmat\n"
+  "\n"
+  "  movq  %rax, %rdi\n"
+  CALL_L64("atoi")
+  "\n"
+  "  movq %rax, %r8    /* fd             */\n"
+  "  xorq %r9, %r9     /* offset         */\n"
+  "  movq $1, %rcx     /* MAP_SHARED     */\n"
+  "  movq $3, %rdx     /* PROT_READ | PROT_WRITE */\n"
+  "  movq $" STRINGIFY(SHM_FD_MAP_LENGTH) ", %rsi /* length */\n"
+  "  xorq %rdi, %rdi   /* requested addr */\n"
+  CALL_L64("mmap")
+  "\n"
+  "  cmpq $-1, %rax\n"
+  "  je   __afl_setup_abort\n"
+  "  jmp  __afl_setup_mapped\n"
+  "\n"
+  "__afl_setup_shmat:\n"
+  "\n"
   "  leaq .AFL_SHM_ENV(%rip), %rdi\n"
   CALL_L64("getenv")
   "\n"
@@ -536,6 +670,8 @@ static const u8* main_payload_64 =
   "  cmpq $-1, %rax\n"
   "  je   __afl_setup_abort\n"
   "\n"
+  "__afl_setup_mapped:\n"
+  "\n"
   "  /* Store the address of the SHM region. */\n"
   "\n"
   "  movq %rax, %rdx\n"
@@ -560,8 +696,10 @@ static const u8* main_payload_64 =
   "  /* Phone home and tell the parent that we're OK. (Note that signals with\n"
   "     no SA_RESTART will mess it up). If this fails, assume that the fd is\n"
   "     closed because we were execve()d from an instrumented binary, or because\n"
-  "     the parent doesn't want to use the fork server. */\n"
+  "     the parent doesn't want to use the fork server. The hello message\n"
+  "     tells the parent how big our coverage map is. */\n"
   "\n"
+  "  movl $" STRINGIFY(FORKSERVER_HELLO_MAP_SIZE(MAP_SIZE_POW2)) ", __afl_temp(%rip)\n"
   "  movq $4, %rdx               /* length    */\n"
   "  leaq __afl_temp(%rip), %rsi /* data      */\n"
   "  movq $" STRINGIFY(FORKSRV_TO_FUZZER) ", %rdi       /* file desc */\n"
@@ -752,6 +890,9 @@ static const u8* main_payload_64 =
   ".AFL_SHM_ENV:\n"
   "  .asciz \"" SHM_ENV_VAR "\"\n"
   "\n"
+  ".AFL_SHM_FD_ENV:\n"
+  "  .asciz \"" SHM_FD_ENV_VAR "\"\n"
+  "\n"
   "/* --- END --- */\n"
   "\n";
 
@@ -19,6 +19,10 @@
    Exit code is 2 if the target program crashes; 1 if it times out or
    there is a problem executing it; or 0 if execution is successful.
 
+   With -i, it maps a whole directory of inputs instead. The target is
+   started once per worker (-w) with the fork server, and the tuples of
+   each input are written to a file of the same name in the -o directory.
+
  */
 
 #define AFL_MAIN
@@ -28,6 +32,7 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "../instrumentation/forkserver_internal.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -53,9 +58,16 @@ static u8* trace_bits;                /* SHM with instrumentation bitmap   */
 static u8 *out_file,                  /* Trace output file                 */
           *doc_path,                  /* Path to docs                      */
           *target_path,               /* Path to target binary             */
-          *at_file;                   /* Substitution string for @@        */
+          *at_file,                   /* Substitution string for @@        */
+          *in_dir;                    /* Corpus to map, in corpus mode     */
+
+static u32 exec_tmout,                /* Exec timeout (ms)                 */
+           num_workers = 1;           /* Worker processes in corpus mode   */
 
-static u32 exec_tmout;                /* Exec timeout (ms)                 */
+static s32 fsrv_ctl_fd,               /* Fork server control pipe (write)  */
+           fsrv_st_fd,                /* Fork server status pipe (read)    */
+           fsrv_pid,                  /* PID of the fork server            */
+           input_fd = -1;             /* The worker's current input file   */
 
 static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
 
@@ -126,6 +138,16 @@ static void classify_counts(u8* mem, const u8* map) {
 }
 
 
+/* In corpus mode, each input's tuples are written as 32-bit values, with the
+   map index in the low 24 bits and the classified hit count in the top 8. */
+
+#if MAP_SIZE_POW2 > 24
+#  error "The corpus mode tuple listing only has room for 24-bit map indexes"
+#endif
+
+#define TUPLE_INDEX_BITS 24
+
+
 /* Get rid of shared memory (atexit handler). */
 
 static void remove_shm(void) {
@@ -227,6 +249,29 @@ static u32 write_results(void) {
 }
 
 
+/* Write the tuples of one input, in corpus mode. */
+
+static u32 write_tuples(u8* fname) {
+
+  static u32 tuples[MAP_SIZE];
+  u32 i, cnt = 0;
+  s32 fd;
+
+  for (i = 0; i < MAP_SIZE; i++)
+    if (trace_bits[i]) tuples[cnt++] = i | ((u32)trace_bits[i] << TUPLE_INDEX_BITS);
+
+  unlink(fname); /* Ignore errors */
+  fd = open(fname, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fname);
+
+  ck_write(fd, tuples, cnt * sizeof(u32), fname);
+  close(fd);
+
+  return cnt;
+
+}
+
+
 /* Handle timeout signal. */
 
 static void handle_timeout(int sig) {
@@ -237,63 +282,73 @@ static void handle_timeout(int sig) {
 }
 
 
-/* Execute target application. */
+/* Set up the descriptors and limits of a freshly forked target, before it's
+   executed. */
 
-static void run_target(char** argv) {
+static void set_up_child(void) {
 
-  static struct itimerval it;
-  int status = 0;
+  struct rlimit r;
 
-  if (!quiet_mode)
-    SAYF("-- Program output begins --\n" cRST);
+  if (quiet_mode) {
 
-  MEM_BARRIER();
+    s32 fd = open("/dev/null", O_RDWR);
 
-  child_pid = fork();
+    if (fd < 0 || dup2(fd, 1) < 0 || dup2(fd, 2) < 0) {
+      *(u32*)trace_bits = EXEC_FAIL_SIG;
+      PFATAL("Descriptor initialization failed");
+    }
 
-  if (child_pid < 0) PFATAL("fork() failed");
+    close(fd);
 
-  if (!child_pid) {
+  }
 
-    struct rlimit r;
+  if (mem_limit) {
 
-    if (quiet_mode) {
+    r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
 
-      s32 fd = open("/dev/null", O_RDWR);
+#ifdef RLIMIT_AS
 
-      if (fd < 0 || dup2(fd, 1) < 0 || dup2(fd, 2) < 0) {
-        *(u32*)trace_bits = EXEC_FAIL_SIG;
-        PFATAL("Descriptor initialization failed");
-      }
+    setrlimit(RLIMIT_AS, &r); /* Ignore errors */
 
-      close(fd);
+#else
 
-    }
+    setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
 
-    if (mem_limit) {
+#endif /* ^RLIMIT_AS */
 
-      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+  }
 
-#ifdef RLIMIT_AS
+  if (!keep_cores) r.rlim_max = r.rlim_cur = 0;
+  else r.rlim_max = r.rlim_cur = RLIM_INFINITY;
 
-      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
 
-#else
+  if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
 
-      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+  setsid();
 
-#endif /* ^RLIMIT_AS */
+}
 
-    }
 
-    if (!keep_cores) r.rlim_max = r.rlim_cur = 0;
-    else r.rlim_max = r.rlim_cur = RLIM_INFINITY;
+/* Execute target application. */
+
+static void run_target(char** argv) {
+
+  static struct itimerval it;
+  int status = 0;
+
+  if (!quiet_mode)
+    SAYF("-- Program output begins --\n" cRST);
+
+  MEM_BARRIER();
+
+  child_pid = fork();
 
-    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+  if (child_pid < 0) PFATAL("fork() failed");
 
-    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+  if (!child_pid) {
 
-    setsid();
+    set_up_child();
 
     execv(target_path, argv);
 
@@ -457,6 +512,247 @@ static void detect_file_args(char** argv) {
 }
 
 
+/* Start the target's fork server, in corpus mode. The target reads each input
+   from input_fd, which it gets as its stdin. */
+
+static void init_forkserver(char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  s32 hello;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  fsrv_pid = fork();
+
+  if (fsrv_pid < 0) PFATAL("fork() failed");
+
+  if (!fsrv_pid) {
+
+    set_up_child();
+
+    if (dup2(input_fd, 0) < 0 || dup2(ctl_pipe[0], FUZZER_TO_FORKSRV) < 0 ||
+        dup2(st_pipe[1], FORKSRV_TO_FUZZER) < 0)
+      PFATAL("dup2() failed");
+
+    close(input_fd);
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    execv(target_path, argv);
+    exit(0);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait forever. */
+
+  child_pid = fsrv_pid;
+  it.it_value.tv_sec = ((exec_tmout ? exec_tmout : EXEC_TIMEOUT) * FORK_WAIT_MULT) / 1000;
+  it.it_value.tv_usec = (((exec_tmout ? exec_tmout : EXEC_TIMEOUT) * FORK_WAIT_MULT) % 1000) * 1000;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if (read(fsrv_st_fd, &hello, 4) != 4)
+    FATAL("Unable to start the fork server of '%s' (is it instrumented?)", argv[0]);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+  child_pid = 0;
+  child_timed_out = 0;
+
+  if (FORKSERVER_HELLO_HAS_MAP_SIZE(hello) &&
+      FORKSERVER_HELLO_GET_MAP_SIZE(hello) > MAP_SIZE)
+    FATAL("The target needs a %u byte map, rebuild with a larger MAP_SIZE_POW2",
+          FORKSERVER_HELLO_GET_MAP_SIZE(hello));
+
+}
+
+
+/* Run the current input through the fork server, in corpus mode. */
+
+static void run_forkserver_target(void) {
+
+  static struct itimerval it;
+  u8  command;
+  s32 status;
+
+  memset(trace_bits, 0, MAP_SIZE);
+  MEM_BARRIER();
+
+  child_timed_out = 0;
+  child_crashed = 0;
+
+  command = FORK_RUN;
+  if (write(fsrv_ctl_fd, &command, 1) != 1 ||
+      read(fsrv_st_fd, &child_pid, 4) != 4 || child_pid <= 0)
+    FATAL("Unable to request a new process from the fork server");
+
+  if (exec_tmout) {
+
+    it.it_value.tv_sec = (exec_tmout / 1000);
+    it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
+    setitimer(ITIMER_REAL, &it, NULL);
+
+  }
+
+  command = GET_STATUS;
+  if (write(fsrv_ctl_fd, &command, 1) != 1 ||
+      read(fsrv_st_fd, &status, 4) != 4)
+    FATAL("Unable to get the target's status from the fork server");
+
+  child_pid = 0;
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  MEM_BARRIER();
+
+  classify_counts(trace_bits, binary_mode ?
+                  count_class_binary : count_class_human);
+
+  if (!child_timed_out && !stop_soon && WIFSIGNALED(status))
+    child_crashed = 1;
+
+}
+
+
+/* Map every n-th input of the corpus, starting at the worker's index. Each
+   worker has its own SHM region, input file and fork server. */
+
+static void map_corpus_worker(char** argv, struct dirent** names, u32 cnt,
+                              u32 worker) {
+
+  u32 i, done = 0, crashes = 0, timeouts = 0;
+  u8 *cur_input = alloc_printf("%s/.cur_input.%u", out_file, worker);
+
+  setup_shm();
+
+  unlink(cur_input); /* Ignore errors */
+  input_fd = open(cur_input, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (input_fd < 0) PFATAL("Unable to create '%s'", cur_input);
+
+  at_file = cur_input;
+  detect_file_args(argv);
+
+  init_forkserver(argv);
+
+  for (i = worker; i < cnt && !stop_soon; i += num_workers) {
+
+    u8 *in_file = alloc_printf("%s/%s", in_dir, names[i]->d_name),
+       *tuple_file = alloc_printf("%s/%s", out_file, names[i]->d_name);
+    struct stat st;
+    u8* mem;
+    s32 fd;
+
+    fd = open(in_file, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+
+      if (fd >= 0) close(fd);
+      ck_free(in_file);
+      ck_free(tuple_file);
+      continue;
+
+    }
+
+    mem = ck_alloc_nozero(st.st_size);
+    ck_read(fd, mem, st.st_size, in_file);
+    close(fd);
+
+    /* Replace the contents of the input file, and rewind it, which rewinds
+       the target's stdin too. */
+
+    if (ftruncate(input_fd, 0) || lseek(input_fd, 0, SEEK_SET))
+      PFATAL("Unable to reset '%s'", cur_input);
+    ck_write(input_fd, mem, st.st_size, cur_input);
+    lseek(input_fd, 0, SEEK_SET);
+
+    run_forkserver_target();
+    write_tuples(tuple_file);
+
+    crashes += child_crashed;
+    timeouts += child_timed_out;
+    done++;
+
+    ck_free(mem);
+    ck_free(in_file);
+    ck_free(tuple_file);
+
+  }
+
+  close(fsrv_ctl_fd);
+  close(fsrv_st_fd);
+  kill(fsrv_pid, SIGKILL);
+  waitpid(fsrv_pid, NULL, 0);
+
+  close(input_fd);
+  unlink(cur_input);
+  ck_free(cur_input);
+
+  if (!quiet_mode)
+    OKF("Worker %u mapped %u inputs (%u crashes, %u timeouts).", worker, done,
+        crashes, timeouts);
+
+}
+
+
+/* Map a whole corpus, splitting its inputs between the workers. Returns the
+   number of workers that failed. */
+
+static u32 map_corpus(char** argv) {
+
+  struct dirent** names;
+  s32 cnt;
+  u32 i, failed = 0;
+  pid_t* pids;
+
+  cnt = scandir(in_dir, &names, NULL, alphasort);
+  if (cnt < 0) PFATAL("Unable to open '%s'", in_dir);
+
+  if (mkdir(out_file, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", out_file);
+
+  pids = ck_alloc(num_workers * sizeof(pid_t));
+
+  for (i = 0; i < num_workers; i++) {
+
+    pids[i] = fork();
+    if (pids[i] < 0) PFATAL("fork() failed");
+
+    if (!pids[i]) {
+      map_corpus_worker(argv, names, cnt, i);
+      exit(0);
+    }
+
+  }
+
+  for (i = 0; i < num_workers; i++) {
+
+    int status;
+
+    if (waitpid(pids[i], &status, 0) <= 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status))
+      failed++;
+
+  }
+
+  for (i = 0; i < (u32)cnt; i++) free(names[i]);
+  free(names); /* not tracked */
+  ck_free(pids);
+
+  return failed;
+
+}
+
+
 /* Show banner. */
 
 static void show_banner(void) {
@@ -477,6 +773,12 @@ static void usage(u8* argv0) {
 
        "  -o file       - file to write the trace data to\n\n"
 
+       "Corpus mode settings:\n\n"
+
+       "  -i dir        - map every input in dir, writing each input's tuples\n"
+       "                  in binary to a file of the same name in the -o dir\n"
+       "  -w workers    - number of target processes to map the inputs with (1)\n\n"
+
        "Execution control settings:\n\n"
 
        "  -t msec       - timeout for each run (none)\n"
@@ -626,7 +928,7 @@ int main(int argc, char** argv) {
 
   doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
 
-  while ((opt = getopt(argc,argv,"+o:m:t:A:eqZQbc")) > 0)
+  while ((opt = getopt(argc,argv,"+o:i:w:m:t:A:eqZQbc")) > 0)
 
     switch (opt) {
 
@@ -636,6 +938,18 @@ int main(int argc, char** argv) {
         out_file = optarg;
         break;
 
+      case 'i':
+
+        if (in_dir) FATAL("Multiple -i options not supported");
+        in_dir = optarg;
+        break;
+
+      case 'w':
+
+        num_workers = atoi(optarg);
+        if (!num_workers || optarg[0] == '-') FATAL("Bad value of -w");
+        break;
+
       case 'm': {
 
           u8 suffix = 'M';
@@ -745,7 +1059,10 @@ int main(int argc, char** argv) {
 
   if (optind == argc || !out_file) usage(argv[0]);
 
-  setup_shm();
+  if (in_dir && (cmin_mode || at_file))
+    FATAL("-i is not supported with afl-cmin mode or -A");
+
+  if (!in_dir) setup_shm();
   setup_signal_handlers();
 
   set_up_environment();
@@ -757,13 +1074,23 @@ int main(int argc, char** argv) {
     ACTF("Executing '%s'...\n", target_path);
   }
 
-  detect_file_args(argv + optind);
+  if (!in_dir) detect_file_args(argv + optind);
 
   if (qemu_mode)
     use_argv = get_qemu_argv(argv[0], argv + optind, argc - optind);
   else
     use_argv = argv + optind;
 
+  if (in_dir) {
+
+    u32 failed = map_corpus(use_argv);
+
+    if (failed) FATAL("%u of the workers failed", failed);
+    if (!quiet_mode) OKF("Wrote the tuples of '%s' to '%s'." cRST, in_dir, out_file);
+    exit(0);
+
+  }
+
   run_target(use_argv);
 
   tcnt = write_results();
@@ -266,6 +266,43 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used instead of SHM_ENV_VAR to pass the number of an
+   inherited file descriptor (a memfd or an unlinked POSIX SHM object) that the
+   called program should mmap as its SHM region. */
+
+#define SHM_FD_ENV_VAR      "__AFL_SHM_FD"
+
+/* Environment variables used to tell the called program how big the SHM
+   region's bitmap is, and whether it should maintain the dirty line index
+   (see DIRTY_LINE_POW2 below). */
+
+#define MAP_SIZE_ENV_VAR    "__AFL_MAP_SIZE"
+#define DIRTY_INDEX_ENV_VAR "__AFL_DIRTY_INDEX"
+
+/* Environment variable used to pass the SHM ID of the comparison log to the
+   called program, for binaries built with AFL_LLVM_CMPLOG.  The log has
+   CMPLOG_SLOTS slots of CMPLOG_SLOT_SIZE bytes: a length byte (0 for an empty
+   slot), then up to CMPLOG_MAX_LEN bytes of a constant compare operand. */
+
+#define CMPLOG_SHM_ENV_VAR  "__AFL_CMPLOG_SHM_ID"
+#define CMPLOG_SLOTS        1024
+#define CMPLOG_MAX_LEN      32
+#define CMPLOG_SLOT_SIZE    (1 + CMPLOG_MAX_LEN)
+#define CMPLOG_SHM_SIZE     (CMPLOG_SLOTS * CMPLOG_SLOT_SIZE)
+
+/* Environment variable used to pass the SHM ID of the compare operand pair
+   log, which the input-to-state mutator reads.  The log has CMPLOG_PAIR_SLOTS
+   slots of CMPLOG_PAIR_SLOT_SIZE bytes: a type byte (0 for an empty slot),
+   the lengths of the constant and observed operands, then CMPLOG_MAX_LEN bytes
+   for each of the constant and the observed operand. */
+
+#define CMPLOG_PAIRS_SHM_ENV_VAR "__AFL_CMPLOG_PAIRS_SHM_ID"
+#define CMPLOG_PAIR_SLOTS        256
+#define CMPLOG_PAIR_SLOT_SIZE    (3 + 2 * CMPLOG_MAX_LEN)
+#define CMPLOG_PAIRS_SHM_SIZE    (CMPLOG_PAIR_SLOTS * CMPLOG_PAIR_SLOT_SIZE)
+#define CMPLOG_PAIR_INT          1
+#define CMPLOG_PAIR_STR          2
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
@@ -309,11 +346,36 @@
    2; you probably want to keep it under 18 or so for performance reasons
    (adjusting AFL_INST_RATIO when compiling is probably a better way to solve
    problems with complex programs). You need to recompile the target binary
-   after changing this - otherwise, SEGVs may ensue. */
+   after changing this - otherwise, SEGVs may ensue.  The fork server reports
+   the map size of the binary to the fuzzer, and the trace-pc-guard runtime
+   adapts to whatever size the fuzzer asks for within the range below. */
 
+#ifndef MAP_SIZE_POW2
 #define MAP_SIZE_POW2       16
+#endif
 #define MAP_SIZE            (1 << MAP_SIZE_POW2)
 
+#define MIN_MAP_SIZE_POW2   13
+#define MAX_MAP_SIZE_POW2   23
+#define MIN_MAP_SIZE        (1 << MIN_MAP_SIZE_POW2)
+#define MAX_MAP_SIZE        (1 << MAX_MAP_SIZE_POW2)
+
+/* The longest block history that the LLVM pass's AFL_LLVM_NGRAM coverage can
+   hash into a map index, and how much bigger the map is made by default
+   (2^SENSITIVE_MAP_SIZE_SHIFT times) for each of the calling context and
+   n-gram coverage modes: */
+
+#define NGRAM_SIZE_MAX      16
+#define SENSITIVE_MAP_SIZE_SHIFT 2
+
+/* Size of the lines tracked by the optional dirty line index (2^DIRTY_LINE_POW2
+   bytes).  The index holds one byte per line and lives directly after the
+   bitmap in the SHM region; a nonzero byte means the line may have been
+   touched, so the fuzzer only has to look at those lines. */
+
+#define DIRTY_LINE_POW2     6
+#define DIRTY_INDEX_SIZE(map_size) ((map_size) >> DIRTY_LINE_POW2)
+
 /* Maximum allocator request size (keep well under INT_MAX): */
 
 #define MAX_ALLOC           0x40000000
@@ -32,7 +32,9 @@
 #include <unistd.h>
 
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Debug.h"
@@ -51,6 +53,12 @@ namespace {
 
       bool runOnModule(Module &M) override;
 
+    private:
+
+      unsigned int instrumentCompares(Module &M);
+      unsigned int instrumentCallSites(Function &F, GlobalVariable *AFLPrevCtx,
+                                       Value *Ctx, unsigned int map_size);
+
       // StringRef getPassName() const override {
       //  return "American Fuzzy Lop Instrumentation";
       // }
@@ -93,66 +101,267 @@ bool AFLCoverage::runOnModule(Module &M) {
 
   }
 
+  /* Decide how cheap the instrumentation should be.  Counters that saturate
+     at 255 never wrap around to 0 and hide a hot edge.  Single-threaded
+     targets can keep the previous location in a plain global rather than in
+     thread-local storage.  The blocks whose only predecessor always falls
+     through to them run exactly when their predecessor does, so their
+     coverage adds nothing and they can go uninstrumented. */
+
+  char not_zero = !!getenv("AFL_LLVM_NOT_ZERO");
+  char no_tls = !!getenv("AFL_LLVM_NO_TLS");
+  char skip_implied = !!getenv("AFL_LLVM_SKIP_IMPLIED");
+
+  /* Decide whether each block also marks its line of the map in the dirty
+     line index, so that only the touched lines have to be checked and
+     cleared after each run. The runtime only keeps the index when every
+     module marks its lines, so each module says which way it was built. */
+
+  char dirty_index = !!getenv("AFL_LLVM_DIRTY_INDEX");
+
+  new GlobalVariable(M, Int8Ty, true, GlobalValue::WeakAnyLinkage,
+                     ConstantInt::get(Int8Ty, 1),
+                     dirty_index ? "__afl_dirty_index_marked"
+                                 : "__afl_dirty_index_unmarked");
+
+  /* Decide whether the map index also takes in the calling context, and
+     whether it hashes the last few blocks rather than just the previous one.
+     Both tell apart paths that plain edge coverage lumps together, and need a
+     bigger map to keep the collisions down. Each module says what size it was
+     built for, and the runtime reports the biggest to the fuzzer. */
+
+  char ctx = !!getenv("AFL_LLVM_CTX");
+
+  char* ngram_str = getenv("AFL_LLVM_NGRAM");
+  unsigned int ngram = 0;
+
+  if (ngram_str) {
+
+    if (sscanf(ngram_str, "%u", &ngram) != 1 || ngram < 2 ||
+        ngram > NGRAM_SIZE_MAX)
+      FATAL("Bad value of AFL_LLVM_NGRAM (must be between 2 and %u)",
+            NGRAM_SIZE_MAX);
+
+  }
+
+  unsigned int map_size_pow2 = MAP_SIZE_POW2;
+  if (ctx) map_size_pow2 += SENSITIVE_MAP_SIZE_SHIFT;
+  if (ngram) map_size_pow2 += SENSITIVE_MAP_SIZE_SHIFT;
+  if (map_size_pow2 > MAX_MAP_SIZE_POW2) map_size_pow2 = MAX_MAP_SIZE_POW2;
+
+  char* map_size_str = getenv("AFL_LLVM_MAP_SIZE_POW2");
+
+  if (map_size_str) {
+
+    if (sscanf(map_size_str, "%u", &map_size_pow2) != 1 ||
+        map_size_pow2 < MAP_SIZE_POW2 || map_size_pow2 > MAX_MAP_SIZE_POW2)
+      FATAL("Bad value of AFL_LLVM_MAP_SIZE_POW2 (must be between %u and %u)",
+            MAP_SIZE_POW2, MAX_MAP_SIZE_POW2);
+
+  }
+
+  unsigned int map_size = 1U << map_size_pow2;
+  char map_size_marker[32];
+
+  snprintf(map_size_marker, sizeof(map_size_marker), "__afl_llvm_map_pow2_%u",
+           map_size_pow2);
+  new GlobalVariable(M, Int8Ty, true, GlobalValue::WeakAnyLinkage,
+                     ConstantInt::get(Int8Ty, 1), map_size_marker);
+
   /* Get globals for the SHM region and the previous location. Note that
-     __afl_prev_loc is thread-local. */
+     __afl_prev_loc is thread-local, and __afl_prev_loc_st is its
+     single-threaded twin in the runtime. */
 
   GlobalVariable *AFLMapPtr =
       new GlobalVariable(M, PointerType::get(Int8Ty, 0), false,
                          GlobalValue::ExternalLinkage, 0, "__afl_area_ptr");
 
-  GlobalVariable *AFLPrevLoc = new GlobalVariable(
-      M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_prev_loc",
-      0, GlobalVariable::GeneralDynamicTLSModel, 0, false);
+  GlobalVariable *AFLPrevLoc = no_tls
+      ? new GlobalVariable(M, Int32Ty, false, GlobalValue::ExternalLinkage, 0,
+                           "__afl_prev_loc_st")
+      : new GlobalVariable(M, Int32Ty, false, GlobalValue::ExternalLinkage, 0,
+                           "__afl_prev_loc", 0,
+                           GlobalVariable::GeneralDynamicTLSModel, 0, false);
+
+  /* The calling context, and the history of the last NGRAM_SIZE_MAX - 1
+     blocks, have single-threaded twins in the runtime too. */
+
+  GlobalVariable *AFLPrevCtx = NULL, *AFLPrevNgram = NULL;
+  ArrayType *NgramTy = ArrayType::get(Int32Ty, NGRAM_SIZE_MAX - 1);
+
+  if (ctx)
+    AFLPrevCtx = no_tls
+        ? new GlobalVariable(M, Int32Ty, false, GlobalValue::ExternalLinkage, 0,
+                             "__afl_prev_ctx_st")
+        : new GlobalVariable(M, Int32Ty, false, GlobalValue::ExternalLinkage, 0,
+                             "__afl_prev_ctx", 0,
+                             GlobalVariable::GeneralDynamicTLSModel, 0, false);
+
+  if (ngram)
+    AFLPrevNgram = no_tls
+        ? new GlobalVariable(M, NgramTy, false, GlobalValue::ExternalLinkage, 0,
+                             "__afl_prev_ngram_st")
+        : new GlobalVariable(M, NgramTy, false, GlobalValue::ExternalLinkage, 0,
+                             "__afl_prev_ngram", 0,
+                             GlobalVariable::GeneralDynamicTLSModel, 0, false);
+
+  GlobalVariable *AFLDirtyPtr = dirty_index
+      ? new GlobalVariable(M, PointerType::get(Int8Ty, 0), false,
+                           GlobalValue::ExternalLinkage, 0, "__afl_dirty_ptr")
+      : NULL;
+
+  /* Log the constant operands of compares first, so that the hooks go in
+     before the coverage instrumentation is placed at the top of each block. */
+
+  unsigned int cmp_sites = getenv("AFL_LLVM_CMPLOG") ? instrumentCompares(M) : 0;
 
   /* Instrument all the things! */
 
-  int inst_blocks = 0;
+  int inst_blocks = 0, implied_blocks = 0;
+  unsigned int call_sites = 0;
+
+  for (auto &F : M) {
+
+    if (F.isDeclaration()) continue;
+
+    /* The context is the xor of the IDs of the call sites on the stack. The
+       function loads it once on entry, and each call site adds its own ID
+       to it for the duration of the call. */
+
+    LoadInst *Ctx = NULL;
+
+    if (ctx) {
+
+      IRBuilder<> IRB(&(*F.getEntryBlock().getFirstInsertionPt()));
+      Ctx = IRB.CreateLoad(AFLPrevCtx);
+      Ctx->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+      call_sites += instrumentCallSites(F, AFLPrevCtx, Ctx, map_size);
+
+    }
 
-  for (auto &F : M)
     for (auto &BB : F) {
 
+      /* The entry block's coverage goes after the context is loaded */
+
       BasicBlock::iterator IP = BB.getFirstInsertionPt();
+      if (Ctx && Ctx->getParent() == &BB) IP = ++Ctx->getIterator();
       IRBuilder<> IRB(&(*IP));
 
+      if (skip_implied) {
+
+        BasicBlock *Pred = BB.getSinglePredecessor();
+
+        if (Pred && Pred->getTerminator()->getNumSuccessors() == 1) {
+          implied_blocks++;
+          continue;
+        }
+
+      }
+
       if (AFL_R(100) >= inst_ratio) continue;
 
       /* Make up cur_loc */
 
-      unsigned int cur_loc = AFL_R(MAP_SIZE);
+      unsigned int cur_loc = AFL_R(map_size);
 
       ConstantInt *CurLoc = ConstantInt::get(Int32Ty, cur_loc);
 
-      /* Load prev_loc */
+      /* Load prev_loc, or the last ngram - 1 blocks of the history. Each
+         entry of the history is shifted one more bit than the last, so the
+         order of the blocks counts. */
+
+      Value *MapIdx = CurLoc;
+      std::vector<Value *> History;
+
+      if (ngram) {
+
+        for (unsigned int i = 0; i < ngram - 1; i++) {
+
+          LoadInst *Prev = IRB.CreateLoad(
+              IRB.CreateConstInBoundsGEP2_32(NgramTy, AFLPrevNgram, 0, i));
+          Prev->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+          History.push_back(Prev);
+          MapIdx = IRB.CreateXor(MapIdx, Prev);
+
+        }
+
+      } else {
 
-      LoadInst *PrevLoc = IRB.CreateLoad(AFLPrevLoc);
-      PrevLoc->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-      Value *PrevLocCasted = IRB.CreateZExt(PrevLoc, IRB.getInt32Ty());
+        LoadInst *PrevLoc = IRB.CreateLoad(AFLPrevLoc);
+        PrevLoc->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        Value *PrevLocCasted = IRB.CreateZExt(PrevLoc, IRB.getInt32Ty());
+        MapIdx = IRB.CreateXor(PrevLocCasted, CurLoc);
+
+      }
+
+      if (Ctx) MapIdx = IRB.CreateXor(MapIdx, Ctx);
 
       /* Load SHM pointer */
 
       LoadInst *MapPtr = IRB.CreateLoad(AFLMapPtr);
       MapPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-      Value *MapPtrIdx =
-          IRB.CreateGEP(MapPtr, IRB.CreateXor(PrevLocCasted, CurLoc));
+      Value *MapPtrIdx = IRB.CreateGEP(MapPtr, MapIdx);
 
       /* Update bitmap */
 
       LoadInst *Counter = IRB.CreateLoad(MapPtrIdx);
       Counter->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
       Value *Incr = IRB.CreateAdd(Counter, ConstantInt::get(Int8Ty, 1));
+
+      /* Saturate at 255, rather than wrapping around to 0 */
+
+      if (not_zero)
+        Incr = IRB.CreateSelect(
+            IRB.CreateICmpEQ(Counter, ConstantInt::get(Int8Ty, 255)),
+            Counter, Incr);
+
       IRB.CreateStore(Incr, MapPtrIdx)
           ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-      /* Set prev_loc to cur_loc >> 1 */
+      /* Mark the line in the dirty line index */
+
+      if (dirty_index) {
+
+        LoadInst *DirtyPtr = IRB.CreateLoad(AFLDirtyPtr);
+        DirtyPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        Value *DirtyPtrIdx = IRB.CreateGEP(DirtyPtr,
+            IRB.CreateLShr(MapIdx, DIRTY_LINE_POW2));
+
+        IRB.CreateStore(ConstantInt::get(Int8Ty, 1), DirtyPtrIdx)
+            ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-      StoreInst *Store =
-          IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
-      Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+      }
+
+      /* Set prev_loc to cur_loc >> 1, or push cur_loc >> 1 onto the front
+         of the history */
+
+      if (ngram) {
+
+        for (unsigned int i = ngram - 2; i > 0; i--)
+          IRB.CreateStore(IRB.CreateLShr(History[i - 1], 1),
+                          IRB.CreateConstInBoundsGEP2_32(NgramTy, AFLPrevNgram,
+                                                         0, i))
+              ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+        IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1),
+                        IRB.CreateConstInBoundsGEP2_32(NgramTy, AFLPrevNgram,
+                                                       0, 0))
+            ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      } else {
+
+        StoreInst *Store =
+            IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
+        Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      }
 
       inst_blocks++;
 
     }
 
+  }
+
   /* Say something nice. */
 
   if (!be_quiet) {
@@ -163,6 +372,24 @@ bool AFLCoverage::runOnModule(Module &M) {
              ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ?
               "ASAN/MSAN" : "non-hardened"), inst_ratio);
 
+    if (implied_blocks)
+      OKF("Skipped %u blocks whose coverage is implied by their predecessor.",
+          implied_blocks);
+
+    if (not_zero || no_tls)
+      OKF("Using %s%s%s.", not_zero ? "saturating counters" : "",
+          not_zero && no_tls ? " and " : "",
+          no_tls ? "a single-threaded previous location" : "");
+
+    if (dirty_index) OKF("Marking the touched lines in the dirty line index.");
+
+    if (ctx || ngram)
+      OKF("Using %s%s%s coverage in a %u byte map (%u call sites).",
+          ctx ? "calling context" : "", ctx && ngram ? " and " : "",
+          ngram ? "n-gram" : "", map_size, call_sites);
+
+    if (cmp_sites) OKF("Logging %u compares against constants.", cmp_sites);
+
   }
 
   return true;
@@ -170,6 +397,168 @@ bool AFLCoverage::runOnModule(Module &M) {
 }
 
 
+/* Adds a call site ID to the calling context around each call in the
+   function, and puts the function's own context (Ctx, loaded on entry) back
+   after it returns. The
+   calls to intrinsics, inline assembly, and the runtime's hooks are left
+   alone, as are musttail calls, which can't have anything after them. */
+
+unsigned int AFLCoverage::instrumentCallSites(Function &F,
+                                              GlobalVariable *AFLPrevCtx,
+                                              Value *Ctx,
+                                              unsigned int map_size) {
+
+  Module &M = *F.getParent();
+  LLVMContext &C = M.getContext();
+  IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
+
+  std::vector<CallInst *> calls;
+
+  for (auto &BB : F)
+    for (auto &I : BB) {
+
+      CallInst *Call = dyn_cast<CallInst>(&I);
+      if (!Call || isa<IntrinsicInst>(Call) || Call->isInlineAsm() ||
+          Call->isMustTailCall())
+        continue;
+
+      Function *Callee = Call->getCalledFunction();
+      if (Callee && Callee->getName().startswith("__afl_")) continue;
+
+      calls.push_back(Call);
+
+    }
+
+  for (CallInst *Call : calls) {
+
+    unsigned int call_loc = AFL_R(map_size);
+
+    IRBuilder<> Before(Call);
+    Before.CreateStore(Before.CreateXor(Ctx, ConstantInt::get(Int32Ty, call_loc)),
+                       AFLPrevCtx)
+        ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+    IRBuilder<> After(Call->getNextNode());
+    After.CreateStore(Ctx, AFLPrevCtx)
+        ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+  }
+
+  return calls.size();
+
+}
+
+
+/* Inserts a call to the runtime's comparison log before every integer
+   equality compare and string/memory compare call that has a constant
+   operand.  When the fuzzer maps the logs, the constants the target actually
+   compares against end up in them, along with the other operand, and are
+   used to make a dictionary and for input-to-state replacement. */
+
+unsigned int AFLCoverage::instrumentCompares(Module &M) {
+
+  LLVMContext &C = M.getContext();
+
+  Type        *VoidTy  = Type::getVoidTy(C);
+  IntegerType *Int8Ty  = IntegerType::getInt8Ty(C);
+  IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
+  IntegerType *Int64Ty = IntegerType::getInt64Ty(C);
+  PointerType *Int8PtrTy = PointerType::get(Int8Ty, 0);
+
+  auto CmpLogInt = M.getOrInsertFunction("__afl_cmplog_int", VoidTy, Int64Ty,
+                                         Int64Ty, Int8Ty);
+  auto CmpLogStr = M.getOrInsertFunction("__afl_cmplog_str", VoidTy, Int8PtrTy,
+                                         Int8PtrTy, Int32Ty, Int8Ty);
+
+  std::vector<Instruction *> compares;
+
+  for (auto &F : M)
+    for (auto &BB : F)
+      for (auto &I : BB)
+        if (isa<ICmpInst>(&I) || isa<CallInst>(&I)) compares.push_back(&I);
+
+  unsigned int sites = 0;
+
+  for (Instruction *I : compares) {
+
+    IRBuilder<> IRB(I);
+
+    if (ICmpInst *Cmp = dyn_cast<ICmpInst>(I)) {
+
+      if (!Cmp->isEquality()) continue;
+
+      for (unsigned int op = 0; op < 2; op++) {
+
+        ConstantInt *CI = dyn_cast<ConstantInt>(Cmp->getOperand(op));
+        if (!CI) continue;
+
+        unsigned int width = CI->getBitWidth();
+        if (width != 16 && width != 32 && width != 64) continue;
+
+        Value *Other = Cmp->getOperand(1 - op);
+        if (isa<Constant>(Other)) continue;
+
+        IRB.CreateCall(CmpLogInt, {IRB.CreateZExt(Other, Int64Ty),
+                                   ConstantInt::get(Int64Ty, CI->getZExtValue()),
+                                   ConstantInt::get(Int8Ty, width / 8)});
+        sites++;
+
+      }
+
+      continue;
+
+    }
+
+    CallInst *Call = cast<CallInst>(I);
+    Function *Callee = Call->getCalledFunction();
+    if (!Callee || Call->getNumArgOperands() < 2) continue;
+
+    StringRef Name = Callee->getName();
+    bool is_mem = Name == "memcmp" || Name == "bcmp";
+    bool is_sized = is_mem || Name == "strncmp" || Name == "strncasecmp";
+
+    if (!is_mem && !is_sized && Name != "strcmp" && Name != "strcasecmp")
+      continue;
+
+    /* The length argument of memcmp and friends, if it's a constant */
+    uint64_t max_len = ~0ULL;
+    if (is_sized) {
+
+      if (Call->getNumArgOperands() < 3) continue;
+      ConstantInt *Len = dyn_cast<ConstantInt>(Call->getArgOperand(2));
+      if (Len) max_len = Len->getZExtValue();
+      else if (is_mem) continue;
+
+    }
+
+    for (unsigned int op = 0; op < 2; op++) {
+
+      StringRef Str;
+      Value *Arg = Call->getArgOperand(op);
+
+      if (!getConstantStringInfo(Arg, Str, 0, !is_mem) || Str.empty())
+        continue;
+
+      uint64_t len = Str.size() < max_len ? Str.size() : max_len;
+      if (!len) continue;
+
+      Value *Other = Call->getArgOperand(1 - op);
+
+      IRB.CreateCall(CmpLogStr, {IRB.CreatePointerCast(Other, Int8PtrTy),
+                                 IRB.CreatePointerCast(Arg, Int8PtrTy),
+                                 ConstantInt::get(Int32Ty, len),
+                                 ConstantInt::get(Int8Ty, !is_mem)});
+      sites++;
+
+    }
+
+  }
+
+  return sites;
+
+}
+
+
 static void registerAFLPass(const PassManagerBuilder &,
                             legacy::PassManagerBase &PM) {
 
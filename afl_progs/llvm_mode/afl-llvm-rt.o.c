@@ -36,9 +36,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
@@ -55,24 +58,200 @@
 
 /* Globals needed by the injected instrumentation. The __afl_area_initial region
    is used for instrumentation output before __afl_map_shm() has a chance to run.
-   It will end up as .comm, so it shouldn't be too wasteful. */
+   It will end up as .comm, so it shouldn't be too wasteful.  It is sized for
+   the largest map (plus its dirty line index), as the trace-pc-guard IDs may
+   be handed out before the SHM region is attached. */
 
-u8  __afl_area_initial[MAP_SIZE];
+u8  __afl_area_initial[MAX_MAP_SIZE + DIRTY_INDEX_SIZE(MAX_MAP_SIZE)];
 u8* __afl_area_ptr = __afl_area_initial;
+u8* __afl_dirty_ptr = __afl_area_initial + MAX_MAP_SIZE;
+
+/* The size of the map in use. The trace-pc-guard mode works this out at
+   runtime; the LLVM pass bakes a map size into each module, and the biggest
+   one is used. */
+
+static u32 __afl_map_size = MAP_SIZE;
+static u8  __afl_map_size_pow2 = MAP_SIZE_POW2;
+
+/* Whether the map size has been worked out, and whether the map is too big for
+   the SHM region the fuzzer gave us.  The fork server's hello tells the fuzzer
+   to make a bigger one before any child runs. */
+
+static u8  __afl_map_size_done;
+static u8  __afl_map_too_big;
+
+/* The next trace-pc-guard ID to hand out.  IDs are handed out in order, so
+   every edge gets a byte of the map to itself, rather than colliding with the
+   others at random.  ID 0 is left for the edges that aren't instrumented. */
+
+static u32 __afl_next_guard = 1;
+
+/* Whether the fuzzer reads the dirty line index after __afl_dirty_ptr. */
+
+static u8  __afl_dirty_index;
+
+/* Each module that the LLVM pass instruments defines one of these, depending
+   on whether it was built with AFL_LLVM_DIRTY_INDEX.  The index can only be
+   trusted if every module marks the lines it touches. */
+
+#ifndef USE_TRACE_PC
+extern const u8 __afl_dirty_index_marked __attribute__((weak));
+extern const u8 __afl_dirty_index_unmarked __attribute__((weak));
+
+/* Each module that the LLVM pass instruments also defines one of these, named
+   after the 2^pow2 byte map it was built for. */
+
+#define MAP_SIZE_MARKER(pow2) \
+  extern const u8 __afl_llvm_map_pow2_##pow2 __attribute__((weak))
+
+MAP_SIZE_MARKER(13); MAP_SIZE_MARKER(14); MAP_SIZE_MARKER(15);
+MAP_SIZE_MARKER(16); MAP_SIZE_MARKER(17); MAP_SIZE_MARKER(18);
+MAP_SIZE_MARKER(19); MAP_SIZE_MARKER(20); MAP_SIZE_MARKER(21);
+MAP_SIZE_MARKER(22); MAP_SIZE_MARKER(23);
+#endif /* !USE_TRACE_PC */
 
 __thread u32 __afl_prev_loc;
 
+/* The previous location of targets built with AFL_LLVM_NO_TLS, which only
+   track one thread's edges. */
+
+u32 __afl_prev_loc_st;
+
+/* The calling context of targets built with AFL_LLVM_CTX, and the history of
+   the last blocks of targets built with AFL_LLVM_NGRAM, along with their
+   single-threaded twins. */
+
+__thread u32 __afl_prev_ctx;
+__thread u32 __afl_prev_ngram[NGRAM_SIZE_MAX - 1];
+u32 __afl_prev_ctx_st;
+u32 __afl_prev_ngram_st[NGRAM_SIZE_MAX - 1];
+
+
+/* The comparison log and operand pair log filled in by the AFL_LLVM_CMPLOG
+   hooks, or NULL if the fuzzer didn't ask for them. */
+
+static u8* __afl_cmplog_ptr;
+static u8* __afl_cmplog_pairs_ptr;
+
 
 /* Running in persistent mode? */
 
 static u8 is_persistent;
 
 
+/* Work out what map size to use.  The trace-pc-guard mode uses the smallest
+   map with room for all of its edges, unless the fuzzer offered a bigger one.
+   The LLVM pass mode uses the biggest map that any module was built for.  The
+   size is reported to the fuzzer in the fork server's hello. */
+
+static void __afl_init_map_size(void) {
+
+#ifdef USE_TRACE_PC
+  u8 *x;
+  u32 size, offered = 0;
+#else
+  const u8 *markers[] = {
+    &__afl_llvm_map_pow2_13, &__afl_llvm_map_pow2_14, &__afl_llvm_map_pow2_15,
+    &__afl_llvm_map_pow2_16, &__afl_llvm_map_pow2_17, &__afl_llvm_map_pow2_18,
+    &__afl_llvm_map_pow2_19, &__afl_llvm_map_pow2_20, &__afl_llvm_map_pow2_21,
+    &__afl_llvm_map_pow2_22, &__afl_llvm_map_pow2_23
+  };
+  u8 pow2;
+#endif /* ^USE_TRACE_PC */
+
+  if (__afl_map_size_done) return;
+  __afl_map_size_done = 1;
+
+#ifdef USE_TRACE_PC
+
+  x = getenv(MAP_SIZE_ENV_VAR);
+  if (x) {
+    offered = atoi(x);
+    if (offered < MIN_MAP_SIZE || offered > MAX_MAP_SIZE || (offered & (offered - 1))) {
+      fprintf(stderr, "[-] ERROR: Invalid " MAP_SIZE_ENV_VAR " (must be a power of 2 from %u-%u).\n",
+        MIN_MAP_SIZE, MAX_MAP_SIZE);
+      abort();
+    }
+  }
+
+  for (size = MIN_MAP_SIZE; size < __afl_next_guard && size < MAX_MAP_SIZE; size <<= 1);
+  if (size < offered) size = offered;
+
+  __afl_map_size = size;
+  for (__afl_map_size_pow2 = 0; (1U << __afl_map_size_pow2) < size; __afl_map_size_pow2++);
+#else
+  for (pow2 = MIN_MAP_SIZE_POW2; pow2 <= MAX_MAP_SIZE_POW2; pow2++)
+    if (markers[pow2 - MIN_MAP_SIZE_POW2] && pow2 > __afl_map_size_pow2)
+      __afl_map_size_pow2 = pow2;
+  __afl_map_size = 1U << __afl_map_size_pow2;
+#endif /* ^USE_TRACE_PC */
+
+}
+
+
+/* Bring the map (and the dirty line index, if there is one) back to a clean
+   state.  With the index, only the lines that were touched get cleared. */
+
+static void __afl_reset_map(void) {
+
+  u32 i;
+
+  if (!__afl_dirty_index) {
+    memset(__afl_area_ptr, 0, __afl_map_size);
+    return;
+  }
+
+  for (i = 0; i < DIRTY_INDEX_SIZE(__afl_map_size); i++) {
+    if (__afl_dirty_ptr[i]) {
+      memset(__afl_area_ptr + (i << DIRTY_LINE_POW2), 0, 1 << DIRTY_LINE_POW2);
+      __afl_dirty_ptr[i] = 0;
+    }
+  }
+
+}
+
+
+/* Forget the blocks that ran before the next run starts.  The calling context
+   follows the stack, so it's left as it is. */
+
+static void __afl_reset_prev_loc(void) {
+
+  __afl_prev_loc = 0;
+  __afl_prev_loc_st = 0;
+  memset(__afl_prev_ngram, 0, sizeof(__afl_prev_ngram));
+  memset(__afl_prev_ngram_st, 0, sizeof(__afl_prev_ngram_st));
+
+}
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
 
-  u8 *id_str = getenv(SHM_ENV_VAR);
+  u8 *id_str = getenv(SHM_ENV_VAR), *fd_str = getenv(SHM_FD_ENV_VAR);
+
+  __afl_init_map_size();
+
+  /* The fuzzer can hand us the region as an inherited memfd instead. The
+     fork server's children inherit the mapping, so the fd isn't needed again. */
+
+  if (fd_str) {
+
+    int shm_fd = atoi(fd_str);
+    struct stat st;
+
+    if (fstat(shm_fd, &st)) _exit(1);
+    __afl_area_ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          shm_fd, 0);
+    if (__afl_area_ptr == MAP_FAILED) _exit(1);
+    close(shm_fd);
+
+    if ((size_t)st.st_size < __afl_map_size + DIRTY_INDEX_SIZE(__afl_map_size))
+      __afl_map_too_big = 1;
+
+    id_str = NULL;
+
+  }
 
   /* If we're running under AFL, attach to the appropriate region, replacing the
      early-stage __afl_area_initial region that is needed to allow some really
@@ -87,11 +266,183 @@ static void __afl_map_shm(void) {
     /* Whooooops. */
     if (__afl_area_ptr == (void *)-1) _exit(1);
 
+    {
+      struct shmid_ds shm_info;
+      if (!shmctl(shm_id, IPC_STAT, &shm_info) &&
+          shm_info.shm_segsz < __afl_map_size + DIRTY_INDEX_SIZE(__afl_map_size))
+        __afl_map_too_big = 1;
+    }
+
+  }
+
+  if (id_str || fd_str) {
+
+    /* The trace-pc-guard callback always keeps the index up to date, the
+       LLVM pass only does so when built with AFL_LLVM_DIRTY_INDEX. */
+#ifdef USE_TRACE_PC
+    if (getenv(DIRTY_INDEX_ENV_VAR)) __afl_dirty_index = 1;
+#else
+    if (getenv(DIRTY_INDEX_ENV_VAR) && &__afl_dirty_index_marked &&
+        !&__afl_dirty_index_unmarked)
+      __afl_dirty_index = 1;
+#endif /* ^USE_TRACE_PC */
+    __afl_dirty_ptr = __afl_area_ptr + __afl_map_size;
+
+  }
+
+  id_str = getenv(CMPLOG_SHM_ENV_VAR);
+
+  if (id_str) {
+
+    __afl_cmplog_ptr = shmat(atoi(id_str), NULL, 0);
+
+    /* The comparison log is only a nice to have, so just go without it. */
+    if (__afl_cmplog_ptr == (void *)-1) __afl_cmplog_ptr = NULL;
+
+  }
+
+  id_str = getenv(CMPLOG_PAIRS_SHM_ENV_VAR);
+
+  if (id_str) {
+
+    __afl_cmplog_pairs_ptr = shmat(atoi(id_str), NULL, 0);
+    if (__afl_cmplog_pairs_ptr == (void *)-1) __afl_cmplog_pairs_ptr = NULL;
+
   }
 
 }
 
 
+/* Records a constant compare operand in the comparison log. Each distinct
+   operand gets one slot in the log, picked by its hash, so hot compares don't
+   fill the log with copies.  The fuzzer turns the log into a dictionary. */
+
+static void __afl_cmplog_constant(const u8* data, u32 len) {
+
+  u32 hash = 2166136261U, i, probe;
+  u8* slot;
+
+  if (len > CMPLOG_MAX_LEN) len = CMPLOG_MAX_LEN;
+
+  for (i = 0; i < len; i++) hash = (hash ^ data[i]) * 16777619U;
+
+  for (probe = 0; probe < 8; probe++) {
+
+    slot = __afl_cmplog_ptr + ((hash + probe) % CMPLOG_SLOTS) * CMPLOG_SLOT_SIZE;
+
+    if (slot[0] == len && !memcmp(slot + 1, data, len)) return;
+
+    if (!slot[0]) {
+
+      /* Fill in the operand before the length, which marks the slot used. */
+      memcpy(slot + 1, data, len);
+      slot[0] = len;
+      return;
+
+    }
+
+  }
+
+}
+
+
+/* Records both operands of a compare in the operand pair log, so that the
+   input-to-state mutator can find the observed operand in the input and
+   replace it with the constant. Slots are picked the same way as above. */
+
+static void __afl_cmplog_pair(u8 type, const u8* constant, u32 constant_len,
+                              const u8* observed, u32 observed_len) {
+
+  u32 hash = 2166136261U, i, probe;
+  u8* slot;
+
+  if (constant_len > CMPLOG_MAX_LEN) constant_len = CMPLOG_MAX_LEN;
+  if (observed_len > CMPLOG_MAX_LEN) observed_len = CMPLOG_MAX_LEN;
+
+  for (i = 0; i < constant_len; i++) hash = (hash ^ constant[i]) * 16777619U;
+  for (i = 0; i < observed_len; i++) hash = (hash ^ observed[i]) * 16777619U;
+
+  for (probe = 0; probe < 8; probe++) {
+
+    slot = __afl_cmplog_pairs_ptr +
+           ((hash + probe) % CMPLOG_PAIR_SLOTS) * CMPLOG_PAIR_SLOT_SIZE;
+
+    if (slot[0] == type && slot[1] == constant_len && slot[2] == observed_len &&
+        !memcmp(slot + 3, constant, constant_len) &&
+        !memcmp(slot + 3 + CMPLOG_MAX_LEN, observed, observed_len)) return;
+
+    if (!slot[0]) {
+
+      /* As above, the type goes in last and marks the slot used. */
+      slot[1] = constant_len;
+      slot[2] = observed_len;
+      memcpy(slot + 3, constant, constant_len);
+      memcpy(slot + 3 + CMPLOG_MAX_LEN, observed, observed_len);
+      slot[0] = type;
+      return;
+
+    }
+
+  }
+
+}
+
+
+/* Comparison logging hooks, called by AFL_LLVM_CMPLOG builds before compares
+   against a constant. The observed operand is the other side of the compare,
+   which usually comes from the input. For the string compares, is_str says
+   the observed operand may end at a NUL before len bytes. */
+
+void __afl_cmplog_str(const u8* observed, const u8* constant, u32 len, u8 is_str) {
+
+  u32 observed_len;
+
+  if (!len) return;
+
+  if (__afl_cmplog_ptr) __afl_cmplog_constant(constant, len);
+
+  if (__afl_cmplog_pairs_ptr && observed) {
+
+    if (len > CMPLOG_MAX_LEN) len = CMPLOG_MAX_LEN;
+    for (observed_len = 0; observed_len < len; observed_len++)
+      if (is_str && !observed[observed_len]) break;
+
+    if (observed_len && (observed_len != len || memcmp(observed, constant, len)))
+      __afl_cmplog_pair(CMPLOG_PAIR_STR, constant, len, observed, observed_len);
+
+  }
+
+}
+
+
+void __afl_cmplog_int(u64 observed, u64 constant, u8 size) {
+
+  u8 buf[8], obuf[8];
+  u8 i;
+
+  /* Small values are found quickly enough by the arithmetic stages. */
+  if (constant < 256 || size > sizeof(buf)) return;
+
+  for (i = 0; i < size; i++) {
+    buf[i] = (u8)(constant >> (8 * i));
+    obuf[i] = (u8)(observed >> (8 * i));
+  }
+
+  /* The mutator tries both byte orders itself, so only log one pair. */
+  if (__afl_cmplog_pairs_ptr && observed != constant)
+    __afl_cmplog_pair(CMPLOG_PAIR_INT, buf, size, obuf, size);
+
+  if (!__afl_cmplog_ptr) return;
+
+  /* Log both byte orders, since the input may hold it either way. */
+  __afl_cmplog_constant(buf, size);
+
+  for (i = 0; i < size; i++) buf[i] = (u8)(constant >> (8 * (size - 1 - i)));
+  __afl_cmplog_constant(buf, size);
+
+}
+
+
 /* Fork server logic. */
 
 static void __afl_start_forkserver_persistence(void);
@@ -102,15 +453,32 @@ static int cycle_cnt = 0;
 
 static void __afl_start_forkserver(void) {
 
-  static int response = 0x41414141;
+  static int response;
   char command;
   s32 child_pid;
-
-  /* Phone home and tell the parent that we're OK. If parent isn't there,
-     assume we're not running in forkserver mode and just execute program. */
-  if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
+  int max_rss_kb = 0;
+  struct rusage usage;
+
+  /* Phone home and tell the parent that we're OK, and how our map is laid out.
+     If parent isn't there, assume we're not running in forkserver mode and
+     just execute program. */
+  response = FORKSERVER_HELLO_MAP_SIZE(__afl_map_size_pow2) | FORKSERVER_HELLO_MAX_RSS;
+  if (__afl_dirty_index) response |= FORKSERVER_HELLO_DIRTY_INDEX;
+  if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int)) {
+
+    /* Without the fork server, there's no way to ask for a bigger region, so
+       don't write past the end of this one. */
+    if (__afl_map_too_big) {
+      fprintf(stderr, "[-] WARNING: The target needs a %u byte map, which doesn't fit in the fuzzer's, "
+        "not recording coverage. Raise the fuzzer's map size.\n", __afl_map_size);
+      __afl_area_ptr = __afl_area_initial;
+      __afl_dirty_ptr = __afl_area_initial + MAX_MAP_SIZE;
+      __afl_dirty_index = 0;
+    }
     return;
 
+  }
+
   if(getenv(PERSIST_MAX_VAR)) {
     __afl_start_forkserver_persistence();
     return;
@@ -140,8 +508,8 @@ static void __afl_start_forkserver(void) {
           close(FORKSRV_TO_FUZZER);
 
           //Reset the afl bitmap to a clean state
-          memset(__afl_area_ptr, 0, MAP_SIZE);
-          __afl_prev_loc = 0;
+          __afl_reset_map();
+          __afl_reset_prev_loc();
           return;
         }
 
@@ -149,8 +517,13 @@ static void __afl_start_forkserver(void) {
         break;
 
       case GET_STATUS:
-        if(waitpid(child_pid, &response, 0) < 0)
+        if(wait4(child_pid, &response, 0, &usage) < 0)
           _exit(1);
+        max_rss_kb = usage.ru_maxrss > 0 && usage.ru_maxrss <= INT_MAX ? (int)usage.ru_maxrss : 0;
+        break;
+
+      case GET_MAX_RSS:
+        response = max_rss_kb;
         break;
     }
 
@@ -240,6 +613,11 @@ static void __afl_start_forkserver_persistence(void) {
           response = 0;               //die, just return 0 to the parent
 
         break;
+
+      case GET_MAX_RSS:
+        //A persistent child's peak RSS covers all of its runs so far, so it says nothing about the last one
+        response = 0;
+        break;
     }
 
     if(write(FORKSRV_TO_FUZZER, &response, sizeof(response)) != sizeof(response))
@@ -256,8 +634,8 @@ int __afl_persistent_loop(void) {
   if (first_pass) {
 
     if (is_persistent) {
-      memset(__afl_area_ptr, 0, MAP_SIZE);
-      __afl_prev_loc = 0;
+      __afl_reset_map();
+      __afl_reset_prev_loc();
     }
 
     cycle_cnt  = 0;
@@ -268,9 +646,11 @@ int __afl_persistent_loop(void) {
   if (is_persistent) {
 
     if(++cycle_cnt != max_cnt) {
+      /* The fuzzer clears the map (just the dirty lines, if there's an
+         index) before it lets us go again, so there's no need to reset
+         it here too. */
       raise(SIGSTOP);
-      memset(__afl_area_ptr, 0, MAP_SIZE);
-      __afl_prev_loc = 0;
+      __afl_reset_prev_loc();
       return 1;
 
     } else {
@@ -279,6 +659,8 @@ int __afl_persistent_loop(void) {
          follows the loop is not traced. We do that by pivoting back to the
          dummy output region. */
       __afl_area_ptr = __afl_area_initial;
+      __afl_dirty_ptr = __afl_area_initial + MAX_MAP_SIZE;
+      __afl_dirty_index = 0;
     }
   }
 
@@ -325,10 +707,26 @@ __attribute__((constructor(CONST_PRIO))) void __afl_auto_init(void) {
    edge (as opposed to every basic block). */
 
 void __sanitizer_cov_trace_pc_guard(uint32_t* guard) {
+  __afl_dirty_ptr[*guard >> DIRTY_LINE_POW2] = 1;
   __afl_area_ptr[*guard]++;
 }
 
 
+/* Hands out the next trace-pc-guard ID.  Edges from libraries that are loaded
+   after the map size was reported (or beyond the largest map) have to share
+   the bytes of the map. */
+
+static u32 __afl_new_guard_id(void) {
+
+  u32 limit = __afl_map_size_done ? __afl_map_size : MAX_MAP_SIZE;
+  u32 id = __afl_next_guard++;
+
+  if (id >= limit) id = (id - 1) % (limit - 1) + 1;
+  return id;
+
+}
+
+
 /* Init callback. Populates instrumentation IDs. Note that we're using
    ID of 0 as a special value to indicate non-instrumented bits. That may
    still touch the bitmap, but in a fairly harmless way. */
@@ -352,11 +750,11 @@ void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop) {
      to avoid duplicate calls (which can happen as an artifact of the underlying
      implementation in LLVM). */
 
-  *(start++) = R(MAP_SIZE - 1) + 1;
+  *(start++) = __afl_new_guard_id();
 
   while (start < stop) {
 
-    if (R(100) < inst_ratio) *start = R(MAP_SIZE - 1) + 1;
+    if (R(100) < inst_ratio) *start = __afl_new_guard_id();
     else *start = 0;
 
     start++;
@@ -0,0 +1,215 @@
+/*
+   american fuzzy lop - LLVM-mode compare transformation pass
+   ----------------------------------------------------------
+
+   Based on the compare transformation of laf-intel
+   (https://lafintel.wordpress.com/).
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   This library is plugged into LLVM when invoking clang through afl-clang-fast
+   with AFL_LLVM_LAF_TRANSFORM_COMPARES set.  It replaces the calls to strcmp(),
+   strncmp(), memcmp() and bcmp() that have a constant string operand with a
+   chain of byte compares, one basic block per byte.  The coverage pass then
+   instruments each of the blocks, so every byte of the input that matches the
+   constant shows up as new coverage, rather than the whole string having to be
+   guessed at once.
+
+ */
+
+#define AFL_LLVM_PASS
+
+#include "../config.h"
+#include "../debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+using namespace llvm;
+
+/* Longer constants are left alone, so that a big table compare doesn't turn
+   into thousands of blocks. */
+
+#define MAX_TRANSFORM_LEN 256
+
+namespace {
+
+  class CompareTransform : public ModulePass {
+
+    public:
+
+      static char ID;
+      CompareTransform() : ModulePass(ID) { }
+
+      bool runOnModule(Module &M) override;
+
+    private:
+
+      void transformCall(CallInst *Call, StringRef Str, Value *Other,
+                         unsigned int len, bool const_first, bool stop_at_nul);
+
+  };
+
+}
+
+
+char CompareTransform::ID = 0;
+
+
+bool CompareTransform::runOnModule(Module &M) {
+
+  std::vector<CallInst *> calls;
+
+  for (auto &F : M)
+    for (auto &BB : F)
+      for (auto &I : BB)
+        if (CallInst *Call = dyn_cast<CallInst>(&I)) calls.push_back(Call);
+
+  unsigned int transformed = 0;
+
+  for (CallInst *Call : calls) {
+
+    Function *Callee = Call->getCalledFunction();
+    if (!Callee || !Call->getType()->isIntegerTy(32)) continue;
+
+    StringRef Name = Callee->getName();
+    bool is_mem = Name == "memcmp" || Name == "bcmp";
+    bool is_sized = is_mem || Name == "strncmp";
+
+    if (!is_sized && Name != "strcmp") continue;
+    if (Callee->arg_size() != (is_sized ? 3 : 2)) continue;
+
+    /* The length of memcmp and strncmp has to be known at compile time. */
+    uint64_t max_len = ~0ULL;
+    if (is_sized) {
+
+      ConstantInt *Len = dyn_cast<ConstantInt>(Call->getArgOperand(2));
+      if (!Len) continue;
+      max_len = Len->getZExtValue();
+
+    }
+
+    for (unsigned int op = 0; op < 2; op++) {
+
+      StringRef Str;
+      Value *Arg = Call->getArgOperand(op);
+
+      if (!getConstantStringInfo(Arg, Str, 0, !is_mem)) continue;
+
+      /* The string functions compare the terminating NUL too. */
+      uint64_t len = is_mem ? Str.size() : Str.size() + 1;
+      if (len > max_len) len = max_len;
+      if (is_mem && max_len > Str.size()) break;
+      if (!len || len > MAX_TRANSFORM_LEN) break;
+
+      transformCall(Call, Str, Call->getArgOperand(1 - op), len, op == 0,
+                    !is_mem);
+      transformed++;
+      break;
+
+    }
+
+  }
+
+  if (transformed && isatty(2) && !getenv("AFL_QUIET"))
+    OKF("Transformed %u string and memory compares.", transformed);
+
+  return transformed != 0;
+
+}
+
+
+/* Replaces one compare call with the byte compares.  Each block loads a byte
+   of the other operand, and either moves on to the next byte or leaves with
+   the difference, like the library functions do.  The string functions stop
+   once they've matched the NUL, so they never read past the other string. */
+
+void CompareTransform::transformCall(CallInst *Call, StringRef Str,
+                                     Value *Other, unsigned int len,
+                                     bool const_first, bool stop_at_nul) {
+
+  LLVMContext &C = Call->getContext();
+  IntegerType *Int8Ty  = IntegerType::getInt8Ty(C);
+  IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
+
+  BasicBlock *Head = Call->getParent();
+  BasicBlock *End = Head->splitBasicBlock(BasicBlock::iterator(Call),
+                                          "cmp_transform_end");
+  Function *F = Head->getParent();
+
+  IRBuilder<> EndIRB(&*End->begin());
+  PHINode *Result = EndIRB.CreatePHI(Int32Ty, len + 1);
+
+  IRBuilder<> HeadIRB(Head->getTerminator());
+  Value *OtherPtr = HeadIRB.CreatePointerCast(Other, PointerType::get(Int8Ty, 0));
+
+  BasicBlock *Prev = Head;
+
+  for (unsigned int i = 0; i < len; i++) {
+
+    BasicBlock *Byte = BasicBlock::Create(C, "cmp_transform_byte", F, End);
+
+    /* Point the previous block (the head, or the previous byte's match
+       branch) at this byte. */
+    Prev->getTerminator()->setSuccessor(0, Byte);
+
+    IRBuilder<> IRB(Byte);
+    uint8_t ch = i < Str.size() ? Str[i] : 0;
+
+    Value *Ptr = IRB.CreateConstInBoundsGEP1_32(Int8Ty, OtherPtr, i);
+    Value *Loaded = IRB.CreateLoad(Int8Ty, Ptr);
+    Value *Wide = IRB.CreateZExt(Loaded, Int32Ty);
+    Value *Diff = const_first
+                      ? IRB.CreateSub(ConstantInt::get(Int32Ty, ch), Wide)
+                      : IRB.CreateSub(Wide, ConstantInt::get(Int32Ty, ch));
+    Value *Match = IRB.CreateICmpEQ(Loaded, ConstantInt::get(Int8Ty, ch));
+
+    if (i == len - 1 || (stop_at_nul && !ch)) {
+
+      /* The last byte's difference is the result either way. */
+      IRB.CreateBr(End);
+      Result->addIncoming(Diff, Byte);
+      break;
+
+    }
+
+    /* The match branch is pointed at the next byte on the next pass. */
+    IRB.CreateCondBr(Match, End, End);
+    Result->addIncoming(Diff, Byte);
+    Prev = Byte;
+
+  }
+
+  Call->replaceAllUsesWith(Result);
+  Call->eraseFromParent();
+
+}
+
+
+static void registerCompareTransformPass(const PassManagerBuilder &,
+                                         legacy::PassManagerBase &PM) {
+
+  PM.add(new CompareTransform());
+
+}
+
+
+static RegisterStandardPasses RegisterCompareTransformPass(
+    PassManagerBuilder::EP_OptimizerLast, registerCompareTransformPass);
+
+static RegisterStandardPasses RegisterCompareTransformPass0(
+    PassManagerBuilder::EP_EnabledOnOptLevel0, registerCompareTransformPass);
@@ -0,0 +1,179 @@
+/*
+   american fuzzy lop - LLVM-mode compare splitting pass
+   -----------------------------------------------------
+
+   Based on the compare splitting of laf-intel
+   (https://lafintel.wordpress.com/).
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   This library is plugged into LLVM when invoking clang through afl-clang-fast
+   with AFL_LLVM_LAF_SPLIT_COMPARES set.  It splits the integer equality
+   compares against a constant that are wider than a byte into a chain of byte
+   compares, one basic block per byte.  The coverage pass then instruments each
+   of the blocks, so matching a 4-byte magic value takes four byte-sized steps
+   with coverage feedback after each one, rather than 2^32 guesses.
+
+ */
+
+#define AFL_LLVM_PASS
+
+#include "../config.h"
+#include "../debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+using namespace llvm;
+
+namespace {
+
+  class SplitCompares : public ModulePass {
+
+    public:
+
+      static char ID;
+      SplitCompares() : ModulePass(ID) { }
+
+      bool runOnModule(Module &M) override;
+
+    private:
+
+      void splitCompare(ICmpInst *Cmp, Value *Other, ConstantInt *CI);
+
+  };
+
+}
+
+
+char SplitCompares::ID = 0;
+
+
+bool SplitCompares::runOnModule(Module &M) {
+
+  std::vector<ICmpInst *> compares;
+
+  for (auto &F : M)
+    for (auto &BB : F)
+      for (auto &I : BB)
+        if (ICmpInst *Cmp = dyn_cast<ICmpInst>(&I))
+          if (Cmp->isEquality()) compares.push_back(Cmp);
+
+  unsigned int split = 0;
+
+  for (ICmpInst *Cmp : compares) {
+
+    for (unsigned int op = 0; op < 2; op++) {
+
+      ConstantInt *CI = dyn_cast<ConstantInt>(Cmp->getOperand(op));
+      if (!CI) continue;
+
+      unsigned int width = CI->getBitWidth();
+      if (width <= 8 || width > 64 || width % 8) break;
+
+      Value *Other = Cmp->getOperand(1 - op);
+      if (isa<Constant>(Other)) break;
+
+      splitCompare(Cmp, Other, CI);
+      split++;
+      break;
+
+    }
+
+  }
+
+  if (split && isatty(2) && !getenv("AFL_QUIET"))
+    OKF("Split %u integer compares into byte compares.", split);
+
+  return split != 0;
+
+}
+
+
+/* Replaces one compare with the byte compares, starting with the lowest byte,
+   which comes first in the input on little endian targets.  Each block either
+   moves on to the next byte or leaves with a mismatch. */
+
+void SplitCompares::splitCompare(ICmpInst *Cmp, Value *Other, ConstantInt *CI) {
+
+  LLVMContext &C = Cmp->getContext();
+  IntegerType *Int1Ty = IntegerType::getInt1Ty(C);
+  IntegerType *Int8Ty = IntegerType::getInt8Ty(C);
+
+  bool is_eq = Cmp->getPredicate() == CmpInst::ICMP_EQ;
+  unsigned int bytes = CI->getBitWidth() / 8;
+  uint64_t constant = CI->getZExtValue();
+
+  BasicBlock *Head = Cmp->getParent();
+  BasicBlock *End = Head->splitBasicBlock(BasicBlock::iterator(Cmp),
+                                          "split_cmp_end");
+  Function *F = Head->getParent();
+
+  IRBuilder<> EndIRB(&*End->begin());
+  PHINode *Result = EndIRB.CreatePHI(Int1Ty, bytes);
+
+  BasicBlock *Prev = Head;
+
+  for (unsigned int i = 0; i < bytes; i++) {
+
+    BasicBlock *Byte = BasicBlock::Create(C, "split_cmp_byte", F, End);
+
+    /* Point the previous block (the head, or the previous byte's match
+       branch) at this byte. */
+    Prev->getTerminator()->setSuccessor(0, Byte);
+
+    IRBuilder<> IRB(Byte);
+    Value *Shifted = i ? IRB.CreateLShr(Other, i * 8) : Other;
+    Value *Part = IRB.CreateTrunc(Shifted, Int8Ty);
+    Value *Expected = ConstantInt::get(Int8Ty, (constant >> (i * 8)) & 0xff);
+
+    if (i == bytes - 1) {
+
+      /* The last byte decides the result. */
+      Value *Last = is_eq ? IRB.CreateICmpEQ(Part, Expected)
+                          : IRB.CreateICmpNE(Part, Expected);
+      IRB.CreateBr(End);
+      Result->addIncoming(Last, Byte);
+      break;
+
+    }
+
+    /* The match branch is pointed at the next byte on the next pass. */
+    IRB.CreateCondBr(IRB.CreateICmpEQ(Part, Expected), End, End);
+    Result->addIncoming(ConstantInt::get(Int1Ty, !is_eq), Byte);
+    Prev = Byte;
+
+  }
+
+  Cmp->replaceAllUsesWith(Result);
+  Cmp->eraseFromParent();
+
+}
+
+
+static void registerSplitComparesPass(const PassManagerBuilder &,
+                                      legacy::PassManagerBase &PM) {
+
+  PM.add(new SplitCompares());
+
+}
+
+
+static RegisterStandardPasses RegisterSplitComparesPass(
+    PassManagerBuilder::EP_OptimizerLast, registerSplitComparesPass);
+
+static RegisterStandardPasses RegisterSplitComparesPass0(
+    PassManagerBuilder::EP_EnabledOnOptLevel0, registerSplitComparesPass);
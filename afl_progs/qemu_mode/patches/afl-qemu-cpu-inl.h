@@ -32,10 +32,13 @@
 /*
 	This file has been modified from the original AFL version to incorporate into
 	Killerbeez.  Specifically, the fork server has been modified to match the
-  Killerbeez fork server protocol.
+  Killerbeez fork server protocol, and supports persistence mode.
  */
 
+#include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
+#include "exec/cpu_ldst.h"
 #include "../../config.h"
 #include "../../../instrumentation/forkserver_internal.h"
 
@@ -52,8 +55,19 @@
       afl_setup(); \
       afl_forkserver(cpu); \
     } \
+    if(afl_persistent_addr) \
+      afl_persistent_loop(cpu, itb); \
   } while (0)
 
+/* The blocks at the start and the end of the persistence mode loop have to go
+   through cpu_tb_exec(), so that the snippet above sees them.  They're never
+   chained to, and never mirrored in the fork server, so a new child always
+   translates them itself. */
+
+#define AFL_QEMU_PERSISTENT_TB(pc) \
+  (afl_persistent_addr && \
+   ((pc) == afl_persistent_addr || (pc) == afl_persistent_ret_addr))
+
 /* We use one additional file descriptor to relay "needs translation"
    messages between the child and the fork server. */
 
@@ -75,6 +89,25 @@ abi_ulong afl_entry_point, /* ELF entry point (_start) */
 static unsigned char afl_fork_child;
 unsigned int afl_forksrv_pid;
 
+/* Persistence mode: the function that's run once per input, where it returns
+   to, and the number of inputs each child runs before exiting.  The registers
+   at the first call of the function are restored for each later input. */
+
+abi_ulong afl_persistent_addr,
+          afl_persistent_ret_addr;
+
+static int afl_persistent_max_cnt, afl_persistent_cnt;
+static unsigned char afl_persistent_started;
+
+#ifdef TARGET_I386
+static target_ulong afl_persistent_regs[CPU_NB_REGS];
+#endif
+
+/* The previous location of afl_gen_trace's instrumentation, which starts over
+   for each input. */
+
+extern __thread target_ulong afl_prev_loc;
+
 /* Instrumentation ratio: */
 
 unsigned int afl_inst_rms = MAP_SIZE; /* Exported for afl_gen_trace */
@@ -83,8 +116,9 @@ unsigned int afl_inst_rms = MAP_SIZE; /* Exported for afl_gen_trace */
 
 static void afl_setup(void);
 static void afl_forkserver(CPUState*);
+static void afl_persistent_loop(CPUState*, TranslationBlock*);
 
-static void afl_wait_tsl(CPUState*, int);
+static int afl_wait_tsl(CPUState*, int);
 static void afl_request_tsl(target_ulong, target_ulong, uint32_t, TranslationBlock*, int);
 
 /* Data structures passed around by the translate handlers: */
@@ -98,6 +132,7 @@ struct afl_tb {
 struct afl_tsl {
   struct afl_tb tb;
   char is_chain;
+  char is_stop; /* The child is about to stop after a persistence mode input */
 };
 
 struct afl_chain {
@@ -119,6 +154,7 @@ static inline TranslationBlock *tb_find(CPUState*, TranslationBlock*, int);
 static void afl_setup(void) {
 
   char *id_str = getenv(SHM_ENV_VAR),
+       *fd_str = getenv(SHM_FD_ENV_VAR),
        *inst_r = getenv("AFL_INST_RATIO");
 
   int shm_id;
@@ -136,7 +172,22 @@ static void afl_setup(void) {
 
   }
 
-  if (id_str) {
+  if (fd_str) {
+
+    /* The fuzzer handed us the SHM region as an inherited memfd. */
+
+    int shm_fd = atoi(fd_str);
+    struct stat st;
+
+    if (fstat(shm_fd, &st)) exit(1);
+    afl_area_ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        shm_fd, 0);
+    if (afl_area_ptr == MAP_FAILED) exit(1);
+    close(shm_fd);
+
+    if (inst_r) afl_area_ptr[0] = 1;
+
+  } else if (id_str) {
 
     shm_id = atoi(id_str);
     afl_area_ptr = shmat(shm_id, NULL, 0);
@@ -164,16 +215,34 @@ static void afl_setup(void) {
 
   rcu_disable_atfork();
 
+  /* Persistence mode is only supported for x86 targets, as the registers and
+     the return address have to be found in the CPU state. */
+
+  if (getenv(QEMU_PERSISTENT_ADDR_VAR) && getenv(PERSIST_MAX_VAR)) {
+
+#ifdef TARGET_I386
+    afl_persistent_addr = strtoul(getenv(QEMU_PERSISTENT_ADDR_VAR), NULL, 16);
+    if (getenv(QEMU_PERSISTENT_RET_VAR))
+      afl_persistent_ret_addr = strtoul(getenv(QEMU_PERSISTENT_RET_VAR), NULL, 16);
+    afl_persistent_max_cnt = atoi(getenv(PERSIST_MAX_VAR));
+    if (afl_persistent_max_cnt <= 0) afl_persistent_addr = 0;
+#else
+    fprintf(stderr, "[-] Persistence mode isn't supported for this target, ignoring "
+      QEMU_PERSISTENT_ADDR_VAR "\n");
+#endif
+
+  }
+
 }
 
 
 /* Fork server logic, invoked once we hit _start. */
 static int forkserver_installed = 0;
 static void afl_forkserver(CPUState *cpu) {
-  static int response = 0x41414141;
+  static int response = FORKSERVER_HELLO_MAP_SIZE(MAP_SIZE_POW2);
   char command;
-  int child_pid = -1;
-  int t_fd[2];
+  int child_pid = -1, child_stopped = 0;
+  int t_fd[2], tsl_fd = -1;
 
   if (forkserver_installed == 1)
     return;
@@ -200,27 +269,42 @@ static void afl_forkserver(CPUState *cpu) {
       case EXIT:
       case RUN: //QEMU doesn't do the single RUN/FORK commands
       case FORK: //but instead only implements FORK_RUN
+        if (child_stopped)
+          kill(child_pid, SIGKILL);
         _exit(0);
         break;
 
       case FORK_RUN:
 
-        /* Establish a channel with child to grab translation commands. We'll
-           read from t_fd[0], child will write to TSL_FD. */
-        if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
-        close(t_fd[1]);
+        if (child_stopped) {
+
+          /* A persistence mode child is waiting for its next input. */
+          child_stopped = 0;
+          kill(child_pid, SIGCONT);
+
+        } else {
+
+          /* Establish a channel with child to grab translation commands. We'll
+             read from t_fd[0], child will write to TSL_FD. */
+          if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
+          close(t_fd[1]);
+
+          child_pid = fork();
+          if (child_pid < 0) exit(4);
+
+          if (!child_pid) {
 
-        child_pid = fork();
-        if (child_pid < 0) exit(4);
+            /* Child process. Close descriptors and run free. */
+            afl_fork_child = 1;
+            close(FUZZER_TO_FORKSRV);
+            close(FORKSRV_TO_FUZZER);
+            close(t_fd[0]);
+            return;
+          }
 
-        if (!child_pid) {
+          close(TSL_FD);
+          tsl_fd = t_fd[0];
 
-          /* Child process. Close descriptors and run free. */
-          afl_fork_child = 1;
-          close(FUZZER_TO_FORKSRV);
-          close(FORKSRV_TO_FUZZER);
-          close(t_fd[0]);
-          return;
         }
 
         /* Parent. */
@@ -228,16 +312,24 @@ static void afl_forkserver(CPUState *cpu) {
         if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
           _exit(1);
 
-        close(TSL_FD);
-
-        /* Collect translation requests until child dies and closes the pipe. */
-        afl_wait_tsl(cpu, t_fd[0]);
+        /* Collect translation requests until the child dies and closes the
+           pipe, or stops after a persistence mode input. */
+        if (!afl_wait_tsl(cpu, tsl_fd))
+          tsl_fd = -1;
         break;
 
       case GET_STATUS:
-        /* Get and relay exit status to parent. */
-        if(waitpid(child_pid, &response, 0) < 0)
+        /* Get and relay exit status to parent.  A persistence mode child
+           that stopped is done with its input, which is reported as 0. */
+        if(waitpid(child_pid, &response, afl_persistent_addr ? WUNTRACED : 0) < 0)
           _exit(1);
+        if (WIFSTOPPED(response)) {
+          child_stopped = 1;
+          response = 0;
+        } else if (tsl_fd >= 0) {
+          close(tsl_fd);
+          tsl_fd = -1;
+        }
         if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
           _exit(1);
         break;
@@ -262,6 +354,7 @@ static void afl_request_tsl(target_ulong pc, target_ulong cb, uint32_t flags,
   t.tb.cs_base = cb;
   t.tb.flags   = flags;
   t.is_chain   = (last_tb != NULL);
+  t.is_stop    = 0;
 
   if (write(TSL_FD, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
     return;
@@ -279,9 +372,11 @@ static void afl_request_tsl(target_ulong pc, target_ulong cb, uint32_t flags,
 }
 
 /* This is the other side of the same channel. Since timeouts are handled by
-   afl-fuzz simply killing the child, we can just wait until the pipe breaks. */
+   afl-fuzz simply killing the child, we can just wait until the pipe breaks,
+   or the child says it's stopping after a persistence mode input.  Returns 1
+   if the child stopped, or 0 once the pipe is closed. */
 
-static void afl_wait_tsl(CPUState *cpu, int fd) {
+static int afl_wait_tsl(CPUState *cpu, int fd) {
 
   struct afl_tsl t;
   struct afl_chain c;
@@ -294,6 +389,9 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
     if (read(fd, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
       break;
 
+    if (t.is_stop)
+      return 1;
+
     tb = tb_htable_lookup(cpu, t.tb.pc, t.tb.cs_base, t.tb.flags);
 
     if(!tb) {
@@ -322,5 +420,64 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
   }
 
   close(fd);
+  return 0;
+
+}
+
+
+/* Runs the persistence mode loop in the child, before the blocks at the start
+   and the end of the loop execute.  The first time the function is called, its
+   registers (and, unless it was given, the return address) are saved.  When it
+   returns, the child tells the fork server it's done with the input and stops.
+   Once the fork server continues it with the next input, the registers are
+   restored and the function runs again, as though it had just been called. */
+
+static void afl_persistent_loop(CPUState *cpu, TranslationBlock *tb) {
+
+#ifdef TARGET_I386
+  CPUArchState *env = cpu->env_ptr;
+  struct afl_tsl t;
+
+  if (!afl_fork_child) return;
+
+  if (tb->pc == afl_persistent_addr && !afl_persistent_started) {
+
+    afl_persistent_started = 1;
+    memcpy(afl_persistent_regs, env->regs, sizeof(afl_persistent_regs));
+    if (!afl_persistent_ret_addr)
+      afl_persistent_ret_addr = ldtul_p(g2h(env->regs[R_ESP]));
+    return;
+
+  }
+
+  if (tb->pc != afl_persistent_ret_addr || !afl_persistent_started) return;
+
+  /* After the last input, the function returns to its caller as usual, and
+     the child exits. */
+
+  if (++afl_persistent_cnt >= afl_persistent_max_cnt) {
+    afl_persistent_addr = 0;
+    return;
+  }
+
+  memset(&t, 0, sizeof(t));
+  t.is_stop = 1;
+  if (write(TSL_FD, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
+    _exit(1);
+  raise(SIGSTOP);
+
+  memcpy(env->regs, afl_persistent_regs, sizeof(afl_persistent_regs));
+  env->eip = afl_persistent_addr;
+  afl_prev_loc = 0;
+
+  /* Drop the block at the return address, so that the block that returns to
+     it can't jump straight into it next time, and start over at the top of
+     the function. */
+
+  tb_lock();
+  tb_phys_invalidate(tb, -1);
+  tb_unlock();
+  cpu_loop_exit_noexc(cpu);
+#endif
 
 }
@@ -37,10 +37,13 @@ extern unsigned char *afl_area_ptr;
 extern unsigned int afl_inst_rms;
 extern abi_ulong afl_start_code, afl_end_code;
 
+/* The previous location, which the persistence mode loop resets between
+   inputs. */
+__thread target_ulong afl_prev_loc;
+
 /* Generates TCG code for AFL's tracing instrumentation. */
 static void afl_gen_trace(target_ulong cur_loc)
 {
-  static __thread target_ulong prev_loc;
   TCGv index, count, new_prev_loc;
   TCGv_ptr prev_loc_ptr, count_ptr;
 
@@ -63,7 +66,7 @@ static void afl_gen_trace(target_ulong cur_loc)
   if (cur_loc >= afl_inst_rms) return;
 
   /* index = prev_loc ^ cur_loc */
-  prev_loc_ptr = tcg_const_ptr(&prev_loc);
+  prev_loc_ptr = tcg_const_ptr(&afl_prev_loc);
   index = tcg_temp_new();
   tcg_gen_ld_tl(index, prev_loc_ptr, 0);
   tcg_gen_xori_tl(index, index, cur_loc);
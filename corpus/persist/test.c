@@ -2,7 +2,7 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#if defined(PERSIST) || defined(DEFERRED_NOHOOK)
+#if defined(PERSIST) || defined(DEFERRED_NOHOOK) || defined(SHM_INPUT) || defined(STREAM_STDIN)
 #include <forkserver.h>
 #endif
 
@@ -12,6 +12,20 @@ int test_func()
   char * nil = NULL;
   FILE * fp = stdin;
   memset(buffer, 0, 4);
+#ifdef SHM_INPUT
+  size_t length = 0;
+  char * input = KILLERBEEZ_GET_INPUT(&length);
+  if (input)
+    memcpy(buffer, input, length < sizeof(buffer) ? length : sizeof(buffer));
+  else
+#endif
+#ifdef STREAM_STDIN
+  size_t stream_length = 0;
+  char * stream_input = KILLERBEEZ_READ_STDIN(&stream_length);
+  if (stream_input)
+    memcpy(buffer, stream_input, stream_length < sizeof(buffer) ? stream_length : sizeof(buffer));
+  else
+#endif
   read(0, buffer, sizeof(buffer));
 
   if (buffer[0] == 'A')
@@ -21,4 +21,16 @@ typedef struct mutator
   int(*set_input)(void * mutator_state, char * new_input,
     size_t input_length);
   int(*help)(char **help_str);
+
+  void(*report_result)(void * mutator_state, int fuzz_result,
+    int new_path, uint64_t * path_hash);
+
+  void * (*clone_state)(void * mutator_state);
+  void(*merge_state)(void * mutator_state, void * cloned_state);
+
+  int(*mutate_batch)(void * mutator_state, char * arena,
+    size_t capacity, size_t * offsets, size_t * lengths, size_t count);
+
+  int(*mutate_growable)(void * mutator_state,
+    growable_buffer_t * buffer, uint64_t flags);
 } mutator_t;
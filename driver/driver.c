@@ -1,10 +1,22 @@
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define _GNU_SOURCE // setns and unshare
+#endif
 #include <jansson.h>
 #include <jansson_helper.h>
 #include <global_types.h>
 #include <utils.h>
+#include <mutator_factory.h>
 #include <instrumentation.h>
 #include "driver.h"
+#include "phase_timing.h"
+#include "static_dispatch.h"
+#include <tracepoints.h>
+#include <xxhash.h>
 
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #ifndef _WIN32
@@ -12,38 +24,66 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <forkserver_internal.h>
+#if !__APPLE__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/sockios.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sched.h>
+#endif
 #endif
 
+#define PACE_POLL_US 200 //How often to check whether the target has read the last message while pacing
+
 /**
  * Waits for a fuzzed process to be finished processing the input, either via timing out or the
- * process exiting.
+ * process exiting.  If the instrumentation provides `wait_for_process_done`, this function blocks
+ * in it until the process finishes, rather than repeatedly polling `is_process_done`.
  * @param process - a HANDLE to the fuzzed process
- * @param timeout - The maximum number of seconds to wait before declaring the process done
- * @param instrumentation - used to access `is_process_done` and `get_fuzz_result`
- * @param instrumentation_state - arguments for `is_process_done` and `get_fuzz_result`
+ * @param timeout_ms - The maximum number of milliseconds to wait before declaring the process done
+ * @param instrumentation - used to access `is_process_done`, `wait_for_process_done`, and `get_fuzz_result`
+ * @param instrumentation_state - arguments for `is_process_done`, `wait_for_process_done`, and `get_fuzz_result`
  * @return - FUZZ_HANG or FUZZ_ result (from get_fuzz_result)
  */
 #ifdef _WIN32
-int generic_wait_for_process_completion(HANDLE process, int timeout, instrumentation_t * instrumentation, void * instrumentation_state)
+int generic_wait_for_process_completion(HANDLE process, int timeout_ms, instrumentation_t * instrumentation, void * instrumentation_state)
 #else
-int generic_wait_for_process_completion(pid_t process, int timeout, instrumentation_t * instrumentation, void * instrumentation_state)
+int generic_wait_for_process_completion(pid_t process, int timeout_ms, instrumentation_t * instrumentation, void * instrumentation_state)
 #endif
 {
-	time_t start_time = time(NULL);
+	uint64_t deadline = get_time_ms() + timeout_ms;
+	uint64_t now;
 	int process_done = 0;
 
+	PHASE_BEGIN(PHASE_WAIT);
 	while(1)
 	{
-		process_done = instrumentation->is_process_done(instrumentation_state);
-		if (process_done == 1)
-			return instrumentation->get_fuzz_result(instrumentation_state);
-		else if (process_done == -1)
+		now = get_time_ms();
+		if (instrumentation->wait_for_process_done)
+			process_done = INSTRUMENTATION_CALL(instrumentation, wait_for_process_done, instrumentation_state,
+				now < deadline ? (int)(deadline - now) : 0);
+		else
+			process_done = INSTRUMENTATION_CALL(instrumentation, is_process_done, instrumentation_state);
+
+		if (process_done == 1) {
+			PHASE_END(PHASE_WAIT);
+			return INSTRUMENTATION_CALL(instrumentation, get_fuzz_result, instrumentation_state);
+		} else if (process_done == -1)
 			return FUZZ_ERROR;
 		// if it's zero, the process is not done, so keep looping
 
 		// timeout
-		if (time(NULL) - start_time > timeout)
+		if (get_time_ms() >= deadline) {
+			PHASE_END(PHASE_WAIT);
 			return FUZZ_HANG;
+		}
 
 		// FUZZ_HANG isn't ever set in the instrumentation, which isn't great.
 		// could be solved by adding a set_fuzz_result function to the API. I
@@ -51,18 +91,268 @@ int generic_wait_for_process_completion(pid_t process, int timeout, instrumentat
 		// potential issue I forsee is that a second get_fuzz_result would
 		// incorrectly report FUZZ_RUNNING.
 
-		#ifdef _WIN32
-		Sleep(5);
-		#else
-		usleep(5*1000);
-		#endif
+		if (!instrumentation->wait_for_process_done)
+		{
+			#ifdef _WIN32
+			Sleep(1);
+			#else
+			usleep(1000);
+			#endif
+		}
+	}
+}
+
+/**
+ * Sets up a hang_timeout_t from a driver's timeout options.
+ * @param timeout - the hang_timeout_t to initialize
+ * @param timeout_seconds - the driver's timeout option, in seconds
+ * @param timeout_ms - the driver's timeout_ms option, which overrides timeout_seconds when it is non-zero
+ * @param multiplier - the driver's adaptive_timeout option.  If non-zero, the timeout will be set to this
+ * multiple of the observed p99 exec time, but never more than the configured timeout.
+ * @return - zero on success, non-zero if the options are invalid
+ */
+int hang_timeout_init(hang_timeout_t * timeout, int timeout_seconds, int timeout_ms, double multiplier)
+{
+	memset(timeout, 0, sizeof(hang_timeout_t));
+	if (timeout_ms < 0 || timeout_seconds < 0 || multiplier < 0)
+		return 1;
+	if (!timeout_ms)
+		timeout_ms = timeout_seconds * 1000;
+	if (!timeout_ms)
+		return 1;
+
+	timeout->timeout_ms = timeout->max_timeout_ms = timeout_ms;
+	timeout->multiplier = multiplier;
+	return 0;
+}
+
+static int compare_uint32(const void * a, const void * b)
+{
+	uint32_t first = *(const uint32_t *)a, second = *(const uint32_t *)b;
+	return (first > second) - (first < second);
+}
+
+/**
+ * Records how long the target took to process an input and, if the timeout is adaptive, periodically
+ * recalculates the hang timeout from the 99th percentile of the recorded exec times.
+ * @param timeout - the hang_timeout_t to update
+ * @param exec_time_ms - the number of milliseconds the target took to process the input
+ */
+void hang_timeout_record(hang_timeout_t * timeout, uint64_t exec_time_ms)
+{
+	uint32_t sorted[HANG_TIMEOUT_SAMPLES];
+	uint64_t new_timeout;
+
+	//The exec times of escalated tests are of inputs that already timed out, so they'd skew the timeout
+	if (timeout->multiplier <= 0 || timeout->escalated_from_ms)
+		return;
+
+	timeout->samples[timeout->next_sample] = (uint32_t)exec_time_ms;
+	timeout->next_sample = (timeout->next_sample + 1) % HANG_TIMEOUT_SAMPLES;
+	if (timeout->num_samples < HANG_TIMEOUT_SAMPLES)
+		timeout->num_samples++;
+	timeout->since_update++;
+
+	if (timeout->num_samples < HANG_TIMEOUT_MIN_SAMPLES
+		|| (timeout->since_update < HANG_TIMEOUT_UPDATE_INTERVAL && timeout->num_samples != HANG_TIMEOUT_MIN_SAMPLES))
+		return;
+	timeout->since_update = 0;
+
+	memcpy(sorted, timeout->samples, timeout->num_samples * sizeof(uint32_t));
+	qsort(sorted, timeout->num_samples, sizeof(uint32_t), compare_uint32);
+	new_timeout = (uint64_t)(sorted[(timeout->num_samples * 99) / 100] * timeout->multiplier) + 1;
+	if (new_timeout < HANG_TIMEOUT_MIN_MS)
+		new_timeout = HANG_TIMEOUT_MIN_MS;
+	if (new_timeout > (uint64_t)timeout->max_timeout_ms)
+		new_timeout = timeout->max_timeout_ms;
+	if ((int)new_timeout != timeout->timeout_ms)
+		DEBUG_MSG("Adaptive hang timeout changed from %d ms to %d ms", timeout->timeout_ms, (int)new_timeout);
+	timeout->timeout_ms = (int)new_timeout;
+}
+
+/**
+ * Escalates a hang timeout for the next tests, so that an input which timed out can be tested again to see
+ * whether it really hangs, or just ran slowly.  The adaptive timeout isn't updated while it's escalated.
+ * @param timeout - the hang_timeout_t to escalate
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to go back to the timeout that was
+ * in use before it was escalated
+ */
+void hang_timeout_escalate(hang_timeout_t * timeout, double multiplier)
+{
+	double escalated;
+
+	if (multiplier <= 0) {
+		if (timeout->escalated_from_ms)
+			timeout->timeout_ms = timeout->escalated_from_ms;
+		timeout->escalated_from_ms = 0;
+		return;
+	}
+
+	if (!timeout->escalated_from_ms)
+		timeout->escalated_from_ms = timeout->timeout_ms;
+	escalated = timeout->max_timeout_ms * multiplier;
+	timeout->timeout_ms = escalated > INT_MAX ? INT_MAX : (int)escalated;
+	if (timeout->timeout_ms < timeout->escalated_from_ms)
+		timeout->timeout_ms = timeout->escalated_from_ms;
+}
+
+/**
+ * Waits for a fuzzed process to be finished processing the input, using (and updating) a hang_timeout_t
+ * to decide when the process has hung.  See generic_wait_for_process_completion for more information.
+ * @param process - a HANDLE to the fuzzed process
+ * @param timeout - the hang_timeout_t holding the current timeout
+ * @param instrumentation - used to access `is_process_done` and `get_fuzz_result`
+ * @param instrumentation_state - arguments for `is_process_done` and `get_fuzz_result`
+ * @return - FUZZ_HANG or FUZZ_ result (from get_fuzz_result)
+ */
+#ifdef _WIN32
+int hang_timeout_wait_for_process_completion(HANDLE process, hang_timeout_t * timeout, instrumentation_t * instrumentation, void * instrumentation_state)
+#else
+int hang_timeout_wait_for_process_completion(pid_t process, hang_timeout_t * timeout, instrumentation_t * instrumentation, void * instrumentation_state)
+#endif
+{
+	uint64_t start_time = get_time_ms();
+	int result;
+
+	result = generic_wait_for_process_completion(process, timeout->timeout_ms, instrumentation, instrumentation_state);
+	// Hangs aren't recorded, since they'd only tell us the timeout we already have
+	if (result != FUZZ_HANG && result != FUZZ_ERROR)
+		hang_timeout_record(timeout, get_time_ms() - start_time);
+	return result;
+}
+
+/**
+ * This function tests several inputs with a driver, using the driver's test_inputs function if it has one, so that
+ * the driver can amortize the cost of each test across the inputs.  Otherwise, the inputs are tested one at a time.
+ * Unlike testing them one at a time, the instrumentation's state after this function returns only describes the
+ * last input, so callers that look at the coverage of each input should use test_input instead.
+ * @param driver - the driver to test the inputs with
+ * @param inputs - an array of the inputs that should be tested
+ * @param lengths - an array of the lengths of the buffers in the inputs parameter
+ * @param count - the number of inputs to test
+ * @param results - an array of count ints, used to return the FUZZ_ result of each input
+ * @return - zero on success, or FUZZ_ERROR on failure
+ */
+int driver_test_inputs(driver_t * driver, char ** inputs, size_t * lengths, size_t count, int * results)
+{
+	size_t i;
+
+	if (driver->test_inputs)
+		return driver->test_inputs(driver->state, inputs, lengths, count, results);
+
+	for (i = 0; i < count; i++)
+	{
+		results[i] = driver->test_input(driver->state, inputs[i], lengths[i]);
+		if (results[i] == FUZZ_ERROR)
+			return FUZZ_ERROR;
+	}
+	return 0;
+}
+
+/**
+ * This function gets the last input that a driver tested, borrowing the driver's buffer when the driver
+ * supports it, so that the input doesn't need to be copied.  Otherwise, the input is copied with
+ * get_last_input.  Either way, the returned buffer is only valid until the next test, and the caller
+ * should free the copy parameter when it is done with the input.
+ * @param driver - the driver to get the last input from
+ * @param length - a pointer to an int, used to return the length of the last input
+ * @param copy - a pointer to a buffer pointer, used to return the buffer that the caller needs to free,
+ * or NULL if the input was borrowed from the driver
+ * @return - the last input, or NULL if there isn't one
+ */
+const char * driver_peek_last_input(driver_t * driver, int * length, char ** copy)
+{
+	*copy = NULL;
+	if (driver->peek_last_input)
+		return driver->peek_last_input(driver->state, length);
+	*copy = driver->get_last_input(driver->state, length);
+	return *copy;
+}
+
+/**
+ * This function escalates a driver's hang timeout, so that an input which timed out can be tested again
+ * with a longer timeout.  See hang_timeout_escalate for more information.
+ * @param driver - the driver whose timeout should be escalated
+ * @param multiplier - the multiple of the driver's configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success, or non-zero if the driver doesn't have a timeout that can be escalated
+ */
+int driver_escalate_timeout(driver_t * driver, double multiplier)
+{
+	if (!driver->escalate_timeout)
+		return 1;
+	return driver->escalate_timeout(driver->state, multiplier);
+}
+
+/**
+ * Sets up a dedup_filter_t from a driver's dedup option.
+ * @param filter - the dedup_filter_t to initialize
+ * @param entries - the driver's dedup option, the number of recently tested inputs to remember.  It's rounded
+ * up to a power of two.  If it's zero, the filter is disabled, and never reports an input as a duplicate.
+ * @return - zero on success, non-zero if the option is invalid or the table couldn't be allocated
+ */
+int dedup_filter_init(dedup_filter_t * filter, int entries)
+{
+	size_t size = 1;
+
+	memset(filter, 0, sizeof(dedup_filter_t));
+	if (entries < 0 || entries > DEDUP_FILTER_MAX_ENTRIES)
+		return 1;
+	if (!entries)
+		return 0;
+
+	while (size < (size_t)entries)
+		size <<= 1;
+	filter->hashes = (uint64_t *)calloc(size, sizeof(uint64_t));
+	if (!filter->hashes)
+		return 1;
+	filter->mask = size - 1;
+	return 0;
+}
+
+/**
+ * Checks whether an input was tested recently, and remembers it if it wasn't.
+ * @param filter - the dedup_filter_t to check the input against
+ * @param buffer - the input that's about to be tested
+ * @param length - the length of the input
+ * @return - 1 if the input is a duplicate of a recently tested one, and should be skipped, or 0 otherwise
+ */
+int dedup_filter_seen(dedup_filter_t * filter, const char * buffer, size_t length)
+{
+	uint64_t hash, * entry;
+
+	if (!filter || !filter->hashes)
+		return 0;
+
+	hash = XXH64(buffer, length, 0);
+	if (!hash) //Zero marks an empty entry
+		hash = 1;
+	entry = &filter->hashes[hash & filter->mask];
+	if (*entry == hash) {
+		filter->skipped++;
+		return 1;
 	}
+	*entry = hash;
+	return 0;
+}
+
+/**
+ * Frees the table of a dedup_filter_t set up by dedup_filter_init.
+ * @param filter - the dedup_filter_t to free
+ */
+void dedup_filter_free(dedup_filter_t * filter)
+{
+	if (filter->skipped)
+		INFO_MSG("Skipped %llu duplicate inputs", (unsigned long long)filter->skipped);
+	free(filter->hashes);
+	filter->hashes = NULL;
 }
 
 /**
  * This function will call mutate on the given mutator state to modify the mutator buffer
  * and then, if the mutation succeeds, call the given test_input function with the mutated
- * buffer
+ * buffer.  Mutations that the dedup filter has seen recently are skipped, and the input is
+ * mutated again instead.  The fix ups rewrite the checksum and length fields of the mutation
+ * before it's tested.
  * @param state - a driver specific structure previously created by the driver's create function
  * @param mutator - the mutator to call to obtain a mutated input buffer
  * @param mutator_state - the state of the mutator given in the mutator parameter
@@ -70,22 +360,75 @@ int generic_wait_for_process_completion(pid_t process, int timeout, instrumentat
  * @param buffer_length - the length of the buffer parameter
  * @param test_input_func - the test_input function to call after mutating the input buffer
  * @param mutate_last_size - this parameter is used to return the size of the mutated input buffer
+ * @param dedup - the driver's dedup filter, or NULL to test every mutation
+ * @param fixups - the driver's fix ups, or NULL to test the mutations as they are
  * @return - FUZZ_CRASH, FUZZ_HANG, or FUZZ_NONE on success, FUZZ_ERROR on error, -2 if the mutator has finished generating inputs
  */
 int generic_test_next_input(void * state, mutator_t * mutator, void * mutator_state, char * buffer, size_t buffer_length,
-	int (*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size)
+	int (*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size, dedup_filter_t * dedup,
+	fixups_t * fixups)
 {
+	int skips = 0;
+
 	if (!mutator) {
 		ERROR_MSG("Mutator module missing!");
 		return -1;
 	}
-	DEBUG_MSG("Mutating input...");
-	*mutate_last_size = mutator->mutate(mutator_state, buffer, buffer_length);
-	if (*mutate_last_size < 0)
+	do {
+		DEBUG_MSG("Mutating input...");
+		PHASE_BEGIN(PHASE_MUTATE);
+		*mutate_last_size = MUTATOR_CALL(mutator, mutate, mutator_state, buffer, buffer_length);
+		PHASE_END(PHASE_MUTATE);
+		TRACEPOINT_MUTATE_DONE(*mutate_last_size);
+		if (*mutate_last_size < 0)
+			return -1;
+		else if (*mutate_last_size == 0)
+			return -2;
+	} while (skips++ < DEDUP_FILTER_MAX_SKIPS && dedup_filter_seen(dedup, buffer, *mutate_last_size));
+	fixups_apply(fixups, buffer, *mutate_last_size);
+	return DRIVER_TEST_INPUT_CALL(test_input_func, state, buffer, *mutate_last_size);
+}
+
+/**
+ * This function is the same as generic_test_next_input, except that the input is mutated into a growable
+ * buffer, which the mutator can grow to fit mutations that are larger than the buffer.  The buffer must
+ * only be written to by this function, since the mutator is told it still holds the last mutation.
+ * @param state - a driver specific structure previously created by the driver's create function
+ * @param mutator - the mutator to call to obtain a mutated input buffer
+ * @param mutator_state - the state of the mutator given in the mutator parameter
+ * @param buffer - the growable buffer to write the mutated input to
+ * @param test_input_func - the test_input function to call after mutating the input buffer
+ * @param mutate_last_size - this parameter is used to return the size of the mutated input buffer
+ * @param dedup - the driver's dedup filter, or NULL to test every mutation
+ * @param fixups - the driver's fix ups, or NULL to test the mutations as they are
+ * @return - FUZZ_CRASH, FUZZ_HANG, or FUZZ_NONE on success, FUZZ_ERROR on error, -2 if the mutator has finished generating inputs
+ */
+int generic_test_next_growable_input(void * state, mutator_t * mutator, void * mutator_state, growable_buffer_t * buffer,
+	int (*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size, dedup_filter_t * dedup,
+	fixups_t * fixups)
+{
+	//Nothing but the mutator writes to the buffer unless the fix ups rewrite the mutation, so the
+	//mutator only has to undo the bytes it last changed
+	uint64_t flags = fixups ? 0 : MUTATE_BUFFER_UNCHANGED;
+	int skips = 0;
+
+	if (!mutator) {
+		ERROR_MSG("Mutator module missing!");
 		return -1;
-	else if (*mutate_last_size == 0)
-		return -2;
-	return test_input_func(state, buffer, *mutate_last_size);
+	}
+	do {
+		DEBUG_MSG("Mutating input...");
+		PHASE_BEGIN(PHASE_MUTATE);
+		*mutate_last_size = MUTATOR_MUTATE_GROWABLE(mutator, mutator_state, buffer, flags);
+		PHASE_END(PHASE_MUTATE);
+		TRACEPOINT_MUTATE_DONE(*mutate_last_size);
+		if (*mutate_last_size < 0)
+			return -1;
+		else if (*mutate_last_size == 0)
+			return -2;
+	} while (skips++ < DEDUP_FILTER_MAX_SKIPS && dedup_filter_seen(dedup, buffer->data, *mutate_last_size));
+	fixups_apply(fixups, buffer->data, *mutate_last_size);
+	return DRIVER_TEST_INPUT_CALL(test_input_func, state, buffer->data, *mutate_last_size);
 }
 
 /**
@@ -115,6 +458,54 @@ int setup_mutate_buffer(double ratio, size_t input_length, char ** buffer, size_
 	return 0;
 }
 
+/**
+ * This function sets up a growable buffer to hold the mutated inputs that a driver sends to the target
+ * program.  It starts out ratio times the size of the input, and can grow to MUTATE_BUFFER_MAX_SIZE.
+ * @param ratio - The desired ratio of the buffer's starting size to the input size.
+ * @param input_length - The size of the input buffer
+ * @param buffer - the growable buffer to set up
+ * @return - zero on success, non-zero on failure
+ */
+int setup_growable_mutate_buffer(double ratio, size_t input_length, growable_buffer_t * buffer)
+{
+	return growable_buffer_init(buffer, (size_t)(input_length * ratio), MUTATE_BUFFER_MAX_SIZE);
+}
+
+/**
+ * This function replaces each "@@" in the target's arguments with a port, e.g. the port the driver listens on.
+ * @param arguments - the arguments to substitute the port into
+ * @param port - the port to put in the arguments
+ * @return - a newly allocated copy of the arguments with the port substituted, or NULL on failure
+ */
+char * substitute_port(char * arguments, int port)
+{
+	char port_str[16], *new_arguments, *pos, *out;
+	size_t port_length, count = 0;
+
+	snprintf(port_str, sizeof(port_str), "%d", port);
+	port_length = strlen(port_str);
+	for (pos = strstr(arguments, "@@"); pos; pos = strstr(pos + 2, "@@"))
+		count++;
+
+	new_arguments = (char *)malloc(strlen(arguments) + count * port_length + 1);
+	if (!new_arguments)
+		return NULL;
+	out = new_arguments;
+	for (pos = arguments; *pos; )
+	{
+		if (pos[0] == '@' && pos[1] == '@')
+		{
+			memcpy(out, port_str, port_length);
+			out += port_length;
+			pos += 2;
+		}
+		else
+			*out++ = *pos++;
+	}
+	*out = 0;
+	return new_arguments;
+}
+
 /**
 * This function sends the provided buffer on the already connected TCP socket
 * @param sock - a pointer to a connected TCP SOCKET to send the buffer on
@@ -171,3 +562,273 @@ int send_tcp_input(int * sock, char * buffer, size_t length)
 	return total_read != length; 
 }
 
+#if !defined(_WIN32) && !__APPLE__
+/**
+ * This function checks whether the program on the other end of a local TCP connection has read everything that
+ * was sent to it, by looking up the receive queue of its end of the connection with sock_diag.
+ * @param sock - the driver's end of the connection
+ * @return - 1 if the target has read everything, 0 if it hasn't, or -1 if the target's end of the connection
+ * can't be found (e.g. because the target isn't on this computer)
+ */
+int target_read_everything(int sock)
+{
+	struct {
+		struct nlmsghdr header;
+		struct inet_diag_req_v2 request;
+	} message;
+	struct sockaddr_nl kernel;
+	struct sockaddr_storage local, remote;
+	socklen_t local_length = sizeof(local), remote_length = sizeof(remote);
+	char buffer[1024];
+	struct nlmsghdr * reply;
+	struct inet_diag_msg * diag;
+	int diag_sock, unsent, received, result = -1;
+
+	//Anything still in our send queue hasn't made it to the target yet
+	if (ioctl(sock, SIOCOUTQ, &unsent) == 0 && unsent > 0)
+		return 0;
+
+	if (getsockname(sock, (struct sockaddr *)&local, &local_length)
+		|| getpeername(sock, (struct sockaddr *)&remote, &remote_length)
+		|| local.ss_family != remote.ss_family
+		|| (local.ss_family != AF_INET && local.ss_family != AF_INET6))
+		return -1;
+
+	//The target's end of the connection has the addresses the other way around
+	memset(&message, 0, sizeof(message));
+	message.header.nlmsg_len = sizeof(message);
+	message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	message.header.nlmsg_flags = NLM_F_REQUEST;
+	message.request.sdiag_family = local.ss_family;
+	message.request.sdiag_protocol = IPPROTO_TCP;
+	message.request.idiag_states = ~0U;
+	message.request.id.idiag_cookie[0] = INET_DIAG_NOCOOKIE;
+	message.request.id.idiag_cookie[1] = INET_DIAG_NOCOOKIE;
+	if (local.ss_family == AF_INET)
+	{
+		message.request.id.idiag_sport = ((struct sockaddr_in *)&remote)->sin_port;
+		message.request.id.idiag_dport = ((struct sockaddr_in *)&local)->sin_port;
+		memcpy(message.request.id.idiag_src, &((struct sockaddr_in *)&remote)->sin_addr, sizeof(struct in_addr));
+		memcpy(message.request.id.idiag_dst, &((struct sockaddr_in *)&local)->sin_addr, sizeof(struct in_addr));
+	}
+	else
+	{
+		message.request.id.idiag_sport = ((struct sockaddr_in6 *)&remote)->sin6_port;
+		message.request.id.idiag_dport = ((struct sockaddr_in6 *)&local)->sin6_port;
+		memcpy(message.request.id.idiag_src, &((struct sockaddr_in6 *)&remote)->sin6_addr, sizeof(struct in6_addr));
+		memcpy(message.request.id.idiag_dst, &((struct sockaddr_in6 *)&local)->sin6_addr, sizeof(struct in6_addr));
+	}
+
+	diag_sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (diag_sock < 0)
+		return -1;
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	if (sendto(diag_sock, &message, sizeof(message), 0, (struct sockaddr *)&kernel, sizeof(kernel)) == sizeof(message))
+	{
+		received = recv(diag_sock, buffer, sizeof(buffer), 0);
+		reply = (struct nlmsghdr *)buffer;
+		if (received > 0 && NLMSG_OK(reply, received) && reply->nlmsg_type == SOCK_DIAG_BY_FAMILY)
+		{
+			diag = (struct inet_diag_msg *)NLMSG_DATA(reply);
+			result = diag->idiag_rqueue == 0;
+		}
+	}
+	close(diag_sock);
+	return result;
+}
+#endif
+
+/**
+ * This function waits before a network driver sends the next message of an input to the target.  Without pacing,
+ * it waits for the whole delay.  With pacing, the delay is only an upper bound, and waiting stops as soon as the
+ * target sends a response (which is thrown away) or closes the connection.  For TCP connections to a local target
+ * on Linux, waiting also stops once the target has read all of the previous messages.
+ * @param sock - a pointer to the socket the messages are sent on
+ * @param delay_ms - the maximum number of milliseconds to wait
+ * @param pace - whether to stop waiting once the target is ready for the next message (1) or not (0)
+ * @param check_read - whether to check if the target has read the previous messages.  This should only be set for
+ * TCP connections that have already been sent a message.
+ */
+#ifdef _WIN32
+void wait_before_message(SOCKET * sock, int delay_ms, int pace, int check_read)
+#else
+void wait_before_message(int * sock, int delay_ms, int pace, int check_read)
+#endif
+{
+	uint64_t deadline = get_time_ms() + delay_ms;
+	uint64_t now, wait_us;
+	struct timeval poll_time;
+	fd_set read_fds;
+	char buffer[4096];
+
+	if (!pace)
+	{
+#ifdef _WIN32
+		Sleep(delay_ms);
+#else
+		usleep(1000 * delay_ms);
+#endif
+		return;
+	}
+
+#if defined(_WIN32) || __APPLE__
+	check_read = 0;
+#endif
+	while ((now = get_time_ms()) < deadline)
+	{
+#if !defined(_WIN32) && !__APPLE__
+		if (check_read)
+		{
+			switch (target_read_everything(*sock))
+			{
+				case 1: return;
+				case -1: check_read = 0; break;
+			}
+		}
+#endif
+		wait_us = (deadline - now) * 1000;
+		if (check_read && wait_us > PACE_POLL_US)
+			wait_us = PACE_POLL_US;
+
+		FD_ZERO(&read_fds);
+		FD_SET(*sock, &read_fds);
+		poll_time.tv_sec = (long)(wait_us / 1000000);
+		poll_time.tv_usec = (long)(wait_us % 1000000);
+		if (select((int)*sock + 1, &read_fds, NULL, NULL, &poll_time) > 0)
+		{
+			recv(*sock, buffer, sizeof(buffer), 0);
+			return;
+		}
+	}
+}
+
+#if !defined(_WIN32) && !__APPLE__
+/**
+ * This function creates a network namespace with its loopback interface up, for a driver to run its target in.  The
+ * targets in different namespaces can all listen on the same port.  The calling thread is left in the namespace it
+ * was in before.
+ * @param host_fd - a pointer used to return an fd for the namespace the calling thread was in, which netns_enter
+ * can go back to.  It should be closed by the caller.
+ * @return - an fd for the new namespace, to pass to netns_enter, or -1 on failure
+ */
+int netns_create(int * host_fd)
+{
+	struct ifreq request;
+	int netns_fd = -1, sock;
+
+	*host_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (*host_fd < 0)
+	{
+		ERROR_MSG("Couldn't open the current network namespace: %s", strerror(errno));
+		return -1;
+	}
+	if (unshare(CLONE_NEWNET))
+	{
+		ERROR_MSG("Couldn't create a network namespace, which requires root: %s", strerror(errno));
+		close(*host_fd);
+		*host_fd = -1;
+		return -1;
+	}
+
+	//A new namespace's loopback interface starts out down
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	memset(&request, 0, sizeof(request));
+	strncpy(request.ifr_name, "lo", IFNAMSIZ - 1);
+	if (sock >= 0 && !ioctl(sock, SIOCGIFFLAGS, &request))
+	{
+		request.ifr_flags |= IFF_UP | IFF_RUNNING;
+		if (!ioctl(sock, SIOCSIFFLAGS, &request))
+			netns_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+	}
+	if (netns_fd < 0)
+		ERROR_MSG("Couldn't bring up the network namespace's loopback interface: %s", strerror(errno));
+	if (sock >= 0)
+		close(sock);
+
+	if (setns(*host_fd, CLONE_NEWNET))
+		FATAL_MSG("Couldn't return to the original network namespace: %s", strerror(errno));
+	if (netns_fd < 0)
+	{
+		close(*host_fd);
+		*host_fd = -1;
+	}
+	return netns_fd;
+}
+
+/**
+ * This function moves the calling thread into a network namespace.  The sockets the thread creates afterwards, and
+ * the processes it starts, are in that namespace.
+ * @param netns_fd - an fd for the namespace, from netns_create
+ * @return - zero on success, non-zero on failure
+ */
+int netns_enter(int netns_fd)
+{
+	if (setns(netns_fd, CLONE_NEWNET))
+	{
+		ERROR_MSG("Couldn't enter the network namespace: %s", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * This function turns on the fork server library's desocket mode for targets started after it's called.  In
+ * desocket mode, the target's sockets on the given port are replaced with socket pairs that the library feeds
+ * the input through, so the input should be passed to the instrumentation's enable function (encoded with
+ * desocket_encode_inputs), rather than sent over the network.
+ * @param port - the port the target listens on or connects to
+ * @param prefix_messages - the number of messages at the start of each input to take a snapshot of the target
+ * after, so that the later inputs that start with the same messages don't need to replay them, or 0 to not take
+ * snapshots
+ * @return - zero on success, non-zero on failure
+ */
+int desocket_enable(int port, int prefix_messages)
+{
+	char buffer[16];
+
+	if (prefix_messages) {
+		snprintf(buffer, sizeof(buffer), "%d", prefix_messages);
+		if (setenv(DESOCKET_PREFIX_ENV_VAR, buffer, 1))
+			return 1;
+	}
+	else
+		unsetenv(DESOCKET_PREFIX_ENV_VAR);
+	snprintf(buffer, sizeof(buffer), "%d", port);
+	return setenv(DESOCKET_ENV_VAR, buffer, 1) != 0;
+}
+
+/**
+ * This function encodes the messages that a network driver would send to the target into the input format
+ * used by the fork server library's desocket mode.
+ * @param inputs - an array of messages to send to the target
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @param length - a pointer used to return the length of the encoded input
+ * @return - the encoded input on success, or NULL on failure.  The encoded input should be freed by the caller.
+ */
+char * desocket_encode_inputs(char ** inputs, size_t * lengths, size_t inputs_count, size_t * length)
+{
+	desocket_message_t message;
+	size_t i, offset = 0;
+	char * buffer;
+
+	*length = 0;
+	for (i = 0; i < inputs_count; i++)
+		*length += sizeof(message) + lengths[i];
+	buffer = malloc(*length);
+	if (!buffer)
+		return NULL;
+
+	for (i = 0; i < inputs_count; i++)
+	{
+		message.length = (uint32_t)lengths[i];
+		memcpy(buffer + offset, &message, sizeof(message));
+		memcpy(buffer + offset + sizeof(message), inputs[i], lengths[i]);
+		offset += sizeof(message) + lengths[i];
+	}
+	return buffer;
+}
+#endif
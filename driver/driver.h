@@ -8,6 +8,7 @@
 
 #include <global_types.h>
 #include <instrumentation.h>
+#include <fixup.h>
 
 #ifdef DRIVER_EXPORTS
 #define DRIVER_API __declspec(dllexport)
@@ -29,20 +30,95 @@ struct driver
 	int (*test_input)(void * driver_state, char * buffer, size_t length);
 	int (*test_next_input)(void * driver_state);
 	char *(*get_last_input)(void * driver_state, int * length);
+	//Optional, NULL if the driver can only test one input at a time.  Use driver_test_inputs to call it.
+	int (*test_inputs)(void * driver_state, char ** inputs, size_t * lengths, size_t count, int * results);
+	//Optional, NULL if the driver can't lend out its last input.  The returned buffer is owned by the driver
+	//and is only valid until the next test.  Use driver_peek_last_input to call it.
+	const char *(*peek_last_input)(void * driver_state, int * length);
+	//Optional, NULL if the driver has no hang timeout.  Use driver_escalate_timeout to call it.
+	int (*escalate_timeout)(void * driver_state, double multiplier);
 	void * state;
 };
 typedef struct driver driver_t;
 
+//The largest that a driver's mutate buffer grows to, unless the input_ratio makes it larger to start with
+#define MUTATE_BUFFER_MAX_SIZE (16 * 1024 * 1024)
+
+#define HANG_TIMEOUT_SAMPLES          1024 //The number of exec times kept to calculate the adaptive timeout
+#define HANG_TIMEOUT_MIN_SAMPLES        32 //The number of exec times to observe before adapting the timeout
+#define HANG_TIMEOUT_UPDATE_INTERVAL    64 //How many execs between recalculations of the adaptive timeout
+#define HANG_TIMEOUT_MIN_MS             20 //The adaptive timeout will never drop below this many milliseconds
+#define DRIVER_DEFAULT_TIMEOUT           2 //The hang timeout in seconds when the driver options don't set one
+
+struct hang_timeout
+{
+	int timeout_ms;          //The current hang timeout, in milliseconds
+	int max_timeout_ms;      //The configured hang timeout, which the adaptive timeout never exceeds
+	double multiplier;       //The multiple of the p99 exec time to use as the timeout, or 0 to disable adapting
+	int escalated_from_ms;   //The timeout to go back to after an escalated test, or 0 if it isn't escalated
+
+	uint32_t samples[HANG_TIMEOUT_SAMPLES]; //A ring buffer of recent exec times, in milliseconds
+	size_t num_samples;      //The number of valid entries in samples
+	size_t next_sample;      //The index in samples to write the next exec time to
+	size_t since_update;     //The number of exec times recorded since the timeout was last recalculated
+};
+typedef struct hang_timeout hang_timeout_t;
+
+#define DEDUP_FILTER_MAX_ENTRIES (1 << 24) //The most inputs that a driver's dedup option can remember
+#define DEDUP_FILTER_MAX_SKIPS          64 //The most duplicates in a row that are skipped before one is tested anyway
+
+//Remembers the hashes of the inputs a driver tested recently, so that mutations which are identical to one
+//of them can be skipped.  The hashes are kept in a direct-mapped table, so a new input evicts the older one
+//that maps to the same entry, and an input is only reported as a duplicate if all 64 bits of its hash match.
+struct dedup_filter
+{
+	uint64_t * hashes;       //The table of recent input hashes, or NULL if the filter is disabled
+	size_t mask;             //The number of entries in hashes, minus one
+	uint64_t skipped;        //The number of duplicate inputs that weren't tested
+};
+typedef struct dedup_filter dedup_filter_t;
+
 #ifdef _WIN32
-FUNC_PREFIX int generic_wait_for_process_completion(HANDLE process, int timeout, instrumentation_t * instrumentation, void * instrumentation_state);
+FUNC_PREFIX int generic_wait_for_process_completion(HANDLE process, int timeout_ms, instrumentation_t * instrumentation, void * instrumentation_state);
+FUNC_PREFIX int hang_timeout_wait_for_process_completion(HANDLE process, hang_timeout_t * timeout, instrumentation_t * instrumentation, void * instrumentation_state);
 #else
-FUNC_PREFIX int generic_wait_for_process_completion(pid_t process, int timeout, instrumentation_t * instrumentation, void * instrumentation_state);
+FUNC_PREFIX int generic_wait_for_process_completion(pid_t process, int timeout_ms, instrumentation_t * instrumentation, void * instrumentation_state);
+FUNC_PREFIX int hang_timeout_wait_for_process_completion(pid_t process, hang_timeout_t * timeout, instrumentation_t * instrumentation, void * instrumentation_state);
 #endif
+FUNC_PREFIX int hang_timeout_init(hang_timeout_t * timeout, int timeout_seconds, int timeout_ms, double multiplier);
+FUNC_PREFIX void hang_timeout_record(hang_timeout_t * timeout, uint64_t exec_time_ms);
+FUNC_PREFIX void hang_timeout_escalate(hang_timeout_t * timeout, double multiplier);
+FUNC_PREFIX int dedup_filter_init(dedup_filter_t * filter, int entries);
+FUNC_PREFIX int dedup_filter_seen(dedup_filter_t * filter, const char * buffer, size_t length);
+FUNC_PREFIX void dedup_filter_free(dedup_filter_t * filter);
 FUNC_PREFIX int generic_test_next_input(void * state, mutator_t * mutator, void * mutator_state, char * buffer, size_t buffer_length,
-	int(*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size);
+	int(*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size, dedup_filter_t * dedup,
+	fixups_t * fixups);
+FUNC_PREFIX int generic_test_next_growable_input(void * state, mutator_t * mutator, void * mutator_state, growable_buffer_t * buffer,
+	int(*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size, dedup_filter_t * dedup,
+	fixups_t * fixups);
+FUNC_PREFIX int driver_test_inputs(driver_t * driver, char ** inputs, size_t * lengths, size_t count, int * results);
+FUNC_PREFIX const char * driver_peek_last_input(driver_t * driver, int * length, char ** copy);
+FUNC_PREFIX int driver_escalate_timeout(driver_t * driver, double multiplier);
 FUNC_PREFIX int setup_mutate_buffer(double ratio, size_t input_length, char ** buffer, size_t * length);
+FUNC_PREFIX int setup_growable_mutate_buffer(double ratio, size_t input_length, growable_buffer_t * buffer);
+FUNC_PREFIX char * substitute_port(char * arguments, int port);
 #ifdef _WIN32
 FUNC_PREFIX int send_tcp_input(SOCKET * sock, char * buffer, size_t length);
 #else
 FUNC_PREFIX int send_tcp_input(int * sock, char * buffer, size_t length);
 #endif
+#ifdef _WIN32
+FUNC_PREFIX void wait_before_message(SOCKET * sock, int delay_ms, int pace, int check_read);
+#else
+FUNC_PREFIX void wait_before_message(int * sock, int delay_ms, int pace, int check_read);
+#endif
+#if !defined(_WIN32) && !__APPLE__
+FUNC_PREFIX int target_read_everything(int sock);
+FUNC_PREFIX int netns_create(int * host_fd);
+FUNC_PREFIX int netns_enter(int netns_fd);
+#endif
+#ifndef _WIN32
+FUNC_PREFIX int desocket_enable(int port, int prefix_messages);
+FUNC_PREFIX char * desocket_encode_inputs(char ** inputs, size_t * lengths, size_t inputs_count, size_t * length);
+#endif
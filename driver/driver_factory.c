@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #include "instrumentation.h"
+#include <jansson_helper.h>
 #include "driver_factory.h"
 #include "driver.h"  // for driver_t
 
@@ -12,6 +13,8 @@
 #include "network_client_driver.h"
 #ifdef _WIN32
 #include "wmp_driver.h"
+#else
+#include "inprocess_driver.h"
 #endif
 
 
@@ -73,6 +76,11 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 	mutator_t * mutator, void * mutator_state)
 {
 	driver_t * ret = (driver_t *)malloc(sizeof(driver_t));
+	if (!ret)
+		return NULL;
+	ret->test_inputs = NULL;
+	ret->peek_last_input = NULL;
+	ret->escalate_timeout = NULL;
 	if (!strcmp(driver_type, "file"))
 	{
 		ret->state = file_create(options, instrumentation, instrumentation_state, mutator, mutator_state);
@@ -82,6 +90,8 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = file_test_input;
 		ret->test_next_input = file_test_next_input;
 		ret->get_last_input = file_get_last_input;
+		ret->escalate_timeout = file_escalate_timeout;
+		ret->peek_last_input = file_peek_last_input;
 	}
 	else if (!strcmp(driver_type, "stdin"))
 	{
@@ -92,6 +102,8 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = stdin_test_input;
 		ret->test_next_input = stdin_test_next_input;
 		ret->get_last_input = stdin_get_last_input;
+		ret->escalate_timeout = stdin_escalate_timeout;
+		ret->peek_last_input = stdin_peek_last_input;
 	}
 	else if (!strcmp(driver_type, "network_server"))
 	{
@@ -102,6 +114,8 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = network_server_test_input;
 		ret->test_next_input = network_server_test_next_input;
 		ret->get_last_input = network_server_get_last_input;
+		ret->escalate_timeout = network_server_escalate_timeout;
+		ret->test_inputs = network_server_test_inputs;
 	}
 	else if (!strcmp(driver_type, "network_client"))
 	{
@@ -114,6 +128,7 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = network_client_test_input;
 		ret->test_next_input = network_client_test_next_input;
 		ret->get_last_input = network_client_get_last_input;
+		ret->escalate_timeout = network_client_escalate_timeout;
 	}
 	#ifdef _WIN32
 	else if (!strcmp(driver_type, "wmp"))
@@ -125,6 +140,21 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = wmp_test_input;
 		ret->test_next_input = wmp_test_next_input;
 		ret->get_last_input = wmp_get_last_input;
+		ret->peek_last_input = wmp_peek_last_input;
+	}
+	#else
+	else if (!strcmp(driver_type, "inprocess"))
+	{
+		ret->state = inprocess_create(options, instrumentation, instrumentation_state, mutator, mutator_state);
+		if (!ret->state)
+			FACTORY_ERROR();
+		ret->cleanup = inprocess_cleanup;
+		ret->test_input = inprocess_test_input;
+		ret->test_next_input = inprocess_test_next_input;
+		ret->get_last_input = inprocess_get_last_input;
+		ret->escalate_timeout = inprocess_escalate_timeout;
+		ret->peek_last_input = inprocess_peek_last_input;
+		ret->test_inputs = inprocess_test_inputs;
 	}
 	#endif
 	else
@@ -139,6 +169,36 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
     free(new_text);                                                     \
   }
 
+/**
+ * This function creates the driver for one of several fuzzing workers in the same process.  The worker's index
+ * is passed to the driver as its instance option, which the drivers that need something of their own for each
+ * worker (the file driver's test filename, or the network_client driver's port) use to pick it.  So a driver
+ * that's recreated for a worker, or a temporary one made for the first worker, gets the same one again.
+ * @param driver_type - the name of the driver that should be created.
+ * @param options - a JSON string that contains the driver specific string of options
+ * @param worker - the index of the worker that the driver is for
+ * @param instrumentation - optionally, a pointer to an instrumentation instance that the driver will use
+ * to instrument the requested program.  This instrumentation instance should already be initialized.
+ * @param instrumentation_state - a pointer to the instrumentation state for the passed in instrumentation
+ * @param mutator - optionally, a pointer to a mutator instance that the driver will use
+ * to obtain input when fuzzing the requested program.  This mutator instance should already be initialized.
+ * @param mutator_state - a pointer to the mutator state for the passed in mutator
+ * @return - a driver_t object of the specified type on success or NULL on failure
+ */
+DRIVER_API driver_t * driver_worker_factory(char * driver_type, char * options, int worker, instrumentation_t * instrumentation,
+	void * instrumentation_state, mutator_t * mutator, void * mutator_state)
+{
+	char * worker_options;
+	driver_t * ret;
+
+	worker_options = add_int_option_to_json(options ? options : "{}", "instance", worker);
+	if (!worker_options)
+		return NULL;
+	ret = driver_all_factory(driver_type, worker_options, instrumentation, instrumentation_state, mutator, mutator_state);
+	free(worker_options);
+	return ret;
+}
+
 /**
  * This function returns help text for all available drivers.  This help text will describe the drivers and any options
  * that can be passed to their create functions.
@@ -154,6 +214,8 @@ DRIVER_API char * driver_help(void)
 	APPEND_HELP(text, new_text, network_client_help);
 	#ifdef _WIN32
 	APPEND_HELP(text, new_text, wmp_help);
+	#else
+	APPEND_HELP(text, new_text, inprocess_help);
 	#endif
 	return text;
 }
@@ -1,9 +1,13 @@
 #include "file_driver.h"
 
 #include <utils.h>
+#include <uring.h>
+#include <mutator_factory.h>
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h" // IWYU pragma: keep
+#include "phase_timing.h"
+#include "static_dispatch.h"
 
 //c headers
 #include <stdio.h>
@@ -14,8 +18,148 @@
 #include <process.h>
 #else
 #include <string.h> // memset
-#include <unistd.h> // unlink
+#include <unistd.h> // unlink, pwrite, ftruncate
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h> // SYS_memfd_create
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
 #endif
+#endif
+#endif
+
+#ifndef _WIN32
+/**
+ * This function creates an in-memory test file for the driver.  On Linux, this is a memfd, which the
+ * target process opens via its /proc/<pid>/fd path.  Otherwise, a file on tmpfs (/dev/shm) is used.  The
+ * targets open the test file by its name, so the descriptor is closed on exec rather than inherited by them.
+ * @param state - the file_state_t to create the test file for.  On success, test_fd and test_filename are set.
+ * @return - zero on success, non-zero on failure
+ */
+static int create_memory_file(file_state_t * state)
+{
+	char * filename;
+	size_t filename_length;
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+	state->test_fd = syscall(SYS_memfd_create, "killerbeez_input", MFD_CLOEXEC);
+	if (state->test_fd >= 0)
+	{
+		filename_length = 64;
+		state->test_filename = (char *)malloc(filename_length);
+		if (!state->test_filename)
+			return 1;
+		snprintf(state->test_filename, filename_length, "/proc/%d/fd/%d", getpid(), state->test_fd);
+		state->test_fd_is_memfd = 1;
+		return 0;
+	}
+	// memfd_create isn't supported by this kernel, fall back to tmpfs
+#endif
+
+	if (access("/dev/shm", W_OK))
+		return 1;
+	filename_length = strlen("/dev/shm/fuzzfileXXXXXX") + strlen(state->extension) + 1;
+	filename = (char *)malloc(filename_length);
+	if (!filename)
+		return 1;
+	snprintf(filename, filename_length, "/dev/shm/fuzzfileXXXXXX%s", state->extension);
+	state->test_fd = mkstemps(filename, strlen(state->extension));
+	if (state->test_fd < 0)
+	{
+		free(filename);
+		return 1;
+	}
+	fcntl(state->test_fd, F_SETFD, FD_CLOEXEC);
+	state->test_filename = filename;
+	return 0;
+}
+#endif
+
+/**
+ * This function gives a test filename a unique suffix (before its extension), so that multiple file
+ * drivers in the same process don't overwrite each other's inputs.
+ * @param filename - the test filename to make unique
+ * @param instance - the number to add to the filename
+ * @return - a newly allocated unique filename, or NULL on failure
+ */
+static char * make_unique_filename(char * filename, int instance)
+{
+	char * extension, * separator, * ret;
+	size_t length, prefix_length;
+
+	extension = strrchr(filename, '.');
+	separator = strrchr(filename, '/');
+	if (!separator)
+		separator = strrchr(filename, '\\');
+	if (!extension || (separator && extension < separator))
+		extension = filename + strlen(filename);
+	prefix_length = extension - filename;
+
+	length = strlen(filename) + 16;
+	ret = (char *)malloc(length);
+	if (!ret)
+		return NULL;
+	snprintf(ret, length, "%.*s_%d%s", (int)prefix_length, filename, instance, extension);
+	return ret;
+}
+
+/**
+ * This function writes the input to the test file, either by rewriting the in-memory test file in place, or
+ * by writing the test file on disk.
+ * @param state - a driver specific structure previously created by the file_create function
+ * @param input - the input that should be written
+ * @param length - the length of the input parameter
+ * @return - zero on success, non-zero on failure
+ */
+static int write_test_file(file_state_t * state, char * input, size_t length)
+{
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	DWORD written;
+	size_t total = 0;
+
+	if (!state->in_memory)
+		return write_buffer_to_file(state->test_filename, input, length) != 0;
+
+	//A temporary file is kept in the cache, rather than being flushed to disk.  The handle can't be
+	//held open between inputs, since the target may not share write access to the file.
+	while (file == INVALID_HANDLE_VALUE)
+	{
+		file = CreateFile(state->test_filename, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+		if (file == INVALID_HANDLE_VALUE && GetLastError() != ERROR_SHARING_VIOLATION)
+			return 1;
+	}
+	while (total < length)
+	{
+		if (!WriteFile(file, input + total, (DWORD)(length - total), &written, NULL))
+			break;
+		total += written;
+	}
+	CloseHandle(file);
+	return total != length;
+#else
+	ssize_t written;
+	size_t total = 0;
+
+	if (state->test_fd < 0)
+		return write_buffer_to_file(state->test_filename, input, length) != 0;
+	if (uring_rewrite_file(state->test_fd, input, length) != URING_NOT_USED)
+		return 0;
+
+	while (total < length)
+	{
+		written = pwrite(state->test_fd, input + total, length - total, total);
+		if (written < 0 && errno != EAGAIN && errno != EINTR)
+			return 1;
+		if (written > 0)
+			total += written;
+	}
+	return ftruncate(state->test_fd, length) != 0;
+#endif
+}
 
 /**
  * This function creates a file_state_t object based on the given options.
@@ -34,9 +178,12 @@ static file_state_t * setup_options(char * options)
 	memset(state, 0, sizeof(file_state_t));
 
 	//Setup defaults
-	state->timeout = 2;
+	state->timeout = DRIVER_DEFAULT_TIMEOUT;
 	state->extension = strdup(".dat");
 	state->input_ratio = 2.0;
+	#ifndef _WIN32
+	state->test_fd = -1;
+	#endif
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", file_cleanup);
@@ -44,9 +191,17 @@ static file_state_t * setup_options(char * options)
 	PARSE_OPTION_STRING(state, options, arguments, "arguments", file_cleanup);
 	PARSE_OPTION_STRING(state, options, extension, "extension", file_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", file_cleanup);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout_ms", file_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, adaptive_timeout, "adaptive_timeout", file_cleanup);
+	PARSE_OPTION_INT(state, options, dedup, "dedup", file_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", file_cleanup);
+	PARSE_OPTION_INT(state, options, in_memory, "in_memory", file_cleanup);
+	PARSE_OPTION_INT(state, options, instance, "instance", file_cleanup);
 
-	if (!state->path || !file_exists(state->path) || state->input_ratio <= 0)
+	if (!state->path || !file_exists(state->path) || state->input_ratio <= 0 || state->instance < 0
+		|| hang_timeout_init(&state->hang_timeout, state->timeout, state->timeout_ms, state->adaptive_timeout)
+		|| dedup_filter_init(&state->dedup_filter, state->dedup)
+		|| fixups_create(options, &state->fixups))
 	{
 		if(!state->path)
 		{
@@ -65,8 +220,43 @@ static file_state_t * setup_options(char * options)
 			file_cleanup(state);
 			return NULL;
 		}
+		#ifndef _WIN32
+		if (state->in_memory && create_memory_file(state))
+			WARNING_MSG("Failed to create an in-memory test file, falling back to a temporary file.");
+		if (!state->test_filename)
+		#endif
 		state->test_filename = get_temp_filename(state->extension);
 	}
+	else if (state->instance > 0 && (!state->arguments || !strstr(state->arguments, "@@")))
+	{
+		WARNING_MSG("Multiple file drivers are using the test filename %s. Use \"@@\" in the \"arguments\" "
+			"option so that each driver can be given a unique test filename.", state->test_filename);
+	}
+	else if (state->instance > 0)
+	{
+		//The first worker's driver uses this filename, so the other workers' drivers each get their own
+		char * unique_filename = make_unique_filename(state->test_filename, state->instance);
+		if (!unique_filename)
+		{
+			file_cleanup(state);
+			return NULL;
+		}
+		free(state->test_filename);
+		state->test_filename = unique_filename;
+	}
+
+	#ifndef _WIN32
+	if (state->in_memory && state->test_fd < 0)
+	{
+		state->test_fd = open(state->test_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (state->test_fd < 0)
+		{
+			ERROR_MSG("Failed to open the test file %s", state->test_filename);
+			file_cleanup(state);
+			return NULL;
+		}
+	}
+	#endif
 
 	if (state->arguments)
 	{
@@ -143,7 +333,7 @@ void * file_create(char * options, instrumentation_t * instrumentation, void * i
 	{
 		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
 		if (num_inputs != 1
-			|| setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| setup_growable_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer))
 		{
 			free(input_sizes);
 			file_cleanup(state);
@@ -169,17 +359,24 @@ void file_cleanup(void * driver_state)
 {
 	file_state_t * state = (file_state_t *)driver_state;
 
-	free(state->mutate_buffer);
+	growable_buffer_free(&state->mutate_buffer);
 
+	dedup_filter_free(&state->dedup_filter);
+	fixups_free(state->fixups);
 	free(state->path);
 	free(state->extension);
 	free(state->arguments);
 	free(state->cmd_line);
+	#ifndef _WIN32
+	if (state->test_fd >= 0)
+		close(state->test_fd);
+	if (state->test_filename && !state->test_fd_is_memfd)
+		unlink(state->test_filename);
+	#else
 	if (state->test_filename)
-	{
 		unlink(state->test_filename);
-		free(state->test_filename);
-	}
+	#endif
+	free(state->test_filename);
 	free(state);
 }
 
@@ -195,17 +392,22 @@ int file_test_input(void * driver_state, char * input, size_t length)
 {
 	file_state_t * state = (file_state_t *)driver_state;
 
-	//Write the input to disk
-	DEBUG_MSG("Writing input to disk...");
-	write_buffer_to_file(state->test_filename, input, length);
+	//Write the input to the test file
+	DEBUG_MSG("Writing input to the test file...");
+	PHASE_BEGIN(PHASE_DELIVER);
+	if (write_test_file(state, input, length))
+		return FUZZ_ERROR;
+	PHASE_END(PHASE_DELIVER);
 
 	//Start the process and give it our input
 	DEBUG_MSG("Enabling instrumentation module...");
-	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
+	PHASE_BEGIN(PHASE_ENABLE);
+	if(INSTRUMENTATION_CALL(state->instrumentation, enable, state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
 		return FUZZ_ERROR;
+	PHASE_END(PHASE_ENABLE);
 
 	//Wait for it to be done, return the termination termination status
-	return generic_wait_for_process_completion(state->process, state->timeout,
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
 		state->instrumentation, state->instrumentation_state);
 }
 
@@ -218,8 +420,10 @@ int file_test_input(void * driver_state, char * input, size_t length)
 int file_test_next_input(void * driver_state)
 {
 	file_state_t * state = (file_state_t *)driver_state;
-	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
-		state->mutate_buffer_length, file_test_input, &state->mutate_last_size);
+
+	uring_register_buffer(state->mutate_buffer.data, state->mutate_buffer.capacity);
+	return generic_test_next_growable_input(state, state->mutator, state->mutator_state, &state->mutate_buffer,
+		file_test_input, &state->mutate_last_size, &state->dedup_filter, state->fixups);
 }
 
 /**
@@ -237,7 +441,37 @@ char * file_get_last_input(void * driver_state, int * length)
 	if (!state->mutator || state->mutate_last_size <= 0)
 		return NULL;
 	*length = state->mutate_last_size;
-	return memdup(state->mutate_buffer, state->mutate_last_size);
+	return memdup(state->mutate_buffer.data, state->mutate_last_size);
+}
+
+/**
+ * This function returns the last input that was sent to the target program, without copying it.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - a pointer to the driver's buffer holding the last input, which is only valid until the next
+ * test, or NULL if there isn't one
+ */
+const char * file_peek_last_input(void * driver_state, int * length)
+{
+	file_state_t * state = (file_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return state->mutate_buffer.data;
+}
+
+/**
+ * This function escalates the hang timeout that the driver uses for the next tests, so that an input which
+ * timed out can be tested again with a longer timeout.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success
+ */
+int file_escalate_timeout(void * driver_state, double multiplier)
+{
+	file_state_t * state = (file_state_t *)driver_state;
+	hang_timeout_escalate(&state->hang_timeout, multiplier);
+	return 0;
 }
 
 /**
@@ -255,12 +489,33 @@ int file_help(char ** help_str)
 "Optional Options:\n"
 "  arguments             Arguments to pass to the target process, with the\n"
 "                          target filename specified as @@\n"
+"  dedup                 Remember this many of the recently tested inputs, and\n"
+"                          skip mutations that are identical to one of them\n"
+"                          (default 0, disabled)\n"
 "  extension             The file extension to give the test file\n"
+"  fixups                An array of the checksum and length fields to rewrite\n"
+"                          in each mutated input, e.g. [{\"type\": \"crc32\",\n"
+"                          \"offset\": -4, \"end\": -4}].  The types are crc32,\n"
+"                          crc32c, adler32 and length, and each field also\n"
+"                          takes start, end, size, big_endian and adjust\n"
+"                          (default none)\n"
 "  filename              The filename to give the test file\n"
+"  instance              Which of several fuzzing workers the driver is for,\n"
+"                          which the fuzzer sets.  The workers after the\n"
+"                          first add it to the filename option (default 0)\n"
+"  in_memory             Set to 1 to keep the test file in memory (a memfd or\n"
+"                          tmpfs file on Linux, a temporary file on Windows)\n"
+"                          that is rewritten in place for each input\n"
 "  ratio                 The ratio of mutation buffer size to input size when\n"
-"                          given a mutator\n"
+"                          given a mutator.  The buffer starts at this size,\n"
+"                          and grows for mutators that make larger inputs\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
 "                          process to finish\n"
+"  timeout_ms            The maximum number of milliseconds to wait for the\n"
+"                          target process to finish.  If set, this overrides\n"
+"                          timeout\n"
+"  adaptive_timeout      Lower the timeout to this multiple of the target\n"
+"                          process's 99th percentile exec time\n"
 "\n"
 	);
 	if (*help_str == NULL)
@@ -1,4 +1,5 @@
 #pragma once
+#include "driver.h"
 #include "instrumentation.h"
 #include <sys/types.h>        // for pid_t
 #include "global_types.h"     // for mutator_t
@@ -9,6 +10,8 @@ void file_cleanup(void * driver_state);
 int file_test_input(void * driver_state, char * buffer, size_t length);
 int file_test_next_input(void * driver_state);
 char * file_get_last_input(void * driver_state, int * length);
+const char * file_peek_last_input(void * driver_state, int * length);
+int file_escalate_timeout(void * driver_state, double multiplier);
 int file_help(char ** help_str);
 
 struct file_state
@@ -18,8 +21,19 @@ struct file_state
 	char * arguments;     //Arguments to give the binary
 	char * extension;     //The file extension of the input files to the fuzzed process
 	int timeout;          //Maximum number of seconds to allow the executable to run
+	int timeout_ms;       //Maximum number of milliseconds to allow the executable to run, overrides timeout
+	double adaptive_timeout; //Multiple of the p99 exec time to use as the timeout, or 0 to disable
+	int dedup;               //The number of recently tested inputs to remember and skip duplicates of
 	char * test_filename; //The filename that we're going to write our test input to
 	double input_ratio;   //the ratio of the maximum input size
+	int in_memory;        //Whether to keep the test file in memory (memfd/tmpfs), rather than on disk
+	int instance;         //Which of the process's fuzzing workers the driver is for, to give each its own test file
+
+	//The open test file that is rewritten in place for each input, when in_memory is set
+	#ifndef _WIN32
+	int test_fd;
+	int test_fd_is_memfd; //Whether test_fd is a memfd, and thus test_filename shouldn't be unlinked
+	#endif
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -28,6 +42,15 @@ struct file_state
 	pid_t process;
 	#endif
 
+	//The hang timeout, calculated from the timeout options
+	hang_timeout_t hang_timeout;
+
+	//The recently tested inputs, which are skipped if a mutation repeats one of them
+	dedup_filter_t dedup_filter;
+
+	//The checksum and length fields to rewrite in each mutated input, or NULL
+	fixups_t * fixups;
+
 	//command line of the fuzzed process
 	char * cmd_line;
 
@@ -39,8 +62,7 @@ struct file_state
 
 	mutator_t * mutator;
 	void * mutator_state;
-	char * mutate_buffer;
-	size_t mutate_buffer_length;
+	growable_buffer_t mutate_buffer;
 	int mutate_last_size;
 };
 typedef struct file_state file_state_t;
@@ -0,0 +1,623 @@
+#include "inprocess_driver.h"
+
+#include <global_types.h>     // for mutator_t
+#include <utils.h>
+#include <jansson_helper.h>
+#include <instrumentation.h>
+#include "driver.h" // IWYU pragma: keep
+#include "phase_timing.h"
+
+//c headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Linux/macOS headers
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//The messages the harness server and children send to the driver on the status pipe
+#define INPROCESS_CHILD_STARTED 'S' //A harness child was started; the value is its pid
+#define INPROCESS_CHILD_DONE    'D' //The harness child finished testing an input
+#define INPROCESS_CHILD_EXITED  'X' //The harness child exited; the value is its wait status
+#define INPROCESS_LOAD_FAILED   'L' //The harness server couldn't load the library
+
+#define INPROCESS_STARTUP_MS 10000              //How long to wait for the library to load and a harness child to start
+#define INPROCESS_DEFAULT_MAX_LENGTH (1 << 20) //The default value of the max_length option
+#define INPROCESS_MAX_BATCH 256                //The most inputs to queue for a harness child at once
+
+struct inprocess_message
+{
+	int type;
+	int value;
+};
+typedef struct inprocess_message inprocess_message_t;
+
+//The request the driver sends a harness child for each input.  The input is at offset in the shared memory.
+struct inprocess_request
+{
+	size_t offset;
+	size_t length;
+};
+typedef struct inprocess_request inprocess_request_t;
+
+/**
+ * This function creates an inprocess_state_t object based on the given options.
+ * @param options - A JSON string of the options to set in the new inprocess_state_t. See the
+ * help function for more information on the specific options available.
+ * @return - the inprocess_state_t generated from the options in the JSON options string, or NULL on failure
+ */
+static inprocess_state_t * setup_options(char * options)
+{
+	inprocess_state_t * state;
+
+	state = (inprocess_state_t *)malloc(sizeof(inprocess_state_t));
+	if (!state)
+		return NULL;
+	memset(state, 0, sizeof(inprocess_state_t));
+
+	//Setup defaults
+	state->timeout = DRIVER_DEFAULT_TIMEOUT;
+	state->input_ratio = 2.0;
+	state->max_length = INPROCESS_DEFAULT_MAX_LENGTH;
+	state->function = strdup("LLVMFuzzerTestOneInput");
+	state->init_function = strdup("LLVMFuzzerInitialize");
+	state->control_fd = -1;
+	state->status_fd = -1;
+
+	//Parse the options
+	PARSE_OPTION_STRING(state, options, path, "path", inprocess_cleanup);
+	PARSE_OPTION_STRING(state, options, function, "function", inprocess_cleanup);
+	PARSE_OPTION_STRING(state, options, init_function, "init_function", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, timeout, "timeout", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout_ms", inprocess_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, adaptive_timeout, "adaptive_timeout", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, dedup, "dedup", inprocess_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, max_length, "max_length", inprocess_cleanup);
+
+	//Validate the options
+	if (!state->path || !file_exists(state->path) || !state->function || state->input_ratio <= 0 || state->max_length <= 0
+		|| hang_timeout_init(&state->hang_timeout, state->timeout, state->timeout_ms, state->adaptive_timeout)
+		|| dedup_filter_init(&state->dedup_filter, state->dedup)
+		|| fixups_create(options, &state->fixups))
+	{
+		inprocess_cleanup(state);
+		return NULL;
+	}
+
+	return state;
+}
+
+/**
+ * This function sends a message to the driver on the status pipe.
+ * @param fd - the write end of the status pipe
+ * @param type - the type of message to send, one of the INPROCESS_ message types
+ * @param value - the message's value
+ * @return - non-zero on error, zero on success
+ */
+static int send_message(int fd, int type, int value)
+{
+	inprocess_message_t message;
+
+	message.type = type;
+	message.value = value;
+	return write(fd, &message, sizeof(message)) != sizeof(message);
+}
+
+/**
+ * This function reads a message from the harness server or child on the status pipe.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ * @param timeout_ms - the maximum number of milliseconds to wait for the message, or -1 to wait forever
+ * @param message - a pointer to a inprocess_message_t used to return the message
+ * @return - 1 if a message was read, 0 if the timeout expired first, or -1 if the harness server has exited
+ */
+static int read_message(inprocess_state_t * state, int timeout_ms, inprocess_message_t * message)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = state->status_fd;
+	pfd.events = POLLIN;
+	do
+		ret = poll(&pfd, 1, timeout_ms);
+	while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	if (ret == 0)
+		return 0;
+
+	//The messages are much smaller than PIPE_BUF, so they're never split
+	if (read(state->status_fd, message, sizeof(*message)) != sizeof(*message))
+		return -1;
+	return 1;
+}
+
+/**
+ * This function runs in a harness child.  It tests each input the driver requests until the driver closes the
+ * control pipe, or the library crashes or exits.  If the child dies partway through a batch of inputs, the rest of
+ * the batch's requests are still on the control pipe, so the next harness child carries on with them.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ * @param test_func - the function in the library that tests an input
+ * @param control_fd - the read end of the control pipe
+ * @param status_fd - the write end of the status pipe
+ */
+static void run_harness_child(inprocess_state_t * state, inprocess_test_func_t test_func, int control_fd, int status_fd)
+{
+	inprocess_request_t request;
+
+	while (read(control_fd, &request, sizeof(request)) == sizeof(request))
+	{
+		test_func((const uint8_t *)state->input + request.offset, request.length);
+		if (send_message(status_fd, INPROCESS_CHILD_DONE, 0))
+			break;
+	}
+	_exit(0);
+}
+
+/**
+ * This function runs in the harness server.  It loads the library, calls its init function, and then starts a new
+ * harness child each time the previous one exits, so a crash only costs a fork rather than reloading the library.
+ * The server exits once the driver closes the status pipe.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ * @param control_fd - the read end of the control pipe, which is passed on to the harness children
+ * @param status_fd - the write end of the status pipe
+ */
+static void run_harness_server(inprocess_state_t * state, int control_fd, int status_fd)
+{
+	inprocess_test_func_t test_func;
+	inprocess_init_func_t init_func;
+	char * argv_storage[2] = { state->path, NULL };
+	char ** argv = argv_storage;
+	void * library;
+	int argc = 1, status, dev_null;
+	pid_t child;
+
+	library = dlopen(state->path, RTLD_NOW);
+	test_func = library ? (inprocess_test_func_t)dlsym(library, state->function) : NULL;
+	if (!test_func)
+	{
+		ERROR_MSG("Failed to load %s from %s: %s", state->function, state->path, dlerror());
+		send_message(status_fd, INPROCESS_LOAD_FAILED, 0);
+		_exit(1);
+	}
+
+	//Like other targets, the library's output is sent to /dev/null
+	dev_null = open("/dev/null", O_RDWR);
+	if (dev_null >= 0)
+	{
+		dup2(dev_null, STDOUT_FILENO);
+		dup2(dev_null, STDERR_FILENO);
+		close(dev_null);
+	}
+
+	init_func = state->init_function ? (inprocess_init_func_t)dlsym(library, state->init_function) : NULL;
+	if (init_func)
+		init_func(&argc, &argv);
+
+	while (1)
+	{
+		child = fork();
+		if (child < 0)
+			_exit(1);
+		if (child == 0)
+			run_harness_child(state, test_func, control_fd, status_fd);
+
+		if (send_message(status_fd, INPROCESS_CHILD_STARTED, child))
+		{
+			kill(child, SIGKILL);
+			_exit(0);
+		}
+		while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+		if (send_message(status_fd, INPROCESS_CHILD_EXITED, status))
+			_exit(0);
+	}
+}
+
+/**
+ * This function stops the harness server and its child, if they are running.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ */
+static void stop_server(inprocess_state_t * state)
+{
+	if (state->control_fd >= 0)
+		close(state->control_fd);
+	if (state->status_fd >= 0)
+		close(state->status_fd);
+	state->control_fd = state->status_fd = -1;
+
+	if (state->child > 0)
+		kill(state->child, SIGKILL);
+	if (state->server > 0)
+	{
+		kill(state->server, SIGKILL);
+		waitpid(state->server, NULL, 0);
+	}
+	state->child = state->server = 0;
+}
+
+/**
+ * This function starts the harness server, and waits for it to load the library and start the first harness child.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ * @return - non-zero on error, zero on success
+ */
+static int start_server(inprocess_state_t * state)
+{
+	inprocess_message_t message;
+	int control[2], status[2];
+
+	if (pipe(control))
+		return 1;
+	if (pipe(status))
+	{
+		close(control[0]);
+		close(control[1]);
+		return 1;
+	}
+
+	state->server = fork();
+	if (state->server < 0)
+	{
+		state->server = 0;
+		close(control[0]);
+		close(control[1]);
+		close(status[0]);
+		close(status[1]);
+		return 1;
+	}
+	if (state->server == 0)
+	{
+		close(control[1]);
+		close(status[0]);
+		run_harness_server(state, control[0], status[1]);
+	}
+
+	close(control[0]);
+	close(status[1]);
+	state->control_fd = control[1];
+	state->status_fd = status[0];
+
+	//Don't let the targets that other drivers start hold the pipes open
+	fcntl(state->control_fd, F_SETFD, FD_CLOEXEC);
+	fcntl(state->status_fd, F_SETFD, FD_CLOEXEC);
+
+	if (read_message(state, INPROCESS_STARTUP_MS, &message) != 1 || message.type != INPROCESS_CHILD_STARTED)
+	{
+		ERROR_MSG("The inprocess driver's harness failed to start");
+		stop_server(state);
+		return 1;
+	}
+	state->child = message.value;
+	return 0;
+}
+
+/**
+ * This function allocates and initializes a new driver specific state object based on the given options.
+ * @param options - a JSON string that contains the driver specific string of options
+ * @param instrumentation - a pointer to an instrumentation instance.  This driver doesn't start a new process for
+ * each input, so the instrumentation isn't used to run the target.
+ * @param instrumentation_state - a pointer to the instrumentation state for the passed in instrumentation
+ * @return - a driver specific state object on success or NULL on failure
+ */
+void * inprocess_create(char * options, instrumentation_t * instrumentation, void * instrumentation_state,
+	mutator_t * mutator, void * mutator_state)
+{
+	inprocess_state_t * state;
+	int num_inputs;
+	size_t *input_sizes;
+
+	//This driver requires at least the path to the library. Make sure we either have both a mutator and state
+	if (!options || !strlen(options) || (mutator && !mutator_state) || (!mutator && mutator_state)) //or neither
+		return NULL;
+
+	state = setup_options(options);
+	if (!state)
+		return NULL;
+
+	if (mutator)
+	{
+		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
+		if (num_inputs != 1 || !(size_t)(input_sizes[0] * state->input_ratio))
+		{
+			free(input_sizes);
+			inprocess_cleanup(state);
+			return NULL;
+		}
+		state->mutate_buffer_length = (size_t)(input_sizes[0] * state->input_ratio);
+		free(input_sizes);
+	}
+
+	//The input is written straight into memory shared with the harness children, so it's never copied to them.
+	//When there's a mutator, this memory is also the mutate buffer.
+	state->input_size = state->mutate_buffer_length > (size_t)state->max_length ?
+		state->mutate_buffer_length : (size_t)state->max_length;
+	state->input = mmap(NULL, state->input_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (state->input == MAP_FAILED)
+	{
+		state->input = NULL;
+		inprocess_cleanup(state);
+		return NULL;
+	}
+
+	if (start_server(state))
+	{
+		inprocess_cleanup(state);
+		return NULL;
+	}
+
+	state->mutator = mutator;
+	state->mutator_state = mutator_state;
+	state->mutate_last_size = -1;
+	state->instrumentation = instrumentation;
+	state->instrumentation_state = instrumentation_state;
+	return state;
+}
+
+/**
+ * This function cleans up all resources with the passed in driver state.
+ * @param driver_state - a driver specific state object previously created by the inprocess_create function
+ * This state object should not be referenced after this function returns.
+ */
+void inprocess_cleanup(void * driver_state)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+
+	stop_server(state);
+	if (state->input)
+		munmap(state->input, state->input_size);
+	dedup_filter_free(&state->dedup_filter);
+	fixups_free(state->fixups);
+	free(state->path);
+	free(state->function);
+	free(state->init_function);
+	free(state);
+}
+
+/**
+ * This function waits for the harness child to finish testing the next input that was sent to it.  If the harness
+ * child crashes or hangs, the harness server starts a new one, which tests the next input on the control pipe.
+ * @param state - the inprocess_state_t object that represents the current state of the driver
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int wait_for_result(inprocess_state_t * state)
+{
+	inprocess_message_t message;
+	uint64_t start_time;
+	int ret;
+
+	//Wait for the harness child that replaces the last one that exited
+	if (!state->child)
+	{
+		if (read_message(state, INPROCESS_STARTUP_MS, &message) != 1 || message.type != INPROCESS_CHILD_STARTED)
+			return FUZZ_ERROR;
+		state->child = message.value;
+	}
+
+	start_time = get_time_ms();
+	ret = read_message(state, state->hang_timeout.timeout_ms, &message);
+	if (ret < 0)
+		return FUZZ_ERROR;
+	if (ret == 0)
+	{
+		//The input hung, so kill the harness child and wait for the server to see that it exited
+		kill(state->child, SIGKILL);
+		state->child = 0;
+		do
+			ret = read_message(state, -1, &message);
+		while (ret == 1 && message.type != INPROCESS_CHILD_EXITED);
+		return ret == 1 ? FUZZ_HANG : FUZZ_ERROR;
+	}
+
+	hang_timeout_record(&state->hang_timeout, get_time_ms() - start_time);
+	if (message.type == INPROCESS_CHILD_DONE)
+		return FUZZ_NONE;
+	if (message.type != INPROCESS_CHILD_EXITED)
+		return FUZZ_ERROR;
+
+	//The library crashed or exited while testing the input
+	state->child = 0;
+	return WIFSIGNALED(message.value) ? FUZZ_CRASH : FUZZ_NONE;
+}
+
+/**
+ * This function tests the given input by calling the library's function in a harness child. This function
+ * blocks until the function has returned.  If the harness child crashes or hangs, a new one is started
+ * for the next input.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_ on success or FUZZ_ERROR on failure
+ */
+int inprocess_test_input(void * driver_state, char * input, size_t length)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	inprocess_request_t request;
+	int result;
+
+	if (length > state->input_size)
+	{
+		ERROR_MSG("Input of %lu bytes is larger than the inprocess driver's max_length (%lu bytes)",
+			(unsigned long)length, (unsigned long)state->input_size);
+		return FUZZ_ERROR;
+	}
+	PHASE_BEGIN(PHASE_DELIVER);
+	if (input != state->input)
+		memcpy(state->input, input, length);
+
+	request.offset = 0;
+	request.length = length;
+	if (write(state->control_fd, &request, sizeof(request)) != sizeof(request))
+		return FUZZ_ERROR;
+	PHASE_END(PHASE_DELIVER);
+
+	PHASE_BEGIN(PHASE_WAIT);
+	result = wait_for_result(state);
+	PHASE_END(PHASE_WAIT);
+	return result;
+}
+
+/**
+ * This function tests several inputs, queuing as many of them as fit in the shared memory for the harness child
+ * at once, so the child doesn't wait for the driver between inputs.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param inputs - an array of the inputs that should be tested
+ * @param lengths - an array of the lengths of the buffers in the inputs parameter
+ * @param count - the number of inputs to test
+ * @param results - an array of count ints, used to return the FUZZ_ result of each input
+ * @return - zero on success, or FUZZ_ERROR on failure
+ */
+int inprocess_test_inputs(void * driver_state, char ** inputs, size_t * lengths, size_t count, int * results)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	inprocess_request_t requests[INPROCESS_MAX_BATCH];
+	size_t i, batch, offset;
+
+	for (i = 0; i < count; i += batch)
+	{
+		//Copy the inputs into the shared memory one after another, until it or the batch is full
+		offset = 0;
+		for (batch = 0; i + batch < count && batch < INPROCESS_MAX_BATCH; batch++)
+		{
+			if (lengths[i + batch] > state->input_size - offset)
+				break;
+			memmove(state->input + offset, inputs[i + batch], lengths[i + batch]);
+			requests[batch].offset = offset;
+			requests[batch].length = lengths[i + batch];
+			offset += lengths[i + batch];
+		}
+		if (batch == 0)
+		{
+			ERROR_MSG("Input of %lu bytes is larger than the inprocess driver's max_length (%lu bytes)",
+				(unsigned long)lengths[i], (unsigned long)state->input_size);
+			return FUZZ_ERROR;
+		}
+
+		//The requests are at most PIPE_BUF bytes, so they're written in one piece
+		if (write(state->control_fd, requests, batch * sizeof(inprocess_request_t)) != (ssize_t)(batch * sizeof(inprocess_request_t)))
+			return FUZZ_ERROR;
+		for (offset = 0; offset < batch; offset++)
+		{
+			results[i + offset] = wait_for_result(state);
+			if (results[i + offset] == FUZZ_ERROR)
+				return FUZZ_ERROR;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function will test the output of the mutator given during driver creation.  This function blocks until
+ * the library has finished processing the input.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @return - FUZZ_ result on success, FUZZ_ERROR on error, -2 if the mutator has finished generating inputs
+ */
+int inprocess_test_next_input(void * driver_state)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	return generic_test_next_input(state, state->mutator, state->mutator_state, state->input,
+		state->mutate_buffer_length, inprocess_test_input, &state->mutate_last_size, &state->dedup_filter, state->fixups);
+}
+
+/**
+ * When this driver is using a mutator given to it during driver creation, this function retrieves
+ * the last input that was tested with the inprocess_test_next_input function.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - NULL on error or if the driver doesn't have a mutator, or a buffer containing the last input
+ * that was tested by the driver with the inprocess_test_next_input function.  This buffer should be freed
+ * by the caller.
+ */
+char * inprocess_get_last_input(void * driver_state, int * length)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return memdup(state->input, state->mutate_last_size);
+}
+
+/**
+ * This function returns the last input that was sent to the target program, without copying it.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - a pointer to the driver's buffer holding the last input, which is only valid until the next
+ * test, or NULL if there isn't one
+ */
+const char * inprocess_peek_last_input(void * driver_state, int * length)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return state->input;
+}
+
+/**
+ * This function escalates the hang timeout that the driver uses for the next tests, so that an input which
+ * timed out can be tested again with a longer timeout.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success
+ */
+int inprocess_escalate_timeout(void * driver_state, double multiplier)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	hang_timeout_escalate(&state->hang_timeout, multiplier);
+	return 0;
+}
+
+/**
+ * This function returns help text for this driver.  This help text will describe the driver and any options
+ * that can be passed to inprocess_create.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int inprocess_help(char ** help_str)
+{
+	*help_str = strdup(
+"inprocess - Calls a function in a shared library with the mutated input,\n"
+"            without starting a new process for each input.  The library is\n"
+"            loaded once, and the function is called in a forked child that\n"
+"            is only replaced after a crash or hang.  The instrumentation\n"
+"            isn't used to run the library, so use return_code\n"
+"Required Options:\n"
+"  path                  The path to the shared library\n"
+"Optional Options:\n"
+"  dedup                 Remember this many of the recently tested inputs, and\n"
+"                          skip mutations that are identical to one of them\n"
+"                          (default 0, disabled)\n"
+"  fixups                An array of the checksum and length fields to rewrite\n"
+"                          in each mutated input, e.g. [{\"type\": \"crc32\",\n"
+"                          \"offset\": -4, \"end\": -4}].  The types are crc32,\n"
+"                          crc32c, adler32 and length, and each field also\n"
+"                          takes start, end, size, big_endian and adjust\n"
+"                          (default none)\n"
+"  function              The function to call with each input, which takes\n"
+"                          the same arguments as LLVMFuzzerTestOneInput\n"
+"                          (default LLVMFuzzerTestOneInput)\n"
+"  init_function         A function to call once after loading the library,\n"
+"                          which takes the same arguments as\n"
+"                          LLVMFuzzerInitialize.  It's skipped if the library\n"
+"                          doesn't have it (default LLVMFuzzerInitialize)\n"
+"  max_length            The largest input that can be tested without a\n"
+"                          mutator (default 1048576)\n"
+"  ratio                 The ratio of mutation buffer size to input size when\n"
+"                          given a mutator\n"
+"  timeout               The maximum number of seconds to wait for the\n"
+"                          function to return\n"
+"  timeout_ms            The maximum number of milliseconds to wait for the\n"
+"                          function to return.  If set, this overrides timeout\n"
+"  adaptive_timeout      Lower the timeout to this multiple of the function's\n"
+"                          99th percentile exec time\n"
+"\n"
+	);
+	if (*help_str == NULL)
+		return -1;
+	return 0;
+}
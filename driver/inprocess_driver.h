@@ -0,0 +1,69 @@
+#pragma once
+#include "driver.h"
+#include "instrumentation.h"
+#include <global_types.h>
+#include <stdint.h>
+#include <sys/types.h>        // for pid_t
+
+void * inprocess_create(char * options, instrumentation_t * instrumentation, void * instrumentation_state,
+	mutator_t * mutator, void * mutator_state);
+void inprocess_cleanup(void * driver_state);
+int inprocess_test_input(void * driver_state, char * buffer, size_t length);
+int inprocess_test_inputs(void * driver_state, char ** inputs, size_t * lengths, size_t count, int * results);
+int inprocess_test_next_input(void * driver_state);
+char * inprocess_get_last_input(void * driver_state, int * length);
+const char * inprocess_peek_last_input(void * driver_state, int * length);
+int inprocess_escalate_timeout(void * driver_state, double multiplier);
+int inprocess_help(char ** help_str);
+
+//The function in the library that tests an input, with the same signature as LLVMFuzzerTestOneInput
+typedef int (*inprocess_test_func_t)(const uint8_t * data, size_t size);
+//The function in the library that is called once before testing any inputs, like LLVMFuzzerInitialize
+typedef int (*inprocess_init_func_t)(int * argc, char *** argv);
+
+struct inprocess_state
+{
+	//Options
+	char * path;            //The path to the shared library to fuzz
+	char * function;        //The name of the function that tests an input
+	char * init_function;   //The name of the function to call once after loading the library
+	int timeout;            //Maximum number of seconds to allow the function to run
+	int timeout_ms;         //Maximum number of milliseconds to allow the function to run, overrides timeout
+	double adaptive_timeout; //Multiple of the p99 exec time to use as the timeout, or 0 to disable
+	int dedup;               //The number of recently tested inputs to remember and skip duplicates of
+	double input_ratio;     //the ratio of the maximum input size
+	int max_length;         //The largest input that can be tested with inprocess_test_input
+
+	//The harness server, which loads the library and forks the harness children that test the inputs
+	pid_t server;
+	int control_fd;         //The pipe used to send the length of each input to the harness child
+	int status_fd;          //The pipe used to read the results from the harness server and child
+
+	//The pid of the harness child that is waiting for the next input, or 0 if a new one hasn't started yet
+	pid_t child;
+
+	//The memory shared with the harness children that holds the input to test
+	char * input;
+	size_t input_size;
+
+	//The hang timeout, calculated from the timeout options
+	hang_timeout_t hang_timeout;
+
+	//The recently tested inputs, which are skipped if a mutation repeats one of them
+	dedup_filter_t dedup_filter;
+
+	//The checksum and length fields to rewrite in each mutated input, or NULL
+	fixups_t * fixups;
+
+	//The instrumentation module
+	instrumentation_t * instrumentation;
+
+	//The instrumentation's state
+	void * instrumentation_state;
+
+	mutator_t * mutator;
+	void * mutator_state;
+	size_t mutate_buffer_length;
+	int mutate_last_size;
+};
+typedef struct inprocess_state inprocess_state_t;
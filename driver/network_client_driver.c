@@ -4,6 +4,7 @@
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h"
+#include "phase_timing.h"
 
 //c headers
 #include <stdio.h>
@@ -18,10 +19,12 @@
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <errno.h>
 #include <string.h>
@@ -29,6 +32,7 @@
 
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
+#define closesocket close
 #endif
 
 /**
@@ -48,26 +52,75 @@ static network_client_state_t * setup_options(char * options)
 	memset(state, 0, sizeof(network_client_state_t));
 
 	//Setup defaults
-	state->timeout = 2;
+	state->timeout = DRIVER_DEFAULT_TIMEOUT;
 	state->input_ratio = 2.0;
 	state->lport = 9999;
+	state->port_range = 1;
 	state->target_ip = strdup("127.0.0.1");
+	state->listener = INVALID_SOCKET;
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", network_client_cleanup);
 	PARSE_OPTION_STRING(state, options, arguments, "arguments", network_client_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout_ms", network_client_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, adaptive_timeout, "adaptive_timeout", network_client_cleanup);
 	PARSE_OPTION_INT(state, options, lport, "port", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, port_range, "port_range", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, instance, "instance", network_client_cleanup);
 	PARSE_OPTION_STRING(state, options, target_ip, "ip", network_client_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", network_client_cleanup);
 	PARSE_OPTION_INT_ARRAY(state, options, sleeps, sleeps_count, "sleeps", network_client_cleanup);
-	
+	PARSE_OPTION_INT(state, options, pace, "pace", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, desocket, "desocket", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, prefix_messages, "prefix_messages", network_client_cleanup);
+
+	if (state->port_range < 1 || state->lport <= 0 || state->lport + state->port_range - 1 > 65535 || state->instance < 0)
+	{
+		ERROR_MSG("Invalid port (%d), port_range (%d) or instance (%d) options", state->lport, state->port_range,
+			state->instance);
+		network_client_cleanup(state);
+		return NULL;
+	}
+	if (state->prefix_messages < 0 || (state->prefix_messages && !state->desocket))
+	{
+		ERROR_MSG("The prefix_messages option must be positive, and requires the desocket option");
+		network_client_cleanup(state);
+		return NULL;
+	}
+
+	//Give each driver instance, i.e. each fuzzing worker, its own port from the range
+	if (state->instance > 0 && !state->desocket)
+	{
+		if (state->instance >= state->port_range)
+		{
+			ERROR_MSG("Each network_client driver needs its own port, but the port_range option only has %d ports. "
+				"Increase port_range and use \"@@\" in the arguments option to pass the port to the target",
+				state->port_range);
+			network_client_cleanup(state);
+			return NULL;
+		}
+		state->lport += state->instance;
+	}
+	if (state->arguments && strstr(state->arguments, "@@"))
+	{
+		char * new_arguments = substitute_port(state->arguments, state->lport);
+		if (!new_arguments)
+		{
+			network_client_cleanup(state);
+			return NULL;
+		}
+		free(state->arguments);
+		state->arguments = new_arguments;
+	}
+
 	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 4;
 	state->cmd_line = (char *)malloc(cmd_length);
 	memset(state->cmd_line, 0, cmd_length);
 
 	if (!state->path || !state->cmd_line || !file_exists(state->path)
-		|| !state->target_ip || !state->lport || state->input_ratio <= 0)
+		|| !state->target_ip || !state->lport || state->input_ratio <= 0
+		|| hang_timeout_init(&state->hang_timeout, state->timeout, state->timeout_ms, state->adaptive_timeout))
 	{
 		network_client_cleanup(state);
 		return NULL;
@@ -78,6 +131,115 @@ static network_client_state_t * setup_options(char * options)
 	return state;
 }
 
+/**
+ * This function creates the socket that the driver listens on for the target's connections.  The socket is
+ * kept open for the life of the driver, so it's only bound once rather than for every test.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ * @param sock - a pointer to a SOCKET used to return the created socket
+ * @return - FUZZ_ERROR error, zero on success
+ */
+#ifdef _WIN32
+static int start_listener(network_client_state_t * state, SOCKET * sock)
+#else
+static int start_listener(network_client_state_t * state, int * sock)
+#endif
+{
+	struct sockaddr_in addr;
+	int iResult = 0;
+	*sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (*sock == INVALID_SOCKET)
+	{
+#ifdef _WIN32
+		ERROR_MSG("socket function failed with error: %ld", WSAGetLastError());
+#else
+		ERROR_MSG("socket function failed with error: %d", errno);
+#endif
+		return FUZZ_ERROR;
+	}
+
+#ifndef _WIN32 // Linux
+	// Set SO_REUSEADDR so you reuse the address instead of waiting for a minute.
+	// https://stackoverflow.com/a/24194999
+	int enable = 1;
+	if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+		FATAL_MSG("setsockopt failed.\n");
+	// Keep the targets from inheriting the listener, so that one that leaves a child
+	// behind doesn't hold the port and stop the next driver from binding it.
+	fcntl(*sock, F_SETFD, FD_CLOEXEC);
+#endif
+
+	//Create socket (TCP Only right now)
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(state->target_ip);
+	addr.sin_port = htons(state->lport);
+
+	//Now bind to the socket
+	iResult = bind(*sock, (const struct sockaddr *)& addr, sizeof(addr));
+
+	if (iResult == SOCKET_ERROR)
+	{
+#ifdef _WIN32
+		ERROR_MSG("Socket failed to bind to port. Error code: %d", WSAGetLastError());
+		iResult = closesocket(*sock);
+		if (iResult == SOCKET_ERROR)
+			ERROR_MSG("closesocket function failed with error %d", WSAGetLastError());
+#else
+		ERROR_MSG("Socket failed to bind to port. Error code: %d", errno);
+		iResult = close(*sock);
+		if (iResult == SOCKET_ERROR)
+			ERROR_MSG("closesocket function failed with error %d", errno);
+#endif
+		*sock = INVALID_SOCKET;
+		return FUZZ_ERROR;
+	}
+
+	//Now put the socket into LISTEN state
+	if (listen(*sock, SOMAXCONN) == SOCKET_ERROR)
+	{
+#ifdef _WIN32
+		ERROR_MSG("listen function failed with error: %d", WSAGetLastError());
+#else
+		ERROR_MSG("listen function failed with error: %d", errno);
+#endif
+		closesocket(*sock);
+		*sock = INVALID_SOCKET;
+		return FUZZ_ERROR;
+	}
+
+	return FUZZ_NONE;
+}
+
+/**
+ * This function closes any connections that are waiting to be accepted on the driver's listening socket, such as
+ * one from a previous target that connected after the driver gave up on it, so that the next accept gets the
+ * connection from the target that's about to be started.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ */
+static void drain_listener(network_client_state_t * state)
+{
+	struct timeval tv;
+	fd_set fds;
+#ifdef _WIN32
+	SOCKET sock;
+#else
+	int sock;
+#endif
+
+	while (1)
+	{
+		FD_ZERO(&fds);
+		FD_SET(state->listener, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		if (select((int)state->listener + 1, &fds, NULL, NULL, &tv) <= 0)
+			return;
+		sock = accept(state->listener, NULL, NULL);
+		if (sock == INVALID_SOCKET)
+			return;
+		closesocket(sock);
+	}
+}
+
 /**
  * This function allocates and initializes a new driver specific state object based on the given options.
  * @param options - a JSON string that contains the driver specific string of options
@@ -113,6 +275,27 @@ void * network_client_create(char * options, instrumentation_t * instrumentation
 	state = setup_options(options);
 	if (!state)
 		return NULL;
+
+	if (state->desocket)
+	{
+#ifdef _WIN32
+		ERROR_MSG("The desocket option requires the fork server library, which isn't available on Windows");
+		network_client_cleanup(state);
+		return NULL;
+#else
+		if (desocket_enable(state->lport, state->prefix_messages))
+		{
+			network_client_cleanup(state);
+			return NULL;
+		}
+#endif
+	}
+	else if (start_listener(state, &state->listener))
+	{
+		network_client_cleanup(state);
+		return NULL;
+	}
+
 	if (mutator)
 	{
 		mutator->get_input_info(mutator_state, &state->num_inputs, &state->mutate_buffer_lengths);
@@ -180,6 +363,9 @@ void network_client_cleanup(void * driver_state)
 	free(state->mutate_buffer_lengths);
 	free(state->mutate_last_sizes);
 
+	if (state->listener != INVALID_SOCKET)
+		closesocket(state->listener);
+
 	//Clean up driver specific options
 	free(state->path);
 	free(state->arguments);
@@ -191,77 +377,37 @@ void network_client_cleanup(void * driver_state)
 	free(state);
 }
 
+#ifndef _WIN32
 /**
- * This function creates a socket and waits for a client to connect.
+ * This function tests the given inputs in desocket mode.  Rather than listening for the target to connect and
+ * sending the inputs over the network, the inputs are given to the instrumentation the same way the stdin driver
+ * gives it input, and the fork server library in the target feeds them through the target's socket.
  * @param state - the network_client_state_t object that represents the current state of the driver
- * @param sock - a pointer to a SOCKET used to return the created socket
- * @return - FUZZ_ERROR error, zero on success
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH on success or FUZZ_ERROR on failure
  */
-#ifdef _WIN32
-static int start_listener(network_client_state_t * state, SOCKET * sock)
-#else
-static int start_listener(network_client_state_t * state, int * sock)
-#endif
+static int network_client_run_desocket(network_client_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
 {
-	struct sockaddr_in addr;
-	int iResult = 0;
-	*sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (*sock == INVALID_SOCKET)
-	{
-#ifdef _WIN32
-		ERROR_MSG("socket function failed with error: %ld", WSAGetLastError());
-#else
-		ERROR_MSG("socket function failed with error: %d", errno);
-#endif
-		return FUZZ_ERROR;
-	}
+	char * input;
+	size_t length;
+	int result;
 
-#ifndef _WIN32 // Linux
-	// Set SO_REUSEADDR so you reuse the address instead of waiting for a minute.
-	// https://stackoverflow.com/a/24194999
-	int enable = 1;
-	if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
-		FATAL_MSG("setsockopt failed.\n");
-#endif
-
-	//Create socket (TCP Only right now)
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(state->target_ip);
-	addr.sin_port = htons(state->lport);
-
-	//Now bind to the socket
-	iResult = bind(*sock, (const struct sockaddr *)& addr, sizeof(addr));
-
-	if (iResult == SOCKET_ERROR)
-	{
-#ifdef _WIN32
-		ERROR_MSG("Socket failed to bind to port. Error code: %d", WSAGetLastError());
-		iResult = closesocket(*sock);
-		if (iResult == SOCKET_ERROR)
-			ERROR_MSG("closesocket function failed with error %d", WSAGetLastError());
-#else
-		ERROR_MSG("Socket failed to bind to port. Error code: %d", errno);
-		iResult = close(*sock);
-		if (iResult == SOCKET_ERROR)
-			ERROR_MSG("closesocket function failed with error %d", errno);
-#endif
+	input = desocket_encode_inputs(inputs, lengths, inputs_count, &length);
+	if (!input)
 		return FUZZ_ERROR;
-	}
-
-	//Now put the socket into LISTEN state
-	if (listen(*sock, SOMAXCONN) == SOCKET_ERROR)
-	{
-#ifdef _WIN32
-		ERROR_MSG("listen function failed with error: %d", WSAGetLastError());
+	PHASE_BEGIN(PHASE_ENABLE);
+	result = state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, input, length);
+	PHASE_END(PHASE_ENABLE);
+	free(input);
+	if (result)
 		return FUZZ_ERROR;
-#else
-		ERROR_MSG("listen function failed with error: %d", errno);
-		return FUZZ_ERROR;
-#endif
-	}
 
-	return FUZZ_NONE;
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
+		state->instrumentation, state->instrumentation_state);
 }
+#endif
 
 /**
  * This function will run the fuzzed program and test it with the given inputs. This function
@@ -275,26 +421,27 @@ static int start_listener(network_client_state_t * state, int * sock)
 static int network_client_run(network_client_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
 {
 #ifdef _WIN32
-	SOCKET serverSock;
 	SOCKET clientSock;
 #else
-	int serverSock;
 	int clientSock;
 #endif
 	size_t i;
 	int sock_ret;
 
-	//Start the server socket so the client can connect below:
-	if (start_listener(state, &serverSock))
-	{
-		return FUZZ_ERROR;
-	}
+#ifndef _WIN32
+	if (state->desocket)
+		return network_client_run_desocket(state, inputs, lengths, inputs_count);
+#endif
+
+	drain_listener(state);
 
 	//Have the instrumentation start the new process, since it needs to do so in a custom environment
+	PHASE_BEGIN(PHASE_ENABLE);
 	state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0);
+	PHASE_END(PHASE_ENABLE);
 
 	//Now accept the client connection
-	clientSock = accept(serverSock, NULL, NULL);
+	clientSock = accept(state->listener, NULL, NULL);
 
 	if (clientSock == INVALID_SOCKET)
 	{
@@ -306,20 +453,11 @@ static int network_client_run(network_client_state_t * state, char ** inputs, si
 		return FUZZ_ERROR;
 	}
 
-#ifdef _WIN32
-	closesocket(serverSock);
-#else
-	close(serverSock);
-#endif
-
+	PHASE_BEGIN(PHASE_DELIVER);
 	for (i = 0; i < inputs_count; i++)
 	{
 		if (state->sleeps && state->sleeps[i] != 0)
-#ifdef _WIN32
-			Sleep(state->sleeps[i]);
-#else
-			usleep(1000*state->sleeps[i]);
-#endif
+			wait_before_message(&clientSock, state->sleeps[i], state->pace, i > 0);
 		sock_ret = send_tcp_input(&clientSock, inputs[i], lengths[i]);
 		if (sock_ret)
 		{
@@ -332,14 +470,11 @@ static int network_client_run(network_client_state_t * state, char ** inputs, si
 			return FUZZ_ERROR;
 		}
 	}
-#ifdef _WIN32
 	closesocket(clientSock);
-#else
-	close(clientSock);
-#endif
-	
+	PHASE_END(PHASE_DELIVER);
+
 	//Wait for it to be done
-	return generic_wait_for_process_completion(state->process, state->timeout, 
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout, 
 		state->instrumentation, state->instrumentation_state);
 }
 /**
@@ -434,6 +569,20 @@ char * network_client_get_last_input(void * driver_state, int * length)
 		state->mutate_last_sizes, state->num_inputs, length);
 }
 
+/**
+ * This function escalates the hang timeout that the driver uses for the next tests, so that an input which
+ * timed out can be tested again with a longer timeout.
+ * @param driver_state - a driver specific structure previously created by the network_client_create function
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success
+ */
+int network_client_escalate_timeout(void * driver_state, double multiplier)
+{
+	network_client_state_t * state = (network_client_state_t *)driver_state;
+	hang_timeout_escalate(&state->hang_timeout, multiplier);
+	return 0;
+}
+
 /**
  * This function returns help text for this driver.  This help text will describe the driver and any options
  * that can be passed to network_client_create.
@@ -449,14 +598,45 @@ int network_client_help(char ** help_str)
 "Optional Options:\n"
 "  timeout               The maximum number of seconds to wait\n"
 "                          for the target process to finish\n"
+"  timeout_ms            The maximum number of milliseconds to wait\n"
+"                          for the target process to finish.  If set,\n"
+"                          this overrides timeout\n"
+"  adaptive_timeout      Lower the timeout to this multiple of the\n"
+"                          target process's 99th percentile exec time\n"
 "  ratio                 The ratio of mutation buffer size to\n"
 "                          input size when given a mutator\n"
 "  ip                    The target IP to connect to\n"
 "  port                  The target port to connect to\n"
+"  port_range            The number of ports, starting at port, to give\n"
+"                          out when there are several fuzzing workers.\n"
+"                          Each worker listens on its own port; \"@@\" in\n"
+"                          the arguments is replaced with that port\n"
+"  instance              Which of several fuzzing workers the driver is for,\n"
+"                          which the fuzzer sets, and so which port of the\n"
+"                          range it listens on (default 0)\n"
 "  ratio                 The ratio of mutation buffer size to input\n"
 "                          size when given a mutator\n"
 "  sleeps                An array of milliseconds to wait between each\n"
 "                          input being sent to the target program\n"
+"  pace                  Whether to treat the sleeps as the longest time\n"
+"                          to wait (1) or always wait that long (0).  When\n"
+"                          pacing, the driver stops waiting once the target\n"
+"                          responds or, on Linux, once the target has read\n"
+"                          the previous inputs\n"
+"  desocket              Whether to pass the input to the target through\n"
+"                          the fork server library's socket emulation (1),\n"
+"                          rather than the network (0).  The target must be\n"
+"                          run with the fork server library, i.e. with the\n"
+"                          return_code or ipt instrumentation and its fork\n"
+"                          server enabled.  The sleeps option is ignored in\n"
+"                          this mode\n"
+"  prefix_messages       In desocket mode, snapshot the target once it has\n"
+"                          read this many messages, and run the later inputs\n"
+"                          that start with the same messages from the\n"
+"                          snapshot (default 0, no snapshots).  The target\n"
+"                          must wait for the next message with read, recv,\n"
+"                          recvfrom, recvmsg, or poll, and be run with\n"
+"                          the return_code instrumentation\n"
 "\n"
 	);
 
@@ -13,6 +13,7 @@ void network_client_cleanup(void * driver_state);
 int network_client_test_input(void * driver_state, char * buffer, size_t length);
 int network_client_test_next_input(void * driver_state);
 char * network_client_get_last_input(void * driver_state, int * length);
+int network_client_escalate_timeout(void * driver_state, double multiplier);
 int network_client_help(char ** help_str);
 
 struct network_client_state
@@ -21,11 +22,18 @@ struct network_client_state
 	char * path;            //The path to the fuzzed executable
 	char * arguments;       //Arguments to give the binary
 	int timeout;            //Maximum number of seconds to allow the executable to run
+	int timeout_ms;         //Maximum number of milliseconds to allow the executable to run, overrides timeout
+	double adaptive_timeout; //Multiple of the p99 exec time to use as the timeout, or 0 to disable
 	char * target_ip;       //The IP address to send the fuzzed data to
 	int lport;        //The port to send the fuzzed data to
+	int port_range;         //The number of ports, starting at lport, that the driver instances can listen on
+	int instance;           //Which of the process's fuzzing workers the driver is for, to give each its own port
 	double input_ratio;     //the ratio of the maximum input size
 	int * sleeps;           //How many milliseconds to sleep between inputs
 	int sleeps_count;       //The number of items in the sleeps array
+	int pace;               //Stop sleeping between inputs once the target is ready for the next one
+	int desocket;           //Pass the inputs through the fork server library's socket emulation, rather than the network
+	int prefix_messages;    //In desocket mode, the number of messages to snapshot the target after, or 0 to not snapshot
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -34,6 +42,16 @@ struct network_client_state
 	pid_t process;
 	#endif
 
+	//The socket the driver listens on for the target's connections, kept open for the life of the driver
+	#ifdef _WIN32
+	SOCKET listener;
+	#else
+	int listener;
+	#endif
+
+	//The hang timeout, calculated from the timeout options
+	hang_timeout_t hang_timeout;
+
 	//command line of the fuzzed process
 	char * cmd_line;
 
@@ -1,9 +1,13 @@
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define _GNU_SOURCE // sendmmsg and recvmmsg
+#endif
 #include "network_server_driver.h"
 
 #include <utils.h>
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h"
+#include "phase_timing.h"
 
 //c headers
 #include <stdio.h>
@@ -19,6 +23,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/select.h>
 #if __APPLE__
 #include <sys/sysctl.h>
 #include <sys/socketvar.h>
@@ -27,9 +34,80 @@
 #else
 #include <sys/socket.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 #endif // __APPLE__
 #endif
 
+#ifdef _WIN32
+#define NO_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#define SHUTDOWN_SEND SD_SEND
+#else
+#define NO_SOCKET -1
+#define close_socket close
+#define SHUTDOWN_SEND SHUT_WR
+#endif
+
+#define PERSISTENT_POLL_MS 1
+#define TCP_LISTEN_STATE 0x0A //The state /proc/net/tcp lists listening sockets in
+#define LISTEN_POLL_MIN_US 100
+#define LISTEN_POLL_MAX_US 1000
+#define UDP_BATCH_SIZE 16       //The most datagrams to send or receive in one system call
+#define UDP_MAX_DATAGRAM 65536  //The size of the buffer for each received datagram
+#define UDP_MAX_RESPONSES 256   //The most datagrams from the target to keep for each input
+
+#ifndef _WIN32
+static int setup_instances(network_server_state_t * state);
+static void cleanup_instances(network_server_state_t * state);
+#endif
+
+/**
+ * This function frees the responses collected from the target for the last input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ */
+static void free_responses(network_server_state_t * state)
+{
+	size_t i;
+
+	for (i = 0; i < state->responses_count; i++)
+		free(state->responses[i]);
+	free(state->responses);
+	free(state->response_lengths);
+	state->responses = NULL;
+	state->response_lengths = NULL;
+	state->responses_count = 0;
+}
+
+/**
+ * This function builds the command line that runs the fuzzed program, with the given port in place of each "@@"
+ * in the arguments.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param port - the port to put in the arguments
+ * @return - the newly allocated command line, or NULL on failure
+ */
+static char * build_cmd_line(network_server_state_t * state, int port)
+{
+	char * arguments = state->arguments, * cmd_line;
+	size_t cmd_length;
+
+	if (arguments && strstr(arguments, "@@"))
+	{
+		arguments = substitute_port(arguments, port);
+		if (!arguments)
+			return NULL;
+	}
+	cmd_length = strlen(state->path) + (arguments ? strlen(arguments) : 0) + 2;
+	cmd_line = (char *)malloc(cmd_length);
+	if (cmd_line)
+		snprintf(cmd_line, cmd_length, "%s %s", state->path, arguments ? arguments : "");
+	if (arguments != state->arguments)
+		free(arguments);
+	return cmd_line;
+}
+
 /**
  * This function creates a network_server_state_t object based on the given options.
  * @param options - A JSON string of the options to set in the new network_server_state_t. See the
@@ -39,7 +117,6 @@
 static network_server_state_t * setup_options(char * options)
 {
 	network_server_state_t * state;
-	size_t cmd_length;
 
 	state = (network_server_state_t *)malloc(sizeof(network_server_state_t));
 	if (!state)
@@ -47,30 +124,66 @@ static network_server_state_t * setup_options(char * options)
 	memset(state, 0, sizeof(network_server_state_t));
 
 	//Setup defaults
-	state->timeout = 2;
+	state->timeout = DRIVER_DEFAULT_TIMEOUT;
 	state->input_ratio = 2.0;
+	state->persistent_max_cnt = 1000;
+	state->persistent_wait_ms = 100;
+	state->sock = NO_SOCKET;
+	state->instances = 1;
+	state->netns_fd = state->host_netns_fd = -1;
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", network_server_cleanup);
 	PARSE_OPTION_STRING(state, options, arguments, "arguments", network_server_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout_ms", network_server_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, adaptive_timeout, "adaptive_timeout", network_server_cleanup);
 	PARSE_OPTION_INT(state, options, target_port, "port", network_server_cleanup);
 	PARSE_OPTION_STRING(state, options, target_ip, "ip", network_server_cleanup);
 	PARSE_OPTION_INT(state, options, target_udp, "udp", network_server_cleanup);
 	PARSE_OPTION_INT(state, options, skip_network_check, "skip_network_check", network_server_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", network_server_cleanup);
 	PARSE_OPTION_INT_ARRAY(state, options, sleeps, sleeps_count, "sleeps", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, pace, "pace", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, persistent, "persistent", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, persistent_max_cnt, "persistent_max_cnt", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, persistent_wait_ms, "persistent_wait_ms", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, keep_connection, "keep_connection", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, desocket, "desocket", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, prefix_messages, "prefix_messages", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, udp_responses, "udp_responses", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, instances, "instances", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, netns, "netns", network_server_cleanup);
 
-	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 2;
-	state->cmd_line = (char *)malloc(cmd_length);
-
-	if (!state->path || !state->cmd_line || !file_exists(state->path) || !state->target_ip || !state->target_port || state->input_ratio <= 0)
+	if (state->instances < 1 || state->instances > NETWORK_SERVER_MAX_INSTANCES
+		|| (state->instances > 1 && (state->persistent || state->desocket || state->udp_responses
+			|| state->target_port + state->instances - 1 > 65535)))
+	{
+		ERROR_MSG("The instances option must be between 1 and %d, and can't be used with the persistent, desocket "
+			"or udp_responses options", NETWORK_SERVER_MAX_INSTANCES);
+		network_server_cleanup(state);
+		return NULL;
+	}
+	if (state->instances > 1 && (!state->arguments || !strstr(state->arguments, "@@")))
 	{
+		ERROR_MSG("Each of the target instances needs its own port, so use \"@@\" in the arguments option to pass "
+			"the port to the target");
 		network_server_cleanup(state);
 		return NULL;
 	}
 
-	snprintf(state->cmd_line, cmd_length, "%s %s", state->path, state->arguments ? state->arguments : "");
+	if (state->path)
+		state->cmd_line = build_cmd_line(state, state->target_port);
+
+	if (!state->path || !state->cmd_line || !file_exists(state->path) || !state->target_ip || !state->target_port || state->input_ratio <= 0
+		|| state->persistent_max_cnt <= 0 || state->persistent_wait_ms < 0 || (state->keep_connection && !state->persistent)
+		|| (state->desocket && state->persistent) || state->prefix_messages < 0 || (state->prefix_messages && !state->desocket)
+		|| (state->udp_responses && (!state->target_udp || state->desocket))
+		|| hang_timeout_init(&state->hang_timeout, state->timeout, state->timeout_ms, state->adaptive_timeout))
+	{
+		network_server_cleanup(state);
+		return NULL;
+	}
 
 	return state;
 }
@@ -85,6 +198,17 @@ void network_server_cleanup(void * driver_state)
 	network_server_state_t * state = (network_server_state_t *)driver_state;
 	int i;
 
+	if (state->sock != NO_SOCKET)
+		close_socket(state->sock);
+	free_responses(state);
+#ifndef _WIN32
+	cleanup_instances(state);
+	if (state->netns_fd >= 0)
+		close(state->netns_fd);
+	if (state->host_netns_fd >= 0)
+		close(state->host_netns_fd);
+#endif
+
 	//Cleanup mutator stuff
 	for(i = 0; state->mutate_buffers && i < state->num_inputs; i++)
 		free(state->mutate_buffers[i]);
@@ -135,6 +259,44 @@ void * network_server_create(char * options, instrumentation_t * instrumentation
 	if (!state)
 		return NULL;
 
+	if (state->netns)
+	{
+#if defined(_WIN32) || __APPLE__
+		ERROR_MSG("The netns option requires Linux network namespaces");
+		network_server_cleanup(state);
+		return NULL;
+#else
+		//Only the loopback interface is set up in the namespace
+		if (strncmp(state->target_ip, "127.", 4))
+		{
+			ERROR_MSG("The netns option requires a loopback ip, such as 127.0.0.1");
+			network_server_cleanup(state);
+			return NULL;
+		}
+		state->netns_fd = netns_create(&state->host_netns_fd);
+		if (state->netns_fd < 0)
+		{
+			network_server_cleanup(state);
+			return NULL;
+		}
+#endif
+	}
+
+	if (state->desocket)
+	{
+#ifdef _WIN32
+		ERROR_MSG("The desocket option requires the fork server library, which isn't available on Windows");
+		network_server_cleanup(state);
+		return NULL;
+#else
+		if (desocket_enable(state->target_port, state->prefix_messages))
+		{
+			network_server_cleanup(state);
+			return NULL;
+		}
+#endif
+	}
+
 	if (mutator)
 	{
 		mutator->get_input_info(mutator_state, &state->num_inputs, &state->mutate_buffer_lengths);
@@ -171,6 +333,21 @@ void * network_server_create(char * options, instrumentation_t * instrumentation
 
 	state->instrumentation = instrumentation;
 	state->instrumentation_state = instrumentation_state;
+
+	if (state->instances > 1)
+	{
+#ifdef _WIN32
+		ERROR_MSG("The instances option isn't supported on Windows");
+		network_server_cleanup(state);
+		return NULL;
+#else
+		if (setup_instances(state))
+		{
+			network_server_cleanup(state);
+			return NULL;
+		}
+#endif
+	}
 	return state;
 }
 
@@ -178,12 +355,13 @@ void * network_server_create(char * options, instrumentation_t * instrumentation
  * This function creates a socket and (when using TCP) connects it to the fuzzed program.
  * @param state - the network_server_state_t object that represents the current state of the driver
  * @param sock - a pointer to a SOCKET used to return the created socket
+ * @param port - the port the fuzzed program listens on
  * @return - non-zero on error, zero on success
  */
 #ifdef _WIN32
-static int connect_to_target(network_server_state_t * state, SOCKET * sock)
+static int connect_to_target(network_server_state_t * state, SOCKET * sock, int port)
 #else
-static int connect_to_target(network_server_state_t * state, int * sock)
+static int connect_to_target(network_server_state_t * state, int * sock, int port)
 #endif
 {
 	struct sockaddr_in addr;
@@ -203,7 +381,7 @@ static int connect_to_target(network_server_state_t * state, int * sock)
 	{
 		addr.sin_family = AF_INET;
 		addr.sin_addr.s_addr = inet_addr(state->target_ip);
-		addr.sin_port = htons(state->target_port);
+		addr.sin_port = htons(port);
 #ifdef _WIN32
 		if (connect(*sock, (const struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
 			closesocket(*sock);
@@ -218,24 +396,26 @@ static int connect_to_target(network_server_state_t * state, int * sock)
 	return 0;
 }
 
+#if defined(_WIN32) || defined(__APPLE__)
 /**
- * This function sends the provided buffer on the UDP socket
+ * This function sends the provided buffer on the UDP socket.  It's only needed where sendmmsg isn't available.
  * @param state - the network_server_state_t object that represents the current state of the driver
  * @param sock - a pointer to a UDP SOCKET to send the buffer on
+ * @param port - the port to send the buffer to
  * @param buffer - the buffer to send
  * @param length - the length of the buffer parameter
  * @return - non-zero on error, zero on success
  */
 #ifdef _WIN32
-static int send_udp_input(network_server_state_t * state, SOCKET * sock, char * buffer, size_t length)
+static int send_udp_input(network_server_state_t * state, SOCKET * sock, int port, char * buffer, size_t length)
 #else
-static int send_udp_input(network_server_state_t * state, int * sock, char * buffer, size_t length)
+static int send_udp_input(network_server_state_t * state, int * sock, int port, char * buffer, size_t length)
 #endif
 {
 	struct sockaddr_in addr;
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = inet_addr(state->target_ip);
-	addr.sin_port = htons(state->target_port);
+	addr.sin_port = htons(port);
 #ifdef _WIN32
 	if (sendto(*sock, buffer, length, 0, (const struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR)
 #else
@@ -244,6 +424,248 @@ static int send_udp_input(network_server_state_t * state, int * sock, char * buf
 		return 1;
 	return 0;
 }
+#endif
+
+/**
+ * This function sends several datagrams on the UDP socket, one per buffer.  On Linux, the datagrams are sent
+ * with as few sendmmsg calls as possible, rather than one sendto call each.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a pointer to a UDP SOCKET to send the buffers on
+ * @param port - the port to send the buffers to
+ * @param inputs - an array of buffers to send
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - non-zero on error, zero on success
+ */
+#ifdef _WIN32
+static int send_udp_inputs(network_server_state_t * state, SOCKET * sock, int port, char ** inputs, size_t * lengths, size_t inputs_count)
+#else
+static int send_udp_inputs(network_server_state_t * state, int * sock, int port, char ** inputs, size_t * lengths, size_t inputs_count)
+#endif
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	struct mmsghdr messages[UDP_BATCH_SIZE];
+	struct iovec iovecs[UDP_BATCH_SIZE];
+	struct sockaddr_in addr;
+	size_t i, batch, sent = 0;
+	int ret;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(state->target_ip);
+	addr.sin_port = htons(port);
+
+	while (sent < inputs_count)
+	{
+		batch = inputs_count - sent > UDP_BATCH_SIZE ? UDP_BATCH_SIZE : inputs_count - sent;
+		memset(messages, 0, sizeof(messages));
+		for (i = 0; i < batch; i++)
+		{
+			iovecs[i].iov_base = inputs[sent + i];
+			iovecs[i].iov_len = lengths[sent + i];
+			messages[i].msg_hdr.msg_name = &addr;
+			messages[i].msg_hdr.msg_namelen = sizeof(addr);
+			messages[i].msg_hdr.msg_iov = &iovecs[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		//sendmmsg can return before sending the whole batch, in which case the rest is sent in the next call
+		ret = sendmmsg(*sock, messages, batch, 0);
+		if (ret <= 0)
+			return 1;
+		sent += ret;
+	}
+	return 0;
+#else
+	size_t i;
+
+	for (i = 0; i < inputs_count; i++)
+	{
+		if (send_udp_input(state, sock, port, inputs[i], lengths[i]))
+			return 1;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * This function saves a datagram received from the target as one of the responses to the last input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param buffer - the datagram that was received
+ * @param length - the length of the buffer parameter
+ * @return - non-zero on error, zero on success
+ */
+static int add_response(network_server_state_t * state, char * buffer, size_t length)
+{
+	char ** responses;
+	size_t * response_lengths;
+
+	responses = realloc(state->responses, (state->responses_count + 1) * sizeof(char *));
+	if (!responses)
+		return 1;
+	state->responses = responses;
+	response_lengths = realloc(state->response_lengths, (state->responses_count + 1) * sizeof(size_t));
+	if (!response_lengths)
+		return 1;
+	state->response_lengths = response_lengths;
+
+	state->responses[state->responses_count] = malloc(length ? length : 1);
+	if (!state->responses[state->responses_count])
+		return 1;
+	memcpy(state->responses[state->responses_count], buffer, length);
+	state->response_lengths[state->responses_count] = length;
+	state->responses_count++;
+	return 0;
+}
+
+/**
+ * This function collects the datagrams the target has sent back on the UDP socket, without waiting for more to
+ * arrive.  On Linux, they are read with as few recvmmsg calls as possible.  At most UDP_MAX_RESPONSES datagrams
+ * are kept, and the rest are discarded.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a pointer to the UDP SOCKET the inputs were sent on
+ * @return - non-zero on error, zero on success
+ */
+#ifdef _WIN32
+static int collect_udp_responses(network_server_state_t * state, SOCKET * sock)
+#else
+static int collect_udp_responses(network_server_state_t * state, int * sock)
+#endif
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	struct mmsghdr messages[UDP_BATCH_SIZE];
+	struct iovec iovecs[UDP_BATCH_SIZE];
+	char * buffers;
+	int i, received;
+
+	buffers = malloc(UDP_BATCH_SIZE * UDP_MAX_DATAGRAM);
+	if (!buffers)
+		return 1;
+	do
+	{
+		memset(messages, 0, sizeof(messages));
+		for (i = 0; i < UDP_BATCH_SIZE; i++)
+		{
+			iovecs[i].iov_base = buffers + i * UDP_MAX_DATAGRAM;
+			iovecs[i].iov_len = UDP_MAX_DATAGRAM;
+			messages[i].msg_hdr.msg_iov = &iovecs[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		received = recvmmsg(*sock, messages, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		for (i = 0; i < received; i++)
+		{
+			if (state->responses_count < UDP_MAX_RESPONSES
+				&& add_response(state, (char *)iovecs[i].iov_base, messages[i].msg_len))
+			{
+				free(buffers);
+				return 1;
+			}
+		}
+	} while (received == UDP_BATCH_SIZE);
+	free(buffers);
+	return 0;
+#else
+	struct timeval poll_time;
+	fd_set read_fds;
+	char * buffer;
+	int received;
+
+	buffer = malloc(UDP_MAX_DATAGRAM);
+	if (!buffer)
+		return 1;
+	while (1)
+	{
+		FD_ZERO(&read_fds);
+		FD_SET(*sock, &read_fds);
+		poll_time.tv_sec = 0;
+		poll_time.tv_usec = 0;
+		if (select((int)*sock + 1, &read_fds, NULL, NULL, &poll_time) <= 0)
+			break;
+		received = recvfrom(*sock, buffer, UDP_MAX_DATAGRAM, 0, NULL, NULL);
+		if (received < 0)
+			break;
+		if (state->responses_count < UDP_MAX_RESPONSES && add_response(state, buffer, received))
+		{
+			free(buffer);
+			return 1;
+		}
+	}
+	free(buffer);
+	return 0;
+#endif
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function uses the kernel's sock_diag netlink interface to determine if there is a program listening on
+ * the specified port on the local computer.  Unlike /proc/net/tcp, the kernel only returns the sockets in the
+ * requested state, and IPv6 sockets (which also accept IPv4 connections) are included.
+ * @param port - the port number to check
+ * @param udp - whether the specified port is udp (1) or tcp (0)
+ * @return - 1 if the port is listening, 0 if the port is not listening, or -1 if sock_diag isn't available
+ */
+static int is_port_listening_sock_diag(int port, int udp)
+{
+	struct {
+		struct nlmsghdr header;
+		struct inet_diag_req_v2 request;
+	} message;
+	struct sockaddr_nl kernel;
+	char buffer[8192];
+	struct nlmsghdr * reply;
+	struct inet_diag_msg * diag;
+	int families[] = { AF_INET, AF_INET6 };
+	int sock, i, received, done, found = 0;
+
+	sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (sock < 0)
+		return -1;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	for (i = 0; i < 2 && !found; i++)
+	{
+		memset(&message, 0, sizeof(message));
+		message.header.nlmsg_len = sizeof(message);
+		message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+		message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		message.request.sdiag_family = families[i];
+		message.request.sdiag_protocol = udp ? IPPROTO_UDP : IPPROTO_TCP;
+		//Bound UDP sockets that aren't connected are reported in the closed state
+		message.request.idiag_states = udp ? (1 << TCP_CLOSE) : (1 << TCP_LISTEN);
+		if (sendto(sock, &message, sizeof(message), 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+			close(sock);
+			return -1;
+		}
+
+		//Read the whole dump, even after finding the port, so the next request doesn't see the rest of it
+		done = 0;
+		while (!done)
+		{
+			received = recv(sock, buffer, sizeof(buffer), 0);
+			if (received <= 0) {
+				close(sock);
+				return -1;
+			}
+			for (reply = (struct nlmsghdr *)buffer; NLMSG_OK(reply, received); reply = NLMSG_NEXT(reply, received))
+			{
+				if (reply->nlmsg_type == NLMSG_DONE) {
+					done = 1;
+					break;
+				}
+				if (reply->nlmsg_type == NLMSG_ERROR) {
+					close(sock);
+					return -1;
+				}
+				diag = (struct inet_diag_msg *)NLMSG_DATA(reply);
+				if (ntohs(diag->id.idiag_sport) == port)
+					found = 1;
+			}
+		}
+	}
+
+	close(sock);
+	return found;
+}
+#endif
 
 /**
  * This function determines if there is a program listening on the specified port on the local computer
@@ -278,12 +700,13 @@ static int is_port_listening(int port, int udp)
 		free(udp_table);
 
 	} else {
-		if (GetTcpTable(NULL, &size, TRUE) != ERROR_INSUFFICIENT_BUFFER)
+		//Only ask for the listening sockets, so the table doesn't grow with the connections made to old targets
+		if (GetExtendedTcpTable(NULL, &size, FALSE, AF_INET, TCP_TABLE_BASIC_LISTENER, 0) != ERROR_INSUFFICIENT_BUFFER)
 			return -1;
 		tcp_table = malloc(size);
 		if (!tcp_table)
 			return -1;
-		if (GetTcpTable(tcp_table, &size, TRUE) != NO_ERROR) {
+		if (GetExtendedTcpTable(tcp_table, &size, FALSE, AF_INET, TCP_TABLE_BASIC_LISTENER, 0) != NO_ERROR) {
 			free(tcp_table);
 			return -1;
 		}
@@ -345,9 +768,15 @@ static int is_port_listening(int port, int udp)
 
 #else // Linux
 	char line[250];
-	FILE * tcp_info = fopen("/proc/net/tcp","r");
-	int num, port_from_proc;
+	FILE * tcp_info;
+	int num, port_from_proc, socket_state, listening;
 
+	listening = is_port_listening_sock_diag(port, udp);
+	if (listening >= 0)
+		return listening;
+
+	//Fall back to /proc/net/tcp on kernels without sock_diag
+	tcp_info = fopen("/proc/net/tcp","r");
 	if (tcp_info == NULL)
 		FATAL_MSG("Failed to open /proc/net/tcp");
 
@@ -359,12 +788,18 @@ static int is_port_listening(int port, int udp)
         if(!strncmp(line, "  sl", 4) != 0)
             continue;
 
-		// read in: #: (ip in hex):(port), ignore the rest
-		// throw away the (ip in hex) since we don't need it
-		sscanf(line, "%d: %*[A-Fa-f0-9]:%X", &num, &port_from_proc);
+		// read in: #: (ip in hex):(port) (remote ip):(remote port) (state), ignore the rest
+		// throw away the ips and remote port since we don't need them
+		if (sscanf(line, "%d: %*[A-Fa-f0-9]:%X %*[A-Fa-f0-9]:%*X %X", &num, &port_from_proc, &socket_state) != 3)
+			continue;
 
-		if (port == port_from_proc)
-			return 1;	
+		// Only count listening sockets, connections left over from a previous target process don't mean
+		// the next one is ready
+		if (port == port_from_proc && socket_state == TCP_LISTEN_STATE)
+		{
+			fclose(tcp_info);
+			return 1;
+		}
 	}
 
 	fclose(tcp_info);
@@ -373,74 +808,577 @@ static int is_port_listening(int port, int udp)
 }
 
 /**
- * This function will run the fuzzed program and test it with the given inputs. This function
- * blocks until the program has finished processing the input.
+ * This function starts the fuzzed program and waits for it to start listening on the target port.
  * @param state - the network_server_state_t object that represents the current state of the driver
- * @param inputs - an array of inputs to send to the program
- * @param lengths - an array of lengths for the buffers in the inputs parameter
- * @param inputs_count - the number of buffers in the inputs parameter
- * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ * @return - non-zero on error, zero on success
  */
-static int network_server_run(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+static int start_target(network_server_state_t * state)
 {
+	int listening = 0, poll_us = LISTEN_POLL_MIN_US;
 
-#ifdef _WIN32
-	SOCKET sock;
-#else
-	int sock;
-#endif
-	size_t i;
-	int listening = 0;
-
-	//Start the process and give it our input
+	PHASE_BEGIN(PHASE_ENABLE);
 	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
-		return FUZZ_ERROR;
+		return 1;
+	PHASE_END(PHASE_ENABLE);
 
-	//Wait for the port to be listening
+	//Wait for the port to be listening.  The checks start out close together, so a target that starts
+	//quickly is connected to right away, and back off to every LISTEN_POLL_MAX_US for slower targets.
 	while (!state->skip_network_check && listening == 0) {
 		listening = is_port_listening(state->target_port, state->target_udp);
-		if(listening == 0)
+		if(listening == 0) {
 #ifdef _WIN32
-			Sleep(5);
+			Sleep(poll_us / 1000);
 #else
-			usleep(5*1000);
+			usleep(poll_us);
 #endif
+			poll_us = poll_us * 2 > LISTEN_POLL_MAX_US ? LISTEN_POLL_MAX_US : poll_us * 2;
+		}
 	}
-	if(listening < 0)
-		return FUZZ_ERROR;
+	return listening < 0;
+}
 
-	if (connect_to_target(state, &sock)) // opens socket
-		return FUZZ_ERROR;
-	for (i = 0; i < inputs_count; i++)
+/**
+ * This function sends each of the inputs to the fuzzed program, sleeping before each one as requested by the
+ * sleeps option.  UDP inputs that don't have a sleep between them are sent together.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a pointer to the socket to send the inputs on
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - non-zero on error, zero on success
+ */
+#ifdef _WIN32
+static int send_inputs(network_server_state_t * state, SOCKET * sock, char ** inputs, size_t * lengths, size_t inputs_count)
+#else
+static int send_inputs(network_server_state_t * state, int * sock, char ** inputs, size_t * lengths, size_t inputs_count)
+#endif
+{
+	size_t i, batch;
+
+	PHASE_BEGIN(PHASE_DELIVER);
+	for (i = 0; i < inputs_count; i += batch)
 	{
 		if (state->sleeps && state->sleeps[i] != 0)
+			wait_before_message(sock, state->sleeps[i], state->pace, i > 0 && !state->target_udp);
+		batch = 1;
+		if (state->target_udp)
+		{
+			while (i + batch < inputs_count && (!state->sleeps || state->sleeps[i + batch] == 0))
+				batch++;
+			if (send_udp_inputs(state, sock, state->target_port, inputs + i, lengths + i, batch))
+				return 1;
+		}
+		else if (send_tcp_input(sock, inputs[i], lengths[i]))
+			return 1;
+	}
+	PHASE_END(PHASE_DELIVER);
+	return 0;
+}
+
+/**
+ * This function checks whether the fuzzed program started in persistent mode has exited.  Once it has, the
+ * instrumentation isn't asked again until the program is restarted.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @return - 1 if the program has exited, 0 if it is still running, or -1 on error
+ */
+static int is_target_done(network_server_state_t * state)
+{
+	int done;
+
+	if (!state->process_running)
+		return 1;
+	done = state->instrumentation->is_process_done(state->instrumentation_state);
+	if (done < 0)
+		return -1;
+	if (done)
+		state->process_running = 0;
+	return done != 0;
+}
+
+/**
+ * This function waits for the fuzzed program to finish processing an input in persistent mode.  Since the
+ * program doesn't exit after each input, it's considered finished once it closes the connection, once it
+ * responds on a connection that is being kept open, or once persistent_wait_ms milliseconds have passed.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a pointer to the socket the inputs were sent on.  If the program closes the connection,
+ * the socket is closed and set to NO_SOCKET.
+ * @return - 1 if the program exited while processing the input, 0 if it is still running, or -1 on error
+ */
 #ifdef _WIN32
-			Sleep(state->sleeps[i]);
+static int wait_for_persistent_target(network_server_state_t * state, SOCKET * sock)
 #else
-			usleep(1000*state->sleeps[i]);
+static int wait_for_persistent_target(network_server_state_t * state, int * sock)
 #endif
-		if ((state->target_udp && send_udp_input(state, &sock, inputs[i], lengths[i]))
-			|| (!state->target_udp && send_tcp_input(&sock, inputs[i], lengths[i])))
+{
+	uint64_t deadline = get_time_ms() + state->persistent_wait_ms;
+	struct timeval poll_time;
+	fd_set read_fds;
+	char buffer[4096];
+	int done, received;
+
+	while (1)
+	{
+		done = is_target_done(state);
+		if (done)
+			return done;
+		if (get_time_ms() >= deadline)
+			return 0;
+
+		if (state->target_udp || *sock == NO_SOCKET)
 		{
 #ifdef _WIN32
-			closesocket(sock);
+			Sleep(PERSISTENT_POLL_MS);
 #else
-			close(sock);
+			usleep(PERSISTENT_POLL_MS * 1000);
 #endif
+			continue;
+		}
+
+		FD_ZERO(&read_fds);
+		FD_SET(*sock, &read_fds);
+		poll_time.tv_sec = 0;
+		poll_time.tv_usec = PERSISTENT_POLL_MS * 1000;
+		if (select((int)*sock + 1, &read_fds, NULL, NULL, &poll_time) <= 0)
+			continue;
+
+		//Throw away the response, and stop waiting once the program is done with the connection
+		received = recv(*sock, buffer, sizeof(buffer), 0);
+		if (received <= 0)
+		{
+			close_socket(*sock);
+			*sock = NO_SOCKET;
+		}
+		if (received <= 0 || state->keep_connection)
+			return is_target_done(state);
+	}
+}
+
+/**
+ * This function tests the given inputs in persistent mode.  The fuzzed program is only restarted once it has
+ * exited or has been sent persistent_max_cnt inputs, and crashes are found by asking the instrumentation
+ * whether the program has exited after each input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int network_server_run_persistent(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+	int done, was_running = state->process_running;
+
+	done = is_target_done(state);
+	if (done < 0)
+		return FUZZ_ERROR;
+	if (done || state->persistent_count >= state->persistent_max_cnt)
+	{
+		if (!done)
+			DEBUG_MSG("Restarting the target after %d inputs", state->persistent_count);
+		else if (was_running)
+			WARNING_MSG("The target exited between inputs, restarting it");
+		if (state->sock != NO_SOCKET) {
+			close_socket(state->sock);
+			state->sock = NO_SOCKET;
+		}
+		if (start_target(state))
 			return FUZZ_ERROR;
+		state->process_running = 1;
+		state->persistent_count = 0;
+	}
+	state->persistent_count++;
+
+	if ((state->sock == NO_SOCKET && connect_to_target(state, &state->sock, state->target_port))
+		|| send_inputs(state, &state->sock, inputs, lengths, inputs_count))
+	{
+		//The program may have died partway through the input, so give it a chance to be reaped before
+		//deciding whether that's what happened
+		if (state->sock != NO_SOCKET) {
+			close_socket(state->sock);
+			state->sock = NO_SOCKET;
 		}
+		if (wait_for_persistent_target(state, &state->sock) == 1)
+			return state->instrumentation->get_fuzz_result(state->instrumentation_state);
+		return FUZZ_ERROR;
 	}
+	if (!state->keep_connection && !state->target_udp)
+		shutdown(state->sock, SHUTDOWN_SEND);
+
+	done = wait_for_persistent_target(state, &state->sock);
+	if (state->udp_responses && state->sock != NO_SOCKET && collect_udp_responses(state, &state->sock))
+		done = -1;
+	if (!state->keep_connection && state->sock != NO_SOCKET) {
+		close_socket(state->sock);
+		state->sock = NO_SOCKET;
+	}
+	if (done < 0)
+		return FUZZ_ERROR;
+	if (done)
+		return state->instrumentation->get_fuzz_result(state->instrumentation_state);
+	return FUZZ_NONE;
+}
+
+#ifndef _WIN32
+/**
+ * This function tests the given inputs in desocket mode.  Rather than sending them over the network, the inputs
+ * are given to the instrumentation the same way the stdin driver gives it input, and the fork server library in
+ * the target feeds them through the target's sockets.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int network_server_run_desocket(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+	char * input;
+	size_t length;
+	int result;
+
+	input = desocket_encode_inputs(inputs, lengths, inputs_count, &length);
+	if (!input)
+		return FUZZ_ERROR;
+	PHASE_BEGIN(PHASE_ENABLE);
+	result = state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, input, length);
+	PHASE_END(PHASE_ENABLE);
+	free(input);
+	if (result)
+		return FUZZ_ERROR;
+
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
+		state->instrumentation, state->instrumentation_state);
+}
+#endif
+
+/**
+ * This function will run the fuzzed program and test it with the given inputs. This function
+ * blocks until the program has finished processing the input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int run_inputs(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+
 #ifdef _WIN32
-	closesocket(sock);
+	SOCKET sock;
 #else
-	close(sock);
+	int sock;
 #endif
+	int result;
+
+	free_responses(state);
+	if (state->persistent)
+		return network_server_run_persistent(state, inputs, lengths, inputs_count);
+#ifndef _WIN32
+	if (state->desocket)
+		return network_server_run_desocket(state, inputs, lengths, inputs_count);
+#endif
+
+	//Start the process and give it our input
+	if (start_target(state))
+		return FUZZ_ERROR;
+
+	if (connect_to_target(state, &sock, state->target_port)) // opens socket
+		return FUZZ_ERROR;
+	if (send_inputs(state, &sock, inputs, lengths, inputs_count))
+	{
+		close_socket(sock);
+		return FUZZ_ERROR;
+	}
+	if (state->udp_responses)
+	{
+		//Keep the socket open until the target is done, so its responses can be read
+		result = hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
+			state->instrumentation, state->instrumentation_state);
+		if (collect_udp_responses(state, &sock))
+			result = FUZZ_ERROR;
+		close_socket(sock);
+		return result;
+	}
+	close_socket(sock);
 
 	//Wait for it to be done and return FUZZ_ result
-	return generic_wait_for_process_completion(state->process, state->timeout,
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
 		state->instrumentation, state->instrumentation_state);
 }
 
+/**
+ * This function moves the calling thread into the driver's network namespace, when the netns option is set.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @return - non-zero on error, zero on success
+ */
+static int enter_netns(network_server_state_t * state)
+{
+#if !defined(_WIN32) && !__APPLE__
+	if (state->netns)
+		return netns_enter(state->netns_fd);
+#endif
+	return 0;
+}
+
+/**
+ * This function moves the calling thread back out of the driver's network namespace, when the netns option is set.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @return - non-zero on error, zero on success
+ */
+static int leave_netns(network_server_state_t * state)
+{
+#if !defined(_WIN32) && !__APPLE__
+	if (state->netns)
+		return netns_enter(state->host_netns_fd);
+#endif
+	return 0;
+}
+
+/**
+ * This function will run the fuzzed program and test it with the given inputs, in the driver's network namespace
+ * if it has one. This function blocks until the program has finished processing the input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param inputs - an array of inputs to send to the program
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int network_server_run(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+	int result;
+
+	if (enter_netns(state))
+		return FUZZ_ERROR;
+	result = run_inputs(state, inputs, lengths, inputs_count);
+	if (leave_netns(state))
+		return FUZZ_ERROR;
+	return result;
+}
+
+#ifndef _WIN32
+//The stages of a target instance in network_server_test_inputs
+#define INSTANCE_IDLE      0 //Not testing an input
+#define INSTANCE_LISTENING 1 //Waiting for the target to listen on the instance's port
+#define INSTANCE_SENDING   2 //Waiting to send the next message
+#define INSTANCE_RUNNING   3 //Waiting for the target to finish with the input
+
+/**
+ * This function sets up the target instances for the instances option.  Instance 0 uses the driver's
+ * instrumentation state, and the others each get their own copy of it, so each one can run a target.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @return - non-zero on error, zero on success
+ */
+static int setup_instances(network_server_state_t * state)
+{
+	network_server_instance_t * instance;
+	int i;
+
+	if (!state->instrumentation->copy || !state->instrumentation->is_process_done)
+	{
+		ERROR_MSG("The instances option requires an instrumentation that can run several targets at once");
+		return 1;
+	}
+	state->instance_list = (network_server_instance_t *)calloc(state->instances, sizeof(network_server_instance_t));
+	if (!state->instance_list)
+		return 1;
+	for (i = 0; i < state->instances; i++)
+		state->instance_list[i].sock = NO_SOCKET;
+	for (i = 0; i < state->instances; i++)
+	{
+		instance = &state->instance_list[i];
+		instance->port = state->target_port + i;
+		instance->cmd_line = build_cmd_line(state, instance->port);
+		if (!instance->cmd_line)
+			return 1;
+		if (i == 0)
+			instance->instrumentation_state = state->instrumentation_state;
+		else
+		{
+			instance->instrumentation_state = state->instrumentation->copy(state->instrumentation_state);
+			if (!instance->instrumentation_state)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function stops an instance from testing its input, and frees the input's messages.  The instance's target
+ * is left for the instrumentation to kill the next time the instance runs it.
+ * @param instance - the instance to stop
+ */
+static void stop_instance(network_server_instance_t * instance)
+{
+	size_t i;
+
+	if (instance->sock != NO_SOCKET)
+	{
+		close_socket(instance->sock);
+		instance->sock = NO_SOCKET;
+	}
+	for (i = 0; i < instance->messages_count; i++)
+		free(instance->messages[i]);
+	free(instance->messages);
+	free(instance->message_lengths);
+	instance->messages = NULL;
+	instance->message_lengths = NULL;
+	instance->messages_count = 0;
+	instance->stage = INSTANCE_IDLE;
+}
+
+/**
+ * This function frees the target instances, and the copies of the instrumentation state that they ran their
+ * targets with.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ */
+static void cleanup_instances(network_server_state_t * state)
+{
+	int i;
+
+	for (i = 0; state->instance_list && i < state->instances; i++)
+	{
+		stop_instance(&state->instance_list[i]);
+		free(state->instance_list[i].cmd_line);
+		if (i > 0 && state->instance_list[i].instrumentation_state)
+			state->instrumentation->cleanup(state->instance_list[i].instrumentation_state);
+	}
+	free(state->instance_list);
+	state->instance_list = NULL;
+}
+
+/**
+ * This function starts an instance's target, to test one of the inputs given to network_server_test_inputs
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param instance - the idle instance to start
+ * @param index - the index of the input to test
+ * @param input - the input to test
+ * @return - non-zero on error, zero on success
+ */
+static int start_instance(network_server_state_t * state, network_server_instance_t * instance, size_t index, char * input)
+{
+	if (decode_mem_array(input, &instance->messages, &instance->message_lengths, &instance->messages_count))
+		return 1;
+	if (!instance->messages_count)
+		return 1;
+	if (state->instrumentation->enable(instance->instrumentation_state, &instance->process, instance->cmd_line, NULL, 0))
+		return 1;
+	instance->input = index;
+	instance->next_message = 0;
+	instance->wake_ms = get_time_ms();
+	instance->stage = state->skip_network_check ? INSTANCE_SENDING : INSTANCE_LISTENING;
+	return 0;
+}
+
+/**
+ * This function sends an instance's next message, along with the UDP messages that don't have a sleep before them.
+ * Once every message has been sent, the instance starts waiting for its target to finish.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param instance - the instance to send the messages of
+ * @param now - the current time in milliseconds
+ * @return - non-zero on error, zero on success
+ */
+static int send_instance_messages(network_server_state_t * state, network_server_instance_t * instance, uint64_t now)
+{
+	size_t i = instance->next_message, batch = 1;
+
+	if (state->target_udp)
+	{
+		while (i + batch < instance->messages_count
+			&& (!state->sleeps || i + batch >= (size_t)state->sleeps_count || state->sleeps[i + batch] == 0))
+			batch++;
+		if (send_udp_inputs(state, &instance->sock, instance->port, instance->messages + i,
+			instance->message_lengths + i, batch))
+			return 1;
+	}
+	else if (send_tcp_input(&instance->sock, instance->messages[i], instance->message_lengths[i]))
+		return 1;
+
+	instance->next_message += batch;
+	if (instance->next_message < instance->messages_count)
+	{
+		i = instance->next_message;
+		instance->wake_ms = now + (state->sleeps && i < (size_t)state->sleeps_count ? state->sleeps[i] : 0);
+		instance->check_read = !state->target_udp;
+		return 0;
+	}
+
+	close_socket(instance->sock);
+	instance->sock = NO_SOCKET;
+	instance->stage = INSTANCE_RUNNING;
+	instance->run_start_ms = now;
+	instance->wake_ms = now + state->hang_timeout.timeout_ms;
+	return 0;
+}
+
+/**
+ * This function moves an instance on to its next stage, if what it was waiting for has happened.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param instance - the instance to update
+ * @param now - the current time in milliseconds
+ * @param revents - the poll events of the instance's socket
+ * @return - 1 if the instance has finished testing its input, 0 if it hasn't, or -1 on error
+ */
+static int update_instance(network_server_state_t * state, network_server_instance_t * instance, uint64_t now, short revents)
+{
+	char buffer[4096];
+	int done;
+
+	if (instance->stage == INSTANCE_LISTENING)
+	{
+		//A target that dies before it starts listening won't ever listen
+		done = state->instrumentation->is_process_done(instance->instrumentation_state);
+		if (done)
+		{
+			instance->result = done < 0 ? FUZZ_ERROR : state->instrumentation->get_fuzz_result(instance->instrumentation_state);
+			return done < 0 ? -1 : 1;
+		}
+		done = is_port_listening(instance->port, state->target_udp);
+		if (done < 0)
+			return -1;
+		if (!done)
+			return 0;
+		if (connect_to_target(state, &instance->sock, instance->port))
+			return -1;
+		instance->stage = INSTANCE_SENDING;
+		instance->wake_ms = now + (state->sleeps && state->sleeps_count ? state->sleeps[0] : 0);
+		instance->check_read = 0;
+	}
+
+	if (instance->stage == INSTANCE_SENDING)
+	{
+		//When pacing, a response (which is thrown away), a closed connection, or a local TCP target reading the
+		//messages sent so far ends the wait early
+		if (state->pace && (revents & (POLLIN | POLLHUP)) && recv(instance->sock, buffer, sizeof(buffer), 0) <= 0)
+			revents |= POLLHUP;
+#ifndef __APPLE__
+		if (state->pace && instance->check_read && !revents && now < instance->wake_ms)
+		{
+			done = target_read_everything(instance->sock);
+			if (done < 0)
+				instance->check_read = 0;
+			else if (done)
+				revents = POLLIN;
+		}
+#endif
+		if (now < instance->wake_ms && !(state->pace && revents))
+			return 0;
+		return send_instance_messages(state, instance, now) ? -1 : 0;
+	}
+
+	done = state->instrumentation->is_process_done(instance->instrumentation_state);
+	if (done < 0)
+		return -1;
+	if (done)
+	{
+		hang_timeout_record(&state->hang_timeout, now - instance->run_start_ms);
+		instance->result = state->instrumentation->get_fuzz_result(instance->instrumentation_state);
+		return 1;
+	}
+	if (now < instance->wake_ms)
+		return 0;
+	instance->result = FUZZ_HANG;
+	return 1;
+}
+#endif
+
 static void network_server_test_input_cleanup(char ** inputs, size_t inputs_count, size_t * input_lengths)
 {
 	for (size_t i = 0; i < inputs_count; i++)
@@ -514,6 +1452,117 @@ int network_server_test_next_input(void * driver_state)
 	return network_server_run_result;
 }
 
+/**
+ * This function tests several inputs.  With the instances option, up to that many of the inputs are tested at once,
+ * each by its own copy of the target listening on its own port.  A single thread starts the targets, sends the
+ * messages, and waits for the sleeps between them and for the targets to finish, by polling all of them in turn.
+ * Without the instances option, the inputs are tested one at a time.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param inputs - an array of the inputs that should be tested
+ * @param lengths - an array of the lengths of the buffers in the inputs parameter
+ * @param count - the number of inputs to test
+ * @param results - an array of count ints, used to return the FUZZ_ result of each input
+ * @return - zero on success, or FUZZ_ERROR on failure
+ */
+int network_server_test_inputs(void * driver_state, char ** inputs, size_t * lengths, size_t count, int * results)
+{
+	network_server_state_t * state = (network_server_state_t *)driver_state;
+	size_t next = 0;
+#ifndef _WIN32
+	struct pollfd fds[NETWORK_SERVER_MAX_INSTANCES];
+	network_server_instance_t * instance;
+	size_t finished = 0;
+	uint64_t now, wake;
+	int i, num_fds, timeout, ret;
+#endif
+
+	if (state->instances <= 1)
+	{
+		for (next = 0; next < count; next++)
+		{
+			results[next] = network_server_test_input(state, inputs[next], lengths[next]);
+			if (results[next] == FUZZ_ERROR)
+				return FUZZ_ERROR;
+		}
+		return 0;
+	}
+
+#ifndef _WIN32
+	free_responses(state);
+	if (enter_netns(state))
+		return FUZZ_ERROR;
+	while (finished < count)
+	{
+		//Give each idle instance the next input
+		for (i = 0; i < state->instances && next < count; i++)
+		{
+			if (state->instance_list[i].stage != INSTANCE_IDLE)
+				continue;
+			if (start_instance(state, &state->instance_list[i], next, inputs[next]))
+				goto error;
+			next++;
+		}
+
+		//Wait for the next instance's wait to end, or for a response to an instance that's pacing its messages.
+		//The instances waiting on their targets, or for them to read a paced message, are checked every
+		//PERSISTENT_POLL_MS.
+		now = get_time_ms();
+		wake = UINT64_MAX;
+		num_fds = 0;
+		for (i = 0; i < state->instances; i++)
+		{
+			instance = &state->instance_list[i];
+			fds[i].fd = -1;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			if (instance->stage == INSTANCE_IDLE)
+				continue;
+			if (instance->stage == INSTANCE_SENDING)
+			{
+				if (state->pace)
+					fds[i].fd = instance->sock;
+				if (instance->wake_ms < wake)
+					wake = instance->wake_ms;
+				if (state->pace && instance->check_read && now + PERSISTENT_POLL_MS < wake)
+					wake = now + PERSISTENT_POLL_MS;
+			}
+			else if (now + PERSISTENT_POLL_MS < wake)
+				wake = now + PERSISTENT_POLL_MS;
+			num_fds = i + 1;
+		}
+		timeout = wake <= now ? 0 : (int)(wake - now);
+		if (poll(fds, num_fds, timeout) < 0 && errno != EINTR)
+			goto error;
+
+		now = get_time_ms();
+		for (i = 0; i < state->instances; i++)
+		{
+			instance = &state->instance_list[i];
+			if (instance->stage == INSTANCE_IDLE)
+				continue;
+			ret = update_instance(state, instance, now, i < num_fds ? fds[i].revents : 0);
+			if (ret < 0)
+				goto error;
+			if (ret)
+			{
+				results[instance->input] = instance->result;
+				stop_instance(instance);
+				finished++;
+			}
+		}
+	}
+	return leave_netns(state) ? FUZZ_ERROR : 0;
+
+error:
+	for (i = 0; i < state->instances; i++)
+		stop_instance(&state->instance_list[i]);
+	leave_netns(state);
+	return FUZZ_ERROR;
+#else
+	return FUZZ_ERROR; //network_server_create doesn't allow the instances option on Windows
+#endif
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the network_server_test_next_input function.
@@ -544,6 +1593,37 @@ char * network_server_get_last_input(void * driver_state, int * length)
 	return encode_mem_array(state->mutate_buffers, state->mutate_last_sizes, state->num_inputs, length);
 }
 
+/**
+ * When the udp_responses option is set, this function retrieves the datagrams the target sent back while
+ * processing the last input that was tested, so that they can be used to guide the next mutations.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param length - a pointer to an integer used to return the length of the returned buffer
+ * @return - NULL on error or if the udp_responses option isn't set, or a buffer containing the responses encoded
+ * the same way as a multipart input (see encode_mem_array).  This buffer should be freed by the caller.
+ */
+char * network_server_get_last_responses(void * driver_state, int * length)
+{
+	network_server_state_t * state = (network_server_state_t *)driver_state;
+
+	if (!state->udp_responses)
+		return NULL;
+	return encode_mem_array(state->responses, state->response_lengths, state->responses_count, length);
+}
+
+/**
+ * This function escalates the hang timeout that the driver uses for the next tests, so that an input which
+ * timed out can be tested again with a longer timeout.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success
+ */
+int network_server_escalate_timeout(void * driver_state, double multiplier)
+{
+	network_server_state_t * state = (network_server_state_t *)driver_state;
+	hang_timeout_escalate(&state->hang_timeout, multiplier);
+	return 0;
+}
+
 /**
  * This function returns help text for this driver.  This help text will describe the driver and any options
  * that can be passed to network_server_create.
@@ -559,9 +1639,15 @@ int network_server_help(char ** help_str)
 "  path                  The path to the target process\n"
 "  port                  The target port to connect to\n"
 "Optional Options:\n"
-"  arguments             Arguments to pass to the target process\n"
+"  arguments             Arguments to pass to the target process.  Each \"@@\"\n"
+"                          is replaced with the port the target listens on\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
 "                          process to finish\n"
+"  timeout_ms            The maximum number of milliseconds to wait for the\n"
+"                          target process to finish.  If set, this overrides\n"
+"                          timeout\n"
+"  adaptive_timeout      Lower the timeout to this multiple of the target\n"
+"                          process's 99th percentile exec time\n"
 "  ratio                 The ratio of mutation buffer size to input size when\n"
 "                          given a mutator\n"
 "  skip_network_check    Whether or not to wait for the specified port to be\n"
@@ -569,8 +1655,58 @@ int network_server_help(char ** help_str)
 "                          the target program\n"
 "  sleeps                An array of milliseconds to wait between each input\n"
 "                          being sent to the target program\n"
+"  pace                  Whether to treat the sleeps as the longest time to\n"
+"                          wait (1) or always wait that long (0).  When pacing,\n"
+"                          the driver stops waiting once the target responds\n"
+"                          or, for local TCP targets on Linux, once the target\n"
+"                          has read the previous inputs\n"
 "  udp                   Whether the fuzzed input should be sent to the target\n"
-"                          program on UDP (1) or TCP (0)\n"
+"                          program on UDP (1) or TCP (0).  On Linux, inputs\n"
+"                          without a sleep between them are sent with a single\n"
+"                          sendmmsg call\n"
+"  udp_responses         Whether to collect the datagrams the target sends\n"
+"                          back on UDP, which can be retrieved with\n"
+"                          network_server_get_last_responses\n"
+"  persistent            Whether to keep the target process running between\n"
+"                          inputs (1) or restart it for each input (0).  The\n"
+"                          target is restarted when it exits, which is reported\n"
+"                          as a crash if the instrumentation saw it crash.\n"
+"                          Hangs aren't detected in this mode\n"
+"  persistent_max_cnt    The number of inputs to send to one target process in\n"
+"                          persistent mode before restarting it (default 1000)\n"
+"  persistent_wait_ms    The maximum number of milliseconds to wait for the\n"
+"                          target to close the connection, or to respond when\n"
+"                          keep_connection is set, in persistent mode\n"
+"                          (default 100)\n"
+"  keep_connection       Whether to send every input on the same TCP\n"
+"                          connection in persistent mode, rather than opening a\n"
+"                          new connection for each input\n"
+"  desocket              Whether to pass the input to the target through the\n"
+"                          fork server library's socket emulation (1), rather\n"
+"                          than the network (0).  The target must be run with\n"
+"                          the fork server library, i.e. with the return_code\n"
+"                          or ipt instrumentation and its fork server enabled.\n"
+"                          The sleeps option is ignored in this mode\n"
+"  prefix_messages       In desocket mode, snapshot the target once it has\n"
+"                          read this many messages, and run the later inputs\n"
+"                          that start with the same messages from the\n"
+"                          snapshot (default 0, no snapshots).  The target\n"
+"                          must wait for the next message with read, recv,\n"
+"                          recvfrom, recvmsg, or poll, and be run with\n"
+"                          the return_code instrumentation\n"
+"  instances             On Linux, the number of copies of the target to run\n"
+"                          at once when the driver is given a batch of inputs\n"
+"                          (default 1).  Copy n listens on port + n, which\n"
+"                          \"@@\" in the arguments passes to it.  One thread\n"
+"                          runs all of the copies.  This requires the\n"
+"                          return_code instrumentation, and can't be used in\n"
+"                          persistent or desocket mode, or with udp_responses\n"
+"  netns                 On Linux, whether to run the target in a network\n"
+"                          namespace of its own (1) or not (0).  Each driver,\n"
+"                          i.e. each fuzzing worker, gets its own namespace, so\n"
+"                          several workers' targets can listen on the same port.\n"
+"                          The ip must be a loopback address.  This requires\n"
+"                          root (default 0)\n"
 "\n"
 	);
 	if (*help_str == NULL)
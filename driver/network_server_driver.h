@@ -12,15 +12,50 @@ void * network_server_create(char * options, instrumentation_t * instrumentation
 void network_server_cleanup(void * driver_state);
 int network_server_test_input(void * driver_state, char * buffer, size_t length);
 int network_server_test_next_input(void * driver_state);
+int network_server_test_inputs(void * driver_state, char ** inputs, size_t * lengths, size_t count, int * results);
 char * network_server_get_last_input(void * driver_state, int * length);
+char * network_server_get_last_responses(void * driver_state, int * length);
+int network_server_escalate_timeout(void * driver_state, double multiplier);
 int network_server_help(char ** help_str);
 
+#define NETWORK_SERVER_MAX_INSTANCES 64
+
+//One of the target instances that network_server_test_inputs runs at once, when the instances option is set
+struct network_server_instance
+{
+	void * instrumentation_state; //The instance's copy of the instrumentation state, or the driver's for instance 0
+	char * cmd_line;              //The command line, with the instance's port in place of each "@@"
+	int port;                     //The port the instance's target listens on
+
+	#ifdef _WIN32
+	HANDLE process;
+	SOCKET sock;
+	#else
+	pid_t process;
+	int sock;
+	#endif
+
+	int stage;             //What the instance is waiting for, one of the INSTANCE_ stages
+	size_t input;          //The index of the input the instance is testing, in the inputs given to test_inputs
+	char ** messages;      //The input, split into the messages to send
+	size_t * message_lengths;
+	size_t messages_count;
+	size_t next_message;   //The index of the next message to send
+	int check_read;        //When pacing, whether to check if the target has read the messages sent so far
+	uint64_t wake_ms;      //When the instance's current wait ends
+	uint64_t run_start_ms; //When the last message was sent
+	int result;            //The FUZZ_ result of the input, once the instance is done with it
+};
+typedef struct network_server_instance network_server_instance_t;
+
 struct network_server_state
 {
 	//Options
 	char * path;            //The path to the fuzzed executable
 	char * arguments;       //Arguments to give the binary
 	int timeout;            //Maximum number of seconds to allow the executable to run
+	int timeout_ms;         //Maximum number of milliseconds to allow the executable to run, overrides timeout
+	double adaptive_timeout; //Multiple of the p99 exec time to use as the timeout, or 0 to disable
 	char * target_ip;       //The IP address to send the fuzzed data to
 	int target_port;        //The port to send the fuzzed data to
 	int target_udp;         //Is the driver hitting a udp port (1) or tcp port (0)
@@ -28,6 +63,16 @@ struct network_server_state
 	double input_ratio;     //the ratio of the maximum input size
 	int * sleeps;           //How many milliseconds to sleep between inputs
 	int sleeps_count;       //The number of items in the sleeps array
+	int pace;               //Stop sleeping between inputs once the target is ready for the next one
+	int persistent;         //Keep the target process running between inputs (1) or restart it for each input (0)
+	int persistent_max_cnt; //The number of inputs to send to one target process in persistent mode before restarting it
+	int persistent_wait_ms; //The number of milliseconds to wait for the target to finish with each input in persistent mode
+	int keep_connection;    //Reuse the TCP connection between inputs in persistent mode
+	int desocket;           //Pass the inputs through the fork server library's socket emulation, rather than the network
+	int prefix_messages;    //In desocket mode, the number of messages to snapshot the target after, or 0 to not snapshot
+	int udp_responses;      //Collect the datagrams the target sends back in response to the inputs
+	int instances;          //The number of target instances to test a batch of inputs on at once, each on its own port
+	int netns;              //Run the target in a network namespace of its own, so workers can share the port
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -36,6 +81,30 @@ struct network_server_state
 	pid_t process;
 	#endif
 
+	//Persistent mode's connection to the target, and the number of inputs the current target process has been sent
+	#ifdef _WIN32
+	SOCKET sock;
+	#else
+	int sock;
+	#endif
+	int persistent_count;
+	int process_running;
+
+	//The datagrams the target sent back for the last input, when the udp_responses option is set
+	char ** responses;
+	size_t * response_lengths;
+	size_t responses_count;
+
+	//The network namespace the target runs in, and the namespace the driver was created in, when netns is set
+	int netns_fd;
+	int host_netns_fd;
+
+	//The target instances, when the instances option is more than 1
+	network_server_instance_t * instance_list;
+
+	//The hang timeout, calculated from the timeout options
+	hang_timeout_t hang_timeout;
+
 	//command line of the fuzzed process
 	char * cmd_line;
 
@@ -0,0 +1,242 @@
+#include <jansson.h>
+#include <utils.h>
+#include "phase_timing.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+PHASE_TIMING_THREAD phase_timing_t * phase_timing_current = NULL;
+
+static const char * phase_names[PHASE_COUNT] = PHASE_NAMES;
+
+//A tick count and the nanosecond time it was taken at, used to convert ticks to nanoseconds
+static uint64_t calibration_ticks = 0;
+static uint64_t calibration_ns = 0;
+
+/**
+ * This function reads a fast, monotonic tick counter.  On x86, this is the time stamp counter, on
+ * Windows without it, QueryPerformanceCounter, and otherwise get_time_ns.  The length of a tick is
+ * only known after the fact, by comparing it to get_time_ns.
+ * @return - the current tick count
+ */
+uint64_t phase_timing_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	return __rdtsc();
+#elif defined(_WIN32)
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)counter.QuadPart;
+#else
+	return get_time_ns();
+#endif
+}
+
+/**
+ * This function clears a phase timing, so it can be used to time a thread's phases.
+ * @param timing - the phase timing to clear
+ */
+void phase_timing_init(phase_timing_t * timing)
+{
+	int i;
+
+	memset(timing, 0, sizeof(phase_timing_t));
+	for (i = 0; i < PHASE_COUNT; i++)
+		timing->phases[i].min = UINT64_MAX;
+	if (!calibration_ticks) {
+		calibration_ns = get_time_ns();
+		calibration_ticks = phase_timing_ticks();
+	}
+}
+
+/**
+ * This function finds the histogram bucket for a value.
+ * @param value - the value to find the bucket of
+ * @return - the index of the value's bucket
+ */
+static int bucket_index(uint64_t value)
+{
+	int msb = 0;
+
+	if (value < PHASE_TIMING_SUB_BUCKETS)
+		return (int)value;
+	while (value >> (msb + 1))
+		msb++;
+	return (msb - PHASE_TIMING_SUB_BITS + 1) * PHASE_TIMING_SUB_BUCKETS
+		+ (int)((value >> (msb - PHASE_TIMING_SUB_BITS)) & (PHASE_TIMING_SUB_BUCKETS - 1));
+}
+
+/**
+ * This function finds the smallest value that goes in a histogram bucket.
+ * @param index - the index of the bucket
+ * @return - the bucket's smallest value
+ */
+static uint64_t bucket_lower_bound(int index)
+{
+	if (index < PHASE_TIMING_SUB_BUCKETS)
+		return (uint64_t)index;
+	return (uint64_t)(PHASE_TIMING_SUB_BUCKETS + index % PHASE_TIMING_SUB_BUCKETS)
+		<< (index / PHASE_TIMING_SUB_BUCKETS - 1);
+}
+
+/**
+ * This function records how long a phase took.  Use the PHASE_BEGIN and PHASE_END macros instead,
+ * so that nothing is recorded when phase timing is off.
+ * @param timing - the phase timing to record the time in
+ * @param phase - which of the PHASE_* phases took the time
+ * @param ticks - how long the phase took, in the ticks returned by phase_timing_ticks
+ */
+void phase_timing_record(phase_timing_t * timing, int phase, uint64_t ticks)
+{
+	phase_histogram_t * histogram = &timing->phases[phase];
+
+	histogram->buckets[bucket_index(ticks)]++;
+	histogram->count++;
+	histogram->total += ticks;
+	if (ticks < histogram->min)
+		histogram->min = ticks;
+	if (ticks > histogram->max)
+		histogram->max = ticks;
+}
+
+/**
+ * This function adds the recorded times of one phase timing to another.
+ * @param dest - the phase timing to add the times to
+ * @param src - the phase timing to add the times from
+ */
+void phase_timing_merge(phase_timing_t * dest, phase_timing_t * src)
+{
+	phase_histogram_t * to, * from;
+	int i, j;
+
+	for (i = 0; i < PHASE_COUNT; i++) {
+		to = &dest->phases[i];
+		from = &src->phases[i];
+		for (j = 0; j < PHASE_TIMING_BUCKETS; j++)
+			to->buckets[j] += from->buckets[j];
+		to->count += from->count;
+		to->total += from->total;
+		if (from->min < to->min)
+			to->min = from->min;
+		if (from->max > to->max)
+			to->max = from->max;
+	}
+}
+
+/**
+ * This function finds a percentile of a histogram's values.
+ * @param histogram - the histogram to search
+ * @param percentile - the percentile to find, between 0 and 100
+ * @return - the smallest value of the bucket that holds the percentile, in ticks
+ */
+static uint64_t histogram_percentile(phase_histogram_t * histogram, double percentile)
+{
+	uint64_t rank, seen = 0, value;
+	int i;
+
+	rank = (uint64_t)(histogram->count * percentile / 100);
+	if (rank >= histogram->count)
+		rank = histogram->count - 1;
+	for (i = 0; i < PHASE_TIMING_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank)
+			break;
+	}
+	value = bucket_lower_bound(i);
+	return value < histogram->min ? histogram->min : value;
+}
+
+/**
+ * This function converts a phase timing's histograms to JSON, with all of the times in nanoseconds.
+ * Each timed phase has its count, total, mean, minimum, maximum, percentiles, and the non-empty
+ * buckets of its histogram, as pairs of the bucket's smallest value and its count.
+ * @param timing - the phase timing to convert
+ * @return - a JSON string that should be freed by the caller, or NULL on failure
+ */
+char * phase_timing_to_json(phase_timing_t * timing)
+{
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	static const char * percentile_names[] = { "p50_ns", "p90_ns", "p99_ns", "p999_ns" };
+	json_t * root, * phases, * phase, * buckets;
+	phase_histogram_t * histogram;
+	uint64_t ticks, ns;
+	double ns_per_tick = 1;
+	char * ret;
+	int i, j;
+
+	//Measure the tick length over the whole time the phases were timed
+	ticks = phase_timing_ticks() - calibration_ticks;
+	ns = get_time_ns() - calibration_ns;
+	if (calibration_ticks && ticks)
+		ns_per_tick = (double)ns / ticks;
+
+	root = json_object();
+	phases = json_object();
+	json_object_set_new(root, "ns_per_tick", json_real(ns_per_tick));
+	json_object_set_new(root, "phases", phases);
+	for (i = 0; i < PHASE_COUNT; i++) {
+		histogram = &timing->phases[i];
+		if (!histogram->count)
+			continue;
+
+		phase = json_object();
+		json_object_set_new(phase, "count", json_integer(histogram->count));
+		json_object_set_new(phase, "total_ns", json_integer((json_int_t)(histogram->total * ns_per_tick)));
+		json_object_set_new(phase, "mean_ns", json_integer((json_int_t)(histogram->total * ns_per_tick / histogram->count)));
+		json_object_set_new(phase, "min_ns", json_integer((json_int_t)(histogram->min * ns_per_tick)));
+		for (j = 0; j < (int)ARRAY_SIZE(percentiles); j++)
+			json_object_set_new(phase, percentile_names[j],
+				json_integer((json_int_t)(histogram_percentile(histogram, percentiles[j]) * ns_per_tick)));
+		json_object_set_new(phase, "max_ns", json_integer((json_int_t)(histogram->max * ns_per_tick)));
+
+		buckets = json_array();
+		for (j = 0; j < PHASE_TIMING_BUCKETS; j++) {
+			if (histogram->buckets[j])
+				json_array_append_new(buckets, json_pack("[II]",
+					(json_int_t)(bucket_lower_bound(j) * ns_per_tick), (json_int_t)histogram->buckets[j]));
+		}
+		json_object_set_new(phase, "histogram", buckets);
+		json_object_set_new(phases, phase_names[i], phase);
+	}
+
+	ret = json_dumps(root, JSON_INDENT(2));
+	json_decref(root);
+	return ret;
+}
+
+/**
+ * This function combines the phase timings of several workers and writes them to a file as JSON.
+ * @param filename - the file to write the phase timings to
+ * @param timings - an array of the phase timings to combine
+ * @param count - the number of phase timings in the timings parameter
+ * @return - zero on success, non-zero on failure
+ */
+int phase_timing_write(const char * filename, phase_timing_t * timings, int count)
+{
+	phase_timing_t * combined;
+	char * json;
+	int i, ret;
+
+	combined = (phase_timing_t *)malloc(sizeof(phase_timing_t));
+	if (!combined)
+		return 1;
+	phase_timing_init(combined);
+	for (i = 0; i < count; i++)
+		phase_timing_merge(combined, &timings[i]);
+
+	json = phase_timing_to_json(combined);
+	free(combined);
+	if (!json)
+		return 1;
+	ret = write_buffer_to_file((char *)filename, json, strlen(json));
+	free(json);
+	return ret;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef FUNC_PREFIX
+#ifdef __cplusplus
+#define FUNC_PREFIX extern "C"
+#else
+#define FUNC_PREFIX
+#endif
+#endif
+
+//The phases of a fuzz iteration that can be timed
+#define PHASE_MUTATE       0 //Mutating the next input
+#define PHASE_DELIVER      1 //Writing the input to the test file, socket, or shared memory
+#define PHASE_ENABLE       2 //The instrumentation's enable, which starts the target (and gives it the input on stdin)
+#define PHASE_WAIT         3 //Waiting for the target to finish with the input
+#define PHASE_IS_NEW_PATH  4 //The instrumentation's is_new_path
+#define PHASE_SAVE         5 //Handing a crash, hang, or new path to the corpus and the output writer
+#define PHASE_ITERATION    6 //The whole iteration
+#define PHASE_COUNT        7
+#define PHASE_NAMES { "mutate", "deliver", "enable", "wait", "is_new_path", "save", "iteration" }
+
+//The histograms are log-linear, like HDR histograms: each power of two is split into
+//PHASE_TIMING_SUB_BUCKETS buckets, so every bucket is within 1/PHASE_TIMING_SUB_BUCKETS of its values
+#define PHASE_TIMING_SUB_BITS    4
+#define PHASE_TIMING_SUB_BUCKETS (1 << PHASE_TIMING_SUB_BITS)
+#define PHASE_TIMING_BUCKETS     ((64 - PHASE_TIMING_SUB_BITS + 1) * PHASE_TIMING_SUB_BUCKETS)
+
+struct phase_histogram
+{
+	uint64_t buckets[PHASE_TIMING_BUCKETS];
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+typedef struct phase_histogram phase_histogram_t;
+
+//The phase timings of one thread, or of the threads of one worker.  All of the times are in
+//the ticks returned by phase_timing_ticks, and are only converted to nanoseconds when written.
+struct phase_timing
+{
+	phase_histogram_t phases[PHASE_COUNT];
+	uint64_t starts[PHASE_COUNT];   //The tick that each phase started at
+};
+typedef struct phase_timing phase_timing_t;
+
+#ifdef _WIN32
+#define PHASE_TIMING_THREAD __declspec(thread)
+#else
+#define PHASE_TIMING_THREAD __thread
+#endif
+
+//The phase timing for the calling thread, or NULL if phases aren't being timed on this thread.  When
+//phase timing is off, each PHASE_BEGIN and PHASE_END only costs a check of this pointer.
+extern PHASE_TIMING_THREAD phase_timing_t * phase_timing_current;
+
+#define PHASE_BEGIN(phase)                                                  \
+	do {                                                                    \
+		if (phase_timing_current)                                           \
+			phase_timing_current->starts[phase] = phase_timing_ticks();     \
+	} while (0)
+
+#define PHASE_END(phase)                                                    \
+	do {                                                                    \
+		if (phase_timing_current)                                           \
+			phase_timing_record(phase_timing_current, phase,                \
+				phase_timing_ticks() - phase_timing_current->starts[phase]); \
+	} while (0)
+
+FUNC_PREFIX uint64_t phase_timing_ticks(void);
+FUNC_PREFIX void phase_timing_init(phase_timing_t * timing);
+FUNC_PREFIX void phase_timing_record(phase_timing_t * timing, int phase, uint64_t ticks);
+FUNC_PREFIX void phase_timing_merge(phase_timing_t * dest, phase_timing_t * src);
+FUNC_PREFIX char * phase_timing_to_json(phase_timing_t * timing);
+FUNC_PREFIX int phase_timing_write(const char * filename, phase_timing_t * timings, int count);
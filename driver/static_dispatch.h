@@ -0,0 +1,89 @@
+#pragma once
+
+#include <global_types.h>
+#include <instrumentation.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/types.h> // pid_t
+#endif
+
+//The fuzz loop's calls to the driver, instrumentation and mutator go through these macros.  Normally
+//they're the usual indirect calls through the driver_t, instrumentation_t and mutator_t, but a fuzzer
+//that's built for one combination of them (see FUZZER_SPECIALIZED in the top level CMakeLists.txt)
+//defines STATIC_DRIVER, STATIC_INSTRUMENTATION and STATIC_MUTATOR to their function name prefixes, e.g.
+//file, afl and havoc_mutator.  Then each call checks whether the function pointer is that module's
+//function and calls it directly if it is, so it can be inlined into the loop with link time
+//optimization.  Any other module, or a wrapper such as the fuzzer's thread safe mutator, still works
+//through the indirect call.
+
+#define STATIC_DISPATCH_PASTE(prefix, name) prefix ## _ ## name
+#define STATIC_DISPATCH_NAME(prefix, name) STATIC_DISPATCH_PASTE(prefix, name)
+
+#define STATIC_DISPATCH_CALL(prefix, pointer, name, ...)                 \
+	((pointer) == STATIC_DISPATCH_NAME(prefix, name)                     \
+		? STATIC_DISPATCH_NAME(prefix, name)(__VA_ARGS__) : (pointer)(__VA_ARGS__))
+
+#ifdef STATIC_DRIVER
+int STATIC_DISPATCH_NAME(STATIC_DRIVER, test_input)(void * driver_state, char * buffer, size_t length);
+int STATIC_DISPATCH_NAME(STATIC_DRIVER, test_next_input)(void * driver_state);
+
+#define DRIVER_CALL(driver, name, ...) STATIC_DISPATCH_CALL(STATIC_DRIVER, (driver)->name, name, __VA_ARGS__)
+//For the test_input function pointers that the drivers pass to generic_test_next_input
+#define DRIVER_TEST_INPUT_CALL(func, ...) STATIC_DISPATCH_CALL(STATIC_DRIVER, func, test_input, __VA_ARGS__)
+#else
+#define DRIVER_CALL(driver, name, ...) (driver)->name(__VA_ARGS__)
+#define DRIVER_TEST_INPUT_CALL(func, ...) (func)(__VA_ARGS__)
+#endif
+
+#ifdef STATIC_INSTRUMENTATION
+#ifdef _WIN32
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, enable)(void * instrumentation_state, HANDLE * process, char * cmd_line,
+	char * input, size_t input_length);
+#else
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, enable)(void * instrumentation_state, pid_t * process, char * cmd_line,
+	char * input, size_t input_length);
+#endif
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, is_new_path)(void * instrumentation_state);
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, get_fuzz_result)(void * instrumentation_state);
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, is_process_done)(void * instrumentation_state);
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, wait_for_process_done)(void * instrumentation_state, int timeout_ms);
+
+#define INSTRUMENTATION_CALL(instrumentation, name, ...) \
+	STATIC_DISPATCH_CALL(STATIC_INSTRUMENTATION, (instrumentation)->name, name, __VA_ARGS__)
+#else
+#define INSTRUMENTATION_CALL(instrumentation, name, ...) (instrumentation)->name(__VA_ARGS__)
+#endif
+
+//finish_round is optional, so it's only called directly if the instrumentation has one
+#if defined(STATIC_INSTRUMENTATION) && defined(STATIC_INSTRUMENTATION_FINISH_ROUND)
+int STATIC_DISPATCH_NAME(STATIC_INSTRUMENTATION, finish_round)(void * instrumentation_state,
+	instrumentation_round_result_t * result);
+
+#define INSTRUMENTATION_FINISH_ROUND(instrumentation, ...) \
+	STATIC_DISPATCH_CALL(STATIC_INSTRUMENTATION, (instrumentation)->finish_round, finish_round, __VA_ARGS__)
+#else
+#define INSTRUMENTATION_FINISH_ROUND(instrumentation, ...) (instrumentation)->finish_round(__VA_ARGS__)
+#endif
+
+#ifdef STATIC_MUTATOR
+int STATIC_DISPATCH_NAME(STATIC_MUTATOR, mutate)(void * mutator_state, char * buffer, size_t buffer_length);
+
+#define MUTATOR_CALL(mutator, name, ...) STATIC_DISPATCH_CALL(STATIC_MUTATOR, (mutator)->name, name, __VA_ARGS__)
+#else
+#define MUTATOR_CALL(mutator, name, ...) (mutator)->name(__VA_ARGS__)
+#endif
+
+//mutate_growable is optional, and mutator_mutate_growable falls back to mutate_extended without it
+#if defined(STATIC_MUTATOR) && defined(STATIC_MUTATOR_GROWABLE)
+int STATIC_DISPATCH_NAME(STATIC_MUTATOR, mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
+
+#define MUTATOR_MUTATE_GROWABLE(mutator, mutator_state, buffer, flags)                                        \
+	((mutator)->mutate_growable == STATIC_DISPATCH_NAME(STATIC_MUTATOR, mutate_growable)                      \
+		? STATIC_DISPATCH_NAME(STATIC_MUTATOR, mutate_growable)(mutator_state, buffer, flags)                 \
+		: mutator_mutate_growable(mutator, mutator_state, buffer, flags))
+#else
+#define MUTATOR_MUTATE_GROWABLE(mutator, mutator_state, buffer, flags) \
+	mutator_mutate_growable(mutator, mutator_state, buffer, flags)
+#endif
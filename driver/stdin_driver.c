@@ -2,9 +2,13 @@
 
 #include <global_types.h>     // for mutator_t
 #include <utils.h>
+#include <uring.h>
+#include <mutator_factory.h>
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h" // IWYU pragma: keep
+#include "phase_timing.h"
+#include "static_dispatch.h"
 
 //c headers
 #include <stdio.h>
@@ -42,13 +46,19 @@ static stdin_state_t * setup_options(char * options)
 	PARSE_OPTION_STRING(state, options, path, "path", stdin_cleanup);
 	PARSE_OPTION_STRING(state, options, arguments, "arguments", stdin_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", stdin_cleanup);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout_ms", stdin_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, adaptive_timeout, "adaptive_timeout", stdin_cleanup);
+	PARSE_OPTION_INT(state, options, dedup, "dedup", stdin_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", stdin_cleanup);
 
 	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 2;
 	state->cmd_line = (char *)malloc(cmd_length);
 
 	//Validate the options
-	if (!state->path || !state->cmd_line || !file_exists(state->path) || state->input_ratio <= 0)
+	if (!state->path || !state->cmd_line || !file_exists(state->path) || state->input_ratio <= 0
+		|| hang_timeout_init(&state->hang_timeout, state->timeout, state->timeout_ms, state->adaptive_timeout)
+		|| dedup_filter_init(&state->dedup_filter, state->dedup)
+		|| fixups_create(options, &state->fixups))
 	{
 		stdin_cleanup(state);
 		return NULL;
@@ -86,7 +96,7 @@ void * stdin_create(char * options, instrumentation_t * instrumentation, void *
 	{
 		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
 		if (num_inputs != 1
-			|| setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| setup_growable_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer))
 		{
 			free(input_sizes);
 			stdin_cleanup(state);
@@ -112,7 +122,9 @@ void stdin_cleanup(void * driver_state)
 {
 	stdin_state_t * state = (stdin_state_t *)driver_state;
 
-	free(state->mutate_buffer);
+	growable_buffer_free(&state->mutate_buffer);
+	dedup_filter_free(&state->dedup_filter);
+	fixups_free(state->fixups);
 	free(state->path);
 	free(state->arguments);
 	free(state->cmd_line);
@@ -132,11 +144,14 @@ int stdin_test_input(void * driver_state, char * input, size_t length)
 	stdin_state_t * state = (stdin_state_t *)driver_state;
 
 	//Start the process and give it our input
-	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, input, length))
+	PHASE_BEGIN(PHASE_ENABLE);
+	if(INSTRUMENTATION_CALL(state->instrumentation, enable, state->instrumentation_state, &state->process, state->cmd_line,
+		input, length))
 		return FUZZ_ERROR;
+	PHASE_END(PHASE_ENABLE);
 
 	//Wait for it to be done
-	return generic_wait_for_process_completion(state->process, state->timeout,
+	return hang_timeout_wait_for_process_completion(state->process, &state->hang_timeout,
 		state->instrumentation, state->instrumentation_state);
 }
 
@@ -149,8 +164,10 @@ int stdin_test_input(void * driver_state, char * input, size_t length)
 int stdin_test_next_input(void * driver_state)
 {
 	stdin_state_t * state = (stdin_state_t *)driver_state;
-	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
-		state->mutate_buffer_length, stdin_test_input, &state->mutate_last_size);
+
+	uring_register_buffer(state->mutate_buffer.data, state->mutate_buffer.capacity);
+	return generic_test_next_growable_input(state, state->mutator, state->mutator_state, &state->mutate_buffer,
+		stdin_test_input, &state->mutate_last_size, &state->dedup_filter, state->fixups);
 }
 
 /**
@@ -168,7 +185,37 @@ char * stdin_get_last_input(void * driver_state, int * length)
 	if (!state->mutator || state->mutate_last_size <= 0)
 		return NULL;
 	*length = state->mutate_last_size;
-	return memdup(state->mutate_buffer, state->mutate_last_size);
+	return memdup(state->mutate_buffer.data, state->mutate_last_size);
+}
+
+/**
+ * This function returns the last input that was sent to the target program, without copying it.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - a pointer to the driver's buffer holding the last input, which is only valid until the next
+ * test, or NULL if there isn't one
+ */
+const char * stdin_peek_last_input(void * driver_state, int * length)
+{
+	stdin_state_t * state = (stdin_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return state->mutate_buffer.data;
+}
+
+/**
+ * This function escalates the hang timeout that the driver uses for the next tests, so that an input which
+ * timed out can be tested again with a longer timeout.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @param multiplier - the multiple of the configured timeout to use, or 0 to restore the timeout
+ * @return - zero on success
+ */
+int stdin_escalate_timeout(void * driver_state, double multiplier)
+{
+	stdin_state_t * state = (stdin_state_t *)driver_state;
+	hang_timeout_escalate(&state->hang_timeout, multiplier);
+	return 0;
 }
 
 /**
@@ -185,9 +232,25 @@ int stdin_help(char ** help_str)
 "  path                  The path to the target process\n"
 "Optional Options:\n"
 "  arguments             Arguments to pass to the target process\n"
-"  ratio                 The ratio of mutation buffer size to input size when\n""                          given a mutator\n"
+"  dedup                 Remember this many of the recently tested inputs, and\n"
+"                          skip mutations that are identical to one of them\n"
+"                          (default 0, disabled)\n"
+"  fixups                An array of the checksum and length fields to rewrite\n"
+"                          in each mutated input, e.g. [{\"type\": \"crc32\",\n"
+"                          \"offset\": -4, \"end\": -4}].  The types are crc32,\n"
+"                          crc32c, adler32 and length, and each field also\n"
+"                          takes start, end, size, big_endian and adjust\n"
+"                          (default none)\n"
+"  ratio                 The ratio of mutation buffer size to input size when\n"
+"                          given a mutator.  The buffer starts at this size,\n"
+"                          and grows for mutators that make larger inputs\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
 "                          process to finish\n"
+"  timeout_ms            The maximum number of milliseconds to wait for the\n"
+"                          target process to finish.  If set, this overrides\n"
+"                          timeout\n"
+"  adaptive_timeout      Lower the timeout to this multiple of the target\n"
+"                          process's 99th percentile exec time\n"
 "\n"
 	);
 	if (*help_str == NULL)
@@ -1,4 +1,5 @@
 #pragma once
+#include "driver.h"
 #include "instrumentation.h"
 #include <global_types.h>
 #include <sys/types.h>        // for pid_t
@@ -10,6 +11,8 @@ void stdin_cleanup(void * driver_state);
 int stdin_test_input(void * driver_state, char * buffer, size_t length);
 int stdin_test_next_input(void * driver_state);
 char * stdin_get_last_input(void * driver_state, int * length);
+const char * stdin_peek_last_input(void * driver_state, int * length);
+int stdin_escalate_timeout(void * driver_state, double multiplier);
 int stdin_help(char ** help_str);
 
 struct stdin_state
@@ -18,6 +21,9 @@ struct stdin_state
 	char * path;         //The path to the fuzzed executable
 	char * arguments;    //Arguments to give the binary
 	int timeout;         //Maximum number of seconds to allow the executable to run
+	int timeout_ms;      //Maximum number of milliseconds to allow the executable to run, overrides timeout
+	double adaptive_timeout; //Multiple of the p99 exec time to use as the timeout, or 0 to disable
+	int dedup;               //The number of recently tested inputs to remember and skip duplicates of
 	double input_ratio;  //the ratio of the maximum input size
 
 	//The handle to the fuzzed process instance
@@ -27,6 +33,15 @@ struct stdin_state
 	pid_t process;
 	#endif
 
+	//The hang timeout, calculated from the timeout options
+	hang_timeout_t hang_timeout;
+
+	//The recently tested inputs, which are skipped if a mutation repeats one of them
+	dedup_filter_t dedup_filter;
+
+	//The checksum and length fields to rewrite in each mutated input, or NULL
+	fixups_t * fixups;
+
 	//command line of the fuzzed process
 	char * cmd_line;
 
@@ -38,8 +53,7 @@ struct stdin_state
 
 	mutator_t * mutator;
 	void * mutator_state;
-	char * mutate_buffer;
-	size_t mutate_buffer_length;
+	growable_buffer_t mutate_buffer;
 	int mutate_last_size;
 };
 typedef struct stdin_state stdin_state_t;
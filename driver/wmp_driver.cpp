@@ -9,15 +9,276 @@
 //c headers
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 //Windows API
 #include <process.h>
 #include <Mmdeviceapi.h>
 #include <mmdeviceapi.h>
-#include <endpointvolume.h>
+#include <audiopolicy.h>
 
-static int is_playing_sound();
+#define EXIT_ON_ERROR(hres)  \
+              if (FAILED(hres)) { goto done; }
+#define SAFE_RELEASE(punk)  \
+              if ((punk) != NULL)  \
+                { (punk)->Release(); (punk) = NULL; }
+
+/**
+ * Watches the default audio device for the fuzzed process to start playing sound, which is used to determine
+ * if the wmplayer.exe process has finished parsing the fuzzed file.  The session manager calls OnSessionCreated
+ * when a process opens an audio session, and the session calls OnStateChanged when its stream starts.  Both are
+ * called on the audio service's threads, so they only record what happened and set the watcher's event.  The
+ * driver waits on the event, and inspects the sessions on its own thread in is_playing.
+ */
+class AudioWatcher : public IAudioSessionNotification, public IAudioSessionEvents
+{
+public:
+	HANDLE event; //Set when the fuzzed process opens an audio session, or its session starts playing
+
+	static AudioWatcher * create();
+	void destroy();
+	void start(DWORD process_id);
+	int is_playing();
+
+	//IUnknown
+	STDMETHODIMP QueryInterface(REFIID riid, void ** object);
+	STDMETHODIMP_(ULONG) AddRef() { return InterlockedIncrement(&ref); }
+	STDMETHODIMP_(ULONG) Release();
+
+	//IAudioSessionNotification
+	STDMETHODIMP OnSessionCreated(IAudioSessionControl * new_session);
+
+	//IAudioSessionEvents
+	STDMETHODIMP OnStateChanged(AudioSessionState new_state);
+	STDMETHODIMP OnDisplayNameChanged(LPCWSTR name, LPCGUID context) { return S_OK; }
+	STDMETHODIMP OnIconPathChanged(LPCWSTR path, LPCGUID context) { return S_OK; }
+	STDMETHODIMP OnSimpleVolumeChanged(float volume, BOOL mute, LPCGUID context) { return S_OK; }
+	STDMETHODIMP OnChannelVolumeChanged(DWORD count, float volumes[], DWORD changed, LPCGUID context) { return S_OK; }
+	STDMETHODIMP OnGroupingParamChanged(LPCGUID grouping, LPCGUID context) { return S_OK; }
+	STDMETHODIMP OnSessionDisconnected(AudioSessionDisconnectReason reason) { return S_OK; }
+
+private:
+	volatile LONG ref;
+	volatile LONG process_id;                 //The process whose sessions are watched
+	volatile LONG playing;                    //Whether the watched session has started playing
+	IAudioSessionManager2 * manager;
+	IAudioSessionControl * volatile pending;  //A session the process opened that hasn't been watched yet
+	IAudioSessionControl * session;           //The watched session
+
+	AudioWatcher() : event(NULL), ref(1), process_id(0), playing(0), manager(NULL), pending(NULL), session(NULL) {}
+	int session_process_matches(IAudioSessionControl * ctl);
+	void watch(IAudioSessionControl * ctl);
+	void stop();
+};
+
+/**
+ * This function creates an AudioWatcher for the default audio device.
+ * @return - the new AudioWatcher, or NULL if the audio device couldn't be watched
+ */
+AudioWatcher * AudioWatcher::create()
+{
+	HRESULT hr = S_OK;
+	IMMDeviceEnumerator *pEnumerator = NULL;
+	IMMDevice *pDevice = NULL;
+	IAudioSessionEnumerator *pSessions = NULL;
+	AudioWatcher * watcher = new AudioWatcher();
+
+	watcher->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!watcher->event)
+		goto done;
+
+	hr = CoCreateInstance(
+		__uuidof(MMDeviceEnumerator), NULL,
+		CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
+		(void**)&pEnumerator);
+	EXIT_ON_ERROR(hr);
+
+	hr = pEnumerator->GetDefaultAudioEndpoint(eRender, eConsole, &pDevice);
+	EXIT_ON_ERROR(hr);
+
+	hr = pDevice->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, NULL, (void**)&watcher->manager);
+	EXIT_ON_ERROR(hr);
+
+	//The session manager doesn't send notifications until the sessions have been enumerated once
+	hr = watcher->manager->GetSessionEnumerator(&pSessions);
+	EXIT_ON_ERROR(hr);
+
+	hr = watcher->manager->RegisterSessionNotification(watcher);
+
+done:
+	SAFE_RELEASE(pEnumerator);
+	SAFE_RELEASE(pDevice);
+	SAFE_RELEASE(pSessions);
+	if (!watcher->event || FAILED(hr))
+	{
+		if (watcher->event)
+			CloseHandle(watcher->event);
+		SAFE_RELEASE(watcher->manager);
+		watcher->Release();
+		return NULL;
+	}
+	return watcher;
+}
+
+/**
+ * This function stops watching the audio device and frees the AudioWatcher.
+ */
+void AudioWatcher::destroy()
+{
+	stop();
+	manager->UnregisterSessionNotification(this);
+	SAFE_RELEASE(manager);
+	CloseHandle(event);
+	Release();
+}
+
+/**
+ * This function starts watching a new fuzzed process' audio sessions, and stops watching the last process'.
+ * Sessions that the process opened before this was called are found by enumerating the existing sessions.
+ * @param new_process_id - the process id of the fuzzed process
+ */
+void AudioWatcher::start(DWORD new_process_id)
+{
+	IAudioSessionEnumerator *pSessions = NULL;
+	IAudioSessionControl *pControl = NULL;
+	int count, i;
+
+	stop();
+	InterlockedExchange(&process_id, (LONG)new_process_id);
+
+	if (FAILED(manager->GetSessionEnumerator(&pSessions)))
+		return;
+	if (SUCCEEDED(pSessions->GetCount(&count)))
+	{
+		for (i = 0; i < count && !session; i++)
+		{
+			if (SUCCEEDED(pSessions->GetSession(i, &pControl)))
+			{
+				if (session_process_matches(pControl))
+					watch(pControl);
+				SAFE_RELEASE(pControl);
+			}
+		}
+	}
+	SAFE_RELEASE(pSessions);
+}
+
+/**
+ * This function determines if the fuzzed process is playing sound.  It should be called after the watcher's
+ * event is set, to start watching any session the process opened.
+ * @return - 1 if sound is being played, 0 if sound is not being played
+ */
+int AudioWatcher::is_playing()
+{
+	IAudioSessionControl * ctl = (IAudioSessionControl *)InterlockedExchangePointer((PVOID volatile *)&pending, NULL);
+	if (ctl)
+	{
+		watch(ctl);
+		ctl->Release();
+	}
+	return playing != 0;
+}
+
+/**
+ * This function determines if an audio session belongs to the watched process.
+ * @param ctl - the session to check
+ * @return - 1 if the session belongs to the watched process, 0 otherwise
+ */
+int AudioWatcher::session_process_matches(IAudioSessionControl * ctl)
+{
+	IAudioSessionControl2 *pControl2 = NULL;
+	DWORD session_process_id = 0;
+
+	if (FAILED(ctl->QueryInterface(__uuidof(IAudioSessionControl2), (void**)&pControl2)))
+		return 0;
+	pControl2->GetProcessId(&session_process_id);
+	SAFE_RELEASE(pControl2);
+	return process_id && session_process_id == (DWORD)process_id;
+}
+
+/**
+ * This function starts watching one of the fuzzed process' sessions for its stream to start.
+ * @param ctl - the session to watch
+ */
+void AudioWatcher::watch(IAudioSessionControl * ctl)
+{
+	AudioSessionState session_state;
+
+	if (session)
+		return;
+	if (FAILED(ctl->RegisterAudioSessionEvents(this)))
+		return;
+	ctl->AddRef();
+	session = ctl;
+
+	//The stream may have started before we registered
+	if (SUCCEEDED(ctl->GetState(&session_state)) && session_state == AudioSessionStateActive)
+		InterlockedExchange(&playing, 1);
+}
+
+/**
+ * This function stops watching the last fuzzed process' sessions.
+ */
+void AudioWatcher::stop()
+{
+	IAudioSessionControl * ctl;
+
+	InterlockedExchange(&process_id, 0);
+	ctl = (IAudioSessionControl *)InterlockedExchangePointer((PVOID volatile *)&pending, NULL);
+	SAFE_RELEASE(ctl);
+	if (session)
+	{
+		session->UnregisterAudioSessionEvents(this);
+		SAFE_RELEASE(session);
+	}
+	InterlockedExchange(&playing, 0);
+	ResetEvent(event);
+}
+
+STDMETHODIMP AudioWatcher::QueryInterface(REFIID riid, void ** object)
+{
+	if (riid == __uuidof(IUnknown) || riid == __uuidof(IAudioSessionNotification))
+		*object = static_cast<IAudioSessionNotification *>(this);
+	else if (riid == __uuidof(IAudioSessionEvents))
+		*object = static_cast<IAudioSessionEvents *>(this);
+	else
+	{
+		*object = NULL;
+		return E_NOINTERFACE;
+	}
+	AddRef();
+	return S_OK;
+}
+
+STDMETHODIMP_(ULONG) AudioWatcher::Release()
+{
+	ULONG count = InterlockedDecrement(&ref);
+	if (!count)
+		delete this;
+	return count;
+}
+
+STDMETHODIMP AudioWatcher::OnSessionCreated(IAudioSessionControl * new_session)
+{
+	IAudioSessionControl * old;
+
+	if (!session_process_matches(new_session))
+		return S_OK;
+	new_session->AddRef();
+	old = (IAudioSessionControl *)InterlockedExchangePointer((PVOID volatile *)&pending, new_session);
+	SAFE_RELEASE(old);
+	SetEvent(event);
+	return S_OK;
+}
+
+STDMETHODIMP AudioWatcher::OnStateChanged(AudioSessionState new_state)
+{
+	if (new_state == AudioSessionStateActive)
+	{
+		InterlockedExchange(&playing, 1);
+		SetEvent(event);
+	}
+	return S_OK;
+}
 
 /**
  * This function creates a wmp_state_t object based on the given options.
@@ -85,6 +346,9 @@ void * wmp_create(char * options, instrumentation_t * instrumentation, void * in
 
 	//We need to call this before we make WINAPI calls to get the audio device below
 	CoInitialize(NULL);
+	state->audio_watcher = AudioWatcher::create();
+	if (!state->audio_watcher)
+		WARNING_MSG("Couldn't watch the default audio device, inputs will run until wmplayer.exe exits or times out");
 
 	if (mutator)
 	{
@@ -117,6 +381,8 @@ void wmp_cleanup(void * driver_state)
 	wmp_state_t * state = (wmp_state_t *)driver_state;
 
 	free(state->mutate_buffer);
+	if (state->audio_watcher)
+		((AudioWatcher *)state->audio_watcher)->destroy();
 
 	free(state->path);
 	free(state->extension);
@@ -148,12 +414,30 @@ int wmp_test_input(void * driver_state, char * input, size_t length)
 	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
 		return FUZZ_ERROR;
 
-	time_t start_time = time(NULL);
-	int tmp_result = FUZZ_ERROR;
+	AudioWatcher * audio = (AudioWatcher *)state->audio_watcher;
+	uint64_t deadline = get_time_ms() + (uint64_t)state->timeout * 1000;
+	uint64_t now;
+	DWORD process_id = GetProcessId(state->process);
+	HWINEVENTHOOK dialog_hook;
+	HANDLE handles[2];
+	DWORD num_handles = 0, wait;
+	int check_dialog = 1; //Check once before waiting, in case a dialog was shown before the hook was installed
+	int tmp_result, result;
+	MSG msg;
+
+	dialog_hook = WatchProcessDialogs(process_id);
+	if (audio)
+		audio->start(process_id);
+	handles[num_handles++] = state->process;
+	if (audio)
+		handles[num_handles++] = audio->event;
 
 	// This is reimplementing the loop in generic_wait_for_process
-	// completion, because we want to do an additional check:
-	// `is_playing_sound`, which can end early.
+	// completion, because we want to do additional checks:
+	// if WMP is playing sound, or is showing an error dialog, this
+	// round can end early.  Rather than polling for those, we wait on
+	// the process, the audio watcher's event and the dialog hook's
+	// messages, so we find out as soon as any of them happen.
 	//
 	// We assume that if WMP is playing sound, it has successfully
 	// processed input, which means that we won't get a crash.
@@ -164,31 +448,60 @@ int wmp_test_input(void * driver_state, char * input, size_t length)
 		if (tmp_result == 1) // process is done, it crashed or exited cleanly
 		{
 			// so fetch the result from the instrumentation
-			return state->instrumentation->get_fuzz_result(state->instrumentation_state);
+			result = state->instrumentation->get_fuzz_result(state->instrumentation_state);
+			break;
 		}
 		else if (tmp_result == -1)
 		{
-			return FUZZ_ERROR;
+			result = FUZZ_ERROR;
+			break;
 		} // else it's still running, so do our other checks
 
 		// WMP is playing sound, so we don't expect a crash and can end
 		// this fuzz round.
-		if (is_playing_sound())
-			return FUZZ_NONE;
-		
-		if (time(NULL) - start_time > state->timeout)
-			return FUZZ_HANG;
-		
+		if (audio && audio->is_playing())
+		{
+			result = FUZZ_NONE;
+			break;
+		}
+
 		// If we're stuck in a modal dialog we're "hung". Works for debug, but not dynamorio
-		if (IsProcessInModalDialog(GetProcessId(state->process)))
-			return FUZZ_HANG;
-		
-		Sleep(50);
+		if (check_dialog && IsProcessInModalDialog(process_id))
+		{
+			result = FUZZ_HANG;
+			break;
+		}
+
+		now = get_time_ms();
+		if (now >= deadline)
+		{
+			result = FUZZ_HANG;
+			break;
+		}
+
+		wait = MsgWaitForMultipleObjects(num_handles, handles, FALSE, (DWORD)(deadline - now), QS_ALLINPUT);
+		if (wait == WAIT_OBJECT_0) // the process exited, so the instrumentation will have its result shortly
+		{
+			now = get_time_ms();
+			result = generic_wait_for_process_completion(state->process, now < deadline ? (int)(deadline - now) : 0,
+				state->instrumentation, state->instrumentation_state);
+			break;
+		}
+		else if (wait == WAIT_OBJECT_0 + num_handles) // the dialog hook's callback runs while we pump messages
+		{
+			while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+				DispatchMessage(&msg);
+		}
+		else if (wait == WAIT_FAILED)
+		{
+			result = FUZZ_ERROR;
+			break;
+		}
+		check_dialog = ProcessDialogStarted();
 	}
 
-	// We should never get here, because we should take one of the return
-	// statements in the above loop.
-	return FUZZ_ERROR;
+	UnwatchProcessDialogs(dialog_hook);
+	return result;
 }
 
 /**
@@ -201,7 +514,7 @@ int wmp_test_next_input(void * driver_state)
 {
 	wmp_state_t * state = (wmp_state_t *)driver_state;
 	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
-		state->mutate_buffer_length, wmp_test_input, &state->mutate_last_size);
+		state->mutate_buffer_length, wmp_test_input, &state->mutate_last_size, NULL, NULL);
 }
 
 /**
@@ -222,48 +535,20 @@ char * wmp_get_last_input(void * driver_state, int * length)
 	return (char *)memdup(state->mutate_buffer, state->mutate_last_size);
 }
 
-#define EXIT_ON_ERROR(hres)  \
-              if (FAILED(hres)) { goto done; }
-#define SAFE_RELEASE(punk)  \
-              if ((punk) != NULL)  \
-                { (punk)->Release(); (punk) = NULL; }
-
 /**
- * This function determines if any sound is currently being played out the speakers.  This is used to
- * determine if the wmplayer.exe process has finished parsing the fuzzed file and now trying to play it.
- * @return - 1 if sound is being played, 0 if sound is not being played, and -1 if an error occurs.
+ * This function returns the last input that was sent to the target program, without copying it.
+ * @param driver_state - a driver specific structure previously created by the wmp_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - a pointer to the driver's buffer holding the last input, which is only valid until the next
+ * test, or NULL if there isn't one
  */
-static int is_playing_sound()
+const char * wmp_peek_last_input(void * driver_state, int * length)
 {
-	HRESULT hr = S_OK;
-	IMMDeviceEnumerator *pEnumerator = NULL;
-	IMMDevice *pDevice = NULL;
-	IAudioMeterInformation *pMeterInfo = NULL;
-	HWND hPeakMeter = NULL;
-	float peak = 0;
-	int ret = -1;
-
-	hr = CoCreateInstance(
-		__uuidof(MMDeviceEnumerator), NULL,
-		CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
-		(void**)&pEnumerator);
-	EXIT_ON_ERROR(hr);
-
-	hr = pEnumerator->GetDefaultAudioEndpoint(eRender, eConsole, &pDevice);
-	EXIT_ON_ERROR(hr);
-
-	hr = pDevice->Activate(__uuidof(IAudioMeterInformation), CLSCTX_ALL, NULL, (void**)&pMeterInfo);
-	EXIT_ON_ERROR(hr);
-
-	hr = pMeterInfo->GetPeakValue(&peak);
-	EXIT_ON_ERROR(hr);
-	ret = peak > 0;
-
-done:
-	SAFE_RELEASE(pEnumerator);
-	SAFE_RELEASE(pDevice);
-	SAFE_RELEASE(pMeterInfo)
-	return ret;
+	wmp_state_t * state = (wmp_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return state->mutate_buffer;
 }
 
 /**
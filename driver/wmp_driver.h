@@ -15,6 +15,7 @@ FUNC_PREFIX void wmp_cleanup(void * driver_state);
 FUNC_PREFIX int wmp_test_input(void * driver_state, char * buffer, size_t length);
 FUNC_PREFIX int wmp_test_next_input(void * driver_state);
 FUNC_PREFIX char * wmp_get_last_input(void * driver_state, int * length);
+FUNC_PREFIX const char * wmp_peek_last_input(void * driver_state, int * length);
 FUNC_PREFIX int wmp_help(char ** help_str);
 
 struct wmp_state
@@ -29,6 +30,10 @@ struct wmp_state
 	//The handle to the wmplayer.exe instance
 	HANDLE process;
 
+	//An AudioWatcher (see wmp_driver.cpp) that reports when wmplayer.exe starts playing sound, or NULL if the
+	//audio device couldn't be watched
+	void * audio_watcher;
+
 	//command line of the fuzzed process
 	char * cmd_line;
 
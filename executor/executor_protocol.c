@@ -0,0 +1,558 @@
+#include "executor_protocol.h"
+
+#include <utils.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <WS2tcpip.h>
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define closesocket close
+#endif
+
+//The size of each (index, value) pair of a coverage delta
+#define TRACE_ENTRY_SIZE 5
+
+/**
+ * This function starts up the socket library, which only needs to be done on Windows.
+ * @return - zero on success, non-zero on failure
+ */
+int executor_sockets_init(void)
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+		ERROR_MSG("WSAStartup failed");
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * This function closes a socket that was opened by executor_connect or executor_listen, or accepted from one.
+ * @param sock - the socket to close
+ */
+void executor_close_socket(SOCKET sock)
+{
+	if (sock != INVALID_SOCKET)
+		closesocket(sock);
+}
+
+/**
+ * This function turns off Nagle's algorithm for a socket, so that each message is sent as soon as it's
+ * written, rather than after the acknowledgement of the last one.  The messages are request and reply,
+ * so otherwise every batch would wait for the delayed ACK.
+ * @param sock - the socket to set up
+ */
+static void set_no_delay(SOCKET sock)
+{
+	int enabled = 1;
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&enabled, sizeof(enabled)))
+		WARNING_MSG("Couldn't turn off Nagle's algorithm for the executor connection");
+}
+
+/**
+ * This function connects to an executor.
+ * @param address - the executor's address, as host:port, or just host for the default port
+ * @return - the connected socket, or INVALID_SOCKET on failure
+ */
+SOCKET executor_connect(const char * address)
+{
+	struct addrinfo hints, * addresses, * current;
+	char host[256], port[16];
+	const char * separator;
+	SOCKET sock = INVALID_SOCKET;
+
+	separator = strrchr(address, ':');
+	if (separator && (size_t)(separator - address) < sizeof(host)) {
+		memcpy(host, address, separator - address);
+		host[separator - address] = 0;
+		snprintf(port, sizeof(port), "%s", separator + 1);
+	} else {
+		snprintf(host, sizeof(host), "%s", address);
+		snprintf(port, sizeof(port), "%d", EXECUTOR_DEFAULT_PORT);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addresses)) {
+		ERROR_MSG("Couldn't resolve the executor address %s", address);
+		return INVALID_SOCKET;
+	}
+	for (current = addresses; current; current = current->ai_next)
+	{
+		sock = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+		if (sock == INVALID_SOCKET)
+			continue;
+		if (!connect(sock, current->ai_addr, (int)current->ai_addrlen))
+			break;
+		closesocket(sock);
+		sock = INVALID_SOCKET;
+	}
+	freeaddrinfo(addresses);
+
+	if (sock == INVALID_SOCKET)
+		ERROR_MSG("Couldn't connect to the executor at %s", address);
+	else
+		set_no_delay(sock);
+	return sock;
+}
+
+/**
+ * This function creates the socket that an executor listens for the fuzzer on.
+ * @param bind_address - the address to listen on, or NULL for all of them
+ * @param port - the port to listen on
+ * @return - the listening socket, or INVALID_SOCKET on failure
+ */
+SOCKET executor_listen(const char * bind_address, int port)
+{
+	struct addrinfo hints, * addresses;
+	char port_string[16];
+	SOCKET sock;
+	int enabled = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = bind_address ? AF_UNSPEC : AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	snprintf(port_string, sizeof(port_string), "%d", port);
+	if (getaddrinfo(bind_address, port_string, &hints, &addresses)) {
+		ERROR_MSG("Couldn't resolve the address %s to listen on", bind_address);
+		return INVALID_SOCKET;
+	}
+
+	sock = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+	if (sock == INVALID_SOCKET) {
+		freeaddrinfo(addresses);
+		ERROR_MSG("Couldn't create the executor's socket");
+		return INVALID_SOCKET;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&enabled, sizeof(enabled));
+	if (bind(sock, addresses->ai_addr, (int)addresses->ai_addrlen) || listen(sock, 1)) {
+		freeaddrinfo(addresses);
+		closesocket(sock);
+		ERROR_MSG("Couldn't listen on port %d", port);
+		return INVALID_SOCKET;
+	}
+	freeaddrinfo(addresses);
+	return sock;
+}
+
+/**
+ * This function accepts the fuzzer's connection on an executor's listening socket.
+ * @param listener - the socket that executor_listen created
+ * @return - the connected socket, or INVALID_SOCKET on failure
+ */
+SOCKET executor_accept(SOCKET listener)
+{
+	SOCKET sock = accept(listener, NULL, NULL);
+	if (sock != INVALID_SOCKET)
+		set_no_delay(sock);
+	return sock;
+}
+
+/**
+ * This function empties a buffer, so the next message can be built or received in it.
+ * @param buffer - the buffer to empty
+ */
+void executor_buffer_reset(executor_buffer_t * buffer)
+{
+	buffer->length = 0;
+	buffer->position = 0;
+}
+
+/**
+ * This function frees the memory of a buffer.
+ * @param buffer - the buffer to free
+ */
+void executor_buffer_free(executor_buffer_t * buffer)
+{
+	free(buffer->data);
+	memset(buffer, 0, sizeof(*buffer));
+}
+
+/**
+ * This function makes room in a buffer for more of the payload.
+ * @param buffer - the buffer to grow
+ * @param length - how many more bytes the buffer needs to hold
+ * @return - a pointer to where the bytes should be written, or NULL on failure
+ */
+static char * executor_buffer_reserve(executor_buffer_t * buffer, size_t length)
+{
+	size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+	char * data;
+
+	if (length > EXECUTOR_MAX_MESSAGE - buffer->length)
+		return NULL;
+	while (capacity < buffer->length + length)
+		capacity *= 2;
+	if (capacity != buffer->capacity) {
+		data = (char *)realloc(buffer->data, capacity);
+		if (!data)
+			return NULL;
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+	buffer->length += length;
+	return buffer->data + buffer->length - length;
+}
+
+/**
+ * These functions add an integer to a payload.
+ * @param buffer - the buffer to add the integer to
+ * @param value - the integer to add
+ * @return - zero on success, non-zero on failure
+ */
+int executor_put_u32(executor_buffer_t * buffer, uint32_t value)
+{
+	uint8_t * data = (uint8_t *)executor_buffer_reserve(buffer, 4);
+	int i;
+
+	if (!data)
+		return 1;
+	for (i = 0; i < 4; i++)
+		data[i] = (uint8_t)(value >> (8 * i));
+	return 0;
+}
+
+int executor_put_u64(executor_buffer_t * buffer, uint64_t value)
+{
+	return executor_put_u32(buffer, (uint32_t)value) || executor_put_u32(buffer, (uint32_t)(value >> 32));
+}
+
+/**
+ * This function adds a run of bytes to a payload, as its length and its contents.
+ * @param buffer - the buffer to add the bytes to
+ * @param data - the bytes to add
+ * @param length - the length of the data parameter
+ * @return - zero on success, non-zero on failure
+ */
+int executor_put_bytes(executor_buffer_t * buffer, const char * data, size_t length)
+{
+	char * dest;
+
+	if (length > UINT32_MAX || executor_put_u32(buffer, (uint32_t)length))
+		return 1;
+	dest = executor_buffer_reserve(buffer, length);
+	if (!dest)
+		return 1;
+	if (length)
+		memcpy(dest, data, length);
+	return 0;
+}
+
+/**
+ * This function adds a string to a payload, as its length and its contents.
+ * @param buffer - the buffer to add the string to
+ * @param string - the string to add, or NULL to add an empty string
+ * @return - zero on success, non-zero on failure
+ */
+int executor_put_string(executor_buffer_t * buffer, const char * string)
+{
+	return executor_put_bytes(buffer, string, string ? strlen(string) : 0);
+}
+
+/**
+ * This function adds an input's result to a payload, with the nonzero bytes of its coverage map as the
+ * coverage delta.
+ * @param buffer - the buffer to add the result to
+ * @param result - the result to add.  Its trace and trace_count are ignored.
+ * @param trace_bits - the coverage map to send with the result, or NULL to send the result without one
+ * @param trace_size - the size of the trace_bits parameter
+ * @return - zero on success, non-zero on failure
+ */
+int executor_put_result(executor_buffer_t * buffer, const executor_result_t * result, const uint8_t * trace_bits,
+	size_t trace_size)
+{
+	size_t count_position, i;
+	uint32_t count = 0;
+	uint8_t * data;
+
+	if (executor_put_u32(buffer, (uint32_t)result->fuzz_result) || executor_put_u32(buffer, (uint32_t)result->new_path))
+		return 1;
+	data = (uint8_t *)executor_buffer_reserve(buffer, 2);
+	if (!data)
+		return 1;
+	data[0] = result->has_path_hash;
+	data[1] = result->has_crash_hash;
+	if (executor_put_u64(buffer, result->path_hash) || executor_put_u64(buffer, result->crash_hash)
+		|| executor_put_u64(buffer, result->exec_us) || executor_put_u64(buffer, result->exec_instructions))
+		return 1;
+
+	//The count is filled in once the nonzero bytes have been counted
+	count_position = buffer->length;
+	if (executor_put_u32(buffer, 0))
+		return 1;
+	for (i = 0; trace_bits && i < trace_size; i++)
+	{
+		if (!trace_bits[i])
+			continue;
+		if (executor_put_u32(buffer, (uint32_t)i))
+			return 1;
+		data = (uint8_t *)executor_buffer_reserve(buffer, 1);
+		if (!data)
+			return 1;
+		*data = trace_bits[i];
+		count++;
+	}
+	data = (uint8_t *)buffer->data + count_position;
+	for (i = 0; i < 4; i++)
+		data[i] = (uint8_t)(count >> (8 * i));
+	return 0;
+}
+
+/**
+ * These functions read an integer from a payload.
+ * @param buffer - the buffer to read from
+ * @param value - used to return the integer
+ * @return - zero on success, non-zero if the payload is too short
+ */
+int executor_get_u32(executor_buffer_t * buffer, uint32_t * value)
+{
+	const uint8_t * data;
+
+	if (buffer->length - buffer->position < 4)
+		return 1;
+	data = (const uint8_t *)buffer->data + buffer->position;
+	*value = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+	buffer->position += 4;
+	return 0;
+}
+
+int executor_get_u64(executor_buffer_t * buffer, uint64_t * value)
+{
+	uint32_t low, high;
+
+	if (executor_get_u32(buffer, &low) || executor_get_u32(buffer, &high))
+		return 1;
+	*value = low | ((uint64_t)high << 32);
+	return 0;
+}
+
+/**
+ * This function reads a length prefixed run of bytes from a payload.
+ * @param buffer - the buffer to read from
+ * @param length - used to return the number of bytes
+ * @return - a pointer to the bytes in the buffer, or NULL if the payload is too short
+ */
+const char * executor_get_bytes(executor_buffer_t * buffer, size_t * length)
+{
+	uint32_t bytes_length;
+	const char * bytes;
+
+	if (executor_get_u32(buffer, &bytes_length) || buffer->length - buffer->position < bytes_length)
+		return NULL;
+	bytes = buffer->data + buffer->position;
+	buffer->position += bytes_length;
+	*length = bytes_length;
+	return bytes;
+}
+
+/**
+ * This function reads a string from a payload.
+ * @param buffer - the buffer to read from
+ * @param string - used to return a copy of the string, which should be freed with free, or NULL if the string
+ * is empty
+ * @return - zero on success, non-zero if the payload is too short or the string couldn't be copied
+ */
+int executor_get_string(executor_buffer_t * buffer, char ** string)
+{
+	const char * bytes;
+	size_t length;
+
+	*string = NULL;
+	bytes = executor_get_bytes(buffer, &length);
+	if (!bytes)
+		return 1;
+	if (!length)
+		return 0;
+	*string = (char *)malloc(length + 1);
+	if (!*string)
+		return 1;
+	memcpy(*string, bytes, length);
+	(*string)[length] = 0;
+	return 0;
+}
+
+/**
+ * This function reads an input's result from a payload.
+ * @param buffer - the buffer to read from
+ * @param result - used to return the result.  Its trace points into the buffer, and is only valid until the
+ * next message is received into it.
+ * @return - zero on success, non-zero if the payload is malformed
+ */
+int executor_get_result(executor_buffer_t * buffer, executor_result_t * result)
+{
+	uint32_t fuzz_result, new_path;
+
+	if (executor_get_u32(buffer, &fuzz_result) || executor_get_u32(buffer, &new_path)
+		|| buffer->length - buffer->position < 2)
+		return 1;
+	result->fuzz_result = (int32_t)fuzz_result;
+	result->new_path = (int32_t)new_path;
+	result->has_path_hash = (uint8_t)buffer->data[buffer->position];
+	result->has_crash_hash = (uint8_t)buffer->data[buffer->position + 1];
+	buffer->position += 2;
+	if (executor_get_u64(buffer, &result->path_hash) || executor_get_u64(buffer, &result->crash_hash)
+		|| executor_get_u64(buffer, &result->exec_us) || executor_get_u64(buffer, &result->exec_instructions)
+		|| executor_get_u32(buffer, &result->trace_count)
+		|| (buffer->length - buffer->position) / TRACE_ENTRY_SIZE < result->trace_count)
+		return 1;
+	result->trace = buffer->data + buffer->position;
+	buffer->position += (size_t)result->trace_count * TRACE_ENTRY_SIZE;
+	return 0;
+}
+
+/**
+ * This function writes a result's coverage delta into a coverage map.  Only the bytes in the delta are
+ * written, so the map should be zeroed first.
+ * @param result - the result with the coverage delta
+ * @param trace_bits - the coverage map to write the delta to
+ * @param trace_size - the size of the trace_bits parameter
+ * @return - zero on success, or non-zero if the delta doesn't fit in the map
+ */
+int executor_apply_trace(const executor_result_t * result, uint8_t * trace_bits, size_t trace_size)
+{
+	const uint8_t * entry = (const uint8_t *)result->trace;
+	uint32_t i, index;
+
+	for (i = 0; i < result->trace_count; i++, entry += TRACE_ENTRY_SIZE)
+	{
+		index = entry[0] | (entry[1] << 8) | (entry[2] << 16) | ((uint32_t)entry[3] << 24);
+		if (index >= trace_size)
+			return 1;
+		trace_bits[index] = entry[4];
+	}
+	return 0;
+}
+
+/**
+ * This function sends every byte of a buffer on a socket.
+ * @param sock - the socket to send on
+ * @param data - the bytes to send
+ * @param length - the length of the data parameter
+ * @param flags - the flags to send the bytes with
+ * @return - zero on success, non-zero on failure
+ */
+static int send_all(SOCKET sock, const char * data, size_t length, int flags)
+{
+	int sent;
+
+#ifdef MSG_NOSIGNAL
+	//A closed connection is reported as an error, rather than with a SIGPIPE
+	flags |= MSG_NOSIGNAL;
+#endif
+	while (length)
+	{
+		sent = send(sock, data, length > 0x40000000 ? 0x40000000 : (int)length, flags);
+		if (sent <= 0) {
+#ifndef _WIN32
+			if (sent < 0 && errno == EINTR)
+				continue;
+#endif
+			return 1;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return 0;
+}
+
+/**
+ * This function receives an exact number of bytes from a socket.
+ * @param sock - the socket to receive from
+ * @param data - the buffer to receive the bytes into
+ * @param length - the number of bytes to receive
+ * @return - zero on success, non-zero on failure or if the connection was closed first
+ */
+static int receive_all(SOCKET sock, char * data, size_t length)
+{
+	int received;
+
+	while (length)
+	{
+		received = recv(sock, data, length > 0x40000000 ? 0x40000000 : (int)length, 0);
+		if (received <= 0) {
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR)
+				continue;
+#endif
+			return 1;
+		}
+		data += received;
+		length -= received;
+	}
+	return 0;
+}
+
+/**
+ * This function sends a message.  Where MSG_MORE is supported, the header is held back until the payload is
+ * sent, so that the message goes out in as few packets as possible even though Nagle's algorithm is off.
+ * @param sock - the socket to send the message on
+ * @param type - the executor_message_type of the message
+ * @param payload - the message's payload, or NULL for a message without one
+ * @return - zero on success, non-zero on failure
+ */
+int executor_send_message(SOCKET sock, uint32_t type, executor_buffer_t * payload)
+{
+	executor_buffer_t header;
+	char header_data[8];
+
+	header.data = header_data;
+	header.capacity = sizeof(header_data);
+	header.length = header.position = 0;
+	executor_put_u32(&header, type);
+	executor_put_u32(&header, payload ? (uint32_t)payload->length : 0);
+	if (!payload || !payload->length)
+		return send_all(sock, header_data, sizeof(header_data), 0);
+#ifdef MSG_MORE
+	if (send_all(sock, header_data, sizeof(header_data), MSG_MORE))
+#else
+	if (send_all(sock, header_data, sizeof(header_data), 0))
+#endif
+		return 1;
+	return send_all(sock, payload->data, payload->length, 0);
+}
+
+/**
+ * This function receives a message.
+ * @param sock - the socket to receive the message from
+ * @param type - used to return the executor_message_type of the message
+ * @param payload - the buffer to receive the payload into, which is ready to be read from
+ * @return - zero on success, non-zero on failure or if the connection was closed
+ */
+int executor_receive_message(SOCKET sock, uint32_t * type, executor_buffer_t * payload)
+{
+	executor_buffer_t header;
+	char header_data[8];
+	uint32_t length;
+	char * data;
+
+	if (receive_all(sock, header_data, sizeof(header_data)))
+		return 1;
+	header.data = header_data;
+	header.capacity = header.length = sizeof(header_data);
+	header.position = 0;
+	executor_get_u32(&header, type);
+	executor_get_u32(&header, &length);
+
+	executor_buffer_reset(payload);
+	data = executor_buffer_reserve(payload, length);
+	if (!data && length) {
+		ERROR_MSG("The executor message's %u byte payload is too large", length);
+		return 1;
+	}
+	return length && receive_all(sock, data, length);
+}
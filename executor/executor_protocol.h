@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#else
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#endif
+
+//The executor protocol lets a central fuzzer run its inputs on other machines.  An executor agent on each
+//worker node listens for the fuzzer, creates the driver and instrumentation that the fuzzer asks for, and
+//then runs the batches of inputs the fuzzer sends it, replying with each input's results.  The fuzzer keeps
+//the corpus and the global virgin map, and mutates the inputs itself, so the executors only run targets.
+//
+//Every message is an 8 byte header, with the message type and the length of the payload (both 32-bit little
+//endian), followed by the payload.  The integers in the payloads are little endian as well.
+//	EXECUTOR_MSG_SETUP   fuzzer -> executor   magic, version, then the driver name, driver options,
+//	                                          instrumentation name, and instrumentation options, each as a
+//	                                          length and the string (options of length zero are omitted)
+//	EXECUTOR_MSG_READY   executor -> fuzzer   nothing, once the driver and instrumentation are created
+//	EXECUTOR_MSG_ERROR   executor -> fuzzer   a message saying why the setup or batch failed
+//	EXECUTOR_MSG_BATCH   fuzzer -> executor   the number of inputs, then each input's length and contents
+//	EXECUTOR_MSG_RESULTS executor -> fuzzer   the number of results, the size of the coverage map (or 0 if the
+//	                                          instrumentation doesn't have one), then each input's
+//	                                          executor_result_t, in the order they were sent (see
+//	                                          executor_put_result)
+//A result's coverage delta is only sent for the inputs that found a new path on the executor, as the nonzero
+//bytes of the coverage map.  The executor's own virgin map only has what it has run, so any input that's new
+//to the fuzzer's global virgin map is new to the executor too, and the rest of the runs cost a few bytes.
+
+#define EXECUTOR_PROTOCOL_MAGIC   0x5845424B //"KBEX"
+#define EXECUTOR_PROTOCOL_VERSION 1
+#define EXECUTOR_DEFAULT_PORT     9900
+#define EXECUTOR_MAX_MESSAGE      (256 * 1024 * 1024)
+
+enum executor_message_type
+{
+	EXECUTOR_MSG_SETUP = 1,
+	EXECUTOR_MSG_READY,
+	EXECUTOR_MSG_ERROR,
+	EXECUTOR_MSG_BATCH,
+	EXECUTOR_MSG_RESULTS
+};
+
+//A growable buffer that a message's payload is built in, or a payload that's being read
+struct executor_buffer
+{
+	char * data;
+	size_t length;    //The length of the payload written so far
+	size_t capacity;
+	size_t position;  //How much of the payload has been read
+};
+typedef struct executor_buffer executor_buffer_t;
+
+struct executor_result
+{
+	int32_t fuzz_result;  //The driver's FUZZ_ result, or -1 if the driver failed to test the input
+	int32_t new_path;     //The executor's instrumentation's is_new_path result
+	uint8_t has_path_hash;
+	uint8_t has_crash_hash;
+	uint64_t path_hash;
+	uint64_t crash_hash;
+	uint64_t exec_us;
+	uint64_t exec_instructions;
+	uint32_t trace_count; //The number of nonzero bytes in the coverage delta
+	const char * trace;   //The coverage delta, trace_count (32-bit index, value) pairs, in the received payload
+};
+typedef struct executor_result executor_result_t;
+
+int executor_sockets_init(void);
+void executor_close_socket(SOCKET sock);
+SOCKET executor_connect(const char * address);
+SOCKET executor_listen(const char * bind_address, int port);
+SOCKET executor_accept(SOCKET listener);
+
+void executor_buffer_reset(executor_buffer_t * buffer);
+void executor_buffer_free(executor_buffer_t * buffer);
+int executor_put_u32(executor_buffer_t * buffer, uint32_t value);
+int executor_put_u64(executor_buffer_t * buffer, uint64_t value);
+int executor_put_bytes(executor_buffer_t * buffer, const char * data, size_t length);
+int executor_put_string(executor_buffer_t * buffer, const char * string);
+int executor_put_result(executor_buffer_t * buffer, const executor_result_t * result, const uint8_t * trace_bits,
+	size_t trace_size);
+int executor_get_u32(executor_buffer_t * buffer, uint32_t * value);
+int executor_get_u64(executor_buffer_t * buffer, uint64_t * value);
+const char * executor_get_bytes(executor_buffer_t * buffer, size_t * length);
+int executor_get_string(executor_buffer_t * buffer, char ** string);
+int executor_get_result(executor_buffer_t * buffer, executor_result_t * result);
+int executor_apply_trace(const executor_result_t * result, uint8_t * trace_bits, size_t trace_size);
+
+int executor_send_message(SOCKET sock, uint32_t type, executor_buffer_t * payload);
+int executor_receive_message(SOCKET sock, uint32_t * type, executor_buffer_t * payload);
@@ -0,0 +1,335 @@
+//This program is the executor agent, which runs a central fuzzer's inputs on a worker node (see
+//executor_protocol.h).  It listens for the fuzzer, creates the driver and instrumentation that the fuzzer
+//asks for, and runs the batches of inputs that the fuzzer sends, until the fuzzer disconnects.  Then it waits
+//for the next fuzzer, with a fresh driver and instrumentation state.
+
+#include "executor_protocol.h"
+
+#include <driver.h>
+#include <driver_factory.h>
+#include <instrumentation.h>
+#include <instrumentation_factory.h>
+#include <utils.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(char * program_name)
+{
+	char * help_text;
+	printf(
+		"Usage: %s [options]\n"
+		"\n"
+		"Options:\n"
+		"\t -b bind_address                The address to listen for the fuzzer on [all of them]\n"
+		"\t -l logging_options             Set the options for logging\n"
+		"\t -o                             Exit once the first fuzzer disconnects, rather than waiting for another\n"
+		"\t -p port                        The port to listen for the fuzzer on [%d]\n"
+		"\n"
+		"The fuzzer picks the driver and instrumentation, and their options, when it connects.  Start the fuzzer\n"
+		"with -X to have it run its inputs on executors.  The driver and instrumentation help is below.\n"
+		"\n",
+		program_name, EXECUTOR_DEFAULT_PORT
+	);
+
+#define PRINT_HELP(x, y) \
+	x = y;               \
+	if(x) {              \
+		puts(x);         \
+		free(x);         \
+	}
+
+	PRINT_HELP(help_text, logging_help());
+	PRINT_HELP(help_text, driver_help());
+	PRINT_HELP(help_text, instrumentation_help());
+	exit(1);
+}
+
+//What an executor runs the fuzzer's inputs with
+struct executor_session
+{
+	instrumentation_t * instrumentation;
+	void * instrumentation_state;
+	driver_t * driver;
+};
+typedef struct executor_session executor_session_t;
+
+/**
+ * This function tells the fuzzer why its setup or batch failed.
+ * @param sock - the fuzzer's connection
+ * @param buffer - the buffer to build the message in
+ * @param message - the message to send
+ */
+static void send_error(SOCKET sock, executor_buffer_t * buffer, const char * message)
+{
+	ERROR_MSG("%s", message);
+	executor_buffer_reset(buffer);
+	if (executor_put_string(buffer, message) || executor_send_message(sock, EXECUTOR_MSG_ERROR, buffer))
+		ERROR_MSG("Couldn't tell the fuzzer about the error");
+}
+
+/**
+ * This function frees what a session ran the inputs with.
+ * @param session - the session to clean up
+ */
+static void cleanup_session(executor_session_t * session)
+{
+	if (session->driver) {
+		session->driver->cleanup(session->driver->state);
+		free(session->driver);
+	}
+	if (session->instrumentation_state)
+		session->instrumentation->cleanup(session->instrumentation_state);
+	free(session->instrumentation);
+	memset(session, 0, sizeof(*session));
+}
+
+/**
+ * This function creates the driver and instrumentation that a fuzzer's setup message asks for.
+ * @param session - the session to set up
+ * @param payload - the setup message's payload
+ * @param error - used to return why the setup failed, on failure
+ * @param error_length - the size of the error parameter
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_session(executor_session_t * session, executor_buffer_t * payload, char * error, size_t error_length)
+{
+	char * driver_name = NULL, * driver_options = NULL, * instrumentation_name = NULL, * instrumentation_options = NULL;
+	uint32_t magic, version;
+	int ret = 1;
+
+	memset(session, 0, sizeof(*session));
+	if (executor_get_u32(payload, &magic) || executor_get_u32(payload, &version)
+		|| magic != EXECUTOR_PROTOCOL_MAGIC || version != EXECUTOR_PROTOCOL_VERSION) {
+		snprintf(error, error_length, "The fuzzer doesn't speak version %d of the executor protocol",
+			EXECUTOR_PROTOCOL_VERSION);
+		return 1;
+	}
+	if (executor_get_string(payload, &driver_name) || executor_get_string(payload, &driver_options)
+		|| executor_get_string(payload, &instrumentation_name) || executor_get_string(payload, &instrumentation_options)
+		|| !driver_name || !instrumentation_name) {
+		snprintf(error, error_length, "The fuzzer's setup message is malformed");
+		goto cleanup;
+	}
+
+	INFO_MSG("Running the fuzzer's inputs with the %s driver and %s instrumentation", driver_name, instrumentation_name);
+	session->instrumentation = instrumentation_factory(instrumentation_name);
+	if (!session->instrumentation) {
+		snprintf(error, error_length, "Unknown instrumentation '%s'", instrumentation_name);
+		goto cleanup;
+	}
+	session->instrumentation_state = session->instrumentation->create(instrumentation_options, NULL);
+	if (!session->instrumentation_state) {
+		snprintf(error, error_length, "Bad options for instrumentation %s", instrumentation_name);
+		goto cleanup;
+	}
+	session->driver = driver_instrumentation_factory(driver_name, driver_options, session->instrumentation,
+		session->instrumentation_state);
+	if (!session->driver) {
+		snprintf(error, error_length, "Unknown driver '%s' or bad options: %s", driver_name,
+			driver_options ? driver_options : "none");
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	if (ret)
+		cleanup_session(session);
+	free(driver_name);
+	free(driver_options);
+	free(instrumentation_name);
+	free(instrumentation_options);
+	return ret;
+}
+
+/**
+ * This function runs one input, and adds its result to the reply.
+ * @param session - the session to run the input with
+ * @param input - the input to run
+ * @param length - the length of the input parameter
+ * @param reply - the buffer the results are being built in
+ * @param map_size - updated with the size of the instrumentation's coverage map, if it has one
+ * @return - zero on success, non-zero if the result couldn't be added to the reply
+ */
+static int run_input(executor_session_t * session, const char * input, size_t length, executor_buffer_t * reply,
+	uint32_t * map_size)
+{
+	instrumentation_t * instrumentation = session->instrumentation;
+	void * state = session->instrumentation_state;
+	instrumentation_round_result_t round;
+	executor_result_t result;
+	const uint8_t * trace_bits = NULL;
+	size_t trace_size = 0;
+
+	memset(&result, 0, sizeof(result));
+	result.fuzz_result = session->driver->test_input(session->driver->state, (char *)input, length);
+	if (result.fuzz_result < 0)
+		return executor_put_result(reply, &result, NULL, 0);
+
+	if (instrumentation->finish_round) {
+		if (instrumentation->finish_round(state, &round))
+			round.new_path = -1;
+		result.new_path = round.new_path;
+		result.has_path_hash = round.has_path_hash && result.fuzz_result == FUZZ_NONE;
+		result.path_hash = round.path_hash;
+		result.exec_us = round.exec_us;
+		result.exec_instructions = round.exec_instructions;
+	} else {
+		result.new_path = instrumentation->is_new_path(state);
+		if (result.fuzz_result == FUZZ_NONE && instrumentation->get_path_hash
+			&& !instrumentation->get_path_hash(state, &result.path_hash))
+			result.has_path_hash = 1;
+	}
+	if (result.new_path < 0)
+		result.fuzz_result = FUZZ_ERROR;
+	if (result.fuzz_result == FUZZ_CRASH && instrumentation->get_crash_hash
+		&& !instrumentation->get_crash_hash(state, &result.crash_hash))
+		result.has_crash_hash = 1;
+
+	//Only the new paths need their coverage, for the fuzzer to check against the global virgin map
+	if (instrumentation->get_trace_bits && !instrumentation->get_trace_bits(state, &trace_bits, &trace_size)) {
+		*map_size = (uint32_t)trace_size;
+		if (result.fuzz_result != FUZZ_NONE || result.new_path <= 0)
+			trace_bits = NULL;
+	}
+	return executor_put_result(reply, &result, trace_bits, trace_size);
+}
+
+/**
+ * This function runs a batch of the fuzzer's inputs, and builds the reply with their results.
+ * @param session - the session to run the inputs with
+ * @param payload - the batch message's payload
+ * @param reply - the buffer to build the reply in
+ * @return - zero on success, non-zero if the batch is malformed or the reply couldn't be built
+ */
+static int run_batch(executor_session_t * session, executor_buffer_t * payload, executor_buffer_t * reply)
+{
+	uint32_t count, i, map_size = 0;
+	const char * input;
+	size_t length, map_size_position;
+
+	executor_buffer_reset(reply);
+	if (executor_get_u32(payload, &count) || executor_put_u32(reply, count))
+		return 1;
+	//The map size is filled in once the inputs have run, since some targets only negotiate it on their first run
+	map_size_position = reply->length;
+	if (executor_put_u32(reply, 0))
+		return 1;
+	for (i = 0; i < count; i++)
+	{
+		input = executor_get_bytes(payload, &length);
+		if (!input || run_input(session, input, length, reply, &map_size))
+			return 1;
+	}
+
+	length = reply->length;
+	reply->length = map_size_position;
+	executor_put_u32(reply, map_size);
+	reply->length = length;
+	return 0;
+}
+
+/**
+ * This function serves one fuzzer, until it disconnects.
+ * @param sock - the fuzzer's connection
+ */
+static void serve_fuzzer(SOCKET sock)
+{
+	executor_buffer_t payload, reply;
+	executor_session_t session;
+	char error[1024];
+	uint32_t type, count;
+	uint64_t batches = 0, inputs = 0;
+
+	memset(&payload, 0, sizeof(payload));
+	memset(&reply, 0, sizeof(reply));
+	memset(&session, 0, sizeof(session));
+	if (executor_receive_message(sock, &type, &payload) || type != EXECUTOR_MSG_SETUP) {
+		ERROR_MSG("The fuzzer didn't start with a setup message");
+		goto cleanup;
+	}
+	if (setup_session(&session, &payload, error, sizeof(error))) {
+		send_error(sock, &reply, error);
+		goto cleanup;
+	}
+	executor_buffer_reset(&reply);
+	if (executor_send_message(sock, EXECUTOR_MSG_READY, &reply))
+		goto cleanup;
+
+	while (!executor_receive_message(sock, &type, &payload))
+	{
+		if (type != EXECUTOR_MSG_BATCH) {
+			send_error(sock, &reply, "The executor only takes batches of inputs once it's set up");
+			break;
+		}
+		if (run_batch(&session, &payload, &reply)) {
+			send_error(sock, &reply, "The batch of inputs was malformed, or its results couldn't be sent");
+			break;
+		}
+		if (executor_send_message(sock, EXECUTOR_MSG_RESULTS, &reply))
+			break;
+		batches++;
+		if (!executor_get_u32(&reply, &count))
+			inputs += count;
+	}
+	INFO_MSG("The fuzzer disconnected after %llu batches of %llu inputs", (unsigned long long)batches,
+		(unsigned long long)inputs);
+
+cleanup:
+	cleanup_session(&session);
+	executor_buffer_free(&payload);
+	executor_buffer_free(&reply);
+}
+
+int main(int argc, char ** argv)
+{
+	char * logging_options = NULL, * bind_address = NULL;
+	int port = EXECUTOR_DEFAULT_PORT, once = 0, i;
+	SOCKET listener, sock;
+
+	for (i = 1; i < argc; i++)
+	{
+		IF_ARG_OPTION("-b", bind_address)
+		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-p", port)
+		else if (!strcmp("-o", argv[i]))
+			once = 1;
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+	if (port <= 0 || port > 65535)
+		FATAL_MSG("Bad port (%d)", port);
+	if (executor_sockets_init())
+		FATAL_MSG("Couldn't start up the socket library");
+	listener = executor_listen(bind_address, port);
+	if (listener == INVALID_SOCKET)
+		FATAL_MSG("Couldn't listen for the fuzzer on port %d", port);
+	INFO_MSG("Listening for the fuzzer on port %d", port);
+
+	do
+	{
+		sock = executor_accept(listener);
+		if (sock == INVALID_SOCKET) {
+			WARNING_MSG("Couldn't accept the fuzzer's connection");
+			continue;
+		}
+		INFO_MSG("The fuzzer connected");
+		serve_fuzzer(sock);
+		executor_close_socket(sock);
+	} while (!once);
+
+	executor_close_socket(listener);
+	return 0;
+}
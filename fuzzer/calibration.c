@@ -0,0 +1,225 @@
+#include "calibration.h"
+
+#include <bitmap.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function compares the bitmap of a calibration run against the first run of the same input, and
+ * marks the bytes that differ as unstable.  The hit counts are bucketed first, as the novelty checks
+ * see them, so that a count which only moves within its bucket isn't unstable.
+ * @param calibration - the calibration results to update
+ * @param trace_bits - the bitmap of the run
+ * @param size - the size of the bitmap
+ * @param reference - the bucketed bitmap of the first run of the input, or NULL if this is the first run
+ * @param classified - a buffer the size of the bitmap, which is used to return the bucketed bitmap of the run
+ * @return - zero on success, or non-zero if the bitmap isn't the size of the earlier ones
+ */
+static int compare_trace(calibration_t * calibration, const uint8_t * trace_bits, size_t size,
+	const uint8_t * reference, uint8_t * classified)
+{
+	size_t i;
+
+	if (size != calibration->map_size)
+		return 1;
+	memcpy(classified, trace_bits, size);
+	bitmap_classify_counts(classified, size);
+	if (!reference)
+		return 0;
+	for (i = 0; i < size; i++) {
+		if (classified[i] != reference[i])
+			calibration->unstable_bytes[i] = 1;
+	}
+	return 0;
+}
+
+/**
+ * This function runs each of the inputs several times, and records how long the runs take and which
+ * bytes of the coverage bitmap change between runs of the same input.  The runs go through the
+ * instrumentation's novelty check as well, so the inputs' coverage is already known when fuzzing starts.
+ * @param driver - the driver to run the inputs with
+ * @param instrumentation - the instrumentation that the driver uses
+ * @param instrumentation_state - the driver's instrumentation state
+ * @param inputs - the inputs to run
+ * @param lengths - the lengths of the inputs
+ * @param num_inputs - the number of inputs
+ * @param runs - the number of times to run each input
+ * @param calibration - a pointer used to return the results, which should be freed with calibration_free
+ * @return - zero on success, or non-zero if the driver failed to run an input
+ */
+int calibrate_target(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char ** inputs, size_t * lengths, int num_inputs, int runs, calibration_t * calibration)
+{
+	uint8_t * reference = NULL, * classified = NULL, * covered = NULL;
+	const uint8_t * trace_bits;
+	uint64_t start, elapsed;
+	size_t size, i;
+	int input, run, result, have_reference;
+
+	memset(calibration, 0, sizeof(calibration_t));
+	for (input = 0; input < num_inputs; input++)
+	{
+		have_reference = 0;
+		for (run = 0; run < runs; run++)
+		{
+			start = get_time_ns();
+			result = driver->test_input(driver->state, inputs[input], lengths[input]);
+			elapsed = get_time_ns() - start;
+			if (result < 0) {
+				ERROR_MSG("Calibration failed to run input %d", input);
+				free(reference);
+				free(classified);
+				free(covered);
+				calibration_free(calibration);
+				return 1;
+			}
+			instrumentation->is_new_path(instrumentation_state);
+
+			if (result == FUZZ_HANG) {
+				//The other runs of this input would most likely hang as well, so they're skipped
+				WARNING_MSG("Input %d hung during calibration, and won't be used to calibrate the timeout", input);
+				calibration->hangs++;
+				break;
+			}
+			calibration->runs++;
+			calibration->total_exec_ns += elapsed;
+			if (elapsed > calibration->max_exec_ns)
+				calibration->max_exec_ns = elapsed;
+			if (result == FUZZ_CRASH) {
+				if (!calibration->crashes)
+					WARNING_MSG("Input %d crashed during calibration", input);
+				calibration->crashes++;
+				continue; //A crash's trace stops partway, so it isn't compared
+			}
+
+			//Compare the trace to the first run of this input
+			if (!instrumentation->get_trace_bits
+				|| instrumentation->get_trace_bits(instrumentation_state, &trace_bits, &size) || !size)
+				continue;
+			if (!covered) {
+				calibration->map_size = size;
+				calibration->unstable_bytes = (uint8_t *)calloc(1, size);
+				reference = (uint8_t *)malloc(size);
+				classified = (uint8_t *)malloc(size);
+				covered = (uint8_t *)calloc(1, size);
+				if (!calibration->unstable_bytes || !reference || !classified || !covered) {
+					ERROR_MSG("Couldn't allocate the calibration bitmaps");
+					free(reference);
+					free(classified);
+					free(covered);
+					calibration_free(calibration);
+					return 1;
+				}
+			}
+			else if (!calibration->unstable_bytes)
+				continue; //The bitmap changed size on an earlier run
+			if (compare_trace(calibration, trace_bits, size, have_reference ? reference : NULL,
+				have_reference ? classified : reference)) {
+				WARNING_MSG("The bitmap changed size during calibration, so its unstable bytes can't be found");
+				free(calibration->unstable_bytes);
+				calibration->unstable_bytes = NULL;
+				continue;
+			}
+			have_reference = 1;
+			for (i = 0; i < size; i++)
+				covered[i] |= trace_bits[i];
+		}
+	}
+
+	if (calibration->unstable_bytes) {
+		for (i = 0; i < calibration->map_size; i++) {
+			calibration->covered_count += covered[i] != 0;
+			calibration->unstable_count += calibration->unstable_bytes[i] != 0;
+		}
+	}
+	free(reference);
+	free(classified);
+	free(covered);
+	return 0;
+}
+
+/**
+ * This function runs an input that found a new path again, and compares the bitmap of the second run against the
+ * first run's, to find the bytes of the bitmap that change between runs of the same input while fuzzing, rather
+ * than only from the seeds.  Like the calibration runs, the hit counts are bucketed before they're compared.
+ * @param driver - the driver to run the input with
+ * @param instrumentation - the instrumentation that the driver uses
+ * @param instrumentation_state - the driver's instrumentation state, which just ran the input
+ * @param input - the input to run again
+ * @param length - the length of the input parameter
+ * @param trace_bits - the bitmap of the input's first run
+ * @param size - the size of the bitmap
+ * @param unstable_bytes - a map the size of the bitmap, which is non-zero for the bytes that are already known to
+ * be unstable.  The newly found unstable bytes are marked in it.
+ * @return - the number of newly found unstable bytes, or -1 if the input couldn't be run again
+ */
+int calibration_recheck_input(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char * input, size_t length, const uint8_t * trace_bits, size_t size, uint8_t * unstable_bytes)
+{
+	uint8_t * reference, * classified;
+	const uint8_t * second_trace;
+	size_t second_size, i;
+	int result, found = 0;
+
+	reference = (uint8_t *)malloc(size);
+	classified = (uint8_t *)malloc(size);
+	if (!reference || !classified) {
+		free(reference);
+		free(classified);
+		return -1;
+	}
+	memcpy(reference, trace_bits, size);
+	bitmap_classify_counts(reference, size);
+
+	result = driver->test_input(driver->state, input, length);
+	if (result >= 0)
+		instrumentation->is_new_path(instrumentation_state);
+	//A crash or a hang stops the trace partway, so it isn't compared
+	if (result == FUZZ_NONE && !instrumentation->get_trace_bits(instrumentation_state, &second_trace, &second_size)
+		&& second_size == size) {
+		memcpy(classified, second_trace, size);
+		bitmap_classify_counts(classified, size);
+		for (i = 0; i < size; i++) {
+			if (!unstable_bytes[i] && reference[i] != classified[i]) {
+				unstable_bytes[i] = 1;
+				found++;
+			}
+		}
+	}
+	free(reference);
+	free(classified);
+	return result < 0 ? -1 : found;
+}
+
+/**
+ * This function calculates the hang timeout from the exec times of the calibration runs.
+ * @param calibration - the calibration results, from calibrate_target
+ * @param multiplier - the multiple of the slowest calibration run to use as the timeout, before rounding
+ * @return - the hang timeout in milliseconds, or 0 if none of the calibration runs finished
+ */
+int calibration_timeout_ms(calibration_t * calibration, int multiplier)
+{
+	uint64_t timeout_ms;
+
+	if (!calibration->runs)
+		return 0;
+	timeout_ms = (calibration->max_exec_ns * multiplier + 999999) / 1000000;
+	timeout_ms = (timeout_ms + CALIBRATION_TIMEOUT_ROUND_MS - 1) / CALIBRATION_TIMEOUT_ROUND_MS * CALIBRATION_TIMEOUT_ROUND_MS;
+	if (timeout_ms < HANG_TIMEOUT_MIN_MS)
+		timeout_ms = HANG_TIMEOUT_MIN_MS;
+	if (timeout_ms > INT_MAX)
+		timeout_ms = INT_MAX;
+	return (int)timeout_ms;
+}
+
+/**
+ * This function frees the calibration results.
+ * @param calibration - the calibration results, from calibrate_target
+ */
+void calibration_free(calibration_t * calibration)
+{
+	free(calibration->unstable_bytes);
+	calibration->unstable_bytes = NULL;
+}
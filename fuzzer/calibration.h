@@ -0,0 +1,52 @@
+#pragma once
+#include <driver.h>
+#include <instrumentation.h>
+#include <global_types.h>
+#include <utils.h>
+
+#include <stdint.h>
+
+//Before fuzzing, each seed is run several times to calibrate the target, as AFL's calibration stage
+//does.  The exec times set the hang timeout (only raising the drivers' default one when the hangs
+//aren't tested again), unless the driver options already set a timeout, and the bytes of the coverage bitmap that
+//change between runs of the same input are marked as unstable, so that they aren't mistaken for new
+//paths.  Finding the unstable bytes needs an instrumentation with a
+//bitmap (get_trace_bits); the others are only timed.  While fuzzing, the inputs that find new paths are
+//run once more, and the bytes that change between the two runs are marked as unstable too.
+
+#define CALIBRATION_DEFAULT_RUNS 8   //How many times each seed is run
+#define CALIBRATION_MAX_SEEDS    32  //The most seeds from the seed directory that are calibrated
+
+//The calibrated hang timeout is this multiple of the slowest calibration run, rounded up
+#define CALIBRATION_TIMEOUT_MULTIPLIER 5
+//Or this multiple, when the inputs that time out are tested again with a longer timeout before being saved
+#define CALIBRATION_VERIFIED_TIMEOUT_MULTIPLIER 2
+#define CALIBRATION_TIMEOUT_ROUND_MS   20
+
+//The name of the file in the output directory that the unstable bytes are written to.  It has a byte
+//for each byte of the bitmap, which is non-zero if the byte is unstable, so it can also be given to the
+//dynamorio instrumentation's ignore_bytes_file option.
+#define CALIBRATION_UNSTABLE_BYTES_FILENAME "unstable_bytes.dat"
+
+struct calibration
+{
+	int runs;                //The number of calibration runs that finished without hanging
+	int hangs;
+	int crashes;
+	uint64_t max_exec_ns;    //The slowest run that didn't hang
+	uint64_t total_exec_ns;  //The total time of the runs that didn't hang
+
+	//The unstable bytes of the bitmap, or NULL if the instrumentation doesn't have a bitmap
+	uint8_t * unstable_bytes;
+	size_t map_size;
+	size_t unstable_count;   //The number of unstable bytes
+	size_t covered_count;    //The number of bytes that any calibration run hit
+};
+typedef struct calibration calibration_t;
+
+int calibrate_target(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char ** inputs, size_t * lengths, int num_inputs, int runs, calibration_t * calibration);
+int calibration_recheck_input(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char * input, size_t length, const uint8_t * trace_bits, size_t size, uint8_t * unstable_bytes);
+int calibration_timeout_ms(calibration_t * calibration, int multiplier);
+void calibration_free(calibration_t * calibration);
@@ -0,0 +1,261 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function adds a NUL terminated string as a section of a checkpoint.
+ * @param writer - the binary state writer of the checkpoint
+ * @param name - the name of the section
+ * @param value - the string to store
+ * @return - 0 on success, non-zero on failure
+ */
+static int add_string_section(binary_state_writer_t * writer, const char * name, const char * value)
+{
+	return binary_state_add_section(writer, name, BINARY_STATE_MERGE_FIRST, 0, value, strlen(value) + 1);
+}
+
+/**
+ * This function gets a NUL terminated string section from a checkpoint.
+ * @param checkpoint - the opened checkpoint
+ * @param name - the name of the section
+ * @return - the string, valid until the checkpoint is closed, or NULL if the section doesn't exist
+ * or isn't a string
+ */
+static const char * get_string_section(binary_state_t * checkpoint, const char * name)
+{
+	const char * value;
+	size_t length;
+
+	value = (const char *)binary_state_get_raw_section(checkpoint, name, &length);
+	if (!value || !length || value[length - 1])
+		return NULL;
+	return value;
+}
+
+/**
+ * This function copies a campaign into a checkpoint.  The caller must make sure that the instrumentation
+ * state isn't changed while this function runs.
+ * @param contents - the parts of the campaign to save
+ * @param length - a pointer used to return the length of the checkpoint
+ * @return - a newly allocated buffer holding the checkpoint that should be freed with free, or NULL on failure
+ */
+char * checkpoint_create(checkpoint_contents_t * contents, size_t * length)
+{
+	binary_state_writer_t * writer;
+	checkpoint_stats_t stats;
+	char * corpus_buffer;
+	size_t corpus_length;
+	int i, ret;
+
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < contents->stats->num_workers; i++) {
+		stats.execs += contents->stats->counters[i].execs;
+		stats.crashes += contents->stats->counters[i].crashes;
+		stats.hangs += contents->stats->counters[i].hangs;
+		stats.new_paths += contents->stats->counters[i].new_paths;
+		stats.fork_failures += contents->stats->counters[i].fork_failures;
+		stats.trace_overflows += contents->stats->counters[i].trace_overflows;
+	}
+	stats.start_time = contents->stats->start_time;
+
+	writer = binary_state_writer_create(CHECKPOINT_STATE_NAME, 0);
+	if (!writer)
+		return NULL;
+	ret = binary_state_add_int(writer, "version", CHECKPOINT_VERSION)
+		|| add_string_section(writer, "instrumentation", contents->instrumentation_name)
+		|| add_string_section(writer, "mutator", contents->mutator_name)
+		|| binary_state_add_section(writer, "stats", BINARY_STATE_MERGE_FIRST, 0, &stats, sizeof(stats))
+		|| binary_state_add_section(writer, "seed", BINARY_STATE_MERGE_FIRST, 0, contents->seed, contents->seed_length)
+		|| binary_state_add_section(writer, "instrumentation_state", BINARY_STATE_MERGE_FIRST, 0,
+			contents->instrumentation_state, contents->instrumentation_state_length)
+		|| (contents->mutator_state && add_string_section(writer, "mutator_state", contents->mutator_state));
+	if (!ret && contents->corpus) {
+		corpus_buffer = corpus_serialize(contents->corpus, &corpus_length);
+		ret = !corpus_buffer
+			|| binary_state_add_section(writer, "corpus", BINARY_STATE_MERGE_FIRST, 0, corpus_buffer, corpus_length);
+		free(corpus_buffer);
+	}
+	if (ret) {
+		binary_state_writer_free(writer);
+		return NULL;
+	}
+	return binary_state_writer_finish(writer, length);
+}
+
+/**
+ * This function writes a checkpoint to a file.  It's written to a temporary file first, so that an
+ * interrupted write doesn't destroy the last checkpoint.
+ * @param filename - the file to write the checkpoint to
+ * @param checkpoint - the checkpoint, from checkpoint_create
+ * @param length - the length of the checkpoint parameter
+ * @return - zero on success, non-zero on failure
+ */
+int checkpoint_write_file(const char * filename, const char * checkpoint, size_t length)
+{
+	char temp_filename[MAX_PATH];
+	int ret;
+
+	snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+	ret = write_buffer_to_file(temp_filename, (char *)checkpoint, length);
+	if (!ret) {
+#ifdef _WIN32
+		ret = !MoveFileEx(temp_filename, filename, MOVEFILE_REPLACE_EXISTING);
+#else
+		ret = rename(temp_filename, filename);
+#endif
+	}
+	return ret;
+}
+
+/**
+ * This function maps a checkpoint file, and checks that it was written by a campaign with the same
+ * instrumentation and mutator.
+ * @param filename - the checkpoint file to open
+ * @param instrumentation_name - the name of the instrumentation that's resuming the campaign
+ * @param mutator_name - the name of the mutator that's resuming the campaign
+ * @return - the opened checkpoint, which should be closed with binary_state_close, or NULL on failure
+ */
+binary_state_t * checkpoint_open(const char * filename, const char * instrumentation_name, const char * mutator_name)
+{
+	binary_state_t * checkpoint;
+	const char * name;
+	int64_t version;
+	size_t length;
+
+	checkpoint = binary_state_map_file(filename);
+	if (!checkpoint)
+		return NULL;
+	if (strcmp(binary_state_instrumentation(checkpoint), CHECKPOINT_STATE_NAME)
+		|| binary_state_get_int(checkpoint, "version", &version) || version != CHECKPOINT_VERSION) {
+		ERROR_MSG("%s is not a campaign checkpoint, or is from a different version of the fuzzer", filename);
+		binary_state_close(checkpoint);
+		return NULL;
+	}
+
+	name = get_string_section(checkpoint, "instrumentation");
+	if (!name || strcmp(name, instrumentation_name)) {
+		ERROR_MSG("The checkpoint %s is from the %s instrumentation, not %s", filename, name ? name : "unknown",
+			instrumentation_name);
+		binary_state_close(checkpoint);
+		return NULL;
+	}
+	name = get_string_section(checkpoint, "mutator");
+	if (!name || strcmp(name, mutator_name)) {
+		ERROR_MSG("The checkpoint %s is from the %s mutator, not %s", filename, name ? name : "unknown", mutator_name);
+		binary_state_close(checkpoint);
+		return NULL;
+	}
+
+	//The rest of the sections are checked as they're used, but these are always needed
+	if (!binary_state_get_raw_section(checkpoint, "seed", &length) || !length
+		|| !binary_state_get_raw_section(checkpoint, "instrumentation_state", &length)) {
+		ERROR_MSG("The checkpoint %s is missing the seed or instrumentation state", filename);
+		binary_state_close(checkpoint);
+		return NULL;
+	}
+	return checkpoint;
+}
+
+/**
+ * This function adds the stats from a checkpoint to the stats of the resumed campaign, so that its
+ * totals and start time carry on from the checkpointed campaign.  It should be called before fuzzing starts.
+ * @param checkpoint - the opened checkpoint
+ * @param stats - the stats of the resumed campaign
+ */
+void checkpoint_restore_stats(binary_state_t * checkpoint, fuzzer_stats_t * stats)
+{
+	checkpoint_stats_t saved;
+
+	if (binary_state_get_section(checkpoint, "stats", &saved, sizeof(saved))) {
+		WARNING_MSG("The checkpoint doesn't have the stats, so they won't be resumed");
+		return;
+	}
+	stats->counters[0].execs += saved.execs;
+	stats->counters[0].crashes += saved.crashes;
+	stats->counters[0].hangs += saved.hangs;
+	stats->counters[0].new_paths += saved.new_paths;
+	stats->counters[0].fork_failures += saved.fork_failures;
+	stats->counters[0].trace_overflows += saved.trace_overflows;
+	stats->last_execs = saved.execs;
+	if (saved.start_time)
+		stats->start_time = saved.start_time;
+}
+
+/**
+ * This function is the checkpoint writer thread, which writes each snapshot that it's given.
+ */
+static THREAD_FUNC(checkpoint_writer_thread)
+{
+	checkpoint_writer_t * writer = (checkpoint_writer_t *)arg;
+
+	while (!take_semaphore(writer->ready) && writer->pending)
+	{
+		if (checkpoint_write_file(writer->filename, writer->pending, writer->pending_length))
+			WARNING_MSG("Failed to write the checkpoint %s", writer->filename);
+		free(writer->pending);
+		writer->pending = NULL;
+		writer->busy = 0;
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * This function creates a checkpoint writer, and starts its thread.
+ * @param filename - the file to write the checkpoints to
+ * @return - the new checkpoint writer, or NULL on failure
+ */
+checkpoint_writer_t * checkpoint_writer_create(const char * filename)
+{
+	checkpoint_writer_t * writer;
+
+	writer = (checkpoint_writer_t *)calloc(1, sizeof(checkpoint_writer_t));
+	if (!writer)
+		return NULL;
+	writer->filename = strdup(filename);
+	writer->ready = create_semaphore(0, 2);
+	if (!writer->filename || !writer->ready || create_thread(&writer->thread, checkpoint_writer_thread, writer)) {
+		if (writer->ready)
+			destroy_semaphore(writer->ready);
+		free(writer->filename);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+/**
+ * This function gives a snapshot to the checkpoint writer to write in the background.  It should only
+ * be called from one thread at a time.
+ * @param writer - the checkpoint writer
+ * @param checkpoint - the checkpoint, from checkpoint_create.  On success, the writer frees it once it's written.
+ * @param length - the length of the checkpoint parameter
+ * @return - zero if the writer took the checkpoint, or non-zero if it's still writing the last one
+ */
+int checkpoint_writer_submit(checkpoint_writer_t * writer, char * checkpoint, size_t length)
+{
+	if (writer->busy)
+		return 1;
+	writer->busy = 1;
+	writer->pending = checkpoint;
+	writer->pending_length = length;
+	release_semaphore(writer->ready);
+	return 0;
+}
+
+/**
+ * This function waits for the checkpoint writer to finish writing, and then stops it and frees it.
+ * @param writer - the checkpoint writer to free
+ */
+void checkpoint_writer_destroy(checkpoint_writer_t * writer)
+{
+	if (!writer)
+		return;
+	//The thread writes the pending snapshot, if there is one, before it sees this release with nothing pending
+	release_semaphore(writer->ready);
+	join_thread(writer->thread);
+	destroy_semaphore(writer->ready);
+	free(writer->filename);
+	free(writer);
+}
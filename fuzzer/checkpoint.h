@@ -0,0 +1,78 @@
+#pragma once
+#include "corpus.h"
+#include "stats.h"
+
+#include <binary_state.h>
+#include <instrumentation.h>
+#include <global_types.h>
+#include <utils.h>
+
+//A campaign checkpoint is a binary state (see binary_state.h) holding everything needed to resume a
+//fuzzing campaign: the stats, the seed, the mutator state, the coverage, and the corpus.  The sections
+//are stored uncompressed, so that resuming only maps the file and reads the sections in place, rather
+//than parsing the JSON states.  The sections are:
+//  version                - CHECKPOINT_VERSION
+//  instrumentation        - the name of the instrumentation, which resuming must use as well
+//  mutator                - the name of the mutator, which resuming must use as well
+//  stats                  - a checkpoint_stats_t
+//  seed                   - the seed that the mutator was created with
+//  mutator_state          - the mutator's state, with its terminating NUL (only without a corpus)
+//  instrumentation_state  - the coverage, as the instrumentation's binary or JSON state
+//  corpus                 - the corpus, written with corpus_serialize (only with a corpus)
+
+#define CHECKPOINT_STATE_NAME "checkpoint" //The instrumentation name in the binary state header
+#define CHECKPOINT_VERSION    1
+
+//How often the first worker takes a snapshot of the campaign for the checkpoint writer
+#define CHECKPOINT_INTERVAL_MS (60 * 1000)
+
+//The fuzzer stats in a checkpoint, which are added to the stats of the resumed campaign
+struct checkpoint_stats
+{
+	uint64_t execs;
+	uint64_t crashes;
+	uint64_t hangs;
+	uint64_t new_paths;
+	uint64_t fork_failures;
+	uint64_t trace_overflows;
+	uint64_t start_time;     //When the campaign first started, in milliseconds since the epoch
+};
+typedef struct checkpoint_stats checkpoint_stats_t;
+
+//The parts of a campaign that are saved in a checkpoint
+struct checkpoint_contents
+{
+	const char * instrumentation_name;
+	const char * mutator_name;
+	fuzzer_stats_t * stats;
+	const char * seed;
+	size_t seed_length;
+	const char * mutator_state;          //NULL when there's a corpus, which has the mutator states
+	const char * instrumentation_state;
+	size_t instrumentation_state_length;
+	corpus_t * corpus;                   //NULL if the campaign doesn't have a corpus
+};
+typedef struct checkpoint_contents checkpoint_contents_t;
+
+//Writes the checkpoints from a background thread, so that the workers only pause for as long as it
+//takes to copy the campaign into memory.  While a checkpoint is being written, the snapshots for
+//newer ones are dropped, rather than being queued.
+struct checkpoint_writer
+{
+	char * filename;
+	thread_t thread;
+	semaphore_t ready;             //Released when there's a snapshot to write, or to stop the thread
+	char * pending;                //The snapshot being written, or NULL while the thread is idle
+	size_t pending_length;
+	volatile int busy;
+};
+typedef struct checkpoint_writer checkpoint_writer_t;
+
+char * checkpoint_create(checkpoint_contents_t * contents, size_t * length);
+int checkpoint_write_file(const char * filename, const char * checkpoint, size_t length);
+binary_state_t * checkpoint_open(const char * filename, const char * instrumentation_name, const char * mutator_name);
+void checkpoint_restore_stats(binary_state_t * checkpoint, fuzzer_stats_t * stats);
+
+checkpoint_writer_t * checkpoint_writer_create(const char * filename);
+int checkpoint_writer_submit(checkpoint_writer_t * writer, char * checkpoint, size_t length);
+void checkpoint_writer_destroy(checkpoint_writer_t * writer);
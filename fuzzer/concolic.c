@@ -0,0 +1,452 @@
+#include "concolic.h"
+#include <jansson_helper.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h> // setpriority
+#include <sys/stat.h>     // mkdir
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Returns a string describing the options for the concolic side worker
+ */
+char * concolic_help(void)
+{
+	return strdup(
+"Concolic Options:\n"
+"  cpu                   Which CPU to run the side worker and the executor on,\n"
+"                          modulo the CPUs the fuzzer may use, or -1 to not pin\n"
+"                          them (default the CPU after the workers', if they're\n"
+"                          pinned with -A)\n"
+"  cpu_budget            The percent of its CPU the side worker may use, idling\n"
+"                          for the rest of it after each run (default 50)\n"
+"  input_env             The environment variable set to the input's filename,\n"
+"                          when the path has a @@ (default SYMCC_INPUT_FILE)\n"
+"  min_turns             How many turns the mutator gets on a corpus entry before\n"
+"                          it's explored, unless the mutator runs out of\n"
+"                          mutations for it first (default 1)\n"
+"  nice                  The niceness to run the executor with (default 10)\n"
+"  output_env            The environment variable set to the directory the\n"
+"                          executor should write the solved inputs to (default\n"
+"                          SYMCC_OUTPUT_DIR)\n"
+"  path                  The command line of the concolic executor, e.g. a SymCC\n"
+"                          build of the target.  Each @@ is replaced with the\n"
+"                          input's filename, otherwise the input is on stdin\n"
+"  plateau               How many seconds the fuzzer goes without a new path\n"
+"                          before the corpus entries are explored (default 60)\n"
+"  timeout               The most milliseconds each run of the executor may take\n"
+"                          (default 60000)\n"
+	);
+}
+
+#ifndef _WIN32
+
+/**
+ * This function creates a directory, unless it already exists.
+ * @param path - the directory to create
+ * @return - zero on success, non-zero on failure
+ */
+static int concolic_create_directory(const char * path)
+{
+	return mkdir(path, 0775) == -1 && errno != EEXIST;
+}
+
+/**
+ * This function builds the executor's command line, with the input's filename in place of each "@@".
+ * @param path - the command line from the path option
+ * @param input_file - the filename of the input
+ * @return - the new command line, which the caller should free, or NULL on failure
+ */
+static char * concolic_command_line(const char * path, const char * input_file)
+{
+	size_t filename_length = strlen(input_file), count = 0;
+	const char * pos;
+	char * cmd_line, * out;
+
+	for (pos = strstr(path, "@@"); pos; pos = strstr(pos + 2, "@@"))
+		count++;
+	cmd_line = (char *)malloc(strlen(path) + count * filename_length + 1);
+	if (!cmd_line)
+		return NULL;
+	for (pos = path, out = cmd_line; *pos; )
+	{
+		if (pos[0] == '@' && pos[1] == '@') {
+			memcpy(out, input_file, filename_length);
+			out += filename_length;
+			pos += 2;
+		}
+		else
+			*out++ = *pos++;
+	}
+	*out = 0;
+	return cmd_line;
+}
+
+/**
+ * This function deletes the files in the executor's output directory, saving each one in the findings store
+ * that the instance sync imports from, unless it's already there.
+ * @param worker - the concolic side worker
+ * @param save - whether to save the files, or just delete them, e.g. when they're left over from an earlier run
+ * @return - the number of new inputs that were saved
+ */
+static int concolic_collect_inputs(concolic_worker_t * worker, int save)
+{
+	char ** files, * buffer;
+	size_t count = 0, i;
+	int length, saved = 0;
+
+	files = list_directory_files(worker->executor_output, &count);
+	for (i = 0; i < count; i++)
+	{
+		if (save) {
+			length = read_file(files[i], &buffer);
+			if (length > 0 && findings_store_add(worker->findings, "new_paths", buffer, length) == 1)
+				saved++;
+			if (length >= 0)
+				free(buffer);
+		}
+		unlink(files[i]);
+		free(files[i]);
+	}
+	free(files);
+	return saved;
+}
+
+/**
+ * This function runs one input through the concolic executor, and saves the inputs it solves for.
+ * @param worker - the concolic side worker
+ * @param input - the input to explore
+ * @param length - the length of the input parameter
+ * @return - the number of new inputs that were solved for, or -1 on failure
+ */
+static int concolic_explore(concolic_worker_t * worker, char * input, size_t length)
+{
+	char * cmd_line, * executable, ** argv;
+	int uses_file, fd, status, i;
+	pid_t child;
+
+	if (write_buffer_to_file(worker->input_file, input, length))
+		return -1;
+	uses_file = strstr(worker->path, "@@") != NULL;
+	cmd_line = concolic_command_line(worker->path, worker->input_file);
+	if (!cmd_line || split_command_line(cmd_line, &executable, &argv)) {
+		free(cmd_line);
+		return -1;
+	}
+	free(cmd_line);
+
+	child = fork();
+	if (child == 0)
+	{
+		//The executor's output is thrown away, and it reads the input from stdin unless it was given the filename
+		fd = open(uses_file ? "/dev/null" : worker->input_file, O_RDONLY);
+		if (fd >= 0) {
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		if (worker->nice)
+			setpriority(PRIO_PROCESS, 0, worker->nice);
+		setenv(worker->output_env, worker->executor_output, 1);
+		if (uses_file)
+			setenv(worker->input_env, worker->input_file, 1);
+		execv(executable, argv);
+		_exit(EXIT_FAILURE);
+	}
+
+	free(executable);
+	for (i = 0; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+	if (child < 0) {
+		ERROR_MSG("Failed to start the concolic executor %s", worker->path);
+		return -1;
+	}
+
+	worker->child = child;
+	if (wait_for_process_exit(child, worker->timeout_ms) != 1 && !worker->stop) {
+		WARNING_MSG("The concolic executor took over %d ms, it was killed", worker->timeout_ms);
+		kill(child, SIGKILL);
+	}
+	while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+	worker->child = 0;
+
+	//A killed executor may still have solved for some inputs, so they're kept
+	return concolic_collect_inputs(worker, 1);
+}
+
+/**
+ * This function finds the next corpus entry to explore: one that hasn't been explored yet, and that the
+ * mutator has had enough turns on or has run out of mutations for.
+ * @param worker - the concolic side worker
+ * @param length - used to return the length of the entry's input
+ * @return - a copy of the entry's input, which the caller should free, or NULL if no entry is ready
+ */
+static char * concolic_next_entry(concolic_worker_t * worker, size_t * length)
+{
+	uint8_t * explored;
+	size_t index, size;
+	int times_chosen;
+	char * input;
+
+	for (index = 0; (input = corpus_copy_entry(worker->corpus, index, length, &times_chosen)) != NULL; index++)
+	{
+		if (index >= worker->explored_size) {
+			size = worker->explored_size ? worker->explored_size * 2 : 256;
+			while (size <= index)
+				size *= 2;
+			explored = (uint8_t *)realloc(worker->explored, size);
+			if (!explored) {
+				free(input);
+				return NULL;
+			}
+			memset(explored + worker->explored_size, 0, size - worker->explored_size);
+			worker->explored = explored;
+			worker->explored_size = size;
+		}
+		if (!worker->explored[index] && (times_chosen < 0 || times_chosen >= worker->min_turns)) {
+			worker->explored[index] = 1;
+			return input;
+		}
+		free(input);
+	}
+	return NULL;
+}
+
+/**
+ * This function checks whether the fuzzer has gone the plateau option's number of seconds without
+ * finding a new path.
+ * @param worker - the concolic side worker
+ * @param now - the current get_time_ms time
+ * @return - non-zero if the fuzzer has plateaued, zero otherwise
+ */
+static int concolic_has_plateaued(concolic_worker_t * worker, uint64_t now)
+{
+	uint64_t last_path = worker->start_ms;
+	int i;
+
+	for (i = 0; i < worker->stats->num_workers; i++) {
+		if (worker->stats->counters[i].last_path_ms > last_path)
+			last_path = worker->stats->counters[i].last_path_ms;
+	}
+	return now - last_path >= (uint64_t)worker->plateau * 1000;
+}
+
+/**
+ * This function sleeps for a while, waking up early if the side worker is being stopped.
+ * @param worker - the concolic side worker
+ * @param sleep_ms - how many milliseconds to sleep for
+ */
+static void concolic_idle(concolic_worker_t * worker, uint64_t sleep_ms)
+{
+	while (sleep_ms > 0 && !worker->stop)
+	{
+		usleep((sleep_ms < CONCOLIC_POLL_INTERVAL_MS ? sleep_ms : CONCOLIC_POLL_INTERVAL_MS) * 1000);
+		sleep_ms -= sleep_ms < CONCOLIC_POLL_INTERVAL_MS ? sleep_ms : CONCOLIC_POLL_INTERVAL_MS;
+	}
+}
+
+/**
+ * This function runs the concolic side worker's thread.  While the fuzzer has plateaued, it explores the
+ * corpus entries one at a time, and after each run it idles long enough to stay within its CPU budget.
+ * @param arg - the concolic_worker_t to run
+ */
+static THREAD_FUNC(concolic_worker_thread)
+{
+	concolic_worker_t * worker = (concolic_worker_t *)arg;
+	uint64_t begin, run_time;
+	size_t length;
+	char * input;
+	int solved;
+
+	if (worker->cpu >= 0 && pin_thread_to_cpu(worker->cpu))
+		WARNING_MSG("Couldn't pin the concolic side worker to CPU %d", worker->cpu);
+
+	while (!worker->stop)
+	{
+		begin = get_time_ms();
+		input = concolic_has_plateaued(worker, begin) ? concolic_next_entry(worker, &length) : NULL;
+		if (!input) {
+			concolic_idle(worker, CONCOLIC_POLL_INTERVAL_MS);
+			continue;
+		}
+
+		solved = concolic_explore(worker, input, length);
+		free(input);
+		worker->runs++;
+		if (solved > 0) {
+			worker->solved += solved;
+			INFO_MSG("The concolic executor solved for %d new inputs (%" PRIu64 " from %" PRIu64 " entries so far)",
+				solved, worker->solved, worker->runs);
+		}
+
+		run_time = get_time_ms() - begin;
+		concolic_idle(worker, run_time * (100 - worker->cpu_budget) / worker->cpu_budget);
+	}
+	THREAD_RETURN;
+}
+
+#endif //!_WIN32
+
+/**
+ * This function creates the concolic side worker.  It doesn't run until concolic_worker_start is called.
+ * @param options - a JSON string of the side worker's options
+ * @param corpus - the corpus whose entries are explored
+ * @param stats - the fuzzer stats, which say when the workers last found a new path
+ * @param sync_directory - the sync directory (-y) that the solved inputs are saved in
+ * @param output_directory - the fuzzer's output directory, which the side worker keeps its files in
+ * @param default_cpu - the CPU to pin the side worker to if the cpu option isn't given, or -1 to not pin it
+ * @return - the new concolic side worker on success, or NULL if the options are invalid or on failure
+ */
+concolic_worker_t * concolic_worker_create(char * options, corpus_t * corpus, fuzzer_stats_t * stats,
+	char * sync_directory, char * output_directory, int default_cpu)
+{
+#ifdef _WIN32
+	ERROR_MSG("The concolic side worker isn't supported on Windows");
+	return NULL;
+#else
+	concolic_worker_t * state;
+	char path[MAX_PATH];
+	const char * name;
+	size_t name_length;
+
+	state = (concolic_worker_t *)calloc(1, sizeof(concolic_worker_t));
+	if (!state)
+		return NULL;
+	state->corpus = corpus;
+	state->stats = stats;
+	state->plateau = CONCOLIC_DEFAULT_PLATEAU;
+	state->min_turns = CONCOLIC_DEFAULT_MIN_TURNS;
+	state->cpu = CONCOLIC_CPU_AUTO;
+	state->cpu_budget = CONCOLIC_DEFAULT_CPU_BUDGET;
+	state->nice = CONCOLIC_DEFAULT_NICE;
+	state->timeout_ms = CONCOLIC_DEFAULT_TIMEOUT_MS;
+
+	PARSE_OPTION_STRING(state, options, path, "path", concolic_worker_destroy);
+	PARSE_OPTION_STRING(state, options, output_env, "output_env", concolic_worker_destroy);
+	PARSE_OPTION_STRING(state, options, input_env, "input_env", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, plateau, "plateau", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, min_turns, "min_turns", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, cpu, "cpu", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, cpu_budget, "cpu_budget", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, nice, "nice", concolic_worker_destroy);
+	PARSE_OPTION_INT(state, options, timeout_ms, "timeout", concolic_worker_destroy);
+
+	if (state->cpu == CONCOLIC_CPU_AUTO)
+		state->cpu = default_cpu;
+	if (!state->output_env)
+		state->output_env = strdup(CONCOLIC_DEFAULT_OUTPUT_ENV);
+	if (!state->input_env)
+		state->input_env = strdup(CONCOLIC_DEFAULT_INPUT_ENV);
+	if (!state->path || !state->output_env || !state->input_env || state->plateau < 0 || state->min_turns < 0
+		|| state->cpu < -1 || state->cpu_budget <= 0 || state->cpu_budget > 100 || state->nice < 0
+		|| state->timeout_ms <= 0)
+	{
+		concolic_worker_destroy(state);
+		return NULL;
+	}
+
+	//The solved inputs go in <sync directory>/<output directory's name>.concolic/new_paths, where the instance
+	//sync finds them like another fuzzer's new paths
+	name_length = strlen(output_directory);
+	while (name_length > 1 && output_directory[name_length - 1] == '/')
+		name_length--;
+	name = output_directory + name_length;
+	while (name > output_directory && name[-1] != '/')
+		name--;
+	snprintf(path, sizeof(path), "%s/%.*s" CONCOLIC_SYNC_SUFFIX, sync_directory,
+		(int)(output_directory + name_length - name), name);
+	if (concolic_create_directory(path)) {
+		ERROR_MSG("Unable to create the concolic sync directory %s", path);
+		concolic_worker_destroy(state);
+		return NULL;
+	}
+	state->findings = findings_store_create(path, 0);
+	snprintf(path + strlen(path), sizeof(path) - strlen(path), "/new_paths");
+	if (!state->findings || concolic_create_directory(path)) {
+		ERROR_MSG("Unable to create the concolic findings store in %s", path);
+		concolic_worker_destroy(state);
+		return NULL;
+	}
+
+	snprintf(path, sizeof(path), "%s/concolic", output_directory);
+	state->work_directory = strdup(path);
+	snprintf(path, sizeof(path), "%s/concolic/input", output_directory);
+	state->input_file = strdup(path);
+	snprintf(path, sizeof(path), "%s/concolic/output", output_directory);
+	state->executor_output = strdup(path);
+	if (!state->work_directory || !state->input_file || !state->executor_output
+		|| concolic_create_directory(state->work_directory) || concolic_create_directory(state->executor_output))
+	{
+		ERROR_MSG("Unable to create the concolic side worker's directory in %s", output_directory);
+		concolic_worker_destroy(state);
+		return NULL;
+	}
+	concolic_collect_inputs(state, 0);
+	return state;
+#endif
+}
+
+/**
+ * This function starts the concolic side worker's thread.
+ * @param worker - the concolic side worker to start
+ * @return - zero on success, non-zero on failure
+ */
+int concolic_worker_start(concolic_worker_t * worker)
+{
+#ifdef _WIN32
+	return 1;
+#else
+	worker->start_ms = get_time_ms();
+	if (create_thread(&worker->thread, concolic_worker_thread, worker))
+		return 1;
+	worker->thread_started = 1;
+	INFO_MSG("Started the concolic side worker with %s, after %d seconds without a new path", worker->path,
+		worker->plateau);
+	return 0;
+#endif
+}
+
+/**
+ * This function stops the concolic side worker, waiting for its current run of the executor to finish, and frees it.
+ * @param worker - the concolic side worker to free
+ */
+void concolic_worker_destroy(concolic_worker_t * worker)
+{
+	if (!worker)
+		return;
+	if (worker->thread_started) {
+		worker->stop = 1;
+#ifndef _WIN32
+		if (worker->child > 0)
+			kill(worker->child, SIGKILL);
+#endif
+		join_thread(worker->thread);
+	}
+	if (worker->findings)
+		findings_store_destroy(worker->findings);
+	free(worker->path);
+	free(worker->output_env);
+	free(worker->input_env);
+	free(worker->work_directory);
+	free(worker->input_file);
+	free(worker->executor_output);
+	free(worker->explored);
+	free(worker);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "corpus.h"
+#include "findings.h"
+#include "stats.h"
+#include <utils.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONCOLIC_DEFAULT_OUTPUT_ENV  "SYMCC_OUTPUT_DIR"
+#define CONCOLIC_DEFAULT_INPUT_ENV   "SYMCC_INPUT_FILE"
+#define CONCOLIC_DEFAULT_PLATEAU     60    //Seconds without a new path before the corpus entries are explored
+#define CONCOLIC_DEFAULT_MIN_TURNS   1     //The turns the mutator gets on an entry before it's explored
+#define CONCOLIC_DEFAULT_CPU_BUDGET  50    //The percent of its CPU the side worker may use
+#define CONCOLIC_DEFAULT_NICE        10
+#define CONCOLIC_DEFAULT_TIMEOUT_MS  60000
+
+//The cpu option's default, which pins the side worker to the CPU after the workers' when they're pinned
+#define CONCOLIC_CPU_AUTO            -2
+
+//How often the side worker checks whether the fuzzer has plateaued, and how long it sleeps at a time
+#define CONCOLIC_POLL_INTERVAL_MS    100
+
+//The solved inputs are saved in this subdirectory of the sync directory, named after the fuzzer's output directory
+#define CONCOLIC_SYNC_SUFFIX         ".concolic"
+
+//The concolic side worker (-Y) hands the corpus entries that the mutator has had its turns on to an external
+//concolic executor, such as a SymCC or QSYM build of the target, once the fuzzer has gone a while without finding
+//a new path.  The inputs the executor solves for are saved as the new_paths of a findings store of their own in
+//the sync directory, so the instance sync imports the ones that find new paths, for this fuzzer and every other
+//fuzzer sharing the sync directory.  The side worker runs in its own thread on its own CPU, at a lower priority,
+//and idles for the rest of its CPU's time once it has used its budget, so the workers' speed isn't disturbed.
+struct concolic_worker
+{
+	//Options
+	char * path;         //The executor's command line, with the input's filename in place of each "@@", or the
+	                     //input on stdin if there's no "@@"
+	char * output_env;   //The environment variable that tells the executor where to write the solved inputs
+	char * input_env;    //The environment variable that tells the executor which file is the input, if there's a "@@"
+	int plateau;
+	int min_turns;
+	int cpu;             //The CPU to pin the side worker and the executor to, or -1 to not pin them
+	int cpu_budget;
+	int nice;
+	int timeout_ms;
+
+	corpus_t * corpus;
+	fuzzer_stats_t * stats;      //The workers' stats, which say when the last new path was found
+	findings_store_t * findings; //Where the solved inputs are saved for the instance sync to import
+	char * work_directory;       //Holds the input that's being explored and the executor's output directory
+	char * input_file;
+	char * executor_output;
+	uint8_t * explored;          //One byte for each corpus entry, set once it's been explored
+	size_t explored_size;
+	uint64_t start_ms;
+	uint64_t runs;               //How many entries have been explored
+	uint64_t solved;             //How many of the solved inputs were new
+
+	thread_t thread;
+	int thread_started;
+	volatile int stop;
+#ifndef _WIN32
+	volatile pid_t child;        //The running executor, which is killed if the side worker is stopped, or 0
+#endif
+};
+typedef struct concolic_worker concolic_worker_t;
+
+concolic_worker_t * concolic_worker_create(char * options, corpus_t * corpus, fuzzer_stats_t * stats,
+	char * sync_directory, char * output_directory, int default_cpu);
+int concolic_worker_start(concolic_worker_t * worker);
+void concolic_worker_destroy(concolic_worker_t * worker);
+char * concolic_help(void);
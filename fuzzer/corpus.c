@@ -0,0 +1,928 @@
+#include "corpus.h"
+#include <jansson.h>
+#include <jansson_helper.h>
+#include <mutator_factory.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function allocates memory for a corpus input from the corpus's arena.
+ * @param corpus - the corpus to allocate the memory for
+ * @param length - the number of bytes to allocate
+ * @return - the allocated memory, or NULL on failure
+ */
+static char * corpus_arena_alloc(corpus_t * corpus, size_t length)
+{
+	corpus_arena_block_t * block = corpus->arena;
+	size_t size;
+
+	if (!block || block->size - block->used < length)
+	{
+		//Inputs that are too large for a normal block get a block of their own
+		size = length > CORPUS_ARENA_BLOCK_SIZE ? length : CORPUS_ARENA_BLOCK_SIZE;
+		block = (corpus_arena_block_t *)malloc(sizeof(corpus_arena_block_t) + size);
+		if (!block)
+			return NULL;
+		block->size = size;
+		block->used = 0;
+		block->next = corpus->arena;
+		corpus->arena = block;
+	}
+
+	block->used += length;
+	return block->data + block->used - length;
+}
+
+/**
+ * This function adds an input to the corpus.  The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus to add the input to
+ * @param input - the input to add
+ * @param length - the length of the input parameter
+ * @param copy - whether to copy the input into the corpus, or to use it in place
+ * @return - the new entry, or NULL on failure
+ */
+static corpus_entry_t * corpus_add_entry(corpus_t * corpus, const char * input, size_t length, int copy)
+{
+	corpus_entry_t * entries, * entry;
+	size_t size;
+
+	if (corpus->entries_count == corpus->entries_size)
+	{
+		size = corpus->entries_size ? corpus->entries_size * 2 : 64;
+		entries = (corpus_entry_t *)realloc(corpus->entries, size * sizeof(corpus_entry_t));
+		if (!entries)
+			return NULL;
+		corpus->entries = entries;
+		corpus->entries_size = size;
+	}
+
+	entry = &corpus->entries[corpus->entries_count];
+	memset(entry, 0, sizeof(corpus_entry_t));
+	if (copy) {
+		entry->input = corpus_arena_alloc(corpus, length ? length : 1);
+		if (!entry->input)
+			return NULL;
+		memcpy(entry->input, input, length);
+	} else
+		entry->input = (char *)input;
+	entry->length = length;
+	corpus->entries_count++;
+	return entry;
+}
+
+/**
+ * This function finds the slot in a path frequency table for a path.
+ * @param paths - the path frequency table to search
+ * @param paths_size - the number of slots in the paths parameter
+ * @param hash - the path's hash
+ * @return - the slot that holds the path, or the empty slot where it should be added
+ */
+static corpus_path_t * corpus_path_slot(corpus_path_t * paths, size_t paths_size, uint64_t hash)
+{
+	size_t i = (size_t)hash & (paths_size - 1);
+	while (paths[i].count && paths[i].hash != hash)
+		i = (i + 1) & (paths_size - 1);
+	return &paths[i];
+}
+
+/**
+ * This function looks up how many times the tested inputs have taken a path.  The corpus's mutex should
+ * be held by the caller.
+ * @param corpus - the corpus to look up the path in
+ * @param hash - the path's hash
+ * @return - the number of times the path was taken
+ */
+static uint64_t corpus_path_count(corpus_t * corpus, uint64_t hash)
+{
+	return corpus_path_slot(corpus->paths, corpus->paths_size, hash)->count;
+}
+
+/**
+ * This function scales an entry's energy by how costly its runs are compared to the average entry's, in
+ * the same steps as AFL's calculate_score, so that slow entries don't take up most of the fuzzing time.
+ * When the corpus prefers costly entries, the steps are turned around, so the slow entries get the most.
+ * The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus that the entry is in
+ * @param entry - the entry to scale the energy of
+ * @return - the factor to multiply the entry's energy by, 1 if the entry's cost isn't known
+ */
+static double corpus_cost_factor(corpus_t * corpus, corpus_entry_t * entry)
+{
+	double average, factor = 1;
+
+	if (!entry->cost || !corpus->costed_count)
+		return 1;
+	average = (double)corpus->total_cost / corpus->costed_count;
+	if (entry->cost * 0.1 > average)
+		factor = 0.1;
+	else if (entry->cost * 0.25 > average)
+		factor = 0.25;
+	else if (entry->cost * 0.5 > average)
+		factor = 0.5;
+	else if (entry->cost * 0.75 > average)
+		factor = 0.75;
+	else if (entry->cost * 4 < average)
+		factor = 3;
+	else if (entry->cost * 3 < average)
+		factor = 2;
+	else if (entry->cost * 2 < average)
+		factor = 1.5;
+	return corpus->prefer_costly ? 1 / factor : factor;
+}
+
+/**
+ * This function calculates how many iterations an entry should get for its next turn, in the style of
+ * AFLFast's FAST schedule.  The energy doubles with each turn the entry has had, and is divided by how
+ * often the entry's path has been taken, so entries on rarely taken paths get most of the iterations, and
+ * entries on paths that most mutations already take get few.  Entries without a path hash get the default.
+ * Either way, the energy is scaled by how costly the entry's runs are.  The corpus's mutex should be held
+ * by the caller.
+ * @param corpus - the corpus that the entry is in
+ * @param entry - the entry to calculate the energy of
+ * @return - the number of iterations to give the entry
+ */
+static int corpus_entry_energy(corpus_t * corpus, corpus_entry_t * entry)
+{
+	double energy, min_energy, max_energy, turns_on_path;
+	int power;
+
+	energy = corpus->entry_iterations * corpus_cost_factor(corpus, entry);
+	if (entry->has_path_hash) {
+		power = entry->times_chosen < CORPUS_MAX_SCHEDULE_POWER ? entry->times_chosen : CORPUS_MAX_SCHEDULE_POWER;
+		turns_on_path = (double)corpus_path_count(corpus, entry->path_hash) / corpus->entry_iterations;
+		energy = energy * (double)(1 << power) / (1 + turns_on_path);
+	}
+
+	min_energy = corpus->entry_iterations / CORPUS_ENERGY_RANGE;
+	max_energy = (double)corpus->entry_iterations * CORPUS_ENERGY_RANGE;
+	if (energy < min_energy)
+		energy = min_energy;
+	if (energy > max_energy)
+		energy = max_energy;
+	return energy < 1 ? 1 : (int)energy;
+}
+
+/**
+ * This function calculates an entry's favor factor, the product of its cost and its length as in AFL,
+ * which each coverage map byte's top rated entry has the smallest of.  Entries whose cost isn't known
+ * are given the average cost.  When the corpus prefers costly entries, the factor falls as the cost rises
+ * instead, and the length doesn't count, so each byte's top rated entry is its most costly one, as in
+ * PerfFuzz.  The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus that the entry is in
+ * @param entry - the entry to calculate the favor factor of
+ * @return - the favor factor
+ */
+static uint64_t corpus_favor_factor(corpus_t * corpus, corpus_entry_t * entry)
+{
+	uint64_t cost = entry->cost;
+
+	if (!cost)
+		cost = corpus->costed_count ? corpus->total_cost / corpus->costed_count : 1;
+	if (corpus->prefer_costly)
+		return UINT64_MAX / (cost ? cost : 1);
+	return (cost ? cost : 1) * (entry->length ? entry->length : 1);
+}
+
+/**
+ * This function makes an entry the top rated entry for each coverage map byte that its run hit, if it's
+ * cheaper than the byte's current top rated entry, as in AFL's update_bitmap_score.  Entries that stop
+ * being the top rated entry for any byte free their coverage.  The corpus's mutex should be held by the
+ * caller.
+ * @param corpus - the corpus that the entry is in
+ * @param index - the index of the entry
+ * @param trace_bits - the coverage map of the entry's run
+ * @param trace_size - the size of the trace_bits parameter
+ */
+static void corpus_update_top_rated(corpus_t * corpus, size_t index, const uint8_t * trace_bits, size_t trace_size)
+{
+	corpus_entry_t * entry = &corpus->entries[index], * top;
+	uint64_t factor = corpus_favor_factor(corpus, entry);
+	size_t i;
+
+	if (!corpus->map_size) {
+		corpus->top_rated = (size_t *)calloc(trace_size, sizeof(size_t));
+		if (!corpus->top_rated)
+			return;
+		corpus->map_size = trace_size;
+	}
+	//An entry whose map doesn't line up with the others is left out of the favored set
+	if (trace_size != corpus->map_size)
+		return;
+	entry->trace_mini = (uint8_t *)calloc((trace_size + 7) / 8, 1);
+	if (!entry->trace_mini)
+		return;
+	entry->has_coverage = 1;
+
+	for (i = 0; i < trace_size; i++)
+	{
+		if (!trace_bits[i])
+			continue;
+		entry->trace_mini[i >> 3] |= 1 << (i & 7);
+		if (corpus->top_rated[i]) {
+			top = &corpus->entries[corpus->top_rated[i] - 1];
+			if (factor >= corpus_favor_factor(corpus, top))
+				continue;
+			if (!--top->top_rated_count) {
+				free(top->trace_mini);
+				top->trace_mini = NULL;
+			}
+		}
+		corpus->top_rated[i] = index + 1;
+		entry->top_rated_count++;
+		corpus->top_rated_changed = 1;
+	}
+
+	if (!entry->top_rated_count) {
+		free(entry->trace_mini);
+		entry->trace_mini = NULL;
+	}
+}
+
+/**
+ * This function picks the favored set again after the top rated entries have changed, as in AFL's
+ * cull_queue.  Going through the coverage map bytes in order, the top rated entry of each byte that
+ * the favored set doesn't hit yet is added to it.  The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus to pick the favored set of
+ */
+static void corpus_cull(corpus_t * corpus)
+{
+	corpus_entry_t * entry;
+	uint8_t * unhit;
+	size_t i, j, bytes = (corpus->map_size + 7) / 8;
+
+	if (!corpus->top_rated_changed)
+		return;
+	unhit = (uint8_t *)malloc(bytes);
+	if (!unhit)
+		return;
+	memset(unhit, 0xff, bytes);
+	corpus->top_rated_changed = 0;
+
+	for (i = 0; i < corpus->entries_count; i++)
+		corpus->entries[i].favored = 0;
+	corpus->favored_count = 0;
+	corpus->pending_favored = 0;
+	for (i = 0; i < corpus->map_size; i++)
+	{
+		if (!corpus->top_rated[i] || !(unhit[i >> 3] & (1 << (i & 7))))
+			continue;
+		entry = &corpus->entries[corpus->top_rated[i] - 1];
+		for (j = 0; j < bytes; j++)
+			unhit[j] &= ~entry->trace_mini[j];
+		entry->favored = 1;
+		corpus->favored_count++;
+		if (!entry->times_chosen && !entry->exhausted)
+			corpus->pending_favored++;
+	}
+	free(unhit);
+	DEBUG_MSG("The favored set has %lu of the corpus's %lu entries", (unsigned long)corpus->favored_count,
+		(unsigned long)corpus->entries_count);
+}
+
+/**
+ * This function decides whether the scheduler should pass over an entry, as AFL does with the entries
+ * outside the favored set.  Entries whose coverage isn't known, such as the seeds, are never passed over.
+ * The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus that the entry is in
+ * @param entry - the entry to decide whether to skip
+ * @return - 1 if the entry should be skipped, 0 if it should be mutated
+ */
+static int corpus_skip_entry(corpus_t * corpus, corpus_entry_t * entry)
+{
+	if (!corpus->favored_count || !entry->has_coverage)
+		return 0;
+	if (corpus->pending_favored)
+		return (entry->times_chosen || !entry->favored) && rand() % 100 < CORPUS_SKIP_TO_NEW_FAVORED;
+	if (entry->favored)
+		return 0;
+	return rand() % 100 < (entry->times_chosen ? CORPUS_SKIP_NOT_FAVORED_OLD : CORPUS_SKIP_NOT_FAVORED_NEW);
+}
+
+/**
+ * This function records that a tested input took a path, so the power schedule knows how common
+ * the path is.  It's safe to call from multiple threads at once.
+ * @param corpus - the corpus to record the path in
+ * @param path_hash - the hash of the path the input took, from the instrumentation's get_path_hash
+ */
+void corpus_record_path(corpus_t * corpus, uint64_t path_hash)
+{
+	corpus_path_t * slot, * paths;
+	size_t i, paths_size;
+
+	if (take_mutex(corpus->mutex))
+		return;
+
+	slot = corpus_path_slot(corpus->paths, corpus->paths_size, path_hash);
+	if (!slot->count && (corpus->paths_count + 1) * 2 > corpus->paths_size)
+	{
+		//Keep the table at most half full, so the probe sequences stay short
+		paths_size = corpus->paths_size * 2;
+		paths = (corpus_path_t *)calloc(paths_size, sizeof(corpus_path_t));
+		if (paths) {
+			for (i = 0; i < corpus->paths_size; i++) {
+				if (corpus->paths[i].count)
+					*corpus_path_slot(paths, paths_size, corpus->paths[i].hash) = corpus->paths[i];
+			}
+			free(corpus->paths);
+			corpus->paths = paths;
+			corpus->paths_size = paths_size;
+		}
+		slot = corpus_path_slot(corpus->paths, corpus->paths_size, path_hash);
+	}
+
+	//If the table couldn't grow, stop tracking new paths rather than filling the last empty slot
+	if (slot->count || (corpus->paths_count + 1) < corpus->paths_size)
+	{
+		if (!slot->count) {
+			slot->hash = path_hash;
+			corpus->paths_count++;
+		}
+		slot->count++;
+	}
+
+	release_mutex(corpus->mutex);
+}
+
+/**
+ * This function creates a corpus, which holds the inputs that the fuzzer has found new paths with and
+ * schedules them into the mutator one after another.  The mutator starts out on the seed, which is the
+ * first entry in the corpus.
+ * @param mutator - the mutator that mutates the corpus entries
+ * @param mutator_state - the mutator's state, which should already have been created with the seed
+ * @param seed - the seed input
+ * @param seed_length - the length of the seed parameter
+ * @param entry_iterations - the number of iterations to mutate each entry for before moving on to the next one
+ * @return - the new corpus on success, or NULL on failure
+ */
+corpus_t * corpus_create(mutator_t * mutator, void * mutator_state, char * seed, size_t seed_length, int entry_iterations)
+{
+	corpus_t * corpus;
+
+	corpus = (corpus_t *)calloc(1, sizeof(corpus_t));
+	if (!corpus)
+		return NULL;
+	corpus->mutator = mutator;
+	corpus->mutator_state = mutator_state;
+	corpus->entry_iterations = entry_iterations;
+	corpus->current_energy = entry_iterations;
+	corpus->paths_size = CORPUS_PATHS_INITIAL_SIZE;
+	corpus->paths = (corpus_path_t *)calloc(corpus->paths_size, sizeof(corpus_path_t));
+	corpus->mutex = create_mutex();
+	corpus->initial_mutator_state = mutator->get_state(mutator_state);
+	if (!corpus->paths || !corpus->mutex || !corpus->initial_mutator_state || !corpus_add_entry(corpus, seed, seed_length, 1))
+	{
+		corpus_destroy(corpus);
+		return NULL;
+	}
+	return corpus;
+}
+
+/**
+ * This function frees a corpus and all of its entries.
+ * @param corpus - the corpus to free
+ */
+void corpus_destroy(corpus_t * corpus)
+{
+	corpus_arena_block_t * block, * next;
+	size_t i;
+
+	if (!corpus)
+		return;
+	for (i = 0; i < corpus->entries_count; i++) {
+		free(corpus->entries[i].mutator_state);
+		free(corpus->entries[i].trace_mini);
+	}
+	for (block = corpus->arena; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+	if (corpus->initial_mutator_state)
+		corpus->mutator->free_state(corpus->initial_mutator_state);
+	destroy_mutex(corpus->mutex);
+	free(corpus->top_rated);
+	free(corpus->paths);
+	free(corpus->entries);
+	free(corpus);
+}
+
+/**
+ * This function adds an input that found a new path to the corpus, so that it will be mutated once the
+ * mutator gets to it.  It's safe to call from multiple threads at once.
+ * @param corpus - the corpus to add the input to
+ * @param input - the input to add.  It is copied into the corpus.
+ * @param length - the length of the input parameter
+ * @param path_hash - optionally, the hash of the path that the input took, which lets the power schedule
+ * weigh the entry by how rare its path is.  NULL if the instrumentation doesn't provide path hashes.
+ * @param cost - how costly the input's run was, in instructions or microseconds (the same unit for every
+ * entry), or 0 if it isn't known
+ * @param trace_bits - optionally, the coverage map of the input's run, which decides whether the entry
+ * joins the favored set.  NULL if the instrumentation doesn't provide coverage maps.
+ * @param trace_size - the size of the trace_bits parameter
+ * @return - zero on success, non-zero on failure
+ */
+int corpus_add(corpus_t * corpus, char * input, size_t length, uint64_t * path_hash, uint64_t cost,
+	const uint8_t * trace_bits, size_t trace_size)
+{
+	corpus_entry_t * entry;
+
+	if (take_mutex(corpus->mutex))
+		return 1;
+	entry = corpus_add_entry(corpus, input, length, 1);
+	if (entry && path_hash) {
+		entry->path_hash = *path_hash;
+		entry->has_path_hash = 1;
+	}
+	if (entry && cost) {
+		entry->cost = cost;
+		corpus->total_cost += cost;
+		corpus->costed_count++;
+	}
+	if (entry && trace_bits && trace_size)
+		corpus_update_top_rated(corpus, corpus->entries_count - 1, trace_bits, trace_size);
+	release_mutex(corpus->mutex);
+	return entry == NULL;
+}
+
+/**
+ * This function adds a seed to the corpus without copying it, such as one mapped by load_seed_directory.
+ * It should be called before fuzzing starts.
+ * @param corpus - the corpus to add the seed to
+ * @param input - the seed to add.  It must stay valid until the corpus is destroyed.
+ * @param length - the length of the input parameter
+ * @return - zero on success, non-zero on failure
+ */
+int corpus_add_seed(corpus_t * corpus, const char * input, size_t length)
+{
+	return corpus_add_entry(corpus, input, length, 0) == NULL;
+}
+
+/**
+ * This function copies a corpus entry's input, so that it can be used without holding the corpus's lock.
+ * It's safe to call from multiple threads at once.
+ * @param corpus - the corpus to copy the entry from
+ * @param index - the index of the entry to copy
+ * @param length - used to return the length of the entry's input
+ * @param times_chosen - used to return the number of turns the mutator has had on the entry, or -1 if the
+ * mutator has run out of mutations for it
+ * @return - a copy of the entry's input, which the caller should free, or NULL if there's no such entry or on failure
+ */
+char * corpus_copy_entry(corpus_t * corpus, size_t index, size_t * length, int * times_chosen)
+{
+	char * input = NULL;
+
+	if (take_mutex(corpus->mutex))
+		return NULL;
+	if (index < corpus->entries_count) {
+		input = (char *)memdup(corpus->entries[index].input, corpus->entries[index].length);
+		*length = corpus->entries[index].length;
+		*times_chosen = corpus->entries[index].exhausted ? -1 : corpus->entries[index].times_chosen;
+	}
+	release_mutex(corpus->mutex);
+	return input;
+}
+
+/**
+ * This function moves the mutator on to the next corpus entry that it hasn't run out of mutations for,
+ * saving its progress on the current entry so that it can pick up where it left off next time.
+ * Entries that are too large for the buffer being mutated into are skipped, and the entries outside the
+ * favored set are mostly passed over.  The corpus's mutex should be held by the caller.
+ * @param corpus - the corpus to move on to the next entry of
+ * @param max_length - the largest entry that can be mutated
+ * @return - 1 if the mutator was moved to another entry, 0 if every entry is exhausted, or -1 on error
+ */
+static int corpus_next_entry(corpus_t * corpus, size_t max_length)
+{
+	corpus_entry_t * entry = &corpus->entries[corpus->current];
+	char * state;
+	size_t i, next;
+	int pass;
+
+	state = corpus->mutator->get_state(corpus->mutator_state);
+	if (!state)
+		return -1;
+	free(entry->mutator_state);
+	entry->mutator_state = strdup(state);
+	corpus->mutator->free_state(state);
+	if (!entry->mutator_state)
+		return -1;
+
+	//If every entry that's left gets passed over, the next one is mutated anyway
+	corpus_cull(corpus);
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 1; i <= corpus->entries_count; i++)
+		{
+			next = (corpus->current + i) % corpus->entries_count;
+			if (!corpus->entries[next].exhausted && corpus->entries[next].length <= max_length
+				&& (pass || !corpus_skip_entry(corpus, &corpus->entries[next])))
+				break;
+		}
+		if (i <= corpus->entries_count)
+			break;
+	}
+	if (pass == 2)
+		return 0;
+
+	entry = &corpus->entries[next];
+	if (entry->favored && !entry->times_chosen && corpus->pending_favored)
+		corpus->pending_favored--;
+	entry->times_chosen++;
+	corpus->current_iterations = 0;
+	corpus->current_energy = corpus_entry_energy(corpus, entry);
+	if (next == corpus->current)
+		return 1;
+
+	if (corpus->mutator->set_input(corpus->mutator_state, entry->input, entry->length)
+		|| corpus->mutator->set_state(corpus->mutator_state,
+			entry->mutator_state ? entry->mutator_state : corpus->initial_mutator_state))
+		return -1;
+	corpus->current = next;
+	return 1;
+}
+
+/**
+ * This function mutates the current corpus entry, either into a fixed size buffer or a growable buffer.
+ * @param corpus - the corpus to mutate an entry from
+ * @param buffer - a buffer that the mutated input will be written to, if growable is NULL
+ * @param buffer_length - the size of the passed in buffer argument
+ * @param growable - a growable buffer that the mutated input will be written to, or NULL to use buffer
+ * @param flags - the mutate flags to pass to the mutator
+ * @param lineage - the lineage to record the mutation in, or NULL
+ * @return - the length of the mutated data, or -1 on error
+ */
+static int mutate_current_entry(corpus_t * corpus, char * buffer, size_t buffer_length, growable_buffer_t * growable,
+	uint64_t flags, lineage_t * lineage)
+{
+	corpus_entry_t * entry = &corpus->entries[corpus->current];
+
+	if (!growable) {
+		if (lineage)
+			lineage_capture(lineage, corpus->mutator, corpus->mutator_state, entry->input, entry->length,
+				buffer_length, 0);
+		return corpus->mutator->mutate_extended(corpus->mutator_state, buffer, buffer_length, flags);
+	}
+	//Mutators without a mutate_growable function need the buffer to fit the entry up front
+	if (growable->reserve(growable, entry->length))
+		return -1;
+	if (lineage)
+		lineage_capture(lineage, corpus->mutator, corpus->mutator_state, entry->input, entry->length,
+			growable->capacity, growable->max_capacity);
+	return mutator_mutate_growable(corpus->mutator, corpus->mutator_state, growable, flags);
+}
+
+/**
+ * This function mutates the current corpus entry, moving on to the next entry once the current one
+ * has used up the iterations the power schedule gave it or the mutator runs out of mutations for it.
+ * @param corpus - the corpus to mutate an entry from
+ * @param buffer - a buffer that the mutated input will be written to, if growable is NULL
+ * @param buffer_length - the size of the passed in buffer argument
+ * @param growable - a growable buffer that the mutated input will be written to, or NULL to use buffer
+ * @param flags - the mutate flags to pass to the mutator
+ * @param lineage - the lineage to record the mutation in, or NULL
+ * @return - the length of the mutated data, 0 when every corpus entry is out of mutations, or -1 on error
+ */
+static int corpus_mutate_into(corpus_t * corpus, char * buffer, size_t buffer_length, growable_buffer_t * growable,
+	uint64_t flags, lineage_t * lineage)
+{
+	int ret, moved = 1;
+	size_t max_length;
+
+	if (take_mutex(corpus->mutex))
+		return -1;
+
+	//Only switch entries before the first part of an input, so all of the parts come from the same entry
+	if ((flags & MUTATE_MULTIPLE_INPUTS) && (flags & MUTATE_MULTIPLE_INPUTS_MASK))
+		ret = mutate_current_entry(corpus, buffer, buffer_length, growable, flags, lineage);
+	else
+	{
+		//The parts of a multiple input entry are limited in size separately, so the entry's total size doesn't matter
+		if (flags & MUTATE_MULTIPLE_INPUTS)
+			max_length = (size_t)-1;
+		else
+			max_length = growable ? growable->max_capacity : buffer_length;
+		if (corpus->current_iterations >= corpus->current_energy)
+			moved = corpus_next_entry(corpus, max_length);
+
+		ret = 0;
+		while (moved > 0)
+		{
+			ret = mutate_current_entry(corpus, buffer, buffer_length, growable, flags, lineage);
+			if (ret != 0)
+				break;
+			corpus->entries[corpus->current].exhausted = 1;
+			moved = corpus_next_entry(corpus, max_length);
+		}
+		if (moved < 0)
+			ret = -1;
+		corpus->current_iterations++;
+	}
+
+	release_mutex(corpus->mutex);
+	return ret;
+}
+
+/**
+ * This function mutates the current corpus entry, moving on to the next entry once the current one
+ * has used up the iterations the power schedule gave it or the mutator runs out of mutations for it.
+ * It has the same arguments and return values as the mutator's mutate_extended function, and is safe
+ * to call from multiple threads at once.
+ * @param corpus - the corpus to mutate an entry from
+ * @param buffer - a buffer that the mutated input will be written to
+ * @param buffer_length - the size of the passed in buffer argument
+ * @param flags - the mutate flags to pass to the mutator
+ * @param lineage - the lineage to record the mutation in, or NULL
+ * @return - the length of the mutated data, 0 when every corpus entry is out of mutations, or -1 on error
+ */
+int corpus_mutate(corpus_t * corpus, char * buffer, size_t buffer_length, uint64_t flags, lineage_t * lineage)
+{
+	return corpus_mutate_into(corpus, buffer, buffer_length, NULL, flags, lineage);
+}
+
+/**
+ * This function is the same as corpus_mutate, except that the entry is mutated into a growable buffer,
+ * so entries of any size up to the buffer's max_capacity are mutated, and mutations can grow the buffer.
+ * @param corpus - the corpus to mutate an entry from
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - the mutate flags to pass to the mutator
+ * @param lineage - the lineage to record the mutation in, or NULL
+ * @return - the length of the mutated data, 0 when every corpus entry is out of mutations, or -1 on error
+ */
+int corpus_mutate_growable(corpus_t * corpus, growable_buffer_t * buffer, uint64_t flags, lineage_t * lineage)
+{
+	return corpus_mutate_into(corpus, NULL, 0, buffer, flags, lineage);
+}
+
+/**
+ * This function saves the corpus to a checkpoint file, so that a later run can resume from it with corpus_load.
+ * @param corpus - the corpus to save
+ * @param filename - the file to write the checkpoint to
+ * @return - zero on success, non-zero on failure
+ */
+int corpus_save(corpus_t * corpus, char * filename)
+{
+	json_t * root, * entries, * entry_obj, * temp;
+	corpus_entry_t * entry;
+	char * state, temp_filename[MAX_PATH];
+	size_t i;
+	int ret;
+
+	root = json_object();
+	entries = json_array();
+	if (!root || !entries) {
+		json_decref(root);
+		json_decref(entries);
+		return 1;
+	}
+	json_object_set_new(root, "entries", entries);
+
+	take_mutex(corpus->mutex);
+	state = corpus->mutator->get_state(corpus->mutator_state);
+	json_object_set_new(root, "current", json_integer(corpus->current));
+	json_object_set_new(root, "current_iterations", json_integer(corpus->current_iterations));
+	json_object_set_new(root, "current_energy", json_integer(corpus->current_energy));
+	for (i = 0; i < corpus->entries_count; i++)
+	{
+		entry = &corpus->entries[i];
+		entry_obj = json_object();
+		if (!entry_obj)
+			break;
+		json_array_append_new(entries, entry_obj);
+		//The inputs last as long as the corpus does, so they don't need to be copied
+		json_object_set_new(entry_obj, "input", json_mem_nocopy(entry->input, entry->length));
+		json_object_set_new(entry_obj, "exhausted", json_integer(entry->exhausted));
+		json_object_set_new(entry_obj, "times_chosen", json_integer(entry->times_chosen));
+		if (entry->has_path_hash)
+			json_object_set_new(entry_obj, "path_hash", json_integer((json_int_t)entry->path_hash));
+		temp = NULL;
+		if (i == corpus->current && state)
+			temp = json_string(state);
+		else if (entry->mutator_state)
+			temp = json_string(entry->mutator_state);
+		if (temp)
+			json_object_set_new(entry_obj, "mutator_state", temp);
+	}
+	release_mutex(corpus->mutex);
+	if (state)
+		corpus->mutator->free_state(state);
+
+	//Write the checkpoint to a temporary file first, so an interrupted save doesn't destroy the last checkpoint.
+	//It's encoded straight into the file, rather than into a string first.
+	snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+	ret = dump_json_to_file(root, temp_filename, 0);
+	json_decref(root);
+	if (!ret) {
+#ifdef _WIN32
+		ret = !MoveFileEx(temp_filename, filename, MOVEFILE_REPLACE_EXISTING);
+#else
+		ret = rename(temp_filename, filename);
+#endif
+	}
+	return ret;
+}
+
+/**
+ * This function replaces the corpus's entries with the ones in a checkpoint file written by corpus_save,
+ * and sets up the mutator to resume where the checkpoint left off.  It should be called before fuzzing starts.
+ * @param corpus - the corpus to load the checkpoint into
+ * @param filename - the checkpoint file to load
+ * @return - zero on success, non-zero on failure
+ */
+int corpus_load(corpus_t * corpus, char * filename)
+{
+	json_t * root, * entries, * entry_obj, * temp;
+	json_error_t error;
+	corpus_entry_t * entry;
+	char * checkpoint;
+	size_t i, count, current;
+	int ret = 1;
+
+	if (read_file(filename, &checkpoint) <= 0)
+		return 1;
+	root = json_loads(checkpoint, 0, &error);
+	free(checkpoint);
+	if (!root)
+		return 1;
+
+	entries = json_object_get(root, "entries");
+	temp = json_object_get(root, "current");
+	count = entries && json_is_array(entries) ? json_array_size(entries) : 0;
+	current = temp && json_is_integer(temp) ? (size_t)json_integer_value(temp) : 0;
+	if (!count || current >= count)
+		goto done;
+
+	//Only the seed is in the corpus before the checkpoint is loaded, and the checkpoint includes it
+	free(corpus->entries[0].mutator_state);
+	corpus->entries_count = 0;
+	for (i = 0; i < count; i++)
+	{
+		entry_obj = json_array_get(entries, i);
+		temp = json_object_get(entry_obj, "input");
+		if (!temp || !json_is_mem(temp))
+			goto done;
+		entry = corpus_add_entry(corpus, json_mem_value(temp), json_mem_length(temp), 1);
+		if (!entry)
+			goto done;
+		temp = json_object_get(entry_obj, "exhausted");
+		entry->exhausted = temp && json_is_integer(temp) ? (int)json_integer_value(temp) : 0;
+		temp = json_object_get(entry_obj, "times_chosen");
+		entry->times_chosen = temp && json_is_integer(temp) ? (int)json_integer_value(temp) : 0;
+		temp = json_object_get(entry_obj, "path_hash");
+		if (temp && json_is_integer(temp)) {
+			entry->path_hash = (uint64_t)json_integer_value(temp);
+			entry->has_path_hash = 1;
+		}
+		temp = json_object_get(entry_obj, "mutator_state");
+		if (temp && json_is_string(temp))
+			entry->mutator_state = strdup(json_string_value(temp));
+	}
+
+	temp = json_object_get(root, "current_iterations");
+	corpus->current_iterations = temp && json_is_integer(temp) ? (int)json_integer_value(temp) : 0;
+	temp = json_object_get(root, "current_energy");
+	corpus->current_energy = temp && json_is_integer(temp) ? (int)json_integer_value(temp) : corpus->entry_iterations;
+	corpus->current = current;
+	entry = &corpus->entries[current];
+	if (corpus->mutator->set_input(corpus->mutator_state, entry->input, entry->length)
+		|| corpus->mutator->set_state(corpus->mutator_state,
+			entry->mutator_state ? entry->mutator_state : corpus->initial_mutator_state))
+		goto done;
+	ret = 0;
+
+done:
+	json_decref(root);
+	return ret;
+}
+
+#define CORPUS_SERIALIZED_ALIGN(x) (((x) + CORPUS_SERIALIZED_ALIGNMENT - 1) & ~(size_t)(CORPUS_SERIALIZED_ALIGNMENT - 1))
+
+/**
+ * This function serializes the corpus into a compact binary buffer, such as for a campaign checkpoint.
+ * Unlike corpus_save, the inputs aren't encoded, so the buffer can be read back with corpus_deserialize
+ * straight from a mapped file.
+ * @param corpus - the corpus to serialize
+ * @param length - a pointer used to return the length of the serialized corpus
+ * @return - a newly allocated buffer holding the serialized corpus that should be freed with free,
+ * or NULL on failure
+ */
+char * corpus_serialize(corpus_t * corpus, size_t * length)
+{
+	corpus_serialized_header_t * header;
+	corpus_serialized_entry_t * serialized;
+	corpus_entry_t * entry;
+	const char * entry_state;
+	char * state, * buffer = NULL;
+	size_t i, size, offset;
+
+	take_mutex(corpus->mutex);
+	state = corpus->mutator->get_state(corpus->mutator_state);
+
+	size = sizeof(corpus_serialized_header_t);
+	for (i = 0; i < corpus->entries_count; i++)
+	{
+		entry = &corpus->entries[i];
+		entry_state = i == corpus->current && state ? state : entry->mutator_state;
+		size += CORPUS_SERIALIZED_ALIGN(sizeof(corpus_serialized_entry_t) + entry->length
+			+ (entry_state ? strlen(entry_state) + 1 : 0));
+	}
+
+	buffer = (char *)calloc(1, size);
+	if (buffer)
+	{
+		header = (corpus_serialized_header_t *)buffer;
+		header->entries_count = corpus->entries_count;
+		header->current = corpus->current;
+		header->current_iterations = corpus->current_iterations;
+		header->current_energy = corpus->current_energy;
+
+		offset = sizeof(corpus_serialized_header_t);
+		for (i = 0; i < corpus->entries_count; i++)
+		{
+			entry = &corpus->entries[i];
+			entry_state = i == corpus->current && state ? state : entry->mutator_state;
+			serialized = (corpus_serialized_entry_t *)(buffer + offset);
+			serialized->length = entry->length;
+			serialized->path_hash = entry->path_hash;
+			serialized->mutator_state_length = entry_state ? strlen(entry_state) + 1 : 0;
+			serialized->exhausted = entry->exhausted;
+			serialized->times_chosen = entry->times_chosen;
+			serialized->has_path_hash = entry->has_path_hash;
+			memcpy(serialized + 1, entry->input, entry->length);
+			if (entry_state)
+				memcpy((char *)(serialized + 1) + entry->length, entry_state, (size_t)serialized->mutator_state_length);
+			offset += CORPUS_SERIALIZED_ALIGN(sizeof(corpus_serialized_entry_t) + entry->length
+				+ (size_t)serialized->mutator_state_length);
+		}
+		*length = size;
+	}
+
+	release_mutex(corpus->mutex);
+	if (state)
+		corpus->mutator->free_state(state);
+	return buffer;
+}
+
+/**
+ * This function replaces the corpus's entries with the ones in a buffer written by corpus_serialize,
+ * and sets up the mutator to resume where it left off.  It should be called before fuzzing starts.
+ * The buffer is only read during the call, so it can be unmapped afterwards.
+ * @param corpus - the corpus to load the entries into
+ * @param buffer - the serialized corpus
+ * @param length - the length of the buffer parameter
+ * @return - zero on success, non-zero on failure
+ */
+int corpus_deserialize(corpus_t * corpus, const char * buffer, size_t length)
+{
+	const corpus_serialized_header_t * header = (const corpus_serialized_header_t *)buffer;
+	const corpus_serialized_entry_t * serialized;
+	corpus_entry_t * entry;
+	const char * entry_state;
+	size_t i, offset, entry_length;
+
+	if (length < sizeof(corpus_serialized_header_t) || !header->entries_count || header->current >= header->entries_count)
+		return 1;
+
+	//Only the seed is in the corpus before the entries are loaded, and the serialized corpus includes it
+	free(corpus->entries[0].mutator_state);
+	corpus->entries[0].mutator_state = NULL;
+	corpus->entries_count = 0;
+	offset = sizeof(corpus_serialized_header_t);
+	for (i = 0; i < header->entries_count; i++)
+	{
+		serialized = (const corpus_serialized_entry_t *)(buffer + offset);
+		if (length - offset < sizeof(corpus_serialized_entry_t)
+			|| serialized->length > length - offset - sizeof(corpus_serialized_entry_t)
+			|| serialized->mutator_state_length > length - offset - sizeof(corpus_serialized_entry_t) - serialized->length)
+			return 1;
+		entry_length = sizeof(corpus_serialized_entry_t) + (size_t)serialized->length + (size_t)serialized->mutator_state_length;
+
+		entry = corpus_add_entry(corpus, (const char *)(serialized + 1), (size_t)serialized->length, 1);
+		if (!entry)
+			return 1;
+		entry->exhausted = serialized->exhausted;
+		entry->times_chosen = serialized->times_chosen;
+		entry->path_hash = serialized->path_hash;
+		entry->has_path_hash = serialized->has_path_hash;
+		if (serialized->mutator_state_length) {
+			entry_state = (const char *)(serialized + 1) + serialized->length;
+			if (entry_state[serialized->mutator_state_length - 1])
+				return 1;
+			entry->mutator_state = strdup(entry_state);
+			if (!entry->mutator_state)
+				return 1;
+		}
+		offset += CORPUS_SERIALIZED_ALIGN(entry_length);
+		if (offset > length)
+			offset = length;
+	}
+
+	corpus->current_iterations = header->current_iterations;
+	corpus->current_energy = header->current_energy;
+	corpus->current = (size_t)header->current;
+	entry = &corpus->entries[corpus->current];
+	return corpus->mutator->set_input(corpus->mutator_state, entry->input, entry->length)
+		|| corpus->mutator->set_state(corpus->mutator_state,
+			entry->mutator_state ? entry->mutator_state : corpus->initial_mutator_state);
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <global_types.h>
+#include <utils.h>
+#include "lineage.h"
+#include <stdint.h>
+
+//The default number of iterations to mutate each corpus entry for before moving on to the next one
+#define CORPUS_DEFAULT_ENTRY_ITERATIONS 1000
+
+//The size of each block of memory that the corpus entries' inputs are allocated from
+#define CORPUS_ARENA_BLOCK_SIZE (1024 * 1024)
+
+//The power schedule gives each entry between entry_iterations / CORPUS_ENERGY_RANGE and
+//entry_iterations * CORPUS_ENERGY_RANGE iterations per turn
+#define CORPUS_ENERGY_RANGE 16
+//The most times an entry's energy is doubled for having been chosen before
+#define CORPUS_MAX_SCHEDULE_POWER 10
+
+//The initial number of slots in the path frequency table
+#define CORPUS_PATHS_INITIAL_SIZE 1024
+
+//The chance, out of 100, that the scheduler skips an entry outside the favored set, as in AFL.  While some
+//favored entries haven't had a turn yet, the entries that have had one are mostly skipped as well.
+#define CORPUS_SKIP_TO_NEW_FAVORED 99
+#define CORPUS_SKIP_NOT_FAVORED_OLD 95
+#define CORPUS_SKIP_NOT_FAVORED_NEW 75
+
+//A block of memory that corpus inputs are allocated from.  Blocks are only freed with the corpus.
+struct corpus_arena_block
+{
+	struct corpus_arena_block * next;
+	size_t size;
+	size_t used;
+	char data[1];
+};
+typedef struct corpus_arena_block corpus_arena_block_t;
+
+//An input in the corpus, as well as the mutator's progress on it
+struct corpus_entry
+{
+	char * input;          //Allocated from the corpus arena, or a seed owned by the caller
+	size_t length;
+	char * mutator_state;  //The mutator state when this entry was last switched away from, or NULL
+	int exhausted;         //Whether the mutator has run out of mutations for this entry
+	uint64_t path_hash;    //The hash of the path this entry took when it was found
+	int has_path_hash;     //Whether path_hash is known
+	int times_chosen;      //The number of turns the mutator has had on this entry
+	uint64_t cost;         //How costly the entry's run was, in instructions or microseconds, or 0 if it isn't known
+	int has_coverage;      //Whether the entry's coverage is known, so it can be left out of the favored set
+	int favored;           //Whether the entry is in the favored set
+	size_t top_rated_count; //The number of coverage map bytes the entry is the top rated entry for
+	uint8_t * trace_mini;  //The coverage map bytes the entry's run hit, one bit each, while top_rated_count isn't 0
+};
+typedef struct corpus_entry corpus_entry_t;
+
+//The number of times the inputs tested so far have taken a path
+struct corpus_path
+{
+	uint64_t hash;
+	uint64_t count;  //Zero for an empty slot
+};
+typedef struct corpus_path corpus_path_t;
+
+struct corpus
+{
+	mutator_t * mutator;
+	void * mutator_state;
+	char * initial_mutator_state; //The mutator state to use for entries that haven't been mutated yet
+	int entry_iterations;         //The number of iterations to mutate each entry for before moving on
+
+	mutex_t mutex;
+	corpus_arena_block_t * arena;
+	corpus_entry_t * entries;
+	size_t entries_count;
+	size_t entries_size;          //The number of entries that have been allocated
+	size_t current;               //The entry that the mutator is currently mutating
+	int current_iterations;       //The number of iterations the current entry has been mutated for
+	int current_energy;           //The number of iterations the current entry gets this turn
+
+	//How often each path has been taken, which the power schedule uses to favor the entries on rare paths
+	corpus_path_t * paths;
+	size_t paths_size;            //The number of slots in paths, always a power of two
+	size_t paths_count;           //The number of used slots in paths
+
+	//The cheapest entry (by cost times length) that hit each byte of the coverage map is its top rated
+	//entry.  The favored set is a small set of top rated entries that hits every byte any entry has hit,
+	//which the scheduler gives most of the turns to, as in AFL's queue culling.
+	size_t * top_rated;           //The index of each byte's top rated entry plus one, or 0 if no entry hit it
+	size_t map_size;              //The size of the coverage map, or 0 until an entry's coverage is known
+	int top_rated_changed;        //Whether the favored set has to be culled again
+	size_t favored_count;
+	size_t pending_favored;       //The favored entries that haven't had a turn yet
+	uint64_t total_cost;          //The total cost of the entries whose cost is known, for the energy
+	size_t costed_count;          //The number of entries whose cost is known
+	int prefer_costly;            //Whether the most costly entries are top rated and get the most iterations,
+	                              //rather than the cheapest, as in slow input mode (-f)
+};
+typedef struct corpus corpus_t;
+
+//The layout of a corpus serialized with corpus_serialize.  The header is followed by each entry's
+//corpus_serialized_entry_t, input, and mutator state (with its terminating NUL, if it has one), with
+//each entry padded to CORPUS_SERIALIZED_ALIGNMENT.  All fields are in the host's byte order.
+#define CORPUS_SERIALIZED_ALIGNMENT 8
+
+struct corpus_serialized_header
+{
+	uint64_t entries_count;
+	uint64_t current;
+	int32_t current_iterations;
+	int32_t current_energy;
+};
+typedef struct corpus_serialized_header corpus_serialized_header_t;
+
+struct corpus_serialized_entry
+{
+	uint64_t length;
+	uint64_t path_hash;
+	uint64_t mutator_state_length; //Including the terminating NUL, or 0 if the entry has no mutator state
+	int32_t exhausted;
+	int32_t times_chosen;
+	int32_t has_path_hash;
+	int32_t reserved;
+};
+typedef struct corpus_serialized_entry corpus_serialized_entry_t;
+
+corpus_t * corpus_create(mutator_t * mutator, void * mutator_state, char * seed, size_t seed_length, int entry_iterations);
+void corpus_destroy(corpus_t * corpus);
+int corpus_add(corpus_t * corpus, char * input, size_t length, uint64_t * path_hash, uint64_t cost,
+	const uint8_t * trace_bits, size_t trace_size);
+void corpus_record_path(corpus_t * corpus, uint64_t path_hash);
+int corpus_add_seed(corpus_t * corpus, const char * input, size_t length);
+char * corpus_copy_entry(corpus_t * corpus, size_t index, size_t * length, int * times_chosen);
+int corpus_mutate(corpus_t * corpus, char * buffer, size_t buffer_length, uint64_t flags, lineage_t * lineage);
+int corpus_mutate_growable(corpus_t * corpus, growable_buffer_t * buffer, uint64_t flags, lineage_t * lineage);
+int corpus_save(corpus_t * corpus, char * filename);
+int corpus_load(corpus_t * corpus, char * filename);
+char * corpus_serialize(corpus_t * corpus, size_t * length);
+int corpus_deserialize(corpus_t * corpus, const char * buffer, size_t length);
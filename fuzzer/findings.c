@@ -0,0 +1,424 @@
+#include "findings.h"
+#include "lineage.h"
+#include "xxhash.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>   // mkdir
+#include <errno.h>
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * findings_type_names[FINDINGS_NUM_TYPES] = FINDINGS_TYPE_NAMES;
+
+//The initial number of slots in the seen set and the crash buckets
+#define FINDINGS_SEEN_INITIAL_SIZE    1024
+#define FINDINGS_BUCKETS_INITIAL_SIZE 64
+
+/**
+ * This function looks up the index of a finding type.
+ * @param type - the name of the finding type, i.e. its subdirectory of the output directory
+ * @return - the index of the type in FINDINGS_TYPE_NAMES, or -1 if it isn't a known type
+ */
+static int findings_type_index(const char * type)
+{
+	int i;
+	for (i = 0; i < FINDINGS_NUM_TYPES; i++) {
+		if (!strcmp(findings_type_names[i], type))
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * This function finds the slot in the seen set for a finding.
+ * @param seen - the seen set to search
+ * @param seen_size - the number of slots in the seen parameter
+ * @param type - the index of the finding's type
+ * @param hash - the finding's hash
+ * @return - the slot that holds the finding, or the empty slot where it should be added
+ */
+static findings_entry_t * findings_seen_slot(findings_entry_t * seen, size_t seen_size, int type, uint64_t hash)
+{
+	size_t i = (size_t)(hash ^ type) & (seen_size - 1);
+	while (seen[i].type != -1 && (seen[i].hash != hash || seen[i].type != type))
+		i = (i + 1) & (seen_size - 1);
+	return &seen[i];
+}
+
+/**
+ * This function records a finding in the seen set, growing it as needed.
+ * @param store - the findings store to record the finding in
+ * @param type - the index of the finding's type
+ * @param hash - the finding's hash
+ * @return - 1 if the finding was added, 0 if it was already in the set, or -1 on failure
+ */
+static int findings_seen_add(findings_store_t * store, int type, uint64_t hash)
+{
+	findings_entry_t * slot, * seen;
+	size_t i, seen_size;
+
+	slot = findings_seen_slot(store->seen, store->seen_size, type, hash);
+	if (slot->type != -1)
+		return 0;
+
+	//Keep the set at most half full, so the probe sequences stay short
+	if ((store->seen_count + 1) * 2 > store->seen_size) {
+		seen_size = store->seen_size * 2;
+		seen = (findings_entry_t *)malloc(seen_size * sizeof(findings_entry_t));
+		if (!seen)
+			return -1;
+		for (i = 0; i < seen_size; i++)
+			seen[i].type = -1;
+		for (i = 0; i < store->seen_size; i++) {
+			if (store->seen[i].type != -1)
+				*findings_seen_slot(seen, seen_size, store->seen[i].type, store->seen[i].hash) = store->seen[i];
+		}
+		free(store->seen);
+		store->seen = seen;
+		store->seen_size = seen_size;
+		slot = findings_seen_slot(store->seen, store->seen_size, type, hash);
+	}
+
+	slot->type = type;
+	slot->hash = hash;
+	store->seen_count++;
+	return 1;
+}
+
+/**
+ * This function finds the slot in the crash buckets for a crash hash.
+ * @param buckets - the crash buckets to search
+ * @param buckets_size - the number of slots in the buckets parameter
+ * @param hash - the crash hash
+ * @return - the slot that holds the bucket, or the empty slot where it should be added
+ */
+static findings_bucket_t * findings_bucket_slot(findings_bucket_t * buckets, size_t buckets_size, uint64_t hash)
+{
+	size_t i = (size_t)hash & (buckets_size - 1);
+	while (buckets[i].count && buckets[i].hash != hash)
+		i = (i + 1) & (buckets_size - 1);
+	return &buckets[i];
+}
+
+/**
+ * This function adds crashes to a crash bucket, growing the crash buckets as needed.
+ * @param store - the findings store to add the crashes to
+ * @param hash - the crash hash of the bucket
+ * @param count - the number of crashes to add to the bucket
+ * @return - the number of crashes in the bucket, including the new ones, or 0 on failure
+ */
+static uint64_t findings_bucket_add(findings_store_t * store, uint64_t hash, uint64_t count)
+{
+	findings_bucket_t * slot, * buckets;
+	size_t i, buckets_size;
+
+	slot = findings_bucket_slot(store->buckets, store->buckets_size, hash);
+	if (!slot->count) {
+		//Keep the table at most half full, so the probe sequences stay short
+		if ((store->buckets_count + 1) * 2 > store->buckets_size) {
+			buckets_size = store->buckets_size * 2;
+			buckets = (findings_bucket_t *)calloc(buckets_size, sizeof(findings_bucket_t));
+			if (!buckets)
+				return 0;
+			for (i = 0; i < store->buckets_size; i++) {
+				if (store->buckets[i].count)
+					*findings_bucket_slot(buckets, buckets_size, store->buckets[i].hash) = store->buckets[i];
+			}
+			free(store->buckets);
+			store->buckets = buckets;
+			store->buckets_size = buckets_size;
+			slot = findings_bucket_slot(store->buckets, store->buckets_size, hash);
+		}
+		slot->hash = hash;
+		store->buckets_count++;
+	}
+	slot->count += count;
+	return slot->count;
+}
+
+/**
+ * This function creates a directory, if it doesn't already exist.
+ * @param path - the directory to create
+ * @return - zero on success, non-zero on failure
+ */
+static int findings_create_directory(const char * path)
+{
+#ifdef _WIN32
+	return !CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(path, 0775) == -1 && errno != EEXIST;
+#endif
+}
+
+/**
+ * This function loads the findings listed in a store's index file into its seen set, so that
+ * findings from a previous run in the same output directory aren't written again.
+ * @param store - the findings store to load the index for
+ * @param path - the path of the index file
+ */
+static void findings_load_index(findings_store_t * store, const char * path)
+{
+	char line[256], type_name[64];
+	unsigned long long hash;
+	unsigned long length;
+	FILE * fp;
+	int type;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %llx %lu", type_name, &hash, &length) != 3)
+			continue;
+		type = findings_type_index(type_name);
+		if (type >= 0)
+			findings_seen_add(store, type, hash);
+	}
+	fclose(fp);
+}
+
+/**
+ * This function loads the crash buckets file from a previous run in the same output directory,
+ * so that the buckets that were already full stay full.
+ * @param store - the findings store to load the crash buckets for
+ * @param path - the path of the crash buckets file
+ */
+static void findings_load_buckets(findings_store_t * store, const char * path)
+{
+	unsigned long long hash, count;
+	char line[256];
+	FILE * fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%llx %llu", &hash, &count) == 2 && count)
+			findings_bucket_add(store, hash, count);
+	}
+	fclose(fp);
+}
+
+/**
+ * This function writes the crash buckets file, which records how many crashes fell in each bucket,
+ * including the ones that weren't saved because their bucket was full.
+ * @param store - the findings store to write the crash buckets file for
+ * @return - zero on success, non-zero on failure
+ */
+static int findings_write_buckets(findings_store_t * store)
+{
+	char path[MAX_PATH];
+	size_t i;
+	FILE * fp;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", store->directory, FINDINGS_BUCKETS_FILENAME);
+	fp = fopen(path, "w");
+	if (!fp)
+		return 1;
+	for (i = 0; i < store->buckets_size; i++) {
+		if (store->buckets[i].count)
+			fprintf(fp, "%016" PRIX64 " %" PRIu64 "\n", store->buckets[i].hash, store->buckets[i].count);
+	}
+	ret = ferror(fp);
+	return fclose(fp) || ret;
+}
+
+/**
+ * This function creates a findings store, which saves the inputs that the fuzzer finds in the
+ * output directory.  Each input is named by its hash and placed in a fan out subdirectory
+ * named by the first characters of the hash, e.g. crashes/1A/1A2B3C4D5E6F7A8B, so that no
+ * directory grows too large to list or search quickly.
+ * @param directory - the output directory to save the findings in.  The subdirectories
+ * for each finding type should already exist.
+ * @param bucket_limit - the number of crashes to save from each crash bucket (see
+ * findings_store_bucket_crash), or 0 to save every crash
+ * @return - the new findings store on success, or NULL on failure
+ */
+findings_store_t * findings_store_create(char * directory, int bucket_limit)
+{
+	findings_store_t * store;
+	char path[MAX_PATH];
+	size_t i;
+
+	store = (findings_store_t *)calloc(1, sizeof(findings_store_t));
+	if (!store)
+		return NULL;
+
+	store->directory = strdup(directory);
+	store->mutex = create_mutex();
+	store->seen_size = FINDINGS_SEEN_INITIAL_SIZE;
+	store->seen = (findings_entry_t *)malloc(store->seen_size * sizeof(findings_entry_t));
+	store->bucket_limit = bucket_limit;
+	store->buckets_size = FINDINGS_BUCKETS_INITIAL_SIZE;
+	store->buckets = (findings_bucket_t *)calloc(store->buckets_size, sizeof(findings_bucket_t));
+	if (!store->directory || !store->mutex || !store->seen || !store->buckets) {
+		findings_store_destroy(store);
+		return NULL;
+	}
+	for (i = 0; i < store->seen_size; i++)
+		store->seen[i].type = -1;
+
+	if (bucket_limit) {
+		snprintf(path, sizeof(path), "%s/%s", directory, FINDINGS_BUCKETS_FILENAME);
+		findings_load_buckets(store, path);
+	}
+	snprintf(path, sizeof(path), "%s/%s", directory, FINDINGS_INDEX_FILENAME);
+	findings_load_index(store, path);
+	store->index = fopen(path, "a");
+	if (!store->index) {
+		ERROR_MSG("Failed to open the findings index %s", path);
+		findings_store_destroy(store);
+		return NULL;
+	}
+	return store;
+}
+
+/**
+ * This function frees a findings store.
+ * @param store - the findings store to free
+ */
+void findings_store_destroy(findings_store_t * store)
+{
+	if (!store)
+		return;
+	if (store->index)
+		fclose(store->index);
+	if (store->bucket_limit && store->buckets_count && findings_write_buckets(store))
+		ERROR_MSG("Failed to write the crash buckets file in %s", store->directory);
+	destroy_mutex(store->mutex);
+	free(store->buckets);
+	free(store->seen);
+	free(store->directory);
+	free(store);
+}
+
+/**
+ * This function writes a finding to the store, unless an input with the same hash has already been
+ * saved with the same type.
+ * @param store - the findings store to save the finding in
+ * @param type - the finding's type, i.e. one of "crashes", "hangs", or "new_paths"
+ * @param hash - the hash of the input, which is used as its filename
+ * @param length - the length of the input
+ * @param data - the contents to write to the finding's file
+ * @param data_length - the length of the data parameter
+ * @param extension - the extension to give the finding's file, or "" for none
+ * @return - 1 if the finding was saved, 0 if it was already in the store, or -1 on failure
+ */
+static int findings_store_write(findings_store_t * store, char * type, uint64_t hash, size_t length,
+	const char * data, size_t data_length, const char * extension)
+{
+	char path[MAX_PATH];
+	int type_index, fanout, ret;
+
+	type_index = findings_type_index(type);
+	if (type_index < 0)
+		return -1;
+	fanout = (int)(hash >> (64 - 4 * FINDINGS_FANOUT_CHARS));
+
+	take_mutex(store->mutex);
+	ret = findings_seen_add(store, type_index, hash);
+	if (ret == 1) {
+		snprintf(path, sizeof(path), "%s/%s/%0*X", store->directory, type, FINDINGS_FANOUT_CHARS, fanout);
+		if (!(store->created[type_index][fanout / 8] & (1 << (fanout % 8)))) {
+			if (findings_create_directory(path))
+				ERROR_MSG("Unable to create directory %s", path);
+			store->created[type_index][fanout / 8] |= 1 << (fanout % 8);
+		}
+
+		snprintf(path, sizeof(path), "%s/%s/%0*X/%016" PRIX64 "%s", store->directory, type,
+			FINDINGS_FANOUT_CHARS, fanout, hash, extension);
+		if (write_buffer_to_file(path, (char *)data, data_length)) {
+			ERROR_MSG("Unable to write the finding %s", path);
+			ret = -1;
+		} else {
+			fprintf(store->index, "%s %016" PRIX64 " %lu\n", type, hash, (unsigned long)length);
+			fflush(store->index);
+		}
+	}
+	release_mutex(store->mutex);
+	return ret;
+}
+
+/**
+ * This function saves a finding to the store, unless the same input has already been saved with
+ * the same type.  The in memory seen set is checked instead of the filesystem, so duplicates cost
+ * only a hash.  It's safe to call from multiple threads at once.
+ * @param store - the findings store to save the finding in
+ * @param type - the finding's type, i.e. one of "crashes", "hangs", or "new_paths"
+ * @param buffer - the input to save
+ * @param length - the length of the buffer parameter
+ * @return - 1 if the finding was saved, 0 if it was already in the store, or -1 on failure
+ */
+int findings_store_add(findings_store_t * store, char * type, const char * buffer, size_t length)
+{
+	return findings_store_write(store, type, XXH64(buffer, length, 0), length, buffer, length, "");
+}
+
+/**
+ * This function saves the lineage record of a finding in place of the finding itself, unless the same
+ * input has already been saved with the same type.  The record is named by the input's hash, with
+ * LINEAGE_EXTENSION added, and the index lists the input as if it had been saved in full.  It's safe to
+ * call from multiple threads at once.
+ * @param store - the findings store to save the finding in
+ * @param type - the finding's type, i.e. one of "crashes", "hangs", or "new_paths"
+ * @param buffer - the input that the lineage record regenerates
+ * @param length - the length of the buffer parameter
+ * @param lineage - the lineage record to save, from lineage_encode
+ * @return - 1 if the finding was saved, 0 if it was already in the store, or -1 on failure
+ */
+int findings_store_add_lineage(findings_store_t * store, char * type, const char * buffer, size_t length,
+	const char * lineage)
+{
+	return findings_store_write(store, type, XXH64(buffer, length, 0), length, lineage, strlen(lineage),
+		LINEAGE_EXTENSION);
+}
+
+/**
+ * This function adds a crash to its crash bucket, and decides whether the crash should be saved.
+ * One bug usually crashes with the same hash over and over, so only the first bucket_limit crashes
+ * of each bucket are saved, and the rest are only counted.  It's safe to call from multiple threads
+ * at once.
+ * @param store - the findings store to add the crash to
+ * @param hash - the crash hash, from the instrumentation's get_crash_hash
+ * @return - 1 if the crash should be saved, or 0 if its bucket is full
+ */
+int findings_store_bucket_crash(findings_store_t * store, uint64_t hash)
+{
+	uint64_t count;
+
+	if (!store->bucket_limit)
+		return 1;
+	take_mutex(store->mutex);
+	count = findings_bucket_add(store, hash, 1);
+	release_mutex(store->mutex);
+	//If the bucket couldn't be added, saving the crash is better than losing it
+	return !count || count <= store->bucket_limit;
+}
+
+/**
+ * This function checks whether the store has already saved an input, without needing the input itself.
+ * It's safe to call from multiple threads at once.
+ * @param store - the findings store to check
+ * @param type - the finding's type, i.e. one of "crashes", "hangs", or "new_paths"
+ * @param hash - the input's hash, which is also its filename
+ * @return - 1 if the input has been saved with that type, 0 otherwise
+ */
+int findings_store_contains(findings_store_t * store, char * type, uint64_t hash)
+{
+	int type_index, ret;
+
+	type_index = findings_type_index(type);
+	if (type_index < 0)
+		return 0;
+	take_mutex(store->mutex);
+	ret = findings_seen_slot(store->seen, store->seen_size, type_index, hash)->type != -1;
+	release_mutex(store->mutex);
+	return ret;
+}
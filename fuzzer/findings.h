@@ -0,0 +1,67 @@
+#pragma once
+#include <utils.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//The types of findings the fuzzer saves, each in its own subdirectory of the output directory
+#define FINDINGS_TYPE_NAMES { "crashes", "hangs", "new_paths", "slow" }
+#define FINDINGS_NUM_TYPES   4
+
+//The name of the index file in the output directory.  Each finding that is written to the store
+//appends a line with its type, hash, and length, e.g. "crashes 1A2B3C4D5E6F7A8B 4"
+#define FINDINGS_INDEX_FILENAME "index"
+
+//The name of the crash buckets file in the output directory, which is written when the store is
+//destroyed.  Each bucket has a line with its crash hash and how many crashes fell into it,
+//e.g. "1A2B3C4D5E6F7A8B 1234"
+#define FINDINGS_BUCKETS_FILENAME "crash_buckets"
+
+//The number of hex characters of the hash used to name the fan out subdirectories
+#define FINDINGS_FANOUT_CHARS 2
+#define FINDINGS_FANOUT_DIRS  (1 << (4 * FINDINGS_FANOUT_CHARS))
+
+//A finding that has been saved to the store, as kept in the seen set
+struct findings_entry
+{
+	uint64_t hash;
+	int type;      //The index of the finding's type in FINDINGS_TYPE_NAMES, or -1 for an empty slot
+};
+typedef struct findings_entry findings_entry_t;
+
+//A crash bucket, which counts the crashes with the same crash hash (see the instrumentation's get_crash_hash)
+struct findings_bucket
+{
+	uint64_t hash;
+	uint64_t count; //The number of crashes in the bucket, or 0 for an empty slot
+};
+typedef struct findings_bucket findings_bucket_t;
+
+struct findings_store
+{
+	char * directory;
+	FILE * index;
+	mutex_t mutex;
+
+	//An open addressing hash set of the findings that have already been saved
+	findings_entry_t * seen;
+	size_t seen_size;    //The number of slots in seen, always a power of two
+	size_t seen_count;   //The number of used slots in seen
+
+	//Which of the fan out subdirectories of each type have already been created
+	uint8_t created[FINDINGS_NUM_TYPES][FINDINGS_FANOUT_DIRS / 8];
+
+	//An open addressing hash table of the crash buckets, and how many crashes of each bucket are saved
+	findings_bucket_t * buckets;
+	size_t buckets_size;  //The number of slots in buckets, always a power of two
+	size_t buckets_count; //The number of used slots in buckets
+	uint64_t bucket_limit;
+};
+typedef struct findings_store findings_store_t;
+
+findings_store_t * findings_store_create(char * directory, int bucket_limit);
+void findings_store_destroy(findings_store_t * store);
+int findings_store_add(findings_store_t * store, char * type, const char * buffer, size_t length);
+int findings_store_add_lineage(findings_store_t * store, char * type, const char * buffer, size_t length,
+	const char * lineage);
+int findings_store_bucket_crash(findings_store_t * store, uint64_t hash);
+int findings_store_contains(findings_store_t * store, char * type, uint64_t hash);
@@ -0,0 +1,580 @@
+#include "instance_sync.h"
+#include "xxhash.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The initial number of slots in the known set
+#define INSTANCE_SYNC_KNOWN_INITIAL_SIZE 1024
+
+//The name of the directory that the other fuzzers' inputs are imported from
+#define INSTANCE_SYNC_IMPORT_DIRECTORY "new_paths"
+
+//The deepest directory that is watched, the new_paths fan out subdirectories
+#define INSTANCE_SYNC_MAX_DEPTH 3
+
+/**
+ * This function finds the slot in the known set for a hash.
+ * @param known - the known set to search
+ * @param known_size - the number of slots in the known parameter
+ * @param hash - the hash to find, which must not be 0
+ * @return - the slot that holds the hash, or the empty slot where it should be added
+ */
+static uint64_t * instance_sync_known_slot(uint64_t * known, size_t known_size, uint64_t hash)
+{
+	size_t i = (size_t)hash & (known_size - 1);
+	while (known[i] && known[i] != hash)
+		i = (i + 1) & (known_size - 1);
+	return &known[i];
+}
+
+/**
+ * This function checks whether an input's hash is already known, either because it was already read
+ * from the sync directory or because this fuzzer saved it itself.
+ * @param sync - the instance sync state
+ * @param hash - the input's hash
+ * @return - non-zero if the hash is known, zero otherwise
+ */
+static int instance_sync_is_known(instance_sync_t * sync, uint64_t hash)
+{
+	if (!hash)
+		return sync->known_zero;
+	if (*instance_sync_known_slot(sync->known, sync->known_size, hash))
+		return 1;
+	return sync->findings && findings_store_contains(sync->findings, INSTANCE_SYNC_IMPORT_DIRECTORY, hash);
+}
+
+/**
+ * This function records an input's hash in the known set, growing it as needed.
+ * @param sync - the instance sync state
+ * @param hash - the input's hash
+ * @return - zero on success, non-zero on failure
+ */
+static int instance_sync_add_known(instance_sync_t * sync, uint64_t hash)
+{
+	uint64_t * slot, * known;
+	size_t i, known_size;
+
+	if (!hash) {
+		sync->known_zero = 1;
+		return 0;
+	}
+	slot = instance_sync_known_slot(sync->known, sync->known_size, hash);
+	if (*slot)
+		return 0;
+
+	//Keep the set at most half full, so the probe sequences stay short
+	if ((sync->known_count + 1) * 2 > sync->known_size) {
+		known_size = sync->known_size * 2;
+		known = (uint64_t *)calloc(known_size, sizeof(uint64_t));
+		if (!known)
+			return 1;
+		for (i = 0; i < sync->known_size; i++) {
+			if (sync->known[i])
+				*instance_sync_known_slot(known, known_size, sync->known[i]) = sync->known[i];
+		}
+		free(sync->known);
+		sync->known = known;
+		sync->known_size = known_size;
+		slot = instance_sync_known_slot(sync->known, sync->known_size, hash);
+	}
+	*slot = hash;
+	sync->known_count++;
+	return 0;
+}
+
+/**
+ * This function parses the hash that the findings store names its files with.
+ * @param path - the path of the file
+ * @param hash - used to return the hash
+ * @return - non-zero if the file is named by a hash, zero otherwise
+ */
+static int instance_sync_filename_hash(const char * path, uint64_t * hash)
+{
+	const char * name = path + strlen(path);
+	char * end;
+
+	while (name > path && name[-1] != '/' && name[-1] != '\\')
+		name--;
+	if (strlen(name) != 16)
+		return 0;
+	*hash = strtoull(name, &end, 16);
+	return *end == 0;
+}
+
+/**
+ * This function adds a file to the files to be read on the next import, unless its name says that
+ * it's an input that is already known.
+ * @param sync - the instance sync state
+ * @param path - the path of the file
+ */
+static void instance_sync_queue(instance_sync_t * sync, const char * path)
+{
+	char ** pending;
+	uint64_t hash;
+
+	if (instance_sync_filename_hash(path, &hash) && instance_sync_is_known(sync, hash))
+		return;
+	if (sync->pending_count == sync->pending_size) {
+		pending = (char **)realloc(sync->pending, (sync->pending_size ? sync->pending_size * 2 : 256) * sizeof(char *));
+		if (!pending)
+			return;
+		sync->pending = pending;
+		sync->pending_size = sync->pending_size ? sync->pending_size * 2 : 256;
+	}
+	sync->pending[sync->pending_count] = strdup(path);
+	if (sync->pending[sync->pending_count])
+		sync->pending_count++;
+}
+
+/**
+ * This function gets the full path of a file, so that paths which name the same directory can be compared.
+ * @param path - the path to get the full path of
+ * @return - the full path, or NULL on failure.  The caller should free it.
+ */
+static char * instance_sync_full_path(const char * path)
+{
+#ifdef _WIN32
+	return _fullpath(NULL, path, MAX_PATH);
+#else
+	return realpath(path, NULL);
+#endif
+}
+
+/**
+ * This function checks whether a directory is this fuzzer's own output directory.
+ * @param sync - the instance sync state
+ * @param path - the directory to check
+ * @return - non-zero if the directory is the fuzzer's own output directory, zero otherwise
+ */
+static int instance_sync_is_own_directory(instance_sync_t * sync, const char * path)
+{
+	char * full_path = instance_sync_full_path(path);
+	int ret;
+
+#ifdef _WIN32
+	ret = !full_path || !_stricmp(full_path, sync->own_directory);
+#else
+	ret = !full_path || !strcmp(full_path, sync->own_directory);
+#endif
+	free(full_path);
+	return ret;
+}
+
+#if !defined(_WIN32) && defined(__linux__)
+/**
+ * This function adds an inotify watch for a directory of the sync directory.
+ * @param sync - the instance sync state
+ * @param path - the directory to watch
+ * @param depth - the depth of the directory in the sync directory (see instance_sync_watch_t)
+ * @return - zero on success, non-zero on failure
+ */
+static int instance_sync_watch(instance_sync_t * sync, const char * path, int depth)
+{
+	instance_sync_watch_t * watches;
+	uint32_t mask;
+	size_t i;
+	int wd;
+
+	//The output directories are only watched for their new_paths directory, and the new_paths
+	//directories for their fan out subdirectories and inputs
+	mask = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+	if (depth >= 2)
+		mask |= IN_CLOSE_WRITE;
+	wd = inotify_add_watch(sync->inotify_fd, path, mask);
+	if (wd < 0) {
+		WARNING_MSG("Couldn't watch the sync directory %s (errno %d), its new inputs won't be imported", path, errno);
+		return 1;
+	}
+
+	for (i = 0; i < sync->watches_count; i++) {
+		if (sync->watches[i].wd == wd)
+			return 0; //The directory is already being watched
+	}
+	if (sync->watches_count == sync->watches_size) {
+		watches = (instance_sync_watch_t *)realloc(sync->watches,
+			(sync->watches_size ? sync->watches_size * 2 : 64) * sizeof(instance_sync_watch_t));
+		if (!watches)
+			return 1;
+		sync->watches = watches;
+		sync->watches_size = sync->watches_size ? sync->watches_size * 2 : 64;
+	}
+	sync->watches[sync->watches_count].path = strdup(path);
+	if (!sync->watches[sync->watches_count].path)
+		return 1;
+	sync->watches[sync->watches_count].wd = wd;
+	sync->watches[sync->watches_count].depth = depth;
+	sync->watches_count++;
+	return 0;
+}
+#endif
+
+/**
+ * This function adds a directory of the sync directory: it's watched (where the directories are watched),
+ * the directories in it that hold inputs to import are added too, and the inputs already in it are queued.
+ * A directory is only watched before it's listed, so that no input written in between is missed.
+ * @param sync - the instance sync state
+ * @param path - the directory to add
+ * @param depth - the depth of the directory in the sync directory: 0 for the sync directory, 1 for a
+ * fuzzer's output directory, 2 for its new_paths directory, and 3 for a new_paths fan out subdirectory
+ */
+static void instance_sync_add_directory(instance_sync_t * sync, const char * path, int depth)
+{
+	char filename[MAX_PATH];
+	const char * name;
+	int is_directory;
+#ifdef _WIN32
+	WIN32_FIND_DATA find_data;
+	HANDLE find_handle;
+	int success = 1;
+#else
+	struct dirent * dp;
+	DIR * dfd;
+#endif
+
+	if (depth == 1 && instance_sync_is_own_directory(sync, path))
+		return;
+#if !defined(_WIN32) && defined(__linux__)
+	if (instance_sync_watch(sync, path, depth))
+		return;
+#endif
+
+#ifdef _WIN32
+	snprintf(filename, sizeof(filename), "%s\\*", path);
+	for (find_handle = FindFirstFile(filename, &find_data);
+		find_handle != INVALID_HANDLE_VALUE && success;
+		success = FindNextFile(find_handle, &find_data))
+	{
+		name = find_data.cFileName;
+		is_directory = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	dfd = opendir(path);
+	while (dfd && (dp = readdir(dfd)) != NULL)
+	{
+		name = dp->d_name;
+		is_directory = dp->d_type == DT_DIR;
+#endif
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+		snprintf(filename, sizeof(filename), "%s/%s", path, name);
+		if (is_directory) {
+			if (depth < INSTANCE_SYNC_MAX_DEPTH && (depth != 1 || !strcmp(name, INSTANCE_SYNC_IMPORT_DIRECTORY)))
+				instance_sync_add_directory(sync, filename, depth + 1);
+		} else if (depth >= 2)
+			instance_sync_queue(sync, filename);
+	}
+#ifdef _WIN32
+	if (find_handle != INVALID_HANDLE_VALUE)
+		FindClose(find_handle);
+#else
+	if (dfd)
+		closedir(dfd);
+#endif
+}
+
+#ifdef _WIN32
+/**
+ * This function starts watching the sync directory tree for the next batch of changes.
+ * @param sync - the instance sync state
+ * @return - zero on success, non-zero on failure
+ */
+static int instance_sync_read_changes(instance_sync_t * sync)
+{
+	ResetEvent(sync->overlapped.hEvent);
+	if (!ReadDirectoryChangesW(sync->directory_handle, sync->notify_buffer, INSTANCE_SYNC_NOTIFY_BUFFER_SIZE,
+		TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+		NULL, &sync->overlapped, NULL)) {
+		WARNING_MSG("Couldn't watch the sync directory %s (error %lu)", sync->directory, GetLastError());
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function handles a change to a file in the sync directory tree.
+ * @param sync - the instance sync state
+ * @param relative_path - the path of the changed file, relative to the sync directory
+ * @param action - the FILE_ACTION_* change that was made to the file
+ */
+static void instance_sync_handle_change(instance_sync_t * sync, char * relative_path, DWORD action)
+{
+	size_t import_length = strlen(INSTANCE_SYNC_IMPORT_DIRECTORY);
+	char path[MAX_PATH], * separator;
+	DWORD attributes;
+	int depth = 1; //The depth of the changed file in the sync directory, as in instance_sync_add_directory
+
+	separator = strchr(relative_path, '\\');
+	if (separator) {
+		//Only the new_paths directories of the other fuzzers' output directories are imported
+		if (_strnicmp(separator + 1, INSTANCE_SYNC_IMPORT_DIRECTORY, import_length)
+			|| (separator[import_length + 1] && separator[import_length + 1] != '\\'))
+			return;
+		*separator = 0;
+		snprintf(path, sizeof(path), "%s\\%s", sync->directory, relative_path);
+		*separator = '\\';
+		if (instance_sync_is_own_directory(sync, path))
+			return;
+		for (; separator; separator = strchr(separator + 1, '\\'))
+			depth++;
+	}
+
+	snprintf(path, sizeof(path), "%s\\%s", sync->directory, relative_path);
+	attributes = GetFileAttributes(path);
+	if (attributes == INVALID_FILE_ATTRIBUTES)
+		return;
+	if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+		//A directory that was created or moved in may already have inputs in it
+		if (action != FILE_ACTION_MODIFIED && depth <= INSTANCE_SYNC_MAX_DEPTH)
+			instance_sync_add_directory(sync, path, depth);
+	} else if (depth > 2 && depth <= INSTANCE_SYNC_MAX_DEPTH + 1)
+		instance_sync_queue(sync, path);
+}
+
+/**
+ * This function finds the files that changed in the sync directory tree since it was last checked.
+ * @param sync - the instance sync state
+ */
+static void instance_sync_poll(instance_sync_t * sync)
+{
+	FILE_NOTIFY_INFORMATION * info;
+	char relative_path[MAX_PATH];
+	DWORD length, offset = 0;
+	int path_length;
+
+	if (sync->directory_handle == INVALID_HANDLE_VALUE)
+		return;
+	if (!GetOverlappedResult(sync->directory_handle, &sync->overlapped, &length, FALSE)) {
+		if (GetLastError() != ERROR_IO_INCOMPLETE) {
+			WARNING_MSG("Failed to read the changes to the sync directory %s (error %lu)", sync->directory, GetLastError());
+			CloseHandle(sync->directory_handle);
+			sync->directory_handle = INVALID_HANDLE_VALUE;
+		}
+		return;
+	}
+
+	if (!length) {
+		//Too much changed to fit in the buffer, so the whole tree has to be rescanned
+		instance_sync_add_directory(sync, sync->directory, 0);
+	} else {
+		do {
+			info = (FILE_NOTIFY_INFORMATION *)((char *)sync->notify_buffer + offset);
+			if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED
+				|| info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+				path_length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+					relative_path, sizeof(relative_path) - 1, NULL, NULL);
+				if (path_length > 0) {
+					relative_path[path_length] = 0;
+					instance_sync_handle_change(sync, relative_path, info->Action);
+				}
+			}
+			offset += info->NextEntryOffset;
+		} while (info->NextEntryOffset);
+	}
+
+	if (instance_sync_read_changes(sync)) {
+		CloseHandle(sync->directory_handle);
+		sync->directory_handle = INVALID_HANDLE_VALUE;
+	}
+}
+#elif defined(__linux__)
+/**
+ * This function finds the files that were written to the watched directories since they were last checked.
+ * @param sync - the instance sync state
+ */
+static void instance_sync_poll(instance_sync_t * sync)
+{
+	char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)], path[MAX_PATH];
+	struct inotify_event * event;
+	ssize_t length, offset;
+	size_t i;
+
+	if (sync->inotify_fd < 0)
+		return;
+	while ((length = read(sync->inotify_fd, buffer, sizeof(buffer))) > 0) {
+		for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)(buffer + offset);
+			if (event->mask & IN_Q_OVERFLOW) {
+				//Events were lost, so the whole tree has to be rescanned
+				instance_sync_add_directory(sync, sync->directory, 0);
+				continue;
+			}
+			if (!event->len)
+				continue;
+			for (i = 0; i < sync->watches_count && sync->watches[i].wd != event->wd; i++);
+			if (i == sync->watches_count)
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s", sync->watches[i].path, event->name);
+			if (event->mask & IN_ISDIR) {
+				if (sync->watches[i].depth < INSTANCE_SYNC_MAX_DEPTH
+					&& (sync->watches[i].depth != 1 || !strcmp(event->name, INSTANCE_SYNC_IMPORT_DIRECTORY)))
+					instance_sync_add_directory(sync, path, sync->watches[i].depth + 1);
+			} else if (sync->watches[i].depth >= 2 && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+				instance_sync_queue(sync, path);
+		}
+	}
+}
+#else
+/**
+ * This function finds the new files in the sync directory tree.  This platform has no directory watch
+ * to use, so the tree is rescanned, though the files named by known hashes aren't read again.
+ * @param sync - the instance sync state
+ */
+static void instance_sync_poll(instance_sync_t * sync)
+{
+	instance_sync_add_directory(sync, sync->directory, 0);
+}
+#endif
+
+/**
+ * This function starts syncing with the other fuzzers that use the same sync directory.  The inputs
+ * that are already in their new_paths directories are imported first.
+ * @param directory - the sync directory, which holds the output directories of the fuzzers to sync with
+ * @param output_directory - this fuzzer's output directory, whose inputs are never imported.  It's
+ * usually one of the subdirectories of the sync directory, so the others can import from it.
+ * @param findings - the fuzzer's findings store, whose inputs are already known, or NULL
+ * @return - the new instance sync state on success, or NULL on failure
+ */
+instance_sync_t * instance_sync_create(char * directory, char * output_directory, findings_store_t * findings)
+{
+	instance_sync_t * sync;
+
+	sync = (instance_sync_t *)calloc(1, sizeof(instance_sync_t));
+	if (!sync)
+		return NULL;
+#ifdef _WIN32
+	sync->directory_handle = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+	sync->inotify_fd = -1;
+#endif
+
+	sync->directory = strdup(directory);
+	sync->own_directory = instance_sync_full_path(output_directory);
+	sync->findings = findings;
+	sync->known_size = INSTANCE_SYNC_KNOWN_INITIAL_SIZE;
+	sync->known = (uint64_t *)calloc(sync->known_size, sizeof(uint64_t));
+	if (!sync->directory || !sync->own_directory || !sync->known) {
+		instance_sync_destroy(sync);
+		return NULL;
+	}
+	if (!is_directory(directory)) {
+		ERROR_MSG("The sync directory %s does not exist", directory);
+		instance_sync_destroy(sync);
+		return NULL;
+	}
+
+#ifdef _WIN32
+	sync->notify_buffer = (DWORD *)malloc(INSTANCE_SYNC_NOTIFY_BUFFER_SIZE);
+	sync->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!sync->notify_buffer || !sync->overlapped.hEvent) {
+		instance_sync_destroy(sync);
+		return NULL;
+	}
+	sync->directory_handle = CreateFile(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (sync->directory_handle == INVALID_HANDLE_VALUE || instance_sync_read_changes(sync)) {
+		ERROR_MSG("Couldn't watch the sync directory %s", directory);
+		instance_sync_destroy(sync);
+		return NULL;
+	}
+#elif defined(__linux__)
+	sync->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (sync->inotify_fd < 0) {
+		ERROR_MSG("Couldn't create an inotify instance to watch the sync directory %s", directory);
+		instance_sync_destroy(sync);
+		return NULL;
+	}
+#endif
+
+	instance_sync_add_directory(sync, sync->directory, 0);
+	return sync;
+}
+
+/**
+ * This function stops syncing with the other fuzzers, and frees the instance sync state.
+ * @param sync - the instance sync state to free
+ */
+void instance_sync_destroy(instance_sync_t * sync)
+{
+	size_t i;
+
+	if (!sync)
+		return;
+#ifdef _WIN32
+	if (sync->directory_handle != INVALID_HANDLE_VALUE) {
+		CancelIo(sync->directory_handle);
+		CloseHandle(sync->directory_handle);
+	}
+	if (sync->overlapped.hEvent)
+		CloseHandle(sync->overlapped.hEvent);
+	free(sync->notify_buffer);
+#elif defined(__linux__)
+	if (sync->inotify_fd >= 0)
+		close(sync->inotify_fd);
+	for (i = 0; i < sync->watches_count; i++)
+		free(sync->watches[i].path);
+	free(sync->watches);
+#endif
+	for (i = 0; i < sync->pending_count; i++)
+		free(sync->pending[i]);
+	free(sync->pending);
+	free(sync->known);
+	free(sync->own_directory);
+	free(sync->directory);
+	free(sync);
+}
+
+/**
+ * This function gets the next input that one of the other fuzzers found, which this fuzzer hasn't
+ * seen yet.  Each input is only returned once.  It should only be called from one thread at a time.
+ * @param sync - the instance sync state
+ * @param length - used to return the length of the input
+ * @return - the input, or NULL if there are no new inputs right now.  The caller should free it.
+ */
+char * instance_sync_next(instance_sync_t * sync, size_t * length)
+{
+	uint64_t hash, name_hash;
+	char * path, * input;
+	int input_length;
+
+	if (!sync->pending_count)
+		instance_sync_poll(sync);
+
+	while (sync->pending_count) {
+		path = sync->pending[--sync->pending_count];
+		input = NULL;
+		input_length = read_file(path, &input);
+		if (input_length <= 0) {
+			free(input);
+			free(path);
+			continue;
+		}
+
+		//An input that's named by a hash it doesn't have is still being written, and will show up again
+		hash = XXH64(input, input_length, 0);
+		if ((instance_sync_filename_hash(path, &name_hash) && name_hash != hash) || instance_sync_is_known(sync, hash)) {
+			free(input);
+			free(path);
+			continue;
+		}
+		free(path);
+		instance_sync_add_known(sync, hash);
+		*length = input_length;
+		return input;
+	}
+	return NULL;
+}
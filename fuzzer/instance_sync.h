@@ -0,0 +1,63 @@
+#pragma once
+#include "findings.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+//Instance sync lets independent fuzzer processes on the same host share the inputs that found new paths,
+//like AFL's sync mode.  Each fuzzer's output directory is a subdirectory of a shared sync directory, and
+//each fuzzer imports the new_paths of the others.  The new inputs are found by watching the directories
+//(with inotify on Linux and ReadDirectoryChangesW on Windows) rather than by rescanning them, and the
+//inputs whose hash is already known aren't read or run again.  Other platforms rescan the directories.
+
+//The size of the buffer that ReadDirectoryChangesW writes the changes to
+#define INSTANCE_SYNC_NOTIFY_BUFFER_SIZE (64 * 1024)
+
+#if !defined(_WIN32) && defined(__linux__)
+//A watched directory of the sync directory
+struct instance_sync_watch
+{
+	int wd;      //The inotify watch descriptor, or -1 if the slot is free
+	int depth;   //0 for the sync directory, 1 for a fuzzer's output directory, 2 for its new_paths
+	             //directory, and 3 for one of the new_paths fan out subdirectories
+	char * path;
+};
+typedef struct instance_sync_watch instance_sync_watch_t;
+#endif
+
+struct instance_sync
+{
+	char * directory;       //The sync directory
+	char * own_directory;   //The full path of this fuzzer's output directory, which isn't imported
+	findings_store_t * findings;
+
+	//An open addressing hash set of the hashes of the inputs that have already been read or saved
+	uint64_t * known;
+	size_t known_size;      //The number of slots in known, always a power of two
+	size_t known_count;     //The number of used slots in known
+	int known_zero;         //Whether the hash 0, which marks the empty slots, is known
+
+	//The files that have shown up since the last import, and haven't been read yet
+	char ** pending;
+	size_t pending_count;
+	size_t pending_size;
+
+#ifdef _WIN32
+	HANDLE directory_handle;
+	OVERLAPPED overlapped;
+	DWORD * notify_buffer;
+#elif defined(__linux__)
+	int inotify_fd;
+	instance_sync_watch_t * watches;
+	size_t watches_count;
+	size_t watches_size;
+#endif
+};
+typedef struct instance_sync instance_sync_t;
+
+instance_sync_t * instance_sync_create(char * directory, char * output_directory, findings_store_t * findings);
+void instance_sync_destroy(instance_sync_t * sync);
+char * instance_sync_next(instance_sync_t * sync, size_t * length);
@@ -0,0 +1,188 @@
+#include "lineage.h"
+#include "xxhash.h"
+
+#include <jansson.h>
+#include <jansson_helper.h>
+#include <mutator_factory.h>
+#include <utils.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+LINEAGE_THREAD lineage_t * lineage_current = NULL;
+
+/**
+ * This function records how the next input will be mutated.  It must be called right before the mutation,
+ * while nothing else can change the mutator's state.
+ * @param lineage - the lineage to record the mutation in
+ * @param mutator - the mutator that will mutate the input
+ * @param mutator_state - the mutator state that will mutate the input
+ * @param parent - the input that the mutator state will mutate
+ * @param parent_length - the length of parent
+ * @param buffer_length - the size of the buffer the input will be mutated into
+ * @param max_length - the most that the buffer can grow to, or 0 if it isn't a growable buffer
+ * @return - zero on success, or non-zero if the mutator state couldn't be recorded.  On failure, the
+ * lineage is marked invalid, so that the input is saved in full.
+ */
+int lineage_capture(lineage_t * lineage, mutator_t * mutator, void * mutator_state, const char * parent,
+	size_t parent_length, size_t buffer_length, size_t max_length)
+{
+	char * state;
+
+	lineage->valid = 0;
+	free(lineage->mutator_state);
+	lineage->mutator_state = NULL;
+
+	state = mutator->get_state(mutator_state);
+	if (!state)
+		return 1;
+	lineage->mutator_state = strdup(state);
+	mutator->free_state(state);
+	if (!lineage->mutator_state)
+		return 1;
+
+	if (parent != lineage->parent || parent_length != lineage->parent_length) {
+		lineage->parent = parent;
+		lineage->parent_length = parent_length;
+		lineage->parent_hash = XXH64(parent, parent_length, 0);
+	}
+	lineage->buffer_length = buffer_length;
+	lineage->max_length = max_length;
+	lineage->valid = 1;
+	return 0;
+}
+
+/**
+ * This function frees the mutator state that a lineage recorded.
+ * @param lineage - the lineage to free
+ */
+void lineage_free(lineage_t * lineage)
+{
+	free(lineage->mutator_state);
+	memset(lineage, 0, sizeof(lineage_t));
+}
+
+/**
+ * This function encodes a lineage as the JSON record that is saved in place of the input.
+ * @param lineage - the lineage of the input, which must be valid
+ * @param mutator_name - the name of the mutator that mutated the input
+ * @param mutator_options - the options the mutator was created with, or NULL
+ * @return - the record, which should be freed with free, or NULL on failure
+ */
+char * lineage_encode(lineage_t * lineage, char * mutator_name, char * mutator_options)
+{
+	char parent_hash[17];
+	json_t * root;
+	char * record;
+
+	snprintf(parent_hash, sizeof(parent_hash), "%016" PRIX64, lineage->parent_hash);
+	root = json_object();
+	if (!root)
+		return NULL;
+	if (json_object_set_new(root, "parent", json_string(parent_hash))
+		|| json_object_set_new(root, "parent_length", json_integer((json_int_t)lineage->parent_length))
+		|| json_object_set_new(root, "mutator", json_string(mutator_name))
+		|| (mutator_options && json_object_set_new(root, "options", json_string(mutator_options)))
+		|| json_object_set_new(root, "state", json_string(lineage->mutator_state))
+		|| json_object_set_new(root, "buffer_length", json_integer((json_int_t)lineage->buffer_length))
+		|| json_object_set_new(root, "max_length", json_integer((json_int_t)lineage->max_length))) {
+		json_decref(root);
+		return NULL;
+	}
+	record = json_dumps(root, 0);
+	json_decref(root);
+	return record;
+}
+
+/**
+ * This function gets the input that a lineage record's input was mutated from.
+ * @param record - the lineage record, as written by lineage_encode
+ * @param parent_hash - used to return the XXH64 hash of the input that was mutated
+ * @return - the parent's hash as a hex string, which should be freed with free, or NULL if the record is bad
+ */
+char * lineage_parent(const char * record, uint64_t * parent_hash)
+{
+	char * parent, * end;
+	int result;
+
+	parent = get_string_options(record, "parent", &result);
+	if (result <= 0)
+		return NULL;
+	*parent_hash = strtoull(parent, &end, 16);
+	if (!*parent || *end) {
+		free(parent);
+		return NULL;
+	}
+	return parent;
+}
+
+/**
+ * This function regenerates the input that a lineage record describes, by mutating its parent once with
+ * the mutator state that the fuzzer recorded.
+ * @param record - the lineage record, as written by lineage_encode
+ * @param mutator_directory - the directory to load the mutator from
+ * @param parent - the input that was mutated, whose hash is the record's parent
+ * @param parent_length - the length of parent
+ * @param length - used to return the length of the regenerated input
+ * @return - the regenerated input, which should be freed with free, or NULL on failure
+ */
+char * lineage_replay(const char * record, char * mutator_directory, const char * parent, size_t parent_length,
+	int * length)
+{
+	char * mutator_name, * mutator_options, * mutator_state, * output = NULL;
+	uint64_t buffer_length, max_length = 0;
+	growable_buffer_t buffer;
+	mutator_t * mutator = NULL;
+	void * state = NULL;
+	int result, options_result;
+
+	mutator_name = get_string_options(record, "mutator", &result);
+	mutator_options = get_string_options(record, "options", &options_result);
+	mutator_state = get_string_options(record, "state", &result);
+	buffer_length = get_uint64t_options(record, "buffer_length", &result);
+	if (result > 0)
+		max_length = get_uint64t_options(record, "max_length", &result);
+	if (!mutator_name || !mutator_state || result <= 0 || options_result < 0 || !buffer_length) {
+		ERROR_MSG("Bad lineage record");
+		goto cleanup;
+	}
+
+	mutator = mutator_factory_directory(mutator_directory, mutator_name);
+	if (!mutator) {
+		ERROR_MSG("Unknown mutator (%s)", mutator_name);
+		goto cleanup;
+	}
+	state = mutator->create(mutator_options, mutator_state, (char *)parent, parent_length);
+	if (!state) {
+		ERROR_MSG("Bad mutator options or saved state for mutator %s", mutator_name);
+		goto cleanup;
+	}
+
+	if (max_length) {
+		if (growable_buffer_init(&buffer, (size_t)buffer_length, (size_t)max_length))
+			goto cleanup;
+		*length = mutator_mutate_growable(mutator, state, &buffer, 0);
+		output = buffer.data;
+	} else {
+		output = (char *)malloc((size_t)buffer_length);
+		if (!output)
+			goto cleanup;
+		*length = mutator->mutate(state, output, (size_t)buffer_length);
+	}
+	if (*length <= 0) {
+		ERROR_MSG("The %s mutator couldn't regenerate the input", mutator_name);
+		free(output);
+		output = NULL;
+	}
+
+cleanup:
+	if (state)
+		mutator->cleanup(state);
+	free(mutator);
+	free(mutator_name);
+	free(mutator_options);
+	free(mutator_state);
+	return output;
+}
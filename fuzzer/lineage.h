@@ -0,0 +1,45 @@
+#pragma once
+#include <global_types.h>
+#include <utils.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Rather than saving a full copy of each input that finds a new path, the fuzzer can save its lineage: the
+//hash of the input it was mutated from, and the mutator, options, state, and buffer size it was mutated with.
+//The mutators are deterministic given their state, so the replay tool regenerates the input by creating the
+//mutator with that state and input, and mutating once.  The input it was mutated from is either a seed, or
+//another finding that is either saved in full or regenerated from its own lineage first.
+
+//The extension of the lineage records, which are saved in place of the inputs with the same name otherwise
+#define LINEAGE_EXTENSION ".lineage"
+
+#ifdef _WIN32
+#define LINEAGE_THREAD __declspec(thread)
+#else
+#define LINEAGE_THREAD __thread
+#endif
+
+//How the last input that a worker mutated was made
+struct lineage
+{
+	int valid;               //Whether the record describes the last mutation
+	char * mutator_state;    //The mutator's state from right before the mutation
+	const char * parent;     //The input that was mutated, which is only used to skip rehashing the same parent
+	uint64_t parent_hash;    //The XXH64 hash of the input that was mutated
+	size_t parent_length;
+	size_t buffer_length;    //The size of the buffer the input was mutated into
+	size_t max_length;       //The most the buffer could grow to, or 0 if it wasn't a growable buffer
+};
+typedef struct lineage lineage_t;
+
+//The lineage to record the mutations of the current thread in, or NULL if they aren't recorded
+extern LINEAGE_THREAD lineage_t * lineage_current;
+
+int lineage_capture(lineage_t * lineage, mutator_t * mutator, void * mutator_state, const char * parent,
+	size_t parent_length, size_t buffer_length, size_t max_length);
+void lineage_free(lineage_t * lineage);
+char * lineage_encode(lineage_t * lineage, char * mutator_name, char * mutator_options);
+char * lineage_parent(const char * record, uint64_t * parent_hash);
+char * lineage_replay(const char * record, char * mutator_directory, const char * parent, size_t parent_length,
+	int * length);
@@ -1,10 +1,34 @@
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define _GNU_SOURCE // syncfs
+#endif
 #include <global_types.h>
 #include <driver.h>
 #include <driver_factory.h>
 #include <mutator_factory.h>
 #include <instrumentation.h>
 #include <instrumentation_factory.h>
+#include <binary_state.h>
+#include <phase_timing.h>
+#include <static_dispatch.h>
+#include <tracepoints.h>
 #include <utils.h>
+#include <uring.h>
+#include <jansson_helper.h>
+#include "findings.h"
+#include "corpus.h"
+#include "stats.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "calibration.h"
+#include "instance_sync.h"
+#include "trim.h"
+#include "lineage.h"
+#include "remote.h"
+#include "concolic.h"
+#include "slow_inputs.h"
+#ifdef BUILTIN_MUTATORS
+#include <builtin_mutators.h>
+#endif
 
 #ifdef _WIN32
 #include <io.h>
@@ -17,87 +41,2322 @@
 #include <unistd.h>     // access, F_OK, W_OK, getopt
 #include <sys/stat.h>   // mkdir
 #include <errno.h>      // output directory creation
+#include <fcntl.h>      // open
+#include <sys/wait.h>   // waitpid
+#include <poll.h>       // poll
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * This function prints out the usage information for the fuzzer and each of the individual components
+ * @param program_name - the name of the program currently being run (for use in the outputted message)
+ * @param mutator_directory - the directory to look for mutators in, when printing out the mutator help information
+ */
+void usage(char * program_name, char * mutator_directory)
+{
+	printf(
+"\n"
+"Usage: %s\n"
+"         [options] driver_name instrumentation_name mutator_name\n"
+"   or: %s -D job_pipe\n"
+"         Run as a daemon that preloads the mutators and runs the jobs written\n"
+"         to job_pipe, one \"working_directory [options] driver_name\n"
+"         instrumentation_name mutator_name\" line per job, until a \"quit\" line.\n"
+"         A job written while another is running does its startup right away,\n"
+"         and starts fuzzing once the running job exits\n"
+"\n"
+"Options:\n"
+"  -A first_cpu                   Pin each worker to its own CPU, starting with the\n"
+"                                   first_cpu-th CPU the fuzzer may run on, and\n"
+"                                   allocate the worker's buffers and coverage maps\n"
+"                                   on that CPU, so they're in its NUMA node's memory\n"
+"  -a dictionary_file             Write the constants the target compared its inputs\n"
+"                                   against to this dictionary file, for use with\n"
+"                                   the dictionary mutator (requires an instrumentation\n"
+"                                   that records them, such as afl with cmplog)\n"
+"  -b                             Dump the instrumentation state in the compact binary format\n"
+"  -B crash_bucket_size           Bucket the crashes by how they crashed (e.g. their\n"
+"                                   coverage and signal), and only save the first\n"
+"                                   crash_bucket_size crashes of each bucket.  The\n"
+"                                   number of crashes in each bucket is written to\n"
+"                                   the crash_buckets file in the output directory\n"
+"  -c corpus_checkpoint_file      Save the corpus to this file, and resume from it\n"
+"                                   if it exists (implies -q)\n"
+"  -C checkpoint_file             Periodically save the whole campaign (the stats,\n"
+"                                   seed, mutator state, coverage, and corpus) to\n"
+"                                   this binary file, and resume from it if it exists\n"
+"  -d driver_options              JSON filename with options for the driver\n"
+"  -e                             Pipeline each worker, mutating the next input\n"
+"                                   while the current one runs and writing the\n"
+"                                   output files from a separate thread\n"
+"  -f                             Look for slow inputs and memory blowups: save the\n"
+"                                   inputs whose run was the most costly yet (in\n"
+"                                   time or instructions, or peak RSS) for any edge\n"
+"                                   to the slow directory, and give the corpus's most\n"
+"                                   costly entries the most turns (implies -q)\n"
+"  -g trim_max_exec_us            Trim the inputs that find new paths before adding\n"
+"                                   them to the corpus, if their runs took under\n"
+"                                   trim_max_exec_us microseconds\n"
+"                                   (optional, 2000 by default, 0 to never trim)\n"
+"  -H hang_verify_multiplier     Test the inputs that time out again, with this\n"
+"                                   multiple of the driver's configured timeout,\n"
+"                                   and only save the ones that time out again\n"
+"                                   (optional, 4 by default, 0 to save every hang)\n"
+"  -hd                            Get help text about drivers\n"
+"  -hi                            Get help text about instrumentation\n"
+"  -hl                            Get help text about logging\n"
+"  -hm [mutator_name]            Get help text about mutators, or only the named one\n"
+"  -hx                            Get help text about the metrics exporter\n"
+"  -hX                            Get help text about running the inputs on executors\n"
+"  -hY                            Get help text about the concolic side worker\n"
+"  -i instrumentation_options     JSON filename with options for the instrumentation\n"
+"  -j instrumentation_state_file  Set the file that the instrumentation state should dump to\n"
+"  -J                             With -j and -k, dump only what changed in the instrumentation\n"
+"                                   state since the state loaded with -k, as a binary state delta\n"
+"                                   that the merger can apply to the loaded state\n"
+"  -k instrumentation_state_file  Set the file that the instrumentation state should load from\n"
+"  -K calibration_runs            The number of times to run each seed before fuzzing,\n"
+"                                   to set the hang timeout from their exec times\n"
+"                                   and find the unstable bytes of\n"
+"                                   the coverage bitmap,\n"
+"                                   which the new paths are also run again to find\n"
+"                                   (optional, 8 by default, 0 to skip both)\n"
+"  -l logging_options             JSON filename with options for logging\n"
+"  -L time_limit                  Limit the number of seconds to fuzz for\n"
+"                                   (optional, infinite by default)\n"
+"  -m mutator_options             JSON filename with options for the mutator\n"
+"  -n num_iterations              Limit the number of iterations to run\n"
+"                                   (optional, infinite by default)\n"
+"  -o output_directory            The directory to write files which cause a\n"
+"                                   crash or hang, and the fuzzer_stats files\n"
+"  -p mutator_directory           The directory to look for mutator DLLs in\n"
+"                                   (must be specified to view help for\n"
+"                                   specific mutators)\n"
+"  -P                             Log how long each step of the fuzzer's startup takes\n"
+"  -q                             Keep the inputs that find new paths in a corpus,\n"
+"                                   and take turns mutating each of them.  Most of\n"
+"                                   the turns go to a small set of fast entries that\n"
+"                                   covers every edge that the corpus has hit\n"
+"  -r mutator_state               Set the state that the mutator should load\n"
+"  -R                             Save the lineage of each input that finds a new\n"
+"                                   path (the input it was mutated from and the\n"
+"                                   mutator state it was mutated with) rather than\n"
+"                                   the input itself, and don't trim them.  The\n"
+"                                   replay tool regenerates the inputs\n"
+"  -s seed                        The seed file to use\n"
+"  -S seed_directory              A directory of seed files to use, or a packed\n"
+"                                   corpus (see corpus_pack.h), which are added to\n"
+"                                   the corpus after the seed file, if there is\n"
+"                                   one (implies -q)\n"
+"  -t mutator_state_file          Set the file that the mutator state should dump to\n"
+"  -T phase_timing_file           Time each phase of the fuzz iterations, and write\n"
+"                                   their latency histograms to this file when the\n"
+"                                   instrumentation state is dumped\n"
+"  -u mutator_state_file          Set the file that the mutator state should load from\n"
+"  -U                             Write the test files, stdin files and findings with\n"
+"                                   io_uring, submitting each write as one system\n"
+"                                   call (Linux only)\n"
+"  -w num_workers                 The number of workers to fuzz with in parallel,\n"
+"                                   each with its own driver and instrumentation\n"
+"                                   (optional, 1 by default)\n"
+"  -W max_restarts                How many times in a row a worker whose driver or\n"
+"                                   instrumentation fails is recreated from its saved\n"
+"                                   state before the fuzzer stops (optional, 5 by\n"
+"                                   default, 0 to stop on the first failure)\n"
+"  -x metrics_options             JSON filename with options for exporting the\n"
+"                                   fuzzer's stats to StatsD or Prometheus\n"
+"  -X executor_options            JSON filename with options for running the inputs\n"
+"                                   on executor agents on other machines, with one\n"
+"                                   worker for each executor, rather than with local\n"
+"                                   drivers.  The corpus and coverage stay here\n"
+"  -y sync_directory              Import the inputs that found new paths from the\n"
+"                                   output directories of the other fuzzers in\n"
+"                                   this directory, as they're found (implies -q)\n"
+"  -Y concolic_options            JSON filename with options for a side worker that\n"
+"                                   runs the corpus through a concolic executor once\n"
+"                                   fuzzing plateaus, and shares the inputs it solves\n"
+"                                   for through the sync directory (needs -y)\n"
+"  -Z autotune_seconds            Tune how many of the -w workers fuzz: start with\n"
+"                                   one, add one at a time while measuring the exec\n"
+"                                   speed for autotune_seconds each, and keep the\n"
+"                                   fastest number once more workers stop helping.\n"
+"                                   With -A, the workers fill the physical cores\n"
+"                                   before their SMT siblings\n"
+"\n\n",
+		program_name, program_name
+	);
+
+	exit(1);
+}
+
+//A fuzzing worker; each worker has its own driver and instrumentation state,
+//and either its own clone of the mutator state or the shared one
+struct worker
+{
+	int id;
+	driver_t * driver;
+	void * instrumentation_state;
+	void * mutator_state;  //The worker's clone of the mutator state, or NULL if it uses the shared one
+	thread_t thread;
+	fuzzer_stats_counters_t * stats; //The worker's counters in the fuzzer stats
+	phase_timing_t * timing; //The worker's phase timing, or NULL if phases aren't being timed
+
+	//The double buffered inputs used in pipelined mode.  The worker's mutate thread mutates
+	//into one buffer while the worker tests the other.
+	thread_t mutate_thread;
+	char * buffers[2];
+	int lengths[2];
+	size_t buffer_length;
+	semaphore_t free_buffers;   //The number of buffers the mutate thread can mutate into
+	semaphore_t ready_buffers;  //The number of mutated buffers waiting to be tested
+
+	//How much the worker's trim stage has shrunk the new paths
+	uint64_t trimmed_inputs;
+	uint64_t trimmed_bytes;
+
+	//The bytes of the bitmap that the calibration and the worker's rechecks of its new paths found to be unstable
+	uint8_t * unstable_bytes;
+	size_t unstable_size;
+	size_t unstable_found; //The number of unstable bytes that the rechecks found
+
+	lineage_t lineage; //How the worker's last input was mutated, when the lineage of new paths is recorded (-R)
+
+	//The remote mode state (-X).  The worker mutates a batch of inputs at a time, and runs them on its executor.
+	remote_executor_t * executor;
+	char ** batch_inputs;
+	int * batch_lengths;
+	executor_result_t * batch_results;
+	executor_result_t * remote_result; //The result that's being classified, which has the crash hash
+
+	int driver_failed;        //Whether the driver returned an error for the last input
+	int consecutive_restarts; //How many times the worker has been restarted since its last successful iteration
+	volatile int parked;      //Whether the autotune (-Z) is keeping the worker from starting more iterations
+};
+typedef struct worker worker_t;
+
+//A slot in the output queue, holding a file waiting to be written by the output writer thread.
+//The sequence number tracks whether the slot is free for the next enqueue or ready to be dequeued.
+struct output_slot
+{
+	volatile long sequence;
+	char * directory;
+	char * buffer;
+	int length;
+	char * lineage;
+};
+typedef struct output_slot output_slot_t;
+
+//The global module state objects
+static mutator_t * mutator = NULL;
+static void * mutator_state = NULL;
+static instrumentation_t * instrumentation = NULL;
+static worker_t * workers = NULL;
+static int num_workers = 1;
+
+//The mutator given to the drivers when there is more than one worker or a corpus.  It
+//forwards everything to the real mutator (through the corpus, if there is one), but
+//requests thread safe mutations when there is more than one worker
+static mutator_t thread_safe_mutator;
+
+//The inputs that found new paths, which are scheduled back into the mutator
+static corpus_t * corpus = NULL;
+static int use_corpus = 0;
+static char * corpus_checkpoint_file = NULL;
+static seed_directory_t * seeds = NULL; //The seeds mapped from the -S directory, which the corpus uses in place
+
+//How many iterations the first worker runs between saving the corpus checkpoint
+#define CORPUS_CHECKPOINT_INTERVAL 10000
+
+//The campaign checkpoint state.  The first worker takes the snapshots, and the checkpoint writer writes them.
+static char * checkpoint_file = NULL;
+static checkpoint_writer_t * checkpoint_writer = NULL;
+static checkpoint_contents_t checkpoint_contents; //The parts of the campaign that don't change while fuzzing
+static char * checkpoint_seed = NULL;            //The seed, kept for the checkpoints
+static uint64_t next_checkpoint_ms = 0;
+
+//The state shared between the workers
+static char * output_directory = "output";
+static findings_store_t * findings = NULL;
+static fuzzer_stats_t * stats = NULL;
+static phase_timing_t * phase_timings = NULL; //One phase timing for each worker, when the phases are being timed
+static int num_iterations;
+static uint64_t end_time_ms = 0; //The get_time_ms time to stop fuzzing at, or 0 for no time limit
+static int iterations_started = 0;
+static int iterations_finished = 0;
+static int stop_workers = 0;
+static mutex_t iteration_mutex = NULL;
+static mutex_t coverage_mutex = NULL;
+static void * shared_instrumentation_state = NULL; // the merged coverage of all the workers
+static int coverage_sync_disabled = 0;
+
+//The pipelined mode state
+static int pipelined = 0;
+
+//The CPU that the first worker is pinned to, or -1 if the workers aren't pinned
+static int first_cpu = -1;
+//The order that the workers take the CPUs in, by the indices pin_thread_to_cpu takes, or NULL to take them in
+//the order they're numbered.  The autotune (-Z) fills the physical cores before their SMT siblings.
+static int * cpu_order = NULL;
+static int cpu_order_count = 0;
+
+//How many seconds the autotune (-Z) measures the exec speed of each number of workers for, or 0 to fuzz with
+//all of the workers.  A worker that doesn't raise the exec speed by AUTOTUNE_MIN_GAIN_PERCENT doesn't count
+//as an improvement, and the ramp stops after AUTOTUNE_PATIENCE workers in a row don't improve it.
+#define AUTOTUNE_MIN_GAIN_PERCENT 5
+#define AUTOTUNE_PATIENCE         2
+#define AUTOTUNE_SETTLE_PERCENT   25 //The part of each step that's skipped while the new worker starts its target
+#define AUTOTUNE_POLL_MS          100
+static int autotune_seconds = 0;
+
+//The number of crashes saved from each crash bucket, or 0 if the crashes aren't bucketed
+static int crash_bucket_size = 0;
+
+//The state of the sync with the other fuzzers that share the sync directory (-y), or NULL if there's no sync
+static instance_sync_t * instance_sync = NULL;
+static uint64_t next_import_ms = 0;
+
+//Whether the new paths are saved as lineage records rather than in full (-R), and what the records need to
+//regenerate the inputs that were mutated from the seed
+static int record_lineage = 0;
+static char * lineage_mutator_name = NULL;
+static char * lineage_mutator_options = NULL;
+static char * lineage_seed = NULL;
+static size_t lineage_seed_length = 0;
+
+//The new paths are trimmed while the target's runs average under this many microseconds (-g), or never if 0
+static int trim_max_exec_us = TRIM_DEFAULT_MAX_EXEC_US;
+
+//The inputs that time out are tested again with this multiple of the driver's configured timeout (-H), and
+//are only saved as hangs if they time out again, or they're all saved if it's 0
+#define HANG_VERIFY_DEFAULT_MULTIPLIER 4.0
+static double hang_verify_multiplier = HANG_VERIFY_DEFAULT_MULTIPLIER;
+
+//Whether the inputs that find new paths are run again to find the unstable bytes of the bitmap, which is done
+//unless calibration is skipped (-K 0)
+static int recheck_new_paths = 0;
+static uint64_t fuzz_start_ns = 0;
+
+//The options for running the inputs on executors (-X), or NULL if they're run with local drivers, and the
+//global virgin map of the executors' inputs
+static remote_options_t * remote = NULL;
+static remote_coverage_t * remote_coverage = NULL;
+
+//The concolic side worker (-Y), which solves for new inputs from the corpus entries once fuzzing has plateaued
+static concolic_worker_t * concolic = NULL;
+
+//The cost maxima of slow input mode (-f), or NULL if the fuzzer isn't looking for slow inputs
+static int find_slow_inputs = 0;
+static slow_inputs_t * slow_inputs = NULL;
+
+//The worker supervision state.  A worker whose driver or instrumentation fails is recreated from its saved
+//instrumentation state through the factories, up to max_worker_restarts times in a row (-W), with the same
+//options that the workers were created with.
+#define WORKER_RESTARTS_DEFAULT       5
+#define WORKER_RESTART_BACKOFF_MS     100   //The delay before the first restart, which doubles with each failure
+#define WORKER_RESTART_MAX_BACKOFF_MS 10000
+static int max_worker_restarts = WORKER_RESTARTS_DEFAULT;
+static char * restart_driver_name = NULL;
+static char * restart_driver_options = NULL;
+static char * restart_instrumentation_options = NULL;
+static mutator_t * restart_driver_mutator = NULL;
+
+//The output writer state.  The workers add the inputs that should be saved to a bounded lock free
+//queue, and the output writer thread writes them to the output directory.
+#define OUTPUT_QUEUE_SIZE 1024 //Must be a power of two
+#define OUTPUT_BATCH_SIZE   64 //The most files the output writer writes before syncing them to disk
+static output_slot_t output_queue[OUTPUT_QUEUE_SIZE];
+static volatile long output_enqueue_position = 0;
+static volatile long output_dequeue_position = 0;
+static volatile int output_writer_stop = 0;
+static thread_t output_thread;
+static semaphore_t output_available = NULL;
+
+#ifdef _WIN32
+#define ATOMIC_COMPARE_AND_SWAP(ptr, old_value, new_value) \
+	(InterlockedCompareExchange((ptr), (new_value), (old_value)) == (old_value))
+#define MEMORY_BARRIER() MemoryBarrier()
+#else
+#define ATOMIC_COMPARE_AND_SWAP(ptr, old_value, new_value) __sync_bool_compare_and_swap((ptr), (old_value), (new_value))
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+//How many iterations each worker runs before merging its coverage with the other workers
+#define WORKER_SYNC_INTERVAL 1000
+
+//How often the first worker imports the inputs that the other fuzzers sharing the sync directory found
+#define INSTANCE_SYNC_INTERVAL_MS 1000
+
+//The size of the pipelined mode input buffers, relative to the seed size
+#define PIPELINE_BUFFER_RATIO 2.0
+
+//The length a worker's mutate thread gives a buffer when there are no more iterations to run
+#define PIPELINE_DONE -3
+
+static void cleanup_modules(void)
+{
+	int i, j;
+	for (i = 0; workers && i < num_workers; i++) {
+		if (workers[i].driver) {
+			workers[i].driver->cleanup(workers[i].driver->state);
+			free(workers[i].driver);
+		}
+		if (instrumentation && workers[i].instrumentation_state)
+			instrumentation->cleanup(workers[i].instrumentation_state);
+		if (mutator && workers[i].mutator_state)
+			mutator->cleanup(workers[i].mutator_state);
+		free(workers[i].buffers[0]);
+		free(workers[i].buffers[1]);
+		free(workers[i].unstable_bytes);
+		lineage_free(&workers[i].lineage);
+		remote_executor_destroy(workers[i].executor);
+		for (j = 0; workers[i].batch_inputs && j < remote->batch_size; j++)
+			free(workers[i].batch_inputs[j]);
+		free(workers[i].batch_inputs);
+		free(workers[i].batch_lengths);
+		free(workers[i].batch_results);
+		destroy_semaphore(workers[i].free_buffers);
+		destroy_semaphore(workers[i].ready_buffers);
+	}
+	if (instrumentation && shared_instrumentation_state)
+		instrumentation->cleanup(shared_instrumentation_state);
+	concolic_worker_destroy(concolic);
+	corpus_destroy(corpus);
+	free_seed_directory(seeds);
+	if(mutator && mutator_state)
+		mutator->cleanup(mutator_state);
+	free(workers);
+	free(instrumentation);
+	free(mutator);
+	destroy_mutex(iteration_mutex);
+	destroy_mutex(coverage_mutex);
+	destroy_semaphore(output_available);
+	instance_sync_destroy(instance_sync);
+	remote_coverage_destroy(remote_coverage);
+	remote_options_destroy(remote);
+	findings_store_destroy(findings);
+	slow_inputs_destroy(slow_inputs);
+	fuzzer_stats_destroy(stats);
+	free(phase_timings);
+	free(cpu_order);
+	free(checkpoint_seed);
+	free(lineage_seed);
+	tracepoints_unregister();
+	uring_disable();
+}
+
+static void sigint_handler(int sig)
+{
+	CRITICAL_MSG("CTRL-c detected, exiting\n");
+	cleanup_modules();
+	exit(0);
+}
+
+#ifndef _WIN32
+//A write to a fork server that has died fails with EPIPE rather than killing the fuzzer, so that the worker can be
+//restarted.  It's a handler rather than SIG_IGN, since exec resets handlers and the targets keep the usual SIGPIPE.
+static void sigpipe_handler(int sig)
+{
+}
+#endif
+
+#define NUM_ITERATIONS_INFINITE -1
+
+/**
+ * This function gets the lineage that the current thread's next mutation should be recorded in.
+ * @param flags - the mutate flags of the mutation
+ * @return - the lineage to record the mutation in, or NULL if it isn't recorded
+ */
+static lineage_t * mutation_lineage(uint64_t flags)
+{
+	lineage_t * lineage = lineage_current;
+
+	//The parts of a multiple input mutation can't be regenerated from one mutator state
+	if (lineage && (flags & MUTATE_MULTIPLE_INPUTS)) {
+		lineage->valid = 0;
+		lineage = NULL;
+	}
+	return lineage;
+}
+
+/**
+ * This function records the lineage of a mutation of the seed, when there's no corpus.
+ * @param lineage - the lineage to record the mutation in
+ * @param state - the mutator state that will mutate the seed
+ * @param buffer_length - the size of the buffer the input will be mutated into
+ * @param max_length - the most that the buffer can grow to, or 0 if it isn't a growable buffer
+ */
+static void capture_seed_lineage(lineage_t * lineage, void * state, size_t buffer_length, size_t max_length)
+{
+	//Another worker could mutate with a shared mutator state between the capture and the mutation
+	if (state == mutator_state && num_workers > 1)
+		lineage->valid = 0;
+	else
+		lineage_capture(lineage, mutator, state, lineage_seed, lineage_seed_length, buffer_length, max_length);
+}
+
+static int thread_safe_mutate_extended(void * state, char * buffer, size_t buffer_length, uint64_t flags)
+{
+	lineage_t * lineage = mutation_lineage(flags);
+
+	if (num_workers > 1)
+		flags |= MUTATE_THREAD_SAFE;
+	if (corpus)
+		return corpus_mutate(corpus, buffer, buffer_length, flags, lineage);
+	if (lineage)
+		capture_seed_lineage(lineage, state, buffer_length, 0);
+	return mutator->mutate_extended(state, buffer, buffer_length, flags);
+}
+
+static int thread_safe_mutate(void * state, char * buffer, size_t buffer_length)
+{
+	return thread_safe_mutate_extended(state, buffer, buffer_length, 0);
+}
+
+static int thread_safe_mutate_growable(void * state, growable_buffer_t * buffer, uint64_t flags)
+{
+	lineage_t * lineage = mutation_lineage(flags);
+
+	if (num_workers > 1)
+		flags |= MUTATE_THREAD_SAFE;
+	if (corpus)
+		return corpus_mutate_growable(corpus, buffer, flags, lineage);
+	if (lineage)
+		capture_seed_lineage(lineage, state, buffer->capacity, buffer->max_capacity);
+	return mutator_mutate_growable(mutator, state, buffer, flags);
+}
+
+/**
+ * This function merges a worker's coverage into the coverage shared by all of the workers,
+ * and then loads the combined coverage back into the worker, so that it will not report
+ * paths that the other workers have already found.  It must be called from the worker's
+ * own thread (or after the worker has stopped), since it modifies the worker's
+ * instrumentation state.
+ * @param worker - the worker to synchronize
+ */
+static void sync_worker_coverage(worker_t * worker)
+{
+	void * merged;
+	char * state;
+	size_t state_length;
+
+	if (num_workers < 2 || !worker->instrumentation_state || take_mutex(coverage_mutex))
+		return;
+
+	if (!coverage_sync_disabled)
+	{
+		merged = instrumentation->merge(shared_instrumentation_state ? shared_instrumentation_state
+			: worker->instrumentation_state, worker->instrumentation_state);
+		if (!merged) {
+			WARNING_MSG("The instrumentation does not support merging, workers will not share coverage");
+			coverage_sync_disabled = 1;
+		} else {
+			if (shared_instrumentation_state)
+				instrumentation->cleanup(shared_instrumentation_state);
+			shared_instrumentation_state = merged;
+
+			state = instrumentation_save_state(instrumentation, shared_instrumentation_state, 1, &state_length);
+			if (!state || instrumentation_load_state(instrumentation, worker->instrumentation_state, state, state_length))
+				WARNING_MSG("Worker %d failed to load the shared coverage", worker->id);
+			if (state)
+				instrumentation->free_state(state);
+		}
+	}
+
+	release_mutex(coverage_mutex);
+}
+
+/**
+ * This function sleeps the calling thread.
+ * @param ms - how many milliseconds to sleep for
+ */
+static void sleep_ms(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+/**
+ * This function checks whether there are iterations left to run.  It should be called with the iteration mutex
+ * held, unless the answer is only a hint.
+ * @return - non-zero if the workers should run more iterations, zero if they should stop
+ */
+static int iterations_left(void)
+{
+	return !stop_workers && (num_iterations == NUM_ITERATIONS_INFINITE || iterations_started < num_iterations)
+		&& (!end_time_ms || get_time_ms() < end_time_ms);
+}
+
+/**
+ * This function reserves the next iteration for a worker to run.
+ * @return - non-zero if the worker should run another iteration, zero if it should stop
+ */
+static int start_iteration(void)
+{
+	int ret = 0;
+	take_mutex(iteration_mutex);
+	if (iterations_left()) {
+		iterations_started++;
+		ret = 1;
+	}
+	release_mutex(iteration_mutex);
+	return ret;
+}
+
+/**
+ * This function waits while the autotune (-Z) has a worker parked, so that the worker doesn't start any more
+ * iterations until it's needed, or there are none left for it to run.
+ * @param worker - the worker that's about to start an iteration
+ */
+static void wait_while_parked(worker_t * worker)
+{
+	while (worker->parked && iterations_left())
+		sleep_ms(AUTOTUNE_POLL_MS);
+}
+
+/**
+ * This function records that a worker has finished an iteration, or that it has stopped and
+ * the other workers should stop as well.
+ * @param finished - whether the iteration finished (1) or the worker stopped early (0)
+ */
+static void end_iteration(int finished)
+{
+	take_mutex(iteration_mutex);
+	if (finished)
+		iterations_finished++;
+	else
+		stop_workers = 1;
+	release_mutex(iteration_mutex);
+}
+
+/**
+ * This function gives back an iteration that a worker reserved and didn't finish, because the worker is
+ * being restarted and will run the iteration again.
+ */
+static void abandon_iteration(void)
+{
+	take_mutex(iteration_mutex);
+	iterations_started--;
+	release_mutex(iteration_mutex);
+}
+
+/**
+ * This function writes an input that found a crash, hang, or new path to the output directory.
+ * @param directory - the subdirectory of the output directory to write the input to
+ * @param buffer - the input to write
+ * @param length - the length of the buffer parameter
+ * @param lineage - the lineage record to write in place of the input, or NULL to write the input itself
+ */
+static void save_input(char * directory, const char * buffer, int length, const char * lineage)
+{
+	if (findings && lineage)
+		findings_store_add_lineage(findings, directory, buffer, length, lineage);
+	else if (findings)
+		findings_store_add(findings, directory, buffer, length);
+}
+
+static int compare_lines(const void * a, const void * b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * This function writes the constants the workers' targets compared their inputs against to an
+ * AFL style dictionary file, which the dictionary and afl mutators can load with their dictionary
+ * option.  Each worker's target has its own compare log, so the tokens are combined and any
+ * duplicates are removed.
+ * @param filename - the dictionary file to write
+ * @return - zero on success, non-zero on failure
+ */
+static int write_dictionary(char * filename)
+{
+	char ** dictionaries, ** lines = NULL, ** new_lines, * pos;
+	file_buffer_t * output;
+	size_t num_lines = 0, max_lines = 0, i, j;
+	int ret = 1;
+
+	if (!instrumentation->get_dictionary) {
+		WARNING_MSG("The instrumentation does not support getting a dictionary");
+		return 1;
+	}
+
+	dictionaries = calloc(num_workers, sizeof(char *));
+	if (!dictionaries)
+		return 1;
+	for (i = 0; i < (size_t)num_workers; i++) {
+		dictionaries[i] = instrumentation->get_dictionary(workers[i].instrumentation_state);
+		if (!dictionaries[i])
+			continue;
+		for (pos = strtok(dictionaries[i], "\n"); pos; pos = strtok(NULL, "\n")) {
+			if (num_lines == max_lines) {
+				max_lines = max_lines ? max_lines * 2 : 256;
+				new_lines = realloc(lines, max_lines * sizeof(char *));
+				if (!new_lines)
+					goto cleanup;
+				lines = new_lines;
+			}
+			lines[num_lines++] = pos;
+		}
+	}
+
+	//Each token and its newline are written straight from the dictionaries, rather than copied into one buffer
+	output = malloc((2 * num_lines + 1) * sizeof(file_buffer_t));
+	if (!output)
+		goto cleanup;
+	qsort(lines, num_lines, sizeof(char *), compare_lines);
+	for (i = 0, j = 0; i < num_lines; i++) {
+		if (i && !strcmp(lines[i], lines[i - 1]))
+			continue;
+		output[2 * j].data = lines[i];
+		output[2 * j].length = strlen(lines[i]);
+		output[2 * j + 1].data = "\n";
+		output[2 * j + 1].length = 1;
+		j++;
+	}
+	ret = write_buffers_to_file(filename, output, 2 * j);
+	if (!ret)
+		INFO_MSG("Wrote %lu dictionary tokens to %s", (unsigned long)j, filename);
+	free(output);
+
+cleanup:
+	for (i = 0; i < (size_t)num_workers; i++) {
+		if (dictionaries[i])
+			instrumentation->free_state(dictionaries[i]);
+	}
+	free(dictionaries);
+	free(lines);
+	return ret;
+}
+
+/**
+ * This function queues an input to be written by the output writer thread, so that the workers
+ * don't wait on the disk.  It is safe to call from multiple workers at once.  If the output writer
+ * has fallen so far behind that the queue is full, the input is written immediately instead.
+ * @param directory - the subdirectory of the output directory to write the input to
+ * @param buffer - the input to write.  The output writer thread takes ownership of it.
+ * @param length - the length of the buffer parameter
+ * @param lineage - the lineage record to write in place of the input, or NULL to write the input itself.
+ * The output writer thread takes ownership of it.
+ */
+static void queue_output(char * directory, char * buffer, int length, char * lineage)
+{
+	output_slot_t * slot;
+	long position, difference;
+
+	position = output_enqueue_position;
+	while (1)
+	{
+		slot = &output_queue[position & (OUTPUT_QUEUE_SIZE - 1)];
+		difference = slot->sequence - position;
+		if (difference == 0) {
+			if (ATOMIC_COMPARE_AND_SWAP(&output_enqueue_position, position, position + 1))
+				break;
+		} else if (difference < 0) {
+			WARNING_MSG("The output writer has fallen behind, writing the %s input directly", directory);
+			save_input(directory, buffer, length, lineage);
+			free(buffer);
+			free(lineage);
+			return;
+		}
+		position = output_enqueue_position;
+	}
+
+	slot->directory = directory;
+	slot->buffer = buffer;
+	slot->length = length;
+	slot->lineage = lineage;
+	MEMORY_BARRIER();
+	slot->sequence = position + 1;
+	release_semaphore(output_available);
+}
+
+/**
+ * This function removes the next input from the output queue.  It should only be called by the
+ * output writer thread.
+ * @param directory - used to return the subdirectory of the output directory to write the input to
+ * @param buffer - used to return the input
+ * @param length - used to return the length of the input
+ * @param lineage - used to return the lineage record to write in place of the input, or NULL
+ * @return - non-zero if an input was dequeued, zero if the queue is empty
+ */
+static int dequeue_output(char ** directory, char ** buffer, int * length, char ** lineage)
+{
+	long position = output_dequeue_position;
+	output_slot_t * slot = &output_queue[position & (OUTPUT_QUEUE_SIZE - 1)];
+
+	if (slot->sequence != position + 1)
+		return 0;
+	MEMORY_BARRIER();
+	*directory = slot->directory;
+	*buffer = slot->buffer;
+	*length = slot->length;
+	*lineage = slot->lineage;
+	output_dequeue_position = position + 1;
+	MEMORY_BARRIER();
+	slot->sequence = position + OUTPUT_QUEUE_SIZE;
+	return 1;
+}
+
+/**
+ * This function flushes the files that the output writer has written to disk.  They are
+ * flushed once per batch, rather than once per file.
+ */
+static void sync_output(void)
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	int fd = open(output_directory, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (syncfs(fd))
+		WARNING_MSG("Failed to sync the output directory %s", output_directory);
+	close(fd);
+#elif defined(__APPLE__)
+	sync();
 #endif
+}
+
+/**
+ * This function runs the output writer thread, which writes the inputs queued by the workers
+ * in batches, syncing each batch to disk, until the fuzzer stops and the queue is empty.
+ * @param arg - unused
+ */
+static THREAD_FUNC(output_writer)
+{
+	char * directory, * buffer, * lineage;
+	int length, written;
+
+	while (!take_semaphore(output_available))
+	{
+		written = 0;
+		while (dequeue_output(&directory, &buffer, &length, &lineage))
+		{
+			save_input(directory, buffer, length, lineage);
+			free(buffer);
+			free(lineage);
+			written++;
+			if (written % OUTPUT_BATCH_SIZE == 0)
+				sync_output();
+			//Each dequeued input has a matching release of the semaphore.  Consume the
+			//ones that were drained by this batch, so the writer doesn't wake up for them.
+			if (written > 1)
+				take_semaphore(output_available);
+		}
+		if (written % OUTPUT_BATCH_SIZE)
+			sync_output();
+		if (output_writer_stop && !written)
+			break;
+	}
+
+	THREAD_RETURN;
+}
+
+/**
+ * This function starts the output writer thread.
+ * @return - zero on success, non-zero on failure
+ */
+static int start_output_writer(void)
+{
+	long i;
+	for (i = 0; i < OUTPUT_QUEUE_SIZE; i++)
+		output_queue[i].sequence = i;
+	output_available = create_semaphore(0, 0x7fffffff);
+	return !output_available || create_thread(&output_thread, output_writer, NULL);
+}
+
+/**
+ * This function waits for the output writer thread to write all of the queued inputs, and then stops it.
+ */
+static void stop_output_writer(void)
+{
+	output_writer_stop = 1;
+	release_semaphore(output_available);
+	join_thread(output_thread);
+}
+
+/**
+ * This function runs a worker's mutate thread in pipelined mode.  It mutates the next input
+ * into whichever of the worker's buffers is free, while the worker tests the other one.
+ * @param arg - a pointer to the worker_t to mutate the inputs for
+ */
+static THREAD_FUNC(pipeline_mutator)
+{
+	worker_t * worker = (worker_t *)arg;
+	int slot = 0, length;
+
+	phase_timing_current = worker->timing;
+	do
+	{
+		if (take_semaphore(worker->free_buffers))
+			break;
+
+		wait_while_parked(worker);
+		if (!start_iteration())
+			length = PIPELINE_DONE;
+		else
+		{
+			PHASE_BEGIN(PHASE_MUTATE);
+			if (worker->mutator_state)
+				length = mutator->mutate_extended(worker->mutator_state, worker->buffers[slot], worker->buffer_length, 0);
+			else
+				length = thread_safe_mutate_extended(mutator_state, worker->buffers[slot], worker->buffer_length, 0);
+			PHASE_END(PHASE_MUTATE);
+			TRACEPOINT_MUTATE_DONE(length);
+			if (length < 0)
+				length = -1;
+		}
+
+		worker->lengths[slot] = length;
+		release_semaphore(worker->ready_buffers);
+		slot = !slot;
+	} while (length > 0);
+
+	THREAD_RETURN;
+}
+
+/**
+ * This function gets the next input for a worker to test, and tests it with the worker's driver.
+ * In pipelined mode, the input is taken from the worker's mutate thread, otherwise the driver
+ * mutates and tests the input itself.
+ * @param worker - the worker to test an input for
+ * @param slot - in pipelined mode, a pointer to the index of the worker's buffer to test next
+ * @param input - in pipelined mode, used to return the tested input
+ * @param input_length - in pipelined mode, used to return the length of the tested input
+ * @return - the driver's FUZZ_ result, -2 if the mutator has run out of mutations, PIPELINE_DONE
+ * if there are no more iterations to run, or -1 on error
+ */
+static int test_worker_input(worker_t * worker, int * slot, char ** input, int * input_length)
+{
+	int fuzz_result;
+
+	worker->driver_failed = 0;
+	if (!pipelined) {
+		wait_while_parked(worker);
+		if (!start_iteration())
+			return PIPELINE_DONE;
+		fuzz_result = DRIVER_CALL(worker->driver, test_next_input, worker->driver->state);
+		worker->driver_failed = fuzz_result == FUZZ_ERROR;
+		return fuzz_result;
+	}
+
+	if (take_semaphore(worker->ready_buffers))
+		return -1;
+	*input = worker->buffers[*slot];
+	*input_length = worker->lengths[*slot];
+	if (*input_length == 0)
+		return -2;
+	if (*input_length < 0)
+		return *input_length;
+
+	fuzz_result = DRIVER_CALL(worker->driver, test_input, worker->driver->state, *input, *input_length);
+	worker->driver_failed = fuzz_result == FUZZ_ERROR;
+	return fuzz_result;
+}
+
+/**
+ * This function copies the counts of the problems a worker's instrumentation has run into to the worker's stats.
+ * @param worker - the worker to update the stats of
+ */
+static void update_instrumentation_counters(worker_t * worker)
+{
+	instrumentation_counters_t counters;
+
+	if (!instrumentation->get_counters)
+		return;
+	instrumentation->get_counters(worker->instrumentation_state, &counters);
+	worker->stats->fork_failures = counters.fork_failures;
+	worker->stats->trace_overflows = counters.trace_overflows;
+	worker->stats->oom_kills = counters.oom_kills;
+}
+
+/**
+ * This function gets the results of a worker's last run from its instrumentation, in one call when the
+ * instrumentation supports finish_round, or from is_new_path and get_path_hash otherwise.
+ * @param worker - the worker that ran the input
+ * @param fuzz_result - the driver's FUZZ_ result for the run
+ * @param result - a pointer used to return the results of the run.  Its fuzz_result is always the driver's.
+ * @return - zero on success, or -1 if the instrumentation failed to determine the results
+ */
+static int finish_worker_round(worker_t * worker, int fuzz_result, instrumentation_round_result_t * result)
+{
+	void * instrumentation_state = worker->instrumentation_state;
+
+	if (instrumentation->finish_round) {
+		if (INSTRUMENTATION_FINISH_ROUND(instrumentation, instrumentation_state, result))
+			return -1;
+		result->fuzz_result = fuzz_result;
+		if (fuzz_result != FUZZ_NONE)
+			result->has_path_hash = 0;
+		return 0;
+	}
+
+	memset(result, 0, sizeof(*result));
+	result->fuzz_result = fuzz_result;
+	result->new_path = INSTRUMENTATION_CALL(instrumentation, is_new_path, instrumentation_state);
+	if (result->new_path < 0)
+		return -1;
+	result->new_bits = result->new_path > 0 ? 2 : 0;
+	if (fuzz_result == FUZZ_NONE && instrumentation->get_path_hash
+		&& !instrumentation->get_path_hash(instrumentation_state, &result->path_hash))
+		result->has_path_hash = 1;
+	return 0;
+}
+
+/**
+ * This function gets the cost of a run for the corpus, which is the number of instructions the run executed
+ * if the instrumentation counted them, or else how long it took.
+ * @param round - the results of the run
+ * @return - the cost of the run, or 0 if it isn't known
+ */
+static uint64_t round_cost(instrumentation_round_result_t * round)
+{
+	return round->exec_instructions ? round->exec_instructions : round->exec_us;
+}
+
+/**
+ * This function gets the coverage map of a worker's last run, for the corpus to pick its favored entries with.
+ * @param worker - the worker that ran the input
+ * @param trace_bits - used to return the coverage map, which is only valid until the next run, or NULL if
+ * the instrumentation doesn't provide one
+ * @param trace_size - used to return the size of the coverage map, or 0 if there isn't one
+ */
+static void get_worker_trace_bits(worker_t * worker, const uint8_t ** trace_bits, size_t * trace_size)
+{
+	if (!instrumentation->get_trace_bits
+		|| instrumentation->get_trace_bits(worker->instrumentation_state, trace_bits, trace_size)) {
+		*trace_bits = NULL;
+		*trace_size = 0;
+	}
+}
+
+/**
+ * This function runs an input that found a new path again, and stops the bytes of the bitmap that changed
+ * between the two runs from counting as new paths, so that a target with nondeterministic coverage doesn't
+ * keep finding "new" paths that only differ in those bytes.  The bytes are marked as seen in the worker's
+ * virgin maps, which the other workers pick up when they share their coverage.  It must be called right after
+ * the run that found the new path, while its bitmap is still the instrumentation's current one.
+ * @param worker - the worker that found the new path
+ * @param input - the input that found the new path
+ * @param length - the length of the input parameter
+ */
+static void recheck_new_path(worker_t * worker, char * input, int length)
+{
+	const uint8_t * trace_bits;
+	size_t trace_size;
+	int found;
+
+	if (!instrumentation->ignore_unstable_bytes)
+		return;
+	get_worker_trace_bits(worker, &trace_bits, &trace_size);
+	if (!trace_bits)
+		return;
+	//The bitmap can grow when the target negotiates its size, and the old mask is of no use then
+	if (worker->unstable_size != trace_size) {
+		free(worker->unstable_bytes);
+		worker->unstable_bytes = (uint8_t *)calloc(1, trace_size);
+		worker->unstable_size = worker->unstable_bytes ? trace_size : 0;
+		if (!worker->unstable_bytes)
+			return;
+	}
+
+	found = calibration_recheck_input(worker->driver, instrumentation, worker->instrumentation_state, input, length,
+		trace_bits, trace_size, worker->unstable_bytes);
+	worker->stats->execs++;
+	if (found <= 0)
+		return;
+	DEBUG_MSG("Worker %d found %d more unstable bytes of the bitmap", worker->id, found);
+	worker->unstable_found += found;
+	if (instrumentation->ignore_unstable_bytes(worker->instrumentation_state, worker->unstable_bytes, trace_size))
+		WARNING_MSG("Worker %d's instrumentation can't ignore the unstable bytes", worker->id);
+}
+
+/**
+ * This function copies the campaign into a checkpoint.  It must be called from the first worker's thread,
+ * or after the workers have stopped, since it reads the first worker's instrumentation and mutator states.
+ * @param finished - whether the workers have stopped, and merged their mutator states into the shared one
+ * @param length - a pointer used to return the length of the checkpoint
+ * @return - the checkpoint, which should be freed with free, or NULL on failure
+ */
+static char * snapshot_campaign(int finished, size_t * length)
+{
+	char * instrumentation_saved_state, * mutator_saved_state = NULL, * checkpoint = NULL;
+	void * state;
+	size_t state_length;
+
+	//The shared coverage is only replaced while holding the coverage mutex
+	if (num_workers > 1)
+		take_mutex(coverage_mutex);
+	state = shared_instrumentation_state ? shared_instrumentation_state : workers[0].instrumentation_state;
+	instrumentation_saved_state = instrumentation_save_state(instrumentation, state, 1, &state_length);
+	if (num_workers > 1)
+		release_mutex(coverage_mutex);
+	if (!instrumentation_saved_state)
+		return NULL;
+
+	//The corpus has the mutator states of each of its entries
+	if (!corpus) {
+		mutator_saved_state = mutator->get_state(!finished && workers[0].mutator_state ? workers[0].mutator_state : mutator_state);
+		if (!mutator_saved_state) {
+			instrumentation->free_state(instrumentation_saved_state);
+			return NULL;
+		}
+	}
+
+	checkpoint_contents.mutator_state = mutator_saved_state;
+	checkpoint_contents.instrumentation_state = instrumentation_saved_state;
+	//The NUL is kept for JSON states, so that they can be used straight from the mapped checkpoint
+	checkpoint_contents.instrumentation_state_length = binary_state_is_binary(instrumentation_saved_state, state_length)
+		? state_length : state_length + 1;
+	checkpoint_contents.corpus = corpus;
+	checkpoint = checkpoint_create(&checkpoint_contents, length);
+
+	instrumentation->free_state(instrumentation_saved_state);
+	if (mutator_saved_state)
+		mutator->free_state(mutator_saved_state);
+	return checkpoint;
+}
+
+/**
+ * This function takes a snapshot of the campaign and hands it to the checkpoint writer, if it's time for
+ * another checkpoint.  It must be called from the first worker's thread.
+ */
+static void checkpoint_campaign(void)
+{
+	char * checkpoint;
+	size_t length;
+	uint64_t now = get_time_ms();
+
+	if (now < next_checkpoint_ms)
+		return;
+	next_checkpoint_ms = now + CHECKPOINT_INTERVAL_MS;
+
+	PHASE_BEGIN(PHASE_SAVE);
+	checkpoint = snapshot_campaign(0, &length);
+	if (!checkpoint)
+		WARNING_MSG("Failed to take a snapshot of the campaign for the checkpoint");
+	else if (checkpoint_writer_submit(checkpoint_writer, checkpoint, length)) {
+		WARNING_MSG("The last checkpoint is still being written, skipping this one");
+		free(checkpoint);
+	}
+	PHASE_END(PHASE_SAVE);
+}
+
+/**
+ * This function gets the CPU that a worker is pinned to, when the workers are pinned (-A).
+ * @param worker_id - the id of the worker to get the CPU of
+ * @return - the index of the CPU, as pin_thread_to_cpu takes it
+ */
+static int worker_cpu(int worker_id)
+{
+	if (cpu_order)
+		return cpu_order[(first_cpu + worker_id) % cpu_order_count];
+	return first_cpu + worker_id;
+}
+
+/**
+ * This function pins the calling thread to a worker's CPU, when the workers are pinned (-A).
+ * Memory is placed in the NUMA node of the CPU that first touches it, so the thread creating
+ * a worker's state is pinned to the worker's CPU too, and the worker's buffers and coverage
+ * maps end up in the memory nearest the CPU that uses them.
+ * @param worker_id - the id of the worker whose CPU the calling thread should run on
+ */
+static void pin_worker_cpu(int worker_id)
+{
+	if (first_cpu >= 0 && pin_thread_to_cpu(worker_cpu(worker_id)))
+		WARNING_MSG("Failed to pin worker %d to a CPU", worker_id);
+}
+
+/**
+ * This function gets the crash hash of a worker's last run, from the executor's result in remote mode, or else
+ * from the worker's instrumentation.
+ * @param worker - the worker that ran the crashing input
+ * @param crash_hash - used to return the crash hash
+ * @return - zero on success, non-zero if the crash couldn't be hashed
+ */
+static int get_worker_crash_hash(worker_t * worker, uint64_t * crash_hash)
+{
+	if (worker->remote_result) {
+		*crash_hash = worker->remote_result->crash_hash;
+		return !worker->remote_result->has_crash_hash;
+	}
+	if (!instrumentation->get_crash_hash)
+		return 1;
+	return instrumentation->get_crash_hash(worker->instrumentation_state, crash_hash);
+}
+
+/**
+ * This function tests an input that timed out again, with the worker's driver's timeout escalated, to check
+ * whether it really hangs or only ran slowly, e.g. because the host was busy.  The worker's round results
+ * are replaced with the results of the second run.
+ * @param worker - the worker that tested the input
+ * @param input - the input that timed out
+ * @param length - the length of the input parameter
+ * @param round - the results of the run that timed out, which are replaced with the second run's results
+ * @return - the driver's FUZZ_ result for the second run, or FUZZ_HANG if the input couldn't be tested again
+ */
+static int verify_hang(worker_t * worker, char * input, int length, instrumentation_round_result_t * round)
+{
+	instrumentation_round_result_t verified;
+	int fuzz_result;
+
+	if (driver_escalate_timeout(worker->driver, hang_verify_multiplier))
+		return FUZZ_HANG;
+	fuzz_result = worker->driver->test_input(worker->driver->state, input, length);
+	driver_escalate_timeout(worker->driver, 0);
+	worker->stats->execs++;
+	if (fuzz_result < 0 || finish_worker_round(worker, fuzz_result, &verified) || verified.new_path < 0)
+		return FUZZ_HANG;
+
+	if (fuzz_result != FUZZ_HANG) {
+		DEBUG_MSG("Worker %d's input that timed out finished with a longer timeout, not saving it", worker->id);
+		worker->stats->unconfirmed_hangs++;
+	}
+	*round = verified;
+	return fuzz_result;
+}
+
+/**
+ * This function counts a tested input in the worker's stats if it crashed, hung, or found a new path,
+ * and decides which output directory it should be saved in.
+ * @param worker - the worker that tested the input
+ * @param fuzz_result - the driver's FUZZ_ result for the input
+ * @param new_path - the instrumentation's is_new_path result for the input
+ * @return - the output directory to save the input in, or NULL if it shouldn't be saved
+ */
+static char * classify_finding(worker_t * worker, int fuzz_result, int new_path)
+{
+	uint64_t crash_hash;
+	char * directory = NULL;
+
+	if (fuzz_result == FUZZ_CRASH) {
+		directory = "crashes";
+		CRITICAL_MSG("Found %s", directory);
+		worker->stats->crashes++;
+		worker->stats->last_crash_ms = get_time_ms();
+		if (crash_bucket_size && !get_worker_crash_hash(worker, &crash_hash)
+			&& !findings_store_bucket_crash(findings, crash_hash)) {
+			DEBUG_MSG("Not saving the crash, its bucket %016llx is full", (unsigned long long)crash_hash);
+			directory = NULL;
+		}
+	} else if (fuzz_result == FUZZ_HANG) {
+		directory = "hangs";
+		ERROR_MSG("Found %s", directory);
+		worker->stats->hangs++;
+		worker->stats->last_hang_ms = get_time_ms();
+	} else if (new_path > 0) {
+		directory = "new_paths";
+		INFO_MSG("Found %s", directory);
+		worker->stats->new_paths++;
+		worker->stats->last_path_ms = get_time_ms();
+	}
+	return directory;
+}
+
+/**
+ * This function raises the cost maxima of slow input mode (-f) with a run that finished normally, and counts
+ * the run in the worker's stats if it was a slow input.  The runs that crashed, hung, or found a new path
+ * are saved as those instead.  It must be called before anything else is run, since it reads the run's
+ * coverage map.
+ * @param worker - the worker that tested the input
+ * @param fuzz_result - the driver's FUZZ_ result for the input
+ * @param round - the results of the run
+ * @param directory - the output directory that classify_finding picked for the input, or NULL
+ * @return - the output directory to save the input in, or NULL if it shouldn't be saved
+ */
+static char * classify_slow_input(worker_t * worker, int fuzz_result, instrumentation_round_result_t * round,
+	char * directory)
+{
+	const uint8_t * trace_bits;
+	size_t trace_size;
+	int slow;
+
+	if (!slow_inputs || fuzz_result != FUZZ_NONE)
+		return directory;
+	get_worker_trace_bits(worker, &trace_bits, &trace_size);
+	slow = slow_inputs_update(slow_inputs, trace_bits, trace_size, round_cost(round), round->exec_max_rss_kb);
+	if (slow < 0)
+		WARNING_MSG("Failed to update the slow input mode's cost maxima");
+	if (slow <= 0 || directory)
+		return directory;
+	INFO_MSG("Found %s input (cost %llu, peak RSS %llu KB)", SLOW_INPUTS_DIRECTORY,
+		(unsigned long long)round_cost(round), (unsigned long long)round->exec_max_rss_kb);
+	worker->stats->slow_inputs++;
+	return SLOW_INPUTS_DIRECTORY;
+}
+
+/**
+ * This function runs the inputs that the other fuzzers sharing the sync directory found, and that this
+ * fuzzer hasn't seen yet, if it's time for another import.  The inputs that find new paths here too are
+ * added to the corpus and saved in the new_paths directory, and the ones that crash or hang here are saved
+ * like the fuzzer's own.  It must be called from the first worker's thread.
+ * @param worker - the first worker, which runs the imported inputs
+ */
+static void import_synced_inputs(worker_t * worker)
+{
+	instrumentation_round_result_t round;
+	int fuzz_result, imported = 0, tested = 0;
+	uint64_t now = get_time_ms();
+	const uint8_t * trace_bits;
+	size_t length, trace_size;
+	char * input, * directory;
+
+	if (now < next_import_ms)
+		return;
+	next_import_ms = now + INSTANCE_SYNC_INTERVAL_MS;
+
+	while ((input = instance_sync_next(instance_sync, &length)) != NULL)
+	{
+		tested++;
+		fuzz_result = worker->driver->test_input(worker->driver->state, input, length);
+		worker->stats->execs++;
+
+		//The inputs that crash or hang here are saved too, e.g. the ones the concolic side worker solved for
+		if ((fuzz_result == FUZZ_CRASH || fuzz_result == FUZZ_HANG)
+			&& (directory = classify_finding(worker, fuzz_result, 0)) != NULL) {
+			queue_output(directory, input, (int)length, NULL);
+			continue;
+		}
+		if (fuzz_result != FUZZ_NONE || finish_worker_round(worker, fuzz_result, &round) || round.new_path <= 0) {
+			free(input);
+			continue;
+		}
+
+		imported++;
+		worker->stats->new_paths++;
+		worker->stats->last_path_ms = get_time_ms();
+		get_worker_trace_bits(worker, &trace_bits, &trace_size);
+		if (corpus_add(corpus, input, length, round.has_path_hash ? &round.path_hash : NULL, round_cost(&round),
+			trace_bits, trace_size))
+			WARNING_MSG("Failed to add the imported input to the corpus");
+		queue_output("new_paths", input, (int)length, NULL);
+	}
+	if (tested)
+		INFO_MSG("Imported %d of the %d new inputs from the other fuzzers", imported, tested);
+}
+
+/**
+ * This function saves the trim runs that crashed, hung, or found a new path of their own, since the
+ * instrumentation won't report their novelty again.  It's the trim_finding_callback_t of trim_new_path.
+ * @param context - the worker that ran the trim
+ * @param input - the input that was run
+ * @param length - the length of input
+ * @param fuzz_result - the driver's FUZZ_ result for the run
+ * @param new_path - the instrumentation's is_new_path result for the run
+ */
+static void save_trim_finding(void * context, const char * input, size_t length, int fuzz_result, int new_path)
+{
+	worker_t * worker = (worker_t *)context;
+	instrumentation_round_result_t round;
+	const uint8_t * trace_bits;
+	char * directory, * buffer;
+	uint64_t path_hash, cost = 0;
+	size_t trace_size;
+
+	directory = classify_finding(worker, fuzz_result, new_path);
+	if (!directory)
+		return;
+	buffer = (char *)memdup((void *)input, length);
+	if (!buffer) {
+		ERROR_MSG("Unable to dump the trim input");
+		return;
+	}
+	//The trim has already finished the run, and finish_round just returns its results again
+	if (instrumentation->finish_round && !instrumentation->finish_round(worker->instrumentation_state, &round))
+		cost = round_cost(&round);
+	get_worker_trace_bits(worker, &trace_bits, &trace_size);
+	if (fuzz_result == FUZZ_NONE && corpus_add(corpus, buffer, length,
+		!instrumentation->get_path_hash(worker->instrumentation_state, &path_hash) ? &path_hash : NULL,
+		cost, trace_bits, trace_size))
+		WARNING_MSG("Failed to add the new path to the corpus");
+	queue_output(directory, buffer, (int)length, NULL);
+}
+
+/**
+ * This function trims an input that found a new path before it's added to the corpus, so long as the
+ * input's run was quick enough (under -g microseconds) that the trim runs don't slow down the fuzzing much.
+ * @param worker - the worker that found the new path
+ * @param input - the input that found the new path, which is trimmed in place
+ * @param length - a pointer to the length of input, which is updated to the trimmed length
+ * @param path_hash - the path hash of the input
+ * @param exec_us - how long the input's run took in microseconds, or 0 if the instrumentation doesn't know,
+ * in which case the average time of the worker's runs is used instead
+ */
+static void trim_new_path(worker_t * worker, char * input, int * length, uint64_t path_hash, uint64_t exec_us)
+{
+	size_t trimmed_length = *length;
+	int execs;
+
+	//The current run hasn't been counted yet
+	if (!exec_us)
+		exec_us = (get_time_ns() - fuzz_start_ns) / (worker->stats->execs + 1) / 1000;
+	if (!trim_max_exec_us || exec_us >= (uint64_t)trim_max_exec_us)
+		return;
+
+	if (trim_input(worker->driver, instrumentation, worker->instrumentation_state, input, &trimmed_length,
+		path_hash, save_trim_finding, worker, &execs))
+		WARNING_MSG("Failed to trim the new path");
+	worker->stats->execs += execs;
+	if (trimmed_length < (size_t)*length) {
+		DEBUG_MSG("Trimmed the new path from %d to %lu bytes in %d runs", *length, (unsigned long)trimmed_length, execs);
+		worker->trimmed_inputs++;
+		worker->trimmed_bytes += *length - trimmed_length;
+		*length = (int)trimmed_length;
+	}
+}
+
+/**
+ * This function waits before a worker is restarted, doubling the wait with each restart in a row so that a
+ * target or driver that keeps failing doesn't spin.  It wakes up early if the workers are stopping.
+ * @param worker - the worker that is being restarted
+ */
+static void worker_restart_backoff(worker_t * worker)
+{
+	int delay_ms = WORKER_RESTART_BACKOFF_MS, i;
+
+	for (i = 1; i < worker->consecutive_restarts && delay_ms < WORKER_RESTART_MAX_BACKOFF_MS; i++)
+		delay_ms *= 2;
+	if (delay_ms > WORKER_RESTART_MAX_BACKOFF_MS)
+		delay_ms = WORKER_RESTART_MAX_BACKOFF_MS;
+
+	for (; delay_ms > 0 && !stop_workers; delay_ms -= WORKER_RESTART_BACKOFF_MS)
+		sleep_ms(WORKER_RESTART_BACKOFF_MS);
+}
+
+/**
+ * This function recreates a worker's instrumentation state and driver after one of them failed.  The
+ * instrumentation's state is saved first, so the new instrumentation state keeps the coverage that the worker
+ * has found, and the new driver is created through the driver factory with the worker's original options.
+ * It must be called from the worker's own thread.
+ * @param worker - the worker to restart
+ * @return - zero on success, or non-zero if the worker couldn't be recreated and should stop
+ */
+static int restart_worker(worker_t * worker)
+{
+	char * state;
+	size_t state_length = 0;
+	void * instrumentation_state;
+	driver_t * driver;
+
+	if (worker->consecutive_restarts >= max_worker_restarts)
+		return 1;
+	worker->consecutive_restarts++;
+	worker_restart_backoff(worker);
+	if (stop_workers)
+		return 1;
+	WARNING_MSG("Restarting worker %d (restart %d of %d in a row)", worker->id, worker->consecutive_restarts,
+		max_worker_restarts);
+
+	//The driver is cleaned up first, since it may still be using the instrumentation state
+	state = instrumentation_save_state(instrumentation, worker->instrumentation_state, 1, &state_length);
+	if (!state)
+		WARNING_MSG("Worker %d's instrumentation state couldn't be saved, its coverage will be lost", worker->id);
+	worker->driver->cleanup(worker->driver->state);
+	free(worker->driver);
+	worker->driver = NULL;
+	instrumentation->cleanup(worker->instrumentation_state);
+	worker->instrumentation_state = NULL;
+
+	instrumentation_state = instrumentation_create_with_state(instrumentation, restart_instrumentation_options,
+		state, state_length);
+	if (state)
+		instrumentation->free_state(state);
+	if (!instrumentation_state) {
+		ERROR_MSG("Failed to recreate the instrumentation state for worker %d", worker->id);
+		return 1;
+	}
+	worker->instrumentation_state = instrumentation_state;
+
+	//The worker keeps its own test file or port, since the driver is made for the same worker index
+	driver = driver_worker_factory(restart_driver_name, restart_driver_options, worker->id, instrumentation,
+		instrumentation_state, restart_driver_mutator, worker->mutator_state ? worker->mutator_state : mutator_state);
+	if (!driver) {
+		ERROR_MSG("Failed to recreate the driver for worker %d", worker->id);
+		return 1;
+	}
+	worker->driver = driver;
+	worker->stats->worker_restarts++;
+	return 0;
+}
+
+/**
+ * This function restarts a worker whose driver or instrumentation failed, so that it can retry the iteration
+ * that failed rather than stopping the campaign.  In pipelined mode, the failed input's buffer is handed back
+ * to the mutate thread, which mutates a new input in it.
+ * @param worker - the worker that failed
+ * @param slot - in pipelined mode, a pointer to the index of the worker's buffer that failed
+ * @return - zero if the worker was restarted and should keep fuzzing, or non-zero if it should stop
+ */
+static int retry_worker_iteration(worker_t * worker, int * slot)
+{
+	if (restart_worker(worker))
+		return 1;
+	abandon_iteration();
+	if (pipelined) {
+		*slot = !*slot;
+		release_semaphore(worker->free_buffers);
+	}
+	return 0;
+}
+
+/**
+ * This function runs the main fuzz loop for a single worker, until the requested number of
+ * iterations have been run, the mutator runs out of mutations, or an error occurs that restarting
+ * the worker's driver and instrumentation doesn't fix.
+ * @param arg - a pointer to the worker_t to run the fuzz loop for
+ */
+static THREAD_FUNC(fuzz_worker)
+{
+	worker_t * worker = (worker_t *)arg;
+	driver_t * driver = worker->driver;
+	instrumentation_round_result_t round;
+	int fuzz_result, new_path, has_path_hash, slow_input, mutate_length = 0, local_iteration = 0, slot = 0;
+	uint64_t path_hash;
+	char * mutate_buffer, * input = NULL, * directory, * lineage, * hang_input;
+	const char * last_input;
+	const uint8_t * trace_bits;
+	uint8_t * trace_copy;
+	size_t trace_size;
+
+	phase_timing_current = worker->timing;
+	lineage_current = record_lineage ? &worker->lineage : NULL;
+	pin_worker_cpu(worker->id);
+	if (pipelined && create_thread(&worker->mutate_thread, pipeline_mutator, worker)) {
+		ERROR_MSG("Failed to start the mutate thread for worker %d", worker->id);
+		end_iteration(0);
+		THREAD_RETURN;
+	}
+
+	//Copy the input, mutate it, and run the fuzzed program
+	while (1)
+	{
+		PHASE_BEGIN(PHASE_ITERATION);
+		TRACEPOINT_ITERATION_START(worker->id, local_iteration);
+		fuzz_result = test_worker_input(worker, &slot, &input, &mutate_length);
+		if (fuzz_result == PIPELINE_DONE)
+			break;
+		DEBUG_MSG("Worker %d fuzzed the %d iteration", worker->id, local_iteration);
+
+		if (fuzz_result < 0)
+		{
+			update_instrumentation_counters(worker);
+			if(fuzz_result == -2)
+				WARNING_MSG("The mutator has run out of mutations to test after %d iterations", iterations_finished);
+			else
+				ERROR_MSG("The driver failed to test the target program, fuzz_result was %d",fuzz_result);
+			if (worker->driver_failed && !retry_worker_iteration(worker, &slot)) {
+				driver = worker->driver;
+				continue;
+			}
+			end_iteration(0);
+			break;
+		}
+
+		PHASE_BEGIN(PHASE_IS_NEW_PATH);
+		if (finish_worker_round(worker, fuzz_result, &round))
+			round.new_path = -1;
+		new_path = round.new_path;
+		PHASE_END(PHASE_IS_NEW_PATH);
+		TRACEPOINT_NOVELTY_DECIDED(worker->id, fuzz_result, new_path);
+		if (new_path < 0)
+		{
+			update_instrumentation_counters(worker);
+			ERROR_MSG("The instrumentation failed to determine the fuzzed process's fuzz_result");
+			if (!retry_worker_iteration(worker, &slot)) {
+				driver = worker->driver;
+				continue;
+			}
+			end_iteration(0);
+			break;
+		}
+
+		//Test the inputs that timed out again with a longer timeout, so that the ones which only ran slowly aren't
+		//saved as hangs.  The input is copied first, since the driver's buffer may be reused by the second run.
+		hang_input = NULL;
+		if (fuzz_result == FUZZ_HANG && hang_verify_multiplier > 0) {
+			mutate_buffer = NULL;
+			last_input = pipelined ? input : driver_peek_last_input(driver, &mutate_length, &mutate_buffer);
+			hang_input = mutate_buffer ? mutate_buffer : last_input ? (char *)memdup((void *)last_input, mutate_length) : NULL;
+			if (hang_input) {
+				fuzz_result = verify_hang(worker, hang_input, mutate_length, &round);
+				new_path = round.new_path;
+			}
+		}
+
+		//Tell the corpus's power schedule which path the input took
+		has_path_hash = round.has_path_hash;
+		path_hash = round.path_hash;
+		if (corpus && has_path_hash)
+			corpus_record_path(corpus, path_hash);
+
+		//Let the mutator adapt to how its mutation fared
+		if (mutator->report_result)
+			mutator->report_result(worker->mutator_state ? worker->mutator_state : mutator_state,
+				fuzz_result, new_path, has_path_hash ? &path_hash : NULL);
+
+		directory = classify_finding(worker, fuzz_result, new_path);
+		directory = classify_slow_input(worker, fuzz_result, &round, directory);
+		slow_input = directory && !strcmp(directory, SLOW_INPUTS_DIRECTORY);
+
+		//Hand the tested input to the output writer, which needs its own copy since
+		//the tested buffer is reused for the next input
+		if (directory != NULL) {
+			PHASE_BEGIN(PHASE_SAVE);
+			mutate_buffer = hang_input;
+			hang_input = NULL;
+			if (!mutate_buffer) {
+				if (pipelined)
+					last_input = input;
+				else
+					last_input = driver_peek_last_input(driver, &mutate_length, &mutate_buffer);
+				if (last_input && !mutate_buffer)
+					mutate_buffer = memdup((void *)last_input, mutate_length);
+			}
+			if (!mutate_buffer)
+				ERROR_MSG("Unable to dump mutate buffer\n");
+			else {
+				//The trim runs overwrite the coverage map, so the corpus gets a copy of this run's map
+				trace_copy = NULL;
+				if (corpus && fuzz_result == FUZZ_NONE) {
+					get_worker_trace_bits(worker, &trace_bits, &trace_size);
+					if (trace_bits)
+						trace_copy = (uint8_t *)memdup((void *)trace_bits, trace_size);
+				}
+				if (recheck_new_paths && fuzz_result == FUZZ_NONE && !slow_input)
+					recheck_new_path(worker, mutate_buffer, mutate_length);
+				//A trimmed input couldn't be regenerated from its lineage, so the new paths aren't trimmed with -R.
+				//The slow inputs aren't trimmed either, since the trim only keeps their path, not their cost.
+				if (corpus && fuzz_result == FUZZ_NONE && has_path_hash && !record_lineage && !slow_input)
+					trim_new_path(worker, mutate_buffer, &mutate_length, path_hash, round.exec_us);
+				if (corpus && fuzz_result == FUZZ_NONE && corpus_add(corpus, mutate_buffer, mutate_length,
+					has_path_hash ? &path_hash : NULL, round_cost(&round), trace_copy, trace_copy ? trace_size : 0))
+					WARNING_MSG("Failed to add the new path to the corpus");
+				free(trace_copy);
+				lineage = NULL;
+				if (record_lineage && fuzz_result == FUZZ_NONE && worker->lineage.valid)
+					lineage = lineage_encode(&worker->lineage, lineage_mutator_name, lineage_mutator_options);
+				queue_output(directory, mutate_buffer, mutate_length, lineage);
+				TRACEPOINT_FINDING_SAVED(directory, mutate_length);
+			}
+			PHASE_END(PHASE_SAVE);
+		}
+		free(hang_input);
+
+		//Hand the tested buffer back to the mutate thread
+		if (pipelined) {
+			slot = !slot;
+			release_semaphore(worker->free_buffers);
+		}
+
+		end_iteration(1);
+		worker->stats->execs++;
+		worker->consecutive_restarts = 0;
+		update_instrumentation_counters(worker);
+		PHASE_END(PHASE_ITERATION);
+		local_iteration++;
+		if (local_iteration % WORKER_SYNC_INTERVAL == 0)
+			sync_worker_coverage(worker);
+		if (corpus_checkpoint_file && worker->id == 0 && local_iteration % CORPUS_CHECKPOINT_INTERVAL == 0
+			&& corpus_save(corpus, corpus_checkpoint_file))
+			WARNING_MSG("Failed to save the corpus checkpoint %s", corpus_checkpoint_file);
+		if (checkpoint_writer && worker->id == 0)
+			checkpoint_campaign();
+		if (instance_sync && worker->id == 0)
+			import_synced_inputs(worker);
+	}
+
+	if (pipelined) {
+		//Wake the mutate thread if it is waiting for a free buffer, so that it sees the workers stopping
+		release_semaphore(worker->free_buffers);
+		join_thread(worker->mutate_thread);
+	}
+
+	THREAD_RETURN;
+}
+
+/**
+ * This function runs the fuzz loop for a worker in remote mode (-X), until the requested number of iterations
+ * have been run, the mutator runs out of mutations, or an error occurs.  The worker mutates a batch of inputs,
+ * runs them on its executor, and then handles their results like fuzz_worker does, except that the new paths
+ * are decided by the global virgin map of every executor's inputs.
+ * @param arg - a pointer to the worker_t to run the fuzz loop for
+ */
+static THREAD_FUNC(remote_fuzz_worker)
+{
+	worker_t * worker = (worker_t *)arg;
+	executor_result_t * result;
+	const uint8_t * trace_bits;
+	uint32_t map_size;
+	int count, length, new_path, i, done = 0, local_iteration = 0;
+	char * directory, * buffer;
+
+	pin_worker_cpu(worker->id);
+	while (!done)
+	{
+		for (count = 0; count < remote->batch_size && start_iteration(); count++)
+		{
+			if (worker->mutator_state)
+				length = mutator->mutate_extended(worker->mutator_state, worker->batch_inputs[count], worker->buffer_length, 0);
+			else
+				length = thread_safe_mutate_extended(mutator_state, worker->batch_inputs[count], worker->buffer_length, 0);
+			if (length <= 0) {
+				if (length == 0)
+					WARNING_MSG("The mutator has run out of mutations to test after %d iterations", iterations_finished);
+				else
+					ERROR_MSG("The mutator failed to mutate the input");
+				end_iteration(0);
+				done = 1;
+				break;
+			}
+			worker->batch_lengths[count] = length;
+		}
+		if (!count)
+			break;
+
+		if (remote_executor_run(worker->executor, worker->batch_inputs, worker->batch_lengths, count,
+			worker->batch_results, &map_size)) {
+			end_iteration(0);
+			break;
+		}
+		DEBUG_MSG("Worker %d ran a batch of %d inputs on the executor at %s", worker->id, count, worker->executor->address);
+
+		for (i = 0; i < count && !done; i++)
+		{
+			result = &worker->batch_results[i];
+			if (result->fuzz_result < 0) {
+				ERROR_MSG("The executor at %s failed to test the target program, fuzz_result was %d",
+					worker->executor->address, result->fuzz_result);
+				end_iteration(0);
+				done = 1;
+				break;
+			}
+			trace_bits = remote_executor_trace(worker->executor, result, map_size);
+			new_path = remote_coverage_is_new_path(remote_coverage, result, trace_bits, map_size);
+
+			if (corpus && result->has_path_hash)
+				corpus_record_path(corpus, result->path_hash);
+			if (mutator->report_result)
+				mutator->report_result(worker->mutator_state ? worker->mutator_state : mutator_state,
+					result->fuzz_result, new_path, result->has_path_hash ? &result->path_hash : NULL);
+
+			worker->remote_result = result;
+			directory = classify_finding(worker, result->fuzz_result, new_path);
+			worker->remote_result = NULL;
+			if (directory != NULL) {
+				length = worker->batch_lengths[i];
+				buffer = (char *)memdup(worker->batch_inputs[i], length);
+				if (!buffer)
+					ERROR_MSG("Unable to dump mutate buffer\n");
+				else {
+					if (corpus && result->fuzz_result == FUZZ_NONE && corpus_add(corpus, buffer, length,
+						result->has_path_hash ? &result->path_hash : NULL,
+						result->exec_instructions ? result->exec_instructions : result->exec_us,
+						trace_bits, trace_bits ? map_size : 0))
+						WARNING_MSG("Failed to add the new path to the corpus");
+					queue_output(directory, buffer, length, NULL);
+				}
+			}
+
+			end_iteration(1);
+			worker->stats->execs++;
+			local_iteration++;
+			if (corpus_checkpoint_file && worker->id == 0 && local_iteration % CORPUS_CHECKPOINT_INTERVAL == 0
+				&& corpus_save(corpus, corpus_checkpoint_file))
+				WARNING_MSG("Failed to save the corpus checkpoint %s", corpus_checkpoint_file);
+		}
+	}
+
+	THREAD_RETURN;
+}
+
+/**
+ * This function sets up a worker for remote mode (-X), by allocating the buffers of its batches and connecting
+ * to its executor.
+ * @param worker - the worker to set up
+ * @param address - the "host[:port]" address of the worker's executor
+ * @param driver_name - the name of the driver the executor should run the inputs with
+ * @param driver_options - the options of the driver
+ * @param instrumentation_name - the name of the instrumentation the executor should run the inputs with
+ * @param instrumentation_options - the options of the instrumentation
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_remote_worker(worker_t * worker, const char * address, char * driver_name, char * driver_options,
+	char * instrumentation_name, char * instrumentation_options)
+{
+	int num_inputs, i;
+	size_t * input_sizes;
+
+	mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
+	if (num_inputs != 1) {
+		free(input_sizes);
+		ERROR_MSG("Running the inputs on executors only supports mutators with a single input");
+		return 1;
+	}
+
+	worker->batch_inputs = (char **)calloc(remote->batch_size, sizeof(char *));
+	worker->batch_lengths = (int *)calloc(remote->batch_size, sizeof(int));
+	worker->batch_results = (executor_result_t *)calloc(remote->batch_size, sizeof(executor_result_t));
+	if (!worker->batch_inputs || !worker->batch_lengths || !worker->batch_results) {
+		free(input_sizes);
+		return 1;
+	}
+	for (i = 0; i < remote->batch_size; i++)
+	{
+		if (setup_mutate_buffer(PIPELINE_BUFFER_RATIO, input_sizes[0], &worker->batch_inputs[i], &worker->buffer_length)) {
+			free(input_sizes);
+			return 1;
+		}
+	}
+	free(input_sizes);
+
+	worker->executor = remote_executor_connect(address, driver_name, driver_options, instrumentation_name,
+		instrumentation_options);
+	return !worker->executor;
+}
+
+/**
+ * This function sets up a worker's buffers for pipelined mode.
+ * @param worker - the worker to set up
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_pipeline(worker_t * worker)
+{
+	int num_inputs;
+	size_t * input_sizes;
+
+	mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
+	if (num_inputs != 1) {
+		free(input_sizes);
+		ERROR_MSG("Pipelined mode only supports mutators with a single input");
+		return 1;
+	}
+
+	if (setup_mutate_buffer(PIPELINE_BUFFER_RATIO, input_sizes[0], &worker->buffers[0], &worker->buffer_length)
+		|| setup_mutate_buffer(PIPELINE_BUFFER_RATIO, input_sizes[0], &worker->buffers[1], &worker->buffer_length)) {
+		free(input_sizes);
+		return 1;
+	}
+	free(input_sizes);
+
+	worker->free_buffers = create_semaphore(2, 2);
+	worker->ready_buffers = create_semaphore(0, 2);
+	return !worker->free_buffers || !worker->ready_buffers;
+}
+
+/**
+ * This function runs the calibration stage (see calibration.h) with the seed and the seeds from the seed
+ * directory, using a temporary driver and instrumentation state.  The instrumentation state is temporary
+ * too, since a fork server started for the temporary driver's command line (e.g. the file driver's test
+ * file) would keep running it after the driver is gone.  The calibrated hang timeout is added to the driver
+ * options, unless they already set one, and each worker's instrumentation state ignores the unstable bytes of
+ * the bitmap.  Without the hang verification (-H 0), the timeout is only added when it's longer than the
+ * drivers' default timeout.
+ * @param driver_name - the name of the driver to calibrate with
+ * @param driver_options - a pointer to the driver options, which is updated with the calibrated timeout
+ * @param instrumentation_options - the options to create the temporary instrumentation state with
+ * @param seed_buffer - the seed that the mutator was created with
+ * @param seed_length - the length of the seed_buffer parameter
+ * @param largest_seed - the index of the seed from the seed directory that seed_buffer is, or -1
+ * @param runs - the number of times to run each seed
+ */
+static void calibrate_seeds(char * driver_name, char ** driver_options, char * instrumentation_options,
+	char * seed_buffer, int seed_length, int largest_seed, int runs)
+{
+	char * inputs[CALIBRATION_MAX_SEEDS + 1];
+	size_t lengths[CALIBRATION_MAX_SEEDS + 1];
+	char * new_options, filename[MAX_PATH];
+	int num_inputs, i, found, timeout_ms;
+	calibration_t calibration;
+	driver_t * driver;
+	void * instrumentation_state;
+
+	instrumentation_state = instrumentation->create(instrumentation_options, NULL);
+	if (!instrumentation_state)
+		FATAL_MSG("Couldn't create the instrumentation state for calibration");
+	//The temporary driver is made for the first worker, whose driver is only created once it's gone
+	driver = driver_worker_factory(driver_name, *driver_options, 0, instrumentation, instrumentation_state,
+		mutator, mutator_state);
+	if (!driver)
+	{
+		instrumentation->cleanup(instrumentation_state);
+		return; //The real drivers report the bad options
+	}
+
+	//The seeds are copied, since the seed directory is mapped read only
+	inputs[0] = seed_buffer;
+	lengths[0] = seed_length;
+	num_inputs = 1;
+	for (i = 0; seeds && i < (int)seeds->count && num_inputs <= CALIBRATION_MAX_SEEDS; i++)
+	{
+		if (i == largest_seed)
+			continue;
+		inputs[num_inputs] = (char *)memdup((void *)seeds->seeds[i].data, seeds->seeds[i].length);
+		if (!inputs[num_inputs])
+			FATAL_MSG("Couldn't allocate the seeds for calibration");
+		lengths[num_inputs++] = seeds->seeds[i].length;
+	}
+
+	INFO_MSG("Calibrating the target with %d seeds, %d runs each", num_inputs, runs);
+	found = calibrate_target(driver, instrumentation, instrumentation_state, inputs, lengths,
+		num_inputs, runs, &calibration);
+	driver->cleanup(driver->state);
+	free(driver);
+	instrumentation->cleanup(instrumentation_state);
+	for (i = 1; i < num_inputs; i++)
+		free(inputs[i]);
+	if (found)
+		FATAL_MSG("Failed to calibrate the target");
+	if (calibration.runs)
+		INFO_MSG("Calibration runs took %.3f ms on average, and %.3f ms at most",
+			calibration.total_exec_ns / 1000000.0 / calibration.runs, calibration.max_exec_ns / 1000000.0);
+
+	//Use the calibrated timeout, unless the driver options already set one.  The hangs that are tested again
+	//with a longer timeout can have a tighter timeout, even below the default one, since the runs that only
+	//ran slowly because of the host's jitter won't be saved.  Without that, the default timeout is the floor,
+	//so a fast target's ordinary runs aren't saved as hangs
+	timeout_ms = calibration_timeout_ms(&calibration, hang_verify_multiplier > 0
+		? CALIBRATION_VERIFIED_TIMEOUT_MULTIPLIER : CALIBRATION_TIMEOUT_MULTIPLIER);
+	if (*driver_options)
+	{
+		get_int_options(*driver_options, "timeout", &found);
+		if (found <= 0)
+			get_int_options(*driver_options, "timeout_ms", &found);
+	}
+	else
+		found = 0;
+	if (timeout_ms && found <= 0 && hang_verify_multiplier <= 0 && timeout_ms <= DRIVER_DEFAULT_TIMEOUT * 1000)
+		INFO_MSG("Kept the default hang timeout of %d ms, which is longer than the %d ms from the calibration runs",
+			DRIVER_DEFAULT_TIMEOUT * 1000, timeout_ms);
+	else if (timeout_ms && found <= 0)
+	{
+		new_options = add_int_option_to_json(*driver_options ? *driver_options : "{}", "timeout_ms", timeout_ms);
+		if (!new_options)
+			FATAL_MSG("Couldn't add the calibrated timeout to the driver options");
+		free(*driver_options);
+		*driver_options = new_options;
+		INFO_MSG("Set the hang timeout to %d ms from the calibration runs", timeout_ms);
+	}
+
+	if (calibration.unstable_bytes)
+	{
+		INFO_MSG("Found %lu unstable bytes out of the %lu bitmap bytes the seeds hit (%.2f%% stability)",
+			(unsigned long)calibration.unstable_count, (unsigned long)calibration.covered_count,
+			calibration.covered_count ? 100.0 * (calibration.covered_count - calibration.unstable_count)
+				/ calibration.covered_count : 100.0);
+		if (calibration.unstable_count)
+		{
+			for (i = 0; i < num_workers; i++)
+			{
+				if (instrumentation->ignore_unstable_bytes(workers[i].instrumentation_state, calibration.unstable_bytes,
+					calibration.map_size))
+					WARNING_MSG("Worker %d's instrumentation can't ignore the unstable bytes", i);
+				//The rechecks of the new paths only count the unstable bytes that calibration didn't find
+				workers[i].unstable_bytes = (uint8_t *)memdup(calibration.unstable_bytes, calibration.map_size);
+				workers[i].unstable_size = workers[i].unstable_bytes ? calibration.map_size : 0;
+			}
+			snprintf(filename, sizeof(filename), "%s/" CALIBRATION_UNSTABLE_BYTES_FILENAME, output_directory);
+			if (write_buffer_to_file(filename, (char *)calibration.unstable_bytes, calibration.map_size))
+				WARNING_MSG("Failed to write the unstable bytes to %s", filename);
+		}
+	}
+	calibration_free(&calibration);
+}
+
+/**
+ * This function writes the unstable bytes of the bitmap to the unstable bytes file in the output directory, if
+ * the rechecks of the new paths found more of them than the calibration did.  Each worker's unstable bytes are
+ * merged into those of the worker with the largest bitmap, and the workers with other bitmap sizes are skipped.
+ */
+static void save_unstable_bytes(void)
+{
+	char filename[MAX_PATH];
+	uint64_t found = 0;
+	int i, largest = 0;
+	size_t j, count = 0;
+
+	for (i = 0; i < num_workers; i++) {
+		found += workers[i].unstable_found;
+		if (workers[i].unstable_size > workers[largest].unstable_size)
+			largest = i;
+	}
+	if (!found)
+		return;
+
+	for (i = 0; i < num_workers; i++) {
+		if (i == largest || workers[i].unstable_size != workers[largest].unstable_size)
+			continue;
+		for (j = 0; j < workers[i].unstable_size; j++)
+			workers[largest].unstable_bytes[j] |= workers[i].unstable_bytes[j];
+	}
+	for (j = 0; j < workers[largest].unstable_size; j++)
+		count += workers[largest].unstable_bytes[j] != 0;
+	INFO_MSG("Found %lu unstable bytes of the bitmap, counting the ones that rechecking the new paths found",
+		(unsigned long)count);
+	snprintf(filename, sizeof(filename), "%s/" CALIBRATION_UNSTABLE_BYTES_FILENAME, output_directory);
+	if (write_buffer_to_file(filename, (char *)workers[largest].unstable_bytes, workers[largest].unstable_size))
+		WARNING_MSG("Failed to write the unstable bytes to %s", filename);
+}
+
+#define PRINT_HELP(x) \
+		puts(x);      \
+		free(x);
+
+//The startup profiling state
+static int profile_startup = 0;
+static uint64_t startup_begin_ms = 0;
+static uint64_t startup_step_ms = 0;
+
+/**
+ * This function logs how long a step of the fuzzer's startup took, when the startup is being profiled.
+ * @param name - the name of the step that just finished
+ */
+static void startup_step(const char * name)
+{
+	uint64_t now = get_time_ms();
+
+	if (profile_startup)
+		INFO_MSG("Startup: %s took %llu ms", name, (unsigned long long)(now - startup_step_ms));
+	startup_step_ms = now;
+}
+
+#define JOB_LINE_MAX (64 * 1024)
+//How often the daemon checks whether the running job is done, while it waits for the next job
+#define JOB_POLL_MS 100
+
+//The pipe that a job started by the daemon (-D) waits on before it starts fuzzing, or -1 if it doesn't wait
+static int job_start_gate = -1;
+
+#ifndef _WIN32
+//The job lines the daemon has read from the job pipe, but not handled yet
+typedef struct job_reader
+{
+	int fd;
+	char * data;
+	size_t length;
+} job_reader_t;
+
+/**
+ * This function reads the next line from the daemon's job pipe.  A line longer than the buffer is split.
+ * @param reader - the job pipe's reader
+ * @param line - the buffer to copy the line into, without its newline, which should be JOB_LINE_MAX bytes
+ * @param timeout_ms - how long to wait for a line, or -1 to wait until there is one
+ * @return - 1 if a line was read, 0 if there wasn't a whole line before the timeout, or -1 on failure
+ */
+static int read_job_line(job_reader_t * reader, char * line, int timeout_ms)
+{
+	struct pollfd pipe_poll;
+	size_t length;
+	ssize_t result;
+	char * end;
+
+	while (1)
+	{
+		end = (char *)memchr(reader->data, '\n', reader->length);
+		if (end || reader->length == JOB_LINE_MAX - 1) {
+			length = end ? (size_t)(end - reader->data) : reader->length;
+			memcpy(line, reader->data, length);
+			line[length] = 0;
+			if (end)
+				length++;
+			reader->length -= length;
+			memmove(reader->data, reader->data + length, reader->length);
+			return 1;
+		}
+		if (timeout_ms >= 0) {
+			pipe_poll.fd = reader->fd;
+			pipe_poll.events = POLLIN;
+			result = poll(&pipe_poll, 1, timeout_ms);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+				return (int)result;
+		}
+		result = read(reader->fd, reader->data + reader->length, JOB_LINE_MAX - 1 - reader->length);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return -1;
+		reader->length += result;
+	}
+}
 
-#include <signal.h>
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-#include <time.h>
+/**
+ * This function checks whether a job's child is done, and logs how it finished
+ * @param child - the job's child
+ * @param job - the job's number
+ * @param wait - whether to wait for the child to be done
+ * @return - 1 if the child is done or couldn't be waited for, 0 if it's still running
+ */
+static int job_finished(pid_t child, int job, int wait)
+{
+	pid_t ret;
+	int status;
+
+	ret = waitpid(child, &status, wait ? 0 : WNOHANG);
+	if (!ret)
+		return 0;
+	if (ret < 0)
+		printf("Job %d: couldn't wait for the job\n", job);
+	else if (WIFEXITED(status))
+		printf("Job %d: exited with %d\n", job, WEXITSTATUS(status));
+	else
+		printf("Job %d: killed by signal %d\n", job, WTERMSIG(status));
+	fflush(stdout);
+	return 1;
+}
+#endif
 
 /**
- * This function prints out the usage information for the fuzzer and each of the individual components
- * @param program_name - the name of the program currently being run (for use in the outputted message)
- * @param mutator_directory - the directory to look for mutators in, when printing out the mutator help information
+ * This function holds back a job that the daemon (-D) started while another job was running, once its startup
+ * is done, until the daemon opens its start gate.  The stats' start time is then reset, so the job's exec
+ * speed doesn't count the time it waited.
  */
-void usage(char * program_name, char * mutator_directory)
+static void wait_for_job_start(void)
 {
-	printf(
-"\n"
-"Usage: %s\n"
-"         [options] driver_name instrumentation_name mutator_name\n"
-"\n"
-"Options:\n"
-"  -d driver_options              JSON filename with options for the driver\n"
-"  -hd                            Get help text about drivers\n"
-"  -hi                            Get help text about instrumentation\n"
-"  -hl                            Get help text about logging\n"
-"  -hm                            Get help text about mutators\n"
-"  -i instrumentation_options     JSON filename with options for the instrumentation\n"
-"  -j instrumentation_state_file  Set the file that the instrumentation state should dump to\n"
-"  -k instrumentation_state_file  Set the file that the instrumentation state should load from\n"
-"  -l logging_options             JSON filename with options for logging\n"
-"  -m mutator_options             JSON filename with options for the mutator\n"
-"  -n num_iterations              Limit the number of iterations to run\n"
-"                                   (optional, infinite by default)\n"
-"  -o output_directory            The directory to write files which cause a\n"
-"                                   crash or hang\n"
-"  -p mutator_directory           The directory to look for mutator DLLs in\n"
-"                                   (must be specified to view help for\n"
-"                                   specific mutators)\n"
-"  -r mutator_state               Set the state that the mutator should load\n"
-"  -s seed                        The seed file to use\n"
-"  -t mutator_state_file          Set the file that the mutator state should dump to\n"
-"  -u mutator_state_file          Set the file that the mutator state should load from\n"
-"\n\n",
-		program_name
-	);
+#ifndef _WIN32
+	char go;
 
-	exit(1);
+	if (job_start_gate < 0)
+		return;
+	//The daemon closing the gate without writing to it, e.g. when it's killed, starts the job too
+	while (read(job_start_gate, &go, 1) < 0 && errno == EINTR);
+	close(job_start_gate);
+	job_start_gate = -1;
+	stats->start_time = (uint64_t)time(NULL) * 1000;
+	stats->start_time_ms = stats->last_execs_time = get_time_ms();
+	startup_begin_ms = startup_step_ms = stats->start_time_ms;
+#endif
 }
 
-//The global module state objects
-static driver_t * driver = NULL;
-static mutator_t * mutator = NULL;
-static void * mutator_state = NULL;
-static instrumentation_t * instrumentation = NULL;
-static void * instrumentation_state = NULL;
+/**
+ * This function counts the execs that all of the workers have run.
+ * @return - the total number of execs
+ */
+static uint64_t total_worker_execs(void)
+{
+	uint64_t execs = 0;
+	int i;
 
-static void cleanup_modules(void)
+	for (i = 0; i < num_workers; i++)
+		execs += workers[i].stats->execs;
+	return execs;
+}
+
+/**
+ * This function measures the workers' combined exec speed for one step of the autotune (-Z).  The first part of
+ * the step isn't measured, so the speed doesn't include a newly unparked worker starting its target.
+ * @return - the exec speed in execs per second, or 0 if the workers stopped during the step
+ */
+static uint64_t measure_autotune_step(void)
 {
-	if(driver)
-		driver->cleanup(driver->state);
-	if(instrumentation && instrumentation_state)
-		instrumentation->cleanup(instrumentation_state);
-	if(mutator && mutator_state)
-		mutator->cleanup(mutator_state);
-	free(driver);
-	free(instrumentation);
-	free(mutator);
+	uint64_t step_ms = (uint64_t)autotune_seconds * 1000, settle_ms = step_ms * AUTOTUNE_SETTLE_PERCENT / 100;
+	uint64_t start_ms, start_execs, elapsed_ms;
+
+	start_ms = get_time_ms();
+	while (get_time_ms() - start_ms < settle_ms && iterations_left())
+		sleep_ms(AUTOTUNE_POLL_MS);
+	start_ms = get_time_ms();
+	start_execs = total_worker_execs();
+	while (get_time_ms() - start_ms < step_ms - settle_ms && iterations_left())
+		sleep_ms(AUTOTUNE_POLL_MS);
+	elapsed_ms = get_time_ms() - start_ms;
+	if (!iterations_left() || !elapsed_ms)
+		return 0;
+	return (total_worker_execs() - start_execs) * 1000 / elapsed_ms;
 }
 
-static void sigint_handler(int sig)
+/**
+ * This function tunes how many of the workers fuzz (-Z).  It starts with the first worker, unparks one more
+ * at a time and measures the combined exec speed, and keeps the number of workers that was fastest.  The
+ * ramp stops once more workers stop paying off, which is where the target runs out of whatever it's limited
+ * by: the physical cores (the later workers only get SMT siblings when the workers are pinned), forking, the
+ * disk, or the trace bandwidth.  The workers past the best number stay parked for the rest of the run.
+ */
+static void autotune_workers(void)
 {
-	CRITICAL_MSG("CTRL-c detected, exiting\n");
-	cleanup_modules();
-	exit(0);
+	uint64_t speed, best_speed;
+	int count, best_count = 1, i;
+
+	best_speed = measure_autotune_step();
+	if (!best_speed)
+		return;
+	INFO_MSG("Autotune: 1 worker ran %llu execs/s", (unsigned long long)best_speed);
+	for (count = 2; count <= num_workers && iterations_left(); count++)
+	{
+		workers[count - 1].parked = 0;
+		stats->active_workers = count;
+		speed = measure_autotune_step();
+		if (!speed)
+			break;
+		INFO_MSG("Autotune: %d workers ran %llu execs/s, %llu us per exec per worker", count,
+			(unsigned long long)speed, (unsigned long long)(count * 1000000ULL / speed));
+		if (speed * 100 > best_speed * (100 + AUTOTUNE_MIN_GAIN_PERCENT)) {
+			best_speed = speed;
+			best_count = count;
+		}
+		else if (count - best_count >= AUTOTUNE_PATIENCE)
+			break;
+	}
+
+	for (i = best_count; i < num_workers; i++)
+		workers[i].parked = 1;
+	stats->active_workers = best_count;
+	INFO_MSG("Autotune: fuzzing with %d of the %d workers, which ran %llu execs/s", best_count, num_workers,
+		(unsigned long long)best_speed);
 }
 
-#define NUM_ITERATIONS_INFINITE -1
+/**
+ * This function runs the fuzzer as a resident daemon, which preloads the mutator libraries once and then
+ * runs the jobs that are written to a named pipe, one per line.  Each line has a working directory followed
+ * by the fuzzer's usual arguments.  A child is forked for each job, so the jobs start without loading the
+ * mutators again.  A line with "quit" stops the daemon once the jobs it's already read are done.
+ *
+ * The jobs are pipelined: a job that's read while another one is running is started right away, and does
+ * all of its startup (mapping its seeds, creating its instrumentation, starting its target's fork server,
+ * calibrating its seeds, and creating its drivers) alongside the running job.  It then waits at its start
+ * gate until the running job exits, and starts fuzzing with its caches warm.  At most one job waits at a
+ * time, so the next lines stay in the pipe until it starts.
+ * @param job_pipe - the named pipe to read the jobs from
+ * @param mutator_directory - the directory to preload the mutator libraries from
+ * @param argc - a pointer to main's argc, which is set to the job's argc in the job's child
+ * @param argv - a pointer to main's argv, which is set to the job's argv in the job's child
+ * @return - -1 in a job's child, which should go on to run the job, otherwise the daemon's exit code
+ */
+static int run_job_daemon(char * job_pipe, char * mutator_directory, int * argc, char *** argv)
+{
+#ifdef _WIN32
+	printf("The fuzzer daemon (-D) isn't supported on Windows\n");
+	return 1;
+#else
+	char * line, * executable, ** job_argv;
+	job_reader_t reader;
+	pid_t child, running = -1, next = -1;
+	int gate[2], next_gate = -1, job = 0, running_job = 0, next_job = 0, quit = 0, ret;
 
-#define PRINT_HELP(x) \
-		puts(x);      \
-		free(x);
+	line = (char *)malloc(JOB_LINE_MAX);
+	reader.data = (char *)malloc(JOB_LINE_MAX);
+	reader.length = 0;
+	if (!line || !reader.data) {
+		printf("Couldn't allocate the job buffer\n");
+		free(line);
+		free(reader.data);
+		return 1;
+	}
+	//The pipe is opened for writing too, so it stays open when the writers close it, rather than reading EOF
+	reader.fd = open(job_pipe, O_RDWR);
+	if (reader.fd < 0) {
+		printf("Couldn't open the job pipe %s\n", job_pipe);
+		free(line);
+		free(reader.data);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	printf("Preloaded %d mutator libraries, waiting for jobs on %s\n",
+		mutator_directory ? mutator_factory_preload(mutator_directory) : 0, job_pipe);
+	fflush(stdout);
+
+	while (1)
+	{
+		//Start the waiting job as soon as the running one is done
+		if (running < 0 && next > 0) {
+			//A job that failed during its startup has already closed its end
+			if (write(next_gate, "", 1) != 1 && errno != EPIPE)
+				printf("Job %d: couldn't open the job's start gate\n", next_job);
+			close(next_gate);
+			running = next;
+			running_job = next_job;
+			next = -1;
+		}
+		if (running < 0 && quit)
+			break;
+		//There's nothing more to read until the running job is done
+		if (running > 0 && (next > 0 || quit)) {
+			job_finished(running, running_job, 1);
+			running = -1;
+			continue;
+		}
+
+		ret = read_job_line(&reader, line, running > 0 ? JOB_POLL_MS : -1);
+		if (ret < 0) {
+			printf("Couldn't read the job pipe %s\n", job_pipe);
+			quit = 1;
+			continue;
+		}
+		if (!ret) {
+			if (job_finished(running, running_job, 0))
+				running = -1;
+			continue;
+		}
+		line[strcspn(line, "\r")] = 0;
+		if (!line[0])
+			continue;
+		if (!strcmp(line, "quit")) {
+			quit = 1;
+			continue;
+		}
+
+		job++;
+		if (running > 0 && pipe(gate)) {
+			printf("Job %d: couldn't create the job's start gate, it will start once job %d is done\n",
+				job, running_job);
+			job_finished(running, running_job, 1);
+			running = -1;
+		}
+		fflush(stdout);
+		child = fork();
+		if (child == 0) {
+			signal(SIGPIPE, SIG_DFL);
+			close(reader.fd);
+			free(reader.data);
+			if (running > 0) {
+				close(gate[1]);
+				job_start_gate = gate[0];
+			}
+			if (split_command_line(line, &executable, &job_argv) || !job_argv[0]) {
+				printf("Job %d: couldn't parse the job line\n", job);
+				exit(1);
+			}
+			if (chdir(job_argv[0])) {
+				printf("Job %d: couldn't change to the working directory %s\n", job, job_argv[0]);
+				exit(1);
+			}
+			free(executable);
+			free(job_argv[0]);
+			job_argv[0] = (*argv)[0];
+			for (*argc = 0; job_argv[*argc]; (*argc)++);
+			*argv = job_argv;
+			free(line);
+			return -1;
+		}
+		if (running > 0)
+			close(gate[0]);
+		if (child < 0) {
+			printf("Job %d: couldn't fork the job\n", job);
+			if (running > 0)
+				close(gate[1]);
+			continue;
+		}
+		if (running > 0) {
+			next = child;
+			next_job = job;
+			next_gate = gate[1];
+		} else {
+			running = child;
+			running_job = job;
+		}
+	}
+
+	close(reader.fd);
+	free(reader.data);
+	free(line);
+	return 0;
+#endif
+}
 
 int main(int argc, char ** argv)
 {
@@ -105,22 +2364,36 @@ int main(int argc, char ** argv)
 		*mutator_name, *mutator_options = NULL, *mutator_saved_state = NULL,
 		*mutation_state_dump_file = NULL, *mutation_state_load_file = NULL,
 		*mutate_buffer = NULL, *mutator_directory = NULL, *mutator_directory_cli = NULL,
-		*logging_options = NULL,
-		*seed_file = NULL, *seed_buffer = NULL,
+		*logging_options = NULL, *metrics_options = NULL,
+		*seed_file = NULL, *seed_buffer = NULL, *seed_directory = NULL,
 		*instrumentation_name = NULL, *instrumentation_options = NULL, 
 		*instrumentation_state_string = NULL, *instrumentation_state_load_file = NULL,
-		*instrumentation_state_dump_file = NULL;
-	int seed_length = 0, mutate_length = 0, instrumentation_length = 0, mutator_state_length;
+		*instrumentation_state_dump_file = NULL, *dictionary_file = NULL, *phase_timing_file = NULL,
+		*base_state = NULL, *sync_directory = NULL, *remote_options = NULL, *concolic_options = NULL;
+	int seed_length = 0, largest_seed = -1, instrumentation_length = 0, mutator_state_length, binary_state_dump = 0;
+	int use_uring = 0;
+	int delta_state_dump = 0, base_state_length = 0, instrumentation_state_mapped = 0, seed_mapped = 0;
+	int time_limit = 0, calibration_runs = CALIBRATION_DEFAULT_RUNS;
+	size_t state_length;
 	time_t fuzz_begin_time;
-	int i = 0, iteration = 0, fuzz_result = FUZZ_NONE, new_path = 0;
+	int i = 0;
 	char filename[MAX_PATH];
-	char filehash[256];
 	char c;
-	char * directory;
+	void * instrumentation_state;
+	mutator_t * driver_mutator;
+	binary_state_t * checkpoint = NULL;
+	char * checkpoint_buffer;
+	const char * checkpoint_section;
+	size_t checkpoint_section_length;
 
 	//Default options
-	int num_iterations = NUM_ITERATIONS_INFINITE; //default to infinite
-	char * output_directory = "output";
+	num_iterations = NUM_ITERATIONS_INFINITE; //default to infinite
+	startup_begin_ms = startup_step_ms = get_time_ms();
+
+#ifdef BUILTIN_MUTATORS
+	//This fuzzer was built with the mutators linked in, use them rather than the mutator libraries
+	builtin_mutators_register();
+#endif
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Mutator Setup /////////////////////////////////////////////////////////////////////////////////////
@@ -169,16 +2442,57 @@ int main(int argc, char ** argv)
 		}
 	}
 	
+	//Run as a daemon that forks a fuzzer for each job, if asked to.  Only the job's child gets past here.
+	if (argc == 3 && !strcmp(argv[1], "-D"))
+	{
+		i = run_job_daemon(argv[2], mutator_directory, &argc, &argv);
+		if (i >= 0)
+			return i;
+		optind = 1;
+		startup_begin_ms = startup_step_ms = get_time_ms();
+	}
+
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	while ((c = getopt(argc, argv, "d:h:i:j:k:l:m:n:o:p:r:s:t:u:")) != -1)
+	while ((c = getopt(argc, argv, "A:a:bB:c:C:d:efg:H:h:i:j:Jk:K:l:L:m:n:o:p:PqRr:s:S:t:T:u:Uw:W:x:X:y:Y:Z:")) != -1)
 	{
 		switch (c)
 		{
+			case 'A':
+				first_cpu = atoi(optarg);
+				break;
+			case 'a':
+				dictionary_file = optarg;
+				break;
+			case 'b':
+				binary_state_dump = 1;
+				break;
+			case 'B':
+				crash_bucket_size = atoi(optarg);
+				break;
+			case 'c':
+				corpus_checkpoint_file = optarg;
+				break;
+			case 'C':
+				checkpoint_file = optarg;
+				break;
 			case 'd':
 				read_file(optarg, &driver_options);
 				break;
+			case 'e':
+				pipelined = 1;
+				break;
+			case 'g':
+				trim_max_exec_us = atoi(optarg);
+				break;
+			case 'f':
+				find_slow_inputs = 1;
+				use_corpus = 1;
+				break;
+			case 'H':
+				hang_verify_multiplier = atof(optarg);
+				break;
 			case 'h':
 				if (optarg == NULL) {
 					usage(argv[0], mutator_directory);
@@ -188,8 +2502,20 @@ int main(int argc, char ** argv)
 					PRINT_HELP(driver_help());
 				} else if (strcmp(optarg, "i") == 0) {
 					PRINT_HELP(instrumentation_help());
+				} else if (strcmp(optarg, "m") == 0 && optind < argc && argv[optind][0] != '-') {
+					//Only load the mutator that the help was asked for
+					char * help = mutator_type_help(mutator_directory, argv[optind]);
+					if (help) {
+						PRINT_HELP(help);
+					}
 				} else if (strcmp(optarg, "m") == 0) {
 					PRINT_HELP(mutator_help(mutator_directory));
+				} else if (strcmp(optarg, "x") == 0) {
+					PRINT_HELP(metrics_help());
+				} else if (strcmp(optarg, "X") == 0) {
+					PRINT_HELP(remote_help());
+				} else if (strcmp(optarg, "Y") == 0) {
+					PRINT_HELP(concolic_help());
 				}
 				exit(1);
 			case 'i':
@@ -198,12 +2524,21 @@ int main(int argc, char ** argv)
 			case 'j':
 				instrumentation_state_dump_file = optarg;
 				break;
+			case 'J':
+				delta_state_dump = 1;
+				break;
 			case 'k':
 				instrumentation_state_load_file = optarg;
 				break;
+			case 'K':
+				calibration_runs = atoi(optarg);
+				break;
 			case 'l':
 				read_file(optarg, &logging_options);
 				break;
+			case 'L':
+				time_limit = atoi(optarg);
+				break;
 			case 'm':
 				read_file(optarg, &mutator_options);
 				break;
@@ -216,18 +2551,57 @@ int main(int argc, char ** argv)
 			case 'p':
 				mutator_directory_cli = optarg;
 				break;
+			case 'P':
+				profile_startup = 1;
+				break;
+			case 'q':
+				use_corpus = 1;
+				break;
+			case 'R':
+				record_lineage = 1;
+				break;
 			case 'r':
 				mutator_saved_state = optarg;
 				break;
 			case 's':
 				seed_file = optarg;
 				break;
+			case 'S':
+				seed_directory = optarg;
+				break;
 			case 't':
 				mutation_state_dump_file = optarg;
 				break;
+			case 'T':
+				phase_timing_file = optarg;
+				break;
 			case 'u':
 				mutation_state_load_file = optarg;
 				break;
+			case 'U':
+				use_uring = 1;
+				break;
+			case 'x':
+				read_file(optarg, &metrics_options);
+				break;
+			case 'X':
+				read_file(optarg, &remote_options);
+				break;
+			case 'w':
+				num_workers = atoi(optarg);
+				break;
+			case 'W':
+				max_worker_restarts = atoi(optarg);
+				break;
+			case 'y':
+				sync_directory = optarg;
+				break;
+			case 'Y':
+				read_file(optarg, &concolic_options);
+				break;
+			case 'Z':
+				autotune_seconds = atoi(optarg);
+				break;
 		}
 	}
 
@@ -247,10 +2621,66 @@ int main(int argc, char ** argv)
 	}
 
 	signal(SIGINT, sigint_handler);
+#ifndef _WIN32
+	signal(SIGPIPE, sigpipe_handler);
+#endif
+	tracepoints_register();
 
 	//Check number of iterations for valid number of rounds
 	if (num_iterations != NUM_ITERATIONS_INFINITE && num_iterations <= 0)
 		FATAL_MSG("Invalid number of iterations %d", num_iterations);
+	if (num_workers <= 0)
+		FATAL_MSG("Invalid number of workers %d", num_workers);
+	if (max_worker_restarts < 0)
+		FATAL_MSG("Invalid number of worker restarts %d", max_worker_restarts);
+	if (first_cpu < -1)
+		FATAL_MSG("Invalid first CPU %d", first_cpu);
+	if (autotune_seconds < 0)
+		FATAL_MSG("Invalid autotune step %d", autotune_seconds);
+	if (autotune_seconds && (num_workers < 2 || remote_options))
+		FATAL_MSG("The autotune (-Z) needs more than one worker (-w), and can't be used with executors (-X)");
+	if (autotune_seconds && first_cpu >= 0)
+	{
+		cpu_order = (int *)malloc(get_processor_count() * sizeof(int));
+		if (cpu_order)
+			cpu_order_count = get_cpu_core_order(cpu_order, get_processor_count());
+		if (!cpu_order_count) {
+			WARNING_MSG("Couldn't find the CPUs' cores, the workers are pinned in the order of their CPUs");
+			free(cpu_order);
+			cpu_order = NULL;
+		}
+	}
+	if (crash_bucket_size < 0)
+		FATAL_MSG("Invalid crash bucket size %d", crash_bucket_size);
+	if (time_limit < 0)
+		FATAL_MSG("Invalid time limit %d", time_limit);
+	if (delta_state_dump && (!instrumentation_state_dump_file || !instrumentation_state_load_file))
+		FATAL_MSG("Dumping the instrumentation state as a delta (-J) needs both -j and -k");
+	if (record_lineage && pipelined)
+		FATAL_MSG("The lineage of the new paths (-R) can't be recorded when the workers are pipelined (-e)");
+	if (record_lineage && sync_directory)
+		FATAL_MSG("The lineage of the new paths (-R) can't be recorded when syncing with other fuzzers (-y), "
+			"since they can only import inputs that are saved in full");
+	if (concolic_options && !sync_directory)
+		FATAL_MSG("The concolic side worker (-Y) needs a sync directory (-y) to share the inputs it solves for");
+	if (remote_options)
+	{
+		remote = remote_options_create(remote_options);
+		if (!remote)
+			FATAL_MSG("Bad executor options, pass %s -hX for help", argv[0]);
+		free(remote_options);
+		if (executor_sockets_init())
+			FATAL_MSG("Couldn't start up the socket library for the executors");
+		if (pipelined || record_lineage || sync_directory || checkpoint_file || dictionary_file || phase_timing_file
+			|| instrumentation_state_dump_file || instrumentation_state_load_file || find_slow_inputs)
+			FATAL_MSG("The inputs can't be run on executors (-X) with -a, -C, -e, -f, -j, -k, -R, -T, or -y, since "
+				"they need the drivers or instrumentation states in this process");
+		//Each worker runs its inputs on its own executor, and the executors' drivers time out the hangs
+		num_workers = remote->executors_count;
+		calibration_runs = 0;
+	}
+	if (use_uring && uring_enable())
+		WARNING_MSG("io_uring isn't available (-U), using the regular system calls instead");
 
 	if (mutator_directory_cli) 
 	{ 
@@ -260,6 +2690,7 @@ int main(int argc, char ** argv)
 	}
 	if (!mutator_directory)
 		FATAL_MSG("Mutator directory was not found in default location. You may need to pass the -md flag.");
+	startup_step("parsing the arguments");
 
 	if (instrumentation_state_dump_file) {
 		strncpy(filename, instrumentation_state_dump_file, sizeof(filename));
@@ -306,44 +2737,163 @@ int main(int argc, char ** argv)
 	create_output_directory("/crashes");	// creates ./output/crashes and so on
 	create_output_directory("/hangs");
 	create_output_directory("/new_paths");
+	if (find_slow_inputs) {
+		create_output_directory("/" SLOW_INPUTS_DIRECTORY);
+		slow_inputs = slow_inputs_create();
+		if (!slow_inputs)
+			FATAL_MSG("Unable to allocate the slow input mode's cost maxima");
+	}
+	findings = findings_store_create(output_directory, crash_bucket_size);
+	if (!findings)
+		FATAL_MSG("Unable to create the findings store in %s", output_directory);
+	if (sync_directory) {
+		instance_sync = instance_sync_create(sync_directory, output_directory, findings);
+		if (!instance_sync)
+			FATAL_MSG("Unable to sync with the other fuzzers in %s", sync_directory);
+	}
+	stats = fuzzer_stats_create(output_directory, num_workers);
+	if (!stats)
+		FATAL_MSG("Unable to create the fuzzer stats in %s", output_directory);
+	if (metrics_options) {
+		stats->metrics = metrics_exporter_create(metrics_options, output_directory);
+		if (!stats->metrics)
+			FATAL_MSG("Bad metrics options, pass %s -hx for help", argv[0]);
+		free(metrics_options);
+	}
+
+	startup_step("setting up the output directory");
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
+	//Map the campaign checkpoint, if there is one to resume from.  The seed, states, and corpus given
+	//on the command line take precedence over the ones in the checkpoint.
+	if (checkpoint_file && file_exists(checkpoint_file))
+	{
+		checkpoint = checkpoint_open(checkpoint_file, instrumentation_name, mutator_name);
+		if (!checkpoint)
+			FATAL_MSG("Failed to open the campaign checkpoint %s", checkpoint_file);
+		INFO_MSG("Resuming the campaign from the checkpoint %s", checkpoint_file);
+		if (binary_state_get_raw_section(checkpoint, "corpus", &checkpoint_section_length))
+			use_corpus = 1;
+	}
+
 	//Load the instrumentation state from disk (if specified, and create the instrumentation
 	if (instrumentation_state_load_file)
 	{
-		instrumentation_length = read_file(instrumentation_state_load_file, &instrumentation_state_string);
-		if (instrumentation_length <= 0)
+		instrumentation_state_string = instrumentation_load_state_file(instrumentation_state_load_file, &state_length,
+			&instrumentation_state_mapped);
+		instrumentation_length = (int)state_length;
+		if (!instrumentation_state_string)
 			FATAL_MSG("Could not read instrumentation file or empty instrumentation file: %s", instrumentation_state_load_file);
 	}
+	else if (checkpoint)
+	{
+		checkpoint_section = (const char *)binary_state_get_raw_section(checkpoint, "instrumentation_state",
+			&checkpoint_section_length);
+		instrumentation_state_string = (char *)memdup((void *)checkpoint_section, checkpoint_section_length);
+		if (!instrumentation_state_string)
+			FATAL_MSG("Couldn't allocate the instrumentation state from the checkpoint");
+		instrumentation_length = (int)checkpoint_section_length;
+		if (!binary_state_is_binary(instrumentation_state_string, checkpoint_section_length))
+			instrumentation_length--; //Don't count the JSON state's NUL
+	}
 
 	// NULL means instrumentation failed to initialize.
 	instrumentation = instrumentation_factory(instrumentation_name);
 	if (!instrumentation)
 	{
-		free(instrumentation_state_string);
+		instrumentation_free_state_file(instrumentation_state_string, instrumentation_length, instrumentation_state_mapped);
 		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
 	}
+	if (crash_bucket_size && !instrumentation->get_crash_hash)
+		WARNING_MSG("The %s instrumentation can't hash crashes, so every crash will be saved", instrumentation_name);
+#ifdef STATIC_DRIVER_NAME
+	if (strcmp(driver_name, STATIC_DRIVER_NAME) || strcmp(instrumentation_name, STATIC_INSTRUMENTATION_NAME)
+		|| strcmp(mutator_name, STATIC_MUTATOR_NAME))
+		WARNING_MSG("This fuzzer is specialized for the %s driver, %s instrumentation and %s mutator, any others "
+			"are called indirectly", STATIC_DRIVER_NAME, STATIC_INSTRUMENTATION_NAME, STATIC_MUTATOR_NAME);
+#endif
 
-	instrumentation_state = instrumentation->create(instrumentation_options, instrumentation_state_string);
-	if (!instrumentation_state)
+	workers = (worker_t *)calloc(num_workers, sizeof(worker_t));
+	iteration_mutex = create_mutex();
+	coverage_mutex = create_mutex();
+	if (phase_timing_file)
+		phase_timings = (phase_timing_t *)malloc(num_workers * sizeof(phase_timing_t));
+	if (!workers || !iteration_mutex || !coverage_mutex || (phase_timing_file && !phase_timings))
+		FATAL_MSG("Couldn't allocate the state for %d workers", num_workers);
+
+	//Each worker gets its own instrumentation state, starting from the loaded state (if any)
+	for (i = 0; i < num_workers; i++)
 	{
-		free(instrumentation_state_string);
-		FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		workers[i].id = i;
+		workers[i].stats = &stats->counters[i];
+		if (phase_timings) {
+			workers[i].timing = &phase_timings[i];
+			phase_timing_init(workers[i].timing);
+		}
+		pin_worker_cpu(i);
+		if (remote)
+			continue;
+		workers[i].instrumentation_state = instrumentation_create_with_state(instrumentation, instrumentation_options,
+			instrumentation_state_string, instrumentation_length);
+		if (!workers[i].instrumentation_state)
+		{
+			instrumentation_free_state_file(instrumentation_state_string, instrumentation_length, instrumentation_state_mapped);
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		}
 	}
 
-	free(instrumentation_state_string);
+	//Keep the loaded state, so that the dumped state can be a delta from it
+	if (delta_state_dump)
+	{
+		if (!binary_state_is_binary(instrumentation_state_string, instrumentation_length))
+			FATAL_MSG("Dumping the instrumentation state as a delta (-J) needs a binary state to be loaded with -k");
+		base_state = instrumentation_state_string;
+		base_state_length = instrumentation_length;
+	}
+	else
+		instrumentation_free_state_file(instrumentation_state_string, instrumentation_length, instrumentation_state_mapped);
+	instrumentation_state_string = NULL;
+	startup_step("creating the instrumentation");
 
-	//Load the seed buffer from a file
+	//Map the seed buffer from a file
 	if (seed_file)
 	{
-		seed_length = read_file(seed_file, &seed_buffer);
-		if (seed_length <= 0)
+		seed_buffer = (char *)map_file(seed_file, &state_length);
+		seed_length = (int)state_length;
+		seed_mapped = 1;
+		if (!seed_buffer)
 			FATAL_MSG("Could not read seed file or empty seed file: %s", seed_file);
 	}
 
+	//Map the seed files from the seed directory.  Without a seed file, the largest seed is used to create the
+	//mutator, since the drivers size their mutate buffers from it, and the corpus skips seeds that don't fit.
+	if (seed_directory)
+	{
+		seeds = load_seed_directory(seed_directory);
+		if (!seeds)
+			FATAL_MSG("Could not find any non-empty seed files in the seed directory: %s", seed_directory);
+		INFO_MSG("Loaded %lu seeds from %s", (unsigned long)seeds->count, seed_directory);
+		if (!seed_buffer) {
+			largest_seed = 0;
+			for (i = 1; i < (int)seeds->count; i++) {
+				if (seeds->seeds[i].length > seeds->seeds[largest_seed].length)
+					largest_seed = i;
+			}
+			seed_buffer = (char *)seeds->seeds[largest_seed].data;
+			seed_length = (int)seeds->seeds[largest_seed].length;
+		}
+	}
+
+	if (!seed_buffer && checkpoint)
+	{
+		checkpoint_section = (const char *)binary_state_get_raw_section(checkpoint, "seed", &checkpoint_section_length);
+		seed_buffer = (char *)memdup((void *)checkpoint_section, checkpoint_section_length);
+		seed_length = (int)checkpoint_section_length;
+	}
+
 	if (!seed_buffer)
 		FATAL_MSG("No seed file or seed id specified.");
 
@@ -354,6 +2904,12 @@ int main(int argc, char ** argv)
 		if (mutator_state_length <= 0)
 			FATAL_MSG("Could not read mutator saved state from file: %s", mutation_state_load_file);
 	}
+	else if (checkpoint && !mutator_saved_state)
+	{
+		checkpoint_section = (const char *)binary_state_get_raw_section(checkpoint, "mutator_state", &checkpoint_section_length);
+		if (checkpoint_section && checkpoint_section_length && !checkpoint_section[checkpoint_section_length - 1])
+			mutator_saved_state = strdup(checkpoint_section);
+	}
 
 	//Create the mutator
 	mutator = mutator_factory_directory(mutator_directory, mutator_name);
@@ -364,75 +2920,248 @@ int main(int argc, char ** argv)
 	if (!mutator_state)
 		FATAL_MSG("Bad mutator options or saved state for mutator %s", mutator_name);
 	free(mutator_saved_state);
-	free(seed_buffer);
+	startup_step("loading the seeds and creating the mutator");
 
-	//Create the driver
-	driver = driver_all_factory(driver_name, driver_options, instrumentation, instrumentation_state, mutator, mutator_state);
-	if (!driver)
+	if (use_corpus || corpus_checkpoint_file || seeds || instance_sync)
+	{
+		corpus = corpus_create(mutator, mutator_state, seed_buffer, seed_length, CORPUS_DEFAULT_ENTRY_ITERATIONS);
+		if (!corpus)
+			FATAL_MSG("Failed to create the corpus");
+		corpus->prefer_costly = find_slow_inputs;
+		checkpoint_section = checkpoint ? (const char *)binary_state_get_raw_section(checkpoint, "corpus",
+			&checkpoint_section_length) : NULL;
+		if (checkpoint_section)
+		{
+			//The checkpoint already has the seeds in it
+			if (corpus_deserialize(corpus, checkpoint_section, checkpoint_section_length))
+				FATAL_MSG("Failed to load the corpus from the campaign checkpoint %s", checkpoint_file);
+		}
+		else if (corpus_checkpoint_file && file_exists(corpus_checkpoint_file))
+		{
+			//The checkpoint already has the seeds in it
+			if (corpus_load(corpus, corpus_checkpoint_file))
+				FATAL_MSG("Failed to load the corpus checkpoint %s", corpus_checkpoint_file);
+		}
+		else
+		{
+			for (i = 0; seeds && i < (int)seeds->count; i++)
+			{
+				if (i != largest_seed && corpus_add_seed(corpus, seeds->seeds[i].data, seeds->seeds[i].length))
+					FATAL_MSG("Failed to add the seed %s to the corpus", seeds->seeds[i].filename);
+			}
+		}
+	}
+	if (concolic_options)
+	{
+		//The side worker gets the CPU after the workers' own, so it doesn't compete with them
+		concolic = concolic_worker_create(concolic_options, corpus, stats, sync_directory, output_directory,
+			first_cpu >= 0 ? worker_cpu(num_workers) : -1);
+		if (!concolic)
+			FATAL_MSG("Bad concolic side worker options, pass %s -hY for help", argv[0]);
+		free(concolic_options);
+	}
+	startup_step("creating the corpus");
+	recheck_new_paths = calibration_runs > 0;
+	if (calibration_runs > 0)
+		calibrate_seeds(driver_name, &driver_options, instrumentation_options, seed_buffer, seed_length, largest_seed,
+			calibration_runs);
+	startup_step("calibrating the seeds");
+
+	if (checkpoint_file)
+	{
+		//The checkpoints need the seed that the mutator was created with
+		checkpoint_seed = largest_seed < 0 && !seed_mapped ? seed_buffer : (char *)memdup(seed_buffer, seed_length);
+		if (!checkpoint_seed)
+			FATAL_MSG("Couldn't allocate the seed for the campaign checkpoint");
+		checkpoint_contents.instrumentation_name = instrumentation_name;
+		checkpoint_contents.mutator_name = mutator_name;
+		checkpoint_contents.stats = stats;
+		checkpoint_contents.seed = checkpoint_seed;
+		checkpoint_contents.seed_length = seed_length;
+	}
+	if (record_lineage)
+	{
+		//The lineage records of the inputs mutated straight from the seed need its hash after it's freed
+		lineage_mutator_name = mutator_name;
+		lineage_mutator_options = mutator_options;
+		lineage_seed = (char *)memdup(seed_buffer, seed_length);
+		lineage_seed_length = seed_length;
+		if (!lineage_seed)
+			FATAL_MSG("Couldn't allocate the seed for the lineage records");
+	}
+	if (seed_mapped)
+		unmap_file(seed_buffer, seed_length);
+	else if (largest_seed < 0 && !checkpoint_file)
+		free(seed_buffer);
+
+	//Mutators that can clone their state give each worker its own copy, so the workers don't contend for
+	//the mutator's lock.  The corpus switches the shared state between its entries, so it can't use clones.
+	if (num_workers > 1 && !corpus && mutator->clone_state && mutator->merge_state)
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			workers[i].mutator_state = mutator->clone_state(mutator_state);
+			if (!workers[i].mutator_state)
+				FATAL_MSG("Failed to clone the mutator state for worker %d", i);
+		}
+	}
+
+	//When multiple workers share the mutator, they need to use the thread safe mutate functions, when
+	//there's a corpus, the mutate functions need to go through it, and when the lineage of the new paths
+	//is recorded, the mutate functions record each mutation
+	driver_mutator = mutator;
+	if ((num_workers > 1 && !workers[0].mutator_state) || corpus || record_lineage)
+	{
+		memcpy(&thread_safe_mutator, mutator, sizeof(mutator_t));
+		thread_safe_mutator.mutate = thread_safe_mutate;
+		thread_safe_mutator.mutate_extended = thread_safe_mutate_extended;
+		thread_safe_mutator.mutate_growable = thread_safe_mutate_growable;
+		driver_mutator = &thread_safe_mutator;
+	}
+
+	//Connect to the executors, or create the drivers
+	if (remote)
+	{
+		remote_coverage = remote_coverage_create();
+		if (!remote_coverage)
+			FATAL_MSG("Couldn't allocate the coverage of the executors");
+		for (i = 0; i < num_workers; i++)
+		{
+			if (setup_remote_worker(&workers[i], remote->executors[i], driver_name, driver_options, instrumentation_name,
+				instrumentation_options))
+				FATAL_MSG("Failed to set up worker %d with the executor at %s", i, remote->executors[i]);
+		}
+		INFO_MSG("Running the inputs on %d executors, in batches of %d", num_workers, remote->batch_size);
+	}
+	restart_driver_name = driver_name;
+	restart_driver_options = driver_options;
+	restart_instrumentation_options = instrumentation_options;
+	restart_driver_mutator = driver_mutator;
+	for (i = 0; i < num_workers && !remote; i++)
+	{
+		pin_worker_cpu(i);
+		workers[i].driver = driver_worker_factory(driver_name, driver_options, i, instrumentation,
+			workers[i].instrumentation_state, driver_mutator,
+			workers[i].mutator_state ? workers[i].mutator_state : mutator_state);
+		if (!workers[i].driver)
+		{
+			FATAL_MSG("Unknown driver '%s' or bad options: \n\n\tdriver options: %s\n\n"\
+				"\tmutator options: %s\n\n\tPass %s -hd for help.\n", driver_name,
+				driver_options, mutator_options, argv[0]);
+		}
+	}
+	startup_step("creating the drivers");
+
+	if (pipelined)
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			pin_worker_cpu(i);
+			if (setup_pipeline(&workers[i]))
+				FATAL_MSG("Failed to setup the pipeline for worker %d", i);
+		}
+	}
+	//The main thread was only pinned while allocating each worker's state, so it's allocated near the worker
+	if (first_cpu >= 0)
+		pin_thread_to_cpu(-1);
+	wait_for_job_start();
+	if (start_output_writer())
+		FATAL_MSG("Failed to start the output writer thread");
+	if (checkpoint)
+	{
+		checkpoint_restore_stats(checkpoint, stats);
+		binary_state_close(checkpoint);
+	}
+	if (checkpoint_file)
 	{
-		FATAL_MSG("Unknown driver '%s' or bad options: \n\n\tdriver options: %s\n\n"\
-			"\tmutator options: %s\n\n\tPass %s -hd for help.\n", driver_name,
-			driver_options, mutator_options, argv[0]);
+		checkpoint_writer = checkpoint_writer_create(checkpoint_file);
+		if (!checkpoint_writer)
+			FATAL_MSG("Failed to start the checkpoint writer thread");
+		next_checkpoint_ms = get_time_ms() + CHECKPOINT_INTERVAL_MS;
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Main Fuzz Loop ////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
+	if (profile_startup)
+		INFO_MSG("Startup: the fuzzer started fuzzing after %llu ms", (unsigned long long)(get_time_ms() - startup_begin_ms));
 	fuzz_begin_time = time(NULL);
+	fuzz_start_ns = get_time_ns();
+	if (time_limit)
+		end_time_ms = get_time_ms() + (uint64_t)time_limit * 1000;
+	if (fuzzer_stats_start(stats))
+		FATAL_MSG("Failed to start the stats thread");
+	if (concolic && concolic_worker_start(concolic))
+		FATAL_MSG("Failed to start the concolic side worker");
 
-	//Copy the input, mutate it, and run the fuzzed program
-	for (iteration = 0; num_iterations == NUM_ITERATIONS_INFINITE || iteration < num_iterations; iteration++)
+	if (num_workers == 1 && remote)
+		remote_fuzz_worker(&workers[0]);
+	else if (num_workers == 1)
+		fuzz_worker(&workers[0]);
+	else
 	{
-		DEBUG_MSG("Fuzzing the %d iteration", iteration);
-
-		fuzz_result = driver->test_next_input(driver->state);
-
-		if (fuzz_result < 0)
+		INFO_MSG("Starting %d workers", num_workers);
+		if (autotune_seconds) {
+			for (i = 1; i < num_workers; i++)
+				workers[i].parked = 1;
+			stats->active_workers = 1;
+		}
+		for (i = 0; i < num_workers; i++)
 		{
-			if(fuzz_result == -2)
-				WARNING_MSG("The mutator has run out of mutations to test after %d iterations", iteration);
-			else
-				ERROR_MSG("The driver failed to test the target program, fuzz_result was %d",fuzz_result);
-			break;
+			if (create_thread(&workers[i].thread, remote ? remote_fuzz_worker : fuzz_worker, &workers[i]))
+				FATAL_MSG("Failed to start worker %d", i);
 		}
+		if (autotune_seconds)
+			autotune_workers();
+		for (i = 0; i < num_workers; i++)
+			join_thread(workers[i].thread);
 
-		new_path = instrumentation->is_new_path(instrumentation_state);
-		if (new_path < 0)
+		//Collect the coverage that each worker found since its last sync, and the
+		//progress each worker made with its clone of the mutator state
+		for (i = 0; i < num_workers; i++)
 		{
-			ERROR_MSG("The instrumentation failed to determine the fuzzed process's fuzz_result");
-			break;
+			sync_worker_coverage(&workers[i]);
+			if (workers[i].mutator_state)
+				mutator->merge_state(mutator_state, workers[i].mutator_state);
 		}
+	}
 
-		directory = NULL;
-		if (fuzz_result == FUZZ_CRASH) {
-			directory = "crashes";
-			CRITICAL_MSG("Found %s", directory);
-		} else if (fuzz_result == FUZZ_HANG) {
-			directory = "hangs";
-			ERROR_MSG("Found %s", directory);
-		} else if (new_path > 0) {
-			directory = "new_paths";
-			INFO_MSG("Found %s", directory);
-		}
+	//Let the output writer finish writing the queued inputs, and write the final stats
+	stop_output_writer();
+	fuzzer_stats_stop(stats);
 
-		if (directory != NULL) {
-			mutate_buffer = driver->get_last_input(driver->state, &mutate_length);
-			if (!mutate_buffer) {
-				ERROR_MSG("Unable to dump mutate buffer\n");
-			} else {
-				if (output_directory) {
-					md5((uint8_t *)mutate_buffer, mutate_length, filehash, sizeof(filehash));
-					snprintf(filename, MAX_PATH, "%s/%s/%s", output_directory, directory, filehash);
-					if (!file_exists(filename)) //If the file already exists, there's no reason to write it again
-						write_buffer_to_file(filename, mutate_buffer, mutate_length);
-				}
-				free(mutate_buffer);
-			}
-		}
+	if (corpus_checkpoint_file && corpus_save(corpus, corpus_checkpoint_file))
+		WARNING_MSG("Failed to save the corpus checkpoint %s", corpus_checkpoint_file);
+	if (checkpoint_file)
+	{
+		//Wait for the last snapshot to be written, so it doesn't overwrite the final checkpoint
+		checkpoint_writer_destroy(checkpoint_writer);
+		checkpoint_writer = NULL;
+		checkpoint_buffer = snapshot_campaign(1, &state_length);
+		if (!checkpoint_buffer || checkpoint_write_file(checkpoint_file, checkpoint_buffer, state_length))
+			WARNING_MSG("Failed to save the campaign checkpoint %s", checkpoint_file);
+		free(checkpoint_buffer);
 	}
+	if (corpus)
+		INFO_MSG("The corpus has %lu entries", (unsigned long)corpus->entries_count);
+	if (crash_bucket_size && findings->buckets_count)
+		INFO_MSG("The crashes fell into %lu buckets", (unsigned long)findings->buckets_count);
+	if (slow_inputs)
+		INFO_MSG("The most costly run had a cost of %llu, and the most memory hungry one a peak RSS of %llu KB",
+			(unsigned long long)slow_inputs->highest[SLOW_INPUTS_COST],
+			(unsigned long long)slow_inputs->highest[SLOW_INPUTS_RSS]);
+	for (i = 1; i < num_workers; i++) {
+		workers[0].trimmed_inputs += workers[i].trimmed_inputs;
+		workers[0].trimmed_bytes += workers[i].trimmed_bytes;
+	}
+	if (workers[0].trimmed_inputs)
+		INFO_MSG("Trimmed %llu bytes from %llu new paths", (unsigned long long)workers[0].trimmed_bytes,
+			(unsigned long long)workers[0].trimmed_inputs);
+	save_unstable_bytes();
+
+	INFO_MSG("Ran %d iterations in %lld seconds", iterations_finished, time(NULL) - fuzz_begin_time);
 
-	INFO_MSG("Ran %ld iterations in %lld seconds", iteration, time(NULL) - fuzz_begin_time);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
@@ -440,15 +3169,38 @@ int main(int argc, char ** argv)
 
 	if (instrumentation_state_dump_file)
 	{
-		instrumentation_state_string = instrumentation->get_state(instrumentation_state);
-		if (instrumentation_state_string)
+		instrumentation_state = shared_instrumentation_state ? shared_instrumentation_state : workers[0].instrumentation_state;
+		if (delta_state_dump)
 		{
-			write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, strlen(instrumentation_state_string));
-			instrumentation->free_state(instrumentation_state_string);
+			instrumentation_state_string = instrumentation_get_state_delta(instrumentation, instrumentation_state,
+				base_state, base_state_length, &state_length);
+			if (instrumentation_state_string)
+			{
+				write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, state_length);
+				free(instrumentation_state_string);
+			}
+			else
+				WARNING_MSG("Couldn't dump instrumentation state delta to file %s", instrumentation_state_dump_file);
 		}
 		else
-			WARNING_MSG("Couldn't dump instrumentation state to file %s", instrumentation_state_dump_file);
+		{
+			instrumentation_state_string = instrumentation_save_state(instrumentation, instrumentation_state,
+				binary_state_dump, &state_length);
+			if (instrumentation_state_string)
+			{
+				write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, state_length);
+				instrumentation->free_state(instrumentation_state_string);
+			}
+			else
+				WARNING_MSG("Couldn't dump instrumentation state to file %s", instrumentation_state_dump_file);
+		}
 	}
+	if (base_state)
+		instrumentation_free_state_file(base_state, base_state_length, instrumentation_state_mapped);
+	if (phase_timing_file && phase_timing_write(phase_timing_file, phase_timings, num_workers))
+		WARNING_MSG("Couldn't write the phase timings to file %s", phase_timing_file);
+	if (dictionary_file && write_dictionary(dictionary_file))
+		WARNING_MSG("Couldn't write the dictionary to file %s", dictionary_file);
 	if (mutation_state_dump_file)
 	{
 		mutator_saved_state = mutator->get_state(mutator_state);
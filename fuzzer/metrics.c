@@ -0,0 +1,262 @@
+#include "metrics.h"
+#include <jansson_helper.h>
+
+#ifdef _WIN32
+#define NO_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define NO_SOCKET -1
+#define close_socket close
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The largest StatsD datagram that's sent, which keeps it under the usual 1500 byte MTU
+#define METRICS_STATSD_MAX_LENGTH 1400
+
+/**
+ * Returns a string describing the options for the metrics exporter
+ */
+char * metrics_help(void)
+{
+	return strdup(
+"Metrics Options:\n"
+"  instance              The instance label of the Prometheus metrics (default\n"
+"                          the output directory)\n"
+"  interval              How often to export the metrics, in milliseconds\n"
+"                          (default 10000)\n"
+"  prefix                The prefix of the metric names (default killerbeez)\n"
+"  prometheus_file       Write the metrics to this file in the Prometheus text\n"
+"                          format, e.g. for node_exporter's textfile collector\n"
+"  statsd_ip             Send the metrics to the StatsD server at this IP address\n"
+"  statsd_port           The UDP port of the StatsD server (default 8125)\n"
+	);
+}
+
+/**
+ * This function creates a metrics exporter, which exports the fuzzer's stats to StatsD and/or a
+ * Prometheus text file.
+ * @param options - a JSON string of the metrics exporter's options
+ * @param output_directory - the fuzzer's output directory, which is the default instance label
+ * @return - the new metrics exporter on success, or NULL if the options are invalid or on failure
+ */
+metrics_exporter_t * metrics_exporter_create(char * options, char * output_directory)
+{
+	metrics_exporter_t * state;
+#ifdef _WIN32
+	WSADATA wsaData;
+#endif
+
+	state = (metrics_exporter_t *)calloc(1, sizeof(metrics_exporter_t));
+	if (!state)
+		return NULL;
+	state->sock = NO_SOCKET;
+	state->statsd_port = METRICS_DEFAULT_STATSD_PORT;
+	state->interval_ms = METRICS_DEFAULT_INTERVAL_MS;
+
+	PARSE_OPTION_STRING(state, options, statsd_ip, "statsd_ip", metrics_exporter_destroy);
+	PARSE_OPTION_INT(state, options, statsd_port, "statsd_port", metrics_exporter_destroy);
+	PARSE_OPTION_STRING(state, options, prometheus_file, "prometheus_file", metrics_exporter_destroy);
+	PARSE_OPTION_STRING(state, options, prefix, "prefix", metrics_exporter_destroy);
+	PARSE_OPTION_STRING(state, options, instance, "instance", metrics_exporter_destroy);
+	PARSE_OPTION_INT(state, options, interval_ms, "interval", metrics_exporter_destroy);
+
+	if (!state->prefix)
+		state->prefix = strdup(METRICS_DEFAULT_PREFIX);
+	if (!state->instance)
+		state->instance = strdup(output_directory);
+	if (!state->prefix || !state->instance || (!state->statsd_ip && !state->prometheus_file)
+		|| state->statsd_port <= 0 || state->statsd_port > 65535 || state->interval_ms <= 0
+		|| (state->statsd_ip && inet_addr(state->statsd_ip) == INADDR_NONE))
+	{
+		metrics_exporter_destroy(state);
+		return NULL;
+	}
+
+	if (state->statsd_ip)
+	{
+#ifdef _WIN32
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData)) {
+			ERROR_MSG("WSAStartup Failed");
+			metrics_exporter_destroy(state);
+			return NULL;
+		}
+#endif
+		state->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (state->sock == NO_SOCKET) {
+			ERROR_MSG("Failed to create the StatsD socket");
+			metrics_exporter_destroy(state);
+			return NULL;
+		}
+	}
+	return state;
+}
+
+/**
+ * This function frees a metrics exporter.
+ * @param metrics - the metrics exporter to free
+ */
+void metrics_exporter_destroy(metrics_exporter_t * metrics)
+{
+	if (!metrics)
+		return;
+	if (metrics->sock != NO_SOCKET)
+		close_socket(metrics->sock);
+	free(metrics->statsd_ip);
+	free(metrics->prometheus_file);
+	free(metrics->prefix);
+	free(metrics->instance);
+	free(metrics);
+}
+
+//The format and arguments of a StatsD counter, as the change since the last export, and of a StatsD gauge
+#define STATSD_COUNTER(name, field) \
+	"%s." name ":%" PRIu64 "|c\n", metrics->prefix, block->field - metrics->last.field
+#define STATSD_GAUGE(name, field) \
+	"%s." name ":%" PRIu64 "|g\n", metrics->prefix, block->field
+
+/**
+ * This function sends the stats to the StatsD server.  The execs, crashes, hangs, new paths, and failures are
+ * sent as counters of how much they've gone up since the last export, so that the StatsD server can total them
+ * across the fuzzers, and the exec speed and number of workers are sent as gauges.
+ * @param metrics - the metrics exporter to send the stats with
+ * @param block - the current stats
+ * @return - zero on success, non-zero on failure
+ */
+static int send_statsd(metrics_exporter_t * metrics, fuzzer_stats_block_t * block)
+{
+	char buffer[METRICS_STATSD_MAX_LENGTH];
+	struct sockaddr_in addr;
+	int length;
+
+	length = 0;
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("execs", execs));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_GAUGE("execs_per_sec", execs_per_sec));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("crashes", crashes));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("hangs", hangs));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("new_paths", new_paths));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("fork_failures", fork_failures));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("trace_overflows", trace_overflows));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("oom_kills", oom_kills));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("worker_restarts", worker_restarts));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("unconfirmed_hangs", unconfirmed_hangs));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_COUNTER("slow_inputs", slow_inputs));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_GAUGE("workers", num_workers));
+	length += snprintf(buffer + length, sizeof(buffer) - length, STATSD_GAUGE("active_workers", active_workers));
+	if (length >= (int)sizeof(buffer))
+		return 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(metrics->statsd_ip);
+	addr.sin_port = htons(metrics->statsd_port);
+	//Drop the trailing newline
+	return sendto(metrics->sock, buffer, length - 1, 0, (const struct sockaddr *)&addr, sizeof(addr)) != length - 1;
+}
+
+/**
+ * This function writes a Prometheus label value, escaping the characters that need it.
+ * @param fp - the file to write the label value to
+ * @param value - the label value
+ */
+static void write_prometheus_label(FILE * fp, const char * value)
+{
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"')
+			fprintf(fp, "\\%c", *value);
+		else if (*value == '\n')
+			fputs("\\n", fp);
+		else
+			fputc(*value, fp);
+	}
+}
+
+/**
+ * This function writes the stats to the Prometheus text file, replacing it all at once so that
+ * the collector never reads a partial file.
+ * @param metrics - the metrics exporter to write the stats with
+ * @param block - the current stats
+ * @return - zero on success, non-zero on failure
+ */
+static int write_prometheus(metrics_exporter_t * metrics, fuzzer_stats_block_t * block)
+{
+	char temp_filename[MAX_PATH];
+	FILE * fp;
+	int ret;
+
+	//The metrics that are written, with their type, help text, and value.  The times are in seconds, as
+	//Prometheus expects, so a stuck fuzzer shows up as time() - last_update_seconds growing.
+	struct {
+		const char * name;
+		const char * type;
+		const char * help;
+		double value;
+	} values[] = {
+		{ "execs_total", "counter", "The number of inputs tested", (double)block->execs },
+		{ "execs_per_second", "gauge", "The number of inputs tested per second", (double)block->execs_per_sec },
+		{ "crashes_total", "counter", "The number of inputs that crashed the target", (double)block->crashes },
+		{ "hangs_total", "counter", "The number of inputs that timed out", (double)block->hangs },
+		{ "new_paths_total", "counter", "The number of inputs that found new paths", (double)block->new_paths },
+		{ "fork_failures_total", "counter", "The number of times the target couldn't be started", (double)block->fork_failures },
+		{ "trace_overflows_total", "counter", "The number of times the trace data overflowed", (double)block->trace_overflows },
+		{ "oom_kills_total", "counter", "The number of times the target went over its memory limit", (double)block->oom_kills },
+		{ "worker_restarts_total", "counter", "The number of times a failed worker was restarted", (double)block->worker_restarts },
+		{ "unconfirmed_hangs_total", "counter", "The number of inputs that timed out, but finished when tested again", (double)block->unconfirmed_hangs },
+		{ "slow_inputs_total", "counter", "The number of inputs that set a new cost maximum in slow input mode", (double)block->slow_inputs },
+		{ "workers", "gauge", "The number of workers", (double)block->num_workers },
+		{ "active_workers", "gauge", "The number of workers that are fuzzing", (double)block->active_workers },
+		{ "start_time_seconds", "gauge", "When the fuzzer started", block->start_time / 1000.0 },
+		{ "last_update_seconds", "gauge", "When the stats were last updated", block->last_update / 1000.0 },
+		{ "last_path_seconds", "gauge", "When the last new path was found, or 0 for never", block->last_path / 1000.0 },
+		{ "last_crash_seconds", "gauge", "When the last crash was found, or 0 for never", block->last_crash / 1000.0 },
+	};
+	size_t i;
+
+	snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", metrics->prometheus_file);
+	fp = fopen(temp_filename, "w");
+	if (!fp)
+		return 1;
+	for (i = 0; i < ARRAY_SIZE(values); i++)
+	{
+		fprintf(fp, "# HELP %s_%s %s\n# TYPE %s_%s %s\n%s_%s{instance=\"", metrics->prefix, values[i].name,
+			values[i].help, metrics->prefix, values[i].name, values[i].type, metrics->prefix, values[i].name);
+		write_prometheus_label(fp, metrics->instance);
+		fprintf(fp, "\"} %.17g\n", values[i].value);
+	}
+	ret = fclose(fp) != 0;
+	if (!ret) {
+#ifdef _WIN32
+		ret = !MoveFileEx(temp_filename, metrics->prometheus_file, MOVEFILE_REPLACE_EXISTING);
+#else
+		ret = rename(temp_filename, metrics->prometheus_file);
+#endif
+	}
+	return ret;
+}
+
+/**
+ * This function exports the stats, if the export interval has passed since they were last exported.
+ * @param metrics - the metrics exporter to export the stats with
+ * @param block - the current stats
+ * @param now - the current get_time_ms time
+ * @param force - whether to export the stats even if the interval hasn't passed, e.g. when the fuzzer stops
+ */
+void metrics_export(metrics_exporter_t * metrics, fuzzer_stats_block_t * block, uint64_t now, int force)
+{
+	if (!force && now - metrics->last_export < (uint64_t)metrics->interval_ms)
+		return;
+	metrics->last_export = now;
+
+	if (metrics->statsd_ip && send_statsd(metrics, block))
+		WARNING_MSG("Failed to send the metrics to the StatsD server at %s:%d", metrics->statsd_ip, metrics->statsd_port);
+	if (metrics->prometheus_file && write_prometheus(metrics, block))
+		WARNING_MSG("Failed to write the Prometheus metrics file %s", metrics->prometheus_file);
+	metrics->last = *block;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "stats.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#define METRICS_DEFAULT_PREFIX      "killerbeez"
+#define METRICS_DEFAULT_STATSD_PORT 8125
+#define METRICS_DEFAULT_INTERVAL_MS 10000
+
+//Exports the fuzzer stats to a metrics system, by sending them to a StatsD server over UDP, and/or
+//by writing them to a file in the Prometheus text format, for node_exporter's textfile collector
+struct metrics_exporter
+{
+	//Options
+	char * statsd_ip;        //The IP address of the StatsD server, or NULL to not send to StatsD
+	int statsd_port;
+	char * prometheus_file;  //The file to write the Prometheus metrics to, or NULL to not write them
+	char * prefix;           //The prefix of the metric names
+	char * instance;         //The instance label of the Prometheus metrics
+	int interval_ms;         //How often to export the stats
+
+#ifdef _WIN32
+	SOCKET sock;
+#else
+	int sock;
+#endif
+	uint64_t last_export;
+	fuzzer_stats_block_t last; //The stats at the last export, to send the change in the StatsD counters
+};
+typedef struct metrics_exporter metrics_exporter_t;
+
+metrics_exporter_t * metrics_exporter_create(char * options, char * output_directory);
+void metrics_exporter_destroy(metrics_exporter_t * metrics);
+void metrics_export(metrics_exporter_t * metrics, fuzzer_stats_block_t * block, uint64_t now, int force);
+char * metrics_help(void);
@@ -0,0 +1,293 @@
+#include "remote.h"
+#include <bitmap.h>
+#include <jansson_helper.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Returns a string describing the options for running the inputs on executors
+ */
+char * remote_help(void)
+{
+	return strdup(
+"Executor Options:\n"
+"  batch_size            How many inputs to send to an executor at once\n"
+"                          (default 64)\n"
+"  executors             A list of the \"host[:port]\" addresses of the executor\n"
+"                          agents to run the inputs on, one for each worker (the\n"
+"                          port is 9900 by default)\n"
+	);
+}
+
+/**
+ * This function parses the options for running the inputs on executors.
+ * @param options - a JSON string of the options
+ * @return - the parsed options on success, or NULL if the options are invalid or on failure
+ */
+remote_options_t * remote_options_create(char * options)
+{
+	remote_options_t * remote;
+	json_t * root, * executors, * address;
+	size_t i;
+
+	remote = (remote_options_t *)calloc(1, sizeof(remote_options_t));
+	if (!remote)
+		return NULL;
+	remote->batch_size = REMOTE_DEFAULT_BATCH_SIZE;
+	PARSE_OPTION_INT(remote, options, batch_size, "batch_size", remote_options_destroy);
+
+	root = get_root_option_json_object(options);
+	executors = root ? json_object_get(root, "executors") : NULL;
+	if (remote->batch_size <= 0 || !executors || !json_is_array(executors) || !json_array_size(executors))
+		goto fail;
+	remote->executors = (char **)calloc(json_array_size(executors), sizeof(char *));
+	if (!remote->executors)
+		goto fail;
+	json_array_foreach(executors, i, address)
+	{
+		if (!json_is_string(address))
+			goto fail;
+		remote->executors[remote->executors_count] = strdup(json_string_value(address));
+		if (!remote->executors[remote->executors_count++])
+			goto fail;
+	}
+	json_decref(root);
+	return remote;
+
+fail:
+	if (root)
+		json_decref(root);
+	remote_options_destroy(remote);
+	return NULL;
+}
+
+/**
+ * This function frees the options for running the inputs on executors.
+ * @param remote - the options to free
+ */
+void remote_options_destroy(remote_options_t * remote)
+{
+	int i;
+
+	if (!remote)
+		return;
+	for (i = 0; i < remote->executors_count; i++)
+		free(remote->executors[i]);
+	free(remote->executors);
+	free(remote);
+}
+
+/**
+ * This function connects to an executor, and has it create the driver and instrumentation that the inputs run with.
+ * @param address - the "host[:port]" address of the executor
+ * @param driver_name - the name of the driver the executor should run the inputs with
+ * @param driver_options - the options of the driver, or NULL for the defaults
+ * @param instrumentation_name - the name of the instrumentation the executor should run the inputs with
+ * @param instrumentation_options - the options of the instrumentation, or NULL for the defaults
+ * @return - the connection to the executor, once it's ready for the inputs, or NULL on failure
+ */
+remote_executor_t * remote_executor_connect(const char * address, char * driver_name, char * driver_options,
+	char * instrumentation_name, char * instrumentation_options)
+{
+	remote_executor_t * executor;
+	char * error = NULL;
+	uint32_t type = 0;
+
+	executor = (remote_executor_t *)calloc(1, sizeof(remote_executor_t));
+	if (!executor)
+		return NULL;
+	executor->address = strdup(address);
+	executor->sock = executor_connect(address);
+	if (!executor->address || executor->sock == INVALID_SOCKET) {
+		remote_executor_destroy(executor);
+		return NULL;
+	}
+
+	if (executor_put_u32(&executor->request, EXECUTOR_PROTOCOL_MAGIC)
+		|| executor_put_u32(&executor->request, EXECUTOR_PROTOCOL_VERSION)
+		|| executor_put_string(&executor->request, driver_name)
+		|| executor_put_string(&executor->request, driver_options)
+		|| executor_put_string(&executor->request, instrumentation_name)
+		|| executor_put_string(&executor->request, instrumentation_options)
+		|| executor_send_message(executor->sock, EXECUTOR_MSG_SETUP, &executor->request)
+		|| executor_receive_message(executor->sock, &type, &executor->reply)
+		|| type != EXECUTOR_MSG_READY) {
+		if (type == EXECUTOR_MSG_ERROR && !executor_get_string(&executor->reply, &error) && error)
+			ERROR_MSG("The executor at %s couldn't set up the driver and instrumentation: %s", address, error);
+		else
+			ERROR_MSG("The executor at %s didn't set up the driver and instrumentation", address);
+		free(error);
+		remote_executor_destroy(executor);
+		return NULL;
+	}
+	return executor;
+}
+
+/**
+ * This function disconnects from an executor, which lets it wait for the next fuzzer.
+ * @param executor - the executor to disconnect from
+ */
+void remote_executor_destroy(remote_executor_t * executor)
+{
+	if (!executor)
+		return;
+	executor_close_socket(executor->sock);
+	executor_buffer_free(&executor->request);
+	executor_buffer_free(&executor->reply);
+	free(executor->trace_bits);
+	free(executor->address);
+	free(executor);
+}
+
+/**
+ * This function runs a batch of inputs on an executor.
+ * @param executor - the executor to run the inputs on
+ * @param inputs - the inputs to run
+ * @param lengths - the length of each of the inputs
+ * @param count - the number of inputs
+ * @param results - used to return the result of each input.  Their coverage deltas point into the executor's reply,
+ * so they're only valid until the next batch.
+ * @param map_size - used to return the size of the executor's coverage map, or 0 if its instrumentation doesn't
+ * have one
+ * @return - zero on success, non-zero on failure
+ */
+int remote_executor_run(remote_executor_t * executor, char ** inputs, int * lengths, int count,
+	executor_result_t * results, uint32_t * map_size)
+{
+	char * error = NULL;
+	uint32_t type, result_count;
+	int i;
+
+	executor_buffer_reset(&executor->request);
+	if (executor_put_u32(&executor->request, count))
+		return 1;
+	for (i = 0; i < count; i++)
+	{
+		if (executor_put_bytes(&executor->request, inputs[i], lengths[i]))
+			return 1;
+	}
+
+	if (executor_send_message(executor->sock, EXECUTOR_MSG_BATCH, &executor->request)
+		|| executor_receive_message(executor->sock, &type, &executor->reply)) {
+		ERROR_MSG("Lost the connection to the executor at %s", executor->address);
+		return 1;
+	}
+	if (type == EXECUTOR_MSG_ERROR) {
+		if (!executor_get_string(&executor->reply, &error) && error)
+			ERROR_MSG("The executor at %s failed to run the inputs: %s", executor->address, error);
+		free(error);
+		return 1;
+	}
+	if (type != EXECUTOR_MSG_RESULTS || executor_get_u32(&executor->reply, &result_count)
+		|| result_count != (uint32_t)count || executor_get_u32(&executor->reply, map_size)) {
+		ERROR_MSG("The executor at %s sent a malformed reply to the inputs", executor->address);
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (executor_get_result(&executor->reply, &results[i])) {
+			ERROR_MSG("The executor at %s sent a malformed result", executor->address);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function rebuilds the coverage map of a result from its coverage delta.
+ * @param executor - the executor that ran the input
+ * @param result - the result to rebuild the coverage map of
+ * @param map_size - the size of the executor's coverage map
+ * @return - the coverage map, which is only valid until the next call, or NULL if the result doesn't have a coverage
+ * delta or it's malformed
+ */
+const uint8_t * remote_executor_trace(remote_executor_t * executor, const executor_result_t * result, size_t map_size)
+{
+	if (!result->trace_count || !map_size)
+		return NULL;
+	if (executor->trace_size != map_size) {
+		free(executor->trace_bits);
+		executor->trace_size = 0;
+		executor->trace_bits = (uint8_t *)malloc(map_size);
+		if (!executor->trace_bits)
+			return NULL;
+		executor->trace_size = map_size;
+	}
+
+	memset(executor->trace_bits, 0, map_size);
+	if (executor_apply_trace(result, executor->trace_bits, map_size)) {
+		WARNING_MSG("The executor at %s sent a coverage delta that doesn't fit its coverage map", executor->address);
+		return NULL;
+	}
+	return executor->trace_bits;
+}
+
+/**
+ * This function creates the coverage that every executor's inputs have found.
+ * @return - the new coverage, or NULL on failure
+ */
+remote_coverage_t * remote_coverage_create(void)
+{
+	remote_coverage_t * coverage;
+
+	coverage = (remote_coverage_t *)calloc(1, sizeof(remote_coverage_t));
+	if (!coverage)
+		return NULL;
+	coverage->mutex = create_mutex();
+	if (!coverage->mutex) {
+		free(coverage);
+		return NULL;
+	}
+	return coverage;
+}
+
+/**
+ * This function frees the coverage that every executor's inputs have found.
+ * @param coverage - the coverage to free
+ */
+void remote_coverage_destroy(remote_coverage_t * coverage)
+{
+	if (!coverage)
+		return;
+	destroy_mutex(coverage->mutex);
+	free(coverage->virgin_bits);
+	free(coverage);
+}
+
+/**
+ * This function decides whether an input that an executor ran found a new path, by checking its coverage map
+ * against the global virgin map.  An executor only sends the coverage of the inputs that were new to it, so the
+ * rest weren't new to the global virgin map either.  When the executors' instrumentation doesn't have a coverage
+ * map, the executor's own answer is used.
+ * @param coverage - the coverage that every executor's inputs have found
+ * @param result - the result of the input
+ * @param trace_bits - the input's coverage map, from remote_executor_trace, or NULL if it doesn't have one
+ * @param map_size - the size of the coverage map
+ * @return - 2 if the input hit a new edge, 1 if it only hit an edge a new number of times, or 0 if it didn't find
+ * a new path
+ */
+int remote_coverage_is_new_path(remote_coverage_t * coverage, const executor_result_t * result, const uint8_t * trace_bits,
+	size_t map_size)
+{
+	if (result->fuzz_result != FUZZ_NONE || result->new_path <= 0)
+		return 0;
+	//The atomic checks compare the maps a 64 byte line at a time
+	if (!trace_bits || map_size % 64)
+		return result->new_path;
+
+	//Only the inputs that were new to their executor get here, so the lock is rarely taken
+	take_mutex(coverage->mutex);
+	if (!coverage->virgin_bits) {
+		coverage->virgin_bits = (uint8_t *)malloc(map_size);
+		if (coverage->virgin_bits) {
+			memset(coverage->virgin_bits, 0xff, map_size);
+			coverage->map_size = map_size;
+		}
+	}
+	release_mutex(coverage->mutex);
+	if (!coverage->virgin_bits || coverage->map_size != map_size)
+		return result->new_path;
+	return bitmap_has_new_bits_atomic(coverage->virgin_bits, (uint8_t *)trace_bits, map_size);
+}
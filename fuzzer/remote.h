@@ -0,0 +1,56 @@
+#pragma once
+#include <executor_protocol.h>
+#include <utils.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REMOTE_DEFAULT_BATCH_SIZE 64
+
+//The options for running the inputs on executor agents (-X), rather than with local drivers
+struct remote_options
+{
+	char ** executors;   //The "host[:port]" addresses of the executors, one for each worker
+	int executors_count;
+	int batch_size;      //How many inputs are sent to an executor at once
+};
+typedef struct remote_options remote_options_t;
+
+//A worker's connection to its executor
+struct remote_executor
+{
+	char * address;
+	SOCKET sock;
+	executor_buffer_t request;
+	executor_buffer_t reply;
+
+	//The coverage map of the last result that had a coverage delta
+	uint8_t * trace_bits;
+	size_t trace_size;
+};
+typedef struct remote_executor remote_executor_t;
+
+//The coverage that every executor's inputs have found, which decides which of their inputs are new paths
+struct remote_coverage
+{
+	uint8_t * virgin_bits; //The global virgin map, or NULL until the executors report their map size
+	size_t map_size;
+	mutex_t mutex;         //Guards creating the virgin map
+};
+typedef struct remote_coverage remote_coverage_t;
+
+remote_options_t * remote_options_create(char * options);
+void remote_options_destroy(remote_options_t * remote);
+char * remote_help(void);
+
+remote_executor_t * remote_executor_connect(const char * address, char * driver_name, char * driver_options,
+	char * instrumentation_name, char * instrumentation_options);
+void remote_executor_destroy(remote_executor_t * executor);
+int remote_executor_run(remote_executor_t * executor, char ** inputs, int * lengths, int count,
+	executor_result_t * results, uint32_t * map_size);
+const uint8_t * remote_executor_trace(remote_executor_t * executor, const executor_result_t * result, size_t map_size);
+
+remote_coverage_t * remote_coverage_create(void);
+void remote_coverage_destroy(remote_coverage_t * coverage);
+int remote_coverage_is_new_path(remote_coverage_t * coverage, const executor_result_t * result, const uint8_t * trace_bits,
+	size_t map_size);
@@ -0,0 +1,138 @@
+#include "slow_inputs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function creates the cost maxima for slow input mode.  The maxima are allocated once the size of the
+ * coverage map is known, by the first update.
+ * @return - the new slow input state, which should be freed with slow_inputs_destroy, or NULL on failure
+ */
+slow_inputs_t * slow_inputs_create(void)
+{
+	slow_inputs_t * slow;
+
+	slow = (slow_inputs_t *)calloc(1, sizeof(slow_inputs_t));
+	if (!slow)
+		return NULL;
+	slow->mutex = create_mutex();
+	if (!slow->mutex) {
+		free(slow);
+		return NULL;
+	}
+	return slow;
+}
+
+/**
+ * This function frees the cost maxima for slow input mode.
+ * @param slow - the slow input state to free, created with slow_inputs_create
+ */
+void slow_inputs_destroy(slow_inputs_t * slow)
+{
+	int objective;
+
+	if (!slow)
+		return;
+	for (objective = 0; objective < SLOW_INPUTS_NUM_OBJECTIVES; objective++)
+		free(slow->maxima[objective]);
+	destroy_mutex(slow->mutex);
+	free(slow);
+}
+
+/**
+ * This function allocates the cost maxima, once the size of the coverage map is known.  The slow input
+ * state's mutex should be held by the caller.
+ * @param slow - the slow input state to allocate the maxima of
+ * @param map_size - the size of the coverage map
+ * @return - zero on success, non-zero on failure
+ */
+static int slow_inputs_allocate(slow_inputs_t * slow, size_t map_size)
+{
+	int objective;
+
+	for (objective = 0; objective < SLOW_INPUTS_NUM_OBJECTIVES; objective++) {
+		slow->maxima[objective] = (uint64_t *)calloc(map_size, sizeof(uint64_t));
+		if (!slow->maxima[objective]) {
+			while (objective-- > 0) {
+				free(slow->maxima[objective]);
+				slow->maxima[objective] = NULL;
+			}
+			return 1;
+		}
+	}
+	slow->map_size = map_size;
+	return 0;
+}
+
+/**
+ * This function raises the cost maxima of the coverage map bytes that a run hit, and decides whether the run
+ * is a slow input.  A byte's first run only sets its maxima, since a run that hits a new byte is a new path
+ * anyway.  It's safe to call from multiple threads at once.
+ * @param slow - the slow input state to update
+ * @param trace_bits - the coverage map of the run, or NULL if the instrumentation doesn't provide one
+ * @param trace_size - the size of the trace_bits parameter
+ * @param cost - the cost of the run, in instructions or microseconds (the same unit for every run), or 0 if it
+ * isn't known
+ * @param max_rss_kb - the peak RSS of the run's target process in kilobytes, or 0 if it isn't known
+ * @return - 1 if the run beat one of the maxima, 0 if it didn't, or -1 on failure
+ */
+int slow_inputs_update(slow_inputs_t * slow, const uint8_t * trace_bits, size_t trace_size, uint64_t cost,
+	uint64_t max_rss_kb)
+{
+	static const uint8_t no_map = 1;
+	uint64_t costs[SLOW_INPUTS_NUM_OBJECTIVES], word, * maximum;
+	size_t i, j, end;
+	int objective, raised = 0;
+
+	costs[SLOW_INPUTS_COST] = cost;
+	costs[SLOW_INPUTS_RSS] = max_rss_kb;
+	if (!cost && !max_rss_kb)
+		return 0;
+	if (!trace_bits || !trace_size) {
+		trace_bits = &no_map;
+		trace_size = 1;
+	}
+
+	if (take_mutex(slow->mutex))
+		return -1;
+	if (!slow->map_size && slow_inputs_allocate(slow, trace_size)) {
+		release_mutex(slow->mutex);
+		return -1;
+	}
+	//A map that doesn't line up with the others is left out
+	if (trace_size != slow->map_size) {
+		release_mutex(slow->mutex);
+		return 0;
+	}
+
+	//Most of the map is zero, so it's skipped a word at a time
+	for (i = 0; i < trace_size; i += sizeof(word))
+	{
+		end = i + sizeof(word) < trace_size ? i + sizeof(word) : trace_size;
+		if (end - i == sizeof(word)) {
+			memcpy(&word, trace_bits + i, sizeof(word));
+			if (!word)
+				continue;
+		}
+		for (j = i; j < end; j++)
+		{
+			if (!trace_bits[j])
+				continue;
+			for (objective = 0; objective < SLOW_INPUTS_NUM_OBJECTIVES; objective++)
+			{
+				maximum = &slow->maxima[objective][j];
+				if (costs[objective] <= *maximum + *maximum * SLOW_INPUTS_MIN_GAIN_PERCENT / 100)
+					continue;
+				if (*maximum)
+					raised = 1;
+				*maximum = costs[objective];
+			}
+		}
+	}
+	for (objective = 0; objective < SLOW_INPUTS_NUM_OBJECTIVES; objective++) {
+		if (costs[objective] > slow->highest[objective])
+			slow->highest[objective] = costs[objective];
+	}
+	release_mutex(slow->mutex);
+	return raised;
+}
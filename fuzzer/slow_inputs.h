@@ -0,0 +1,34 @@
+#pragma once
+#include <utils.h>
+#include <stdint.h>
+
+//In slow input mode (-f), the cost of each run is something to raise, as in PerfFuzz, rather than only
+//something for the corpus to keep down.  For each byte of the coverage map, the most costly run that hit it is
+//remembered for each objective, and a run that beats one of those maxima by SLOW_INPUTS_MIN_GAIN_PERCENT is a
+//slow input, which is saved in the slow directory and added to the corpus, so it's mutated further.  A run
+//that only beats a maximum by a little doesn't count, so the jitter of the wall time doesn't mark inputs as
+//slow.  Instrumentations without a coverage map keep a single maximum for each objective.
+
+#define SLOW_INPUTS_DIRECTORY        "slow"
+#define SLOW_INPUTS_MIN_GAIN_PERCENT 20
+
+//The objectives that a slow input can raise
+enum {
+	SLOW_INPUTS_COST,   //The cost of the run, in instructions if they were counted, or else microseconds
+	SLOW_INPUTS_RSS,    //The peak RSS of the run's target process, in kilobytes
+	SLOW_INPUTS_NUM_OBJECTIVES
+};
+
+struct slow_inputs
+{
+	mutex_t mutex;
+	uint64_t * maxima[SLOW_INPUTS_NUM_OBJECTIVES]; //The most costly run that hit each byte of the coverage map
+	size_t map_size;                               //The size of the maxima, or 0 until the first run's is known
+	uint64_t highest[SLOW_INPUTS_NUM_OBJECTIVES];  //The most costly run of any byte
+};
+typedef struct slow_inputs slow_inputs_t;
+
+slow_inputs_t * slow_inputs_create(void);
+void slow_inputs_destroy(slow_inputs_t * slow);
+int slow_inputs_update(slow_inputs_t * slow, const uint8_t * trace_bits, size_t trace_size, uint64_t cost,
+	uint64_t max_rss_kb);
@@ -0,0 +1,320 @@
+#include "stats.h"
+#include "metrics.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#define MEMORY_BARRIER() MemoryBarrier()
+#else
+#include <sys/mman.h>   // mmap
+#include <fcntl.h>      // open
+#include <unistd.h>     // ftruncate, getpid, usleep
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * This function creates the shared memory file in the output directory and maps the stats block from it.
+ * @param path - the path of the shared memory file
+ * @return - the mapped stats block on success, or NULL on failure
+ */
+static fuzzer_stats_block_t * map_stats_block(const char * path)
+{
+	void * block = NULL;
+#ifdef _WIN32
+	HANDLE file, mapping;
+
+	file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, 0, sizeof(fuzzer_stats_block_t), NULL);
+	if (mapping) {
+		//The view keeps the mapping open after the handles are closed
+		block = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(fuzzer_stats_block_t));
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	if (!ftruncate(fd, sizeof(fuzzer_stats_block_t))) {
+		block = mmap(NULL, sizeof(fuzzer_stats_block_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (block == MAP_FAILED)
+			block = NULL;
+	}
+	close(fd);
+#endif
+	return (fuzzer_stats_block_t *)block;
+}
+
+/**
+ * This function unmaps a stats block that was mapped with map_stats_block
+ * @param block - the stats block to unmap
+ */
+static void unmap_stats_block(fuzzer_stats_block_t * block)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(block);
+#else
+	munmap(block, sizeof(fuzzer_stats_block_t));
+#endif
+}
+
+/**
+ * This function converts a get_time_ms time to milliseconds since the epoch.
+ * @param stats - the fuzzer stats that the time is for
+ * @param time_ms - the get_time_ms time to convert, or 0 for never
+ * @return - the time in milliseconds since the epoch, or 0 if the time_ms parameter was 0
+ */
+static uint64_t stats_epoch_time(fuzzer_stats_t * stats, uint64_t time_ms)
+{
+	if (!time_ms)
+		return 0;
+	return stats->start_time + (time_ms - stats->start_time_ms);
+}
+
+/**
+ * This function creates the fuzzer stats, which collect the workers' counters into the shared memory
+ * block and the stats file in the output directory.  If the shared memory file can't be mapped, the
+ * stats file is still written.
+ * @param directory - the output directory to write the stats files in
+ * @param num_workers - the number of workers to keep counters for
+ * @return - the new fuzzer stats on success, or NULL on failure
+ */
+fuzzer_stats_t * fuzzer_stats_create(char * directory, int num_workers)
+{
+	fuzzer_stats_t * stats;
+	char path[MAX_PATH];
+
+	stats = (fuzzer_stats_t *)calloc(1, sizeof(fuzzer_stats_t));
+	if (!stats)
+		return NULL;
+
+	stats->num_workers = stats->active_workers = num_workers;
+	stats->directory = strdup(directory);
+	stats->counters = (fuzzer_stats_counters_t *)calloc(num_workers, sizeof(fuzzer_stats_counters_t));
+	if (!stats->directory || !stats->counters) {
+		fuzzer_stats_destroy(stats);
+		return NULL;
+	}
+
+	stats->start_time = (uint64_t)time(NULL) * 1000;
+	stats->start_time_ms = stats->last_execs_time = get_time_ms();
+
+	snprintf(path, sizeof(path), "%s/%s", directory, FUZZER_STATS_SHARED_FILENAME);
+	stats->block = map_stats_block(path);
+	if (!stats->block)
+		WARNING_MSG("Failed to map the shared memory stats file %s", path);
+	return stats;
+}
+
+/**
+ * This function frees the fuzzer stats, stopping the stats thread if it's running.
+ * @param stats - the fuzzer stats to free
+ */
+void fuzzer_stats_destroy(fuzzer_stats_t * stats)
+{
+	if (!stats)
+		return;
+	fuzzer_stats_stop(stats);
+	if (stats->block)
+		unmap_stats_block(stats->block);
+	metrics_exporter_destroy(stats->metrics);
+	free(stats->counters);
+	free(stats->directory);
+	free(stats);
+}
+
+/**
+ * This function writes the stats file, replacing it all at once so that readers never see a partial file.
+ * @param stats - the fuzzer stats to write
+ * @param block - the current stats to write to the file
+ * @return - zero on success, non-zero on failure
+ */
+static int write_stats_file(fuzzer_stats_t * stats, fuzzer_stats_block_t * block)
+{
+	char path[MAX_PATH], temp_path[MAX_PATH], buffer[1024];
+	uint64_t run_time = block->last_update - block->start_time, avg_execs_per_sec = 0;
+	int length, ret;
+
+	//The average exec speed over the whole run, which is what the manager sizes the workunits with
+	if (run_time)
+		avg_execs_per_sec = block->execs * 1000 / run_time;
+
+	length = snprintf(buffer, sizeof(buffer),
+		"start_time        : %" PRIu64 "\n"
+		"last_update       : %" PRIu64 "\n"
+		"fuzzer_pid        : %" PRIu64 "\n"
+		"num_workers       : %" PRIu64 "\n"
+		"execs_done        : %" PRIu64 "\n"
+		"execs_per_sec     : %" PRIu64 "\n"
+		"avg_execs_per_sec : %" PRIu64 "\n"
+		"paths_found       : %" PRIu64 "\n"
+		"crashes           : %" PRIu64 "\n"
+		"hangs             : %" PRIu64 "\n"
+		"last_path         : %" PRIu64 "\n"
+		"last_crash        : %" PRIu64 "\n"
+		"last_hang         : %" PRIu64 "\n"
+		"fork_failures     : %" PRIu64 "\n"
+		"trace_overflows   : %" PRIu64 "\n"
+		"oom_kills         : %" PRIu64 "\n"
+		"worker_restarts   : %" PRIu64 "\n"
+		"unconfirmed_hangs : %" PRIu64 "\n"
+		"active_workers    : %" PRIu64 "\n"
+		"slow_inputs       : %" PRIu64 "\n",
+		block->start_time / 1000, block->last_update / 1000, block->pid, block->num_workers,
+		block->execs, block->execs_per_sec, avg_execs_per_sec, block->new_paths, block->crashes, block->hangs,
+		block->last_path / 1000, block->last_crash / 1000, block->last_hang / 1000,
+		block->fork_failures, block->trace_overflows, block->oom_kills, block->worker_restarts,
+		block->unconfirmed_hangs, block->active_workers, block->slow_inputs);
+
+	if (snprintf(path, sizeof(path), "%s/%s", stats->directory, FUZZER_STATS_FILENAME) >= (int)sizeof(path)
+		|| snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path))
+		return 1; //The output directory's path is too long
+	ret = write_buffer_to_file(temp_path, buffer, length);
+	if (!ret) {
+#ifdef _WIN32
+		ret = !MoveFileEx(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+		ret = rename(temp_path, path);
+#endif
+	}
+	return ret;
+}
+
+/**
+ * This function collects the workers' counters into the shared memory block, and writes the stats file
+ * if it hasn't been written recently.  It shouldn't be called while the stats thread is running.
+ * @param stats - the fuzzer stats to update
+ * @param write_file - whether to write the stats file even if it was written recently
+ */
+void fuzzer_stats_update(fuzzer_stats_t * stats, int write_file)
+{
+	fuzzer_stats_block_t current;
+	fuzzer_stats_counters_t * counters;
+	uint64_t now = get_time_ms(), last_crash = 0, last_hang = 0, last_path = 0;
+	int i;
+
+	memset(&current, 0, sizeof(current));
+	for (i = 0; i < stats->num_workers; i++) {
+		counters = &stats->counters[i];
+		current.execs += counters->execs;
+		current.crashes += counters->crashes;
+		current.hangs += counters->hangs;
+		current.new_paths += counters->new_paths;
+		current.fork_failures += counters->fork_failures;
+		current.trace_overflows += counters->trace_overflows;
+		current.oom_kills += counters->oom_kills;
+		current.worker_restarts += counters->worker_restarts;
+		current.unconfirmed_hangs += counters->unconfirmed_hangs;
+		current.slow_inputs += counters->slow_inputs;
+		if (counters->last_crash_ms > last_crash)
+			last_crash = counters->last_crash_ms;
+		if (counters->last_hang_ms > last_hang)
+			last_hang = counters->last_hang_ms;
+		if (counters->last_path_ms > last_path)
+			last_path = counters->last_path_ms;
+	}
+
+	//The exec speed is measured over at least a second, so it doesn't jump around between updates,
+	//unless this is the final update of a shorter run
+	if (now - stats->last_execs_time >= 1000 || (write_file && now > stats->last_execs_time)) {
+		stats->execs_per_sec = (current.execs - stats->last_execs) * 1000 / (now - stats->last_execs_time);
+		stats->last_execs = current.execs;
+		stats->last_execs_time = now;
+	}
+
+	current.magic = FUZZER_STATS_MAGIC;
+	current.version = FUZZER_STATS_VERSION;
+	current.size = sizeof(fuzzer_stats_block_t);
+#ifdef _WIN32
+	current.pid = GetCurrentProcessId();
+#else
+	current.pid = getpid();
+#endif
+	current.num_workers = stats->num_workers;
+	current.active_workers = stats->active_workers;
+	current.start_time = stats->start_time;
+	current.last_update = stats_epoch_time(stats, now);
+	current.execs_per_sec = stats->execs_per_sec;
+	current.last_crash = stats_epoch_time(stats, last_crash);
+	current.last_hang = stats_epoch_time(stats, last_hang);
+	current.last_path = stats_epoch_time(stats, last_path);
+
+	//Only this function writes to the block, so the sequence doesn't need an atomic increment.  The
+	//copy writes the same odd sequence, so it stays odd until the whole block has been written.
+	if (stats->block) {
+		current.sequence = stats->block->sequence + 1;
+		stats->block->sequence = current.sequence;
+		MEMORY_BARRIER();
+		memcpy(stats->block, &current, sizeof(current));
+		MEMORY_BARRIER();
+		stats->block->sequence = current.sequence + 1;
+	}
+
+	if (write_file || now - stats->last_file_update >= FUZZER_STATS_FILE_INTERVAL_MS) {
+		if (write_stats_file(stats, &current))
+			WARNING_MSG("Failed to write the stats file in %s", stats->directory);
+		stats->last_file_update = now;
+	}
+	if (stats->metrics)
+		metrics_export(stats->metrics, &current, now, write_file);
+}
+
+/**
+ * This function runs the stats thread, which updates the stats until fuzzer_stats_stop is called.
+ * @param arg - a pointer to the fuzzer_stats_t to update
+ */
+static THREAD_FUNC(stats_thread)
+{
+	fuzzer_stats_t * stats = (fuzzer_stats_t *)arg;
+
+	while (!stats->stop)
+	{
+#ifdef _WIN32
+		Sleep(FUZZER_STATS_BLOCK_INTERVAL_MS);
+#else
+		usleep(FUZZER_STATS_BLOCK_INTERVAL_MS * 1000);
+#endif
+		fuzzer_stats_update(stats, 0);
+	}
+
+	THREAD_RETURN;
+}
+
+/**
+ * This function starts the stats thread, which periodically updates the shared memory block and the stats file.
+ * @param stats - the fuzzer stats to start updating
+ * @return - zero on success, non-zero on failure
+ */
+int fuzzer_stats_start(fuzzer_stats_t * stats)
+{
+	fuzzer_stats_update(stats, 1);
+	stats->stop = 0;
+	if (create_thread(&stats->thread, stats_thread, stats))
+		return 1;
+	stats->running = 1;
+	return 0;
+}
+
+/**
+ * This function stops the stats thread, if it's running, and writes the final stats.
+ * @param stats - the fuzzer stats to stop updating
+ */
+void fuzzer_stats_stop(fuzzer_stats_t * stats)
+{
+	if (!stats->running)
+		return;
+	stats->stop = 1;
+	join_thread(stats->thread);
+	stats->running = 0;
+	fuzzer_stats_update(stats, 1);
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <utils.h>
+#include <stdint.h>
+
+//The names of the stats files in the output directory.  The stats file is a text file with one
+//"name : value" line per stat, and the shared memory file holds a fuzzer_stats_block_t.
+#define FUZZER_STATS_FILENAME        "fuzzer_stats"
+#define FUZZER_STATS_SHARED_FILENAME "fuzzer_stats.shm"
+
+//How often the shared memory block and the stats file are updated
+#define FUZZER_STATS_BLOCK_INTERVAL_MS 100
+#define FUZZER_STATS_FILE_INTERVAL_MS  1000
+
+#define FUZZER_STATS_MAGIC   0x315354415453424BULL //"KBSTATS1"
+#define FUZZER_STATS_VERSION 1
+
+//The counters that a worker updates as it fuzzes.  Each worker only writes its own counters, so they
+//don't need to be locked, and they're padded to a cache line so the workers' counters don't share one.
+struct fuzzer_stats_counters
+{
+	volatile uint64_t execs;
+	volatile uint64_t crashes;
+	volatile uint64_t hangs;
+	volatile uint64_t new_paths;
+	volatile uint64_t last_crash_ms;  //The get_time_ms time of the last crash, or 0 for never
+	volatile uint64_t last_hang_ms;
+	volatile uint64_t last_path_ms;
+	volatile uint64_t fork_failures;  //Copied from the worker's instrumentation counters
+	volatile uint64_t trace_overflows;
+	volatile uint64_t oom_kills;
+	volatile uint64_t worker_restarts; //The number of times the worker's driver and instrumentation were recreated
+	volatile uint64_t unconfirmed_hangs; //The inputs that timed out, but finished when they were tested again
+	volatile uint64_t slow_inputs;    //The inputs that set a new cost maximum in slow input mode (-f)
+	uint64_t padding[3];
+};
+typedef struct fuzzer_stats_counters fuzzer_stats_counters_t;
+
+//The stats block in the shared memory file, which external monitors can map and read without slowing
+//down the fuzzer.  It's updated like a seqlock: the sequence is odd while the block is being updated.
+//To read it, read the sequence, retry if it's odd, copy the block, and retry if the sequence changed.
+//All of the times are in milliseconds since the epoch.
+struct fuzzer_stats_block
+{
+	uint64_t magic;                //FUZZER_STATS_MAGIC
+	uint32_t version;              //FUZZER_STATS_VERSION
+	uint32_t size;                 //sizeof(fuzzer_stats_block_t)
+	volatile uint64_t sequence;
+	uint64_t pid;
+	uint64_t num_workers;
+	uint64_t start_time;
+	uint64_t last_update;
+	uint64_t execs;
+	uint64_t execs_per_sec;        //Over the last update interval
+	uint64_t crashes;
+	uint64_t hangs;
+	uint64_t new_paths;
+	uint64_t last_crash;
+	uint64_t last_hang;
+	uint64_t last_path;
+	uint64_t fork_failures;
+	uint64_t trace_overflows;
+	uint64_t oom_kills;
+	uint64_t worker_restarts;
+	uint64_t unconfirmed_hangs;
+	uint64_t active_workers;       //The workers that are fuzzing, which the autotune (-Z) may keep below num_workers
+	uint64_t slow_inputs;
+};
+typedef struct fuzzer_stats_block fuzzer_stats_block_t;
+
+struct metrics_exporter;
+
+struct fuzzer_stats
+{
+	char * directory;
+	int num_workers;
+	volatile int active_workers;        //The number of workers that are fuzzing, set by the autotune (-Z)
+	fuzzer_stats_counters_t * counters; //One set of counters for each worker
+
+	//The shared memory block, or NULL if it couldn't be mapped
+	fuzzer_stats_block_t * block;
+
+	//The exporter that sends the stats to a metrics system, or NULL if they aren't exported
+	struct metrics_exporter * metrics;
+
+	uint64_t start_time;           //In milliseconds since the epoch
+	uint64_t start_time_ms;        //The get_time_ms time that the stats were created, to convert the times to the epoch
+	uint64_t last_file_update;
+	uint64_t last_execs;           //The number of execs when the exec speed was last calculated
+	uint64_t last_execs_time;
+	uint64_t execs_per_sec;
+
+	thread_t thread;
+	int running;
+	volatile int stop;
+};
+typedef struct fuzzer_stats fuzzer_stats_t;
+
+fuzzer_stats_t * fuzzer_stats_create(char * directory, int num_workers);
+void fuzzer_stats_destroy(fuzzer_stats_t * stats);
+int fuzzer_stats_start(fuzzer_stats_t * stats);
+void fuzzer_stats_stop(fuzzer_stats_t * stats);
+void fuzzer_stats_update(fuzzer_stats_t * stats, int write_file);
@@ -0,0 +1,99 @@
+#include "trim.h"
+
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function returns the smallest power of two that is at least a value.
+ * @param value - the value to round up
+ * @return - the rounded up value
+ */
+static size_t next_power_of_two(size_t value)
+{
+	size_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+/**
+ * This function trims an input in place, by removing the chunks of it that don't change the path the
+ * target takes.  The chunk size starts at 1/TRIM_START_STEPS of the input, and is halved after each
+ * pass over the input until it reaches 1/TRIM_END_STEPS of the input, or TRIM_MIN_BYTES.
+ * @param driver - the driver to run the trimmed inputs with
+ * @param instrumentation - the instrumentation that the driver uses, which must have get_path_hash
+ * @param instrumentation_state - the driver's instrumentation state
+ * @param input - the input to trim, which is trimmed in place
+ * @param length - a pointer to the length of input, which is updated to the trimmed length
+ * @param path_hash - the path hash of the untrimmed input
+ * @param found - a function to tell about the trim runs that crashed, hung, or found a new path, or NULL
+ * @param context - the context to pass to found
+ * @param execs - a pointer used to return the number of times the target was run
+ * @return - zero on success, or non-zero if the driver or instrumentation failed.  The input is left as
+ * trimmed as it got before the failure.
+ */
+int trim_input(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char * input, size_t * length, uint64_t path_hash, trim_finding_callback_t found, void * context, int * execs)
+{
+	size_t length_p2, remove_length, remove_position, removed, end_length;
+	uint64_t candidate_hash;
+	char * candidate;
+	int fuzz_result, new_path;
+
+	*execs = 0;
+	if (*length < 2 * TRIM_MIN_BYTES)
+		return 0;
+	candidate = (char *)malloc(*length);
+	if (!candidate)
+		return 1;
+
+	length_p2 = next_power_of_two(*length);
+	remove_length = length_p2 / TRIM_START_STEPS;
+	if (remove_length < TRIM_MIN_BYTES)
+		remove_length = TRIM_MIN_BYTES;
+	end_length = length_p2 / TRIM_END_STEPS;
+	if (end_length < TRIM_MIN_BYTES)
+		end_length = TRIM_MIN_BYTES;
+	while (remove_length >= end_length)
+	{
+		//The first chunk is kept, as AFL does, since it's the most likely to hold a header or magic value
+		remove_position = remove_length;
+		while (remove_position < *length)
+		{
+			removed = *length - remove_position;
+			if (removed > remove_length)
+				removed = remove_length;
+			memcpy(candidate, input, remove_position);
+			memcpy(candidate + remove_position, input + remove_position + removed,
+				*length - remove_position - removed);
+
+			fuzz_result = driver->test_input(driver->state, candidate, *length - removed);
+			(*execs)++;
+			if (fuzz_result < 0) {
+				free(candidate);
+				return 1;
+			}
+			new_path = instrumentation->is_new_path(instrumentation_state);
+			if (new_path < 0) {
+				free(candidate);
+				return 1;
+			}
+
+			if (fuzz_result == FUZZ_NONE && !instrumentation->get_path_hash(instrumentation_state, &candidate_hash)
+				&& candidate_hash == path_hash) {
+				memcpy(input, candidate, *length - removed);
+				*length -= removed;
+				continue; //The next chunk has moved to remove_position
+			}
+			if (found && (fuzz_result != FUZZ_NONE || new_path > 0))
+				found(context, candidate, *length - removed, fuzz_result, new_path);
+			remove_position += remove_length;
+		}
+		remove_length >>= 1;
+	}
+
+	free(candidate);
+	return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <driver.h>
+#include <instrumentation.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Before an input that found a new path is added to the corpus, it's trimmed as AFL's trim stage does:
+//chunks of the input are removed, largest first, and a removal is kept when the input without the chunk
+//still takes the same path (its instrumentation path hash doesn't change).  Smaller queue entries make
+//each mutation more likely to hit a byte that matters, and the target runs faster on them.  Trimming
+//takes many runs of the target, so the fuzzer only trims while the target is fast.
+
+#define TRIM_MIN_BYTES   4     //The smallest chunk that's removed
+#define TRIM_START_STEPS 16    //The first chunks removed are 1/TRIM_START_STEPS of the input
+#define TRIM_END_STEPS   1024  //The last chunks removed are 1/TRIM_END_STEPS of the input
+
+//The fuzzer trims while the target's runs average less than this many microseconds
+#define TRIM_DEFAULT_MAX_EXEC_US 2000
+
+/**
+ * A function that is told about the trim runs that crashed, hung, or found a new path, so that these
+ * findings aren't lost.  The instrumentation has already run its novelty check on the run.
+ * @param context - the context that was passed to trim_input
+ * @param input - the input that was run, which is only valid until the function returns
+ * @param length - the length of input
+ * @param fuzz_result - the driver's FUZZ_ result for the run
+ * @param new_path - the instrumentation's is_new_path result for the run
+ */
+typedef void(*trim_finding_callback_t)(void * context, const char * input, size_t length,
+	int fuzz_result, int new_path);
+
+int trim_input(driver_t * driver, instrumentation_t * instrumentation, void * instrumentation_state,
+	char * input, size_t * length, uint64_t path_hash, trim_finding_callback_t found, void * context, int * execs);
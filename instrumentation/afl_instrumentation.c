@@ -1,15 +1,34 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h> // for pthread_mutex_*
 #include <stddef.h>  // for NULL
+#include <sys/mman.h> // for mmap, shm_open
+#include <sys/resource.h> // for wait4
 #include <sys/shm.h> // for shm functions
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>  // for lseek, write, ftruncate
+#ifdef __linux__
+#include <linux/memfd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 #include <utils.h>   // for FUZZ_* return values
 
 #include <jansson_helper.h>  // for PARSE_OPTION_*
 
 #include "afl_instrumentation.h"
+#include "binary_state.h"
+#include "bitmap.h"
+#include "xxhash.h"
+
+//The target process finds its shared memory region through an environment
+//variable, which is process wide state.  When several afl instrumentation
+//states are in use from different threads (i.e. the fuzzer's worker mode),
+//exporting the variable and starting the target process must happen as one
+//step, otherwise a target could attach to another state's bitmap.
+static pthread_mutex_t launch_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * This function allocates and initializes a new instrumentation specific state
@@ -43,8 +62,12 @@ void * afl_create(char *options, char *state) {
 void afl_cleanup(void *instrumentation_state) {
 	afl_state_t * state = (afl_state_t *)instrumentation_state;
 
-	//Cleanup the SHM region
-	shmctl(state->shm_id, IPC_RMID, NULL);
+	//Cleanup the SHM region, if this state ever set one up (merged states don't)
+	remove_shm(state);
+	if(state->cmplog_bits) {
+		shmdt(state->cmplog_bits);
+		shmctl(state->cmplog_shm_id, IPC_RMID, NULL);
+	}
 
 	//Kill any remaining target processes
 	destroy_target_process(state, 1);
@@ -54,9 +77,21 @@ void afl_cleanup(void *instrumentation_state) {
 		fork_server_exit(&state->fs);
 		state->fork_server_setup = 0;
 	}
+	if(state->count_instructions && state->instructions_fd >= 0) // merged states don't count
+		close(state->instructions_fd);
+	fork_server_cleanup_input_shm(&state->fs);
+	spawn_target_cleanup(&state->spawn);
+	target_cgroup_cleanup(&state->cgroup);
 
 	free(state->target_path);
 	free(state->qemu_path);
+	free(state->qemu_persistent_addr);
+	free(state->qemu_persistent_ret);
+	free(state->ignore_bytes_file);
+	free(state->ignore_bytes);
+	free_virgin_maps(state);
+	free(state->shared_virgin_maps);
+	free(state);
 }
 
 char * afl_get_state(void *instrumentation_state) {
@@ -68,12 +103,14 @@ char * afl_get_state(void *instrumentation_state) {
 	if (!state_obj)
 		return NULL;
 
-	//Add the virgin_bits, virgin_tmout, and virgin_crash bitmaps
-	ADD_MEM(temp, (const char *)state->virgin_bits, MAP_SIZE, state_obj, "virgin_bits");
-	ADD_MEM(temp, (const char *)state->virgin_tmout, MAP_SIZE, state_obj, "virgin_tmout");
-	ADD_MEM(temp, (const char *)state->virgin_crash, MAP_SIZE, state_obj, "virgin_crash");
+	//Add the virgin_bits, virgin_tmout, and virgin_crash bitmaps.  They're encoded straight from the
+	//state, rather than copied first.
+	ADD_INT(temp, state->map_size, state_obj, "map_size");
+	ADD_MEM_NOCOPY(temp, (const char *)state->virgin_bits, state->map_size, state_obj, "virgin_bits");
+	ADD_MEM_NOCOPY(temp, (const char *)state->virgin_tmout, state->map_size, state_obj, "virgin_tmout");
+	ADD_MEM_NOCOPY(temp, (const char *)state->virgin_crash, state->map_size, state_obj, "virgin_crash");
 
-	ret = json_dumps(state_obj, 0);
+	ret = dump_json_to_string(state_obj, 0, NULL);
 	json_decref(state_obj);
 	return ret;
 }
@@ -87,37 +124,162 @@ void afl_free_state(char *state) {
 }
 
 
+/**
+ * Loads a virgin bitmap from a state.  The shared virgin bitmaps are updated
+ * by the other states at the same time, so the loaded bitmap is merged into
+ * them, rather than replacing them.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param dest - the virgin bitmap to load
+ * @param loaded - the bitmap from the state, map_size bytes long
+ */
+static void load_virgin_map(afl_state_t * state, uint8_t * dest, const uint8_t * loaded) {
+	if(state->shared_virgin_region)
+		bitmap_and_atomic(dest, loaded, state->map_size);
+	else
+		memcpy(dest, loaded, state->map_size);
+}
+
+/**
+ * Loads a virgin bitmap from a binary state (see load_virgin_map).
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param binary_state - the binary state to load the bitmap from
+ * @param name - the name of the bitmap's section
+ * @param dest - the virgin bitmap to load
+ * @return - zero on success, non-zero on failure
+ */
+static int load_binary_virgin_map(afl_state_t * state, binary_state_t * binary_state,
+		const char * name, uint8_t * dest) {
+	uint8_t * loaded;
+	int ret;
+
+	if(!state->shared_virgin_region)
+		return binary_state_get_section(binary_state, name, dest, state->map_size);
+	loaded = malloc(state->map_size);
+	if(!loaded)
+		return 1;
+	ret = binary_state_get_section(binary_state, name, loaded, state->map_size);
+	if(!ret)
+		load_virgin_map(state, dest, loaded);
+	free(loaded);
+	return ret;
+}
+
 #define get_bits(name, dest)                      \
 	GET_MEM(tempstr, state, tempstr, name, result); \
-	memcpy(dest, tempstr, MAP_SIZE);                \
+	load_virgin_map(afl_state, dest, (const uint8_t *)tempstr); \
 	free(tempstr);
 
 int afl_set_state(void *instrumentation_state, char *state) {
-	int result;
+	int result, map_size;
 	char * tempstr;
 	afl_state_t * afl_state = (afl_state_t *)instrumentation_state;
 
 	if(!state || !instrumentation_state)
 		return 1;
 
+	//States saved before the map size was configurable don't list it
+	map_size = get_int_options(state, "map_size", &result);
+	if(result <= 0)
+		map_size = MAP_SIZE;
+	if(set_map_size_from_state(afl_state, map_size))
+		return 1;
+
 	afl_state->loaded_state = 1;
+	memset(afl_state->trace_hashes, 0, sizeof(afl_state->trace_hashes));
 	get_bits("virgin_bits", afl_state->virgin_bits);
 	get_bits("virgin_tmout", afl_state->virgin_tmout);
 	get_bits("virgin_crash", afl_state->virgin_crash);
+	clear_virgin_bytes(afl_state, afl_state->ignore_bytes, afl_state->ignore_bytes_size);
 
 	return 0;
 }
 
 /**
- * This function merges the bitmap in src into the bitmap in dest
- * @param dest - the bitmap that will be combined with the src bitmap.
- * @param src - the bitmap that will be added to the dest bitmap
+ * This function returns the virgin bitmaps in the compact binary state format.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success, or NULL on failure.  It should be
+ *           freed with afl_free_state.
  */
-void merge_bitmaps(u8 * dest, const u8 * src)
-{
-	size_t i;
-	for (i = 0; i < MAP_SIZE; i++)
-		dest[i] &= src[i];
+char * afl_get_binary_state(void *instrumentation_state, size_t *length) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	binary_state_writer_t * writer;
+
+	writer = binary_state_writer_create("afl", 1);
+	if(!writer)
+		return NULL;
+	if(binary_state_add_int(writer, "map_size", state->map_size)
+		|| binary_state_add_section(writer, "virgin_bits", BINARY_STATE_MERGE_AND, 0, state->virgin_bits, state->map_size)
+		|| binary_state_add_section(writer, "virgin_tmout", BINARY_STATE_MERGE_AND, 0, state->virgin_tmout, state->map_size)
+		|| binary_state_add_section(writer, "virgin_crash", BINARY_STATE_MERGE_AND, 0, state->virgin_crash, state->map_size)) {
+		binary_state_writer_free(writer);
+		return NULL;
+	}
+	return binary_state_writer_finish(writer, length);
+}
+
+/**
+ * This function loads a state previously obtained via afl_get_binary_state.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param state - the binary state to load
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_set_binary_state(void *instrumentation_state, char *state, size_t length) {
+	afl_state_t * afl_state = (afl_state_t *)instrumentation_state;
+	binary_state_t * binary_state;
+	int64_t map_size;
+	int ret = 1;
+
+	binary_state = binary_state_open(state, length);
+	if(!binary_state)
+		return 1;
+
+	if(!strcmp(binary_state_instrumentation(binary_state), "afl")
+		&& !binary_state_get_int(binary_state, "map_size", &map_size)
+		&& map_size <= MAX_MAP_SIZE && !set_map_size_from_state(afl_state, (int)map_size)
+		&& !load_binary_virgin_map(afl_state, binary_state, "virgin_bits", afl_state->virgin_bits)
+		&& !load_binary_virgin_map(afl_state, binary_state, "virgin_tmout", afl_state->virgin_tmout)
+		&& !load_binary_virgin_map(afl_state, binary_state, "virgin_crash", afl_state->virgin_crash)) {
+		afl_state->loaded_state = 1;
+		memset(afl_state->trace_hashes, 0, sizeof(afl_state->trace_hashes));
+		clear_virgin_bytes(afl_state, afl_state->ignore_bytes, afl_state->ignore_bytes_size);
+		ret = 0;
+	}
+
+	binary_state_close(binary_state);
+	return ret;
+}
+
+/**
+ * Switches to the map size of a state that's being loaded.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param map_size - the map size of the state being loaded
+ * @return - zero on success, non-zero on failure
+ */
+static int set_map_size_from_state(afl_state_t * state, int map_size) {
+	if(map_size < MIN_MAP_SIZE || map_size > MAX_MAP_SIZE || (map_size & (map_size - 1))) {
+		ERROR_MSG("Invalid map size %d in afl instrumentation state", map_size);
+		return 1;
+	}
+	state->map_size_fixed = 1;
+	if(map_size == state->map_size)
+		return 0;
+
+	//Once the target is running, the map size can't change anymore
+	if(state->trace_bits) {
+		ERROR_MSG("The state's map size (%d) does not match the target's (%d)", map_size, state->map_size);
+		return 1;
+	}
+
+	//The saved bitmaps only make sense for the map size they were built with
+	WARNING_MSG("Using the saved state's map size (%d), rather than %d", map_size, state->map_size);
+	if(resize_virgin_maps(state, map_size))
+		return 1;
+	state->map_size = map_size;
+	return 0;
 }
 
 void * afl_merge(void *instrumentation_state, void *other_instrumentation_state) {
@@ -125,17 +287,29 @@ void * afl_merge(void *instrumentation_state, void *other_instrumentation_state)
 	afl_state_t * second = (afl_state_t *)other_instrumentation_state;
 	afl_state_t * ret;
 
+	//The bitmaps of targets with different map sizes don't line up
+	if(first->map_size != second->map_size) {
+		ERROR_MSG("Cannot merge afl states with different map sizes (%d and %d)",
+			first->map_size, second->map_size);
+		return NULL;
+	}
+
 	ret = (afl_state_t *)malloc(sizeof(afl_state_t));
 	if(!ret)
 		return NULL;
 	memset(ret, 0, sizeof(afl_state_t));
-
-	memcpy(ret->virgin_bits, first->virgin_bits, MAP_SIZE);
-	merge_bitmaps(ret->virgin_bits, second->virgin_bits);
-	memcpy(ret->virgin_tmout, first->virgin_tmout, MAP_SIZE);
-	merge_bitmaps(ret->virgin_tmout, second->virgin_tmout);
-	memcpy(ret->virgin_crash, first->virgin_crash, MAP_SIZE);
-	merge_bitmaps(ret->virgin_crash, second->virgin_crash);
+	if(resize_virgin_maps(ret, first->map_size)) {
+		afl_cleanup(ret);
+		return NULL;
+	}
+	ret->map_size = first->map_size;
+
+	memcpy(ret->virgin_bits, first->virgin_bits, ret->map_size);
+	bitmap_and(ret->virgin_bits, second->virgin_bits, ret->map_size);
+	memcpy(ret->virgin_tmout, first->virgin_tmout, ret->map_size);
+	bitmap_and(ret->virgin_tmout, second->virgin_tmout, ret->map_size);
+	memcpy(ret->virgin_crash, first->virgin_crash, ret->map_size);
+	bitmap_and(ret->virgin_crash, second->virgin_crash, ret->map_size);
 	return ret;
 }
 
@@ -166,10 +340,18 @@ int afl_enable(void *instrumentation_state, pid_t *process, char *cmd_line,
 
 	/* After this memset, trace_bits[] are effectively volatile, so we
 			must prevent any earlier operations from venturing into that
-			territory. */
-	memset(state->trace_bits, 0, MAP_SIZE);
+			territory.  If the last run left everything it touched in the
+			dirty line index, only those lines need to be cleared. */
+	if(state->trace_bits_sparse)
+		bitmap_clear_sparse(state->trace_bits, state->trace_bits + state->map_size,
+			1 << DIRTY_LINE_POW2, state->map_size);
+	else
+		memset(state->trace_bits, 0, state->shm_map_size + DIRTY_INDEX_SIZE(state->shm_map_size));
+	state->trace_bits_sparse = 0;
 	MEM_BARRIER();
 
+	state->run_start_ns = get_time_ns();
+	state->last_exec_max_rss_kb = 0;
 	if(create_target_process(state, cmd_line, input, input_length))
 		return -1;
 	state->process_finished = 0;
@@ -216,6 +398,245 @@ int afl_get_fuzz_result(void *instrumentation_state) {
 	return state->last_fuzz_result;
 }
 
+/**
+ * This function returns the hash of the trace of the last input.  Inputs that
+ * hit the same edges the same number of times have the same hash.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param hash - a pointer used to return the hash
+ * @return - zero on success, or non-zero if the last input didn't exit
+ *           normally, and so has no hash.
+ */
+int afl_get_path_hash(void *instrumentation_state, uint64_t *hash) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->fuzz_results_set && finish_fuzz_round(state) < 0)
+		return 1;
+	if(!state->last_path_hash_valid)
+		return 1;
+	*hash = state->last_path_hash;
+	return 0;
+}
+
+/**
+ * This function returns the hash of the last crash, which combines the
+ * crashing signal with the hash of the simplified trace (which only records
+ * whether each edge was hit), so crashes that take the same edges to the same
+ * signal have the same hash, regardless of their loop counts.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param hash - a pointer used to return the hash
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int afl_get_crash_hash(void *instrumentation_state, uint64_t *hash) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->fuzz_results_set && finish_fuzz_round(state) < 0)
+		return 1;
+	if(state->last_fuzz_result != FUZZ_CRASH)
+		return 1;
+	//The crash branch of finish_fuzz_round already simplified the whole trace
+	*hash = bitmap_hash(state->trace_bits, state->map_size)
+		^ (0x9E3779B97F4A7C15ULL * (uint64_t)WTERMSIG(state->last_status));
+	return 0;
+}
+
+/**
+ * This function returns the details of the last crash.  Only the signal is
+ * known, since the target is just waited on.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param info - a pointer used to return the crash's details
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int afl_get_crash_info(void *instrumentation_state, instrumentation_crash_info_t *info) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(afl_get_fuzz_result(state) != FUZZ_CRASH)
+		return 1;
+	memset(info, 0, sizeof(instrumentation_crash_info_t));
+	info->signal = WTERMSIG(state->last_status);
+	return 0;
+}
+
+/**
+ * This function returns the counts of the problems the instrumentation has
+ * run into while starting the target.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param counters - a pointer used to return the counts
+ */
+void afl_get_counters(void *instrumentation_state, instrumentation_counters_t *counters) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	*counters = state->counters;
+}
+
+/**
+ * This function returns the trace bitmap of the last run.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param trace_bits - a pointer used to return the bitmap, which is only valid
+ *                     until the next run
+ * @param size - a pointer used to return the size of the bitmap
+ * @return - zero on success, or non-zero if the target hasn't been run yet
+ */
+int afl_get_trace_bits(void *instrumentation_state, const uint8_t **trace_bits, size_t *size) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->trace_bits)
+		return 1;
+	*trace_bits = state->trace_bits;
+	*size = state->map_size;
+	return 0;
+}
+
+/**
+ * This function stops the unstable bytes of the bitmap, which change between
+ * runs of the same input, from being reported as new paths, crashes, or hangs.
+ * The bytes are marked as already seen in each of the virgin maps, so the
+ * masking costs nothing per run, and is kept in the saved state.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param unstable_bytes - a map the size of the bitmap, which is non-zero for
+ *                         each byte that should be ignored
+ * @param size - the size of the unstable_bytes parameter, which may be less
+ *               than the bitmap size of this state if its target hasn't
+ *               negotiated the size yet
+ * @return - zero on success, or non-zero if the map is larger than the bitmap
+ */
+int afl_ignore_unstable_bytes(void *instrumentation_state, const uint8_t *unstable_bytes, size_t size) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(size > (size_t)state->virgin_size)
+		return 1;
+	clear_virgin_bytes(state, unstable_bytes, size);
+	return 0;
+}
+
+/**
+ * This function finishes the last run and returns all of its results at once.
+ * The bitmap is only walked once per run, by finish_fuzz_round, no matter how
+ * many of the results the caller uses.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param result - a pointer used to return the results of the last run
+ * @return - zero on success, or -1 on failure
+ */
+int afl_finish_round(void *instrumentation_state, instrumentation_round_result_t *result) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->fuzz_results_set && finish_fuzz_round(state) < 0)
+		return -1;
+	result->fuzz_result = state->last_fuzz_result;
+	result->new_path = state->last_is_new_path ? 1 : 0;
+	result->new_bits = state->last_is_new_path;
+	result->has_path_hash = state->last_path_hash_valid;
+	result->path_hash = state->last_path_hash;
+	result->exec_us = state->last_exec_us;
+	result->exec_instructions = state->last_exec_instructions;
+	result->exec_max_rss_kb = state->last_exec_max_rss_kb;
+	return 0;
+}
+
+/**
+ * This function returns the constants that the target compared its input
+ * against, as recorded by a target built with AFL_LLVM_CMPLOG in the compare
+ * log.  The constants are formatted as an AFL style dictionary, with one
+ * quoted token per line.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @return - the dictionary text, which should be freed with afl_free_state, or
+ *           NULL on failure or if the cmplog option isn't set
+ */
+char * afl_get_dictionary(void *instrumentation_state) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	uint8_t * slot;
+	char * ret, * pos;
+	int i, j, length;
+
+	if(!state->cmplog_bits)
+		return NULL;
+
+	//Every byte takes at most 4 characters escaped, plus the quotes and newline
+	ret = malloc(CMPLOG_SLOTS * (CMPLOG_MAX_LEN * 4 + 3) + 1);
+	if(!ret)
+		return NULL;
+
+	pos = ret;
+	for(i = 0; i < CMPLOG_SLOTS; i++) {
+		slot = state->cmplog_bits + i * CMPLOG_SLOT_SIZE;
+		length = slot[0];
+		if(!length || length > CMPLOG_MAX_LEN)
+			continue;
+
+		*pos++ = '"';
+		for(j = 1; j <= length; j++) {
+			if(slot[j] < 32 || slot[j] >= 127)
+				pos += sprintf(pos, "\\x%02x", slot[j]);
+			else {
+				if(slot[j] == '"' || slot[j] == '\\')
+					*pos++ = '\\';
+				*pos++ = slot[j];
+			}
+		}
+		*pos++ = '"';
+		*pos++ = '\n';
+	}
+	*pos = 0;
+	return ret;
+}
+
+/**
+ * Checks the trace of a run that exited normally for new bits.  If the target
+ * maintains the dirty line index, only the lines it touched are checked, and
+ * only those lines have to be cleared before the next run.  The trace is hashed
+ * first, so that a trace identical to a recent one (which can't have any new
+ * bits) is rejected without walking the virgin map.
+ * @param state - The AFL specific state structure
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+static int has_new_bits(afl_state_t *state) {
+	uint8_t * dirty_index = state->trace_bits + state->map_size;
+	uint64_t hash, * seen;
+
+	if(state->use_dirty_index)
+		hash = bitmap_hash_sparse(state->trace_bits, dirty_index, 1 << DIRTY_LINE_POW2, state->map_size);
+	else
+		hash = bitmap_hash(state->trace_bits, state->map_size);
+	seen = &state->trace_hashes[hash & (TRACE_HASH_CACHE_SIZE - 1)];
+	state->trace_bits_sparse = state->use_dirty_index;
+	state->last_path_hash = hash;
+	state->last_path_hash_valid = 1;
+	if(*seen == hash)
+		return 0;
+	*seen = hash;
+
+	if(state->shared_virgin_region) {
+		if(!state->use_dirty_index)
+			return bitmap_has_new_bits_atomic(state->virgin_bits, state->trace_bits, state->map_size);
+		return bitmap_has_new_bits_atomic_sparse(state->virgin_bits, state->trace_bits,
+			dirty_index, 1 << DIRTY_LINE_POW2, state->map_size);
+	}
+	if(!state->use_dirty_index)
+		return bitmap_has_new_bits(state->virgin_bits, state->trace_bits, state->map_size);
+	return bitmap_has_new_bits_sparse(state->virgin_bits, state->trace_bits,
+		dirty_index, 1 << DIRTY_LINE_POW2, state->map_size);
+}
+
+/**
+ * Simplifies the trace of a run that hung or crashed, and checks it for new
+ * bits in the hang or crash virgin bitmap.
+ * @param state - The AFL specific state structure
+ * @param virgin_map - the virgin bitmap to check the trace against
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+static int simplify_and_has_new_bits(afl_state_t *state, uint8_t *virgin_map) {
+	if(!state->shared_virgin_region)
+		return bitmap_simplify_and_has_new_bits(virgin_map, state->trace_bits, state->map_size);
+	bitmap_simplify_trace(state->trace_bits, state->map_size);
+	return bitmap_has_new_bits_atomic(virgin_map, state->trace_bits, state->map_size);
+}
+
 /**
  * This function determines if the target process CRASHED, HUNG or EXITED
  * NORMALLY, cleans up the process, and checks to see if any new code was
@@ -229,18 +650,15 @@ int afl_get_fuzz_result(void *instrumentation_state) {
  * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
  */
 static int finish_fuzz_round(afl_state_t *state) {
-	int status, rc;
+	int status, rc, max_rss_kb;
 
+	state->last_path_hash_valid = 0;
+	state->last_exec_us = (get_time_ns() - state->run_start_ns) / 1000;
 	// if our process is still running, then it was a hang
 	if(!afl_is_process_done(state)) {
 		destroy_target_process(state, 1);
 		state->last_fuzz_result = FUZZ_HANG;
-#ifdef __x86_64__
-		simplify_trace((uint64_t*)state->trace_bits);
-#else
-		simplify_trace((uint32_t*)state->trace_bits);
-#endif /* ^__x86_64__ */
-		state->last_is_new_path = has_new_bits(state->virgin_tmout, state->trace_bits);
+		state->last_is_new_path = simplify_and_has_new_bits(state, state->virgin_tmout);
 		DEBUG_MSG("Process hung, has_new_bits = %d", state->last_is_new_path);
 		state->fuzz_results_set = 1;
 
@@ -249,7 +667,7 @@ static int finish_fuzz_round(afl_state_t *state) {
 			 compiler below this point. Past this location, trace_bits[] behave
 			 very normally and do not have to be treated as volatile. */
 		MEM_BARRIER();
-		state->last_is_new_path = has_new_bits(state->virgin_bits, state->trace_bits);
+		state->last_is_new_path = has_new_bits(state);
 		state->last_fuzz_result = FUZZ_NONE;  // process exited normally
 		DEBUG_MSG("Process exited normally, has_new_bits = %d", state->last_is_new_path);
 		state->fuzz_results_set = 1;
@@ -258,18 +676,21 @@ static int finish_fuzz_round(afl_state_t *state) {
 		// process was terminated by a signal.  We look for signals which
 		// indicate non-crashing conditions (e.g. SIGPIPE)
 		if(WTERMSIG(state->last_status) == SIGPIPE) {
-			state->last_is_new_path = has_new_bits(state->virgin_bits, state->trace_bits);
+			state->last_is_new_path = has_new_bits(state);
 			state->last_fuzz_result = FUZZ_NONE;  // we'll say the process exited normally
 			DEBUG_MSG("Process exited due to SIGPIPE, has_new_bits = %d", state->last_is_new_path);
 			state->fuzz_results_set = 1;
+		} else if(WTERMSIG(state->last_status) == SIGKILL && target_cgroup_oom_killed(&state->cgroup)) {
+			// the OOM killer stopped it for going over the cgroup's memory limit, which isn't a bug
+			// in the target, and its coverage was cut short
+			state->last_fuzz_result = FUZZ_OOM;
+			state->last_is_new_path = 0;
+			state->counters.oom_kills++;
+			DEBUG_MSG("Process went over the cgroup's memory limit");
+			state->fuzz_results_set = 1;
 		} else {
 			state->last_fuzz_result = FUZZ_CRASH;
-#ifdef __x86_64__
-			simplify_trace((uint64_t*)state->trace_bits);
-#else
-			simplify_trace((uint32_t*)state->trace_bits);
-#endif /* ^__x86_64__ */
-			state->last_is_new_path = has_new_bits(state->virgin_crash, state->trace_bits);
+			state->last_is_new_path = simplify_and_has_new_bits(state, state->virgin_crash);
 			DEBUG_MSG("Process crashed, has_new_bits = %d", state->last_is_new_path);
 			state->fuzz_results_set = 1;
 		}
@@ -278,6 +699,18 @@ static int finish_fuzz_round(afl_state_t *state) {
 		// I'm not sure what happened!
 		return FUZZ_ERROR;
 	}
+
+	// The child's instructions are added to the fork server's counter once it has exited
+	state->last_exec_instructions = 0;
+	if(state->instructions_fd >= 0 && !state->persistence_max_cnt)
+		state->last_exec_instructions = read_instructions_counter(state) - state->run_start_instructions;
+
+	// Without the fork server, afl_is_process_done already got the peak RSS when it reaped the child
+	if(state->measure_rss && state->use_fork_server && !state->persistence_max_cnt
+		&& state->last_fuzz_result != FUZZ_HANG) {
+		max_rss_kb = fork_server_get_max_rss(&state->fs);
+		state->last_exec_max_rss_kb = max_rss_kb > 0 ? max_rss_kb : 0;
+	}
 	return state->last_fuzz_result;
 }
 
@@ -290,6 +723,7 @@ static int finish_fuzz_round(afl_state_t *state) {
  */
 int afl_is_process_done(void *instrumentation_state) {
 	int status, rc;
+	struct rusage usage;
 	afl_state_t * state = (afl_state_t *)instrumentation_state;
 
 	// If the state says we're done, our job is easy!
@@ -306,17 +740,19 @@ int afl_is_process_done(void *instrumentation_state) {
 		return 1;
 	} else {
 		// We just need to check to see if the process is still alive
-		rc = waitpid(state->child_pid, &status, WNOHANG);
+		rc = wait4(state->child_pid, &status, WNOHANG, &usage);
 		if(rc == 0)  // child did not change state
 			return 0;
 		if(rc == state->child_pid) {
 			// our child changed state (exited, received a signal, etc.)
 			state->last_status = status;  // Record it
+			if(state->measure_rss && usage.ru_maxrss > 0)
+				state->last_exec_max_rss_kb = usage.ru_maxrss;
 			state->child_pid = 0;         // We no longer have a child process
 			state->process_finished = 1;  // Mark that we're done
 			return 1;
 		}
-		if(rc == -1) // waitpid failed
+		if(rc == -1) // wait4 failed
 			return -1;
 		ERROR_MSG("waitpid() said pid %d changed state but our child was %d",
 			rc, state->child_pid);
@@ -327,16 +763,114 @@ int afl_is_process_done(void *instrumentation_state) {
 	return -1;
 }
 
+/**
+ * Blocks until the target process is done fuzzing the inputs, or the timeout
+ * expires.
+ * @param instrumentation_state - The afl_state_t object containing this
+ *                                instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process is not done testing the fuzzed input, 1 if the
+ *           process is done, or -1 on error.
+ */
+int afl_wait_for_process_done(void *instrumentation_state, int timeout_ms) {
+	int status;
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(state->process_finished)
+		return 1;
+
+	if(state->use_fork_server) {
+		status = fork_server_wait_for_status(&state->fs, timeout_ms);
+		if(status == FORKSERVER_NO_RESULTS_READY)
+			return 0;
+		if(status < 0)
+			return -1;
+		state->last_status = status;
+		state->process_finished = 1;
+		return 1;
+	}
+
+	if(wait_for_process_exit(state->child_pid, timeout_ms) < 0)
+		return -1;
+	return afl_is_process_done(state);
+}
+
 int afl_help(char **help_str) {
 	*help_str = strdup(
 		"afl - AFL-based instrumentation\n"
 		"Options:\n"
 		"  use_fork_server      Whether to use a fork server; 1=yes, 0=no (default=1)\n"
+		"  lazy_binding         Whether to leave LD_BIND_NOW out of the environment of the\n"
+		"                         targets started without the fork server, so they only\n"
+		"                         resolve the functions they call; 1=yes, 0=no (default=0)\n"
 		"  persistence_max_cnt  The number of executions to run in one process while\n"
 		"                         fuzzing in persistence mode (default=1)\n"
 		"  qemu_mode            Whether to use qemu mode; 1=yes, 0=no (default=0)\n"
 		"  qemu_path            The path to afl-qemu-trace (including executable name)\n"
+		"  qemu_persistent_addr The address (in hex) of the function that qemu mode runs\n"
+		"                         once per input in persistence mode.  Required for qemu\n"
+		"                         persistence mode; the function must read the input itself\n"
+		"  qemu_persistent_ret  The address (in hex) that ends each persistence mode\n"
+		"                         iteration (default=the return address of the function)\n"
 		"  deferred_startup     Whether to use deferred startup mode; 1=yes, 0=no (default=0)\n"
+		"  shm_input            Whether to pass inputs to the target through shared memory,\n"
+		"                         rather than stdin; 1=yes, 0=no (default=0).  The target must\n"
+		"                         read them with KILLERBEEZ_GET_INPUT()\n"
+		"  map_size             The size of the coverage map to offer the target, a power of 2\n"
+		"                         from 8192 to 8388608 (default=65536).  Targets that report\n"
+		"                         their own map size through the fork server override this,\n"
+		"                         and the trace-pc-guard runtime uses the smallest map that\n"
+		"                         fits all of its edges unless this is set\n"
+		"  dirty_index          Whether to ask the target to keep an index of the touched\n"
+		"                         map lines, so sparse maps are checked faster; 1=yes, 0=no\n"
+		"                         (default=0).  Only the trace-pc-guard LLVM runtime, and the\n"
+		"                         LLVM pass with AFL_LLVM_DIRTY_INDEX, support it\n"
+		"  cmplog               Whether to record the constants the target compares its input\n"
+		"                         against, for the fuzzer's dictionary output; 1=yes, 0=no\n"
+		"                         (default=0).  The target must be built with AFL_LLVM_CMPLOG\n"
+		"  huge_pages           Whether to back the coverage map's SHM region and the virgin\n"
+		"                         bitmaps with huge pages, so checking a run's coverage takes\n"
+		"                         fewer TLB misses; 1=yes, 0=no (default=0).  The SHM region\n"
+		"                         needs huge pages reserved in /proc/sys/vm/nr_hugepages, and\n"
+		"                         falls back to regular pages without them\n"
+		"  shm_memfd            Whether to give the target the coverage map as an inherited\n"
+		"                         memfd (or an unlinked POSIX SHM object), rather than a SysV\n"
+		"                         SHM segment, so the number of workers isn't limited by\n"
+		"                         shmmni and no segment is left behind if the fuzzer dies;\n"
+		"                         1=yes, 0=no (default=0).  The target must be built with this\n"
+		"                         version of afl-gcc or afl-clang-fast\n"
+		"  shared_virgin_maps   A name for the virgin bitmaps to share with every other afl\n"
+		"                         instrumentation on this host that uses the same name, such\n"
+		"                         as the fuzzer's other workers, so an edge that one of them\n"
+		"                         finds is never new to the others.  Each new edge is claimed\n"
+		"                         with an atomic update, so only one of them saves it.  The\n"
+		"                         bitmaps are removed once the last one detaches, and a state\n"
+		"                         that is loaded is merged into them (default=none)\n"
+		"  ignore_bytes_file    A file with a byte for each byte of the coverage map, which\n"
+		"                         is non-zero for the bytes that should never count as new\n"
+		"                         coverage, such as the picker or the fuzzer's calibration\n"
+		"                         writes for the bytes that vary between runs of one input\n"
+		"  count_instructions   Whether to count the instructions each run executes with a\n"
+		"                         perf event, which the fuzzer's corpus uses as the cost of\n"
+		"                         the run rather than its wall time; 1=yes, 0=no (default=0).\n"
+		"                         Linux only, and needs the fork server.  The counts aren't\n"
+		"                         known in persistence mode, until the target process exits\n"
+		"  measure_rss          Whether to get the peak RSS of each run's target process,\n"
+		"                         which the fuzzer's slow input mode (-f) tries to raise;\n"
+		"                         1=yes, 0=no (default=0).  With the fork server, it needs a\n"
+		"                         target built with afl-clang-fast or run with the fork server\n"
+		"                         library, and it isn't known in persistence mode\n"
+		"  cgroup               A cgroup v2 directory to create a group in for this worker's\n"
+		"                         fork server and targets, so a target that uses a lot of\n"
+		"                         memory or processes can't slow down the other workers on\n"
+		"                         the host.  It must be writable by the fuzzer and have no\n"
+		"                         processes of its own (default=none).  Linux only\n"
+		"  cgroup_cpus          The CPUs the group may run on, in cpuset.cpus format, e.g.\n"
+		"                         \"2-3\" (default=all)\n"
+		"  cgroup_memory_mb     The group's memory limit in MB.  Targets that the OOM killer\n"
+		"                         stops are counted as oom_kills, rather than crashes\n"
+		"                         (default=no limit)\n"
+		"  cgroup_pids_max      The maximum number of processes in the group (default=no limit)\n"
 		"\n"
 	);
 	if (*help_str == NULL)
@@ -363,11 +897,15 @@ static afl_state_t * setup_options(char *options) {
 		return NULL;
 	memset(state, 0, sizeof(afl_state_t));
 	state->use_fork_server = 1;  // default to use the fork server
+	state->instructions_fd = -1;
+	state->shm_fd = -1;
 
 	if(options) {
 		DEBUG_MSG("JSON options = %s", options);
 		PARSE_OPTION_INT(state, options, use_fork_server,
 				"use_fork_server", afl_cleanup);
+		PARSE_OPTION_INT_TEMP(state, options, spawn.lazy_binding,
+				"lazy_binding", afl_cleanup, lazy_binding);
 		PARSE_OPTION_INT(state, options, persistence_max_cnt,
 				"persistence_max_cnt", afl_cleanup);
 		PARSE_OPTION_INT(state, options, deferred_startup,
@@ -376,7 +914,42 @@ static afl_state_t * setup_options(char *options) {
 				"qemu_mode", afl_cleanup);
 		PARSE_OPTION_STRING(state, options, qemu_path,
 				"qemu_path", afl_cleanup);
+		PARSE_OPTION_STRING(state, options, qemu_persistent_addr,
+				"qemu_persistent_addr", afl_cleanup);
+		PARSE_OPTION_STRING(state, options, qemu_persistent_ret,
+				"qemu_persistent_ret", afl_cleanup);
+		PARSE_OPTION_INT(state, options, shm_input,
+				"shm_input", afl_cleanup);
+		PARSE_OPTION_INT(state, options, huge_pages,
+				"huge_pages", afl_cleanup);
+		PARSE_OPTION_INT(state, options, shm_memfd,
+				"shm_memfd", afl_cleanup);
+		PARSE_OPTION_INT(state, options, map_size,
+				"map_size", afl_cleanup);
+		PARSE_OPTION_INT(state, options, dirty_index,
+				"dirty_index", afl_cleanup);
+		PARSE_OPTION_INT(state, options, cmplog,
+				"cmplog", afl_cleanup);
+		PARSE_OPTION_STRING(state, options, ignore_bytes_file,
+				"ignore_bytes_file", afl_cleanup);
+		PARSE_OPTION_STRING(state, options, shared_virgin_maps,
+				"shared_virgin_maps", afl_cleanup);
+		PARSE_OPTION_INT(state, options, count_instructions,
+				"count_instructions", afl_cleanup);
+		PARSE_OPTION_INT(state, options, measure_rss,
+				"measure_rss", afl_cleanup);
+		PARSE_OPTION_STRING_TEMP(state, options, cgroup.parent,
+				"cgroup", afl_cleanup, cgroup_parent);
+		PARSE_OPTION_STRING_TEMP(state, options, cgroup.cpus,
+				"cgroup_cpus", afl_cleanup, cgroup_cpus);
+		PARSE_OPTION_INT_TEMP(state, options, cgroup.memory_max,
+				"cgroup_memory_mb", afl_cleanup, cgroup_memory_max);
+		PARSE_OPTION_INT_TEMP(state, options, cgroup.pids_max,
+				"cgroup_pids_max", afl_cleanup, cgroup_pids_max);
 	}
+	state->map_size_fixed = state->map_size != 0;
+	if(!state->map_size)
+		state->map_size = MAP_SIZE;
 
 	if(state->persistence_max_cnt && !state->use_fork_server) {
 		ERROR_MSG("Cannot use persistence mode without the fork server");
@@ -387,12 +960,46 @@ static afl_state_t * setup_options(char *options) {
 	} else if(state->qemu_mode && !state->use_fork_server) {
 		ERROR_MSG("Cannot use qemu mode without the fork server");
 		error = 1;
-	} else if(state->qemu_mode && state->persistence_max_cnt) {
-		ERROR_MSG("Cannot use qemu mode and persistence mode (yet).");
+	} else if(state->shm_input && (!state->use_fork_server || state->qemu_mode)) {
+		ERROR_MSG("Cannot use shm input without the fork server, or in qemu mode");
+		error = 1;
+	} else if(state->dirty_index && (!state->use_fork_server || state->qemu_mode)) {
+		ERROR_MSG("Cannot use the dirty line index without the fork server, or in qemu mode");
+		error = 1;
+	} else if(state->qemu_mode && state->persistence_max_cnt && !state->qemu_persistent_addr) {
+		ERROR_MSG("Cannot use qemu mode and persistence mode without the qemu_persistent_addr option");
+		error = 1;
+	} else if((state->qemu_persistent_addr || state->qemu_persistent_ret)
+			&& (!state->qemu_mode || !state->persistence_max_cnt)) {
+		ERROR_MSG("The qemu_persistent_addr and qemu_persistent_ret options need qemu mode and persistence mode");
+		error = 1;
+	} else if(state->count_instructions && !state->use_fork_server) {
+		ERROR_MSG("Cannot count the instructions without the fork server");
+		error = 1;
+	} else if(state->cgroup.parent && !state->use_fork_server) {
+		ERROR_MSG("Cannot use a cgroup without the fork server");
+		error = 1;
+	} else if(!state->cgroup.parent && (state->cgroup.cpus || state->cgroup.memory_max || state->cgroup.pids_max)) {
+		ERROR_MSG("The cgroup_cpus, cgroup_memory_mb and cgroup_pids_max options need the cgroup option");
+		error = 1;
+	} else if(state->cgroup.memory_max < 0 || state->cgroup.pids_max < 0) {
+		ERROR_MSG("The cgroup_memory_mb and cgroup_pids_max options can't be negative");
+		error = 1;
+	} else if(state->map_size < MIN_MAP_SIZE || state->map_size > MAX_MAP_SIZE
+			|| (state->map_size & (state->map_size - 1))) {
+		ERROR_MSG("The map size must be a power of 2 from %d to %d", MIN_MAP_SIZE, MAX_MAP_SIZE);
 		error = 1;
 	}
 
-	if(error) {
+	if(!error && state->ignore_bytes_file) {
+		state->ignore_bytes_size = read_file(state->ignore_bytes_file, (char **)&state->ignore_bytes);
+		if(state->ignore_bytes_size <= 0 || state->ignore_bytes_size > MAX_MAP_SIZE) {
+			ERROR_MSG("Could not read the ignore bytes file %s, or it's larger than the largest map", state->ignore_bytes_file);
+			error = 1;
+		}
+	}
+
+	if(error || resize_virgin_maps(state, state->map_size) || target_cgroup_create(&state->cgroup)) {
 		afl_cleanup(state);
 		return NULL;
 	}
@@ -431,6 +1038,147 @@ static afl_state_t * setup_options(char *options) {
 	return state;
 }
 
+/**
+ * Sets the environment variables that tell the target process where its
+ * bitmap is and how it's laid out.  The caller must hold the launch_mutex.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param shm_str - a buffer of at least 16 bytes to hold the SHM ID's environment variable
+ * @param map_size_str - a buffer of at least 16 bytes to hold the map size's environment variable
+ * @param cmplog_str - a buffer of at least 16 bytes to hold the compare log's SHM ID environment variable
+ */
+static void export_shm_env(afl_state_t * state, char * shm_str, char * map_size_str,
+		char * cmplog_str) {
+	if(state->shm_fd >= 0) {
+		//The memfd is only inherited by the target started while the launch_mutex is held
+		snprintf(shm_str, 16, "%d", state->shm_fd);
+		setenv(SHM_FD_ENV_VAR, shm_str, 1);
+		unsetenv(SHM_ENV_VAR);
+		fcntl(state->shm_fd, F_SETFD, 0);
+	} else {
+		snprintf(shm_str, 16, "%d", state->shm_id);
+		setenv(SHM_ENV_VAR, shm_str, 1);
+		unsetenv(SHM_FD_ENV_VAR);
+	}
+	//Until the map size is settled, offer the fork server the smallest map, so that targets
+	//which size their map to fit their edges report the size they actually need
+	snprintf(map_size_str, 16, "%d", state->use_fork_server && !state->map_size_fixed
+		? MIN_MAP_SIZE : state->map_size);
+	setenv(MAP_SIZE_ENV_VAR, map_size_str, 1);
+	if(state->dirty_index)
+		setenv(DIRTY_INDEX_ENV_VAR, "1", 1);
+	else
+		unsetenv(DIRTY_INDEX_ENV_VAR);
+	if(state->cmplog_bits) {
+		snprintf(cmplog_str, 16, "%d", state->cmplog_shm_id);
+		setenv(CMPLOG_SHM_ENV_VAR, cmplog_str, 1);
+	} else
+		unsetenv(CMPLOG_SHM_ENV_VAR);
+}
+
+/**
+ * Stops the SHM region's memfd being inherited by any more processes, once
+ * the target has been started.  The caller must hold the launch_mutex.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ */
+static void unexport_shm_fd(afl_state_t * state) {
+	if(state->shm_fd >= 0)
+		fcntl(state->shm_fd, F_SETFD, FD_CLOEXEC);
+}
+
+/**
+ * Reads the map size and dirty line index support from the fork server's
+ * hello message.  Targets that don't report a map size may write anywhere in
+ * the SHM region, so the whole region gets checked.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @return - 0 if the map fits in the SHM region, 1 if the SHM region needs to
+ *           be recreated with the new state->map_size and the target restarted,
+ *           or -1 on error
+ */
+static int negotiate_map_size(afl_state_t * state) {
+	int hello = state->fs.hello;
+	int map_size;
+
+	state->use_dirty_index = 0;
+	if(!FORKSERVER_HELLO_HAS_MAP_SIZE(hello)) {
+		state->map_size = state->shm_map_size;
+		if(state->dirty_index)
+			WARNING_MSG("The target did not report its map size, not using the dirty line index");
+		return 0;
+	}
+
+	map_size = FORKSERVER_HELLO_GET_MAP_SIZE(hello);
+	if(map_size < MIN_MAP_SIZE || map_size > MAX_MAP_SIZE) {
+		ERROR_MSG("The target reported an unsupported map size (%d)", map_size);
+		return -1;
+	}
+	if(map_size != state->map_size) {
+		if(state->loaded_state) {
+			ERROR_MSG("The target's map size (%d) does not match the loaded state's map size (%d)",
+				map_size, state->map_size);
+			return -1;
+		}
+		DEBUG_MSG("Target uses a map size of %d, rather than %d", map_size, state->map_size);
+		state->map_size = map_size;
+	}
+	state->map_size_fixed = 1;
+	if(map_size > state->shm_map_size)
+		return 1;
+
+	state->use_dirty_index = state->dirty_index && (hello & FORKSERVER_HELLO_DIRTY_INDEX);
+	if(state->dirty_index && !state->use_dirty_index)
+		WARNING_MSG("The target does not support the dirty line index");
+	return 0;
+}
+
+/**
+ * Opens a perf event that counts the user space instructions the fork server
+ * and the children it forks execute.  The event is inherited by the children,
+ * so each child's count is added to it when the child exits, and the count of a
+ * run is the difference between reads before and after it.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @return - zero on success, non-zero on failure
+ */
+static int open_instructions_counter(afl_state_t * state) {
+#ifdef __linux__
+	struct perf_event_attr pe;
+
+	if(state->instructions_fd >= 0)
+		close(state->instructions_fd);
+
+	memset(&pe, 0, sizeof(struct perf_event_attr));
+	pe.size = sizeof(struct perf_event_attr);
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.config = PERF_COUNT_HW_INSTRUCTIONS;
+	pe.inherit = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	state->instructions_fd = syscall(__NR_perf_event_open, &pe, state->fs.pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if(state->instructions_fd >= 0)
+		return 0;
+	ERROR_MSG("Could not count the target's instructions (perf_event_open failed with errno %d (%s))", errno, strerror(errno));
+	if(errno == ENOENT)
+		ERROR_MSG("The CPU doesn't have an instruction counter, or the virtual machine doesn't expose it");
+	else
+		ERROR_MSG("Try adjusting the perf system permissions with: echo 2 | sudo tee /proc/sys/kernel/perf_event_paranoid");
+#else
+	ERROR_MSG("Counting the target's instructions is only supported on Linux");
+#endif
+	return 1;
+}
+
+/**
+ * Reads the instruction counter opened by open_instructions_counter.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @return - the number of instructions counted so far, or 0 if the counter can't be read
+ */
+static uint64_t read_instructions_counter(afl_state_t * state) {
+	uint64_t count;
+
+	if(read(state->instructions_fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
 /**
  * This function starts the fuzzed process
  * @param state - The afl_state_t object containing this instrumentation's state
@@ -443,11 +1191,14 @@ static int create_target_process(afl_state_t * state, char* cmd_line,
 			char * input, size_t input_length) {
 	char ** argv;
 	char qemu_command_line[4096];
-	int i;
+	char shm_str[16], map_size_str[16], cmplog_str[16];
+	int i, rc;
 
 	if(state->use_fork_server) {
 		if(!state->fork_server_setup) {
 			DEBUG_MSG("Using fork server...");
+			if(state->shm_input && fork_server_setup_input_shm(&state->fs, MAX_FILE))
+				return -1;
 			if(state->qemu_mode) {
 				//prepend the command with the path of afl-qemu-trace
 				snprintf(qemu_command_line, sizeof(qemu_command_line), "%s %s", state->qemu_path, cmd_line);
@@ -458,44 +1209,84 @@ static int create_target_process(afl_state_t * state, char* cmd_line,
 			if(split_command_line(cmd_line, &state->target_path, &argv))
 				return -1;
 
-			if(state->deferred_startup) {
-				//set the deferred environment variable to let the forkserver know it
-				setenv(DEFER_ENV_VAR, "1", 1); //shouldn't do the startup right away
-			}
+			do {
+				pthread_mutex_lock(&launch_mutex);
+				// set the environment variable so the instrumented binary knows which
+				// shared memory ID to attach to when it goes to write the bitmap
+				export_shm_env(state, shm_str, map_size_str, cmplog_str);
+				if(state->deferred_startup) {
+					//set the deferred environment variable to let the forkserver know it
+					setenv(DEFER_ENV_VAR, "1", 1); //shouldn't do the startup right away
+				}
+				if(state->qemu_persistent_addr) {
+					//tell afl-qemu-trace where the persistence mode loop is
+					setenv(QEMU_PERSISTENT_ADDR_VAR, state->qemu_persistent_addr, 1);
+					if(state->qemu_persistent_ret)
+						setenv(QEMU_PERSISTENT_RET_VAR, state->qemu_persistent_ret, 1);
+				}
 
-			//Start the fork server
-			fork_server_init(&state->fs, state->target_path, argv, 0,
-					state->persistence_max_cnt, input_length != 0);
-			state->fork_server_setup = 1;
+				//Start the fork server
+				state->fs.cgroup = state->cgroup.path ? &state->cgroup : NULL;
+				fork_server_init(&state->fs, state->target_path, argv, 0,
+						state->persistence_max_cnt, input_length != 0 && !state->shm_input);
+				unexport_shm_fd(state);
+				pthread_mutex_unlock(&launch_mutex);
+				state->fork_server_setup = 1;
+
+				//Find out how big the target's map is, and if it doesn't fit, restart
+				//the target with a big enough SHM region
+				rc = negotiate_map_size(state);
+				if(rc > 0) {
+					fork_server_exit(&state->fs);
+					waitpid(state->fs.pid, NULL, 0);
+					state->fork_server_setup = 0;
+					remove_shm(state);
+					if(setup_shm(state))
+						rc = -1;
+					else
+						memset(state->trace_bits, 0, state->shm_map_size + DIRTY_INDEX_SIZE(state->shm_map_size));
+				}
+			} while(rc > 0);
 
 			//Free the split arguments
 			for(i = 0; argv[i]; i++)
 				free(argv[i]);
 			free(argv);
+
+			if(rc < 0 || (state->count_instructions && open_instructions_counter(state)))
+				return -1;
 		}
 
-		if(state->fs.target_stdin != -1) {
+		if(state->shm_input) {
+			//Hand the input to the target through the input channel, rather than stdin
+			if(fork_server_write_input(&state->fs, input, input_length))
+				return -1;
+		} else if(state->fs.target_stdin != -1) {
 			//Take care of the stdin input, write over the file, then truncate it accordingly
-			lseek(state->fs.target_stdin, 0, SEEK_SET);
-			if(input != NULL && input_length != 0) {
-				if(write(state->fs.target_stdin, input, input_length) != input_length)
-					FATAL_MSG("Short write to target's stdin file");
-			}
-			if(ftruncate(state->fs.target_stdin, input_length))
-				FATAL_MSG("ftruncate() failed");
-			lseek(state->fs.target_stdin, 0, SEEK_SET);
+			if(write_stdin_file(state->fs.target_stdin, input, input_length))
+				FATAL_MSG("Failed to write the target's stdin file");
 		}
 
-		//Start the new child and tell it to go
+		//Start the new child and tell it to go.  The counter is read first, since the
+		//child's instructions are added to it as soon as the child exits.
+		if(state->instructions_fd >= 0)
+			state->run_start_instructions = read_instructions_counter(state);
 		state->child_pid = fork_server_fork_run(&state->fs);
 		if(state->child_pid < 0) {
+			state->counters.fork_failures++;
 			ERROR_MSG("Fork server failed to fork a new child\n");
 			return -1;
 		}
 	} else {
 		DEBUG_MSG("Not using fork server, executing %s", cmd_line);
-		if (start_process_and_write_to_stdin(cmd_line, input, input_length, &state->child_pid)) {
+		pthread_mutex_lock(&launch_mutex);
+		export_shm_env(state, shm_str, map_size_str, cmplog_str);
+		i = spawn_target_process(&state->spawn, cmd_line, input, input_length, &state->child_pid);
+		unexport_shm_fd(state);
+		pthread_mutex_unlock(&launch_mutex);
+		if (i) {
 			state->child_pid = 0;
+			state->counters.fork_failures++;
 			ERROR_MSG("Failed to create process with command line: %s\n", cmd_line);
 			return -1;
 		}
@@ -552,164 +1343,355 @@ int setup_shm(void *instrumentation_state) {
 	http://www.apache.org/licenses/LICENSE-2.0
 	*/
  
-	char* shm_str;
 	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	size_t shm_size;
 
 	if(state->trace_bits) // if trace_bits already points at the shm
 		return 0;     // region, we've already run this function!
 
-	// If we loaded a saved input bitmap, do not overwrite the
-	// map showing what was fuzzed showing everything as untouched
-	if(!state->loaded_state) {
-		memset(state->virgin_bits, 255, MAP_SIZE);
-		memset(state->virgin_tmout, 255, MAP_SIZE);
-		memset(state->virgin_crash, 255, MAP_SIZE);
-	}
+	// Targets that can't tell us their map size were most likely built with
+	// the default one, so never hand out less than that.  The dirty line
+	// index goes right after the bitmap.
+	state->shm_map_size = state->map_size > MAP_SIZE ? state->map_size : MAP_SIZE;
+	if(resize_virgin_maps(state, state->shm_map_size))
+		return 1;
 
 	// Allocate shared memory; shm_id must be module level or global so
 	// the atexit function has access to it (as we can not pass arguments
 	// to the callback function)
-	state->shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+	shm_size = state->shm_map_size + DIRTY_INDEX_SIZE(state->shm_map_size);
+	if(state->shm_memfd)
+		return setup_shm_fd(state, shm_size) || setup_cmplog_shm(state);
+	state->shm_id = -1;
+#ifdef SHM_HUGETLB
+	if(state->huge_pages) {
+		state->shm_id = shmget(IPC_PRIVATE, (shm_size + HUGE_SHM_PAGE_SIZE - 1) & ~(HUGE_SHM_PAGE_SIZE - 1),
+			IPC_CREAT | IPC_EXCL | SHM_HUGETLB | 0600);
+		if(state->shm_id < 0)
+			WARNING_MSG("Couldn't get huge pages for the SHM region (are any reserved in "
+				"/proc/sys/vm/nr_hugepages?), using regular pages");
+	}
+#endif
+	if(state->shm_id < 0)
+		state->shm_id = shmget(IPC_PRIVATE, shm_size, IPC_CREAT | IPC_EXCL | 0600);
 	if(state->shm_id < 0) {
 		ERROR_MSG("shmget() failed");
 		return 1;
 	}
-	shm_str = alloc_printf("%d", state->shm_id);
-
-	// set the environment variable so the instrumented binary knows which
-	// shared memory ID to attach to when it goes to write the bitmap
-	setenv(SHM_ENV_VAR, shm_str, 1);
-	ck_free(shm_str);
 
 	// Attach to shared memory region
 	state->trace_bits = shmat(state->shm_id, NULL, 0);
-	if(!state->trace_bits) {
+	if(state->trace_bits == (void *)-1) {
+		state->trace_bits = NULL;
+		shmctl(state->shm_id, IPC_RMID, NULL);
 		ERROR_MSG("shmat() failed");
 		return 1;
 	}
 
+	return setup_cmplog_shm(state);
+}
+
+/**
+ * This sets up the compare log's shared memory, if the compare log is used.
+ * The compare log lives in its own region, so that it survives the bitmap
+ * being cleared before every run.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @returns zero on success, non-zero on error
+ */
+static int setup_cmplog_shm(afl_state_t * state) {
+	if(state->cmplog && !state->cmplog_bits) {
+		state->cmplog_shm_id = shmget(IPC_PRIVATE, CMPLOG_SHM_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+		if(state->cmplog_shm_id < 0) {
+			ERROR_MSG("shmget() failed for the compare log");
+			return 1;
+		}
+		state->cmplog_bits = shmat(state->cmplog_shm_id, NULL, 0);
+		if(state->cmplog_bits == (void *)-1) {
+			state->cmplog_bits = NULL;
+			shmctl(state->cmplog_shm_id, IPC_RMID, NULL);
+			ERROR_MSG("shmat() failed for the compare log");
+			return 1;
+		}
+		memset(state->cmplog_bits, 0, CMPLOG_SHM_SIZE);
+	}
+	DEBUG_MSG("Using the %s bitmap functions", bitmap_implementation_name());
 	return 0;
 }
 
 /**
- * Check if the current execution path brings anything new to the table.
- * Update virgin bits to reflect the new paths found, so subsequent calls will
- * always return 0.
- *
- * This function is called after every exec() on a fairly large buffer, so
- * it needs to be fast. We do this in 32-bit and 64-bit flavors.
- *
- * @param virgin_map - The map we should compare against, which will be
- *                     virgin_{bits,tmout,crash} in practice.
- * @param trace_bits - The trace for this particular run
- * @returns - 1 if the only change is the hit-count for a particular tuple;
- *            2 if there are new tuples seen, 0 if it is not a new path
- **/
-static inline uint8_t has_new_bits(uint8_t* virgin_map, uint8_t *trace_bits) {
-	/*
-	This function is based on the AFL has_new_bits function present in afl-fuzz.c,
-	available at this URL:
-	https://github.com/mirrorer/afl/blob/master/afl-fuzz.c#L1968.
-	AFL's license is as shown below:
+ * This creates the SHM region as a memfd, or where there's no memfd_create,
+ * as a POSIX SHM object that's unlinked as soon as it's opened, so that it
+ * can be handed to the target by file descriptor and it goes away with the
+ * last process that has it open.  The descriptor is close-on-exec, except
+ * while the target is being started.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param shm_size - the size of the bitmap and the dirty line index
+ * @returns zero on success, non-zero on error
+ */
+static int setup_shm_fd(afl_state_t * state, size_t shm_size) {
+	char name[64];
+
+	state->shm_fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create) && defined(MFD_HUGETLB)
+	if(state->huge_pages) {
+		state->shm_fd = syscall(SYS_memfd_create, "killerbeez_shm", MFD_CLOEXEC | MFD_HUGETLB);
+		if(state->shm_fd >= 0 && map_shm_fd(state,
+				(shm_size + HUGE_SHM_PAGE_SIZE - 1) & ~(HUGE_SHM_PAGE_SIZE - 1)))
+			state->shm_fd = -1;
+		if(state->shm_fd < 0)
+			WARNING_MSG("Couldn't get huge pages for the SHM region (are any reserved in "
+				"/proc/sys/vm/nr_hugepages?), using regular pages");
+		else
+			return 0;
+	}
+#endif
+#if defined(__linux__) && defined(SYS_memfd_create)
+	state->shm_fd = syscall(SYS_memfd_create, "killerbeez_shm", MFD_CLOEXEC);
+#endif
+	if(state->shm_fd < 0) {
+		snprintf(name, sizeof(name), "/killerbeez_shm.%d.%p", getpid(), (void *)state);
+		state->shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if(state->shm_fd >= 0) {
+			shm_unlink(name);
+			fcntl(state->shm_fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	if(state->shm_fd < 0) {
+		ERROR_MSG("Couldn't create a memfd or POSIX SHM object for the SHM region: %s", strerror(errno));
+		return 1;
+	}
+	if(map_shm_fd(state, shm_size)) {
+		ERROR_MSG("Couldn't map the SHM region: %s", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
 
-	american fuzzy lop - fuzzer code
-	--------------------------------
-	Written and maintained by Michal Zalewski <lcamtuf@google.com>
+/**
+ * This sizes the SHM region's memfd and maps it.  On failure, the memfd is
+ * closed.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param size - the size of the SHM region
+ * @returns zero on success, non-zero on error
+ */
+static int map_shm_fd(afl_state_t * state, size_t size) {
+	if(!ftruncate(state->shm_fd, size)) {
+		state->trace_bits = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, state->shm_fd, 0);
+		if(state->trace_bits != MAP_FAILED) {
+			state->shm_size = size;
+			return 0;
+		}
+	}
+	state->trace_bits = NULL;
+	close(state->shm_fd);
+	state->shm_fd = -1;
+	return 1;
+}
 
-	Forkserver design by Jann Horn <jannhorn@googlemail.com>
+/**
+ * This function detaches and removes the shared memory region, if one was set up
+ * @param state - The afl_state_t object containing this instrumentation's state
+ */
+static void remove_shm(afl_state_t * state) {
+	if(!state->trace_bits)
+		return;
+	if(state->shm_memfd) {
+		munmap(state->trace_bits, state->shm_size);
+		close(state->shm_fd);
+		state->shm_fd = -1;
+	} else {
+		shmdt(state->trace_bits);
+		shmctl(state->shm_id, IPC_RMID, NULL);
+	}
+	state->trace_bits = NULL;
+}
 
-	Copyright 2013, 2014, 2015, 2016, 2017 Google Inc. All rights reserved.
+/**
+ * Grows (or allocates) the virgin bitmaps.  The newly added parts of the
+ * bitmaps are marked as untouched.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param size - the new size of the virgin bitmaps
+ * @return - zero on success, non-zero on failure
+ */
+static int resize_virgin_maps(afl_state_t * state, int size) {
+	uint8_t ** maps[] = { &state->virgin_bits, &state->virgin_tmout, &state->virgin_crash };
+	uint8_t * map, * huge_maps = NULL, * old_maps = state->virgin_bits;
+	int i;
 
-	Licensed under the Apache License, Version 2.0 (the "License");
-	you may not use this file except in compliance with the License.
-	You may obtain a copy of the License at:
+	if(size <= state->virgin_size)
+		return 0;
 
-	http://www.apache.org/licenses/LICENSE-2.0
-	*/
+	//The shared bitmaps can't grow, since the other states are using them
+	if(state->shared_virgin_maps) {
+		if(!state->shared_virgin_region)
+			return attach_shared_virgin_maps(state, size);
+		ERROR_MSG("The map size (%d) is larger than the shared virgin bitmaps' (%d), set a larger map_size",
+			size, state->virgin_size);
+		return 1;
+	}
 
-#ifdef __x86_64__
-  uint64_t* current = (uint64_t*)trace_bits;
-  uint64_t* virgin  = (uint64_t*)virgin_map;
-  uint32_t  i = (MAP_SIZE >> 3);
-#else
-  uint32_t* current = (uint32_t*)trace_bits;
-  uint32_t* virgin  = (uint32_t*)virgin_map;
-  uint32_t  i = (MAP_SIZE >> 2);
-#endif /* ^__x86_64__ */
-
-  uint8_t   ret = 0;
-  while (i--) {
-    /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
-       that have not been already cleared from the virgin map - since this will
-       almost always be the case. */
-    if (unlikely(*current) && unlikely(*current & *virgin)) {
-      if (likely(ret < 2)) {
-        uint8_t* cur = (uint8_t*)current;
-        uint8_t* vir = (uint8_t*)virgin;
-
-        /* Looks like we have not found any new bytes yet; see if any non-zero
-           bytes in current[] are pristine in virgin[]. */
-#ifdef __x86_64__
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-            (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-            (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff)) ret = 2;
-        else ret = 1;
-#else
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff)) ret = 2;
-        else ret = 1;
-#endif /* ^__x86_64__ */
-      }
-      *virgin &= ~*current;
-    }
-    current++;
-    virgin++;
-  }
-  return ret;
-}
-
-/* Destructively simplify trace by eliminating hit count information
-   and replacing it with 0x80 or 0x01 depending on whether the tuple
-   is hit or not. Called on every new crash or timeout, should be
-   reasonably fast. */
-static const uint8_t simplify_lookup[256] = {
-  [0]         = 1,
-  [1 ... 255] = 128
-};
-
-#ifdef __x86_64__
-static void simplify_trace(uint64_t* mem) {
-  uint32_t i = MAP_SIZE >> 3;
-  while (i--) {
-    /* Optimize for sparse bitmaps. */
-    if (unlikely(*mem)) {
-      uint8_t* mem8 = (uint8_t*)mem;
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
-      mem8[4] = simplify_lookup[mem8[4]];
-      mem8[5] = simplify_lookup[mem8[5]];
-      mem8[6] = simplify_lookup[mem8[6]];
-      mem8[7] = simplify_lookup[mem8[7]];
-    } else *mem = 0x0101010101010101ULL;
-    mem++;
-  }
+	//With huge pages, the three bitmaps share one huge page backed buffer
+	if(state->huge_pages) {
+		huge_maps = alloc_huge_buffer(VIRGIN_MAPS_COUNT * (size_t)size);
+		if(!huge_maps) {
+			ERROR_MSG("Failed to allocate the virgin bitmaps");
+			return 1;
+		}
+	}
+
+	for(i = 0; i < VIRGIN_MAPS_COUNT; i++) {
+		if(huge_maps) {
+			map = huge_maps + i * (size_t)size;
+			if(*maps[i])
+				memcpy(map, *maps[i], state->virgin_size);
+		}
+		else {
+			map = realloc(*maps[i], size);
+			if(!map) {
+				ERROR_MSG("Failed to allocate the virgin bitmaps");
+				return 1;
+			}
+		}
+		memset(map + state->virgin_size, 255, size - state->virgin_size);
+		*maps[i] = map;
+	}
+	if(huge_maps && old_maps)
+		free_huge_buffer(old_maps, VIRGIN_MAPS_COUNT * (size_t)state->virgin_size);
+	state->virgin_size = size;
+	memset(state->trace_hashes, 0, sizeof(state->trace_hashes));
+	clear_virgin_bytes(state, state->ignore_bytes, state->ignore_bytes_size);
+	return 0;
+}
+
+/**
+ * Frees the virgin bitmaps, whether they're separate allocations or share one
+ * huge page backed buffer.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ */
+static void free_virgin_maps(afl_state_t * state) {
+	struct shmid_ds info;
+
+	if(state->shared_virgin_region) {
+		//The last state to detach removes the bitmaps, so the next campaign starts fresh
+		shmdt(state->shared_virgin_region);
+		if(!shmctl(state->shared_virgin_shm_id, IPC_STAT, &info) && !info.shm_nattch)
+			shmctl(state->shared_virgin_shm_id, IPC_RMID, NULL);
+		state->shared_virgin_region = NULL;
+	}
+	else if(state->huge_pages) {
+		if(state->virgin_bits)
+			free_huge_buffer(state->virgin_bits, VIRGIN_MAPS_COUNT * (size_t)state->virgin_size);
+	}
+	else {
+		free(state->virgin_bits);
+		free(state->virgin_tmout);
+		free(state->virgin_crash);
+	}
+	state->virgin_bits = state->virgin_tmout = state->virgin_crash = NULL;
+	state->virgin_size = 0;
+}
+
+/**
+ * Attaches to the virgin bitmaps that are shared by every state with the same
+ * shared_virgin_maps name, creating and initializing them if this is the first
+ * state to use them.  The bitmaps are in a SysV SHM region, whose key is the
+ * hash of the name, so that other fuzzer processes can share them too.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param size - the size of each of the virgin bitmaps.  Bitmaps that another
+ *               state created are used if they are at least this large.
+ * @return - zero on success, non-zero on failure
+ */
+static int attach_shared_virgin_maps(afl_state_t * state, int size) {
+	size_t region_size = sizeof(shared_virgin_header_t) + VIRGIN_MAPS_COUNT * (size_t)size;
+	key_t key = (key_t)(XXH64(state->shared_virgin_maps, strlen(state->shared_virgin_maps), 0) & 0x7fffffff);
+	shared_virgin_header_t * header;
+	uint8_t * maps;
+	int created = 0, i;
+
+	if(key == IPC_PRIVATE)
+		key = 1;
+	//If the region is removed between failing to create it and opening it, try again
+	for(i = 0; i < 10; i++) {
+		state->shared_virgin_shm_id = shmget(key, region_size, IPC_CREAT | IPC_EXCL | 0600);
+		if(state->shared_virgin_shm_id >= 0) {
+			created = 1;
+			break;
+		}
+		if(errno != EEXIST)
+			break;
+		state->shared_virgin_shm_id = shmget(key, 0, 0600);
+		if(state->shared_virgin_shm_id >= 0 || errno != ENOENT)
+			break;
+	}
+	if(state->shared_virgin_shm_id < 0) {
+		ERROR_MSG("Couldn't get the shared virgin bitmaps %s (errno %d)", state->shared_virgin_maps, errno);
+		return 1;
+	}
+
+	header = shmat(state->shared_virgin_shm_id, NULL, 0);
+	if(header == (void *)-1) {
+		ERROR_MSG("Couldn't attach the shared virgin bitmaps %s (errno %d)", state->shared_virgin_maps, errno);
+		if(created)
+			shmctl(state->shared_virgin_shm_id, IPC_RMID, NULL);
+		return 1;
+	}
+	state->shared_virgin_region = header;
+	maps = (uint8_t *)(header + 1);
+
+	if(created) {
+		memset(maps, 255, VIRGIN_MAPS_COUNT * (size_t)size);
+		header->map_size = size;
+		MEM_BARRIER();
+		header->magic = SHARED_VIRGIN_MAGIC;
+	}
+	else {
+		for(i = 0; header->magic != SHARED_VIRGIN_MAGIC && i < SHARED_VIRGIN_WAIT_MS; i++)
+			usleep(1000);
+		MEM_BARRIER();
+		if(header->magic != SHARED_VIRGIN_MAGIC || header->map_size < (uint32_t)size) {
+			ERROR_MSG("The shared virgin bitmaps %s were never initialized, or are smaller than the map size (%d)",
+				state->shared_virgin_maps, size);
+			free_virgin_maps(state);
+			return 1;
+		}
+		size = header->map_size;
+	}
+
+	state->virgin_bits = maps;
+	state->virgin_tmout = maps + (size_t)size;
+	state->virgin_crash = maps + 2 * (size_t)size;
+	state->virgin_size = size;
+	memset(state->trace_hashes, 0, sizeof(state->trace_hashes));
+	clear_virgin_bytes(state, state->ignore_bytes, state->ignore_bytes_size);
+	return 0;
+}
+
+/**
+ * Marks the ignored bytes as already seen in each of the virgin bitmaps, so
+ * they're never reported as new paths, crashes or hangs.  Only the part of the
+ * ignored bytes that the virgin bitmaps have room for is applied, and the rest
+ * is applied if the bitmaps grow.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @param ignore_bytes - a map that is non-zero for each byte to ignore, or NULL
+ * @param size - the size of the ignore_bytes parameter
+ */
+static void clear_virgin_bytes(afl_state_t * state, const uint8_t * ignore_bytes, size_t size) {
+	size_t i;
+
+	if(!ignore_bytes)
+		return;
+	if(size > (size_t)state->virgin_size)
+		size = state->virgin_size;
+	for(i = 0; i < size; i++) {
+		if(ignore_bytes[i] && state->shared_virgin_region) {
+			__sync_fetch_and_and(&state->virgin_bits[i], 0);
+			__sync_fetch_and_and(&state->virgin_tmout[i], 0);
+			__sync_fetch_and_and(&state->virgin_crash[i], 0);
+		}
+		else if(ignore_bytes[i]) {
+			state->virgin_bits[i] = 0;
+			state->virgin_tmout[i] = 0;
+			state->virgin_crash[i] = 0;
+		}
+	}
 }
-#else
-static void simplify_trace(uint32_t* mem) {
-  uint32_t i = MAP_SIZE >> 2;
-  while (i--) {
-    /* Optimize for sparse bitmaps. */
-    if (unlikely(*mem)) {
-      uint8_t* mem8 = (uint8_t*)mem;
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
-    } else *mem = 0x01010101;
-    mem++;
-  }
-}
-#endif /* ^__x86_64__ */
@@ -5,16 +5,40 @@
 #include <sys/wait.h>  // for waitpid
 
 #include "forkserver_internal.h"
+#include "instrumentation.h"
 
 #include "../afl_progs/config.h"
 #include "../afl_progs/alloc-inl.h"
 
+//The number of recent trace hashes kept to quickly reject repeated paths, must be a power of 2
+#define TRACE_HASH_CACHE_SIZE 256
+//The number of virgin bitmaps: virgin_bits, virgin_tmout and virgin_crash
+#define VIRGIN_MAPS_COUNT 3
+//The size the SHM region is rounded up to when it's backed by huge pages
+#define HUGE_SHM_PAGE_SIZE (2 * 1024 * 1024)
+//Marks a shared virgin maps region as initialized ("KBVM")
+#define SHARED_VIRGIN_MAGIC 0x4d56424b
+//How long to wait for another process to initialize a shared virgin maps region
+#define SHARED_VIRGIN_WAIT_MS 1000
+
+//The header of a shared virgin maps region, which is followed by the virgin_bits,
+//virgin_tmout and virgin_crash bitmaps
+struct shared_virgin_header {
+	volatile uint32_t magic; // SHARED_VIRGIN_MAGIC, once the bitmaps are initialized
+	uint32_t map_size;       // The size of each of the bitmaps
+	uint8_t padding[56];     // Keeps the bitmaps cache line aligned
+};
+typedef struct shared_virgin_header shared_virgin_header_t;
+
 struct afl_state {
 	int shm_id;
 	char *qemu_path;
+	char *qemu_persistent_addr;  // The function to run once per input in qemu persistence mode
+	char *qemu_persistent_ret;   // Where that function returns to, if not the caller
 	char *target_path;
 	pid_t child_pid;
 	forkserver_t fs;
+	spawn_target_t spawn;  // The target, when it's started without the fork server
 	int process_finished;
 	int last_fuzz_result;
 	int fuzz_results_set;  // have we set the fuzz results?
@@ -25,11 +49,45 @@ struct afl_state {
 	int persistence_max_cnt;
 	int qemu_mode;
 	int deferred_startup;
+	int shm_input;  // pass inputs to the target through shared memory
 	int loaded_state;
-	uint8_t virgin_bits[MAP_SIZE];  // Regions yet untouched by fuzzing
-	uint8_t virgin_tmout[MAP_SIZE]; // Bits we haven't seen in tmouts
-	uint8_t virgin_crash[MAP_SIZE]; // Bits we haven't seen in crashes
-	uint8_t *trace_bits;            // SHM with instrumentation bitmap
+	int map_size;         // The size of the bitmap the target uses (negotiated with the fork server)
+	int map_size_fixed;   // Whether map_size was set by the options, a loaded state or the target
+	int shm_map_size;     // The size of the bitmap in the SHM region, at least map_size
+	int shm_memfd;        // Whether to pass the SHM region to the target as an inherited memfd, rather than SysV SHM
+	int shm_fd;           // The memfd (or unlinked POSIX SHM object) holding the SHM region, or -1
+	size_t shm_size;      // The size of the SHM region's mapping
+	int dirty_index;      // Whether to ask the target to maintain the dirty line index
+	int use_dirty_index;  // Whether the target agreed to maintain the dirty line index
+	int trace_bits_sparse; // Only the lines in the dirty line index need clearing
+	int virgin_size;      // The size of the virgin bitmaps
+	int huge_pages;       // Whether to back the SHM region and the virgin bitmaps with huge pages
+	char *shared_virgin_maps; // The name of the virgin bitmaps shared with the other states, or NULL
+	int shared_virgin_shm_id;
+	shared_virgin_header_t *shared_virgin_region; // The shared virgin bitmaps, once they're attached
+	uint8_t *virgin_bits;  // Regions yet untouched by fuzzing
+	uint8_t *virgin_tmout; // Bits we haven't seen in tmouts
+	uint8_t *virgin_crash; // Bits we haven't seen in crashes
+	uint8_t *trace_bits;   // SHM with instrumentation bitmap
+	uint64_t trace_hashes[TRACE_HASH_CACHE_SIZE]; // Hashes of recent normal traces, already merged into virgin_bits
+	uint64_t last_path_hash;   // The hash of the last normal trace
+	int last_path_hash_valid;  // Whether the last run exited normally, and last_path_hash is its hash
+	uint64_t run_start_ns;     // When the last run was started, from get_time_ns
+	uint64_t last_exec_us;     // How long the last run took
+	int count_instructions;    // Whether to count the instructions each run executes
+	int instructions_fd;       // The perf event counting the fork server's and its children's instructions, or -1
+	uint64_t run_start_instructions; // The count before the last run was started
+	uint64_t last_exec_instructions; // How many instructions the last run executed, or 0 if it isn't known
+	int measure_rss;           // Whether to get the peak RSS of each run's target process
+	uint64_t last_exec_max_rss_kb; // The peak RSS of the last run's target process in kilobytes, or 0 if it isn't known
+	int cmplog;            // Whether to give the target a log for the constants it compares against
+	int cmplog_shm_id;
+	uint8_t *cmplog_bits;  // SHM with the compare log, CMPLOG_SLOTS slots of a length byte and the data
+	instrumentation_counters_t counters; // The problems starting the target, for the fuzzer's stats
+	target_cgroup_t cgroup;  // The cgroup the fork server and targets run in, if the cgroup option is set
+	char *ignore_bytes_file; // A file of the bitmap bytes to ignore, such as the picker writes
+	uint8_t *ignore_bytes;   // The contents of ignore_bytes_file, non-zero for each ignored byte
+	int ignore_bytes_size;
 };
 typedef struct afl_state afl_state_t;
 
@@ -38,12 +96,23 @@ void afl_cleanup(void *instrumentation_state);
 char * afl_get_state(void *instrumentation_state);
 void afl_free_state(char *state);
 int afl_set_state(void *instrumentation_state, char *state);
+char * afl_get_binary_state(void *instrumentation_state, size_t *length);
+int afl_set_binary_state(void *instrumentation_state, char *state, size_t length);
 void * afl_merge(void *instrumentation_state, void *other_instrumentation_state);
 int afl_enable(void *instrumentation_state, pid_t *process, char *cmd_line,
 		char *input, size_t input_length);
 int afl_is_new_path(void *instrumentation_state);
 int afl_get_fuzz_result(void *instrumentation_state);
+int afl_get_path_hash(void *instrumentation_state, uint64_t *hash);
+int afl_get_crash_hash(void *instrumentation_state, uint64_t *hash);
+int afl_get_crash_info(void *instrumentation_state, instrumentation_crash_info_t *info);
+char * afl_get_dictionary(void *instrumentation_state);
+void afl_get_counters(void *instrumentation_state, instrumentation_counters_t *counters);
+int afl_get_trace_bits(void *instrumentation_state, const uint8_t **trace_bits, size_t *size);
+int afl_ignore_unstable_bytes(void *instrumentation_state, const uint8_t *unstable_bytes, size_t size);
+int afl_finish_round(void *instrumentation_state, instrumentation_round_result_t *result);
 int afl_is_process_done(void *instrumentation_state);
+int afl_wait_for_process_done(void *instrumentation_state, int timeout_ms);
 int afl_help(char **help_str);
 
 static afl_state_t * setup_options(char *options);
@@ -51,11 +120,19 @@ static void destroy_target_process(afl_state_t * state, int force);
 static int create_target_process(afl_state_t * state, char* cmd_line,
 			char * input, size_t input_length);
 int setup_shm(void *instrumentation_state);
-static void remove_shm();
-#ifdef __x86_64__
-static void simplify_trace(uint64_t* mem);
-#else
-static void simplify_trace(uint32_t* mem);
-#endif /* ^__x86_64__ */
-static inline uint8_t has_new_bits(uint8_t* virgin_map, uint8_t *trace_bits);
+static void remove_shm(afl_state_t * state);
+static int setup_cmplog_shm(afl_state_t * state);
+static int setup_shm_fd(afl_state_t * state, size_t shm_size);
+static int map_shm_fd(afl_state_t * state, size_t size);
+static int resize_virgin_maps(afl_state_t * state, int size);
+static void free_virgin_maps(afl_state_t * state);
+static int attach_shared_virgin_maps(afl_state_t * state, int size);
+static int set_map_size_from_state(afl_state_t * state, int map_size);
+static void clear_virgin_bytes(afl_state_t * state, const uint8_t * ignore_bytes, size_t size);
+static int negotiate_map_size(afl_state_t * state);
+static int open_instructions_counter(afl_state_t * state);
+static uint64_t read_instructions_counter(afl_state_t * state);
 static int finish_fuzz_round(afl_state_t *state);
+static int has_new_bits(afl_state_t *state);
+static void export_shm_env(afl_state_t * state, char * shm_str, char * map_size_str,
+		char * cmplog_str);
@@ -0,0 +1,1511 @@
+#include "binary_state.h"
+#include "bitmap.h"
+
+#include <utils.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//RLE encoding: a control byte below RLE_RUN is followed by control + 1 literal
+//bytes.  RLE_RUN is followed by the repeated byte, and then the run's length
+//minus RLE_MIN_RUN as a LEB128 varint.  Virgin bitmaps are mostly long runs
+//of 0xff, so they shrink to a tiny fraction of their size.
+#define RLE_RUN         0x80
+#define RLE_MAX_LITERAL 0x80
+#define RLE_MIN_RUN     4
+
+struct binary_state_writer_section
+{
+	struct binary_state_section info;
+	char * data;
+};
+
+struct binary_state_writer
+{
+	char instrumentation[16];
+	int compress;
+	uint32_t num_sections;
+	uint32_t max_sections;
+	struct binary_state_writer_section * sections;
+};
+
+struct binary_state
+{
+	const char * buffer;
+	size_t length;
+	int mapped;
+	struct binary_state_header header;
+	struct binary_state_section * sections;
+};
+
+#define ALIGN_UP(x) (((x) + BINARY_STATE_ALIGNMENT - 1) & ~((uint64_t)BINARY_STATE_ALIGNMENT - 1))
+
+//////////////////////////////////////////////////////////////
+// RLE Encoding //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+static size_t run_length(const uint8_t * data, size_t length)
+{
+	size_t i;
+	for (i = 1; i < length && data[i] == data[0]; i++);
+	return i;
+}
+
+/**
+ * Encodes a buffer with the RLE encoding
+ * @param data - the buffer to encode
+ * @param length - the length of the data parameter
+ * @param encoded_length - a pointer used to return the length of the encoded buffer
+ * @return - a newly allocated buffer with the encoded data, or NULL on failure or
+ *           if the encoding isn't any smaller than the data
+ */
+static char * rle_encode(const uint8_t * data, size_t length, size_t * encoded_length)
+{
+	uint8_t * out;
+	size_t in_pos = 0, out_pos = 0, run, literal_start, literal_length, remaining;
+
+	//Worst case is all literals: one control byte per RLE_MAX_LITERAL bytes, plus
+	//the run that pushes the output past the input's length
+	out = malloc(length + length / RLE_MAX_LITERAL + 16);
+	if (!out)
+		return NULL;
+
+	while (in_pos < length) {
+		run = run_length(data + in_pos, length - in_pos);
+		if (run >= RLE_MIN_RUN) {
+			out[out_pos++] = RLE_RUN;
+			out[out_pos++] = data[in_pos];
+			remaining = run - RLE_MIN_RUN;
+			do {
+				out[out_pos++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+				remaining >>= 7;
+			} while (remaining);
+			in_pos += run;
+			if (out_pos >= length) //It's not getting any smaller
+				break;
+			continue;
+		}
+
+		//Collect literal bytes until the next worthwhile run
+		literal_start = in_pos;
+		while (in_pos < length && in_pos - literal_start < RLE_MAX_LITERAL) {
+			if (run_length(data + in_pos, length - in_pos) >= RLE_MIN_RUN)
+				break;
+			in_pos++;
+		}
+		literal_length = in_pos - literal_start;
+		out[out_pos++] = (uint8_t)(literal_length - 1);
+		memcpy(out + out_pos, data + literal_start, literal_length);
+		out_pos += literal_length;
+		if (out_pos >= length)
+			break;
+	}
+
+	if (out_pos >= length) {
+		free(out);
+		return NULL;
+	}
+	*encoded_length = out_pos;
+	return (char *)out;
+}
+
+#define RLE_OP_COPY 0
+#define RLE_OP_AND  1
+
+/**
+ * Decodes RLE encoded data into a buffer, either copying it or ANDing it with the
+ * buffer's current contents.  When ANDing, runs of 0xff are skipped entirely.
+ * @param encoded - the RLE encoded data
+ * @param encoded_length - the length of the encoded parameter
+ * @param dest - the buffer to decode to
+ * @param length - the decoded length of the data, which must match the dest buffer's size
+ * @param op - RLE_OP_COPY or RLE_OP_AND
+ * @return - 0 on success, non-zero if the encoded data is malformed
+ */
+static int rle_decode(const uint8_t * encoded, size_t encoded_length, uint8_t * dest, size_t length, int op)
+{
+	size_t in_pos = 0, out_pos = 0, count, i;
+	uint64_t run;
+	int shift;
+	uint8_t value;
+
+	while (in_pos < encoded_length) {
+		if (encoded[in_pos] < RLE_RUN) {
+			count = encoded[in_pos++] + 1;
+			if (count > encoded_length - in_pos || count > length - out_pos)
+				return 1;
+			if (op == RLE_OP_COPY)
+				memcpy(dest + out_pos, encoded + in_pos, count);
+			else
+				bitmap_and(dest + out_pos, encoded + in_pos, count);
+			in_pos += count;
+			out_pos += count;
+			continue;
+		}
+
+		if (encoded[in_pos] != RLE_RUN || encoded_length - in_pos < 3)
+			return 1;
+		value = encoded[in_pos + 1];
+		in_pos += 2;
+		run = 0;
+		shift = 0;
+		do {
+			if (in_pos >= encoded_length || shift > 56)
+				return 1;
+			run |= (uint64_t)(encoded[in_pos] & 0x7f) << shift;
+			shift += 7;
+		} while (encoded[in_pos++] & 0x80);
+		run += RLE_MIN_RUN;
+		if (run > length - out_pos)
+			return 1;
+
+		count = (size_t)run;
+		if (op == RLE_OP_COPY)
+			memset(dest + out_pos, value, count);
+		else if (!value)
+			memset(dest + out_pos, 0, count);
+		else if (value != 0xff) {
+			for (i = 0; i < count; i++)
+				dest[out_pos + i] &= value;
+		}
+		out_pos += count;
+	}
+	return out_pos != length;
+}
+
+//////////////////////////////////////////////////////////////
+// Writing ///////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Creates a new binary state writer
+ * @param instrumentation_name - the name of the instrumentation writing the state
+ * @param compress - whether sections should be RLE encoded when that makes them smaller
+ * @return - a binary state writer that should be freed with binary_state_writer_finish or
+ *           binary_state_writer_free, or NULL on failure
+ */
+binary_state_writer_t * binary_state_writer_create(const char * instrumentation_name, int compress)
+{
+	binary_state_writer_t * writer;
+
+	if (strlen(instrumentation_name) >= sizeof(writer->instrumentation))
+		return NULL;
+	writer = calloc(1, sizeof(binary_state_writer_t));
+	if (!writer)
+		return NULL;
+	strncpy(writer->instrumentation, instrumentation_name, sizeof(writer->instrumentation) - 1);
+	writer->compress = compress;
+	return writer;
+}
+
+/**
+ * Adds a section to a binary state
+ * @param writer - a binary state writer created with binary_state_writer_create
+ * @param name - the name of the section, shorter than BINARY_STATE_NAME_LENGTH
+ * @param merge - how the section should be merged with other states, one of the BINARY_STATE_MERGE_* values
+ * @param record_size - the size of each record, for BINARY_STATE_MERGE_UNION sections.  The records must
+ *                      be sorted in memcmp order.
+ * @param data - the section's data
+ * @param length - the length of the data parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int binary_state_add_section(binary_state_writer_t * writer, const char * name, uint32_t merge,
+	uint32_t record_size, const void * data, size_t length)
+{
+	struct binary_state_writer_section * section, * sections;
+	size_t encoded_length;
+	char * encoded = NULL;
+
+	if (strlen(name) >= BINARY_STATE_NAME_LENGTH || merge > BINARY_STATE_MERGE_UNION
+		|| (merge == BINARY_STATE_MERGE_UNION && (!record_size || length % record_size)))
+		return 1;
+
+	if (writer->num_sections == writer->max_sections) {
+		sections = realloc(writer->sections, (writer->max_sections + 8) * sizeof(struct binary_state_writer_section));
+		if (!sections)
+			return 1;
+		writer->sections = sections;
+		writer->max_sections += 8;
+	}
+
+	section = &writer->sections[writer->num_sections];
+	memset(section, 0, sizeof(struct binary_state_writer_section));
+	strncpy(section->info.name, name, BINARY_STATE_NAME_LENGTH - 1);
+	section->info.merge = merge;
+	section->info.record_size = record_size;
+	section->info.length = length;
+
+	if (writer->compress && length)
+		encoded = rle_encode((const uint8_t *)data, length, &encoded_length);
+	if (encoded) {
+		section->info.encoding = BINARY_STATE_ENCODING_RLE;
+		section->info.stored_length = encoded_length;
+		section->data = encoded;
+	} else {
+		section->info.encoding = BINARY_STATE_ENCODING_RAW;
+		section->info.stored_length = length;
+		section->data = length ? memdup((void *)data, length) : malloc(1);
+		if (!section->data)
+			return 1;
+	}
+
+	writer->num_sections++;
+	return 0;
+}
+
+/**
+ * Adds a section holding a single integer to a binary state.  These sections keep the first
+ * state's value when merging.
+ * @param writer - a binary state writer created with binary_state_writer_create
+ * @param name - the name of the section, shorter than BINARY_STATE_NAME_LENGTH
+ * @param value - the integer to store
+ * @return - 0 on success, non-zero on failure
+ */
+int binary_state_add_int(binary_state_writer_t * writer, const char * name, int64_t value)
+{
+	return binary_state_add_section(writer, name, BINARY_STATE_MERGE_FIRST, 0, &value, sizeof(value));
+}
+
+/**
+ * Lays out the sections added to a binary state writer, and frees the writer
+ * @param writer - a binary state writer created with binary_state_writer_create
+ * @param length - a pointer used to return the length of the binary state
+ * @return - a newly allocated buffer holding the binary state that should be freed with free,
+ *           or NULL on failure
+ */
+char * binary_state_writer_finish(binary_state_writer_t * writer, size_t * length)
+{
+	struct binary_state_header * header;
+	struct binary_state_section * sections;
+	uint64_t offset;
+	uint32_t i;
+	char * buffer;
+
+	offset = ALIGN_UP(sizeof(struct binary_state_header) + writer->num_sections * sizeof(struct binary_state_section));
+	for (i = 0; i < writer->num_sections; i++) {
+		writer->sections[i].info.offset = offset;
+		offset = ALIGN_UP(offset + writer->sections[i].info.stored_length);
+	}
+
+	buffer = calloc(1, (size_t)offset);
+	if (!buffer) {
+		binary_state_writer_free(writer);
+		return NULL;
+	}
+
+	header = (struct binary_state_header *)buffer;
+	memcpy(header->magic, BINARY_STATE_MAGIC, BINARY_STATE_MAGIC_LENGTH);
+	header->version = BINARY_STATE_VERSION;
+	header->num_sections = writer->num_sections;
+	header->length = offset;
+	memcpy(header->instrumentation, writer->instrumentation, sizeof(header->instrumentation));
+
+	sections = (struct binary_state_section *)(buffer + sizeof(struct binary_state_header));
+	for (i = 0; i < writer->num_sections; i++) {
+		sections[i] = writer->sections[i].info;
+		memcpy(buffer + sections[i].offset, writer->sections[i].data, (size_t)sections[i].stored_length);
+	}
+
+	*length = (size_t)offset;
+	binary_state_writer_free(writer);
+	return buffer;
+}
+
+/**
+ * Frees a binary state writer without creating a binary state
+ * @param writer - a binary state writer created with binary_state_writer_create
+ */
+void binary_state_writer_free(binary_state_writer_t * writer)
+{
+	uint32_t i;
+
+	if (!writer)
+		return;
+	for (i = 0; i < writer->num_sections; i++)
+		free(writer->sections[i].data);
+	free(writer->sections);
+	free(writer);
+}
+
+//////////////////////////////////////////////////////////////
+// Reading ///////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Checks whether a state buffer holds a binary state (rather than a JSON state)
+ * @param buffer - the state buffer
+ * @param length - the length of the buffer parameter
+ * @return - non-zero if the buffer is a binary state, 0 otherwise
+ */
+int binary_state_is_binary(const char * buffer, size_t length)
+{
+	return buffer && length >= sizeof(struct binary_state_header)
+		&& !memcmp(buffer, BINARY_STATE_MAGIC, BINARY_STATE_MAGIC_LENGTH);
+}
+
+/**
+ * Checks that a binary state's header and section table are consistent
+ * @param state - the binary state to check, with the header already copied out of the buffer
+ * @return - 0 if the state is valid, non-zero otherwise
+ */
+static int validate_state(binary_state_t * state)
+{
+	struct binary_state_section * section;
+	uint64_t table_end;
+	uint32_t i;
+
+	if (state->header.version != BINARY_STATE_VERSION) {
+		ERROR_MSG("Unsupported binary state version %u", state->header.version);
+		return 1;
+	}
+	//The lengths are checked against the header's size first, so the section table's space doesn't wrap around
+	if (state->length < sizeof(struct binary_state_header) || state->header.length < sizeof(struct binary_state_header)
+			|| state->header.length > state->length || memchr(state->header.instrumentation, 0,
+			sizeof(state->header.instrumentation)) == NULL)
+		return 1;
+	if (state->header.num_sections > (state->header.length - sizeof(struct binary_state_header)) / sizeof(struct binary_state_section))
+		return 1;
+	table_end = sizeof(struct binary_state_header) + (uint64_t)state->header.num_sections * sizeof(struct binary_state_section);
+	if ((uint64_t)state->header.num_sections * sizeof(struct binary_state_section)
+			> state->header.length - sizeof(struct binary_state_header))
+		return 1;
+
+	state->sections = malloc(state->header.num_sections * sizeof(struct binary_state_section) + 1);
+	if (!state->sections)
+		return 1;
+	memcpy(state->sections, state->buffer + sizeof(struct binary_state_header), (size_t)(table_end - sizeof(struct binary_state_header)));
+
+	for (i = 0; i < state->header.num_sections; i++) {
+		section = &state->sections[i];
+		if (!memchr(section->name, 0, BINARY_STATE_NAME_LENGTH)
+			|| section->merge > BINARY_STATE_MERGE_UNION
+			|| section->encoding > BINARY_STATE_ENCODING_RLE
+			|| section->offset < table_end || section->offset > state->header.length
+			|| section->stored_length > state->header.length - section->offset
+			|| (section->encoding == BINARY_STATE_ENCODING_RAW && section->stored_length != section->length)
+			|| (section->merge == BINARY_STATE_MERGE_UNION && (!section->record_size || section->length % section->record_size))
+			|| section->length > SIZE_MAX / 2)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Opens a binary state held in memory.  The buffer must remain valid until the state is closed.
+ * @param buffer - the binary state
+ * @param length - the length of the buffer parameter
+ * @return - a binary state that should be closed with binary_state_close, or NULL if the buffer isn't a
+ *           valid binary state
+ */
+binary_state_t * binary_state_open(const char * buffer, size_t length)
+{
+	binary_state_t * state;
+
+	if (!binary_state_is_binary(buffer, length))
+		return NULL;
+
+	state = calloc(1, sizeof(binary_state_t));
+	if (!state)
+		return NULL;
+	state->buffer = buffer;
+	state->length = length;
+	memcpy(&state->header, buffer, sizeof(struct binary_state_header));
+	if (validate_state(state)) {
+		ERROR_MSG("Malformed binary instrumentation state");
+		binary_state_close(state);
+		return NULL;
+	}
+	return state;
+}
+
+/**
+ * Opens a binary state file by mapping it into memory, rather than reading it
+ * @param filename - the file to open
+ * @return - a binary state that should be closed with binary_state_close, or NULL on failure
+ */
+binary_state_t * binary_state_map_file(const char * filename)
+{
+	binary_state_t * state;
+	const char * buffer;
+	size_t length;
+
+	buffer = map_file(filename, &length);
+	if (!buffer)
+		return NULL;
+
+	state = binary_state_open(buffer, length);
+	if (!state) {
+		unmap_file(buffer, length);
+		return NULL;
+	}
+	state->mapped = 1;
+	return state;
+}
+
+/**
+ * Closes a binary state opened with binary_state_open or binary_state_map_file
+ * @param state - the binary state to close
+ */
+void binary_state_close(binary_state_t * state)
+{
+	if (!state)
+		return;
+	if (state->mapped)
+		unmap_file(state->buffer, state->length);
+	free(state->sections);
+	free(state);
+}
+
+/**
+ * Gets the name of the instrumentation that wrote a binary state
+ * @param state - an opened binary state
+ * @return - the name of the instrumentation
+ */
+const char * binary_state_instrumentation(binary_state_t * state)
+{
+	return state->header.instrumentation;
+}
+
+/**
+ * Gets the buffer holding a binary state
+ * @param state - an opened binary state
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the buffer holding the binary state, valid until the state is closed
+ */
+const char * binary_state_buffer(binary_state_t * state, size_t * length)
+{
+	*length = (size_t)state->header.length;
+	return state->buffer;
+}
+
+static struct binary_state_section * find_section(binary_state_t * state, const char * name)
+{
+	uint32_t i;
+	for (i = 0; i < state->header.num_sections; i++) {
+		if (!strcmp(state->sections[i].name, name))
+			return &state->sections[i];
+	}
+	return NULL;
+}
+
+/**
+ * Gets the decoded length of a section in a binary state
+ * @param state - an opened binary state
+ * @param name - the name of the section
+ * @param length - a pointer used to return the section's length
+ * @return - 0 on success, non-zero if the section doesn't exist
+ */
+int binary_state_section_length(binary_state_t * state, const char * name, size_t * length)
+{
+	struct binary_state_section * section = find_section(state, name);
+	if (!section)
+		return 1;
+	*length = (size_t)section->length;
+	return 0;
+}
+
+/**
+ * Decodes a section of a binary state into a buffer
+ * @param state - an opened binary state
+ * @param name - the name of the section
+ * @param dest - the buffer to decode the section into
+ * @param length - the size of the dest buffer, which must match the section's length
+ * @return - 0 on success, non-zero if the section doesn't exist, has a different length, or is malformed
+ */
+int binary_state_get_section(binary_state_t * state, const char * name, void * dest, size_t length)
+{
+	struct binary_state_section * section = find_section(state, name);
+
+	if (!section || section->length != length)
+		return 1;
+	if (section->encoding == BINARY_STATE_ENCODING_RAW) {
+		memcpy(dest, state->buffer + section->offset, length);
+		return 0;
+	}
+	return rle_decode((const uint8_t *)state->buffer + section->offset, (size_t)section->stored_length,
+		(uint8_t *)dest, length, RLE_OP_COPY);
+}
+
+/**
+ * Gets a pointer to an uncompressed section of a binary state, without copying it
+ * @param state - an opened binary state
+ * @param name - the name of the section
+ * @param length - a pointer used to return the section's length
+ * @return - a pointer to the section's data, valid until the state is closed, or NULL if the section
+ *           doesn't exist or is compressed
+ */
+const void * binary_state_get_raw_section(binary_state_t * state, const char * name, size_t * length)
+{
+	struct binary_state_section * section = find_section(state, name);
+
+	if (!section || section->encoding != BINARY_STATE_ENCODING_RAW)
+		return NULL;
+	*length = (size_t)section->length;
+	return state->buffer + section->offset;
+}
+
+/**
+ * Gets a section added with binary_state_add_int from a binary state
+ * @param state - an opened binary state
+ * @param name - the name of the section
+ * @param value - a pointer used to return the integer
+ * @return - 0 on success, non-zero on failure
+ */
+int binary_state_get_int(binary_state_t * state, const char * name, int64_t * value)
+{
+	return binary_state_get_section(state, name, value, sizeof(*value));
+}
+
+//////////////////////////////////////////////////////////////
+// Merging ///////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Merges two sorted lists of records, dropping duplicates
+ * @param first - the first sorted record list
+ * @param first_length - the length of the first parameter
+ * @param second - the second sorted record list
+ * @param second_length - the length of the second parameter
+ * @param record_size - the size of each record
+ * @param length - a pointer used to return the length of the merged list
+ * @return - a newly allocated buffer holding the merged list, or NULL on failure
+ */
+static char * union_records(const char * first, size_t first_length, const char * second, size_t second_length,
+	size_t record_size, size_t * length)
+{
+	size_t i = 0, j = 0, out = 0;
+	char * merged;
+	int cmp;
+
+	merged = malloc(first_length + second_length + 1);
+	if (!merged)
+		return NULL;
+
+	while (i < first_length || j < second_length) {
+		if (i >= first_length)
+			cmp = 1;
+		else if (j >= second_length)
+			cmp = -1;
+		else
+			cmp = memcmp(first + i, second + j, record_size);
+
+		if (cmp <= 0) {
+			memcpy(merged + out, first + i, record_size);
+			i += record_size;
+			if (!cmp)
+				j += record_size;
+		} else {
+			memcpy(merged + out, second + j, record_size);
+			j += record_size;
+		}
+		out += record_size;
+	}
+	*length = out;
+	return merged;
+}
+
+/**
+ * Gets the decoded contents of a section, either in place or by decoding it into a new buffer
+ * @param state - an opened binary state
+ * @param section - the section to get
+ * @param allocated - a pointer used to return a buffer the caller must free, or NULL if none was allocated
+ * @return - the section's data, or NULL on failure
+ */
+static const char * section_data(binary_state_t * state, struct binary_state_section * section, char ** allocated)
+{
+	*allocated = NULL;
+	if (section->encoding == BINARY_STATE_ENCODING_RAW)
+		return state->buffer + section->offset;
+
+	*allocated = malloc((size_t)section->length + 1);
+	if (!*allocated)
+		return NULL;
+	if (binary_state_get_section(state, section->name, *allocated, (size_t)section->length)) {
+		free(*allocated);
+		*allocated = NULL;
+		return NULL;
+	}
+	return *allocated;
+}
+
+//The inputs are split into one contiguous chunk per thread.  Each thread folds
+//its chunk into a single accumulator per section, and then the accumulators
+//are combined pairwise in a tree, so no intermediate states are created.
+struct merge_chunk
+{
+	binary_state_t ** states;
+	char ** input_filenames;
+	int num_states;
+	struct binary_state_section * sections; //The first state's sections, which every chunk merges
+	uint32_t num_sections;
+	char ** data;          //The accumulated data for each section
+	size_t * lengths;      //The length of the accumulated data for each section
+	struct merge_chunk * other; //The chunk to combine into this one, in the tree phase
+	int error;
+};
+
+/**
+ * Finds a section in another state, and checks that it can be merged with the first state's section
+ * @return - the matching section, or NULL if it is missing or doesn't match
+ */
+static struct binary_state_section * matching_section(binary_state_t * state, struct binary_state_section * section,
+	const char * filename)
+{
+	struct binary_state_section * other = find_section(state, section->name);
+	if (!other || other->merge != section->merge || other->record_size != section->record_size
+		|| (section->merge == BINARY_STATE_MERGE_AND && other->length != section->length)) {
+		ERROR_MSG("Section %s of %s doesn't match the first state", section->name, filename);
+		return NULL;
+	}
+	return other;
+}
+
+/**
+ * Folds one section of every state in a chunk into the chunk's accumulator for that section
+ * @param chunk - the chunk to merge
+ * @param index - the index of the section in the chunk's sections
+ * @return - 0 on success, non-zero on failure
+ */
+static int fold_section(struct merge_chunk * chunk, uint32_t index)
+{
+	struct binary_state_section * section = &chunk->sections[index], * other;
+	const char * other_data;
+	char * merged, * temp, * allocated;
+	size_t merged_length, length;
+	int j;
+
+	other = matching_section(chunk->states[0], section, chunk->input_filenames[0]);
+	if (!other)
+		return 1;
+	merged_length = (size_t)other->length;
+	merged = malloc(merged_length + 1);
+	chunk->data[index] = merged;
+	if (!merged || binary_state_get_section(chunk->states[0], section->name, merged, merged_length))
+		return 1;
+	chunk->lengths[index] = merged_length;
+
+	for (j = 1; j < chunk->num_states && section->merge != BINARY_STATE_MERGE_FIRST; j++) {
+		other = matching_section(chunk->states[j], section, chunk->input_filenames[j]);
+		if (!other)
+			return 1;
+
+		if (section->merge == BINARY_STATE_MERGE_AND) {
+			//AND straight out of the encoded data, rather than decoding it first
+			if (other->encoding == BINARY_STATE_ENCODING_RLE) {
+				if (rle_decode((const uint8_t *)chunk->states[j]->buffer + other->offset, (size_t)other->stored_length,
+						(uint8_t *)merged, merged_length, RLE_OP_AND))
+					return 1;
+			} else
+				bitmap_and((uint8_t *)merged, (const uint8_t *)chunk->states[j]->buffer + other->offset, merged_length);
+		} else { //BINARY_STATE_MERGE_UNION
+			other_data = section_data(chunk->states[j], other, &allocated);
+			if (!other_data)
+				return 1;
+			temp = union_records(merged, merged_length, other_data, (size_t)other->length,
+				section->record_size, &length);
+			free(allocated);
+			if (!temp)
+				return 1;
+			free(merged);
+			chunk->data[index] = merged = temp;
+			chunk->lengths[index] = merged_length = length;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Merges all of the sections of the states in a chunk.  Run in its own thread.
+ * @param arg - the merge_chunk to merge
+ */
+static THREAD_FUNC(fold_chunk)
+{
+	struct merge_chunk * chunk = (struct merge_chunk *)arg;
+	uint32_t i;
+
+	for (i = 0; i < chunk->num_sections && !chunk->error; i++)
+		chunk->error = fold_section(chunk, i);
+	THREAD_RETURN;
+}
+
+/**
+ * Combines the accumulated sections of chunk->other into chunk.  Run in its own thread.
+ * @param arg - the merge_chunk to combine into
+ */
+static THREAD_FUNC(combine_chunks)
+{
+	struct merge_chunk * chunk = (struct merge_chunk *)arg, * other = chunk->other;
+	char * temp;
+	size_t length;
+	uint32_t i;
+
+	for (i = 0; other && i < chunk->num_sections && !chunk->error; i++) {
+		if (chunk->sections[i].merge == BINARY_STATE_MERGE_AND)
+			bitmap_and((uint8_t *)chunk->data[i], (const uint8_t *)other->data[i], chunk->lengths[i]);
+		else if (chunk->sections[i].merge == BINARY_STATE_MERGE_UNION) {
+			temp = union_records(chunk->data[i], chunk->lengths[i], other->data[i], other->lengths[i],
+				chunk->sections[i].record_size, &length);
+			if (!temp) {
+				chunk->error = 1;
+				break;
+			}
+			free(chunk->data[i]);
+			chunk->data[i] = temp;
+			chunk->lengths[i] = length;
+		}
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * Runs a function on each of the given chunks, in parallel
+ * @param func - the function to run
+ * @param chunks - the chunks to run the function on
+ * @param num_chunks - the number of chunks
+ * @param stride - the distance between each chunk that the function should be run on
+ * @return - 0 on success, non-zero if any of the chunks failed
+ */
+static int run_chunks(thread_func_t func, struct merge_chunk * chunks, int num_chunks, int stride)
+{
+	thread_t * threads;
+	int * started;
+	int i, ret = 0;
+
+	threads = calloc(num_chunks, sizeof(thread_t));
+	started = calloc(num_chunks, sizeof(int));
+	if (!threads || !started) {
+		free(threads);
+		free(started);
+		return 1;
+	}
+
+	//Run the last chunk on this thread, rather than waiting idly
+	for (i = 0; i < num_chunks - stride; i += stride)
+		started[i] = !create_thread(&threads[i], func, &chunks[i]);
+	for (; i < num_chunks; i += stride)
+		func(&chunks[i]);
+	for (i = 0; i < num_chunks; i += stride) {
+		if (i < num_chunks - stride && !started[i])
+			func(&chunks[i]); //Creating the thread failed, so run it here instead
+		else if (started[i])
+			join_thread(threads[i]);
+		ret |= chunks[i].error;
+	}
+
+	free(threads);
+	free(started);
+	return ret;
+}
+
+/**
+ * Merges binary state files without loading them into an instrumentation.  The input files are mapped
+ * into memory, and each section is combined according to its merge type.  The inputs are divided between
+ * several threads, whose results are then combined in a tree.
+ * @param output_filename - the file to write the merged binary state to
+ * @param input_filenames - the binary state files to merge
+ * @param num_inputs - the number of files in input_filenames
+ * @param compress - whether the merged state's sections should be RLE encoded when that makes them smaller
+ * @param num_threads - the number of threads to merge with
+ * @return - 0 on success, non-zero on failure
+ */
+int binary_state_merge_files(const char * output_filename, char ** input_filenames, int num_inputs, int compress,
+	int num_threads)
+{
+	binary_state_t ** states;
+	binary_state_writer_t * writer = NULL;
+	struct merge_chunk * chunks = NULL;
+	char * merged;
+	size_t length;
+	uint32_t i, num_sections;
+	int j, start, stride, ret = 1;
+
+	if (num_inputs <= 0)
+		return 1;
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > num_inputs)
+		num_threads = num_inputs;
+	states = calloc(num_inputs, sizeof(binary_state_t *));
+	if (!states)
+		return 1;
+
+	for (j = 0; j < num_inputs; j++) {
+		states[j] = binary_state_map_file(input_filenames[j]);
+		if (!states[j]) {
+			ERROR_MSG("Could not load binary instrumentation state %s", input_filenames[j]);
+			goto out;
+		}
+		if (strcmp(binary_state_instrumentation(states[j]), binary_state_instrumentation(states[0]))) {
+			ERROR_MSG("%s was written by the %s instrumentation, not %s", input_filenames[j],
+				binary_state_instrumentation(states[j]), binary_state_instrumentation(states[0]));
+			goto out;
+		}
+	}
+	num_sections = states[0]->header.num_sections;
+
+	chunks = calloc(num_threads, sizeof(struct merge_chunk));
+	if (!chunks)
+		goto out;
+	for (j = 0, start = 0; j < num_threads; j++) {
+		chunks[j].states = &states[start];
+		chunks[j].input_filenames = &input_filenames[start];
+		chunks[j].num_states = num_inputs / num_threads + (j < num_inputs % num_threads);
+		chunks[j].sections = states[0]->sections;
+		chunks[j].num_sections = num_sections;
+		chunks[j].data = calloc(num_sections + 1, sizeof(char *));
+		chunks[j].lengths = calloc(num_sections + 1, sizeof(size_t));
+		if (!chunks[j].data || !chunks[j].lengths)
+			goto out;
+		start += chunks[j].num_states;
+	}
+
+	if (run_chunks(fold_chunk, chunks, num_threads, 1))
+		goto out;
+	for (stride = 1; stride < num_threads; stride *= 2) {
+		for (j = 0; j + stride < num_threads; j += 2 * stride)
+			chunks[j].other = &chunks[j + stride];
+		//Chunks without a partner in this round have nothing to do
+		for (j = 0; j < num_threads; j += 2 * stride) {
+			if (j + stride >= num_threads)
+				chunks[j].other = NULL;
+		}
+		if (run_chunks(combine_chunks, chunks, num_threads, 2 * stride))
+			goto out;
+	}
+
+	writer = binary_state_writer_create(binary_state_instrumentation(states[0]), compress);
+	if (!writer)
+		goto out;
+	for (i = 0; i < num_sections; i++) {
+		if (binary_state_add_section(writer, chunks[0].sections[i].name, chunks[0].sections[i].merge,
+				chunks[0].sections[i].record_size, chunks[0].data[i], chunks[0].lengths[i]))
+			goto out;
+	}
+
+	merged = binary_state_writer_finish(writer, &length);
+	writer = NULL;
+	if (merged) {
+		ret = write_buffer_to_file((char *)output_filename, merged, length) < 0;
+		free(merged);
+	}
+
+out:
+	binary_state_writer_free(writer);
+	if (chunks) {
+		for (j = 0; j < num_threads; j++) {
+			if (chunks[j].data) {
+				for (i = 0; i < num_sections; i++)
+					free(chunks[j].data[i]);
+			}
+			free(chunks[j].data);
+			free(chunks[j].lengths);
+		}
+		free(chunks);
+	}
+	for (j = 0; j < num_inputs; j++)
+		binary_state_close(states[j]);
+	free(states);
+	return ret;
+}
+
+//////////////////////////////////////////////////////////////
+// Deltas ////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Removes the records in one sorted list of records from another
+ * @param first - the sorted record list to remove records from
+ * @param first_length - the length of the first parameter
+ * @param second - the sorted record list of the records to remove
+ * @param second_length - the length of the second parameter
+ * @param record_size - the size of each record
+ * @param length - a pointer used to return the length of the remaining list
+ * @return - a newly allocated buffer holding the records of first that aren't in second, or NULL on failure
+ */
+static char * difference_records(const char * first, size_t first_length, const char * second, size_t second_length,
+	size_t record_size, size_t * length)
+{
+	size_t i = 0, j = 0, out = 0;
+	char * difference;
+	int cmp;
+
+	difference = malloc(first_length + 1);
+	if (!difference)
+		return NULL;
+
+	while (i < first_length) {
+		cmp = j < second_length ? memcmp(first + i, second + j, record_size) : -1;
+		if (cmp < 0) {
+			memcpy(difference + out, first + i, record_size);
+			out += record_size;
+		}
+		if (cmp <= 0)
+			i += record_size;
+		if (cmp >= 0)
+			j += record_size;
+	}
+	*length = out;
+	return difference;
+}
+
+/**
+ * Creates a delta of a binary state, which holds only what changed since an earlier (base) state of the
+ * same instrumentation.  A delta is itself a binary state, with the same sections as the current state:
+ * BINARY_STATE_MERGE_AND sections hold the bits that were cleared since the base (as zeros, with every
+ * other bit set, so unchanged bitmaps are runs of 0xff that compress to almost nothing), and
+ * BINARY_STATE_MERGE_UNION sections hold the records added since the base.  Merging the base with the
+ * delta, with binary_state_apply_delta or binary_state_merge_files, gives the current state, and deltas
+ * from the same base can be merged with each other to combine them.  The delta also records the hash of
+ * its base state, in the BINARY_STATE_DELTA_BASE section.
+ * @param base - the binary state the delta is from
+ * @param base_length - the length of the base parameter
+ * @param current - the binary state the delta is to
+ * @param current_length - the length of the current parameter
+ * @param compress - whether the delta's sections should be RLE encoded when that makes them smaller
+ * @param length - a pointer used to return the length of the delta
+ * @return - a newly allocated buffer holding the delta that should be freed with free, or NULL on failure
+ */
+char * binary_state_create_delta(const char * base, size_t base_length, const char * current, size_t current_length,
+	int compress, size_t * length)
+{
+	binary_state_t * base_state, * current_state;
+	binary_state_writer_t * writer = NULL;
+	struct binary_state_section * section, * base_section;
+	const char * current_data, * base_data = NULL;
+	char * current_allocated = NULL, * base_allocated = NULL, * delta = NULL, * ret = NULL;
+	size_t delta_length, i;
+	uint32_t j;
+
+	base_state = binary_state_open(base, base_length);
+	current_state = binary_state_open(current, current_length);
+	if (!base_state || !current_state)
+		goto out;
+	if (strcmp(binary_state_instrumentation(base_state), binary_state_instrumentation(current_state))) {
+		ERROR_MSG("Can't create a delta from a %s state to a %s state", binary_state_instrumentation(base_state),
+			binary_state_instrumentation(current_state));
+		goto out;
+	}
+
+	writer = binary_state_writer_create(binary_state_instrumentation(current_state), compress);
+	if (!writer)
+		goto out;
+	for (j = 0; j < current_state->header.num_sections; j++) {
+		section = &current_state->sections[j];
+		current_data = section_data(current_state, section, &current_allocated);
+		if (!current_data)
+			goto out;
+
+		//Sections that are new since the base, or that were kept from the first state, are stored whole
+		base_section = find_section(base_state, section->name);
+		if (section->merge == BINARY_STATE_MERGE_FIRST || !base_section || base_section->merge != section->merge
+			|| base_section->record_size != section->record_size
+			|| (section->merge == BINARY_STATE_MERGE_AND && base_section->length != section->length)) {
+			if (binary_state_add_section(writer, section->name, section->merge, section->record_size,
+					current_data, (size_t)section->length))
+				goto out;
+			free(current_allocated);
+			current_allocated = NULL;
+			continue;
+		}
+
+		base_data = section_data(base_state, base_section, &base_allocated);
+		if (!base_data)
+			goto out;
+		if (section->merge == BINARY_STATE_MERGE_AND) {
+			delta_length = (size_t)section->length;
+			delta = malloc(delta_length + 1);
+			if (!delta)
+				goto out;
+			for (i = 0; i < delta_length; i++)
+				delta[i] = current_data[i] | ~base_data[i];
+		} else { //BINARY_STATE_MERGE_UNION
+			delta = difference_records(current_data, (size_t)section->length, base_data, (size_t)base_section->length,
+				section->record_size, &delta_length);
+			if (!delta)
+				goto out;
+		}
+		if (binary_state_add_section(writer, section->name, section->merge, section->record_size, delta, delta_length))
+			goto out;
+		free(delta);
+		free(current_allocated);
+		free(base_allocated);
+		delta = current_allocated = base_allocated = NULL;
+	}
+
+	if (!binary_state_add_int(writer, BINARY_STATE_DELTA_BASE, (int64_t)bitmap_hash((const uint8_t *)base,
+			(size_t)base_state->header.length))) {
+		ret = binary_state_writer_finish(writer, length);
+		writer = NULL;
+	}
+
+out:
+	binary_state_writer_free(writer);
+	free(delta);
+	free(current_allocated);
+	free(base_allocated);
+	binary_state_close(base_state);
+	binary_state_close(current_state);
+	return ret;
+}
+
+/**
+ * Checks whether a binary state is a delta created by binary_state_create_delta
+ * @param buffer - the state buffer
+ * @param length - the length of the buffer parameter
+ * @param base_hash - a pointer used to return the hash of the delta's base state, or NULL
+ * @return - non-zero if the buffer is a delta, 0 otherwise
+ */
+int binary_state_is_delta(const char * buffer, size_t length, uint64_t * base_hash)
+{
+	binary_state_t * state;
+	int64_t hash;
+	int ret;
+
+	state = binary_state_open(buffer, length);
+	if (!state)
+		return 0;
+	ret = !binary_state_get_int(state, BINARY_STATE_DELTA_BASE, &hash);
+	if (ret && base_hash)
+		*base_hash = (uint64_t)hash;
+	binary_state_close(state);
+	return ret;
+}
+
+/**
+ * Applies a delta created by binary_state_create_delta to its base state (or a later state), in memory.
+ * Each of the state's sections is merged with the delta's section of the same name, as
+ * binary_state_merge_files would.
+ * @param state - the binary state to apply the delta to
+ * @param state_length - the length of the state parameter
+ * @param delta - the delta to apply
+ * @param delta_length - the length of the delta parameter
+ * @param compress - whether the new state's sections should be RLE encoded when that makes them smaller
+ * @param length - a pointer used to return the length of the new state
+ * @return - a newly allocated buffer holding the new state that should be freed with free, or NULL on failure
+ */
+char * binary_state_apply_delta(const char * state, size_t state_length, const char * delta, size_t delta_length,
+	int compress, size_t * length)
+{
+	binary_state_t * base_state, * delta_state;
+	binary_state_writer_t * writer = NULL;
+	struct binary_state_section * section, * delta_section;
+	const char * delta_data;
+	char * merged = NULL, * temp, * allocated, * ret = NULL;
+	size_t merged_length;
+	uint32_t j;
+
+	base_state = binary_state_open(state, state_length);
+	delta_state = binary_state_open(delta, delta_length);
+	if (!base_state || !delta_state)
+		goto out;
+	if (strcmp(binary_state_instrumentation(base_state), binary_state_instrumentation(delta_state))) {
+		ERROR_MSG("Can't apply a delta of a %s state to a %s state", binary_state_instrumentation(delta_state),
+			binary_state_instrumentation(base_state));
+		goto out;
+	}
+
+	writer = binary_state_writer_create(binary_state_instrumentation(base_state), compress);
+	if (!writer)
+		goto out;
+	for (j = 0; j < base_state->header.num_sections; j++) {
+		section = &base_state->sections[j];
+		merged_length = (size_t)section->length;
+		merged = malloc(merged_length + 1);
+		if (!merged || binary_state_get_section(base_state, section->name, merged, merged_length))
+			goto out;
+
+		if (section->merge != BINARY_STATE_MERGE_FIRST) {
+			delta_section = matching_section(delta_state, section, "the delta");
+			if (!delta_section)
+				goto out;
+			if (section->merge == BINARY_STATE_MERGE_AND) {
+				if (delta_section->encoding == BINARY_STATE_ENCODING_RLE) {
+					if (rle_decode((const uint8_t *)delta_state->buffer + delta_section->offset,
+							(size_t)delta_section->stored_length, (uint8_t *)merged, merged_length, RLE_OP_AND))
+						goto out;
+				} else
+					bitmap_and((uint8_t *)merged, (const uint8_t *)delta_state->buffer + delta_section->offset, merged_length);
+			} else { //BINARY_STATE_MERGE_UNION
+				delta_data = section_data(delta_state, delta_section, &allocated);
+				if (!delta_data)
+					goto out;
+				temp = union_records(merged, merged_length, delta_data, (size_t)delta_section->length,
+					section->record_size, &merged_length);
+				free(allocated);
+				if (!temp)
+					goto out;
+				free(merged);
+				merged = temp;
+			}
+		}
+
+		if (binary_state_add_section(writer, section->name, section->merge, section->record_size, merged, merged_length))
+			goto out;
+		free(merged);
+		merged = NULL;
+	}
+
+	ret = binary_state_writer_finish(writer, length);
+	writer = NULL;
+
+out:
+	binary_state_writer_free(writer);
+	free(merged);
+	binary_state_close(base_state);
+	binary_state_close(delta_state);
+	return ret;
+}
+
+/**
+ * Merges another binary state, or a delta, into a binary state held in memory, without building a new state.
+ * This only works when every section of the state is stored raw, and the other state doesn't add any records
+ * to the state's BINARY_STATE_MERGE_UNION sections, since a section that grew would no longer fit.  Otherwise
+ * the state isn't changed, and binary_state_apply_delta should be used to build the merged state instead.
+ * @param state - the binary state to merge into
+ * @param state_length - the length of the state parameter
+ * @param other - the binary state or delta to merge
+ * @param other_length - the length of the other parameter
+ * @return - 0 on success, BINARY_STATE_NOT_IN_PLACE if the state can't be merged in place, or another non-zero
+ * value on failure, which may leave the state partly merged
+ */
+int binary_state_merge_in_place(char * state, size_t state_length, const char * other, size_t other_length)
+{
+	binary_state_t * base_state, * other_state;
+	struct binary_state_section * section, * other_section;
+	const char * other_data;
+	char * allocated, * added;
+	size_t added_length;
+	uint32_t j;
+	int pass, ret = 1;
+
+	base_state = binary_state_open(state, state_length);
+	other_state = binary_state_open(other, other_length);
+	if (!base_state || !other_state)
+		goto out;
+	if (strcmp(binary_state_instrumentation(base_state), binary_state_instrumentation(other_state))) {
+		ERROR_MSG("Can't merge a %s state into a %s state", binary_state_instrumentation(other_state),
+			binary_state_instrumentation(base_state));
+		goto out;
+	}
+
+	//Every section is checked before any of them are changed, so a state that can't be merged in place is left alone
+	for (pass = 0; pass < 2; pass++) {
+		for (j = 0; j < base_state->header.num_sections; j++) {
+			section = &base_state->sections[j];
+			if (section->merge == BINARY_STATE_MERGE_FIRST)
+				continue;
+			other_section = matching_section(other_state, section, "the merged state");
+			if (!other_section)
+				goto out;
+			if (section->encoding != BINARY_STATE_ENCODING_RAW) {
+				ret = BINARY_STATE_NOT_IN_PLACE;
+				goto out;
+			}
+
+			if (section->merge == BINARY_STATE_MERGE_UNION) {
+				if (pass)
+					continue;
+				other_data = section_data(other_state, other_section, &allocated);
+				if (!other_data)
+					goto out;
+				added = difference_records(other_data, (size_t)other_section->length, state + section->offset,
+					(size_t)section->length, section->record_size, &added_length);
+				free(allocated);
+				if (!added)
+					goto out;
+				free(added);
+				if (added_length) {
+					ret = BINARY_STATE_NOT_IN_PLACE;
+					goto out;
+				}
+			} else if (pass) { //BINARY_STATE_MERGE_AND
+				if (other_section->encoding == BINARY_STATE_ENCODING_RLE) {
+					if (rle_decode((const uint8_t *)other_state->buffer + other_section->offset,
+							(size_t)other_section->stored_length, (uint8_t *)state + section->offset,
+							(size_t)section->length, RLE_OP_AND))
+						goto out;
+				} else
+					bitmap_and((uint8_t *)state + section->offset, (const uint8_t *)other_state->buffer + other_section->offset,
+						(size_t)section->length);
+			}
+		}
+	}
+	ret = 0;
+
+out:
+	binary_state_close(base_state);
+	binary_state_close(other_state);
+	return ret;
+}
+
+/**
+ * Copies a binary state, with its sections encoded either way.  Decoding a state lets later merges work in
+ * place, with binary_state_merge_in_place.
+ * @param buffer - the binary state to copy
+ * @param length - the length of the buffer parameter
+ * @param compress - whether the copy's sections should be RLE encoded when that makes them smaller
+ * @param copy_length - a pointer used to return the length of the copy
+ * @return - a newly allocated buffer holding the copy that should be freed with free, or NULL on failure
+ */
+char * binary_state_copy(const char * buffer, size_t length, int compress, size_t * copy_length)
+{
+	binary_state_t * state;
+	binary_state_writer_t * writer = NULL;
+	struct binary_state_section * section;
+	const char * data;
+	char * allocated = NULL, * ret = NULL;
+	uint32_t j;
+
+	state = binary_state_open(buffer, length);
+	if (!state)
+		return NULL;
+	writer = binary_state_writer_create(binary_state_instrumentation(state), compress);
+	if (!writer)
+		goto out;
+	for (j = 0; j < state->header.num_sections; j++) {
+		section = &state->sections[j];
+		data = section_data(state, section, &allocated);
+		if (!data || binary_state_add_section(writer, section->name, section->merge, section->record_size, data,
+				(size_t)section->length))
+			goto out;
+		free(allocated);
+		allocated = NULL;
+	}
+	ret = binary_state_writer_finish(writer, copy_length);
+	writer = NULL;
+
+out:
+	binary_state_writer_free(writer);
+	free(allocated);
+	binary_state_close(state);
+	return ret;
+}
+
+/**
+ * Counts the cleared bits of a binary state's BINARY_STATE_MERGE_AND sections.  For a virgin bitmap, that's how
+ * many of the edge and hit count buckets the fuzzers have found.
+ * @param buffer - the binary state
+ * @param length - the length of the buffer parameter
+ * @param section_name - the section to count the bits of, or NULL to count every BINARY_STATE_MERGE_AND section
+ * @param count - a pointer used to return the number of cleared bits
+ * @return - 0 on success, non-zero if the state is malformed or doesn't have the section
+ */
+int binary_state_count_cleared_bits(const char * buffer, size_t length, const char * section_name, uint64_t * count)
+{
+	binary_state_t * state;
+	struct binary_state_section * section;
+	const uint8_t * data;
+	char * allocated;
+	uint64_t total = 0;
+	uint32_t j;
+	size_t i;
+	uint8_t cleared;
+	int found = 0;
+
+	state = binary_state_open(buffer, length);
+	if (!state)
+		return 1;
+	for (j = 0; j < state->header.num_sections; j++) {
+		section = &state->sections[j];
+		if (section->merge != BINARY_STATE_MERGE_AND || (section_name && strcmp(section->name, section_name)))
+			continue;
+		data = (const uint8_t *)section_data(state, section, &allocated);
+		if (!data) {
+			binary_state_close(state);
+			return 1;
+		}
+		//Most of a virgin bitmap is still set, so the cleared bits are counted a byte at a time
+		for (i = 0; i < (size_t)section->length; i++) {
+			for (cleared = (uint8_t)~data[i]; cleared; cleared &= cleared - 1)
+				total++;
+		}
+		free(allocated);
+		found = 1;
+	}
+	binary_state_close(state);
+	*count = total;
+	return section_name && !found;
+}
+
+//////////////////////////////////////////////////////////////
+// Instrumentation Helpers ///////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Loads a JSON or binary state into an instrumentation state
+ * @param instrumentation - the instrumentation the state belongs to
+ * @param instrumentation_state - an instrumentation state created with the instrumentation's create function
+ * @param state - the JSON or binary state to load
+ * @param state_length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int instrumentation_load_state(instrumentation_t * instrumentation, void * instrumentation_state,
+	char * state, size_t state_length)
+{
+	if (!binary_state_is_binary(state, state_length))
+		return instrumentation->set_state(instrumentation_state, state);
+	if (binary_state_is_delta(state, state_length, NULL)) {
+		ERROR_MSG("The instrumentation state is a delta, which must be applied to its base state before it's loaded");
+		return 1;
+	}
+	if (!instrumentation->set_binary_state) {
+		ERROR_MSG("This instrumentation does not support binary states");
+		return 1;
+	}
+	return instrumentation->set_binary_state(instrumentation_state, state, state_length);
+}
+
+/**
+ * Loads an instrumentation state file.  Binary states are mapped read only, rather than read, since
+ * they can be large.  JSON states are read into a NULL terminated buffer, since they're parsed as strings.
+ * @param filename - the JSON or binary state file to load
+ * @param length - a pointer used to return the length of the state
+ * @param mapped - a pointer used to return whether the state was mapped
+ * @return - the state, which should be freed with instrumentation_free_state_file, or NULL on failure
+ */
+char * instrumentation_load_state_file(const char * filename, size_t * length, int * mapped)
+{
+	char * state;
+	int read_length;
+
+	state = (char *)map_file(filename, length);
+	if (state && binary_state_is_binary(state, *length)) {
+		*mapped = 1;
+		return state;
+	}
+	if (state)
+		unmap_file(state, *length);
+
+	*mapped = 0;
+	read_length = read_file((char *)filename, &state);
+	if (read_length <= 0) {
+		free(state);
+		return NULL;
+	}
+	*length = read_length;
+	return state;
+}
+
+/**
+ * Frees a state loaded with instrumentation_load_state_file
+ * @param state - the state to free
+ * @param length - the length of the state
+ * @param mapped - whether the state was mapped
+ */
+void instrumentation_free_state_file(char * state, size_t length, int mapped)
+{
+	if (mapped)
+		unmap_file(state, length);
+	else
+		free(state);
+}
+
+/**
+ * Creates an instrumentation state, loading it from a JSON or binary state if one is given
+ * @param instrumentation - the instrumentation to create the state for
+ * @param options - the instrumentation's options
+ * @param state - the JSON or binary state to load, or NULL
+ * @param state_length - the length of the state parameter
+ * @return - the new instrumentation state on success, or NULL on failure
+ */
+void * instrumentation_create_with_state(instrumentation_t * instrumentation, char * options,
+	char * state, size_t state_length)
+{
+	void * instrumentation_state;
+
+	if (!binary_state_is_binary(state, state_length))
+		return instrumentation->create(options, state);
+
+	instrumentation_state = instrumentation->create(options, NULL);
+	if (instrumentation_state && instrumentation_load_state(instrumentation, instrumentation_state, state, state_length)) {
+		instrumentation->cleanup(instrumentation_state);
+		return NULL;
+	}
+	return instrumentation_state;
+}
+
+/**
+ * Gets an instrumentation's state, as a binary state if asked for and the instrumentation supports
+ * it, or as a JSON state otherwise
+ * @param instrumentation - the instrumentation the state belongs to
+ * @param instrumentation_state - the instrumentation state to save
+ * @param binary - whether a binary state is preferred
+ * @param length - a pointer used to return the length of the saved state
+ * @return - the saved state, which should be freed with the instrumentation's free_state function, or
+ *           NULL on failure
+ */
+char * instrumentation_save_state(instrumentation_t * instrumentation, void * instrumentation_state,
+	int binary, size_t * length)
+{
+	char * state;
+
+	if (binary && instrumentation->get_binary_state)
+		return instrumentation->get_binary_state(instrumentation_state, length);
+
+	state = instrumentation->get_state(instrumentation_state);
+	if (state)
+		*length = strlen(state);
+	return state;
+}
+
+/**
+ * Gets a delta of an instrumentation's state from an earlier state, so that only what changed since the
+ * earlier state needs to be sent.  See binary_state_create_delta.
+ * @param instrumentation - the instrumentation the state belongs to, which must support binary states
+ * @param instrumentation_state - the instrumentation state to get the delta of
+ * @param base - the earlier binary state that the delta is from, such as the state the instrumentation
+ *               state was loaded from
+ * @param base_length - the length of the base parameter
+ * @param length - a pointer used to return the length of the delta
+ * @return - the delta, which should be freed with free, or NULL on failure
+ */
+char * instrumentation_get_state_delta(instrumentation_t * instrumentation, void * instrumentation_state,
+	char * base, size_t base_length, size_t * length)
+{
+	char * state, * delta;
+	size_t state_length;
+
+	if (!instrumentation->get_binary_state || !binary_state_is_binary(base, base_length)) {
+		ERROR_MSG("State deltas can only be made between binary states");
+		return NULL;
+	}
+	state = instrumentation->get_binary_state(instrumentation_state, &state_length);
+	if (!state)
+		return NULL;
+	delta = binary_state_create_delta(base, base_length, state, state_length, 1, length);
+	instrumentation->free_state(state);
+	return delta;
+}
+
+/**
+ * Applies a delta from binary_state_create_delta or instrumentation_get_state_delta to an
+ * instrumentation state, which should already hold the delta's base state (or a later one)
+ * @param instrumentation - the instrumentation the state belongs to, which must support binary states
+ * @param instrumentation_state - the instrumentation state to apply the delta to
+ * @param delta - the delta to apply
+ * @param delta_length - the length of the delta parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int instrumentation_apply_state_delta(instrumentation_t * instrumentation, void * instrumentation_state,
+	char * delta, size_t delta_length)
+{
+	char * state, * new_state;
+	size_t state_length, new_length;
+	int ret;
+
+	if (!instrumentation->get_binary_state || !instrumentation->set_binary_state) {
+		ERROR_MSG("This instrumentation does not support binary states");
+		return 1;
+	}
+	state = instrumentation->get_binary_state(instrumentation_state, &state_length);
+	if (!state)
+		return 1;
+	new_state = binary_state_apply_delta(state, state_length, delta, delta_length, 0, &new_length);
+	instrumentation->free_state(state);
+	if (!new_state)
+		return 1;
+	ret = instrumentation->set_binary_state(instrumentation_state, new_state, new_length);
+	free(new_state);
+	return ret;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "instrumentation.h"
+
+//A compact, versioned alternative to the JSON instrumentation state.  A binary
+//state is a header, followed by a table of named sections, followed by the
+//section data (each aligned to BINARY_STATE_ALIGNMENT, so uncompressed
+//sections can be used in place from a mapped file).  Each section says how it
+//is combined with the same section of another state, so states can be merged
+//without the instrumentation that wrote them.  All fields are in the host's
+//byte order.
+
+#define BINARY_STATE_MAGIC        "KBZSTATE"
+#define BINARY_STATE_MAGIC_LENGTH 8
+#define BINARY_STATE_VERSION      1
+#define BINARY_STATE_ALIGNMENT    64
+#define BINARY_STATE_NAME_LENGTH  64
+
+//How a section is combined with the same section of another state
+#define BINARY_STATE_MERGE_FIRST 0 //Keep the value from the first state
+#define BINARY_STATE_MERGE_AND   1 //Bitwise AND (e.g. virgin bitmaps)
+#define BINARY_STATE_MERGE_UNION 2 //Union of sorted, fixed size records
+
+//How a section's data is stored
+#define BINARY_STATE_ENCODING_RAW 0
+#define BINARY_STATE_ENCODING_RLE 1
+
+struct binary_state_header
+{
+	char magic[BINARY_STATE_MAGIC_LENGTH];
+	uint32_t version;
+	uint32_t num_sections;
+	uint64_t length;            //The length of the whole state, including this header
+	char instrumentation[16];   //The name of the instrumentation that wrote the state
+};
+
+struct binary_state_section
+{
+	char name[BINARY_STATE_NAME_LENGTH];
+	uint32_t merge;         //One of the BINARY_STATE_MERGE_* values
+	uint32_t encoding;      //One of the BINARY_STATE_ENCODING_* values
+	uint32_t record_size;   //The size of the records in BINARY_STATE_MERGE_UNION sections
+	uint32_t reserved;
+	uint64_t offset;        //The offset of the data from the start of the state
+	uint64_t stored_length; //The length of the data in the state
+	uint64_t length;        //The length of the data once decoded
+};
+
+typedef struct binary_state_writer binary_state_writer_t;
+typedef struct binary_state binary_state_t;
+
+//Writing
+INSTRUMENTATION_API binary_state_writer_t * binary_state_writer_create(const char * instrumentation_name, int compress);
+INSTRUMENTATION_API int binary_state_add_section(binary_state_writer_t * writer, const char * name, uint32_t merge,
+	uint32_t record_size, const void * data, size_t length);
+INSTRUMENTATION_API int binary_state_add_int(binary_state_writer_t * writer, const char * name, int64_t value);
+INSTRUMENTATION_API char * binary_state_writer_finish(binary_state_writer_t * writer, size_t * length);
+INSTRUMENTATION_API void binary_state_writer_free(binary_state_writer_t * writer);
+
+//Reading
+INSTRUMENTATION_API int binary_state_is_binary(const char * buffer, size_t length);
+INSTRUMENTATION_API binary_state_t * binary_state_open(const char * buffer, size_t length);
+INSTRUMENTATION_API binary_state_t * binary_state_map_file(const char * filename);
+INSTRUMENTATION_API void binary_state_close(binary_state_t * state);
+INSTRUMENTATION_API const char * binary_state_instrumentation(binary_state_t * state);
+INSTRUMENTATION_API const char * binary_state_buffer(binary_state_t * state, size_t * length);
+INSTRUMENTATION_API int binary_state_section_length(binary_state_t * state, const char * name, size_t * length);
+INSTRUMENTATION_API int binary_state_get_section(binary_state_t * state, const char * name, void * dest, size_t length);
+INSTRUMENTATION_API const void * binary_state_get_raw_section(binary_state_t * state, const char * name, size_t * length);
+INSTRUMENTATION_API int binary_state_get_int(binary_state_t * state, const char * name, int64_t * value);
+
+//Merging
+INSTRUMENTATION_API int binary_state_merge_files(const char * output_filename, char ** input_filenames,
+	int num_inputs, int compress, int num_threads);
+
+//Deltas, which hold only what changed since a base state, so that hosts which already have the base state
+//only need to exchange the changes.  A delta is a binary state with the BINARY_STATE_DELTA_BASE section,
+//which holds the hash of its base state.  Deltas can be merged with their base state, or with each other,
+//by binary_state_merge_files (with the base state first), but can't be loaded on their own.
+#define BINARY_STATE_DELTA_BASE "delta_base_hash"
+INSTRUMENTATION_API char * binary_state_create_delta(const char * base, size_t base_length, const char * current,
+	size_t current_length, int compress, size_t * length);
+INSTRUMENTATION_API int binary_state_is_delta(const char * buffer, size_t length, uint64_t * base_hash);
+INSTRUMENTATION_API char * binary_state_apply_delta(const char * state, size_t state_length, const char * delta,
+	size_t delta_length, int compress, size_t * length);
+
+//Merging in memory, for services that keep a global state up to date (see merger/state_merge.h)
+#define BINARY_STATE_NOT_IN_PLACE 2
+INSTRUMENTATION_API int binary_state_merge_in_place(char * state, size_t state_length, const char * other,
+	size_t other_length);
+INSTRUMENTATION_API char * binary_state_copy(const char * buffer, size_t length, int compress, size_t * copy_length);
+INSTRUMENTATION_API int binary_state_count_cleared_bits(const char * buffer, size_t length, const char * section_name,
+	uint64_t * count);
+
+//Helpers for the fuzzer and merger, which use the binary state when the
+//instrumentation supports it and the JSON state otherwise
+INSTRUMENTATION_API char * instrumentation_load_state_file(const char * filename, size_t * length, int * mapped);
+INSTRUMENTATION_API void instrumentation_free_state_file(char * state, size_t length, int mapped);
+INSTRUMENTATION_API void * instrumentation_create_with_state(instrumentation_t * instrumentation, char * options,
+	char * state, size_t state_length);
+INSTRUMENTATION_API int instrumentation_load_state(instrumentation_t * instrumentation, void * instrumentation_state,
+	char * state, size_t state_length);
+INSTRUMENTATION_API char * instrumentation_save_state(instrumentation_t * instrumentation, void * instrumentation_state,
+	int binary, size_t * length);
+INSTRUMENTATION_API char * instrumentation_get_state_delta(instrumentation_t * instrumentation,
+	void * instrumentation_state, char * base, size_t base_length, size_t * length);
+INSTRUMENTATION_API int instrumentation_apply_state_delta(instrumentation_t * instrumentation,
+	void * instrumentation_state, char * delta, size_t delta_length);
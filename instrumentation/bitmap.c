@@ -0,0 +1,1014 @@
+#include "bitmap.h"
+
+#include <string.h>
+
+#include "xxhash.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BITMAP_X86 1
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITMAP_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define BITMAP_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BITMAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h> //_InterlockedCompareExchange64, for the shared virgin maps
+#endif
+
+//The AFL hit count buckets, used by classify_counts
+//The sparse kernels check whether a whole cache line of the trace is zero before looking at its
+//vectors, so the empty stretches of the big maps that context and n-gram coverage use are skipped
+//with one test per line.  The map sizes are all multiples of the line.
+#define ZERO_SKIP_LINE 64
+
+#define AREP4(_sym)   (_sym), (_sym), (_sym), (_sym)
+#define AREP8(_sym)   AREP4(_sym), AREP4(_sym)
+#define AREP16(_sym)  AREP8(_sym), AREP8(_sym)
+#define AREP32(_sym)  AREP16(_sym), AREP16(_sym)
+#define AREP64(_sym)  AREP32(_sym), AREP32(_sym)
+#define AREP128(_sym) AREP64(_sym), AREP64(_sym)
+
+static const uint8_t count_class_lookup[256] = {
+	/* 0 - 3:       4 */ 0, 1, 2, 4,
+	/* 4 - 7:      +4 */ AREP4(8),
+	/* 8 - 15:     +8 */ AREP8(16),
+	/* 16 - 31:   +16 */ AREP16(32),
+	/* 32 - 127:  +96 */ AREP64(64), AREP32(64),
+	/* 128+:     +128 */ AREP128(128)
+};
+
+//The set of implementations selected for this CPU
+struct bitmap_functions
+{
+	const char * name;
+	uint8_t (*has_new_bits)(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size);
+	void (*simplify_trace)(uint8_t * trace_bits, size_t size);
+	uint8_t (*simplify_and_has_new_bits)(uint8_t * virgin_map, uint8_t * trace_bits, size_t size);
+	void (*classify_counts)(uint8_t * trace_bits, size_t size);
+	void (*and_bitmaps)(uint8_t * dest, const uint8_t * src, size_t size);
+};
+
+//////////////////////////////////////////////////////////////
+// Portable Implementation ///////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Checks a single 8 byte chunk of the trace against the virgin map, and clears the bits that
+ * were hit from the virgin map.  The ignore_bytes applied by the caller should already have
+ * been removed from cur.
+ * @return - 2 if there's a new tuple, 1 if there's only new hit counts, 0 otherwise
+ */
+static uint8_t check_word(uint64_t cur, uint8_t * virgin)
+{
+	uint64_t vir, new_vir;
+	uint8_t * cur8 = (uint8_t *)&cur, * vir8 = (uint8_t *)&vir;
+	int i;
+
+	memcpy(&vir, virgin, sizeof(vir));
+	if (!(cur & vir))
+		return 0;
+
+	new_vir = vir & ~cur;
+	memcpy(virgin, &new_vir, sizeof(new_vir));
+
+	//Look for bytes that were hit in this trace, but never before
+	for (i = 0; i < 8; i++) {
+		if (cur8[i] && vir8[i] == 0xff)
+			return 2;
+	}
+	return 1;
+}
+
+static uint8_t has_new_bits_generic(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size)
+{
+	uint64_t cur, ignore;
+	uint8_t ret = 0, result;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; i += 8) {
+		memcpy(&cur, trace_bits + i, sizeof(cur));
+		if (!cur) //Optimize for sparse bitmaps
+			continue;
+		if (ignore_bytes) {
+			memcpy(&ignore, ignore_bytes + i, sizeof(ignore));
+			for (j = 0; j < 8; j++) {
+				if (((uint8_t *)&ignore)[j])
+					((uint8_t *)&cur)[j] = 0;
+			}
+		}
+		result = check_word(cur, virgin_map + i);
+		if (result > ret)
+			ret = result;
+	}
+	return ret;
+}
+
+static void simplify_trace_generic(uint8_t * trace_bits, size_t size)
+{
+	uint64_t cur;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; i += 8) {
+		memcpy(&cur, trace_bits + i, sizeof(cur));
+		if (!cur) {
+			memset(trace_bits + i, 1, 8);
+			continue;
+		}
+		for (j = 0; j < 8; j++)
+			trace_bits[i + j] = trace_bits[i + j] ? 128 : 1;
+	}
+}
+
+static uint8_t simplify_and_has_new_bits_generic(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	uint64_t cur;
+	uint8_t ret = 0, result;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; i += 8) {
+		for (j = 0; j < 8; j++)
+			trace_bits[i + j] = trace_bits[i + j] ? 128 : 1;
+		memcpy(&cur, trace_bits + i, sizeof(cur));
+		result = check_word(cur, virgin_map + i);
+		if (result > ret)
+			ret = result;
+	}
+	return ret;
+}
+
+static void classify_counts_generic(uint8_t * trace_bits, size_t size)
+{
+	uint64_t cur;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; i += 8) {
+		memcpy(&cur, trace_bits + i, sizeof(cur));
+		if (!cur) //Optimize for sparse bitmaps
+			continue;
+		for (j = 0; j < 8; j++)
+			trace_bits[i + j] = count_class_lookup[trace_bits[i + j]];
+	}
+}
+
+static void and_bitmaps_generic(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	uint64_t a, b;
+	size_t i;
+
+	for (i = 0; i < size; i += 8) {
+		memcpy(&a, dest + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a &= b;
+		memcpy(dest + i, &a, sizeof(a));
+	}
+}
+
+static const struct bitmap_functions generic_functions = {
+	"generic",
+	has_new_bits_generic,
+	simplify_trace_generic,
+	simplify_and_has_new_bits_generic,
+	classify_counts_generic,
+	and_bitmaps_generic
+};
+
+//////////////////////////////////////////////////////////////
+// SSE2 Implementation ///////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+#ifdef BITMAP_SSE2
+
+#define SSE2_SELECT(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+#define SSE2_GE(x, k) _mm_cmpeq_epi8(_mm_max_epu8(x, k), x)
+
+/**
+ * Compares 16 bytes of the (already classified) trace against the virgin map, and clears the
+ * bits that were hit from the virgin map.
+ * @return - 2 if there's a new tuple, 1 if there's only new hit counts, 0 otherwise
+ */
+static inline uint8_t check_block_sse2(__m128i cur, uint8_t * virgin, uint8_t ret)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vir = _mm_loadu_si128((const __m128i *)virgin);
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(cur, vir), zero)) == 0xffff)
+		return ret;
+	if (ret < 2) {
+		//Look for bytes that were hit in this trace, but never before
+		__m128i new_tuples = _mm_andnot_si128(_mm_cmpeq_epi8(cur, zero),
+			_mm_cmpeq_epi8(vir, _mm_set1_epi8((char)0xff)));
+		ret = _mm_movemask_epi8(new_tuples) ? 2 : 1;
+	}
+	_mm_storeu_si128((__m128i *)virgin, _mm_andnot_si128(cur, vir));
+	return ret;
+}
+
+static inline __m128i simplify_sse2(__m128i cur)
+{
+	__m128i is_zero = _mm_cmpeq_epi8(cur, _mm_setzero_si128());
+	return SSE2_SELECT(is_zero, _mm_set1_epi8(1), _mm_set1_epi8((char)128));
+}
+
+/**
+ * Skips the cache lines of the trace that are all zero
+ * @param trace_bits - the trace bitmap
+ * @param i - the line aligned offset to start at
+ * @param size - the size of the bitmap
+ * @return - the offset of the first line with a nonzero byte, or one past the last full line
+ */
+static inline size_t skip_zero_lines_sse2(const uint8_t * trace_bits, size_t i, size_t size)
+{
+	__m128i any;
+
+	for (; i + ZERO_SKIP_LINE <= size; i += ZERO_SKIP_LINE) {
+		any = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(trace_bits + i)), _mm_loadu_si128((const __m128i *)(trace_bits + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(trace_bits + i + 32)), _mm_loadu_si128((const __m128i *)(trace_bits + i + 48))));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff)
+			break;
+	}
+	return i;
+}
+
+static uint8_t has_new_bits_sse2(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i cur, ignore;
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_sse2(trace_bits, i, size)) >= size)
+			break;
+		cur = _mm_loadu_si128((const __m128i *)(trace_bits + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(cur, zero)) == 0xffff) //Optimize for sparse bitmaps
+			continue;
+		if (ignore_bytes) {
+			ignore = _mm_loadu_si128((const __m128i *)(ignore_bytes + i));
+			cur = _mm_and_si128(cur, _mm_cmpeq_epi8(ignore, zero));
+		}
+		ret = check_block_sse2(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static void simplify_trace_sse2(uint8_t * trace_bits, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; i += 16) {
+		__m128i cur = _mm_loadu_si128((const __m128i *)(trace_bits + i));
+		_mm_storeu_si128((__m128i *)(trace_bits + i), simplify_sse2(cur));
+	}
+}
+
+static uint8_t simplify_and_has_new_bits_sse2(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		__m128i cur = simplify_sse2(_mm_loadu_si128((const __m128i *)(trace_bits + i)));
+		_mm_storeu_si128((__m128i *)(trace_bits + i), cur);
+		ret = check_block_sse2(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static void classify_counts_sse2(uint8_t * trace_bits, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i cur, classified;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_sse2(trace_bits, i, size)) >= size)
+			break;
+		cur = _mm_loadu_si128((const __m128i *)(trace_bits + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(cur, zero)) == 0xffff) //Optimize for sparse bitmaps
+			continue;
+
+		//0, 1, and 2 stay the same, everything else is rounded up into its bucket
+		classified = cur;
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8(3)), _mm_set1_epi8(4), classified);
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8(4)), _mm_set1_epi8(8), classified);
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8(8)), _mm_set1_epi8(16), classified);
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8(16)), _mm_set1_epi8(32), classified);
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8(32)), _mm_set1_epi8(64), classified);
+		classified = SSE2_SELECT(SSE2_GE(cur, _mm_set1_epi8((char)128)), _mm_set1_epi8((char)128), classified);
+		_mm_storeu_si128((__m128i *)(trace_bits + i), classified);
+	}
+}
+
+static void and_bitmaps_sse2(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i += 16)
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_and_si128(_mm_loadu_si128((const __m128i *)(dest + i)),
+			_mm_loadu_si128((const __m128i *)(src + i))));
+}
+
+static const struct bitmap_functions sse2_functions = {
+	"sse2",
+	has_new_bits_sse2,
+	simplify_trace_sse2,
+	simplify_and_has_new_bits_sse2,
+	classify_counts_sse2,
+	and_bitmaps_sse2
+};
+
+#endif //BITMAP_SSE2
+
+//////////////////////////////////////////////////////////////
+// AVX2 Implementation ///////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+#ifdef BITMAP_AVX2
+
+#define AVX2_GE(x, k) _mm256_cmpeq_epi8(_mm256_max_epu8(x, k), x)
+
+/**
+ * Compares 32 bytes of the (already classified) trace against the virgin map, and clears the
+ * bits that were hit from the virgin map.
+ * @return - 2 if there's a new tuple, 1 if there's only new hit counts, 0 otherwise
+ */
+static inline TARGET_AVX2 uint8_t check_block_avx2(__m256i cur, uint8_t * virgin, uint8_t ret)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i vir = _mm256_loadu_si256((const __m256i *)virgin);
+
+	if (_mm256_testz_si256(cur, vir))
+		return ret;
+	if (ret < 2) {
+		//Look for bytes that were hit in this trace, but never before
+		__m256i new_tuples = _mm256_andnot_si256(_mm256_cmpeq_epi8(cur, zero),
+			_mm256_cmpeq_epi8(vir, _mm256_set1_epi8((char)0xff)));
+		ret = _mm256_testz_si256(new_tuples, new_tuples) ? 1 : 2;
+	}
+	_mm256_storeu_si256((__m256i *)virgin, _mm256_andnot_si256(cur, vir));
+	return ret;
+}
+
+static inline TARGET_AVX2 __m256i simplify_avx2(__m256i cur)
+{
+	__m256i is_zero = _mm256_cmpeq_epi8(cur, _mm256_setzero_si256());
+	return _mm256_blendv_epi8(_mm256_set1_epi8((char)128), _mm256_set1_epi8(1), is_zero);
+}
+
+/**
+ * Skips the cache lines of the trace that are all zero
+ * @param trace_bits - the trace bitmap
+ * @param i - the line aligned offset to start at
+ * @param size - the size of the bitmap
+ * @return - the offset of the first line with a nonzero byte, or one past the last full line
+ */
+static inline TARGET_AVX2 size_t skip_zero_lines_avx2(const uint8_t * trace_bits, size_t i, size_t size)
+{
+	__m256i any;
+
+	for (; i + ZERO_SKIP_LINE <= size; i += ZERO_SKIP_LINE) {
+		any = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(trace_bits + i)),
+			_mm256_loadu_si256((const __m256i *)(trace_bits + i + 32)));
+		if (!_mm256_testz_si256(any, any))
+			break;
+	}
+	return i;
+}
+
+static TARGET_AVX2 uint8_t has_new_bits_avx2(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i cur, ignore;
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 32) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_avx2(trace_bits, i, size)) >= size)
+			break;
+		cur = _mm256_loadu_si256((const __m256i *)(trace_bits + i));
+		if (_mm256_testz_si256(cur, cur)) //Optimize for sparse bitmaps
+			continue;
+		if (ignore_bytes) {
+			ignore = _mm256_loadu_si256((const __m256i *)(ignore_bytes + i));
+			cur = _mm256_and_si256(cur, _mm256_cmpeq_epi8(ignore, zero));
+		}
+		ret = check_block_avx2(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static TARGET_AVX2 void simplify_trace_avx2(uint8_t * trace_bits, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; i += 32) {
+		__m256i cur = _mm256_loadu_si256((const __m256i *)(trace_bits + i));
+		_mm256_storeu_si256((__m256i *)(trace_bits + i), simplify_avx2(cur));
+	}
+}
+
+static TARGET_AVX2 uint8_t simplify_and_has_new_bits_avx2(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 32) {
+		__m256i cur = simplify_avx2(_mm256_loadu_si256((const __m256i *)(trace_bits + i)));
+		_mm256_storeu_si256((__m256i *)(trace_bits + i), cur);
+		ret = check_block_avx2(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static TARGET_AVX2 void classify_counts_avx2(uint8_t * trace_bits, size_t size)
+{
+	__m256i cur, classified;
+	size_t i;
+
+	for (i = 0; i < size; i += 32) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_avx2(trace_bits, i, size)) >= size)
+			break;
+		cur = _mm256_loadu_si256((const __m256i *)(trace_bits + i));
+		if (_mm256_testz_si256(cur, cur)) //Optimize for sparse bitmaps
+			continue;
+
+		//0, 1, and 2 stay the same, everything else is rounded up into its bucket
+		classified = cur;
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8(4), AVX2_GE(cur, _mm256_set1_epi8(3)));
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8(8), AVX2_GE(cur, _mm256_set1_epi8(4)));
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8(16), AVX2_GE(cur, _mm256_set1_epi8(8)));
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8(32), AVX2_GE(cur, _mm256_set1_epi8(16)));
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8(64), AVX2_GE(cur, _mm256_set1_epi8(32)));
+		classified = _mm256_blendv_epi8(classified, _mm256_set1_epi8((char)128), AVX2_GE(cur, _mm256_set1_epi8((char)128)));
+		_mm256_storeu_si256((__m256i *)(trace_bits + i), classified);
+	}
+}
+
+static TARGET_AVX2 void and_bitmaps_avx2(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i += 32)
+		_mm256_storeu_si256((__m256i *)(dest + i), _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(dest + i)),
+			_mm256_loadu_si256((const __m256i *)(src + i))));
+}
+
+static const struct bitmap_functions avx2_functions = {
+	"avx2",
+	has_new_bits_avx2,
+	simplify_trace_avx2,
+	simplify_and_has_new_bits_avx2,
+	classify_counts_avx2,
+	and_bitmaps_avx2
+};
+
+/**
+ * Checks whether the CPU and OS support AVX2
+ * @return - 1 if AVX2 can be used, 0 otherwise
+ */
+static int cpu_supports_avx2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return 0;
+	__cpuid(info, 1);
+	//Check for OSXSAVE and AVX, then that the OS saves the YMM registers
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif //BITMAP_AVX2
+
+//////////////////////////////////////////////////////////////
+// NEON Implementation ///////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+#ifdef BITMAP_NEON
+
+/**
+ * Compares 16 bytes of the (already classified) trace against the virgin map, and clears the
+ * bits that were hit from the virgin map.
+ * @return - 2 if there's a new tuple, 1 if there's only new hit counts, 0 otherwise
+ */
+static inline uint8_t check_block_neon(uint8x16_t cur, uint8_t * virgin, uint8_t ret)
+{
+	uint8x16_t vir = vld1q_u8(virgin);
+
+	if (!vmaxvq_u8(vandq_u8(cur, vir)))
+		return ret;
+	if (ret < 2) {
+		//Look for bytes that were hit in this trace, but never before
+		uint8x16_t new_tuples = vandq_u8(vtstq_u8(cur, cur), vceqq_u8(vir, vdupq_n_u8(0xff)));
+		ret = vmaxvq_u8(new_tuples) ? 2 : 1;
+	}
+	vst1q_u8(virgin, vbicq_u8(vir, cur));
+	return ret;
+}
+
+static inline uint8x16_t simplify_neon(uint8x16_t cur)
+{
+	return vbslq_u8(vceqq_u8(cur, vdupq_n_u8(0)), vdupq_n_u8(1), vdupq_n_u8(128));
+}
+
+/**
+ * Skips the cache lines of the trace that are all zero
+ * @param trace_bits - the trace bitmap
+ * @param i - the line aligned offset to start at
+ * @param size - the size of the bitmap
+ * @return - the offset of the first line with a nonzero byte, or one past the last full line
+ */
+static inline size_t skip_zero_lines_neon(const uint8_t * trace_bits, size_t i, size_t size)
+{
+	uint8x16_t any;
+
+	for (; i + ZERO_SKIP_LINE <= size; i += ZERO_SKIP_LINE) {
+		any = vorrq_u8(vorrq_u8(vld1q_u8(trace_bits + i), vld1q_u8(trace_bits + i + 16)),
+			vorrq_u8(vld1q_u8(trace_bits + i + 32), vld1q_u8(trace_bits + i + 48)));
+		if (vmaxvq_u8(any))
+			break;
+	}
+	return i;
+}
+
+static uint8_t has_new_bits_neon(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size)
+{
+	uint8x16_t cur;
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_neon(trace_bits, i, size)) >= size)
+			break;
+		cur = vld1q_u8(trace_bits + i);
+		if (!vmaxvq_u8(cur)) //Optimize for sparse bitmaps
+			continue;
+		if (ignore_bytes)
+			cur = vandq_u8(cur, vceqq_u8(vld1q_u8(ignore_bytes + i), vdupq_n_u8(0)));
+		ret = check_block_neon(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static void simplify_trace_neon(uint8_t * trace_bits, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; i += 16)
+		vst1q_u8(trace_bits + i, simplify_neon(vld1q_u8(trace_bits + i)));
+}
+
+static uint8_t simplify_and_has_new_bits_neon(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	uint8_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		uint8x16_t cur = simplify_neon(vld1q_u8(trace_bits + i));
+		vst1q_u8(trace_bits + i, cur);
+		ret = check_block_neon(cur, virgin_map + i, ret);
+	}
+	return ret;
+}
+
+static void classify_counts_neon(uint8_t * trace_bits, size_t size)
+{
+	uint8x16_t cur, classified;
+	size_t i;
+
+	for (i = 0; i < size; i += 16) {
+		if (!(i % ZERO_SKIP_LINE) && (i = skip_zero_lines_neon(trace_bits, i, size)) >= size)
+			break;
+		cur = vld1q_u8(trace_bits + i);
+		if (!vmaxvq_u8(cur)) //Optimize for sparse bitmaps
+			continue;
+
+		//0, 1, and 2 stay the same, everything else is rounded up into its bucket
+		classified = cur;
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(3)), vdupq_n_u8(4), classified);
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(4)), vdupq_n_u8(8), classified);
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(8)), vdupq_n_u8(16), classified);
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(16)), vdupq_n_u8(32), classified);
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(32)), vdupq_n_u8(64), classified);
+		classified = vbslq_u8(vcgeq_u8(cur, vdupq_n_u8(128)), vdupq_n_u8(128), classified);
+		vst1q_u8(trace_bits + i, classified);
+	}
+}
+
+static void and_bitmaps_neon(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i += 16)
+		vst1q_u8(dest + i, vandq_u8(vld1q_u8(dest + i), vld1q_u8(src + i)));
+}
+
+static const struct bitmap_functions neon_functions = {
+	"neon",
+	has_new_bits_neon,
+	simplify_trace_neon,
+	simplify_and_has_new_bits_neon,
+	classify_counts_neon,
+	and_bitmaps_neon
+};
+
+#endif //BITMAP_NEON
+
+//////////////////////////////////////////////////////////////
+// Runtime Dispatch //////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//Selected on first use.  Racing threads will all select the same implementation,
+//so no locking is needed.
+static const struct bitmap_functions * selected_functions = NULL;
+
+static const struct bitmap_functions * get_functions(void)
+{
+	const struct bitmap_functions * functions = selected_functions;
+	if (functions)
+		return functions;
+
+	functions = &generic_functions;
+#ifdef BITMAP_SSE2
+	functions = &sse2_functions;
+#endif
+#ifdef BITMAP_AVX2
+	if (cpu_supports_avx2())
+		functions = &avx2_functions;
+#endif
+#ifdef BITMAP_NEON
+	functions = &neon_functions;
+#endif
+	selected_functions = functions;
+	return functions;
+}
+
+/**
+ * Check if the current execution path brings anything new to the table, and update the virgin
+ * map to reflect the newly hit bits, so subsequent calls will return 0.
+ * @param virgin_map - the bitmap representing the edges that have been hit so far
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_has_new_bits(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	return get_functions()->has_new_bits(virgin_map, trace_bits, NULL, size);
+}
+
+/**
+ * This function is identical to bitmap_has_new_bits, but takes an ignore_bytes bitmap
+ * that lists bytes that should be ignored when determining if a new edge has been found
+ * @param virgin_map - the bitmap representing the edges that have been hit so far
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param ignore_bytes - a bitmap where each non-zero byte marks an edge that should be ignored
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_has_new_bits_with_ignore(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size)
+{
+	return get_functions()->has_new_bits(virgin_map, trace_bits, ignore_bytes, size);
+}
+
+/**
+ * Finds the next run of consecutive nonzero entries in a dirty line index
+ * @param dirty_index - the dirty line index, one byte per line
+ * @param num_lines - the number of entries in dirty_index
+ * @param start - the entry to start looking at.  On return, it is set to the first entry in the run
+ * @return - the number of entries in the run, or 0 if there are no more dirty lines
+ */
+static size_t next_dirty_run(const uint8_t * dirty_index, size_t num_lines, size_t * start)
+{
+	uint64_t word;
+	size_t i = *start, end;
+
+	//Skip the clean lines 8 at a time
+	while (i < num_lines) {
+		if (i + 8 <= num_lines) {
+			memcpy(&word, dirty_index + i, sizeof(word));
+			if (!word) {
+				i += 8;
+				continue;
+			}
+		}
+		if (dirty_index[i])
+			break;
+		i++;
+	}
+	if (i >= num_lines)
+		return 0;
+
+	for (end = i + 1; end < num_lines && dirty_index[end]; end++);
+	*start = i;
+	return end - i;
+}
+
+/**
+ * This function is identical to bitmap_has_new_bits, but only looks at the lines of the trace
+ * that the dirty line index says were touched.  The lines that aren't marked must be zero.
+ * @param virgin_map - the bitmap representing the edges that have been hit so far
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param dirty_index - one byte per line of trace_bits, nonzero for lines that may have been hit
+ * @param line_size - the number of bytes of trace_bits covered by each dirty_index entry,
+ *                    must be a multiple of 64
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_has_new_bits_sparse(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * dirty_index,
+	size_t line_size, size_t size)
+{
+	const struct bitmap_functions * functions = get_functions();
+	size_t line = 0, num_lines = size / line_size, run;
+	uint8_t ret = 0, result;
+
+	while ((run = next_dirty_run(dirty_index, num_lines, &line)) != 0) {
+		result = functions->has_new_bits(virgin_map + line * line_size, trace_bits + line * line_size,
+			NULL, run * line_size);
+		if (result > ret)
+			ret = result;
+		line += run;
+	}
+	return ret;
+}
+
+/**
+ * Zeroes the lines of the trace that the dirty line index says were touched, and then the
+ * index itself.
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param dirty_index - one byte per line of trace_bits, nonzero for lines that may have been hit
+ * @param line_size - the number of bytes of trace_bits covered by each dirty_index entry
+ * @param size - the size of the bitmap
+ */
+void bitmap_clear_sparse(uint8_t * trace_bits, uint8_t * dirty_index, size_t line_size, size_t size)
+{
+	size_t line = 0, num_lines = size / line_size, run;
+
+	while ((run = next_dirty_run(dirty_index, num_lines, &line)) != 0) {
+		memset(trace_bits + line * line_size, 0, run * line_size);
+		line += run;
+	}
+	memset(dirty_index, 0, num_lines);
+}
+
+/**
+ * Destructively simplify a trace by eliminating hit count information, and replacing it
+ * with 0x80 or 0x01 depending on whether the tuple is hit or not.
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmap
+ */
+void bitmap_simplify_trace(uint8_t * trace_bits, size_t size)
+{
+	get_functions()->simplify_trace(trace_bits, size);
+}
+
+/**
+ * Simplifies the trace (see bitmap_simplify_trace) and checks it for new bits (see
+ * bitmap_has_new_bits) in a single pass over the bitmaps.
+ * @param virgin_map - the bitmap representing the edges that have been hit so far
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_simplify_and_has_new_bits(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	return get_functions()->simplify_and_has_new_bits(virgin_map, trace_bits, size);
+}
+
+/**
+ * Destructively classify execution counts in a trace into AFL's hit count buckets.
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmap
+ */
+void bitmap_classify_counts(uint8_t * trace_bits, size_t size)
+{
+	get_functions()->classify_counts(trace_bits, size);
+}
+
+/**
+ * Hashes a trace, so it can be quickly compared with the traces of earlier runs.
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmap
+ * @return - the hash of the trace
+ */
+uint64_t bitmap_hash(const uint8_t * trace_bits, size_t size)
+{
+	return XXH64(trace_bits, size, 0);
+}
+
+/**
+ * Hashes the lines of a trace that the dirty line index says were touched.  The hash includes
+ * the position of each run of dirty lines, but it is not the same as the bitmap_hash of the
+ * same trace, so the two shouldn't be compared.
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param dirty_index - one byte per line of trace_bits, nonzero for lines that may have been hit
+ * @param line_size - the number of bytes of trace_bits covered by each dirty_index entry
+ * @param size - the size of the bitmap
+ * @return - the hash of the trace
+ */
+uint64_t bitmap_hash_sparse(const uint8_t * trace_bits, const uint8_t * dirty_index, size_t line_size, size_t size)
+{
+	size_t line = 0, num_lines = size / line_size, run;
+	uint64_t hash = 0;
+
+	while ((run = next_dirty_run(dirty_index, num_lines, &line)) != 0) {
+		hash = XXH64(trace_bits + line * line_size, run * line_size, hash + line);
+		line += run;
+	}
+	return hash;
+}
+
+/**
+ * ANDs one bitmap into another, as is done when merging virgin maps.  Unlike the other
+ * bitmap functions, the size doesn't need to be a multiple of 64 bytes.
+ * @param dest - the bitmap to AND into
+ * @param src - the bitmap to AND with dest
+ * @param size - the size of the bitmaps
+ */
+void bitmap_and(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	size_t bulk = size & ~(size_t)63, i;
+
+	get_functions()->and_bitmaps(dest, src, bulk);
+	for (i = bulk; i < size; i++)
+		dest[i] &= src[i];
+}
+
+//////////////////////////////////////////////////////////////
+// Shared Virgin Maps ////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * Atomically ANDs a value into a word of a virgin map that other threads or processes may be updating.
+ * @param word - the word to AND into
+ * @param value - the value to AND with the word
+ * @return - the word's value before the AND
+ */
+static inline uint64_t atomic_fetch_and_word(volatile uint64_t * word, uint64_t value)
+{
+#ifdef _MSC_VER
+	uint64_t old = *word;
+	uint64_t seen;
+
+	while ((seen = (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)word, (__int64)(old & value),
+		(__int64)old)) != old)
+		old = seen;
+	return old;
+#else
+	return __sync_fetch_and_and(word, value);
+#endif
+}
+
+/**
+ * This function is identical to bitmap_has_new_bits, but the virgin map may be shared with other
+ * threads or processes that check their traces against it at the same time.  The words of the trace
+ * that have no new bits, which is almost all of them, are checked without any atomic operations.  The
+ * others clear their bits from the virgin map with an atomic fetch and, and only count the bits that
+ * weren't already cleared, so when the same new bits are found at once, only one of the callers
+ * reports them.
+ * @param virgin_map - the shared bitmap representing the edges that have been hit so far, which must
+ *                     be 8 byte aligned
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_has_new_bits_atomic(uint8_t * virgin_map, uint8_t * trace_bits, size_t size)
+{
+	volatile uint64_t * virgin = (volatile uint64_t *)virgin_map;
+	uint64_t cur, old;
+	uint8_t ret = 0;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size / 8; i++) {
+		memcpy(&cur, trace_bits + i * 8, sizeof(cur));
+		if (!cur || !(cur & virgin[i]))
+			continue;
+
+		old = atomic_fetch_and_word(&virgin[i], ~cur);
+		if (!(cur & old))
+			continue; //Someone else found these bits first
+		if (!ret)
+			ret = 1;
+		//Look for bytes that were hit in this trace, but never before
+		for (j = 0; j < 8 && ret < 2; j++) {
+			if (((uint8_t *)&cur)[j] && ((uint8_t *)&old)[j] == 0xff)
+				ret = 2;
+		}
+	}
+	return ret;
+}
+
+/**
+ * This function is identical to bitmap_has_new_bits_atomic, but only looks at the lines of the trace
+ * that the dirty line index says were touched.  The lines that aren't marked must be zero.
+ * @param virgin_map - the shared bitmap representing the edges that have been hit so far, which must
+ *                     be 8 byte aligned
+ * @param trace_bits - the bitmap representing the edges hit in the last run
+ * @param dirty_index - one byte per line of trace_bits, nonzero for lines that may have been hit
+ * @param line_size - the number of bytes of trace_bits covered by each dirty_index entry,
+ *                    must be a multiple of 64
+ * @param size - the size of the bitmaps
+ * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
+ */
+uint8_t bitmap_has_new_bits_atomic_sparse(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * dirty_index,
+	size_t line_size, size_t size)
+{
+	size_t line = 0, num_lines = size / line_size, run;
+	uint8_t ret = 0, result;
+
+	while ((run = next_dirty_run(dirty_index, num_lines, &line)) != 0) {
+		result = bitmap_has_new_bits_atomic(virgin_map + line * line_size, trace_bits + line * line_size,
+			run * line_size);
+		if (result > ret)
+			ret = result;
+		line += run;
+	}
+	return ret;
+}
+
+/**
+ * ANDs a bitmap into a shared virgin map that other threads or processes may be updating at the same time.
+ * @param dest - the shared bitmap to AND into, which must be 8 byte aligned
+ * @param src - the bitmap to AND with dest
+ * @param size - the size of the bitmaps, which must be a multiple of 8 bytes
+ */
+void bitmap_and_atomic(uint8_t * dest, const uint8_t * src, size_t size)
+{
+	volatile uint64_t * virgin = (volatile uint64_t *)dest;
+	uint64_t value;
+	size_t i;
+
+	for (i = 0; i < size / 8; i++) {
+		memcpy(&value, src + i * 8, sizeof(value));
+		if (virgin[i] & ~value)
+			atomic_fetch_and_word(&virgin[i], value);
+	}
+}
+
+/**
+ * Selects an implementation by name, rather than the fastest one that the CPU supports, so the
+ * implementations can be benchmarked and checked against each other.  This isn't thread safe, so
+ * it shouldn't be called while other threads are using the bitmap functions.
+ * @param name - "avx2", "sse2", "neon", or "generic", or NULL to go back to the fastest one
+ * @return - zero on success, or non-zero if the implementation isn't supported on this CPU
+ */
+int bitmap_select_implementation(const char * name)
+{
+	const struct bitmap_functions * functions = NULL;
+
+	if (!name) {
+		selected_functions = NULL;
+		return 0;
+	}
+
+	if (!strcmp(name, generic_functions.name))
+		functions = &generic_functions;
+#ifdef BITMAP_SSE2
+	if (!strcmp(name, sse2_functions.name))
+		functions = &sse2_functions;
+#endif
+#ifdef BITMAP_AVX2
+	if (!strcmp(name, avx2_functions.name) && cpu_supports_avx2())
+		functions = &avx2_functions;
+#endif
+#ifdef BITMAP_NEON
+	if (!strcmp(name, neon_functions.name))
+		functions = &neon_functions;
+#endif
+	if (!functions)
+		return 1;
+	selected_functions = functions;
+	return 0;
+}
+
+/**
+ * Gets the name of the implementation selected for this CPU
+ * @return - "avx2", "sse2", "neon", or "generic"
+ */
+const char * bitmap_implementation_name(void)
+{
+	return get_functions()->name;
+}
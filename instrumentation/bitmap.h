@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Vectorized versions of the AFL style coverage bitmap functions.  On first
+//use, the fastest implementation that the CPU supports is selected (AVX2 or
+//SSE2 on x86, NEON on ARM64, and a portable 64-bit version otherwise).
+//All of these functions require the bitmap size to be a multiple of 64 bytes.
+
+uint8_t bitmap_has_new_bits(uint8_t * virgin_map, uint8_t * trace_bits, size_t size);
+uint8_t bitmap_has_new_bits_with_ignore(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * ignore_bytes, size_t size);
+uint8_t bitmap_has_new_bits_sparse(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * dirty_index,
+	size_t line_size, size_t size);
+void bitmap_clear_sparse(uint8_t * trace_bits, uint8_t * dirty_index, size_t line_size, size_t size);
+void bitmap_simplify_trace(uint8_t * trace_bits, size_t size);
+uint8_t bitmap_simplify_and_has_new_bits(uint8_t * virgin_map, uint8_t * trace_bits, size_t size);
+void bitmap_classify_counts(uint8_t * trace_bits, size_t size);
+uint64_t bitmap_hash(const uint8_t * trace_bits, size_t size);
+uint64_t bitmap_hash_sparse(const uint8_t * trace_bits, const uint8_t * dirty_index, size_t line_size, size_t size);
+void bitmap_and(uint8_t * dest, const uint8_t * src, size_t size);
+
+//Versions of the virgin map functions for virgin maps that are shared by several threads or processes,
+//which update the virgin map with atomic operations, rather than the vectorized ones
+uint8_t bitmap_has_new_bits_atomic(uint8_t * virgin_map, uint8_t * trace_bits, size_t size);
+uint8_t bitmap_has_new_bits_atomic_sparse(uint8_t * virgin_map, uint8_t * trace_bits, const uint8_t * dirty_index,
+	size_t line_size, size_t size);
+void bitmap_and_atomic(uint8_t * dest, const uint8_t * src, size_t size);
+
+const char * bitmap_implementation_name(void);
+int bitmap_select_implementation(const char * name);
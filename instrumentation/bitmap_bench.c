@@ -0,0 +1,454 @@
+#include "bitmap.h"
+
+#include <jansson.h>
+#include <jansson_helper.h>
+#include <utils.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Benchmarks each implementation of the coverage bitmap functions in bitmap.c over several map sizes,
+//densities, and hit patterns, and checks that each one gets the same results as the generic version.
+
+#define BENCH_DEFAULT_DURATION_MS 50
+#define BENCH_LINE_SIZE           64 //The line size of the dirty line index for the sparse functions
+
+//The bitmap functions that are benchmarked
+#define KERNEL_CLASSIFY_COUNTS            0
+#define KERNEL_SIMPLIFY_TRACE             1
+#define KERNEL_HAS_NEW_BITS               2
+#define KERNEL_HAS_NEW_BITS_SPARSE        3
+#define KERNEL_SIMPLIFY_AND_HAS_NEW_BITS  4
+#define KERNEL_AND                        5
+#define KERNEL_HASH                       6
+#define KERNEL_COUNT                      7
+static const char * kernel_names[KERNEL_COUNT] = {
+	"classify_counts", "simplify_trace", "has_new_bits", "has_new_bits_sparse",
+	"simplify_and_has_new_bits", "and", "hash"
+};
+
+static const char * implementation_names[] = { "generic", "sse2", "avx2", "neon" };
+
+//The options that control a benchmark run
+struct bench_options
+{
+	int * sizes;          //The map sizes to benchmark, which must be multiples of 64
+	size_t sizes_count;
+	int * densities;      //The fraction of the map's bytes that are hit, in hundredths of a percent
+	size_t densities_count;
+	char ** patterns;     //"scattered" for hits spread over the whole map, "clustered" for runs of hits
+	size_t patterns_count;
+	int duration_ms;      //How long to benchmark each function, implementation, and map for
+};
+typedef struct bench_options bench_options_t;
+
+//The bitmaps that the functions are run on.  Before each call, the working bitmaps are reset from
+//the original ones, so every call does the same work.
+struct bench_maps
+{
+	size_t size;
+	uint8_t * trace;           //The trace that was generated
+	uint8_t * dirty_index;     //The dirty line index of the generated trace
+	uint8_t * virgin;          //The virgin map the trace is checked against
+	uint8_t * work_trace;
+	uint8_t * work_virgin;
+	uint8_t * work_dirty_index;
+};
+typedef struct bench_maps bench_maps_t;
+
+static void cleanup_bench_options(bench_options_t * options)
+{
+	size_t i;
+
+	for (i = 0; options->patterns && i < options->patterns_count; i++)
+		free(options->patterns[i]);
+	free(options->patterns);
+	free(options->sizes);
+	free(options->densities);
+	free(options);
+}
+
+/**
+ * Copies a default array of ints into the options, if the options didn't have one
+ * @param array - the options' array
+ * @param count - the number of items in the options' array
+ * @param defaults - the default array
+ * @param num_defaults - the number of items in the default array
+ * @return - zero on success, non-zero on failure
+ */
+static int set_default_ints(int ** array, size_t * count, const int * defaults, size_t num_defaults)
+{
+	if (*array)
+		return 0;
+	*array = (int *)malloc(num_defaults * sizeof(int));
+	if (!*array)
+		return 1;
+	memcpy(*array, defaults, num_defaults * sizeof(int));
+	*count = num_defaults;
+	return 0;
+}
+
+static bench_options_t * setup_bench_options(char * options)
+{
+	static const int default_sizes[] = { 65536, 1 << 20 };
+	static const int default_densities[] = { 10, 100, 1000 };
+	bench_options_t * state;
+	size_t i;
+
+	state = (bench_options_t *)calloc(1, sizeof(bench_options_t));
+	if (!state)
+		return NULL;
+	state->duration_ms = BENCH_DEFAULT_DURATION_MS;
+
+	if (options && *options) {
+		PARSE_OPTION_INT_ARRAY(state, options, sizes, sizes_count, "sizes", cleanup_bench_options);
+		PARSE_OPTION_INT_ARRAY(state, options, densities, densities_count, "densities", cleanup_bench_options);
+		PARSE_OPTION_ARRAY(state, options, patterns, patterns_count, "patterns", cleanup_bench_options);
+		PARSE_OPTION_INT(state, options, duration_ms, "duration_ms", cleanup_bench_options);
+	}
+
+	if (!state->patterns) {
+		state->patterns = (char **)calloc(2, sizeof(char *));
+		if (state->patterns) {
+			state->patterns_count = 2;
+			state->patterns[0] = strdup("scattered");
+			state->patterns[1] = strdup("clustered");
+		}
+		if (!state->patterns || !state->patterns[0] || !state->patterns[1]) {
+			cleanup_bench_options(state);
+			return NULL;
+		}
+	}
+	if (set_default_ints(&state->sizes, &state->sizes_count, default_sizes, ARRAY_SIZE(default_sizes))
+		|| set_default_ints(&state->densities, &state->densities_count, default_densities, ARRAY_SIZE(default_densities))
+		|| state->duration_ms <= 0)
+	{
+		cleanup_bench_options(state);
+		return NULL;
+	}
+
+	for (i = 0; i < state->sizes_count; i++) {
+		if (state->sizes[i] <= 0 || state->sizes[i] % BENCH_LINE_SIZE) {
+			cleanup_bench_options(state);
+			return NULL;
+		}
+	}
+	for (i = 0; i < state->densities_count; i++) {
+		if (state->densities[i] < 0 || state->densities[i] > 10000) {
+			cleanup_bench_options(state);
+			return NULL;
+		}
+	}
+	for (i = 0; i < state->patterns_count; i++) {
+		if (strcmp(state->patterns[i], "scattered") && strcmp(state->patterns[i], "clustered")) {
+			cleanup_bench_options(state);
+			return NULL;
+		}
+	}
+	return state;
+}
+
+/**
+ * A small, fast random number generator, so the same maps are generated on every platform
+ * @param state - the generator's state, which must not be zero
+ * @return - the next random number
+ */
+static uint64_t next_random(uint64_t * state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/**
+ * Picks a hit count for a byte of the trace.  Most edges are only hit a few times, but some are
+ * hit many times, so each power of two up to 128 is picked as the limit equally often.
+ * @param random - the random number generator's state
+ * @return - the hit count, between 1 and 255
+ */
+static uint8_t random_hit_count(uint64_t * random)
+{
+	uint64_t value = next_random(random);
+	return (uint8_t)(1 + (value >> 8) % (2 << (value % 8)) % 255);
+}
+
+static void free_bench_maps(bench_maps_t * maps)
+{
+	free(maps->trace);
+	free(maps->dirty_index);
+	free(maps->virgin);
+	free(maps->work_trace);
+	free(maps->work_virgin);
+	free(maps->work_dirty_index);
+	memset(maps, 0, sizeof(bench_maps_t));
+}
+
+/**
+ * Generates a trace with the given density and hit pattern, and its dirty line index.  The virgin
+ * map is cleared to all ones, as though nothing had been hit yet.
+ * @param maps - the bitmaps to generate
+ * @param size - the size of the bitmaps
+ * @param density - the fraction of the trace's bytes that are hit, in hundredths of a percent
+ * @param pattern - "scattered" to spread the hits over the whole trace, or "clustered" to put them
+ *                  in runs of 32 bytes, like the edges of a function
+ * @return - zero on success, non-zero on failure
+ */
+static int generate_bench_maps(bench_maps_t * maps, size_t size, int density, const char * pattern)
+{
+	uint64_t random = 0x9E3779B97F4A7C15ULL ^ size ^ ((uint64_t)density << 32);
+	size_t hits, run_length, i, j, position;
+
+	memset(maps, 0, sizeof(bench_maps_t));
+	maps->size = size;
+	maps->trace = (uint8_t *)calloc(1, size);
+	maps->dirty_index = (uint8_t *)calloc(1, size / BENCH_LINE_SIZE);
+	maps->virgin = (uint8_t *)malloc(size);
+	maps->work_trace = (uint8_t *)malloc(size);
+	maps->work_virgin = (uint8_t *)malloc(size);
+	maps->work_dirty_index = (uint8_t *)malloc(size / BENCH_LINE_SIZE);
+	if (!maps->trace || !maps->dirty_index || !maps->virgin || !maps->work_trace
+		|| !maps->work_virgin || !maps->work_dirty_index)
+	{
+		free_bench_maps(maps);
+		return 1;
+	}
+	memset(maps->virgin, 0xff, size);
+
+	hits = (size_t)((uint64_t)size * density / 10000);
+	run_length = strcmp(pattern, "clustered") ? 1 : 32;
+	for (i = 0; i < hits; i += run_length) {
+		position = (size_t)(next_random(&random) % size);
+		for (j = 0; j < run_length && position + j < size; j++)
+			maps->trace[position + j] = random_hit_count(&random);
+	}
+	for (i = 0; i < size; i++) {
+		if (maps->trace[i])
+			maps->dirty_index[i / BENCH_LINE_SIZE] = 1;
+	}
+	return 0;
+}
+
+/**
+ * Resets the working bitmaps from the generated ones
+ * @param maps - the bitmaps to reset
+ */
+static void reset_bench_maps(bench_maps_t * maps)
+{
+	memcpy(maps->work_trace, maps->trace, maps->size);
+	memcpy(maps->work_virgin, maps->virgin, maps->size);
+	memcpy(maps->work_dirty_index, maps->dirty_index, maps->size / BENCH_LINE_SIZE);
+}
+
+/**
+ * Runs one of the bitmap functions on the working bitmaps
+ * @param kernel - which of the KERNEL_* functions to run
+ * @param maps - the bitmaps to run it on
+ * @return - the function's return value, or 0 for the functions that don't return anything
+ */
+static uint64_t run_kernel(int kernel, bench_maps_t * maps)
+{
+	switch (kernel)
+	{
+		case KERNEL_CLASSIFY_COUNTS:
+			bitmap_classify_counts(maps->work_trace, maps->size);
+			return 0;
+		case KERNEL_SIMPLIFY_TRACE:
+			bitmap_simplify_trace(maps->work_trace, maps->size);
+			return 0;
+		case KERNEL_HAS_NEW_BITS:
+			return bitmap_has_new_bits(maps->work_virgin, maps->work_trace, maps->size);
+		case KERNEL_HAS_NEW_BITS_SPARSE:
+			return bitmap_has_new_bits_sparse(maps->work_virgin, maps->work_trace, maps->work_dirty_index,
+				BENCH_LINE_SIZE, maps->size);
+		case KERNEL_SIMPLIFY_AND_HAS_NEW_BITS:
+			return bitmap_simplify_and_has_new_bits(maps->work_virgin, maps->work_trace, maps->size);
+		case KERNEL_AND:
+			bitmap_and(maps->work_virgin, maps->work_trace, maps->size);
+			return 0;
+		case KERNEL_HASH:
+			return bitmap_hash(maps->work_trace, maps->size);
+	}
+	return 0;
+}
+
+/**
+ * Runs a bitmap function with the selected implementation and with the generic one, and checks
+ * that the return values and the resulting bitmaps are the same.
+ * @param kernel - which of the KERNEL_* functions to check
+ * @param maps - the bitmaps to check it on
+ * @param implementation - the name of the implementation to check
+ * @return - 1 if the results are the same, 0 if they're different, or -1 on failure
+ */
+static int check_kernel(int kernel, bench_maps_t * maps, const char * implementation)
+{
+	uint8_t * expected_trace, * expected_virgin;
+	uint64_t expected;
+	int ret = -1;
+
+	expected_trace = (uint8_t *)malloc(maps->size);
+	expected_virgin = (uint8_t *)malloc(maps->size);
+	if (expected_trace && expected_virgin)
+	{
+		bitmap_select_implementation("generic");
+		reset_bench_maps(maps);
+		expected = run_kernel(kernel, maps);
+		memcpy(expected_trace, maps->work_trace, maps->size);
+		memcpy(expected_virgin, maps->work_virgin, maps->size);
+
+		bitmap_select_implementation(implementation);
+		reset_bench_maps(maps);
+		ret = run_kernel(kernel, maps) == expected && !memcmp(expected_trace, maps->work_trace, maps->size)
+			&& !memcmp(expected_virgin, maps->work_virgin, maps->size);
+	}
+	free(expected_trace);
+	free(expected_virgin);
+	return ret;
+}
+
+/**
+ * Benchmarks a bitmap function with the selected implementation.  The functions that check for new
+ * bits are benchmarked against a virgin map that already has the trace's bits cleared, since that's
+ * how almost every execution goes while fuzzing.
+ * @param kernel - which of the KERNEL_* functions to benchmark
+ * @param maps - the bitmaps to benchmark it on
+ * @param implementation - the name of the implementation to benchmark
+ * @param duration_ms - how long to benchmark the function for
+ * @return - a JSON object with the benchmark's results
+ */
+static json_t * benchmark_kernel(int kernel, bench_maps_t * maps, const char * implementation, int duration_ms)
+{
+	json_t * result;
+	uint64_t start, elapsed, total = 0, min = UINT64_MAX, calls = 0, end_time;
+	int matches;
+
+	result = json_object();
+	json_object_set_new(result, "kernel", json_string(kernel_names[kernel]));
+	json_object_set_new(result, "implementation", json_string(implementation));
+
+	matches = check_kernel(kernel, maps, implementation);
+	if (matches < 0) {
+		json_object_set_new(result, "error", json_string("Out of memory"));
+		return result;
+	}
+
+	//Check the trace against itself once, so the virgin map has its bits cleared
+	reset_bench_maps(maps);
+	if (kernel == KERNEL_HAS_NEW_BITS || kernel == KERNEL_HAS_NEW_BITS_SPARSE || kernel == KERNEL_SIMPLIFY_AND_HAS_NEW_BITS) {
+		run_kernel(kernel, maps);
+		memcpy(maps->work_trace, maps->trace, maps->size);
+		memcpy(maps->work_dirty_index, maps->dirty_index, maps->size / BENCH_LINE_SIZE);
+	}
+
+	end_time = get_time_ns() + (uint64_t)duration_ms * 1000000;
+	while (get_time_ns() < end_time)
+	{
+		//The functions that change the trace get a fresh copy of it each time
+		if (kernel == KERNEL_CLASSIFY_COUNTS || kernel == KERNEL_SIMPLIFY_TRACE || kernel == KERNEL_SIMPLIFY_AND_HAS_NEW_BITS)
+			memcpy(maps->work_trace, maps->trace, maps->size);
+		start = get_time_ns();
+		run_kernel(kernel, maps);
+		elapsed = get_time_ns() - start;
+		total += elapsed;
+		if (elapsed < min)
+			min = elapsed;
+		calls++;
+	}
+
+	json_object_set_new(result, "matches_generic", json_boolean(matches));
+	json_object_set_new(result, "calls", json_integer(calls));
+	json_object_set_new(result, "mean_ns", json_real(calls ? (double)total / calls : 0));
+	json_object_set_new(result, "min_ns", json_integer(calls ? min : 0));
+	json_object_set_new(result, "bytes_per_second", json_real(total ? calls * maps->size * 1000000000.0 / total : 0));
+	return result;
+}
+
+static void usage(char * program_name)
+{
+	printf(
+"Usage: %s [\"JSON Benchmark Options String\"]\n"
+"\n"
+"Benchmarks each implementation of the coverage bitmap functions that this CPU\n"
+"supports, and checks that they get the same results as the generic version.\n"
+"The results are printed as a JSON array.  The exit code is 1 if any of the\n"
+"implementations got different results.\n"
+"\n"
+"Options:\n"
+"  sizes        An array of the map sizes to benchmark, which must be multiples\n"
+"                 of 64 (default [65536, 1048576])\n"
+"  densities    An array of the fractions of the map that are hit, in\n"
+"                 hundredths of a percent (default [10, 100, 1000])\n"
+"  patterns     An array of the hit patterns to benchmark, \"scattered\" for hits\n"
+"                 spread over the whole map, or \"clustered\" for runs of hits\n"
+"                 (default [\"scattered\", \"clustered\"])\n"
+"  duration_ms  How long to benchmark each function for (default %d)\n",
+		program_name, BENCH_DEFAULT_DURATION_MS);
+}
+
+int main(int argc, char ** argv)
+{
+	bench_options_t * options;
+	bench_maps_t maps;
+	json_t * results, * result;
+	char * output;
+	size_t i, j, k;
+	int kernel, implementation, ret = 0;
+
+	if (argc > 2 || (argc == 2 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))) {
+		usage(argv[0]);
+		return 1;
+	}
+	options = setup_bench_options(argc == 2 ? argv[1] : NULL);
+	if (!options) {
+		fprintf(stderr, "Invalid benchmark options\n");
+		usage(argv[0]);
+		return 1;
+	}
+
+	results = json_array();
+	for (i = 0; i < options->sizes_count; i++)
+	{
+		for (j = 0; j < options->densities_count; j++)
+		{
+			for (k = 0; k < options->patterns_count; k++)
+			{
+				if (generate_bench_maps(&maps, options->sizes[i], options->densities[j], options->patterns[k])) {
+					fprintf(stderr, "Couldn't allocate the %d byte maps\n", options->sizes[i]);
+					ret = 1;
+					continue;
+				}
+				for (kernel = 0; kernel < KERNEL_COUNT; kernel++)
+				{
+					for (implementation = 0; implementation < (int)ARRAY_SIZE(implementation_names); implementation++)
+					{
+						//The hash doesn't have a vectorized version
+						if ((kernel == KERNEL_HASH && implementation)
+							|| bitmap_select_implementation(implementation_names[implementation]))
+							continue;
+						result = benchmark_kernel(kernel, &maps, implementation_names[implementation], options->duration_ms);
+						json_object_set_new(result, "size", json_integer(options->sizes[i]));
+						json_object_set_new(result, "density", json_integer(options->densities[j]));
+						json_object_set_new(result, "pattern", json_string(options->patterns[k]));
+						if (!json_is_true(json_object_get(result, "matches_generic"))) {
+							fprintf(stderr, "The %s %s got different results than the generic version\n",
+								implementation_names[implementation], kernel_names[kernel]);
+							ret = 1;
+						}
+						json_array_append_new(results, result);
+					}
+				}
+				free_bench_maps(&maps);
+			}
+		}
+	}
+	bitmap_select_implementation(NULL);
+
+	output = json_dumps(results, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+	if (output)
+		puts(output);
+	free(output);
+	json_decref(results);
+	cleanup_bench_options(options);
+	return ret;
+}
@@ -0,0 +1,565 @@
+// Linux-only breakpoint coverage instrumentation, for targets that weren't compiled with any instrumentation.
+
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>    // kill
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>    // memset
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "instrumentation.h"
+#include "breakpoint_instrumentation.h"
+#include "forkserver_internal.h"
+
+#include <utils.h>
+#include <jansson_helper.h>
+
+//The fork server library reads the SHM id from the environment when the target starts, so the states can't start
+//their targets at the same time
+static pthread_mutex_t launch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////////////////////////
+// Private methods /////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+static int compare_addresses(const void * a, const void * b)
+{
+	uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+	return first < second ? -1 : first > second;
+}
+
+/**
+ * This function reads the basic block addresses from a blocks file, which lists one hex address per line, relative to
+ * the executable's load address (i.e. the addresses objdump shows).  Blank lines and lines starting with # are
+ * skipped.  The addresses are sorted and duplicates are removed.
+ * @param filename - the blocks file to read
+ * @param addresses_out - a pointer used to return the addresses, which the caller should free
+ * @param num_out - a pointer used to return the number of addresses
+ * @return - zero on success, non-zero on failure
+ */
+static int read_blocks_file(char * filename, uint64_t ** addresses_out, uint32_t * num_out)
+{
+	char * buffer, * line, * end;
+	uint64_t * addresses, * temp;
+	size_t num = 0, size = 1024, i, unique;
+	int length;
+
+	length = read_file(filename, &buffer);
+	if(length < 0) {
+		ERROR_MSG("Couldn't read the blocks file %s", filename);
+		return 1;
+	}
+	addresses = malloc(size * sizeof(uint64_t));
+	if(!addresses) {
+		free(buffer);
+		return 1;
+	}
+
+	for(line = buffer; *line; line = end) {
+		while(*line && isspace((unsigned char)*line))
+			line++;
+		if(!*line)
+			break;
+		if(*line == '#') {
+			end = strchr(line, '\n');
+			if(!end)
+				break;
+			continue;
+		}
+		if(num == size) {
+			size *= 2;
+			temp = realloc(addresses, size * sizeof(uint64_t));
+			if(!temp) {
+				free(addresses);
+				free(buffer);
+				return 1;
+			}
+			addresses = temp;
+		}
+		addresses[num] = strtoull(line, &end, 16);
+		if(end == line || (*end && !isspace((unsigned char)*end))) {
+			ERROR_MSG("The blocks file %s has a line that isn't a hex address: %.32s", filename, line);
+			free(addresses);
+			free(buffer);
+			return 1;
+		}
+		num++;
+	}
+	free(buffer);
+
+	if(!num || num > UINT32_MAX / 2) {
+		ERROR_MSG("The blocks file %s doesn't list any blocks, or lists too many", filename);
+		free(addresses);
+		return 1;
+	}
+	qsort(addresses, num, sizeof(uint64_t), compare_addresses);
+	for(i = 1, unique = 1; i < num; i++) {
+		if(addresses[i] != addresses[unique - 1])
+			addresses[unique++] = addresses[i];
+	}
+
+	*addresses_out = addresses;
+	*num_out = (uint32_t)unique;
+	return 0;
+}
+
+/**
+ * This function creates the SHM region that the fork server library reads the block addresses from and records the
+ * hit blocks in
+ * @param state - The breakpoint_state_t object containing this instrumentation's state
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_shm(breakpoint_state_t * state)
+{
+	uint64_t * addresses;
+	uint32_t num_blocks;
+
+	if(read_blocks_file(state->blocks_file, &addresses, &num_blocks))
+		return 1;
+
+	state->shm_id = shmget(IPC_PRIVATE, BREAKPOINT_SHM_SIZE(num_blocks), IPC_CREAT | IPC_EXCL | 0600);
+	if(state->shm_id < 0) {
+		free(addresses);
+		ERROR_MSG("shmget() failed");
+		return 1;
+	}
+	state->shm = shmat(state->shm_id, NULL, 0);
+	if(state->shm == (void *)-1) {
+		state->shm = NULL;
+		free(addresses);
+		shmctl(state->shm_id, IPC_RMID, NULL);
+		ERROR_MSG("shmat() failed");
+		return 1;
+	}
+
+	memset(state->shm, 0, BREAKPOINT_SHM_SIZE(num_blocks));
+	state->shm->num_blocks = num_blocks;
+	memcpy(BREAKPOINT_SHM_ADDRESSES(state->shm), addresses, num_blocks * sizeof(uint64_t));
+	free(addresses);
+	return 0;
+}
+
+/**
+ * This function marks a block as hit, as if a child had hit it.  If the fork server is running, it removes the block's
+ * breakpoint before it forks the next child.
+ * @param state - The breakpoint_state_t object containing this instrumentation's state
+ * @param index - the index of the block to mark
+ */
+static void mark_block_hit(breakpoint_state_t * state, uint32_t index)
+{
+	if(!__atomic_exchange_n(&BREAKPOINT_SHM_HIT(state->shm)[index], 1, __ATOMIC_SEQ_CST))
+		BREAKPOINT_SHM_HIT_LIST(state->shm)[__atomic_fetch_add(&state->shm->num_hits, 1, __ATOMIC_SEQ_CST)] = index + 1;
+}
+
+/**
+ * This function terminates the fuzzed process and sets the result in the
+ * instrumentation state.
+ *
+ * @param state - The breakpoint_state_t object containing this
+ * instrumentation's state
+ */
+static void destroy_target_process(breakpoint_state_t * state)
+{
+	if(state->child_pid && state->child_pid != -1) {
+		kill(state->child_pid, SIGKILL);
+		state->child_pid = 0;
+		state->last_status = fork_server_get_status(&state->fs, 1);
+	}
+}
+
+/**
+ * This function starts the fuzzed process
+ * @param state - The breakpoint_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process to start
+ * @param stdin_input - the input to pass to the fuzzed process's stdin
+ * @param stdin_length - the length of the stdin_input parameter
+ * @return - zero on success, non-zero on failure.
+ */
+static int create_target_process(breakpoint_state_t * state, char* cmd_line, char * stdin_input, size_t stdin_length)
+{
+	int i;
+	char ** argv;
+	char * target_path;
+	char shm_str[32];
+
+	state->last_status = FUZZ_RUNNING;
+	state->last_signal = 0;
+	state->process_reaped = 0;
+
+	if(!state->fork_server_setup) {
+		if(split_command_line(cmd_line, &target_path, &argv))
+			return -1;
+
+		pthread_mutex_lock(&launch_mutex);
+		snprintf(shm_str, sizeof(shm_str), "%d", state->shm_id);
+		setenv(BREAKPOINT_SHM_ENV_VAR, shm_str, 1);
+		state->fs.init_function = state->init_function;
+		state->fs.init_marker = state->init_marker;
+		fork_server_init(&state->fs, target_path, argv, 1, 0, stdin_length != 0);
+		unsetenv(BREAKPOINT_SHM_ENV_VAR);
+		pthread_mutex_unlock(&launch_mutex);
+		state->fork_server_setup = 1;
+
+		//Free the split up command line
+		for(i = 0; argv[i]; i++)
+			free(argv[i]);
+		free(argv);
+		free(target_path);
+	}
+
+	if(state->fs.target_stdin != -1) {
+		//Take care of the stdin input, write over the file, then truncate it accordingly
+		if(write_stdin_file(state->fs.target_stdin, stdin_input, stdin_length))
+			FATAL_MSG("Failed to write the target's stdin file");
+	}
+
+	//Start the new child and tell it to go
+	state->child_pid = fork_server_fork_run(&state->fs);
+	if(state->child_pid < 0) {
+		ERROR_MSG("Fork server failed to fork a new child\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * This function creates a breakpoint_state_t object based on the given options.
+ * @param options - A JSON string of the options to set in the new
+ *                  breakpoint_state_t. See the help function for more information on
+ *                  the specific options available.
+ * @return the breakpoint_state_t generated from the options in the JSON options
+ *         string, or NULL on failure
+ */
+static breakpoint_state_t * setup_options(char *options) {
+	breakpoint_state_t * state;
+
+	state = malloc(sizeof(breakpoint_state_t));
+	if(!state)
+		return NULL;
+	memset(state, 0, sizeof(breakpoint_state_t));
+	state->shm_id = -1;
+
+	if(options) {
+		state->options = strdup(options);
+		PARSE_OPTION_STRING(state, options, blocks_file, "blocks_file", breakpoint_cleanup);
+		PARSE_OPTION_STRING(state, options, init_function, "init_function", breakpoint_cleanup);
+		PARSE_OPTION_INT(state, options, init_marker, "init_marker", breakpoint_cleanup);
+	}
+
+	if(!state->blocks_file) {
+		ERROR_MSG("The breakpoint instrumentation requires the blocks_file option");
+		breakpoint_cleanup(state);
+		return NULL;
+	}
+	if(setup_shm(state)) {
+		breakpoint_cleanup(state);
+		return NULL;
+	}
+	return state;
+}
+
+////////////////////////////////////////////////////////////////
+// Instrumentation methods /////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates and initializes a new instrumentation specific state object based on the given options.
+ * @param options - a JSON string that contains the instrumentation specific string of options
+ * @param state - an instrumentation specific JSON string previously returned from breakpoint_get_state that should be loaded
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * breakpoint_create(char * options, char * state)
+{
+	breakpoint_state_t * breakpoint_state = setup_options(options);
+	if (!breakpoint_state)
+		return NULL;
+
+	if (state && breakpoint_set_state(breakpoint_state, state))
+	{
+		breakpoint_cleanup(breakpoint_state);
+		return NULL;
+	}
+
+	return breakpoint_state;
+}
+
+/**
+ * This function cleans up all resources with the passed in instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * This state object should not be referenced after this function returns.
+ */
+void breakpoint_cleanup(void * instrumentation_state)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+
+	destroy_target_process(state);
+	if(state->fork_server_setup)
+		fork_server_exit(&state->fs);
+	if(state->shm) {
+		shmdt(state->shm);
+		shmctl(state->shm_id, IPC_RMID, NULL);
+	}
+
+	free(state->options);
+	free(state->blocks_file);
+	free(state->init_function);
+	free(state);
+}
+
+/**
+ * This function merges the coverage information from two instrumentation states.  The merged state has the blocks that
+ * were hit in either state marked as hit.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @param other_instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
+ * on success, or NULL on failure
+ */
+void * breakpoint_merge(void * instrumentation_state, void * other_instrumentation_state)
+{
+	breakpoint_state_t * first = (breakpoint_state_t *)instrumentation_state;
+	breakpoint_state_t * second = (breakpoint_state_t *)other_instrumentation_state;
+	breakpoint_state_t * merged;
+	uint32_t i;
+
+	if(first->shm->num_blocks != second->shm->num_blocks
+		|| memcmp(BREAKPOINT_SHM_ADDRESSES(first->shm), BREAKPOINT_SHM_ADDRESSES(second->shm),
+			first->shm->num_blocks * sizeof(uint64_t))) {
+		ERROR_MSG("Can't merge breakpoint instrumentation states with different blocks files");
+		return NULL;
+	}
+
+	merged = setup_options(first->options);
+	if(!merged)
+		return NULL;
+	for(i = 0; i < merged->shm->num_blocks; i++) {
+		if(BREAKPOINT_SHM_HIT(first->shm)[i] || BREAKPOINT_SHM_HIT(second->shm)[i])
+			mark_block_hit(merged, i);
+	}
+	merged->last_num_hits = merged->shm->num_hits;
+	return merged;
+}
+
+/**
+ * This function returns the state information holding the previous execution path info.  The returned value can later be passed to
+ * breakpoint_create or breakpoint_set_state to load the state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @return - A JSON string that holds the instrumentation specific state object information on success, or NULL on failure
+ */
+char * breakpoint_get_state(void * instrumentation_state)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+	json_t *state_obj, *temp;
+	char * ret;
+
+	state_obj = json_object();
+	ADD_INT(temp, state->shm->num_blocks, state_obj, "num_blocks");
+	ADD_MEM(temp, (const char *)BREAKPOINT_SHM_HIT(state->shm), state->shm->num_blocks, state_obj, "hit");
+	ret = json_dumps(state_obj, 0);
+	json_decref(state_obj);
+	return ret;
+}
+
+/**
+ * This function frees an instrumentation state previously obtained via breakpoint_get_state.
+ * @param state - the instrumentation state to free
+ */
+void breakpoint_free_state(char * state)
+{
+	free(state);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via breakpoint_get_state.
+ * The blocks that were hit in the loaded state are marked as hit, so they won't get a breakpoint.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @param state - an instrumentation state previously obtained via breakpoint_get_state
+ * @return - 0 on success, non-zero on failure.
+ */
+int breakpoint_set_state(void * instrumentation_state, char * state)
+{
+	breakpoint_state_t * current_state = (breakpoint_state_t *)instrumentation_state;
+	int result, num_blocks;
+	char * hit;
+	uint32_t i;
+
+	if (!state)
+		return 1;
+
+	num_blocks = get_int_options(state, "num_blocks", &result);
+	if(result <= 0 || num_blocks != (int)current_state->shm->num_blocks) {
+		ERROR_MSG("The breakpoint instrumentation state is for a different blocks file");
+		return 1;
+	}
+	hit = get_mem_options(state, "hit", &result);
+	if(result <= 0)
+		return 1;
+	for(i = 0; i < current_state->shm->num_blocks; i++) {
+		if(hit[i])
+			mark_block_hit(current_state, i);
+	}
+	free(hit);
+	current_state->last_num_hits = current_state->shm->num_hits;
+	return 0;
+}
+
+/**
+ * This function enables the instrumentation and runs the fuzzed process.  If the process needs to be restarted, it will be.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @process - a pointer to return a handle to the process that instrumentation was enabled on
+ * @cmd_line - the command line of the fuzzed process to enable instrumentation on
+ * @input - a buffer to the input that should be sent to the fuzzed process on stdin
+ * @input_length - the length of the input parameter
+ * returns 0 on success, -1 on failure
+ */
+int breakpoint_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+	if(state->child_pid)
+		destroy_target_process(state);
+	state->last_num_hits = __atomic_load_n(&state->shm->num_hits, __ATOMIC_SEQ_CST);
+	if (create_target_process(state, cmd_line, input, input_length))
+		return -1;
+	state->enable_called = 1;
+	*process = state->child_pid;
+	return 0;
+}
+
+/**
+ * This function determines whether the process being instrumented has taken a new path.  Since each breakpoint is
+ * removed once it's hit, the last input took a new path if it hit any breakpoints.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the breakpoint_create function
+ * @return - 1 if the previously setup process (via the enable function) took a new path, 0 if it did not, or -1 on failure.
+ */
+int breakpoint_is_new_path(void * instrumentation_state)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+	uint32_t num_hits;
+
+	if(!state->enable_called)
+		return -1;
+	num_hits = __atomic_load_n(&state->shm->num_hits, __ATOMIC_SEQ_CST);
+	if(num_hits == state->last_num_hits)
+		return 0;
+	state->last_num_hits = num_hits;
+	return 1;
+}
+
+/**
+ * This function will return the result of the fuzz job. It should be called
+ * after the process has finished processing the tested input.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
+ */
+int breakpoint_get_fuzz_result(void * instrumentation_state)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+	if(!state->enable_called)
+		return -1;
+	return state->last_status;
+}
+
+/**
+ * This function returns the details of the last crash.  Only the signal is known, since the
+ * target is just waited on.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param info - a pointer used to return the crash's details
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int breakpoint_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info)
+{
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+	if(breakpoint_get_fuzz_result(state) != FUZZ_CRASH)
+		return 1;
+	memset(info, 0, sizeof(instrumentation_crash_info_t));
+	info->signal = state->last_signal;
+	return 0;
+}
+
+/**
+ * Checks if the target process is done fuzzing the inputs yet.  If it has finished, it will have
+ * written last_status, the result of the fuzz job.
+ *
+ * @param state - The breakpoint_state_t object containing this instrumentation's state
+ * @return - 0 if the process has not done testing the fuzzed input, 1 if the process is done, -1 on error
+ */
+int breakpoint_is_process_done(void * instrumentation_state)
+{
+	int status;
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+
+	if(!state->enable_called)
+		return -1;
+	if(state->process_reaped)
+		return 1;
+
+	status = fork_server_get_status(&state->fs, 0);
+	//it's still alive or an error occurred and we can't tell
+	if(status < 0 || status == FORKSERVER_NO_RESULTS_READY)
+		return 0;
+
+	if(WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL) {
+		state->last_status = FUZZ_CRASH;
+		state->last_signal = WTERMSIG(status);
+	} else
+		state->last_status = FUZZ_NONE;
+
+	state->process_reaped = 1;
+	state->child_pid = 0;
+	return 1;
+}
+
+/**
+ * Blocks until the target process is done testing the fuzzed input, or the timeout expires.
+ *
+ * @param state - The breakpoint_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process has not done testing the fuzzed input, 1 if the process is done, -1 on error
+ */
+int breakpoint_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	int status;
+	breakpoint_state_t * state = (breakpoint_state_t *)instrumentation_state;
+
+	if(!state->enable_called)
+		return -1;
+	if(state->process_reaped)
+		return 1;
+
+	status = fork_server_wait_for_status(&state->fs, timeout_ms);
+	if(status == FORKSERVER_NO_RESULTS_READY)
+		return 0;
+	if(status < 0)
+		return -1;
+	//The status has been recorded in the fork server state, so this won't block
+	return breakpoint_is_process_done(state);
+}
+
+/**
+ * This function returns help text for this instrumentation.  This help text will describe the instrumentation and any options
+ * that can be passed to breakpoint_create.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int breakpoint_help(char ** help_str)
+{
+	*help_str = strdup(
+		"breakpoint - Linux x86 basic block coverage for uninstrumented targets, with one-shot breakpoints\n"
+		"Options:\n"
+		"  blocks_file          A file listing the target's basic block addresses, one hex address per\n"
+		"                         line as objdump shows them; see tools/find_basic_blocks.py (required)\n"
+		"  init_function        The function to start the fork server at, rather than main, so the\n"
+		"                         target's startup code before it only runs once.  Either a name in the\n"
+		"                         dynamic symbol table, or a hex offset (0x...) from the executable's load\n"
+		"                         address\n"
+		"  init_marker          Whether to wait for the target to call KILLERBEEZ_INIT() to start the\n"
+		"                         fork server, rather than starting it at main; 1=yes, 0=no (default=0)\n"
+		"\n"
+	);
+	if (*help_str == NULL)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "forkserver_internal.h"
+#include "instrumentation.h"
+
+void * breakpoint_create(char * options, char * state);
+void breakpoint_cleanup(void * instrumentation_state);
+void * breakpoint_merge(void * instrumentation_state, void * other_instrumentation_state);
+char * breakpoint_get_state(void * instrumentation_state);
+void breakpoint_free_state(char * state);
+int breakpoint_set_state(void * instrumentation_state, char * state);
+int breakpoint_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
+int breakpoint_is_new_path(void * instrumentation_state);
+int breakpoint_get_fuzz_result(void * instrumentation_state);
+int breakpoint_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info);
+int breakpoint_is_process_done(void * instrumentation_state);
+int breakpoint_wait_for_process_done(void * instrumentation_state, int timeout_ms);
+int breakpoint_help(char ** help_str);
+
+struct breakpoint_state
+{
+	char * options;       // The options the state was created with, so merge can create another one
+	char * blocks_file;   // The file listing the addresses of the target's basic blocks
+	char * init_function; // The function to start the fork server at, rather than main
+	int init_marker;      // Whether the target starts the fork server with KILLERBEEZ_INIT()
+
+	int fork_server_setup;
+	forkserver_t fs;
+
+	int shm_id;
+	breakpoint_shm_t * shm;  // The block addresses and which of them have been hit
+	uint32_t last_num_hits;  // The number of blocks that had been hit before the last input
+
+	pid_t child_pid;
+
+	int enable_called;
+	int last_status;
+	int last_signal;    // the signal that the last crashed target was killed with
+	int process_reaped; // used to prevent further calls to fork_server_get_status if the process has been reaped
+};
+typedef struct breakpoint_state breakpoint_state_t;
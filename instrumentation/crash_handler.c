@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include <Windows.h>
+
+#include "crash_handler.h"
+
+#ifndef STATUS_HEAP_CORRUPTION
+#define STATUS_HEAP_CORRUPTION ((DWORD)0xC0000374L)
+#endif
+#ifndef STATUS_STACK_BUFFER_OVERRUN
+#define STATUS_STACK_BUFFER_OVERRUN ((DWORD)0xC0000409L)
+#endif
+
+static crash_handler_record_t * record = NULL;
+
+/**
+ * This function records the exception that is killing the target, and then kills the target, so it
+ * doesn't spend any time in Windows Error Reporting.
+ * @param exception - the exception record of the exception
+ */
+static void report_crash(EXCEPTION_RECORD * exception)
+{
+	if (record && !InterlockedCompareExchange(&record->crashed, 2, 0)) {
+		record->exception_code = exception->ExceptionCode;
+		record->fault_address = (uint64_t)(uintptr_t)exception->ExceptionAddress;
+		MemoryBarrier();
+		record->crashed = 1;
+	}
+	TerminateProcess(GetCurrentProcess(), exception->ExceptionCode);
+}
+
+/**
+ * This function is the vectored exception handler, which sees every exception before the target's own
+ * handlers do.  Most exceptions are left for the target to handle (e.g. C++ exceptions), but the ones
+ * that Windows never lets the target recover from are reported here, since they may never reach the
+ * unhandled exception filter.
+ * @param info - the exception's details
+ * @return - EXCEPTION_CONTINUE_SEARCH, so the exception is dispatched as usual
+ */
+static LONG CALLBACK vectored_handler(EXCEPTION_POINTERS * info)
+{
+	switch (info->ExceptionRecord->ExceptionCode) {
+	case STATUS_HEAP_CORRUPTION:
+	case STATUS_STACK_BUFFER_OVERRUN:
+	case STATUS_STACK_OVERFLOW:
+		report_crash(info->ExceptionRecord);
+	}
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+/**
+ * This function is the unhandled exception filter, which is called for the exceptions that none of the
+ * target's handlers handled.
+ * @param info - the exception's details
+ * @return - EXCEPTION_CONTINUE_SEARCH, although the target is killed before this returns
+ */
+static LONG WINAPI unhandled_exception_filter(EXCEPTION_POINTERS * info)
+{
+	report_crash(info->ExceptionRecord);
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+/**
+ * This function stops the target from replacing the unhandled exception filter, by patching
+ * SetUnhandledExceptionFilter to return NULL without doing anything.  The C runtime's startup code
+ * installs its own filter, which doesn't call the previous one.  The function is patched in kernelbase.dll
+ * when it's loaded, since the kernel32.dll export just jumps there.
+ */
+static void lock_unhandled_exception_filter(void)
+{
+#ifdef _M_X64
+	static const unsigned char stub[] = { 0x33, 0xC0, 0xC3 };             //xor eax, eax; ret
+#else
+	static const unsigned char stub[] = { 0x33, 0xC0, 0xC2, 0x04, 0x00 }; //xor eax, eax; ret 4
+#endif
+	HMODULE module;
+	void * function;
+	DWORD old_protect;
+
+	module = GetModuleHandle("kernelbase.dll");
+	if (!module)
+		module = GetModuleHandle("kernel32.dll");
+	function = module ? (void *)GetProcAddress(module, "SetUnhandledExceptionFilter") : NULL;
+	if (!function || !VirtualProtect(function, sizeof(stub), PAGE_EXECUTE_READWRITE, &old_protect))
+		return;
+	memcpy(function, stub, sizeof(stub));
+	VirtualProtect(function, sizeof(stub), old_protect, &old_protect);
+	FlushInstructionCache(GetCurrentProcess(), function, sizeof(stub));
+}
+
+/**
+ * This function maps the crash record that the debug instrumentation created for this process, and
+ * installs the exception handlers.
+ * @return - TRUE on success, or FALSE on failure
+ */
+static BOOL crash_handler_init(void)
+{
+	char name[MAX_PATH];
+	HANDLE mapping;
+
+	snprintf(name, sizeof(name), CRASH_HANDLER_SHM_NAME, GetCurrentProcessId());
+	mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (!mapping)
+		return FALSE;
+	record = (crash_handler_record_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(crash_handler_record_t));
+	CloseHandle(mapping);
+	if (!record)
+		return FALSE;
+
+	if (!AddVectoredExceptionHandler(1, vectored_handler))
+		return FALSE;
+	SetUnhandledExceptionFilter(unhandled_exception_filter);
+	lock_unhandled_exception_filter();
+	return TRUE;
+}
+
+BOOL WINAPI DllMain(HINSTANCE instance, DWORD reason, LPVOID reserved)
+{
+	if (reason == DLL_PROCESS_ATTACH) {
+		DisableThreadLibraryCalls(instance);
+		return crash_handler_init();
+	}
+	return TRUE;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <Windows.h>
+
+//The debug instrumentation's crash_handler option injects crash_handler.dll into the target, rather
+//than running the target under the Windows debugging API.  The DLL installs a vectored exception handler
+//and an unhandled exception filter, and reports the exception that kills the target in a shared memory
+//record, so no debug events are sent to the fuzzer while the target runs.
+
+#define CRASH_HANDLER_DLL "crash_handler.dll"
+#define CRASH_HANDLER_LOAD_TIMEOUT_MS 10000 //How long the DLL has to load before the target is given up on
+
+//The name of the file mapping holding a target's crash_handler_record_t, which is formatted with the
+//target's process id
+#define CRASH_HANDLER_SHM_NAME "Local\\killerbeez_crash_handler_%lu"
+
+struct crash_handler_record
+{
+	volatile LONG crashed;   //Set to 1 once the rest of the record is filled in
+	DWORD exception_code;    //The code of the exception that killed the target
+	uint64_t fault_address;  //The address of the instruction that faulted
+};
+typedef struct crash_handler_record crash_handler_record_t;
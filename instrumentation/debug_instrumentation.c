@@ -8,6 +8,189 @@
 #include <utils.h>
 #include <jansson_helper.h>
 
+/**
+ * This function hashes the return addresses of the top frames of a crashed thread's stack, so that crashes
+ * that fault in the same function when it's called from the same places can be told apart from crashes at
+ * the same address with different callers.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ * @param thread_id - the id of the crashed thread
+ * @return - the hash of the stack, or 0 if the stack couldn't be walked
+ */
+static uint64_t hash_crash_stack(debug_state_t * state, DWORD thread_id)
+{
+	STACKFRAME64 frame;
+	CONTEXT context;
+	HANDLE thread;
+	DWORD machine;
+	uint64_t hash;
+	int i;
+
+	thread = OpenThread(THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE, thread_id);
+	if (!thread)
+		return 0;
+	memset(&context, 0, sizeof(context));
+	context.ContextFlags = CONTEXT_FULL;
+	if (!GetThreadContext(thread, &context) || !state->dbghelp.sym_initialize(state->child_handle, NULL, TRUE)) {
+		CloseHandle(thread);
+		return 0;
+	}
+
+	memset(&frame, 0, sizeof(frame));
+#ifdef _M_X64
+	machine = IMAGE_FILE_MACHINE_AMD64;
+	frame.AddrPC.Offset = context.Rip;
+	frame.AddrFrame.Offset = context.Rbp;
+	frame.AddrStack.Offset = context.Rsp;
+#else
+	machine = IMAGE_FILE_MACHINE_I386;
+	frame.AddrPC.Offset = context.Eip;
+	frame.AddrFrame.Offset = context.Ebp;
+	frame.AddrStack.Offset = context.Esp;
+#endif
+	frame.AddrPC.Mode = frame.AddrFrame.Mode = frame.AddrStack.Mode = AddrModeFlat;
+
+	//FNV-1a over the frames' addresses
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < state->stack_depth; i++) {
+		if (!state->dbghelp.stack_walk64(machine, state->child_handle, thread, &frame, &context, NULL,
+				state->dbghelp.function_table_access, state->dbghelp.get_module_base, NULL) || !frame.AddrPC.Offset)
+			break;
+		hash = (hash ^ frame.AddrPC.Offset) * 0x100000001b3ULL;
+	}
+
+	state->dbghelp.sym_cleanup(state->child_handle);
+	CloseHandle(thread);
+	return i ? hash : 0;
+}
+
+/**
+ * This function loads the dbghelp.dll functions that walk the stack of a crashed target.
+ * @param dbghelp - the dbghelp_functions_t to load the functions into
+ * @return - zero on success, non-zero on failure
+ */
+static int load_dbghelp(dbghelp_functions_t * dbghelp)
+{
+	dbghelp->library = LoadLibrary("dbghelp.dll");
+	if (!dbghelp->library)
+		return 1;
+	dbghelp->sym_initialize = (sym_initialize_t)GetProcAddress(dbghelp->library, "SymInitialize");
+	dbghelp->sym_cleanup = (sym_cleanup_t)GetProcAddress(dbghelp->library, "SymCleanup");
+	dbghelp->stack_walk64 = (stack_walk64_t)GetProcAddress(dbghelp->library, "StackWalk64");
+	dbghelp->function_table_access = (PFUNCTION_TABLE_ACCESS_ROUTINE64)GetProcAddress(dbghelp->library, "SymFunctionTableAccess64");
+	dbghelp->get_module_base = (PGET_MODULE_BASE_ROUTINE64)GetProcAddress(dbghelp->library, "SymGetModuleBase64");
+	return !dbghelp->sym_initialize || !dbghelp->sym_cleanup || !dbghelp->stack_walk64
+		|| !dbghelp->function_table_access || !dbghelp->get_module_base;
+}
+
+/**
+ * This function starts the template process that the clone_offset option's clones are made from, and runs
+ * it until it reaches the clone point, where it's left stopped.  It must be called from the debug thread.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the template process
+ * @return - zero on success, non-zero on failure
+ */
+static int start_template_process(debug_state_t * state, char * cmd_line)
+{
+	DEBUG_EVENT de;
+	HANDLE process;
+	DWORD pid, cont;
+	unsigned char * clone_address = NULL;
+	unsigned char original, breakpoint = 0xCC;
+
+	if (start_process_and_write_to_stdin_flags(cmd_line, NULL, 0, &process, DEBUG_ONLY_THIS_PROCESS))
+		return 1;
+	pid = GetProcessId(process);
+
+	memset(&de, 0, sizeof(DEBUG_EVENT));
+	while (WaitForDebugEvent(&de, INFINITE))
+	{
+		cont = DBG_CONTINUE;
+		if (de.dwProcessId == pid) {
+			if (de.dwDebugEventCode == CREATE_PROCESS_DEBUG_EVENT)
+			{
+				if (de.u.CreateProcessInfo.hFile)
+					CloseHandle(de.u.CreateProcessInfo.hFile);
+				clone_address = (unsigned char *)de.u.CreateProcessInfo.lpBaseOfImage + state->clone_rva;
+				if (!ReadProcessMemory(process, clone_address, &original, 1, NULL)
+					|| !WriteProcessMemory(process, clone_address, &breakpoint, 1, NULL)) {
+					ERROR_MSG("Could not set a breakpoint at the clone point (offset %s)", state->clone_offset);
+					break;
+				}
+				FlushInstructionCache(process, clone_address, 1);
+			}
+			else if (de.dwDebugEventCode == EXCEPTION_DEBUG_EVENT && clone_address
+				&& de.u.Exception.ExceptionRecord.ExceptionCode == EXCEPTION_BREAKPOINT
+				&& de.u.Exception.ExceptionRecord.ExceptionAddress == clone_address)
+			{
+				//The template is left stopped in this debug event, so it stays at the clone point
+				if (!WriteProcessMemory(process, clone_address, &original, 1, NULL))
+					break;
+				FlushInstructionCache(process, clone_address, 1);
+				if (win_fork_server_init(&state->clone_server, process, de.dwThreadId, clone_address)) {
+					win_fork_server_exit(&state->clone_server);
+					return 1;
+				}
+				state->template_cmd_line = strdup(cmd_line);
+				if (!state->template_cmd_line) {
+					win_fork_server_exit(&state->clone_server);
+					return 1;
+				}
+				return 0;
+			}
+			else if (de.dwDebugEventCode == EXCEPTION_DEBUG_EVENT
+				&& de.u.Exception.ExceptionRecord.ExceptionCode != EXCEPTION_BREAKPOINT
+				&& de.u.Exception.ExceptionRecord.ExceptionCode != STATUS_WX86_BREAKPOINT)
+				cont = DBG_EXCEPTION_NOT_HANDLED; //Let the target handle its own exceptions during startup
+			else if (de.dwDebugEventCode == EXIT_PROCESS_DEBUG_EVENT)
+			{
+				ERROR_MSG("The target exited before it reached the clone point (offset %s)", state->clone_offset);
+				ContinueDebugEvent(de.dwProcessId, de.dwThreadId, cont);
+				break;
+			}
+		}
+
+		if (!ContinueDebugEvent(de.dwProcessId, de.dwThreadId, cont))
+			break;
+		memset(&de, 0, sizeof(DEBUG_EVENT));
+	}
+
+	TerminateProcess(process, 0);
+	CloseHandle(process);
+	return 1;
+}
+
+/**
+ * This function kills the clone_offset option's template process, so that the next clone starts a new one.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ */
+static void destroy_template_process(debug_state_t * state)
+{
+	win_fork_server_exit(&state->clone_server);
+	free(state->template_cmd_line);
+	state->template_cmd_line = NULL;
+}
+
+/**
+ * This function starts the target process for the clone_offset option, by cloning the template process.
+ * The template is started first if it isn't running, or if the command line has changed since it was
+ * started.  It must be called from the debug thread.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ * @return - zero on success, non-zero on failure
+ */
+static int clone_target_process(debug_state_t * state)
+{
+	//The clones share the template's stdin, which was already read up to the clone point
+	if (state->thread_args.stdin_length) {
+		ERROR_MSG("The clone_offset option can't be used with drivers that pass the input on stdin");
+		return 1;
+	}
+	if (state->template_cmd_line && strcmp(state->template_cmd_line, state->thread_args.cmd_line))
+		destroy_template_process(state);
+	if (!state->template_cmd_line && start_template_process(state, state->thread_args.cmd_line))
+		return 1;
+	return win_fork_server_fork(&state->clone_server, &state->child_handle);
+}
+
 /**
  * This function creates the target process and debugs it.  This function runs in
  * a separate thread, releasing the process_creation_semaphore once it has created
@@ -20,15 +203,26 @@ static int debugging_thread(debug_state_t * state)
 {
 	DEBUG_EVENT de;
 	DWORD cont, child_pid;
+	int failed;
 
 	while (1)
 	{
 		//Wait for the main thread to tell us to go
 		take_semaphore(state->fuzz_round_semaphore);
 
-		//Create the child process, mark it as running, and let the main thread know we're done
-		if (start_process_and_write_to_stdin_flags(state->thread_args.cmd_line, state->thread_args.stdin_input,
-				state->thread_args.stdin_length, &state->child_handle, DEBUG_ONLY_THIS_PROCESS)) {
+		//Create the child process, mark it as running, and let the main thread know we're done.  The process pool has
+		//to be created here, since only the thread that created a debugged process can debug it.
+		if (state->process_pool_size && !state->process_pool)
+			state->process_pool = process_pool_create(state->thread_args.cmd_line, state->process_pool_size, DEBUG_ONLY_THIS_PROCESS);
+		if (state->clone_rva)
+			failed = clone_target_process(state);
+		else if (state->process_pool)
+			failed = process_pool_start(state->process_pool, state->thread_args.cmd_line, state->thread_args.stdin_input,
+				state->thread_args.stdin_length, &state->child_handle);
+		else
+			failed = start_process_and_write_to_stdin_flags(state->thread_args.cmd_line, state->thread_args.stdin_input,
+				state->thread_args.stdin_length, &state->child_handle, DEBUG_ONLY_THIS_PROCESS);
+		if (failed) {
 			release_semaphore(state->process_creation_semaphore);
 			state->child_handle = NULL;
 			ERROR_MSG("Failed to create process with command line: %s\n", state->thread_args.cmd_line);
@@ -55,6 +249,9 @@ static int debugging_thread(debug_state_t * state)
 						(de.u.Exception.ExceptionRecord.ExceptionCode != EXCEPTION_BREAKPOINT &&
 						 de.u.Exception.ExceptionRecord.ExceptionCode != STATUS_WX86_BREAKPOINT)) {
 						state->last_status = FUZZ_CRASH;
+						state->last_crash.signal = de.u.Exception.ExceptionRecord.ExceptionCode;
+						state->last_crash.fault_address = (uint64_t)(uintptr_t)de.u.Exception.ExceptionRecord.ExceptionAddress;
+						state->last_crash.stack_hash = state->stack_depth ? hash_crash_stack(state, de.dwThreadId) : 0;
 						cont = DBG_EXCEPTION_NOT_HANDLED;
 						state->process_running = 0;
 
@@ -86,12 +283,140 @@ static int debugging_thread(debug_state_t * state)
 	return 0;
 }
 
+/**
+ * This function determines whether a target's exit code says it was killed by an exception, for the crash_handler
+ * option's targets that died without reporting the exception (e.g. from a __fastfail, which skips every handler).
+ * @param exit_code - the exit code of the target
+ * @return - non-zero if the exit code is that of a crash, zero otherwise
+ */
+static int is_crash_exit_code(DWORD exit_code)
+{
+	switch (exit_code) {
+	case STATUS_ACCESS_VIOLATION:
+	case STATUS_ARRAY_BOUNDS_EXCEEDED:
+	case STATUS_DATATYPE_MISALIGNMENT:
+	case STATUS_HEAP_CORRUPTION:
+	case STATUS_ILLEGAL_INSTRUCTION:
+	case STATUS_INTEGER_DIVIDE_BY_ZERO:
+	case STATUS_IN_PAGE_ERROR:
+	case STATUS_PRIVILEGED_INSTRUCTION:
+	case STATUS_STACK_BUFFER_OVERRUN:
+	case STATUS_STACK_OVERFLOW:
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function unmaps the crash_handler option's crash record of the last target.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ */
+static void free_crash_record(debug_state_t * state)
+{
+	if (state->crash_record)
+		UnmapViewOfFile(state->crash_record);
+	if (state->crash_record_mapping)
+		CloseHandle(state->crash_record_mapping);
+	state->crash_record = NULL;
+	state->crash_record_mapping = NULL;
+}
+
+/**
+ * This function starts the target process for the crash_handler option.  The target is started suspended, its
+ * crash record is created, and crash_handler.dll is loaded into it by a remote thread before it's resumed, so
+ * the exception handlers are installed before any of the target's own code runs.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process to start
+ * @param stdin_input - the input to pass to the fuzzed process's stdin
+ * @param stdin_length - the length of the stdin_input parameter
+ * @return - zero on success, non-zero on failure.
+ */
+static int start_crash_handler_process(debug_state_t * state, char * cmd_line, char * stdin_input, size_t stdin_length)
+{
+	char name[MAX_PATH];
+	HANDLE thread, loader;
+	void * remote_path;
+	size_t path_length = strlen(state->crash_handler_dll) + 1;
+	DWORD loaded = 0;
+
+	if (start_process_and_write_to_stdin_suspended(cmd_line, stdin_input, stdin_length, &state->child_handle, &thread)) {
+		ERROR_MSG("Failed to create process with command line: %s\n", cmd_line);
+		state->child_handle = NULL;
+		return 1;
+	}
+
+	snprintf(name, sizeof(name), CRASH_HANDLER_SHM_NAME, GetProcessId(state->child_handle));
+	state->crash_record_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+		sizeof(crash_handler_record_t), name);
+	if (state->crash_record_mapping)
+		state->crash_record = (crash_handler_record_t *)MapViewOfFile(state->crash_record_mapping,
+			FILE_MAP_ALL_ACCESS, 0, 0, sizeof(crash_handler_record_t));
+
+	//kernel32.dll is loaded at the same address in every process, so our LoadLibraryA is the target's too
+	remote_path = VirtualAllocEx(state->child_handle, NULL, path_length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	loader = NULL;
+	if (state->crash_record && remote_path
+		&& WriteProcessMemory(state->child_handle, remote_path, state->crash_handler_dll, path_length, NULL))
+		loader = CreateRemoteThread(state->child_handle, NULL, 0,
+			(LPTHREAD_START_ROUTINE)GetProcAddress(GetModuleHandle("kernel32.dll"), "LoadLibraryA"), remote_path, 0, NULL);
+	if (loader) {
+		if (WaitForSingleObject(loader, CRASH_HANDLER_LOAD_TIMEOUT_MS) != WAIT_OBJECT_0 || !GetExitCodeThread(loader, &loaded))
+			loaded = 0;
+		CloseHandle(loader);
+	}
+
+	if (!loaded || ResumeThread(thread) == (DWORD)-1) {
+		ERROR_MSG("Failed to load %s into the target process", state->crash_handler_dll);
+		TerminateProcess(state->child_handle, 0);
+		CloseHandle(state->child_handle);
+		CloseHandle(thread);
+		state->child_handle = NULL;
+		free_crash_record(state);
+		return 1;
+	}
+	CloseHandle(thread);
+	state->process_running = 1;
+	return 0;
+}
+
+/**
+ * This function terminates the crash_handler option's target process, and reads the result from its crash record.
+ * @param state - The debug_state_t object containing this instrumentation's state
+ */
+static void destroy_crash_handler_process(debug_state_t * state)
+{
+	DWORD exit_code;
+
+	state->last_child_hung = get_process_status(state->child_handle);
+	memset(&state->last_crash, 0, sizeof(state->last_crash));
+	if (state->crash_record && state->crash_record->crashed == 1) {
+		state->last_status = FUZZ_CRASH;
+		state->last_crash.signal = state->crash_record->exception_code;
+		state->last_crash.fault_address = state->crash_record->fault_address;
+		state->last_child_hung = 0; //It's killed itself by now, if it hasn't finished yet
+	}
+	else if (!state->last_child_hung && GetExitCodeProcess(state->child_handle, &exit_code) && is_crash_exit_code(exit_code)) {
+		state->last_status = FUZZ_CRASH;
+		state->last_crash.signal = exit_code;
+	}
+	else
+		state->last_status = FUZZ_NONE;
+
+	TerminateProcess(state->child_handle, 0);
+	CloseHandle(state->child_handle);
+	state->child_handle = NULL;
+	state->process_running = 0;
+	free_crash_record(state);
+}
+
 /**
  * This function terminates the fuzzed process.
  * @param state - The debug_state_t object containing this instrumentation's state
  */
 static void destroy_target_process(debug_state_t * state) {
-	if (state->child_handle) {
+	if (state->child_handle && state->crash_handler)
+		destroy_crash_handler_process(state);
+	else if (state->child_handle) {
 		state->last_child_hung = get_process_status(state->child_handle);
 		//If the process hung, then make sure the debug thread finishes its debug loop
 		if(state->last_child_hung)//otherwise we'll be waiting for it forever
@@ -123,6 +448,8 @@ static int create_target_process(debug_state_t * state, char* cmd_line, char * s
 	state->finished_last_run = 0;
 	state->last_child_hung = 0;
 	state->last_status = FUZZ_RUNNING;
+	if (state->crash_handler)
+		return start_crash_handler_process(state, cmd_line, stdin_input, stdin_length);
 
 	//Tell the debug thread to start a new process
 	state->thread_args.cmd_line = cmd_line;
@@ -169,11 +496,50 @@ static int finish_fuzz_round(debug_state_t * state) {
 void * debug_create(char * options, char * state)
 {
 	debug_state_t * debug_state;
+	char * end;
 	debug_state = malloc(sizeof(debug_state_t));
 	if (!debug_state)
 		return NULL;
 	memset(debug_state, 0, sizeof(debug_state_t));
 
+	if (options && strlen(options)) {
+		PARSE_OPTION_INT(debug_state, options, process_pool_size, "process_pool", debug_cleanup);
+		PARSE_OPTION_INT(debug_state, options, stack_depth, "stack_depth", debug_cleanup);
+		PARSE_OPTION_STRING(debug_state, options, clone_offset, "clone_offset", debug_cleanup);
+		PARSE_OPTION_INT(debug_state, options, crash_handler, "crash_handler", debug_cleanup);
+	}
+	if (debug_state->process_pool_size < 0 || debug_state->stack_depth < 0) {
+		ERROR_MSG("The process_pool and stack_depth options must not be negative");
+		debug_cleanup(debug_state);
+		return NULL;
+	}
+	if (debug_state->clone_offset) {
+		debug_state->clone_rva = (uintptr_t)strtoull(debug_state->clone_offset, &end, 16);
+		if (*end || !debug_state->clone_rva || debug_state->process_pool_size) {
+			ERROR_MSG("The clone_offset option must be a non-zero hex offset, and can't be used with the process_pool option");
+			debug_cleanup(debug_state);
+			return NULL;
+		}
+	}
+	if (debug_state->crash_handler) {
+		if (debug_state->process_pool_size || debug_state->clone_offset || debug_state->stack_depth) {
+			ERROR_MSG("The crash_handler option can't be used with the process_pool, clone_offset, or stack_depth options");
+			debug_cleanup(debug_state);
+			return NULL;
+		}
+		debug_state->crash_handler_dll = filename_relative_to_binary_dir(CRASH_HANDLER_DLL);
+		if (!debug_state->crash_handler_dll) {
+			ERROR_MSG("Could not find %s next to the fuzzer", CRASH_HANDLER_DLL);
+			debug_cleanup(debug_state);
+			return NULL;
+		}
+	}
+	if (debug_state->stack_depth && load_dbghelp(&debug_state->dbghelp)) {
+		ERROR_MSG("Could not load the stack walking functions from dbghelp.dll");
+		debug_cleanup(debug_state);
+		return NULL;
+	}
+
 	debug_state->fuzz_round_semaphore = create_semaphore(0, 1);
 	debug_state->process_creation_semaphore = create_semaphore(0, 1);
 	debug_state->results_ready_semaphore = create_semaphore(0, 1);
@@ -188,6 +554,10 @@ void * debug_create(char * options, char * state)
 		return NULL;
 	}
 
+	//The crash_handler option's targets aren't debugged, so they don't need the debug thread
+	if (debug_state->crash_handler)
+		return debug_state;
+
 	debug_state->debug_thread_handle = CreateThread(
 		NULL,           // default security attributes
 		0,              // default stack size
@@ -219,6 +589,13 @@ void debug_cleanup(void * instrumentation_state)
 		CloseHandle(state->debug_thread_handle);
 		state->debug_thread_handle = NULL;
 	}
+	if (state->process_pool)
+		process_pool_destroy(state->process_pool);
+	destroy_template_process(state);
+	free(state->clone_offset);
+	free(state->crash_handler_dll);
+	if (state->dbghelp.library)
+		FreeLibrary(state->dbghelp.library);
 
 	if(state->fuzz_round_semaphore)
 		destroy_semaphore(state->fuzz_round_semaphore);
@@ -342,6 +719,42 @@ int debug_get_fuzz_result(void * instrumentation_state)
 	return state->last_status;
 }
 
+/**
+ * This function returns the hash of the last crash, which combines the exception code with the
+ * address that faulted (and with the stack_depth option, the hash of the stack), so crashes at the
+ * same instruction for the same reason have the same hash.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param hash - a pointer used to return the hash
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int debug_get_crash_hash(void * instrumentation_state, uint64_t * hash)
+{
+	debug_state_t * state = (debug_state_t *)instrumentation_state;
+
+	if (debug_get_fuzz_result(state) != FUZZ_CRASH)
+		return 1;
+	*hash = (uint64_t)state->last_crash.signal ^ (0x9E3779B97F4A7C15ULL * state->last_crash.fault_address)
+		^ state->last_crash.stack_hash;
+	return 0;
+}
+
+/**
+ * This function returns the details of the last crash: the exception code, the address that faulted, and
+ * with the stack_depth option, the hash of the crashed thread's stack.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param info - a pointer used to return the crash's details
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int debug_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info)
+{
+	debug_state_t * state = (debug_state_t *)instrumentation_state;
+
+	if (debug_get_fuzz_result(state) != FUZZ_CRASH)
+		return 1;
+	*info = state->last_crash;
+	return 0;
+}
+
 /**
  * Checks if the target process is done fuzzing the inputs yet.  If it has finished, it will have
  * written last_status, the result of the fuzz job.
@@ -356,6 +769,8 @@ int debug_is_process_done(void * instrumentation_state)
 
 	if (!state->enable_called)
 		return -1;
+	if (state->crash_handler && state->child_handle)
+		return get_process_status(state->child_handle) != 1;
 	if (state->process_running)
 		return 0;
 	else
@@ -363,6 +778,27 @@ int debug_is_process_done(void * instrumentation_state)
 	// we don't need to setup for get_fuzz_result, it should be handled by the debug thread.
 }
 
+/**
+ * Blocks until the target process has finished testing the fuzzed input, or the timeout expires.
+ *
+ * @param state - The debug_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process has not finished testing the fuzzed input, 1 if the process is done,
+ * or -1 on error.
+ */
+int debug_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	debug_state_t * state = (debug_state_t *)instrumentation_state;
+
+	if (!state->enable_called)
+		return -1;
+	if (state->process_running && state->child_handle
+		&& wait_for_process_exit(state->child_handle, timeout_ms) < 0)
+		return -1;
+	// The debug thread marks the process as finished once it has handled the exit or crash
+	return debug_is_process_done(state);
+}
+
 /**
  * This function returns help text for this instrumentation.  This help text will describe the instrumentation and any options
  * that can be passed to debug_create.
@@ -374,7 +810,26 @@ int debug_help(char ** help_str)
 	*help_str = strdup(
 		"debug - Windows debug thread \"instrumentation\", only detects crashes\n"
 		"Options:\n"
-		"\tNone\n"
+		"\tprocess_pool             The number of target processes to start\n"
+		"\t                           suspended ahead of time, so they're ready\n"
+		"\t                           when the next input is tested (default 0,\n"
+		"\t                           which starts each process when it's needed)\n"
+		"\tstack_depth              The number of frames of the crashed thread's\n"
+		"\t                           stack to hash for each crash, so crashes can\n"
+		"\t                           be triaged by their callers (default 0, which\n"
+		"\t                           only records the address that faulted)\n"
+		"\tclone_offset             The offset (in hex) from the target executable's\n"
+		"\t                           base of the instruction to clone the target\n"
+		"\t                           at.  Each input is tested in a clone of a\n"
+		"\t                           process that was stopped there, rather than\n"
+		"\t                           in a new process.  The clone point should be\n"
+		"\t                           after the target's startup and before it opens\n"
+		"\t                           its input file (default none)\n"
+		"\tcrash_handler            Set to 1 to load crash_handler.dll into the\n"
+		"\t                           target to detect crashes, rather than\n"
+		"\t                           debugging it, so targets that throw many\n"
+		"\t                           exceptions they handle themselves aren't\n"
+		"\t                           slowed down by the debugger (default 0)\n"
 		"\n"
 	);
 	if (*help_str == NULL)
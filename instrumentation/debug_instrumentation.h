@@ -1,8 +1,13 @@
 #pragma once
 #include <utils.h>
 
+#include "instrumentation.h"
+
 #ifdef _WIN32
 #include <Windows.h> // HANDLE (winnt.h might work instead)
+#include <DbgHelp.h> // STACKFRAME64
+#include "forkserver_windows.h"
+#include "crash_handler.h"
 #else
 #include <sys/types.h> // pid_t
 #endif
@@ -22,7 +27,10 @@ int debug_enable(void * instrumentation_state, pid_t * process, char * cmd_line,
 
 int debug_is_new_path(void * instrumentation_state);
 int debug_get_fuzz_result(void * instrumentation_state);
+int debug_get_crash_hash(void * instrumentation_state, uint64_t * hash);
+int debug_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info);
 int debug_is_process_done(void * instrumentation_state);
+int debug_wait_for_process_done(void * instrumentation_state, int timeout_ms);
 int debug_help(char ** help_str);
 
 typedef struct
@@ -32,6 +40,27 @@ typedef struct
 	size_t stdin_length; //the length of the input to write stdin
 } thread_args_t;
 
+#ifdef _WIN32
+//The dbghelp.dll functions used to walk the stack of a crashed target, which are loaded at runtime so
+//that only the stack_depth option needs dbghelp.dll
+typedef BOOL (WINAPI * sym_initialize_t)(HANDLE process, PCSTR search_path, BOOL invade_process);
+typedef BOOL (WINAPI * sym_cleanup_t)(HANDLE process);
+typedef BOOL (WINAPI * stack_walk64_t)(DWORD machine_type, HANDLE process, HANDLE thread, LPSTACKFRAME64 stack_frame,
+	PVOID context_record, PREAD_PROCESS_MEMORY_ROUTINE64 read_memory, PFUNCTION_TABLE_ACCESS_ROUTINE64 function_table_access,
+	PGET_MODULE_BASE_ROUTINE64 get_module_base, PTRANSLATE_ADDRESS_ROUTINE64 translate_address);
+
+struct dbghelp_functions
+{
+	HMODULE library;
+	sym_initialize_t sym_initialize;
+	sym_cleanup_t sym_cleanup;
+	stack_walk64_t stack_walk64;
+	PFUNCTION_TABLE_ACCESS_ROUTINE64 function_table_access;
+	PGET_MODULE_BASE_ROUTINE64 get_module_base;
+};
+typedef struct dbghelp_functions dbghelp_functions_t;
+#endif
+
 struct debug_state
 {
 	#ifdef _WIN32
@@ -57,9 +86,31 @@ struct debug_state
 
 	int finished_last_run;
 	int last_status;
+	instrumentation_crash_info_t last_crash; //The details of the last crash, set with last_status
+	int stack_depth;                         //The number of stack frames hashed for each crash, or 0 for none
 	int last_child_hung;
 	int enable_called;
 
+	#ifdef _WIN32
+	int process_pool_size;          //The number of suspended target processes to keep ready, or 0 to disable the pool
+	process_pool_t * process_pool;  //Only used from the debug thread, besides being destroyed in debug_cleanup
+	dbghelp_functions_t dbghelp;    //Only loaded when the stack_depth option is set
+
+	//With the clone_offset option, each input is tested in a clone of a template process stopped at the
+	//clone point, rather than in a new process.  Only the debug thread uses these, besides debug_cleanup.
+	char * clone_offset;            //The clone point's offset (in hex) from the target executable's base
+	uintptr_t clone_rva;            //The parsed clone_offset, or 0 if cloning is disabled
+	win_forkserver_t clone_server;  //The template process, once it has reached the clone point
+	char * template_cmd_line;       //The command line the template process was started with
+
+	//With the crash_handler option, the target isn't debugged.  Instead, crash_handler.dll is injected into it,
+	//and it reports the exception that killed it in crash_record.
+	int crash_handler;                     //Whether the crash_handler option is set
+	char * crash_handler_dll;              //The path of crash_handler.dll
+	HANDLE crash_record_mapping;           //The file mapping holding the current target's crash_record
+	crash_handler_record_t * crash_record; //The current target's crash record, or NULL if no target is running
+	#endif
+
 	//This struct is used to pass arguments to the debugging thread.  It
 	//should only be accessed while in the create_thread_process function,
 	//as they will point to memory that is out of scope afterwards.  The
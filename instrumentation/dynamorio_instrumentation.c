@@ -6,6 +6,8 @@
 
 #include "instrumentation.h"
 #include "dynamorio_instrumentation.h"
+#include "binary_state.h"
+#include "bitmap.h"
 
 #include <utils.h>
 #include <jansson_helper.h>
@@ -79,114 +81,12 @@ char *alloc_printf(const char *format_string, ...) {
 #define FFL(_b) (0xffULL << ((_b) << 3))
 #define FF(_b)  (0xff << ((_b) << 3))
 
-/**
- * Check if the current execution path brings anything new to the table.
- * Update virgin bits to reflect the finds. Returns 1 if the only change is
- * the hit-count for a particular tuple; 2 if there are new tuples seen.
- * Updates the map, so subsequent calls will always return 0.
- * 
- * This function is called after every exec() on a fairly large buffer, so
- * it needs to be fast. We do this in 32-bit and 64-bit flavors.
- *
- * @param trace_bits - the bitmap representing the edges hit in the last run
- * @param virgin_map - the bitmap representing the edges that have been hit so far
- * @return - 1 if the only change is hit-count, 2 if there are new edges, 0 otherwise
- */
-static inline u8 has_new_bits(u8*trace_bits, u8* virgin_map) {
-
-#ifdef __x86_64__
-
-	u64* current = (u64*)trace_bits;
-	u64* virgin = (u64*)virgin_map;
-
-	u32  i = (MAP_SIZE >> 3);
-
-#else
-
-	u32* current = (u32*)trace_bits;
-	u32* virgin = (u32*)virgin_map;
-
-	u32  i = (MAP_SIZE >> 2);
-
-#endif /* ^__x86_64__ */
-
-	u8   ret = 0;
-
-	while (i--) {
-
-#ifdef __x86_64__
-
-		u64 cur = *current;
-		u64 vir = *virgin;
-
-#else
-
-		u32 cur = *current;
-		u32 vir = *virgin;
-
-#endif /* ^__x86_64__ */
-
-		/* Optimize for *current == ~*virgin, since this will almost always be the
-		case. */
-
-		if (cur & vir) {
-
-			if (ret < 2) {
-
-				/* This trace did not have any new bytes yet; see if there's any
-				current[] byte that is non-zero when virgin[] is 0xff. */
-
-#ifdef __x86_64__
-
-				if (((cur & FFL(0)) && (vir & FFL(0)) == FFL(0)) ||
-					((cur & FFL(1)) && (vir & FFL(1)) == FFL(1)) ||
-					((cur & FFL(2)) && (vir & FFL(2)) == FFL(2)) ||
-					((cur & FFL(3)) && (vir & FFL(3)) == FFL(3)) ||
-					((cur & FFL(4)) && (vir & FFL(4)) == FFL(4)) ||
-					((cur & FFL(5)) && (vir & FFL(5)) == FFL(5)) ||
-					((cur & FFL(6)) && (vir & FFL(6)) == FFL(6)) ||
-					((cur & FFL(7)) && (vir & FFL(7)) == FFL(7))) ret = 2;
-				else ret = 1;
-
-#else
-
-				if (((cur & FF(0)) && (vir & FF(0)) == FF(0)) ||
-					((cur & FF(1)) && (vir & FF(1)) == FF(1)) ||
-					((cur & FF(2)) && (vir & FF(2)) == FF(2)) ||
-					((cur & FF(3)) && (vir & FF(3)) == FF(3))) ret = 2;
-				else ret = 1;
-
-#endif /* ^__x86_64__ */
-
-			}
-
-			*virgin = vir & ~cur;
-
-		}
-
-		current++;
-		virgin++;
-
-	}
-
-	return ret;
-
-}
-
 #ifdef DEBUG_TRACE_BITS
 static int first_run = 1;
-#endif
+
 /**
- * Check if the current execution path brings anything new to the table.
- * Update virgin bits to reflect the finds. Returns 1 if the only change is
- * the hit-count for a particular tuple; 2 if there are new tuples seen.
- * Updates the map, so subsequent calls will always return 0.
- *
- * This function is called after every exec() on a fairly large buffer, so
- * it needs to be fast. We do this in 32-bit and 64-bit flavors.
- *
- * This function is identical to has_new_bits, but takes an ignore_bytes bitmap
- * that lists bits that should be ignored when determining if a new edge has been found
+ * A byte at a time version of bitmap_has_new_bits_with_ignore, which prints each byte
+ * that changed.  This is only used when debugging the trace bits, since it's much slower.
  *
  * @param trace_bits - the bitmap representing the edges hit in the last run
  * @param virgin_map - the bitmap representing the edges that have been hit so far
@@ -236,107 +136,7 @@ static inline u8 has_new_bits_with_ignore(u8*trace_bits, u8* virgin_map, u8* ign
 
 }
 
-#define AREP4(_sym)   (_sym), (_sym), (_sym), (_sym)
-#define AREP8(_sym)   AREP4(_sym), AREP4(_sym)
-#define AREP16(_sym)  AREP8(_sym), AREP8(_sym)
-#define AREP32(_sym)  AREP16(_sym), AREP16(_sym)
-#define AREP64(_sym)  AREP32(_sym), AREP32(_sym)
-#define AREP128(_sym) AREP64(_sym), AREP64(_sym)
-
-static u8 count_class_lookup[256] = {
-
-	/* 0 - 3:       4 */ 0, 1, 2, 4,
-	/* 4 - 7:      +4 */ AREP4(8),
-	/* 8 - 15:     +8 */ AREP8(16),
-	/* 16 - 31:   +16 */ AREP16(32),
-	/* 32 - 127:  +96 */ AREP64(64), AREP32(64),
-	/* 128+:     +128 */ AREP128(128)
-
-};
-
-#ifdef __x86_64__
-
-/**
- * Destructively classify execution counts in a trace. This is used as a
- * preprocessing step for any newly acquired traces. Called on every exec,
- * must be fast.
- * @param mem - the bitmap which defines the edges that have been hit by a trace
- */
-static inline void classify_counts(u64* mem) {
-
-	u32 i = MAP_SIZE >> 3;
-
-	while (i--) {
-
-		/* Optimize for sparse bitmaps. */
-
-		if (*mem) {
-
-			u8* mem8 = (u8*)mem;
-
-			mem8[0] = count_class_lookup[mem8[0]];
-			mem8[1] = count_class_lookup[mem8[1]];
-			mem8[2] = count_class_lookup[mem8[2]];
-			mem8[3] = count_class_lookup[mem8[3]];
-			mem8[4] = count_class_lookup[mem8[4]];
-			mem8[5] = count_class_lookup[mem8[5]];
-			mem8[6] = count_class_lookup[mem8[6]];
-			mem8[7] = count_class_lookup[mem8[7]];
-
-		}
-
-		mem++;
-
-	}
-
-}
-
-#else
-
-/**
-* Destructively classify execution counts in a trace. This is used as a
-* preprocessing step for any newly acquired traces. Called on every exec,
-* must be fast.
-* @param mem - the bitmap which defines the edges that have been hit by a trace
-*/
-static inline void classify_counts(u32* mem) {
-
-	u32 i = MAP_SIZE >> 2;
-
-	while (i--) {
-
-		/* Optimize for sparse bitmaps. */
-
-		if (*mem) {
-
-			u8* mem8 = (u8*)mem;
-
-			mem8[0] = count_class_lookup[mem8[0]];
-			mem8[1] = count_class_lookup[mem8[1]];
-			mem8[2] = count_class_lookup[mem8[2]];
-			mem8[3] = count_class_lookup[mem8[3]];
-
-		}
-
-		mem++;
-
-	}
-
-}
-
-#endif /* ^__x86_64__ */
-
-/**
- * This function merges the bitmap in src into the bitmap in dest
- * @param dest - the bitmap that will be combined with the src bitmap.
- * @param src - the bitmap that will be added to the dest bitmap
- */
-void merge_bitmaps(u8 * dest, const u8 * src)
-{
-	size_t i;
-	for (i = 0; i < MAP_SIZE; i++)
-		dest[i] &= src[i];
-}
+#endif //DEBUG_TRACE_BITS
 
 ////////////////////////////////////////////////////////////////
 // Process and SHM Management //////////////////////////////////
@@ -362,19 +162,13 @@ static void remove_shm(u8 * trace_bits, HANDLE shm_handle)
  * If this shared memory region isn't associated with a target module, -1 should be passed in.
  * @param out_trace_bits - A pointer to a pointer of memory that will be assigned to a mapped view of
  * the shared memory region
- * @param for_edges - whether the shm region is for the full edge recording or not
+ * @param size - the size of the shared memory region
  * @return - a Windows handle to the shared memory region on success, or NULL on failure
  */
-static HANDLE setup_shm_region(char * fuzzer_id, int index, u8 ** out_trace_bits, int for_edges)
+static HANDLE setup_shm_region(char * fuzzer_id, int index, u8 ** out_trace_bits, DWORD size)
 {
 	char* shm_str;
 	HANDLE shm_handle;
-	DWORD size;
-
-	if (for_edges)
-		size = EDGES_SHM_SIZE;
-	else
-		size = MAP_SIZE;
 
 	if (index < 0)
 		shm_str = (char *)alloc_printf("afl_shm_%s", fuzzer_id);
@@ -410,6 +204,114 @@ static HANDLE setup_shm_region(char * fuzzer_id, int index, u8 ** out_trace_bits
 	return shm_handle;
 }
 
+/**
+ * This function creates a control block and the events used to start fuzz iterations in the winafl client and get
+ * their results.
+ * @param control_id - the id that the control block and its events are named after
+ * @param control_handle - used to return the handle of the control block's shared memory region
+ * @param control - used to return the mapped control block
+ * @param command_event - used to return the event that's set after writing the command
+ * @param result_event - used to return the event that the client sets after writing the result
+ */
+static void create_control_block(char * control_id, HANDLE * control_handle, winafl_control_t ** control,
+	HANDLE * command_event, HANDLE * result_event)
+{
+	char * name;
+
+	name = (char *)alloc_printf(WINAFL_CONTROL_NAME, control_id);
+	*control_handle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(winafl_control_t), name);
+	ck_free(name);
+	if (!*control_handle)
+		FATAL_MSG("CreateFileMapping failed for the control block (GLE=%d)", GetLastError());
+	*control = (winafl_control_t *)MapViewOfFile(*control_handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(winafl_control_t));
+	if (!*control)
+		FATAL_MSG("MapViewOfFile() failed for the control block (GLE=%d)", GetLastError());
+
+	name = (char *)alloc_printf(WINAFL_COMMAND_EVENT_NAME, control_id);
+	*command_event = CreateEvent(NULL, FALSE, FALSE, name);
+	ck_free(name);
+	name = (char *)alloc_printf(WINAFL_RESULT_EVENT_NAME, control_id);
+	*result_event = CreateEvent(NULL, FALSE, FALSE, name);
+	ck_free(name);
+	if (!*command_event || !*result_event)
+		FATAL_MSG("CreateEvent failed for the control block (GLE=%d)", GetLastError());
+}
+
+/**
+ * This function creates the control block and events of the fuzzer id, which the first target process uses.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ */
+static void setup_control_block(dynamorio_state_t * state)
+{
+	create_control_block(state->fuzzer_id, &state->control_handle, &state->control, &state->command_event,
+		&state->result_event);
+}
+
+/**
+ * This function cleans up a control block and its events.
+ * @param control_handle - the handle of the control block's shared memory region
+ * @param control - the mapped control block
+ * @param command_event - the control block's command event
+ * @param result_event - the control block's result event
+ */
+static void destroy_control_block(HANDLE control_handle, winafl_control_t * control, HANDLE command_event,
+	HANDLE result_event)
+{
+	remove_shm((u8 *)control, control_handle);
+	if (command_event)
+		CloseHandle(command_event);
+	if (result_event)
+		CloseHandle(result_event);
+}
+
+/**
+ * This function cleans up the control block of the current target process and its events.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ */
+static void cleanup_control_block(dynamorio_state_t * state)
+{
+	destroy_control_block(state->control_handle, state->control, state->command_event, state->result_event);
+}
+
+/**
+ * This function creates the shared memory region the inputs are written to for the winafl client, when the
+ * shm_input option is set.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ */
+static void setup_input_region(dynamorio_state_t * state)
+{
+	char * name;
+	DWORD size = winafl_input_size(state->shm_input_max_length);
+
+	name = (char *)alloc_printf(WINAFL_INPUT_NAME, state->fuzzer_id);
+	state->input_handle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, name);
+	ck_free(name);
+	if (!state->input_handle)
+		FATAL_MSG("CreateFileMapping failed for the shared memory input region (GLE=%d)", GetLastError());
+	state->input = (winafl_input_t *)MapViewOfFile(state->input_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!state->input)
+		FATAL_MSG("MapViewOfFile() failed for the shared memory input region (GLE=%d)", GetLastError());
+	state->input->length = 0;
+	state->input->max_length = state->shm_input_max_length;
+}
+
+/**
+ * This function writes an input to the shared memory input region.  Inputs longer than the region are truncated.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param input - the input to write
+ * @param input_length - the length of the input parameter
+ */
+static void write_shm_input(dynamorio_state_t * state, char * input, size_t input_length)
+{
+	if (input_length > state->input->max_length) {
+		DEBUG_MSG("Truncating the %zu byte input to the %u byte shared memory input region", input_length, state->input->max_length);
+		input_length = state->input->max_length;
+	}
+	if (input_length)
+		memcpy(state->input->data, input, input_length);
+	state->input->length = (DWORD)input_length;
+}
+
 /**
  * This function generates a fuzzer_id for use with mapping of shared memory regions and assigns
  * the fuzzer_id to state->fuzzer_id (first freeing the previous state->fuzzer_id if set).
@@ -440,41 +342,55 @@ static void setup_shm_and_pick_fuzzer_id(dynamorio_state_t * state, int reset_vi
 	u8 attempts = 0;
 	target_module_t * target_module;
 
-	if (state->per_module_coverage)
+	if (state->per_module_coverage && !state->edges)
 	{
+		//Put all of the modules' coverage maps in one region
+		while (attempts < 5 && !state->shm_handle) {
+			attempts++;
+			generate_fuzzer_id(state);
+			state->shm_handle = setup_shm_region(state->fuzzer_id, -1, (u8**)&state->arena,
+				winafl_arena_size((DWORD)state->num_modules, MAP_SIZE));
+		}
+		if (!state->shm_handle) {
+			FATAL_MSG("Couldn't create the coverage arena shm region");
+		}
+
+		winafl_arena_init(state->arena, (DWORD)state->num_modules, MAP_SIZE);
+		FOREACH_MODULE(target_module, state)
+		{
+			target_module->trace_bits = winafl_arena_map(state->arena, target_module->index);
+			if (reset_virgin_bits)
+				memset(target_module->virgin_bits, 0xFF, MAP_SIZE);
+		}
+	}
+	else if (state->per_module_coverage)
+	{
+		//The edge lists are too large to share one region, so each module gets its own
 		//First pick a fuzzer id by trying to create the first shm region
 		target_module = state->modules;
 		while (attempts < 5 && !target_module->shm_handle) {
 			attempts++;
 			generate_fuzzer_id(state);
-			if(state->edges)
-				target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, (u8**)&target_module->edges_memory, 1);
-			else
-				target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, &target_module->trace_bits, 0);
+			target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, (u8**)&target_module->edges_memory, EDGES_SHM_SIZE);
 		}
 		if (!target_module->shm_handle) {
 			PFATAL("Couldn't create shm region for %s module\n", state->module_names[target_module->index]);
 		}
 		if(reset_virgin_bits)
 			memset(target_module->virgin_bits, 0xFF, MAP_SIZE);
-		if (state->edges)
-			memset(target_module->edges_memory, 0, EDGES_SHM_SIZE);
+		memset(target_module->edges_memory, 0, EDGES_SHM_SIZE);
 
 		//Next create the rest of them with that fuzzer id
 		target_module = target_module->next;
 		while (target_module)
 		{
-			if (state->edges)
-				target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, (u8**)&target_module->edges_memory, 1);
-			else
-				target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, &target_module->trace_bits, 0);
+			target_module->shm_handle = setup_shm_region(state->fuzzer_id, target_module->index, (u8**)&target_module->edges_memory, EDGES_SHM_SIZE);
 			if (!target_module->shm_handle)
 				FATAL_MSG("Couldn't create shm region for %s module", state->module_names[target_module->index]);
 
 			if (reset_virgin_bits)
 				memset(target_module->virgin_bits, 0xFF, MAP_SIZE);
-			if (state->edges)
-				memset(target_module->edges_memory, 0, EDGES_SHM_SIZE);
+			memset(target_module->edges_memory, 0, EDGES_SHM_SIZE);
 
 			target_module = target_module->next;
 		}
@@ -485,9 +401,9 @@ static void setup_shm_and_pick_fuzzer_id(dynamorio_state_t * state, int reset_vi
 			attempts++;
 			generate_fuzzer_id(state);
 			if (state->edges)
-				state->shm_handle = setup_shm_region(state->fuzzer_id, -1, (u8**)&state->edges_memory, 1);
+				state->shm_handle = setup_shm_region(state->fuzzer_id, -1, (u8**)&state->edges_memory, EDGES_SHM_SIZE);
 			else
-				state->shm_handle = setup_shm_region(state->fuzzer_id, -1, &state->trace_bits, 0);
+				state->shm_handle = setup_shm_region(state->fuzzer_id, -1, &state->trace_bits, MAP_SIZE);
 		}
 		if (!state->shm_handle) {
 			FATAL_MSG("Couldn't create shm region");
@@ -606,27 +522,51 @@ static void cleanup_pipe(HANDLE * pipe)
 	}
 }
 
+/**
+ * This function nudges the fuzzed process, telling the winafl client to terminate it.  The nudge is sent with
+ * dr_nudge_pid from DynamoRIO's drconfiglib.dll, so a drconfig.exe process doesn't need to be started for each
+ * nudge.  If drconfiglib.dll can't be loaded, drconfig.exe is used instead.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ */
+static void nudge_target_process(dynamorio_state_t * state)
+{
+	char kill_cmd[512], lib_path[MAX_PATH];
+	HANDLE kill_handle;
+
+	if (!state->drconfig_lib_loaded) {
+		state->drconfig_lib_loaded = 1;
+		snprintf(lib_path, sizeof(lib_path) - 1, "%s\\drconfiglib.dll", state->dynamorio_dir);
+		state->drconfig_lib = LoadLibrary(lib_path);
+		if (state->drconfig_lib)
+			state->dr_nudge_pid = (dr_nudge_pid_t)GetProcAddress(state->drconfig_lib, "dr_nudge_pid");
+		if (!state->dr_nudge_pid)
+			WARNING_MSG("Could not load dr_nudge_pid from %s, falling back to drconfig.exe", lib_path);
+	}
+
+	//Send the NUDGE_TERMINATE_PROCESS nudge to client 0 (winafl.dll).  Don't wait for the nudge to
+	//be handled, since the caller waits for the process to exit.
+	if (state->dr_nudge_pid && state->dr_nudge_pid(state->child_pid, 0, 1, 0) == DR_CONFIG_SUCCESS)
+		return;
+
+	snprintf(kill_cmd, sizeof(kill_cmd) - 1, "%s\\drconfig.exe -nudge_pid %d 0 1", state->dynamorio_dir, state->child_pid);
+	if (start_process_and_write_to_stdin(kill_cmd, NULL, 0, &kill_handle))
+		FATAL_MSG("Could not nudge process with drconfig");
+	CloseHandle(kill_handle);
+}
+
 /**
  * This function terminates the fuzzed process (running in drrun.exe).
  * @param state - The dynamorio_state_t object containing this instrumentation's state
  * @param wait_exit - The maximum number of milliseconds to wait when trying to wait for fuzzed process.
  */
 static void destroy_target_process(dynamorio_state_t * state, int wait_exit) {
-	//TODO this seems like it'll be really slow.  Optimize it if possible
-
-	char kill_cmd[512];
-	HANDLE kill_handle;
-
 	if (state->child_handle) {
 
 		//nudge the child process
 		if (WaitForSingleObject(state->child_handle, wait_exit) == WAIT_TIMEOUT) {
 
 			//Try to nudge the process first
-			snprintf(kill_cmd, sizeof(kill_cmd) - 1, "%s\\drconfig.exe -nudge_pid %d 0 1", state->dynamorio_dir, state->child_pid);
-			if (start_process_and_write_to_stdin(kill_cmd, NULL, 0, &kill_handle))
-				FATAL_MSG("Could not nudge process with drconfig");
-			CloseHandle(kill_handle);
+			nudge_target_process(state);
 
 			//wait until the child process exits
 			if (WaitForSingleObject(state->child_handle, state->timeout) == WAIT_TIMEOUT) {
@@ -646,6 +586,54 @@ static void destroy_target_process(dynamorio_state_t * state, int wait_exit) {
 	cleanup_pipe(&state->pipe_handle);
 }
 
+/**
+ * This function builds the command line that starts the fuzzed process inside of DynamoRIO.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param pidfile - the file that drrun.exe should write the fuzzed process's pid to
+ * @param control_id - the control id of the process's pipe and control block, or NULL to use the fuzzer id's
+ * @param cmd_line - the command line of the fuzzed process to start
+ * @return - the command line, which should be freed with ck_free
+ */
+static char * drrun_command(dynamorio_state_t * state, char * pidfile, char * control_id, char * cmd_line)
+{
+	char * persist_options = "", * control_options = "", * dr_cmd;
+
+	if (state->persist_dir)
+		persist_options = alloc_printf("-persist -persist_dir \"%s\"", state->persist_dir);
+	if (control_id)
+		control_options = alloc_printf(" -control_id %s", control_id);
+	dr_cmd = alloc_printf(
+		"%s\\drrun.exe -pidfile %s -no_follow_children %s -c \"%s\\winafl.dll\" %s -fuzzer_id %s%s -- %s",
+		state->dynamorio_dir, pidfile, persist_options, state->winafl_dir, state->client_params, state->fuzzer_id,
+		control_options, cmd_line);
+	if (state->persist_dir)
+		ck_free(persist_options);
+	if (control_id)
+		ck_free(control_options);
+	return dr_cmd;
+}
+
+/**
+ * This function reads the pid of a fuzzed process from the pidfile drrun.exe wrote, and deletes the pidfile.
+ * @param pidfile - the pidfile given to drrun.exe
+ * @return - the pid of the fuzzed process, or 0 if the pidfile couldn't be read
+ */
+static s32 read_pidfile(char * pidfile)
+{
+	FILE *fp;
+	size_t pidsize;
+	char buffer[MAX_PATH];
+
+	fp = fopen(pidfile, "rb");
+	if (!fp)
+		return 0;
+	pidsize = fread(buffer, 1, sizeof(buffer)-1, fp);
+	buffer[pidsize] = 0;
+	fclose(fp);
+	remove(pidfile);
+	return atoi(buffer);
+}
+
 /**
  * This function starts the fuzzed process inside of DynamoRIO
  * @param state - The dynamorio_state_t object containing this instrumentation's state
@@ -655,16 +643,16 @@ static void destroy_target_process(dynamorio_state_t * state, int wait_exit) {
  */
 static void create_target_process(dynamorio_state_t * state, char* cmd_line, char * stdin_input, size_t stdin_length) {
 	char* dr_cmd;
-	FILE *fp;
-	size_t pidsize;
-	char buffer[MAX_PATH];
 
 	state->pipe_handle = create_pipe(state->pipe_name, state->timeout);
 
+	//Throw away any command or result left over from the previous process
+	state->control->command = state->control->result = 0;
+	ResetEvent(state->command_event);
+	ResetEvent(state->result_event);
+
 	//Create the child process
-	dr_cmd = alloc_printf(
-		"%s\\drrun.exe -pidfile %s -no_follow_children -c \"%s\\winafl.dll\" %s -fuzzer_id %s -- %s",
-		state->dynamorio_dir, state->pidfile, state->winafl_dir, state->client_params, state->fuzzer_id, cmd_line);
+	dr_cmd = drrun_command(state, state->pidfile, state->control_id, cmd_line);
 	if (start_process_and_write_to_stdin(dr_cmd, stdin_input, stdin_length, &state->child_handle))
 		FATAL_MSG("Child process died when started with command line: %s", dr_cmd);
 
@@ -679,19 +667,191 @@ static void create_target_process(dynamorio_state_t * state, char* cmd_line, cha
 	ck_free(dr_cmd);
 
 	//by the time pipe has connected the pidfile must have been created
-	fp = fopen(state->pidfile, "rb");
-	if (!fp)
+	state->child_pid = read_pidfile(state->pidfile);
+	if (!state->child_pid)
 		FATAL_MSG("Error opening pidfile %s", state->pidfile);
-	pidsize = fread(buffer, 1, sizeof(buffer)-1, fp);
-	buffer[pidsize] = 0;
-	fclose(fp);
-	remove(state->pidfile);
-	state->child_pid = atoi(buffer);
 
 	//Reset the fuzz iteration count
 	state->fuzz_iterations_current = 0;
 }
 
+/**
+ * This function starts a target process in DynamoRIO for an empty slot of the process pool.  It doesn't wait
+ * for the winafl client to connect, so DynamoRIO starts up while the current process runs its input.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param slot - the empty slot to start the process in
+ * @param cmd_line - the command line of the fuzzed process to start
+ */
+static void fill_pool_slot(dynamorio_state_t * state, pooled_process_t * slot, char * cmd_line)
+{
+	char * dr_cmd;
+
+	//Each slot gets its own pipe and control block the first time it's filled
+	if (!slot->pipe_name) {
+		slot->control_id = (char *)alloc_printf("%s_pool%d", state->fuzzer_id, (int)(slot - state->pool));
+		slot->pipe_name = (char *)alloc_printf("\\\\.\\pipe\\afl_pipe_%s", slot->control_id);
+		slot->pidfile = (char *)alloc_printf("childpid_%s.txt", slot->control_id);
+		create_control_block(slot->control_id, &slot->control_handle, &slot->control, &slot->command_event,
+			&slot->result_event);
+	}
+
+	slot->pipe_handle = create_pipe(slot->pipe_name, state->timeout);
+	slot->control->command = slot->control->result = 0;
+	ResetEvent(slot->command_event);
+	ResetEvent(slot->result_event);
+
+	dr_cmd = drrun_command(state, slot->pidfile, slot->control_id, cmd_line);
+	if (start_process_and_write_to_stdin(dr_cmd, NULL, 0, &slot->child_handle)) {
+		WARNING_MSG("Could not start a pooled process with command line: %s", dr_cmd);
+		slot->child_handle = NULL;
+		cleanup_pipe(&slot->pipe_handle);
+	}
+	else
+		slot->cmd_line = strdup(cmd_line);
+	ck_free(dr_cmd);
+}
+
+/**
+ * This function stops the process in a slot of the process pool, if there is one, and empties the slot.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param slot - the slot to empty
+ */
+static void empty_pool_slot(dynamorio_state_t * state, pooled_process_t * slot)
+{
+	s32 pid;
+
+	if (slot->child_handle) {
+		//The client quits if it's waiting for the 'F' command, otherwise the process is killed
+		winafl_control_post(&slot->control->command, 'Q', slot->command_event);
+		if (WaitForSingleObject(slot->child_handle, state->timeout) == WAIT_TIMEOUT) {
+			TerminateProcess(slot->child_handle, 9);
+			pid = read_pidfile(slot->pidfile);
+			if (pid)
+				TerminateProcessByPid(pid, 9);
+		}
+		CloseHandle(slot->child_handle);
+		slot->child_handle = NULL;
+	}
+	if (slot->pidfile)
+		remove(slot->pidfile);
+	cleanup_pipe(&slot->pipe_handle);
+	free(slot->cmd_line);
+	slot->cmd_line = NULL;
+}
+
+/**
+ * This function swaps the process in a slot of the process pool with the current target process.  The slot gets
+ * the current process's pipe and control block, which are reused when the slot is filled again.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param slot - the slot to swap with the current process
+ */
+static void swap_pooled_process(dynamorio_state_t * state, pooled_process_t * slot)
+{
+	pooled_process_t current;
+
+	current.control_id = state->control_id;
+	current.pipe_name = state->pipe_name;
+	current.pidfile = state->pidfile;
+	current.child_handle = state->child_handle;
+	current.pipe_handle = state->pipe_handle;
+	current.control_handle = state->control_handle;
+	current.control = state->control;
+	current.command_event = state->command_event;
+	current.result_event = state->result_event;
+
+	state->control_id = slot->control_id;
+	state->pipe_name = slot->pipe_name;
+	state->pidfile = slot->pidfile;
+	state->child_handle = slot->child_handle;
+	state->pipe_handle = slot->pipe_handle;
+	state->control_handle = slot->control_handle;
+	state->control = slot->control;
+	state->command_event = slot->command_event;
+	state->result_event = slot->result_event;
+
+	current.cmd_line = NULL;
+	free(slot->cmd_line);
+	*slot = current;
+}
+
+/**
+ * This function makes a process from the process pool the current target process, if one was started with the
+ * same command line.  The pooled processes that were started with other command lines, or that died, are stopped.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process
+ * @return - 1 if a pooled process is now the current process, or 0 if a new process needs to be started
+ */
+static int take_pooled_process(dynamorio_state_t * state, char * cmd_line)
+{
+	pooled_process_t * slot;
+	s32 pid;
+	int i;
+
+	for (i = 0; i < state->process_pool; i++)
+	{
+		slot = &state->pool[i];
+		if (!slot->cmd_line)
+			continue;
+		if (strcmp(slot->cmd_line, cmd_line) || get_process_status(slot->child_handle) == 0) {
+			empty_pool_slot(state, slot);
+			continue;
+		}
+
+		//The client has usually connected already, since the process was started during an earlier run
+		if (!connect_to_pipe(slot->pipe_handle, slot->pipe_name, state->timeout)
+			|| !(pid = read_pidfile(slot->pidfile))) {
+			empty_pool_slot(state, slot);
+			continue;
+		}
+		swap_pooled_process(state, slot);
+		state->child_pid = pid;
+		state->fuzz_iterations_current = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function starts a process in each empty slot of the process pool.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process to start
+ */
+static void refill_process_pool(dynamorio_state_t * state, char * cmd_line)
+{
+	int i;
+
+	for (i = 0; i < state->process_pool; i++)
+	{
+		if (!state->pool[i].cmd_line)
+			fill_pool_slot(state, &state->pool[i], cmd_line);
+	}
+}
+
+/**
+ * This function stops the processes in the process pool, and frees the pool.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ */
+static void cleanup_process_pool(dynamorio_state_t * state)
+{
+	pooled_process_t * slot;
+	int i;
+
+	if (!state->pool)
+		return;
+	for (i = 0; i < state->process_pool; i++)
+	{
+		slot = &state->pool[i];
+		empty_pool_slot(state, slot);
+		if (slot->control)
+			destroy_control_block(slot->control_handle, slot->control, slot->command_event, slot->result_event);
+		if (slot->control_id) ck_free(slot->control_id);
+		if (slot->pipe_name) ck_free(slot->pipe_name);
+		if (slot->pidfile) ck_free(slot->pidfile);
+	}
+	free(state->pool);
+	state->pool = NULL;
+}
+
 /**
  * This function ends the fuzzed process (if it wasn't previously ended), cleans
  * up the pipe, and calculates the whether a new path was taken.
@@ -700,28 +860,21 @@ static void create_target_process(dynamorio_state_t * state, char* cmd_line, cha
  * has_new_coverage/has_new_coverage_per_module functions
  */
 static int finish_fuzz_round(dynamorio_state_t * state) {
-	DWORD num_bytes_available;
-	char result;
-	DWORD num_read;
+	LONG result;
 	int ret;
 
 	if (state->analyzed_last_round)
 		return state->last_path_was_new;
 
-	//Determine if the last process hung or not.  If there's nothing in the pipe, then it obviously hung.
-	if (!PeekNamedPipe(state->pipe_handle, NULL, 0, NULL, &num_bytes_available, NULL))
-		return -1;
-
-	if (!num_bytes_available)
+	//Determine if the last process hung or not.  If the client hasn't posted a result, then it obviously hung.
+	result = InterlockedExchange(&state->control->result, 0);
+	if (!result)
 	{
 		destroy_target_process(state, 0);
 		state->last_process_status = FUZZ_HANG;
 	}
 	else
 	{
-		//Read the result from the child
-		ReadFile(state->pipe_handle, &result, 1, &num_read, NULL);
-
 		//See if we should restart the client
 		state->fuzz_iterations_current++;
 		if (state->fuzz_iterations_current == state->fuzz_iterations_max) {
@@ -729,14 +882,14 @@ static int finish_fuzz_round(dynamorio_state_t * state) {
 		}
 
 		//Record the process status
-		if (num_read == 1 && result == 'K') //Normal
+		if (result == 'K') //Normal
 		{
 			state->last_process_status = FUZZ_NONE;
 		}
 		else //The process hung or crashed, restart it
 		{
 			destroy_target_process(state, 0);
-			if (num_read == 1 && result == 'C') //Crash
+			if (result == 'C') //Crash
 				state->last_process_status = FUZZ_CRASH;
 			else //unknown char or couldn't read, Hang
 				state->last_process_status = FUZZ_HANG;
@@ -757,7 +910,7 @@ static int finish_fuzz_round(dynamorio_state_t * state) {
 
 /**
  * Checks if the target process is done fuzzing the inputs yet.  If it has finished, it will have
- * written the results to the dynamorio instrumentation's pipe.
+ * written the results to the control block.
 
  * @param state - The dynamorio_state_t object containing this instrumentation's state
  * @return - 0 if the process has not done testing the fuzzed input, 1 if the process is done, -1 on error.
@@ -765,15 +918,38 @@ static int finish_fuzz_round(dynamorio_state_t * state) {
 int dynamorio_is_process_done(void * instrumentation_state)
 {
 	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
-	DWORD num_bytes_available;
 
 	if (!state->enable_called)
 		return -1;
 
-	if (!PeekNamedPipe(state->pipe_handle, NULL, 0, NULL, &num_bytes_available, NULL))
+	return state->control->result != 0;
+}
+
+/**
+ * Blocks until the target process has finished testing the fuzzed input, or the timeout expires.  This spins on
+ * the control block for a short time, and then waits for the client to set the result event.
+ *
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process has not finished testing the fuzzed input, 1 if the process is done,
+ * or -1 on error.
+ */
+int dynamorio_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
+	LONG result;
+
+	if (!state->enable_called)
 		return -1;
+	if (state->control->result)
+		return 1;
 
-	return num_bytes_available != 0;
+	//Put the result back, so finish_fuzz_round can read it
+	result = winafl_control_wait(&state->control->result, state->result_event, timeout_ms < 0 ? 0 : timeout_ms);
+	if (!result)
+		return 0;
+	InterlockedExchange(&state->control->result, result);
+	return 1;
 }
 
 ////////////////////////////////////////////////////////////////
@@ -827,7 +1003,8 @@ static void generate_client_params(dynamorio_state_t * state)
 	temp = (char *)malloc(size);
 	if (!temp)
 		FATAL_MSG("Couldn't get memory for client_params");
-	snprintf(temp, size - 1, "%s -fuzz_iterations %d", state->client_params ? state->client_params : "", state->fuzz_iterations_max);
+	snprintf(temp, size - 1, "%s -fuzz_iterations %d%s", state->client_params ? state->client_params : "", state->fuzz_iterations_max,
+		state->shm_input ? " -shm_input" : "");
 	if (state->num_modules)
 	{
 		char line[1024];
@@ -855,6 +1032,61 @@ static void generate_client_params(dynamorio_state_t * state)
 	state->client_params = temp;
 }
 
+/**
+ * This function picks the directory DynamoRIO's persisted code caches are stored in.  Each target gets its own
+ * directory under persist_cache_dir, named after the target and a hash of the paths, sizes, and modification times
+ * of the target and its coverage modules.  When any of those modules change, a new directory is used, so caches
+ * built from the old modules are never loaded.
+ * @param state - The dynamorio_state_t object containing this instrumentation's state
+ * @return - the newly allocated directory name on success, or NULL on failure
+ */
+static char * get_persist_dir(dynamorio_state_t * state)
+{
+	char target_dir[MAX_PATH], module_path[MAX_PATH], hash[33];
+	char * key, * dir, * file_part;
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	size_t key_size, key_length, i;
+
+	if (!GetFullPathName(state->target_path, sizeof(target_dir), target_dir, &file_part) || !file_part)
+		return NULL;
+	*file_part = 0;
+
+	key_size = (state->num_modules + 1) * (MAX_PATH + 64);
+	key = (char *)malloc(key_size);
+	if (!key)
+		return NULL;
+	key_length = 0;
+
+	for (i = 0; i <= state->num_modules; i++)
+	{
+		//Find the module next to the target first, and then in the usual DLL search path
+		if (i == 0)
+			strncpy(module_path, state->target_path, sizeof(module_path) - 1);
+		else if (!SearchPath(target_dir, state->module_names[i - 1], NULL, sizeof(module_path), module_path, NULL)
+			&& !SearchPath(NULL, state->module_names[i - 1], NULL, sizeof(module_path), module_path, NULL))
+			strncpy(module_path, state->module_names[i - 1], sizeof(module_path) - 1);
+		module_path[sizeof(module_path) - 1] = 0;
+
+		memset(&attributes, 0, sizeof(attributes));
+		GetFileAttributesEx(module_path, GetFileExInfoStandard, &attributes);
+		key_length += snprintf(key + key_length, key_size - key_length, "%s|%lu|%lu|%lu|%lu\n", module_path,
+			attributes.nFileSizeHigh, attributes.nFileSizeLow,
+			attributes.ftLastWriteTime.dwHighDateTime, attributes.ftLastWriteTime.dwLowDateTime);
+	}
+	md5((uint8_t *)key, key_length, hash, sizeof(hash));
+	free(key);
+
+	CreateDirectory(state->persist_cache_dir, NULL);
+	dir = (char *)alloc_printf("%s\\%s_%.16s", state->persist_cache_dir, PathFindFileName(state->target_path), hash);
+	if (!CreateDirectory(dir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		ERROR_MSG("Could not create the persisted code cache directory %s (GLE=%d)", dir, GetLastError());
+		ck_free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
 /**
 * This function adds the string \bin32\ or \bin64\ to the end of the provided
 * dynamorio base path. The architecture is chosen to match the binary in
@@ -957,6 +1189,7 @@ static dynamorio_state_t * copy_state(dynamorio_state_t * original)
 		pick_default_dynamorio_dir(ret, NULL);
 		ret->default_winafl_dir = filename_relative_to_binary_dir(".");
 		ret->fuzz_iterations_max = 1;
+		ret->shm_input_max_length = WINAFL_INPUT_DEFAULT_MAX_SIZE;
 		ret->timeout = 1000; //1 second
 		ret->edges = 0;
 		ret->analyzed_last_round = 1;
@@ -974,6 +1207,11 @@ static dynamorio_state_t * copy_state(dynamorio_state_t * original)
 	ret->per_module_coverage = original->per_module_coverage;
 	ret->fuzz_iterations_max = original->fuzz_iterations_max;
 	if (original->client_params) ret->client_params = strdup(original->client_params);
+	if (original->persist_cache_dir) ret->persist_cache_dir = strdup(original->persist_cache_dir);
+	if (original->persist_dir) ret->persist_dir = (char *)alloc_printf("%s", original->persist_dir);
+	ret->shm_input = original->shm_input;
+	ret->shm_input_max_length = original->shm_input_max_length;
+	ret->process_pool = original->process_pool;
 	ret->timeout = original->timeout;
 	ret->fuzz_iterations_current = original->fuzz_iterations_current;
 	ret->edges = original->edges;
@@ -1049,6 +1287,10 @@ static dynamorio_state_t * setup_options(char * options)
 	PARSE_OPTION_INT(state, options, timeout, "timeout", dynamorio_cleanup);
 	PARSE_OPTION_ARRAY(state, options, module_names, num_modules, "coverage_modules", dynamorio_cleanup);
 	PARSE_OPTION_INT(state, options, edges, "edges", dynamorio_cleanup);
+	PARSE_OPTION_STRING(state, options, persist_cache_dir, "persist_cache_dir", dynamorio_cleanup);
+	PARSE_OPTION_INT(state, options, shm_input, "shm_input", dynamorio_cleanup);
+	PARSE_OPTION_INT(state, options, shm_input_max_length, "shm_input_max_length", dynamorio_cleanup);
+	PARSE_OPTION_INT(state, options, process_pool, "process_pool", dynamorio_cleanup);
 
 	if (!state->num_modules && state->target_path) { //if the user didn't specify a module, we'll pick the executable itself by default
 		state->num_modules = 1;
@@ -1102,6 +1344,36 @@ static dynamorio_state_t * setup_options(char * options)
 	}
 	//printf("\n");
 
+	if (state->persist_cache_dir)
+	{
+		if (!state->target_path) {
+			ERROR_MSG("The persist_cache_dir option requires the target_path option");
+			dynamorio_cleanup(state);
+			return NULL;
+		}
+		state->persist_dir = get_persist_dir(state);
+		if (!state->persist_dir) {
+			dynamorio_cleanup(state);
+			return NULL;
+		}
+	}
+
+	if (state->shm_input && state->shm_input_max_length <= 0) {
+		ERROR_MSG("The shm_input_max_length option must be greater than 0");
+		dynamorio_cleanup(state);
+		return NULL;
+	}
+
+	//A persistence mode target would run ahead to its target function while it waits in the pool, and could read
+	//the input file before the input is written
+	if (state->process_pool < 0 || state->process_pool > DYNAMORIO_MAX_PROCESS_POOL
+		|| (state->process_pool && state->client_params && strstr(state->client_params, "-target_module"))) {
+		ERROR_MSG("The process_pool option must be between 0 and %d, and can't be used with the -target_module "
+			"client_params", DYNAMORIO_MAX_PROCESS_POOL);
+		dynamorio_cleanup(state);
+		return NULL;
+	}
+
 	generate_client_params(state);
 	load_ignore_bytes(state);
 	return state;
@@ -1141,21 +1413,29 @@ void dynamorio_cleanup(void * instrumentation_state)
 
 	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
 	destroy_target_process(state, 0);
-	remove_shm(state->trace_bits, state->shm_handle);
+	cleanup_process_pool(state);
+	remove_shm(state->arena ? (u8 *)state->arena : state->trace_bits, state->shm_handle);
+	cleanup_control_block(state);
+	remove_shm((u8 *)state->input, state->input_handle);
 
 	for (target_module = state->modules; target_module; )
 	{
 		next = target_module->next;
-		remove_shm(target_module->trace_bits, target_module->shm_handle);
+		if (target_module->shm_handle) //Only the edge lists have their own shm regions
+			remove_shm((u8 *)target_module->edges_memory, target_module->shm_handle);
 		free(state->ignore_bytes);
 		free(state->module_names[target_module->index]);
 		free(target_module);
 		target_module = next;
 	}
 
+	if (state->drconfig_lib) FreeLibrary(state->drconfig_lib);
 	if (state->pidfile) ck_free(state->pidfile);
 	if (state->pipe_name) ck_free(state->pipe_name);
+	if (state->control_id) ck_free(state->control_id);
 	if (state->fuzzer_id) ck_free(state->fuzzer_id);
+	if (state->persist_dir) ck_free(state->persist_dir);
+	free(state->persist_cache_dir);
 	free(state->default_dynamorio_dir);
 	free(state->dynamorio_dir);
 	free(state->default_winafl_dir);
@@ -1215,7 +1495,7 @@ void * dynamorio_merge(void * instrumentation_state, void * other_instrumentatio
 			{
 				if (!strcmp(ret->module_names[ret_module->index], second->module_names[new_module->index]))
 				{
-					merge_bitmaps(ret_module->virgin_bits, new_module->virgin_bits);
+					bitmap_and(ret_module->virgin_bits, new_module->virgin_bits, MAP_SIZE);
 					//We don't really need to track these, they're not relevant for merged instrumentations
 					ret_module->last_path_was_new = ret_module->last_shm_hash = 0;
 				}
@@ -1224,7 +1504,7 @@ void * dynamorio_merge(void * instrumentation_state, void * other_instrumentatio
 	}
 	else
 	{
-		merge_bitmaps(ret->virgin_bits, second->virgin_bits);
+		bitmap_and(ret->virgin_bits, second->virgin_bits, MAP_SIZE);
 		ret->last_path_was_new = ret->last_shm_hash = 0;
 	}
 	return ret;
@@ -1251,7 +1531,7 @@ char * dynamorio_get_state(void * instrumentation_state)
 	
 	if (!state->per_module_coverage)
 	{
-		ADD_MEM(temp, (const char *)state->virgin_bits, MAP_SIZE, state_obj, "virgin_bits");
+		ADD_MEM_NOCOPY(temp, (const char *)state->virgin_bits, MAP_SIZE, state_obj, "virgin_bits");
 		ADD_INT(temp, state->last_shm_hash, state_obj, "last_shm_hash");
 		ADD_INT(temp, state->last_path_was_new, state_obj, "last_path_was_new");
 	}
@@ -1266,7 +1546,7 @@ char * dynamorio_get_state(void * instrumentation_state)
 			if (!module_obj)
 				return NULL;
 			ADD_STRING(temp, state->module_names[target_module->index], module_obj, "name");
-			ADD_MEM(temp, (const char *)target_module->virgin_bits, MAP_SIZE, module_obj, "virgin_bits");
+			ADD_MEM_NOCOPY(temp, (const char *)target_module->virgin_bits, MAP_SIZE, module_obj, "virgin_bits");
 			ADD_INT(temp, target_module->last_shm_hash, module_obj, "last_shm_hash");
 			ADD_INT(temp, target_module->last_path_was_new, module_obj, "last_path_was_new");
 			json_array_append_new(module_list, module_obj);
@@ -1274,7 +1554,7 @@ char * dynamorio_get_state(void * instrumentation_state)
 		json_object_set_new(state_obj, "modules", module_list);
 	}
 
-	ret = json_dumps(state_obj, 0);
+	ret = dump_json_to_string(state_obj, 0, NULL);
 	json_decref(state_obj);
 	return ret;
 
@@ -1362,55 +1642,243 @@ int dynamorio_set_state(void * instrumentation_state, char * state)
 	return 0;
 }
 
+/**
+ * This function builds the name of a per module binary state section, i.e. "module/item".
+ * @param buffer - a buffer of BINARY_STATE_NAME_LENGTH bytes to write the name to
+ * @param module_name - the name of the module, or NULL for the sections that aren't per module
+ * @param item - the name of the item in the module
+ * @return - 0 on success, non-zero if the name is too long
+ */
+static int binary_section_name(char * buffer, char * module_name, const char * item)
+{
+	int length;
+	if (module_name)
+		length = snprintf(buffer, BINARY_STATE_NAME_LENGTH, "%s/%s", module_name, item);
+	else
+		length = snprintf(buffer, BINARY_STATE_NAME_LENGTH, "%s", item);
+	if (length < 0 || length >= BINARY_STATE_NAME_LENGTH) {
+		ERROR_MSG("The module name %s is too long for the binary instrumentation state", module_name);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function adds the coverage information for one module (or for the whole process) to a binary state.
+ * @param writer - the binary state writer to add the sections to
+ * @param module_name - the name of the module, or NULL when per module coverage isn't being used
+ * @param virgin_bits - the virgin bits to add
+ * @param last_shm_hash - the most recent hash of the module's SHM region
+ * @param last_path_was_new - whether the last path was new in the module
+ * @return - 0 on success, non-zero on failure
+ */
+static int add_binary_coverage(binary_state_writer_t * writer, char * module_name, u8 * virgin_bits,
+	u32 last_shm_hash, int last_path_was_new)
+{
+	char name[BINARY_STATE_NAME_LENGTH];
+
+	if (binary_section_name(name, module_name, "virgin_bits")
+		|| binary_state_add_section(writer, name, BINARY_STATE_MERGE_AND, 0, virgin_bits, MAP_SIZE)
+		|| binary_section_name(name, module_name, "last_shm_hash")
+		|| binary_state_add_int(writer, name, last_shm_hash)
+		|| binary_section_name(name, module_name, "last_path_was_new")
+		|| binary_state_add_int(writer, name, last_path_was_new))
+		return 1;
+	return 0;
+}
+
+/**
+ * This function loads the coverage information for one module (or for the whole process) from a binary state.
+ * @param binary_state - the binary state to read the sections from
+ * @param module_name - the name of the module, or NULL when per module coverage isn't being used
+ * @param virgin_bits - the virgin bits to load into
+ * @param last_shm_hash - a pointer used to return the most recent hash of the module's SHM region
+ * @param last_path_was_new - a pointer used to return whether the last path was new in the module
+ * @return - 0 on success, non-zero on failure
+ */
+static int get_binary_coverage(binary_state_t * binary_state, char * module_name, u8 * virgin_bits,
+	u32 * last_shm_hash, int * last_path_was_new)
+{
+	char name[BINARY_STATE_NAME_LENGTH];
+	int64_t hash, path_was_new;
+
+	if (binary_section_name(name, module_name, "virgin_bits")
+		|| binary_state_get_section(binary_state, name, virgin_bits, MAP_SIZE)
+		|| binary_section_name(name, module_name, "last_shm_hash")
+		|| binary_state_get_int(binary_state, name, &hash)
+		|| binary_section_name(name, module_name, "last_path_was_new")
+		|| binary_state_get_int(binary_state, name, &path_was_new))
+		return 1;
+	*last_shm_hash = (u32)hash;
+	*last_path_was_new = (int)path_was_new;
+	return 0;
+}
+
+/**
+ * This function returns the state information in the compact binary state format.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success, or NULL on failure.  It should be freed with dynamorio_free_state.
+ */
+char * dynamorio_get_binary_state(void * instrumentation_state, size_t * length)
+{
+	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
+	target_module_t * target_module;
+	binary_state_writer_t * writer;
+	int error;
+
+	writer = binary_state_writer_create("dynamorio", 1);
+	if (!writer)
+		return NULL;
+
+	error = binary_state_add_int(writer, "last_process_status", state->last_process_status);
+	if (!state->per_module_coverage)
+		error = error || add_binary_coverage(writer, NULL, state->virgin_bits, state->last_shm_hash, state->last_path_was_new);
+	else
+	{
+		FOREACH_MODULE(target_module, state)
+		{
+			error = error || add_binary_coverage(writer, state->module_names[target_module->index],
+				target_module->virgin_bits, target_module->last_shm_hash, target_module->last_path_was_new);
+		}
+	}
+
+	if (error) {
+		binary_state_writer_free(writer);
+		return NULL;
+	}
+	return binary_state_writer_finish(writer, length);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via dynamorio_get_binary_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
+ * @param state - a binary state previously obtained via dynamorio_get_binary_state
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure.
+ */
+int dynamorio_set_binary_state(void * instrumentation_state, char * state, size_t length)
+{
+	dynamorio_state_t * dynamorio_state = (dynamorio_state_t *)instrumentation_state;
+	target_module_t * target_module;
+	binary_state_t * binary_state;
+	int64_t last_process_status;
+	int error;
+
+	binary_state = binary_state_open(state, length);
+	if (!binary_state)
+		return 1;
+
+	error = strcmp(binary_state_instrumentation(binary_state), "dynamorio")
+		|| binary_state_get_int(binary_state, "last_process_status", &last_process_status);
+	if (!error)
+	{
+		//If a child process is running when the state is being set
+		destroy_target_process(dynamorio_state, 0);//kill it so we don't orphan it
+
+		dynamorio_state->last_process_status = (int)last_process_status;
+		dynamorio_state->analyzed_last_round = 1;
+
+		if (!dynamorio_state->per_module_coverage)
+			error = get_binary_coverage(binary_state, NULL, dynamorio_state->virgin_bits,
+				&dynamorio_state->last_shm_hash, &dynamorio_state->last_path_was_new);
+		else
+		{
+			FOREACH_MODULE(target_module, dynamorio_state)
+			{
+				error = error || get_binary_coverage(binary_state, dynamorio_state->module_names[target_module->index],
+					target_module->virgin_bits, &target_module->last_shm_hash, &target_module->last_path_was_new);
+			}
+		}
+	}
+
+	binary_state_close(binary_state);
+	return error;
+}
+
 /**
  * This function enables the instrumentation and runs the fuzzed process.  If the process needs to be restarted, it will be.
  * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
  * @process - a pointer to return a handle to the process that instrumentation was enabled on
  * @cmd_line - the command line of the fuzzed process to enable instrumentation on
- * @input - a buffer to the input that should be sent to the fuzzed process on stdin
+ * @input - a buffer to the input that should be sent to the fuzzed process on stdin, or written to the shared
+ * memory input region when the shm_input option is set
  * @input_length - the length of the input parameter
  * returns 0 on success, -1 on failure
  */
 int dynamorio_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length)
 {
 	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
-	DWORD num_written;
 	target_module_t * target_module;
+	int pooled;
 
 	if (!state->fuzzer_id)
 	{
 		setup_shm_and_pick_fuzzer_id(state, 1);
+		setup_control_block(state);
+		if (state->shm_input)
+			setup_input_region(state);
 		state->pipe_name = (char *)alloc_printf("\\\\.\\pipe\\afl_pipe_%s", state->fuzzer_id);
 		state->pidfile = alloc_printf("childpid_%s.txt", state->fuzzer_id);
+		if (state->process_pool) {
+			state->pool = (pooled_process_t *)calloc(state->process_pool, sizeof(pooled_process_t));
+			if (!state->pool)
+				FATAL_MSG("Couldn't allocate the process pool");
+		}
 	}
 
+	//The pooled processes were started before the input was known, so they can't get it on stdin
+	pooled = state->pool && !input_length;
 	if (!state->child_handle   //if we haven't started the child yet
 		|| get_process_status(state->child_handle) == 0 //or the child died
-		|| input_length != 0) //or the fuzzer wants to send input on stdin (which doesn't work with persistence mode)
+		|| (input_length != 0 && !state->shm_input)) //or the fuzzer wants to send input on stdin (which doesn't work with persistence mode)
 	{
 		if (state->child_handle)
 			destroy_target_process(state, 0);
-		create_target_process(state, cmd_line, input, input_length);
+		if (!pooled || !take_pooled_process(state, cmd_line))
+			create_target_process(state, cmd_line, state->shm_input ? NULL : input, state->shm_input ? 0 : input_length);
 	}
 	else //the child is alive and we haven't cleaned up from last round
 		finish_fuzz_round(state);
 
+	//The client reads the input after it gets the 'F' command, so it must be written before then
+	if (state->shm_input)
+		write_shm_input(state, input, input_length);
+
 	*process = state->child_handle;
 
 	//Blank the map state
-	if (state->per_module_coverage)
+	if (state->per_module_coverage && !state->edges)
+	{
+		//Only the maps the client wrote to need to be cleared
+		FOREACH_MODULE(target_module, state)
+		{
+			if (*winafl_arena_dirty(target_module->trace_bits)) {
+				memset(target_module->trace_bits, 0, MAP_SIZE);
+				*winafl_arena_dirty(target_module->trace_bits) = 0;
+			}
+		}
+	}
+	else if (state->per_module_coverage)
 	{
+		//Only the edge count needs to be reset, as the edges after it are never read
 		FOREACH_MODULE(target_module, state)
-			memset(state->edges ? (void *)target_module->edges_memory : target_module->trace_bits, 0, state->edges ? EDGES_SHM_SIZE : MAP_SIZE);
+			target_module->edges_memory->num_edges = 0;
 	}
+	else if (state->edges)
+		state->edges_memory->num_edges = 0;
 	else
-		memset(state->edges ? (void *)state->edges_memory : state->trace_bits, 0, state->edges ? EDGES_SHM_SIZE : MAP_SIZE);
+		memset(state->trace_bits, 0, MAP_SIZE);
 
 	//Tell the child instrumentation to go
-	WriteFile(state->pipe_handle, "F", 1, &num_written, NULL);
+	winafl_control_post(&state->control->command, 'F', state->command_event);
 	state->analyzed_last_round = 0;
 	state->enable_called = 1;
 
+	//Start the processes for the next inputs while this one runs
+	if (pooled)
+		refill_process_pool(state, cmd_line);
+
 	return 0;
 }
 
@@ -1430,11 +1898,7 @@ static int has_new_coverage(u8 * trace_bits, u8 * virgin_bits, u8 * ignore_bytes
 	u8 hnb;
 	u32 hash, temp;
 
-#ifdef __x86_64__
-	classify_counts((u64*)trace_bits);
-#else
-	classify_counts((u32*)trace_bits);
-#endif // ^__x86_64__
+	bitmap_classify_counts(trace_bits, MAP_SIZE);
 
 	//A quick check of the last hash we saw to see if this output took the same path
 	//Used to speed up the memory compare
@@ -1460,9 +1924,13 @@ static int has_new_coverage(u8 * trace_bits, u8 * virgin_bits, u8 * ignore_bytes
 	//We had a new path (or hash collision), record it to the virgin bits
 	*last_shm_hash = hash;
 	if (ignore_bytes)
+#ifdef DEBUG_TRACE_BITS
 		hnb = has_new_bits_with_ignore(trace_bits, virgin_bits, ignore_bytes);
+#else
+		hnb = bitmap_has_new_bits_with_ignore(virgin_bits, trace_bits, ignore_bytes, MAP_SIZE);
+#endif
 	else
-		hnb = has_new_bits(trace_bits, virgin_bits);
+		hnb = bitmap_has_new_bits(virgin_bits, trace_bits, MAP_SIZE);
 	DEBUG_MSG("has_new_bits = %hhu", hnb);
 	return hnb != 0;
 }
@@ -1482,6 +1950,12 @@ static int has_new_coverage_per_module(dynamorio_state_t * state)
 
 	FOREACH_MODULE(target_module, state)
 	{
+		//Modules that weren't hit have an empty map, which can't have any new bits
+		if (!*winafl_arena_dirty(target_module->trace_bits)) {
+			target_module->last_path_was_new = 0;
+			continue;
+		}
+
 		last_hash = target_module->last_shm_hash;
 		isnew = has_new_coverage(target_module->trace_bits, target_module->virgin_bits, target_module->ignore_bytes, &target_module->last_shm_hash, state->dump_map_dir);
 		ret |= isnew;
@@ -1637,6 +2111,25 @@ int dynamorio_help(char ** help_str)
 "                          record coverage information\n"
 "  per_module_coverage   Whether coverage should be tracked in one bitmap (0),\n"
 "                          or in a separate bitmap for each module (1)\n"
+"  persist_cache_dir     A directory to store DynamoRIO's persisted code\n"
+"                          caches in, so later runs of the target don't need\n"
+"                          to translate its modules again.  Requires\n"
+"                          target_path\n"
+"  shm_input             Whether the inputs should be written to a shared\n"
+"                          memory region that the winafl.dll tool passes to\n"
+"                          the target function (1), rather than sent on\n"
+"                          stdin (0).  Use the -input_buffer_arg and\n"
+"                          -input_length_arg client_params to pick the\n"
+"                          target function's arguments\n"
+"  shm_input_max_length  The longest input the shared memory input region\n"
+"                          holds.  Longer inputs are truncated\n"
+"  process_pool          The number of target processes to start in\n"
+"                          DynamoRIO ahead of time, so that each input runs\n"
+"                          in a process that has already started up, while\n"
+"                          the next one starts (0 to start each process when\n"
+"                          its input is ready).  Only for targets that read\n"
+"                          their input from a file, and aren't fuzzed in\n"
+"                          persistence mode\n"
 "\n"
 	);
 	if (*help_str == NULL)
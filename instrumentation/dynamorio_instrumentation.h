@@ -4,6 +4,9 @@
 
 #include "winafl_types.h"
 #include "winafl_config.h"
+#include "winafl_control.h"
+#include "winafl_arena.h"
+#include "winafl_input.h"
 
 void * dynamorio_create(char * options, char * state);
 void dynamorio_cleanup(void * instrumentation_state);
@@ -11,23 +14,32 @@ void * dynamorio_merge(void * instrumentation_state, void * other_instrumentatio
 char * dynamorio_get_state(void * instrumentation_state);
 void dynamorio_free_state(char * state);
 int dynamorio_set_state(void * instrumentation_state, char * state);
+char * dynamorio_get_binary_state(void * instrumentation_state, size_t * length);
+int dynamorio_set_binary_state(void * instrumentation_state, char * state, size_t length);
 int dynamorio_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length);
 int dynamorio_is_new_path(void * instrumentation_state);
 int dynamorio_get_module_info(void * instrumentation_state, int index, int * is_new, char ** module_name, char ** info, int * size);
 instrumentation_edges_t * dynamorio_get_edges(void * instrumentation_state, int index);
 int dynamorio_is_process_done(void * instrumentation_state);
+int dynamorio_wait_for_process_done(void * instrumentation_state, int timeout_ms);
 int dynamorio_get_fuzz_result(void * instrumentation_state);
 int dynamorio_help(char ** help_str);
 
 void dynamorio_print_state(void * instrumentation_state);
 
+//dr_nudge_pid from DynamoRIO's drconfiglib.dll, which nudges a process without starting drconfig.exe
+typedef int (*dr_nudge_pid_t)(DWORD process_id, unsigned int client_id, unsigned __int64 arg, unsigned int timeout_ms);
+#define DR_CONFIG_SUCCESS 0
+
+#define DYNAMORIO_MAX_PROCESS_POOL 16 //The most target processes that the process_pool option starts ahead of time
+
 #define FOREACH_MODULE(x, state)  for(x = state->modules; x; x = x->next)
 
 struct target_module
 {
 	int index;
-	HANDLE shm_handle;              /* Handle of the SHM region         */
-	u8 * trace_bits;                /* SHM with instrumentation bitmap  */
+	HANDLE shm_handle;              /* Handle of the SHM region (edges only) */
+	u8 * trace_bits;                /* The module's bitmap in the coverage arena */
 	u8  virgin_bits[MAP_SIZE];      /* Regions yet untouched by fuzzing */
 	u32 last_shm_hash;              /* The most recent hash of the SHM region */
 	int last_path_was_new;
@@ -39,6 +51,25 @@ struct target_module
 };
 typedef struct target_module target_module_t;
 
+//A target process that was started in DynamoRIO ahead of time, so that the next input doesn't have to wait for
+//DynamoRIO and the winafl client to start up.  The client connects to the process's own pipe and control block,
+//named after its control id, and waits in the target's first thread for the 'F' command.  It shares the coverage
+//map with the other processes, which is only written to after the 'F' command.
+struct pooled_process
+{
+	char * control_id;               /* Names the process's pipe, control block, and pidfile */
+	char * pipe_name;
+	char * pidfile;
+	char * cmd_line;                 /* The command line the process was started with, or NULL if the slot is empty */
+	HANDLE child_handle;             /* Handle to drrun.exe */
+	HANDLE pipe_handle;
+	HANDLE control_handle;
+	winafl_control_t * control;
+	HANDLE command_event;
+	HANDLE result_event;
+};
+typedef struct pooled_process pooled_process_t;
+
 
 struct dynamorio_state
 {
@@ -56,11 +87,26 @@ struct dynamorio_state
 	char * client_params;
 	int timeout;
 	int edges;
+	char * persist_cache_dir;
+	char * persist_dir;              /* The persisted code cache directory for this target and its modules */
+	int shm_input;                   /* Whether inputs are sent to the client in shared memory */
+	int shm_input_max_length;        /* The longest input the shared memory input region holds */
+	int process_pool;                /* The number of target processes to start ahead of time */
 
 	HANDLE child_handle;             /* Handle to the child process      */
 	s32 child_pid;                   /* PID of the fuzzed program        */
 	HANDLE pipe_handle;              /* Handle of the comms named pipe   */
 	HANDLE shm_handle;               /* Handle of the SHM region         */
+	winafl_arena_t * arena;          /* SHM with each module's bitmap, when per_module_coverage is set */
+	HANDLE control_handle;           /* Handle of the control block SHM region */
+	winafl_control_t * control;      /* Starts iterations and reports their results */
+	HANDLE command_event;            /* Set after writing control->command */
+	HANDLE result_event;             /* Set by the client after writing control->result */
+	HANDLE input_handle;             /* Handle of the shared memory input region */
+	winafl_input_t * input;          /* SHM the inputs are written to, when shm_input is set */
+	HMODULE drconfig_lib;            /* DynamoRIO's drconfiglib.dll      */
+	dr_nudge_pid_t dr_nudge_pid;     /* Nudges the fuzzed program, or NULL if drconfig.exe must be used */
+	int drconfig_lib_loaded;         /* Whether we've tried to load drconfiglib.dll */
 
 	char ** module_names;
 	size_t num_modules;
@@ -68,6 +114,8 @@ struct dynamorio_state
 
 	char * pidfile;                 /* pid file name */
 	char * pipe_name;               /* name of the pipe to communicate with Dynamorio */
+	char * control_id;              /* The control id of the current process, or NULL if it's the fuzzer id */
+	pooled_process_t * pool;        /* The process_pool processes started ahead of time */
 	int fuzz_iterations_current;
 
 	u8  virgin_bits[MAP_SIZE];      /* Regions yet untouched by fuzzing */
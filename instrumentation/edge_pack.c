@@ -0,0 +1,309 @@
+#include "edge_pack.h"
+
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function encodes a value as a LEB128 varint: seven bits per byte, lowest first, with the top bit set on
+ * every byte but the last.
+ * @param buffer - the buffer to write the varint to, which must have room for EDGE_PACK_MAX_VARINT bytes
+ * @param value - the value to encode
+ * @return - the number of bytes written
+ */
+static size_t write_varint(uint8_t * buffer, uint64_t value)
+{
+	size_t length = 0;
+
+	while (value >= 0x80) {
+		buffer[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (uint8_t)value;
+	return length;
+}
+
+/**
+ * This function zigzag encodes a signed value, so that small negative values also get short varints.
+ */
+static uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int compare_packed_edges(const void * a, const void * b)
+{
+	const packed_edge_t * edge_a = (const packed_edge_t *)a, * edge_b = (const packed_edge_t *)b;
+
+	if (edge_a->module != edge_b->module)
+		return edge_a->module < edge_b->module ? -1 : 1;
+	if (edge_a->from != edge_b->from)
+		return edge_a->from < edge_b->from ? -1 : 1;
+	if (edge_a->to != edge_b->to)
+		return edge_a->to < edge_b->to ? -1 : 1;
+	return 0;
+}
+
+/**
+ * This function creates a compact edge file, and writes its header.
+ * @param filename - the file to write the edges to
+ * @param module_names - the name of each module, by module id.  A NULL name is written as an empty one.
+ * @param num_modules - the number of entries in the module_names parameter
+ * @return - the new edge file writer on success, or NULL on failure
+ */
+edge_pack_writer_t * edge_pack_writer_create(const char * filename, char ** module_names, uint32_t num_modules)
+{
+	edge_pack_writer_t * writer;
+	uint8_t varint[EDGE_PACK_MAX_VARINT];
+	size_t name_length;
+	uint32_t i;
+
+	writer = (edge_pack_writer_t *)calloc(1, sizeof(edge_pack_writer_t));
+	if (!writer)
+		return NULL;
+	writer->fp = fopen(filename, "wb");
+	if (!writer->fp) {
+		free(writer);
+		return NULL;
+	}
+
+	fwrite(EDGE_PACK_MAGIC, EDGE_PACK_MAGIC_LENGTH, 1, writer->fp);
+	fwrite(varint, write_varint(varint, EDGE_PACK_VERSION), 1, writer->fp);
+	fwrite(varint, write_varint(varint, num_modules), 1, writer->fp);
+	for (i = 0; i < num_modules; i++)
+	{
+		name_length = module_names[i] ? strlen(module_names[i]) : 0;
+		fwrite(varint, write_varint(varint, name_length), 1, writer->fp);
+		if (name_length)
+			fwrite(module_names[i], name_length, 1, writer->fp);
+	}
+	writer->error = ferror(writer->fp);
+	return writer;
+}
+
+/**
+ * This function writes the edges of an input to a compact edge file.
+ * @param writer - the edge file writer, created with edge_pack_writer_create
+ * @param input_id - the id of the input that had the edges
+ * @param edges - the edges to write.  They're sorted in place.
+ * @param num_edges - the number of edges in the edges parameter
+ * @return - zero on success, non-zero on failure
+ */
+int edge_pack_write_list(edge_pack_writer_t * writer, uint32_t input_id, packed_edge_t * edges, size_t num_edges)
+{
+	uint8_t buffer[4 * EDGE_PACK_MAX_VARINT];
+	uint32_t module = 0;
+	uint64_t from = 0;
+	size_t i, length;
+
+	qsort(edges, num_edges, sizeof(packed_edge_t), compare_packed_edges);
+	length = write_varint(buffer, zigzag_encode((int64_t)input_id - (int64_t)writer->last_input_id));
+	length += write_varint(buffer + length, num_edges);
+	fwrite(buffer, length, 1, writer->fp);
+	writer->last_input_id = input_id;
+
+	for (i = 0; i < num_edges; i++)
+	{
+		//The from offset is relative to the last edge's, unless the last edge was in another module
+		if (edges[i].module != module)
+			from = 0;
+		length = write_varint(buffer, edges[i].module - module);
+		length += write_varint(buffer + length, edges[i].from - from);
+		length += write_varint(buffer + length, zigzag_encode((int64_t)(edges[i].to - edges[i].from)));
+		length += write_varint(buffer + length, edges[i].count);
+		fwrite(buffer, length, 1, writer->fp);
+		module = edges[i].module;
+		from = edges[i].from;
+	}
+
+	if (ferror(writer->fp))
+		writer->error = 1;
+	return writer->error;
+}
+
+/**
+ * This function closes a compact edge file, and frees its writer.
+ * @param writer - the edge file writer, created with edge_pack_writer_create
+ * @return - zero on success, or non-zero if any of the file's writes failed
+ */
+int edge_pack_writer_close(edge_pack_writer_t * writer)
+{
+	int error;
+
+	if (!writer)
+		return 1;
+	error = writer->error;
+	if (fclose(writer->fp))
+		error = 1;
+	free(writer);
+	return error;
+}
+
+/**
+ * This function decodes a varint from a compact edge file.
+ * @param reader - the edge file reader
+ * @param value - used to return the decoded value
+ * @return - zero on success, or non-zero if the file ends in the varint or the varint is too long
+ */
+static int read_varint(edge_pack_reader_t * reader, uint64_t * value)
+{
+	uint64_t result = 0;
+	int shift;
+	uint8_t byte;
+
+	for (shift = 0; shift < 7 * EDGE_PACK_MAX_VARINT; shift += 7)
+	{
+		if (reader->position >= reader->length)
+			return 1;
+		byte = reader->data[reader->position++];
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * This function opens a compact edge file, and reads its header.
+ * @param filename - the file written by the edge file writer
+ * @return - the new edge file reader on success, or NULL if the file can't be read or isn't a compact edge file
+ */
+edge_pack_reader_t * edge_pack_reader_open(const char * filename)
+{
+	edge_pack_reader_t * reader;
+	uint64_t version, num_modules, name_length;
+	uint32_t i;
+
+	reader = (edge_pack_reader_t *)calloc(1, sizeof(edge_pack_reader_t));
+	if (!reader)
+		return NULL;
+	reader->data = (const uint8_t *)map_file(filename, &reader->length);
+	if (!reader->data || reader->length < EDGE_PACK_MAGIC_LENGTH
+		|| memcmp(reader->data, EDGE_PACK_MAGIC, EDGE_PACK_MAGIC_LENGTH)) {
+		edge_pack_reader_close(reader);
+		return NULL;
+	}
+	reader->position = EDGE_PACK_MAGIC_LENGTH;
+	if (read_varint(reader, &version) || version != EDGE_PACK_VERSION || read_varint(reader, &num_modules)
+		|| num_modules > reader->length - reader->position) {
+		edge_pack_reader_close(reader);
+		return NULL;
+	}
+
+	reader->module_names = (char **)calloc(num_modules ? (size_t)num_modules : 1, sizeof(char *));
+	if (!reader->module_names) {
+		edge_pack_reader_close(reader);
+		return NULL;
+	}
+	reader->num_modules = (uint32_t)num_modules;
+	for (i = 0; i < reader->num_modules; i++)
+	{
+		if (read_varint(reader, &name_length) || name_length > reader->length - reader->position) {
+			edge_pack_reader_close(reader);
+			return NULL;
+		}
+		reader->module_names[i] = (char *)malloc((size_t)name_length + 1);
+		if (!reader->module_names[i]) {
+			edge_pack_reader_close(reader);
+			return NULL;
+		}
+		memcpy(reader->module_names[i], reader->data + reader->position, (size_t)name_length);
+		reader->module_names[i][name_length] = 0;
+		reader->position += (size_t)name_length;
+	}
+	return reader;
+}
+
+/**
+ * This function moves on to the next input's list of edges in a compact edge file.  Any edges left in the
+ * current list are skipped.
+ * @param reader - the edge file reader, opened with edge_pack_reader_open
+ * @param input_id - used to return the id of the list's input
+ * @param num_edges - used to return the number of edges in the list
+ * @return - 1 if a list was read, 0 at the end of the file, or -1 if the file is corrupt
+ */
+int edge_pack_read_list(edge_pack_reader_t * reader, uint32_t * input_id, uint64_t * num_edges)
+{
+	packed_edge_t edge;
+	uint64_t delta;
+	int ret;
+
+	while (reader->edges_left)
+	{
+		ret = edge_pack_read_edge(reader, &edge);
+		if (ret <= 0)
+			return -1;
+	}
+	if (reader->position == reader->length)
+		return 0;
+	if (read_varint(reader, &delta) || read_varint(reader, num_edges))
+		return -1;
+
+	reader->last_input_id = (uint32_t)((int64_t)reader->last_input_id + zigzag_decode(delta));
+	reader->edges_left = *num_edges;
+	memset(&reader->last, 0, sizeof(reader->last));
+	*input_id = reader->last_input_id;
+	return 1;
+}
+
+/**
+ * This function reads the next edge of the current list in a compact edge file.
+ * @param reader - the edge file reader, on a list read with edge_pack_read_list
+ * @param edge - used to return the edge
+ * @return - 1 if an edge was read, 0 at the end of the list, or -1 if the file is corrupt
+ */
+int edge_pack_read_edge(edge_pack_reader_t * reader, packed_edge_t * edge)
+{
+	uint64_t module_delta, from, to_delta, count;
+
+	if (!reader->edges_left)
+		return 0;
+	if (read_varint(reader, &module_delta) || read_varint(reader, &from) || read_varint(reader, &to_delta)
+		|| read_varint(reader, &count))
+		return -1;
+
+	edge->module = reader->last.module + (uint32_t)module_delta;
+	edge->from = module_delta ? from : reader->last.from + from;
+	edge->to = edge->from + (uint64_t)zigzag_decode(to_delta);
+	edge->count = (uint32_t)count;
+	reader->last = *edge;
+	reader->edges_left--;
+	return 1;
+}
+
+/**
+ * This function gets the name of a module in a compact edge file.
+ * @param reader - the edge file reader, opened with edge_pack_reader_open
+ * @param module - the module id of an edge
+ * @return - the module's name, which is empty if it has none, or NULL if the file doesn't have the module
+ */
+const char * edge_pack_module_name(edge_pack_reader_t * reader, uint32_t module)
+{
+	return module < reader->num_modules ? reader->module_names[module] : NULL;
+}
+
+/**
+ * This function closes a compact edge file, and frees its reader.
+ * @param reader - the edge file reader to close
+ */
+void edge_pack_reader_close(edge_pack_reader_t * reader)
+{
+	uint32_t i;
+
+	if (!reader)
+		return;
+	if (reader->data)
+		unmap_file((const char *)reader->data, reader->length);
+	for (i = 0; reader->module_names && i < reader->num_modules; i++)
+		free(reader->module_names[i]);
+	free(reader->module_names);
+	free(reader);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//The compact edge files that the tracer writes with -c, and the reader for them.  Each edge is a module id (the
+//index the instrumentation's get_edges was called with) and the edge's from and to offsets in the module, rather
+//than instrumentation_edge_t's pair of 64-bit addresses.  The edges are sorted, and each one is stored as the
+//change from the edge before it, in LEB128 varints, so most edges take a handful of bytes.
+//
+//The file starts with the EDGE_PACK_MAGIC and a varint version, then the number of modules and each module's name,
+//as a varint length and the name's bytes (empty if the module has no name).  Then there is a list of edges for each
+//traced input, until the end of the file.  A list is the zigzag encoded change of its input id from the last list's
+//(starting from 0) and the number of edges, and each edge in the list is:
+//  - The change in the module id from the edge before it
+//  - The from offset, or its change from the edge before it if the module is the same
+//  - The zigzag encoded difference between the to and from offsets
+//  - The number of runs that had the edge
+//The offsets are module relative, so they normally fit in 32 bits, but any 64-bit value can be stored.
+
+#define EDGE_PACK_MAGIC     "KBEDGES\n"
+#define EDGE_PACK_MAGIC_LENGTH 8
+#define EDGE_PACK_VERSION   1
+
+//The most bytes that a varint of a 64-bit value takes
+#define EDGE_PACK_MAX_VARINT 10
+
+struct packed_edge
+{
+	uint32_t module;
+	uint64_t from;
+	uint64_t to;
+	uint32_t count; //The number of runs that had the edge
+};
+typedef struct packed_edge packed_edge_t;
+
+struct edge_pack_writer
+{
+	FILE * fp;
+	uint32_t last_input_id;
+	int error; //Whether any of the writes have failed
+};
+typedef struct edge_pack_writer edge_pack_writer_t;
+
+struct edge_pack_reader
+{
+	const uint8_t * data; //The mapped file
+	size_t length;
+	size_t position;
+	uint32_t num_modules;
+	char ** module_names;
+
+	uint32_t last_input_id;
+	uint64_t edges_left;  //The number of edges that haven't been read from the current list
+	packed_edge_t last;   //The last edge read from the current list
+};
+typedef struct edge_pack_reader edge_pack_reader_t;
+
+edge_pack_writer_t * edge_pack_writer_create(const char * filename, char ** module_names, uint32_t num_modules);
+int edge_pack_write_list(edge_pack_writer_t * writer, uint32_t input_id, packed_edge_t * edges, size_t num_edges);
+int edge_pack_writer_close(edge_pack_writer_t * writer);
+
+edge_pack_reader_t * edge_pack_reader_open(const char * filename);
+int edge_pack_read_list(edge_pack_reader_t * reader, uint32_t * input_id, uint64_t * num_edges);
+int edge_pack_read_edge(edge_pack_reader_t * reader, packed_edge_t * edge);
+const char * edge_pack_module_name(edge_pack_reader_t * reader, uint32_t module);
+void edge_pack_reader_close(edge_pack_reader_t * reader);
@@ -1,14 +1,39 @@
 #define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "forkserver.h"
 #include "forkserver_internal.h"
 
 static void forkserver_persistence_init(void);
+static int forkserver_concurrent_init(int num_channels);
+static int forkserver_prefix_init(void);
+static void attach_input_shm(void);
+
+static int max_cnt = 0;
+
+//The number of iterations the persistence mode child runs before exiting.  In
+//adaptive mode, this is shared with the fork server, which sets it when it
+//decides to restart the child.
+static volatile int * child_max_cnt = &max_cnt;
+
+//The shared memory region the fuzzer writes inputs to, if it's using one
+static forkserver_shm_input_t * input_shm = NULL;
 
 //////////////////////////////////////////////////////////////
 //Fork Server ////////////////////////////////////////////////
@@ -18,12 +43,64 @@ static void forkserver_persistence_init(void);
 //has been modified significantly to suit our purposes.  The LLVM mode of
 //AFL is available at:
 //https://github.com/mirrorer/afl/blob/master/llvm_mode/afl-llvm-rt.o.c#L95
+//
+//To keep fork() off the critical path, the fork server forks the next child
+//as soon as it has reported the previous child's status.  The new child waits
+//on target_pipe until it is needed, so a FORK or FORK_RUN command only has to
+//hand out its pid (and for FORK_RUN, tell it to go).  Children haven't run any
+//of the target's code yet while waiting, so they see whatever input the
+//fuzzer writes before releasing them.
+
+/**
+ * This function forks a child process that waits for the fork server to tell it to run
+ * @param target_pipe - the pipe the fork server uses to tell the child to run
+ * @return - the child's pid in the fork server, or 0 in the child once it has been told to run
+ */
+/**
+ * This function waits for a child to exit, like waitpid, and records the child's peak RSS for GET_MAX_RSS
+ * @param pid - the child to wait for
+ * @param status - used to return the child's exit status
+ * @param max_rss_kb - used to return the child's peak RSS in kilobytes, or 0 if it isn't known
+ * @return - the pid of the child on success, or -1 on failure
+ */
+static int reap_child(int pid, int * status, int * max_rss_kb)
+{
+  struct rusage usage;
+  int ret;
+
+  ret = wait4(pid, status, 0, &usage);
+  *max_rss_kb = ret > 0 && usage.ru_maxrss > 0 && usage.ru_maxrss <= INT_MAX ? (int)usage.ru_maxrss : 0;
+  return ret;
+}
+
+static int fork_waiting_child(int * target_pipe)
+{
+  int response, child_pid;
+
+  forkserver_breakpoints_update();
+  child_pid = fork();
+  if(child_pid < 0)
+    _exit(1);
+
+  //In child process: close fds, and wait for the fork server to tell us to go
+  if(!child_pid) {
+    close(FUZZER_TO_FORKSRV);
+    close(FORKSRV_TO_FUZZER);
+    close(target_pipe[1]);
+    if(read(target_pipe[0], &response, sizeof(int)) != sizeof(int))
+      _exit(1);
+    close(target_pipe[0]);
+  }
+  return child_pid;
+}
 
 void __forkserver_init(void)
 {
-  int response = 0x41414141;
+  //The fork server library doesn't own a coverage map, so its hello leaves the
+  //map size up to the fuzzer
+  int response = FORKSERVER_HELLO_LIBRARY;
   char command;
-  int child_pid = -1;
+  int child_pid = -1, warm_pid, max_rss_kb = 0;
   int target_pipe[2];
 
   // Phone home and tell the parent that we're OK. If parent isn't there,
@@ -31,14 +108,32 @@ void __forkserver_init(void)
   if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
     return;
 
+  //Attach the input channel now, so every forked child inherits it
+  attach_input_shm();
+  forkserver_breakpoints_init();
+
   if(getenv(PERSIST_MAX_VAR)) {
     forkserver_persistence_init();
+    if(getenv(SNAPSHOT_ENV_VAR))
+      forkserver_snapshot_init(child_max_cnt);
+    return;
+  }
+  if(getenv(CONCURRENT_ENV_VAR)) {
+    forkserver_concurrent_init(atoi(getenv(CONCURRENT_ENV_VAR)));
+    return;
+  }
+  if(getenv(DESOCKET_PREFIX_ENV_VAR) && getenv(DESOCKET_ENV_VAR)) {
+    forkserver_prefix_init();
     return;
   }
 
   if(pipe(target_pipe))
     _exit(1);
 
+  warm_pid = fork_waiting_child(target_pipe);
+  if(!warm_pid)
+    return;
+
   while (1) {
 
     // Wait for parent by reading from the pipe. Exit if read fails.
@@ -48,28 +143,30 @@ void __forkserver_init(void)
     switch(command) {
 
       case EXIT:
+        if(warm_pid != -1)
+          kill(warm_pid, SIGKILL);
         _exit(0);
         break;
 
       case FORK:
       case FORK_RUN:
 
-        child_pid = fork();
-        if(child_pid < 0)
-          _exit(1);
-
-        //In child process: close fds, resume execution.
-        if(!child_pid) {
-          close(FUZZER_TO_FORKSRV);
-          close(FORKSRV_TO_FUZZER);
-          close(target_pipe[1]);
+        //Use the child that was forked ahead of time, unless it died while waiting
+        if(warm_pid != -1 && waitpid(warm_pid, &response, WNOHANG) != 0)
+          warm_pid = -1;
+        if(warm_pid == -1) {
+          warm_pid = fork_waiting_child(target_pipe);
+          if(!warm_pid)
+            return;
+        }
+        child_pid = warm_pid;
+        warm_pid = -1;
 
-          //If we're just forking, wait for the forkserver to tell us to go
-          if(command == FORK && read(target_pipe[0], &response, sizeof(int)) != sizeof(int))
+        //If we're forking and running, tell the child to go now
+        if(command == FORK_RUN) {
+          response = 0;
+          if(write(target_pipe[1], &response, sizeof(int)) != sizeof(int))
             _exit(1);
-
-          close(target_pipe[0]);
-          return;
         }
         response = child_pid;
 
@@ -88,9 +185,643 @@ void __forkserver_init(void)
         break;
 
       case GET_STATUS:
-        if(waitpid(child_pid, &response, 0) < 0)
+        if(reap_child(child_pid, &response, &max_rss_kb) < 0)
           _exit(1);
         break;
+
+      case GET_MAX_RSS:
+        response = max_rss_kb;
+        break;
+    }
+
+    if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
+      _exit(1);
+
+    //Now that the fuzzer has the status, fork the next child while it processes the results
+    if(command == GET_STATUS && warm_pid == -1) {
+      warm_pid = fork_waiting_child(target_pipe);
+      if(!warm_pid)
+        return;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////
+//Concurrent Mode ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//In concurrent mode, the fork server serves each channel the same way the
+//normal fork server serves its only one, except that it doesn't wait on a
+//channel's child in GET_STATUS.  Instead it polls all of the channels'
+//command pipes, along with a pipe that the SIGCHLD handler writes to, and
+//answers a GET_STATUS once the channel's child has been reaped.  This way the
+//target's initialization is only done once, but every channel can have a
+//child running on its own core.
+
+struct concurrent_channel {
+  int command_fd;     //The channel's command pipe, or -1 once the channel is closed
+  int status_fd;
+  int stdin_fd;       //The file the channel's children read as stdin, or -1 to use the fork server's
+  int target_pipe[2]; //The pipe the fork server uses to tell the channel's child to run
+  int child_pid;      //The channel's current child, or -1 if it doesn't have one
+  int child_status;   //The child's exit status, once it has been reaped
+  int max_rss_kb;     //The peak RSS of the channel's last child that was reaped, for GET_MAX_RSS
+  int reaped;         //Whether the child has been reaped
+  int wants_status;   //Whether the fuzzer is waiting for the child's exit status
+};
+
+static struct concurrent_channel channels[MAX_CONCURRENT_CHANNELS];
+static int num_channels = 0;
+static int sigchld_pipe[2];
+
+/**
+ * This function tells the concurrent fork server's main loop that a child has exited
+ * @param sig - the signal that was received (SIGCHLD)
+ */
+static void concurrent_sigchld_handler(int sig)
+{
+  int saved_errno = errno;
+  char byte = 0;
+  if(write(sigchld_pipe[1], &byte, 1) < 0) {
+    //The pipe is already full, so the main loop will reap the children anyway
+  }
+  errno = saved_errno;
+}
+
+/**
+ * This function closes the fork server's fds in a newly forked child, and waits for the fork server to tell it to run
+ * @param channel - the channel the child was forked for
+ */
+static void concurrent_child_start(struct concurrent_channel * channel)
+{
+  int i, response;
+
+  signal(SIGCHLD, SIG_DFL);
+  close(sigchld_pipe[0]);
+  close(sigchld_pipe[1]);
+  if(channel->stdin_fd != -1)
+    dup2(channel->stdin_fd, 0);
+  for(i = 0; i < num_channels; i++) {
+    if(channels[i].command_fd != -1) {
+      close(channels[i].command_fd);
+      close(channels[i].status_fd);
+    }
+    if(channels[i].stdin_fd != -1)
+      close(channels[i].stdin_fd);
+    if(&channels[i] != channel) {
+      close(channels[i].target_pipe[0]);
+      close(channels[i].target_pipe[1]);
+    }
+  }
+  close(channel->target_pipe[1]);
+  if(read(channel->target_pipe[0], &response, sizeof(int)) != sizeof(int))
+    _exit(1);
+  close(channel->target_pipe[0]);
+}
+
+/**
+ * This function reaps the children that have exited, and sends their exit statuses to the channels that are waiting
+ * for them
+ */
+static void concurrent_reap_children(void)
+{
+  struct rusage usage;
+  int i, pid, status;
+
+  while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+    for(i = 0; i < num_channels; i++) {
+      if(channels[i].child_pid != pid)
+        continue;
+      channels[i].child_status = status;
+      channels[i].max_rss_kb = usage.ru_maxrss > 0 && usage.ru_maxrss <= INT_MAX ? (int)usage.ru_maxrss : 0;
+      channels[i].reaped = 1;
+      if(channels[i].wants_status) {
+        channels[i].wants_status = 0;
+        channels[i].child_pid = -1;
+        if(write(channels[i].status_fd, &status, sizeof(status)) != sizeof(status))
+          _exit(1);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * This function closes a channel, and kills its child if it has one
+ * @param channel - the channel to close
+ */
+static void concurrent_close_channel(struct concurrent_channel * channel)
+{
+  if(channel->child_pid != -1 && !channel->reaped)
+    kill(channel->child_pid, SIGKILL);
+  channel->child_pid = -1;
+  close(channel->command_fd);
+  close(channel->status_fd);
+  channel->command_fd = -1;
+}
+
+/**
+ * This function handles a command from one of the channels
+ * @param channel - the channel to read the command from
+ * @return - 0 in the fork server, or 1 in a child that has been told to run
+ */
+static int concurrent_handle_command(struct concurrent_channel * channel)
+{
+  char command;
+  int response, child_pid;
+
+  if(read(channel->command_fd, &command, sizeof(command)) != sizeof(command)) {
+    concurrent_close_channel(channel); //The fuzzer closed the channel
+    return 0;
+  }
+
+  switch(command) {
+
+    case EXIT:
+      concurrent_close_channel(channel);
+      return 0;
+
+    case FORK:
+    case FORK_RUN:
+      forkserver_breakpoints_update();
+      child_pid = fork();
+      if(child_pid < 0)
+        _exit(1);
+      if(!child_pid) {
+        concurrent_child_start(channel);
+        return 1;
+      }
+      channel->child_pid = child_pid;
+      channel->reaped = 0;
+      channel->wants_status = 0;
+
+      //If we're forking and running, tell the child to go now
+      if(command == FORK_RUN) {
+        response = 0;
+        if(write(channel->target_pipe[1], &response, sizeof(int)) != sizeof(int))
+          _exit(1);
+      }
+      response = child_pid;
+      break;
+
+    case RUN:
+      if(channel->child_pid == -1) {
+        response = FORKSERVER_ERROR;
+        break;
+      }
+      response = 0;
+      if(write(channel->target_pipe[1], &response, sizeof(int)) != sizeof(int))
+        _exit(1);
+      break;
+
+    case GET_STATUS:
+      if(channel->child_pid == -1) {
+        response = FORKSERVER_ERROR;
+        break;
+      }
+      if(!channel->reaped) {
+        channel->wants_status = 1; //Answered once the child is reaped
+        return 0;
+      }
+      channel->child_pid = -1;
+      response = channel->child_status;
+      break;
+
+    case GET_MAX_RSS:
+      response = channel->max_rss_kb;
+      break;
+
+    default:
+      response = FORKSERVER_ERROR;
+      break;
+  }
+
+  if(write(channel->status_fd, &response, sizeof(int)) != sizeof(int))
+    _exit(1);
+  return 0;
+}
+
+/**
+ * This function runs the concurrent mode fork server.  It only returns in the children, and the fork server exits
+ * once all of the channels have been closed.
+ * @param requested_channels - the number of channels the fuzzer set up
+ * @return - 0 in a child that has been told to run
+ */
+static int forkserver_concurrent_init(int requested_channels)
+{
+  struct pollfd fds[MAX_CONCURRENT_CHANNELS + 1];
+  struct concurrent_channel * polled[MAX_CONCURRENT_CHANNELS + 1];
+  struct sigaction action;
+  int i, num_fds, open_channels;
+  char buffer[64];
+
+  if(requested_channels < 1 || requested_channels > MAX_CONCURRENT_CHANNELS)
+    _exit(1);
+  num_channels = requested_channels;
+  for(i = 0; i < num_channels; i++) {
+    channels[i].command_fd = i ? FORKSRV_CHANNEL_FD(i) : FUZZER_TO_FORKSRV;
+    channels[i].status_fd = i ? FORKSRV_CHANNEL_FD(i) + 1 : FORKSRV_TO_FUZZER;
+    channels[i].stdin_fd = i && fcntl(FORKSRV_CHANNEL_FD(i) + 2, F_GETFD) != -1 ? FORKSRV_CHANNEL_FD(i) + 2 : -1;
+    channels[i].child_pid = -1;
+    if(pipe(channels[i].target_pipe))
+      _exit(1);
+  }
+
+  if(pipe(sigchld_pipe) || fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK) || fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK))
+    _exit(1);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = concurrent_sigchld_handler;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGCHLD, &action, NULL))
+    _exit(1);
+
+  open_channels = num_channels;
+  while(open_channels) {
+    fds[0].fd = sigchld_pipe[0];
+    fds[0].events = POLLIN;
+    num_fds = 1;
+    for(i = 0; i < num_channels; i++) {
+      if(channels[i].command_fd == -1)
+        continue;
+      fds[num_fds].fd = channels[i].command_fd;
+      fds[num_fds].events = POLLIN;
+      polled[num_fds] = &channels[i];
+      num_fds++;
+    }
+
+    if(poll(fds, num_fds, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      _exit(1);
+    }
+
+    if(fds[0].revents) {
+      while(read(sigchld_pipe[0], buffer, sizeof(buffer)) > 0);
+      concurrent_reap_children();
+    }
+    for(i = 1; i < num_fds; i++) {
+      if(!fds[i].revents)
+        continue;
+      if(concurrent_handle_command(polled[i]))
+        return 0;
+      if(polled[i]->command_fd == -1)
+        open_channels--;
+    }
+  }
+  _exit(0);
+}
+
+//////////////////////////////////////////////////////////////
+//Prefix Snapshots ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//Stateful network targets often spend most of each input replaying the first
+//few messages (logging in, selecting a mailbox, etc), which the mutator
+//usually leaves alone.  With DESOCKET_PREFIX_ENV_VAR set to k in desocket
+//mode, the fork server's child only delivers the first k messages of its input
+//at first.  Once the target has read them and asks for more, the child forks a
+//prefix server, which stays at that point in the target, and then carries on
+//with the rest of its input.  Later inputs that start with the same k messages
+//are run by children of the prefix server, which only have to deliver the rest
+//of the input.  The fork server is still the only process that talks to the
+//fuzzer, and it forwards the commands for those inputs to the prefix server
+//over a socket pair.  There's only one prefix server at a time, so an input
+//with a different prefix replaces it.
+//
+//Only children started with FORK_RUN can take a snapshot, since the input of a
+//child started with FORK isn't known when it's forked.  Since the prefix
+//server's children start after the prefix, the coverage of the prefix is only
+//recorded in the run that took the snapshot.
+
+#define PREFIX_FD    FORKSRV_CHANNEL_FDS_END //In a child that can take a snapshot, its end of the socket pair
+#define PREFIX_READY 0x58465250               //Sent once a child has taken a snapshot ("PRFX")
+
+struct prefix_server {
+  int fd;               //The fork server's end of the prefix server's socket pair, or -1 if there isn't one
+  char * prefix;        //The messages the prefix server's target has read
+  size_t prefix_length;
+};
+
+static int prefix_messages = 0; //The number of messages in the prefix
+static int prefix_allowed = 0;  //Whether this process can take a snapshot
+
+/**
+ * This function finds the end of the prefix of a desocket mode input
+ * @param input - the input, a series of desocket_message_t headers and their data
+ * @param length - the length of the input parameter
+ * @return - the length of the first prefix_messages messages, or 0 if the input doesn't have any messages after them
+ */
+static size_t find_prefix_length(const char * input, size_t length)
+{
+  desocket_message_t message;
+  size_t offset = 0;
+  int i;
+
+  for(i = 0; i < prefix_messages; i++) {
+    if(offset + sizeof(message) > length)
+      return 0;
+    memcpy(&message, input + offset, sizeof(message));
+    offset += sizeof(message);
+    if(message.length > length - offset)
+      return 0;
+    offset += message.length;
+  }
+  return offset < length ? offset : 0;
+}
+
+size_t forkserver_prefix_length(const char * input, size_t length)
+{
+  if(!prefix_allowed)
+    return 0;
+  return find_prefix_length(input, length);
+}
+
+int forkserver_prefix_snapshot(void)
+{
+  int response, child_pid = -1, server_pid;
+  char command;
+
+  if(!prefix_allowed)
+    return 0;
+  prefix_allowed = 0;
+
+  server_pid = fork();
+  if(server_pid) {
+    //The target carries on with the rest of this input, while the prefix server waits for the next one
+    response = PREFIX_READY;
+    if(server_pid > 0)
+      send(PREFIX_FD, &response, sizeof(int), MSG_NOSIGNAL);
+    close(PREFIX_FD);
+    return 0;
+  }
+
+  while(1) {
+    if(read(PREFIX_FD, &command, sizeof(command)) != sizeof(command))
+      command = EXIT; //The fork server replaced this prefix server, or has exited
+
+    switch(command) {
+
+      case FORK_RUN:
+        forkserver_breakpoints_update();
+        child_pid = fork();
+        if(!child_pid) {
+          close(PREFIX_FD);
+          return 1;
+        }
+        response = child_pid < 0 ? FORKSERVER_ERROR : child_pid;
+        break;
+
+      case GET_STATUS:
+        if(child_pid == -1 || waitpid(child_pid, &response, 0) < 0)
+          response = FORKSERVER_ERROR;
+        child_pid = -1;
+        break;
+
+      default:
+        if(child_pid > 0)
+          kill(child_pid, SIGKILL);
+        _exit(0);
+    }
+
+    if(send(PREFIX_FD, &response, sizeof(int), MSG_NOSIGNAL) != sizeof(int)) {
+      if(child_pid > 0)
+        kill(child_pid, SIGKILL);
+      _exit(0);
+    }
+  }
+}
+
+/**
+ * This function gets the current input in the fork server, without moving the offset of the stdin file
+ * @param length - a pointer used to return the length of the input
+ * @return - the input, or NULL if it couldn't be read.  The input should not be freed.
+ */
+static char * read_current_input(size_t * length)
+{
+  static char * buffer = NULL;
+  static size_t size = 0;
+  char * input;
+  ssize_t result;
+
+  input = __killerbeez_get_input(length);
+  if(input)
+    return input;
+
+  *length = 0;
+  while(1) {
+    if(*length == size) {
+      input = realloc(buffer, size ? size * 2 : 4096);
+      if(!input)
+        return NULL;
+      buffer = input;
+      size = size ? size * 2 : 4096;
+    }
+    result = pread(0, buffer + *length, size - *length, *length);
+    if(result < 0 && errno == EINTR)
+      continue;
+    if(result < 0)
+      return NULL;
+    if(!result)
+      return buffer;
+    *length += result;
+  }
+}
+
+/**
+ * This function stops the prefix server, which exits once its end of the socket pair is closed
+ * @param server - the prefix server to stop
+ */
+static void prefix_server_stop(struct prefix_server * server)
+{
+  if(server->fd != -1)
+    close(server->fd);
+  server->fd = -1;
+  free(server->prefix);
+  server->prefix = NULL;
+  server->prefix_length = 0;
+}
+
+/**
+ * This function sends a command to the prefix server, and stops it if it doesn't answer
+ * @param server - the prefix server to send the command to
+ * @param command - FORK_RUN or GET_STATUS
+ * @return - the prefix server's response, or FORKSERVER_ERROR on failure
+ */
+static int prefix_server_request(struct prefix_server * server, char command)
+{
+  int response;
+
+  if(send(server->fd, &command, sizeof(command), MSG_NOSIGNAL) != sizeof(command)
+      || read(server->fd, &response, sizeof(int)) != sizeof(int)) {
+    prefix_server_stop(server);
+    return FORKSERVER_ERROR;
+  }
+  return response;
+}
+
+/**
+ * This function forks a child for the prefix mode fork server
+ * @param target_pipe - the pipe the fork server uses to tell the child to run
+ * @param server - the current prefix server, whose socket pair the child shouldn't keep open
+ * @param can_snapshot - whether the child can take a snapshot
+ * @param snapshot_fd - used to return the fork server's end of the child's socket pair, if it can take a snapshot
+ * @return - the child's pid in the fork server, or 0 in the child once it has been told to run
+ */
+static int prefix_fork_child(int * target_pipe, struct prefix_server * server, int can_snapshot, int * snapshot_fd)
+{
+  int pair[2], child_pid;
+
+  *snapshot_fd = -1;
+  if(can_snapshot && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair))
+    can_snapshot = 0;
+
+  prefix_allowed = can_snapshot;
+  child_pid = fork_waiting_child(target_pipe);
+  prefix_allowed = 0;
+  if(!child_pid) {
+    if(server->fd != -1)
+      close(server->fd);
+    prefix_allowed = can_snapshot;
+    if(can_snapshot) {
+      dup2(pair[1], PREFIX_FD);
+      fcntl(PREFIX_FD, F_SETFD, FD_CLOEXEC);
+      close(pair[0]);
+      close(pair[1]);
+    }
+    return 0;
+  }
+  if(can_snapshot) {
+    close(pair[1]);
+    *snapshot_fd = pair[0];
+  }
+  return child_pid;
+}
+
+/**
+ * This function runs the prefix mode fork server.  It only returns in the children.
+ * @return - 0 in a child that has been told to run
+ */
+static int forkserver_prefix_init(void)
+{
+  struct prefix_server server = { -1, NULL, 0 };
+  struct pollfd ready;
+  char command, * input = NULL, * pending_prefix = NULL;
+  size_t input_length, prefix_length = 0;
+  int response, ready_message, child_pid = -1, from_server = 0, snapshot_fd = -1, target_pipe[2];
+  int max_rss_kb = 0;
+
+  prefix_messages = atoi(getenv(DESOCKET_PREFIX_ENV_VAR));
+  if(prefix_messages <= 0 || pipe(target_pipe))
+    _exit(1);
+
+  while(1) {
+
+    if(read(FUZZER_TO_FORKSRV, &command, sizeof(command)) != sizeof(command))
+      _exit(1);
+
+    switch(command) {
+
+      case EXIT:
+        if(child_pid != -1 && !from_server)
+          kill(child_pid, SIGKILL);
+        prefix_server_stop(&server);
+        _exit(0);
+        break;
+
+      case FORK:
+      case FORK_RUN:
+        from_server = 0;
+        prefix_length = 0;
+        if(command == FORK_RUN && (input = read_current_input(&input_length)) != NULL)
+          prefix_length = find_prefix_length(input, input_length);
+
+        //Run the input from the prefix server's snapshot if it has the same prefix
+        if(prefix_length && server.fd != -1 && prefix_length == server.prefix_length
+            && !memcmp(input, server.prefix, prefix_length)) {
+          child_pid = prefix_server_request(&server, FORK_RUN);
+          if(child_pid > 0) {
+            from_server = 1;
+            response = child_pid;
+            break;
+          }
+        }
+
+        //Otherwise start a new child, which replaces the prefix server with a snapshot of the input's prefix
+        free(pending_prefix);
+        pending_prefix = NULL;
+        if(prefix_length) {
+          prefix_server_stop(&server);
+          pending_prefix = malloc(prefix_length);
+          if(pending_prefix)
+            memcpy(pending_prefix, input, prefix_length);
+          else
+            prefix_length = 0;
+        }
+        if(snapshot_fd != -1)
+          close(snapshot_fd);
+        child_pid = prefix_fork_child(target_pipe, &server, pending_prefix != NULL, &snapshot_fd);
+        if(!child_pid)
+          return 0;
+
+        if(command == FORK_RUN) {
+          response = 0;
+          if(write(target_pipe[1], &response, sizeof(int)) != sizeof(int))
+            _exit(1);
+        }
+        response = child_pid;
+        break;
+
+      case RUN:
+        if(child_pid == -1 || from_server) {
+          response = FORKSERVER_ERROR;
+          break;
+        }
+        response = 0;
+        if(write(target_pipe[1], &response, sizeof(int)) != sizeof(int))
+          _exit(1);
+        break;
+
+      case GET_STATUS:
+        if(child_pid == -1) {
+          response = FORKSERVER_ERROR;
+          break;
+        }
+        if(from_server) {
+          //The prefix server's children aren't the fork server's, so their peak RSS isn't known here
+          response = prefix_server_request(&server, GET_STATUS);
+          child_pid = -1;
+          max_rss_kb = 0;
+          break;
+        }
+        if(reap_child(child_pid, &response, &max_rss_kb) < 0)
+          _exit(1);
+        child_pid = -1;
+
+        //The child sent PREFIX_READY before it went on with the rest of its input, if it took a snapshot
+        if(snapshot_fd != -1) {
+          ready.fd = snapshot_fd;
+          ready.events = POLLIN;
+          if(poll(&ready, 1, 0) == 1 && read(snapshot_fd, &ready_message, sizeof(int)) == sizeof(int)
+              && ready_message == PREFIX_READY) {
+            server.fd = snapshot_fd;
+            server.prefix = pending_prefix;
+            server.prefix_length = prefix_length;
+            pending_prefix = NULL;
+          }
+          else
+            close(snapshot_fd);
+          snapshot_fd = -1;
+        }
+        break;
+
+      case GET_MAX_RSS:
+        response = max_rss_kb;
+        break;
+
+      default:
+        response = FORKSERVER_ERROR;
+        break;
     }
 
     if(write(FORKSRV_TO_FUZZER, &response, sizeof(int)) != sizeof(int))
@@ -102,10 +833,129 @@ void __forkserver_init(void)
 //Persistence Mode ///////////////////////////////////////////
 //////////////////////////////////////////////////////////////
 
-static int max_cnt = 0;
 static int cycle_cnt = 0;
 static int forkserver_cycle_cnt = 0;
 
+//In adaptive mode, the fork server starts with the given max_cnt, and then
+//watches each child's per-iteration CPU time and RSS.  If a child gets slower
+//or grows too much compared to its first few iterations, the target is
+//leaking state, so the child is restarted early and max_cnt is lowered.  If a
+//child runs all of its iterations without doing so, max_cnt is raised.
+#define ADAPTIVE_MIN_CNT        16
+#define ADAPTIVE_MAX_CNT        (1 << 20)
+#define ADAPTIVE_WARMUP_CNT     16 //The iterations used to measure a new child's baseline
+#define ADAPTIVE_CHECK_INTERVAL 16 //How often (in iterations) the child's RSS is checked
+#define ADAPTIVE_SLOWDOWN       2  //Restart a child once it takes this many times its baseline CPU time,
+#define ADAPTIVE_MIN_SLOWDOWN   100000 //and at least this many more nanoseconds per iteration
+#define ADAPTIVE_RSS_GROWTH     (64 * 1024 * 1024) //Restart a child once it has grown by this many bytes
+
+struct adaptive_stats {
+  int enabled;
+  int has_clock;
+  clockid_t clock;      //The child's CPU time clock
+  uint64_t last_time;   //The child's CPU time when it last stopped
+  uint64_t base_time;   //The child's average CPU time per iteration during the warmup
+  uint64_t recent_time; //A moving average of the child's CPU time per iteration since the warmup
+  long base_rss;        //The child's RSS (in pages) after the warmup
+  int degraded;         //Whether the child has slowed down or grown too much
+};
+static struct adaptive_stats adaptive;
+
+/**
+ * This function reads a child's CPU time clock
+ * @return - the CPU time in nanoseconds, or 0 if the clock couldn't be read
+ */
+static uint64_t adaptive_cpu_time(void)
+{
+  struct timespec ts;
+  if(!adaptive.has_clock || clock_gettime(adaptive.clock, &ts))
+    return 0;
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * This function reads a child's resident set size
+ * @param child_pid - the pid of the child to check
+ * @return - the RSS in pages, or -1 if it couldn't be read
+ */
+static long adaptive_rss(int child_pid)
+{
+  char path[64], buffer[128];
+  long size, rss;
+  int fd, length;
+
+  snprintf(path, sizeof(path), "/proc/%d/statm", child_pid);
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return -1;
+  length = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if(length <= 0)
+    return -1;
+  buffer[length] = 0;
+  if(sscanf(buffer, "%ld %ld", &size, &rss) != 2)
+    return -1;
+  return rss;
+}
+
+/**
+ * This function resets the adaptive mode statistics for a newly started child
+ * @param child_pid - the pid of the child, which must be stopped waiting for its first input
+ */
+static void adaptive_start(int child_pid)
+{
+  adaptive.has_clock = !clock_getcpuclockid(child_pid, &adaptive.clock);
+  adaptive.last_time = adaptive_cpu_time();
+  adaptive.base_time = adaptive.recent_time = 0;
+  adaptive.base_rss = 0;
+  adaptive.degraded = 0;
+}
+
+/**
+ * This function updates the adaptive mode statistics after a child finishes an iteration, and lowers max_cnt if the
+ * child has slowed down or grown too much.
+ * @param child_pid - the pid of the child, which must be stopped waiting for its next input
+ */
+static void adaptive_update(int child_pid)
+{
+  uint64_t now, elapsed;
+  long rss;
+
+  now = adaptive_cpu_time();
+  elapsed = now - adaptive.last_time;
+  adaptive.last_time = now;
+
+  if(forkserver_cycle_cnt <= ADAPTIVE_WARMUP_CNT) {
+    adaptive.base_time += elapsed;
+    if(forkserver_cycle_cnt == ADAPTIVE_WARMUP_CNT) {
+      adaptive.base_time /= ADAPTIVE_WARMUP_CNT;
+      adaptive.recent_time = adaptive.base_time;
+      adaptive.base_rss = adaptive_rss(child_pid);
+    }
+    return;
+  }
+
+  adaptive.recent_time = (adaptive.recent_time * 7 + elapsed) / 8;
+  if(adaptive.has_clock && adaptive.recent_time > adaptive.base_time * ADAPTIVE_SLOWDOWN
+    && adaptive.recent_time > adaptive.base_time + ADAPTIVE_MIN_SLOWDOWN)
+    adaptive.degraded = 1;
+  if(forkserver_cycle_cnt % ADAPTIVE_CHECK_INTERVAL == 0) {
+    rss = adaptive_rss(child_pid);
+    if(adaptive.base_rss > 0 && rss > 0 &&
+      (rss - adaptive.base_rss) * sysconf(_SC_PAGESIZE) > ADAPTIVE_RSS_GROWTH)
+      adaptive.degraded = 1;
+  }
+
+  //Restart the child at the next FORK command, and stop future children sooner
+  if(adaptive.degraded) {
+    max_cnt = forkserver_cycle_cnt / 2;
+    if(max_cnt < ADAPTIVE_MIN_CNT)
+      max_cnt = ADAPTIVE_MIN_CNT;
+    if(max_cnt > forkserver_cycle_cnt)
+      max_cnt = forkserver_cycle_cnt;
+  }
+}
+
 static void forkserver_persistence_init(void)
 {
   int response = 0x41414141;
@@ -117,6 +967,15 @@ static void forkserver_persistence_init(void)
   if(!max_cnt)
     _exit(1);
 
+  //In adaptive mode, the child's limit is shared, so the fork server can change it while the child runs
+  adaptive.enabled = getenv(PERSIST_ADAPTIVE_VAR) != NULL;
+  if(adaptive.enabled) {
+    child_max_cnt = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(child_max_cnt == MAP_FAILED)
+      _exit(1);
+    *child_max_cnt = INT_MAX;
+  }
+
   while (1) {
 
     // Wait for parent by reading from the pipe. Exit if read fails.
@@ -135,18 +994,25 @@ static void forkserver_persistence_init(void)
       case FORK:
       case FORK_RUN:
 
-        if(child_pid == -1 || forkserver_cycle_cnt == max_cnt) {
+        if(child_pid == -1 || forkserver_cycle_cnt >= max_cnt) {
 
-          if(child_pid != -1 && forkserver_cycle_cnt == max_cnt) {
+          if(child_pid != -1 && forkserver_cycle_cnt >= max_cnt) {
             //if we've hit the maximum cycle count, continue the child, so it may exit
             //and clean up.  We do this now, rather than in GET_STATUS commands, to ensure that
             //the exit portion of the target process does not get traced.
+            if(adaptive.enabled) {
+              *child_max_cnt = forkserver_cycle_cnt;
+              if(!adaptive.degraded && max_cnt < ADAPTIVE_MAX_CNT)
+                max_cnt *= 2;
+            }
             kill(child_pid, SIGCONT);
             if(waitpid(child_pid, &response, 0) < 0)
               _exit(1);
             forkserver_cycle_cnt = 0;
+            *child_max_cnt = adaptive.enabled ? INT_MAX : max_cnt;
           }
 
+          forkserver_breakpoints_update();
           child_pid = fork();
           if(child_pid < 0)
             _exit(1);
@@ -163,6 +1029,8 @@ static void forkserver_persistence_init(void)
             kill(child_pid, SIGKILL);
             child_pid = -1;
           }
+          else if(adaptive.enabled)
+            adaptive_start(child_pid);
         }
         response = child_pid;
 
@@ -190,9 +1058,21 @@ static void forkserver_persistence_init(void)
           child_pid = -1; //by hitting the max_cnt count and exiting, or by crashing
           forkserver_cycle_cnt = 0;
         }
-        else if(WIFSTOPPED(response)) //If we hit a SIGSTOP, then the child didn't
-          response = 0;               //die, just return 0 to the parent
+        else if(WIFSTOPPED(response)) { //If we hit a SIGSTOP, then the child didn't
+          response = 0;                 //die, just return 0 to the parent
+          if(adaptive.enabled)
+            adaptive_update(child_pid);
+        }
+
+        break;
 
+      case GET_MAX_CNT:
+        response = max_cnt;
+        break;
+
+      case GET_MAX_RSS:
+        //A persistent child's peak RSS covers all of its runs so far, so it says nothing about the last one
+        response = 0;
         break;
     }
 
@@ -203,6 +1083,83 @@ static void forkserver_persistence_init(void)
 
 int __killerbeez_loop(void) {
   raise(SIGSTOP);
-  return cycle_cnt++ != max_cnt;
+  return cycle_cnt++ != *child_max_cnt;
+}
+
+//////////////////////////////////////////////////////////////
+//Shared Memory Input ////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+static void attach_input_shm(void)
+{
+  char * shm_id_str;
+  void * region;
+
+  if(input_shm)
+    return;
+  shm_id_str = getenv(SHM_INPUT_ENV_VAR);
+  if(!shm_id_str)
+    return;
+  region = shmat(atoi(shm_id_str), NULL, SHM_RDONLY);
+  if(region != (void *)-1)
+    input_shm = (forkserver_shm_input_t *)region;
+}
+
+char * __killerbeez_get_input(size_t * length) {
+  attach_input_shm();
+  if(!input_shm)
+    return NULL;
+  *length = input_shm->length;
+  return input_shm->data;
+}
+
+
+//////////////////////////////////////////////////////////////
+//Stream Stdin ///////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function reads exactly length bytes from stdin
+ * @param buffer - the buffer to read into
+ * @param length - the number of bytes to read
+ * @return - 0 on success, -1 on EOF or failure
+ */
+static int read_stdin_fully(char * buffer, size_t length)
+{
+  size_t total = 0;
+  ssize_t result;
+
+  while(total < length) {
+    result = read(0, buffer + total, length - total);
+    if(result < 0 && errno == EINTR)
+      continue;
+    if(result <= 0)
+      return -1;
+    total += result;
+  }
+  return 0;
 }
 
+char * __killerbeez_read_stdin(size_t * length) {
+  static char * buffer = NULL;
+  static size_t buffer_size = 0;
+  stdin_frame_t frame;
+  char * new_buffer;
+
+  if(!getenv(STREAM_STDIN_ENV_VAR) || read_stdin_fully((char *)&frame, sizeof(frame)))
+    return NULL;
+
+  //Keep a spare byte, so the input can be used as a string
+  if((size_t)frame.length + 1 > buffer_size) {
+    new_buffer = realloc(buffer, (size_t)frame.length + 1);
+    if(!new_buffer)
+      return NULL;
+    buffer = new_buffer;
+    buffer_size = (size_t)frame.length + 1;
+  }
+  if(read_stdin_fully(buffer, frame.length))
+    return NULL;
+  buffer[frame.length] = 0;
+  *length = frame.length;
+  return buffer;
+}
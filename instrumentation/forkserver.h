@@ -1,7 +1,20 @@
 #pragma once
 
+#include <stddef.h> // size_t
+
 //Macros and fucntion definitions for use when instrumenting target programs
 int __killerbeez_loop(void);
 #define KILLERBEEZ_LOOP() __killerbeez_loop()
+//Returns the current input from the fuzzer's shared memory input channel, or NULL if
+//the fuzzer isn't passing inputs via shared memory.  The input stays valid until the
+//next call to KILLERBEEZ_LOOP().
+char * __killerbeez_get_input(size_t * length);
+#define KILLERBEEZ_GET_INPUT(length) __killerbeez_get_input(length)
+//Reads the next framed input from stdin, when the fuzzer streams inputs through
+//stdin (the instrumentation's stream_stdin option), or returns NULL if it doesn't,
+//or stdin is closed.  Call it once per KILLERBEEZ_LOOP() iteration.  The input
+//stays valid until the next call, and is followed by a NUL byte.
+char * __killerbeez_read_stdin(size_t * length);
+#define KILLERBEEZ_READ_STDIN(length) __killerbeez_read_stdin(length)
 void __forkserver_init(void);
 #define KILLERBEEZ_INIT() __forkserver_init()
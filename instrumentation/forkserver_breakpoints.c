@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "forkserver_internal.h"
+
+//////////////////////////////////////////////////////////////
+//Breakpoint Coverage ////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//The breakpoint instrumentation gets basic block coverage of binary-only
+//targets the way UnTracer does.  When the fork server starts, it writes an
+//int3 over the first byte of each basic block that hasn't been hit yet.  A
+//child that hits one traps into breakpoint_handler, which records the block in
+//the shared memory region, puts the original byte back in the child, and
+//reruns the instruction.  Before the fork server forks its next child, it puts
+//the original bytes back for the blocks that its children have hit, so every
+//later child inherits the fork server's code without those breakpoints.  Once
+//the target's coverage settles, most inputs don't trap at all and run at the
+//uninstrumented target's speed.
+//
+//The code pages with breakpoints are left writable, so the children don't
+//need an mprotect call for each breakpoint they hit.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define BREAKPOINT_INSTRUCTION 0xcc //int3
+#ifdef __x86_64__
+#define CONTEXT_PC(uc) ((uc)->uc_mcontext.gregs[REG_RIP])
+#else
+#define CONTEXT_PC(uc) ((uc)->uc_mcontext.gregs[REG_EIP])
+#endif
+
+#define MAX_CODE_SEGMENTS 16
+
+struct code_segment {
+  uintptr_t start; //Relative to the executable's load address
+  uintptr_t end;
+};
+
+struct executable_info {
+  uintptr_t base;
+  int num_segments;
+  struct code_segment segments[MAX_CODE_SEGMENTS];
+};
+
+static breakpoint_shm_t * shm = NULL;
+static uintptr_t executable_base;
+//The first byte of each block, or BREAKPOINT_INSTRUCTION if the block doesn't
+//have a breakpoint (it was already hit, or it couldn't be patched)
+static unsigned char * original_bytes = NULL;
+static uint32_t removed_hits = 0; //The number of hit_list entries the fork server has removed the breakpoints of
+static struct sigaction old_sigtrap_action;
+
+/**
+ * This function is a dl_iterate_phdr callback that records the load address and executable segments of the main
+ * executable, which is always the first object listed
+ */
+static int find_executable_info(struct dl_phdr_info * info, size_t size, void * data)
+{
+  struct executable_info * executable = (struct executable_info *)data;
+  int i;
+
+  executable->base = info->dlpi_addr;
+  for(i = 0; i < info->dlpi_phnum && executable->num_segments < MAX_CODE_SEGMENTS; i++) {
+    if(info->dlpi_phdr[i].p_type != PT_LOAD || !(info->dlpi_phdr[i].p_flags & PF_X))
+      continue;
+    executable->segments[executable->num_segments].start = info->dlpi_phdr[i].p_vaddr;
+    executable->segments[executable->num_segments].end = info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz;
+    executable->num_segments++;
+  }
+  return 1;
+}
+
+/**
+ * This function looks up a block by the address of its first byte
+ * @param address - the address to look up, relative to the executable's load address
+ * @return - the index of the block, or -1 if no block starts at address
+ */
+static long find_block(uintptr_t address)
+{
+  uint64_t * addresses = BREAKPOINT_SHM_ADDRESSES(shm);
+  long low = 0, high = (long)shm->num_blocks - 1, middle;
+
+  while(low <= high) {
+    middle = low + (high - low) / 2;
+    if(addresses[middle] == address)
+      return middle;
+    if(addresses[middle] < address)
+      low = middle + 1;
+    else
+      high = middle - 1;
+  }
+  return -1;
+}
+
+/**
+ * This function passes a SIGTRAP that isn't from one of our breakpoints on to the handler that was installed
+ * before ours
+ */
+static void forward_sigtrap(int sig, siginfo_t * info, void * context)
+{
+  if(old_sigtrap_action.sa_flags & SA_SIGINFO)
+    old_sigtrap_action.sa_sigaction(sig, info, context);
+  else if(old_sigtrap_action.sa_handler == SIG_DFL) {
+    //Kill the process with the SIGTRAP once the handler returns
+    sigaction(SIGTRAP, &old_sigtrap_action, NULL);
+    raise(SIGTRAP);
+  }
+  else if(old_sigtrap_action.sa_handler != SIG_IGN)
+    old_sigtrap_action.sa_handler(sig);
+}
+
+/**
+ * This function handles the breakpoints at the start of the basic blocks
+ * @param sig - the signal number, always SIGTRAP
+ * @param info - information about the signal
+ * @param context - the target's context when it hit the breakpoint
+ */
+static void breakpoint_handler(int sig, siginfo_t * info, void * context)
+{
+  ucontext_t * uc = (ucontext_t *)context;
+  unsigned char * pc = (unsigned char *)CONTEXT_PC(uc) - 1;
+  long index = find_block((uintptr_t)pc - executable_base);
+
+  if(index < 0 || original_bytes[index] == BREAKPOINT_INSTRUCTION || *pc != BREAKPOINT_INSTRUCTION) {
+    forward_sigtrap(sig, info, context);
+    return;
+  }
+
+  //Record the block, unless another child hit it first.  The list holds index + 1, so the fork server can tell
+  //an entry that hasn't been written yet (0) from block 0.
+  if(!__atomic_exchange_n(&BREAKPOINT_SHM_HIT(shm)[index], 1, __ATOMIC_SEQ_CST))
+    BREAKPOINT_SHM_HIT_LIST(shm)[__atomic_fetch_add(&shm->num_hits, 1, __ATOMIC_SEQ_CST)] = index + 1;
+
+  *pc = original_bytes[index];
+  __builtin___clear_cache((char *)pc, (char *)pc + 1);
+  CONTEXT_PC(uc) = (greg_t)(uintptr_t)pc;
+}
+
+/**
+ * This function checks whether a block lies in one of the executable's code segments
+ * @param executable - the executable's code segments
+ * @param address - the block's address, relative to the executable's load address
+ * @return - 1 if the block is in a code segment, 0 otherwise
+ */
+static int in_code_segment(struct executable_info * executable, uint64_t address)
+{
+  int i;
+  for(i = 0; i < executable->num_segments; i++) {
+    if(address >= executable->segments[i].start && address < executable->segments[i].end)
+      return 1;
+  }
+  return 0;
+}
+
+void forkserver_breakpoints_init(void)
+{
+  struct executable_info executable;
+  struct sigaction action;
+  char * shm_id_str;
+  void * region;
+  uint64_t * addresses;
+  volatile uint8_t * hit;
+  unsigned char * address;
+  uintptr_t page, last_page = 0, page_mask;
+  uint32_t i;
+  int page_writable = 0;
+
+  shm_id_str = getenv(BREAKPOINT_SHM_ENV_VAR);
+  if(!shm_id_str || shm)
+    return;
+  region = shmat(atoi(shm_id_str), NULL, 0);
+  if(region == (void *)-1)
+    _exit(1);
+  shm = (breakpoint_shm_t *)region;
+  original_bytes = malloc(shm->num_blocks ? shm->num_blocks : 1);
+  if(!original_bytes)
+    _exit(1);
+  memset(original_bytes, BREAKPOINT_INSTRUCTION, shm->num_blocks);
+
+  memset(&executable, 0, sizeof(executable));
+  dl_iterate_phdr(find_executable_info, &executable);
+  executable_base = executable.base;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = breakpoint_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGTRAP, &action, &old_sigtrap_action))
+    _exit(1);
+
+  //The blocks that were hit in an earlier run (i.e. a loaded state) don't get a breakpoint
+  addresses = BREAKPOINT_SHM_ADDRESSES(shm);
+  hit = BREAKPOINT_SHM_HIT(shm);
+  removed_hits = shm->num_hits;
+  page_mask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+  for(i = 0; i < shm->num_blocks; i++) {
+    if(hit[i] || !in_code_segment(&executable, addresses[i]))
+      continue;
+    address = (unsigned char *)(executable_base + addresses[i]);
+    page = (uintptr_t)address & page_mask;
+    if(page != last_page) {
+      last_page = page;
+      page_writable = !mprotect((void *)page, ~page_mask + 1, PROT_READ | PROT_WRITE | PROT_EXEC);
+    }
+    if(!page_writable || *address == BREAKPOINT_INSTRUCTION)
+      continue;
+    original_bytes[i] = *address;
+    *address = BREAKPOINT_INSTRUCTION;
+  }
+}
+
+void forkserver_breakpoints_update(void)
+{
+  uint32_t num_hits, index;
+  unsigned char * address;
+
+  if(!shm)
+    return;
+  num_hits = __atomic_load_n(&shm->num_hits, __ATOMIC_SEQ_CST);
+  for(; removed_hits < num_hits; removed_hits++) {
+    //Stop at an entry that a running child hasn't finished writing, and pick it up before the next fork
+    index = BREAKPOINT_SHM_HIT_LIST(shm)[removed_hits];
+    if(!index)
+      break;
+    index--;
+    if(index >= shm->num_blocks || original_bytes[index] == BREAKPOINT_INSTRUCTION)
+      continue;
+    address = (unsigned char *)(executable_base + BREAKPOINT_SHM_ADDRESSES(shm)[index]);
+    *address = original_bytes[index];
+    __builtin___clear_cache((char *)address, (char *)address + 1);
+    original_bytes[index] = BREAKPOINT_INSTRUCTION;
+  }
+}
+
+#else
+
+void forkserver_breakpoints_init(void)
+{
+  if(getenv(BREAKPOINT_SHM_ENV_VAR))
+    fprintf(stderr, "The breakpoint instrumentation isn't supported on this architecture\n");
+}
+
+void forkserver_breakpoints_update(void)
+{
+}
+
+#endif
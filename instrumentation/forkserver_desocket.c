@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "forkserver.h"
+#include "forkserver_internal.h"
+
+//////////////////////////////////////////////////////////////
+//Desocket Mode //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//Desocket mode lets the network drivers pass inputs to the target the same
+//way the stdin driver does, rather than through the kernel's TCP/UDP stack.
+//When the target binds or connects a socket to the port named in
+//DESOCKET_ENV_VAR, the socket is swapped for one end of a UNIX socket pair
+//(with dup2, so the target keeps the same file descriptor), and the library
+//holds on to the other end.  Since the target still has a real socket,
+//poll(), select(), epoll, and non-blocking I/O keep working.
+//
+//A TCP server's listening socket is made readable so the target will accept a
+//connection.  The first accept() returns a new socket pair, with the input
+//already written to it and the library's end shut down, so the target reads
+//the input followed by EOF.  A TCP client gets the input as soon as it
+//connects.  Datagram sockets use SOCK_SEQPACKET socket pairs, so each message
+//of the input arrives as its own datagram.  A UDP server gets its input the
+//first time it receives on the socket.
+//
+//Each process only tests one input, so the target exits once it's finished
+//with it: when it closes the connection, when it accepts another connection on
+//a blocking listener, or when it receives on the datagram socket after the
+//last message.  The input is read from the fuzzer's shared memory input
+//channel if there is one, and from stdin otherwise.
+//
+//In prefix mode (see forkserver.c), the messages after the prefix are held
+//back until the target has read the prefix and reads, receives, or polls the
+//socket again.  That's where the snapshot is taken, and then the socket is
+//swapped for a new socket pair that the rest of the input is delivered on, so
+//the snapshot's socket pair is left empty for the next input.  Targets that
+//wait for the rest of the input some other way (e.g. with select or epoll)
+//never take the snapshot, and hang.
+
+#define DESOCKET_MAX_FDS   1024
+#define DESOCKET_PEER_PORT 40000 //The port reported for the other end of desocketed connections
+
+enum desocket_kind {
+  DESOCKET_NONE = 0,
+  DESOCKET_LISTENER,   //A TCP server's listening socket
+  DESOCKET_CONNECTION, //A TCP connection that the input is delivered on
+  DESOCKET_DATAGRAM,   //A UDP socket that the input is delivered on
+};
+
+struct desocket_fd {
+  int kind;
+  int family;    //The address family the target created the socket with
+  int peer;      //The library's end of the socket pair
+  int delivered; //Whether the input has been written to the socket yet
+  size_t prefix_length; //In prefix mode, the length of the prefix, until the rest of the input is delivered
+};
+
+static struct desocket_fd desocket_fds[DESOCKET_MAX_FDS];
+
+//The port to desocket, 0 if desocket mode is disabled, or -1 if the environment hasn't been checked yet
+static int desocket_port = -1;
+
+//Whether a connection has been accepted on a listening socket yet
+static int connection_accepted = 0;
+
+#define LOAD_REAL(name) \
+  static __typeof__(name) * real_##name = NULL; \
+  if(!real_##name) \
+    real_##name = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+/**
+ * This function gets the port that desocket mode should emulate
+ * @return - the port, or 0 if desocket mode isn't enabled
+ */
+static int get_desocket_port(void)
+{
+  char * port;
+
+  if(desocket_port < 0) {
+    port = getenv(DESOCKET_ENV_VAR);
+    desocket_port = port ? atoi(port) : 0;
+    if(desocket_port < 0 || desocket_port > 65535)
+      desocket_port = 0;
+  }
+  return desocket_port;
+}
+
+/**
+ * This function looks up a file descriptor that has been desocketed
+ * @param fd - the file descriptor to look up
+ * @return - the file descriptor's desocket information, or NULL if it isn't desocketed
+ */
+static struct desocket_fd * get_desocket_fd(int fd)
+{
+  if(fd < 0 || fd >= DESOCKET_MAX_FDS || desocket_fds[fd].kind == DESOCKET_NONE)
+    return NULL;
+  return &desocket_fds[fd];
+}
+
+/**
+ * This function determines whether an address is on the port being desocketed
+ * @param addr - the address the target is binding or connecting to
+ * @param addrlen - the length of the addr parameter
+ * @return - 1 if the address is on the desocketed port, 0 otherwise
+ */
+static int is_desocket_address(const struct sockaddr * addr, socklen_t addrlen)
+{
+  int port = get_desocket_port();
+
+  if(!port || !addr)
+    return 0;
+  if(addr->sa_family == AF_INET && addrlen >= sizeof(struct sockaddr_in))
+    return ntohs(((const struct sockaddr_in *)addr)->sin_port) == port;
+  if(addr->sa_family == AF_INET6 && addrlen >= sizeof(struct sockaddr_in6))
+    return ntohs(((const struct sockaddr_in6 *)addr)->sin6_port) == port;
+  return 0;
+}
+
+/**
+ * This function writes a loopback address to a buffer provided by the target
+ * @param family - the address family to write the address in
+ * @param port - the port to put in the address
+ * @param addr - the buffer to write the address to, or NULL
+ * @param addrlen - the length of the addr buffer, which is updated with the full length of the address
+ */
+static void fill_address(int family, int port, struct sockaddr * addr, socklen_t * addrlen)
+{
+  struct sockaddr_in addr4;
+  struct sockaddr_in6 addr6;
+  void * source;
+  socklen_t length;
+
+  if(!addr || !addrlen)
+    return;
+
+  if(family == AF_INET6) {
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = htons(port);
+    addr6.sin6_addr = in6addr_loopback;
+    source = &addr6;
+    length = sizeof(addr6);
+  } else {
+    memset(&addr4, 0, sizeof(addr4));
+    addr4.sin_family = AF_INET;
+    addr4.sin_port = htons(port);
+    addr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    source = &addr4;
+    length = sizeof(addr4);
+  }
+  memcpy(addr, source, *addrlen < length ? *addrlen : length);
+  *addrlen = length;
+}
+
+/**
+ * This function gets the current input
+ * @param length - a pointer used to return the length of the input
+ * @return - the input, or NULL if it couldn't be read.  The input should not be freed.
+ */
+static char * stdin_input = NULL;
+static size_t stdin_length = 0;
+
+static char * get_input(size_t * length)
+{
+  size_t size = 0;
+  ssize_t result;
+  char * input;
+
+  input = __killerbeez_get_input(length);
+  if(input)
+    return input;
+
+  if(!stdin_input) {
+    do {
+      if(stdin_length == size) {
+        size = size ? size * 2 : 4096;
+        input = realloc(stdin_input, size);
+        if(!input)
+          return NULL;
+        stdin_input = input;
+      }
+      result = read(0, stdin_input + stdin_length, size - stdin_length);
+      if(result > 0)
+        stdin_length += result;
+    } while(result > 0 || (result < 0 && errno == EINTR));
+  }
+  *length = stdin_length;
+  return stdin_input;
+}
+
+/**
+ * This function forgets the input read from stdin, so the next call to get_input reads the current one
+ */
+static void forget_input(void)
+{
+  free(stdin_input);
+  stdin_input = NULL;
+  stdin_length = 0;
+}
+
+/**
+ * This function writes part of the input to the library's end of a desocketed socket.  The input is cut off at the
+ * first message that doesn't fit in the socket's buffer, since the target can't read from the socket until this
+ * function returns.
+ * @param info - the desocketed socket to write the input to
+ * @param input - the input, or NULL if it couldn't be read
+ * @param offset - the offset of the first message to write
+ * @param length - the offset to stop writing messages at
+ */
+static void send_messages(struct desocket_fd * info, char * input, size_t offset, size_t length)
+{
+  desocket_message_t message;
+
+  while(input && offset + sizeof(message) <= length) {
+    memcpy(&message, input + offset, sizeof(message));
+    offset += sizeof(message);
+    if(message.length > length - offset)
+      break;
+
+    //Empty datagrams would look like the end of the input, and a message that doesn't fit would leave a gap in
+    //a TCP stream
+    if(message.length && send(info->peer, input + offset, message.length, MSG_DONTWAIT | MSG_NOSIGNAL)
+        != (ssize_t)message.length)
+      break;
+    offset += message.length;
+  }
+}
+
+/**
+ * This function writes the input to the library's end of a desocketed socket, and shuts it down so the target
+ * reads EOF after the input.  In prefix mode, only the prefix is written, and the rest is left to deliver_suffix.
+ * @param info - the desocketed socket to write the input to
+ */
+static void deliver_input(struct desocket_fd * info)
+{
+  size_t length;
+  char * input;
+
+  info->delivered = 1;
+  input = get_input(&length);
+  info->prefix_length = input ? forkserver_prefix_length(input, length) : 0;
+  if(info->prefix_length) {
+    send_messages(info, input, 0, info->prefix_length);
+    return;
+  }
+  send_messages(info, input, 0, length);
+  shutdown(info->peer, SHUT_WR);
+}
+
+/**
+ * This function swaps a socket the target created for one end of a socket pair
+ * @param fd - the target's socket
+ * @param kind - what kind of desocketed socket the socket will become
+ * @param family - the address family the target used for the socket
+ * @return - 0 on success, -1 on failure
+ */
+static int desocket_fd(int fd, int kind, int family)
+{
+  int pair[2], status_flags, fd_flags;
+  LOAD_REAL(close);
+
+  if(fd < 0 || fd >= DESOCKET_MAX_FDS)
+    return -1;
+
+  status_flags = fcntl(fd, F_GETFL);
+  fd_flags = fcntl(fd, F_GETFD);
+  if(status_flags < 0 || fd_flags < 0)
+    return -1;
+  if(socketpair(AF_UNIX, (kind == DESOCKET_DATAGRAM ? SOCK_SEQPACKET : SOCK_STREAM) | SOCK_CLOEXEC, 0, pair))
+    return -1;
+  if(dup2(pair[0], fd) < 0) {
+    real_close(pair[0]);
+    real_close(pair[1]);
+    return -1;
+  }
+  real_close(pair[0]);
+  fcntl(fd, F_SETFL, status_flags);
+  fcntl(fd, F_SETFD, fd_flags);
+
+  desocket_fds[fd].kind = kind;
+  desocket_fds[fd].family = family;
+  desocket_fds[fd].peer = pair[1];
+  desocket_fds[fd].delivered = 0;
+  return 0;
+}
+
+/**
+ * This function takes the prefix snapshot once the target has read the prefix from a desocketed socket and asks for
+ * more, and then delivers the rest of the input on a new socket pair
+ * @param fd - the socket the target is reading from
+ */
+static void deliver_suffix(int fd)
+{
+  struct desocket_fd * info = get_desocket_fd(fd);
+  size_t offset, length;
+  int unread;
+  char * input;
+  LOAD_REAL(close);
+
+  if(!info || !info->prefix_length || ioctl(fd, FIONREAD, &unread) || unread > 0)
+    return;
+  offset = info->prefix_length;
+  info->prefix_length = 0;
+
+  //A child of the prefix server has a new input, with the same prefix
+  if(forkserver_prefix_snapshot())
+    forget_input();
+
+  real_close(info->peer);
+  if(desocket_fd(fd, info->kind, info->family))
+    return;
+  info->delivered = 1;
+  input = get_input(&length);
+  send_messages(info, input, offset, length);
+  shutdown(info->peer, SHUT_WR);
+}
+
+/**
+ * This function ends the target once it has finished with its input
+ */
+static void finish_input(void)
+{
+  exit(0);
+}
+
+int bind(int sockfd, const struct sockaddr * addr, socklen_t addrlen)
+{
+  int type;
+  socklen_t type_length = sizeof(type);
+  char wakeup = 0;
+  LOAD_REAL(bind);
+
+  if(!get_desocket_fd(sockfd) && is_desocket_address(addr, addrlen)
+      && !getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &type_length)) {
+    if(type == SOCK_STREAM && !desocket_fd(sockfd, DESOCKET_LISTENER, addr->sa_family)) {
+      //Make the listening socket readable, so the target will accept a connection
+      send(desocket_fds[sockfd].peer, &wakeup, sizeof(wakeup), MSG_DONTWAIT | MSG_NOSIGNAL);
+      return 0;
+    }
+    if(type == SOCK_DGRAM && !desocket_fd(sockfd, DESOCKET_DATAGRAM, addr->sa_family))
+      return 0;
+  }
+  return real_bind(sockfd, addr, addrlen);
+}
+
+int listen(int sockfd, int backlog)
+{
+  LOAD_REAL(listen);
+
+  if(get_desocket_fd(sockfd))
+    return 0;
+  return real_listen(sockfd, backlog);
+}
+
+int accept4(int sockfd, struct sockaddr * addr, socklen_t * addrlen, int flags)
+{
+  struct desocket_fd * listener = get_desocket_fd(sockfd);
+  int fd;
+  LOAD_REAL(accept4);
+
+  if(!listener || listener->kind != DESOCKET_LISTENER)
+    return real_accept4(sockfd, addr, addrlen, flags);
+
+  //The input has already been given to the target.  If it's waiting for the next connection, it's done with it.
+  if(connection_accepted) {
+    if(fcntl(sockfd, F_GETFL) & O_NONBLOCK) {
+      errno = EAGAIN;
+      return -1;
+    }
+    finish_input();
+  }
+  //The listening socket is left readable, since it may have been created before the fork server started, in
+  //which case it's shared with the children that test later inputs
+  connection_accepted = 1;
+
+  fd = socket(listener->family, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  if(desocket_fd(fd, DESOCKET_CONNECTION, listener->family)) {
+    close(fd);
+    return -1;
+  }
+  if(flags & SOCK_NONBLOCK)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, (flags & SOCK_CLOEXEC) ? FD_CLOEXEC : 0);
+
+  deliver_input(&desocket_fds[fd]);
+  fill_address(listener->family, DESOCKET_PEER_PORT, addr, addrlen);
+  return fd;
+}
+
+int accept(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  return accept4(sockfd, addr, addrlen, 0);
+}
+
+int connect(int sockfd, const struct sockaddr * addr, socklen_t addrlen)
+{
+  int type;
+  socklen_t type_length = sizeof(type);
+  LOAD_REAL(connect);
+
+  if(!get_desocket_fd(sockfd) && is_desocket_address(addr, addrlen)
+      && !getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &type_length)
+      && (type == SOCK_STREAM || type == SOCK_DGRAM)
+      && !desocket_fd(sockfd, type == SOCK_STREAM ? DESOCKET_CONNECTION : DESOCKET_DATAGRAM, addr->sa_family)) {
+    deliver_input(&desocket_fds[sockfd]);
+    return 0;
+  }
+  return real_connect(sockfd, addr, addrlen);
+}
+
+/**
+ * This function prepares a desocketed datagram socket for the target to receive on, and checks whether the
+ * target has received all of the input
+ * @param sockfd - the socket the target is receiving on
+ * @param result - the result of the receive call, or 1 if the call hasn't been made yet
+ */
+static void check_datagram_receive(int sockfd, ssize_t result)
+{
+  struct desocket_fd * info = get_desocket_fd(sockfd);
+
+  if(!info || info->kind != DESOCKET_DATAGRAM)
+    return;
+  if(!info->delivered)
+    deliver_input(info);
+  else if(!result)
+    finish_input();
+}
+
+ssize_t recvfrom(int sockfd, void * buf, size_t len, int flags, struct sockaddr * src_addr, socklen_t * addrlen)
+{
+  struct desocket_fd * info = get_desocket_fd(sockfd);
+  ssize_t result;
+  LOAD_REAL(recvfrom);
+
+  if(!info)
+    return real_recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
+
+  check_datagram_receive(sockfd, 1);
+  deliver_suffix(sockfd);
+  result = real_recvfrom(sockfd, buf, len, flags, NULL, NULL);
+  check_datagram_receive(sockfd, result);
+  if(result >= 0)
+    fill_address(info->family, DESOCKET_PEER_PORT, src_addr, addrlen);
+  return result;
+}
+
+ssize_t recv(int sockfd, void * buf, size_t len, int flags)
+{
+  return recvfrom(sockfd, buf, len, flags, NULL, NULL);
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr * msg, int flags)
+{
+  struct desocket_fd * info = get_desocket_fd(sockfd);
+  void * name;
+  socklen_t name_length;
+  ssize_t result;
+  LOAD_REAL(recvmsg);
+
+  if(!info)
+    return real_recvmsg(sockfd, msg, flags);
+
+  //UNIX sockets don't have a sender address, so make one up
+  name = msg->msg_name;
+  name_length = msg->msg_namelen;
+  msg->msg_name = NULL;
+  msg->msg_namelen = 0;
+  check_datagram_receive(sockfd, 1);
+  deliver_suffix(sockfd);
+  result = real_recvmsg(sockfd, msg, flags);
+  check_datagram_receive(sockfd, result);
+  msg->msg_name = name;
+  msg->msg_namelen = name_length;
+  if(result >= 0)
+    fill_address(info->family, DESOCKET_PEER_PORT, name, &msg->msg_namelen);
+  return result;
+}
+
+ssize_t read(int fd, void * buf, size_t count)
+{
+  LOAD_REAL(read);
+
+  deliver_suffix(fd);
+  return real_read(fd, buf, count);
+}
+
+int poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+  nfds_t i;
+  LOAD_REAL(poll);
+
+  for(i = 0; i < nfds; i++) {
+    if(fds[i].events & POLLIN)
+      deliver_suffix(fds[i].fd);
+  }
+  return real_poll(fds, nfds, timeout);
+}
+
+ssize_t sendto(int sockfd, const void * buf, size_t len, int flags, const struct sockaddr * dest_addr, socklen_t addrlen)
+{
+  LOAD_REAL(sendto);
+
+  //The socket pair is already connected, so it can't be given an address
+  if(get_desocket_fd(sockfd))
+    return real_sendto(sockfd, buf, len, flags | MSG_NOSIGNAL, NULL, 0);
+  return real_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+}
+
+ssize_t sendmsg(int sockfd, const struct msghdr * msg, int flags)
+{
+  struct msghdr copy;
+  LOAD_REAL(sendmsg);
+
+  if(!get_desocket_fd(sockfd))
+    return real_sendmsg(sockfd, msg, flags);
+  copy = *msg;
+  copy.msg_name = NULL;
+  copy.msg_namelen = 0;
+  return real_sendmsg(sockfd, &copy, flags | MSG_NOSIGNAL);
+}
+
+int getsockname(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  struct desocket_fd * info = get_desocket_fd(sockfd);
+  LOAD_REAL(getsockname);
+
+  if(!info)
+    return real_getsockname(sockfd, addr, addrlen);
+  fill_address(info->family, get_desocket_port(), addr, addrlen);
+  return 0;
+}
+
+int getpeername(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  struct desocket_fd * info = get_desocket_fd(sockfd);
+  LOAD_REAL(getpeername);
+
+  if(!info)
+    return real_getpeername(sockfd, addr, addrlen);
+  if(info->kind == DESOCKET_LISTENER) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  fill_address(info->family, DESOCKET_PEER_PORT, addr, addrlen);
+  return 0;
+}
+
+int setsockopt(int sockfd, int level, int optname, const void * optval, socklen_t optlen)
+{
+  LOAD_REAL(setsockopt);
+
+  //TCP and IP options don't apply to a UNIX socket pair, so pretend they worked
+  if(get_desocket_fd(sockfd) && level != SOL_SOCKET)
+    return 0;
+  return real_setsockopt(sockfd, level, optname, optval, optlen);
+}
+
+int close(int fd)
+{
+  struct desocket_fd * info = get_desocket_fd(fd);
+  int kind;
+  LOAD_REAL(close);
+
+  if(info) {
+    kind = info->kind;
+    real_close(info->peer);
+    info->kind = DESOCKET_NONE;
+    if(kind == DESOCKET_CONNECTION) {
+      real_close(fd);
+      finish_input();
+    }
+  }
+  return real_close(fd);
+}
@@ -1,8 +1,18 @@
 #define _GNU_SOURCE
 #include <dlfcn.h>
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
 
 #include "forkserver.h"
 #include "forkserver_config.h"
+#include "forkserver_internal.h"
 
 #if !DISABLE_HOOKING
 
@@ -56,10 +66,169 @@ __attribute__ ((section ("__DATA,__interpose"))) = { (const void*)(unsigned long
 #if USE_LIBC_START_MAIN
 static orig_function_type orig_main = 0;
 
-void * fake_main(void * a0, void * a1, void * a2, void * a3, void * a4, void * a5, void * a6, void * a7)
+//////////////////////////////////////////////////////////////
+//Deferred Startup ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//When the fuzzer names a function to start the fork server at, the first byte
+//of that function is replaced with a breakpoint once the target reaches main.
+//The SIGTRAP handler puts the original byte back and starts the fork server.
+//The fork server never returns from the handler, while each child returns
+//from it and runs the function as if nothing had happened.  This way the
+//target's startup code up to that function only runs once, without needing
+//to rebuild the fork server library for each target.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_INIT_BREAKPOINT 1
+#define BREAKPOINT_INSTRUCTION 0xcc //int3
+#ifdef __x86_64__
+#define CONTEXT_PC(uc) ((uc)->uc_mcontext.gregs[REG_RIP])
+#else
+#define CONTEXT_PC(uc) ((uc)->uc_mcontext.gregs[REG_EIP])
+#endif
+
+static unsigned char * init_breakpoint = NULL;
+static unsigned char init_breakpoint_byte;
+static struct sigaction old_sigtrap_action;
+
+/**
+ * This function writes a single byte of the target's code
+ * @param address - the address to write to
+ * @param value - the byte to write
+ * @return - 0 on success, non-zero on failure
+ */
+static int patch_code_byte(unsigned char * address, unsigned char value)
+{
+  long page_size = sysconf(_SC_PAGESIZE);
+  void * page = (void *)((uintptr_t)address & ~(uintptr_t)(page_size - 1));
+
+  if(mprotect(page, page_size, PROT_READ | PROT_WRITE | PROT_EXEC))
+    return 1;
+  *address = value;
+  __builtin___clear_cache((char *)address, (char *)address + 1);
+  return mprotect(page, page_size, PROT_READ | PROT_EXEC);
+}
+
+/**
+ * This function handles the breakpoint at the start of the function the fuzzer asked to start the fork server at
+ * @param sig - the signal number, always SIGTRAP
+ * @param info - information about the signal
+ * @param context - the target's context when it hit the breakpoint
+ */
+static void init_breakpoint_handler(int sig, siginfo_t * info, void * context)
 {
+  ucontext_t * uc = (ucontext_t *)context;
+
+  sigaction(SIGTRAP, &old_sigtrap_action, NULL);
+
+  //If this isn't our breakpoint, let the target's own handling deal with it
+  if((unsigned char *)CONTEXT_PC(uc) - 1 != init_breakpoint) {
+    raise(SIGTRAP);
+    return;
+  }
+
+  //Put the function back the way it was, and rerun it from the start in each child
+  if(patch_code_byte(init_breakpoint, init_breakpoint_byte))
+    _exit(1);
+  CONTEXT_PC(uc) = (greg_t)(uintptr_t)init_breakpoint;
   __forkserver_init();
-  return orig_main(a0, a1, a2, a3, a4, a5, a6, a7);
+}
+
+/**
+ * This function is a dl_iterate_phdr callback that records the load address of the main executable, which is
+ * always the first object listed
+ */
+static int find_executable_base(struct dl_phdr_info * info, size_t size, void * data)
+{
+  *(uintptr_t *)data = info->dlpi_addr;
+  return 1;
+}
+
+/**
+ * This function finds the function the fork server should start at
+ * @param name - the name of the function, or a hex offset (starting with 0x) from the main executable's load address
+ * for functions that aren't in the dynamic symbol table
+ * @return - the address of the function, or NULL if it couldn't be found
+ */
+static void * find_init_function(const char * name)
+{
+  uintptr_t base = 0;
+  char * end;
+  unsigned long offset;
+
+  if(!strncmp(name, "0x", 2)) {
+    offset = strtoul(name, &end, 16);
+    if(*end || !offset)
+      return NULL;
+    dl_iterate_phdr(find_executable_base, &base);
+    return (void *)(base + offset);
+  }
+  return dlsym(RTLD_DEFAULT, name);
+}
+
+/**
+ * This function sets a breakpoint at the function the fork server should start at
+ * @param name - the name or offset of the function, as given to find_init_function
+ * @return - 0 on success, non-zero on failure
+ */
+static int set_init_breakpoint(const char * name)
+{
+  struct sigaction action;
+
+  init_breakpoint = (unsigned char *)find_init_function(name);
+  if(!init_breakpoint)
+    return 1;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = init_breakpoint_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGTRAP, &action, &old_sigtrap_action))
+    return 1;
+
+  init_breakpoint_byte = *init_breakpoint;
+  if(patch_code_byte(init_breakpoint, BREAKPOINT_INSTRUCTION)) {
+    sigaction(SIGTRAP, &old_sigtrap_action, NULL);
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+/**
+ * This function decides whether the fork server should start later than main, as the fuzzer asked.  The fuzzer
+ * can name a function to start at, or say that the target will call KILLERBEEZ_INIT() itself.
+ * @return - 1 if the fork server will be started later, or 0 if it should be started now
+ */
+static int defer_fork_server_init(void)
+{
+  char * name;
+
+  if(getenv(INIT_MARKER_VAR))
+    return 1;
+
+  name = getenv(INIT_FUNCTION_VAR);
+  if(!name || !*name)
+    return 0;
+#ifdef HAS_INIT_BREAKPOINT
+  if(!set_init_breakpoint(name))
+    return 1;
+#endif
+  fprintf(stderr, "Couldn't start the fork server at %s, starting it at main instead\n", name);
+  return 0;
+}
+
+void * fake_main(void * a0, void * a1, void * a2, void * a3, void * a4, void * a5, void * a6, void * a7)
+{
+  void * ret;
+
+  if(!defer_fork_server_init())
+    __forkserver_init();
+  ret = orig_main(a0, a1, a2, a3, a4, a5, a6, a7);
+
+  //libc calls exit() internally once main returns, so snapshot mode can't hook that call
+  forkserver_snapshot_exit();
+  return ret;
 }
 #endif
 
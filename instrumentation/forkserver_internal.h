@@ -1,7 +1,25 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
 #define PERSIST_MAX_VAR "PERSISTENCE_MAX_CNT"
 #define DEFER_ENV_VAR   "DEFER_ENV_VAR"
+#define SHM_INPUT_ENV_VAR "KILLERBEEZ_SHM_INPUT"
+#define SNAPSHOT_ENV_VAR  "KILLERBEEZ_SNAPSHOT"
+#define PERSIST_ADAPTIVE_VAR "KILLERBEEZ_PERSIST_ADAPTIVE"
+#define INIT_FUNCTION_VAR "KILLERBEEZ_INIT_FUNCTION"
+#define INIT_MARKER_VAR   "KILLERBEEZ_INIT_MARKER"
+#define DESOCKET_ENV_VAR  "KILLERBEEZ_DESOCKET"
+#define DESOCKET_PREFIX_ENV_VAR "KILLERBEEZ_DESOCKET_PREFIX"
+#define CONCURRENT_ENV_VAR "KILLERBEEZ_CONCURRENT"
+#define BREAKPOINT_SHM_ENV_VAR "KILLERBEEZ_BREAKPOINT_SHM"
+#define STREAM_STDIN_ENV_VAR "KILLERBEEZ_STREAM_STDIN"
+//The guest addresses of the function QEMU mode runs once per input in
+//persistence mode, and of where that function returns to (optional)
+#define QEMU_PERSISTENT_ADDR_VAR "AFL_QEMU_PERSISTENT_ADDR"
+#define QEMU_PERSISTENT_RET_VAR  "AFL_QEMU_PERSISTENT_RET"
 
 //Designated file descriptors for read/write to the forkserver
 //and target process
@@ -10,24 +28,90 @@
 #define QEMU_TSL_FD         200
 #define MAX_FORKSRV_FD      201
 
+//In concurrent mode, one fork server serves several channels, and each channel
+//has at most one child at a time, but the channels' children run in parallel.
+//Channel 0 uses FUZZER_TO_FORKSRV and FORKSRV_TO_FUZZER, and its children read
+//the fork server's stdin.  Channel n (n > 0) uses the three fds starting at
+//FORKSRV_CHANNEL_FD(n): its command pipe, its status pipe, and optionally the
+//file its children read as their stdin.
+#define MAX_CONCURRENT_CHANNELS   64
+#define FORKSRV_CHANNEL_FD_BASE   202
+#define FORKSRV_CHANNEL_FD(n)     (FORKSRV_CHANNEL_FD_BASE + 3 * ((n) - 1))
+#define FORKSRV_CHANNEL_FDS_END   FORKSRV_CHANNEL_FD(MAX_CONCURRENT_CHANNELS)
+
 //Commands that the fuzzer can send to the forkserver
 #define EXIT       0
 #define FORK       1
 #define RUN        2
 #define FORK_RUN   3
 #define GET_STATUS 4
+#define GET_MAX_CNT 5 //Persistence mode only, gets the fork server's current max_cnt
+#define GET_MAX_RSS 6 //Gets the peak RSS in kilobytes of the child that the last GET_STATUS reaped, or 0 if
+                      //it isn't known.  Only sent to the fork servers whose hello says they answer it.
+
+//The forkserver's "hello" message.  Targets with an AFL style coverage map
+//report the log2 of the map size they use in the low byte, along with flags
+//saying whether they maintain the dirty line index and answer GET_MAX_RSS.
+//The fork server library sends FORKSERVER_HELLO_LIBRARY, and older targets
+//just send FORKSERVER_HELLO, which tell the fuzzer nothing about the map.
+#define FORKSERVER_HELLO                     0x41414141
+#define FORKSERVER_HELLO_LIBRARY             0x41414142
+#define FORKSERVER_HELLO_MAP_MAGIC           0x4b420000
+#define FORKSERVER_HELLO_DIRTY_INDEX         0x100
+#define FORKSERVER_HELLO_MAX_RSS             0x200
+#define FORKSERVER_HELLO_MAP_SIZE(pow2)      (FORKSERVER_HELLO_MAP_MAGIC | (pow2))
+#define FORKSERVER_HELLO_HAS_MAP_SIZE(hello) (((hello) & 0xffff0000) == FORKSERVER_HELLO_MAP_MAGIC)
+#define FORKSERVER_HELLO_GET_MAP_SIZE(hello) (1U << ((hello) & 0xff))
+#define FORKSERVER_HELLO_HAS_MAX_RSS(hello)  ((hello) == FORKSERVER_HELLO_LIBRARY || \
+  (FORKSERVER_HELLO_HAS_MAP_SIZE(hello) && ((hello) & FORKSERVER_HELLO_MAX_RSS)))
 
 //Possible response codes returned from the forkserver
 #define FORKSERVER_ERROR -1
 #define FORKSERVER_NO_RESULTS_READY -2
 
+//The layout of the shared memory region used to pass inputs to the target
+struct forkserver_shm_input {
+  uint32_t length;     //The length of the current input
+  uint32_t max_length; //The size of the data buffer
+  char data[1];        //The current input
+};
+typedef struct forkserver_shm_input forkserver_shm_input_t;
+#define SHM_INPUT_REGION_SIZE(max_length) (offsetof(forkserver_shm_input_t, data) + (max_length))
+
+//A cgroup v2 group that a fuzzer worker's fork server and targets run in, so that a target that uses a lot of memory
+//or forks a lot of processes can't slow down the other workers on the host.  Each worker's group is created under
+//parent, which must be a cgroup v2 group that the fuzzer can write to (e.g. one delegated to the fuzzer's user),
+//with no processes of its own.
+struct target_cgroup {
+  char * parent;       //The cgroup directory the worker's group is created in, or NULL to not use a cgroup
+  char * cpus;         //The group's cpuset.cpus, e.g. "2-3", or NULL to not restrict its CPUs
+  int memory_max;      //The group's memory.max in megabytes, or 0 for no limit
+  int pids_max;        //The group's pids.max, or 0 for no limit
+  char * path;         //The worker's group, once it's been created
+  uint64_t oom_kills;  //The group's oom_kill count from memory.events, when it was last read
+};
+typedef struct target_cgroup target_cgroup_t;
+
 struct forkserver {
   int fuzzer_to_forksrv;
   int forksrv_to_fuzzer;
-  int target_stdin;
+  int target_stdin;                   //The file or stream stdin pipe that the target reads its stdin from, or -1
+  int stream_stdin;                   //Whether the target's stdin is a stream of framed inputs, rather than a file
+  int stdin_stream;                   //In stream stdin mode, the fuzzer's end of the target's stdin pipe, or -1
   int sent_get_status;
   int last_status;
   int pid;
+  int target_pid;                     //The pid of the last target process the fork server started
+  int hello;                          //The hello message the forkserver sent when it started
+  int snapshot;                       //Whether persistence mode children should use snapshot mode
+  int adaptive_persistence;           //Whether the fork server should tune the persistence max_cnt
+  char * init_function;               //The function to start the fork server library at, rather than main
+  int init_marker;                    //Whether the fork server library should wait for KILLERBEEZ_INIT()
+  int input_shm_id;                   //The SHM id of the input channel
+  forkserver_shm_input_t * input_shm; //The input channel, or NULL if inputs aren't passed via SHM
+  int num_channels;                   //While a concurrent mode fork server starts, its number of channels
+  int * channel_fds;                  //While a concurrent mode fork server starts, the fds of channels 1 and up
+  target_cgroup_t * cgroup;           //The cgroup the fork server is started in, or NULL
 };
 typedef struct forkserver forkserver_t;
 
@@ -35,10 +119,109 @@ typedef struct forkserver forkserver_t;
 //commands listed above
 void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int use_forkserver_library,
   int persistence_max_cnt, int needs_stdin_fd);
+void fork_server_init_concurrent(forkserver_t * channels, int num_channels, char * target_path, char ** argv,
+  int use_forkserver_library, int needs_stdin_fd);
 int fork_server_exit(forkserver_t * fs);
 int fork_server_fork(forkserver_t * fs);
 int fork_server_fork_run(forkserver_t * fs);
 int fork_server_run(forkserver_t * fs);
 int fork_server_get_status(forkserver_t * fs, int wait);
+int fork_server_get_max_cnt(forkserver_t * fs);
+int fork_server_get_max_rss(forkserver_t * fs);
 int fork_server_get_pending_status(forkserver_t * fs, int wait);
+int fork_server_wait_for_status(forkserver_t * fs, int timeout_ms);
+
+//These functions implement snapshot mode in the fork server library
+void forkserver_snapshot_init(volatile int * max_cnt);
+void forkserver_snapshot_exit(void);
+
+//These functions manage the shared memory input channel
+int fork_server_setup_input_shm(forkserver_t * fs, size_t max_length);
+int fork_server_write_input(forkserver_t * fs, char * input, size_t length);
+void fork_server_cleanup_input_shm(forkserver_t * fs);
+
+//In desocket mode, the fork server library replaces the target's sockets on
+//the port named in DESOCKET_ENV_VAR with socket pairs, and the input is a
+//series of messages to feed through them.  Each message is a
+//desocket_message_t header followed by the message's data.
+struct desocket_message {
+  uint32_t length; //The length of the data following this header
+};
+typedef struct desocket_message desocket_message_t;
+
+//These functions implement desocket mode's prefix snapshots in the fork
+//server library (see forkserver.c)
+size_t forkserver_prefix_length(const char * input, size_t length);
+int forkserver_prefix_snapshot(void);
+
+//The breakpoint instrumentation's shared memory region.  The fork server
+//library puts a breakpoint at each of the listed basic block addresses that
+//hasn't been hit yet.  The first child to hit a block marks it in hit[] and
+//appends its index to hit_list[], and the fork server removes the block's
+//breakpoint before forking the next child, so each block only traps once.
+//The region is a breakpoint_shm_t header followed by the arrays:
+//  uint64_t addresses[num_blocks]; //Sorted, relative to the executable's load address
+//  uint32_t hit_list[num_blocks];  //The blocks in the order they were first hit
+//  uint8_t hit[num_blocks];        //Whether each block has been hit
+struct breakpoint_shm {
+  uint32_t num_blocks;
+  volatile uint32_t num_hits; //The number of entries in hit_list
+};
+typedef struct breakpoint_shm breakpoint_shm_t;
+#define BREAKPOINT_SHM_ADDRESSES(shm) ((uint64_t *)((char *)(shm) + sizeof(breakpoint_shm_t)))
+#define BREAKPOINT_SHM_HIT_LIST(shm)  ((volatile uint32_t *)(BREAKPOINT_SHM_ADDRESSES(shm) + (shm)->num_blocks))
+#define BREAKPOINT_SHM_HIT(shm)       ((volatile uint8_t *)(BREAKPOINT_SHM_HIT_LIST(shm) + (shm)->num_blocks))
+#define BREAKPOINT_SHM_SIZE(num_blocks) \
+  (sizeof(breakpoint_shm_t) + (size_t)(num_blocks) * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t)))
+
+//These functions implement the breakpoint instrumentation in the fork server library
+void forkserver_breakpoints_init(void);
+void forkserver_breakpoints_update(void);
+
+//These functions manage a worker's target cgroup.  target_cgroup_oom_killed returns
+//whether the OOM killer has killed a process in the group since it was last called.
+int target_cgroup_create(target_cgroup_t * cgroup);
+int target_cgroup_enter(target_cgroup_t * cgroup);
+int target_cgroup_oom_killed(target_cgroup_t * cgroup);
+void target_cgroup_cleanup(target_cgroup_t * cgroup);
+
+//These functions manage the files targets read their stdin from
+int create_stdin_file(void);
+int write_stdin_file(int fd, char * input, size_t length);
+
+//In stream stdin mode, the target's stdin is one long-lived pipe that every
+//run's input is written to, rather than a file that is rewritten and rewound,
+//so a persistent target can read an input per iteration and never sees EOF.
+//Each input is a stdin_frame_t header followed by the input, and the target
+//reads them with KILLERBEEZ_READ_STDIN().  The whole frame must fit in the
+//pipe, since it's written before the target runs.
+#define STREAM_STDIN_PIPE_SIZE (1024 * 1024)
+struct stdin_frame {
+  uint32_t length; //The length of the input following this header
+};
+typedef struct stdin_frame stdin_frame_t;
+
+//These functions manage the stream stdin pipe
+int create_stdin_stream(int * stream_fd);
+int write_stdin_frame(int target_stdin, int stream_fd, char * input, size_t length);
+
+//A target that is started without the fork server.  The command line is only
+//split when it changes, and each process is started with posix_spawn, which
+//doesn't copy the fuzzer's address space the way fork does.  Unlike the fork
+//server's children, each process links itself from scratch, so when
+//lazy_binding is turned on, a LD_BIND_NOW that the user exported is left out
+//of its environment, and the dynamic linker only resolves the functions the
+//target calls.
+struct spawn_target {
+  char * cmd_line;   //The command line that executable and argv were split from
+  char * executable;
+  char ** argv;
+  int stdin_fd;      //The file the targets' stdin is read from, or 0 until it's created
+  int lazy_binding;  //Whether the targets are started without the user's LD_BIND_NOW
+};
+typedef struct spawn_target spawn_target_t;
+
+int spawn_target_process(spawn_target_t * target, char * cmd_line, char * input, size_t input_length,
+  pid_t * process_out);
+void spawn_target_cleanup(spawn_target_t * target);
 
@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "forkserver_internal.h"
+
+//////////////////////////////////////////////////////////////
+//Snapshot Mode //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//Snapshot mode is persistence mode for targets that don't call
+//KILLERBEEZ_LOOP().  The persistence mode child takes a snapshot of its
+//writable memory when the fork server starts it, and each time the target
+//exits, the snapshot is restored and the child stops to wait for the next
+//input, rather than exiting.  The kernel's soft dirty page tracking is used to
+//find the pages written since the snapshot, so only those are copied back.
+//Mappings created since the snapshot are unmapped, the heap is shrunk back,
+//and files opened since the snapshot are closed.  Other process state (signal
+//handlers, threads, timers, etc) is not restored, so snapshot mode is only
+//suitable for single threaded targets that don't rely on it.
+
+#define SNAPSHOT_MAX_REGIONS    1024
+#define SNAPSHOT_MAX_FDS        256
+#define SNAPSHOT_FD_BASE        800               //Where the snapshot keeps its copies of the target's file descriptors
+#define SNAPSHOT_MAPS_SIZE      (1024 * 1024)     //Room for /proc/self/maps
+#define SNAPSHOT_STACK_SIZE     (256 * 1024)      //The stack used while restoring the target's stack
+#define SNAPSHOT_PAGEMAP_BATCH  512               //The number of /proc/self/pagemap entries read at once
+#define PAGEMAP_SOFT_DIRTY      (1ULL << 55)
+
+struct snapshot_range {
+  uintptr_t start;
+  uintptr_t end;
+};
+
+struct snapshot_region {
+  uintptr_t start;
+  uintptr_t end;
+  int prot;
+  char * copy; //The region's contents when the snapshot was taken
+};
+
+struct mapping {
+  uintptr_t start;
+  uintptr_t end;
+  int prot;
+  int shared;
+  int special; //[vvar], [vdso], and [vsyscall] can't be copied or unmapped
+  int stack;   //The stack grows on demand, so it's never unmapped
+};
+
+//All of the snapshot's bookkeeping lives in its own mapping, which is left out
+//of the snapshot, so it survives restoring the target's memory
+struct snapshot {
+  ucontext_t context;         //Where execution resumes after the snapshot has been restored
+  ucontext_t restore_context; //Runs restore_snapshot on the snapshot's own stack
+  int taken;
+  int iterations;
+  volatile int * max_cnt;
+  int soft_dirty;             //Whether the kernel tracks soft dirty pages
+  size_t page_size;
+  uintptr_t brk;
+
+  struct snapshot_region regions[SNAPSHOT_MAX_REGIONS]; //The writable regions that are restored
+  size_t num_regions;
+  struct snapshot_range mapped[SNAPSHOT_MAX_REGIONS];   //Every mapping when the snapshot was taken, sorted
+  size_t num_mapped;
+  char * copies;
+  size_t copies_size;
+
+  int fds[SNAPSHOT_MAX_FDS];       //The target's open file descriptors when the snapshot was taken
+  int saved_fds[SNAPSHOT_MAX_FDS]; //Duplicates of those file descriptors, to restore them from
+  size_t num_fds;
+  int pagemap_fd;
+  int clear_refs_fd;
+
+  volatile char probe;
+  uint64_t pagemap[SNAPSHOT_PAGEMAP_BATCH];
+  char maps[SNAPSHOT_MAPS_SIZE];
+  char stack[SNAPSHOT_STACK_SIZE];
+};
+
+static struct snapshot * snapshot = NULL;
+
+//////////////////////////////////////////////////////////////
+//Helpers ////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//These helpers run while the target's memory is being restored, so they can't
+//allocate memory or use any other libc state.
+
+static void __attribute__((noreturn)) exit_process(int status)
+{
+  syscall(SYS_exit_group, status);
+  while(1);
+}
+
+static uintptr_t parse_hex(char ** str)
+{
+  uintptr_t value = 0;
+  char * p = *str;
+
+  for(;; p++) {
+    if(*p >= '0' && *p <= '9')
+      value = (value << 4) | (*p - '0');
+    else if(*p >= 'a' && *p <= 'f')
+      value = (value << 4) | (*p - 'a' + 10);
+    else
+      break;
+  }
+  *str = p;
+  return value;
+}
+
+/**
+ * This function reads /proc/self/maps into the snapshot's buffer
+ * @return - the length of the maps file, or 0 on failure
+ */
+static size_t read_maps(void)
+{
+  size_t length = 0;
+  ssize_t result;
+  int fd;
+
+  fd = open("/proc/self/maps", O_RDONLY);
+  if(fd < 0)
+    return 0;
+  while(length < sizeof(snapshot->maps) - 1) {
+    result = read(fd, snapshot->maps + length, sizeof(snapshot->maps) - 1 - length);
+    if(result <= 0)
+      break;
+    length += result;
+  }
+  close(fd);
+  snapshot->maps[length] = 0;
+  return length;
+}
+
+/**
+ * This function parses a line of /proc/self/maps
+ * @param line - the line to parse
+ * @param mapping - a pointer used to return the parsed mapping
+ * @return - a pointer to the next line, or NULL if there are no more lines
+ */
+static char * parse_mapping(char * line, struct mapping * mapping)
+{
+  char * p = line;
+
+  if(!*p)
+    return NULL;
+
+  mapping->start = parse_hex(&p);
+  p++; //the '-'
+  mapping->end = parse_hex(&p);
+  p++; //the ' '
+  mapping->prot = (p[0] == 'r' ? PROT_READ : 0) | (p[1] == 'w' ? PROT_WRITE : 0) | (p[2] == 'x' ? PROT_EXEC : 0);
+  mapping->shared = p[3] == 's';
+
+  while(*p && *p != '\n' && *p != '[')
+    p++;
+  mapping->stack = !strncmp(p, "[stack]", 7);
+  mapping->special = *p == '[' && strncmp(p, "[heap]", 6) && !mapping->stack;
+
+  while(*p && *p != '\n')
+    p++;
+  return *p ? p + 1 : p;
+}
+
+/**
+ * This function lists the target process's open file descriptors
+ * @param fds - an array used to return the file descriptors
+ * @param max_fds - the size of the fds array
+ * @return - the number of file descriptors, or -1 on failure
+ */
+static int list_fds(int * fds, int max_fds)
+{
+  char buffer[4096];
+  long length, offset;
+  int dir_fd, count = 0, fd;
+  struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  } * entry;
+
+  dir_fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY);
+  if(dir_fd < 0)
+    return -1;
+  while((length = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer))) > 0) {
+    for(offset = 0; offset < length; offset += entry->d_reclen) {
+      entry = (struct linux_dirent64 *)(buffer + offset);
+      if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        continue;
+      fd = atoi(entry->d_name);
+      if(fd != dir_fd && count < max_fds)
+        fds[count++] = fd;
+    }
+  }
+  close(dir_fd);
+  return count;
+}
+
+static int is_snapshot_fd(int fd)
+{
+  size_t i;
+
+  if(fd == snapshot->pagemap_fd || fd == snapshot->clear_refs_fd)
+    return 1;
+  for(i = 0; i < snapshot->num_fds; i++) {
+    if(fd == snapshot->fds[i] || fd == snapshot->saved_fds[i])
+      return 1;
+  }
+  return 0;
+}
+
+static void clear_soft_dirty(void)
+{
+  if(write(snapshot->clear_refs_fd, "4", 1) != 1)
+    snapshot->soft_dirty = 0;
+}
+
+/**
+ * This function adds a mapping to the sorted list of mappings in the snapshot
+ * @param start - the start of the mapping
+ * @param end - the end of the mapping
+ * @return - 0 on success, non-zero if there are too many mappings
+ */
+static int add_mapped_range(uintptr_t start, uintptr_t end)
+{
+  size_t i;
+
+  if(snapshot->num_mapped == SNAPSHOT_MAX_REGIONS)
+    return 1;
+  for(i = snapshot->num_mapped; i > 0 && snapshot->mapped[i - 1].start > start; i--)
+    snapshot->mapped[i] = snapshot->mapped[i - 1];
+  snapshot->mapped[i].start = start;
+  snapshot->mapped[i].end = end;
+  snapshot->num_mapped++;
+  return 0;
+}
+
+/**
+ * This function adds a writable region to the snapshot, leaving out the snapshot's own bookkeeping
+ * @param start - the start of the region
+ * @param end - the end of the region
+ * @param prot - the region's memory protections
+ * @return - 0 on success, non-zero if there are too many regions
+ */
+static int add_region(uintptr_t start, uintptr_t end, int prot)
+{
+  uintptr_t excluded_start = (uintptr_t)snapshot;
+  uintptr_t excluded_end = excluded_start + sizeof(struct snapshot);
+
+  if(start < excluded_end && excluded_start < end) {
+    if(start < excluded_start && add_region(start, excluded_start, prot))
+      return 1;
+    return excluded_end < end ? add_region(excluded_end, end, prot) : 0;
+  }
+
+  if(snapshot->num_regions == SNAPSHOT_MAX_REGIONS)
+    return 1;
+  snapshot->regions[snapshot->num_regions].start = start;
+  snapshot->regions[snapshot->num_regions].end = end;
+  snapshot->regions[snapshot->num_regions].prot = prot;
+  snapshot->num_regions++;
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////
+//Taking and Restoring Snapshots /////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function records the target's writable memory, mappings, heap size, and open files
+ * @return - 0 on success, non-zero on failure
+ */
+static int take_snapshot(void)
+{
+  struct mapping mapping;
+  char * line;
+  size_t i, offset;
+  int fds[SNAPSHOT_MAX_FDS], num_fds;
+
+  snapshot->brk = (uintptr_t)syscall(SYS_brk, 0);
+
+  if(!read_maps())
+    return 1;
+  for(line = snapshot->maps; (line = parse_mapping(line, &mapping)) != NULL; ) {
+    if(add_mapped_range(mapping.start, mapping.end))
+      return 1;
+    if((mapping.prot & (PROT_READ | PROT_WRITE)) == (PROT_READ | PROT_WRITE) && !mapping.shared && !mapping.special) {
+      if(add_region(mapping.start, mapping.end, mapping.prot))
+        return 1;
+    }
+  }
+
+  //Copy the writable regions
+  for(i = 0; i < snapshot->num_regions; i++)
+    snapshot->copies_size += snapshot->regions[i].end - snapshot->regions[i].start;
+  snapshot->copies = mmap(NULL, snapshot->copies_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(snapshot->copies == MAP_FAILED)
+    return 1;
+  if(add_mapped_range((uintptr_t)snapshot->copies, (uintptr_t)snapshot->copies + snapshot->copies_size))
+    return 1;
+  for(i = 0, offset = 0; i < snapshot->num_regions; i++) {
+    snapshot->regions[i].copy = snapshot->copies + offset;
+    memcpy(snapshot->regions[i].copy, (void *)snapshot->regions[i].start, snapshot->regions[i].end - snapshot->regions[i].start);
+    offset += snapshot->regions[i].end - snapshot->regions[i].start;
+  }
+
+  //Keep a duplicate of each open file descriptor, so they can be restored if the target closes them
+  num_fds = list_fds(fds, SNAPSHOT_MAX_FDS);
+  if(num_fds < 0)
+    return 1;
+  for(i = 0; i < num_fds; i++) {
+    if(fds[i] == snapshot->pagemap_fd || fds[i] == snapshot->clear_refs_fd)
+      continue;
+    snapshot->fds[snapshot->num_fds] = fds[i];
+    snapshot->saved_fds[snapshot->num_fds] = fcntl(fds[i], F_DUPFD_CLOEXEC, SNAPSHOT_FD_BASE);
+    if(snapshot->saved_fds[snapshot->num_fds] < 0)
+      return 1;
+    snapshot->num_fds++;
+  }
+
+  //Check that the kernel tracks soft dirty pages, by writing to a page after clearing them
+  snapshot->soft_dirty = 1;
+  clear_soft_dirty();
+  snapshot->probe = 1;
+  offset = ((uintptr_t)&snapshot->probe / snapshot->page_size) * sizeof(uint64_t);
+  if(!snapshot->soft_dirty || pread(snapshot->pagemap_fd, snapshot->pagemap, sizeof(uint64_t), offset) != sizeof(uint64_t)
+      || !(snapshot->pagemap[0] & PAGEMAP_SOFT_DIRTY))
+    snapshot->soft_dirty = 0;
+  clear_soft_dirty();
+  return 0;
+}
+
+/**
+ * This function unmaps any part of a mapping that didn't exist when the snapshot was taken
+ * @param mapping - the mapping to check
+ */
+static void unmap_new_memory(struct mapping * mapping)
+{
+  uintptr_t position = mapping->start;
+  size_t i;
+
+  for(i = 0; i < snapshot->num_mapped && position < mapping->end; i++) {
+    if(snapshot->mapped[i].end <= position)
+      continue;
+    if(snapshot->mapped[i].start >= mapping->end)
+      break;
+    if(snapshot->mapped[i].start > position)
+      munmap((void *)position, snapshot->mapped[i].start - position);
+    position = snapshot->mapped[i].end;
+  }
+  if(position < mapping->end)
+    munmap((void *)position, mapping->end - position);
+}
+
+/**
+ * This function copies the pages of a region that have been written since the snapshot was taken back from the snapshot
+ * @param region - the region to restore
+ * @param all - whether to restore every page, rather than only the dirty ones
+ */
+static void restore_region(struct snapshot_region * region, int all)
+{
+  size_t num_pages, batch, i, page, page_size = snapshot->page_size;
+  uintptr_t start = region->start;
+
+  if(all || !snapshot->soft_dirty) {
+    memcpy((void *)region->start, region->copy, region->end - region->start);
+    return;
+  }
+
+  num_pages = (region->end - region->start) / page_size;
+  for(page = 0; page < num_pages; page += batch) {
+    batch = num_pages - page < SNAPSHOT_PAGEMAP_BATCH ? num_pages - page : SNAPSHOT_PAGEMAP_BATCH;
+    if(pread(snapshot->pagemap_fd, snapshot->pagemap, batch * sizeof(uint64_t),
+        ((start / page_size) + page) * sizeof(uint64_t)) != batch * sizeof(uint64_t)) {
+      memcpy((void *)(start + page * page_size), region->copy + page * page_size, (num_pages - page) * page_size);
+      return;
+    }
+    for(i = 0; i < batch; i++) {
+      if(snapshot->pagemap[i] & PAGEMAP_SOFT_DIRTY)
+        memcpy((void *)(start + (page + i) * page_size), region->copy + (page + i) * page_size, page_size);
+    }
+  }
+}
+
+/**
+ * This function restores the target's memory, heap, and open files to the snapshot, and then resumes execution
+ * where the snapshot was taken.  It runs on the snapshot's own stack, since the target's stack is restored too.
+ */
+static void restore_snapshot(void)
+{
+  struct mapping mapping;
+  char * line;
+  size_t i, covered;
+  int fds[SNAPSHOT_MAX_FDS], num_fds, j, remapped;
+
+  //Shrink the heap back, and unmap anything mapped since the snapshot
+  syscall(SYS_brk, snapshot->brk);
+  if(!read_maps())
+    exit_process(1);
+  for(line = snapshot->maps; (line = parse_mapping(line, &mapping)) != NULL; ) {
+    if(!mapping.special && !mapping.stack)
+      unmap_new_memory(&mapping);
+  }
+
+  //Restore the writable regions, remapping any that the target unmapped or made read only
+  read_maps();
+  for(i = 0; i < snapshot->num_regions; i++) {
+    covered = 0;
+    for(line = snapshot->maps; (line = parse_mapping(line, &mapping)) != NULL; ) {
+      if(mapping.start < snapshot->regions[i].end && snapshot->regions[i].start < mapping.end
+          && (mapping.prot & PROT_WRITE) && !mapping.shared) {
+        covered += (mapping.end < snapshot->regions[i].end ? mapping.end : snapshot->regions[i].end)
+          - (mapping.start > snapshot->regions[i].start ? mapping.start : snapshot->regions[i].start);
+      }
+    }
+    remapped = covered != snapshot->regions[i].end - snapshot->regions[i].start;
+    if(remapped && mmap((void *)snapshot->regions[i].start, snapshot->regions[i].end - snapshot->regions[i].start,
+        snapshot->regions[i].prot, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+      exit_process(1);
+    restore_region(&snapshot->regions[i], remapped);
+  }
+
+  //Close any files opened since the snapshot, and put back any that were closed or replaced
+  num_fds = list_fds(fds, SNAPSHOT_MAX_FDS);
+  for(j = 0; j < num_fds; j++) {
+    if(!is_snapshot_fd(fds[j]))
+      close(fds[j]);
+  }
+  for(i = 0; i < snapshot->num_fds; i++)
+    dup2(snapshot->saved_fds[i], snapshot->fds[i]);
+
+  clear_soft_dirty();
+  setcontext(&snapshot->context);
+  exit_process(1); //setcontext only returns on failure
+}
+
+//////////////////////////////////////////////////////////////
+//Fork Server Interface //////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function takes a snapshot of the persistence mode child, and then waits for the fork server to tell it to run.
+ * It returns once for each input, until max_cnt inputs have been run and the child exits.  If the snapshot can't be
+ * taken, it returns without one, and the target runs as an ordinary forked child.
+ * @param max_cnt - the maximum number of inputs to run before exiting, which the fork server may change while
+ * the child runs
+ */
+void forkserver_snapshot_init(volatile int * max_cnt)
+{
+  snapshot = mmap(NULL, sizeof(struct snapshot), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(snapshot == MAP_FAILED) {
+    snapshot = NULL;
+    return;
+  }
+  snapshot->max_cnt = max_cnt;
+  snapshot->page_size = sysconf(_SC_PAGESIZE);
+  snapshot->pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  snapshot->clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+
+  getcontext(&snapshot->context);
+  if(!snapshot->taken) {
+    if(snapshot->pagemap_fd < 0 || snapshot->clear_refs_fd < 0 || take_snapshot()) {
+      //Run without a snapshot, which lets the child exit normally after one input
+      snapshot = NULL;
+      raise(SIGSTOP);
+      return;
+    }
+    snapshot->taken = 1;
+  }
+
+  //Each time the snapshot is restored, execution resumes here.  Tell the fork server we're ready for the next
+  //input, and exit once the maximum number of inputs have been run.
+  raise(SIGSTOP);
+  if(snapshot->iterations++ == *snapshot->max_cnt)
+    exit_process(0);
+}
+
+/**
+ * This function restores the snapshot when the target exits, if snapshot mode is in use.  Otherwise it returns.
+ */
+void forkserver_snapshot_exit(void)
+{
+  if(!snapshot || !snapshot->taken)
+    return;
+
+  //Switch to the snapshot's stack, since restoring the target's stack would overwrite this function's frame
+  getcontext(&snapshot->restore_context);
+  snapshot->restore_context.uc_stack.ss_sp = snapshot->stack;
+  snapshot->restore_context.uc_stack.ss_size = sizeof(snapshot->stack);
+  snapshot->restore_context.uc_link = NULL;
+  makecontext(&snapshot->restore_context, restore_snapshot, 0);
+  setcontext(&snapshot->restore_context);
+}
+
+//Hook the target's calls to exit() and _exit(), so they restore the snapshot instead
+void exit(int status)
+{
+  static void (*orig_exit)(int) = NULL;
+
+  forkserver_snapshot_exit();
+  if(!orig_exit)
+    orig_exit = (void (*)(int))dlsym(RTLD_NEXT, "exit");
+  orig_exit(status);
+  exit_process(status);
+}
+
+void _exit(int status)
+{
+  forkserver_snapshot_exit();
+  exit_process(status);
+}
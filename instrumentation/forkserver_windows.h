@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Windows.h>
+
+//Windows has no fork(), so the Windows fork server clones a template process
+//instead.  The template is started under a debugger and run until it reaches
+//the clone point, where it's left stopped in its breakpoint's debug event.
+//Each input is then tested in a clone of the template's address space and
+//handles, which starts at the clone point in a copy of the thread that hit the
+//breakpoint.  Just like fork(), the template's other threads aren't copied.
+//The clones are never registered with the Windows subsystem (csrss), so the
+//clone point should be after the target's startup and before it opens its
+//input file, and the target shouldn't create windows or consoles afterwards.
+
+struct win_forkserver {
+  HANDLE process;    //The template process
+  HANDLE thread;     //The template thread that hit the clone point
+  CONTEXT context;   //The template thread's context at the clone point
+  void * stack_base; //The template thread's TEB fields that the clone's
+  void * stack_limit;//thread needs to run on the template thread's stack
+  void * deallocation_stack;
+  void * tls_pointer;
+  void * tls_slots[TLS_MINIMUM_AVAILABLE];
+};
+typedef struct win_forkserver win_forkserver_t;
+
+int win_fork_server_init(win_forkserver_t * fs, HANDLE process, DWORD thread_id, void * clone_address);
+int win_fork_server_fork(win_forkserver_t * fs, HANDLE * process_out);
+void win_fork_server_exit(win_forkserver_t * fs);
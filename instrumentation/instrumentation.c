@@ -2,20 +2,31 @@
 //Headers necessary for the forkserver
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/resource.h>
+#include <sys/shm.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <signal.h>
+#include <spawn.h>
+#ifdef __linux__
+#include <linux/memfd.h>
+#endif
 #endif
 
 #include "instrumentation.h"
 #include <utils.h>
+#include <uring.h>
+#include <tracepoints.h>
 
 
 #ifndef _WIN32
@@ -23,10 +34,6 @@
 
 #include "forkserver_internal.h"
 
-#define STRINGIFY_INTERNAL(x) #x
-#define STRINGIFY(x) STRINGIFY_INTERNAL(x)
-#define MSAN_ERROR 86
-
 //The amount of time to wait before considering the fork server initialization failed
 #define FORK_SERVER_STARTUP_TIME 10
 
@@ -61,6 +68,58 @@ static void find_fork_server_library(char * buffer, size_t buffer_len)
 //////////////////////////////////////////////////////////////
 // Fork Server Initialization ////////////////////////////////
 //////////////////////////////////////////////////////////////
+
+//The number of fds each concurrent mode channel has in forkserver_t's channel_fds: the fork server's end of the
+//command pipe, its end of the status pipe, the stdin file (or -1), and the fuzzer's ends of the two pipes
+#define CHANNEL_FDS 5
+
+/**
+ * This function moves the fork server's ends of a concurrent mode fork server's channels 1 and up above all of the
+ * fds the fork server expects, so that setting up the other fds can't overwrite them, and closes the fuzzer's ends.
+ * It's called in the fork server's process before exec, and place_channel_fds finishes the job.
+ * @param fs - the forkserver_t of channel 0, with the channels' fds
+ */
+static void raise_channel_fds(forkserver_t * fs)
+{
+  int i, j, moved, * fds;
+
+  for(i = 1; i < fs->num_channels; i++) {
+    fds = fs->channel_fds + CHANNEL_FDS * (i - 1);
+    close(fds[3]);
+    close(fds[4]);
+    for(j = 0; j < 3; j++) {
+      if(fds[j] < 0)
+        continue;
+      moved = fcntl(fds[j], F_DUPFD, FORKSRV_CHANNEL_FDS_END);
+      if(moved < 0)
+        FATAL_MSG("fcntl() failed");
+      close(fds[j]);
+      fds[j] = moved;
+    }
+  }
+}
+
+/**
+ * This function moves the fds of a concurrent mode fork server's channels 1 and up to where the fork server expects
+ * them (see FORKSRV_CHANNEL_FD), after raise_channel_fds has moved them out of the way
+ * @param fs - the forkserver_t of channel 0, with the channels' fds
+ */
+static void place_channel_fds(forkserver_t * fs)
+{
+  int i, j, * fds;
+
+  for(i = 1; i < fs->num_channels; i++) {
+    fds = fs->channel_fds + CHANNEL_FDS * (i - 1);
+    for(j = 0; j < 3; j++) {
+      if(fds[j] < 0)
+        continue;
+      if(dup2(fds[j], FORKSRV_CHANNEL_FD(i) + j) < 0)
+        FATAL_MSG("dup2() failed");
+      close(fds[j]);
+    }
+  }
+}
+
 /**
  *
  * @param needs_stdin_fd - whether we should open a library for the stdin of
@@ -132,6 +191,11 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
       DEBUG_MSG("Set memory limits");
     }
 
+    // Move into the worker's cgroup before anything else runs, so the target and
+    // everything it forks are always limited by it
+    if (fs && fs->cgroup && fs->cgroup->path && target_cgroup_enter(fs->cgroup))
+      FATAL_MSG("Couldn't move the target into the cgroup %s (errno=%d)", fs->cgroup->path, errno);
+
     // Dumping cores is slow and can lead to anomalies if SIGKILL is delivered
     // before the dump is complete.
 
@@ -143,6 +207,8 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
          specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
     setsid();
 
+    if(fs && fs->num_channels)
+      raise_channel_fds(fs);
     if(dev_null_fd < 0)
       dev_null_fd = open("/dev/null", O_RDWR);
     if(needs_stdin_fd) {
@@ -179,6 +245,8 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
 
     /* On Linux, would be faster to use O_CLOEXEC. Maybe TODO. */
     close(dev_null_fd);
+    if(fs && fs->num_channels)
+      place_channel_fds(fs);
     DEBUG_MSG("Setting up pipes is complete...");
 
     // If we are using a forksrv, we might need to inject it dynamically if it
@@ -198,10 +266,38 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
   #endif
       }
 
+      // Tell the forkserver library where to start, if it shouldn't start at main
+      if(use_forkserver_library && fs->init_function)
+        setenv(INIT_FUNCTION_VAR, fs->init_function, 1);
+      if(use_forkserver_library && fs->init_marker)
+        setenv(INIT_MARKER_VAR, "1", 1);
+
+      // Tell the forkserver where to find the input channel, if we're using one
+      if(fs->input_shm) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%d", fs->input_shm_id);
+        setenv(SHM_INPUT_ENV_VAR, buffer, 1);
+      }
+
+      // Tell the target to read framed inputs from its stdin, if it's a stream
+      if(needs_stdin_fd && fs->stdin_stream != -1)
+        setenv(STREAM_STDIN_ENV_VAR, "1", 1);
+
+      // Tell the forkserver how many channels to serve, if it's in concurrent mode
+      if(fs->num_channels) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%d", fs->num_channels);
+        setenv(CONCURRENT_ENV_VAR, buffer, 1);
+      }
+
       if(persistence_max_cnt) {
         char buffer[16];
         snprintf(buffer, sizeof(buffer),"%d",persistence_max_cnt);
         setenv(PERSIST_MAX_VAR, buffer, 1);
+        if(fs->snapshot)
+          setenv(SNAPSHOT_ENV_VAR, "1", 1);
+        if(fs->adaptive_persistence)
+          setenv(PERSIST_ADAPTIVE_VAR, "1", 1);
       }
 
       // This should improve performance a bit, since it stops the linker from
@@ -209,26 +305,8 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
       if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
     }
 
-    // Set sane defaults for ASAN if nothing else specified.
-    setenv("ASAN_OPTIONS", "abort_on_error=1:"
-                           "detect_leaks=0:"
-                           "symbolize=0:"
-                           "allocator_may_return_null=1", 0);
-
-    // MSAN uses slightly different arguments when using the forkserver
-    if(fs) {
-      // MSAN is tricky, because it doesn't support abort_on_error=1 at this
-      // point. So, we do this in a very hacky way.
-      setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                             "symbolize=0:"
-                             "abort_on_error=1:"
-                             "allocator_may_return_null=1:"
-                             "msan_track_origins=0", 0);
-    } else {
-      setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                             "symbolize=0:"
-                             "msan_track_origins=0", 0);
-    }
+    // Set the sanitizers' options, if nothing else specified
+    set_sanitizer_options();
 
     DEBUG_MSG("Setup done, about to execv: %s", target_path);
     execv(target_path, argv);
@@ -257,7 +335,6 @@ void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int u
   int st_pipe[2], ctl_pipe[2];
   int err, status, forksrv_pid;
   int rlen = -1, timed_out = 1;
-  char stdin_filename[100];
   time_t start_time;
 
   if(dev_null_fd < 0) {
@@ -269,9 +346,13 @@ void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int u
   fs->sent_get_status = 0;
   fs->last_status = -1;
 
-  if(needs_stdin_fd) {
-    strncpy(stdin_filename, "/tmp/fuzzfileXXXXXX", sizeof(stdin_filename));
-    fs->target_stdin = mkstemp(stdin_filename);
+  fs->stdin_stream = -1;
+  if(needs_stdin_fd && fs->stream_stdin) {
+    fs->target_stdin = create_stdin_stream(&fs->stdin_stream);
+    if(fs->target_stdin < 0)
+      FATAL_MSG("Couldn't make the stdin pipe\n");
+  } else if(needs_stdin_fd) {
+    fs->target_stdin = create_stdin_file();
     if(fs->target_stdin < 0)
       FATAL_MSG("Couldn't make temp file\n");
   }
@@ -332,7 +413,8 @@ void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int u
   // If we have a four-byte "hello" message from the server, we're all set.
   // Otherwise, try to figure out what went wrong.
   if (rlen == 4) {
-    DEBUG_MSG("All right - fork server (PID %d) is up.", forksrv_pid);
+    fs->hello = status;
+    DEBUG_MSG("All right - fork server (PID %d) is up (hello 0x%08x).", forksrv_pid, status);
     return;
   }
 
@@ -453,6 +535,72 @@ void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int u
   FATAL_MSG("Fork server handshake failed");
 }
 
+/**
+ * This function starts a program with a concurrent mode fork server embedded in it.  The fork server serves several
+ * channels, each of which has at most one child at a time, but the channels' children run in parallel, so the
+ * target's initialization is only paid for once.  Each channel is used through its own forkserver_t, with the same
+ * functions as a normal fork server, and the channels must not be shared between threads.  Persistence mode isn't
+ * supported in concurrent mode.
+ * @param channels - an array of num_channels forkserver_t structures for the channels.  The first one is set up the
+ * same way as with fork_server_init, including its init_function and init_marker options.
+ * @param num_channels - the number of channels, at most MAX_CONCURRENT_CHANNELS
+ * @param target_path - The path to the program to start
+ * @param argv - Arguments to pass to the program
+ * @param use_forkserver_library - Whether or not to use LD_PRELOAD/DYLD_INSERT_LIBRARIES to inject the fork server
+ * library or not
+ * @param needs_stdin_fd - whether each channel needs a file for the stdin of its children
+ */
+void fork_server_init_concurrent(forkserver_t * channels, int num_channels, char * target_path, char ** argv,
+  int use_forkserver_library, int needs_stdin_fd)
+{
+  int st_pipe[2], ctl_pipe[2];
+  int i, * fds;
+
+  if(num_channels < 1 || num_channels > MAX_CONCURRENT_CHANNELS)
+    FATAL_MSG("A concurrent fork server must have between 1 and %d channels", MAX_CONCURRENT_CHANNELS);
+
+  fds = (int *)malloc(sizeof(int) * CHANNEL_FDS * num_channels);
+  if(!fds)
+    FATAL_MSG("Couldn't allocate the fork server channels");
+  for(i = 1; i < num_channels; i++) {
+    if(pipe(st_pipe) || pipe(ctl_pipe))
+      FATAL_MSG("pipe() failed");
+    channels[i].fuzzer_to_forksrv = ctl_pipe[1];
+    channels[i].forksrv_to_fuzzer = st_pipe[0];
+    channels[i].sent_get_status = 0;
+    channels[i].last_status = -1;
+    channels[i].target_pid = 0;
+    channels[i].target_stdin = -1;
+    channels[i].stdin_stream = -1;
+    if(needs_stdin_fd) {
+      channels[i].target_stdin = create_stdin_file();
+      if(channels[i].target_stdin < 0)
+        FATAL_MSG("Couldn't make temp file\n");
+    }
+    fds[CHANNEL_FDS * (i - 1)] = ctl_pipe[0];
+    fds[CHANNEL_FDS * (i - 1) + 1] = st_pipe[1];
+    fds[CHANNEL_FDS * (i - 1) + 2] = channels[i].target_stdin;
+    fds[CHANNEL_FDS * (i - 1) + 3] = ctl_pipe[1];
+    fds[CHANNEL_FDS * (i - 1) + 4] = st_pipe[0];
+  }
+
+  channels[0].num_channels = num_channels;
+  channels[0].channel_fds = fds;
+  fork_server_init(&channels[0], target_path, argv, use_forkserver_library, 0, needs_stdin_fd);
+  channels[0].num_channels = 0;
+  channels[0].channel_fds = NULL;
+
+  //Close the fork server's ends of the other channels
+  for(i = 1; i < num_channels; i++) {
+    close(fds[CHANNEL_FDS * (i - 1)]);
+    close(fds[CHANNEL_FDS * (i - 1) + 1]);
+    channels[i].pid = channels[0].pid;
+    channels[i].hello = channels[0].hello;
+  }
+  free(fds);
+  DEBUG_MSG("The fork server (PID %d) is serving %d channels", channels[0].pid, num_channels);
+}
+
 //////////////////////////////////////////////////////////////
 // Fork Server Communication Functions ///////////////////////
 //////////////////////////////////////////////////////////////
@@ -495,6 +643,8 @@ int fork_server_exit(forkserver_t * fs)
     close(fs->fuzzer_to_forksrv);
     close(fs->forksrv_to_fuzzer);
     close(fs->target_stdin);
+    if(fs->stdin_stream != -1)
+      close(fs->stdin_stream);
   }
   return ret;
 }
@@ -507,10 +657,17 @@ int fork_server_exit(forkserver_t * fs)
  */
 static int send_fork(forkserver_t * fs, char command)
 {
+  int pid;
+
   if(send_command(fs, command))
     return FORKSERVER_ERROR;
   fs->sent_get_status = 0;
-  return read_response(fs); //Wait for the target pid
+  pid = read_response(fs); //Wait for the target pid
+  if(pid > 0) {
+    fs->target_pid = pid;
+    TRACEPOINT_TARGET_SPAWNED(pid);
+  }
+  return pid;
 }
 
 /**
@@ -562,16 +719,16 @@ int fork_server_get_pending_status(forkserver_t * fs, int wait)
   if(fs->sent_get_status && fs->last_status != -1)
     return fs->last_status;
 
-  if(wait)
-    return read_response(fs); //Wait for the target's exit status
-  else {
+  if(!wait) {
     err = ioctl(fs->forksrv_to_fuzzer, FIONREAD, &bytes_available);
-    if(!err && bytes_available == sizeof(int)) {
-      fs->last_status = read_response(fs); //Wait for the target's exit status
-      return fs->last_status;
-    }
+    if(err || bytes_available != sizeof(int))
+      return FORKSERVER_NO_RESULTS_READY;
   }
-  return FORKSERVER_NO_RESULTS_READY;
+
+  fs->last_status = read_response(fs); //Wait for the target's exit status
+  if(fs->last_status != FORKSERVER_ERROR)
+    TRACEPOINT_TARGET_EXITED(fs->target_pid, fs->last_status);
+  return fs->last_status;
 }
 
 /**
@@ -592,4 +749,828 @@ int fork_server_get_status(forkserver_t * fs, int wait)
   return fork_server_get_pending_status(fs, wait);
 }
 
+/**
+ * This function asks a persistence mode fork server for the number of iterations it currently runs in each child,
+ * which changes over time in adaptive mode.  It can't be used while a GET_STATUS response is outstanding.
+ * @param fs - A forkserver_t structure to hold the fork server state
+ * @return - the fork server's current max_cnt on success, FORKSERVER_ERROR on failure
+ */
+int fork_server_get_max_cnt(forkserver_t * fs)
+{
+  if(fs->sent_get_status && fs->last_status == -1)
+    return FORKSERVER_ERROR;
+  if(send_command(fs, GET_MAX_CNT))
+    return FORKSERVER_ERROR;
+  return read_response(fs);
+}
+
+/**
+ * This function asks the fork server for the peak RSS of the child that GET_STATUS last reaped.  It can't be used
+ * while a GET_STATUS response is outstanding.
+ * @param fs - A forkserver_t structure to hold the fork server state
+ * @return - the child's peak RSS in kilobytes, 0 if the fork server doesn't know it, or FORKSERVER_ERROR on failure
+ */
+int fork_server_get_max_rss(forkserver_t * fs)
+{
+  if(!FORKSERVER_HELLO_HAS_MAX_RSS(fs->hello))
+    return 0;
+  if(fs->sent_get_status && fs->last_status == -1)
+    return FORKSERVER_ERROR;
+  if(send_command(fs, GET_MAX_RSS))
+    return FORKSERVER_ERROR;
+  return read_response(fs);
+}
+
+/**
+ * This function sends a GET_STATUS command to the fork server (if it has not already been sent) and blocks until
+ * either the fork server responds or the timeout expires.  Rather than repeatedly checking the status pipe, this
+ * function sleeps in poll() on the pipe, so it returns as soon as the target's exit status is available.
+ * @param fs - A forkserver_t structure to hold the fork server state
+ * @param timeout_ms - the maximum number of milliseconds to wait for the fork server's response
+ * @return - the finished process's exit status (see waitpid) on success, FORKSERVER_ERROR on failure, or
+ * FORKSERVER_NO_RESULTS_READY when the forkserver has not responded before the timeout
+ */
+int fork_server_wait_for_status(forkserver_t * fs, int timeout_ms)
+{
+  struct pollfd pfd;
+  int status, result;
+
+  status = fork_server_get_status(fs, 0);
+  if(status != FORKSERVER_NO_RESULTS_READY)
+    return status;
+
+  pfd.fd = fs->forksrv_to_fuzzer;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  result = poll(&pfd, 1, timeout_ms < 0 ? 0 : timeout_ms);
+  if(result < 0 && errno != EINTR)
+    return FORKSERVER_ERROR;
+  if(result <= 0)
+    return FORKSERVER_NO_RESULTS_READY;
+  if(pfd.revents & (POLLERR | POLLNVAL))
+    return FORKSERVER_ERROR;
+  status = fork_server_get_pending_status(fs, 0);
+  if(status == FORKSERVER_NO_RESULTS_READY && (pfd.revents & POLLHUP))
+    return FORKSERVER_ERROR; //The fork server went away without responding
+  return status;
+}
+
+//////////////////////////////////////////////////////////////
+// Shared Memory Input Channel ///////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function creates the pipe that targets read their stdin from in stream stdin mode.  The pipe is made as big
+ * as STREAM_STDIN_PIPE_SIZE if the system allows it, since each frame has to fit in it.  The fuzzer's end is
+ * non-blocking, so a frame that doesn't fit fails rather than waiting on a target that isn't running, and is
+ * closed on exec, so the target sees EOF if the fuzzer goes away.
+ * @param stream_fd - a pointer to an int that is set to the pipe's write end, which the fuzzer writes frames to
+ * @return - the pipe's read end, which is the target's stdin, or -1 on failure
+ */
+int create_stdin_stream(int * stream_fd)
+{
+  int fds[2];
+
+  if(pipe(fds))
+    return -1;
+  if(fcntl(fds[1], F_SETFL, O_NONBLOCK) || fcntl(fds[1], F_SETFD, FD_CLOEXEC)) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+#ifdef F_SETPIPE_SZ
+  if(fcntl(fds[1], F_SETPIPE_SZ, STREAM_STDIN_PIPE_SIZE) < 0)
+    WARNING_MSG("Couldn't raise the size of the stdin pipe, so large inputs may not fit (errno=%d)", errno);
+#endif
+  *stream_fd = fds[1];
+  return fds[0];
+}
+
+/**
+ * This function writes an input to the stream stdin pipe, as one frame.  Anything a previous target left in the
+ * pipe, such as the frame of a target that crashed or hung before its next read, is thrown away first, so the
+ * next target reads this frame.  It should be called before telling the fork server to run the target.
+ * @param target_stdin - the pipe's read end, returned by create_stdin_stream
+ * @param stream_fd - the pipe's write end, set by create_stdin_stream
+ * @param input - the input to write to the pipe
+ * @param length - the length of the input parameter
+ * @return - 0 on success, FORKSERVER_ERROR on failure
+ */
+int write_stdin_frame(int target_stdin, int stream_fd, char * input, size_t length)
+{
+  char buffer[4096];
+  stdin_frame_t frame;
+  struct iovec iov[2];
+  int pending = 0;
+  ssize_t result;
+
+  while(!ioctl(target_stdin, FIONREAD, &pending) && pending > 0) {
+    result = read(target_stdin, buffer, pending < (int)sizeof(buffer) ? pending : (int)sizeof(buffer));
+    if(result <= 0 && errno != EINTR)
+      return FORKSERVER_ERROR;
+  }
+
+  if(length > UINT32_MAX)
+    return FORKSERVER_ERROR;
+  frame.length = length;
+  iov[0].iov_base = &frame;
+  iov[0].iov_len = sizeof(frame);
+  iov[1].iov_base = input;
+  iov[1].iov_len = length;
+  do {
+    result = writev(stream_fd, iov, 2);
+  } while(result < 0 && errno == EINTR);
+  if(result != (ssize_t)(sizeof(frame) + length)) {
+    ERROR_MSG("Input of %lu bytes doesn't fit in the stdin pipe", (unsigned long)length);
+    return FORKSERVER_ERROR;
+  }
+  return 0;
+}
+
+/**
+ * This function creates the shared memory region used to pass inputs to the target process.  It must be called
+ * before fork_server_init, so that the fork server is told about the region when it starts.
+ * @param fs - A forkserver_t structure to hold the fork server state
+ * @param max_length - The maximum length of an input that can be passed through the region
+ * @return - 0 on success, FORKSERVER_ERROR on failure
+ */
+int fork_server_setup_input_shm(forkserver_t * fs, size_t max_length)
+{
+  void * region;
+
+  if(fs->input_shm)
+    return 0;
+
+  fs->input_shm_id = shmget(IPC_PRIVATE, SHM_INPUT_REGION_SIZE(max_length), IPC_CREAT | IPC_EXCL | 0600);
+  if(fs->input_shm_id < 0) {
+    ERROR_MSG("shmget() failed for the input channel");
+    return FORKSERVER_ERROR;
+  }
+
+  region = shmat(fs->input_shm_id, NULL, 0);
+  if(region == (void *)-1) {
+    ERROR_MSG("shmat() failed for the input channel");
+    shmctl(fs->input_shm_id, IPC_RMID, NULL);
+    return FORKSERVER_ERROR;
+  }
+
+  fs->input_shm = (forkserver_shm_input_t *)region;
+  fs->input_shm->length = 0;
+  fs->input_shm->max_length = max_length;
+  return 0;
+}
+
+/**
+ * This function copies an input into the shared memory input channel, where the target process can read it with
+ * KILLERBEEZ_GET_INPUT().  It should be called before telling the fork server to run the target.
+ * @param fs - A forkserver_t structure to hold the fork server state
+ * @param input - The input to pass to the target
+ * @param length - The length of the input parameter
+ * @return - 0 on success, FORKSERVER_ERROR on failure
+ */
+int fork_server_write_input(forkserver_t * fs, char * input, size_t length)
+{
+  if(!fs->input_shm)
+    return FORKSERVER_ERROR;
+  if(length > fs->input_shm->max_length) {
+    ERROR_MSG("Input of %lu bytes is larger than the input channel (%u bytes)", (unsigned long)length,
+      fs->input_shm->max_length);
+    return FORKSERVER_ERROR;
+  }
+  if(length)
+    memcpy(fs->input_shm->data, input, length);
+  fs->input_shm->length = length;
+  return 0;
+}
+
+/**
+ * This function removes the shared memory input channel
+ * @param fs - A forkserver_t structure to hold the fork server state
+ */
+void fork_server_cleanup_input_shm(forkserver_t * fs)
+{
+  if(!fs->input_shm)
+    return;
+  shmdt(fs->input_shm);
+  shmctl(fs->input_shm_id, IPC_RMID, NULL);
+  fs->input_shm = NULL;
+}
+
+//////////////////////////////////////////////////////////////
+// Target Cgroups ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+//How long target_cgroup_cleanup waits for the killed processes to leave the group before giving up on removing it
+#define CGROUP_REMOVE_ATTEMPTS 100
+
+/**
+ * This function writes a value to one of a cgroup's control files
+ * @param directory - the cgroup's directory
+ * @param name - the name of the control file
+ * @param value - the value to write
+ * @return - zero on success, non-zero on failure
+ */
+static int write_cgroup_file(const char * directory, const char * name, const char * value)
+{
+  char path[MAX_PATH];
+  size_t length = strlen(value);
+  int fd, ret;
+
+  snprintf(path, sizeof(path), "%s/%s", directory, name);
+  fd = open(path, O_WRONLY | O_CLOEXEC);
+  if(fd < 0)
+    return 1;
+  ret = write(fd, value, length) != (ssize_t)length;
+  close(fd);
+  return ret;
+}
+
+/**
+ * This function reads the number of times the kernel's OOM killer has killed a process in a cgroup, from the
+ * oom_kill line of its memory.events file
+ * @param directory - the cgroup's directory
+ * @param oom_kills - a pointer used to return the count
+ * @return - zero on success, non-zero on failure
+ */
+static int read_cgroup_oom_kills(const char * directory, uint64_t * oom_kills)
+{
+  char path[MAX_PATH], buffer[512], * line;
+  ssize_t length;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/memory.events", directory);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return 1;
+  length = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if(length <= 0)
+    return 1;
+  buffer[length] = 0;
+
+  for(line = buffer; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+    if(!strncmp(line, "oom_kill ", 9)) {
+      *oom_kills = strtoull(line + 9, NULL, 10);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * This function creates a worker's cgroup under the parent cgroup named in its options, enables the controllers that
+ * its limits need in the parent, and sets the limits.  Each call makes a new group, named after the fuzzer's pid and
+ * a counter, so every worker in the fuzzer gets its own group.
+ * @param cgroup - the target_cgroup_t with the group's options
+ * @return - zero on success, non-zero on failure
+ */
+int target_cgroup_create(target_cgroup_t * cgroup)
+{
+  static int next_id = 0;
+  char path[MAX_PATH], value[32];
+
+  if(!cgroup->parent || cgroup->path)
+    return 0;
+
+  //The controllers have to be enabled in the parent for its children to have their control files
+  if((cgroup->cpus && write_cgroup_file(cgroup->parent, "cgroup.subtree_control", "+cpuset"))
+    || (cgroup->memory_max && write_cgroup_file(cgroup->parent, "cgroup.subtree_control", "+memory"))
+    || (cgroup->pids_max && write_cgroup_file(cgroup->parent, "cgroup.subtree_control", "+pids"))) {
+    ERROR_MSG("Couldn't enable the cgroup controllers in %s (%s).  It must be a cgroup v2 group that the fuzzer can "
+      "write to, with no processes of its own.", cgroup->parent, strerror(errno));
+    return 1;
+  }
+
+  snprintf(path, sizeof(path), "%s/killerbeez-%d-%d", cgroup->parent, (int)getpid(), __sync_fetch_and_add(&next_id, 1));
+  if(mkdir(path, 0755) && errno != EEXIST) {
+    ERROR_MSG("Couldn't create the cgroup %s (%s)", path, strerror(errno));
+    return 1;
+  }
+  cgroup->path = strdup(path);
+  if(!cgroup->path) {
+    rmdir(path);
+    return 1;
+  }
+
+  if(cgroup->cpus && write_cgroup_file(path, "cpuset.cpus", cgroup->cpus)) {
+    ERROR_MSG("Couldn't set the CPUs of the cgroup %s to %s", path, cgroup->cpus);
+    return 1;
+  }
+  if(cgroup->memory_max) {
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)cgroup->memory_max << 20);
+    if(write_cgroup_file(path, "memory.max", value)) {
+      ERROR_MSG("Couldn't set the memory limit of the cgroup %s", path);
+      return 1;
+    }
+    //Swapping would just make the targets slow rather than killing them, but it may not be enabled
+    write_cgroup_file(path, "memory.swap.max", "0");
+    read_cgroup_oom_kills(path, &cgroup->oom_kills);
+  }
+  if(cgroup->pids_max) {
+    snprintf(value, sizeof(value), "%d", cgroup->pids_max);
+    if(write_cgroup_file(path, "pids.max", value)) {
+      ERROR_MSG("Couldn't set the process limit of the cgroup %s", path);
+      return 1;
+    }
+  }
+  DEBUG_MSG("Created the target cgroup %s", path);
+  return 0;
+}
+
+/**
+ * This function moves the calling process into a worker's cgroup.  It's called in the fork server's (or the target's)
+ * process before exec, so the target never runs outside of the group, and everything it forks stays in it.
+ * @param cgroup - the target_cgroup_t created by target_cgroup_create
+ * @return - zero on success, non-zero on failure
+ */
+int target_cgroup_enter(target_cgroup_t * cgroup)
+{
+  //Writing 0 moves the writing process
+  return write_cgroup_file(cgroup->path, "cgroup.procs", "0");
+}
+
+/**
+ * This function checks whether the kernel's OOM killer has killed a process in a worker's cgroup since the last
+ * check, i.e. whether a target that was killed with SIGKILL hit the group's memory limit.
+ * @param cgroup - the target_cgroup_t created by target_cgroup_create
+ * @return - 1 if there were new OOM kills, or 0 if there weren't (or the group has no memory limit)
+ */
+int target_cgroup_oom_killed(target_cgroup_t * cgroup)
+{
+  uint64_t oom_kills;
+
+  if(!cgroup->path || !cgroup->memory_max || read_cgroup_oom_kills(cgroup->path, &oom_kills)
+    || oom_kills == cgroup->oom_kills)
+    return 0;
+  cgroup->oom_kills = oom_kills;
+  return 1;
+}
+
+/**
+ * This function kills any processes left in a worker's cgroup, removes the group, and frees the target_cgroup_t's
+ * options
+ * @param cgroup - the target_cgroup_t to clean up
+ */
+void target_cgroup_cleanup(target_cgroup_t * cgroup)
+{
+  int i;
+
+  if(cgroup->path) {
+    //cgroup.kill needs Linux 5.14, but the fork server has usually exited by now anyway
+    write_cgroup_file(cgroup->path, "cgroup.kill", "1");
+    for(i = 0; i < CGROUP_REMOVE_ATTEMPTS && rmdir(cgroup->path) && errno == EBUSY; i++)
+      usleep(1000);
+    free(cgroup->path);
+  }
+  free(cgroup->parent);
+  free(cgroup->cpus);
+  memset(cgroup, 0, sizeof(*cgroup));
+}
+
+#else
+
+int target_cgroup_create(target_cgroup_t * cgroup)
+{
+  if(!cgroup->parent)
+    return 0;
+  ERROR_MSG("Target cgroups are only supported on Linux");
+  return 1;
+}
+
+int target_cgroup_enter(target_cgroup_t * cgroup)
+{
+  return 1;
+}
+
+int target_cgroup_oom_killed(target_cgroup_t * cgroup)
+{
+  return 0;
+}
+
+void target_cgroup_cleanup(target_cgroup_t * cgroup)
+{
+  free(cgroup->parent);
+  free(cgroup->cpus);
+  memset(cgroup, 0, sizeof(*cgroup));
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////
+// Stdin Files ///////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function creates the file that targets read their stdin from.  Using a file rather than a pipe means the
+ * input can be written before the target starts, no matter how large it is, without waiting for the target to
+ * read it.  On Linux, the file is a memfd, which lives only in memory, so large inputs never touch the disk and
+ * the target can mmap its stdin.  Elsewhere, it is a temporary file that is unlinked right away, so it doesn't
+ * outlive the fuzzer.
+ * @return - the file descriptor of the new file, or -1 on failure
+ */
+int create_stdin_file(void)
+{
+  char filename[100];
+  int fd;
+
+#ifdef SYS_memfd_create
+  //The close on exec flag isn't copied when the file is dup'd onto a target's stdin, so it only stops the file
+  //from leaking into other processes
+  fd = syscall(SYS_memfd_create, "killerbeez_stdin", MFD_CLOEXEC);
+  if(fd >= 0)
+    return fd;
+#endif
+  strncpy(filename, "/tmp/fuzzfileXXXXXX", sizeof(filename));
+  fd = mkstemp(filename);
+  if(fd >= 0)
+    unlink(filename);
+  return fd;
+}
+
+/**
+ * This function replaces the contents of a file created by create_stdin_file with an input, and rewinds it so the
+ * next target reads the input from the start.
+ * @param fd - the file descriptor returned by create_stdin_file
+ * @param input - the input to write to the file
+ * @param length - the length of the input parameter
+ * @return - 0 on success, FORKSERVER_ERROR on failure
+ */
+int write_stdin_file(int fd, char * input, size_t length)
+{
+  size_t total = 0;
+  ssize_t result;
+
+  if(uring_rewrite_file(fd, input, length) != URING_NOT_USED)
+    return lseek(fd, 0, SEEK_SET) < 0 ? FORKSERVER_ERROR : 0;
+
+  while(total < length) {
+    result = pwrite(fd, input + total, length - total, total);
+    if(result < 0 && errno == EINTR)
+      continue;
+    if(result <= 0)
+      return FORKSERVER_ERROR;
+    total += result;
+  }
+  if(ftruncate(fd, length) || lseek(fd, 0, SEEK_SET) < 0)
+    return FORKSERVER_ERROR;
+  return 0;
+}
+
+/**
+ * This function frees the split command line of a target started without the fork server
+ * @param target - the spawn_target_t structure to free the command line of
+ */
+static void free_command_line(spawn_target_t * target)
+{
+  int i;
+
+  if(target->argv) {
+    for(i = 0; target->argv[i]; i++)
+      free(target->argv[i]);
+    free(target->argv);
+  }
+  free(target->executable);
+  free(target->cmd_line);
+  target->argv = NULL;
+  target->executable = NULL;
+  target->cmd_line = NULL;
+}
+
+/**
+ * This function frees the split command line and closes the stdin file of a target started without the fork server
+ * @param target - the spawn_target_t structure to clean up
+ */
+void spawn_target_cleanup(spawn_target_t * target)
+{
+  free_command_line(target);
+  if(target->stdin_fd > 0)
+    close(target->stdin_fd);
+  memset(target, 0, sizeof(*target));
+}
+
+/**
+ * This function copies an environment, leaving out one of its variables.
+ * @param env - the NULL terminated environment to copy
+ * @param name - the name of the variable to leave out
+ * @return - the copied environment, which shares env's strings and should be freed with free, or NULL on failure
+ */
+static char ** environment_without(char ** env, const char * name)
+{
+  char ** copy;
+  size_t count, i, j, name_length = strlen(name);
+
+  for(count = 0; env[count]; count++);
+  copy = malloc((count + 1) * sizeof(char *));
+  if(!copy)
+    return NULL;
+  for(i = j = 0; i < count; i++)
+    if(strncmp(env[i], name, name_length) || env[i][name_length] != '=')
+      copy[j++] = env[i];
+  copy[j] = NULL;
+  return copy;
+}
+
+/**
+ * This function starts a target process without the fork server, with its stdin reading the input from a file
+ * made by create_stdin_file.  The target's stdout and stderr are sent to /dev/null.
+ * @param target - a spawn_target_t structure that caches the split up command line and the stdin file between
+ * calls.  It should be zeroed before the first call, and cleaned up with spawn_target_cleanup.
+ * @param cmd_line - The command line of the new process to start.  The command line must start with the path of
+ * the executable to start.
+ * @param input - a buffer that should be passed to the newly created process's stdin
+ * @param input_length - The length of the input parameter
+ * @param process_out - a pointer to a pid_t that will be filled in with the pid of the newly created process
+ * @return - zero on success, non-zero on failure
+ */
+int spawn_target_process(spawn_target_t * target, char * cmd_line, char * input, size_t input_length,
+  pid_t * process_out)
+{
+  posix_spawn_file_actions_t actions;
+  extern char ** environ;
+  char ** envp, ** lazy_environ = NULL;
+  int error;
+  pid_t child_pid;
+
+  if(!target->cmd_line || strcmp(target->cmd_line, cmd_line)) {
+    free_command_line(target);
+    target->cmd_line = strdup(cmd_line);
+    if(!target->cmd_line || split_command_line(cmd_line, &target->executable, &target->argv)) {
+      free_command_line(target);
+      return 1;
+    }
+  }
+
+  //The whole input is written before the child starts, so the fuzzer never blocks waiting for it to be read
+  if(target->stdin_fd <= 0) {
+    target->stdin_fd = create_stdin_file();
+    if(target->stdin_fd < 0) {
+      target->stdin_fd = 0;
+      ERROR_MSG("Couldn't create the target's stdin file");
+      return 1;
+    }
+  }
+  if(write_stdin_file(target->stdin_fd, input, input_length)) {
+    ERROR_MSG("Failed to write the target's stdin file");
+    return 1;
+  }
+
+  //Connect the stdin file to the child's stdin, and send its stdout/stderr to /dev/null
+  if(posix_spawn_file_actions_init(&actions))
+    return 1;
+  error = posix_spawn_file_actions_adddup2(&actions, target->stdin_fd, STDIN_FILENO)
+    || posix_spawn_file_actions_addclose(&actions, target->stdin_fd)
+    || posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0)
+    || posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+  //The environment is read at spawn time, so variables the caller just exported are passed on.  A process that
+  //only runs one input rarely calls most of its imports, so binding them all up front is wasted work.
+  set_sanitizer_options();
+  envp = environ;
+  if(target->lazy_binding && getenv("LD_BIND_NOW")) {
+    lazy_environ = environment_without(environ, "LD_BIND_NOW");
+    if(lazy_environ)
+      envp = lazy_environ;
+  }
+  if(!error)
+    error = posix_spawn(&child_pid, target->executable, &actions, NULL, target->argv, envp);
+  posix_spawn_file_actions_destroy(&actions);
+  free(lazy_environ);
+  if(error) {
+    ERROR_MSG("posix_spawn() failed for %s: %s", target->executable, strerror(error));
+    return 1;
+  }
+
+  TRACEPOINT_TARGET_SPAWNED(child_pid);
+  *process_out = child_pid;
+  return 0;
+}
+
 #endif //!_WIN32
+
+#ifdef _WIN32
+//The Windows fork server, which clones a template process rather than forking
+
+#include <stddef.h>
+#include <string.h>
+#include "forkserver_windows.h"
+
+#define PROCESS_CREATE_FLAGS_INHERIT_HANDLES 0x00000004
+
+//The offsets of the TEB fields that tie a thread to its stack and thread local storage
+#ifdef _M_X64
+#define TEB_TLS_POINTER_OFFSET        0x58
+#define TEB_DEALLOCATION_STACK_OFFSET 0x1478
+#define TEB_TLS_SLOTS_OFFSET          0x1480
+#else
+#define TEB_TLS_POINTER_OFFSET        0x2c
+#define TEB_DEALLOCATION_STACK_OFFSET 0xe0c
+#define TEB_TLS_SLOTS_OFFSET          0xe10
+#endif
+
+typedef LONG (NTAPI * nt_create_process_ex_t)(HANDLE * process, ACCESS_MASK access, void * object_attributes,
+  HANDLE parent, ULONG flags, HANDLE section, HANDLE debug_port, HANDLE exception_port, ULONG job_member_level);
+typedef LONG (NTAPI * rtl_create_user_thread_t)(HANDLE process, void * security_descriptor, BOOLEAN suspended,
+  ULONG stack_zero_bits, SIZE_T stack_reserve, SIZE_T stack_commit, void * start_address, void * parameter,
+  HANDLE * thread, void * client_id);
+typedef LONG (NTAPI * nt_query_information_thread_t)(HANDLE thread, int info_class, void * info, ULONG length,
+  ULONG * return_length);
+typedef HANDLE (NTAPI * dbg_ui_get_thread_debug_object_t)(void);
+
+struct thread_basic_information {
+  LONG exit_status;
+  void * teb;
+  void * client_id[2];
+  ULONG_PTR affinity_mask;
+  LONG priority;
+  LONG base_priority;
+};
+
+static nt_create_process_ex_t nt_create_process_ex = NULL;
+static rtl_create_user_thread_t rtl_create_user_thread = NULL;
+static nt_query_information_thread_t nt_query_information_thread = NULL;
+static dbg_ui_get_thread_debug_object_t dbg_ui_get_thread_debug_object = NULL;
+
+/**
+ * This function loads the undocumented ntdll.dll functions that clone processes.
+ * @return - zero on success, non-zero on failure
+ */
+static int load_clone_functions(void)
+{
+  HMODULE ntdll;
+
+  if(nt_create_process_ex)
+    return 0;
+  ntdll = GetModuleHandle("ntdll.dll");
+  if(!ntdll)
+    return 1;
+  rtl_create_user_thread = (rtl_create_user_thread_t)GetProcAddress(ntdll, "RtlCreateUserThread");
+  nt_query_information_thread = (nt_query_information_thread_t)GetProcAddress(ntdll, "NtQueryInformationThread");
+  dbg_ui_get_thread_debug_object = (dbg_ui_get_thread_debug_object_t)GetProcAddress(ntdll, "DbgUiGetThreadDebugObject");
+  if(!rtl_create_user_thread || !nt_query_information_thread || !dbg_ui_get_thread_debug_object)
+    return 1;
+  nt_create_process_ex = (nt_create_process_ex_t)GetProcAddress(ntdll, "NtCreateProcessEx");
+  return !nt_create_process_ex;
+}
+
+/**
+ * This function finds a thread's TEB
+ * @param thread - a handle to the thread
+ * @return - the address of the thread's TEB in its process, or NULL on failure
+ */
+static char * get_thread_teb(HANDLE thread)
+{
+  struct thread_basic_information info;
+
+  if(nt_query_information_thread(thread, 0 /* ThreadBasicInformation */, &info, sizeof(info), NULL) < 0)
+    return NULL;
+  return (char *)info.teb;
+}
+
+/**
+ * This function reads or writes the TEB fields that a win_forkserver_t copies from the template thread
+ * @param fs - the fork server whose copies of the fields are read or written
+ * @param process - the process the TEB is in
+ * @param teb - the address of the TEB
+ * @param write - whether to write the fork server's copies to the TEB, rather than read them from it
+ * @return - zero on success, non-zero on failure
+ */
+static int copy_teb_fields(win_forkserver_t * fs, HANDLE process, char * teb, int write)
+{
+  struct {
+    SIZE_T offset;
+    void * value;
+    SIZE_T size;
+  } fields[] = {
+    { offsetof(NT_TIB, StackBase), &fs->stack_base, sizeof(fs->stack_base) },
+    { offsetof(NT_TIB, StackLimit), &fs->stack_limit, sizeof(fs->stack_limit) },
+    { TEB_DEALLOCATION_STACK_OFFSET, &fs->deallocation_stack, sizeof(fs->deallocation_stack) },
+    { TEB_TLS_POINTER_OFFSET, &fs->tls_pointer, sizeof(fs->tls_pointer) },
+    { TEB_TLS_SLOTS_OFFSET, fs->tls_slots, sizeof(fs->tls_slots) },
+  };
+  int i;
+
+  for(i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    if(write) {
+      if(!WriteProcessMemory(process, teb + fields[i].offset, fields[i].value, fields[i].size, NULL))
+        return 1;
+    } else if(!ReadProcessMemory(process, teb + fields[i].offset, fields[i].value, fields[i].size, NULL))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * This function sets up a fork server from a template process that has just hit the int3 breakpoint at
+ * its clone point.  The caller must have restored the byte the breakpoint replaced, and must leave the
+ * template's breakpoint debug event uncontinued, so the template stays stopped at the clone point.
+ * @param fs - the win_forkserver_t to set up
+ * @param process - a handle to the template process.  The fork server owns this handle afterwards.
+ * @param thread_id - the id of the thread that hit the breakpoint
+ * @param clone_address - the address of the breakpoint that was hit
+ * @return - zero on success, non-zero on failure
+ */
+int win_fork_server_init(win_forkserver_t * fs, HANDLE process, DWORD thread_id, void * clone_address)
+{
+  BOOL process_wow64, our_wow64;
+  char * teb;
+
+  memset(fs, 0, sizeof(win_forkserver_t));
+  fs->process = process;
+  if(load_clone_functions()) {
+    ERROR_MSG("Could not load the process cloning functions from ntdll.dll");
+    return 1;
+  }
+
+  //A WOW64 process has a 32-bit and a 64-bit TEB per thread, so only targets of our own bitness are cloned
+  if(!IsWow64Process(process, &process_wow64) || !IsWow64Process(GetCurrentProcess(), &our_wow64)
+    || process_wow64 != our_wow64) {
+    ERROR_MSG("Only targets of the same bitness as the fuzzer can be cloned");
+    return 1;
+  }
+
+  fs->thread = OpenThread(THREAD_ALL_ACCESS, FALSE, thread_id);
+  if(!fs->thread)
+    return 1;
+  memset(&fs->context, 0, sizeof(fs->context));
+  fs->context.ContextFlags = CONTEXT_FULL | CONTEXT_FLOATING_POINT;
+  teb = get_thread_teb(fs->thread);
+  if(!GetThreadContext(fs->thread, &fs->context) || !teb || copy_teb_fields(fs, process, teb, 0)) {
+    ERROR_MSG("Could not read the state of the thread at the clone point");
+    return 1;
+  }
+
+  //The clones start at the instruction that the breakpoint replaced
+#ifdef _M_X64
+  fs->context.Rip = (DWORD64)clone_address;
+#else
+  fs->context.Eip = (DWORD)clone_address;
+#endif
+  return 0;
+}
+
+/**
+ * This function clones the template process.  The clone is debugged by the calling thread, which must
+ * be the thread that is debugging the template, and it starts running at the clone point straight away.
+ * @param fs - the fork server to clone the template of
+ * @param process_out - a pointer used to return a handle to the clone
+ * @return - zero on success, non-zero on failure
+ */
+int win_fork_server_fork(win_forkserver_t * fs, HANDLE * process_out)
+{
+  HANDLE clone, thread;
+  char * teb;
+#ifdef _M_X64
+  void * start = (void *)fs->context.Rip;
+#else
+  void * start = (void *)fs->context.Eip;
+#endif
+
+  //Without a section, NtCreateProcessEx copies the parent's address space, and with a debug port the
+  //clone is debugged with it, so its events show up in our WaitForDebugEvent loop
+  if(nt_create_process_ex(&clone, PROCESS_ALL_ACCESS, NULL, fs->process, PROCESS_CREATE_FLAGS_INHERIT_HANDLES,
+      NULL, dbg_ui_get_thread_debug_object(), NULL, 0) < 0) {
+    ERROR_MSG("NtCreateProcessEx failed to clone the template process");
+    return 1;
+  }
+
+  //RtlCreateUserThread doesn't tell csrss about the thread, which it doesn't know the clone's process for.
+  //The thread gets its own stack, but it's pointed at the copy of the template thread's stack instead.
+  if(rtl_create_user_thread(clone, NULL, TRUE, 0, 0, 0, start, NULL, &thread, NULL) < 0) {
+    ERROR_MSG("Failed to create a thread in the clone of the template process");
+    TerminateProcess(clone, 0);
+    CloseHandle(clone);
+    return 1;
+  }
+  teb = get_thread_teb(thread);
+  if(!teb || copy_teb_fields(fs, clone, teb, 1) || !SetThreadContext(thread, &fs->context)
+    || ResumeThread(thread) == (DWORD)-1) {
+    ERROR_MSG("Failed to start the clone of the template process at the clone point");
+    TerminateProcess(clone, 0);
+    CloseHandle(thread);
+    CloseHandle(clone);
+    return 1;
+  }
+
+  CloseHandle(thread);
+  *process_out = clone;
+  return 0;
+}
+
+/**
+ * This function kills a fork server's template process and frees its handles
+ * @param fs - the fork server to clean up
+ */
+void win_fork_server_exit(win_forkserver_t * fs)
+{
+  if(fs->thread)
+    CloseHandle(fs->thread);
+  if(fs->process) {
+    TerminateProcess(fs->process, 0);
+    CloseHandle(fs->process);
+  }
+  memset(fs, 0, sizeof(win_forkserver_t));
+}
+
+#endif //_WIN32
@@ -37,6 +37,40 @@ struct instrumentation_edges
 };
 typedef struct instrumentation_edges instrumentation_edges_t;
 
+//Counts of the problems an instrumentation has run into while running the target, for the fuzzer's stats
+struct instrumentation_counters
+{
+	uint64_t fork_failures;   //The number of times the target couldn't be started
+	uint64_t trace_overflows; //The number of times the target's trace data overflowed its buffer
+	uint64_t oom_kills;       //The number of times the target was killed for going over its memory limit
+};
+typedef struct instrumentation_counters instrumentation_counters_t;
+
+//The details of how the target crashed, for triaging the crashes
+struct instrumentation_crash_info
+{
+	uint32_t signal;        //The signal the target was killed with, or on Windows, the exception code
+	uint64_t fault_address; //The address of the instruction that faulted, or 0 if it isn't known
+	uint64_t stack_hash;    //A hash of the top frames of the crashing thread's stack, or 0 if it isn't known
+};
+typedef struct instrumentation_crash_info instrumentation_crash_info_t;
+
+//Everything the fuzzer needs to know about how the last input's run went, which finish_round fills in at once
+struct instrumentation_round_result
+{
+	int fuzz_result;        //The FUZZ_ result of the run
+	int new_path;           //The is_new_path result of the run
+	int new_bits;           //0 if the run found nothing new, 1 if it only hit known edges a new number of times,
+	                        //or 2 if it hit new edges
+	int has_path_hash;      //Whether path_hash was set, i.e. whether get_path_hash would have succeeded
+	uint64_t path_hash;     //The get_path_hash result of the run
+	uint64_t exec_us;       //How long the run took in microseconds, or 0 if it isn't known
+	uint64_t exec_instructions; //How many instructions the run executed, or 0 if they weren't counted
+	uint64_t exec_max_rss_kb; //The peak resident set size of the run's target process in kilobytes, or 0 if it
+	                          //isn't known
+};
+typedef struct instrumentation_round_result instrumentation_round_result_t;
+
 struct instrumentation
 {
 	void *(*create)(char * options, char * state);
@@ -59,5 +93,37 @@ struct instrumentation
 	int (*get_module_info)(void * instrumentation_state, int index, int * is_new, char ** module_name, char ** info, int * size);
 	instrumentation_edges_t * (*get_edges)(void * instrumentation_state, int index);
 	int(*is_process_done)(void * instrumentation_state);
+	int(*wait_for_process_done)(void * instrumentation_state, int timeout_ms);
+	//Compact binary versions of get_state and set_state (see binary_state.h).  States
+	//returned by get_binary_state are freed with free_state.
+	char * (*get_binary_state)(void * instrumentation_state, size_t * length);
+	int(*set_binary_state)(void * instrumentation_state, char * state, size_t length);
+	//Returns a hash of the path the last input took, which is the same for every input that takes the same
+	//path.  Returns zero on success, or non-zero if the last run has no path hash (e.g. it crashed or hung).
+	int(*get_path_hash)(void * instrumentation_state, uint64_t * hash);
+	//Returns a hash of how the last input crashed, which is the same for crashes that are likely the same bug
+	//(e.g. the same coverage and signal, or the same fault address), so the fuzzer can bucket them.  Returns
+	//zero on success, or non-zero if the last run didn't crash or the crash can't be hashed.
+	int(*get_crash_hash)(void * instrumentation_state, uint64_t * hash);
+	//Fills in the details of how the last input crashed.  Returns zero on success, or non-zero if the last run
+	//didn't crash.
+	int(*get_crash_info)(void * instrumentation_state, instrumentation_crash_info_t * info);
+	//Returns the constants the target compared its input against so far, as the text of an AFL style
+	//dictionary file with one quoted token per line, or NULL on failure.  Freed with free_state.
+	char * (*get_dictionary)(void * instrumentation_state);
+	//Fills in the counts of the problems the instrumentation has run into since it was created
+	void (*get_counters)(void * instrumentation_state, instrumentation_counters_t * counters);
+	//Returns the coverage bitmap of the last run, which is only valid until the next run, so that the fuzzer
+	//can compare the bitmaps of repeated runs of the same input.  Returns zero on success.
+	int(*get_trace_bits)(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size);
+	//Stops the bitmap bytes that are non-zero in unstable_bytes from counting as new paths, crashes, or hangs.
+	//The unstable_bytes parameter must be the size returned by get_trace_bits.  Returns zero on success.
+	int(*ignore_unstable_bytes)(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size);
+	//Finishes the last run and fills in all of its results at once, so the fuzzer doesn't need to call
+	//get_fuzz_result, is_new_path and get_path_hash separately.  Returns zero on success, or -1 on error.
+	int(*finish_round)(void * instrumentation_state, instrumentation_round_result_t * result);
+	//Creates a new state with the same options, which runs its own copy of the target, so that a driver can run
+	//several targets at once.  The new state doesn't have any of the original's coverage.  Returns NULL on failure.
+	void *(*copy)(void * instrumentation_state);
 };
 typedef struct instrumentation instrumentation_t;
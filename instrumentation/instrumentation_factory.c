@@ -1,12 +1,18 @@
 #include "instrumentation_factory.h"
+#include "tiered_instrumentation.h"
 #ifdef _WIN32
 #include "debug_instrumentation.h"
 #include "dynamorio_instrumentation.h"
+#ifdef WINDOWS_IPT
+#include "windows_ipt_instrumentation.h"
+#endif
 #else
 #include "return_code_instrumentation.h"
 #include "afl_instrumentation.h"
 #if !__APPLE__ // Linux
 #include "linux_ipt_instrumentation.h"
+#include "linux_lbr_instrumentation.h"
+#include "breakpoint_instrumentation.h"
 #endif
 #endif
 
@@ -38,7 +44,10 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->enable = debug_enable;
 		ret->is_new_path = debug_is_new_path;
 		ret->get_fuzz_result = debug_get_fuzz_result;
+		ret->get_crash_hash = debug_get_crash_hash;
+		ret->get_crash_info = debug_get_crash_info;
 		ret->is_process_done = debug_is_process_done;
+		ret->wait_for_process_done = debug_wait_for_process_done;
 	}
 	else if (!strcmp(instrumentation_type, "dynamorio"))
 	{
@@ -48,13 +57,37 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->get_state = dynamorio_get_state;
 		ret->free_state = dynamorio_free_state;
 		ret->set_state = dynamorio_set_state;
+		ret->get_binary_state = dynamorio_get_binary_state;
+		ret->set_binary_state = dynamorio_set_binary_state;
 		ret->enable = dynamorio_enable;
 		ret->is_new_path = dynamorio_is_new_path;
 		ret->get_module_info = dynamorio_get_module_info;
 		ret->get_edges = dynamorio_get_edges;
 		ret->is_process_done = dynamorio_is_process_done;
+		ret->wait_for_process_done = dynamorio_wait_for_process_done;
 		ret->get_fuzz_result = dynamorio_get_fuzz_result;
 	}
+	#ifdef WINDOWS_IPT
+	else if (!strcmp(instrumentation_type, "ipt"))
+	{
+		ret->create = windows_ipt_create;
+		ret->cleanup = windows_ipt_cleanup;
+		ret->merge = windows_ipt_merge;
+		ret->get_state = windows_ipt_get_state;
+		ret->free_state = windows_ipt_free_state;
+		ret->set_state = windows_ipt_set_state;
+		ret->get_binary_state = windows_ipt_get_binary_state;
+		ret->set_binary_state = windows_ipt_set_binary_state;
+		ret->enable = windows_ipt_enable;
+		ret->is_new_path = windows_ipt_is_new_path;
+		ret->get_fuzz_result = windows_ipt_get_fuzz_result;
+		ret->get_counters = windows_ipt_get_counters;
+		ret->get_trace_bits = windows_ipt_get_trace_bits;
+		ret->ignore_unstable_bytes = windows_ipt_ignore_unstable_bytes;
+		ret->is_process_done = windows_ipt_is_process_done;
+		ret->wait_for_process_done = windows_ipt_wait_for_process_done;
+	}
+	#endif
 	#else
 	if (!strcmp(instrumentation_type, "return_code"))
 	{
@@ -67,7 +100,10 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->enable = return_code_enable;
 		ret->is_new_path = return_code_is_new_path;
 		ret->get_fuzz_result = return_code_get_fuzz_result;
+		ret->get_crash_info = return_code_get_crash_info;
 		ret->is_process_done = return_code_is_process_done;
+		ret->wait_for_process_done = return_code_wait_for_process_done;
+		ret->copy = return_code_copy;
 	}
 	else if (!strcmp(instrumentation_type, "afl"))
 	{
@@ -77,10 +113,21 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->get_state = afl_get_state;
 		ret->free_state = afl_free_state;
 		ret->set_state = afl_set_state;
+		ret->get_binary_state = afl_get_binary_state;
+		ret->set_binary_state = afl_set_binary_state;
 		ret->enable = afl_enable;
 		ret->is_new_path = afl_is_new_path;
 		ret->get_fuzz_result = afl_get_fuzz_result;
+		ret->get_path_hash = afl_get_path_hash;
+		ret->get_crash_hash = afl_get_crash_hash;
+		ret->get_crash_info = afl_get_crash_info;
+		ret->get_dictionary = afl_get_dictionary;
+		ret->get_counters = afl_get_counters;
+		ret->get_trace_bits = afl_get_trace_bits;
+		ret->ignore_unstable_bytes = afl_ignore_unstable_bytes;
+		ret->finish_round = afl_finish_round;
 		ret->is_process_done = afl_is_process_done;
+		ret->wait_for_process_done = afl_wait_for_process_done;
 	}
 	#if !__APPLE__ // Linux
 	else if (!strcmp(instrumentation_type, "ipt"))
@@ -91,13 +138,74 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->get_state = linux_ipt_get_state;
 		ret->free_state = linux_ipt_free_state;
 		ret->set_state = linux_ipt_set_state;
+		ret->get_binary_state = linux_ipt_get_binary_state;
+		ret->set_binary_state = linux_ipt_set_binary_state;
 		ret->enable = linux_ipt_enable;
 		ret->is_new_path = linux_ipt_is_new_path;
 		ret->get_fuzz_result = linux_ipt_get_fuzz_result;
+		ret->get_counters = linux_ipt_get_counters;
+		ret->get_trace_bits = linux_ipt_get_trace_bits;
+		ret->ignore_unstable_bytes = linux_ipt_ignore_unstable_bytes;
 		ret->is_process_done = linux_ipt_is_process_done;
+		ret->wait_for_process_done = linux_ipt_wait_for_process_done;
+	}
+	else if (!strcmp(instrumentation_type, "lbr"))
+	{
+		ret->create = linux_lbr_create;
+		ret->cleanup = linux_lbr_cleanup;
+		ret->merge = linux_lbr_merge;
+		ret->get_state = linux_lbr_get_state;
+		ret->free_state = linux_lbr_free_state;
+		ret->set_state = linux_lbr_set_state;
+		ret->enable = linux_lbr_enable;
+		ret->is_new_path = linux_lbr_is_new_path;
+		ret->get_fuzz_result = linux_lbr_get_fuzz_result;
+		ret->get_counters = linux_lbr_get_counters;
+		ret->get_trace_bits = linux_lbr_get_trace_bits;
+		ret->ignore_unstable_bytes = linux_lbr_ignore_unstable_bytes;
+		ret->is_process_done = linux_lbr_is_process_done;
+		ret->wait_for_process_done = linux_lbr_wait_for_process_done;
+	}
+	else if (!strcmp(instrumentation_type, "breakpoint"))
+	{
+		ret->create = breakpoint_create;
+		ret->cleanup = breakpoint_cleanup;
+		ret->merge = breakpoint_merge;
+		ret->get_state = breakpoint_get_state;
+		ret->free_state = breakpoint_free_state;
+		ret->set_state = breakpoint_set_state;
+		ret->enable = breakpoint_enable;
+		ret->is_new_path = breakpoint_is_new_path;
+		ret->get_fuzz_result = breakpoint_get_fuzz_result;
+		ret->get_crash_info = breakpoint_get_crash_info;
+		ret->is_process_done = breakpoint_is_process_done;
+		ret->wait_for_process_done = breakpoint_wait_for_process_done;
 	}
 	#endif
 	#endif
+	else if (!strcmp(instrumentation_type, "tiered"))
+	{
+		ret->create = tiered_create;
+		ret->cleanup = tiered_cleanup;
+		ret->merge = tiered_merge;
+		ret->get_state = tiered_get_state;
+		ret->free_state = tiered_free_state;
+		ret->set_state = tiered_set_state;
+		ret->enable = tiered_enable;
+		ret->is_new_path = tiered_is_new_path;
+		ret->get_fuzz_result = tiered_get_fuzz_result;
+		ret->get_module_info = tiered_get_module_info;
+		ret->get_edges = tiered_get_edges;
+		ret->get_path_hash = tiered_get_path_hash;
+		ret->get_crash_hash = tiered_get_crash_hash;
+		ret->get_crash_info = tiered_get_crash_info;
+		ret->get_dictionary = tiered_get_dictionary;
+		ret->get_counters = tiered_get_counters;
+		ret->get_trace_bits = tiered_get_trace_bits;
+		ret->ignore_unstable_bytes = tiered_ignore_unstable_bytes;
+		ret->is_process_done = tiered_is_process_done;
+		ret->wait_for_process_done = tiered_wait_for_process_done;
+	}
 	else
 		FACTORY_ERROR();
 	return ret;
@@ -122,12 +230,18 @@ char * instrumentation_help(void)
 	#ifdef _WIN32
 	APPEND_HELP(text, new_text, debug_help);
 	APPEND_HELP(text, new_text, dynamorio_help);
+	#ifdef WINDOWS_IPT
+	APPEND_HELP(text, new_text, windows_ipt_help);
+	#endif
 	#else
 	APPEND_HELP(text, new_text, return_code_help);
 	APPEND_HELP(text, new_text, afl_help);
 	#if !__APPLE__ // Linux
 	APPEND_HELP(text, new_text, linux_ipt_help);
+	APPEND_HELP(text, new_text, linux_lbr_help);
+	APPEND_HELP(text, new_text, breakpoint_help);
 	#endif
 	#endif
+	APPEND_HELP(text, new_text, tiered_help);
 	return text;
 }
@@ -0,0 +1,865 @@
+// The Intel PT packet decoder and trace hashing shared by the IPT instrumentations
+#ifndef _WIN32
+#define _GNU_SOURCE // memmem
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IPT_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "bitmap.h"
+#include "ipt_decoder.h"
+
+#include <utils.h>
+
+////////////////////////////////////////////////////////////////
+// Portability helpers /////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+#ifdef _MSC_VER
+/**
+ * This function counts the leading zero bits of a 64-bit number, like __builtin_clzll
+ * @param value - the number to count the leading zeros of, which must not be zero
+ * @return - the number of leading zero bits
+ */
+static int count_leading_zeros64(uint64_t value)
+{
+  unsigned long index;
+#ifdef _M_X64
+  _BitScanReverse64(&index, value);
+  return 63 - (int)index;
+#else
+  if(value >> 32) {
+    _BitScanReverse(&index, (unsigned long)(value >> 32));
+    return 31 - (int)index;
+  }
+  _BitScanReverse(&index, (unsigned long)value);
+  return 63 - (int)index;
+#endif
+}
+
+/**
+ * This function counts the trailing zero bits of a 32-bit number, like __builtin_ctz
+ * @param value - the number to count the trailing zeros of, which must not be zero
+ * @return - the number of trailing zero bits
+ */
+static int count_trailing_zeros(uint32_t value)
+{
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return (int)index;
+}
+#else
+#define count_leading_zeros64(value) __builtin_clzll(value)
+#define count_trailing_zeros(value)  __builtin_ctz(value)
+#endif
+
+#ifdef _WIN32
+/**
+ * This function finds the first occurrence of a byte string in a buffer, as Windows doesn't have memmem
+ * @param haystack - the buffer to search
+ * @param haystack_length - the length of the haystack parameter
+ * @param needle - the byte string to search for
+ * @param needle_length - the length of the needle parameter, which must not be zero
+ * @return - the first occurrence of needle in haystack, or NULL if there isn't one
+ */
+static void * memmem(const void * haystack, size_t haystack_length, const void * needle, size_t needle_length)
+{
+  const unsigned char * p = haystack, * end = p + haystack_length;
+
+  while(end - p >= (ptrdiff_t)needle_length) {
+    p = memchr(p, *(const unsigned char *)needle, (end - p) - needle_length + 1);
+    if(!p)
+      return NULL;
+    if(!memcmp(p, needle, needle_length))
+      return (void *)p;
+    p++;
+  }
+  return NULL;
+}
+#endif
+
+////////////////////////////////////////////////////////////////
+// IPT Packet Analyzer /////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+#define BYTES_LEFT(num)    ((end - p) >= (num))
+
+//The PSB packet, which the decoder resynchronizes on
+static const unsigned char ipt_psb[16] = {
+  0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+  0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82
+};
+
+/**
+ * This function sign extends a number
+ * @param num - the number to sign extend
+ * @param sign_bit - which bit in num is the value's current sign bit
+ * @return - the sign extended number
+ */
+static uint64_t sign_extend(uint64_t num, uint8_t sign_bit)
+{
+  uint64_t mask = ~0ULL << sign_bit;
+  return num & (1ULL << (sign_bit - 1)) ? num | mask : num & ~mask;
+}
+
+/**
+ * This function parsers an IPT TIP/FUP packet and obtains the IP address that it refers to
+ * @param outp - The position of the TIP/FUP packet bytes in the IPT packet buffer.  This pointer will
+ * be updated to point after the parsed TIP/FUP packet.
+ * @param end - The end of the IPT packet buffer.  Used to ensure, we don't read past the end
+ * @param last_ip - The IP address that was in the most recent TIP/FUP packet. This value will be
+ * updated with the IP address from the parsed packet.
+ * @return - the IP address from the TIP/FUP packet.
+ */
+static uint64_t handle_ip_packet(unsigned char ** outp, unsigned char *end, uint64_t *last_ip)
+{
+  unsigned char *p = *outp;
+  uint64_t new_ip;
+  int num_bytes;
+  uint64_t new_bytes;
+
+  int ip_bytes = p[0] >> 5;
+
+  if (ip_bytes == 0) //IP is out of context
+    return 0;
+  else if(ip_bytes == 1) { //Bottom 32 bits, last_ip top 48
+    num_bytes = 2;
+    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFULL;
+    new_ip = (*last_ip & (0xFFFFFFFFFFFFULL << 16)) | new_bytes;
+  } else if(ip_bytes == 2) { //Bottom 32 bits, last_ip top 32
+    num_bytes = 4;
+    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFULL;
+    new_ip = (*last_ip & (0xFFFFFFFFULL << 32)) | new_bytes;
+  } else if(ip_bytes == 3) { //Bottom 48 bits, sign extended
+    num_bytes = 6;
+    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFFFFFULL;
+    new_ip = sign_extend(new_bytes, 48);
+  } else if(ip_bytes == 4) { //Bottom 48 bits, last_ip top 16
+    num_bytes = 6;
+    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFFFFFULL;
+    new_ip = (*last_ip & (0xFFFFULL << 48)) | new_bytes;
+  } else if(ip_bytes == 6) { //All 64 bits
+    num_bytes = 8;
+    new_ip = *((uint64_t *)(p+1));
+  } else {
+    WARNING_MSG("Got unknown IP packet (IPBytes=%d)", ip_bytes);
+    return 0;
+  }
+
+  if (!BYTES_LEFT(num_bytes)) {
+    WARNING_MSG("Got error in handle_ip_packet: Not enough bytes for decoding IP (have %lu, need %lu)", end-p, ip_bytes);
+    return 0;
+  }
+
+  *outp = p + num_bytes;
+  *last_ip = new_ip;
+  return new_ip;
+}
+
+/**
+ * This function adds the buffered words to a hash, and empties the buffer
+ * @param hash - the hash to update
+ * @param buffer - the buffered words
+ * @param buffered - a pointer to the number of words in buffer, which is set to zero
+ */
+static void flush_hash_buffer(XXH64_state_t * hash, uint64_t * buffer, size_t * buffered)
+{
+  if(*buffered && XXH64_update(hash, buffer, *buffered * sizeof(uint64_t)) == XXH_ERROR)
+    WARNING_MSG("Updating the TIP/TNT hash failed!"); //Should never happen
+  *buffered = 0;
+}
+
+/**
+ * This function adds any remaining TNT packet bits to the TNT hash being recorded, and hashes the buffered TNT words
+ * and TIP addresses, so that the hashes can be digested
+ * @param ipt_hashes - A pointer to the hash structure with the TNT hash to update
+ */
+static void finish_tnt_hash(struct ipt_hash_state * ipt_hashes)
+{
+  //There's always room for these two, as the buffer is flushed whenever it fills up
+  if(ipt_hashes->num_bits != 0)
+    ipt_hashes->tnt_buffer[ipt_hashes->tnt_buffered++] = ipt_hashes->tnt_bits;
+  if(ipt_hashes->tnt_buffered == IPT_HASH_BUFFER_WORDS)
+    flush_hash_buffer(ipt_hashes->tnt, ipt_hashes->tnt_buffer, &ipt_hashes->tnt_buffered);
+  //Add in the total number of bits, so we can differentiate between a packet with TNN and a packet with TN
+  ipt_hashes->tnt_buffer[ipt_hashes->tnt_buffered++] = ipt_hashes->total_num_bits;
+
+  flush_hash_buffer(ipt_hashes->tnt, ipt_hashes->tnt_buffer, &ipt_hashes->tnt_buffered);
+  flush_hash_buffer(ipt_hashes->tip, ipt_hashes->tip_buffer, &ipt_hashes->tip_buffered);
+}
+
+/**
+ * This function spreads the low bits of a value out over the even bits, i.e. bit n moves to bit 2n
+ * @param bits - the bits to spread, at most 8 of them
+ * @return - the spread bits
+ */
+static uint32_t spread_tnt_bits(uint32_t bits)
+{
+#ifdef __BMI2__
+  return _pdep_u32(bits, 0x5555);
+#else
+  bits = (bits | (bits << 4)) & 0x0f0f;
+  bits = (bits | (bits << 2)) & 0x3333;
+  return (bits | (bits << 1)) & 0x5555;
+#endif
+}
+
+/**
+ * This function adds TNT packet bits to the TNT hash being recorded.  The hash is built 8 TNT bits at a time, and each
+ * bit goes into the hash word at its position in its packet byte plus the number of bits already in the word, so the
+ * bits taken from one packet byte into one word are spread over every other bit of it.  Rather than move the bits
+ * one at a time, each such run is spread at once, and the finished words are buffered to be hashed a block at a time.
+ * @param ipt_hashes - A pointer to the hash structure with the TNT hash to update
+ * @param tnt_bits - the TNT bits to add to the hash, starting with bit 0
+ * @param num_bits - the number of bits in the tnt_bits parameter
+ */
+static void add_tnt_to_hash(struct ipt_hash_state * ipt_hashes, uint64_t tnt_bits, int num_bits)
+{
+  uint64_t * words, word = ipt_hashes->tnt_bits, word_bits = ipt_hashes->num_bits;
+  int i, count, num_words = 0;
+#ifdef IPT_DEBUG
+  char bit_string[65];
+
+  for(i = 0; i < num_bits; i++)
+    bit_string[i] = (tnt_bits >> i) & 1 ? 'T' : 'N';
+  bit_string[num_bits] = 0;
+
+  IPT_DEBUG_MSG("TNT bits %d: %s", num_bits, bit_string);
+#endif
+
+  //A packet finishes at most 7 words, so make sure the buffer has room for them
+  if(ipt_hashes->tnt_buffered > IPT_HASH_BUFFER_WORDS - 7)
+    flush_hash_buffer(ipt_hashes->tnt, ipt_hashes->tnt_buffer, &ipt_hashes->tnt_buffered);
+  words = ipt_hashes->tnt_buffer + ipt_hashes->tnt_buffered;
+
+  for(i = 0; i < num_bits; i += count) {
+    //Take the bits up to the end of the packet byte or the hash word, whichever comes first
+    count = 8 - (i % 8);
+    if(count > 8 - word_bits)
+      count = 8 - word_bits;
+    if(count > num_bits - i)
+      count = num_bits - i;
+    word |= (uint64_t)spread_tnt_bits((tnt_bits >> i) & ((1 << count) - 1)) << (i % 8 + word_bits);
+    word_bits += count;
+    if(word_bits == 8) {
+      words[num_words++] = word;
+      word = 0;
+      word_bits = 0;
+    }
+  }
+  ipt_hashes->tnt_buffered += num_words;
+  if(ipt_hashes->tnt_buffered == IPT_HASH_BUFFER_WORDS)
+    flush_hash_buffer(ipt_hashes->tnt, ipt_hashes->tnt_buffer, &ipt_hashes->tnt_buffered);
+  ipt_hashes->tnt_bits = word;
+  ipt_hashes->num_bits = word_bits;
+  ipt_hashes->total_num_bits += num_bits;
+}
+
+/**
+ * This function records an AFL style edge from the previous location to the given location in the edge bitmap
+ * @param decoder - the decoder recording the trace
+ * @param location - a value identifying the current location in the target
+ */
+static void add_edge_to_bitmap(struct ipt_decoder * decoder, uint64_t location)
+{
+  //Spread the location over the whole bitmap, as nearby addresses differ only in their low bits
+  uint32_t cur = (uint32_t)((location * 0x9E3779B97F4A7C15ULL) >> 32);
+
+  decoder->trace_bits[(cur ^ decoder->prev_location) & (decoder->map_size - 1)]++;
+  decoder->prev_location = cur >> 1;
+}
+
+/**
+ * This function finds the coverage library that contains an address.  Consecutive TIP addresses are usually in the
+ * same library, so the most recently found library is checked first, before a binary search of the sorted ranges.
+ * @param decoder - the decoder recording the trace
+ * @param address - the address to look up
+ * @return - the library's address range, or NULL if the address isn't in any of the coverage libraries
+ */
+static struct ipt_library_range * find_library_range(struct ipt_decoder * decoder, uint64_t address)
+{
+  struct ipt_library_range * range = decoder->last_library_range;
+  size_t low = 0, high = decoder->num_library_ranges, mid;
+
+  if(range && range->start <= address && address < range->end)
+    return range;
+
+  while(low < high) {
+    mid = low + (high - low) / 2;
+    range = &decoder->library_ranges[mid];
+    if(address < range->start)
+      high = mid;
+    else if(address >= range->end)
+      low = mid + 1;
+    else {
+      decoder->last_library_range = range;
+      return range;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * This function adds TNT packet bits to the edge bitmap.  Without the target's control flow graph, the address of
+ * each conditional branch is not known, so each branch is instead identified by the most recent TIP address and the
+ * TNT bits that have been taken since it.  The number of bits remembered is limited to IPT_TNT_HISTORY_BITS, so
+ * that a loop only adds a bounded number of edges.
+ * @param decoder - the decoder recording the trace
+ * @param tnt_bits - the TNT bits to add to the edge bitmap
+ * @param num_bits - the number of bits in the tnt_bits parameter
+ */
+static void add_tnt_to_bitmap(struct ipt_decoder * decoder, uint64_t tnt_bits, int num_bits)
+{
+  const uint32_t history_mask = (1 << IPT_TNT_HISTORY_BITS) - 1;
+  int i;
+
+  //The oldest branch is in the most significant bit
+  for(i = num_bits - 1; i >= 0; i--) {
+    decoder->tnt_history = ((decoder->tnt_history << 1) | ((tnt_bits >> i) & 1)) & history_mask;
+    add_edge_to_bitmap(decoder, (decoder->last_tip << (IPT_TNT_HISTORY_BITS + 1))
+      | (1 << IPT_TNT_HISTORY_BITS) | decoder->tnt_history);
+  }
+}
+
+/**
+ * This function adds TNT packet bits to either the TNT hash or the edge bitmap, depending on whether the decoder has an edge bitmap
+ * @param decoder - the decoder recording the trace
+ * @param tnt_bits - the TNT bits to add, starting with bit 0
+ * @param num_bits - the number of bits in the tnt_bits parameter
+ */
+static void add_tnt(struct ipt_decoder * decoder, uint64_t tnt_bits, int num_bits)
+{
+  if(num_bits < 0) //A malformed packet without a stop bit
+    return;
+  if(decoder->trace_bits)
+    add_tnt_to_bitmap(decoder, tnt_bits, num_bits);
+  else
+    add_tnt_to_hash(&decoder->hashes, tnt_bits, num_bits);
+}
+
+/**
+ * This function adds a TIP packet's IP address to the TIP hash being recorded, or to the edge bitmap if the decoder
+ * has one
+ * @param decoder - the decoder recording the trace
+ * @param tip - the IP address to add to the TIP hash
+ */
+static void add_tip_to_hash(struct ipt_decoder * decoder, uint64_t tip)
+{
+  uint64_t adjusted_address = tip;
+  struct ipt_library_range * range;
+
+  IPT_DEBUG_MSG("TIP %lx", tip);
+
+  //Adjust the reported address to remove ASLR
+  if(decoder->library_ranges) {
+    //Normalize the address, then mix in the hash of the library to ensure there are not collisions
+    //when two separate libraries report a TIP at the same offset
+    range = find_library_range(decoder, tip);
+    if(range)
+      adjusted_address = (tip - range->start) | (((uint64_t)range->hash) << 32);
+  } else if(decoder->target_start <= tip && tip < decoder->target_end) //if the address is in the target executable
+    adjusted_address = tip - decoder->target_start; //normalize the address with the target's start address
+
+  if(decoder->trace_bits) {
+    add_edge_to_bitmap(decoder, adjusted_address);
+    decoder->last_tip = adjusted_address;
+    decoder->tnt_history = 0;
+  } else {
+    decoder->hashes.tip_buffer[decoder->hashes.tip_buffered++] = adjusted_address;
+    if(decoder->hashes.tip_buffered == IPT_HASH_BUFFER_WORDS)
+      flush_hash_buffer(decoder->hashes.tip, decoder->hashes.tip_buffer, &decoder->hashes.tip_buffered);
+  }
+}
+
+/**
+ * This function determines how many bits are in a TNT packet, from the position of its stop bit
+ * @param payload - the TNT packet's payload, including the stop bit
+ * @return - the number of TNT bits below the stop bit, or -1 if there is no stop bit
+ */
+static int get_tnt_num_bits(uint64_t payload)
+{
+  return payload ? 63 - count_leading_zeros64(payload) : -1;
+}
+
+/**
+ * This function reads the payload of a long TNT packet
+ * @param packet - A pointer to the long TNT packet
+ * @return - the packet's 6 byte payload
+ */
+static uint64_t get_long_tnt_payload(unsigned char * packet)
+{
+  uint64_t payload = 0;
+  memcpy(&payload, packet + 2, 6); //IPT is only on x86, so the payload is already in little endian order
+  return payload;
+}
+
+/**
+ * This function skips a run of PAD packets, 16 bytes at a time where SSE2 is available
+ * @param p - the first PAD packet of the run
+ * @param limit - the end of the bytes that may be skipped
+ * @return - the first byte after the run, or limit if the run reaches it
+ */
+static unsigned char * skip_pad_packets(unsigned char * p, unsigned char * limit)
+{
+#ifdef IPT_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  int mask;
+
+  while(limit - p >= 16) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero));
+    if(mask != 0xffff)
+      return p + count_trailing_zeros(~mask);
+    p += 16;
+  }
+#endif
+  while(p < limit && !*p)
+    p++;
+  return p;
+}
+
+/**
+ * This function checks whether a PSB packet starts at the given position
+ * @param p - the position to check, which must have at least 16 bytes after it
+ * @return - non-zero if there is a PSB packet at p, zero otherwise
+ */
+static int is_psb(const unsigned char * p)
+{
+#ifdef IPT_SSE2
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+    _mm_loadu_si128((const __m128i *)ipt_psb))) == 0xffff;
+#else
+  return !memcmp(p, ipt_psb, sizeof(ipt_psb));
+#endif
+}
+
+/**
+ * This function finds the first PSB packet in a buffer.  Where SSE2 is available, the buffer is scanned 16 bytes at
+ * a time for the 0x02 0x82 pairs that a PSB starts with, and only those are compared against the whole PSB.
+ * @param p - the start of the buffer
+ * @param end - the end of the buffer
+ * @return - the start of the first PSB packet, or NULL if there isn't one
+ */
+static unsigned char * find_psb(unsigned char * p, unsigned char * end)
+{
+#ifdef IPT_SSE2
+  const __m128i first = _mm_set1_epi8(0x02), second = _mm_set1_epi8((char)0x82);
+  int mask;
+
+  //Every candidate in the 16 bytes at p needs the rest of its PSB before end, as does the load at p + 1
+  while(end - p >= 32) {
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), first),
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), second)));
+    for(; mask; mask &= mask - 1) {
+      if(is_psb(p + count_trailing_zeros(mask)))
+        return p + count_trailing_zeros(mask);
+    }
+    p += 16;
+  }
+#endif
+  return memmem(p, end - p, ipt_psb, sizeof(ipt_psb));
+}
+
+/**
+ * This function sets up a decoder.  The caller should set the decoder's edge bitmap and address ranges, if any, and
+ * reset it before each trace.
+ * @param decoder - the decoder to set up, which should be zeroed
+ * @return - 0 on success, non-zero on failure
+ */
+int ipt_decoder_init(struct ipt_decoder * decoder)
+{
+  decoder->hashes.tip = XXH64_createState();
+  decoder->hashes.tnt = XXH64_createState();
+  return !decoder->hashes.tip || !decoder->hashes.tnt;
+}
+
+/**
+ * This function frees the decoder's hashes.  The edge bitmap and address ranges belong to the caller.
+ * @param decoder - the decoder to clean up
+ */
+void ipt_decoder_cleanup(struct ipt_decoder * decoder)
+{
+  if(decoder->hashes.tip)
+    XXH64_freeState(decoder->hashes.tip);
+  if(decoder->hashes.tnt)
+    XXH64_freeState(decoder->hashes.tnt);
+  decoder->hashes.tip = decoder->hashes.tnt = NULL;
+}
+
+/**
+ * This function resets the IPT decoder and hashes, so that a new execution trace can be recorded
+ * @param decoder - the decoder recording the trace
+ * @param return - 0 on success, non-zero on failure
+ */
+int ipt_decoder_reset(struct ipt_decoder * decoder)
+{
+  decoder->leftover = 0;
+  decoder->bytes_decoded = 0;
+  decoder->unknown_packet_hit = 0;
+  decoder->last_ip = 0;
+  decoder->overflows = 0;
+
+  if(decoder->trace_bits) {
+    memset(decoder->trace_bits, 0, decoder->map_size);
+    decoder->prev_location = 0;
+    decoder->last_tip = 0;
+    decoder->tnt_history = 0;
+  }
+
+  decoder->hashes.tnt_bits = 0;
+  decoder->hashes.num_bits = 0;
+  decoder->hashes.total_num_bits = 0;
+  decoder->hashes.tnt_buffered = 0;
+  decoder->hashes.tip_buffered = 0;
+  if(XXH64_reset(decoder->hashes.tnt, 0) == XXH_ERROR ||
+      XXH64_reset(decoder->hashes.tip, 0) == XXH_ERROR)
+    return 1;
+  return 0;
+}
+
+/**
+ * This function parses a block of IPT packets, and adds the TIP/TNT packets in it to the hashes being recorded.
+ * Unless this is the final block of the trace, parsing stops short of the end of the block, so that no packet
+ * split across two blocks is misparsed.  The unparsed bytes should be passed in again at the start of the next
+ * block.
+ * @param decoder - the decoder recording the trace
+ * @param start - The start of the IPT packet block
+ * @param end - The end of the IPT packet block
+ * @param final - whether this is the last block in the trace
+ * @return - the number of bytes that were parsed
+ */
+size_t ipt_decode_packets(struct ipt_decoder * decoder, unsigned char * start, unsigned char * end, int final)
+{
+  unsigned char * p = start, * limit, * psb_pos;
+  uint64_t ip_address, tnt_payload;
+
+  if(!final && end - start <= IPT_MAX_PACKET_SIZE)
+    return 0;
+  limit = final ? end : end - IPT_MAX_PACKET_SIZE;
+
+  //Rather than use Intel's libipt, we instead parse the buffer ourselves to ensure we can do so
+  //quickly.  As we only need the TIP/TNT packets, this parser attempts to parse as little else
+  //as possible.  Further, we only record hashes of the TIP/TNT packets, as full decoding of the
+  //IPT packets to match them to the basic blocks transitions is far too slow.
+  while(p < limit) {
+
+    if(decoder->unknown_packet_hit) {
+      psb_pos = find_psb(p, end);
+      if(!psb_pos) {
+        //Keep anything that could be the start of a PSB split across drains
+        if(!final && end - p >= sizeof(ipt_psb))
+          return (end - start) - (sizeof(ipt_psb) - 1);
+        if(final)
+          DEBUG_MSG("Couldn't find PSB packet");
+        return final ? end - start : p - start;
+      }
+      if(psb_pos - p != 0)
+        IPT_DEBUG_MSG("Skipping %d bytes", psb_pos - p);
+      p = psb_pos + sizeof(ipt_psb);
+      decoder->last_ip = 0;
+      decoder->unknown_packet_hit = 0;
+    }
+
+    while(p < limit)
+    {
+      IPT_DEBUG_MSG_PACKET("%04x: %02x %02x %02x %02x %02x %02x %02x %02x", decoder->bytes_decoded + (p - start),
+          (unsigned char)p[0], (unsigned char)p[1], (unsigned char)p[2], (unsigned char)p[3],
+          (unsigned char)p[4], (unsigned char)p[5], (unsigned char)p[6], (unsigned char)p[7]);
+
+      if (p[0] == 2 && BYTES_LEFT(2)) {
+        if (p[1] == 0xa3 && BYTES_LEFT(8)) { // Long TNT
+          IPT_DEBUG_MSG_PACKET("Long TNT");
+          tnt_payload = get_long_tnt_payload(p);
+          add_tnt(decoder, tnt_payload, get_tnt_num_bits(tnt_payload));
+          p += 8;
+          continue;
+        }
+        if (p[1] == 0x43 && BYTES_LEFT(8)) { // PIP
+          IPT_DEBUG_MSG_PACKET("PIP");
+          p += 8;
+          continue;
+        }
+        if (p[1] == 3 && BYTES_LEFT(4)) { // CBR
+          IPT_DEBUG_MSG_PACKET("CBR");
+          p += 4;
+          continue;
+        }
+        if (p[1] == 0x83) { //TRACESTOP
+          IPT_DEBUG_MSG_PACKET("TRACESTOP");
+          p += 2;
+          continue;
+        }
+        if (p[1] == 0xf3 && BYTES_LEFT(8)) { // OVF
+          p += 8;
+          decoder->overflows++;
+          WARNING_MSG("IPT received overflow packet");
+          continue;
+        }
+        if (p[1] == 0x82 && BYTES_LEFT(16) && is_psb(p)) { // PSB
+          IPT_DEBUG_MSG_PACKET("PSB");
+          p += 16;
+          decoder->last_ip = 0;
+          continue;
+        }
+        if (p[1] == 0x23) { // PSBEND
+          IPT_DEBUG_MSG_PACKET("PSBEND");
+          p += 2;
+          continue;
+        }
+        if (p[1] == 0xc3 && BYTES_LEFT(11) && p[2] == 0x88) { //MNT
+          IPT_DEBUG_MSG_PACKET("MNT");
+          p += 10;
+          continue;
+        }
+        if (p[1] == 0x73 && BYTES_LEFT(7)) { //TMA
+          IPT_DEBUG_MSG_PACKET("TMA");
+          p += 7;
+          continue;
+        }
+        if (p[1] == 0xc8 && BYTES_LEFT(7)) { //VMCS
+          IPT_DEBUG_MSG_PACKET("VMCS");
+          p += 7;
+          continue;
+        }
+      }
+
+      if(!(p[0] & 1)) {
+        if (p[0] == 0) { // PAD
+          IPT_DEBUG_MSG_PACKET("PAD");
+          p = skip_pad_packets(p + 1, limit);
+          continue;
+        }
+
+        // Short TNT
+        add_tnt(decoder, p[0] >> 1, get_tnt_num_bits(p[0] >> 1));
+        IPT_DEBUG_MSG_PACKET("SHORT TNT");
+        p++;
+        continue;
+      }
+
+#define TIP_TYPE_TIP     0xd
+#define TIP_TYPE_TIP_PGE 0x11
+#define TIP_TYPE_TIP_PGD 0x1
+#define TIP_TYPE_FUP     0x1d
+
+      char tip_type = p[0] & 0x1f;
+      if(tip_type == TIP_TYPE_TIP || tip_type == TIP_TYPE_TIP_PGE
+          || tip_type == TIP_TYPE_TIP_PGD || tip_type == TIP_TYPE_FUP) {
+        ip_address = handle_ip_packet(&p, end, &decoder->last_ip);
+        IPT_DEBUG_MSG_PACKET("TIP/PGE/PGD/FUP");
+        if(tip_type == TIP_TYPE_TIP)
+          add_tip_to_hash(decoder, ip_address);
+        p++;
+        continue;
+      }
+
+      if (p[0] == 0x99 && BYTES_LEFT(2)) { // MODE
+        IPT_DEBUG_MSG_PACKET("MODE");
+        p += 2;
+        continue;
+      }
+
+      if (p[0] == 0x19 && BYTES_LEFT(8)) { // TSC
+        IPT_DEBUG_MSG_PACKET("TSC");
+        p+=8;
+        continue;
+      }
+      if (p[0] == 0x59 && BYTES_LEFT(2)) { // MTC
+        IPT_DEBUG_MSG_PACKET("MTC");
+        p += 2;
+        continue;
+      }
+      if ((p[0] & 3) == 3) { // CYC
+        IPT_DEBUG_MSG_PACKET("CYC");
+        if ((p[0] & 4) && BYTES_LEFT(1)) {
+          do {
+            p++;
+          } while ((p[0] & 1) && BYTES_LEFT(1));
+        }
+        p++;
+        continue;
+      }
+
+      WARNING_MSG("Hit unknown packet type at offset 0x%lx", decoder->bytes_decoded + (p - start));
+      decoder->unknown_packet_hit = 1;
+      break;
+    }
+  }
+  return (p < end ? p : end) - start;
+}
+
+/**
+ * This function finishes recording a trace.  When the trace is recorded in an edge bitmap, the bitmap's hit counts
+ * are classified, otherwise the trace's hashes are returned.
+ * @param decoder - the decoder that recorded the trace
+ * @param key - a pointer used to return the trace's hashes, when it isn't recorded in an edge bitmap
+ */
+void ipt_decoder_finish(struct ipt_decoder * decoder, struct ipt_hashtable_key * key)
+{
+  if(decoder->trace_bits) {
+    bitmap_classify_counts(decoder->trace_bits, decoder->map_size);
+    return;
+  }
+
+  finish_tnt_hash(&decoder->hashes);
+  key->tip = XXH64_digest(decoder->hashes.tip);
+  key->tnt = XXH64_digest(decoder->hashes.tnt);
+  DEBUG_MSG("Got TIP hash 0x%llx and TNT hash 0x%llx", key->tip, key->tnt);
+}
+
+////////////////////////////////////////////////////////////////
+// IPT Trace Hash Set //////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+static int compare_hash_keys(const void * first, const void * second)
+{
+  return memcmp(first, second, sizeof(struct ipt_hashtable_key));
+}
+
+static int is_zero_key(const struct ipt_hashtable_key * key)
+{
+  return !key->tip && !key->tnt;
+}
+
+/**
+ * This function picks the first slot to probe for a key in the hash set.  The keys are already hashes, so they
+ * only need to be combined.
+ * @param key - the key to find the slot for
+ * @param num_slots - the number of slots in the hash set
+ * @return - the index of the slot
+ */
+static size_t hash_set_slot(const struct ipt_hashtable_key * key, size_t num_slots)
+{
+  return (size_t)(key->tip ^ (key->tnt * 0x9E3779B97F4A7C15ULL)) & (num_slots - 1);
+}
+
+/**
+ * This function ensures the hash set has room for the given number of keys, while staying at most half full
+ * @param hash_set - the hash set to grow
+ * @param num_keys - the number of keys that the hash set should be able to hold
+ * @return - 0 on success, non-zero on failure
+ */
+static int reserve_hash_set(struct ipt_hash_set * hash_set, size_t num_keys)
+{
+  struct ipt_hashtable_key * slots;
+  size_t num_slots, i, slot;
+
+  num_slots = hash_set->num_slots ? hash_set->num_slots : IPT_HASH_SET_MIN_SLOTS;
+  while(num_slots / 2 < num_keys)
+    num_slots *= 2;
+  if(num_slots == hash_set->num_slots)
+    return 0;
+
+  slots = calloc(num_slots, sizeof(struct ipt_hashtable_key));
+  if(!slots) {
+    ERROR_MSG("Failed to allocate memory for %lu IPT trace hashes", num_keys);
+    return 1;
+  }
+  for(i = 0; i < hash_set->num_slots; i++) {
+    if(is_zero_key(&hash_set->slots[i]))
+      continue;
+    for(slot = hash_set_slot(&hash_set->slots[i], num_slots); !is_zero_key(&slots[slot]); slot = (slot + 1) & (num_slots - 1))
+      ;
+    slots[slot] = hash_set->slots[i];
+  }
+
+  free(hash_set->slots);
+  hash_set->slots = slots;
+  hash_set->num_slots = num_slots;
+  return 0;
+}
+
+/**
+ * This function adds a key to the hash set, if it isn't already in it
+ * @param hash_set - the hash set to add the key to
+ * @param key - the key to add
+ * @return - 1 if the key was added, 0 if it was already in the hash set, or -1 on failure
+ */
+int ipt_hash_set_add(struct ipt_hash_set * hash_set, const struct ipt_hashtable_key * key)
+{
+  size_t slot;
+
+  if(is_zero_key(key)) {
+    if(hash_set->has_zero_key)
+      return 0;
+    hash_set->has_zero_key = 1;
+    return 1;
+  }
+
+  if(reserve_hash_set(hash_set, hash_set->num_keys + 1))
+    return -1;
+
+  for(slot = hash_set_slot(key, hash_set->num_slots); !is_zero_key(&hash_set->slots[slot]);
+      slot = (slot + 1) & (hash_set->num_slots - 1)) {
+    if(!compare_hash_keys(&hash_set->slots[slot], key))
+      return 0;
+  }
+  hash_set->slots[slot] = *key;
+  hash_set->num_keys++;
+  return 1;
+}
+
+/**
+ * This function adds an array of keys to the hash set
+ * @param hash_set - the hash set to add the keys to
+ * @param keys - the keys to add
+ * @param num_keys - the number of keys in the keys parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int ipt_hash_set_add_keys(struct ipt_hash_set * hash_set, const struct ipt_hashtable_key * keys, size_t num_keys)
+{
+  size_t i;
+
+  if(reserve_hash_set(hash_set, hash_set->num_keys + num_keys))
+    return 1;
+  for(i = 0; i < num_keys; i++) {
+    if(ipt_hash_set_add(hash_set, &keys[i]) < 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * This function gets the keys in the hash set, sorted so that states can be compared and merged without loading them
+ * @param hash_set - the hash set to get the keys from
+ * @param num_keys - a pointer used to return the number of keys
+ * @return - an array of the keys that should be freed by the caller, or NULL on failure
+ */
+struct ipt_hashtable_key * ipt_hash_set_get_keys(struct ipt_hash_set * hash_set, size_t * num_keys)
+{
+  struct ipt_hashtable_key * keys;
+  size_t i, count = 0;
+
+  keys = malloc((hash_set->num_keys + 1) * sizeof(struct ipt_hashtable_key));
+  if(!keys)
+    return NULL;
+  if(hash_set->has_zero_key)
+    memset(&keys[count++], 0, sizeof(struct ipt_hashtable_key));
+  for(i = 0; i < hash_set->num_slots; i++) {
+    if(!is_zero_key(&hash_set->slots[i]))
+      keys[count++] = hash_set->slots[i];
+  }
+  qsort(keys, count, sizeof(struct ipt_hashtable_key), compare_hash_keys);
+  *num_keys = count;
+  return keys;
+}
+
+/**
+ * This function empties the hash set and frees its memory
+ * @param hash_set - the hash set to clear
+ */
+void ipt_hash_set_clear(struct ipt_hash_set * hash_set)
+{
+  free(hash_set->slots);
+  memset(hash_set, 0, sizeof(struct ipt_hash_set));
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// The Intel PT packet decoder and trace hashing shared by the linux_ipt and windows_ipt instrumentations.  It only
+// depends on the trace data, so each instrumentation collects the trace its own way and passes the packets in.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xxhash.h"
+
+//Uncomment this #define to make the IPT parser print each packet and parser details
+//#define IPT_DEBUG
+
+#ifdef IPT_DEBUG
+//Prints each IPT packet and the packet bytes
+#define IPT_DEBUG_MSG_PACKET(...) DEBUG_MSG(__VA_ARGS__)
+//Prints status messages about the parser
+#define IPT_DEBUG_MSG(...)        DEBUG_MSG(__VA_ARGS__)
+#else
+#define IPT_DEBUG_MSG_PACKET(...)
+#define IPT_DEBUG_MSG(...)
+#endif
+
+struct ipt_hashtable_key {
+  uint64_t tip;
+  uint64_t tnt;
+};
+
+//The set of previously seen trace hashes.  This is an open addressing hash table in one allocation, using linear
+//probing and kept at most half full.  The all zero key marks empty slots, so it's tracked separately.
+struct ipt_hash_set
+{
+  struct ipt_hashtable_key * slots;
+  size_t num_slots; //Always zero or a power of two
+  size_t num_keys;
+  int has_zero_key;
+};
+
+//The initial number of slots in the ipt_hash_set
+#define IPT_HASH_SET_MIN_SLOTS  1024
+
+//The number of TNT words and TIP addresses that are buffered before they're hashed.  Together the buffers are 8KB,
+//so they stay in the L1 cache while the decoder fills them.
+#define IPT_HASH_BUFFER_WORDS   512
+
+struct ipt_hash_state
+{
+  uint64_t tnt_bits;
+  uint64_t num_bits;
+  uint64_t total_num_bits;
+  XXH64_state_t * tnt;
+  XXH64_state_t * tip;
+
+  //The TNT words and TIP addresses that haven't been added to the hashes yet.  They're hashed a block at a time,
+  //which gives the same hashes as adding them one at a time, without a streaming update for each one.
+  uint64_t tnt_buffer[IPT_HASH_BUFFER_WORDS];
+  size_t tnt_buffered;
+  uint64_t tip_buffer[IPT_HASH_BUFFER_WORDS];
+  size_t tip_buffered;
+};
+
+//The largest IPT packet the parser handles (PSB)
+#define IPT_MAX_PACKET_SIZE     16
+//The scratch buffer holds a straddling packet plus enough of the following data to parse past it, and some
+//extra space since the parser can read a few bytes past the last packet
+#define IPT_SCRATCH_DATA_SIZE   (2 * IPT_MAX_PACKET_SIZE)
+
+//The default size of the edge bitmap, when the edge_bitmap option is used
+#define IPT_DEFAULT_MAP_SIZE    (1 << 16)
+//The number of recent TNT bits mixed into the location of each conditional branch in the edge bitmap
+#define IPT_TNT_HISTORY_BITS    8
+
+//The address range of a coverage library in the target, and the hash used to tell apart libraries' addresses
+struct ipt_library_range
+{
+  uint64_t start;
+  uint64_t end;
+  uint32_t hash;
+};
+
+struct ipt_decoder
+{
+  unsigned char scratch[IPT_SCRATCH_DATA_SIZE + IPT_MAX_PACKET_SIZE];
+  size_t leftover;        //The bytes at the start of scratch that are part of a packet that hasn't been parsed yet
+  uint64_t bytes_decoded; //The number of bytes of the current trace that have been parsed
+  int unknown_packet_hit; //Whether the parser is looking for a PSB packet to resynchronize on
+  uint64_t last_ip;       //The IP address in the most recent TIP/FUP packet
+  uint64_t overflows;     //The number of OVF packets in the current trace
+
+  struct ipt_hash_state hashes; //The hashes of the current trace, unless it's recorded in an edge bitmap
+
+  uint8_t * trace_bits;   //If set, the edge bitmap that the current trace's edges are recorded in, rather than hashed
+  int map_size;           //The size of trace_bits, a power of two
+  uint32_t prev_location; //The AFL style previous location, used to index the edge bitmap
+  uint64_t last_tip;      //The normalized address of the most recent TIP packet
+  uint32_t tnt_history;   //The most recent TNT bits
+
+  //TIP addresses are normalized to remove ASLR.  If library_ranges is set, they're made relative to the coverage
+  //library they're in, otherwise addresses in the target executable are made relative to target_start.
+  struct ipt_library_range * library_ranges; //Sorted by start address
+  size_t num_library_ranges;
+  struct ipt_library_range * last_library_range; //The range that the most recent TIP address was found in
+  uint64_t target_start;
+  uint64_t target_end;
+};
+
+int ipt_decoder_init(struct ipt_decoder * decoder);
+void ipt_decoder_cleanup(struct ipt_decoder * decoder);
+int ipt_decoder_reset(struct ipt_decoder * decoder);
+size_t ipt_decode_packets(struct ipt_decoder * decoder, unsigned char * start, unsigned char * end, int final);
+void ipt_decoder_finish(struct ipt_decoder * decoder, struct ipt_hashtable_key * key);
+
+int ipt_hash_set_add(struct ipt_hash_set * hash_set, const struct ipt_hashtable_key * key);
+int ipt_hash_set_add_keys(struct ipt_hash_set * hash_set, const struct ipt_hashtable_key * keys, size_t num_keys);
+struct ipt_hashtable_key * ipt_hash_set_get_keys(struct ipt_hash_set * hash_set, size_t * num_keys);
+void ipt_hash_set_clear(struct ipt_hash_set * hash_set);
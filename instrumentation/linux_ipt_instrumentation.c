@@ -1,9 +1,14 @@
 // Linux-only Intel PT instrumentation.
 #define _GNU_SOURCE
 
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/perf_event.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -13,445 +18,487 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "binary_state.h"
+#include "bitmap.h"
 #include "instrumentation.h"
+#include "ipt_decoder.h"
 #include "linux_ipt_instrumentation.h"
 #include "forkserver_internal.h"
-#include "uthash.h"
 #include "xxhash.h"
 
 #include <utils.h>
 #include <jansson_helper.h>
 
+//The CPUs that this process's states picked with IPT_CPU_AUTO.  Their threads are only pinned when they first run the
+//target, so until then the other states in the process (e.g. the other fuzzer workers) can't find them in /proc.
+static pthread_mutex_t claimed_cpus_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cpu_set_t claimed_cpus;
+
 ////////////////////////////////////////////////////////////////
-// IPT Packet Analyzer /////////////////////////////////////////
+// IPT Trace Collection ////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 
-//Uncomment this #define to make the IPT parser print each packet and parser details
-//#define IPT_DEBUG
-
-#ifdef IPT_DEBUG
-//Prints each IPT packet and the packet bytes
-#define IPT_DEBUG_MSG_PACKET(...) DEBUG_MSG(__VA_ARGS__)
-//Prints status messages about the parser
-#define IPT_DEBUG_MSG(...)        DEBUG_MSG(__VA_ARGS__)
-#else
-#define IPT_DEBUG_MSG_PACKET(...)
-#define IPT_DEBUG_MSG(...)
-#endif
-
-#define BYTES_LEFT(num)    ((end - p) >= (num))
-#define BIT_TEST(num, bit) ((num) & (1 << (bit)))
-
 /**
- * This function sign extends a number
- * @param num - the number to sign extend
- * @param sign_bit - which bit in num is the value's current sign bit
- * @return - the sign extended number
+ * This function decodes any new trace data in the AUX ring buffer.  The packets are parsed in place in the ring
+ * buffer, and only the few bytes of a packet that straddles the end of the ring buffer (or the end of the trace)
+ * are copied into the decoder's scratch buffer.  The AUX tail is advanced as the data is parsed, so the kernel can
+ * reuse that part of the ring buffer while the target is still running.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param final - whether the trace has ended, and all of the remaining data should be decoded
  */
-static uint64_t sign_extend(uint64_t num, uint8_t sign_bit)
+static void drain_ipt(linux_ipt_state_t * state, int final)
 {
-  uint64_t mask = ~0ULL << sign_bit;
-  return num & (1ULL << (sign_bit - 1)) ? num | mask : num & ~mask;
+  struct ipt_decoder * decoder = &state->decoder;
+  unsigned char * ring = (unsigned char *)state->perf_aux_buf;
+  uint64_t head, tail, offset, count, aux_size = state->pem->aux_size;
+  size_t consumed, remaining;
+  int last_block;
+
+  head = __atomic_load_n(&state->pem->aux_head, __ATOMIC_ACQUIRE); //smp_rmb() after reading aux_head
+  tail = state->pem->aux_tail;
+  if(final && state->segment_end)
+    head = state->segment_end;
+
+  //aux_head and aux_tail only ever increase, the ring buffer offset is their value modulo the ring buffer size
+  while(tail < head || (final && decoder->leftover)) {
+    offset = tail % aux_size;
+
+    if(decoder->leftover) {
+      //Finish the straddling packet by appending the next bytes from the ring buffer to the scratch buffer
+      count = head - tail;
+      if(count > IPT_SCRATCH_DATA_SIZE - decoder->leftover)
+        count = IPT_SCRATCH_DATA_SIZE - decoder->leftover;
+      if(count > aux_size - offset)
+        count = aux_size - offset;
+      last_block = final && tail + count == head;
+      if(!last_block && count < IPT_MAX_PACKET_SIZE)
+        break; //Wait for enough data to parse past the straddling packet
+
+      memcpy(decoder->scratch + decoder->leftover, ring + offset, count);
+      consumed = ipt_decode_packets(decoder, decoder->scratch, decoder->scratch + decoder->leftover + count, last_block);
+      if(!last_block && consumed < decoder->leftover)
+        break; //Should never happen, the parser always gets past the straddling packet with this much data
+      decoder->bytes_decoded += consumed;
+      tail += last_block ? count : consumed - decoder->leftover;
+      decoder->leftover = 0;
+    } else {
+      //Parse the contiguous data in place.  The parser may read a few bytes past the last packet, so don't let it
+      //finish the trace right at the end of the mapping.
+      count = head - tail;
+      if(count > aux_size - offset)
+        count = aux_size - offset;
+      last_block = final && tail + count == head && aux_size - (offset + count) >= IPT_MAX_PACKET_SIZE;
+
+      consumed = ipt_decode_packets(decoder, ring + offset, ring + offset + count, last_block);
+      decoder->bytes_decoded += consumed;
+      tail += consumed;
+      remaining = count - consumed;
+
+      //Move a packet at the end of the ring buffer or the end of the trace into the scratch buffer
+      if(remaining && (offset + count == aux_size || (final && tail + remaining == head))) {
+        memcpy(decoder->scratch, ring + offset + consumed, remaining);
+        decoder->leftover = remaining;
+        tail += remaining;
+      } else if(remaining)
+        break; //Wait for the rest of the packet
+    }
+
+    __atomic_store_n(&state->pem->aux_tail, tail, __ATOMIC_RELEASE); //smp_mb() before writing aux_tail
+  }
+  __atomic_store_n(&state->pem->aux_tail, tail, __ATOMIC_RELEASE);
 }
 
 /**
- * This function parsers an IPT TIP/FUP packet and obtains the IP address that it refers to
- * @param outp - The position of the TIP/FUP packet bytes in the IPT packet buffer.  This pointer will
- * be updated to point after the parsed TIP/FUP packet.
- * @param end - The end of the IPT packet buffer.  Used to ensure, we don't read past the end
- * @param last_ip - The IP address that was in the most recent TIP/FUP packet. This value will be
- * updated with the IP address from the parsed packet.
- * @return - the IP address from the TIP/FUP packet.
+ * This function reads the records in the perf data ring buffer, and checks whether any IPT trace data was lost
+ * because the AUX ring buffer filled up.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @return - 1 if trace data was lost, 0 otherwise
  */
-static uint64_t handle_ip_packet(unsigned char ** outp, unsigned char *end, uint64_t *last_ip)
+static int check_ipt_truncated(linux_ipt_state_t * state)
 {
-  unsigned char *p = *outp;
-  uint64_t new_ip;
-  int num_bytes;
-  uint64_t new_bytes;
-
-  int ip_bytes = p[0] >> 5;
+  struct perf_event_header header;
+  struct { struct perf_event_header header; uint64_t aux_offset, aux_size, flags; } aux;
+  uint64_t head, tail;
+  char * data = (char *)state->pem + state->pem->data_offset;
+  int truncated = 0;
+  size_t i;
 
-  if (ip_bytes == 0) //IP is out of context
-    return 0;
-  else if(ip_bytes == 1) { //Bottom 32 bits, last_ip top 48
-    num_bytes = 2;
-    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFULL;
-    new_ip = (*last_ip & (0xFFFFFFFFFFFFULL << 16)) | new_bytes;
-  } else if(ip_bytes == 2) { //Bottom 32 bits, last_ip top 32
-    num_bytes = 4;
-    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFULL;
-    new_ip = (*last_ip & (0xFFFFFFFFULL << 32)) | new_bytes;
-  } else if(ip_bytes == 3) { //Bottom 48 bits, sign extended
-    num_bytes = 6;
-    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFFFFFULL;
-    new_ip = sign_extend(new_bytes, 48);
-  } else if(ip_bytes == 4) { //Bottom 48 bits, last_ip top 16
-    num_bytes = 6;
-    new_bytes = *((uint64_t *)(p+1)) & 0xFFFFFFFFFFFFULL;
-    new_ip = (*last_ip & (0xFFFFULL << 48)) | new_bytes;
-  } else if(ip_bytes == 6) { //All 64 bits
-    num_bytes = 8;
-    new_ip = *((uint64_t *)(p+1));
-  } else {
-    WARNING_MSG("Got unknown IP packet (IPBytes=%d)", ip_bytes);
-    return 0;
+  head = __atomic_load_n(&state->pem->data_head, __ATOMIC_ACQUIRE);
+  tail = state->pem->data_tail;
+  while(tail + sizeof(header) <= head) {
+    for(i = 0; i < sizeof(header); i++)
+      ((char *)&header)[i] = data[(tail + i) % state->pem->data_size];
+    if(header.size < sizeof(header))
+      break;
+    if(header.type == PERF_RECORD_AUX && header.size >= sizeof(aux)) {
+      for(i = 0; i < sizeof(aux); i++)
+        ((char *)&aux)[i] = data[(tail + i) % state->pem->data_size];
+      if(aux.flags & PERF_AUX_FLAG_TRUNCATED)
+        truncated = 1;
+    }
+    tail += header.size;
   }
+  __atomic_store_n(&state->pem->data_tail, head, __ATOMIC_RELEASE);
+  return truncated;
+}
 
-  if (!BYTES_LEFT(num_bytes)) {
-    WARNING_MSG("Got error in handle_ip_packet: Not enough bytes for decoding IP (have %lu, need %lu)", end-p, ip_bytes);
-    return 0;
+/**
+ * This function runs in a background thread while the target is running.  It waits for the AUX ring buffer to
+ * fill past its watermark, and decodes the new trace data as it arrives.
+ * @param arg - The linux_ipt_state_t object containing this instrumentation's state
+ */
+static THREAD_FUNC(ipt_decoder_thread)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)arg;
+  struct pollfd pfd;
+
+  pfd.fd = state->perf_fd;
+  pfd.events = POLLIN;
+  while(!__atomic_load_n(&state->decoder_stop, __ATOMIC_ACQUIRE)) {
+    //Once the target exits, the perf fd reports POLLHUP immediately, so fall back to sleeping
+    if(poll(&pfd, 1, IPT_DECODER_POLL_MS) > 0 && (pfd.revents & (POLLHUP | POLLERR)))
+      usleep(IPT_DECODER_POLL_MS * 1000);
+    drain_ipt(state, 0);
   }
-
-  *outp = p + num_bytes;
-  *last_ip = new_ip;
-  return new_ip;
+  THREAD_RETURN;
 }
 
 /**
- * This function adds any remaining TNT packet bits to the TNT hash being recorded
- * @param ipt_hashes - A pointer to the hash structure with the TNT hash to update
+ * This function starts decoding a new IPT trace, in a background thread if the decoder_thread option is set
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param return - 0 on success, non-zero on failure
  */
-static void finish_tnt_hash(struct ipt_hash_state * ipt_hashes)
+static int start_ipt_decoder(linux_ipt_state_t * state)
 {
-  if(ipt_hashes->num_bits != 0) {
-    if(XXH64_update(ipt_hashes->tnt, &ipt_hashes->tnt_bits, sizeof(uint64_t)) == XXH_ERROR)
-      WARNING_MSG("Updating the TNT hash failed!"); //Should never happen
+  if(ipt_decoder_reset(&state->decoder))
+    return 1;
+  if(!state->decoder_thread)
+    return 0;
+
+  state->decoder_stop = 0;
+  if(create_thread(&state->decoder_thread_handle, ipt_decoder_thread, state)) {
+    WARNING_MSG("Couldn't start the IPT decoder thread, the trace will be decoded after the target finishes");
+    return 0;
   }
-  //Add in the total number of bits, so we can differentiate between a packet with TNN and a packet with TN
-  if(XXH64_update(ipt_hashes->tnt, &ipt_hashes->total_num_bits, sizeof(uint64_t)) == XXH_ERROR)
-    WARNING_MSG("Updating the TNT hash failed!"); //Should never happen
+  state->decoder_running = 1;
+  return 0;
 }
 
 /**
- * This function adds TNT packet bits to the TNT hash being recorded
- * @param ipt_hashes - A pointer to the hash structure with the TNT hash to update
- * @param tnt_bits - the TNT bits to add to the hash
- * @param num_bits - the number of bits in the tnt_bits parameter
+ * This function stops the background IPT decoder thread, if it is running
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
  */
-static void add_tnt_to_hash(struct ipt_hash_state * ipt_hashes, unsigned char * tnt_bits, int num_bits)
+static void stop_ipt_decoder(linux_ipt_state_t * state)
 {
-  uint64_t i;
-#ifdef IPT_DEBUG
-  char bit_string[64];
-
-  for(i = 0; i < num_bits; i++)
-    bit_string[i] = BIT_TEST(tnt_bits[i / 8], i % 8) ? 'T' : 'N';
-  bit_string[num_bits] = 0;
-
-  IPT_DEBUG_MSG("TNT bits %d: %s", num_bits, bit_string);
-#endif
-
-  for(i = 0; i < num_bits; i++) {
-    ipt_hashes->tnt_bits |= (BIT_TEST(tnt_bits[i / 8], i % 8) << ipt_hashes->num_bits);
-    ipt_hashes->num_bits++;
-    if(ipt_hashes->num_bits == sizeof(ipt_hashes->tnt_bits)) {
-      if(XXH64_update(ipt_hashes->tnt, &ipt_hashes->tnt_bits, sizeof(uint64_t)) == XXH_ERROR)
-        WARNING_MSG("Updating the TNT hash failed!"); //Should never happen
-      ipt_hashes->tnt_bits = 0;
-      ipt_hashes->num_bits = 0;
-    }
-  }
-  ipt_hashes->total_num_bits += num_bits;
+  if(!state->decoder_running)
+    return;
+  __atomic_store_n(&state->decoder_stop, 1, __ATOMIC_RELEASE);
+  join_thread(state->decoder_thread_handle);
+  state->decoder_running = 0;
 }
 
 /**
- * This function adds a TIP packet's IP address to the TIP hash being recorded
+ * This function finishes decoding the IPT trace to determine if the execution trace was new or not.  If it was, the
+ * execution trace's hash is added to the hashtable to ensure we do not mark it as new again.  When the edge_bitmap
+ * option is used, the trace is instead new if it hit any edges (or edge hit counts) not previously seen.
  * @param state - The linux_ipt_state_t object containing this instrumentation's state
- * @param tip - the IP address to add to the TIP hash
+ * @param return - -1 on error, 0 if the IPT packets in the IPT packet buffer don't describe a unique run, or 1 if they do
  */
-static void add_tip_to_hash(linux_ipt_state_t * state, uint64_t tip)
+static int analyze_ipt(linux_ipt_state_t * state)
 {
-  uint64_t adjusted_address = tip;
-  int i;
-  long index = -1;
+  struct ipt_hashtable_key key;
 
-  IPT_DEBUG_MSG("TIP %lx", tip);
+  stop_ipt_decoder(state);
+  if(state->persistence_max_cnt) {
+    //In persistence mode, the target has either stopped at the end of the iteration or exited.  Either way, the
+    //kernel flushed its trace data to the AUX buffer when it was switched out, so IPT can stay enabled and the
+    //iteration's trace is everything up to the current AUX head.
+    state->segment_end = __atomic_load_n(&state->pem->aux_head, __ATOMIC_ACQUIRE);
+  } else //Disable IPT, which flushes the remaining trace data to the AUX buffer
+    ioctl(state->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+  drain_ipt(state, 1);
+  state->counters.trace_overflows += state->decoder.overflows;
+
+  if(state->persistence_max_cnt)
+    IPT_DEBUG_MSG("Decoded %lu bytes of IPT trace data, from AUX offsets %lu to %lu", state->decoder.bytes_decoded,
+      state->segment_start, state->segment_end);
+  else
+    IPT_DEBUG_MSG("Decoded %lu bytes of IPT trace data", state->decoder.bytes_decoded);
 
-  //Adjust the reported address to remove ASLR
-  if(state->num_coverage_libraries) {
-    for(i = 0; i < state->num_coverage_libraries; i++) {
-      if(state->library_starts[i] <= tip && tip < state->library_ends[i]) {
-        index = i;
-        break;
-      }
-    }
+  //Perform a quick sanity check to ensure the IPT trace data is sane
+  if(check_ipt_truncated(state)) {
+    state->counters.trace_overflows++;
+    WARNING_MSG("The IPT trace data has overflown. Use the ipt_mmap_size option to increase the size%s.",
+      state->decoder_thread ? "" : ", or the decoder_thread option to decode it while the target runs");
+    return -1;
+  } else if(!state->decoder.bytes_decoded) {
+    WARNING_MSG("No IPT trace data was recorded, something is likely wrong.");
+    return -1;
+  }
 
-    //Normalize the address, then mix in the hash of the library to ensure there are not collisions
-    //when two separate libraries report a TIP at the same offset
-    if(index != -1)
-      adjusted_address = (tip - state->library_starts[i]) | (((uint64_t)state->library_hashes[i]) << 32);
-  } else if(state->target_start <= tip && tip < state->target_end) //if the address is in the target executable
-    adjusted_address = tip - state->target_start; //normalize the address with the target's start address
+  ipt_decoder_finish(&state->decoder, &key);
+  if(state->edge_bitmap)
+    return bitmap_has_new_bits(state->virgin_bits, state->decoder.trace_bits, state->map_size) != 0;
 
-  if(XXH64_update(state->ipt_hashes.tip, &adjusted_address, sizeof(uint64_t)) == XXH_ERROR)
-    WARNING_MSG("Updating the TIP hash failed!"); //Should never happen
+  //Add our hashes to the hash set, which tells us whether they were already in it
+  return ipt_hash_set_add(&state->hash_set, &key);
 }
 
+////////////////////////////////////////////////////////////////
+// Private methods /////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
 /**
- * This function determines how many bits are in a TNT packet
- * @param packet - A pointer to the IPT packet buffer
- * @param max - the maximum possible bits that could be in a packet
+ * This function wraps the perf_event_open syscall, which does not have one in libc
  */
-static int get_tnt_num_bits(unsigned char * packet, int max_bits)
+static long perf_event_open(struct perf_event_attr* hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags)
 {
-  int num_bits;
-  for(num_bits = max_bits; num_bits >= 0; num_bits--) { //Find the stop bit
-    if(BIT_TEST(packet[num_bits / 8], num_bits % 8))
-      break;
-  }
-  return num_bits;
+  return syscall(__NR_perf_event_open, hw_event, (uintptr_t)pid, (uintptr_t)cpu, (uintptr_t)group_fd, (uintptr_t)flags);
 }
 
 /**
- * This function parses the IPT packet buffer to determine if the execution trace was new or not.  If it was, the
- * execution trace's hash is added to the hashtable to ensure we do not mark it as new again.
+ * This function cleans up the IPT related file descriptor and memory mappings
  * @param state - The linux_ipt_state_t object containing this instrumentation's state
- * @param return - -1 on error, 0 if the IPT packets in the IPT packet buffer don't describe a unique run, or 1 if they do
  */
-static int analyze_ipt(linux_ipt_state_t * state)
+static void cleanup_ipt(linux_ipt_state_t * state)
 {
-  unsigned char * p, * start, * end, * psb_pos;
-  struct ipt_hashtable_entry * hashes, * match = NULL;
-  uint64_t ip_address;
-  size_t num_bytes_at_end;
-  int unknown_packet_hit = 0;
+  stop_ipt_decoder(state);
+  if(state->perf_aux_buf && state->perf_aux_buf != MAP_FAILED && state->pem && state->pem != MAP_FAILED) {
+    munmap(state->perf_aux_buf, state->pem->aux_size);
+    state->perf_aux_buf = NULL;
+    munmap(state->pem, state->ipt_mmap_size + getpagesize());
+    state->pem = NULL;
+  }
+  if(state->perf_fd >= 0)
+    close(state->perf_fd);
+  state->perf_fd = -1;
+}
 
-  const unsigned char psb[0x10] = {
-    0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
-    0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82
-  };
+/**
+ * This function allocates the bitmaps used by the edge_bitmap option
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero on failure
+ */
+static int setup_edge_bitmaps(linux_ipt_state_t * state)
+{
+  state->decoder.trace_bits = calloc(1, state->map_size);
+  state->decoder.map_size = state->map_size;
+  state->virgin_bits = malloc(state->map_size);
+  if(!state->decoder.trace_bits || !state->virgin_bits) {
+    ERROR_MSG("Failed to allocate the IPT edge bitmaps");
+    return 1;
+  }
+  memset(state->virgin_bits, 0xff, state->map_size);
+  return 0;
+}
 
-  //Disable IPT while we're analyzing it
-  ioctl(state->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+/**
+ * This function marks the ignored bytes of the edge bitmap as already seen in the virgin bitmap, so they're never
+ * reported as new paths
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param ignore_bytes - a map that is non-zero for each byte to ignore, or NULL
+ * @param size - the size of the ignore_bytes parameter, which must not be larger than the edge bitmap
+ */
+static void clear_virgin_bytes(linux_ipt_state_t * state, const uint8_t * ignore_bytes, size_t size)
+{
+  size_t i;
 
-  //Perform a quick sanity check to ensure the IPT trace data is sane
-  if (state->pem->aux_head == state->pem->aux_tail) {
-    WARNING_MSG("No IPT trace data was recorded, something is likely wrong.");
-    return -1;
-  } else if (state->persistence_max_cnt == 0 && state->pem->aux_head < state->pem->aux_tail) {
-    WARNING_MSG("The IPT trace data has overflown. Use the ipt_mmap_size option to increase the size.");
-    return -1;
+  if(!ignore_bytes)
+    return;
+  for(i = 0; i < size; i++) {
+    if(ignore_bytes[i])
+      state->virgin_bits[i] = 0;
   }
+}
+
+static int compare_library_ranges(const void * first, const void * second)
+{
+  const struct ipt_library_range * first_range = first, * second_range = second;
+  if(first_range->start == second_range->start)
+    return 0;
+  return first_range->start < second_range->start ? -1 : 1;
+}
+
+/**
+ * This function finds a CPU that no other process is pinned to.  Processes pinned to a single CPU (such as other
+ * fuzzers using the cpu option) are found by scanning /proc, so each worker on the host can claim its own core.
+ * The CPUs claimed by the process's other states are skipped too.  The caller must hold the claimed_cpus_mutex.
+ * @param exclude - a CPU that shouldn't be chosen, or IPT_CPU_NONE
+ * @return - the CPU number, or -1 if every CPU is already in use
+ */
+static int find_free_cpu(int exclude)
+{
+  char filename[64], line[256];
+  char * used;
+  int num_cpus, cpu, user_process;
+  struct dirent * entry;
+  DIR * proc;
+  FILE * fp;
+
+  //Every process is pinned to the only CPU of a single CPU system
+  num_cpus = get_processor_count();
+  if(num_cpus <= 1)
+    return exclude == 0 ? -1 : 0;
 
-  //Reset the IPT hashes struct
-  state->ipt_hashes.tnt_bits = 0;
-  state->ipt_hashes.num_bits = 0;
-  state->ipt_hashes.total_num_bits = 0;
-  if(XXH64_reset(state->ipt_hashes.tnt, 0) == XXH_ERROR ||
-      XXH64_reset(state->ipt_hashes.tip, 0) == XXH_ERROR)
+  used = calloc(num_cpus, 1);
+  if(!used)
     return -1;
 
-  hashes = malloc(sizeof(struct ipt_hashtable_entry));
-  if(!hashes)
+  proc = opendir("/proc");
+  if(!proc) {
+    ERROR_MSG("Failed to open /proc to find a free CPU");
+    free(used);
     return -1;
+  }
 
-  //Reorder the buffer if it wrapped around to make parsing easier
-  if(state->pem->aux_head < state->pem->aux_tail) {
-    state->reorder_buffer = malloc(state->ipt_mmap_size);
-    num_bytes_at_end = state->pem->aux_size - state->pem->aux_tail;
-    memcpy(state->reorder_buffer, state->perf_aux_buf + state->pem->aux_tail, num_bytes_at_end);
-    memcpy(state->reorder_buffer + num_bytes_at_end, state->perf_aux_buf, state->pem->aux_head);
+  while((entry = readdir(proc)) != NULL) {
+    if(!isdigit(entry->d_name[0]))
+      continue;
+    snprintf(filename, sizeof(filename), "/proc/%s/status", entry->d_name);
+    fp = fopen(filename, "r");
+    if(!fp)
+      continue;
 
-    start = state->reorder_buffer;
-    end = state->reorder_buffer + num_bytes_at_end + state->pem->aux_head;
-  } else {
-    start = (char *)state->perf_aux_buf + state->pem->aux_tail;
-    end = (char *)state->perf_aux_buf + state->pem->aux_head;
-  }
-  p = start;
-
-#ifdef IPT_DEBUG
-  write_buffer_to_file("/tmp/ipt_dump", start, end-start);
-#endif
-
-  //Rather than use Intel's libipt, we instead parse the buffer ourselves to ensure we can do so
-  //quickly.  As we only need the TIP/TNT packets, this parser attempts to parse as little else
-  //as possible.  Further, we only record hashes of the TIP/TNT packets, as full decoding of the
-  //IPT packets to match them to the basic blocks transitions is far too slow.
-  while(p < end) {
-
-    if(unknown_packet_hit) {
-      psb_pos = memmem(p, end - p, psb, sizeof(psb));
-      if(!psb_pos) {
-        DEBUG_MSG("Couldn't find PSB packet");
+    //Kernel threads are pinned to each CPU, but don't have any memory, so only count processes with a VmSize
+    user_process = 0;
+    while(fgets(line, sizeof(line), fp)) {
+      if(!strncmp(line, "VmSize:", 7))
+        user_process = 1;
+      else if(!strncmp(line, "Cpus_allowed_list:", 18)) {
+        if(user_process && !strchr(line, '-') && !strchr(line, ',')
+            && sscanf(line + 18, "%d", &cpu) == 1 && cpu >= 0 && cpu < num_cpus)
+          used[cpu] = 1;
         break;
       }
-      if(psb_pos - p != 0)
-        IPT_DEBUG_MSG("Skipping %d bytes", psb_pos - p);
-      p = psb_pos + sizeof(psb);
-      state->last_ip = 0;
-      unknown_packet_hit = 0;
     }
+    fclose(fp);
+  }
+  closedir(proc);
 
-    while(p < end)
-    {
-      IPT_DEBUG_MSG_PACKET("%04x: %02x %02x %02x %02x %02x %02x %02x %02x", p - start,
-          (unsigned char)p[0], (unsigned char)p[1], (unsigned char)p[2], (unsigned char)p[3],
-          (unsigned char)p[4], (unsigned char)p[5], (unsigned char)p[6], (unsigned char)p[7]);
-
-      if (p[0] == 2 && BYTES_LEFT(2)) {
-        if (p[1] == 0xa3 && BYTES_LEFT(8)) { // Long TNT
-          IPT_DEBUG_MSG_PACKET("Long TNT");
-          add_tnt_to_hash(&state->ipt_hashes, p+2, get_tnt_num_bits(p+2, 47));
-          p += 8;
-          continue;
-        }
-        if (p[1] == 0x43 && BYTES_LEFT(8)) { // PIP
-          IPT_DEBUG_MSG_PACKET("PIP");
-          p += 8;
-          continue;
-        }
-        if (p[1] == 3 && BYTES_LEFT(4)) { // CBR
-          IPT_DEBUG_MSG_PACKET("CBR");
-          p += 4;
-          continue;
-        }
-        if (p[1] == 0x83) { //TRACESTOP
-          IPT_DEBUG_MSG_PACKET("TRACESTOP");
-          p += 2;
-          continue;
-        }
-        if (p[1] == 0xf3 && BYTES_LEFT(8)) { // OVF
-          p += 8;
-          WARNING_MSG("IPT received overflow packet");
-          continue;
-        }
-        if (p[1] == 0x82 && BYTES_LEFT(16) && !memcmp(p, psb, 16)) { // PSB
-          IPT_DEBUG_MSG_PACKET("PSB");
-          p += 16;
-          state->last_ip = 0;
-          continue;
-        }
-        if (p[1] == 0x23) { // PSBEND
-          IPT_DEBUG_MSG_PACKET("PSBEND");
-          p += 2;
-          continue;
-        }
-        if (p[1] == 0xc3 && BYTES_LEFT(11) && p[2] == 0x88) { //MNT
-          IPT_DEBUG_MSG_PACKET("MNT");
-          p += 10;
-          continue;
-        }
-        if (p[1] == 0x73 && BYTES_LEFT(7)) { //TMA
-          IPT_DEBUG_MSG_PACKET("TMA");
-          p += 7;
-          continue;
-        }
-        if (p[1] == 0xc8 && BYTES_LEFT(7)) { //VMCS
-          IPT_DEBUG_MSG_PACKET("VMCS");
-          p += 7;
-          continue;
-        }
-      }
-
-      if(!(p[0] & 1)) {
-        if (p[0] == 0) { // PAD
-          IPT_DEBUG_MSG_PACKET("PAD");
-          p++;
-          continue;
-        }
+  for(cpu = 0; cpu < num_cpus; cpu++) {
+    if(!used[cpu] && cpu != exclude && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &claimed_cpus)))
+      break;
+  }
+  free(used);
+  return cpu < num_cpus ? cpu : -1;
+}
 
-        // Short TNT
-        char tnt_bits = p[0] >> 1;
-        add_tnt_to_hash(&state->ipt_hashes, &tnt_bits, get_tnt_num_bits(&tnt_bits, 6));
-        IPT_DEBUG_MSG_PACKET("SHORT TNT");
-        p++;
-        continue;
-      }
+/**
+ * This function pins a process to a single CPU
+ * @param pid - the process to pin, or 0 for the calling thread (and any threads and processes it starts afterwards)
+ * @param cpu - the CPU to pin the process to
+ * @return - 0 on success, non-zero on failure
+ */
+static int pin_to_cpu(pid_t pid, int cpu)
+{
+  cpu_set_t cpus;
 
-#define TIP_TYPE_TIP     0xd
-#define TIP_TYPE_TIP_PGE 0x11
-#define TIP_TYPE_TIP_PGD 0x1
-#define TIP_TYPE_FUP     0x1d
-
-      char tip_type = p[0] & 0x1f;
-      if(tip_type == TIP_TYPE_TIP || tip_type == TIP_TYPE_TIP_PGE
-          || tip_type == TIP_TYPE_TIP_PGD || tip_type == TIP_TYPE_FUP) {
-        ip_address = handle_ip_packet(&p, end, &state->last_ip);
-        IPT_DEBUG_MSG_PACKET("TIP/PGE/PGD/FUP");
-        if(tip_type == TIP_TYPE_TIP)
-          add_tip_to_hash(state, ip_address);
-        p++;
-        continue;
-      }
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if(sched_setaffinity(pid, sizeof(cpus), &cpus)) {
+    ERROR_MSG("Failed to pin %s to CPU %d: %s", pid ? "the fork server" : "the fuzzer", cpu, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
 
-      if (p[0] == 0x99 && BYTES_LEFT(2)) { // MODE
-        IPT_DEBUG_MSG_PACKET("MODE");
-        p += 2;
-        continue;
-      }
+/**
+ * This function claims a free CPU for one of the cpu and target_cpu options, so that the process's other states
+ * don't pick it too.  The caller must hold the claimed_cpus_mutex.
+ * @param cpu - used to return the CPU
+ * @param claimed - set to non-zero if the CPU was claimed
+ * @param exclude - a CPU that shouldn't be chosen, or IPT_CPU_NONE
+ * @return - 0 on success, non-zero if every CPU is already in use
+ */
+static int claim_free_cpu(int * cpu, int * claimed, int exclude)
+{
+  *cpu = find_free_cpu(exclude);
+  if(*cpu < 0)
+    return 1;
+  if(*cpu < CPU_SETSIZE) {
+    CPU_SET(*cpu, &claimed_cpus);
+    *claimed = 1;
+  }
+  return 0;
+}
 
-      if (p[0] == 0x19 && BYTES_LEFT(8)) { // TSC
-        IPT_DEBUG_MSG_PACKET("TSC");
-        p+=8;
-        continue;
-      }
-      if (p[0] == 0x59 && BYTES_LEFT(2)) { // MTC
-        IPT_DEBUG_MSG_PACKET("MTC");
-        p += 2;
-        continue;
-      }
-      if ((p[0] & 3) == 3) { // CYC
-        IPT_DEBUG_MSG_PACKET("CYC");
-        if ((p[0] & 4) && BYTES_LEFT(1)) {
-          do {
-            p++;
-          } while ((p[0] & 1) && BYTES_LEFT(1));
-        }
-        p++;
-        continue;
-      }
+/**
+ * This function chooses the CPUs requested by the cpu and target_cpu options.  Nothing is pinned yet, since the
+ * state may be created by a different thread than the one that runs the target (e.g. the fuzzer's main thread
+ * creates each worker's state), so the thread is pinned when it first starts the fork server.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero on failure
+ */
+static int setup_cpu_affinity(linux_ipt_state_t * state)
+{
+  int error = 0;
 
-      WARNING_MSG("Hit unknown packet type at offset 0x%lx", p - start);
-      unknown_packet_hit = 1;
-      break;
-    }
+  pthread_mutex_lock(&claimed_cpus_mutex);
+  if(state->cpu == IPT_CPU_AUTO && claim_free_cpu(&state->cpu, &state->cpu_claimed, IPT_CPU_NONE)) {
+    ERROR_MSG("Could not find a free CPU for the fuzzer");
+    error = 1;
   }
+  else if(state->target_cpu == IPT_CPU_AUTO
+      && claim_free_cpu(&state->target_cpu, &state->target_cpu_claimed, state->cpu)) {
+    ERROR_MSG("Could not find a free CPU for the target");
+    error = 1;
+  }
+  pthread_mutex_unlock(&claimed_cpus_mutex);
+  if(error)
+    return 1;
 
-  //Create a hashtable entry to lookup/add
-  finish_tnt_hash(&state->ipt_hashes);
-  memset(hashes, 0, sizeof(struct ipt_hashtable_entry));
-  hashes->id.tip = XXH64_digest(state->ipt_hashes.tip);
-  hashes->id.tnt = XXH64_digest(state->ipt_hashes.tnt);
-  DEBUG_MSG("Got TIP hash 0x%llx and TNT hash 0x%llx", hashes->id.tip, hashes->id.tnt);
-
-  //Look for our hashes in the hashtable, and add them if they're not already in it
-  HASH_FIND(hh, state->head, &hashes->id, sizeof(struct ipt_hashtable_key), match);
-  if(!match)
-    HASH_ADD(hh, state->head, id, sizeof(struct ipt_hashtable_key), hashes);
-  else
-    free(hashes);
-  return match == NULL;
+  if(state->cpu >= 0)
+    INFO_MSG("Pinning the fuzzer to CPU %d", state->cpu);
+  if(state->target_cpu >= 0)
+    INFO_MSG("Pinning the target to CPU %d", state->target_cpu);
+  return 0;
 }
 
-////////////////////////////////////////////////////////////////
-// Private methods /////////////////////////////////////////////
-////////////////////////////////////////////////////////////////
-
 /**
- * This function wraps the perf_event_open syscall, which does not have one in libc
+ * This function pins the calling thread, which runs the target, to the cpu option's CPU.  The decoder thread and
+ * the fork server that it starts afterwards inherit it.  The thread's old CPUs are saved, so that they can be
+ * restored when the state is cleaned up, e.g. after a temporary state that the fuzzer calibrates with.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero on failure
  */
-static long perf_event_open(struct perf_event_attr* hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags)
+static int pin_target_thread(linux_ipt_state_t * state)
 {
-  return syscall(__NR_perf_event_open, hw_event, (uintptr_t)pid, (uintptr_t)cpu, (uintptr_t)group_fd, (uintptr_t)flags);
+  if(state->cpu < 0 || state->thread_pinned)
+    return 0;
+
+  state->unpinned_cpus = malloc(sizeof(cpu_set_t));
+  if(!state->unpinned_cpus || sched_getaffinity(0, sizeof(cpu_set_t), (cpu_set_t *)state->unpinned_cpus)) {
+    free(state->unpinned_cpus);
+    state->unpinned_cpus = NULL;
+  }
+  if(pin_to_cpu(0, state->cpu))
+    return 1;
+  state->pinned_thread = pthread_self();
+  state->thread_pinned = 1;
+  return 0;
 }
 
 /**
- * This function cleans up the IPT related file descriptor and memory mappings
+ * This function releases the CPUs that a state claimed, and restores the CPUs of the thread it pinned, if it's the
+ * calling thread.  A thread that has already exited (e.g. a fuzzer worker that has finished) is left alone.
  * @param state - The linux_ipt_state_t object containing this instrumentation's state
  */
-static void cleanup_ipt(linux_ipt_state_t * state)
+static void release_cpu_affinity(linux_ipt_state_t * state)
 {
-  if(state->perf_aux_buf && state->perf_aux_buf != MAP_FAILED && state->pem && state->pem != MAP_FAILED) {
-    munmap(state->perf_aux_buf, state->pem->aux_size);
-    state->perf_aux_buf = NULL;
-    munmap(state->pem, state->ipt_mmap_size + getpagesize());
-    state->pem = NULL;
-  }
-  if(state->perf_fd >= 0)
-    close(state->perf_fd);
-  state->perf_fd = -1;
+  if(state->thread_pinned && state->unpinned_cpus && pthread_equal(state->pinned_thread, pthread_self())
+      && sched_setaffinity(0, sizeof(cpu_set_t), (cpu_set_t *)state->unpinned_cpus))
+    WARNING_MSG("Failed to restore the fuzzer's CPUs: %s", strerror(errno));
+  state->thread_pinned = 0;
+  free(state->unpinned_cpus);
+  state->unpinned_cpus = NULL;
+
+  pthread_mutex_lock(&claimed_cpus_mutex);
+  if(state->cpu_claimed)
+    CPU_CLR(state->cpu, &claimed_cpus);
+  if(state->target_cpu_claimed)
+    CPU_CLR(state->target_cpu, &claimed_cpus);
+  state->cpu_claimed = state->target_cpu_claimed = 0;
+  pthread_mutex_unlock(&claimed_cpus_mutex);
 }
 
 /**
@@ -511,7 +558,7 @@ static int setup_ipt(linux_ipt_state_t * state, pid_t pid)
 {
   struct perf_event_attr pe;
 
-  state->last_ip = 0;
+  state->decoder.last_ip = 0;
 
   memset(&pe, 0, sizeof(struct perf_event_attr));
   pe.size = sizeof(struct perf_event_attr);
@@ -521,6 +568,7 @@ static int setup_ipt(linux_ipt_state_t * state, pid_t pid)
   pe.exclude_hv = 1;
   pe.exclude_kernel = 1;
   pe.type = state->intel_pt_type;
+  pe.aux_watermark = state->ipt_mmap_size / 4; //Wake the decoder thread when the AUX buffer is a quarter full
 
   state->perf_fd = perf_event_open(&pe, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
   if(state->perf_fd < 0) {
@@ -544,7 +592,10 @@ static int setup_ipt(linux_ipt_state_t * state, pid_t pid)
 
   state->pem->aux_offset = state->pem->data_offset + state->pem->data_size;
   state->pem->aux_size = state->ipt_mmap_size;
-  state->perf_aux_buf = mmap(NULL, state->pem->aux_size, PROT_READ, MAP_SHARED, state->perf_fd, state->pem->aux_offset);
+  //Mapping the AUX buffer writable puts it in ring buffer mode (rather than overwrite mode), so the kernel won't
+  //overwrite trace data that hasn't been decoded yet, and will report when trace data is lost
+  state->perf_aux_buf = mmap(NULL, state->pem->aux_size, PROT_READ|PROT_WRITE, MAP_SHARED, state->perf_fd,
+    state->pem->aux_offset);
   if(state->perf_aux_buf == MAP_FAILED) {
     ERROR_MSG("Perf AUX mmap failed (ipt_mmap_size=%d)\n", state->ipt_mmap_size);
     return 1;
@@ -566,14 +617,14 @@ static void record_fork_server_address_info(linux_ipt_state_t * state)
   size_t i;
   char * file_buffer;
   XXH32_state_t * hash;
+  struct ipt_library_range * ranges = NULL;
 
-  //Allocate the library start/end arrays
+  //Allocate the library address ranges, indexed by the library until they're sorted below
   if(state->num_coverage_libraries) {
-    state->library_starts = calloc(state->num_coverage_libraries, sizeof(uint64_t));
-    state->library_ends = calloc(state->num_coverage_libraries, sizeof(uint64_t));
-    state->library_hashes = calloc(state->num_coverage_libraries, sizeof(uint32_t));
-    if(!state->library_starts || !state->library_ends || !state->library_hashes)
+    ranges = calloc(state->num_coverage_libraries, sizeof(struct ipt_library_range));
+    if(!ranges)
       FATAL_MSG("Failed allocating memory for library address ranges and hashes");
+    state->decoder.num_library_ranges = 0;
   }
 
   //Open /proc/$pid/maps
@@ -592,16 +643,16 @@ static void record_fork_server_address_info(linux_ipt_state_t * state)
     if(state->num_coverage_libraries) {
       for(i = 0; i < state->num_coverage_libraries; i++) {
         if(strcmp(map_filename, state->coverage_libraries[i]) == 0) {
-          if(state->library_starts[i] == 0)
-            state->library_starts[i] = start;
-          state->library_ends[i] = end;
+          if(ranges[i].start == 0)
+            ranges[i].start = start;
+          ranges[i].end = end;
         }
       }
 
     } else if(strcmp(map_filename, state->target_path) == 0) {
-      if(state->target_start == 0)
-        state->target_start = start;
-      state->target_end = end;
+      if(state->decoder.target_start == 0)
+        state->decoder.target_start = start;
+      state->decoder.target_end = end;
     }
   }
   fclose(fp);
@@ -609,10 +660,9 @@ static void record_fork_server_address_info(linux_ipt_state_t * state)
   //Give a warning if we weren't able to find a library's or the main executable's start/end address
   if(state->num_coverage_libraries) {
     for(i = 0; i < state->num_coverage_libraries; i++) {
-      if(!state->library_starts[i] || !state->library_ends[i]) {
+      if(!ranges[i].start || !ranges[i].end) {
         WARNING_MSG("Could not determine the address of the %s library in memory.  The generated hashes will be specific to "
           "this run if ASLR is enabled.", state->coverage_libraries[i]);
-        state->library_starts[i] = state->library_ends[i] = 0;
       } else {
         //Read the library
         file_len = read_file(state->coverage_libraries[i], &file_buffer);
@@ -624,18 +674,26 @@ static void record_fork_server_address_info(linux_ipt_state_t * state)
         if(XXH32_reset(hash, 0) == XXH_ERROR ||
             XXH32_update(hash, file_buffer, file_len) == XXH_ERROR)
           FATAL_MSG("Failed calculating hash of library %s", state->coverage_libraries[i]); //Should never happen
-        state->library_hashes[i] = XXH32_digest(hash);
+        ranges[i].hash = XXH32_digest(hash);
 
         //Deallocate the hash and file contents
         XXH32_freeState(hash);
         free(file_buffer);
+
+        ranges[state->decoder.num_library_ranges++] = ranges[i];
       }
     }
 
-  } else if(!state->target_start || !state->target_end) {
+    //Sort the libraries that were found by their address, so TIP addresses can be looked up quickly
+    qsort(ranges, state->decoder.num_library_ranges, sizeof(struct ipt_library_range), compare_library_ranges);
+    free(state->decoder.library_ranges);
+    state->decoder.library_ranges = ranges;
+    state->decoder.last_library_range = NULL;
+
+  } else if(!state->decoder.target_start || !state->decoder.target_end) {
     WARNING_MSG("Could not determine the address of the target executable in memory.  The generated hashes will be specific to "
       "this run if ASLR is enabled and the executable is PIE.");
-    state->target_start = state->target_end = 0;
+    state->decoder.target_start = state->decoder.target_end = 0;
   }
 }
 
@@ -666,18 +724,29 @@ static int create_target_process(linux_ipt_state_t * state, char* cmd_line, char
 {
   char ** argv;
   char * temp_path;
-  int i, pid;
+  int i, pid, error = 0;
 
   if(!state->fork_server_setup) {
     if(split_command_line(cmd_line, &temp_path, &argv))
       return -1;
 
-    //Get the absolute path for the target
+    //Get the absolute path for the target, and pin this thread so the fork server inherits its CPU
     state->target_path = realpath(temp_path, NULL);
-    if(state->target_path) {
+    if(state->target_path && pin_target_thread(state))
+      error = 1;
+    else if(state->target_path) {
+      state->fs.snapshot = state->snapshot;
+      state->fs.adaptive_persistence = state->persistence_adaptive;
+      state->fs.init_function = state->init_function;
+      state->fs.init_marker = state->init_marker;
+      state->fs.stream_stdin = state->stream_stdin;
       fork_server_init(&state->fs, state->target_path, argv, 1, state->persistence_max_cnt, stdin_length != 0);
       record_fork_server_address_info(state);
       state->fork_server_setup = 1;
+
+      //The target processes are forked from the fork server, so they inherit its CPU
+      if(state->target_cpu >= 0)
+        error = pin_to_cpu(state->fs.pid, state->target_cpu);
     }
 
     //Free the split up command line
@@ -686,14 +755,16 @@ static int create_target_process(linux_ipt_state_t * state, char* cmd_line, char
     free(argv);
     free(temp_path);
 
-    //if realpath failed, return failure
-    if(!state->target_path)
+    //if realpath or pinning failed, return failure
+    if(!state->target_path || error)
       return -1;
   }
 
   pid = fork_server_fork(&state->fs);
-  if(pid < 0)
+  if(pid < 0) {
+    state->counters.fork_failures++;
     return -1;
+  }
 
   if(pid != state->child_pid) {
     //New target process, cleanup the old IPT state and set it up for the new target
@@ -702,22 +773,26 @@ static int create_target_process(linux_ipt_state_t * state, char* cmd_line, char
     if(setup_ipt(state, state->child_pid))
       return -1;
   } else {
-    //Persistence mode with the same target process being used, adjust the ring buffers and reenable IPT
+    //Persistence mode with the same target process being used.  IPT is still enabled, but the target is stopped
+    //until the fork server tells it to run the next iteration, so its trace starts at the current AUX head.  Skip
+    //anything left over from the last iteration.
     __sync_synchronize(); //smp_mb()
     __atomic_store_n(&state->pem->aux_tail, state->pem->aux_head, __ATOMIC_SEQ_CST);
-    ioctl(state->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
   }
+  state->segment_start = state->pem->aux_tail;
+  state->segment_end = 0;
 
-  if(state->fs.target_stdin != -1) {
+  if(start_ipt_decoder(state))
+    return -1;
+
+  if(state->fs.stdin_stream != -1) {
+    //Send the stdin input down the target's long-lived stdin pipe, for it to read with KILLERBEEZ_READ_STDIN()
+    if(write_stdin_frame(state->fs.target_stdin, state->fs.stdin_stream, stdin_input, stdin_length))
+      FATAL_MSG("Failed to write the input to the target's stdin pipe");
+  } else if(state->fs.target_stdin != -1) {
     //Take care of the stdin input, write over the file, then truncate it accordingly
-    lseek(state->fs.target_stdin, 0, SEEK_SET);
-    if(stdin_input != NULL && stdin_length != 0) {
-      if(write(state->fs.target_stdin, stdin_input, stdin_length) != stdin_length)
-        FATAL_MSG("Short write to target's stdin file");
-    }
-    if(ftruncate(state->fs.target_stdin, stdin_length))
-      FATAL_MSG("ftruncate() failed");
-    lseek(state->fs.target_stdin, 0, SEEK_SET);
+    if(write_stdin_file(state->fs.target_stdin, stdin_input, stdin_length))
+      FATAL_MSG("Failed to write the target's stdin file");
   }
   return 0;
 }
@@ -813,12 +888,27 @@ static linux_ipt_state_t * setup_options(char * options)
 
   //Setup defaults
   state->ipt_mmap_size = 1024*1024; //1MB
+  state->decoder_thread = 1;
+  state->map_size = IPT_DEFAULT_MAP_SIZE;
+  state->cpu = IPT_CPU_NONE;
+  state->target_cpu = IPT_CPU_NONE;
 
   //Parse the options
   if(options) {
     PARSE_OPTION_INT(state, options, persistence_max_cnt, "persistence_max_cnt", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, snapshot, "snapshot", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, persistence_adaptive, "persistence_adaptive", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, stream_stdin, "stream_stdin", linux_ipt_cleanup);
     PARSE_OPTION_INT(state, options, ipt_mmap_size, "ipt_mmap_size", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, decoder_thread, "decoder_thread", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, edge_bitmap, "edge_bitmap", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, map_size, "map_size", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, cpu, "cpu", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, target_cpu, "target_cpu", linux_ipt_cleanup);
+    PARSE_OPTION_STRING(state, options, init_function, "init_function", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, init_marker, "init_marker", linux_ipt_cleanup);
     PARSE_OPTION_ARRAY(state, options, coverage_libraries, num_coverage_libraries, "coverage_libraries", linux_ipt_cleanup);
+    PARSE_OPTION_STRING(state, options, ignore_bytes_file, "ignore_bytes_file", linux_ipt_cleanup);
   }
 
   for(i = 0; i < state->num_coverage_libraries; i++) {
@@ -839,19 +929,45 @@ static linux_ipt_state_t * setup_options(char * options)
     state->coverage_libraries[i] = temp_path;
   }
 
-  //Fix up the IPT mmap size if it's not page aligned
-  if(state->ipt_mmap_size % pagesize != 0)
-    state->ipt_mmap_size = (((state->ipt_mmap_size + pagesize) / pagesize) * pagesize);
-
-  //If we're in persistence mode, allocate the reorder buffer
-  if(state->persistence_max_cnt) {
-    state->reorder_buffer = malloc(state->ipt_mmap_size);
-    if(!state->reorder_buffer) {
+  if(state->edge_bitmap) {
+    if(state->map_size < 64 || (state->map_size & (state->map_size - 1))) {
+      ERROR_MSG("The map_size option must be a power of two, and at least 64");
+      linux_ipt_cleanup(state);
+      return NULL;
+    }
+    if(setup_edge_bitmaps(state)) {
+      linux_ipt_cleanup(state);
+      return NULL;
+    }
+  }
+  if(state->ignore_bytes_file) {
+    if(!state->edge_bitmap) {
+      ERROR_MSG("The ignore_bytes_file option requires the edge_bitmap option");
+      linux_ipt_cleanup(state);
+      return NULL;
+    }
+    state->ignore_bytes_size = read_file(state->ignore_bytes_file, (char **)&state->ignore_bytes);
+    if(state->ignore_bytes_size <= 0 || state->ignore_bytes_size > state->map_size) {
+      ERROR_MSG("Could not read the ignore bytes file %s, or it's larger than the edge bitmap", state->ignore_bytes_file);
       linux_ipt_cleanup(state);
       return NULL;
     }
+    clear_virgin_bytes(state, state->ignore_bytes, state->ignore_bytes_size);
   }
 
+  //Snapshot mode runs the target in persistence mode
+  if(state->snapshot && !state->persistence_max_cnt)
+    state->persistence_max_cnt = IPT_DEFAULT_SNAPSHOT_MAX_CNT;
+  if(state->persistence_adaptive && !state->persistence_max_cnt) {
+    ERROR_MSG("The persistence_adaptive option requires persistence mode (persistence_max_cnt or snapshot)");
+    linux_ipt_cleanup(state);
+    return NULL;
+  }
+
+  //Fix up the IPT mmap size if it's not page aligned
+  if(state->ipt_mmap_size % pagesize != 0)
+    state->ipt_mmap_size = (((state->ipt_mmap_size + pagesize) / pagesize) * pagesize);
+
   return state;
 }
 
@@ -867,14 +983,12 @@ void * linux_ipt_create(char * options, char * state)
   if(!linux_ipt_state)
     return NULL;
 
-  if(get_ipt_system_info(linux_ipt_state)) {
+  if(get_ipt_system_info(linux_ipt_state) || setup_cpu_affinity(linux_ipt_state)) {
     linux_ipt_cleanup(linux_ipt_state);
     return NULL;
   }
 
-  linux_ipt_state->ipt_hashes.tip = XXH64_createState();
-  linux_ipt_state->ipt_hashes.tnt = XXH64_createState();
-  if(!linux_ipt_state->ipt_hashes.tip || !linux_ipt_state->ipt_hashes.tnt) {
+  if(ipt_decoder_init(&linux_ipt_state->decoder)) {
     linux_ipt_cleanup(linux_ipt_state);
     return NULL;
   }
@@ -894,7 +1008,6 @@ void * linux_ipt_create(char * options, char * state)
  */
 void linux_ipt_cleanup(void * instrumentation_state)
 {
-  struct ipt_hashtable_entry * hash, * tmp;
   size_t i;
   linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
 
@@ -908,29 +1021,27 @@ void linux_ipt_cleanup(void * instrumentation_state)
   }
 
   //Cleanup our xxhashes
-  if(state->ipt_hashes.tnt != NULL)
-    XXH64_freeState(state->ipt_hashes.tip);
-  if(state->ipt_hashes.tnt != NULL)
-    XXH64_freeState(state->ipt_hashes.tnt);
+  ipt_decoder_cleanup(&state->decoder);
 
   //Cleanup the perf IPT fd and mmaps
   cleanup_ipt(state);
 
-  //Cleanup the hashtable entries
-  HASH_ITER(hh, state->head, hash, tmp) {
-    HASH_DEL(state->head, hash);
-    free(hash);
-  }
+  //Cleanup the trace hashes
+  ipt_hash_set_clear(&state->hash_set);
+
+  release_cpu_affinity(state);
 
   for(i = 0; i < state->num_coverage_libraries; i++)
     free(state->coverage_libraries[i]);
-  free(state->library_starts);
-  free(state->library_ends);
-  free(state->library_hashes);
+  free(state->decoder.library_ranges);
   free(state->coverage_libraries);
-  free(state->reorder_buffer);
   free(state->filter);
+  free(state->init_function);
   free(state->target_path);
+  free(state->decoder.trace_bits);
+  free(state->virgin_bits);
+  free(state->ignore_bytes_file);
+  free(state->ignore_bytes);
   free(state);
 }
 
@@ -944,34 +1055,43 @@ void linux_ipt_cleanup(void * instrumentation_state)
 void * linux_ipt_merge(void * instrumentation_state, void * other_instrumentation_state)
 {
   linux_ipt_state_t * merged;
-  struct ipt_hashtable_entry * entry = NULL, * hash = NULL, * tmp = NULL, * match = NULL;
-  linux_ipt_state_t * first = (linux_ipt_state_t *)instrumentation_state;
+  struct ipt_hashtable_key * keys;
+  size_t num_keys;
+  int i, error;
+  linux_ipt_state_t * states[2], * first = (linux_ipt_state_t *)instrumentation_state;
   linux_ipt_state_t * second = (linux_ipt_state_t *)other_instrumentation_state;
 
+  if(first->edge_bitmap != second->edge_bitmap || (first->edge_bitmap && first->map_size != second->map_size)) {
+    ERROR_MSG("Cannot merge IPT states that use different edge_bitmap or map_size options");
+    return NULL;
+  }
+
   merged = linux_ipt_create(NULL, NULL);
   if (!merged)
     return NULL;
 
-  //Add the first state's entries
-  HASH_ITER(hh, first->head, hash, tmp)
-  {
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    memset(entry, 0, sizeof(entry));
-    entry->id.tip = hash->id.tip;
-    entry->id.tnt = hash->id.tnt;
-    HASH_ADD(hh, merged->head, id, sizeof(struct ipt_hashtable_key), entry);
+  if(first->edge_bitmap) {
+    merged->edge_bitmap = 1;
+    merged->map_size = first->map_size;
+    if(setup_edge_bitmaps(merged)) {
+      linux_ipt_cleanup(merged);
+      return NULL;
+    }
+    memcpy(merged->virgin_bits, first->virgin_bits, merged->map_size);
+    bitmap_and(merged->virgin_bits, second->virgin_bits, merged->map_size);
   }
 
-  //Add the second state's entries
-  HASH_ITER(hh, second->head, hash, tmp)
-  {
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    memset(entry, 0, sizeof(entry));
-    entry->id.tip = hash->id.tip;
-    entry->id.tnt = hash->id.tnt;
-    HASH_FIND(hh, merged->head, &entry->id, sizeof(struct ipt_hashtable_key), match);
-    if(!match)
-      HASH_ADD(hh, merged->head, id, sizeof(struct ipt_hashtable_key), entry);
+  //Add both states' hashes
+  states[0] = first;
+  states[1] = second;
+  for(i = 0; i < 2; i++) {
+    keys = ipt_hash_set_get_keys(&states[i]->hash_set, &num_keys);
+    error = !keys || ipt_hash_set_add_keys(&merged->hash_set, keys, num_keys);
+    free(keys);
+    if(error) {
+      linux_ipt_cleanup(merged);
+      return NULL;
+    }
   }
 
   return merged;
@@ -983,11 +1103,28 @@ void * linux_ipt_merge(void * instrumentation_state, void * other_instrumentatio
  * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
  * @return - A JSON string that holds the instrumentation specific state object information on success, or NULL on failure
  */
+/**
+ * This function asks the fork server for the persistence max_cnt it has settled on, when it's tuning it in adaptive
+ * mode, so the value can be saved in the instrumentation state.
+ * @param state - the linux_ipt_state_t object containing this instrumentation's state
+ */
+static void update_persistence_max_cnt(linux_ipt_state_t * state)
+{
+  int max_cnt;
+
+  if(!state->persistence_adaptive || !state->fork_server_setup)
+    return;
+  max_cnt = fork_server_get_max_cnt(&state->fs);
+  if(max_cnt > 0)
+    state->persistence_max_cnt = max_cnt;
+}
+
 char * linux_ipt_get_state(void * instrumentation_state)
 {
   linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
   json_t *state_obj, *hash_obj, *hash_list, *temp;
-  struct ipt_hashtable_entry * hash = NULL, * tmp = NULL;
+  struct ipt_hashtable_key * keys;
+  size_t num_keys, i;
   char * ret;
 
   state_obj = json_object();
@@ -999,21 +1136,36 @@ char * linux_ipt_get_state(void * instrumentation_state)
   ADD_INT(temp, state->last_fuzz_result, state_obj, "last_fuzz_result");
   ADD_INT(temp, state->fuzz_results_set, state_obj, "fuzz_results_set");
   ADD_INT(temp, state->last_is_new_path, state_obj, "last_is_new_path");
+  if(state->persistence_adaptive) {
+    update_persistence_max_cnt(state);
+    ADD_INT(temp, state->persistence_max_cnt, state_obj, "persistence_max_cnt");
+  }
+  if(state->edge_bitmap) {
+    ADD_INT(temp, state->map_size, state_obj, "map_size");
+    ADD_MEM_NOCOPY(temp, (const char *)state->virgin_bits, state->map_size, state_obj, "virgin_bits");
+  }
 
   hash_list = json_array();
   if (!hash_list)
     return NULL;
-  HASH_ITER(hh, state->head, hash, tmp)
+  keys = ipt_hash_set_get_keys(&state->hash_set, &num_keys);
+  if (!keys)
+    return NULL;
+  for(i = 0; i < num_keys; i++)
   {
-    hash_obj = json_mem((const char *)&hash->id, sizeof(struct ipt_hashtable_key));
-    if (!hash_obj)
+    hash_obj = json_mem_nocopy((const char *)&keys[i], sizeof(struct ipt_hashtable_key));
+    if (!hash_obj) {
+      free(keys);
       return NULL;
+    }
     json_array_append_new(hash_list, hash_obj);
   }
   json_object_set_new(state_obj, "hash_list", hash_list);
 
-  ret = json_dumps(state_obj, 0);
+  //The hash list points into keys, so they're freed once the state is dumped
+  ret = dump_json_to_string(state_obj, 0, NULL);
   json_decref(state_obj);
+  free(keys);
   return ret;
 }
 
@@ -1035,9 +1187,9 @@ void linux_ipt_free_state(char * state)
 int linux_ipt_set_state(void * instrumentation_state, char * state)
 {
   linux_ipt_state_t * current_state = (linux_ipt_state_t *)instrumentation_state;
-  struct ipt_hashtable_entry * entry = NULL, * hash = NULL, * tmp = NULL, * match = NULL;
   json_t * hash_obj;
-  int result, temp_int;
+  int result, temp_int, map_size;
+  char * virgin_bits;
   size_t length;
 
   if(!state)
@@ -1046,11 +1198,8 @@ int linux_ipt_set_state(void * instrumentation_state, char * state)
   //If a child process is running when the state is being set
   destroy_target_process(current_state, 0); //kill it so we don't orphan it
 
-  //Free any existing hashes already in the hashtable
-  HASH_ITER(hh, current_state->head, hash, tmp) {
-    HASH_DEL(current_state->head, hash);
-    free(hash);
-  }
+  //Free any existing hashes already in the hash set
+  ipt_hash_set_clear(&current_state->hash_set);
 
   GET_INT(temp_int, state, current_state->last_status, "last_status", result);
   GET_INT(temp_int, state, current_state->process_finished, "process_finished", result);
@@ -1058,27 +1207,165 @@ int linux_ipt_set_state(void * instrumentation_state, char * state)
   GET_INT(temp_int, state, current_state->fuzz_results_set, "fuzz_results_set", result);
   GET_INT(temp_int, state, current_state->last_is_new_path, "last_is_new_path", result);
 
+  //Start the next fork server with the max_cnt that adaptive mode settled on
+  if(current_state->persistence_adaptive) {
+    temp_int = get_int_options(state, "persistence_max_cnt", &result);
+    if(result > 0 && temp_int > 0)
+      current_state->persistence_max_cnt = temp_int;
+  }
+
+  if(current_state->edge_bitmap) {
+    GET_INT(temp_int, state, map_size, "map_size", result);
+    if(map_size != current_state->map_size) {
+      ERROR_MSG("The IPT state's map_size (%d) does not match the map_size option (%d)", map_size, current_state->map_size);
+      return 1;
+    }
+    GET_MEM(virgin_bits, state, virgin_bits, "virgin_bits", result);
+    memcpy(current_state->virgin_bits, virgin_bits, current_state->map_size);
+    free(virgin_bits);
+    clear_virgin_bytes(current_state, current_state->ignore_bytes, current_state->ignore_bytes_size);
+  }
+
   FOREACH_OBJECT_JSON_ARRAY_ITEM_BEGIN(state, hash_list, "hash_list", hash_obj, result)
 
     length = json_mem_length(hash_obj);
     if(length != sizeof(struct ipt_hashtable_key))
       return 1;
 
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    if(!entry)
+    if(ipt_hash_set_add(&current_state->hash_set, (const struct ipt_hashtable_key *)json_mem_value(hash_obj)) < 0)
       return 1;
 
-    memset(entry, 0, sizeof(entry));
-    memcpy(&entry->id, json_mem_value(hash_obj), sizeof(struct ipt_hashtable_key));
-    HASH_FIND(hh, current_state->head, &entry->id, sizeof(struct ipt_hashtable_key), match);
-    if(!match)
-      HASH_ADD(hh, current_state->head, id, sizeof(struct ipt_hashtable_key), entry);
-
   FOREACH_OBJECT_JSON_ARRAY_ITEM_END(hash_list)
 
   return 0; //No state to set, so just return success
 }
 
+/**
+ * This function returns the state information in the compact binary state format.  The hashes are
+ * sorted, so states can be merged without loading them.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success, or NULL on failure.  It should be freed with linux_ipt_free_state.
+ */
+char * linux_ipt_get_binary_state(void * instrumentation_state, size_t * length)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+  struct ipt_hashtable_key * keys;
+  binary_state_writer_t * writer;
+  size_t num_keys;
+  int error;
+
+  keys = ipt_hash_set_get_keys(&state->hash_set, &num_keys);
+  if(!keys)
+    return NULL;
+  update_persistence_max_cnt(state);
+
+  writer = binary_state_writer_create("ipt", 1);
+  if(!writer) {
+    free(keys);
+    return NULL;
+  }
+  error = binary_state_add_int(writer, "last_status", state->last_status)
+    || binary_state_add_int(writer, "process_finished", state->process_finished)
+    || binary_state_add_int(writer, "last_fuzz_result", state->last_fuzz_result)
+    || binary_state_add_int(writer, "fuzz_results_set", state->fuzz_results_set)
+    || binary_state_add_int(writer, "last_is_new_path", state->last_is_new_path)
+    || binary_state_add_section(writer, "hash_list", BINARY_STATE_MERGE_UNION, sizeof(struct ipt_hashtable_key),
+      keys, num_keys * sizeof(struct ipt_hashtable_key));
+  if(!error && state->persistence_adaptive)
+    error = binary_state_add_int(writer, "persistence_max_cnt", state->persistence_max_cnt);
+  if(!error && state->edge_bitmap)
+    error = binary_state_add_int(writer, "map_size", state->map_size)
+      || binary_state_add_section(writer, "virgin_bits", BINARY_STATE_MERGE_AND, 0, state->virgin_bits, state->map_size);
+  free(keys);
+  if(error) {
+    binary_state_writer_free(writer);
+    return NULL;
+  }
+  return binary_state_writer_finish(writer, length);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via linux_ipt_get_binary_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param state - a binary state previously obtained via linux_ipt_get_binary_state
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure.
+ */
+int linux_ipt_set_binary_state(void * instrumentation_state, char * state, size_t length)
+{
+  linux_ipt_state_t * current_state = (linux_ipt_state_t *)instrumentation_state;
+  const struct ipt_hashtable_key * keys;
+  struct ipt_hashtable_key * keys_copy = NULL;
+  binary_state_t * binary_state;
+  int64_t last_status, process_finished, last_fuzz_result, fuzz_results_set, last_is_new_path, map_size;
+  int64_t persistence_max_cnt;
+  size_t keys_length;
+  int error;
+
+  binary_state = binary_state_open(state, length);
+  if(!binary_state)
+    return 1;
+
+  if(strcmp(binary_state_instrumentation(binary_state), "ipt")
+    || binary_state_get_int(binary_state, "last_status", &last_status)
+    || binary_state_get_int(binary_state, "process_finished", &process_finished)
+    || binary_state_get_int(binary_state, "last_fuzz_result", &last_fuzz_result)
+    || binary_state_get_int(binary_state, "fuzz_results_set", &fuzz_results_set)
+    || binary_state_get_int(binary_state, "last_is_new_path", &last_is_new_path)
+    || binary_state_section_length(binary_state, "hash_list", &keys_length)) {
+    binary_state_close(binary_state);
+    return 1;
+  }
+
+  //Use the hashes in place, unless the section was compressed
+  keys = binary_state_get_raw_section(binary_state, "hash_list", &keys_length);
+  if(!keys) {
+    keys_copy = malloc(keys_length + 1);
+    if(!keys_copy || binary_state_get_section(binary_state, "hash_list", keys_copy, keys_length)) {
+      free(keys_copy);
+      binary_state_close(binary_state);
+      return 1;
+    }
+    keys = keys_copy;
+  }
+
+  if(current_state->edge_bitmap) {
+    if(binary_state_get_int(binary_state, "map_size", &map_size) || map_size != current_state->map_size) {
+      ERROR_MSG("The IPT state's map_size does not match the map_size option (%d)", current_state->map_size);
+      free(keys_copy);
+      binary_state_close(binary_state);
+      return 1;
+    }
+    if(binary_state_get_section(binary_state, "virgin_bits", current_state->virgin_bits, current_state->map_size)) {
+      free(keys_copy);
+      binary_state_close(binary_state);
+      return 1;
+    }
+    clear_virgin_bytes(current_state, current_state->ignore_bytes, current_state->ignore_bytes_size);
+  }
+
+  //If a child process is running when the state is being set
+  destroy_target_process(current_state, 0); //kill it so we don't orphan it
+
+  //Free any existing hashes already in the hash set
+  ipt_hash_set_clear(&current_state->hash_set);
+
+  current_state->last_status = (int)last_status;
+  current_state->process_finished = (int)process_finished;
+  current_state->last_fuzz_result = (int)last_fuzz_result;
+  current_state->fuzz_results_set = (int)fuzz_results_set;
+  current_state->last_is_new_path = (int)last_is_new_path;
+  if(current_state->persistence_adaptive &&
+    !binary_state_get_int(binary_state, "persistence_max_cnt", &persistence_max_cnt) && persistence_max_cnt > 0)
+    current_state->persistence_max_cnt = (int)persistence_max_cnt;
+
+  error = ipt_hash_set_add_keys(&current_state->hash_set, keys, keys_length / sizeof(struct ipt_hashtable_key));
+  free(keys_copy);
+  binary_state_close(binary_state);
+  return error;
+}
+
 /**
  * This function enables the instrumentation and runs the fuzzed process.
  * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
@@ -1157,6 +1444,53 @@ int linux_ipt_get_fuzz_result(void * instrumentation_state)
   return finish_fuzz_round((linux_ipt_state_t *)instrumentation_state);
 }
 
+/**
+ * This function returns the counts of the problems the instrumentation has run into while starting and tracing
+ * the target.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_ipt_create function
+ * @param counters - a pointer used to return the counts
+ */
+void linux_ipt_get_counters(void * instrumentation_state, instrumentation_counters_t * counters)
+{
+  *counters = ((linux_ipt_state_t *)instrumentation_state)->counters;
+}
+
+/**
+ * This function returns the edge bitmap of the last execution, when the edge_bitmap option is used.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_ipt_create function
+ * @param trace_bits - a pointer used to return the bitmap, which is only valid until the next execution
+ * @param size - a pointer used to return the size of the bitmap
+ * @return - zero on success, or non-zero if the edge_bitmap option isn't used
+ */
+int linux_ipt_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+
+  if(!state->edge_bitmap)
+    return 1;
+  *trace_bits = state->decoder.trace_bits;
+  *size = state->map_size;
+  return 0;
+}
+
+/**
+ * This function stops the unstable bytes of the edge bitmap, which change between executions of the same input,
+ * from being reported as new paths.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_ipt_create function
+ * @param unstable_bytes - a map the size of the edge bitmap, which is non-zero for each byte that should be ignored
+ * @param size - the size of the unstable_bytes parameter
+ * @return - zero on success, or non-zero if the edge_bitmap option isn't used or the map is larger than the bitmap
+ */
+int linux_ipt_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+
+  if(!state->edge_bitmap || size > (size_t)state->map_size)
+    return 1;
+  clear_virgin_bytes(state, unstable_bytes, size);
+  return 0;
+}
+
 /**
  * Checks if the target process is done fuzzing the inputs yet.
  * @param state - The linux_ipt_state_t object containing this instrumentation's state
@@ -1179,6 +1513,30 @@ int linux_ipt_is_process_done(void * instrumentation_state)
   return 1;
 }
 
+/**
+ * Blocks until the target process is done fuzzing the inputs, or the timeout expires.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process is not done testing the fuzzed input, 1 if the process is done, or -1 on error
+ */
+int linux_ipt_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+  int status;
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+
+  if(state->process_finished)
+    return 1;
+
+  status = fork_server_wait_for_status(&state->fs, timeout_ms);
+  if(status == FORKSERVER_NO_RESULTS_READY)
+    return 0;
+  if(status < 0)
+    return -1;
+  state->last_status = status;
+  state->process_finished = 1;
+  return 1;
+}
+
 /**
  * This function returns help text for the Linux IPT instrumentation.
  * @param help_str - A pointer that will be updated to point to the new help string.
@@ -1191,8 +1549,47 @@ int linux_ipt_help(char ** help_str)
 "Options:\n"
 "  persistence_max_cnt  The number of executions to run in one process while\n"
 "                         fuzzing in persistence mode\n"
+"  snapshot             Whether to run targets that don't use KILLERBEEZ_LOOP\n"
+"                         in persistence mode, by restoring a snapshot of the\n"
+"                         target's memory after each execution (default 0)\n"
+"  persistence_adaptive Whether the fork server should raise or lower\n"
+"                         persistence_max_cnt based on how the target's exec\n"
+"                         time and memory usage grow.  The chosen value is\n"
+"                         saved in the instrumentation state (default 0)\n"
+"  stream_stdin         Whether to write each input to one long-lived stdin\n"
+"                         pipe, prefixed with its length, for a persistent\n"
+"                         target to read with KILLERBEEZ_READ_STDIN(), rather\n"
+"                         than rewriting a stdin file for each run.  Inputs\n"
+"                         must be smaller than 1MB (default 0)\n"
 "  ipt_mmap_size        The amount of memory to use for the IPT trace data\n"
 "                         buffer\n"
+"  decoder_thread       Whether to decode the IPT trace data in a background\n"
+"                         thread while the target runs, so long traces don't\n"
+"                         overflow the trace data buffer (default 1)\n"
+"  edge_bitmap          Whether to record an AFL style bitmap of the edges\n"
+"                         and hit counts in each trace, rather than a hash of\n"
+"                         the whole trace, so only traces with new edges are\n"
+"                         considered new paths (default 0)\n"
+"  map_size             The size of the edge bitmap, which must be a power of\n"
+"                         two (default 65536)\n"
+"  ignore_bytes_file    A file with a byte for each byte of the edge bitmap,\n"
+"                         which is non-zero for the bytes that should never\n"
+"                         count as new coverage, such as the picker writes\n"
+"                         (requires edge_bitmap)\n"
+"  init_function        The function to start the fork server at, rather than\n"
+"                         main, so the target's startup code before it only\n"
+"                         runs once.  Either a name in the dynamic symbol\n"
+"                         table, or a hex offset (0x...) from the executable's\n"
+"                         load address\n"
+"  init_marker          Whether to wait for the target to call\n"
+"                         KILLERBEEZ_INIT() to start the fork server, rather\n"
+"                         than starting it at main (default 0)\n"
+"  cpu                  The CPU to pin the fuzzer, the IPT decoder thread, and\n"
+"                         the target to, or -2 to pick a CPU that no other\n"
+"                         process is pinned to (default -1, not pinned)\n"
+"  target_cpu           The CPU to pin the fork server and target to, if it\n"
+"                         should differ from the fuzzer's, or -2 to pick a\n"
+"                         free CPU (default -1, the same as cpu)\n"
 "  coverage_libraries   An array of library or executable filenames that IPT\n"
 "                         should record trace information.  By default, only\n"
 "                         the executable is traced.\n"
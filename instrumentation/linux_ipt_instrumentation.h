@@ -1,8 +1,12 @@
 #pragma once
 
 #include "forkserver_internal.h"
-#include "uthash.h"
-#include "xxhash.h"
+#include "instrumentation.h"
+#include "ipt_decoder.h"
+
+#include <utils.h>
+
+#include <pthread.h>
 
 void * linux_ipt_create(char * options, char * state);
 void linux_ipt_cleanup(void * instrumentation_state);
@@ -10,45 +14,52 @@ void * linux_ipt_merge(void * instrumentation_state, void * other_instrumentatio
 char * linux_ipt_get_state(void * instrumentation_state);
 void linux_ipt_free_state(char * state);
 int linux_ipt_set_state(void * instrumentation_state, char * state);
+char * linux_ipt_get_binary_state(void * instrumentation_state, size_t * length);
+int linux_ipt_set_binary_state(void * instrumentation_state, char * state, size_t length);
 int linux_ipt_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
 int linux_ipt_is_new_path(void * instrumentation_state);
 int linux_ipt_is_process_done(void * instrumentation_state);
+int linux_ipt_wait_for_process_done(void * instrumentation_state, int timeout_ms);
 int linux_ipt_get_fuzz_result(void * instrumentation_state);
+void linux_ipt_get_counters(void * instrumentation_state, instrumentation_counters_t * counters);
+int linux_ipt_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size);
+int linux_ipt_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size);
 int linux_ipt_help(char ** help_str);
 
-struct ipt_hashtable_key {
-  uint64_t tip;
-  uint64_t tnt;
-};
+//The cpu and target_cpu option values that don't name a specific CPU
+#define IPT_CPU_NONE            -1 //Don't pin the process (or for target_cpu, use the same CPU as the fuzzer)
+#define IPT_CPU_AUTO            -2 //Pick a CPU that no other process is pinned to
 
-struct ipt_hashtable_entry {
-    struct ipt_hashtable_key id;
-    UT_hash_handle hh;
-};
+//The persistence_max_cnt used in snapshot mode, if it isn't set
+#define IPT_DEFAULT_SNAPSHOT_MAX_CNT 1000
 
-struct ipt_hash_state
-{
-  uint64_t tnt_bits;
-  uint64_t num_bits;
-  uint64_t total_num_bits;
-  XXH64_state_t * tnt;
-  XXH64_state_t * tip;
-};
+//How often the decoder thread checks for new trace data, if it isn't woken up sooner
+#define IPT_DECODER_POLL_MS     1
 
 struct linux_ipt_state
 {
   int persistence_max_cnt;
+  int snapshot;
+  int persistence_adaptive;
+  int stream_stdin;
   int ipt_mmap_size;
+  int decoder_thread;
+  int edge_bitmap;
+  int map_size;
+  int cpu;
+  int target_cpu;
+  int cpu_claimed;        //Whether cpu was picked with IPT_CPU_AUTO, and is held in the process's claimed CPUs
+  int target_cpu_claimed; //Likewise for target_cpu
+  int thread_pinned;      //Whether the thread that runs the target has been pinned to cpu
+  pthread_t pinned_thread;
+  void * unpinned_cpus;   //The pinned thread's cpu_set_t from before it was pinned, to restore it on cleanup
+  char * init_function;
+  int init_marker;
 
   char ** coverage_libraries;
-  uint64_t * library_starts;
-  uint64_t * library_ends;
-  uint32_t * library_hashes;
   size_t num_coverage_libraries;
 
   char * target_path;
-  uint64_t target_start;
-  uint64_t target_end;
 
   int num_address_ranges;
   int fork_server_setup;
@@ -57,12 +68,20 @@ struct linux_ipt_state
   int perf_fd;
   struct perf_event_mmap_page * pem;
   void * perf_aux_buf;
-  char * reorder_buffer;
-  uint64_t last_ip;
+  struct ipt_decoder decoder; //Also holds the target's address ranges, and the edge bitmap of the current execution
+  thread_t decoder_thread_handle;
+  int decoder_running;
+  int decoder_stop;
+  uint64_t segment_start; //In persistence mode, the AUX offset the current iteration's trace starts at
+  uint64_t segment_end;   //In persistence mode, the AUX offset it ends at, once the iteration has finished
   char * filter;
 
-  struct ipt_hash_state ipt_hashes;
-  struct ipt_hashtable_entry * head;
+  struct ipt_hash_set hash_set;
+
+  uint8_t * virgin_bits;  //The edges that haven't been hit by any previous execution
+  char * ignore_bytes_file; //A file of the edge bitmap bytes to ignore, such as the picker writes
+  uint8_t * ignore_bytes;   //The contents of ignore_bytes_file, non-zero for each ignored byte
+  int ignore_bytes_size;
 
   pid_t child_pid;
   forkserver_t fs;
@@ -71,5 +90,7 @@ struct linux_ipt_state
   int last_fuzz_result;
   int fuzz_results_set;
   int last_is_new_path;
+
+  instrumentation_counters_t counters; //The problems starting and tracing the target, for the fuzzer's stats
 };
 typedef struct linux_ipt_state linux_ipt_state_t;
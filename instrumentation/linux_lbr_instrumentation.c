@@ -0,0 +1,726 @@
+// Linux-only branch stack sampling instrumentation, for hosts without Intel PT.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "instrumentation.h"
+#include "linux_lbr_instrumentation.h"
+#include "forkserver_internal.h"
+
+#include <utils.h>
+#include <jansson_helper.h>
+
+//The ipt instrumentation needs Intel PT, which AMD CPUs and most virtual machines don't have.  This instrumentation
+//asks perf for samples of the CPU's branch stack instead (LBR on Intel, BRS or LbrExtV2 on AMD), which many more hosts
+//support.  Every sample_period branches, the kernel records the last few branches the target took, and each one is
+//added to an AFL style edge bitmap.  The coverage is only a sample of the target's edges, so an input can look new
+//just because different branches were sampled.  A smaller sample_period sees more of the edges, and costs more
+//interrupts.
+
+////////////////////////////////////////////////////////////////
+// Branch Sample Analyzer //////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function normalizes an address, so the same edge gets the same location in every run, even with ASLR
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param address - the address to normalize
+ * @return - the address relative to the executable, or 0 for addresses outside of it
+ */
+static uint64_t normalize_address(linux_lbr_state_t * state, uint64_t address)
+{
+  if(address < state->target_start || address >= state->target_end)
+    return 0;
+  return address - state->target_start + 1;
+}
+
+/**
+ * This function records an edge from a branch's address to its target in the edge bitmap.  Only the branches that
+ * start or end in the executable are recorded, since the libraries' addresses change from run to run.
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param from - the address of the branch instruction
+ * @param to - the address the branch jumped to
+ */
+static void add_edge_to_bitmap(linux_lbr_state_t * state, uint64_t from, uint64_t to)
+{
+  uint32_t from_location, to_location;
+
+  from = normalize_address(state, from);
+  to = normalize_address(state, to);
+  if(!from && !to)
+    return;
+
+  //Spread the locations over the whole bitmap, as nearby addresses differ only in their low bits
+  from_location = (uint32_t)((from * 0x9E3779B97F4A7C15ULL) >> 32);
+  to_location = (uint32_t)((to * 0x9E3779B97F4A7C15ULL) >> 32);
+  state->trace_bits[((from_location >> 1) ^ to_location) & (state->map_size - 1)]++;
+}
+
+/**
+ * This function copies data out of the perf ring buffer, which may wrap around its end
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param offset - the offset of the data from the start of the ring buffer, which may be past its end
+ * @param dest - the buffer to copy the data to
+ * @param length - the length of the data, which must not be more than the size of the ring buffer
+ */
+static void copy_from_ring_buffer(linux_lbr_state_t * state, uint64_t offset, void * dest, size_t length)
+{
+  unsigned char * data = (unsigned char *)state->pem + state->pem->data_offset;
+  uint64_t size = state->pem->data_size;
+  size_t first;
+
+  offset %= size;
+  first = size - offset;
+  if(first > length)
+    first = length;
+  memcpy(dest, data + offset, first);
+  memcpy((unsigned char *)dest + first, data, length - first);
+}
+
+/**
+ * This function adds the branches of every sample in the perf ring buffer to the edge bitmap
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ */
+static void read_samples(linux_lbr_state_t * state)
+{
+  struct perf_event_header header;
+  struct perf_branch_entry * entries;
+  uint64_t head, tail, num_entries, i;
+
+  head = __atomic_load_n(&state->pem->data_head, __ATOMIC_ACQUIRE);
+  tail = state->pem->data_tail;
+  while(tail + sizeof(header) <= head) {
+    copy_from_ring_buffer(state, tail, &header, sizeof(header));
+    if(header.size < sizeof(header) || tail + header.size > head)
+      break;
+
+    if(header.type == PERF_RECORD_SAMPLE && header.size >= sizeof(header) + sizeof(uint64_t)) {
+      //A sample with just PERF_SAMPLE_BRANCH_STACK is the number of branches, followed by the branches
+      copy_from_ring_buffer(state, tail, state->sample_buffer, header.size);
+      num_entries = *(uint64_t *)(state->sample_buffer + sizeof(header));
+      entries = (struct perf_branch_entry *)(state->sample_buffer + sizeof(header) + sizeof(uint64_t));
+      if(num_entries > (header.size - sizeof(header) - sizeof(uint64_t)) / sizeof(struct perf_branch_entry))
+        num_entries = (header.size - sizeof(header) - sizeof(uint64_t)) / sizeof(struct perf_branch_entry);
+      for(i = 0; i < num_entries; i++)
+        add_edge_to_bitmap(state, entries[i].from, entries[i].to);
+    }
+    else if(header.type == PERF_RECORD_LOST)
+      state->counters.trace_overflows++;
+    tail += header.size;
+  }
+  __atomic_store_n(&state->pem->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * This function wraps the perf_event_open syscall, which does not have one in libc
+ */
+static long perf_event_open(struct perf_event_attr* hw_event, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+  return syscall(__NR_perf_event_open, hw_event, (uintptr_t)pid, (uintptr_t)cpu, (uintptr_t)group_fd, (uintptr_t)flags);
+}
+
+/**
+ * This function cleans up the perf file descriptor and ring buffer
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ */
+static void cleanup_lbr(linux_lbr_state_t * state)
+{
+  if(state->pem && state->pem != MAP_FAILED)
+    munmap(state->pem, (state->mmap_pages + 1) * getpagesize());
+  state->pem = NULL;
+  if(state->perf_fd >= 0)
+    close(state->perf_fd);
+  state->perf_fd = -1;
+}
+
+/**
+ * This function reads the samples of the last execution into the edge bitmap, and checks it for new edges
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @return - 1 if the execution had new edges or hit counts, 0 if it didn't
+ */
+static int analyze_lbr(linux_lbr_state_t * state)
+{
+  memset(state->trace_bits, 0, state->map_size);
+  read_samples(state);
+  cleanup_lbr(state);
+
+  bitmap_classify_counts(state->trace_bits, state->map_size);
+  return bitmap_has_new_bits(state->virgin_bits, state->trace_bits, state->map_size) != 0;
+}
+
+/**
+ * This function sets up branch stack sampling for the specified process
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param pid - The process ID of the process to sample
+ * @return - 0 on success, non-zero on failure
+ */
+static int setup_lbr(linux_lbr_state_t * state, pid_t pid)
+{
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(struct perf_event_attr));
+  pe.size = sizeof(struct perf_event_attr);
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+  pe.sample_period = state->sample_period;
+  pe.sample_type = PERF_SAMPLE_BRANCH_STACK;
+  pe.branch_sample_type = PERF_SAMPLE_BRANCH_USER | PERF_SAMPLE_BRANCH_ANY;
+  pe.disabled = 0;
+  pe.exclude_hv = 1;
+  pe.exclude_kernel = 1;
+
+  state->perf_fd = perf_event_open(&pe, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if(state->perf_fd < 0) {
+    ERROR_MSG("Could not open the perf event file system (perf_event_open failed with errno %d (%s))", errno, strerror(errno));
+    if(errno == EOPNOTSUPP || errno == ENOENT)
+      ERROR_MSG("This CPU (or virtual machine) doesn't support branch stack sampling");
+    else
+      ERROR_MSG("Try adjusting the perf system permissions with: echo 1 | sudo tee /proc/sys/kernel/perf_event_paranoid");
+    return 1;
+  }
+
+  state->pem = mmap(NULL, (state->mmap_pages + 1) * getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED, state->perf_fd, 0);
+  if(state->pem == MAP_FAILED) {
+    state->pem = NULL;
+    ERROR_MSG("Perf mmap failed (mmap_pages=%d)\n", state->mmap_pages);
+    return 1;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// Private methods /////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates the edge bitmaps
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero on failure
+ */
+static int setup_edge_bitmaps(linux_lbr_state_t * state)
+{
+  state->trace_bits = calloc(1, state->map_size);
+  state->virgin_bits = malloc(state->map_size);
+  //A sample's size is a 16-bit field, so this holds any sample
+  state->sample_buffer = malloc(UINT16_MAX + 1);
+  if(!state->trace_bits || !state->virgin_bits || !state->sample_buffer) {
+    ERROR_MSG("Failed to allocate the LBR edge bitmaps");
+    return 1;
+  }
+  memset(state->virgin_bits, 0xff, state->map_size);
+  return 0;
+}
+
+/**
+ * This function records the address range of the executable inside of the fork server (which will have the same
+ * addresses as all target processes).
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ */
+static void record_fork_server_address_info(linux_lbr_state_t * state)
+{
+  char filename[64], line[1024+MAX_PATH], map_filename[MAX_PATH];
+  FILE * fp;
+  uint64_t start, end;
+  int count;
+
+  snprintf(filename, sizeof(filename), "/proc/%d/maps", state->fs.pid);
+  fp = fopen(filename, "r");
+  if(!fp)
+    FATAL_MSG("Failed to open the fork server's maps file (%s)", filename);
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    memset(map_filename, 0, sizeof(map_filename));
+    count = sscanf(line, "%16lx-%16lx %*4s %*8s %*s %*d %1024s\n", &start, &end, map_filename);
+    if(count == 3 && strcmp(map_filename, state->target_path) == 0) {
+      if(state->target_start == 0)
+        state->target_start = start;
+      state->target_end = end;
+    }
+  }
+  fclose(fp);
+
+  if(!state->target_start || !state->target_end) {
+    WARNING_MSG("Could not determine the address of the target executable in memory.  Every sampled branch will be "
+      "recorded, and the edges will be specific to this run if ASLR is enabled.");
+    state->target_start = 0;
+    state->target_end = UINT64_MAX;
+  }
+}
+
+/**
+ * This function terminates the fuzzed process.
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ */
+static void destroy_target_process(linux_lbr_state_t * state)
+{
+  if(state->child_pid && state->child_pid != -1) {
+    kill(state->child_pid, SIGKILL);
+    state->child_pid = 0;
+    state->last_status = fork_server_get_status(&state->fs, 1);
+  }
+}
+
+/**
+ * This function starts the fuzzed process
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process to start
+ * @param stdin_input - the input to pass to the fuzzed process's stdin
+ * @param stdin_length - the length of the stdin_input parameter
+ * @return - zero on success, non-zero on failure.
+ */
+static int create_target_process(linux_lbr_state_t * state, char* cmd_line, char * stdin_input, size_t stdin_length)
+{
+  char ** argv;
+  char * temp_path;
+  int i, pid;
+
+  if(!state->fork_server_setup) {
+    if(split_command_line(cmd_line, &temp_path, &argv))
+      return -1;
+
+    //Get the absolute path for the target
+    state->target_path = realpath(temp_path, NULL);
+    if(state->target_path) {
+      state->fs.init_function = state->init_function;
+      state->fs.init_marker = state->init_marker;
+      fork_server_init(&state->fs, state->target_path, argv, 1, 0, stdin_length != 0);
+      record_fork_server_address_info(state);
+      state->fork_server_setup = 1;
+    }
+
+    //Free the split up command line
+    for(i = 0; argv[i]; i++)
+      free(argv[i]);
+    free(argv);
+    free(temp_path);
+
+    //if realpath failed, return failure
+    if(!state->target_path)
+      return -1;
+  }
+
+  pid = fork_server_fork(&state->fs);
+  if(pid < 0) {
+    state->counters.fork_failures++;
+    return -1;
+  }
+
+  //Sample the new child, which waits for the RUN command before running any of the target's code
+  state->child_pid = pid;
+  cleanup_lbr(state);
+  if(setup_lbr(state, state->child_pid))
+    return -1;
+
+  if(state->fs.target_stdin != -1) {
+    //Take care of the stdin input, write over the file, then truncate it accordingly
+    if(write_stdin_file(state->fs.target_stdin, stdin_input, stdin_length))
+      FATAL_MSG("Failed to write the target's stdin file");
+  }
+  return 0;
+}
+
+/**
+ * This function creates a linux_lbr_state_t object based on the given options.
+ * @param options - A JSON string of the options to set in the new linux_lbr_state_t. See the help function for more
+ *                  information on the specific options available.
+ * @return the linux_lbr_state_t generated from the options in the JSON options string, or NULL on failure
+ */
+static linux_lbr_state_t * setup_options(char * options)
+{
+  linux_lbr_state_t * state;
+
+  state = malloc(sizeof(linux_lbr_state_t));
+  if(!state)
+    return NULL;
+  memset(state, 0, sizeof(linux_lbr_state_t));
+
+  //Setup defaults
+  state->sample_period = LBR_DEFAULT_SAMPLE_PERIOD;
+  state->mmap_pages = LBR_DEFAULT_MMAP_PAGES;
+  state->map_size = LBR_DEFAULT_MAP_SIZE;
+  state->perf_fd = -1;
+
+  //Parse the options
+  if(options) {
+    PARSE_OPTION_INT(state, options, sample_period, "sample_period", linux_lbr_cleanup);
+    PARSE_OPTION_INT(state, options, mmap_pages, "mmap_pages", linux_lbr_cleanup);
+    PARSE_OPTION_INT(state, options, map_size, "map_size", linux_lbr_cleanup);
+    PARSE_OPTION_STRING(state, options, init_function, "init_function", linux_lbr_cleanup);
+    PARSE_OPTION_INT(state, options, init_marker, "init_marker", linux_lbr_cleanup);
+  }
+
+  if(state->sample_period <= 0) {
+    ERROR_MSG("The sample_period option must be positive");
+    linux_lbr_cleanup(state);
+    return NULL;
+  }
+  if(state->mmap_pages <= 0 || (state->mmap_pages & (state->mmap_pages - 1))) {
+    ERROR_MSG("The mmap_pages option must be a power of two");
+    linux_lbr_cleanup(state);
+    return NULL;
+  }
+  if(state->map_size < 64 || (state->map_size & (state->map_size - 1))) {
+    ERROR_MSG("The map_size option must be a power of two, and at least 64");
+    linux_lbr_cleanup(state);
+    return NULL;
+  }
+  if(setup_edge_bitmaps(state)) {
+    linux_lbr_cleanup(state);
+    return NULL;
+  }
+  return state;
+}
+
+static int finish_fuzz_round(linux_lbr_state_t * state)
+{
+  if(!state->fuzz_results_set) {
+    //if it's still alive, it's a hang
+    if(!linux_lbr_is_process_done(state)) {
+      destroy_target_process(state);
+      state->last_fuzz_result = FUZZ_HANG;
+    }
+    //If it died from a signal (and it wasn't SIGKILL, that we send), it's a crash
+    else if(WIFSIGNALED(state->last_status) && WTERMSIG(state->last_status) != SIGKILL)
+      state->last_fuzz_result = FUZZ_CRASH;
+    //Otherwise, just set FUZZ_NONE
+    else
+      state->last_fuzz_result = FUZZ_NONE;
+    state->fuzz_results_set = 1;
+  }
+
+  return state->last_fuzz_result;
+}
+
+////////////////////////////////////////////////////////////////
+// Instrumentation methods /////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates and initializes a new instrumentation specific state object based on the given options.
+ * @param options - a JSON string that contains the instrumentation specific string of options
+ * @param state - an instrumentation specific JSON string previously returned from linux_lbr_get_state that should be loaded
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * linux_lbr_create(char * options, char * state)
+{
+  linux_lbr_state_t * linux_lbr_state = setup_options(options);
+  if(!linux_lbr_state)
+    return NULL;
+
+  if(state && linux_lbr_set_state(linux_lbr_state, state)) {
+    linux_lbr_cleanup(linux_lbr_state);
+    return NULL;
+  }
+
+  return linux_lbr_state;
+}
+
+/**
+ * This function cleans up all resources with the passed in instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * This state object should not be referenced after this function returns.
+ */
+void linux_lbr_cleanup(void * instrumentation_state)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+
+  //Kill any remaining target processes
+  destroy_target_process(state);
+
+  //Cleanup the fork server
+  if(state->fork_server_setup) {
+    fork_server_exit(&state->fs);
+    state->fork_server_setup = 0;
+  }
+
+  cleanup_lbr(state);
+  free(state->init_function);
+  free(state->target_path);
+  free(state->trace_bits);
+  free(state->virgin_bits);
+  free(state->sample_buffer);
+  free(state);
+}
+
+/**
+ * This function merges the coverage information from two instrumentation states.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @param other_instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
+ * on success, or NULL on failure
+ */
+void * linux_lbr_merge(void * instrumentation_state, void * other_instrumentation_state)
+{
+  linux_lbr_state_t * merged, * first = (linux_lbr_state_t *)instrumentation_state;
+  linux_lbr_state_t * second = (linux_lbr_state_t *)other_instrumentation_state;
+  char options[64];
+
+  if(first->map_size != second->map_size) {
+    ERROR_MSG("Cannot merge LBR states that use different map_size options");
+    return NULL;
+  }
+
+  snprintf(options, sizeof(options), "{\"map_size\":%d}", first->map_size);
+  merged = linux_lbr_create(options, NULL);
+  if(!merged)
+    return NULL;
+  memcpy(merged->virgin_bits, first->virgin_bits, merged->map_size);
+  bitmap_and(merged->virgin_bits, second->virgin_bits, merged->map_size);
+  return merged;
+}
+
+/**
+ * This function returns the state information holding the previous execution path info.  The returned value can later be passed to
+ * linux_lbr_create or linux_lbr_set_state to load the state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @return - A JSON string that holds the instrumentation specific state object information on success, or NULL on failure
+ */
+char * linux_lbr_get_state(void * instrumentation_state)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+  json_t *state_obj, *temp;
+  char * ret;
+
+  state_obj = json_object();
+  if (!state_obj)
+    return NULL;
+
+  ADD_INT(temp, state->map_size, state_obj, "map_size");
+  ADD_MEM_NOCOPY(temp, (const char *)state->virgin_bits, state->map_size, state_obj, "virgin_bits");
+  ret = dump_json_to_string(state_obj, 0, NULL);
+  json_decref(state_obj);
+  return ret;
+}
+
+/**
+ * This function frees an instrumentation state previously obtained via linux_lbr_get_state.
+ * @param state - the instrumentation state to free
+ */
+void linux_lbr_free_state(char * state)
+{
+  free(state);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via linux_lbr_get_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @param state - an instrumentation state previously obtained via linux_lbr_get_state
+ * @return - 0 on success, non-zero on failure.
+ */
+int linux_lbr_set_state(void * instrumentation_state, char * state)
+{
+  linux_lbr_state_t * current_state = (linux_lbr_state_t *)instrumentation_state;
+  int result, temp_int, map_size;
+  char * virgin_bits;
+
+  if(!state)
+    return 1;
+
+  GET_INT(temp_int, state, map_size, "map_size", result);
+  if(map_size != current_state->map_size) {
+    ERROR_MSG("The LBR state's map_size (%d) does not match the map_size option (%d)", map_size, current_state->map_size);
+    return 1;
+  }
+  GET_MEM(virgin_bits, state, virgin_bits, "virgin_bits", result);
+  memcpy(current_state->virgin_bits, virgin_bits, current_state->map_size);
+  free(virgin_bits);
+  return 0;
+}
+
+/**
+ * This function enables the instrumentation and runs the fuzzed process.  If the process needs to be restarted, it will be.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @process - a pointer to return a handle to the process that instrumentation was enabled on
+ * @cmd_line - the command line of the fuzzed process to enable instrumentation on
+ * @input - a buffer to the input that should be sent to the fuzzed process on stdin
+ * @input_length - the length of the input parameter
+ * returns 0 on success, -1 on failure
+ */
+int linux_lbr_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+  if(state->child_pid)
+    destroy_target_process(state);
+
+  if(create_target_process(state, cmd_line, input, input_length))
+    return -1;
+  state->process_finished = 0;
+  state->fuzz_results_set = 0;
+
+  if(fork_server_run(&state->fs))
+    return -1;
+
+  *process = state->child_pid;
+  return 0;
+}
+
+/**
+ * This function determines whether the process being instrumented has taken a new path.  Calling this function will stop the
+ * process if it is not yet finished.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_lbr_create function
+ * @return - 1 if the previously setup process (via the enable function) had new sampled edges, 0 if it did not, or -1 on failure.
+ */
+int linux_lbr_is_new_path(void * instrumentation_state)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+
+  //Ensure that the process has finished parsing the input (or stop it if it's not)
+  finish_fuzz_round(state);
+
+  //If we haven't cleaned up the perf state, then it must not have been
+  if(state->perf_fd >= 0) //analyzed.  Analyze it now and cleanup the perf state
+    state->last_is_new_path = analyze_lbr(state);
+
+  return state->last_is_new_path;
+}
+
+/**
+ * This function will return the result of the fuzz job. It should be called
+ * after the process has finished processing the tested input.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_lbr_create function
+ * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
+ */
+int linux_lbr_get_fuzz_result(void * instrumentation_state)
+{
+  return finish_fuzz_round((linux_lbr_state_t *)instrumentation_state);
+}
+
+/**
+ * This function returns the counts of the problems the instrumentation has run into while starting and sampling
+ * the target.  Samples that the kernel dropped because the ring buffer was full count as trace overflows.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_lbr_create function
+ * @param counters - a pointer used to return the counts
+ */
+void linux_lbr_get_counters(void * instrumentation_state, instrumentation_counters_t * counters)
+{
+  *counters = ((linux_lbr_state_t *)instrumentation_state)->counters;
+}
+
+/**
+ * This function returns the edge bitmap of the last execution.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_lbr_create function
+ * @param trace_bits - a pointer used to return the bitmap, which is only valid until the next execution
+ * @param size - a pointer used to return the size of the bitmap
+ * @return - zero on success
+ */
+int linux_lbr_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+
+  *trace_bits = state->trace_bits;
+  *size = state->map_size;
+  return 0;
+}
+
+/**
+ * This function stops the unstable bytes of the edge bitmap, which change between executions of the same input,
+ * from being reported as new paths.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the linux_lbr_create function
+ * @param unstable_bytes - a map the size of the edge bitmap, which is non-zero for each byte that should be ignored
+ * @param size - the size of the unstable_bytes parameter
+ * @return - zero on success, or non-zero if the map is larger than the bitmap
+ */
+int linux_lbr_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size)
+{
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+  size_t i;
+
+  if(size > (size_t)state->map_size)
+    return 1;
+  for(i = 0; i < size; i++) {
+    if(unstable_bytes[i])
+      state->virgin_bits[i] = 0;
+  }
+  return 0;
+}
+
+/**
+ * Checks if the target process is done fuzzing the inputs yet.
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @return - 0 if the process is not done testing the fuzzed input, non-zero if the process is done.
+ */
+int linux_lbr_is_process_done(void * instrumentation_state)
+{
+  int status;
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+
+  if(state->process_finished)
+    return 1;
+
+  status = fork_server_get_status(&state->fs, 0);
+  //it's still alive or an error occurred and we can't tell
+  if(status < 0 || status == FORKSERVER_NO_RESULTS_READY)
+    return 0;
+  state->last_status = status;
+  state->process_finished = 1;
+  return 1;
+}
+
+/**
+ * Blocks until the target process is done fuzzing the inputs, or the timeout expires.
+ * @param state - The linux_lbr_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process is not done testing the fuzzed input, 1 if the process is done, or -1 on error
+ */
+int linux_lbr_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+  int status;
+  linux_lbr_state_t * state = (linux_lbr_state_t *)instrumentation_state;
+
+  if(state->process_finished)
+    return 1;
+
+  status = fork_server_wait_for_status(&state->fs, timeout_ms);
+  if(status == FORKSERVER_NO_RESULTS_READY)
+    return 0;
+  if(status < 0)
+    return -1;
+  state->last_status = status;
+  state->process_finished = 1;
+  return 1;
+}
+
+/**
+ * This function returns help text for the Linux LBR instrumentation.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int linux_lbr_help(char ** help_str)
+{
+  *help_str = strdup(
+"lbr - Linux branch stack sampling instrumentation, for CPUs without Intel PT\n"
+"Options:\n"
+"  sample_period        The number of branches the target takes between\n"
+"                         samples of the CPU's branch stack.  Smaller values\n"
+"                         see more of the target's edges, with more overhead\n"
+"                         (default 1000)\n"
+"  mmap_pages           The number of pages in the perf sample buffer, which\n"
+"                         must be a power of two (default 64)\n"
+"  map_size             The size of the edge bitmap, which must be a power of\n"
+"                         two (default 65536)\n"
+"  init_function        The function to start the fork server at, rather than\n"
+"                         main, so the target's startup code before it only\n"
+"                         runs once.  Either a name in the dynamic symbol\n"
+"                         table, or a hex offset (0x...) from the executable's\n"
+"                         load address\n"
+"  init_marker          Whether to wait for the target to call\n"
+"                         KILLERBEEZ_INIT() to start the fork server, rather\n"
+"                         than starting it at main (default 0)\n"
+"\n"
+  );
+  if (*help_str == NULL)
+    return -1;
+  return 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "forkserver_internal.h"
+#include "instrumentation.h"
+
+#include <utils.h>
+
+void * linux_lbr_create(char * options, char * state);
+void linux_lbr_cleanup(void * instrumentation_state);
+void * linux_lbr_merge(void * instrumentation_state, void * other_instrumentation_state);
+char * linux_lbr_get_state(void * instrumentation_state);
+void linux_lbr_free_state(char * state);
+int linux_lbr_set_state(void * instrumentation_state, char * state);
+int linux_lbr_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
+int linux_lbr_is_new_path(void * instrumentation_state);
+int linux_lbr_is_process_done(void * instrumentation_state);
+int linux_lbr_wait_for_process_done(void * instrumentation_state, int timeout_ms);
+int linux_lbr_get_fuzz_result(void * instrumentation_state);
+void linux_lbr_get_counters(void * instrumentation_state, instrumentation_counters_t * counters);
+int linux_lbr_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size);
+int linux_lbr_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size);
+int linux_lbr_help(char ** help_str);
+
+//The number of branches the target takes between samples, if the sample_period option isn't set.  Each sample
+//records the CPU's whole branch stack (e.g. the last 16 or 32 branches), so a smaller period sees more of the
+//target's edges, at the cost of an interrupt for each sample.
+#define LBR_DEFAULT_SAMPLE_PERIOD 1000
+//The size of the perf sample ring buffer in pages, if the mmap_pages option isn't set.  It must be a power of two.
+#define LBR_DEFAULT_MMAP_PAGES    64
+//The default size of the edge bitmap
+#define LBR_DEFAULT_MAP_SIZE      (1 << 16)
+
+struct linux_lbr_state
+{
+  int sample_period;
+  int mmap_pages;
+  int map_size;
+  char * init_function;
+  int init_marker;
+
+  char * target_path;
+  uint64_t target_start; //The address range the executable is mapped at, which the edges are made relative to
+  uint64_t target_end;
+  int fork_server_setup;
+  forkserver_t fs;
+
+  int perf_fd;
+  struct perf_event_mmap_page * pem;
+  unsigned char * sample_buffer; //A copy of the sample that's being parsed, if it wraps around the ring buffer
+
+  uint8_t * trace_bits;   //The edges sampled in the current execution
+  uint8_t * virgin_bits;  //The edges that haven't been sampled in any previous execution
+
+  pid_t child_pid;
+  int last_status;
+  int process_finished;
+  int last_fuzz_result;
+  int fuzz_results_set;
+  int last_is_new_path;
+
+  instrumentation_counters_t counters; //The problems starting and sampling the target, for the fuzzer's stats
+};
+typedef struct linux_lbr_state linux_lbr_state_t;
@@ -1,5 +1,6 @@
 // Linux-only return code instrumentation.
 
+#include <pthread.h>
 #include <signal.h>    // kill
 #include <string.h>    // memset
 #include <sys/types.h>
@@ -12,10 +13,90 @@
 #include <utils.h>
 #include <jansson_helper.h>
 
+//The fork server shared by the states with the concurrent_children option.  The first state to run the target starts
+//it with concurrent_children channels, and the states that follow (e.g. the other fuzzer workers) each take the next
+//unused channel, so their children run in parallel while the target's initialization is only done once.
+static pthread_mutex_t shared_fork_server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static forkserver_t * shared_channels = NULL;
+static char * shared_cmd_line = NULL; // The command line the shared fork server was started with
+static int shared_channels_count = 0;
+static int shared_channels_used = 0;  // The number of channels that have been given to a state
+static int shared_channels_users = 0; // The number of states that still have a channel
+
 ////////////////////////////////////////////////////////////////
 // Private methods /////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 
+/**
+ * This function gives a state a channel of the shared concurrent mode fork server, and starts the fork server if this
+ * is the first state to run the target.  The states can only share the fork server if they run the same command line.
+ * @param state - The return_code_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process
+ * @param target_path - the path of the fuzzed program, split from cmd_line
+ * @param argv - the arguments of the fuzzed program, split from cmd_line
+ * @param needs_stdin_fd - whether the target reads its input from stdin
+ * @return - zero if the state was given a channel, or non-zero if it should start its own fork server
+ */
+static int attach_shared_fork_server(return_code_state_t * state, char * cmd_line, char * target_path, char ** argv,
+	int needs_stdin_fd)
+{
+	int result = 1;
+
+	pthread_mutex_lock(&shared_fork_server_mutex);
+	if(!shared_channels) {
+		shared_channels = calloc(state->concurrent_children, sizeof(forkserver_t));
+		shared_cmd_line = strdup(cmd_line);
+		if(!shared_channels || !shared_cmd_line) {
+			free(shared_channels);
+			free(shared_cmd_line);
+			shared_channels = NULL;
+			shared_cmd_line = NULL;
+			pthread_mutex_unlock(&shared_fork_server_mutex);
+			return 1;
+		}
+		shared_channels[0].init_function = state->init_function;
+		shared_channels[0].init_marker = state->init_marker;
+		fork_server_init_concurrent(shared_channels, state->concurrent_children, target_path, argv, 1, needs_stdin_fd);
+		shared_channels[0].init_function = NULL;
+		shared_channels_count = state->concurrent_children;
+		shared_channels_used = 0;
+	}
+
+	if(strcmp(cmd_line, shared_cmd_line))
+		WARNING_MSG("The target's command line differs from the shared fork server's (e.g. each worker has its own "
+			"input file), so this state is starting its own fork server");
+	else if(shared_channels_used >= shared_channels_count)
+		WARNING_MSG("All %d channels of the shared fork server are in use, so this state is starting its own fork "
+			"server.  Set concurrent_children to the number of workers.", shared_channels_count);
+	else {
+		state->fs = shared_channels[shared_channels_used++];
+		state->shared_channel = 1;
+		shared_channels_users++;
+		result = 0;
+	}
+	pthread_mutex_unlock(&shared_fork_server_mutex);
+	return result;
+}
+
+/**
+ * This function closes a state's channel of the shared concurrent mode fork server.  Once every channel is closed, the
+ * fork server exits, and the next state to run the target starts a new one.
+ * @param state - The return_code_state_t object containing this instrumentation's state
+ */
+static void detach_shared_fork_server(return_code_state_t * state)
+{
+	pthread_mutex_lock(&shared_fork_server_mutex);
+	fork_server_exit(&state->fs);
+	state->shared_channel = 0;
+	if(--shared_channels_users == 0 && shared_channels_used == shared_channels_count) {
+		free(shared_channels);
+		free(shared_cmd_line);
+		shared_channels = NULL;
+		shared_cmd_line = NULL;
+	}
+	pthread_mutex_unlock(&shared_fork_server_mutex);
+}
+
 /**
  * This function terminates the fuzzed process and sets the result in the
  * instrumentation state.
@@ -27,7 +108,7 @@ static void destroy_target_process(return_code_state_t * state)
 {
 	if(state->child_pid && state->child_pid != -1) {
 		if(!state->use_fork_server)
-			state->last_status = get_process_status(state->child_pid);
+			state->last_status = get_process_status_signal(state->child_pid, &state->last_signal);
 
 		kill(state->child_pid, SIGKILL);
 		state->child_pid = 0;
@@ -52,6 +133,7 @@ static int create_target_process(return_code_state_t * state, char* cmd_line, ch
 	char * target_path;
 
 	state->last_status = FUZZ_RUNNING;
+	state->last_signal = 0;
 	state->process_reaped = 0;
 
 	if(state->use_fork_server) {
@@ -59,8 +141,13 @@ static int create_target_process(return_code_state_t * state, char* cmd_line, ch
 			if(split_command_line(cmd_line, &target_path, &argv))
 				return -1;
 
-			//Start the fork server
-			fork_server_init(&state->fs, target_path, argv, 1, 0, stdin_length != 0);
+			//Start the fork server, or take a channel of the shared one
+			if(!state->concurrent_children
+				|| attach_shared_fork_server(state, cmd_line, target_path, argv, stdin_length != 0)) {
+				state->fs.init_function = state->init_function;
+				state->fs.init_marker = state->init_marker;
+				fork_server_init(&state->fs, target_path, argv, 1, 0, stdin_length != 0);
+			}
 			state->fork_server_setup = 1;
 
 			//Free the split up command line
@@ -72,14 +159,8 @@ static int create_target_process(return_code_state_t * state, char* cmd_line, ch
 
 		if(state->fs.target_stdin != -1) {
 			//Take care of the stdin input, write over the file, then truncate it accordingly
-			lseek(state->fs.target_stdin, 0, SEEK_SET);
-			if(stdin_input != NULL && stdin_length != 0) {
-				if(write(state->fs.target_stdin, stdin_input, stdin_length) != stdin_length)
-					FATAL_MSG("Short write to target's stdin file");
-			}
-			if(ftruncate(state->fs.target_stdin, stdin_length))
-				FATAL_MSG("ftruncate() failed");
-			lseek(state->fs.target_stdin, 0, SEEK_SET);
+			if(write_stdin_file(state->fs.target_stdin, stdin_input, stdin_length))
+				FATAL_MSG("Failed to write the target's stdin file");
 		}
 
 		//Start the new child and tell it to go
@@ -90,7 +171,7 @@ static int create_target_process(return_code_state_t * state, char* cmd_line, ch
 		}
 
 	} else {
-		if (start_process_and_write_to_stdin(cmd_line, stdin_input, stdin_length, &state->child_pid)) {
+		if (spawn_target_process(&state->spawn, cmd_line, stdin_input, stdin_length, &state->child_pid)) {
 			state->child_pid = 0;
 			ERROR_MSG("Failed to create process with command line: %s\n", cmd_line);
 			return -1;
@@ -119,6 +200,28 @@ static return_code_state_t * setup_options(char *options) {
 
 	if(options) {
 		PARSE_OPTION_INT(state, options, use_fork_server, "use_fork_server", return_code_cleanup);
+		PARSE_OPTION_STRING(state, options, init_function, "init_function", return_code_cleanup);
+		PARSE_OPTION_INT(state, options, init_marker, "init_marker", return_code_cleanup);
+		PARSE_OPTION_INT(state, options, concurrent_children, "concurrent_children", return_code_cleanup);
+		PARSE_OPTION_INT_TEMP(state, options, spawn.lazy_binding, "lazy_binding", return_code_cleanup,
+			lazy_binding);
+	}
+
+	if(state->concurrent_children < 0 || state->concurrent_children > MAX_CONCURRENT_CHANNELS) {
+		ERROR_MSG("The concurrent_children option must be between 0 and %d", MAX_CONCURRENT_CHANNELS);
+		return_code_cleanup(state);
+		return NULL;
+	}
+	if(state->concurrent_children && !state->use_fork_server) {
+		ERROR_MSG("The concurrent_children option requires the fork server");
+		return_code_cleanup(state);
+		return NULL;
+	}
+
+	if((state->init_function || state->init_marker) && !state->use_fork_server) {
+		ERROR_MSG("The init_function and init_marker options require the fork server");
+		return_code_cleanup(state);
+		return NULL;
 	}
 	return state;
 }
@@ -158,7 +261,11 @@ void return_code_cleanup(void * instrumentation_state)
 	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
 
 	destroy_target_process(state);
+	spawn_target_cleanup(&state->spawn);
+	if(state->shared_channel)
+		detach_shared_fork_server(state);
 
+	free(state->init_function);
 	free(state);
 }
 
@@ -249,10 +356,9 @@ int return_code_enable(void * instrumentation_state, pid_t * process, char * cmd
  */
 int return_code_is_new_path(void * instrumentation_state)
 {
-	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
-	if(!state->enable_called)
-		return -1;
-	return 0; //We don't gather instrumentation data, so we can't ever tell if we hit a new path.
+	//We don't gather instrumentation data, so we can't ever tell if we hit a new path.  This doesn't depend on
+	//enable having been called, so drivers that don't start a new process (i.e. inprocess) can use this module.
+	return 0;
 }
 
 /**
@@ -270,6 +376,23 @@ int return_code_get_fuzz_result(void * instrumentation_state)
 	return state->last_status;
 }
 
+/**
+ * This function returns the details of the last crash.  Only the signal is known, since the
+ * target is just waited on.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param info - a pointer used to return the crash's details
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int return_code_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info)
+{
+	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
+	if(return_code_get_fuzz_result(state) != FUZZ_CRASH)
+		return 1;
+	memset(info, 0, sizeof(instrumentation_crash_info_t));
+	info->signal = state->last_signal;
+	return 0;
+}
+
 /**
  * Checks if the target process is done fuzzing the inputs yet.  If it has finished, it will have
  * written last_status, the result of the fuzz job.
@@ -297,15 +420,16 @@ int return_code_is_process_done(void * instrumentation_state)
 			if(status < 0 || status == FORKSERVER_NO_RESULTS_READY)
 				return 0;
 
-			if(WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL)
+			if(WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL) {
 				state->last_status = FUZZ_CRASH;
-			else
+				state->last_signal = WTERMSIG(status);
+			} else
 				state->last_status = FUZZ_NONE;
 
 			state->process_reaped = 1;
 			return 1;
 		} else {
-			int fuzz_result = get_process_status(state->child_pid);
+			int fuzz_result = get_process_status_signal(state->child_pid, &state->last_signal);
 
 			// expects 2, 1, 0, or -1
 			if (fuzz_result == FUZZ_RUNNING) // it's aliiiiive
@@ -326,6 +450,67 @@ int return_code_is_process_done(void * instrumentation_state)
 	}
 }
 
+/**
+ * Blocks until the target process is done testing the fuzzed input, or the timeout expires.
+ *
+ * @param state - The return_code_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process has not done testing the fuzzed input, 1 if the process is done, -1 on error
+ */
+int return_code_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	int status;
+	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
+
+	if(!state->enable_called)
+		return -1;
+	if(state->process_reaped)
+		return 1;
+
+	if(state->use_fork_server) {
+		status = fork_server_wait_for_status(&state->fs, timeout_ms);
+		if(status == FORKSERVER_NO_RESULTS_READY)
+			return 0;
+		if(status < 0)
+			return -1;
+		//The status has been recorded in the fork server state, so this won't block
+		return return_code_is_process_done(state);
+	}
+
+	if(wait_for_process_exit(state->child_pid, timeout_ms) < 0)
+		return -1;
+	return return_code_is_process_done(state);
+}
+
+/**
+ * This function creates a new state with the same options as an existing one.  The new state starts its own fork
+ * server the first time it runs the target, so that a driver can run several copies of the target at once.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the return_code_create function
+ * @return - the new instrumentation state on success, or NULL on failure
+ */
+void * return_code_copy(void * instrumentation_state)
+{
+	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
+	return_code_state_t * copy;
+
+	copy = setup_options(NULL);
+	if(!copy)
+		return NULL;
+	copy->use_fork_server = state->use_fork_server;
+	copy->init_marker = state->init_marker;
+	copy->spawn.lazy_binding = state->spawn.lazy_binding;
+	if(state->init_function) {
+		copy->init_function = strdup(state->init_function);
+		if(!copy->init_function) {
+			return_code_cleanup(copy);
+			return NULL;
+		}
+	}
+	//The copies run the target with their own command lines (e.g. their own ports), which a shared concurrent mode
+	//fork server can't do, so concurrent_children isn't copied
+	return copy;
+}
+
 /**
  * This function returns help text for this instrumentation.  This help text will describe the instrumentation and any options
  * that can be passed to return_code_create.
@@ -338,6 +523,20 @@ int return_code_help(char ** help_str)
 		"return_code - Linux/Mac return_code \"instrumentation\"\n"
 		"Options:\n"
 		"  use_fork_server      Whether to inject the fork server library; 1=yes, 0=no (default=1)\n"
+		"  lazy_binding         Whether to leave LD_BIND_NOW out of the environment of the targets\n"
+		"                         started without the fork server, so they only resolve the functions\n"
+		"                         they call; 1=yes, 0=no (default=0)\n"
+		"  init_function        The function to start the fork server at, rather than main, so the\n"
+		"                         target's startup code before it only runs once.  Either a name in the\n"
+		"                         dynamic symbol table, or a hex offset (0x...) from the executable's load\n"
+		"                         address\n"
+		"  init_marker          Whether to wait for the target to call KILLERBEEZ_INIT() to start the\n"
+		"                         fork server, rather than starting it at main; 1=yes, 0=no (default=0)\n"
+		"  concurrent_children  Share one fork server between this many workers (e.g. the fuzzer's -w),\n"
+		"                         each with its own channel, so their children run in parallel and the\n"
+		"                         target is only initialized once.  The workers must run the same\n"
+		"                         command line, e.g. with the stdin driver.  (default=0, a fork server\n"
+		"                         for each worker)\n"
 		"\n"
 	);
 	if (*help_str == NULL)
@@ -1,5 +1,6 @@
 #pragma once
 #include "forkserver_internal.h"
+#include "instrumentation.h"
 
 void * return_code_create(char * options, char * state);
 void return_code_cleanup(void * instrumentation_state);
@@ -10,7 +11,10 @@ int return_code_set_state(void * instrumentation_state, char * state);
 int return_code_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
 int return_code_is_new_path(void * instrumentation_state);
 int return_code_get_fuzz_result(void * instrumentation_state);
+int return_code_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info);
 int return_code_is_process_done(void * instrumentation_state);
+int return_code_wait_for_process_done(void * instrumentation_state, int timeout_ms);
+void * return_code_copy(void * instrumentation_state);
 int return_code_help(char ** help_str);
 
 struct return_code_state
@@ -18,11 +22,17 @@ struct return_code_state
 	int fork_server_setup;
 	int use_fork_server;
 	forkserver_t fs;
+	spawn_target_t spawn; // The target, when it's started without the fork server
+	char * init_function; // The function to start the fork server at, rather than main
+	int init_marker;      // Whether the target starts the fork server with KILLERBEEZ_INIT()
+	int concurrent_children; // How many states share one concurrent mode fork server, or 0 for a fork server each
+	int shared_channel;   // Whether fs is a channel of the shared concurrent mode fork server
 
 	pid_t child_pid;
 
 	int enable_called;
 	int last_status;
+	int last_signal;    // the signal that the last crashed target was killed with
 	int process_reaped; // used to prevent further calls to get_process_status if the process has been reaped
 };
 typedef struct return_code_state return_code_state_t;
@@ -0,0 +1,715 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instrumentation.h"
+#include "instrumentation_factory.h"
+#include "tiered_instrumentation.h"
+
+#include <utils.h>
+#include <jansson.h>
+#include <jansson_helper.h>
+
+////////////////////////////////////////////////////////////////
+// Private methods /////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function gets the options of one of the tiered instrumentation's instrumentations, which can either
+ * be given as a JSON object or as a string holding a JSON object.
+ * @param options - the tiered instrumentation's JSON options
+ * @param option_name - the name of the option to get
+ * @param result - a pointer used to return 0 if the option wasn't found, 1 if it was, or -1 on failure
+ * @return - the instrumentation's JSON options, or NULL if they weren't found or on failure.  The return value
+ * should be freed by the caller.
+ */
+static char * get_sub_options(char * options, const char * option_name, int * result)
+{
+	json_t * root, * item;
+	char * ret = NULL;
+
+	*result = -1;
+	root = get_root_option_json_object(options);
+	if (!root)
+		return NULL;
+
+	item = json_object_get(root, option_name);
+	if (!item)
+		*result = 0;
+	else if (json_is_string(item))
+		ret = strdup(json_string_value(item));
+	else if (json_is_object(item))
+		ret = json_dumps(item, 0);
+	else
+		ERROR_MSG("The tiered instrumentation's %s option must be a JSON object", option_name);
+	if (ret)
+		*result = 1;
+	json_decref(root);
+	return ret;
+}
+
+/**
+ * This function creates one of the tiered instrumentation's instrumentations.
+ * @param name - the name of the instrumentation to create
+ * @param options - the instrumentation's JSON options, or NULL for the defaults
+ * @param state - the instrumentation's state to load, or NULL
+ * @param instrumentation_out - a pointer used to return the instrumentation
+ * @param state_out - a pointer used to return the instrumentation's state
+ * @return - zero on success, non-zero on failure
+ */
+static int create_sub_instrumentation(char * name, char * options, char * state, instrumentation_t ** instrumentation_out,
+	void ** state_out)
+{
+	*instrumentation_out = instrumentation_factory(name);
+	if (!*instrumentation_out) {
+		ERROR_MSG("Unknown instrumentation %s given to the tiered instrumentation", name);
+		return 1;
+	}
+	*state_out = (*instrumentation_out)->create(options, state);
+	if (!*state_out) {
+		ERROR_MSG("Failed to create the %s instrumentation for the tiered instrumentation", name);
+		free(*instrumentation_out);
+		*instrumentation_out = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function copies a buffer into a growable buffer.
+ * @param buffer - a pointer to the growable buffer, which may be reallocated
+ * @param size - a pointer to the size of the growable buffer, which is updated if it's reallocated
+ * @param data - the data to copy into the buffer
+ * @param length - the length of data
+ * @return - zero on success, non-zero on failure
+ */
+static int copy_to_buffer(char ** buffer, size_t * size, const char * data, size_t length)
+{
+	char * new_buffer;
+
+	if (length > *size || !*buffer) {
+		new_buffer = (char *)realloc(*buffer, length ? length : 1);
+		if (!new_buffer)
+			return 1;
+		*buffer = new_buffer;
+		*size = length ? length : 1;
+	}
+	if (length)
+		memcpy(*buffer, data, length);
+	return 0;
+}
+
+/**
+ * This function builds the detailed instrumentation's command line, by replacing the target at the start of the
+ * last input's command line with the detailed_path option.  A quoted target is replaced with a quoted path.
+ * @param state - the tiered_state_t object containing this instrumentation's state
+ * @return - the command line for the detailed instrumentation, or NULL on failure
+ */
+static char * get_detailed_cmd_line(tiered_state_t * state)
+{
+	char * start, * end;
+	size_t path_length, length;
+	int quoted;
+
+	if (!state->detailed_path)
+		return state->cmd_line;
+
+	start = state->cmd_line;
+	while (*start == ' ' || *start == '\t')
+		start++;
+	quoted = *start == '"';
+	if (quoted) {
+		end = strchr(start + 1, '"');
+		end = end ? end + 1 : start + strlen(start);
+	}
+	else
+		end = start + strcspn(start, " \t");
+
+	path_length = strlen(state->detailed_path);
+	length = path_length + (quoted ? 2 : 0) + strlen(end) + 1;
+	if (length > state->detailed_cmd_line_size || !state->detailed_cmd_line) {
+		free(state->detailed_cmd_line);
+		state->detailed_cmd_line = (char *)malloc(length);
+		if (!state->detailed_cmd_line) {
+			state->detailed_cmd_line_size = 0;
+			return NULL;
+		}
+		state->detailed_cmd_line_size = length;
+	}
+	snprintf(state->detailed_cmd_line, length, quoted ? "\"%s\"%s" : "%s%s", state->detailed_path, end);
+	return state->detailed_cmd_line;
+}
+
+/**
+ * This function re-runs the last input under the detailed instrumentation, if it hasn't been already.
+ * @param state - the tiered_state_t object containing this instrumentation's state
+ * @return - zero on success, or non-zero if the input couldn't be re-run
+ */
+static int retrace_last_input(tiered_state_t * state)
+{
+#ifdef _WIN32
+	HANDLE process;
+#else
+	pid_t process;
+#endif
+	char * cmd_line;
+
+	if (state->retraced)
+		return state->detailed_result < 0;
+	state->retraced = 1;
+	state->detailed_result = -1;
+	state->retraces++;
+
+	cmd_line = get_detailed_cmd_line(state);
+	if (!cmd_line || state->detailed->enable(state->detailed_state, &process, cmd_line,
+			state->input_length ? state->input : NULL, state->input_length)
+		|| state->detailed->wait_for_process_done(state->detailed_state, state->timeout) < 0)
+		return 1;
+	state->detailed_result = state->detailed->get_fuzz_result(state->detailed_state);
+
+	//The detailed instrumentation gathers its coverage when it checks for a new path
+	if (state->detailed_result < 0 || state->detailed->is_new_path(state->detailed_state) < 0) {
+		state->detailed_result = -1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function determines whether the detailed instrumentation's data describes the last input.
+ * @param state - the tiered_state_t object containing this instrumentation's state
+ * @return - non-zero if the last input was re-run under the detailed instrumentation, or zero otherwise
+ */
+static int has_detailed_data(tiered_state_t * state)
+{
+	return state->enable_called && state->retraced && state->detailed_result >= 0;
+}
+
+////////////////////////////////////////////////////////////////
+// Instrumentation methods /////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates and initializes a new instrumentation specific state object based on the given options.
+ * @param options - a JSON string that contains the instrumentation specific string of options
+ * @param state - an instrumentation specific JSON string previously returned from tiered_get_state that should be loaded
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * tiered_create(char * options, char * state)
+{
+	tiered_state_t * tiered_state;
+	char * fast_state = NULL, * detailed_state = NULL;
+	int result;
+
+	tiered_state = (tiered_state_t *)malloc(sizeof(tiered_state_t));
+	if (!tiered_state)
+		return NULL;
+	memset(tiered_state, 0, sizeof(tiered_state_t));
+	tiered_state->timeout = TIERED_DEFAULT_TIMEOUT_MS;
+	tiered_state->retrace_new_paths = 1;
+
+	if (options && strlen(options)) {
+		PARSE_OPTION_STRING(tiered_state, options, fast_name, "fast", tiered_cleanup);
+		PARSE_OPTION_STRING(tiered_state, options, detailed_name, "detailed", tiered_cleanup);
+		PARSE_OPTION_INT(tiered_state, options, timeout, "timeout", tiered_cleanup);
+		PARSE_OPTION_STRING(tiered_state, options, detailed_path, "detailed_path", tiered_cleanup);
+		PARSE_OPTION_INT(tiered_state, options, retrace_new_paths, "retrace_new_paths", tiered_cleanup);
+		PARSE_OPTION_INT(tiered_state, options, sample_interval, "sample_interval", tiered_cleanup);
+		tiered_state->fast_options = get_sub_options(options, "fast_options", &result);
+		if (result >= 0)
+			tiered_state->detailed_options = get_sub_options(options, "detailed_options", &result);
+		if (result < 0) {
+			tiered_cleanup(tiered_state);
+			return NULL;
+		}
+	}
+	if (!tiered_state->fast_name || !tiered_state->detailed_name || tiered_state->timeout <= 0) {
+		ERROR_MSG("The tiered instrumentation needs the fast and detailed options, and a positive timeout");
+		tiered_cleanup(tiered_state);
+		return NULL;
+	}
+	if (tiered_state->sample_interval < 0) {
+		ERROR_MSG("The tiered instrumentation's sample_interval option can't be negative");
+		tiered_cleanup(tiered_state);
+		return NULL;
+	}
+
+	if (state) {
+		fast_state = get_string_options(state, "fast", &result);
+		if (result > 0)
+			detailed_state = get_string_options(state, "detailed", &result);
+		if (result <= 0) {
+			free(fast_state);
+			tiered_cleanup(tiered_state);
+			return NULL;
+		}
+	}
+	result = create_sub_instrumentation(tiered_state->fast_name, tiered_state->fast_options, fast_state,
+			&tiered_state->fast, &tiered_state->fast_state)
+		|| create_sub_instrumentation(tiered_state->detailed_name, tiered_state->detailed_options, detailed_state,
+			&tiered_state->detailed, &tiered_state->detailed_state);
+	free(fast_state);
+	free(detailed_state);
+	if (result) {
+		tiered_cleanup(tiered_state);
+		return NULL;
+	}
+	if (!tiered_state->fast->wait_for_process_done || !tiered_state->detailed->wait_for_process_done) {
+		ERROR_MSG("The tiered instrumentation's instrumentations must support waiting for the target");
+		tiered_cleanup(tiered_state);
+		return NULL;
+	}
+	return tiered_state;
+}
+
+/**
+ * This function cleans up all resources with the passed in instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * This state object should not be referenced after this function returns.
+ */
+void tiered_cleanup(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (state->retraces)
+		DEBUG_MSG("The tiered instrumentation re-ran %llu inputs under the %s instrumentation, %llu of which only "
+			"crashed under it", (unsigned long long)state->retraces, state->detailed_name,
+			(unsigned long long)state->detailed_only_crashes);
+	if (state->fast_state)
+		state->fast->cleanup(state->fast_state);
+	if (state->detailed_state)
+		state->detailed->cleanup(state->detailed_state);
+	free(state->fast);
+	free(state->detailed);
+	free(state->fast_name);
+	free(state->fast_options);
+	free(state->detailed_name);
+	free(state->detailed_options);
+	free(state->detailed_path);
+	free(state->cmd_line);
+	free(state->detailed_cmd_line);
+	free(state->input);
+	free(state);
+}
+
+/**
+ * This function merges the coverage information from two instrumentation states, by merging the fast and the
+ * detailed instrumentations' states separately.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @param other_instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
+ * on success, or NULL on failure
+ */
+void * tiered_merge(void * instrumentation_state, void * other_instrumentation_state)
+{
+	tiered_state_t * first = (tiered_state_t *)instrumentation_state;
+	tiered_state_t * second = (tiered_state_t *)other_instrumentation_state;
+	tiered_state_t * merged;
+
+	if (strcmp(first->fast_name, second->fast_name) || strcmp(first->detailed_name, second->detailed_name))
+		return NULL;
+
+	merged = (tiered_state_t *)malloc(sizeof(tiered_state_t));
+	if (!merged)
+		return NULL;
+	memset(merged, 0, sizeof(tiered_state_t));
+	merged->timeout = first->timeout;
+	merged->retrace_new_paths = first->retrace_new_paths;
+	merged->sample_interval = first->sample_interval;
+	merged->fast_name = strdup(first->fast_name);
+	merged->detailed_name = strdup(first->detailed_name);
+	merged->fast_options = first->fast_options ? strdup(first->fast_options) : NULL;
+	merged->detailed_options = first->detailed_options ? strdup(first->detailed_options) : NULL;
+	merged->fast = instrumentation_factory(first->fast_name);
+	merged->detailed = instrumentation_factory(first->detailed_name);
+	merged->detailed_path = first->detailed_path ? strdup(first->detailed_path) : NULL;
+	if (!merged->fast_name || !merged->detailed_name || !merged->fast || !merged->detailed
+		|| (first->detailed_path && !merged->detailed_path)) {
+		tiered_cleanup(merged);
+		return NULL;
+	}
+
+	merged->fast_state = merged->fast->merge(first->fast_state, second->fast_state);
+	if (merged->fast_state)
+		merged->detailed_state = merged->detailed->merge(first->detailed_state, second->detailed_state);
+	if (!merged->fast_state || !merged->detailed_state) {
+		tiered_cleanup(merged);
+		return NULL;
+	}
+	return merged;
+}
+
+/**
+ * This function returns the state information holding the previous execution path info.  The returned value can later be passed to
+ * tiered_create or tiered_set_state to load the state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @return - A JSON string that holds the instrumentation specific state object information on success, or NULL on failure
+ */
+char * tiered_get_state(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+	json_t *state_obj, *temp;
+	char * fast_state, * detailed_state, * ret = NULL;
+
+	fast_state = state->fast->get_state(state->fast_state);
+	detailed_state = state->detailed->get_state(state->detailed_state);
+	state_obj = json_object();
+	if (fast_state && detailed_state && state_obj) {
+		temp = json_string(fast_state);
+		if (temp)
+			json_object_set_new(state_obj, "fast", temp);
+		temp = temp ? json_string(detailed_state) : NULL;
+		if (temp) {
+			json_object_set_new(state_obj, "detailed", temp);
+			ret = json_dumps(state_obj, 0);
+		}
+	}
+	if (fast_state)
+		state->fast->free_state(fast_state);
+	if (detailed_state)
+		state->detailed->free_state(detailed_state);
+	json_decref(state_obj);
+	return ret;
+}
+
+/**
+ * This function frees an instrumentation state previously obtained via tiered_get_state.
+ * @param state - the instrumentation state to free
+ */
+void tiered_free_state(char * state)
+{
+	free(state);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via tiered_get_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @param state - an instrumentation state previously obtained via tiered_get_state
+ * @return - 0 on success, non-zero on failure.
+ */
+int tiered_set_state(void * instrumentation_state, char * state)
+{
+	tiered_state_t * current_state = (tiered_state_t *)instrumentation_state;
+	char * fast_state, * detailed_state;
+	int result;
+
+	if (!state)
+		return 1;
+	fast_state = get_string_options(state, "fast", &result);
+	if (result <= 0)
+		return 1;
+	detailed_state = get_string_options(state, "detailed", &result);
+	if (result <= 0) {
+		free(fast_state);
+		return 1;
+	}
+	result = current_state->fast->set_state(current_state->fast_state, fast_state)
+		|| current_state->detailed->set_state(current_state->detailed_state, detailed_state);
+	free(fast_state);
+	free(detailed_state);
+	current_state->retraced = 0;
+	return result;
+}
+
+/**
+ * This function enables the fast instrumentation and runs the fuzzed process, saving a copy of the input in case it
+ * has to be re-run under the detailed instrumentation.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @process - a pointer to return a handle to the process that instrumentation was enabled on
+ * @cmd_line - the command line of the fuzzed process to enable instrumentation on
+ * @input - a buffer to the input that should be sent to the fuzzed process on stdin
+ * @input_length - the length of the input parameter
+ * returns 0 on success, -1 on failure
+ */
+#ifdef _WIN32
+int tiered_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length)
+#else
+int tiered_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length)
+#endif
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (copy_to_buffer(&state->cmd_line, &state->cmd_line_size, cmd_line, strlen(cmd_line) + 1)
+		|| copy_to_buffer(&state->input, &state->input_size, input, input ? input_length : 0))
+		return -1;
+	state->input_length = input ? input_length : 0;
+	state->retraced = 0;
+	state->enable_called = 1;
+	state->runs++;
+	return state->fast->enable(state->fast_state, process, cmd_line, input, input_length);
+}
+
+/**
+ * This function determines whether the process being instrumented has taken a new path, according to the fast
+ * instrumentation.  Inputs that took a new path are re-run under the detailed instrumentation.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the tiered_create function
+ * @return - 1 if the previously setup process (via the enable function) took a new path, 0 if it did not, or -1 on failure.
+ */
+int tiered_is_new_path(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+	int new_path;
+
+	if (!state->enable_called)
+		return -1;
+	new_path = state->fast->is_new_path(state->fast_state);
+	if (new_path > 0 && state->retrace_new_paths && retrace_last_input(state))
+		WARNING_MSG("Failed to re-run a new path under the %s instrumentation", state->detailed_name);
+	return new_path;
+}
+
+/**
+ * This function will return the result of the fuzz job, according to the fast instrumentation.  Inputs that crashed
+ * or hung are re-run under the detailed instrumentation, as is every sample_interval-th input that did neither, which
+ * is reported as a crash if it only crashes under the detailed instrumentation.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
+ */
+int tiered_get_fuzz_result(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+	int result;
+
+	if (!state->enable_called)
+		return -1;
+	result = state->fast->get_fuzz_result(state->fast_state);
+	if ((result == FUZZ_CRASH || result == FUZZ_HANG) && !state->retraced && retrace_last_input(state))
+		WARNING_MSG("Failed to re-run a %s under the %s instrumentation", result == FUZZ_CRASH ? "crash" : "hang",
+			state->detailed_name);
+	else if (result == FUZZ_NONE && !state->retraced && state->sample_interval
+			&& state->runs % state->sample_interval == 0) {
+		if (retrace_last_input(state))
+			WARNING_MSG("Failed to re-run a sampled input under the %s instrumentation", state->detailed_name);
+		else if (state->detailed_result == FUZZ_CRASH)
+			state->detailed_only_crashes++;
+	}
+	if (result == FUZZ_NONE && has_detailed_data(state) && state->detailed_result == FUZZ_CRASH)
+		return FUZZ_CRASH;
+	return result;
+}
+
+/**
+ * This function returns the detailed instrumentation's info about a module in the last input's re-run.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param index - the index of the module to get
+ * @param is_new - a pointer used to return whether the module took a new path
+ * @param module_name - a pointer used to return the module's name
+ * @param info - a pointer used to return the module's info
+ * @param size - a pointer used to return the size of info
+ * @return - zero on success, or non-zero if the last input wasn't re-run, the detailed instrumentation doesn't track
+ * modules, or the index is out of range
+ */
+int tiered_get_module_info(void * instrumentation_state, int index, int * is_new, char ** module_name, char ** info, int * size)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!has_detailed_data(state) || !state->detailed->get_module_info)
+		return 1;
+	return state->detailed->get_module_info(state->detailed_state, index, is_new, module_name, info, size);
+}
+
+/**
+ * This function returns the edges the last input took in its re-run under the detailed instrumentation.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param index - the index of the module to get the edges of
+ * @return - the edges, or NULL if the last input wasn't re-run or the detailed instrumentation doesn't record edges
+ */
+instrumentation_edges_t * tiered_get_edges(void * instrumentation_state, int index)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!has_detailed_data(state) || !state->detailed->get_edges)
+		return NULL;
+	return state->detailed->get_edges(state->detailed_state, index);
+}
+
+/**
+ * This function returns the fast instrumentation's hash of the path that the last input took, so that it can be
+ * compared with the fast instrumentation's runs of other inputs.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param hash - a pointer used to return the hash
+ * @return - zero on success, or non-zero if the last run has no path hash
+ */
+int tiered_get_path_hash(void * instrumentation_state, uint64_t * hash)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!state->fast->get_path_hash)
+		return 1;
+	return state->fast->get_path_hash(state->fast_state, hash);
+}
+
+/**
+ * This function returns the hash of the last crash.  When the crash was reproduced under the detailed instrumentation
+ * and it can hash crashes, its hash is used, otherwise the fast instrumentation's is.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param hash - a pointer used to return the hash
+ * @return - zero on success, or non-zero if the last input didn't crash or the crash can't be hashed
+ */
+int tiered_get_crash_hash(void * instrumentation_state, uint64_t * hash)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (has_detailed_data(state) && state->detailed_result == FUZZ_CRASH && state->detailed->get_crash_hash
+		&& !state->detailed->get_crash_hash(state->detailed_state, hash))
+		return 0;
+	if (!state->fast->get_crash_hash)
+		return 1;
+	return state->fast->get_crash_hash(state->fast_state, hash);
+}
+
+/**
+ * This function returns the details of the last crash, from the detailed instrumentation when the crash was
+ * reproduced under it, or otherwise from the fast instrumentation.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param info - a pointer used to return the crash's details
+ * @return - zero on success, or non-zero if the last input didn't crash
+ */
+int tiered_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (has_detailed_data(state) && state->detailed_result == FUZZ_CRASH && state->detailed->get_crash_info
+		&& !state->detailed->get_crash_info(state->detailed_state, info))
+		return 0;
+	if (!state->fast->get_crash_info)
+		return 1;
+	return state->fast->get_crash_info(state->fast_state, info);
+}
+
+/**
+ * This function returns the constants that the target compared its input against, from the fast instrumentation.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @return - the text of an AFL style dictionary file, or NULL on failure.  Freed with tiered_free_state.
+ */
+char * tiered_get_dictionary(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+	char * dictionary, * ret;
+
+	if (!state->fast->get_dictionary)
+		return NULL;
+	dictionary = state->fast->get_dictionary(state->fast_state);
+	if (!dictionary)
+		return NULL;
+	ret = strdup(dictionary); //It has to be freed with tiered_free_state, rather than the fast instrumentation's
+	state->fast->free_state(dictionary);
+	return ret;
+}
+
+/**
+ * This function fills in the counts of the problems both instrumentations have run into.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param counters - a pointer used to return the counts
+ */
+void tiered_get_counters(void * instrumentation_state, instrumentation_counters_t * counters)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+	instrumentation_counters_t detailed_counters;
+
+	memset(counters, 0, sizeof(instrumentation_counters_t));
+	if (state->fast->get_counters)
+		state->fast->get_counters(state->fast_state, counters);
+	if (state->detailed->get_counters) {
+		memset(&detailed_counters, 0, sizeof(detailed_counters));
+		state->detailed->get_counters(state->detailed_state, &detailed_counters);
+		counters->fork_failures += detailed_counters.fork_failures;
+		counters->trace_overflows += detailed_counters.trace_overflows;
+		counters->oom_kills += detailed_counters.oom_kills;
+	}
+}
+
+/**
+ * This function returns the fast instrumentation's coverage bitmap of the last run.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param trace_bits - a pointer used to return the bitmap
+ * @param size - a pointer used to return the size of the bitmap
+ * @return - zero on success, or non-zero if the fast instrumentation doesn't have a coverage bitmap
+ */
+int tiered_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!state->fast->get_trace_bits)
+		return 1;
+	return state->fast->get_trace_bits(state->fast_state, trace_bits, size);
+}
+
+/**
+ * This function stops the fast instrumentation's unstable bitmap bytes from counting as new paths, crashes, or hangs.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param unstable_bytes - the bitmap of unstable bytes, the size returned by tiered_get_trace_bits
+ * @param size - the size of unstable_bytes
+ * @return - zero on success, or non-zero on failure
+ */
+int tiered_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!state->fast->ignore_unstable_bytes)
+		return 1;
+	return state->fast->ignore_unstable_bytes(state->fast_state, unstable_bytes, size);
+}
+
+/**
+ * Checks if the fast instrumentation's target process is done fuzzing the input yet.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @return - 0 if the process has not finished testing the fuzzed input, 1 if the process is done, or -1 on error.
+ */
+int tiered_is_process_done(void * instrumentation_state)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!state->enable_called || !state->fast->is_process_done)
+		return -1;
+	return state->fast->is_process_done(state->fast_state);
+}
+
+/**
+ * Blocks until the fast instrumentation's target process has finished testing the fuzzed input, or the timeout expires.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the create() function
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process has not finished testing the fuzzed input, 1 if the process is done, or -1 on error.
+ */
+int tiered_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	tiered_state_t * state = (tiered_state_t *)instrumentation_state;
+
+	if (!state->enable_called)
+		return -1;
+	return state->fast->wait_for_process_done(state->fast_state, timeout_ms);
+}
+
+/**
+ * This function returns help text for this instrumentation.  This help text will describe the instrumentation and any options
+ * that can be passed to tiered_create.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int tiered_help(char ** help_str)
+{
+	*help_str = strdup(
+		"tiered - Fuzzes with a fast instrumentation, and re-runs the inputs that find a new\n"
+		"         path, crash, or hang under a detailed instrumentation\n"
+		"Options:\n"
+		"  fast                 The name of the instrumentation that every input is run under\n"
+		"  fast_options         The fast instrumentation's options, as a JSON object\n"
+		"  detailed             The name of the instrumentation that the inputs that find a new\n"
+		"                         path, crash, or hang are re-run under, for their edges,\n"
+		"                         module info, and crash details\n"
+		"  detailed_options     The detailed instrumentation's options, as a JSON object\n"
+		"  timeout              The number of milliseconds each re-run is given (default=2000)\n"
+		"  detailed_path        The path of a second build of the target, such as an ASAN or\n"
+		"                         MSAN build, that the detailed instrumentation runs instead\n"
+		"                         of the target in the driver's command line\n"
+		"  retrace_new_paths    Whether the inputs that find a new path are re-run, or only\n"
+		"                         the crashes and hangs (default=1)\n"
+		"  sample_interval      Re-run every Nth input that didn't crash or hang as well, and\n"
+		"                         report it as a crash if it only crashes under the detailed\n"
+		"                         instrumentation (default=0, off)\n"
+		"\n"
+	);
+	if (*help_str == NULL)
+		return -1;
+	return 0;
+}
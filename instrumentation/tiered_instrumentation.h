@@ -0,0 +1,81 @@
+#pragma once
+#include "instrumentation.h"
+
+#ifdef _WIN32
+#include <Windows.h> // HANDLE
+#else
+#include <sys/types.h> // pid_t
+#endif
+
+//The tiered instrumentation fuzzes with a fast instrumentation, and re-runs the inputs that the fast
+//instrumentation says found a new path, crashed, or hung under a second, detailed instrumentation, so that
+//the detailed instrumentation's edges, module info, and crash details are available for those inputs
+//without slowing down every run of the target.
+//
+//With the detailed_path option, the detailed instrumentation runs a second build of the target instead, such as
+//an ASAN or MSAN build, so that the fuzzing runs a fast plain build and only the findings pay for the sanitizer.
+//Bugs that only the sanitizer notices are found by re-running a sample of the other inputs under it as well.
+
+#define TIERED_DEFAULT_TIMEOUT_MS 2000 //How long the detailed instrumentation's runs are given by default
+
+void * tiered_create(char * options, char * state);
+void tiered_cleanup(void * instrumentation_state);
+void * tiered_merge(void * instrumentation_state, void * other_instrumentation_state);
+char * tiered_get_state(void * instrumentation_state);
+void tiered_free_state(char * state);
+int tiered_set_state(void * instrumentation_state, char * state);
+
+#ifdef _WIN32
+int tiered_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length);
+#else
+int tiered_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
+#endif
+
+int tiered_is_new_path(void * instrumentation_state);
+int tiered_get_fuzz_result(void * instrumentation_state);
+int tiered_get_module_info(void * instrumentation_state, int index, int * is_new, char ** module_name, char ** info, int * size);
+instrumentation_edges_t * tiered_get_edges(void * instrumentation_state, int index);
+int tiered_get_path_hash(void * instrumentation_state, uint64_t * hash);
+int tiered_get_crash_hash(void * instrumentation_state, uint64_t * hash);
+int tiered_get_crash_info(void * instrumentation_state, instrumentation_crash_info_t * info);
+char * tiered_get_dictionary(void * instrumentation_state);
+void tiered_get_counters(void * instrumentation_state, instrumentation_counters_t * counters);
+int tiered_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size);
+int tiered_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size);
+int tiered_is_process_done(void * instrumentation_state);
+int tiered_wait_for_process_done(void * instrumentation_state, int timeout_ms);
+int tiered_help(char ** help_str);
+
+struct tiered_state
+{
+	char * fast_name;              //The name of the instrumentation every input is run under
+	char * fast_options;
+	instrumentation_t * fast;
+	void * fast_state;
+
+	char * detailed_name;          //The name of the instrumentation the candidate inputs are re-run under
+	char * detailed_options;
+	instrumentation_t * detailed;
+	void * detailed_state;
+	int timeout;                   //The number of milliseconds each of the detailed instrumentation's runs is given
+	char * detailed_path;          //The target the detailed instrumentation runs instead of the fast one's, or NULL
+	int retrace_new_paths;         //Whether the inputs that find a new path are re-run, or only crashes and hangs
+	int sample_interval;           //Every how many runs an input that found nothing is re-run anyway, or 0 for never
+
+	//A copy of the last input the fast instrumentation ran, so it can be re-run
+	char * cmd_line;
+	size_t cmd_line_size;          //The size of the cmd_line buffer
+	char * detailed_cmd_line;      //The cmd_line with the target replaced by detailed_path
+	size_t detailed_cmd_line_size; //The size of the detailed_cmd_line buffer
+	char * input;
+	size_t input_length;
+	size_t input_size;             //The size of the input buffer
+
+	int enable_called;
+	int retraced;                  //Whether the last input has been re-run under the detailed instrumentation
+	int detailed_result;           //The detailed instrumentation's FUZZ_ result for the last input, or -1
+	uint64_t retraces;             //The number of inputs re-run under the detailed instrumentation
+	uint64_t runs;                 //The number of inputs run under the fast instrumentation
+	uint64_t detailed_only_crashes; //The number of sampled inputs that only crashed under the detailed instrumentation
+};
+typedef struct tiered_state tiered_state_t;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <windows.h>
+
+//The coverage arena holds the coverage maps of every target module in a
+//single shared memory region when per module coverage is enabled, instead of
+//one region per module.  The arena starts with a header listing the offset of
+//each module's map.  Each map is preceded by a dirty flag, which the winafl
+//client sets whenever the module's map is written, so the side checking the
+//maps can skip the modules that weren't hit without reading their maps.  The
+//flag is a fixed distance before the map, so the instrumented code can set it
+//with the register that already holds the map pointer.
+
+#define WINAFL_ARENA_ALIGNMENT   64
+#define WINAFL_ARENA_DIRTY_DISP  WINAFL_ARENA_ALIGNMENT //The distance from the dirty flag to the start of its map
+
+struct winafl_arena
+{
+	DWORD num_modules;
+	DWORD map_size;
+	DWORD size;       //The size of the whole arena, including this header
+	DWORD offsets[1]; //The offset of each module's map from the start of the arena, num_modules long
+};
+typedef struct winafl_arena winafl_arena_t;
+
+/**
+ * This function calculates the size of a coverage arena.
+ * @param num_modules - the number of modules in the arena
+ * @param map_size - the size of each module's map; must be a multiple of WINAFL_ARENA_ALIGNMENT
+ * @return - the size of the arena
+ */
+static __inline DWORD winafl_arena_size(DWORD num_modules, DWORD map_size)
+{
+	DWORD header_size = sizeof(winafl_arena_t) + num_modules * sizeof(DWORD);
+	header_size = (header_size + WINAFL_ARENA_ALIGNMENT - 1) & ~(WINAFL_ARENA_ALIGNMENT - 1);
+	return header_size + num_modules * (WINAFL_ARENA_DIRTY_DISP + map_size);
+}
+
+/**
+ * This function fills in the header of a zeroed coverage arena, laying out the modules' maps one after another.
+ * @param arena - the arena to initialize, which must be at least winafl_arena_size(num_modules, map_size) long
+ * @param num_modules - the number of modules in the arena
+ * @param map_size - the size of each module's map; must be a multiple of WINAFL_ARENA_ALIGNMENT
+ */
+static __inline void winafl_arena_init(winafl_arena_t * arena, DWORD num_modules, DWORD map_size)
+{
+	DWORD i, offset;
+
+	arena->num_modules = num_modules;
+	arena->map_size = map_size;
+	arena->size = winafl_arena_size(num_modules, map_size);
+	offset = arena->size - num_modules * (WINAFL_ARENA_DIRTY_DISP + map_size);
+	for (i = 0; i < num_modules; i++) {
+		arena->offsets[i] = offset + WINAFL_ARENA_DIRTY_DISP;
+		offset += WINAFL_ARENA_DIRTY_DISP + map_size;
+	}
+}
+
+/**
+ * This function returns a module's coverage map in a coverage arena.
+ * @param arena - the coverage arena
+ * @param index - the index of the module
+ * @return - the module's coverage map
+ */
+static __inline unsigned char * winafl_arena_map(winafl_arena_t * arena, DWORD index)
+{
+	return (unsigned char *)arena + arena->offsets[index];
+}
+
+/**
+ * This function returns the dirty flag of a coverage map in a coverage arena.
+ * @param map - a coverage map returned by winafl_arena_map
+ * @return - the map's dirty flag
+ */
+static __inline volatile unsigned char * winafl_arena_dirty(unsigned char * map)
+{
+	return (volatile unsigned char *)(map - WINAFL_ARENA_DIRTY_DISP);
+}
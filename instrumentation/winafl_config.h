@@ -353,4 +353,11 @@
 
 #define EDGES_SHM_SIZE (100 * 1024 * 1024) //100MB
 
+/* The number of slots in the hash set the verbose edge instrumentation uses to
+   write each edge only once per run, and the most unique edges it records in a
+   run (the set is kept at most half full, so probes stay short): */
+
+#define VERBOSE_EDGE_SET_SLOTS (1 << 21)
+#define VERBOSE_EDGE_MAX (VERBOSE_EDGE_SET_SLOTS / 2)
+
 #endif /* ! _HAVE_CONFIG_H */
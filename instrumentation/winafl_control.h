@@ -0,0 +1,65 @@
+#pragma once
+
+#include <windows.h>
+
+//The control block the dynamorio instrumentation and the winafl client use to
+//start each fuzz iteration and report its result.  It replaces the single
+//character commands that were sent over the comms pipe, which still exists so
+//the instrumentation can tell when the client has started.  The block lives in
+//a named shared memory region, and each side sets an auto-reset event after
+//writing its field.  The reader spins on the field for a short time before
+//waiting on the event, since persistence mode iterations are often shorter
+//than the time it takes to wake a waiting thread.
+
+#define WINAFL_CONTROL_NAME        "afl_control_%s"
+#define WINAFL_COMMAND_EVENT_NAME  "afl_command_%s"
+#define WINAFL_RESULT_EVENT_NAME   "afl_result_%s"
+#define WINAFL_CONTROL_SPIN_COUNT  4000
+
+struct winafl_control
+{
+	volatile LONG command; //'F' to fuzz an iteration, 'Q' to quit, or 0 once the client has read it
+	volatile LONG result;  //'K' if the iteration finished, 'C' on a crash, or 0 once the instrumentation has read it
+};
+typedef struct winafl_control winafl_control_t;
+
+/**
+ * This function writes a value to one of the control block's fields and wakes the other side.
+ * @param field - the field to write
+ * @param value - the value to write to the field
+ * @param event - the event associated with the field
+ */
+static __inline void winafl_control_post(volatile LONG * field, LONG value, HANDLE event)
+{
+	InterlockedExchange(field, value);
+	SetEvent(event);
+}
+
+/**
+ * This function waits for the other side to write to one of the control block's fields, and then clears the field.
+ * @param field - the field to wait on
+ * @param event - the event associated with the field
+ * @param timeout - the maximum number of milliseconds to wait after spinning, or INFINITE
+ * @return - the value written to the field, or 0 if the timeout expired first
+ */
+static __inline LONG winafl_control_wait(volatile LONG * field, HANDLE event, DWORD timeout)
+{
+	LONG value;
+	int i;
+
+	for (i = 0; i < WINAFL_CONTROL_SPIN_COUNT; i++) {
+		value = InterlockedExchange(field, 0);
+		if (value)
+			return value;
+		YieldProcessor();
+	}
+
+	//The event may still be set from a value we picked up while spinning, so keep waiting until the field is written
+	while (1) {
+		value = InterlockedExchange(field, 0);
+		if (value)
+			return value;
+		if (WaitForSingleObject(event, timeout) != WAIT_OBJECT_0)
+			return InterlockedExchange(field, 0);
+	}
+}
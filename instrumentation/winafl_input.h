@@ -0,0 +1,31 @@
+#pragma once
+
+#include <windows.h>
+
+//The shared memory input region lets the dynamorio instrumentation hand each
+//input to the winafl client without going through a file or the target's
+//stdin.  The instrumentation writes the input to the region before posting
+//the 'F' command, and the client points the target function's buffer and
+//length arguments at it before each iteration, so persistence mode can fuzz
+//a function that takes its input in memory.
+
+#define WINAFL_INPUT_NAME              "afl_input_%s"
+#define WINAFL_INPUT_DEFAULT_MAX_SIZE  (1024 * 1024)
+
+struct winafl_input
+{
+	DWORD length;     //The length of the current input
+	DWORD max_length; //The size of the data buffer
+	char data[1];     //The input, max_length long
+};
+typedef struct winafl_input winafl_input_t;
+
+/**
+ * This function calculates the size of a shared memory input region.
+ * @param max_length - the longest input the region should hold
+ * @return - the size of the region
+ */
+static __inline DWORD winafl_input_size(DWORD max_length)
+{
+	return (DWORD)(sizeof(winafl_input_t) + max_length);
+}
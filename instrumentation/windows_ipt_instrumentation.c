@@ -0,0 +1,814 @@
+// Windows-only Intel PT instrumentation, through the IPT driver's interface in winipt's libipt
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ipt.h>
+#include <libipt.h>
+
+#include "binary_state.h"
+#include "bitmap.h"
+#include "instrumentation.h"
+#include "ipt_decoder.h"
+#include "windows_ipt_instrumentation.h"
+
+#include <utils.h>
+#include <jansson_helper.h>
+
+//libipt is a static library, so link it into whatever links the instrumentation (see WINIPT_LIBRARY in the top
+//level CMakeLists.txt)
+#pragma comment(lib, "libipt.lib")
+
+//The offset of ImageBaseAddress in the target's PEB
+#ifdef _M_X64
+#define PEB_IMAGE_BASE_OFFSET 0x10
+#else
+#define PEB_IMAGE_BASE_OFFSET 0x08
+#endif
+
+////////////////////////////////////////////////////////////////
+// IPT Trace Collection ////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function checks whether a thread's IPT ring buffer has wrapped, which means the start of its trace was lost.
+ * The driver's trace buffers start out zeroed, so the part past the ring buffer's offset is only non-zero if it has
+ * been written to before.
+ * @param unwritten - the part of the ring buffer after the ring buffer's offset
+ * @param length - the length of the unwritten parameter
+ * @return - non-zero if the ring buffer has wrapped, zero otherwise
+ */
+static int has_wrapped(const unsigned char * unwritten, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		if (unwritten[i])
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function records the address range of the target executable, so that TIP addresses in it can be normalized
+ * to remove ASLR.  It must be called while the target's main thread is still suspended at its start, when the
+ * thread's registers point at the target's PEB.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @param thread - the target's suspended main thread
+ */
+static void record_target_address_range(windows_ipt_state_t * state, HANDLE thread)
+{
+	IMAGE_DOS_HEADER dos_header;
+	IMAGE_NT_HEADERS nt_headers;
+	CONTEXT context;
+	uintptr_t peb, image_base = 0;
+
+	state->decoder.target_start = state->decoder.target_end = 0;
+
+	memset(&context, 0, sizeof(context));
+	context.ContextFlags = CONTEXT_INTEGER;
+	if (GetThreadContext(thread, &context)) {
+#ifdef _M_X64
+		peb = (uintptr_t)context.Rdx;
+#else
+		peb = (uintptr_t)context.Ebx;
+#endif
+		if (ReadProcessMemory(state->child_handle, (LPCVOID)(peb + PEB_IMAGE_BASE_OFFSET), &image_base,
+				sizeof(image_base), NULL)
+			&& ReadProcessMemory(state->child_handle, (LPCVOID)image_base, &dos_header, sizeof(dos_header), NULL)
+			&& dos_header.e_magic == IMAGE_DOS_SIGNATURE
+			&& ReadProcessMemory(state->child_handle, (LPCVOID)(image_base + dos_header.e_lfanew), &nt_headers,
+				sizeof(nt_headers), NULL)
+			&& nt_headers.Signature == IMAGE_NT_SIGNATURE) {
+			state->decoder.target_start = image_base;
+			state->decoder.target_end = image_base + nt_headers.OptionalHeader.SizeOfImage;
+			return;
+		}
+	}
+
+	if (!state->address_warning_shown) {
+		WARNING_MSG("Could not determine the address of the target executable in memory.  The generated hashes will be "
+			"specific to this run if ASLR is enabled.");
+		state->address_warning_shown = 1;
+	}
+}
+
+/**
+ * This function copies the target's IPT trace out of the IPT driver, and decodes each of the target's threads' traces.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero if the trace couldn't be read or was truncated
+ */
+static int decode_trace(windows_ipt_state_t * state)
+{
+	IPT_TRACE_DATA * trace_data;
+	IPT_TRACE_HEADER * header;
+	unsigned char * thread_trace, * end;
+	DWORD size;
+	int truncated = 0;
+
+	if (!GetProcessIptTraceSize(state->child_handle, &size) || size < FIELD_OFFSET(IPT_TRACE_DATA, TraceData)) {
+		WARNING_MSG("Couldn't get the size of the target's IPT trace (error %lu)", GetLastError());
+		return 1;
+	}
+	if (size > state->trace_size) {
+		free(state->trace);
+		//The parser can read a few bytes past the end of the trace
+		state->trace = malloc(size + IPT_SCRATCH_DATA_SIZE);
+		state->trace_size = state->trace ? size : 0;
+		if (!state->trace) {
+			ERROR_MSG("Failed to allocate memory for the target's IPT trace (%lu bytes)", size);
+			return 1;
+		}
+	}
+	if (!GetProcessIptTrace(state->child_handle, state->trace, size)) {
+		WARNING_MSG("Couldn't read the target's IPT trace (error %lu)", GetLastError());
+		return 1;
+	}
+	StopProcessIptTracing(state->child_handle);
+	memset(state->trace + size, 0, IPT_SCRATCH_DATA_SIZE);
+
+	trace_data = (IPT_TRACE_DATA *)state->trace;
+	if (!trace_data->ValidTrace) {
+		WARNING_MSG("The IPT driver returned an invalid trace for the target");
+		return 1;
+	}
+	if (ipt_decoder_reset(&state->decoder))
+		return 1;
+
+	//Each of the target's threads has its own trace header, followed by the contents of its ring buffer
+	end = (unsigned char *)state->trace + size;
+	header = (IPT_TRACE_HEADER *)trace_data->TraceData;
+	while ((unsigned char *)header + FIELD_OFFSET(IPT_TRACE_HEADER, Trace) <= end) {
+		thread_trace = (unsigned char *)header->Trace;
+		if (header->TraceSize > (DWORD)(end - thread_trace) || header->RingBufferOffset > header->TraceSize)
+			break;
+		if (has_wrapped(thread_trace + header->RingBufferOffset, header->TraceSize - header->RingBufferOffset))
+			truncated = 1;
+
+		//The threads' traces are separate packet streams, so resynchronize on each one's first PSB
+		state->decoder.unknown_packet_hit = 1;
+		state->decoder.last_ip = 0;
+		state->decoder.bytes_decoded += ipt_decode_packets(&state->decoder, thread_trace,
+			thread_trace + header->RingBufferOffset, 1);
+		header = (IPT_TRACE_HEADER *)(thread_trace + header->TraceSize);
+	}
+	state->counters.trace_overflows += state->decoder.overflows;
+
+	if (truncated) {
+		state->counters.trace_overflows++;
+		WARNING_MSG("The IPT trace data has overflown. Use the ipt_buffer_size option to increase the size.");
+		return 1;
+	}
+	IPT_DEBUG_MSG("Decoded %llu bytes of IPT trace data", state->decoder.bytes_decoded);
+	return 0;
+}
+
+/**
+ * This function decodes the target's IPT trace to determine if the execution trace was new or not.  If it was, the
+ * execution trace's hash is added to the hash set to ensure we do not mark it as new again.  When the edge_bitmap
+ * option is used, the trace is instead new if it hit any edges (or edge hit counts) not previously seen.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @return - -1 on error, 0 if the trace doesn't describe a unique run, or 1 if it does
+ */
+static int analyze_ipt(windows_ipt_state_t * state)
+{
+	struct ipt_hashtable_key key;
+
+	if (decode_trace(state))
+		return -1;
+	if (!state->decoder.bytes_decoded) {
+		WARNING_MSG("No IPT trace data was recorded, something is likely wrong.");
+		return -1;
+	}
+
+	ipt_decoder_finish(&state->decoder, &key);
+	if (state->edge_bitmap)
+		return bitmap_has_new_bits(state->virgin_bits, state->decoder.trace_bits, state->map_size) != 0;
+
+	//Add our hashes to the hash set, which tells us whether they were already in it
+	return ipt_hash_set_add(&state->hash_set, &key);
+}
+
+////////////////////////////////////////////////////////////////
+// Private methods /////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates the bitmaps used by the edge_bitmap option
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @return - 0 on success, non-zero on failure
+ */
+static int setup_edge_bitmaps(windows_ipt_state_t * state)
+{
+	state->decoder.trace_bits = calloc(1, state->map_size);
+	state->decoder.map_size = state->map_size;
+	state->virgin_bits = malloc(state->map_size);
+	if (!state->decoder.trace_bits || !state->virgin_bits) {
+		ERROR_MSG("Failed to allocate the IPT edge bitmaps");
+		return 1;
+	}
+	memset(state->virgin_bits, 0xff, state->map_size);
+	return 0;
+}
+
+/**
+ * This function terminates the fuzzed process, after its trace has been decoded.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ */
+static void destroy_target_process(windows_ipt_state_t * state)
+{
+	if (!state->child_handle)
+		return;
+	TerminateProcess(state->child_handle, 0);
+	CloseHandle(state->child_handle);
+	state->child_handle = NULL;
+}
+
+/**
+ * This function starts the fuzzed process with IPT tracing enabled
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @param cmd_line - the command line of the fuzzed process to start
+ * @param stdin_input - the input to pass to the fuzzed process's stdin
+ * @param stdin_length - the length of the stdin_input parameter
+ * @return - zero on success, non-zero on failure.
+ */
+static int create_target_process(windows_ipt_state_t * state, char * cmd_line, char * stdin_input, size_t stdin_length)
+{
+	IPT_OPTIONS options;
+	HANDLE thread;
+	DWORD pages_pow2;
+
+	if (start_process_and_write_to_stdin_suspended(cmd_line, stdin_input, stdin_length, &state->child_handle, &thread)) {
+		state->counters.fork_failures++;
+		return 1;
+	}
+	record_target_address_range(state, thread);
+
+	//The buffer size is given to the driver as a power of two number of 4KB pages
+	for (pages_pow2 = 0; (WINDOWS_IPT_MIN_BUFFER_SIZE << pages_pow2) < state->ipt_buffer_size; pages_pow2++)
+		;
+	memset(&options, 0, sizeof(options));
+	options.OptionVersion = 1;
+	options.TimingSettings = IptNoTimingPackets;
+	options.TopaPagesPow2 = pages_pow2;
+	options.MatchSettings = IptMatchByAnyApp;
+	options.ModeSettings = IptCtlUserModeOnly;
+	if (!StartProcessIptTracing(state->child_handle, options)) {
+		ERROR_MSG("Couldn't start tracing the target with IPT (error %lu).  Is the IPT driver available?", GetLastError());
+		TerminateProcess(state->child_handle, 0);
+		CloseHandle(thread);
+		CloseHandle(state->child_handle);
+		state->child_handle = NULL;
+		return 1;
+	}
+
+	if (ResumeThread(thread) == (DWORD)-1) {
+		CloseHandle(thread);
+		destroy_target_process(state);
+		return 1;
+	}
+	CloseHandle(thread);
+	return 0;
+}
+
+/**
+ * This function ends the fuzzed process if it's still running, which makes it a hang, and otherwise determines whether
+ * it crashed from its exit code.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
+ */
+static int finish_fuzz_round(windows_ipt_state_t * state)
+{
+	DWORD exit_code;
+
+	if (!state->fuzz_results_set) {
+		//The trace is read from the IPT driver after the process has ended, so a hang is decoded up to where it was killed
+		if (!windows_ipt_is_process_done(state)) {
+			TerminateProcess(state->child_handle, 0);
+			WaitForSingleObject(state->child_handle, INFINITE);
+			state->last_fuzz_result = FUZZ_HANG;
+		}
+		//Processes killed by an unhandled exception exit with the exception code, an NTSTATUS error value
+		else if (GetExitCodeProcess(state->child_handle, &exit_code) && (exit_code & 0xC0000000) == 0xC0000000)
+			state->last_fuzz_result = FUZZ_CRASH;
+		else
+			state->last_fuzz_result = FUZZ_NONE;
+		state->process_finished = 1;
+		state->fuzz_results_set = 1;
+	}
+	return state->last_fuzz_result;
+}
+
+////////////////////////////////////////////////////////////////
+// Instrumentation methods /////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates and initializes a new instrumentation specific state object based on the given options.
+ * @param options - a JSON string that contains the instrumentation specific string of options
+ * @param state - an instrumentation specific JSON string previously returned from windows_ipt_get_state that should be loaded
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * windows_ipt_create(char * options, char * state)
+{
+	windows_ipt_state_t * ipt_state;
+	DWORD buffer_version;
+
+	ipt_state = malloc(sizeof(windows_ipt_state_t));
+	if (!ipt_state)
+		return NULL;
+	memset(ipt_state, 0, sizeof(windows_ipt_state_t));
+
+	ipt_state->ipt_buffer_size = WINDOWS_IPT_DEFAULT_BUFFER_SIZE;
+	ipt_state->map_size = IPT_DEFAULT_MAP_SIZE;
+	if (options) {
+		PARSE_OPTION_INT(ipt_state, options, ipt_buffer_size, "ipt_buffer_size", windows_ipt_cleanup);
+		PARSE_OPTION_INT(ipt_state, options, edge_bitmap, "edge_bitmap", windows_ipt_cleanup);
+		PARSE_OPTION_INT(ipt_state, options, map_size, "map_size", windows_ipt_cleanup);
+	}
+
+	if (ipt_state->ipt_buffer_size < WINDOWS_IPT_MIN_BUFFER_SIZE || ipt_state->ipt_buffer_size > WINDOWS_IPT_MAX_BUFFER_SIZE
+		|| (ipt_state->ipt_buffer_size & (ipt_state->ipt_buffer_size - 1))) {
+		ERROR_MSG("The ipt_buffer_size option must be a power of two between %d and %d", WINDOWS_IPT_MIN_BUFFER_SIZE,
+			WINDOWS_IPT_MAX_BUFFER_SIZE);
+		windows_ipt_cleanup(ipt_state);
+		return NULL;
+	}
+	if (ipt_state->edge_bitmap) {
+		if (ipt_state->map_size < 64 || (ipt_state->map_size & (ipt_state->map_size - 1))) {
+			ERROR_MSG("The map_size option must be a power of two, and at least 64");
+			windows_ipt_cleanup(ipt_state);
+			return NULL;
+		}
+		if (setup_edge_bitmaps(ipt_state)) {
+			windows_ipt_cleanup(ipt_state);
+			return NULL;
+		}
+	}
+
+	if (!GetIptBufferVersion(&buffer_version)) {
+		ERROR_MSG("The IPT driver isn't available (error %lu).  Windows 10 1809 or later with an Intel PT capable CPU "
+			"is required.", GetLastError());
+		windows_ipt_cleanup(ipt_state);
+		return NULL;
+	}
+
+	if (ipt_decoder_init(&ipt_state->decoder)) {
+		windows_ipt_cleanup(ipt_state);
+		return NULL;
+	}
+
+	if (state && windows_ipt_set_state(ipt_state, state)) {
+		windows_ipt_cleanup(ipt_state);
+		return NULL;
+	}
+	return ipt_state;
+}
+
+/**
+ * This function cleans up all resources with the passed in instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * This state object should not be referenced after this function returns.
+ */
+void windows_ipt_cleanup(void * instrumentation_state)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	destroy_target_process(state);
+	ipt_decoder_cleanup(&state->decoder);
+	ipt_hash_set_clear(&state->hash_set);
+	free(state->decoder.trace_bits);
+	free(state->virgin_bits);
+	free(state->trace);
+	free(state);
+}
+
+/**
+ * This function merges the coverage information from two instrumentation states.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @param other_instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
+ * on success, or NULL on failure
+ */
+void * windows_ipt_merge(void * instrumentation_state, void * other_instrumentation_state)
+{
+	windows_ipt_state_t * merged, * states[2];
+	windows_ipt_state_t * first = (windows_ipt_state_t *)instrumentation_state;
+	windows_ipt_state_t * second = (windows_ipt_state_t *)other_instrumentation_state;
+	struct ipt_hashtable_key * keys;
+	size_t num_keys;
+	int i, error;
+
+	if (first->edge_bitmap != second->edge_bitmap || (first->edge_bitmap && first->map_size != second->map_size)) {
+		ERROR_MSG("Cannot merge IPT states that use different edge_bitmap or map_size options");
+		return NULL;
+	}
+
+	merged = windows_ipt_create(NULL, NULL);
+	if (!merged)
+		return NULL;
+
+	if (first->edge_bitmap) {
+		merged->edge_bitmap = 1;
+		merged->map_size = first->map_size;
+		if (setup_edge_bitmaps(merged)) {
+			windows_ipt_cleanup(merged);
+			return NULL;
+		}
+		memcpy(merged->virgin_bits, first->virgin_bits, merged->map_size);
+		bitmap_and(merged->virgin_bits, second->virgin_bits, merged->map_size);
+	}
+
+	//Add both states' hashes
+	states[0] = first;
+	states[1] = second;
+	for (i = 0; i < 2; i++) {
+		keys = ipt_hash_set_get_keys(&states[i]->hash_set, &num_keys);
+		error = !keys || ipt_hash_set_add_keys(&merged->hash_set, keys, num_keys);
+		free(keys);
+		if (error) {
+			windows_ipt_cleanup(merged);
+			return NULL;
+		}
+	}
+	return merged;
+}
+
+/**
+ * This function returns the state information holding the previous execution path info.  The returned value can later be passed to
+ * windows_ipt_create or windows_ipt_set_state to load the state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @return - A JSON string that holds the instrumentation specific state object information on success, or NULL on failure
+ */
+char * windows_ipt_get_state(void * instrumentation_state)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+	json_t *state_obj, *hash_obj, *hash_list, *temp;
+	struct ipt_hashtable_key * keys;
+	size_t num_keys, i;
+	char * ret;
+
+	state_obj = json_object();
+	if (!state_obj)
+		return NULL;
+
+	ADD_INT(temp, state->last_fuzz_result, state_obj, "last_fuzz_result");
+	ADD_INT(temp, state->fuzz_results_set, state_obj, "fuzz_results_set");
+	ADD_INT(temp, state->last_is_new_path, state_obj, "last_is_new_path");
+	if (state->edge_bitmap) {
+		ADD_INT(temp, state->map_size, state_obj, "map_size");
+		ADD_MEM_NOCOPY(temp, (const char *)state->virgin_bits, state->map_size, state_obj, "virgin_bits");
+	}
+
+	hash_list = json_array();
+	if (!hash_list)
+		return NULL;
+	keys = ipt_hash_set_get_keys(&state->hash_set, &num_keys);
+	if (!keys)
+		return NULL;
+	for (i = 0; i < num_keys; i++) {
+		hash_obj = json_mem_nocopy((const char *)&keys[i], sizeof(struct ipt_hashtable_key));
+		if (!hash_obj) {
+			free(keys);
+			return NULL;
+		}
+		json_array_append_new(hash_list, hash_obj);
+	}
+	json_object_set_new(state_obj, "hash_list", hash_list);
+
+	//The hash list points into keys, so they're freed once the state is dumped
+	ret = dump_json_to_string(state_obj, 0, NULL);
+	json_decref(state_obj);
+	free(keys);
+	return ret;
+}
+
+/**
+ * This function frees an instrumentation state previously obtained via windows_ipt_get_state.
+ * @param state - the instrumentation state to free
+ */
+void windows_ipt_free_state(char * state)
+{
+	free(state);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via windows_ipt_get_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @param state - an instrumentation state previously obtained via windows_ipt_get_state
+ * @return - 0 on success, non-zero on failure.
+ */
+int windows_ipt_set_state(void * instrumentation_state, char * state)
+{
+	windows_ipt_state_t * current_state = (windows_ipt_state_t *)instrumentation_state;
+	json_t * hash_obj;
+	int result, temp_int, map_size;
+	char * virgin_bits;
+
+	if (!state)
+		return 1;
+
+	//If a child process is running when the state is being set
+	destroy_target_process(current_state); //kill it so we don't orphan it
+	ipt_hash_set_clear(&current_state->hash_set);
+
+	GET_INT(temp_int, state, current_state->last_fuzz_result, "last_fuzz_result", result);
+	GET_INT(temp_int, state, current_state->fuzz_results_set, "fuzz_results_set", result);
+	GET_INT(temp_int, state, current_state->last_is_new_path, "last_is_new_path", result);
+	current_state->process_finished = 1;
+	current_state->trace_analyzed = 1;
+
+	if (current_state->edge_bitmap) {
+		GET_INT(temp_int, state, map_size, "map_size", result);
+		if (map_size != current_state->map_size) {
+			ERROR_MSG("The IPT state's map_size (%d) does not match the map_size option (%d)", map_size, current_state->map_size);
+			return 1;
+		}
+		GET_MEM(virgin_bits, state, virgin_bits, "virgin_bits", result);
+		memcpy(current_state->virgin_bits, virgin_bits, current_state->map_size);
+		free(virgin_bits);
+	}
+
+	FOREACH_OBJECT_JSON_ARRAY_ITEM_BEGIN(state, hash_list, "hash_list", hash_obj, result)
+
+		if (json_mem_length(hash_obj) != sizeof(struct ipt_hashtable_key))
+			return 1;
+		if (ipt_hash_set_add(&current_state->hash_set, (const struct ipt_hashtable_key *)json_mem_value(hash_obj)) < 0)
+			return 1;
+
+	FOREACH_OBJECT_JSON_ARRAY_ITEM_END(hash_list)
+
+	return 0;
+}
+
+/**
+ * This function returns the state information in the compact binary state format.  The hashes are
+ * sorted, so states can be merged without loading them.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success, or NULL on failure.  It should be freed with windows_ipt_free_state.
+ */
+char * windows_ipt_get_binary_state(void * instrumentation_state, size_t * length)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+	struct ipt_hashtable_key * keys;
+	binary_state_writer_t * writer;
+	size_t num_keys;
+	int error;
+
+	keys = ipt_hash_set_get_keys(&state->hash_set, &num_keys);
+	if (!keys)
+		return NULL;
+
+	writer = binary_state_writer_create("windows_ipt", 1);
+	if (!writer) {
+		free(keys);
+		return NULL;
+	}
+	error = binary_state_add_int(writer, "last_fuzz_result", state->last_fuzz_result)
+		|| binary_state_add_int(writer, "fuzz_results_set", state->fuzz_results_set)
+		|| binary_state_add_int(writer, "last_is_new_path", state->last_is_new_path)
+		|| binary_state_add_section(writer, "hash_list", BINARY_STATE_MERGE_UNION, sizeof(struct ipt_hashtable_key),
+			keys, num_keys * sizeof(struct ipt_hashtable_key));
+	if (!error && state->edge_bitmap)
+		error = binary_state_add_int(writer, "map_size", state->map_size)
+			|| binary_state_add_section(writer, "virgin_bits", BINARY_STATE_MERGE_AND, 0, state->virgin_bits, state->map_size);
+	free(keys);
+	if (error) {
+		binary_state_writer_free(writer);
+		return NULL;
+	}
+	return binary_state_writer_finish(writer, length);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in state previously obtained via windows_ipt_get_binary_state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @param state - a binary state previously obtained via windows_ipt_get_binary_state
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure.
+ */
+int windows_ipt_set_binary_state(void * instrumentation_state, char * state, size_t length)
+{
+	windows_ipt_state_t * current_state = (windows_ipt_state_t *)instrumentation_state;
+	const struct ipt_hashtable_key * keys;
+	struct ipt_hashtable_key * keys_copy = NULL;
+	binary_state_t * binary_state;
+	int64_t last_fuzz_result, fuzz_results_set, last_is_new_path, map_size;
+	size_t keys_length;
+	int error;
+
+	binary_state = binary_state_open(state, length);
+	if (!binary_state)
+		return 1;
+
+	if (strcmp(binary_state_instrumentation(binary_state), "windows_ipt")
+		|| binary_state_get_int(binary_state, "last_fuzz_result", &last_fuzz_result)
+		|| binary_state_get_int(binary_state, "fuzz_results_set", &fuzz_results_set)
+		|| binary_state_get_int(binary_state, "last_is_new_path", &last_is_new_path)
+		|| binary_state_section_length(binary_state, "hash_list", &keys_length)) {
+		binary_state_close(binary_state);
+		return 1;
+	}
+
+	//Use the hashes in place, unless the section was compressed
+	keys = binary_state_get_raw_section(binary_state, "hash_list", &keys_length);
+	if (!keys) {
+		keys_copy = malloc(keys_length + 1);
+		if (!keys_copy || binary_state_get_section(binary_state, "hash_list", keys_copy, keys_length)) {
+			free(keys_copy);
+			binary_state_close(binary_state);
+			return 1;
+		}
+		keys = keys_copy;
+	}
+
+	if (current_state->edge_bitmap) {
+		if (binary_state_get_int(binary_state, "map_size", &map_size) || map_size != current_state->map_size
+			|| binary_state_get_section(binary_state, "virgin_bits", current_state->virgin_bits, current_state->map_size)) {
+			ERROR_MSG("The IPT state's edge bitmap does not match the map_size option (%d)", current_state->map_size);
+			free(keys_copy);
+			binary_state_close(binary_state);
+			return 1;
+		}
+	}
+
+	//If a child process is running when the state is being set
+	destroy_target_process(current_state); //kill it so we don't orphan it
+	ipt_hash_set_clear(&current_state->hash_set);
+
+	current_state->last_fuzz_result = (int)last_fuzz_result;
+	current_state->fuzz_results_set = (int)fuzz_results_set;
+	current_state->last_is_new_path = (int)last_is_new_path;
+	current_state->process_finished = 1;
+	current_state->trace_analyzed = 1;
+
+	error = ipt_hash_set_add_keys(&current_state->hash_set, keys, keys_length / sizeof(struct ipt_hashtable_key));
+	free(keys_copy);
+	binary_state_close(binary_state);
+	return error;
+}
+
+/**
+ * This function enables the instrumentation and runs the fuzzed process.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @process - a pointer to return a handle to the process that the instrumentation was enabled on
+ * @cmd_line - the command line of the fuzzed process to enable instrumentation on
+ * @input - a buffer to the input that should be sent to the fuzzed process on stdin
+ * @input_length - the length of the input parameter
+ * returns 0 on success, -1 on failure
+ */
+int windows_ipt_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	destroy_target_process(state);
+	state->process_finished = 0;
+	state->fuzz_results_set = 0;
+	state->trace_analyzed = 0;
+	if (create_target_process(state, cmd_line, input, input_length))
+		return -1;
+	*process = state->child_handle;
+	return 0;
+}
+
+/**
+ * This function determines whether the process being instrumented has taken a new path.  Calling this function will stop the
+ * process if it is not yet finished.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the windows_ipt_create function
+ * @return - 1 if the previously setup process (via the enable function) took a new path, 0 if it did not, or -1 on failure.
+ */
+int windows_ipt_is_new_path(void * instrumentation_state)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	if (!state->child_handle && !state->trace_analyzed)
+		return -1;
+	finish_fuzz_round(state);
+	if (!state->trace_analyzed) {
+		state->last_is_new_path = analyze_ipt(state);
+		state->trace_analyzed = 1;
+	}
+	return state->last_is_new_path;
+}
+
+/**
+ * This function will return the result of the fuzz job. It should be called
+ * after the process has finished processing the tested input.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the windows_ipt_create function
+ * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
+ */
+int windows_ipt_get_fuzz_result(void * instrumentation_state)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	if (!state->child_handle && !state->fuzz_results_set)
+		return -1;
+	return finish_fuzz_round(state);
+}
+
+/**
+ * This function returns the counts of the problems the instrumentation has run into while starting and tracing
+ * the target.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the windows_ipt_create function
+ * @param counters - a pointer used to return the counts
+ */
+void windows_ipt_get_counters(void * instrumentation_state, instrumentation_counters_t * counters)
+{
+	*counters = ((windows_ipt_state_t *)instrumentation_state)->counters;
+}
+
+/**
+ * This function returns the edge bitmap of the last execution, when the edge_bitmap option is used.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the windows_ipt_create function
+ * @param trace_bits - a pointer used to return the bitmap, which is only valid until the next execution
+ * @param size - a pointer used to return the size of the bitmap
+ * @return - zero on success, or non-zero if the edge_bitmap option isn't used
+ */
+int windows_ipt_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	if (!state->edge_bitmap)
+		return 1;
+	*trace_bits = state->decoder.trace_bits;
+	*size = state->map_size;
+	return 0;
+}
+
+/**
+ * This function stops the unstable bytes of the edge bitmap, which change between executions of the same input,
+ * from being reported as new paths.
+ * @param instrumentation_state - an instrumentation specific structure previously created by the windows_ipt_create function
+ * @param unstable_bytes - a map the size of the edge bitmap, which is non-zero for each byte that should be ignored
+ * @param size - the size of the unstable_bytes parameter
+ * @return - zero on success, or non-zero if the edge_bitmap option isn't used or the map is larger than the bitmap
+ */
+int windows_ipt_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+	size_t i;
+
+	if (!state->edge_bitmap || size > (size_t)state->map_size)
+		return 1;
+	for (i = 0; i < size; i++) {
+		if (unstable_bytes[i])
+			state->virgin_bits[i] = 0;
+	}
+	return 0;
+}
+
+/**
+ * Checks if the target process is done fuzzing the inputs yet.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @return - 0 if the process is not done testing the fuzzed input, non-zero if the process is done.
+ */
+int windows_ipt_is_process_done(void * instrumentation_state)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	if (!state->process_finished && state->child_handle)
+		state->process_finished = get_process_status(state->child_handle) != 1;
+	return state->process_finished;
+}
+
+/**
+ * Blocks until the target process is done fuzzing the inputs, or the timeout expires.
+ * @param state - The windows_ipt_state_t object containing this instrumentation's state
+ * @param timeout_ms - The maximum number of milliseconds to wait
+ * @return - 0 if the process is not done testing the fuzzed input, 1 if the process is done, or -1 on error
+ */
+int windows_ipt_wait_for_process_done(void * instrumentation_state, int timeout_ms)
+{
+	windows_ipt_state_t * state = (windows_ipt_state_t *)instrumentation_state;
+
+	if (!state->process_finished && state->child_handle && wait_for_process_exit(state->child_handle, timeout_ms) < 0)
+		return -1;
+	return windows_ipt_is_process_done(state);
+}
+
+/**
+ * This function returns help text for the Windows IPT instrumentation.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int windows_ipt_help(char ** help_str)
+{
+	*help_str = strdup(
+		"ipt - Windows Intel Processor Trace instrumentation, through the IPT driver\n"
+		"Options:\n"
+		"\tipt_buffer_size          The size of each of the target's threads' trace\n"
+		"\t                           buffers, a power of two from 4KB to 128MB\n"
+		"\t                           (default 1MB)\n"
+		"\tedge_bitmap              Set to 1 to record the TIP and TNT packets as\n"
+		"\t                           AFL style edges in a bitmap, rather than\n"
+		"\t                           hashing the whole trace, so a trace is only\n"
+		"\t                           new if it hits new edges (default 0)\n"
+		"\tmap_size                 The size of the edge bitmap, a power of two\n"
+		"\t                           (default 65536)\n"
+		"\n"
+	);
+	if (*help_str == NULL)
+		return -1;
+	return 0;
+}
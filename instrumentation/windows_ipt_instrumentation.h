@@ -0,0 +1,57 @@
+#pragma once
+
+#include "instrumentation.h"
+#include "ipt_decoder.h"
+
+#include <utils.h>
+
+#include <Windows.h> // HANDLE
+
+void * windows_ipt_create(char * options, char * state);
+void windows_ipt_cleanup(void * instrumentation_state);
+void * windows_ipt_merge(void * instrumentation_state, void * other_instrumentation_state);
+char * windows_ipt_get_state(void * instrumentation_state);
+void windows_ipt_free_state(char * state);
+int windows_ipt_set_state(void * instrumentation_state, char * state);
+char * windows_ipt_get_binary_state(void * instrumentation_state, size_t * length);
+int windows_ipt_set_binary_state(void * instrumentation_state, char * state, size_t length);
+int windows_ipt_enable(void * instrumentation_state, HANDLE * process, char * cmd_line, char * input, size_t input_length);
+int windows_ipt_is_new_path(void * instrumentation_state);
+int windows_ipt_is_process_done(void * instrumentation_state);
+int windows_ipt_wait_for_process_done(void * instrumentation_state, int timeout_ms);
+int windows_ipt_get_fuzz_result(void * instrumentation_state);
+void windows_ipt_get_counters(void * instrumentation_state, instrumentation_counters_t * counters);
+int windows_ipt_get_trace_bits(void * instrumentation_state, const uint8_t ** trace_bits, size_t * size);
+int windows_ipt_ignore_unstable_bytes(void * instrumentation_state, const uint8_t * unstable_bytes, size_t size);
+int windows_ipt_help(char ** help_str);
+
+//The default size of each of the target's threads' IPT trace buffers, and the sizes the IPT driver supports.  The
+//size must be a power of two.
+#define WINDOWS_IPT_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define WINDOWS_IPT_MIN_BUFFER_SIZE     (4 * 1024)
+#define WINDOWS_IPT_MAX_BUFFER_SIZE     (128 * 1024 * 1024)
+
+struct windows_ipt_state
+{
+	int ipt_buffer_size;
+	int edge_bitmap;
+	int map_size;
+
+	HANDLE child_handle;
+	int process_finished;
+	int last_fuzz_result;
+	int fuzz_results_set;
+	int last_is_new_path;
+	int trace_analyzed; //Whether the current process's trace has been decoded yet
+	int address_warning_shown; //Whether the target executable's address range couldn't be found before
+
+	struct ipt_decoder decoder; //Also holds the target executable's address range, and the current edge bitmap
+	struct ipt_hash_set hash_set;
+	uint8_t * virgin_bits; //The edges that haven't been hit by any previous execution
+
+	char * trace;       //The buffer the IPT driver copies the target's trace into, reused between executions
+	DWORD trace_size;   //The size of the trace buffer
+
+	instrumentation_counters_t counters; //The problems starting and tracing the target, for the fuzzer's stats
+};
+typedef struct windows_ipt_state windows_ipt_state_t;
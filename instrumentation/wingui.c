@@ -40,3 +40,66 @@ BOOL IsProcessInModalDialog(
 
     return FALSE;
 }
+
+/*
+ * Set by DialogStartProc when the watched process shows a dialog, and
+ * cleared by ProcessDialogStarted.  Only one process is watched at a time.
+ */
+static volatile LONG lDialogStarted = 0;
+
+static void CALLBACK DialogStartProc(
+    HWINEVENTHOOK hHook,
+    DWORD dwEvent,
+    HWND hwnd,
+    LONG idObject,
+    LONG idChild,
+    DWORD dwEventThread,
+    DWORD dwmsEventTime
+)
+{
+    InterlockedExchange( &lDialogStarted, 1 );
+}
+
+/*
+ * Starts watching a process for dialogs, so that the caller can check for
+ * a modal dialog as soon as one appears rather than polling for it.  The
+ * hook is out of context, so its events are delivered while the calling
+ * thread pumps its message queue, e.g. after MsgWaitForMultipleObjects
+ * reports that there are messages waiting.  Dialogs shown before the hook
+ * is installed aren't reported, so callers should check the process with
+ * IsProcessInModalDialog once after installing it.
+ */
+HWINEVENTHOOK WatchProcessDialogs(
+    DWORD dwTargetProcessId
+)
+{
+    InterlockedExchange( &lDialogStarted, 0 );
+    return SetWinEventHook(
+        EVENT_SYSTEM_DIALOGSTART,
+        EVENT_SYSTEM_DIALOGSTART,
+        NULL,
+        DialogStartProc,
+        dwTargetProcessId,
+        0, // All of the process' threads
+        WINEVENT_OUTOFCONTEXT
+    );
+}
+
+/*
+ * Returns whether the watched process has shown a dialog since the last
+ * call, then resets the flag.
+ */
+BOOL ProcessDialogStarted( void )
+{
+    return InterlockedExchange( &lDialogStarted, 0 ) != 0;
+}
+
+/*
+ * Stops watching the process given to WatchProcessDialogs.
+ */
+void UnwatchProcessDialogs(
+    HWINEVENTHOOK hHook
+)
+{
+    if ( hHook ) UnhookWinEvent( hHook );
+}
@@ -3,3 +3,6 @@
 #include <windows.h>
 
 extern "C" BOOL IsProcessInModalDialog( DWORD dwTargetProcessId );
+extern "C" HWINEVENTHOOK WatchProcessDialogs( DWORD dwTargetProcessId );
+extern "C" BOOL ProcessDialogStarted( void );
+extern "C" void UnwatchProcessDialogs( HWINEVENTHOOK hHook );
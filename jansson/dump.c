@@ -98,36 +98,36 @@ static int dump_indent(size_t flags, int depth, int space, json_dump_callback_t
 	return 0;
 }
 
+/* mem values are hex encoded a chunk at a time, so that a large mem value is handed to the
+   callback in a few big pieces, rather than being encoded into one string first */
+#define MEM_DUMP_CHUNK 4096
+
 static int dump_mem(const char *mem, size_t len, json_dump_callback_t dump, void *data)
 {
-	const unsigned char *pos;
-	unsigned char buffer[200];
-	int num_chars;
+	static const char hex[] = "0123456789ABCDEF";
+	const unsigned char *pos = (const unsigned char *)mem, *end = pos + len;
+	char buffer[2 * MEM_DUMP_CHUNK];
+	size_t i, chunk;
 
 	if (dump("\"" MEM_TOKEN, 1 + strlen(MEM_TOKEN), data))
 		return -1;
 
-	for (pos = (const unsigned char *)mem; pos < (const unsigned char *)(mem + len); pos += num_chars / 2)
+	while (pos < end)
 	{
-		if (pos + 0x20 < (const unsigned char *)(mem + len))
-			num_chars = snprintf(buffer, sizeof(buffer), 
-				"%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X"
-				"%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X",
-				*pos, *(pos + 1), *(pos + 2), *(pos + 3), *(pos + 4), *(pos + 5), *(pos + 6), *(pos + 7),
-				*(pos + 8), *(pos + 9), *(pos + 10), *(pos + 11), *(pos + 12), *(pos + 13), *(pos + 14), *(pos + 15),
-				*(pos + 16), *(pos + 17), *(pos + 18), *(pos + 19), *(pos + 20), *(pos + 21), *(pos + 22), *(pos + 23),
-				*(pos + 24), *(pos + 25), *(pos + 26), *(pos + 27), *(pos + 28), *(pos + 29), *(pos + 30), *(pos + 31));
-		else
-			num_chars = snprintf(buffer, sizeof(buffer), "%02X", *pos);
-
-		if (dump(buffer, num_chars, data))
+		chunk = (size_t)(end - pos) < MEM_DUMP_CHUNK ? (size_t)(end - pos) : MEM_DUMP_CHUNK;
+		for (i = 0; i < chunk; i++)
+		{
+			buffer[2 * i] = hex[pos[i] >> 4];
+			buffer[2 * i + 1] = hex[pos[i] & 0xf];
+		}
+		if (dump(buffer, 2 * chunk, data))
 			return -1;
+		pos += chunk;
 	}
 
 	return dump("\"", 1, data);
 }
 
-
 static int dump_string(const char *str, size_t len, json_dump_callback_t dump, void *data, size_t flags)
 {
 	const char *pos, *end, *lim;
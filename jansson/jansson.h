@@ -102,6 +102,7 @@ extern "C" {
 	JANSSON_API json_t *json_string(const char *value);
 	JANSSON_API json_t *json_stringn(const char *value, size_t len);
 	JANSSON_API json_t *json_mem(const char *value, size_t len);
+	JANSSON_API json_t *json_mem_nocopy(const char *value, size_t len);
 	JANSSON_API json_t *json_string_nocheck(const char *value);
 	JANSSON_API json_t *json_stringn_nocheck(const char *value, size_t len);
 	JANSSON_API json_t *json_integer(json_int_t value);
@@ -663,7 +663,7 @@ int decode_mem_array(const char *json_string, char *** items, size_t ** item_len
 char * encode_mem_array(char ** items, size_t * item_lengths, size_t items_count, int * output_length)
 {
 	json_t *items_obj, *item_obj;
-	size_t i;
+	size_t i, length;
 	char * ret;
 
 	items_obj = json_array();
@@ -671,15 +671,70 @@ char * encode_mem_array(char ** items, size_t * item_lengths, size_t items_count
 		return NULL;
 	for (i = 0; i < items_count; i++)
 	{
-		item_obj = json_mem(items[i], item_lengths[i]);
+		item_obj = json_mem_nocopy(items[i], item_lengths[i]);
 		if (!item_obj) {
 			json_decref(items_obj);
 			return NULL;
 		}
 		json_array_append_new(items_obj, item_obj);
 	}
-	ret = json_dumps(items_obj, 0);
-	*output_length = strlen(ret);
+	ret = dump_json_to_string(items_obj, 0, &length);
 	json_decref(items_obj);
+	if (ret)
+		*output_length = (int)length;
+	return ret;
+}
+
+/**
+ * Dumps a JSON object to a string.  Unlike json_dumps, the object is measured first, so the string is
+ * allocated once at its final size, rather than being copied each time it outgrows its buffer.  That
+ * keeps the peak memory of dumping large mem values (such as instrumentation bitmaps) close to the
+ * size of the string itself.
+ * @param root - the JSON object to dump
+ * @param flags - the jansson encoding flags to dump the object with
+ * @param length - a pointer used to return the length of the string, or NULL
+ * @return - the NULL terminated JSON string on success, or NULL on failure.  The caller should free it.
+ */
+char * dump_json_to_string(const json_t * root, size_t flags, size_t * length)
+{
+	char * ret;
+	size_t size;
+
+	size = json_dumpb(root, NULL, 0, flags);
+	if (!size)
+		return NULL;
+	ret = malloc(size + 1);
+	if (!ret)
+		return NULL;
+	if (json_dumpb(root, ret, size, flags) != size) {
+		free(ret);
+		return NULL;
+	}
+	ret[size] = 0;
+	if (length)
+		*length = size;
 	return ret;
 }
+
+/**
+ * Dumps a JSON object straight to a file, a buffered chunk at a time, without building the JSON string
+ * in memory first.
+ * @param root - the JSON object to dump
+ * @param filename - the file to write the JSON to
+ * @param flags - the jansson encoding flags to dump the object with
+ * @return - 0 on success, non-zero on failure
+ */
+int dump_json_to_file(const json_t * root, const char * filename, size_t flags)
+{
+	FILE * fp;
+	int ret;
+
+	fp = fopen(filename, "wb");
+	if (!fp)
+		return 1;
+	setvbuf(fp, NULL, _IOFBF, 64 * 1024);
+	ret = json_dumpf(root, fp, flags);
+	if (fclose(fp))
+		ret = 1;
+	return ret != 0;
+}
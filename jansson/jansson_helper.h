@@ -164,6 +164,8 @@ extern "C" {
 #define ADD_INT(temp, arg1, dest, name)           ADD_ITEM1(temp, arg1, dest, json_integer, name)
 #define ADD_UINT64T                               ADD_INT //Internally they both use json_integer
 #define ADD_MEM(temp, arg1, arg2, dest, name)     ADD_ITEM2(temp, arg1, arg2, dest, json_mem, name)
+//Like ADD_MEM, but without copying the buffer, which must last until the object is dumped and freed
+#define ADD_MEM_NOCOPY(temp, arg1, arg2, dest, name) ADD_ITEM2(temp, arg1, arg2, dest, json_mem_nocopy, name)
 #define ADD_DOUBLE(temp, arg1, dest, name)        ADD_ITEM1(temp, arg1, dest, json_real, name)
 
 #define GET_ITEM(arg1, dest, temp, func, name, ret) \
@@ -204,6 +206,9 @@ JANSSON_API char * add_int_option_to_json(const char * root_options, const char
 JANSSON_API int decode_mem_array(const char *json_string, char *** items, size_t ** item_lengths, size_t * items_count);
 JANSSON_API char * encode_mem_array(char ** items, size_t * item_lengths, size_t items_count, int * output_length);
 
+JANSSON_API char * dump_json_to_string(const json_t * root, size_t flags, size_t * length);
+JANSSON_API int dump_json_to_file(const json_t * root, const char * filename, size_t flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -59,6 +59,7 @@ typedef struct {
 	json_t json;
 	char *value;
 	size_t length;
+	int borrowed; /* the value belongs to the caller, and isn't freed with the json_t */
 } json_mem_t;
 
 typedef struct {
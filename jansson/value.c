@@ -718,6 +718,7 @@ size_t json_string_length(const json_t *json)
 
 /*** mem ***/
 
+/* own: 1 to take ownership of the malloc'd value, 0 to copy it, or -1 to borrow it */
 static json_t *mem_create(const char *value, size_t len, int own)
 {
 	char *v;
@@ -738,12 +739,13 @@ static json_t *mem_create(const char *value, size_t len, int own)
 	mem = jsonp_malloc(sizeof(json_mem_t));
 	if (!mem) {
 		if (!own)
-			jsonp_free(v);
+			free(v);
 		return NULL;
 	}
 	json_init(&mem->json, JSON_MEM);
 	mem->value = v;
 	mem->length = len;
+	mem->borrowed = own < 0;
 
 	return &mem->json;
 }
@@ -758,6 +760,18 @@ json_t *json_mem_own(const char *value, size_t len)
 	return mem_create(value, len, 1);
 }
 
+json_t *json_mem_nocopy(const char *value, size_t len)
+{
+	return mem_create(value, len, -1);
+}
+
+static void json_delete_mem(json_mem_t *mem)
+{
+	if (!mem->borrowed)
+		free(mem->value);
+	jsonp_free(mem);
+}
+
 const char *json_mem_value(const json_t *json)
 {
 	if (!json_is_mem(json))
@@ -1006,6 +1020,9 @@ void json_delete(json_t *json)
 	case JSON_REAL:
 		json_delete_real(json_to_real(json));
 		break;
+	case JSON_MEM:
+		json_delete_mem(json_to_mem(json));
+		break;
 	default:
 		return;
 	}
@@ -0,0 +1,362 @@
+//This program is the merge daemon, which keeps the global instrumentation state of each target in memory and
+//merges the states that the fuzzers send back into it, so the manager doesn't have to load and save the whole
+//state for every result.  It listens on a Unix socket for requests, one line each, and answers each one with
+//a line that starts with "ok" or "error":
+//	merge name file                   Merge the binary state or delta in file into the named state.  Answers with
+//	                                  the number of cleared bits of the merged state's bitmaps.
+//	count name [section]              Answers with the number of cleared bits of the named state's bitmaps, or
+//	                                  of just the given bitmap (e.g. virgin_bits).
+//	diff name base_file output_file   Write the delta of the named state since the state in base_file, e.g. to
+//	                                  send a host only what's new since the state it already has.  Answers
+//	                                  with the length of the delta.
+//	get name output_file              Write the named state, compressed.  Answers with its length.
+//	quit                              Stop the daemon.
+//The states are kept decoded in memory, so that most merges are done in place, and are written to the state
+//directory as name.state after each merge, so the daemon picks up where it left off when it's restarted.
+
+#include "state_merge.h"
+
+#include <utils.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//The longest request line
+#define REQUEST_MAX 4096
+
+void usage(char * program_name)
+{
+	char * help_text;
+	printf(
+		"Usage: %s [-l logging_options] state_directory socket_path\n"
+		"\n"
+		"Options:\n"
+		"\t -l logging_options           Set the options for logging\n"
+		"\t state_directory              The directory to keep the merged states in\n"
+		"\t socket_path                  The Unix socket to listen for the requests on\n"
+		"\n",
+		program_name
+	);
+
+#define PRINT_HELP(x, y) \
+	x = y;               \
+	if(x) {              \
+		puts(x);         \
+		free(x);         \
+	}
+
+	PRINT_HELP(help_text, logging_help());
+	exit(1);
+}
+
+//A target's global state
+struct merged_state
+{
+	char * name;
+	char * buffer; //The decoded state, or NULL if nothing has been merged into it yet
+	size_t length;
+};
+typedef struct merged_state merged_state_t;
+
+static char * state_directory;
+static merged_state_t * states = NULL;
+static size_t states_count = 0;
+
+/**
+ * This function checks that a state's name is safe to use as a filename.
+ * @param name - the name to check
+ * @return - non-zero if the name is valid, zero otherwise
+ */
+static int valid_name(const char * name)
+{
+	return name[0] && strspn(name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-.") == strlen(name)
+		&& name[0] != '.';
+}
+
+/**
+ * This function finds a state by name, loading it from the state directory the first time it's used.
+ * @param name - the name of the state
+ * @return - the state, or NULL on failure
+ */
+static merged_state_t * find_state(const char * name)
+{
+	merged_state_t * state, * new_states;
+	char filename[MAX_PATH], * file;
+	size_t i, length;
+
+	for (i = 0; i < states_count; i++)
+	{
+		if (!strcmp(states[i].name, name))
+			return &states[i];
+	}
+
+	new_states = (merged_state_t *)realloc(states, (states_count + 1) * sizeof(merged_state_t));
+	if (!new_states)
+		return NULL;
+	states = new_states;
+	state = &states[states_count];
+	memset(state, 0, sizeof(*state));
+	state->name = strdup(name);
+	if (!state->name)
+		return NULL;
+	states_count++;
+
+	snprintf(filename, sizeof(filename), "%s/%s.state", state_directory, name);
+	if (file_exists(filename)) {
+		file = (char *)map_file(filename, &length);
+		if (file) {
+			state->buffer = state_merge_load(file, length, &state->length);
+			unmap_file(file, length);
+		}
+		if (!state->buffer)
+			WARNING_MSG("Couldn't load the state %s, starting it over", filename);
+	}
+	return state;
+}
+
+/**
+ * This function writes a state to the state directory, replacing the last copy only once the new one is written.
+ * @param state - the state to write
+ * @return - zero on success, non-zero on failure
+ */
+static int save_state(merged_state_t * state)
+{
+	char filename[MAX_PATH], temp_filename[MAX_PATH];
+
+	if (snprintf(filename, sizeof(filename), "%s/%s.state", state_directory, state->name) >= (int)sizeof(filename)
+		|| snprintf(temp_filename, sizeof(temp_filename), "%s.new", filename) >= (int)sizeof(temp_filename)) {
+		ERROR_MSG("The path of the state %s in %s is too long", state->name, state_directory);
+		return 1;
+	}
+	if (write_buffer_to_file(temp_filename, state->buffer, state->length) < 0 || rename(temp_filename, filename)) {
+		ERROR_MSG("Couldn't write the state %s", filename);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function merges a state file into a global state.
+ * @param state - the global state to merge into
+ * @param filename - the binary state or delta to merge
+ * @param reply - used to return the reply to the request
+ * @param reply_length - the size of the reply parameter
+ */
+static void merge_file(merged_state_t * state, const char * filename, char * reply, size_t reply_length)
+{
+	char * other;
+	size_t other_length;
+	uint64_t count;
+	int ret;
+
+	other = (char *)map_file(filename, &other_length);
+	if (!other) {
+		snprintf(reply, reply_length, "error couldn't read %s", filename);
+		return;
+	}
+	if (state->buffer)
+		ret = state_merge(&state->buffer, &state->length, other, other_length);
+	else {
+		state->buffer = state_merge_load(other, other_length, &state->length);
+		ret = !state->buffer;
+	}
+	unmap_file(other, other_length);
+
+	if (ret)
+		snprintf(reply, reply_length, "error couldn't merge %s into %s", filename, state->name);
+	else if (save_state(state))
+		snprintf(reply, reply_length, "error couldn't save %s", state->name);
+	else if (state_merge_count_bits(state->buffer, state->length, NULL, &count))
+		snprintf(reply, reply_length, "error couldn't count the bits of %s", state->name);
+	else
+		snprintf(reply, reply_length, "ok %llu", (unsigned long long)count);
+}
+
+/**
+ * This function writes a global state, or its delta since another state, to a file.
+ * @param state - the global state to write
+ * @param base_filename - the state to write the delta since, or NULL to write the whole state
+ * @param filename - the file to write
+ * @param reply - used to return the reply to the request
+ * @param reply_length - the size of the reply parameter
+ */
+static void write_state(merged_state_t * state, const char * base_filename, const char * filename, char * reply,
+	size_t reply_length)
+{
+	char * base = NULL, * output;
+	size_t base_length, length;
+
+	if (base_filename) {
+		base = (char *)map_file(base_filename, &base_length);
+		if (!base) {
+			snprintf(reply, reply_length, "error couldn't read %s", base_filename);
+			return;
+		}
+		output = state_merge_diff(base, base_length, state->buffer, state->length, &length);
+		unmap_file(base, base_length);
+	}
+	else
+		output = state_merge_compress(state->buffer, state->length, &length);
+
+	if (!output)
+		snprintf(reply, reply_length, "error couldn't create the %s of %s", base_filename ? "delta" : "copy", state->name);
+	else if (write_buffer_to_file((char *)filename, output, length) < 0)
+		snprintf(reply, reply_length, "error couldn't write %s", filename);
+	else
+		snprintf(reply, reply_length, "ok %lu", (unsigned long)length);
+	state_merge_free(output);
+}
+
+/**
+ * This function handles a request.
+ * @param request - the request line, which is split up into its arguments
+ * @param reply - used to return the reply to the request
+ * @param reply_length - the size of the reply parameter
+ * @return - non-zero if the daemon should stop, zero otherwise
+ */
+static int handle_request(char * request, char * reply, size_t reply_length)
+{
+	char * args[4] = { NULL, NULL, NULL, NULL }, * save = NULL;
+	merged_state_t * state;
+	uint64_t count;
+	int num_args;
+
+	for (num_args = 0; num_args < 4 && (args[num_args] = strtok_r(num_args ? NULL : request, " \t\r\n", &save)); num_args++);
+	if (!num_args) {
+		snprintf(reply, reply_length, "error empty request");
+		return 0;
+	}
+	if (!strcmp(args[0], "quit")) {
+		snprintf(reply, reply_length, "ok");
+		return 1;
+	}
+	if (num_args < 2 || !valid_name(args[1])) {
+		snprintf(reply, reply_length, "error the request needs a valid state name");
+		return 0;
+	}
+	state = find_state(args[1]);
+	if (!state) {
+		snprintf(reply, reply_length, "error couldn't allocate the state %s", args[1]);
+		return 0;
+	}
+
+	if (!strcmp(args[0], "merge") && num_args == 3)
+		merge_file(state, args[2], reply, reply_length);
+	else if (!strcmp(args[0], "merge"))
+		snprintf(reply, reply_length, "error usage: merge name file");
+	else if (!state->buffer)
+		snprintf(reply, reply_length, "error nothing has been merged into %s", state->name);
+	else if (!strcmp(args[0], "count")) {
+		if (state_merge_count_bits(state->buffer, state->length, num_args > 2 ? args[2] : NULL, &count))
+			snprintf(reply, reply_length, "error %s doesn't have that bitmap", state->name);
+		else
+			snprintf(reply, reply_length, "ok %llu", (unsigned long long)count);
+	}
+	else if (!strcmp(args[0], "diff") && num_args == 4)
+		write_state(state, args[2], args[3], reply, reply_length);
+	else if (!strcmp(args[0], "get") && num_args == 3)
+		write_state(state, NULL, args[2], reply, reply_length);
+	else
+		snprintf(reply, reply_length, "error unknown request %s", args[0]);
+	return 0;
+}
+
+/**
+ * This function answers the requests of one client, until it disconnects.
+ * @param sock - the client's connection
+ * @return - non-zero if the client asked the daemon to stop, zero otherwise
+ */
+static int serve_client(int sock)
+{
+	char request[REQUEST_MAX], reply[REQUEST_MAX + 64];
+	FILE * input, * output;
+	uint64_t start;
+	int quit = 0;
+
+	input = fdopen(sock, "r");
+	output = fdopen(dup(sock), "w");
+	if (!input || !output) {
+		if (input)
+			fclose(input);
+		else
+			close(sock);
+		if (output)
+			fclose(output);
+		return 0;
+	}
+
+	while (!quit && fgets(request, sizeof(request), input))
+	{
+		start = get_time_ms();
+		quit = handle_request(request, reply, sizeof(reply));
+		DEBUG_MSG("Answered with \"%s\" after %llu ms", reply, (unsigned long long)(get_time_ms() - start));
+		fprintf(output, "%s\n", reply);
+		if (fflush(output))
+			break;
+	}
+	fclose(input);
+	fclose(output);
+	return quit;
+}
+
+int main(int argc, char ** argv)
+{
+	char * logging_options = NULL, * socket_path;
+	struct sockaddr_un address;
+	int i, listener, sock, quit = 0;
+	size_t j;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		IF_ARG_OPTION("-l", logging_options)
+		else
+			usage(argv[0]);
+	}
+	if (argc - i != 2)
+		usage(argv[0]);
+	state_directory = argv[i];
+	socket_path = argv[i + 1];
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+		FATAL_MSG("The socket path %s is too long", socket_path);
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+	unlink(socket_path);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) || listen(listener, 16))
+		FATAL_MSG("Couldn't listen on %s: %s", socket_path, strerror(errno));
+	INFO_MSG("Merging the states in %s, listening on %s", state_directory, socket_path);
+
+	while (!quit)
+	{
+		sock = accept(listener, NULL, NULL);
+		if (sock < 0) {
+			if (errno != EINTR)
+				WARNING_MSG("Couldn't accept a connection: %s", strerror(errno));
+			continue;
+		}
+		quit = serve_client(sock);
+	}
+
+	close(listener);
+	unlink(socket_path);
+	for (j = 0; j < states_count; j++)
+	{
+		free(states[j].name);
+		state_merge_free(states[j].buffer);
+	}
+	free(states);
+	return 0;
+}
@@ -2,10 +2,13 @@
 //instrumentation state.  The resulting instrumentation state will include the
 //tracked coverage from all of the input instrumentation states. This allows
 //multiple instances of the fuzzer to share instrumentation data, and ignore
-//paths that the other fuzzer found.
+//paths that the other fuzzer found.  When all of the input states are in the
+//binary state format, they are merged directly from the mapped files without
+//loading them into the instrumentation.
 
 #include <instrumentation.h>
 #include <instrumentation_factory.h>
+#include <binary_state.h>
 #include <utils.h>
 
 #include <stdio.h>
@@ -21,10 +24,11 @@ void usage(char * program_name)
 {
 	char * help_text;
 	printf(
-		"Usage: %s instrumentation_name [-i instrumentation_options] output_file input_file [input_file ...]\n"
+		"Usage: %s instrumentation_name [-i instrumentation_options] [-t num_threads] output_file input_file [input_file ...]\n"
 		"\n"
 		"Options:\n"
 		"\t -i instrumentation_options   Set the options for the instrumentation\n"
+		"\t -t num_threads               Set the number of threads to merge binary states with (default: one per CPU)\n"
 		"\t output_file                  Set the file containing that the combined instrumentation state should dump to\n"
 		"\t input_file                   Set the file containing that the instrumentation state should load from\n"
 		"\n",
@@ -42,11 +46,41 @@ void usage(char * program_name)
 	exit(1);
 }
 
+/**
+* This function checks whether all of the input files are binary states written by the given instrumentation.
+* @param instrumentation_name - the name of the instrumentation the states should have been written by
+* @param input_files - the input state filenames
+* @param num_inputs - the number of filenames in the input_files parameter
+* @return - 1 if all of the inputs are binary states, 0 otherwise
+*/
+static int all_binary_states(char * instrumentation_name, char ** input_files, int num_inputs)
+{
+	struct binary_state_header header;
+	FILE * file;
+	int i, matches;
+
+	//Only the headers are checked here, the states are fully validated when they're merged
+	for (i = 0; i < num_inputs; i++)
+	{
+		file = fopen(input_files[i], "rb");
+		if (!file)
+			return 0;
+		matches = fread(&header, sizeof(header), 1, file) == 1
+			&& binary_state_is_binary((const char *)&header, sizeof(header))
+			&& !strncmp(header.instrumentation, instrumentation_name, sizeof(header.instrumentation));
+		fclose(file);
+		if (!matches)
+			return 0;
+	}
+	return 1;
+}
+
 
 int main(int argc, char ** argv)
 {
 	instrumentation_t * instrumentation;
-	int instrumentation_length, argv_index;
+	int argv_index, num_threads = 0, instrumentation_state_mapped;
+	size_t instrumentation_length, state_length;
 	char *instrumentation_options = NULL, *instrumentation_state_string = NULL, *instrumentation_state_dump_file = NULL;
 	void * instrumentation_state = NULL, *new_instrumentation_state = NULL, *merged_instrumentation_state = NULL;
 
@@ -63,29 +97,41 @@ int main(int argc, char ** argv)
 	if (!instrumentation)
 		FATAL_MSG("Unknown instrumentation (%s)", argv[1]);
 
-	if (strcmp("-i", argv[2]))
+	for (argv_index = 2; argv_index + 1 < argc && argv[argv_index][0] == '-'; argv_index += 2)
 	{
-		argv_index = 3;
-		instrumentation_state_dump_file = argv[2];
+		if (!strcmp("-i", argv[argv_index]))
+			instrumentation_options = argv[argv_index + 1];
+		else if (!strcmp("-t", argv[argv_index]))
+			num_threads = atoi(argv[argv_index + 1]);
+		else
+			usage(argv[0]);
 	}
-	else
+	if (argv_index >= argc)
+		usage(argv[0]);
+	instrumentation_state_dump_file = argv[argv_index++];
+	if (num_threads <= 0)
+		num_threads = get_processor_count();
+
+	if (argv_index < argc && all_binary_states(argv[1], &argv[argv_index], argc - argv_index))
 	{
-		instrumentation_options = argv[3];
-		argv_index = 5;
-		instrumentation_state_dump_file = argv[4];
+		if (binary_state_merge_files(instrumentation_state_dump_file, &argv[argv_index], argc - argv_index, 1, num_threads))
+			FATAL_MSG("Couldn't merge the binary instrumentation states into %s", instrumentation_state_dump_file);
+		free(instrumentation);
+		return 0;
 	}
 
-
 	for (; argv_index < argc; argv_index++)
 	{
 		//Load the instrumentation state from disk
-		instrumentation_length = read_file(argv[argv_index], &instrumentation_state_string);
-		if (instrumentation_length <= 0)
+		instrumentation_state_string = instrumentation_load_state_file(argv[argv_index], &instrumentation_length,
+			&instrumentation_state_mapped);
+		if (!instrumentation_state_string)
 			FATAL_MSG("Could not read instrumentation file or empty instrumentation file: %s", argv[argv_index]);
-		new_instrumentation_state = instrumentation->create(instrumentation_options, instrumentation_state_string);
-		if (!instrumentation)
+		new_instrumentation_state = instrumentation_create_with_state(instrumentation, instrumentation_options,
+			instrumentation_state_string, instrumentation_length);
+		if (!new_instrumentation_state)
 			FATAL_MSG("Bad options/state for instrumentation file %s", argv[argv_index]);
-		free(instrumentation_state_string);
+		instrumentation_free_state_file(instrumentation_state_string, instrumentation_length, instrumentation_state_mapped);
 
 		if (!instrumentation_state)
 			instrumentation_state = new_instrumentation_state;
@@ -98,10 +144,10 @@ int main(int argc, char ** argv)
 		}
 	}
 
-	instrumentation_state_string = instrumentation->get_state(instrumentation_state);
+	instrumentation_state_string = instrumentation_save_state(instrumentation, instrumentation_state, 0, &state_length);
 	if (instrumentation_state_string)
 	{
-		write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, strlen(instrumentation_state_string));
+		write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, state_length);
 		instrumentation->free_state(instrumentation_state_string);
 	}
 	else
@@ -0,0 +1,98 @@
+#include "state_merge.h"
+
+#include <binary_state.h>
+#include <utils.h>
+
+#include <stdlib.h>
+
+/**
+ * This function loads a binary state to merge other states into, by copying it with its sections decoded.
+ * @param state - the binary state to load
+ * @param length - the length of the state parameter
+ * @param loaded_length - a pointer used to return the length of the loaded state
+ * @return - the loaded state, which should be freed with state_merge_free, or NULL if the state is malformed
+ * or on failure
+ */
+STATE_MERGE_API char * state_merge_load(const char * state, size_t length, size_t * loaded_length)
+{
+	return binary_state_copy(state, length, 0, loaded_length);
+}
+
+/**
+ * This function merges a binary state, or a delta of one, into a loaded state.  The merge is done in place
+ * when it can be, and otherwise the loaded state is replaced by a new, merged one.
+ * @param state - a pointer to the loaded state, which is updated if the state is replaced
+ * @param length - a pointer to the length of the loaded state, which is updated if the state is replaced
+ * @param other - the binary state or delta to merge into the loaded state
+ * @param other_length - the length of the other parameter
+ * @return - zero on success, non-zero if the states don't match or on failure
+ */
+STATE_MERGE_API int state_merge(char ** state, size_t * length, const char * other, size_t other_length)
+{
+	char * merged;
+	size_t merged_length;
+	int ret;
+
+	ret = binary_state_merge_in_place(*state, *length, other, other_length);
+	if (ret != BINARY_STATE_NOT_IN_PLACE)
+		return ret;
+
+	//The merged state stays decoded, so the next merge can be done in place
+	merged = binary_state_apply_delta(*state, *length, other, other_length, 0, &merged_length);
+	if (!merged)
+		return 1;
+	free(*state);
+	*state = merged;
+	*length = merged_length;
+	return 0;
+}
+
+/**
+ * This function creates a delta of a binary state, with only what changed since an earlier state.
+ * @param base - the earlier binary state
+ * @param base_length - the length of the base parameter
+ * @param current - the binary state to create the delta of
+ * @param current_length - the length of the current parameter
+ * @param length - a pointer used to return the length of the delta
+ * @return - the compressed delta, which should be freed with state_merge_free, or NULL on failure
+ */
+STATE_MERGE_API char * state_merge_diff(const char * base, size_t base_length, const char * current,
+	size_t current_length, size_t * length)
+{
+	return binary_state_create_delta(base, base_length, current, current_length, 1, length);
+}
+
+/**
+ * This function compresses a loaded state, e.g. to send it to the fuzzers.
+ * @param state - the loaded state
+ * @param length - the length of the state parameter
+ * @param compressed_length - a pointer used to return the length of the compressed state
+ * @return - the compressed state, which should be freed with state_merge_free, or NULL on failure
+ */
+STATE_MERGE_API char * state_merge_compress(const char * state, size_t length, size_t * compressed_length)
+{
+	return binary_state_copy(state, length, 1, compressed_length);
+}
+
+/**
+ * This function counts the coverage in a binary state, as the cleared bits of its bitmaps.
+ * @param state - the binary state
+ * @param length - the length of the state parameter
+ * @param section_name - the bitmap to count the bits of (e.g. virgin_bits for afl), or NULL to count all of them
+ * @param count - a pointer used to return the number of cleared bits
+ * @return - zero on success, non-zero if the state is malformed or doesn't have the section
+ */
+STATE_MERGE_API int state_merge_count_bits(const char * state, size_t length, const char * section_name,
+	uint64_t * count)
+{
+	return binary_state_count_cleared_bits(state, length, section_name, count);
+}
+
+/**
+ * This function frees a state returned by the statemerge library.
+ * @param buffer - the state to free
+ */
+STATE_MERGE_API void state_merge_free(char * buffer)
+{
+	free(buffer);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#define STATE_MERGE_API
+#elif defined(STATE_MERGE_EXPORTS)
+#define STATE_MERGE_API __declspec(dllexport)
+#else
+#define STATE_MERGE_API __declspec(dllimport)
+#endif
+
+//The statemerge library is the merger's logic for binary instrumentation states (see binary_state.h), for
+//services that keep a global state up to date as the results come in, such as the merge daemon.  The states
+//are merged in memory without the instrumentation that wrote them, and a state that's been loaded with
+//state_merge_load is merged in place, so most merges only AND the new bitmaps into it.
+
+STATE_MERGE_API char * state_merge_load(const char * state, size_t length, size_t * loaded_length);
+STATE_MERGE_API int state_merge(char ** state, size_t * length, const char * other, size_t other_length);
+STATE_MERGE_API char * state_merge_diff(const char * base, size_t base_length, const char * current,
+	size_t current_length, size_t * length);
+STATE_MERGE_API char * state_merge_compress(const char * state, size_t length, size_t * compressed_length);
+STATE_MERGE_API int state_merge_count_bits(const char * state, size_t length, const char * section_name,
+	uint64_t * count);
+STATE_MERGE_API void state_merge_free(char * buffer);
@@ -0,0 +1,549 @@
+//This program minimizes a corpus, like afl-cmin.  It runs each of the inputs in a directory, records the
+//coverage features each one hits, and then picks a small set of inputs that still hits every feature.
+//The features are the hit count buckets of each byte of the coverage bitmap, for instrumentations that
+//have one, or the edges, for instrumentations that can list them.  Each input's features are kept as a
+//compressed bitset, so that large corpora fit in memory, and the inputs are run in parallel.
+
+#include <driver.h>
+#include <driver_factory.h>
+#include <instrumentation.h>
+#include <instrumentation_factory.h>
+#include <bitmap.h>
+#include <jansson_helper.h>
+#include <utils.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(char * program_name)
+{
+	char * help_text;
+	printf(
+		"Usage: %s driver_name instrumentation_name input_directory output_file [options]\n"
+		"\n"
+		"Required:\n"
+		"\t driver_name                   The driver framework used to run the target program\n"
+		"\t instrumentation_name          The instrumenation framework to use to determine the path a program took\n"
+		"\t input_directory               The directory or packed corpus (see corpus_pack.h) of inputs to minimize\n"
+		"\t output_file                   Write the filenames of the inputs to keep to this file, one per line\n"
+		"Options:\n"
+		"\t -d driver_options             Set the options for the driver\n"
+		"\t -i instrumentation_options    Set the options for the instrumentation\n"
+		"\t -l logging_options            Set the options for logging\n"
+		"\t -w num_workers                The number of inputs to run in parallel, each with its own\n"
+		"\t                                driver and instrumentation state [default 1]\n"
+		"\n",
+		program_name
+	);
+
+#define PRINT_HELP(x, y) \
+	x = y;               \
+	if(x) {              \
+		puts(x);         \
+		free(x);         \
+	}
+
+	PRINT_HELP(help_text, logging_help());
+	PRINT_HELP(help_text, driver_help());
+	PRINT_HELP(help_text, instrumentation_help());
+	exit(1);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define POPCOUNT64(x) __builtin_popcountll(x)
+#define CTZ64(x)      __builtin_ctzll(x)
+#else
+static int POPCOUNT64(uint64_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+#define CTZ64(x) POPCOUNT64(((x) & (0 - (x))) - 1)
+#endif
+
+//The features an input hit, as a compressed bitset.  Only the non-zero 64-bit words of the bitset are
+//stored, along with their indices, in increasing order of index.
+struct feature_set
+{
+	uint32_t * indices;
+	uint64_t * words;
+	size_t num_words;
+	int hung;       //Whether the input hung, in which case it has no features and is never kept
+};
+typedef struct feature_set feature_set_t;
+
+//A worker that runs inputs, with its own driver and instrumentation state
+struct minimizer_worker
+{
+	driver_t * driver;
+	void * instrumentation_state;
+	uint8_t * classified;   //The bucketed copy of the last run's bitmap
+	uint32_t * edge_ids;    //The feature ids of the last run's edges
+	size_t max_edge_ids;
+	thread_t thread;
+};
+typedef struct minimizer_worker minimizer_worker_t;
+
+//An open addressing hash table that gives each edge a feature id, in the order the edges are first seen.
+//The slots hold the edges' ids plus one, so that zero can mark an empty slot.
+struct edge_ids
+{
+	instrumentation_edge_t * edges;
+	uint32_t num_edges;
+	uint32_t * slots;
+	size_t num_slots; //Always a power of two
+};
+
+static instrumentation_t * instrumentation = NULL;
+static seed_directory_t * inputs = NULL;
+static feature_set_t * feature_sets = NULL;
+static int use_edges = 0;
+static struct edge_ids edge_ids;
+static mutex_t minimizer_mutex; //Protects next_input and edge_ids
+static int next_input = 0;
+
+static size_t hash_edge(const instrumentation_edge_t * edge)
+{
+	uint64_t hash = ((uint64_t)edge->from * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)edge->to;
+	hash ^= hash >> 32;
+	hash *= 0xD6E8FEB86659FD93ULL;
+	hash ^= hash >> 32;
+	return (size_t)hash;
+}
+
+/**
+ * This function gets the feature id of an edge, giving it the next id if it hasn't been seen before.  The
+ * caller must hold the minimizer mutex.
+ * @param edge - the edge to look up
+ * @return - the edge's feature id
+ */
+static uint32_t get_edge_id(const instrumentation_edge_t * edge)
+{
+	uint32_t * slots, id;
+	size_t num_slots, slot, i;
+
+	//Keep the load factor under 1/2
+	if ((edge_ids.num_edges + 1) * 2 > edge_ids.num_slots)
+	{
+		num_slots = edge_ids.num_slots ? edge_ids.num_slots * 2 : 1024;
+		slots = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+		edge_ids.edges = (instrumentation_edge_t *)realloc(edge_ids.edges, num_slots / 2 * sizeof(instrumentation_edge_t));
+		if (!slots || !edge_ids.edges)
+			FATAL_MSG("Couldn't allocate the edge table");
+		for (i = 0; i < edge_ids.num_edges; i++)
+		{
+			slot = hash_edge(&edge_ids.edges[i]) & (num_slots - 1);
+			while (slots[slot])
+				slot = (slot + 1) & (num_slots - 1);
+			slots[slot] = (uint32_t)(i + 1);
+		}
+		free(edge_ids.slots);
+		edge_ids.slots = slots;
+		edge_ids.num_slots = num_slots;
+	}
+
+	slot = hash_edge(edge) & (edge_ids.num_slots - 1);
+	while (edge_ids.slots[slot])
+	{
+		id = edge_ids.slots[slot] - 1;
+		if (edge_ids.edges[id].from == edge->from && edge_ids.edges[id].to == edge->to)
+			return id;
+		slot = (slot + 1) & (edge_ids.num_slots - 1);
+	}
+	id = edge_ids.num_edges++;
+	edge_ids.edges[id] = *edge;
+	edge_ids.slots[slot] = id + 1;
+	return id;
+}
+
+static int compare_ids(const void * first, const void * second)
+{
+	uint32_t a = *(const uint32_t *)first, b = *(const uint32_t *)second;
+	return a < b ? -1 : a > b;
+}
+
+/**
+ * This function compresses a dense bitset into a feature set, keeping only its non-zero words.
+ * @param set - the feature set to fill in
+ * @param bits - the dense bitset
+ * @param size - the size of the bits parameter in bytes, which must be a multiple of 8
+ */
+static void compress_bitmap(feature_set_t * set, const uint8_t * bits, size_t size)
+{
+	uint64_t word;
+	size_t i, count = 0;
+
+	for (i = 0; i < size; i += sizeof(uint64_t))
+	{
+		memcpy(&word, bits + i, sizeof(uint64_t));
+		count += word != 0;
+	}
+	set->indices = (uint32_t *)malloc((count ? count : 1) * sizeof(uint32_t));
+	set->words = (uint64_t *)malloc((count ? count : 1) * sizeof(uint64_t));
+	if (!set->indices || !set->words)
+		FATAL_MSG("Couldn't allocate the feature sets");
+	for (i = 0; i < size; i += sizeof(uint64_t))
+	{
+		memcpy(&word, bits + i, sizeof(uint64_t));
+		if (!word)
+			continue;
+		set->indices[set->num_words] = (uint32_t)(i / sizeof(uint64_t));
+		set->words[set->num_words++] = word;
+	}
+}
+
+/**
+ * This function builds a feature set from a sorted list of feature ids.
+ * @param set - the feature set to fill in
+ * @param ids - the sorted feature ids
+ * @param count - the number of ids
+ */
+static void compress_ids(feature_set_t * set, const uint32_t * ids, size_t count)
+{
+	size_t i;
+
+	//Each id needs at most one word
+	set->indices = (uint32_t *)malloc((count ? count : 1) * sizeof(uint32_t));
+	set->words = (uint64_t *)malloc((count ? count : 1) * sizeof(uint64_t));
+	if (!set->indices || !set->words)
+		FATAL_MSG("Couldn't allocate the feature sets");
+	for (i = 0; i < count; i++)
+	{
+		if (!set->num_words || set->indices[set->num_words - 1] != ids[i] / 64)
+		{
+			set->indices[set->num_words] = ids[i] / 64;
+			set->words[set->num_words++] = 0;
+		}
+		set->words[set->num_words - 1] |= 1ULL << (ids[i] % 64);
+	}
+}
+
+/**
+ * This function records the features that the last run hit.
+ * @param worker - the worker that ran the input
+ * @param set - the input's feature set, which is filled in
+ */
+static void record_features(minimizer_worker_t * worker, feature_set_t * set)
+{
+	instrumentation_edges_t * edges;
+	const uint8_t * trace_bits;
+	size_t size, i;
+
+	if (!use_edges)
+	{
+		//The bucketed hit count of each byte has one bit set, so the bucketed bitmap is the feature bitset
+		if (instrumentation->get_trace_bits(worker->instrumentation_state, &trace_bits, &size) || size % 64)
+			FATAL_MSG("Instrumentation failed to get the coverage bitmap from the tested process (ipt needs the edge_bitmap option).");
+		worker->classified = (uint8_t *)realloc(worker->classified, size);
+		if (!worker->classified)
+			FATAL_MSG("Couldn't allocate the coverage bitmap");
+		memcpy(worker->classified, trace_bits, size);
+		bitmap_classify_counts(worker->classified, size);
+		compress_bitmap(set, worker->classified, size);
+		return;
+	}
+
+	edges = instrumentation->get_edges(worker->instrumentation_state, 0);
+	if (!edges)
+		FATAL_MSG("Instrumentation failed to get the program edges from the tested process.");
+	if (edges->num_edges > worker->max_edge_ids)
+	{
+		worker->max_edge_ids = (size_t)edges->num_edges;
+		worker->edge_ids = (uint32_t *)realloc(worker->edge_ids, worker->max_edge_ids * sizeof(uint32_t));
+		if (!worker->edge_ids)
+			FATAL_MSG("Couldn't allocate the edge ids");
+	}
+	take_mutex(minimizer_mutex);
+	for (i = 0; i < edges->num_edges; i++)
+		worker->edge_ids[i] = get_edge_id(&edges->edges[i]);
+	release_mutex(minimizer_mutex);
+	qsort(worker->edge_ids, (size_t)edges->num_edges, sizeof(uint32_t), compare_ids);
+	compress_ids(set, worker->edge_ids, (size_t)edges->num_edges);
+}
+
+/**
+ * This function is a minimizer worker thread, which runs the inputs until there aren't any left.
+ * @param arg - a pointer to the minimizer_worker_t to run
+ */
+static THREAD_FUNC(minimizer_worker_thread)
+{
+	minimizer_worker_t * worker = (minimizer_worker_t *)arg;
+	seed_file_t * input;
+	int index, result;
+
+	while (1)
+	{
+		take_mutex(minimizer_mutex);
+		index = next_input < (int)inputs->count ? next_input++ : -1;
+		release_mutex(minimizer_mutex);
+		if (index < 0)
+			break;
+
+		input = &inputs->seeds[index];
+		result = worker->driver->test_input(worker->driver->state, (char *)input->data, input->length);
+		if (result == FUZZ_ERROR)
+			FATAL_MSG("Failed to run the input %s", input->filename);
+		if (result == FUZZ_HANG)
+		{
+			WARNING_MSG("The input %s hung, and won't be kept", input->filename);
+			feature_sets[index].hung = 1;
+			continue;
+		}
+		record_features(worker, &feature_sets[index]);
+		DEBUG_MSG("The input %s hit %lu words of features", input->filename, (unsigned long)feature_sets[index].num_words);
+	}
+	THREAD_RETURN;
+}
+
+//The inputs are tried from smallest to largest, so the smallest input with each feature is kept
+static int compare_input_lengths(const void * first, const void * second)
+{
+	const seed_file_t * a = &inputs->seeds[*(const int *)first], * b = &inputs->seeds[*(const int *)second];
+	if (a->length != b->length)
+		return a->length < b->length ? -1 : 1;
+	return *(const int *)first - *(const int *)second;
+}
+
+//The rarest features are covered first, as afl-cmin does
+static uint32_t * feature_counts = NULL;
+static int compare_feature_counts(const void * first, const void * second)
+{
+	uint32_t a = *(const uint32_t *)first, b = *(const uint32_t *)second;
+	if (feature_counts[a] != feature_counts[b])
+		return feature_counts[a] < feature_counts[b] ? -1 : 1;
+	return a < b ? -1 : a > b;
+}
+
+int main(int argc, char ** argv)
+{
+	minimizer_worker_t * workers;
+	char *driver_name, *driver_options = NULL, *logging_options = NULL,
+		*instrumentation_name = NULL, *instrumentation_options = NULL,
+		*input_directory, *output_file;
+	int num_workers = 1, num_inputs, num_kept = 0, * order = NULL, input, i;
+	uint32_t * best_input = NULL, * features = NULL, num_words = 0, feature;
+	uint64_t * covered = NULL, word, new_bits;
+	size_t j, num_features = 0, total_features = 0;
+	char * keep = NULL;
+	feature_set_t * set;
+	FILE * fp;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (argc < 5)
+	{
+		usage(argv[0]);
+	}
+
+	driver_name = argv[1];
+	instrumentation_name = argv[2];
+	input_directory = argv[3];
+	output_file = argv[4];
+	for (i = 5; i < argc; i++)
+	{
+		IF_ARG_OPTION("-d", driver_options)
+		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-w", num_workers)
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have at least one worker.", num_workers);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	//Map each of the inputs once, skipping empty files and duplicates
+	inputs = load_seed_directory(input_directory);
+	if (!inputs)
+		FATAL_MSG("Could not find any non-empty input files in %s", input_directory);
+	num_inputs = (int)inputs->count;
+	if (num_workers > num_inputs)
+		num_workers = num_inputs;
+
+	instrumentation = instrumentation_factory(instrumentation_name);
+	if (!instrumentation)
+		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
+	if (!instrumentation->get_trace_bits)
+	{
+		if (!instrumentation->get_edges)
+			FATAL_MSG("Instrumentation '%s' does not support a coverage bitmap or the ability to get a list of edges",
+				instrumentation_name);
+		use_edges = 1;
+		if (instrumentation_options)
+			instrumentation_options = add_int_option_to_json(instrumentation_options, "edges", 1);
+		else
+			instrumentation_options = "{\"edges\": 1}";
+	}
+
+	workers = (minimizer_worker_t *)calloc(num_workers, sizeof(minimizer_worker_t));
+	feature_sets = (feature_set_t *)calloc(num_inputs, sizeof(feature_set_t));
+	minimizer_mutex = create_mutex();
+	if (!workers || !feature_sets || !minimizer_mutex)
+		FATAL_MSG("Couldn't allocate the state for %d workers", num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].instrumentation_state = instrumentation->create(instrumentation_options, NULL);
+		if (!workers[i].instrumentation_state)
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		workers[i].driver = driver_worker_factory(driver_name, driver_options, i, instrumentation,
+			workers[i].instrumentation_state, NULL, NULL);
+		if (!workers[i].driver)
+			FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options ? driver_options : "none");
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Run the inputs ////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	INFO_MSG("Running %d inputs with %d workers", num_inputs, num_workers);
+	if (num_workers == 1)
+		minimizer_worker_thread(&workers[0]);
+	else
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			if (create_thread(&workers[i].thread, minimizer_worker_thread, &workers[i]))
+				FATAL_MSG("Failed to start worker %d", i);
+		}
+		for (i = 0; i < num_workers; i++)
+			join_thread(workers[i].thread);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Pick the inputs to keep ///////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	for (input = 0; input < num_inputs; input++)
+	{
+		set = &feature_sets[input];
+		if (set->num_words && set->indices[set->num_words - 1] + 1 > num_words)
+			num_words = set->indices[set->num_words - 1] + 1;
+	}
+	order = (int *)malloc(num_inputs * sizeof(int));
+	keep = (char *)calloc(num_inputs, 1);
+	covered = (uint64_t *)calloc(num_words ? num_words : 1, sizeof(uint64_t));
+	feature_counts = (uint32_t *)calloc((num_words ? num_words : 1) * 64, sizeof(uint32_t));
+	best_input = (uint32_t *)malloc((num_words ? num_words : 1) * 64 * sizeof(uint32_t));
+	if (!order || !keep || !covered || !feature_counts || !best_input)
+		FATAL_MSG("Couldn't allocate the corpus minimization state");
+
+	//Find how many inputs hit each feature, and the smallest input that hits it
+	for (input = 0; input < num_inputs; input++)
+		order[input] = input;
+	qsort(order, num_inputs, sizeof(int), compare_input_lengths);
+	memset(best_input, 0xff, (size_t)num_words * 64 * sizeof(uint32_t));
+	for (i = 0; i < num_inputs; i++)
+	{
+		set = &feature_sets[order[i]];
+		for (j = 0; j < set->num_words; j++)
+		{
+			for (word = set->words[j]; word; word &= word - 1)
+			{
+				feature = set->indices[j] * 64 + CTZ64(word);
+				if (!feature_counts[feature]++)
+				{
+					best_input[feature] = order[i];
+					num_features++;
+				}
+			}
+		}
+	}
+
+	features = (uint32_t *)malloc((num_features ? num_features : 1) * sizeof(uint32_t));
+	if (!features)
+		FATAL_MSG("Couldn't allocate the corpus minimization state");
+	num_features = 0;
+	for (feature = 0; feature < num_words * 64; feature++)
+	{
+		if (feature_counts[feature])
+			features[num_features++] = feature;
+	}
+	qsort(features, num_features, sizeof(uint32_t), compare_feature_counts);
+
+	//Walk the features from rarest to most common, and keep the smallest input with each feature that
+	//isn't already covered by the inputs kept so far
+	for (j = 0; j < num_features; j++)
+	{
+		feature = features[j];
+		if (covered[feature / 64] & (1ULL << (feature % 64)))
+			continue;
+		input = best_input[feature];
+		keep[input] = 1;
+		num_kept++;
+
+		set = &feature_sets[input];
+		new_bits = 0;
+		for (i = 0; i < (int)set->num_words; i++)
+		{
+			new_bits += POPCOUNT64(set->words[i] & ~covered[set->indices[i]]);
+			covered[set->indices[i]] |= set->words[i];
+		}
+		total_features += (size_t)new_bits;
+		DEBUG_MSG("Keeping %s, which adds %llu features", inputs->seeds[input].filename, (unsigned long long)new_bits);
+	}
+
+	fp = fopen(output_file, "wb");
+	if (!fp)
+		FATAL_MSG("Couldn't open the file %s to write the inputs to keep to", output_file);
+	for (input = 0; input < num_inputs; input++)
+	{
+		if (keep[input])
+			fprintf(fp, "%s\n", inputs->seeds[input].filename);
+	}
+	fclose(fp);
+	CRITICAL_MSG("Kept %d of %d inputs, which hit %lu features", num_kept, num_inputs, (unsigned long)total_features);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	for (input = 0; input < num_inputs; input++)
+	{
+		free(feature_sets[input].indices);
+		free(feature_sets[input].words);
+	}
+	free(feature_sets);
+	free(order);
+	free(keep);
+	free(covered);
+	free(feature_counts);
+	free(best_input);
+	free(features);
+	free(edge_ids.edges);
+	free(edge_ids.slots);
+	free_seed_directory(inputs);
+
+	//Cleanup the objects and exit
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].driver->cleanup(workers[i].driver->state);
+		instrumentation->cleanup(workers[i].instrumentation_state);
+		free(workers[i].classified);
+		free(workers[i].edge_ids);
+		free(workers[i].driver);
+	}
+	free(workers);
+	destroy_mutex(minimizer_mutex);
+	free(instrumentation);
+	return 0;
+}
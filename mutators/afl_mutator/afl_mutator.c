@@ -10,6 +10,11 @@
 
 #include <string.h>
 
+//What the feedback said about flipping each byte in the walking byte stage
+#define FLIP8_UNKNOWN 0 //No feedback was given
+#define FLIP8_HASHED  1 //The input took the path in flip8_hashes
+#define FLIP8_CHANGED 2 //The input crashed, hung, or found a new path without a path hash
+
 struct afl_state
 {
 	int skip_deterministic;
@@ -18,6 +23,14 @@ struct afl_state
 	size_t input_length;
 	int iteration;
 
+	//The stage and stage iteration of the last mutation, so its feedback can be attributed to it
+	int last_stage;
+	uint64_t last_stage_cur;
+
+	//The feedback from the walking byte stage, which the effector map is built from when the stage ends
+	u8 * flip8_results;
+	uint64_t * flip8_hashes;
+
 	mutate_info_t info;
 };
 typedef struct afl_state afl_state_t;
@@ -34,7 +47,12 @@ mutator_t afl_mutator = {
 	afl_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	FUNCNAME(report_result),
+	NULL, //clone_state
+	NULL, //merge_state
+	NULL, //mutate_batch
+	FUNCNAME(mutate_growable)
 };
 
 static int afl_havoc(mutate_info_t * info, mutate_buffer_t * buf)
@@ -92,23 +110,105 @@ enum {
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////
-//// API methods ///////////////////////////////////////////////////////////////////////////
+//// Effector map //////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifndef ALL_MUTATORS_IN_ONE
+static int compare_uint64(const void * a, const void * b)
+{
+	uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+	return first < second ? -1 : first > second;
+}
+
+/**
+ * This function throws away the walking byte stage's feedback.
+ * @param state - the afl_state_t object to clear the feedback of
+ */
+static void clear_flip8_results(afl_state_t * state)
+{
+	free(state->flip8_results);
+	free(state->flip8_hashes);
+	state->flip8_results = NULL;
+	state->flip8_hashes = NULL;
+}
+
+/**
+ * This function builds the effector map from the walking byte stage's feedback, like afl-fuzz does.
+ * A block of the input is marked as an effector if flipping one of its bytes made the target take
+ * a different path.  afl-fuzz compares against the unmodified input's path, which this mutator never
+ * sees, so the most common path among the byte flips is used instead.  Bytes without feedback are
+ * conservatively treated as effectors, so without feedback nothing is skipped.
+ * @param state - the afl_state_t object to build the effector map for
+ */
+static void build_effector_map(afl_state_t * state)
+{
+	uint64_t * sorted, mode = 0;
+	size_t i, num_hashed = 0, run, best_run = 0, map_length, num_effectors = 0;
+	u8 * map;
+
+	if (!state->flip8_results || state->input_length < EFF_MIN_LEN) {
+		clear_flip8_results(state);
+		return;
+	}
+
+	//Find the most common path that the byte flips took
+	sorted = (uint64_t *)malloc(state->input_length * sizeof(uint64_t));
+	if (!sorted) {
+		clear_flip8_results(state);
+		return;
+	}
+	for (i = 0; i < state->input_length; i++) {
+		if (state->flip8_results[i] == FLIP8_HASHED)
+			sorted[num_hashed++] = state->flip8_hashes[i];
+	}
+	qsort(sorted, num_hashed, sizeof(uint64_t), compare_uint64);
+	for (i = 0; i < num_hashed; i += run) {
+		for (run = 1; i + run < num_hashed && sorted[i + run] == sorted[i]; run++);
+		if (run > best_run) {
+			best_run = run;
+			mode = sorted[i];
+		}
+	}
+	free(sorted);
+
+	map_length = (state->input_length + (1 << EFF_MAP_SCALE2) - 1) >> EFF_MAP_SCALE2;
+	map = (u8 *)calloc(map_length, 1);
+	if (!map) {
+		clear_flip8_results(state);
+		return;
+	}
+
+	//Like afl-fuzz, always fuzz the first and last blocks
+	map[0] = map[map_length - 1] = 1;
+	for (i = 0; i < state->input_length; i++) {
+		if (state->flip8_results[i] != FLIP8_HASHED || state->flip8_hashes[i] != mode)
+			map[i >> EFF_MAP_SCALE2] = 1;
+	}
+	clear_flip8_results(state);
+
+	//If nearly everything is an effector, don't bother with the map
+	for (i = 0; i < map_length; i++)
+		num_effectors += map[i];
+	if (num_effectors * 100 >= map_length * EFF_MAX_PERC) {
+		free(map);
+		map = NULL;
+	}
+	set_effector_map(&state->info, map, map_length);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// API methods ///////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
  * This function fills in m with all of the function pointers for this mutator.
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-AFL_MUTATOR_API void init(mutator_t * m)
+AFL_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &afl_mutator, sizeof(mutator_t));
 }
 
-#endif
-
 /**
  * This function creates and initializes a afl_state_t object based on the passed in JSON options.
  * @param options - a JSON of options for the afl mutator
@@ -128,6 +228,7 @@ static afl_state_t * setup_options(char * options)
 		return NULL;
 	}
 	state->info.should_skip_previous = 1;
+	state->last_stage = -1;
 	if (!options || !strlen(options))
 		return state;
 
@@ -162,25 +263,29 @@ AFL_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * inp
 AFL_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 {
 	cleanup_mutate_info(&((afl_state_t *)mutator_state)->info);
+	clear_flip8_results((afl_state_t *)mutator_state);
 	GENERIC_MUTATOR_CLEANUP(afl_state_t)
 }
 
-static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe)
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe,
+	growable_buffer_t * growable)
 {
 	afl_state_t * state = (afl_state_t *)mutator_state;
 	mutate_buffer_t buf;
-	int ret;
+	int ret, previous_stage;
 	if (buffer_length < state->input_length)
 		return -1;
 
 	buf.buffer = (uint8_t *)buffer;
 	buf.length = MIN(buffer_length, state->input_length);
 	buf.max_length = buffer_length;
+	mutate_buffer_set_growable(&buf, growable);
 	memcpy(buf.buffer, state->input, buf.length);
 
-	if(is_thread_safe && take_mutex(state->info.mutate_mutex))
+	if(is_thread_safe && take_lock(state->info.mutate_mutex))
 		return -1;
 	state->iteration++;
+	previous_stage = state->info.stage;
 	while (1) {
 		ret = mutate_one(&state->info, &buf, mutate_funcs, ARRAY_SIZE(mutate_funcs));
 		if (ret != MUTATOR_DONE)
@@ -191,7 +296,14 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 		state->skip_deterministic = 1;
 		state->info.queue_cycle++;
 	}
-	if (is_thread_safe && release_mutex(state->info.mutate_mutex))
+
+	//mutate_one moves stage_cur past the iteration it just did
+	state->last_stage = state->info.stage;
+	state->last_stage_cur = state->info.stage_cur - 1;
+	if (previous_stage <= STAGE_FLIP8 && state->info.stage > STAGE_FLIP8)
+		build_effector_map(state);
+
+	if (is_thread_safe && release_lock(state->info.mutate_mutex))
 		return -1;
 
 	return ret;
@@ -207,7 +319,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
  */
 AFL_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
 {
-	return mutate_inner(mutator_state, buffer, buffer_length, 0);
+	return mutate_inner(mutator_state, buffer, buffer_length, 0, NULL);
 }
 
 /**
@@ -226,6 +338,19 @@ AFL_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffe
 	SINGLE_INPUT_MUTATE_EXTENDED(afl_state_t, state->info.mutate_mutex);
 }
 
+/**
+ * This function will mutate the input given in the create function into a growable buffer, growing the
+ * buffer when a mutation needs more room than it has.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+AFL_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_GROWABLE(afl_state_t, state->info.mutate_mutex);
+}
+
 /**
  * This function will return the state of the mutator.  The returned value can be used to restart the
  * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
@@ -237,6 +362,7 @@ AFL_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 {
 	afl_state_t * state = (afl_state_t *)mutator_state;
 	json_t *state_obj, *temp;
+	uint64_t position;
 	char * ret;
 
 	state_obj = json_object();
@@ -244,6 +370,10 @@ AFL_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 	ADD_INT(temp, state->skip_deterministic, state_obj, "skip_deterministic");
 	if (!add_mutate_info_to_json(state_obj, &state->info))
 		return NULL;
+	position = get_stage_position(&state->info, mutate_funcs, ARRAY_SIZE(mutate_funcs), state->input_length);
+	if (position != STAGE_NOT_DETERMINISTIC) {
+		ADD_UINT64T(temp, position, state_obj, "position");
+	}
 	ret = json_dumps(state_obj, 0);
 	json_decref(state_obj);
 	return ret;
@@ -260,12 +390,22 @@ AFL_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state)
 {
 	afl_state_t * current_state = (afl_state_t *)mutator_state;
 	int result, temp_int;
+	uint64_t position;
 	if (!state)
 		return 1;
 	GET_INT(temp_int, state, current_state->iteration, "iteration", result);
 	GET_INT(temp_int, state, current_state->skip_deterministic, "skip_deterministic", result);
 	if (get_mutate_info_from_json(state, &current_state->info))
 		return 1;
+
+	//The position in the deterministic stages takes precedence over the stage and stage_cur, so that a
+	//saved state can be moved to any point in the stages by changing one number
+	position = get_uint64t_options(state, "position", &result);
+	if (result > 0 && set_stage_position(&current_state->info, mutate_funcs, ARRAY_SIZE(mutate_funcs),
+		current_state->input_length, position))
+		return 1;
+	clear_flip8_results(current_state);
+	current_state->last_stage = -1;
 	return 0;
 }
 
@@ -289,9 +429,55 @@ AFL_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state)
  */
 AFL_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
+	//The effector map and splice candidates describe the old input
+	clear_flip8_results((afl_state_t *)mutator_state);
+	set_effector_map(&((afl_state_t *)mutator_state)->info, NULL, 0);
+	clear_splice_candidates(&((afl_state_t *)mutator_state)->info);
+	((afl_state_t *)mutator_state)->last_stage = -1;
 	GENERIC_MUTATOR_SET_INPUT(afl_state_t);
 }
 
+/**
+ * This function tells the mutator how the last mutated input fared.  The results of the walking byte
+ * stage are used to build an effector map, which lets the arithmetic and interesting value stages skip
+ * the parts of the input that don't change the target's path.  The results of the havoc stage are used
+ * to schedule the havoc operators, if the schedule_operators option is set.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param fuzz_result - the FUZZ_ result of testing the last mutated input
+ * @param new_path - whether the last mutated input found a new path
+ * @param path_hash - the hash of the last mutated input's path, or NULL if it's unknown
+ */
+AFL_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash)
+{
+	afl_state_t * state = (afl_state_t *)mutator_state;
+	uint64_t index;
+
+	if (take_lock(state->info.mutate_mutex))
+		return;
+
+	index = state->last_stage_cur;
+	if (state->last_stage == STAGE_FLIP8 && index < state->input_length && state->input_length >= EFF_MIN_LEN)
+	{
+		if (!state->flip8_results) {
+			state->flip8_results = (u8 *)calloc(state->input_length, 1);
+			state->flip8_hashes = (uint64_t *)calloc(state->input_length, sizeof(uint64_t));
+		}
+		if (state->flip8_results && state->flip8_hashes) {
+			if (fuzz_result == FUZZ_NONE && path_hash) {
+				state->flip8_results[index] = FLIP8_HASHED;
+				state->flip8_hashes[index] = *path_hash;
+			} else if (fuzz_result != FUZZ_NONE || new_path > 0)
+				state->flip8_results[index] = FLIP8_CHANGED;
+		}
+		else
+			clear_flip8_results(state);
+	}
+	else if (state->last_stage == STAGE_HAVOC || state->last_stage == STAGE_SPLICE)
+		report_mutate_result(&state->info, fuzz_result, new_path);
+
+	release_lock(state->info.mutate_mutex);
+}
+
 /**
  * Obtains information about the inputs that were given to the mutator when it was created
  * @param mutator_state - a mutator specific structure previously created by the create function.
@@ -319,6 +505,9 @@ AFL_MUTATOR_API int FUNCNAME(help)(char ** help_str)
 "                          mangling input\n"
 "  havoc_div             A divisor for determining the number of rounds that\n"
 "                          the havoc stage should run (typically 1, 2, 5, or 10)\n"
+"  num_shards            Split the deterministic mutations into this many equal\n"
+"                          ranges and only do one of them, so the work on an\n"
+"                          input can be divided between several fuzzers\n"
 "  perf_score            A performance score used to determine how long to run\n"
 "                          the havoc and splice stages.  Typically 100, higher\n"
 "                          results in a larger number of mutations in these\n"
@@ -329,9 +518,17 @@ AFL_MUTATOR_API int FUNCNAME(help)(char ** help_str)
 "                          generator\n"
 "  random_state1         The second half of the seed to afl's random number\n"
 "                          generator\n"
+"  schedule_operators    Set to 1 to favor the havoc operators that have found\n"
+"                          new paths and crashes recently, rather than choosing\n"
+"                          them uniformly\n"
+"  shard                 Which of the num_shards ranges to do, from 0 to\n"
+"                          num_shards - 1\n"
 "  skip_deterministic    Instruct AFL to skip the deterministic mutations\n"
 "  splice_filenames      An array of files to use during afl's splice stage,\n"
 "                          for mixing with the input\n"
+"  splice_directory      A directory of files, such as a corpus, to use during\n"
+"                          afl's splice stage along with splice_filenames.  The\n"
+"                          files are mapped read-only rather than copied\n"
 "\n"
 	);
 }
@@ -27,7 +27,6 @@ BF_MUTATOR_API int FUNCNAME(get_total_iteration_count)(void * mutator_state);
 BF_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
 BF_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 BF_MUTATOR_API int FUNCNAME(help)(char **help_str);
+BF_MUTATOR_API int FUNCNAME(mutate_batch)(void * mutator_state, char * arena, size_t capacity, size_t * offsets, size_t * lengths, size_t count);
 
-#ifndef ALL_MUTATORS_IN_ONE
-BF_MUTATOR_API void init(mutator_t * m);
-#endif
+BF_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
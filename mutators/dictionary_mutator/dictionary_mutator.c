@@ -22,7 +22,10 @@ struct dictionary_state
 };
 typedef struct dictionary_state dictionary_state_t;
 
+//The hinted stages try the tokens where the input already has a token, before the full sweep of every position
 static int(*const mutate_funcs[])(mutate_info_t *, mutate_buffer_t *) = {
+	dictionary_hint_overwrite,
+	dictionary_hint_insert,
 	dictionary_overwrite,
 	dictionary_insert,
 };
@@ -39,7 +42,12 @@ mutator_t dictionary_mutator = {
 	dictionary_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	NULL, //report_result
+	NULL, //clone_state
+	NULL, //merge_state
+	NULL, //mutate_batch
+	FUNCNAME(mutate_growable)
 };
 
 /**
@@ -47,17 +55,15 @@ mutator_t dictionary_mutator = {
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-#ifndef ALL_MUTATORS_IN_ONE
-DICTIONARY_MUTATOR_API void init(mutator_t * m)
+DICTIONARY_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &dictionary_mutator, sizeof(mutator_t));
 }
-#endif
 
 static dictionary_state_t * setup_options(char * options)
 {
 	dictionary_state_t * state;
-	char * operation_per_stage[] = { "overwrite", "insert" };
+	char * operation_per_stage[] = { "hint_overwrite", "hint_insert", "overwrite", "insert" };
 	int i;
 
 	state = (dictionary_state_t *)malloc(sizeof(dictionary_state_t));
@@ -94,6 +100,20 @@ static dictionary_state_t * setup_options(char * options)
 	return state;
 }
 
+/**
+ * Finds where the dictionary tokens are in the input, for the hinted dictionary stages.  The full
+ * dictionary stages skip these positions, so the hints are only built if the hinted stages will run.
+ * @param state - the dictionary_state_t with the input and dictionary to build the hints from
+ * @return - 0 on success, nonzero on failure
+ */
+static int update_hints(dictionary_state_t * state)
+{
+	if (state->info.one_stage_only && mutate_funcs[state->info.stage] != dictionary_hint_overwrite
+		&& mutate_funcs[state->info.stage] != dictionary_hint_insert)
+		return 0;
+	return build_dictionary_hints(&state->info, (u8 *)state->input, state->input_length);
+}
+
 /**
  * This function will allocate and initialize the mutator state used in the other Mutator API
  * functions.  
@@ -106,7 +126,22 @@ static dictionary_state_t * setup_options(char * options)
  */
 DICTIONARY_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length)
 {
-	GENERIC_MUTATOR_CREATE(dictionary_state_t, setup_options, FUNCNAME(cleanup));
+	dictionary_state_t * new_state = setup_options(options);
+	if (!new_state)
+		return NULL;
+	new_state->input = shared_input_get(input, input_length);
+	if (!new_state->input || !input_length)
+	{
+		FUNCNAME(cleanup)(new_state);
+		return NULL;
+	}
+	new_state->input_length = input_length;
+	if (update_hints(new_state) || (state && FUNCNAME(set_state)(new_state, state)))
+	{
+		FUNCNAME(cleanup)(new_state);
+		return NULL;
+	}
+	return new_state;
 }
 
 /**
@@ -121,7 +156,8 @@ DICTIONARY_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	GENERIC_MUTATOR_CLEANUP(dictionary_state_t)
 }
 
-static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe)
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe,
+	growable_buffer_t * growable)
 {
 	dictionary_state_t * state = (dictionary_state_t *)mutator_state;
 	mutate_buffer_t buf;
@@ -132,13 +168,14 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	buf.buffer = (uint8_t *)buffer;
 	buf.length = MIN(buffer_length, state->input_length);
 	buf.max_length = buffer_length;
+	mutate_buffer_set_growable(&buf, growable);
 	memcpy(buf.buffer, state->input, buf.length);
 
-	if(is_thread_safe && take_mutex(state->info.mutate_mutex))
+	if(is_thread_safe && take_lock(state->info.mutate_mutex))
 		return -1;
 	state->iteration++;
 	ret = mutate_one(&state->info, &buf, mutate_funcs, ARRAY_SIZE(mutate_funcs));
-	if (is_thread_safe && release_mutex(state->info.mutate_mutex))
+	if (is_thread_safe && release_lock(state->info.mutate_mutex))
 		return -1;
 	return ret;
 }
@@ -153,7 +190,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
  */
 DICTIONARY_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
 {
-	return mutate_inner(mutator_state, buffer, buffer_length, 0);
+	return mutate_inner(mutator_state, buffer, buffer_length, 0, NULL);
 }
 
 /**
@@ -172,6 +209,19 @@ DICTIONARY_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char
 	SINGLE_INPUT_MUTATE_EXTENDED(dictionary_state_t, state->info.mutate_mutex);
 }
 
+/**
+ * This function will mutate the input given in the create function into a growable buffer, growing the
+ * buffer when a mutation needs more room than it has.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+DICTIONARY_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_GROWABLE(dictionary_state_t, state->info.mutate_mutex);
+}
+
 /**
  * This function will return the state of the mutator.  The returned value can be used to restart the
  * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
@@ -233,7 +283,17 @@ DICTIONARY_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state)
  */
 DICTIONARY_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
-	GENERIC_MUTATOR_SET_INPUT(dictionary_state_t);
+	dictionary_state_t * state = (dictionary_state_t *)mutator_state;
+	char * shared_input = shared_input_get(new_input, input_length);
+	if (!shared_input)
+		return -1;
+	shared_input_release(state->input);
+	state->input = shared_input;
+	state->input_length = input_length;
+	//The hints describe where the tokens are in the old input
+	if (update_hints(state))
+		return -1;
+	return 0;
 }
 
 /**
@@ -262,7 +322,11 @@ DICTIONARY_MUTATOR_API int FUNCNAME(help)(char **help_str)
 "  dictionary            A file or directory containing dictionary to use while\n"
 "                          mangling input\n"
 "  operation             The operation to perform with each dictionary item.\n"
-"                          Either, overwrite or insert.  Default option is both.\n"
+"                          Either hint_overwrite, hint_insert, overwrite, or\n"
+"                          insert.  The hint operations only use the positions\n"
+"                          where a dictionary item starts or ends in the input.\n"
+"                          Default option is all four, with the hint operations\n"
+"                          first.\n"
 "  random_state0         The first half of the seed to afl's random number\n"
 "                          generator\n"
 "  random_state1         The second half of the seed to afl's random number\n"
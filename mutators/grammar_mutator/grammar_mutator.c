@@ -0,0 +1,1496 @@
+#include "grammar_mutator.h"
+#include <mutators.h>
+
+#include <utils.h>
+#include <jansson.h>
+#include <jansson_helper.h>
+#include <global_types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The grammar mutator generates and mutates derivation trees of a context free grammar, so that every input
+//it makes is one that the target's parser accepts.  The grammar is compiled into tables when the mutator is
+//created, and the trees are arrays of rule indices in preorder, so that every subtree is a contiguous run
+//of nodes.  Replacing a subtree is then a copy of three runs into a preallocated tree, and serializing a tree
+//walks it with an explicit stack, writing the terminals straight into the mutate buffer.
+//
+//The input, the splice files, and (unless splice_queue is disabled) each input the mutator is given
+//afterwards are parsed with the grammar, and their subtrees are spliced into the mutated trees in place of
+//subtrees of the same nonterminal.  Inputs that don't parse are replaced with trees generated from the
+//start symbol.
+
+//The most nonterminals that parsing an input can nest, which bounds the recursion of the parser
+#define GRAMMAR_MAX_PARSE_DEPTH 1024
+//The most steps that finding the derivation tree of a parsed input can take, so that an ambiguous grammar
+//can't take exponential time
+#define GRAMMAR_MAX_BUILD_STEPS 1000000
+//The most nodes of the splice files' and the queue's trees that are kept to splice with
+#define GRAMMAR_MAX_SPLICE_NODES (1 << 20)
+//How many times a mutation that doesn't fit in the mutate buffer is retried before it's truncated
+#define GRAMMAR_FIT_ATTEMPTS 8
+
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)  (((a) > (b)) ? (a) : (b))
+
+//A symbol of a rule: a nonterminal's index when it's zero or more, or otherwise the terminal ~symbol
+typedef int32_t grammar_symbol_t;
+#define IS_TERMINAL(symbol) ((symbol) < 0)
+
+typedef struct grammar_terminal
+{
+	uint32_t offset;        //Where the terminal's string starts in the grammar's text
+	uint32_t length;
+} grammar_terminal_t;
+
+typedef struct grammar_rule
+{
+	uint32_t nonterminal;   //The nonterminal that this rule expands
+	uint32_t first_symbol;  //Where the rule's symbols start in the grammar's symbols
+	uint32_t symbol_count;
+	uint32_t child_count;   //How many of the symbols are nonterminals, i.e. the number of children of its nodes
+	uint32_t min_depth;     //The depth of the shallowest tree that starts with this rule
+} grammar_rule_t;
+
+typedef struct grammar_nonterminal
+{
+	uint32_t first_rule;    //The nonterminal's rules are contiguous in the grammar's rules
+	uint32_t rule_count;
+	uint32_t min_depth;     //The depth of the shallowest tree of this nonterminal
+	uint32_t min_rule;      //The rule that starts that tree
+} grammar_nonterminal_t;
+
+//A grammar compiled into tables
+typedef struct grammar
+{
+	grammar_nonterminal_t * nonterminals;
+	uint32_t nonterminal_count;
+	grammar_rule_t * rules;
+	uint32_t rule_count;
+	grammar_symbol_t * symbols;
+	uint32_t symbol_count;
+	grammar_terminal_t * terminals;
+	uint32_t terminal_count;
+	char * text;            //The strings of the terminals, one after another
+	uint32_t text_length;
+	uint32_t start;         //The nonterminal that the inputs are derived from
+} grammar_t;
+
+//A derivation tree, as the rule of each node in preorder.  The children of a node are the nodes of the
+//nonterminals in its rule, in order.
+typedef struct grammar_tree
+{
+	uint32_t * rules;
+	uint32_t * sizes;       //The number of nodes in each node's subtree
+	uint32_t length;
+	uint32_t capacity;
+} grammar_tree_t;
+
+struct grammar_state
+{
+	char * input;
+	size_t input_length;
+
+	//Protects the fields below, i.e. the iteration count, random state, and the trees being mutated
+	lock_t mutate_mutex;
+
+	int iteration;
+	uint64_t random_state[2];
+
+	char * grammar_filename;
+	char * start;
+	int max_depth;
+	int max_nodes;
+	int max_parse_length;
+	int splice_queue;
+	char ** splice_filenames;
+	size_t splice_filenames_count;
+	char * splice_directory;
+
+	grammar_t grammar;
+	grammar_tree_t input_tree;      //The input's derivation tree, which is empty if the input didn't parse
+	grammar_tree_t trees[2];        //The mutations are made in these trees, alternately
+	grammar_tree_t generated;       //New subtrees are generated in this tree
+	uint32_t * depths;              //The depth of each node of the tree being mutated
+	uint32_t * stack;               //Used to generate and serialize the trees without recursion
+
+	//The trees of the splice files and of the inputs the mutator was given, one after another, and their
+	//nodes grouped by nonterminal.  The nodes of nonterminal i are splice_index[splice_index_start[i]] up
+	//to splice_index[splice_index_start[i + 1]].
+	grammar_tree_t splice_tree;
+	uint32_t * splice_index;
+	uint32_t * splice_index_start;
+	uint64_t * spliced_hashes;      //The hashes of the inputs whose trees are in the splice tree
+	size_t spliced_count;
+};
+typedef struct grammar_state grammar_state_t;
+
+mutator_t grammar_mutator = {
+	FUNCNAME(create),
+	FUNCNAME(cleanup),
+	FUNCNAME(mutate),
+	FUNCNAME(mutate_extended),
+	FUNCNAME(get_state),
+	grammar_free_state,
+	FUNCNAME(set_state),
+	FUNCNAME(get_current_iteration),
+	grammar_get_total_iteration_count,
+	FUNCNAME(get_input_info),
+	FUNCNAME(set_input),
+	FUNCNAME(help),
+	NULL, //report_result
+	NULL, //clone_state
+	NULL, //merge_state
+	NULL, //mutate_batch
+	FUNCNAME(mutate_growable)
+};
+
+/**
+ * This function fills in m with all of the function pointers for this mutator.
+ * @param m - a pointer to a mutator_t structure
+ * @return none
+ */
+GRAMMAR_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
+{
+	memcpy(m, &grammar_mutator, sizeof(mutator_t));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Random numbers ////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+#define RAND(state,x)    ((x)?(rnd64(state)%(x)):0)
+
+/*
+ * xoroshiro128plus by David Blackman and Sebastiano Vigna
+ */
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rnd64(grammar_state_t * state)
+{
+	const uint64_t s0 = state->random_state[0];
+	uint64_t s1 = state->random_state[1];
+	const uint64_t result = s0 + s1;
+	s1 ^= s0;
+	state->random_state[0] = rotl(s0, 55) ^ s1 ^ (s1 << 14);
+	state->random_state[1] = rotl(s1, 36);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Grammar compilation ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * This function makes room for one more element in an array that's grown as the grammar is compiled.
+ * @param array - a pointer to the array, which is reallocated when it's full
+ * @param capacity - a pointer to the number of elements the array has room for
+ * @param count - the number of elements in the array
+ * @param element_size - the size of each element
+ * @return - zero on success, or non-zero if the array couldn't be grown
+ */
+static int grow_array(void ** array, uint32_t * capacity, uint32_t count, size_t element_size)
+{
+	uint32_t new_capacity;
+	void * new_array;
+
+	if (count < *capacity)
+		return 0;
+	new_capacity = *capacity ? *capacity * 2 : 64;
+	new_array = realloc(*array, new_capacity * element_size);
+	if (!new_array)
+		return 1;
+	*array = new_array;
+	*capacity = new_capacity;
+	return 0;
+}
+
+static int compare_names(const void * a, const void * b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/**
+ * This function adds a terminal to the rule that's being compiled.
+ * @param grammar - the grammar being compiled
+ * @param symbols_capacity - the number of symbols that the grammar has room for
+ * @param terminals_capacity - the number of terminals that the grammar has room for
+ * @param text_capacity - the number of bytes of terminal strings that the grammar has room for
+ * @param text - the terminal's string
+ * @param length - the length of text
+ * @return - zero on success, or non-zero on failure
+ */
+static int add_terminal(grammar_t * grammar, uint32_t * symbols_capacity, uint32_t * terminals_capacity,
+	uint32_t * text_capacity, const char * text, size_t length)
+{
+	char * new_text;
+	uint32_t new_capacity;
+
+	if (!length)
+		return 0;
+	if (grammar->text_length + length > *text_capacity) {
+		new_capacity = MAX(*text_capacity * 2, grammar->text_length + (uint32_t)length);
+		new_text = (char *)realloc(grammar->text, new_capacity);
+		if (!new_text)
+			return 1;
+		grammar->text = new_text;
+		*text_capacity = new_capacity;
+	}
+	if (grow_array((void **)&grammar->terminals, terminals_capacity, grammar->terminal_count, sizeof(grammar_terminal_t))
+		|| grow_array((void **)&grammar->symbols, symbols_capacity, grammar->symbol_count, sizeof(grammar_symbol_t)))
+		return 1;
+
+	memcpy(grammar->text + grammar->text_length, text, length);
+	grammar->terminals[grammar->terminal_count].offset = grammar->text_length;
+	grammar->terminals[grammar->terminal_count].length = (uint32_t)length;
+	grammar->text_length += (uint32_t)length;
+	grammar->symbols[grammar->symbol_count++] = ~(grammar_symbol_t)grammar->terminal_count++;
+	return 0;
+}
+
+/**
+ * This function finds the shallowest tree of each nonterminal, which the generator falls back to when a
+ * tree gets too deep.
+ * @param grammar - the grammar to find the shallowest trees of
+ * @return - zero on success, or non-zero if a nonterminal can't derive a finite input
+ */
+static int find_min_depths(grammar_t * grammar)
+{
+	grammar_rule_t * rule;
+	grammar_symbol_t symbol;
+	uint32_t i, j, depth;
+	int changed = 1;
+
+	for (i = 0; i < grammar->nonterminal_count; i++)
+		grammar->nonterminals[i].min_depth = UINT32_MAX;
+	while (changed)
+	{
+		changed = 0;
+		for (i = 0; i < grammar->rule_count; i++)
+		{
+			rule = &grammar->rules[i];
+			depth = 1;
+			for (j = 0; j < rule->symbol_count && depth != UINT32_MAX; j++) {
+				symbol = grammar->symbols[rule->first_symbol + j];
+				if (!IS_TERMINAL(symbol))
+					depth = grammar->nonterminals[symbol].min_depth == UINT32_MAX ? UINT32_MAX
+						: MAX(depth, grammar->nonterminals[symbol].min_depth + 1);
+			}
+			rule->min_depth = depth;
+			if (depth < grammar->nonterminals[rule->nonterminal].min_depth) {
+				grammar->nonterminals[rule->nonterminal].min_depth = depth;
+				grammar->nonterminals[rule->nonterminal].min_rule = i;
+				changed = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < grammar->nonterminal_count; i++) {
+		if (grammar->nonterminals[i].min_depth == UINT32_MAX)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function compiles a grammar file into tables.  The file has a JSON object, with the name of each
+ * nonterminal mapped to an array of its rules.  A rule is a string in which the names of nonterminals,
+ * such as <expr>, are replaced with a tree of that nonterminal, and everything else is a terminal.
+ * @param grammar - used to return the compiled grammar, which should be freed with free_grammar
+ * @param filename - the grammar file
+ * @param start - the name of the nonterminal that the inputs are derived from
+ * @return - zero on success, or non-zero on failure
+ */
+static int compile_grammar(grammar_t * grammar, char * filename, char * start)
+{
+	uint32_t rules_capacity = 0, symbols_capacity = 0, terminals_capacity = 0, text_capacity = 0;
+	const char ** names = NULL, ** found, * key, * text, * name_end, * literal;
+	json_t * root, * value, * alternative;
+	json_error_t error;
+	grammar_rule_t * rule;
+	grammar_symbol_t symbol;
+	char name[256];
+	size_t i, j, name_length;
+	int ret = 1;
+
+	memset(grammar, 0, sizeof(grammar_t));
+	root = json_load_file(filename, 0, &error);
+	if (!root || !json_is_object(root) || !json_object_size(root)) {
+		printf("Could not load the grammar from %s: %s\n", filename, root ? "it isn't a JSON object of rules" : error.text);
+		goto cleanup;
+	}
+
+	//Number the nonterminals in order of their names, so that the tables don't depend on the JSON's hashing
+	grammar->nonterminal_count = (uint32_t)json_object_size(root);
+	names = (const char **)malloc(grammar->nonterminal_count * sizeof(char *));
+	grammar->nonterminals = (grammar_nonterminal_t *)calloc(grammar->nonterminal_count, sizeof(grammar_nonterminal_t));
+	if (!names || !grammar->nonterminals)
+		goto cleanup;
+	i = 0;
+	json_object_foreach(root, key, value)
+		names[i++] = key;
+	qsort(names, grammar->nonterminal_count, sizeof(char *), compare_names);
+
+	for (i = 0; i < grammar->nonterminal_count; i++)
+	{
+		value = json_object_get(root, names[i]);
+		if (!json_is_array(value) || !json_array_size(value)) {
+			printf("The nonterminal %s in the grammar doesn't have an array of rules\n", names[i]);
+			goto cleanup;
+		}
+		grammar->nonterminals[i].first_rule = grammar->rule_count;
+		grammar->nonterminals[i].rule_count = (uint32_t)json_array_size(value);
+
+		for (j = 0; j < json_array_size(value); j++)
+		{
+			alternative = json_array_get(value, j);
+			if (!json_is_string(alternative)
+				|| grow_array((void **)&grammar->rules, &rules_capacity, grammar->rule_count, sizeof(grammar_rule_t))) {
+				printf("The rules of the nonterminal %s in the grammar must be strings\n", names[i]);
+				goto cleanup;
+			}
+			rule = &grammar->rules[grammar->rule_count++];
+			rule->nonterminal = (uint32_t)i;
+			rule->first_symbol = grammar->symbol_count;
+			rule->child_count = 0;
+
+			//Split the rule into the names of nonterminals and the terminals between them.  Anything in angle
+			//brackets that isn't the name of a nonterminal is part of a terminal.
+			literal = text = json_string_value(alternative);
+			while (*text)
+			{
+				name_end = text + 1;
+				if (*text == '<') {
+					while (*name_end && *name_end != '<' && *name_end != '>' && *name_end != ' ')
+						name_end++;
+				}
+				if (*text != '<' || *name_end != '>') {
+					text = *text == '<' ? name_end : text + 1;
+					continue;
+				}
+				name_length = name_end + 1 - text;
+				found = NULL;
+				if (name_length < sizeof(name)) {
+					memcpy(name, text, name_length);
+					name[name_length] = 0;
+					key = name;
+					found = (const char **)bsearch(&key, names, grammar->nonterminal_count, sizeof(char *), compare_names);
+				}
+				if (!found) {
+					text = name_end;
+					continue;
+				}
+
+				if (add_terminal(grammar, &symbols_capacity, &terminals_capacity, &text_capacity, literal, text - literal)
+					|| grow_array((void **)&grammar->symbols, &symbols_capacity, grammar->symbol_count, sizeof(grammar_symbol_t)))
+					goto cleanup;
+				symbol = (grammar_symbol_t)(found - names);
+				grammar->symbols[grammar->symbol_count++] = symbol;
+				rule->child_count++;
+				literal = text = name_end + 1;
+			}
+			if (add_terminal(grammar, &symbols_capacity, &terminals_capacity, &text_capacity, literal, text - literal))
+				goto cleanup;
+			rule->symbol_count = grammar->symbol_count - rule->first_symbol;
+		}
+	}
+
+	key = start;
+	found = (const char **)bsearch(&key, names, grammar->nonterminal_count, sizeof(char *), compare_names);
+	if (!found) {
+		printf("The grammar doesn't have the start symbol %s\n", start);
+		goto cleanup;
+	}
+	grammar->start = (uint32_t)(found - names);
+	if (find_min_depths(grammar)) {
+		printf("Some of the nonterminals in the grammar can't derive an input of a finite length\n");
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	free(names);
+	json_decref(root);
+	return ret;
+}
+
+static void free_grammar(grammar_t * grammar)
+{
+	free(grammar->nonterminals);
+	free(grammar->rules);
+	free(grammar->symbols);
+	free(grammar->terminals);
+	free(grammar->text);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Derivation trees //////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+static int init_tree(grammar_tree_t * tree, uint32_t capacity)
+{
+	tree->rules = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+	tree->sizes = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+	tree->length = 0;
+	tree->capacity = capacity;
+	return !tree->rules || !tree->sizes;
+}
+
+static void free_tree(grammar_tree_t * tree)
+{
+	free(tree->rules);
+	free(tree->sizes);
+}
+
+/**
+ * This function finds the size of each subtree of a run of whole trees, from their rules.
+ * @param grammar - the grammar of the trees
+ * @param rules - the rules of the trees' nodes in preorder
+ * @param sizes - used to return the number of nodes in each node's subtree
+ * @param length - the number of nodes
+ */
+static void compute_sizes(grammar_t * grammar, uint32_t * rules, uint32_t * sizes, uint32_t length)
+{
+	uint32_t i, child, end, children;
+
+	for (i = length; i > 0; i--)
+	{
+		end = i;
+		children = grammar->rules[rules[i - 1]].child_count;
+		for (child = 0; child < children && end < length; child++)
+			end += sizes[end];
+		sizes[i - 1] = end - (i - 1);
+	}
+}
+
+/**
+ * This function finds the depth of each node of a tree, the root being at depth zero.
+ * @param grammar - the grammar of the tree
+ * @param tree - the tree, whose sizes must be set
+ * @param depths - used to return the depth of each node
+ */
+static void compute_depths(grammar_t * grammar, grammar_tree_t * tree, uint32_t * depths)
+{
+	uint32_t i, child, node, children;
+
+	if (tree->length)
+		depths[0] = 0;
+	for (i = 0; i < tree->length; i++)
+	{
+		node = i + 1;
+		children = grammar->rules[tree->rules[i]].child_count;
+		for (child = 0; child < children; child++) {
+			depths[node] = depths[i] + 1;
+			node += tree->sizes[node];
+		}
+	}
+}
+
+/**
+ * This function generates a random tree of a nonterminal, appending its nodes to a tree.  The rules are
+ * picked at random, until a node is too deep or the tree is getting full, after which the rules that make
+ * the shallowest trees are used.
+ * @param state - the mutator state, whose stack is used to hold the nodes that are still to be generated
+ * @param tree - the tree to append the nodes to.  The sizes of the new nodes aren't set.
+ * @param nonterminal - the nonterminal to generate a tree of
+ * @param depth - the depth of the new tree's root in the tree that it will be part of
+ * @return - zero on success, or non-zero if the new tree doesn't fit
+ */
+static int generate_tree(grammar_state_t * state, grammar_tree_t * tree, uint32_t nonterminal, uint32_t depth)
+{
+	grammar_t * grammar = &state->grammar;
+	grammar_nonterminal_t * current;
+	grammar_rule_t * rule;
+	grammar_symbol_t symbol;
+	uint32_t top = 0, rule_index, i;
+
+	state->stack[top++] = nonterminal;
+	state->stack[top++] = depth;
+	while (top)
+	{
+		depth = state->stack[--top];
+		current = &grammar->nonterminals[state->stack[--top]];
+		if (tree->length + top / 2 >= tree->capacity)
+			return 1;
+
+		rule_index = current->first_rule + (uint32_t)RAND(state, current->rule_count);
+		if (depth + grammar->rules[rule_index].min_depth > (uint32_t)state->max_depth
+			|| tree->length + top / 2 + grammar->rules[rule_index].child_count > tree->capacity / 2)
+			rule_index = current->min_rule;
+		rule = &grammar->rules[rule_index];
+		if (tree->length + top / 2 + 1 + rule->child_count > tree->capacity)
+			return 1;
+		tree->rules[tree->length++] = rule_index;
+
+		//Push the children in reverse, so that they're generated in order
+		for (i = rule->symbol_count; i > 0; i--) {
+			symbol = grammar->symbols[rule->first_symbol + i - 1];
+			if (!IS_TERMINAL(symbol)) {
+				state->stack[top++] = (uint32_t)symbol;
+				state->stack[top++] = depth + 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function writes the input that a tree derives to a buffer, truncating it if it doesn't fit.
+ * @param state - the mutator state, whose stack is used to walk the tree
+ * @param tree - the tree to serialize
+ * @param buffer - the buffer to write the input to
+ * @param buffer_length - the size of buffer
+ * @return - the length of the whole input, which is more than buffer_length if it was truncated
+ */
+static size_t serialize_tree(grammar_state_t * state, grammar_tree_t * tree, char * buffer, size_t buffer_length)
+{
+	grammar_t * grammar = &state->grammar;
+	grammar_terminal_t * terminal;
+	grammar_rule_t * rule;
+	grammar_symbol_t symbol;
+	uint32_t top = 0, node = 0;
+	size_t length = 0;
+
+	if (!tree->length)
+		return 0;
+	state->stack[top++] = tree->rules[node++];
+	state->stack[top++] = 0;
+	while (top)
+	{
+		rule = &grammar->rules[state->stack[top - 2]];
+		if (state->stack[top - 1] == rule->symbol_count) {
+			top -= 2;
+			continue;
+		}
+		symbol = grammar->symbols[rule->first_symbol + state->stack[top - 1]++];
+		if (IS_TERMINAL(symbol)) {
+			terminal = &grammar->terminals[~symbol];
+			if (length < buffer_length)
+				memcpy(buffer + length, grammar->text + terminal->offset, MIN(terminal->length, buffer_length - length));
+			length += terminal->length;
+		} else {
+			state->stack[top++] = tree->rules[node++];
+			state->stack[top++] = 0;
+		}
+	}
+	return length;
+}
+
+/**
+ * This function replaces a subtree of a tree with another subtree, writing the result to another tree.
+ * @param grammar - the grammar of the trees
+ * @param source - the tree to replace the subtree of
+ * @param node - the root of the subtree to replace
+ * @param replacement - the rules of the replacement subtree's nodes, in preorder
+ * @param replacement_length - the number of nodes in the replacment subtree
+ * @param destination - used to return the tree with the subtree replaced
+ * @return - zero on success, or non-zero if the new tree doesn't fit
+ */
+static int replace_subtree(grammar_t * grammar, grammar_tree_t * source, uint32_t node, uint32_t * replacement,
+	uint32_t replacement_length, grammar_tree_t * destination)
+{
+	uint32_t size = source->sizes[node], suffix = source->length - node - size;
+
+	if (node + replacement_length + suffix > destination->capacity)
+		return 1;
+	memcpy(destination->rules, source->rules, node * sizeof(uint32_t));
+	memcpy(destination->rules + node, replacement, replacement_length * sizeof(uint32_t));
+	memcpy(destination->rules + node + replacement_length, source->rules + node + size, suffix * sizeof(uint32_t));
+	destination->length = node + replacement_length + suffix;
+	compute_sizes(grammar, destination->rules, destination->sizes, destination->length);
+	return 0;
+}
+
+/**
+ * This function mutates a tree once, by replacing a random subtree with a new tree of the same nonterminal,
+ * a subtree of the same nonterminal from the splice trees, or a copy of itself in place of one of its own
+ * subtrees of the same nonterminal, which nests it one more time.
+ * @param state - the mutator state
+ * @param source - the tree to mutate
+ * @param destination - used to return the mutated tree
+ * @return - zero on success, or non-zero if the mutated tree doesn't fit
+ */
+static int mutate_tree(grammar_state_t * state, grammar_tree_t * source, grammar_tree_t * destination)
+{
+	grammar_t * grammar = &state->grammar;
+	uint32_t node, nonterminal, candidates, donor, size, offset, other;
+
+	node = (uint32_t)RAND(state, source->length);
+	nonterminal = grammar->rules[source->rules[node]].nonterminal;
+	size = source->sizes[node];
+
+	switch (RAND(state, 3))
+	{
+	case 1: //Splice in a subtree of one of the other inputs
+		candidates = state->splice_index_start ?
+			state->splice_index_start[nonterminal + 1] - state->splice_index_start[nonterminal] : 0;
+		if (candidates) {
+			donor = state->splice_index[state->splice_index_start[nonterminal] + RAND(state, candidates)];
+			return replace_subtree(grammar, source, node, state->splice_tree.rules + donor,
+				state->splice_tree.sizes[donor], destination);
+		}
+		//fall through
+	case 2: //Replace a subtree of the same nonterminal with a copy of this subtree
+		if (size > 1) {
+			offset = (uint32_t)RAND(state, size - 1);
+			for (other = 0; other < size - 1; other++) {
+				donor = node + 1 + (offset + other) % (size - 1);
+				if (grammar->rules[source->rules[donor]].nonterminal == nonterminal)
+					return replace_subtree(grammar, source, donor, source->rules + node, size, destination);
+			}
+		}
+		//fall through
+	default: //Generate a new subtree
+		compute_depths(grammar, source, state->depths);
+		state->generated.length = 0;
+		if (generate_tree(state, &state->generated, nonterminal, state->depths[node]))
+			return 1;
+		return replace_subtree(grammar, source, node, state->generated.rules, state->generated.length, destination);
+	}
+}
+
+/**
+ * This function makes the next mutated tree, from the input's tree if it has one, or from scratch otherwise.
+ * @param state - the mutator state
+ * @return - the mutated tree, or NULL if the mutation didn't fit
+ */
+static grammar_tree_t * next_tree(grammar_state_t * state)
+{
+	grammar_tree_t * source = &state->input_tree;
+	int mutations, i;
+
+	if (!source->length) {
+		state->trees[0].length = 0;
+		if (generate_tree(state, &state->trees[0], state->grammar.start, 0))
+			return NULL;
+		compute_sizes(&state->grammar, state->trees[0].rules, state->trees[0].sizes, state->trees[0].length);
+		return &state->trees[0];
+	}
+
+	mutations = 1 << RAND(state, 3);
+	for (i = 0; i < mutations; i++) {
+		if (mutate_tree(state, source, &state->trees[i & 1]))
+			break;
+		source = &state->trees[i & 1];
+	}
+	return source == &state->input_tree ? NULL : source;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Parsing ///////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+//The parser finds every end of a match of each nonterminal that starts at each position of the input, and
+//remembers them, so that each is only matched once.  A left recursive nonterminal is matched again with
+//the ends it found so far, until it doesn't find any more.  Then one of the derivations of the whole input
+//is found, by trying the ends of each nonterminal in a rule that let the rest of the rule match.
+
+enum { PARSE_UNKNOWN, PARSE_ACTIVE, PARSE_DONE };
+
+typedef struct parse_entry
+{
+	uint32_t first;         //Where the ends of the matches start in the parser's ends
+	uint32_t count;
+	uint8_t status;
+	uint8_t recursed;       //Whether the nonterminal was matched again while it was being matched
+} parse_entry_t;
+
+typedef struct uint32_array
+{
+	uint32_t * data;
+	uint32_t length;
+	uint32_t capacity;
+} uint32_array_t;
+
+typedef struct parser
+{
+	grammar_t * grammar;
+	const char * input;
+	uint32_t length;
+	parse_entry_t * entries;    //The entry of nonterminal i at position j is entries[i * (length + 1) + j]
+	uint32_array_t ends;        //The sorted ends of each finished entry
+	uint32_array_t found;       //The ends of the entries that are being matched
+	uint32_array_t active;      //The nonterminal, start, and end of each nested node being built
+	grammar_tree_t * tree;
+	uint32_t depth;
+	uint32_t steps;
+	int failed;                 //Set when the parser runs out of memory, depth, or steps
+} parser_t;
+
+static int push_uint32(parser_t * parser, uint32_array_t * array, uint32_t value)
+{
+	if (grow_array((void **)&array->data, &array->capacity, array->length, sizeof(uint32_t))) {
+		parser->failed = 1;
+		return 1;
+	}
+	array->data[array->length++] = value;
+	return 0;
+}
+
+static int compare_uint32(const void * a, const void * b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static inline int match_terminal(parser_t * parser, grammar_symbol_t symbol, uint32_t position)
+{
+	grammar_terminal_t * terminal = &parser->grammar->terminals[~symbol];
+	return terminal->length <= parser->length - position
+		&& !memcmp(parser->input + position, parser->grammar->text + terminal->offset, terminal->length);
+}
+
+static parse_entry_t * parse_nonterminal(parser_t * parser, uint32_t nonterminal, uint32_t position);
+
+/**
+ * This function matches the rest of a rule, adding the end of each match to the parser's found ends.
+ * @param parser - the parser
+ * @param rule - the rule to match
+ * @param symbol_index - the index of the first symbol of the rule to match
+ * @param position - where in the input to match it
+ */
+static void parse_rule(parser_t * parser, grammar_rule_t * rule, uint32_t symbol_index, uint32_t position)
+{
+	grammar_symbol_t symbol;
+	parse_entry_t * entry;
+	uint32_t i;
+
+	for (; symbol_index < rule->symbol_count; symbol_index++)
+	{
+		symbol = parser->grammar->symbols[rule->first_symbol + symbol_index];
+		if (IS_TERMINAL(symbol)) {
+			if (!match_terminal(parser, symbol, position))
+				return;
+			position += parser->grammar->terminals[~symbol].length;
+			continue;
+		}
+
+		entry = parse_nonterminal(parser, (uint32_t)symbol, position);
+		for (i = 0; entry && i < entry->count && !parser->failed; i++) {
+			if (symbol_index + 1 == rule->symbol_count)
+				push_uint32(parser, &parser->found, parser->ends.data[entry->first + i]);
+			else
+				parse_rule(parser, rule, symbol_index + 1, parser->ends.data[entry->first + i]);
+		}
+		return;
+	}
+	push_uint32(parser, &parser->found, position);
+}
+
+/**
+ * This function finds the ends of the matches of a nonterminal that start at a position of the input.
+ * @param parser - the parser
+ * @param nonterminal - the nonterminal to match
+ * @param position - where in the input to match it
+ * @return - the nonterminal's entry at the position, or NULL if the parser failed
+ */
+static parse_entry_t * parse_nonterminal(parser_t * parser, uint32_t nonterminal, uint32_t position)
+{
+	parse_entry_t * entry = &parser->entries[nonterminal * (parser->length + 1) + position];
+	grammar_nonterminal_t * current = &parser->grammar->nonterminals[nonterminal];
+	uint32_t base, count, i;
+	int grew;
+
+	if (entry->status == PARSE_ACTIVE)
+		entry->recursed = 1;
+	if (entry->status != PARSE_UNKNOWN)
+		return entry;
+	if (parser->depth >= GRAMMAR_MAX_PARSE_DEPTH) {
+		parser->failed = 1;
+		return NULL;
+	}
+
+	parser->depth++;
+	entry->status = PARSE_ACTIVE;
+	base = parser->found.length;
+	do
+	{
+		entry->recursed = 0;
+		for (i = 0; i < current->rule_count && !parser->failed; i++)
+			parse_rule(parser, &parser->grammar->rules[current->first_rule + i], 0, position);
+
+		//Sort the ends and remove the duplicates, then keep them if there are more than last time
+		if (parser->found.length > base)
+			qsort(parser->found.data + base, parser->found.length - base, sizeof(uint32_t), compare_uint32);
+		for (i = base, count = 0; i < parser->found.length; i++) {
+			if (!count || parser->found.data[base + count - 1] != parser->found.data[i])
+				parser->found.data[base + count++] = parser->found.data[i];
+		}
+		grew = count > entry->count;
+		if (grew) {
+			entry->first = parser->ends.length;
+			entry->count = count;
+			for (i = 0; i < count && !parser->failed; i++)
+				push_uint32(parser, &parser->ends, parser->found.data[base + i]);
+		}
+		parser->found.length = base;
+	} while (grew && entry->recursed && !parser->failed);
+	entry->status = PARSE_DONE;
+	parser->depth--;
+	return parser->failed ? NULL : entry;
+}
+
+static int has_end(parser_t * parser, parse_entry_t * entry, uint32_t end)
+{
+	return entry->status == PARSE_DONE && entry->count
+		&& bsearch(&end, parser->ends.data + entry->first, entry->count, sizeof(uint32_t), compare_uint32);
+}
+
+/**
+ * This function checks whether the rest of a rule matches the input up to the given end, from the ends that
+ * the parser found, without building the derivation.
+ * @param parser - the parser, which has parsed the input
+ * @param rule - the rule to match
+ * @param symbol_index - the index of the first symbol of the rule to match
+ * @param position - where in the input the symbol starts
+ * @param end - where in the input the rule has to end
+ * @return - non-zero if the rest of the rule matches, or zero otherwise
+ */
+static int match_rule(parser_t * parser, grammar_rule_t * rule, uint32_t symbol_index, uint32_t position, uint32_t end)
+{
+	grammar_symbol_t symbol;
+	parse_entry_t * entry;
+	uint32_t i, match_end;
+
+	for (; symbol_index < rule->symbol_count; symbol_index++)
+	{
+		symbol = parser->grammar->symbols[rule->first_symbol + symbol_index];
+		if (IS_TERMINAL(symbol)) {
+			if (!match_terminal(parser, symbol, position))
+				return 0;
+			position += parser->grammar->terminals[~symbol].length;
+			continue;
+		}
+
+		entry = &parser->entries[symbol * (parser->length + 1) + position];
+		if (symbol_index + 1 == rule->symbol_count)
+			return has_end(parser, entry, end);
+		for (i = 0; entry->status == PARSE_DONE && i < entry->count; i++)
+		{
+			match_end = parser->ends.data[entry->first + i];
+			if (match_end > end || ++parser->steps > GRAMMAR_MAX_BUILD_STEPS)
+				break;
+			if (match_rule(parser, rule, symbol_index + 1, match_end, end))
+				return 1;
+		}
+		return 0;
+	}
+	return position == end;
+}
+
+static int build_nonterminal(parser_t * parser, uint32_t nonterminal, uint32_t start, uint32_t end);
+
+/**
+ * This function finds a derivation of the rest of a rule that ends at the given end, appending its nodes to
+ * the parser's tree.
+ * @param parser - the parser, which has parsed the input
+ * @param rule - the rule to derive
+ * @param symbol_index - the index of the first symbol of the rule to derive
+ * @param position - where in the input the symbol starts
+ * @param end - where in the input the rule's derivation has to end
+ * @return - non-zero if a derivation was found, or zero otherwise
+ */
+static int build_rule(parser_t * parser, grammar_rule_t * rule, uint32_t symbol_index, uint32_t position, uint32_t end)
+{
+	grammar_symbol_t symbol;
+	parse_entry_t * entry;
+	uint32_t i, mark, match_end;
+
+	for (; symbol_index < rule->symbol_count; symbol_index++)
+	{
+		symbol = parser->grammar->symbols[rule->first_symbol + symbol_index];
+		if (IS_TERMINAL(symbol)) {
+			if (!match_terminal(parser, symbol, position))
+				return 0;
+			position += parser->grammar->terminals[~symbol].length;
+			continue;
+		}
+
+		if (symbol_index + 1 == rule->symbol_count)
+			return build_nonterminal(parser, (uint32_t)symbol, position, end);
+		entry = &parser->entries[symbol * (parser->length + 1) + position];
+		for (i = 0; entry->status == PARSE_DONE && i < entry->count && !parser->failed; i++)
+		{
+			match_end = parser->ends.data[entry->first + i];
+			if (match_end > end)
+				break;
+			if (!match_rule(parser, rule, symbol_index + 1, match_end, end))
+				continue;
+			mark = parser->tree->length;
+			if (build_nonterminal(parser, (uint32_t)symbol, position, match_end)
+				&& build_rule(parser, rule, symbol_index + 1, match_end, end))
+				return 1;
+			parser->tree->length = mark;
+		}
+		return 0;
+	}
+	return position == end;
+}
+
+/**
+ * This function finds a derivation of a nonterminal that matches the input from start to end, appending its
+ * nodes to the parser's tree.
+ * @param parser - the parser, which has parsed the input
+ * @param nonterminal - the nonterminal to derive
+ * @param start - where in the input the derivation starts
+ * @param end - where in the input the derivation ends
+ * @return - non-zero if a derivation was found, or zero otherwise
+ */
+static int build_nonterminal(parser_t * parser, uint32_t nonterminal, uint32_t start, uint32_t end)
+{
+	grammar_nonterminal_t * current = &parser->grammar->nonterminals[nonterminal];
+	uint32_t i, mark;
+
+	if (!has_end(parser, &parser->entries[nonterminal * (parser->length + 1) + start], end))
+		return 0;
+	if (parser->active.length / 3 >= GRAMMAR_MAX_PARSE_DEPTH || ++parser->steps > GRAMMAR_MAX_BUILD_STEPS) {
+		parser->failed = 1;
+		return 0;
+	}
+
+	//Skip the derivations in which this nonterminal derives itself over the same span.  The nodes being built
+	//start in order, so only the innermost ones can start at the same position.
+	for (i = parser->active.length; i >= 3 && parser->active.data[i - 2] == start; i -= 3) {
+		if (parser->active.data[i - 3] == nonterminal && parser->active.data[i - 1] == end)
+			return 0;
+	}
+
+	if (push_uint32(parser, &parser->active, nonterminal) || push_uint32(parser, &parser->active, start)
+		|| push_uint32(parser, &parser->active, end))
+		return 0;
+	for (i = 0; i < current->rule_count && !parser->failed; i++)
+	{
+		if (!match_rule(parser, &parser->grammar->rules[current->first_rule + i], 0, start, end))
+			continue;
+		mark = parser->tree->length;
+		if (mark == parser->tree->capacity) {
+			parser->failed = 1;
+			break;
+		}
+		parser->tree->rules[parser->tree->length++] = current->first_rule + i;
+		if (build_rule(parser, &parser->grammar->rules[current->first_rule + i], 0, start, end)) {
+			parser->active.length -= 3;
+			return 1;
+		}
+		parser->tree->length = mark;
+	}
+	parser->active.length -= 3;
+	return 0;
+}
+
+/**
+ * This function finds the derivation tree of an input.
+ * @param state - the mutator state
+ * @param input - the input to parse
+ * @param length - the length of input
+ * @param tree - used to return the input's derivation tree, which is empty if no tree was found
+ * @return - zero if the input was parsed, or non-zero otherwise
+ */
+static int parse_input(grammar_state_t * state, const char * input, size_t length, grammar_tree_t * tree)
+{
+	parser_t parser;
+	int ret = 1;
+
+	tree->length = 0;
+	if (length > (size_t)state->max_parse_length)
+		return 1;
+
+	memset(&parser, 0, sizeof(parser_t));
+	parser.grammar = &state->grammar;
+	parser.input = input;
+	parser.length = (uint32_t)length;
+	parser.tree = tree;
+	parser.entries = (parse_entry_t *)calloc((size_t)state->grammar.nonterminal_count * (length + 1), sizeof(parse_entry_t));
+	if (parser.entries && parse_nonterminal(&parser, state->grammar.start, 0)
+		&& build_nonterminal(&parser, state->grammar.start, 0, parser.length)) {
+		compute_sizes(&state->grammar, tree->rules, tree->sizes, tree->length);
+		ret = 0;
+	}
+	else
+		tree->length = 0;
+
+	free(parser.entries);
+	free(parser.ends.data);
+	free(parser.found.data);
+	free(parser.active.data);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Splicing //////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+//FNV-1a, which is only used to avoid adding the same input to the splice tree twice
+static uint64_t hash_input(const char * input, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i = 0; i < length; i++)
+		hash = (hash ^ (uint8_t)input[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+/**
+ * This function parses an input and adds its tree to the splice trees, unless it's already there, it
+ * doesn't parse, or there isn't room for it.
+ * @param state - the mutator state
+ * @param input - the input to add
+ * @param length - the length of input
+ * @param tree - the input's tree if it's already been parsed, or NULL to parse it
+ * @return - zero on success or if the input wasn't added, or non-zero if memory couldn't be allocated
+ */
+static int add_splice_input(grammar_state_t * state, const char * input, size_t length, grammar_tree_t * tree)
+{
+	grammar_tree_t * splice = &state->splice_tree;
+	uint32_t * new_array, capacity, count, i, nonterminal;
+	uint64_t hash, * new_hashes;
+
+	hash = hash_input(input, length);
+	for (i = 0; i < state->spliced_count; i++) {
+		if (state->spliced_hashes[i] == hash)
+			return 0;
+	}
+	if (!tree) {
+		tree = &state->generated;
+		if (parse_input(state, input, length, tree))
+			return 0;
+	}
+	if (!tree->length || splice->length + tree->length > GRAMMAR_MAX_SPLICE_NODES)
+		return 0;
+
+	new_hashes = (uint64_t *)realloc(state->spliced_hashes, (state->spliced_count + 1) * sizeof(uint64_t));
+	if (!new_hashes)
+		return 1;
+	state->spliced_hashes = new_hashes;
+	state->spliced_hashes[state->spliced_count++] = hash;
+
+	if (splice->length + tree->length > splice->capacity) {
+		capacity = MIN(GRAMMAR_MAX_SPLICE_NODES, MAX(splice->capacity * 2, splice->length + tree->length));
+		new_array = (uint32_t *)realloc(splice->rules, capacity * sizeof(uint32_t));
+		if (!new_array)
+			return 1;
+		splice->rules = new_array;
+		new_array = (uint32_t *)realloc(splice->sizes, capacity * sizeof(uint32_t));
+		if (!new_array)
+			return 1;
+		splice->sizes = new_array;
+		new_array = (uint32_t *)realloc(state->splice_index, capacity * sizeof(uint32_t));
+		if (!new_array)
+			return 1;
+		state->splice_index = new_array;
+		splice->capacity = capacity;
+	}
+	memcpy(splice->rules + splice->length, tree->rules, tree->length * sizeof(uint32_t));
+	memcpy(splice->sizes + splice->length, tree->sizes, tree->length * sizeof(uint32_t));
+	splice->length += tree->length;
+
+	//Group the nodes by their nonterminal again
+	if (!state->splice_index_start) {
+		state->splice_index_start = (uint32_t *)malloc((state->grammar.nonterminal_count + 1) * sizeof(uint32_t));
+		if (!state->splice_index_start)
+			return 1;
+	}
+	memset(state->splice_index_start, 0, (state->grammar.nonterminal_count + 1) * sizeof(uint32_t));
+	for (i = 0; i < splice->length; i++)
+		state->splice_index_start[state->grammar.rules[splice->rules[i]].nonterminal + 1]++;
+	for (i = 0; i < state->grammar.nonterminal_count; i++)
+		state->splice_index_start[i + 1] += state->splice_index_start[i];
+	for (i = 0; i < splice->length; i++) {
+		nonterminal = state->grammar.rules[splice->rules[i]].nonterminal;
+		count = state->splice_index_start[nonterminal]++;
+		state->splice_index[count] = i;
+	}
+	for (i = state->grammar.nonterminal_count; i > 0; i--)
+		state->splice_index_start[i] = state->splice_index_start[i - 1];
+	state->splice_index_start[0] = 0;
+	return 0;
+}
+
+/**
+ * This function parses the mutator's input, and adds its tree to the splice trees if splice_queue is set.
+ * @param state - the mutator state
+ * @return - zero on success, or non-zero on failure
+ */
+static int load_input_tree(grammar_state_t * state)
+{
+	if (parse_input(state, state->input, state->input_length, &state->input_tree) || !state->splice_queue)
+		return 0;
+	return add_splice_input(state, state->input, state->input_length, &state->input_tree);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+//// Mutator API ///////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * This function creates and initializes a grammar_state_t object based on the passed in JSON options.
+ * @return the newly created grammar_state_t object or NULL on failure
+ */
+static grammar_state_t * setup_options(char * options)
+{
+	grammar_state_t * state;
+	seed_directory_t * seeds;
+	char * contents;
+	size_t i;
+	int length;
+
+	state = (grammar_state_t *)malloc(sizeof(grammar_state_t));
+	if (!state)
+		return NULL;
+	memset(state, 0, sizeof(grammar_state_t));
+
+	//Setup defaults
+	state->random_state[0] = (((uint64_t)rand()) << 32) | rand();
+	state->random_state[1] = (((uint64_t)rand()) << 32) | rand();
+	state->max_depth = 12;
+	state->max_nodes = 4096;
+	state->max_parse_length = 4096;
+	state->splice_queue = 1;
+	state->start = strdup("<start>");
+	state->mutate_mutex = create_lock();
+	if (!state->start || !state->mutate_mutex) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+
+	if (options && strlen(options)) {
+		PARSE_OPTION_STRING(state, options, grammar_filename, "grammar", FUNCNAME(cleanup));
+		PARSE_OPTION_STRING(state, options, start, "start", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, max_depth, "max_depth", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, max_nodes, "max_nodes", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, max_parse_length, "max_parse_length", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, splice_queue, "splice_queue", FUNCNAME(cleanup));
+		PARSE_OPTION_UINT64T_TEMP(state, options, random_state[0], "random_state0", FUNCNAME(cleanup), temp1);
+		PARSE_OPTION_UINT64T_TEMP(state, options, random_state[1], "random_state1", FUNCNAME(cleanup), temp2);
+		PARSE_OPTION_ARRAY(state, options, splice_filenames, splice_filenames_count, "splice_filenames", FUNCNAME(cleanup));
+		PARSE_OPTION_STRING(state, options, splice_directory, "splice_directory", FUNCNAME(cleanup));
+	}
+
+	if (!state->grammar_filename || state->max_depth <= 0 || state->max_nodes <= 0 || state->max_parse_length < 0
+		|| compile_grammar(&state->grammar, state->grammar_filename, state->start)) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+
+	//All of the trees are allocated once, so that mutating them doesn't allocate anything
+	state->depths = (uint32_t *)malloc(state->max_nodes * sizeof(uint32_t));
+	state->stack = (uint32_t *)malloc(2 * ((size_t)state->max_nodes + 1) * sizeof(uint32_t));
+	if (!state->depths || !state->stack
+		|| init_tree(&state->input_tree, state->max_nodes) || init_tree(&state->generated, state->max_nodes)
+		|| init_tree(&state->trees[0], state->max_nodes) || init_tree(&state->trees[1], state->max_nodes)) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+
+	for (i = 0; i < state->splice_filenames_count; i++)
+	{
+		length = read_file(state->splice_filenames[i], &contents);
+		if (length < 0) {
+			printf("Could not read file %s\n", state->splice_filenames[i]);
+			FUNCNAME(cleanup)(state);
+			return NULL;
+		}
+		if (add_splice_input(state, contents, length, NULL)) {
+			free(contents);
+			FUNCNAME(cleanup)(state);
+			return NULL;
+		}
+		free(contents);
+	}
+	if (state->splice_directory)
+	{
+		seeds = load_seed_directory(state->splice_directory);
+		if (!seeds) {
+			printf("Could not find any non-empty files to splice with in %s\n", state->splice_directory);
+			FUNCNAME(cleanup)(state);
+			return NULL;
+		}
+		for (i = 0; i < seeds->count; i++) {
+			if (add_splice_input(state, seeds->seeds[i].data, seeds->seeds[i].length, NULL)) {
+				free_seed_directory(seeds);
+				FUNCNAME(cleanup)(state);
+				return NULL;
+			}
+		}
+		free_seed_directory(seeds);
+	}
+	return state;
+}
+
+/**
+ * This function will allocate and initialize the mutator state. The mutator state should be
+ * freed by calling the cleanup function.
+ * @param options - a json string that contains the grammar specific options.
+ * @param state - optionally, a previously dumped state (with the get_state() function) to load
+ * @param input - The input that this mutator will later be mutating
+ * @param input_length - the size of the input parameter
+ * @return a mutator specific structure or NULL on failure. The returned value should
+ * not be used for anything other than passing to the various Mutator API functions.
+ */
+GRAMMAR_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length)
+{
+	grammar_state_t * grammar_state = setup_options(options);
+	if (!grammar_state)
+		return NULL;
+
+	grammar_state->input = shared_input_get(input, input_length);
+	grammar_state->input_length = input_length;
+	if (!grammar_state->input || !input_length || load_input_tree(grammar_state))
+	{
+		FUNCNAME(cleanup)(grammar_state);
+		return NULL;
+	}
+	if (state && FUNCNAME(set_state)(grammar_state, state)) {
+		FUNCNAME(cleanup)(grammar_state);
+		return NULL;
+	}
+	return grammar_state;
+}
+
+/**
+ * This function will release any resources that the mutator has open
+ * and free the mutator state structure.
+ * @param mutator_state - a mutator specific structure previously created by
+ * the create function. This structure will be freed and should not be referenced afterwards.
+ */
+GRAMMAR_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
+{
+	grammar_state_t * state = (grammar_state_t *)mutator_state;
+	size_t i;
+
+	destroy_lock(state->mutate_mutex);
+	free(state->grammar_filename);
+	free(state->start);
+	for (i = 0; i < state->splice_filenames_count; i++)
+		free(state->splice_filenames[i]);
+	free(state->splice_filenames);
+	free(state->splice_directory);
+	free_grammar(&state->grammar);
+	free_tree(&state->input_tree);
+	free_tree(&state->trees[0]);
+	free_tree(&state->trees[1]);
+	free_tree(&state->generated);
+	free_tree(&state->splice_tree);
+	free(state->depths);
+	free(state->stack);
+	free(state->splice_index);
+	free(state->splice_index_start);
+	free(state->spliced_hashes);
+	shared_input_release(state->input);
+	free(state);
+}
+
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe,
+	growable_buffer_t * growable)
+{
+	grammar_state_t * state = (grammar_state_t *)mutator_state;
+	grammar_tree_t * tree = NULL;
+	size_t length = 0;
+	int attempt;
+
+	if (!buffer_length)
+		return -1;
+	if (is_thread_safe && take_lock(state->mutate_mutex))
+		return -1;
+
+	state->iteration++;
+	for (attempt = 0; attempt < GRAMMAR_FIT_ATTEMPTS; attempt++)
+	{
+		tree = next_tree(state);
+		if (!tree)
+			continue;
+		length = serialize_tree(state, tree, buffer, buffer_length);
+		if (length > buffer_length && growable && !growable->reserve(growable, length)) {
+			buffer = growable->data;
+			buffer_length = growable->capacity;
+			length = serialize_tree(state, tree, buffer, buffer_length);
+		}
+		if (length && length <= buffer_length)
+			break;
+	}
+
+	//If none of the mutations fit, truncate the last one, or use the input if it was empty
+	if (!length || !tree) {
+		length = MIN(state->input_length, buffer_length);
+		memcpy(buffer, state->input, length);
+	}
+	else if (length > buffer_length)
+		length = buffer_length;
+
+	if (is_thread_safe && release_lock(state->mutate_mutex))
+		return -1;
+	return (int)length;
+}
+
+/**
+ * This function will mutate the input given in the create function and return it in the buffer argument.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a buffer that the mutated input will be written to
+ * @param buffer_length - the size of the passed in buffer argument.  Inputs that don't fit are retried a
+ * few times, and then truncated.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
+{
+	return mutate_inner(mutator_state, buffer, buffer_length, 0, NULL);
+}
+
+/**
+ * This function will mutate the input given in the create function and return it in the buffer argument.
+ * This function also accepts a set of flags which instruct it how to mutate the input. See global_types.h
+ * for the list of available flags.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a buffer that the mutated input will be written to
+ * @param buffer_length - the size of the passed in buffer argument.
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_EXTENDED(grammar_state_t, state->mutate_mutex);
+}
+
+/**
+ * This function will mutate the input given in the create function into a growable buffer, growing the
+ * buffer when a generated input needs more room than it has.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_GROWABLE(grammar_state_t, state->mutate_mutex);
+}
+
+/**
+ * This function will return the state of the mutator. The returned value can be used to restart the
+ * mutator at a later time, by passing it to the create or set_state function. It is the caller's
+ * responsibility to free the memory allocated here by calling the free_state function.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return - a buffer that defines the current state of the mutator. This will be a mutator specific JSON string.
+ */
+GRAMMAR_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
+{
+	grammar_state_t * state = (grammar_state_t *)mutator_state;
+	json_t *obj, *temp;
+	char * ret;
+
+	obj = json_object();
+	ADD_INT(temp, state->iteration, obj, "iteration");
+	ADD_UINT64T(temp, state->random_state[0], obj, "random_state0");
+	ADD_UINT64T(temp, state->random_state[1], obj, "random_state1");
+	ret = json_dumps(obj, 0);
+	json_decref(obj);
+	return ret;
+}
+
+/**
+ * This function will set the current state of the mutator.
+ * This can be used to restart a mutator once from a previous run.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param state - a previously dumped state buffer obtained by the get_state function.
+ * @return 0 on success or non-zero on failure
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state)
+{
+	grammar_state_t * current_state = (grammar_state_t *)mutator_state;
+	int result, temp_int;
+	uint64_t temp_uint64t;
+
+	if (!state)
+		return 1;
+
+	GET_INT(temp_int, state, current_state->iteration, "iteration", result);
+	GET_UINT64T(temp_uint64t, state, current_state->random_state[0], "random_state0", result);
+	GET_UINT64T(temp_uint64t, state, current_state->random_state[1], "random_state1", result);
+	return 0;
+}
+
+/**
+ * This function will return the current iteration count of the mutator, i.e.
+ * how many mutations have been generated with it.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return value - the number of previously generated mutations
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state)
+{
+	GENERIC_MUTATOR_GET_ITERATION(grammar_state_t);
+}
+
+/**
+ * Obtains information about the inputs that were given to the mutator when it was created
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param num_inputs - a pointer to an integer used to return the number of inputs given to this mutator
+ * when it was created. This parameter is optional and can be NULL, if this information is not needed
+ * @param input_sizes - a pointer to a size_t array used to return the sizes of the inputs given to this
+ * mutator when it was created. This parameter is optional and can be NULL, if this information is not needed.
+ */
+GRAMMAR_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes)
+{
+	SINGLE_INPUT_GET_INFO(grammar_state_t);
+}
+
+/**
+ * This function will set the input(saved in the mutators state) to something new, and parse it.  Unless
+ * splice_queue is disabled, the new input's tree is also kept to splice with.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param new_input - The new input used to produce new mutated inputs later when the mutate function is called
+ * @param input_length - the size in bytes of the input buffer.
+ * @return 0 on success and -1 on failure
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
+{
+	grammar_state_t * state = (grammar_state_t *)mutator_state;
+	char * shared_input = shared_input_get(new_input, input_length);
+	if (!shared_input)
+		return -1;
+	shared_input_release(state->input);
+	state->input = shared_input;
+	state->input_length = input_length;
+	return load_input_tree(state) ? -1 : 0;
+}
+
+/**
+ * This function sets a help message for the mutator.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+GRAMMAR_MUTATOR_API int FUNCNAME(help)(char ** help_str)
+{
+	GENERIC_MUTATOR_HELP(
+"grammar - context free grammar based mutator\n"
+"Required Options:\n"
+"  grammar               A JSON file with the grammar of the inputs, mapping the\n"
+"                          name of each nonterminal to an array of its rules,\n"
+"                          e.g. {\"<start>\": [\"<num>\", \"<num>+<start>\"],\n"
+"                          \"<num>\": [\"1\", \"2\"]}.  In the rules, the names\n"
+"                          of nonterminals are replaced with their derivations\n"
+"Optional Options:\n"
+"  max_depth             How deep new subtrees of the derivation trees can get\n"
+"                          before the shallowest rules are used (default 12)\n"
+"  max_nodes             The most nodes in a derivation tree (default 4096)\n"
+"  max_parse_length      Inputs longer than this aren't parsed, and are replaced\n"
+"                          with generated inputs (default 4096)\n"
+"  random_state0         The first half of the seed to the random number\n"
+"                          generator\n"
+"  random_state1         The second half of the seed to the random number\n"
+"                          generator\n"
+"  splice_directory      A directory of files, such as a corpus, whose subtrees\n"
+"                          are spliced into the mutated inputs\n"
+"  splice_filenames      An array of files whose subtrees are spliced into the\n"
+"                          mutated inputs\n"
+"  splice_queue          Whether to also splice the subtrees of each input the\n"
+"                          mutator has been given, i.e. the fuzzer's queue.  Set\n"
+"                          to 0 for inputs to only depend on the mutator state\n"
+"                          and input, e.g. to record lineage (default 1)\n"
+"  start                 The nonterminal the inputs are derived from (default\n"
+"                          <start>)\n"
+"\n"
+	);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <global_types.h>
+#include <mutators.h>
+
+#ifdef _WIN32
+#ifdef GRAMMAR_MUTATOR_EXPORTS
+#define GRAMMAR_MUTATOR_API __declspec(dllexport)
+#else
+#define GRAMMAR_MUTATOR_API __declspec(dllimport)
+#endif
+#else //_WIN32
+#define GRAMMAR_MUTATOR_API
+#endif
+
+#define MUTATOR_NAME "grammar"
+
+GRAMMAR_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length);
+GRAMMAR_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state);
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length);
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags);
+GRAMMAR_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
+GRAMMAR_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state);
+#define grammar_free_state default_free_state
+GRAMMAR_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state);
+GRAMMAR_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state);
+#define grammar_get_total_iteration_count return_unknown_or_infinite_total_iterations
+GRAMMAR_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
+GRAMMAR_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
+GRAMMAR_MUTATOR_API int FUNCNAME(help)(char **help_str);
+
+GRAMMAR_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
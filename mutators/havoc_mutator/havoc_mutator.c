@@ -18,6 +18,11 @@ struct havoc_state
 	int iteration;
 
 	mutate_info_t info;
+
+	//For a cloned state, the operator statistics at the time it was cloned, so that merge_state
+	//only adds what the clone learned
+	uint64_t cloned_operator_uses[HAVOC_NUM_OPERATORS];
+	uint64_t cloned_operator_finds[HAVOC_NUM_OPERATORS];
 };
 typedef struct havoc_state havoc_state_t;
 
@@ -37,7 +42,12 @@ mutator_t havoc_mutator = {
 	havoc_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	FUNCNAME(report_result),
+	FUNCNAME(clone_state),
+	FUNCNAME(merge_state),
+	NULL, //mutate_batch
+	FUNCNAME(mutate_growable)
 };
 
 /**
@@ -45,12 +55,10 @@ mutator_t havoc_mutator = {
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-#ifndef ALL_MUTATORS_IN_ONE
-HAVOC_MUTATOR_API void init(mutator_t * m)
+HAVOC_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &havoc_mutator, sizeof(mutator_t));
 }
-#endif
 
 static havoc_state_t * setup_options(char * options)
 {
@@ -98,7 +106,8 @@ HAVOC_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	GENERIC_MUTATOR_CLEANUP(havoc_state_t)
 }
 
-static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe)
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe,
+	growable_buffer_t * growable)
 {
 	havoc_state_t * state = (havoc_state_t *)mutator_state;
 	mutate_buffer_t buf;
@@ -109,9 +118,10 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	buf.buffer = (uint8_t *)buffer;
 	buf.length = MIN(buffer_length, state->input_length);
 	buf.max_length = buffer_length;
+	mutate_buffer_set_growable(&buf, growable);
 	memcpy(buf.buffer, state->input, buf.length);
 
-	if(is_thread_safe && take_mutex(state->info.mutate_mutex))
+	if(is_thread_safe && take_lock(state->info.mutate_mutex))
 		return -1;
 	if (state->info.stage_cur > MAX(HAVOC_MIN, HAVOC_CYCLES * (state->info.perf_score / state->info.havoc_div) / 100))
 	{
@@ -121,7 +131,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	}
 	state->iteration++;
 	ret = mutate_one(&state->info, &buf, mutate_funcs, ARRAY_SIZE(mutate_funcs));
-	if (is_thread_safe && release_mutex(state->info.mutate_mutex))
+	if (is_thread_safe && release_lock(state->info.mutate_mutex))
 		return -1;
 	return ret;
 }
@@ -136,7 +146,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
  */
 HAVOC_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
 {
-	return mutate_inner(mutator_state, buffer, buffer_length, 0);
+	return mutate_inner(mutator_state, buffer, buffer_length, 0, NULL);
 }
 
 /**
@@ -155,6 +165,19 @@ HAVOC_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buf
 	SINGLE_INPUT_MUTATE_EXTENDED(havoc_state_t, state->info.mutate_mutex);
 }
 
+/**
+ * This function will mutate the input given in the create function into a growable buffer, growing the
+ * buffer when a mutation needs more room than it has.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+HAVOC_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_GROWABLE(havoc_state_t, state->info.mutate_mutex);
+}
+
 /**
  * This function will return the state of the mutator.  The returned value can be used to restart the
  * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
@@ -232,6 +255,74 @@ HAVOC_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_
 	SINGLE_INPUT_GET_INFO(havoc_state_t);
 }
 
+/**
+ * This function tells the mutator how the last mutated input fared, so that the havoc operators that
+ * produce new paths and crashes can be favored when the schedule_operators option is set.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param fuzz_result - the FUZZ_ result of testing the last mutated input
+ * @param new_path - whether the last mutated input found a new path
+ * @param path_hash - the hash of the last mutated input's path, or NULL if it's unknown
+ */
+HAVOC_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash)
+{
+	havoc_state_t * state = (havoc_state_t *)mutator_state;
+	if (take_lock(state->info.mutate_mutex))
+		return;
+	report_mutate_result(&state->info, fuzz_result, new_path);
+	release_lock(state->info.mutate_mutex);
+}
+
+/**
+ * This function creates an independent copy of the mutator state, so that another thread can mutate
+ * without taking the original's mutex.  The copy continues the original's random stream, and the
+ * original jumps ahead 2^64 random numbers, so the two never generate the same mutations.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return - the cloned mutator state, which should be freed with the cleanup function, or NULL on failure
+ */
+HAVOC_MUTATOR_API void * FUNCNAME(clone_state)(void * mutator_state)
+{
+	havoc_state_t * state = (havoc_state_t *)mutator_state, * clone = NULL;
+	char * saved_state;
+
+	if (take_lock(state->info.mutate_mutex))
+		return NULL;
+	saved_state = FUNCNAME(get_state)(state);
+	if (saved_state)
+		clone = (havoc_state_t *)FUNCNAME(create)(NULL, saved_state, state->input, state->input_length);
+	if (clone)
+	{
+		clone->iteration = 0;
+		memcpy(clone->cloned_operator_uses, clone->info.havoc_operator_uses, sizeof(clone->cloned_operator_uses));
+		memcpy(clone->cloned_operator_finds, clone->info.havoc_operator_finds, sizeof(clone->cloned_operator_finds));
+		random_jump(state->info.random_state);
+	}
+	release_lock(state->info.mutate_mutex);
+	havoc_free_state(saved_state);
+	return clone;
+}
+
+/**
+ * This function adds the iterations and operator statistics of a cloned state back into the original.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param cloned_state - a mutator state previously created from mutator_state by the clone_state function
+ */
+HAVOC_MUTATOR_API void FUNCNAME(merge_state)(void * mutator_state, void * cloned_state)
+{
+	havoc_state_t * state = (havoc_state_t *)mutator_state, * clone = (havoc_state_t *)cloned_state;
+	int i, discounts = MIN(clone->info.havoc_operator_discounts, 63);
+
+	if (take_lock(state->info.mutate_mutex))
+		return;
+	state->iteration += clone->iteration;
+	for (i = 0; i < HAVOC_NUM_OPERATORS; i++)
+	{
+		//The statistics the clone started with were halved along with what it learned since
+		state->info.havoc_operator_uses[i] += clone->info.havoc_operator_uses[i] - (clone->cloned_operator_uses[i] >> discounts);
+		state->info.havoc_operator_finds[i] += clone->info.havoc_operator_finds[i] - (clone->cloned_operator_finds[i] >> discounts);
+	}
+	release_lock(state->info.mutate_mutex);
+}
+
 /**
  * This function sets a help message for the mutator.
  * @param help_str - A pointer that will be updated to point to the new help string.
@@ -256,6 +347,9 @@ HAVOC_MUTATOR_API int FUNCNAME(help)(char **help_str)
 "                          generator\n"
 "  random_state1         The second half of the seed to afl's random number\n"
 "                          generator\n"
+"  schedule_operators    Set to 1 to favor the havoc operators that have found\n"
+"                          new paths and crashes recently, rather than choosing\n"
+"                          them uniformly\n"
 "\n"
 	);
 }
@@ -19,6 +19,7 @@ HAVOC_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * i
 HAVOC_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state);
 HAVOC_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length);
 HAVOC_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags);
+HAVOC_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
 HAVOC_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state);
 #define havoc_free_state default_free_state
 HAVOC_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state);
@@ -27,7 +28,8 @@ HAVOC_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state);
 HAVOC_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
 HAVOC_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 HAVOC_MUTATOR_API int FUNCNAME(help)(char **help_str);
+HAVOC_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash);
+HAVOC_MUTATOR_API void * FUNCNAME(clone_state)(void * mutator_state);
+HAVOC_MUTATOR_API void FUNCNAME(merge_state)(void * mutator_state, void * cloned_state);
 
-#ifndef ALL_MUTATORS_IN_ONE
-HAVOC_MUTATOR_API void init(mutator_t * m);
-#endif
+HAVOC_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
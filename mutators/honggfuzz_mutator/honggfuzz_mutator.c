@@ -22,6 +22,14 @@ typedef struct {
 	size_t len;
 } string_t;
 
+//The number of mangle functions in mangle_mangleContent
+#define HONGGFUZZ_NUM_OPERATORS 19
+//The percentage of mangle function choices made uniformly at random when scheduling operators
+#define HONGGFUZZ_OPERATOR_EXPLORE_PERCENT 10
+//The number of mangle function uses after which the operator statistics are halved, so that the schedule
+//follows what is finding new paths now
+#define HONGGFUZZ_OPERATOR_DISCOUNT_USES (1 << 20)
+
 struct honggfuzz_state
 {
 	int mutations_per_run;
@@ -33,13 +41,23 @@ struct honggfuzz_state
 	size_t input_length;
 
 	//Protects the fields below, i.e. the iteration count, mutate buffer information, and random state
-	mutex_t mutate_mutex;
+	lock_t mutate_mutex;
 
 	int iteration;
 	uint8_t * mutated_buffer;
 	uint64_t mutated_buffer_length;
 	uint64_t max_mutated_buffer_length;
 	uint64_t random_state[2];
+
+	//Operator scheduling, driven by report_result
+	int schedule_operators; //Whether to favor the mangle functions that have found new paths and crashes
+	uint32_t operators_used; //A bitmask of the mangle functions used by the last mutation
+	uint64_t operator_uses[HONGGFUZZ_NUM_OPERATORS];
+	uint64_t operator_finds[HONGGFUZZ_NUM_OPERATORS];
+
+	//For a cloned state, the operator statistics when it was cloned, so merge_state only adds what the clone learned
+	uint64_t cloned_operator_uses[HONGGFUZZ_NUM_OPERATORS];
+	uint64_t cloned_operator_finds[HONGGFUZZ_NUM_OPERATORS];
 };
 typedef struct honggfuzz_state honggfuzz_state_t;
 
@@ -55,7 +73,10 @@ mutator_t honggfuzz_mutator = {
 	honggfuzz_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	FUNCNAME(report_result),
+	FUNCNAME(clone_state),
+	FUNCNAME(merge_state)
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -95,21 +116,10 @@ mutator_t honggfuzz_mutator = {
 //https://github.com/google/honggfuzz/blob/master/libcommon/util.c
 
 /*
- * xoroshiro128plus by David Blackman and Sebastiano Vigna
+ * The mutators' shared xoroshiro128plus generator
  */
-static inline uint64_t util_RotL(const uint64_t x, int k)
-{
-	return (x << k) | (x >> (64 - k));
-}
-
 static inline uint64_t util_InternalRnd64(honggfuzz_state_t * state) {
-	const uint64_t s0 = state->random_state[0];
-	uint64_t s1 = state->random_state[1];
-	const uint64_t result = s0 + s1;
-	s1 ^= s0;
-	state->random_state[0] = util_RotL(s0, 55) ^ s1 ^ (s1 << 14);
-	state->random_state[1] = util_RotL(s1, 36);
-	return result;
+	return random_next(state->random_state);
 }
 
 uint64_t util_rnd64(honggfuzz_state_t * state) {
@@ -122,7 +132,7 @@ uint64_t util_rndGet(honggfuzz_state_t * state, uint64_t min, uint64_t max) {
 		return util_rnd64(state);
 	}
 
-	return ((util_rnd64(state) % (max - min + 1)) + min);
+	return random_below(state->random_state, max - min + 1) + min;
 }
 
 void util_rndBuf(honggfuzz_state_t * state, uint8_t* buf, uint64_t sz) {
@@ -620,6 +630,46 @@ static void mangle_ASCIIVal(honggfuzz_state_t * state) {
 	mangle_Overwrite(state, (uint8_t*)buf, off, strlen(buf));
 }
 
+/**
+ * Chooses the next mangle function.  With operator scheduling enabled, most choices are weighted by
+ * how many finds each mangle function has contributed to per use, and the rest are uniform.  The
+ * statistics are halved every HONGGFUZZ_OPERATOR_DISCOUNT_USES uses, like a discounted bandit.
+ * @param state - the honggfuzz mutator state with the operator statistics
+ * @param num_operators - the number of mangle functions to choose from
+ * @return - the index of the chosen mangle function
+ */
+static uint64_t mangle_chooseOperator(honggfuzz_state_t * state, uint64_t num_operators) {
+	double weights[HONGGFUZZ_NUM_OPERATORS], total = 0, target;
+	uint64_t i, uses;
+
+	if (!state->schedule_operators || util_rndGet(state, 0, 99) < HONGGFUZZ_OPERATOR_EXPLORE_PERCENT)
+		return util_rndGet(state, 0, num_operators - 1);
+
+	for (i = 0, uses = 0; i < HONGGFUZZ_NUM_OPERATORS; i++)
+		uses += state->operator_uses[i];
+	if (uses >= HONGGFUZZ_OPERATOR_DISCOUNT_USES) {
+		//The clone's baseline is halved too, so merge_state still only adds what the clone learned
+		for (i = 0; i < HONGGFUZZ_NUM_OPERATORS; i++) {
+			state->operator_uses[i] >>= 1;
+			state->operator_finds[i] >>= 1;
+			state->cloned_operator_uses[i] >>= 1;
+			state->cloned_operator_finds[i] >>= 1;
+		}
+	}
+
+	for (i = 0; i < num_operators; i++) {
+		weights[i] = (state->operator_finds[i] + 1.0) / (state->operator_uses[i] + 100.0);
+		total += weights[i];
+	}
+	target = total * util_rndGet(state, 0, (1 << 24) - 1) / (1 << 24);
+	for (i = 0; i < num_operators - 1; i++) {
+		if (target < weights[i])
+			break;
+		target -= weights[i];
+	}
+	return i;
+}
+
 static void mangle_mangleContent(honggfuzz_state_t* state) {
 	if (state->mutations_per_run == 0U) {
 		return;
@@ -654,8 +704,11 @@ static void mangle_mangleContent(honggfuzz_state_t* state) {
 	};
 
 	uint64_t changesCnt = util_rndGet(state, 1, state->mutations_per_run);
+	state->operators_used = 0;
 	for (uint64_t x = 0; x < changesCnt; x++) {
-		uint64_t choice = util_rndGet(state, 0, ARRAY_SIZE(mangleFuncs) - 1);
+		uint64_t choice = mangle_chooseOperator(state, ARRAY_SIZE(mangleFuncs));
+		state->operators_used |= 1 << choice;
+		state->operator_uses[choice]++;
 		mangleFuncs[choice](state);
 	}
 }
@@ -789,21 +842,17 @@ static int input_parseDictionary(honggfuzz_state_t * state) {
 //// API methods ///////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifndef ALL_MUTATORS_IN_ONE
-
 /**
  * This function filled in the supplied mutator_t with all of the function
  * pointers for this mutator.
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-HONGGFUZZ_MUTATOR_API void init(mutator_t * m)
+HONGGFUZZ_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &honggfuzz_mutator, sizeof(mutator_t));
 }
 
-#endif
-
 /**
  * This function creates and initializes a honggfuzz_state_t object based on the passed in JSON options.
  * @return the newly created honggfuzz_state_t object or NULL on failure
@@ -820,7 +869,7 @@ static honggfuzz_state_t * setup_options(char * options)
 	state->mutations_per_run = 6;
 	state->random_state[0] = (((uint64_t)rand()) << 32) | rand();
 	state->random_state[1] = (((uint64_t)rand()) << 32) | rand();
-	state->mutate_mutex = create_mutex();
+	state->mutate_mutex = create_lock();
 	if (!state->mutate_mutex) {
 		free(state);
 		return NULL;
@@ -833,6 +882,7 @@ static honggfuzz_state_t * setup_options(char * options)
 	PARSE_OPTION_UINT64T_TEMP(state, options, random_state[0], "random_state0", FUNCNAME(cleanup), temp1);
 	PARSE_OPTION_UINT64T_TEMP(state, options, random_state[1], "random_state1", FUNCNAME(cleanup), temp2);
 	PARSE_OPTION_STRING(state, options, dictionary_file, "dictionary", FUNCNAME(cleanup));
+	PARSE_OPTION_INT(state, options, schedule_operators, "schedule_operators", FUNCNAME(cleanup));
 
 	if (state->dictionary_file && input_parseDictionary(state))
 	{
@@ -859,13 +909,12 @@ HONGGFUZZ_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char
 	if (!honggfuzz_state)
 		return NULL;
 
-	honggfuzz_state->input = (char *)malloc(input_length);
+	honggfuzz_state->input = shared_input_get(input, input_length);
 	if (!honggfuzz_state->input || !input_length)
 	{
 		FUNCNAME(cleanup)(honggfuzz_state);
 		return NULL;
 	}
-	memcpy(honggfuzz_state->input, input, input_length);
 	honggfuzz_state->input_length = input_length;
 	if (state && FUNCNAME(set_state)(honggfuzz_state, state)) {
 		FUNCNAME(cleanup)(honggfuzz_state);
@@ -904,8 +953,8 @@ HONGGFUZZ_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 {
 	honggfuzz_state_t * honggfuzz_state = (honggfuzz_state_t *)mutator_state;
 	clear_dictionary(honggfuzz_state);
-	destroy_mutex(honggfuzz_state->mutate_mutex);
-	free(honggfuzz_state->input);
+	destroy_lock(honggfuzz_state->mutate_mutex);
+	shared_input_release(honggfuzz_state->input);
 	honggfuzz_state->input = NULL;
 	free(honggfuzz_state);
 }
@@ -962,7 +1011,7 @@ HONGGFUZZ_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char *
 HONGGFUZZ_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 {
 	honggfuzz_state_t * honggfuzz_state = (honggfuzz_state_t *)mutator_state;
-	json_t *obj, *temp, *dictionary_file, *dictionary_list, *dictionary_obj;
+	json_t *obj, *temp, *dictionary_file, *dictionary_list, *dictionary_obj, *uses_list, *finds_list;
 	uint64_t i;
 	char * ret;
 
@@ -970,6 +1019,20 @@ HONGGFUZZ_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 	ADD_INT(temp, honggfuzz_state->iteration, obj, "iteration");
 	ADD_UINT64T(temp, honggfuzz_state->random_state[0], obj, "random_state0");
 	ADD_UINT64T(temp, honggfuzz_state->random_state[1], obj, "random_state1");
+	ADD_INT(temp, honggfuzz_state->schedule_operators, obj, "schedule_operators");
+
+	uses_list = json_array();
+	finds_list = json_array();
+	if (!uses_list || !finds_list)
+		return NULL;
+	for (i = 0; i < HONGGFUZZ_NUM_OPERATORS; i++)
+	{
+		json_array_append_new(uses_list, json_integer(honggfuzz_state->operator_uses[i]));
+		json_array_append_new(finds_list, json_integer(honggfuzz_state->operator_finds[i]));
+	}
+	json_object_set_new(obj, "operator_uses", uses_list);
+	json_object_set_new(obj, "operator_finds", finds_list);
+
 	if (honggfuzz_state->dictionary_file)
 	{
 		dictionary_file = json_string(honggfuzz_state->dictionary_file);
@@ -998,6 +1061,31 @@ HONGGFUZZ_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 	return ret;
 }
 
+/**
+ * Loads one of the per mangle function counters from a dumped state.  Counters missing from the
+ * state are left alone, so states dumped before they were added still load.
+ * @param state - the dumped state to load the counters from
+ * @param name - the name of the counters' array in the state
+ * @param counts - an array of HONGGFUZZ_NUM_OPERATORS counters to fill in
+ */
+static void get_operator_counts(char * state, char * name, uint64_t * counts)
+{
+	json_t * root, * list, * item;
+	size_t i;
+
+	root = json_loads(state, 0, NULL);
+	if (!root)
+		return;
+	list = json_object_get(root, name);
+	if (list && json_is_array(list)) {
+		json_array_foreach(list, i, item) {
+			if (i < HONGGFUZZ_NUM_OPERATORS && json_is_integer(item))
+				counts[i] = (uint64_t)json_integer_value(item);
+		}
+	}
+	json_decref(root);
+}
+
 /**
  * This function will set the current state of the mutator.
  * This can be used to restart a mutator once from a previous run.
@@ -1020,6 +1108,11 @@ HONGGFUZZ_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state
 	GET_INT(temp_int, state, honggfuzz_state->iteration, "iteration", result);
 	GET_UINT64T(temp_uint64t, state, honggfuzz_state->random_state[0], "random_state0", result);
 	GET_UINT64T(temp_uint64t, state, honggfuzz_state->random_state[1], "random_state1", result);
+	temp_int = get_int_options(state, "schedule_operators", &result);
+	if (result > 0)
+		honggfuzz_state->schedule_operators = temp_int;
+	get_operator_counts(state, "operator_uses", honggfuzz_state->operator_uses);
+	get_operator_counts(state, "operator_finds", honggfuzz_state->operator_finds);
 
 	clear_dictionary(honggfuzz_state);
 	temp_str = get_string_options(state, "dictionary_file", &result);
@@ -1084,6 +1177,81 @@ HONGGFUZZ_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_i
 	GENERIC_MUTATOR_SET_INPUT(honggfuzz_state_t);
 }
 
+/**
+ * This function tells the mutator how the last mutated input fared, crediting the mangle functions it
+ * used when the input crashed or found a new path.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param fuzz_result - the FUZZ_ result of testing the last mutated input
+ * @param new_path - whether the last mutated input found a new path
+ * @param path_hash - the hash of the last mutated input's path, or NULL if it's unknown
+ */
+HONGGFUZZ_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash)
+{
+	honggfuzz_state_t * state = (honggfuzz_state_t *)mutator_state;
+	int i;
+
+	if (fuzz_result != FUZZ_CRASH && new_path <= 0)
+		return;
+	if (take_lock(state->mutate_mutex))
+		return;
+	for (i = 0; i < HONGGFUZZ_NUM_OPERATORS; i++) {
+		if (state->operators_used & (1 << i))
+			state->operator_finds[i]++;
+	}
+	release_lock(state->mutate_mutex);
+}
+
+/**
+ * This function creates an independent copy of the mutator state, so that another thread can mutate
+ * without taking the original's mutex.  The copy continues the original's random stream, and the
+ * original jumps ahead 2^64 random numbers, so the two never generate the same mutations.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return - the cloned mutator state, which should be freed with the cleanup function, or NULL on failure
+ */
+HONGGFUZZ_MUTATOR_API void * FUNCNAME(clone_state)(void * mutator_state)
+{
+	honggfuzz_state_t * state = (honggfuzz_state_t *)mutator_state, * clone = NULL;
+	char * saved_state;
+
+	if (take_lock(state->mutate_mutex))
+		return NULL;
+	saved_state = FUNCNAME(get_state)(state);
+	if (saved_state)
+		clone = (honggfuzz_state_t *)FUNCNAME(create)(NULL, saved_state, state->input, state->input_length);
+	if (clone)
+	{
+		//mutations_per_run isn't part of the saved state
+		clone->mutations_per_run = state->mutations_per_run;
+		clone->iteration = 0;
+		memcpy(clone->cloned_operator_uses, clone->operator_uses, sizeof(clone->cloned_operator_uses));
+		memcpy(clone->cloned_operator_finds, clone->operator_finds, sizeof(clone->cloned_operator_finds));
+		random_jump(state->random_state);
+	}
+	release_lock(state->mutate_mutex);
+	honggfuzz_free_state(saved_state);
+	return clone;
+}
+
+/**
+ * This function adds the iterations and operator statistics of a cloned state back into the original.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param cloned_state - a mutator state previously created from mutator_state by the clone_state function
+ */
+HONGGFUZZ_MUTATOR_API void FUNCNAME(merge_state)(void * mutator_state, void * cloned_state)
+{
+	honggfuzz_state_t * state = (honggfuzz_state_t *)mutator_state, * clone = (honggfuzz_state_t *)cloned_state;
+	int i;
+
+	if (take_lock(state->mutate_mutex))
+		return;
+	state->iteration += clone->iteration;
+	for (i = 0; i < HONGGFUZZ_NUM_OPERATORS; i++) {
+		state->operator_uses[i] += clone->operator_uses[i] - clone->cloned_operator_uses[i];
+		state->operator_finds[i] += clone->operator_finds[i] - clone->cloned_operator_finds[i];
+	}
+	release_lock(state->mutate_mutex);
+}
+
 /**
  * This function sets a help message for the mutator.
  * @param help_str - A pointer that will be updated to point to the new help string.
@@ -1102,6 +1270,9 @@ HONGGFUZZ_MUTATOR_API int FUNCNAME(help)(char ** help_str)
 "                          number generator\n"
 "  random_state1         The second half of the seed to honggfuzz's random\n"
 "                          number generator\n"
+"  schedule_operators    Set to 1 to favor the mangle functions that have found\n"
+"                          new paths and crashes recently, rather than choosing\n"
+"                          them uniformly\n"
 "\n"
 	);
 }
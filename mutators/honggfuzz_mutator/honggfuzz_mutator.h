@@ -28,7 +28,8 @@ HONGGFUZZ_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state);
 HONGGFUZZ_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
 HONGGFUZZ_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 HONGGFUZZ_MUTATOR_API int FUNCNAME(help)(char ** help_str);
+HONGGFUZZ_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash);
+HONGGFUZZ_MUTATOR_API void * FUNCNAME(clone_state)(void * mutator_state);
+HONGGFUZZ_MUTATOR_API void FUNCNAME(merge_state)(void * mutator_state, void * cloned_state);
 
-#ifndef ALL_MUTATORS_IN_ONE
-HONGGFUZZ_MUTATOR_API void init(mutator_t * m);
-#endif
+HONGGFUZZ_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
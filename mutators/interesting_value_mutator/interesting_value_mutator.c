@@ -40,7 +40,11 @@ mutator_t interesting_value_mutator = {
 	interesting_value_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	NULL, //report_result
+	NULL, //clone_state
+	NULL, //merge_state
+	FUNCNAME(mutate_batch)
 };
 
 /**
@@ -48,12 +52,10 @@ mutator_t interesting_value_mutator = {
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-#ifndef ALL_MUTATORS_IN_ONE
-INTERESTING_VALUE_MUTATOR_API void init(mutator_t * m)
+INTERESTING_VALUE_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &interesting_value_mutator, sizeof(mutator_t));
 }
-#endif
 
 static interesting_value_state_t * setup_options(char * options)
 {
@@ -122,7 +124,7 @@ INTERESTING_VALUE_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	GENERIC_MUTATOR_CLEANUP(interesting_value_state_t)
 }
 
-static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe)
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags)
 {
 	interesting_value_state_t * state = (interesting_value_state_t *)mutator_state;
 	mutate_buffer_t buf;
@@ -133,13 +135,14 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	buf.buffer = (uint8_t *)buffer;
 	buf.length = MIN(buffer_length, state->input_length);
 	buf.max_length = buffer_length;
-	memcpy(buf.buffer, state->input, buf.length);
+	mutate_buffer_set_growable(&buf, NULL);
 
-	if(is_thread_safe && take_mutex(state->info.mutate_mutex))
+	if ((flags & MUTATE_THREAD_SAFE) && take_lock(state->info.mutate_mutex))
 		return -1;
+	restore_mutate_buffer(&state->info, &buf, state->input, flags);
 	state->iteration++;
 	ret = mutate_one(&state->info, &buf, mutate_funcs, ARRAY_SIZE(mutate_funcs));
-	if (is_thread_safe && release_mutex(state->info.mutate_mutex))
+	if ((flags & MUTATE_THREAD_SAFE) && release_lock(state->info.mutate_mutex))
 		return -1;
 	return ret;
 }
@@ -157,6 +160,26 @@ INTERESTING_VALUE_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char *
 	return mutate_inner(mutator_state, buffer, buffer_length, 0);
 }
 
+/**
+ * This function will generate up to count mutations of the input given in the create function, packed one
+ * after another into the arena argument.  The mutate mutex is only taken once for the whole batch.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param arena - a buffer that the mutated inputs will be written to
+ * @param capacity - the size of the arena argument.  Each mutation is given capacity / count bytes, which
+ * must be at least as large as the original input buffer.
+ * @param offsets - an array of count size_ts, used to return the offset of each mutation in the arena
+ * @param lengths - an array of count size_ts, used to return the length of each mutation
+ * @param count - the number of mutations to generate
+ * @return - the number of mutations generated, fewer than count when the mutator runs out of mutations,
+ * or -1 on error
+ */
+INTERESTING_VALUE_MUTATOR_API int FUNCNAME(mutate_batch)(void * mutator_state, char * arena, size_t capacity, size_t * offsets, size_t * lengths, size_t count)
+{
+	interesting_value_state_t * state = (interesting_value_state_t *)mutator_state;
+	return mutate_many(&state->info, &state->iteration, state->input, state->input_length,
+		mutate_funcs, ARRAY_SIZE(mutate_funcs), arena, capacity, offsets, lengths, count);
+}
+
 /**
  * This function will mutate the input given in the create function and return it in the buffer argument.
  * This function also accepts a set of flags which instruct it how to mutate the input.  See global_types.h
@@ -170,7 +193,9 @@ INTERESTING_VALUE_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char *
  */
 INTERESTING_VALUE_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags)
 {
-	SINGLE_INPUT_MUTATE_EXTENDED(interesting_value_state_t, state->info.mutate_mutex);
+	if ((flags & MUTATE_MULTIPLE_INPUTS) && (flags & MUTATE_MULTIPLE_INPUTS_MASK) != 0)
+		return -1;
+	return mutate_inner(mutator_state, buffer, buffer_length, flags);
 }
 
 /**
@@ -235,6 +260,7 @@ INTERESTING_VALUE_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator
  */
 INTERESTING_VALUE_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
+	((interesting_value_state_t *)mutator_state)->info.last_buffer = NULL;
 	GENERIC_MUTATOR_SET_INPUT(interesting_value_state_t);
 }
 
@@ -264,6 +290,11 @@ INTERESTING_VALUE_MUTATOR_API int FUNCNAME(help)(char **help_str)
 "  num_bytes             The number of bytes to operate on; either 1, 2, or 4.\n"
 "                          The default option is to do all three of the\n"
 "                          options, one after another.\n"
+"  num_shards            Split the deterministic mutations into this many equal\n"
+"                          ranges and only do one of them, so the work on an\n"
+"                          input can be divided between several fuzzers\n"
+"  shard                 Which of the num_shards ranges to do, from 0 to\n"
+"                          num_shards - 1\n"
 "  skip_previous_stages  Whether the mutation outputs should skip any output\n"
 "                          that would match the output of the bit_flip or\n"
 "                          arithmetic mutator.  Useful when using multiple\n"
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #endif
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,14 +18,45 @@
 #include <jansson.h>
 #include <jansson_helper.h>
 
+//One part of the input and the mutator for it.  The part's mutator state isn't created until the part
+//is first needed, so that inputs with many parts which are only mutated a few at a time start quickly.
+typedef struct
+{
+	mutator_t * mutator; //Shared between all of the parts that use the same mutator
+	void * state;        //NULL until the part's mutator state is created
+
+	//The arguments to create the part's mutator state with, kept until it is created
+	char * options;
+	char * saved_state;
+
+	//The part's unmutated input, which is also used when the part isn't scheduled to be mutated
+	char * input;
+	size_t input_length;
+
+	//The part's state as of the last get_state, or NULL if the part may have changed since then
+	json_t * checkpoint;
+
+	//How the part has fared when it was scheduled to be mutated
+	uint64_t execs;
+	uint64_t finds;     //The number of those execs that found a new path or crash
+	uint64_t time_ms;   //The total time those execs took
+	int exhausted;      //Whether the part's mutator has run out of mutations
+} multipart_part_t;
+
 typedef struct
 {
 	char ** mutator_names;
 	char * mutator_directory;
 
-	mutator_t ** mutators;
-	void ** mutator_states;
+	multipart_part_t * parts;
 	size_t mutator_count;
+
+	//Whether to only mutate one part per input, picked by how often mutating it finds new paths per
+	//second (with the UCB1 bandit algorithm), rather than mutating every part
+	int schedule;
+	size_t scheduled_part;  //The part being mutated for the current input
+	uint64_t round_start;   //When the current input's first part was requested
+	int round_active;       //Whether the current input's result hasn't been reported yet
 } multipart_state_t;
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -106,10 +138,11 @@ static void free_mutator_arrays(char ** inputs, size_t * input_lengths, size_t i
 
 static int setup_mutators(multipart_state_t * multipart_state, char * mutator_options, char * mutator_states, char * mutator_inputs)
 {
-	size_t inputs_count, i;
-	char **inputs = NULL, **options = NULL, **states = NULL, *option, *state;
+	size_t inputs_count, i, j;
+	char **inputs = NULL, **options = NULL, **states = NULL;
 	int num_options, num_states, all_use_same_options, all_use_same_states;
 	size_t * input_lengths;
+	multipart_part_t * part;
 	DEBUG_MSG("Setting up mutators");
 
 	if (decode_mem_array(mutator_inputs, &inputs, &input_lengths, &inputs_count)) {
@@ -134,13 +167,8 @@ static int setup_mutators(multipart_state_t * multipart_state, char * mutator_op
 		return 1;
 	}
 
-	multipart_state->mutators = calloc(inputs_count, sizeof(mutator_t *));
-	multipart_state->mutator_states = calloc(inputs_count, sizeof(void *));
-	if(!multipart_state->mutators || !multipart_state->mutator_states) {
-		free(multipart_state->mutators);
-		free(multipart_state->mutator_states);
-		multipart_state->mutators = NULL;
-		multipart_state->mutator_states = NULL;
+	multipart_state->parts = calloc(inputs_count, sizeof(multipart_part_t));
+	if(!multipart_state->parts) {
 		free_mutator_arrays(inputs, input_lengths, inputs_count, options, num_options, states, num_states);
 		return 1;
 	}
@@ -148,37 +176,131 @@ static int setup_mutators(multipart_state_t * multipart_state, char * mutator_op
 	for (i = 0; i < inputs_count; i++)
 	{
 		DEBUG_MSG("Setting up mutator %d", i);
-		//Create the mutator and get its state
-		multipart_state->mutators[i] = mutator_factory_directory(multipart_state->mutator_directory, multipart_state->mutator_names[i]);
-		if (multipart_state->mutators[i]) {
-			option = NULL;
-			if (all_use_same_options)
-				option = options[0];
-			else if(num_options != 0)
-				option = options[i];
-			state = NULL;
-			if (all_use_same_states)
-				state = states[0];
-			else if (num_states != 0)
-				state = states[i];
-
-			multipart_state->mutator_states[i] = multipart_state->mutators[i]->create(option, state, inputs[i], input_lengths[i]);
-		}
+		part = &multipart_state->parts[i];
 
-		if (!multipart_state->mutator_states[i] || !multipart_state->mutators[i])
+		//Each distinct mutator library is only loaded once, and shared by the parts that use it
+		for (j = 0; j < i; j++) {
+			if (!strcmp(multipart_state->mutator_names[j], multipart_state->mutator_names[i])) {
+				part->mutator = multipart_state->parts[j].mutator;
+				break;
+			}
+		}
+		if (!part->mutator)
+			part->mutator = mutator_factory_directory(multipart_state->mutator_directory, multipart_state->mutator_names[i]);
+		if (!part->mutator)
 		{
-			printf("Unknown mutator %s, bad mutator options, or bad saved state for mutator %lu\n", multipart_state->mutator_names[i], i);
-			free(multipart_state->mutators[i]); //free the one that failed, if it did
-			multipart_state->mutators[i] = NULL;
+			printf("Unknown mutator %s for mutator %lu\n", multipart_state->mutator_names[i], i);
 			free_mutator_arrays(inputs, input_lengths, inputs_count, options, num_options, states, num_states);
 			return 1;
 		}
+
+		//Keep the arguments for when the part's mutator state is created
+		if (all_use_same_options)
+			part->options = options[0] ? strdup(options[0]) : NULL;
+		else if (num_options != 0) {
+			part->options = options[i];
+			options[i] = NULL;
+		}
+		if (all_use_same_states)
+			part->saved_state = states[0] ? strdup(states[0]) : NULL;
+		else if (num_states != 0) {
+			part->saved_state = states[i];
+			states[i] = NULL;
+		}
+		//The part's mutator state is given the same shared input when it's created, rather than a copy of it
+		part->input = shared_input_get(inputs[i], input_lengths[i]);
+		if (!part->input) {
+			free_mutator_arrays(inputs, input_lengths, inputs_count, options, num_options, states, num_states);
+			return 1;
+		}
+		part->input_length = input_lengths[i];
 	}
 
 	free_mutator_arrays(inputs, input_lengths, inputs_count, options, num_options, states, num_states);
 	return 0;
 }
 
+/**
+ * Creates a part's mutator state, if it hasn't been created yet.
+ * @param multipart_state - the multipart mutator state with the part
+ * @param index - the index of the part
+ * @return - 0 on success, non-zero on failure
+ */
+static int create_part(multipart_state_t * multipart_state, size_t index)
+{
+	multipart_part_t * part = &multipart_state->parts[index];
+
+	if (part->state)
+		return 0;
+
+	part->state = part->mutator->create(part->options, part->saved_state, part->input, part->input_length);
+	if (!part->state) {
+		printf("Bad mutator options or bad saved state for mutator %s (%lu)\n",
+			multipart_state->mutator_names[index], index);
+		return 1;
+	}
+
+	free(part->options);
+	free(part->saved_state);
+	part->options = part->saved_state = NULL;
+	return 0;
+}
+
+/**
+ * Picks the part to mutate for the next input.  Each part that hasn't been tried yet is picked first,
+ * then the part with the best upper confidence bound on its finds per exec, scaled by how much faster
+ * than average the inputs it makes run.  Parts whose mutators have run out of mutations are skipped.
+ * @param state - the multipart mutator state to pick a part for
+ * @return - 0 on success, or 1 if every part is out of mutations
+ */
+static int schedule_part(multipart_state_t * state)
+{
+	multipart_part_t * part;
+	uint64_t total_execs = 0, total_time = 0;
+	double score, best_score = -1, average_time, part_time;
+	size_t i;
+	int found = 0;
+
+	for (i = 0; i < state->mutator_count; i++) {
+		part = &state->parts[i];
+		if (part->exhausted)
+			continue;
+		if (!part->execs) {
+			state->scheduled_part = i;
+			return 0;
+		}
+		total_execs += part->execs;
+		total_time += part->time_ms;
+	}
+
+	average_time = (total_time + 1.0) / (total_execs + 1.0);
+	for (i = 0; i < state->mutator_count; i++) {
+		part = &state->parts[i];
+		if (part->exhausted)
+			continue;
+		part_time = (part->time_ms + 1.0) / (part->execs + 1.0);
+		score = ((double)part->finds / part->execs) * (average_time / part_time)
+			+ sqrt(2 * log((double)total_execs) / part->execs);
+		if (!found || score > best_score) {
+			state->scheduled_part = i;
+			best_score = score;
+			found = 1;
+		}
+	}
+	return !found;
+}
+
+/**
+ * Marks a part as changed, so that its state is saved again by the next get_state.
+ * @param part - the part that changed
+ */
+static void part_changed(multipart_part_t * part)
+{
+	if (part->checkpoint)
+		json_decref(part->checkpoint);
+	part->checkpoint = NULL;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 // Mutator Functions //////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -195,7 +317,8 @@ mutator_t multipart_mutator = {
 	FUNCNAME(get_total_iteration_count),
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	FUNCNAME(report_result)
 };
 
 /**
@@ -203,12 +326,10 @@ mutator_t multipart_mutator = {
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-#ifndef ALL_MUTATORS_IN_ONE
-MULTIPART_MUTATOR_API void init(mutator_t * m)
+MULTIPART_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &multipart_mutator, sizeof(mutator_t));
 }
-#endif
 
 /**
  * This function tries to determine the location of the currently executing library
@@ -291,6 +412,7 @@ static multipart_state_t * setup_options(char * options, char * input, size_t in
 
 	PARSE_OPTION_STRING(state, options, mutator_directory, "mutator_directory", FUNCNAME(cleanup));
 	PARSE_OPTION_ARRAY(state, options, mutator_names, mutator_count, "mutators", FUNCNAME(cleanup));
+	PARSE_OPTION_INT(state, options, schedule, "schedule", FUNCNAME(cleanup));
 
 	if(!state->mutator_directory)
 		state->mutator_directory = get_default_mutator_directory();
@@ -339,21 +461,32 @@ MULTIPART_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char
 MULTIPART_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 {
 	multipart_state_t * state = (multipart_state_t *)mutator_state;
-	size_t i;
+	multipart_part_t * part;
+	size_t i, j;
 
+	for (i = 0; state->parts && i < state->mutator_count; i++)
+	{
+		part = &state->parts[i];
+		if (part->state)
+			part->mutator->cleanup(part->state);
+		part_changed(part);
+		free(part->options);
+		free(part->saved_state);
+		shared_input_release(part->input);
+	}
 	for (i = 0; i < state->mutator_count; i++)
 	{
 		free(state->mutator_names[i]);
-		if (state->mutators && state->mutators[i])
-		{
-			state->mutators[i]->cleanup(state->mutator_states[i]);
-			free(state->mutators[i]);
-		}
+		if (!state->parts || !state->parts[i].mutator)
+			continue;
+		//The parts that use the same mutator share it, so only free it once
+		for (j = 0; j < i && state->parts[j].mutator != state->parts[i].mutator; j++);
+		if (j == i)
+			free(state->parts[i].mutator);
 	}
 
 	free(state->mutator_directory);
-	free(state->mutators);
-	free(state->mutator_states);
+	free(state->parts);
 	free(state);
 }
 
@@ -383,25 +516,57 @@ MULTIPART_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char *
 {
 	multipart_state_t * state = (multipart_state_t *)mutator_state;
 	unsigned short input_part = flags & MUTATE_MULTIPLE_INPUTS_MASK;
+	multipart_part_t * part;
 	uint64_t inner_flags;
+	int ret;
 	if (!(flags & MUTATE_MULTIPLE_INPUTS) || input_part < 0 || input_part >= state->mutator_count)
 		return -1;
 
+	part = &state->parts[input_part];
 	inner_flags = flags & ~(MUTATE_MULTIPLE_INPUTS | MUTATE_MULTIPLE_INPUTS_MASK);
-	return state->mutators[input_part]->mutate_extended(state->mutator_states[input_part], buffer, buffer_length, inner_flags);
+
+	//The drivers ask for each part of an input in order, so the first part starts the next input
+	if (state->schedule && input_part == 0) {
+		if (schedule_part(state))
+			return 0;
+		state->round_start = get_time_ms();
+		state->round_active = 1;
+	}
+
+	if (!state->schedule || input_part == state->scheduled_part) {
+		if (create_part(state, input_part))
+			return -1;
+		part_changed(part);
+		ret = part->mutator->mutate_extended(part->state, buffer, buffer_length, inner_flags);
+		if (ret != 0 || !state->schedule)
+			return ret;
+
+		//This part is out of mutations, move on to another one for the following inputs
+		part->exhausted = 1;
+		if (schedule_part(state))
+			return 0;
+	}
+
+	if (buffer_length < part->input_length)
+		return -1;
+	memcpy(buffer, part->input, part->input_length);
+	return (int)part->input_length;
 }
 
 /**
  * This function will return the state of the mutator.  The returned value can be used to restart the
  * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
- * responsibility to free the memory allocated here by calling the free_state function.
+ * responsibility to free the memory allocated here by calling the free_state function.  Only the
+ * parts that have changed since the last call are asked for their state again.  The parts whose mutator
+ * state hasn't been created yet keep the state they were given, or null if they weren't given one.
  * @param mutator_state - a mutator specific structure previously created by the create function.
  * @return - a buffer that defines the current state of the mutator.
  */
 MULTIPART_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 {
 	multipart_state_t * state = (multipart_state_t *)mutator_state;
-	json_t *states_array, *temp;
+	multipart_part_t * part;
+	json_t *states_array;
 	json_error_t error;
 	char * ret, *single_state;
 	size_t i;
@@ -409,10 +574,19 @@ MULTIPART_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 	states_array = json_array();
 	for (i = 0; i < state->mutator_count; i++)
 	{
-		single_state = state->mutators[i]->get_state(state->mutator_states[i]);
-		temp = json_loads(single_state, 0, &error);
-		state->mutators[i]->free_state(single_state);
-		json_array_append_new(states_array, temp);
+		part = &state->parts[i];
+		if (!part->checkpoint && part->state)
+		{
+			single_state = part->mutator->get_state(part->state);
+			if (single_state)
+				part->checkpoint = json_loads(single_state, 0, &error);
+			part->mutator->free_state(single_state);
+		}
+		else if (!part->checkpoint && part->saved_state)
+			part->checkpoint = json_loads(part->saved_state, 0, &error);
+		if (!part->checkpoint)
+			part->checkpoint = json_null();
+		json_array_append(states_array, part->checkpoint);
 	}
 
 	ret = json_dumps(states_array, 0);
@@ -430,6 +604,7 @@ MULTIPART_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
 MULTIPART_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state)
 {
 	multipart_state_t * current_state = (multipart_state_t *)mutator_state;
+	multipart_part_t * part;
 	json_t *states_array, *temp;
 	json_error_t error;
 	char *single_state;
@@ -447,10 +622,19 @@ MULTIPART_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state
 
 	for (i = 0; i < current_state->mutator_count; i++)
 	{
+		part = &current_state->parts[i];
 		temp = json_array_get(states_array, i);
-		single_state = json_dumps(temp, 0);
-		current_state->mutators[i]->set_state(current_state->mutator_states[i], single_state);
-		free(single_state);
+		single_state = json_is_null(temp) ? NULL : json_dumps(temp, 0);
+		part_changed(part);
+		if (part->state) {
+			//A null state is from a part that hadn't been created, so it has nothing to restore
+			if (single_state)
+				part->mutator->set_state(part->state, single_state);
+			free(single_state);
+		} else {
+			free(part->saved_state);
+			part->saved_state = single_state;
+		}
 	}
 
 	json_decref(states_array);
@@ -469,7 +653,12 @@ MULTIPART_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state)
 	int lowest = -1, temp;
 	size_t i;
 	for (i = 0; i < state->mutator_count; i++) {
-		temp = state->mutators[i]->get_current_iteration(state->mutator_states[i]);
+		//A part that hasn't been created or given a saved state hasn't made any mutations yet
+		if (!state->parts[i].state && !state->parts[i].saved_state)
+			return 0;
+		if (create_part(state, i))
+			return -1;
+		temp = state->parts[i].mutator->get_current_iteration(state->parts[i].state);
 		if (lowest == -1 || lowest > temp)
 			lowest = temp;
 	}
@@ -490,7 +679,9 @@ MULTIPART_MUTATOR_API int FUNCNAME(get_total_iteration_count)(void * mutator_sta
 	int lowest = -1, temp;
 	size_t i;
 	for (i = 0; i < state->mutator_count; i++) {
-		temp = state->mutators[i]->get_total_iteration_count(state->mutator_states[i]);
+		if (create_part(state, i))
+			return -1;
+		temp = state->parts[i].mutator->get_total_iteration_count(state->parts[i].state);
 		if (lowest == -1 || (temp != -1 && lowest > temp))
 			lowest = temp;
 	}
@@ -509,16 +700,13 @@ MULTIPART_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int *
 {
 	multipart_state_t * state = (multipart_state_t *)mutator_state;
 	size_t i;
-	size_t * sizes;
 	if (num_inputs)
 		*num_inputs = state->mutator_count;
 	if (input_sizes) {
 		*input_sizes = malloc(sizeof(size_t) * state->mutator_count);
 		for (i = 0; i < state->mutator_count; i++)
 		{
-			state->mutators[i]->get_input_info(state->mutator_states[i], NULL, &sizes);
-			(*input_sizes)[i] = sizes[0];
-			free(sizes);
+			(*input_sizes)[i] = state->parts[i].input_length;
 		}
 	}
 }
@@ -533,8 +721,9 @@ MULTIPART_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int *
 MULTIPART_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
 	multipart_state_t * state = (multipart_state_t *)mutator_state;
+	multipart_part_t * part;
 	size_t inputs_count, i;
-	char **inputs = NULL;
+	char **inputs = NULL, * shared_input;
 	size_t * input_lengths;
 	int ret = 0;
 
@@ -546,11 +735,68 @@ MULTIPART_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_i
 	}
 
 	for (i = 0; ret == 0 && i < state->mutator_count; i++)
-		ret = state->mutators[i]->set_input(state->mutator_states[i], inputs[i], input_lengths[i]);
+	{
+		part = &state->parts[i];
+		part_changed(part);
+		shared_input = shared_input_get(inputs[i], input_lengths[i]);
+		if (!shared_input) {
+			ret = -1;
+			break;
+		}
+		shared_input_release(part->input);
+		part->input = shared_input;
+		part->input_length = input_lengths[i];
+		part->exhausted = 0;
+		if (part->state)
+			ret = part->mutator->set_input(part->state, part->input, part->input_length);
+	}
 	free_mutator_arrays(inputs, input_lengths, inputs_count, NULL, 0, NULL, 0);
 	return ret;
 }
 
+/**
+ * This function tells each of the sub-mutators how the last mutated input fared.  The parts of an input
+ * are tested together, so every created sub-mutator that supports feedback is given the result.  When the
+ * schedule option is set, only the part that was mutated is given the result, and it's used to schedule
+ * the parts.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param fuzz_result - the FUZZ_ result of testing the last mutated input
+ * @param new_path - whether the last mutated input found a new path
+ * @param path_hash - the hash of the last mutated input's path, or NULL if it's unknown
+ */
+MULTIPART_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash)
+{
+	multipart_state_t * state = (multipart_state_t *)mutator_state;
+	multipart_part_t * part;
+	size_t i;
+
+	if (state->schedule) {
+		//Only the scheduled part was mutated, so the result is all its doing
+		if (!state->round_active)
+			return;
+		state->round_active = 0;
+		part = &state->parts[state->scheduled_part];
+		part->execs++;
+		part->time_ms += get_time_ms() - state->round_start;
+		if (new_path > 0 || fuzz_result == FUZZ_CRASH)
+			part->finds++;
+		if (part->state && part->mutator->report_result) {
+			part_changed(part);
+			part->mutator->report_result(part->state, fuzz_result, new_path, path_hash);
+		}
+		return;
+	}
+
+	for (i = 0; i < state->mutator_count; i++)
+	{
+		//Parts that haven't been created haven't made the input, so they have nothing to learn from it
+		if (state->parts[i].state && state->parts[i].mutator->report_result) {
+			part_changed(&state->parts[i]);
+			state->parts[i].mutator->report_result(state->parts[i].state, fuzz_result, new_path, path_hash);
+		}
+	}
+}
+
 /**
  * This function sets a help message for the mutator.
  * @param help_str - A pointer that will be updated to point to the new help string.
@@ -566,6 +812,9 @@ MULTIPART_MUTATOR_API int FUNCNAME(help)(char **help_str)
 "Optional Options:\n"
 "  mutator_directory     The directory to look for other mutator libraries in\n"
 "  options               An array of mutator options to pass to each mutator used\n"
+"  schedule              Set to 1 to only mutate one part of each input, favoring\n"
+"                          the parts whose mutations find the most new paths per\n"
+"                          second, rather than mutating every part (default 0)\n"
 "\n"
 	);
 }
@@ -27,7 +27,6 @@ MULTIPART_MUTATOR_API int FUNCNAME(get_total_iteration_count)(void * mutator_sta
 MULTIPART_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
 MULTIPART_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 MULTIPART_MUTATOR_API int FUNCNAME(help)(char **help_str);
+MULTIPART_MUTATOR_API void FUNCNAME(report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash);
 
-#ifndef ALL_MUTATORS_IN_ONE
-MULTIPART_MUTATOR_API void init(mutator_t * m);
-#endif
+MULTIPART_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
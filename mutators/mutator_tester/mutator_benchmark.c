@@ -0,0 +1,483 @@
+#include "mutator_tester.h"
+
+#include <global_types.h>
+#include <jansson.h>
+#include <jansson_helper.h>
+#include <mutator_factory.h>
+#include <utils.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define BENCHMARK_DEFAULT_DURATION_MS 1000
+#define BENCHMARK_DEFAULT_THREADS     4
+#define BENCHMARK_LATENCY_SAMPLES     (64 * 1024) //The number of recent mutate latencies kept per thread
+
+//The options that control a benchmark run
+struct benchmark_options
+{
+	char ** mutators;       //The names of the mutators to benchmark, or NULL for all of them
+	size_t mutators_count;
+	int * sizes;            //The seed sizes to benchmark each mutator with
+	size_t sizes_count;
+	int duration_ms;        //How long to benchmark each mutator, seed size, and thread count for
+	int threads;            //The number of threads for the multithreaded runs, or 0 to skip them
+	char * options;         //The benchmark options, whose options object maps mutator names to their options
+};
+typedef struct benchmark_options benchmark_options_t;
+
+//The state of one benchmark thread
+struct benchmark_thread
+{
+	mutator_t * mutator;
+	void * mutator_state;
+	char * buffer;
+	size_t buffer_length;
+	uint64_t flags;
+	uint64_t end_time_ns;
+	volatile int * stop;    //Set when any thread's mutator runs out of mutations or fails
+
+	//If set, the mutator state is recreated from these when it runs out of mutations, rather than stopping
+	char * mutator_options;
+	char * seed;
+	size_t seed_length;
+
+	uint64_t mutations;
+	uint64_t bytes;
+	uint64_t * samples;     //A ring buffer of recent mutate latencies, in nanoseconds
+	size_t num_samples;
+	size_t next_sample;
+	uint64_t restarts;      //The number of times the mutator state was recreated
+	uint64_t restart_ns;    //The time spent recreating the mutator state, which isn't counted in the results
+	uint64_t restart_allocations; //The allocations made recreating the mutator state, which aren't counted either
+	int exhausted;
+	int error;
+};
+typedef struct benchmark_thread benchmark_thread_t;
+
+#if defined(__GLIBC__)
+//On glibc, the allocation functions are wrapped to count how many allocations the mutators make
+#define BENCHMARK_COUNT_ALLOCATIONS
+
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static volatile uint64_t allocations = 0;
+
+void * malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static void cleanup_benchmark_options(benchmark_options_t * options)
+{
+	size_t i;
+
+	for (i = 0; options->mutators && i < options->mutators_count; i++)
+		free(options->mutators[i]);
+	free(options->mutators);
+	free(options->sizes);
+	free(options->options);
+	free(options);
+}
+
+static benchmark_options_t * setup_benchmark_options(char * options)
+{
+	int default_sizes[] = { 16, 256, 4096, 65536 };
+	benchmark_options_t * state;
+
+	state = (benchmark_options_t *)calloc(1, sizeof(benchmark_options_t));
+	if (!state)
+		return NULL;
+	state->duration_ms = BENCHMARK_DEFAULT_DURATION_MS;
+	state->threads = BENCHMARK_DEFAULT_THREADS;
+
+	if (options && *options) {
+		PARSE_OPTION_ARRAY(state, options, mutators, mutators_count, "mutators", cleanup_benchmark_options);
+		PARSE_OPTION_INT_ARRAY(state, options, sizes, sizes_count, "sizes", cleanup_benchmark_options);
+		PARSE_OPTION_INT(state, options, duration_ms, "duration_ms", cleanup_benchmark_options);
+		PARSE_OPTION_INT(state, options, threads, "threads", cleanup_benchmark_options);
+		state->options = strdup(options);
+		if (!state->options) {
+			cleanup_benchmark_options(state);
+			return NULL;
+		}
+	}
+
+	if (!state->sizes) {
+		state->sizes = (int *)malloc(sizeof(default_sizes));
+		if (!state->sizes) {
+			cleanup_benchmark_options(state);
+			return NULL;
+		}
+		memcpy(state->sizes, default_sizes, sizeof(default_sizes));
+		state->sizes_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	}
+	if (state->duration_ms <= 0 || state->threads < 0) {
+		cleanup_benchmark_options(state);
+		return NULL;
+	}
+	return state;
+}
+
+/**
+ * Gets the name of a mutator from the filename of its library, e.g. /path/libbit_flip_mutator.so becomes
+ * bit_flip
+ * @param filename - the filename of the mutator library
+ * @return - a newly allocated copy of the mutator's name
+ */
+static char * mutator_name_from_filename(char * filename)
+{
+	char * start, * name, * end;
+
+	start = strrchr(filename, '/');
+#ifdef _WIN32
+	if (strrchr(filename, '\\') > start)
+		start = strrchr(filename, '\\');
+#endif
+	start = start ? start + 1 : filename;
+#ifndef _WIN32
+	if (!strncmp(start, "lib", 3))
+		start += 3;
+#endif
+
+	name = strdup(start);
+	if (!name)
+		return NULL;
+	end = strchr(name, '.');
+	if (end)
+		*end = 0;
+	end = strstr(name, "_mutator");
+	if (end && !end[strlen("_mutator")])
+		*end = 0;
+	return name;
+}
+
+/**
+ * Gets the options to create a mutator with from the benchmark options' options object
+ * @param options - the benchmark options, or NULL
+ * @param name - the name of the mutator to get the options for
+ * @return - a newly allocated JSON string with the mutator's options, or NULL if the mutator doesn't have any
+ */
+static char * get_mutator_options(char * options, char * name)
+{
+	json_t * root, * mutator_options;
+	json_error_t error;
+	char * ret = NULL;
+
+	if (!options)
+		return NULL;
+	root = json_loads(options, 0, &error);
+	if (!root)
+		return NULL;
+	mutator_options = json_object_get(json_object_get(root, "options"), name);
+	if (json_is_string(mutator_options))
+		ret = strdup(json_string_value(mutator_options));
+	else if (mutator_options)
+		ret = json_dumps(mutator_options, 0);
+	json_decref(root);
+	return ret;
+}
+
+static int compare_uint64(const void * a, const void * b)
+{
+	uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+	return (first > second) - (first < second);
+}
+
+/**
+ * Calls mutate_extended in a loop until the benchmark's end time, the mutator runs out of mutations,
+ * or another thread stops the run, recording the number of mutations and how long each one took.  If the
+ * thread has a seed, the mutator state is recreated when it runs out of mutations instead.
+ * @param arg - the benchmark_thread_t for this thread
+ */
+static THREAD_FUNC(benchmark_thread)
+{
+	benchmark_thread_t * thread = (benchmark_thread_t *)arg;
+	uint64_t start, end;
+	int length;
+
+	end = get_time_ns();
+	while (!*thread->stop && end < thread->end_time_ns)
+	{
+		start = end;
+		length = thread->mutator->mutate_extended(thread->mutator_state, thread->buffer, thread->buffer_length, thread->flags);
+		end = get_time_ns();
+		if (length == 0 && thread->seed) {
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+			thread->restart_allocations -= allocations;
+#endif
+			thread->mutator->cleanup(thread->mutator_state);
+			thread->mutator_state = thread->mutator->create(thread->mutator_options, NULL, thread->seed, thread->seed_length);
+			start = end;
+			end = get_time_ns();
+			thread->restart_ns += end - start;
+			thread->restarts++;
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+			thread->restart_allocations += allocations;
+#endif
+			if (!thread->mutator_state) {
+				thread->error = 1;
+				break;
+			}
+			continue;
+		}
+		if (length <= 0) {
+			if (length < 0)
+				thread->error = 1;
+			else
+				thread->exhausted = 1;
+			*thread->stop = 1;
+			break;
+		}
+
+		thread->mutations++;
+		thread->bytes += length;
+		thread->samples[thread->next_sample] = end - start;
+		thread->next_sample = (thread->next_sample + 1) % BENCHMARK_LATENCY_SAMPLES;
+		if (thread->num_samples < BENCHMARK_LATENCY_SAMPLES)
+			thread->num_samples++;
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * Benchmarks one mutator with one seed size and thread count.  All of the threads share the same
+ * mutator state, and with more than one thread they pass MUTATE_THREAD_SAFE to mutate_extended.  With
+ * one thread, the mutator state is recreated whenever it runs out of mutations, so mutators with only a
+ * few mutations for small seeds can still be timed.  With more threads, the run stops instead.
+ * @param name - the name of the mutator to benchmark
+ * @param mutator - the mutator to benchmark
+ * @param mutator_options - the options to create the mutator with, or NULL
+ * @param seed - the seed to create the mutator with
+ * @param seed_length - the length of the seed parameter
+ * @param num_threads - the number of threads to mutate with
+ * @param duration_ms - how long to mutate for
+ * @return - a JSON object describing the results
+ */
+static json_t * benchmark_run(char * name, mutator_t * mutator, char * mutator_options, char * seed, size_t seed_length,
+	int num_threads, int duration_ms)
+{
+	benchmark_thread_t * threads;
+	thread_t * handles;
+	json_t * result;
+	void * mutator_state;
+	uint64_t start_time, elapsed_ns, mutations = 0, bytes = 0, * samples;
+	size_t num_samples = 0;
+	volatile int stop = 0;
+	int i, started, exhausted = 0, error = 0;
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	uint64_t start_allocations, run_allocations;
+#endif
+
+	result = json_object();
+	json_object_set_new(result, "mutator", json_string(name));
+	json_object_set_new(result, "size", json_integer(seed_length));
+	json_object_set_new(result, "threads", json_integer(num_threads));
+
+	mutator_state = mutator->create(mutator_options, NULL, seed, seed_length);
+	if (!mutator_state) {
+		json_object_set_new(result, "error", json_string("Bad mutator options"));
+		return result;
+	}
+
+	threads = (benchmark_thread_t *)calloc(num_threads, sizeof(benchmark_thread_t));
+	handles = (thread_t *)calloc(num_threads, sizeof(thread_t));
+	if (!threads || !handles) {
+		free(threads);
+		free(handles);
+		mutator->cleanup(mutator_state);
+		json_object_set_new(result, "error", json_string("Out of memory"));
+		return result;
+	}
+	for (i = 0; i < num_threads; i++)
+	{
+		threads[i].mutator = mutator;
+		threads[i].mutator_state = mutator_state;
+		threads[i].buffer_length = 2 * seed_length;
+		threads[i].buffer = (char *)malloc(threads[i].buffer_length);
+		threads[i].samples = (uint64_t *)malloc(BENCHMARK_LATENCY_SAMPLES * sizeof(uint64_t));
+		threads[i].flags = num_threads > 1 ? MUTATE_THREAD_SAFE : 0;
+		threads[i].stop = &stop;
+		if (num_threads == 1) {
+			threads[i].mutator_options = mutator_options;
+			threads[i].seed = seed;
+			threads[i].seed_length = seed_length;
+		}
+		if (!threads[i].buffer || !threads[i].samples)
+			error = 1;
+	}
+
+	start_time = get_time_ns();
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	start_allocations = allocations;
+#endif
+	for (i = 0; i < num_threads; i++)
+		threads[i].end_time_ns = start_time + (uint64_t)duration_ms * 1000000;
+	for (started = 0; !error && started < num_threads; started++)
+	{
+		if (create_thread(&handles[started], benchmark_thread, &threads[started])) {
+			stop = error = 1;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		join_thread(handles[i]);
+	elapsed_ns = get_time_ns() - start_time;
+	mutator_state = threads[0].mutator_state;
+	if (num_threads == 1)
+		elapsed_ns -= threads[0].restart_ns;
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	run_allocations = allocations - start_allocations - threads[0].restart_allocations;
+#endif
+
+	json_object_set_new(result, "restarts", json_integer(threads[0].restarts));
+	samples = (uint64_t *)malloc(num_threads * BENCHMARK_LATENCY_SAMPLES * sizeof(uint64_t));
+	for (i = 0; i < num_threads; i++)
+	{
+		mutations += threads[i].mutations;
+		bytes += threads[i].bytes;
+		exhausted |= threads[i].exhausted;
+		error |= threads[i].error;
+		if (samples && threads[i].samples) {
+			memcpy(samples + num_samples, threads[i].samples, threads[i].num_samples * sizeof(uint64_t));
+			num_samples += threads[i].num_samples;
+		}
+		free(threads[i].buffer);
+		free(threads[i].samples);
+	}
+	free(threads);
+	free(handles);
+	if (mutator_state)
+		mutator->cleanup(mutator_state);
+
+	if (error)
+		json_object_set_new(result, "error", json_string("The mutator returned an error"));
+	json_object_set_new(result, "exhausted", json_boolean(exhausted));
+	json_object_set_new(result, "elapsed_ms", json_real(elapsed_ns / 1000000.0));
+	json_object_set_new(result, "mutations", json_integer(mutations));
+	json_object_set_new(result, "mutations_per_second", json_real(elapsed_ns ? mutations * 1000000000.0 / elapsed_ns : 0));
+	json_object_set_new(result, "bytes_per_second", json_real(elapsed_ns ? bytes * 1000000000.0 / elapsed_ns : 0));
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+	json_object_set_new(result, "allocations_per_mutation", mutations ? json_real((double)run_allocations / mutations) : json_null());
+#else
+	json_object_set_new(result, "allocations_per_mutation", json_null());
+#endif
+	if (num_samples) {
+		qsort(samples, num_samples, sizeof(uint64_t), compare_uint64);
+		json_object_set_new(result, "latency_p50_ns", json_integer(samples[num_samples / 2]));
+		json_object_set_new(result, "latency_p99_ns", json_integer(samples[(num_samples * 99) / 100]));
+	} else {
+		json_object_set_new(result, "latency_p50_ns", json_null());
+		json_object_set_new(result, "latency_p99_ns", json_null());
+	}
+	free(samples);
+	return result;
+}
+
+/**
+ * This function benchmarks mutators, running each one over several seed sizes for a fixed time, once with
+ * a single thread and once with several threads sharing the mutator state.  The results are printed
+ * as a JSON array, with one object per mutator, seed size, and thread count.
+ *
+ * @param mutator_directory - the directory to load the mutator libraries from
+ * @param benchmark_options - a JSON string with the benchmark options, or NULL to use the defaults
+ * @return int - 0 on success, or 1 if the options are invalid or no mutators could be loaded
+ */
+int run_benchmark(char * mutator_directory, char * benchmark_options)
+{
+	benchmark_options_t * options;
+	mutator_t * mutator;
+	json_t * results, * result;
+	char ** filenames = NULL, ** names, * name, * mutator_options, * seed, * output;
+	int num_filenames = 0, num_names, i, j, k, thread_counts[2], ret = 1;
+
+	options = setup_benchmark_options(benchmark_options);
+	if (!options) {
+		fprintf(stderr, "Invalid benchmark options\n");
+		return 1;
+	}
+
+	if (options->mutators) {
+		names = options->mutators;
+		num_names = (int)options->mutators_count;
+	} else {
+		filenames = get_mutator_library_filenames(mutator_directory, &num_filenames);
+		names = filenames;
+		num_names = num_filenames;
+	}
+
+	thread_counts[0] = 1;
+	thread_counts[1] = options->threads;
+	results = json_array();
+	for (i = 0; i < num_names; i++)
+	{
+		if (filenames) {
+			mutator = mutator_factory(filenames[i]);
+			name = mutator_name_from_filename(filenames[i]);
+		} else {
+			mutator = mutator_factory_directory(mutator_directory, names[i]);
+			name = strdup(names[i]);
+		}
+		if (!mutator || !name) { //Not a mutator library, e.g. the common mutators library
+			if (!filenames)
+				fprintf(stderr, "Couldn't load the %s mutator\n", names[i]);
+			free(mutator);
+			free(name);
+			continue;
+		}
+
+		mutator_options = get_mutator_options(options->options, name);
+		for (j = 0; j < (int)options->sizes_count; j++)
+		{
+			if (options->sizes[j] <= 0)
+				continue;
+			seed = (char *)malloc(options->sizes[j]);
+			if (!seed)
+				continue;
+			for (k = 0; k < options->sizes[j]; k++)
+				seed[k] = (char)rand();
+
+			for (k = 0; k < 2; k++)
+			{
+				if (thread_counts[k] <= 0 || (k && thread_counts[k] == 1))
+					continue;
+				result = benchmark_run(name, mutator, mutator_options, seed, options->sizes[j], thread_counts[k], options->duration_ms);
+				json_array_append_new(results, result);
+				ret = 0;
+			}
+			free(seed);
+		}
+		free(mutator_options);
+		free(mutator);
+		free(name);
+	}
+
+	output = json_dumps(results, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+	if (output)
+		puts(output);
+	free(output);
+	json_decref(results);
+
+	for (i = 0; i < num_filenames; i++)
+		free(filenames[i]);
+	free(filenames);
+	cleanup_benchmark_options(options);
+	return ret;
+}
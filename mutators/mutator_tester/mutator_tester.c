@@ -28,6 +28,8 @@ static test_info_t test_info[NUM_TESTS] =
 	{ test_run_forever, "Test the mutate() function by mutating the given buffer endlessly." },
 	{ test_mutate_parts, "Test the mutate_input_part() function." },
 	{ test_mutate_once, "Call the mutate() function once and print the output" },
+	{ test_mutate_batch, "Test that mutate_batch() generates the same mutations as calling mutate() repeatedly" },
+	{ test_mutate_growable, "Test that mutate_growable() generates the same mutations as mutate() with a large buffer" },
 };
 
 static test_function test_all_tests[] =
@@ -36,7 +38,9 @@ static test_function test_all_tests[] =
 	test_state,
 	test_thread_mutate,
 	test_mutate_parts,
-	test_mutate_once
+	test_mutate_once,
+	test_mutate_batch,
+	test_mutate_growable
 };
 
 /** This function sets up the mutator for testing. This test program is designed
@@ -67,6 +71,11 @@ int main(int argc, char *argv[])
 		free(help);
 		return 0;
 	}
+	else if ((argc == 3 || argc == 4) && !strcmp(argv[1], "benchmark"))
+	{
+		srand(time(NULL));
+		return run_benchmark(argv[2], argc == 4 ? argv[3] : NULL);
+	}
 	else if (argc < 3)
 	{
 		print_usage(argv[0]);
@@ -164,6 +173,13 @@ void print_usage(char *executable_name)
 	printf("\nUsage:\n");
 	printf("\n%s help \"/path/to/mutator/directory\"\n", executable_name);
 	printf("\tPrint mutator help.\n");
+	printf("\n%s benchmark \"/path/to/mutator/directory\" [\"JSON Benchmark Options String\"]\n", executable_name);
+	printf("\tBenchmark the mutators and print the results as JSON.  Options:\n");
+	printf("\t\t mutators    - An array of the mutators to benchmark (default all of them)\n");
+	printf("\t\t sizes       - An array of the seed sizes to benchmark (default [16, 256, 4096, 65536])\n");
+	printf("\t\t duration_ms - How long to run each benchmark for (default 1000)\n");
+	printf("\t\t threads     - The number of threads for the multithreaded benchmarks, or 0 to skip them (default 4)\n");
+	printf("\t\t options     - An object mapping mutator names to the options to create them with\n");
 	printf("\n%s test_type \"/path/to/mutator.dll\" [\"JSON Mutator Options String\" [path/to/input/data]]\n", executable_name);
 	printf("\tRun a mutator test. Valid Test Types:\n");
 	for (i = 0; i < NUM_TESTS; i++)
@@ -622,3 +638,151 @@ int test_mutate_once(mutator_t * mutator, void * mutator_state, char * mutator_o
 	return 0;
 }
 
+#define BATCH_TEST_COUNT 16
+
+/**
+ * This function tests that generating mutations in a batch gives the same mutations as generating them
+ * one at a time, by comparing a batch against the mutations from a copy of the mutator state.
+ * @param mutator - the mutator struct representing the mutator to be tested, returned by load_mutator
+ * @param mutator_state - the state struct for the mutator being tested.
+ * @param mutator_options - a JSON string that contains the mutator options
+ * @param seed_buffer - The data buffer used to seed the mutator
+ * @param seed_length - The length of the seed_buffer in bytes
+ * @return int - the results of the tests. 0 for success and 1 for fail
+ */
+int test_mutate_batch(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length) {
+	size_t offsets[BATCH_TEST_COUNT], lengths[BATCH_TEST_COUNT], capacity = BATCH_TEST_COUNT * 2 * seed_length;
+	char * arena, * mutate_buffer, * saved_state;
+	void * copy_state;
+	int i, generated, length, ret = 0;
+
+	if (!mutator->mutate_batch)
+		printf("The mutator doesn't implement mutate_batch(), testing the generic fallback\n");
+
+	//Make a copy of the mutator to generate the same mutations one at a time
+	saved_state = mutator->get_state(mutator_state);
+	if (!saved_state) {
+		printf("get_state() failed\n");
+		return 1;
+	}
+	copy_state = mutator->create(mutator_options, saved_state, seed_buffer, seed_length);
+	mutator->free_state(saved_state);
+	if (!copy_state) {
+		printf("Failed to create a copy of the mutator from its state\n");
+		return 1;
+	}
+
+	arena = (char *)malloc(capacity);
+	mutate_buffer = (char *)malloc(2 * seed_length);
+	if (!arena || !mutate_buffer) {
+		printf("Malloc failed\n");
+		free(arena);
+		free(mutate_buffer);
+		mutator->cleanup(copy_state);
+		return 1;
+	}
+
+	generated = mutator_mutate_batch(mutator, mutator_state, arena, capacity, offsets, lengths, BATCH_TEST_COUNT);
+	printf("mutate_batch() generated %d of %d mutations\n", generated, BATCH_TEST_COUNT);
+	if (generated < 0)
+		ret = 1;
+	for (i = 0; i < generated && !ret; i++)
+	{
+		length = mutator->mutate(copy_state, mutate_buffer, 2 * seed_length);
+		if (length != (int)lengths[i] || memcmp(mutate_buffer, arena + offsets[i], length)) {
+			printf("%4d: The batched mutation doesn't match mutate()'s\n", i);
+			printf("batch (%lu bytes): ", lengths[i]);
+			print_hex(arena + offsets[i], lengths[i]);
+			printf("\nmutate (%d bytes): ", length);
+			if (length > 0)
+				print_hex(mutate_buffer, length);
+			printf("\n");
+			ret = 1;
+		}
+	}
+	if (!ret && generated < BATCH_TEST_COUNT && mutator->mutate(copy_state, mutate_buffer, 2 * seed_length) != 0) {
+		printf("mutate_batch() stopped early, but mutate() still has mutations\n");
+		ret = 1;
+	}
+	if (!ret)
+		printf("Success! The batched mutations match\n");
+
+	free(arena);
+	free(mutate_buffer);
+	mutator->cleanup(copy_state);
+	return ret;
+}
+
+//The size of the buffer that mutate_growable's mutations are compared against, and the most the growable buffer can grow to
+#define GROWABLE_TEST_SIZE (4 * 1024 * 1024)
+
+/**
+ * This function tests that mutating into a growable buffer gives the same mutations as mutating into a buffer
+ * that's large enough for any mutation, by starting the growable buffer at the seed's size and comparing its
+ * mutations against the mutations from a copy of the mutator state.
+ * @param mutator - the mutator struct representing the mutator to be tested, returned by load_mutator
+ * @param mutator_state - the state struct for the mutator being tested.
+ * @param mutator_options - a JSON string that contains the mutator options
+ * @param seed_buffer - The data buffer used to seed the mutator
+ * @param seed_length - The length of the seed_buffer in bytes
+ * @return int - the results of the tests. 0 for success and 1 for fail
+ */
+int test_mutate_growable(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length) {
+	growable_buffer_t buffer;
+	char * mutate_buffer, * saved_state;
+	void * copy_state;
+	int i, length, growable_length, grown = 0, ret = 0;
+
+	if (!mutator->mutate_growable)
+		printf("The mutator doesn't implement mutate_growable(), testing the generic fallback\n");
+
+	//Make a copy of the mutator to generate the same mutations into a large buffer
+	saved_state = mutator->get_state(mutator_state);
+	if (!saved_state) {
+		printf("get_state() failed\n");
+		return 1;
+	}
+	copy_state = mutator->create(mutator_options, saved_state, seed_buffer, seed_length);
+	mutator->free_state(saved_state);
+	if (!copy_state) {
+		printf("Failed to create a copy of the mutator from its state\n");
+		return 1;
+	}
+
+	mutate_buffer = (char *)malloc(GROWABLE_TEST_SIZE);
+	if (!mutate_buffer || growable_buffer_init(&buffer, seed_length, GROWABLE_TEST_SIZE)) {
+		printf("Malloc failed\n");
+		free(mutate_buffer);
+		mutator->cleanup(copy_state);
+		return 1;
+	}
+
+	for (i = 0; i < BATCH_TEST_COUNT * 16 && !ret; i++)
+	{
+		growable_length = mutator_mutate_growable(mutator, mutator_state, &buffer, 0);
+		length = mutator->mutate(copy_state, mutate_buffer, GROWABLE_TEST_SIZE);
+		if (growable_length != length || (length > 0 && memcmp(mutate_buffer, buffer.data, length))) {
+			printf("%4d: The growable mutation doesn't match mutate()'s\n", i);
+			printf("growable (%d bytes): ", growable_length);
+			if (growable_length > 0)
+				print_hex(buffer.data, growable_length);
+			printf("\nmutate (%d bytes): ", length);
+			if (length > 0)
+				print_hex(mutate_buffer, length);
+			printf("\n");
+			ret = 1;
+		}
+		if (length > (int)seed_length)
+			grown++;
+		if (length <= 0)
+			break;
+	}
+	if (!ret)
+		printf("Success! The growable mutations match, %d of them were larger than the seed\n", grown);
+
+	growable_buffer_free(&buffer);
+	free(mutate_buffer);
+	mutator->cleanup(copy_state);
+	return ret;
+}
+
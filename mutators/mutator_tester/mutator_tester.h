@@ -6,7 +6,7 @@ void * setup_mutator(mutator_t * mutator, char * mutator_options, char * seed_bu
 void print_usage(char * executable_name);
 
 //Test functions
-#define NUM_TESTS 7
+#define NUM_TESTS 9
 int test_all(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
 int test_mutate(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
 int test_state(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
@@ -14,6 +14,11 @@ int test_thread_mutate(mutator_t * mutator, void * mutator_state, char * mutator
 int test_run_forever(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
 int test_mutate_parts(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
 int test_mutate_once(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
+int test_mutate_batch(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
+int test_mutate_growable(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
+
+//Benchmark
+int run_benchmark(char * mutator_directory, char * benchmark_options);
 
 //Test types
 typedef int(*test_function)(mutator_t * mutator, void * mutator_state, char * mutator_options, char * seed_buffer, size_t seed_length);
@@ -268,6 +268,20 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used to pass the SHM ID of the compare operand pair
+   log to programs built with AFL_LLVM_CMPLOG.  The layout matches
+   afl_progs/config.h: CMPLOG_PAIR_SLOTS slots of a type byte (0 for an empty
+   slot), the lengths of the constant and observed operands, then
+   CMPLOG_MAX_LEN bytes for each of the constant and the observed operand. */
+
+#define CMPLOG_PAIRS_SHM_ENV_VAR "__AFL_CMPLOG_PAIRS_SHM_ID"
+#define CMPLOG_MAX_LEN           32
+#define CMPLOG_PAIR_SLOTS        256
+#define CMPLOG_PAIR_SLOT_SIZE    (3 + 2 * CMPLOG_MAX_LEN)
+#define CMPLOG_PAIRS_SHM_SIZE    (CMPLOG_PAIR_SLOTS * CMPLOG_PAIR_SLOT_SIZE)
+#define CMPLOG_PAIR_INT          1
+#define CMPLOG_PAIR_STR          2
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
@@ -22,36 +22,73 @@
 #include <unistd.h>
 #endif
 
-static inline uint64_t rotl(const uint64_t x, int k) {
-	return (x << k) | (x >> (64 - k));
+/* Generate a random number (from 0 to limit - 1). */
+MUTATORS_API u32 UR(mutate_info_t * info, u32 limit) {
+	return (u32)random_below(info->random_state, limit);
 }
 
-/**
- * xoroshiro128plus by David Blackman and Sebastiano Vigna
- * @param info - an mutate_info_t that holds the current random generator state
- * @return - a random uint64_t
- */
-static inline uint64_t rnd64(mutate_info_t * info) {
-	const uint64_t s0 = info->random_state[0];
-	uint64_t s1 = info->random_state[1];
-	const uint64_t result = s0 + s1;
-	s1 ^= s0;
-	info->random_state[0] = rotl(s0, 55) ^ s1 ^ (s1 << 14);
-	info->random_state[1] = rotl(s1, 36);
-	return result;
+//Replaces the effector map, taking ownership of the new one.  NULL clears it, so every byte is mutated.
+MUTATORS_API void set_effector_map(mutate_info_t * info, u8 * effector_map, size_t effector_map_length) {
+	free(info->effector_map);
+	info->effector_map = effector_map;
+	info->effector_map_length = effector_map ? effector_map_length : 0;
 }
 
-/* Generate a random number (from 0 to limit - 1). This may have slight bias. */
-MUTATORS_API u32 UR(mutate_info_t * info, u32 limit) {
-	return rnd64(info) % limit;
+//Credits the havoc operators used by the last mutation with a find, if the mutated input
+//crashed the target or found a new path.  The mutate mutex should be held in thread safe mode.
+MUTATORS_API void report_mutate_result(mutate_info_t * info, int fuzz_result, int new_path) {
+	int i;
+
+	if (fuzz_result != FUZZ_CRASH && new_path <= 0)
+		return;
+	for (i = 0; i < HAVOC_NUM_OPERATORS; i++) {
+		if (info->havoc_operators_used & (1 << i))
+			info->havoc_operator_finds[i]++;
+	}
+}
+
+//The reserve function of a mutate buffer that writes into a growable buffer
+static int reserve_growable(mutate_buffer_t * buf, size_t length)
+{
+	if (buf->growable->reserve(buf->growable, length))
+		return 1;
+	buf->buffer = (uint8_t *)buf->growable->data;
+	buf->max_length = buf->growable->capacity;
+	return 0;
+}
+
+//Lets the mutate functions grow a mutate buffer that was set up over a growable buffer's data, or stops
+//them from growing it if growable is NULL
+MUTATORS_API void mutate_buffer_set_growable(mutate_buffer_t * buf, growable_buffer_t * growable)
+{
+	buf->growable = growable;
+	buf->reserve = growable ? reserve_growable : NULL;
+}
+
+//Returns whether a mutate buffer has room for length bytes, growing it if it can
+static int has_room(mutate_buffer_t * buf, size_t length)
+{
+	return length <= buf->max_length || (buf->reserve && !buf->reserve(buf, length));
 }
 
 //Mutates a buffer, running through each of the passed in mutate functions, updating the mutate_info_t
 //with the current progress through the mutation functions
 MUTATORS_API int mutate_one(mutate_info_t * info, mutate_buffer_t * buf, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs) {
 	int length = MUTATOR_DONE;
+	if (info->shard_status == SHARD_PENDING)
+		start_shard(info, mutate_funcs, num_funcs, buf->length);
 	while ((length == MUTATOR_DONE || length == MUTATOR_TRY_AGAIN) && info->stage < num_funcs)
 	{
+		if (info->shard_status == SHARD_ACTIVE && (info->stage > info->shard_end_stage ||
+			(info->stage == info->shard_end_stage && info->stage_cur >= info->shard_end_stage_cur)))
+		{
+			//The end of the shard has been reached, skip the rest of the deterministic stages
+			info->shard_status = SHARD_FINISHED;
+			info->stage = num_funcs;
+			length = MUTATOR_DONE;
+			break;
+		}
+		info->changed_length = SIZE_MAX;
 		length = mutate_funcs[info->stage](info, buf);
 		if (length == MUTATOR_TRY_AGAIN)
 			info->stage_cur++;
@@ -68,9 +105,72 @@ MUTATORS_API int mutate_one(mutate_info_t * info, mutate_buffer_t * buf, int(*co
 	info->stage_cur++;
 	if (length == MUTATOR_DONE && info->stage == num_funcs) //If we've reached
 		info->stage_cur = 0; //the end of the mutators cycle, reset the stage to 0
+	info->last_buffer = length > 0 ? buf->buffer : NULL;
+	info->last_length = length;
 	return length;
 }
 
+/**
+ * Copies the input into a mutate buffer before it's mutated with mutate_one.  If the caller passes the
+ * MUTATE_BUFFER_UNCHANGED flag and the buffer still holds the last mutation mutate_one made, only the bytes
+ * that mutation changed are copied back, which saves copying the whole input for each of the one to four
+ * byte changes that the deterministic stages make.
+ * @param info - the mutate_info_t struct that will mutate the buffer
+ * @param buf - the buffer to copy the input into, whose length is the input's length
+ * @param input - the input to copy
+ * @param flags - the mutate flags the mutator was called with
+ */
+MUTATORS_API void restore_mutate_buffer(mutate_info_t * info, mutate_buffer_t * buf, const char * input, uint64_t flags)
+{
+	if ((flags & MUTATE_BUFFER_UNCHANGED) && info->last_buffer == buf->buffer && info->last_length == buf->length
+		&& info->changed_length <= buf->length && info->changed_offset <= buf->length - info->changed_length)
+		memcpy(buf->buffer + info->changed_offset, input + info->changed_offset, info->changed_length);
+	else
+		memcpy(buf->buffer, input, buf->length);
+	info->last_buffer = NULL;
+}
+
+//Mutates the input count times with mutate_one, packing the mutations one after another into an arena
+//and taking the mutate mutex only once for the whole batch.  Each mutation is given capacity / count bytes
+//of room.  Returns the number of mutations generated, fewer than count once the stages are finished,
+//or -1 on error.  The iteration parameter is incremented for each mutation, as the mutate functions do.
+MUTATORS_API int mutate_many(mutate_info_t * info, int * iteration, const char * input, size_t input_length,
+	int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs,
+	char * arena, size_t capacity, size_t * offsets, size_t * lengths, size_t count)
+{
+	mutate_buffer_t buf;
+	size_t i, offset = 0, room;
+	int length = 1;
+
+	if (!count)
+		return 0;
+	room = capacity / count;
+	if (room < input_length)
+		return -1;
+
+	if (take_lock(info->mutate_mutex))
+		return -1;
+	for (i = 0; i < count; i++)
+	{
+		buf.buffer = (uint8_t *)arena + offset;
+		buf.length = input_length;
+		buf.max_length = room;
+		mutate_buffer_set_growable(&buf, NULL);
+		memcpy(buf.buffer, input, input_length);
+
+		(*iteration)++;
+		length = mutate_one(info, &buf, mutate_funcs, num_funcs);
+		if (length <= 0)
+			break;
+		offsets[i] = offset;
+		lengths[i] = length;
+		offset += length;
+	}
+	if (release_lock(info->mutate_mutex) || length < 0)
+		return -1;
+	return (int)i;
+}
+
 static void clear_splice_files(mutate_info_t * info)
 {
 	size_t i;
@@ -127,6 +227,38 @@ MUTATORS_API int load_splice_files(mutate_info_t * info, char ** splice_filename
 	return 0;
 }
 
+/**
+ * Maps the files in a directory, such as a corpus, read-only for splicing with.  Empty files and
+ * duplicates are skipped.
+ * @param info - the mutate_info_t to load the splice directory for
+ * @param directory - the directory of files to splice with
+ * @return - 0 on success, nonzero on failure
+ */
+MUTATORS_API int load_splice_directory(mutate_info_t * info, char * directory)
+{
+	free_seed_directory(info->splice_seeds);
+	clear_splice_candidates(info);
+	info->splice_seeds = load_seed_directory(directory);
+	if (!info->splice_seeds)
+	{
+		printf("Could not find any non-empty files to splice with in %s\n", directory);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Forgets the splice candidates found for the input, so they are found again for a new input
+ * @param info - the mutate_info_t to clear the splice candidates of
+ */
+MUTATORS_API void clear_splice_candidates(mutate_info_t * info)
+{
+	free(info->splice_candidates);
+	info->splice_candidates = NULL;
+	info->splice_candidates_count = 0;
+	info->splice_candidates_built = 0;
+}
+
 static void clear_dictionary_files(mutate_info_t * info)
 {
 	size_t i;
@@ -147,7 +279,14 @@ MUTATORS_API void cleanup_mutate_info(mutate_info_t * info)
 	//Free any dictionary/splice files that were loaded
 	clear_dictionary_files(info);
 	clear_splice_files(info);
-	destroy_mutex(info->mutate_mutex);
+	free_seed_directory(info->splice_seeds);
+	info->splice_seeds = NULL;
+	free(info->splice_directory);
+	info->splice_directory = NULL;
+	clear_splice_candidates(info);
+	set_effector_map(info, NULL, 0);
+	clear_dictionary_hints(info);
+	destroy_lock(info->mutate_mutex);
 	info->mutate_mutex = NULL;
 }
 
@@ -166,24 +305,60 @@ MUTATORS_API int reset_mutate_info(mutate_info_t * info)
 	info->queue_cycle = 1;
 	info->havoc_div = 1;
 	info->perf_score = 100;
-	info->mutate_mutex = create_mutex();
+	info->schedule_operators = 0;
+	info->havoc_operators_used = 0;
+	memset(info->havoc_operator_uses, 0, sizeof(info->havoc_operator_uses));
+	memset(info->havoc_operator_finds, 0, sizeof(info->havoc_operator_finds));
+	info->havoc_operator_discounts = 0;
+	info->shard = 0;
+	info->num_shards = 0;
+	info->shard_status = SHARD_NONE;
+	info->last_buffer = NULL;
+	info->mutate_mutex = create_lock();
 	return info->mutate_mutex == NULL; //1 if the mutex creation failed, 0 otherwise
 }
 
 MUTATORS_API int add_mutate_info_to_json(json_t * obj, mutate_info_t * info)
 {
-	json_t *temp, *temp2, *dictionary_list, *dictionary_item;
+	json_t *temp, *temp2, *dictionary_list, *dictionary_item, *uses_list, *finds_list;
 	uint64_t i;
 
 	ADD_UINT64T(temp, info->random_state[0], obj, "random_state0");
 	ADD_UINT64T(temp, info->random_state[1], obj, "random_state1");
-	ADD_INT(temp, info->stage_cur, obj, "stage_cur");
+	ADD_UINT64T(temp, info->stage_cur, obj, "stage_cur");
 	ADD_INT(temp, info->stage, obj, "stage");
 	ADD_INT(temp, info->should_skip_previous, obj, "should_skip_previous");
 	ADD_INT(temp, info->one_stage_only, obj, "one_stage_only");
 	ADD_INT(temp, info->queue_cycle, obj, "queue_cycle");
 	ADD_INT(temp, info->havoc_div, obj, "havoc_div");
 	ADD_INT(temp, info->perf_score, obj, "perf_score");
+	ADD_INT(temp, info->schedule_operators, obj, "schedule_operators");
+	ADD_INT(temp, info->shard, obj, "shard");
+	ADD_INT(temp, info->num_shards, obj, "num_shards");
+	ADD_INT(temp, info->shard_status, obj, "shard_status");
+	ADD_INT(temp, info->shard_end_stage, obj, "shard_end_stage");
+	ADD_UINT64T(temp, info->shard_end_stage_cur, obj, "shard_end_stage_cur");
+
+	uses_list = json_array();
+	finds_list = json_array();
+	if (!uses_list || !finds_list) {
+		if (uses_list)
+			json_decref(uses_list);
+		if (finds_list)
+			json_decref(finds_list);
+		return 0;
+	}
+	for (i = 0; i < HAVOC_NUM_OPERATORS; i++) {
+		json_array_append_new(uses_list, json_integer(info->havoc_operator_uses[i]));
+		json_array_append_new(finds_list, json_integer(info->havoc_operator_finds[i]));
+	}
+	json_object_set_new(obj, "havoc_operator_uses", uses_list);
+	json_object_set_new(obj, "havoc_operator_finds", finds_list);
+	if (info->effector_map) {
+		//The callers dump the object right away, so the effector map doesn't need to be copied
+		ADD_MEM_NOCOPY(temp, (const char *)info->effector_map, info->effector_map_length, obj, "effector_map");
+		ADD_UINT64T(temp, info->effector_map_length, obj, "effector_map_length");
+	}
 
 	dictionary_list = json_array();
 	if (!dictionary_list)
@@ -224,6 +399,31 @@ MUTATORS_API int add_mutate_info_to_json(json_t * obj, mutate_info_t * info)
 	return 1;
 }
 
+/**
+ * Loads one of the per havoc operator counters from a dumped mutate_info_t.  Counters that are
+ * missing from the state are left alone, so states dumped before they were added still load.
+ * @param state - the dumped state to load the counters from
+ * @param name - the name of the counters' array in the state
+ * @param counts - an array of HAVOC_NUM_OPERATORS counters to fill in
+ */
+static void get_operator_counts_from_json(char * state, char * name, uint64_t * counts)
+{
+	json_t * root, * list, * item;
+	size_t i;
+
+	root = json_loads(state, 0, NULL);
+	if (!root)
+		return;
+	list = json_object_get(root, name);
+	if (list && json_is_array(list)) {
+		json_array_foreach(list, i, item) {
+			if (i < HAVOC_NUM_OPERATORS && json_is_integer(item))
+				counts[i] = (uint64_t)json_integer_value(item);
+		}
+	}
+	json_decref(root);
+}
+
 MUTATORS_API int get_mutate_info_from_json(char * state, mutate_info_t * info)
 {
 	int temp_int, result, inner_result;
@@ -236,13 +436,34 @@ MUTATORS_API int get_mutate_info_from_json(char * state, mutate_info_t * info)
 
 	GET_UINT64T(temp_uint64t, state, info->random_state[0], "random_state0", result);
 	GET_UINT64T(temp_uint64t, state, info->random_state[1], "random_state1", result);
-	GET_INT(temp_int, state, info->stage_cur, "stage_cur", result);
+	GET_UINT64T(temp_uint64t, state, info->stage_cur, "stage_cur", result);
 	GET_INT(temp_int, state, info->stage, "stage", result);
 	GET_INT(temp_int, state, info->should_skip_previous, "should_skip_previous", result);
 	GET_INT(temp_int, state, info->one_stage_only, "one_stage_only", result);
 	GET_INT(temp_int, state, info->queue_cycle, "queue_cycle", result);
 	GET_INT(temp_int, state, info->havoc_div, "havoc_div", result);
 	GET_INT(temp_int, state, info->perf_score, "perf_score", result);
+	temp_int = get_int_options(state, "schedule_operators", &result);
+	if (result > 0)
+		info->schedule_operators = temp_int;
+	temp_int = get_int_options(state, "shard_status", &result);
+	if (result > 0) {
+		info->shard_status = temp_int;
+		GET_INT(temp_int, state, info->shard, "shard", result);
+		GET_INT(temp_int, state, info->num_shards, "num_shards", result);
+		GET_INT(temp_int, state, info->shard_end_stage, "shard_end_stage", result);
+		GET_UINT64T(temp_uint64t, state, info->shard_end_stage_cur, "shard_end_stage_cur", result);
+	}
+	get_operator_counts_from_json(state, "havoc_operator_uses", info->havoc_operator_uses);
+	get_operator_counts_from_json(state, "havoc_operator_finds", info->havoc_operator_finds);
+
+	set_effector_map(info, NULL, 0);
+	temp_uint64t = get_uint64t_options(state, "effector_map_length", &result);
+	if (result > 0) {
+		tempstr = get_mem_options(state, "effector_map", &result);
+		if (result > 0)
+			set_effector_map(info, (u8 *)tempstr, temp_uint64t);
+	}
 
 	FOREACH_OBJECT_JSON_ARRAY_ITEM_BEGIN(state, modules, "dictionary", dictionary_obj, result)
 
@@ -922,11 +1143,22 @@ check_dictionary:
 	return 0;
 }
 
+//Records the range of bytes that a stage's mutation changed, for restore_mutate_buffer
+#define SET_CHANGED(info, offset, length) do { \
+	(info)->changed_offset = (offset);            \
+	(info)->changed_length = (length);            \
+} while (0)
+
+//Records the bytes that flipping num_bits bits starting at bit changed
+#define SET_CHANGED_BITS(info, bit, num_bits) \
+	SET_CHANGED(info, (bit) >> 3, (((bit) + (num_bits) - 1) >> 3) - ((bit) >> 3) + 1)
+
 MUTATORS_API int single_walking_bit(mutate_info_t * info, mutate_buffer_t * buf)
 {
 	if (info->stage_cur >= buf->length << 3)
 		return MUTATOR_DONE;
 	FLIP_BIT(buf->buffer, info->stage_cur);
+	SET_CHANGED_BITS(info, info->stage_cur, 1);
 	return (int)buf->length;
 }
 
@@ -936,6 +1168,7 @@ MUTATORS_API int two_walking_bit(mutate_info_t * info, mutate_buffer_t * buf)
 		return MUTATOR_DONE;
 	FLIP_BIT(buf->buffer, info->stage_cur);
 	FLIP_BIT(buf->buffer, info->stage_cur + 1);
+	SET_CHANGED_BITS(info, info->stage_cur, 2);
 	return (int)buf->length;
 }
 
@@ -947,6 +1180,7 @@ MUTATORS_API int four_walking_bit(mutate_info_t * info, mutate_buffer_t * buf)
 	FLIP_BIT(buf->buffer, info->stage_cur + 1);
 	FLIP_BIT(buf->buffer, info->stage_cur + 2);
 	FLIP_BIT(buf->buffer, info->stage_cur + 3);
+	SET_CHANGED_BITS(info, info->stage_cur, 4);
 	return (int)buf->length;
 }
 
@@ -955,6 +1189,7 @@ MUTATORS_API int walking_byte(mutate_info_t * info, mutate_buffer_t * buf)
 	if (info->stage_cur >= buf->length)
 		return MUTATOR_DONE;
 	buf->buffer[info->stage_cur] ^= 0xFF;
+	SET_CHANGED(info, info->stage_cur, 1);
 	return (int)buf->length;
 }
 
@@ -963,6 +1198,7 @@ MUTATORS_API int two_walking_byte(mutate_info_t * info, mutate_buffer_t * buf)
 	if (info->stage_cur >= buf->length - 1 || buf->length < 2)
 		return MUTATOR_DONE;
 	*(u16*)(buf->buffer + info->stage_cur) ^= 0xFFFF;
+	SET_CHANGED(info, info->stage_cur, 2);
 	return (int)buf->length;
 }
 
@@ -971,9 +1207,35 @@ MUTATORS_API int four_walking_byte(mutate_info_t * info, mutate_buffer_t * buf)
 	if (info->stage_cur >= buf->length - 3 || buf->length < 4)
 		return MUTATOR_DONE;
 	*(u32*)(buf->buffer + info->stage_cur) ^= 0xFFFFFFFF;
+	SET_CHANGED(info, info->stage_cur, 4);
 	return (int)buf->length;
 }
 
+/**
+ * Checks whether a range of the input touches any of the blocks in the effector map.  If it
+ * doesn't, the rest of the stage's iterations for the range's index are skipped.
+ * @param info - the mutate_info_t struct with the effector map and the stage's current iteration
+ * @param index - the index in the input of the range being mutated
+ * @param length - the length of the range being mutated
+ * @param iterations_per_index - the number of iterations the stage spends on each index
+ * @return - 1 if the range should be skipped, 0 if it should be mutated
+ */
+static int skip_non_effector(mutate_info_t * info, uint64_t index, uint64_t length, uint64_t iterations_per_index)
+{
+	uint64_t block;
+
+	if (!info->effector_map)
+		return 0;
+	for (block = index >> EFF_MAP_SCALE2; block <= (index + length - 1) >> EFF_MAP_SCALE2; block++) {
+		if (block >= info->effector_map_length || info->effector_map[block])
+			return 0;
+	}
+
+	//mutate_one increments stage_cur past the last of this index's iterations
+	info->stage_cur = (index + 1) * iterations_per_index - 1;
+	return 1;
+}
+
 MUTATORS_API int one_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * buf)
 {
 	uint64_t index, round;
@@ -983,6 +1245,8 @@ MUTATORS_API int one_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / (2 * ARITH_MAX);
+	if (skip_non_effector(info, index, 1, 2 * ARITH_MAX))
+		return MUTATOR_TRY_AGAIN;
 	round = (info->stage_cur / ARITH_MAX) % 2;
 	arith_value = (u8)(info->stage_cur % (ARITH_MAX));
 
@@ -998,6 +1262,7 @@ MUTATORS_API int one_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_TRY_AGAIN;
 
 	buf->buffer[index] = new_value;
+	SET_CHANGED(info, index, 1);
 	return (int)buf->length;
 }
 
@@ -1010,6 +1275,8 @@ MUTATORS_API int two_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / (4 * ARITH_MAX);
+	if (skip_non_effector(info, index, 2, 4 * ARITH_MAX))
+		return MUTATOR_TRY_AGAIN;
 	round = (info->stage_cur / ARITH_MAX) % 4;
 	arith_value = (info->stage_cur % (ARITH_MAX)) + 1;
 	old_value = *(u16*)(buf->buffer + index);
@@ -1034,6 +1301,7 @@ MUTATORS_API int two_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_TRY_AGAIN;
 
 	*(u16*)(buf->buffer + index) = new_value;
+	SET_CHANGED(info, index, 2);
 	return (int)buf->length;
 }
 
@@ -1046,6 +1314,8 @@ MUTATORS_API int four_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * b
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / (4 * ARITH_MAX);
+	if (skip_non_effector(info, index, 4, 4 * ARITH_MAX))
+		return MUTATOR_TRY_AGAIN;
 	round = (info->stage_cur / ARITH_MAX) % 4;
 	arith_value = (info->stage_cur % (ARITH_MAX)) + 1;
 	old_value = *(u32*)(buf->buffer + index);
@@ -1069,6 +1339,7 @@ MUTATORS_API int four_byte_arithmetics(mutate_info_t * info, mutate_buffer_t * b
 		return MUTATOR_TRY_AGAIN;
 
 	*(u32*)(buf->buffer + index) = new_value;
+	SET_CHANGED(info, index, 4);
 	return (int)buf->length;
 }
 
@@ -1081,6 +1352,8 @@ MUTATORS_API int interesting_one_byte(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / ARRAY_SIZE(interesting_8);
+	if (skip_non_effector(info, index, 1, ARRAY_SIZE(interesting_8)))
+		return MUTATOR_TRY_AGAIN;
 	old_value = buf->buffer[index];
 	new_value = interesting_8[info->stage_cur % ARRAY_SIZE(interesting_8)];
 
@@ -1089,6 +1362,7 @@ MUTATORS_API int interesting_one_byte(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_TRY_AGAIN;
 
 	buf->buffer[index] = new_value;
+	SET_CHANGED(info, index, 1);
 	return (int)buf->length;
 }
 
@@ -1101,6 +1375,8 @@ MUTATORS_API int interesting_two_byte(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / (2 * ARRAY_SIZE(interesting_16));
+	if (skip_non_effector(info, index, 2, 2 * ARRAY_SIZE(interesting_16)))
+		return MUTATOR_TRY_AGAIN;
 	round = (info->stage_cur / ARRAY_SIZE(interesting_16)) % 2;
 	old_value = *(u16*)(buf->buffer + index);
 	new_value = interesting_16[info->stage_cur % ARRAY_SIZE(interesting_16)];
@@ -1118,6 +1394,7 @@ MUTATORS_API int interesting_two_byte(mutate_info_t * info, mutate_buffer_t * bu
 		return MUTATOR_TRY_AGAIN;
 
 	*(u16*)(buf->buffer + index) = new_value;
+	SET_CHANGED(info, index, 2);
 	return (int)buf->length;
 }
 
@@ -1130,6 +1407,8 @@ MUTATORS_API int interesting_four_byte(mutate_info_t * info, mutate_buffer_t * b
 		return MUTATOR_DONE;
 
 	index = info->stage_cur / (2 * ARRAY_SIZE(interesting_32));
+	if (skip_non_effector(info, index, 4, 2 * ARRAY_SIZE(interesting_32)))
+		return MUTATOR_TRY_AGAIN;
 	round = (info->stage_cur / ARRAY_SIZE(interesting_32)) % 2;
 	old_value = *(u32*)(buf->buffer + index);
 	new_value = interesting_32[info->stage_cur % ARRAY_SIZE(interesting_32)];
@@ -1147,9 +1426,161 @@ MUTATORS_API int interesting_four_byte(mutate_info_t * info, mutate_buffer_t * b
 		return MUTATOR_TRY_AGAIN;
 
 	*(u32*)(buf->buffer + index) = new_value;
+	SET_CHANGED(info, index, 4);
 	return (int)buf->length;
 }
 
+//A node in the Aho-Corasick automaton used to find the dictionary tokens in an input.  The children of
+//each node are kept as a linked list, since most nodes only have one child.
+typedef struct {
+	int child;      //The first child of this node, or -1
+	int sibling;    //The next child of this node's parent, or -1
+	int fail;       //The node for the longest proper suffix of this node's string that is in the trie
+	int output;     //The nearest node along the fail links that ends a token, or -1
+	size_t length;  //The length of the token that ends at this node, or 0 if no token ends here
+	u8 c;           //The byte on the edge from this node's parent
+} ac_node_t;
+
+//The automaton matches ASCII letters case insensitively, so that keywords are found regardless of case
+#define AC_FOLD(c) ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+static int ac_find_child(ac_node_t * nodes, int node, u8 c)
+{
+	int child;
+	for (child = nodes[node].child; child >= 0; child = nodes[child].sibling) {
+		if (nodes[child].c == c)
+			return child;
+	}
+	return -1;
+}
+
+//Follows the goto function of the automaton, falling back along the fail links when there's no edge for c
+static int ac_next(ac_node_t * nodes, int node, u8 c)
+{
+	int child;
+	while ((child = ac_find_child(nodes, node, c)) < 0 && node != 0)
+		node = nodes[node].fail;
+	return child < 0 ? 0 : child;
+}
+
+/**
+ * Builds an Aho-Corasick automaton over the dictionary tokens and uses it to find the positions in an input
+ * where a token starts or ends.  The hinted dictionary stages overwrite and insert the tokens at these
+ * positions first, since they're where keyword-like content exists in the input.  The full dictionary
+ * stages then skip these positions.
+ * @param info - the mutate_info_t with the dictionary to look for, which the hints are stored in
+ * @param input - the input to search
+ * @param length - the length of input
+ * @return - 0 on success, nonzero on failure
+ */
+MUTATORS_API int build_dictionary_hints(mutate_info_t * info, const u8 * input, size_t length)
+{
+	ac_node_t * nodes;
+	int * queue;
+	size_t num_nodes = 1, max_nodes = 1, i, j, head = 0, tail = 0;
+	int node, child, fail, match;
+
+	clear_dictionary_hints(info);
+	info->dictionary_hint_map = (u8 *)calloc(length + 1, 1);
+	if (!info->dictionary_hint_map)
+		return 1;
+	info->dictionary_hint_map_length = length + 1;
+	if (!info->dictionary_count)
+		return 0;
+
+	for (i = 0; i < info->dictionary_count; i++)
+		max_nodes += info->dictq[i]->len;
+	nodes = (ac_node_t *)malloc(max_nodes * sizeof(ac_node_t));
+	queue = (int *)malloc(max_nodes * sizeof(int));
+	if (!nodes || !queue) {
+		free(nodes);
+		free(queue);
+		clear_dictionary_hints(info);
+		return 1;
+	}
+
+	//Build the trie of the tokens
+	memset(&nodes[0], 0, sizeof(ac_node_t));
+	nodes[0].child = nodes[0].sibling = nodes[0].output = -1;
+	for (i = 0; i < info->dictionary_count; i++) {
+		node = 0;
+		for (j = 0; j < info->dictq[i]->len; j++) {
+			child = ac_find_child(nodes, node, AC_FOLD(info->dictq[i]->s[j]));
+			if (child < 0) {
+				child = (int)num_nodes++;
+				nodes[child].child = -1;
+				nodes[child].sibling = nodes[node].child;
+				nodes[child].fail = 0;
+				nodes[child].output = -1;
+				nodes[child].length = 0;
+				nodes[child].c = AC_FOLD(info->dictq[i]->s[j]);
+				nodes[node].child = child;
+			}
+			node = child;
+		}
+		if (node != 0)
+			nodes[node].length = info->dictq[i]->len;
+	}
+
+	//Compute the fail and output links in breadth first order, so each node's fail node is done before it
+	for (child = nodes[0].child; child >= 0; child = nodes[child].sibling)
+		queue[tail++] = child;
+	while (head < tail) {
+		node = queue[head++];
+		for (child = nodes[node].child; child >= 0; child = nodes[child].sibling) {
+			fail = nodes[node].fail;
+			while (fail != 0 && ac_find_child(nodes, fail, nodes[child].c) < 0)
+				fail = nodes[fail].fail;
+			fail = ac_find_child(nodes, fail, nodes[child].c);
+			nodes[child].fail = fail < 0 || fail == child ? 0 : fail;
+			nodes[child].output = nodes[nodes[child].fail].length ? nodes[child].fail : nodes[nodes[child].fail].output;
+			queue[tail++] = child;
+		}
+	}
+
+	//Mark the start and end of every token found in the input
+	node = 0;
+	for (i = 0; i < length; i++) {
+		node = ac_next(nodes, node, AC_FOLD(input[i]));
+		for (match = nodes[node].length ? node : nodes[node].output; match >= 0; match = nodes[match].output) {
+			info->dictionary_hint_map[i + 1 - nodes[match].length] = 1;
+			info->dictionary_hint_map[i + 1] = 1;
+		}
+	}
+	free(nodes);
+	free(queue);
+
+	for (i = 0; i <= length; i++)
+		info->dictionary_hints_count += info->dictionary_hint_map[i];
+	info->dictionary_hints = (uint64_t *)malloc((info->dictionary_hints_count + 1) * sizeof(uint64_t));
+	if (!info->dictionary_hints) {
+		clear_dictionary_hints(info);
+		return 1;
+	}
+	for (i = 0, j = 0; i <= length; i++) {
+		if (info->dictionary_hint_map[i])
+			info->dictionary_hints[j++] = i;
+	}
+	return 0;
+}
+
+//Throws away the dictionary hints, so that the full dictionary stages don't skip any positions
+MUTATORS_API void clear_dictionary_hints(mutate_info_t * info)
+{
+	free(info->dictionary_hints);
+	info->dictionary_hints = NULL;
+	info->dictionary_hints_count = 0;
+	free(info->dictionary_hint_map);
+	info->dictionary_hint_map = NULL;
+	info->dictionary_hint_map_length = 0;
+}
+
+//Whether the hinted dictionary stages have already tried the tokens at index
+static int is_dictionary_hint(mutate_info_t * info, uint64_t index)
+{
+	return info->dictionary_hint_map && index < info->dictionary_hint_map_length && info->dictionary_hint_map[index];
+}
+
 MUTATORS_API int dictionary_overwrite(mutate_info_t * info, mutate_buffer_t * buf)
 {
 	uint64_t index;
@@ -1163,8 +1594,9 @@ MUTATORS_API int dictionary_overwrite(mutate_info_t * info, mutate_buffer_t * bu
 
 	// Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
 	// skip if there's no room to insert the payload or if the token is redundant.
-	if ((info->dictionary_count > MAX_DET_EXTRAS && UR(info, info->dictionary_count) >= MAX_DET_EXTRAS)
-		|| dictionary_item->len > buf->max_length - index
+	if (is_dictionary_hint(info, index)
+		|| (info->dictionary_count > MAX_DET_EXTRAS && UR(info, info->dictionary_count) >= MAX_DET_EXTRAS)
+		|| !has_room(buf, index + dictionary_item->len)
 		|| !memcmp(dictionary_item->s, buf->buffer + index, dictionary_item->len))
 		return MUTATOR_TRY_AGAIN;
 
@@ -1186,9 +1618,9 @@ MUTATORS_API int dictionary_insert(mutate_info_t * info, mutate_buffer_t * buf)
 
 	// Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
 	// skip if there's no room to insert the payload or if the token is redundant.
-	if ((info->dictionary_count > MAX_DET_EXTRAS && UR(info, info->dictionary_count) >= MAX_DET_EXTRAS)
-		|| dictionary_item->len > buf->max_length - index
-		|| buf->length + dictionary_item->len > buf->max_length
+	if (is_dictionary_hint(info, index)
+		|| (info->dictionary_count > MAX_DET_EXTRAS && UR(info, info->dictionary_count) >= MAX_DET_EXTRAS)
+		|| !has_room(buf, buf->length + dictionary_item->len)
 		|| !memcmp(dictionary_item->s, buf->buffer + index, dictionary_item->len))
 		return MUTATOR_TRY_AGAIN;
 
@@ -1198,20 +1630,152 @@ MUTATORS_API int dictionary_insert(mutate_info_t * info, mutate_buffer_t * buf)
 	return (int)buf->length;
 }
 
+//Overwrites the input with each dictionary token at each of the dictionary hints.  Unlike the full
+//dictionary stages, every token is tried, even in large dictionaries, since there are few hints.
+MUTATORS_API int dictionary_hint_overwrite(mutate_info_t * info, mutate_buffer_t * buf)
+{
+	uint64_t index;
+	string_t * dictionary_item;
+
+	if (!info->dictionary_count || !info->dictq || info->stage_cur >= info->dictionary_hints_count * info->dictionary_count)
+		return MUTATOR_DONE;
+
+	index = info->dictionary_hints[info->stage_cur / info->dictionary_count];
+	dictionary_item = info->dictq[info->stage_cur % info->dictionary_count];
+	if (index > buf->length
+		|| !has_room(buf, index + dictionary_item->len)
+		|| (index + dictionary_item->len <= buf->length && !memcmp(dictionary_item->s, buf->buffer + index, dictionary_item->len)))
+		return MUTATOR_TRY_AGAIN;
+
+	memcpy(buf->buffer + index, dictionary_item->s, dictionary_item->len);
+	buf->length = MAX(buf->length, index + dictionary_item->len);
+	return (int)buf->length;
+}
+
+//Inserts each dictionary token at each of the dictionary hints
+MUTATORS_API int dictionary_hint_insert(mutate_info_t * info, mutate_buffer_t * buf)
+{
+	uint64_t index;
+	string_t * dictionary_item;
+
+	if (!info->dictionary_count || !info->dictq || info->stage_cur >= info->dictionary_hints_count * info->dictionary_count)
+		return MUTATOR_DONE;
+
+	index = info->dictionary_hints[info->stage_cur / info->dictionary_count];
+	dictionary_item = info->dictq[info->stage_cur % info->dictionary_count];
+	if (index > buf->length || !has_room(buf, buf->length + dictionary_item->len))
+		return MUTATOR_TRY_AGAIN;
+
+	memmove(buf->buffer + index + dictionary_item->len, buf->buffer + index, buf->length - index);
+	memcpy(buf->buffer + index, dictionary_item->s, dictionary_item->len);
+	buf->length += dictionary_item->len;
+	return (int)buf->length;
+}
+
+/**
+ * Finds the splice files and splice_directory files that can be spliced with the input, i.e. the ones that
+ * differ from it in more than one place, away from the start.  Only the input's first and last differing
+ * bytes are needed to pick a split point, so they're found once per input, rather than each time a file is
+ * picked to splice with.
+ * @param info - the mutate_info_t to find the splice candidates for
+ * @param buf - the unmutated input
+ * @return - 0 on success, nonzero on failure
+ */
+static int build_splice_candidates(mutate_info_t * info, mutate_buffer_t * buf)
+{
+	size_t num_sources = info->splice_files_count + (info->splice_seeds ? info->splice_seeds->count : 0);
+	splice_candidate_t * candidate;
+	size_t i;
+
+	clear_splice_candidates(info);
+	if (num_sources) {
+		info->splice_candidates = (splice_candidate_t *)malloc(num_sources * sizeof(splice_candidate_t));
+		if (!info->splice_candidates)
+			return 1;
+	}
+
+	for (i = 0; i < num_sources; i++)
+	{
+		candidate = &info->splice_candidates[info->splice_candidates_count];
+		if (i < info->splice_files_count) {
+			candidate->data = info->splice_files[i]->s;
+			candidate->length = info->splice_files[i]->len;
+		} else {
+			candidate->data = (const u8 *)info->splice_seeds->seeds[i - info->splice_files_count].data;
+			candidate->length = (u32)info->splice_seeds->seeds[i - info->splice_files_count].length;
+		}
+		locate_diffs(buf->buffer, (u8 *)candidate->data, MIN(buf->length, candidate->length),
+			&candidate->first_diff, &candidate->last_diff);
+		if (candidate->first_diff >= 0 && candidate->last_diff >= 2 && candidate->first_diff != candidate->last_diff)
+			info->splice_candidates_count++;
+	}
+	info->splice_candidates_built = 1;
+	return 0;
+}
+
+/**
+ * Chooses the next havoc operator.  Unless operator scheduling is enabled, the operators are chosen
+ * uniformly like afl-fuzz does.  Otherwise, most choices are weighted by how many finds each operator
+ * has contributed to per use, in the spirit of MOpt, with the rest made uniformly at random.  The
+ * statistics are discounted every HAVOC_OPERATOR_DISCOUNT_USES uses, like a discounted bandit, since
+ * the operators that find new paths change as the campaign goes on.
+ * @param info - the mutate_info_t struct with the operator statistics
+ * @param num_operators - the number of operators to choose from
+ * @return - the index of the chosen operator
+ */
+static u32 choose_havoc_operator(mutate_info_t * info, u32 num_operators)
+{
+	double weights[HAVOC_NUM_OPERATORS], total = 0, target;
+	uint64_t uses;
+	u32 i;
+
+	if (!info->schedule_operators || UR(info, 100) < HAVOC_OPERATOR_EXPLORE_PERCENT)
+		return UR(info, num_operators);
+
+	for (i = 0, uses = 0; i < HAVOC_NUM_OPERATORS; i++)
+		uses += info->havoc_operator_uses[i];
+	if (uses >= HAVOC_OPERATOR_DISCOUNT_USES) {
+		for (i = 0; i < HAVOC_NUM_OPERATORS; i++) {
+			info->havoc_operator_uses[i] >>= 1;
+			info->havoc_operator_finds[i] >>= 1;
+		}
+		info->havoc_operator_discounts++;
+	}
+
+	for (i = 0; i < num_operators; i++) {
+		//The +1 and +100 keep new operators from being starved or over-favored before they have statistics
+		weights[i] = (info->havoc_operator_finds[i] + 1.0) / (info->havoc_operator_uses[i] + 100.0);
+		total += weights[i];
+	}
+
+	target = total * UR(info, 1 << 24) / (1 << 24);
+	for (i = 0; i < num_operators - 1; i++) {
+		if (target < weights[i])
+			break;
+		target -= weights[i];
+	}
+	return i;
+}
+
 MUTATORS_API int havoc(mutate_info_t * info, mutate_buffer_t * buf)
 {
 	uint64_t use_stacking, i;
 	u32 pos, num32, del_from, del_len, insert_at, use_extra;
 	u32 copy_from, copy_to, copy_len;
 	u32 clone_from, clone_to, clone_len;
+	u32 op;
 	u16 num16;
 	u8  actually_clone;
 	string_t * dictionary_item;
 
 	use_stacking = 1ULL << (1 + UR(info, HAVOC_STACK_POW2));
+	info->havoc_operators_used = 0;
 	for (i = 0; i < use_stacking; i++)
 	{
-		switch (UR(info, 15 + (info->dictionary_count ? 2 : 0)))
+		op = choose_havoc_operator(info, 15 + (info->dictionary_count ? 2 : 0));
+		info->havoc_operators_used |= 1 << op;
+		info->havoc_operator_uses[op]++;
+		switch (op)
 		{
 		case 0: // Flip a single bit somewhere. Spooky!
 			FLIP_BIT(buf->buffer, UR(info, buf->length << 3));
@@ -1334,11 +1898,13 @@ MUTATORS_API int havoc(mutate_info_t * info, mutate_buffer_t * buf)
 			actually_clone = UR(info, 4);
 			if (actually_clone) {
 				clone_len = choose_block_len(info, buf->length);
+				has_room(buf, buf->length + clone_len);
 				clone_len = MIN(clone_len, buf->max_length - buf->length);
 				clone_from = UR(info, buf->length - clone_len + 1);
 			}
 			else {
 				clone_len = choose_block_len(info, HAVOC_BLK_XL);
+				has_room(buf, buf->length + clone_len);
 				clone_len = MIN(clone_len, buf->max_length - buf->length);
 				clone_from = 0;
 			}
@@ -1384,7 +1950,7 @@ MUTATORS_API int havoc(mutate_info_t * info, mutate_buffer_t * buf)
 			use_extra = UR(info, info->dictionary_count);
 			dictionary_item = info->dictq[use_extra];
 
-			if (buf->length + dictionary_item->len >= buf->max_length)
+			if (!has_room(buf, buf->length + dictionary_item->len + 1))
 				break;
 
 			memmove(buf->buffer + insert_at + dictionary_item->len, buf->buffer + insert_at,
@@ -1400,29 +1966,181 @@ MUTATORS_API int havoc(mutate_info_t * info, mutate_buffer_t * buf)
 
 MUTATORS_API int splice_buffers(mutate_info_t * info, mutate_buffer_t * buf)
 {
-	string_t * target = NULL;
-	u32 attempts = 0, split_at;
-	s32 f_diff = -1, l_diff = -1;
+	splice_candidate_t * target;
+	u32 split_at;
 
 	// Splicing takes the current input file, randomly selects another input, and
 	// splices them together at some offset, then relies on the havoc code to mutate that blob.
-	if (info->splice_files_count == 0)
+	if (!info->splice_candidates_built && build_splice_candidates(info, buf))
+		return -1;
+	if (info->splice_candidates_count == 0)
 		return MUTATOR_DONE;
 
-	//Pick a target to splice with
-	while (target == NULL || ((f_diff < 0 || l_diff < 2 || f_diff == l_diff) && (attempts < 2 * info->splice_files_count)))
+	// Split somewhere between the first and last differing byte.
+	target = &info->splice_candidates[UR(info, info->splice_candidates_count)];
+	split_at = target->first_diff + UR(info, target->last_diff - target->first_diff);
+
+	has_room(buf, target->length);
+	buf->length = MIN(target->length, buf->max_length);
+	if (split_at < buf->length)
+		memcpy(buf->buffer + split_at, target->data + split_at, buf->length - split_at);
+	return havoc(info, buf);
+}
+
+
+#define STAGE_SIZE(x) ((x) > 0 ? (uint64_t)(x) : 0)
+
+/**
+ * Calculates how many iterations (values of stage_cur, including the ones that return MUTATOR_TRY_AGAIN)
+ * a deterministic mutation function runs through for an input
+ * @param info - the mutate_info_t struct with the dictionary that the dictionary stages will use
+ * @param mutate_func - the mutation function to calculate the number of iterations for
+ * @param length - the length of the input being mutated
+ * @return - the number of iterations, or STAGE_NOT_DETERMINISTIC if mutate_func isn't a deterministic stage
+ */
+MUTATORS_API uint64_t stage_iteration_count(mutate_info_t * info, int(*mutate_func)(mutate_info_t *, mutate_buffer_t *), size_t length)
+{
+	int64_t len = (int64_t)length;
+	uint64_t dictionary_iterations = info->dictionary_count && info->dictq ? length * info->dictionary_count + 1 : 0;
+
+	if (mutate_func == single_walking_bit)              return STAGE_SIZE(len << 3);
+	else if (mutate_func == two_walking_bit)            return STAGE_SIZE((len << 3) - 1);
+	else if (mutate_func == four_walking_bit)           return STAGE_SIZE((len << 3) - 3);
+	else if (mutate_func == walking_byte)               return STAGE_SIZE(len);
+	else if (mutate_func == two_walking_byte)           return STAGE_SIZE(len - 1);
+	else if (mutate_func == four_walking_byte)          return STAGE_SIZE(len - 3);
+	else if (mutate_func == one_byte_arithmetics)       return STAGE_SIZE(2 * len * ARITH_MAX);
+	else if (mutate_func == two_byte_arithmetics)       return STAGE_SIZE(4 * (len - 1) * ARITH_MAX);
+	else if (mutate_func == four_byte_arithmetics)      return STAGE_SIZE(4 * (len - 3) * ARITH_MAX);
+	else if (mutate_func == interesting_one_byte)       return STAGE_SIZE(len * (int64_t)ARRAY_SIZE(interesting_8));
+	else if (mutate_func == interesting_two_byte)       return STAGE_SIZE(2 * (len - 1) * (int64_t)ARRAY_SIZE(interesting_16));
+	else if (mutate_func == interesting_four_byte)      return STAGE_SIZE(2 * (len - 3) * (int64_t)ARRAY_SIZE(interesting_32));
+	else if (mutate_func == dictionary_overwrite)       return dictionary_iterations;
+	else if (mutate_func == dictionary_insert)          return dictionary_iterations;
+	else if (mutate_func == dictionary_hint_overwrite
+		|| mutate_func == dictionary_hint_insert)       return info->dictionary_hints_count * info->dictionary_count;
+	return STAGE_NOT_DETERMINISTIC;
+}
+
+/**
+ * Finds the stage and stage_cur of a position in the deterministic stages, counting every iteration of
+ * each stage (including the ones that return MUTATOR_TRY_AGAIN).  Since the size of each stage is known
+ * from the input length, this takes one step per stage rather than one per iteration.
+ * @param info - the mutate_info_t struct with the dictionary and one_stage_only option to use
+ * @param mutate_funcs - the mutate functions that will be passed to mutate_one
+ * @param num_funcs - the number of functions in mutate_funcs
+ * @param length - the length of the input being mutated
+ * @param first - the stage that position 0 is the start of
+ * @param position - the position to find
+ * @param stage - used to return the stage of the position.  If the position is at or past the end of the
+ * deterministic stages, it's the first nondeterministic stage (or num_funcs).
+ * @param stage_cur - used to return the stage_cur of the position, or 0 if it's past the deterministic stages
+ * @return - 0 if the position is within (or at the end of) the deterministic stages, 1 if it's past the end
+ */
+static int find_stage_position(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *),
+	size_t num_funcs, size_t length, size_t first, uint64_t position, int * stage, uint64_t * stage_cur)
+{
+	uint64_t size;
+	size_t i;
+
+	for (i = first; i < num_funcs; i++)
+	{
+		if (info->one_stage_only && i != first)
+			break;
+		size = stage_iteration_count(info, mutate_funcs[i], length);
+		if (size == STAGE_NOT_DETERMINISTIC)
+			break;
+		if (position < size) {
+			*stage = (int)i;
+			*stage_cur = position;
+			return 0;
+		}
+		position -= size;
+	}
+	*stage = (int)i;
+	*stage_cur = 0;
+	return position != 0;
+}
+
+/**
+ * Calculates the position of the mutate_info_t in the deterministic stages, i.e. the total size of the
+ * stages before the current one plus the current stage_cur.  Together with set_stage_position, this lets
+ * a mutator's progress be saved, restored, or split up as a single number, in constant time no matter
+ * how far through the stages it is.
+ * @param info - the mutate_info_t struct to get the position of
+ * @param mutate_funcs - the mutate functions that will be passed to mutate_one
+ * @param num_funcs - the number of functions in mutate_funcs
+ * @param length - the length of the input being mutated
+ * @return - the position, or STAGE_NOT_DETERMINISTIC if the current stage isn't a deterministic stage
+ */
+MUTATORS_API uint64_t get_stage_position(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *),
+	size_t num_funcs, size_t length)
+{
+	uint64_t position = 0, size;
+	size_t i;
+
+	if (info->stage < 0 || (size_t)info->stage >= num_funcs
+		|| stage_iteration_count(info, mutate_funcs[info->stage], length) == STAGE_NOT_DETERMINISTIC)
+		return STAGE_NOT_DETERMINISTIC;
+	for (i = 0; i < (size_t)info->stage; i++)
 	{
-		attempts++;
-		target = info->splice_files[UR(info, info->splice_files_count)];
-		locate_diffs(buf->buffer, target->s, MIN(buf->length, target->len), &f_diff, &l_diff);
+		size = stage_iteration_count(info, mutate_funcs[i], length);
+		if (size == STAGE_NOT_DETERMINISTIC)
+			return STAGE_NOT_DETERMINISTIC;
+		position += size;
 	}
-	if (f_diff < 0 || l_diff < 2 || f_diff == l_diff)
-		return MUTATOR_TRY_AGAIN;
+	return position + info->stage_cur;
+}
 
-	// Split somewhere between the first and last differing byte.
-	split_at = f_diff + UR(info, l_diff - f_diff);
+/**
+ * Moves the mutate_info_t to a position in the deterministic stages, as returned by get_stage_position.
+ * @param info - the mutate_info_t struct to position
+ * @param mutate_funcs - the mutate functions that will be passed to mutate_one
+ * @param num_funcs - the number of functions in mutate_funcs
+ * @param length - the length of the input being mutated
+ * @param position - the position to move to
+ * @return - 0 on success, or 1 if the position is past the end of the deterministic stages, in which
+ * case the mutate_info_t is moved to the start of the first nondeterministic stage
+ */
+MUTATORS_API int set_stage_position(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *),
+	size_t num_funcs, size_t length, uint64_t position)
+{
+	return find_stage_position(info, mutate_funcs, num_funcs, length, 0, position, &info->stage, &info->stage_cur);
+}
 
-	buf->length = target->len;
-	memcpy(buf->buffer + split_at, target->s + split_at, target->len - split_at);
-	return havoc(info, buf);
+/**
+ * Positions the mutate_info_t at the start of its shard of the deterministic stages.  The deterministic
+ * stages from the current stage onward (or only the current stage, if one_stage_only is set) are split
+ * into num_shards equal ranges of iterations, and the stage and stage_cur are set to the start of the
+ * shard-th range.  mutate_one stops once it reaches the end of the range.  Since the size of each stage
+ * is known from the input length, this seeks straight to the shard rather than stepping through the
+ * iterations before it.  The stages stop being sharded at the first nondeterministic stage, such as havoc.
+ * @param info - the mutate_info_t struct with the shard and num_shards options to position
+ * @param mutate_funcs - the mutate functions that will be passed to mutate_one
+ * @param num_funcs - the number of functions in mutate_funcs
+ * @param length - the length of the input being mutated
+ */
+MUTATORS_API void start_shard(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs, size_t length)
+{
+	uint64_t size, total = 0, start, end;
+	size_t first = info->stage, last;
+
+	info->shard_status = SHARD_NONE;
+	for (last = first; last < num_funcs; last++)
+	{
+		if (info->one_stage_only && last != first)
+			break;
+		size = stage_iteration_count(info, mutate_funcs[last], length);
+		if (size == STAGE_NOT_DETERMINISTIC)
+			break;
+		total += size;
+	}
+	if (!total) //No deterministic stages to split up
+		return;
+
+	start = total * info->shard / info->num_shards;
+	end = total * (info->shard + 1) / info->num_shards;
+	find_stage_position(info, mutate_funcs, num_funcs, length, first, start, &info->stage, &info->stage_cur);
+	find_stage_position(info, mutate_funcs, num_funcs, length, first, end, &info->shard_end_stage, &info->shard_end_stage_cur);
+	info->shard_status = SHARD_ACTIVE;
 }
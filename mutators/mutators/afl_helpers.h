@@ -3,6 +3,7 @@
 #include "mutators.h"
 #include "afl_types.h"
 
+#include <global_types.h>
 #include <utils.h>
 #include <jansson_helper.h>
 
@@ -11,12 +12,33 @@ typedef struct {
 	size_t len;
 } string_t;
 
-typedef struct {
+typedef struct mutate_buffer {
 	uint8_t * buffer;
 	size_t length;
 	size_t max_length;
+	//Optional, grows the buffer to hold at least length bytes, updating buffer and max_length.  Returns zero
+	//on success, or non-zero if the buffer can't grow that large, in which case the mutation has to fit.
+	int (*reserve)(struct mutate_buffer * buf, size_t length);
+	growable_buffer_t * growable; //The growable buffer that reserve grows, if there is one
 } mutate_buffer_t;
 
+//The number of operators the havoc stage chooses from, including the two dictionary operators
+#define HAVOC_NUM_OPERATORS 17
+//The share of the operator choices that are made uniformly at random when scheduling the havoc
+//operators, so that operators that haven't found anything yet still get tried
+#define HAVOC_OPERATOR_EXPLORE_PERCENT 10
+//Once the havoc operators have been used this many times in all, their statistics are halved, so that
+//the schedule follows which operators are finding things now rather than early in the campaign
+#define HAVOC_OPERATOR_DISCOUNT_USES (1 << 20)
+
+//A file to splice with that differs enough from the current input, and the range of bytes where they differ
+typedef struct {
+	const u8 * data;
+	u32 length;
+	s32 first_diff;
+	s32 last_diff;
+} splice_candidate_t;
+
 typedef struct {
 	int should_skip_previous;
 	int one_stage_only;
@@ -31,25 +53,95 @@ typedef struct {
 	size_t splice_filenames_count;
 	uint64_t splice_files_count;
 	string_t ** splice_files;
+	char * splice_directory;
+	seed_directory_t * splice_seeds; //The files in splice_directory, mapped read-only
+
+	//The splice files and splice_directory files that can be spliced with the current input.  Built
+	//by the first splice after the input changes, since the split points only depend on the input.
+	splice_candidate_t * splice_candidates;
+	size_t splice_candidates_count;
+	int splice_candidates_built;
 
 	//Used to protects the fields below, as well as any non-thread safe fields in
-	mutex_t mutate_mutex; //the mutator-specific state (such as the iteration)
+	lock_t mutate_mutex; //the mutator-specific state (such as the iteration)
 
 	uint64_t random_state[2]; //the state of the random number generator
 	uint64_t stage_cur; //The current iteration number for the current mutation stage
 	int stage; //The current mutation stage, an index into the mutation functions passed to mutate_one
 	int queue_cycle;
 
+	//MOpt-style operator scheduling for the havoc stage, driven by report_mutate_result
+	int schedule_operators; //Whether to favor the havoc operators that have found new paths and crashes
+	uint32_t havoc_operators_used; //A bitmask of the operators used by the last havoc mutation
+	uint64_t havoc_operator_uses[HAVOC_NUM_OPERATORS]; //How many times each operator has been used
+	uint64_t havoc_operator_finds[HAVOC_NUM_OPERATORS]; //How many finds each operator contributed to
+	uint32_t havoc_operator_discounts; //How many times this state has halved the operator statistics
+
+	//Which blocks of 2^EFF_MAP_SCALE2 bytes of the input change the target's behavior.  The arithmetic
+	//and interesting value stages skip the blocks that don't.  NULL if every block should be mutated.
+	u8 * effector_map;
+	size_t effector_map_length;
+
+	//The positions in the input where a dictionary token starts or ends, which the hinted dictionary stages
+	//try first.  Built by build_dictionary_hints, NULL if the hints haven't been built.
+	uint64_t * dictionary_hints;
+	size_t dictionary_hints_count;
+	u8 * dictionary_hint_map; //Whether each position in the input is one of the dictionary_hints
+	size_t dictionary_hint_map_length;
+
+	//Splits the deterministic stages into num_shards equal ranges of iterations and only runs the shard-th
+	//one, so that the deterministic work on an input can be divided between several fuzzers
+	int shard;
+	int num_shards;
+	int shard_status; //One of the SHARD_* values below
+	int shard_end_stage; //The stage and stage_cur where the current shard ends
+	uint64_t shard_end_stage_cur;
+
+	//The buffer and length of the last mutation mutate_one made, and the range of bytes it changed, so that
+	//restore_mutate_buffer only has to undo those bytes.  changed_length is SIZE_MAX if the stage doesn't
+	//track what it changed.  last_buffer is NULL if there's nothing to undo, and must be reset to NULL
+	//when the input changes.
+	uint8_t * last_buffer;
+	size_t last_length;
+	size_t changed_offset;
+	size_t changed_length;
+
 } mutate_info_t;
 
+//The values of mutate_info_t's shard_status
+#define SHARD_NONE     0 //Sharding isn't being used
+#define SHARD_PENDING  1 //The shard's range will be calculated on the first call to mutate_one
+#define SHARD_ACTIVE   2 //The stages are running through the shard's range
+#define SHARD_FINISHED 3 //The end of the shard's range has been reached
+
 MUTATORS_API u32 UR(mutate_info_t * info, u32 limit);
 MUTATORS_API int load_dictionary(mutate_info_t * info, char * path);
 MUTATORS_API int load_splice_files(mutate_info_t * info, char ** splice_filenames, size_t splice_filenames_count);
+MUTATORS_API int load_splice_directory(mutate_info_t * info, char * directory);
+MUTATORS_API void clear_splice_candidates(mutate_info_t * info);
 MUTATORS_API int reset_mutate_info(mutate_info_t * info);
 MUTATORS_API void cleanup_mutate_info(mutate_info_t * info);
 MUTATORS_API int add_mutate_info_to_json(json_t * obj, mutate_info_t * info);
 MUTATORS_API int get_mutate_info_from_json(char * state, mutate_info_t * info);
+MUTATORS_API int build_dictionary_hints(mutate_info_t * info, const u8 * input, size_t length);
+MUTATORS_API void clear_dictionary_hints(mutate_info_t * info);
+MUTATORS_API void set_effector_map(mutate_info_t * info, u8 * effector_map, size_t effector_map_length);
+MUTATORS_API void report_mutate_result(mutate_info_t * info, int fuzz_result, int new_path);
+MUTATORS_API int mutate_many(mutate_info_t * info, int * iteration, const char * input, size_t input_length,
+	int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs,
+	char * arena, size_t capacity, size_t * offsets, size_t * lengths, size_t count);
+MUTATORS_API void mutate_buffer_set_growable(mutate_buffer_t * buf, growable_buffer_t * growable);
 MUTATORS_API int mutate_one(mutate_info_t * info, mutate_buffer_t * buf, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs);
+MUTATORS_API void restore_mutate_buffer(mutate_info_t * info, mutate_buffer_t * buf, const char * input, uint64_t flags);
+//The value stage_iteration_count returns for stages that don't have a fixed number of iterations
+#define STAGE_NOT_DETERMINISTIC UINT64_MAX
+
+MUTATORS_API uint64_t stage_iteration_count(mutate_info_t * info, int(*mutate_func)(mutate_info_t *, mutate_buffer_t *), size_t length);
+MUTATORS_API uint64_t get_stage_position(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *),
+	size_t num_funcs, size_t length);
+MUTATORS_API int set_stage_position(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *),
+	size_t num_funcs, size_t length, uint64_t position);
+MUTATORS_API void start_shard(mutate_info_t * info, int(*const*mutate_funcs)(mutate_info_t *, mutate_buffer_t *), size_t num_funcs, size_t length);
 
 //Individual mutation functions
 MUTATORS_API int single_walking_bit(mutate_info_t * info, mutate_buffer_t * buf);
@@ -66,6 +158,8 @@ MUTATORS_API int interesting_two_byte(mutate_info_t * info, mutate_buffer_t * bu
 MUTATORS_API int interesting_four_byte(mutate_info_t * info, mutate_buffer_t * buf);
 MUTATORS_API int dictionary_overwrite(mutate_info_t * info, mutate_buffer_t * buf);
 MUTATORS_API int dictionary_insert(mutate_info_t * info, mutate_buffer_t * buf);
+MUTATORS_API int dictionary_hint_overwrite(mutate_info_t * info, mutate_buffer_t * buf);
+MUTATORS_API int dictionary_hint_insert(mutate_info_t * info, mutate_buffer_t * buf);
 MUTATORS_API int havoc(mutate_info_t * info, mutate_buffer_t * buf);
 MUTATORS_API int splice_buffers(mutate_info_t * info, mutate_buffer_t * buf);
 
@@ -80,11 +174,22 @@ MUTATORS_API int splice_buffers(mutate_info_t * info, mutate_buffer_t * buf);
 	PARSE_OPTION_UINT64T_TEMP(state, options, info.random_state[0], "random_state0", cleanup_func, random_state0);                     \
 	PARSE_OPTION_UINT64T_TEMP(state, options, info.random_state[1], "random_state1", cleanup_func, random_state1);                     \
 	PARSE_OPTION_INT_TEMP(state, options, info.stage, "stage", cleanup_func, stage);                                                   \
-	PARSE_OPTION_INT_TEMP(state, options, info.stage_cur, "stage_cur", cleanup_func, stage_cur);                                       \
+	PARSE_OPTION_UINT64T_TEMP(state, options, info.stage_cur, "stage_cur", cleanup_func, stage_cur);                                   \
 	PARSE_OPTION_INT_TEMP(state, options, info.should_skip_previous, "skip_previous_stages", cleanup_func, should_skip_previous);      \
 	PARSE_OPTION_INT_TEMP(state, options, info.queue_cycle, "queue_cycle", cleanup_func, queue_cycle);                                 \
 	PARSE_OPTION_INT_TEMP(state, options, info.havoc_div, "havoc_div", cleanup_func, havoc_div);                                       \
 	PARSE_OPTION_INT_TEMP(state, options, info.perf_score, "perf_score", cleanup_func, perf_score);                                    \
+	PARSE_OPTION_INT_TEMP(state, options, info.schedule_operators, "schedule_operators", cleanup_func, schedule_operators);             \
+	PARSE_OPTION_INT_TEMP(state, options, info.shard, "shard", cleanup_func, shard);                                                   \
+	PARSE_OPTION_INT_TEMP(state, options, info.num_shards, "num_shards", cleanup_func, num_shards);                                    \
+	if (state->info.num_shards < 0 || state->info.shard < 0 ||                                                                         \
+		(state->info.num_shards && state->info.shard >= state->info.num_shards))                                                       \
+	{                                                                                                                                  \
+		cleanup_func(state);                                                                                                           \
+		return NULL;                                                                                                                   \
+	}                                                                                                                                  \
+	if (state->info.num_shards > 1)                                                                                                    \
+		state->info.shard_status = SHARD_PENDING;                                                                                      \
 	PARSE_OPTION_STRING_TEMP(state, options, info.dictionary_file, "dictionary", cleanup_func, dictionary);                            \
 	PARSE_OPTION_ARRAY_TEMP(state, options, info.splice_filenames, info.splice_filenames_count, "splice_filenames", cleanup_func, ss); \
 	if ((dictionary_required && !state->info.dictionary_file) ||                                                                       \
@@ -93,9 +198,11 @@ MUTATORS_API int splice_buffers(mutate_info_t * info, mutate_buffer_t * buf);
 		cleanup_func(state);                                                                                                           \
 		return NULL;                                                                                                                   \
 	}                                                                                                                                  \
-	if ((splice_required && !state->info.splice_filenames_count) ||                                                                    \
+	PARSE_OPTION_STRING_TEMP(state, options, info.splice_directory, "splice_directory", cleanup_func, splice_directory);               \
+	if ((splice_required && !state->info.splice_filenames_count && !state->info.splice_directory) ||                                   \
 		(state->info.splice_filenames_count &&                                                                                         \
-			load_splice_files(&state->info, state->info.splice_filenames, state->info.splice_filenames_count)))                        \
+			load_splice_files(&state->info, state->info.splice_filenames, state->info.splice_filenames_count)) ||                      \
+		(state->info.splice_directory && load_splice_directory(&state->info, state->info.splice_directory)))                           \
 	{                                                                                                                                  \
 		cleanup_func(state);                                                                                                           \
 		return NULL;                                                                                                                   \
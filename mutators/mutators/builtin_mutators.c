@@ -0,0 +1,62 @@
+#include "builtin_mutators.h"
+#include <mutator_factory.h>
+
+#include <stddef.h>
+
+//The functions of each mutator linked into the binary, as named by FUNCNAME with ALL_MUTATORS_IN_ONE
+#define BUILTIN_MUTATOR(prefix)                    \
+	void prefix ## _mutator_init(mutator_t * m);     \
+	int prefix ## _mutator_help(char ** help_str);
+
+BUILTIN_MUTATOR(afl)
+BUILTIN_MUTATOR(arithmetic)
+BUILTIN_MUTATOR(bit_flip)
+BUILTIN_MUTATOR(dictionary)
+BUILTIN_MUTATOR(grammar)
+BUILTIN_MUTATOR(havoc)
+BUILTIN_MUTATOR(honggfuzz)
+BUILTIN_MUTATOR(interesting_value)
+BUILTIN_MUTATOR(multipart)
+BUILTIN_MUTATOR(ni)
+BUILTIN_MUTATOR(nop)
+BUILTIN_MUTATOR(splice)
+BUILTIN_MUTATOR(zzuf)
+#ifndef __APPLE__
+BUILTIN_MUTATOR(radamsa)
+#endif
+#ifndef _WIN32
+BUILTIN_MUTATOR(redqueen)
+#endif
+
+#define BUILTIN_MUTATOR_ENTRY(prefix) { #prefix, prefix ## _mutator_init, prefix ## _mutator_help }
+
+static builtin_mutator_t builtin_mutators[] = {
+	BUILTIN_MUTATOR_ENTRY(afl),
+	BUILTIN_MUTATOR_ENTRY(arithmetic),
+	BUILTIN_MUTATOR_ENTRY(bit_flip),
+	BUILTIN_MUTATOR_ENTRY(dictionary),
+	BUILTIN_MUTATOR_ENTRY(grammar),
+	BUILTIN_MUTATOR_ENTRY(havoc),
+	BUILTIN_MUTATOR_ENTRY(honggfuzz),
+	BUILTIN_MUTATOR_ENTRY(interesting_value),
+	BUILTIN_MUTATOR_ENTRY(multipart),
+	BUILTIN_MUTATOR_ENTRY(ni),
+	BUILTIN_MUTATOR_ENTRY(nop),
+	BUILTIN_MUTATOR_ENTRY(splice),
+	BUILTIN_MUTATOR_ENTRY(zzuf),
+#ifndef __APPLE__
+	BUILTIN_MUTATOR_ENTRY(radamsa),
+#endif
+#ifndef _WIN32
+	BUILTIN_MUTATOR_ENTRY(redqueen),
+#endif
+};
+
+/**
+ * Registers the mutators that were built into this binary with the mutator factory, so that they're
+ * used instead of the mutator libraries.
+ */
+void builtin_mutators_register(void)
+{
+	mutator_factory_set_builtins(builtin_mutators, sizeof(builtin_mutators) / sizeof(builtin_mutators[0]));
+}
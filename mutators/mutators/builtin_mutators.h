@@ -0,0 +1,3 @@
+#pragma once
+
+void builtin_mutators_register(void);
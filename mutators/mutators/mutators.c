@@ -1,7 +1,25 @@
 #include "mutators.h"
 
+#include <utils.h>
+
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+//The header in front of each shared input's data
+typedef struct shared_input shared_input_t;
+struct shared_input
+{
+	shared_input_t * next;
+	shared_input_t * prev;
+	size_t refcount;
+	size_t length;
+	char data[];
+};
+
+static shared_input_t * shared_inputs = NULL; //The shared inputs that are still referenced
+static mutex_t shared_inputs_mutex = NULL;    //Taken to add to, walk, or remove from shared_inputs
 
 MUTATORS_API void default_free_state(char * state)
 {
@@ -12,3 +30,112 @@ MUTATORS_API int return_unknown_or_infinite_total_iterations(void * mutator_stat
 {
 	return -1; //infinite
 }
+
+/**
+ * Advances the state of the xoroshiro128+ random number generator used by the mutators by 2^64 steps.
+ * This splits the generator's period into non-overlapping streams, so that cloned mutator states
+ * don't generate the same random numbers.
+ * @param random_state - the two 64-bit words of the generator's state
+ */
+MUTATORS_API void random_jump(uint64_t * random_state)
+{
+	static const uint64_t jump[] = { 0xbeac0467eba5facbULL, 0xd86b048b86aa9922ULL };
+	uint64_t s0 = 0, s1 = 0, t0, t1;
+	int i, b;
+
+	for (i = 0; i < 2; i++) {
+		for (b = 0; b < 64; b++) {
+			if (jump[i] & (1ULL << b)) {
+				s0 ^= random_state[0];
+				s1 ^= random_state[1];
+			}
+			t0 = random_state[0];
+			t1 = random_state[1] ^ t0;
+			random_state[0] = random_rotl(t0, 55) ^ t1 ^ (t1 << 14);
+			random_state[1] = random_rotl(t1, 36);
+		}
+	}
+	random_state[0] = s0;
+	random_state[1] = s1;
+}
+
+/**
+ * Gets a shared input with the given contents.  If the given buffer is a shared input, or another shared
+ * input has the same contents, a reference to it is returned.  Otherwise a new shared input is made with
+ * a copy of the buffer.
+ * @param input - the buffer with the input's contents
+ * @param input_length - the length of the input buffer
+ * @return - the shared input, which should be released with shared_input_release once it's not needed,
+ * or NULL on failure
+ */
+MUTATORS_API char * shared_input_get(const char * input, size_t input_length)
+{
+	shared_input_t * shared;
+
+	//The first mutator state is created before any others are cloned from it for the other threads, so
+	//the mutex is made before there are any other threads that could use it
+	if (!shared_inputs_mutex) {
+		shared_inputs_mutex = create_mutex();
+		if (!shared_inputs_mutex)
+			return NULL;
+	}
+
+	take_mutex(shared_inputs_mutex);
+	//Look for the buffer itself first, as clones and sub-mutators are given their parent's shared input
+	for (shared = shared_inputs; shared && shared->data != input; shared = shared->next);
+	if (!shared || shared->length != input_length) {
+		for (shared = shared_inputs; shared; shared = shared->next) {
+			if (shared->length == input_length && !memcmp(shared->data, input, input_length))
+				break;
+		}
+	}
+	if (shared) {
+		shared->refcount++;
+		release_mutex(shared_inputs_mutex);
+		return shared->data;
+	}
+	release_mutex(shared_inputs_mutex);
+
+	shared = (shared_input_t *)malloc(offsetof(shared_input_t, data) + input_length);
+	if (!shared)
+		return NULL;
+	memcpy(shared->data, input, input_length);
+	shared->refcount = 1;
+	shared->length = input_length;
+	shared->prev = NULL;
+
+	take_mutex(shared_inputs_mutex);
+	shared->next = shared_inputs;
+	if (shared_inputs)
+		shared_inputs->prev = shared;
+	shared_inputs = shared;
+	release_mutex(shared_inputs_mutex);
+	return shared->data;
+}
+
+/**
+ * Releases a reference to a shared input, and frees it once it's no longer referenced
+ * @param input - the shared input returned by shared_input_get, or NULL
+ */
+MUTATORS_API void shared_input_release(char * input)
+{
+	shared_input_t * shared;
+
+	if (!input)
+		return;
+	shared = (shared_input_t *)(input - offsetof(shared_input_t, data));
+
+	take_mutex(shared_inputs_mutex);
+	if (--shared->refcount) {
+		release_mutex(shared_inputs_mutex);
+		return;
+	}
+	if (shared->prev)
+		shared->prev->next = shared->next;
+	else
+		shared_inputs = shared->next;
+	if (shared->next)
+		shared->next->prev = shared->prev;
+	release_mutex(shared_inputs_mutex);
+	free(shared);
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef _WIN32
 #if defined(MUTATORS_EXPORTS)
 #define MUTATORS_API __declspec(dllexport)
@@ -14,29 +17,86 @@
 #define MUTATORS_API
 #endif
 
-//If you're combining all of the mutators into one project, uncomment this to give them all
-//unique names
-//#define ALL_MUTATORS_IN_ONE
+//When all of the mutators are combined into one binary, ALL_MUTATORS_IN_ONE gives their functions unique
+//names by prefixing them with MUTATOR_PREFIX, a bare token such as bit_flip_mutator (e.g. bit_flip_mutator_init)
 #ifndef ALL_MUTATORS_IN_ONE
 #define FUNCNAME(name) name
 #else
-#define FUNCNAME(name) MUTATOR_NAME ## _ ## name
+#define FUNCNAME_PASTE(prefix, name) prefix ## _ ## name
+#define FUNCNAME_EXPAND(prefix, name) FUNCNAME_PASTE(prefix, name)
+#define FUNCNAME(name) FUNCNAME_EXPAND(MUTATOR_PREFIX, name)
 #endif
 
 MUTATORS_API void default_free_state(char * state);
 MUTATORS_API int return_unknown_or_infinite_total_iterations(void * mutator_state);
 
+//The random number generator the mutators share, xoroshiro128+ by David Blackman and Sebastiano Vigna.  Its state
+//is the two 64-bit words that the mutators save as their random_state0 and random_state1 options.  The functions
+//are inline, since the mutators draw a number for most decisions.  random_jump moves a state ahead 2^64 numbers,
+//so that each thread's copy of a mutator can have its own stream.
+MUTATORS_API void random_jump(uint64_t * random_state);
+
+static inline uint64_t random_rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t random_next(uint64_t * random_state)
+{
+	const uint64_t s0 = random_state[0];
+	uint64_t s1 = random_state[1];
+	const uint64_t result = s0 + s1;
+	s1 ^= s0;
+	random_state[0] = random_rotl(s0, 55) ^ s1 ^ (s1 << 14);
+	random_state[1] = random_rotl(s1, 36);
+	return result;
+}
+
+//Returns a random number from 0 to limit - 1 (or 0 if limit is 0) without the bias of taking the remainder.
+//Limits that fit in 32 bits use Lemire's multiply and reject method on the top bits of the generator's output,
+//which are its best, and only need a division in the rare case that a number is close to being rejected.
+static inline uint64_t random_below(uint64_t * random_state, uint64_t limit)
+{
+	uint64_t product, threshold, value;
+
+	if (limit <= 1)
+		return 0;
+	if (limit <= UINT32_MAX) {
+		product = (random_next(random_state) >> 32) * limit;
+		if ((uint32_t)product < limit) {
+			threshold = (uint32_t)(0 - (uint32_t)limit) % (uint32_t)limit;
+			while ((uint32_t)product < threshold)
+				product = (random_next(random_state) >> 32) * limit;
+		}
+		return product >> 32;
+	}
+
+	//Reject the values below the largest multiple of limit that fits in 64 bits' remainder
+	threshold = (0 - limit) % limit;
+	do {
+		value = random_next(random_state);
+	} while (value < threshold);
+	return value % limit;
+}
+
+//Shared inputs are the immutable, reference counted copies of the inputs that mutator states are given.
+//Getting a shared input for a buffer that's already a shared input, or that has the same contents as one,
+//gives another reference to it rather than a new copy, so the states cloned for each thread and the states
+//using the same seed all share one copy of it.  Mutators must only read from their shared input, and copy
+//it to a buffer of their own before changing it.
+MUTATORS_API char * shared_input_get(const char * input, size_t input_length);
+MUTATORS_API void shared_input_release(char * input);
+
 #define GENERIC_MUTATOR_CREATE(type_t, option_parser_func, cleanup_state_func) \
 	type_t * new_state = option_parser_func(options);                            \
 	if (!new_state)                                                              \
 		return NULL;                                                               \
-	new_state->input = (char *)malloc(input_length);                             \
+	new_state->input = shared_input_get(input, input_length);                    \
 	if (!new_state->input || !input_length)                                      \
 	{                                                                            \
 		cleanup_state_func(new_state);                                             \
 		return NULL;                                                               \
 	}                                                                            \
-	memcpy(new_state->input, input, input_length);                               \
 	new_state->input_length = input_length;                                      \
 	if(state && FUNCNAME(set_state)(new_state, state)) {                         \
 		cleanup_state_func(new_state);                                       \
@@ -46,7 +106,7 @@ MUTATORS_API int return_unknown_or_infinite_total_iterations(void * mutator_stat
 
 #define GENERIC_MUTATOR_CLEANUP(type_t)                                        \
 	type_t * cleanup_state = (type_t *)mutator_state;                            \
-	free(cleanup_state->input);                                                  \
+	shared_input_release(cleanup_state->input);                                  \
 	free(cleanup_state);
 
 #define GENERIC_MUTATOR_GET_ITERATION(type_t)                                  \
@@ -55,13 +115,12 @@ MUTATORS_API int return_unknown_or_infinite_total_iterations(void * mutator_stat
 
 #define GENERIC_MUTATOR_SET_INPUT(type_t)                                      \
 	type_t * state = (type_t *)mutator_state;                                    \
-	if (state->input)                                                            \
-		free(state->input);                                                        \
-	state->input = (char *)malloc(input_length);                                 \
-	if (!state->input)                                                           \
+	char * shared_input = shared_input_get(new_input, input_length);             \
+	if (!shared_input)                                                           \
 		return -1;                                                                 \
+	shared_input_release(state->input);                                          \
+	state->input = shared_input;                                                 \
 	state->input_length = input_length;                                          \
-	memcpy(state->input, new_input, input_length);                               \
 	return 0;
 
 #define GENERIC_MUTATOR_HELP(msg)                                              \
@@ -79,15 +138,30 @@ MUTATORS_API int return_unknown_or_infinite_total_iterations(void * mutator_stat
 		*input_sizes[0] = state->input_length;                                   \
 	}
 
-#define SINGLE_INPUT_MUTATE_EXTENDED(type_t, mutex)                                   \
+#define SINGLE_INPUT_MUTATE_EXTENDED(type_t, lock)                                    \
 	type_t * state = (type_t *)mutator_state;                                           \
 	int ret;                                                                            \
 	if ((flags & MUTATE_MULTIPLE_INPUTS) && (flags & MUTATE_MULTIPLE_INPUTS_MASK) != 0) \
 		return -1;                                                                        \
-	if ((flags & MUTATE_THREAD_SAFE) && take_mutex(mutex))                              \
+	if ((flags & MUTATE_THREAD_SAFE) && take_lock(lock))                                \
 		return -1;                                                                        \
 	ret = FUNCNAME(mutate)(state, buffer, buffer_length);                               \
-	if ((flags & MUTATE_THREAD_SAFE) && release_mutex(mutex))                           \
+	if ((flags & MUTATE_THREAD_SAFE) && release_lock(lock))                             \
+		return -1;                                                                        \
+	return ret;
+
+//The body of a single input mutator's mutate_growable function, which makes room for the input in the
+//growable buffer and then mutates it with the mutator's mutate_inner function
+#define SINGLE_INPUT_MUTATE_GROWABLE(type_t, lock)                                    \
+	type_t * state = (type_t *)mutator_state;                                           \
+	int ret;                                                                            \
+	if ((flags & MUTATE_MULTIPLE_INPUTS) && (flags & MUTATE_MULTIPLE_INPUTS_MASK) != 0) \
+		return -1;                                                                        \
+	if ((flags & MUTATE_THREAD_SAFE) && take_lock(lock))                                \
+		return -1;                                                                        \
+	ret = buffer->reserve(buffer, state->input_length) ? -1                             \
+		: mutate_inner(state, buffer->data, buffer->capacity, 0, buffer);                 \
+	if ((flags & MUTATE_THREAD_SAFE) && release_lock(lock))                             \
 		return -1;                                                                        \
 	return ret;
 
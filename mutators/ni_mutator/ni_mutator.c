@@ -27,7 +27,7 @@ struct ni_state
 	size_t input_length;
 
 	//Protects the fields below, i.e. the iteration count, mutate buffer information, and random state
-	mutex_t mutate_mutex;
+	lock_t mutate_mutex;
 
 	int iteration;
 	uint8_t * mutated_buffer;
@@ -60,25 +60,11 @@ mutator_t ni_mutator = {
 //// Ni mutator methods ////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifdef NI_COMPARISON_TESTING
 #define RAND(state,x)    ((x)?(rnd(state)%(x)):0)
-
-/*
- * xoroshiro128plus by David Blackman and Sebastiano Vigna
- */
-static inline uint64_t util_RotL(const uint64_t x, int k)
-{
-	return (x << k) | (x >> (64 - k));
-}
-
-static inline uint64_t rnd64(ni_state_t * state) {
-	const uint64_t s0 = state->random_state[0];
-	uint64_t s1 = state->random_state[1];
-	const uint64_t result = s0 + s1;
-	s1 ^= s0;
-	state->random_state[0] = util_RotL(s0, 55) ^ s1 ^ (s1 << 14);
-	state->random_state[1] = util_RotL(s1, 36);
-	return result;
-}
+#else
+#define RAND(state,x)    rand_below(state, x)
+#endif
 
 /**
  * This function generates a positive random number
@@ -90,47 +76,50 @@ static inline long long rnd(ni_state_t * state) {
 	//If testing to compare output against the ni binary, use random()
 	return random(); //instead of our own random number generator
 #else
-	long long r = rnd64(state);
+	long long r = random_next(state->random_state);
 	if (r < 0) r = -r;
 	return r;
 #endif
 }
 
 /**
- * This function returns a fresh copy of the input buffer or a sample provided by the
- * mutator options.
+ * This function generates a random number below a limit, without the bias of taking the remainder of rnd.
+ * Like ni's RAND, a negative limit is treated as its absolute value.
+ * @param state - a mutator specific structure previously created by the create function.
+ * @param limit - the number to generate a random number below, or 0 to return 0
+ * @return the randomly generated number
+ */
+static inline long long rand_below(ni_state_t * state, long long limit) {
+	return (long long)random_below(state->random_state, limit < 0 ? 0 - (uint64_t)limit : (uint64_t)limit);
+}
+
+/**
+ * This function returns the input buffer or a sample provided by the mutator options.  The
+ * mutations only read from the returned buffer, so it isn't copied.
  * @param state - a mutator specific structure previously created by the create function.
  * @param index - The index of the sample file to retrieve. To retrieve the input buffer,
  * specify -1 for the index.
  * @param len - A pointer to a size_t used to return the length of the retrieved buffer
- * @return A pointer to the copy of the input buffer or sample
+ * @return A pointer to the input buffer or sample.  It should not be modified or freed.
  */
-static char * get_sample(ni_state_t * state, int index, size_t *len)
+static const char * get_sample(ni_state_t * state, int index, size_t *len)
 {
-	char * content, * copy;
-	size_t length;
-
 	if(index < 0) {
-		length = state->input_length;
-		content = state->input;
-	} else {
-		length = state->samples[index]->length;
-		content = state->samples[index]->content;
+		*len = state->input_length;
+		return state->input;
 	}
-	copy = malloc(length);
-	memcpy(copy, content, length);
-	*len = length;
-	return copy;
+	*len = state->samples[index]->length;
+	return state->samples[index]->content;
 }
 
 /**
  * This function picks a random sample provided by the mutator options or the input buffer
- * and returns a copy to it.
+ * and returns it.
  * @param state - a mutator specific structure previously created by the create function.
  * @param len - A pointer to a size_t used to return the length of the retrieved buffer
- * @return A pointer to the copy of the input buffer or sample
+ * @return A pointer to the input buffer or sample.  It should not be modified or freed.
  */
-static char * get_random_sample(ni_state_t * state, size_t *len)
+static const char * get_random_sample(ni_state_t * state, size_t *len)
 {
 	int index = RAND(state, state->num_samples + 1);
 	if(index == state->num_samples)
@@ -153,15 +142,15 @@ static char * get_random_sample(ni_state_t * state, size_t *len)
 #define MIN(a, b)  (((a) < (b)) ? a : b)
 #define BUFSIZE    4096
 
-static char * random_block(ni_state_t * state, size_t orig_len, size_t * new_len) {
+//Picks a random span of a random sample.  The returned block points into the sample rather than
+//being copied out of it, so it should not be modified or freed.
+static const char * random_block(ni_state_t * state, size_t orig_len, size_t * new_len) {
 	size_t sample_len, start, len;
-	char * sample, * block;
+	const char * sample;
 
 	sample = get_random_sample(state, &sample_len);
-	if(sample_len < 3) {
-		free(sample);
+	if(sample_len < 3)
 		return NULL;
-	}
 
 	start = RAND(state,sample_len-2);
 	len = sample_len - start;
@@ -170,11 +159,8 @@ static char * random_block(ni_state_t * state, size_t orig_len, size_t * new_len
 	len = RAND(state,len);
 	len = MIN(len, sample_len - start);
 
-	block = malloc(len);
-	memcpy(block, sample + start, len);
 	*new_len = len;
-	free(sample);
-	return block;
+	return sample + start;
 }
 
 static void write_all(ni_state_t * state, const char *data, size_t n) {
@@ -417,10 +403,10 @@ static void mutate_area(ni_state_t * state, const char *data, size_t end) {
 	char buff[BUFSIZE];
 	int choice;
 retry:
-	choice = rnd(state) % 35;
+	choice = RAND(state,35);
 	switch(choice) {
 		case 0: { /* insert a random byte */
-			size_t pos = (end ? rnd(state) % end : 0);
+			size_t pos = RAND(state,end);
 			write_all(state, data, pos);
 			buff[0] = rnd(state) & 255;
 			write_all(state, buff, 1);
@@ -428,7 +414,7 @@ retry:
 			break;
 		}
 		case 1: { /* drop a byte */
-			size_t pos = (end ? rnd(state) % end : 0);
+			size_t pos = RAND(state,end);
 			if (pos+1 >= end)
 				goto retry;
 			write_all(state, data, pos);
@@ -440,8 +426,8 @@ retry:
 			size_t s, e;
 			if (!end)
 				goto retry;
-			s = rnd(state) % end;
-			e = rnd(state) % end;
+			s = RAND(state,end);
+			e = RAND(state,end);
 			if (s == e)
 				goto retry;
 			write_all(state, data, e);
@@ -454,11 +440,11 @@ retry:
 			int n = 8;
 			while (rnd(state) & 1 && n < 20000)
 				n <<= 1;
-			n = rnd(state) % n + 2;
+			n = RAND(state,n) + 2;
 			if (!end)
 				goto retry;
-			a = (end ? rnd(state) % end : 0);
-			b = (end ? rnd(state) % end : 0);
+			a = RAND(state,end);
+			b = RAND(state,end);
 			if (a == b) {
 				goto retry;
 			} else if (a > b) {
@@ -470,15 +456,15 @@ retry:
 
 			write_all(state, data, s);
 			if (l * n > 134217728)
-				l = rnd(state) % 1024 + 2;
+				l = RAND(state,1024) + 2;
 			while(n--)
 				write_all(state, data+s, l);
 			write_all(state, data+s, end-s);
 			break;
 		}
 		case 6: { /* insert random data */
-			size_t pos = (end ? rnd(state) % end : 0);
-			int n = rnd(state) % 1022 + 2;
+			size_t pos = RAND(state,end);
+			int n = RAND(state,1022) + 2;
 			int p = 0;
 			while (p < n)
 				buff[p++] = rnd(state) & 255;
@@ -512,8 +498,8 @@ retry:
 		case 20:
 		case 21: { /* aimed random block fusion */
 			size_t j, l, dm, sm;
-			char *buff, *block;
-			size_t bend, block_len;
+			const char *buff, *block;
+			size_t bend, block_len = 0;
 			if (end < 8) goto retry;
 			block = random_block(state, end, &block_len);
 			if (block_len < 8)
@@ -529,13 +515,12 @@ retry:
 			aim(state, buff, bend , data, end, &j, &l);
 			write_all(state, buff, j);
 			write_all(state, data + l, end - l);
-			free(block);
 			break;
 		}
 		case 22:
 		case 23: { /* insert semirandom bytes */
 			size_t p = 0, n = RAND(state,BUFSIZE);
-			size_t pos = (end ? rnd(state) % end : 0);
+			size_t pos = RAND(state,end);
 			n = RAND(state,n+1);
 			n = RAND(state,n+1);
 			n = RAND(state,n+1);
@@ -632,8 +617,8 @@ static void ni_area(ni_state_t * state, const char *data, size_t end, int n) {
  * @param state - a mutator specific structure previously created by the create function.
  */
 static void ni(ni_state_t* state) {
-	char *data;
-	char *datap;
+	const char *data;
+	const char *datap;
 	size_t j, l, end, endp;
 	int m, n = 0;
 
@@ -652,29 +637,23 @@ static void ni(ni_state_t* state) {
 		aim(state, data, end, datap, endp, &j, &l);
 		ni_area(state, data, j, m);
 		ni_area(state, datap + l, endp - l, n);
-		free(datap);
 	}
-	free(data);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////
 //// API methods ///////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifndef ALL_MUTATORS_IN_ONE
-
 /**
  * This function fills in the supplied mutator_t with all of the function
  * pointers for this mutator.
  * @param m - a pointer to a mutator_t structure
  */
-NI_MUTATOR_API void init(mutator_t * m)
+NI_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &ni_mutator, sizeof(mutator_t));
 }
 
-#endif
-
 /**
  * This function creates and initializes a ni_state_t object based on the passed in JSON options.
  * @return the newly created ni_state_t object or NULL on failure
@@ -691,7 +670,7 @@ static ni_state_t * setup_options(char * options)
 	//Setup defaults
 	state->random_state[0] = (((uint64_t)rand()) << 32) | rand();
 	state->random_state[1] = (((uint64_t)rand()) << 32) | rand();
-	state->mutate_mutex = create_mutex();
+	state->mutate_mutex = create_lock();
 	if (!state->mutate_mutex) {
 		free(state);
 		return NULL;
@@ -745,13 +724,12 @@ NI_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * inpu
 	if (!ni_state)
 		return NULL;
 
-	ni_state->input = (char *)malloc(input_length);
+	ni_state->input = shared_input_get(input, input_length);
 	if (!ni_state->input || !input_length)
 	{
 		FUNCNAME(cleanup)(ni_state);
 		return NULL;
 	}
-	memcpy(ni_state->input, input, input_length);
 	ni_state->input_length = input_length;
 	if (state && FUNCNAME(set_state)(ni_state, state)) {
 		FUNCNAME(cleanup)(ni_state);
@@ -771,7 +749,7 @@ NI_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	size_t i;
 	ni_state_t * ni_state = (ni_state_t *)mutator_state;
 
-	destroy_mutex(ni_state->mutate_mutex);
+	destroy_lock(ni_state->mutate_mutex);
 	for(i = 0; i < ni_state->num_samples; i++) {
 		if(ni_state->samples) {
 			if(ni_state->samples[i])
@@ -782,7 +760,7 @@ NI_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	}
 	free(ni_state->sample_filenames);
 	free(ni_state->samples);
-	free(ni_state->input);
+	shared_input_release(ni_state->input);
 	free(ni_state);
 }
 
@@ -28,6 +28,4 @@ NI_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inp
 NI_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 NI_MUTATOR_API int FUNCNAME(help)(char ** help_str);
 
-#ifndef ALL_MUTATORS_IN_ONE
-NI_MUTATOR_API void init(mutator_t * m);
-#endif
+NI_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
@@ -32,12 +32,10 @@ mutator_t nop_mutator = {
 	FUNCNAME(help)
 };
 
-#ifndef ALL_MUTATORS_IN_ONE
-NOP_MUTATOR_API void init(mutator_t * m)
+NOP_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &nop_mutator, sizeof(mutator_t));
 }
-#endif
 
 NOP_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length)
 {
@@ -47,13 +45,12 @@ NOP_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * inp
 		return NULL;
 	memset(nop_state, 0, sizeof(nop_state_t));
 
-	nop_state->input = (char *)malloc(input_length);
+	nop_state->input = shared_input_get(input, input_length);
 	if (!nop_state->input || !input_length)
 	{
 		FUNCNAME(cleanup)(nop_state);
 		return NULL;
 	}
-	memcpy(nop_state->input, input, input_length);
 	nop_state->input_length = input_length;
 	return nop_state;
 }
@@ -61,7 +58,7 @@ NOP_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * inp
 NOP_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 {
 	nop_state_t * nop_state = (nop_state_t *)mutator_state;
-	free(nop_state->input);
+	shared_input_release(nop_state->input);
 	free(nop_state);
 }
 
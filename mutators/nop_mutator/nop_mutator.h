@@ -28,6 +28,4 @@ NOP_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_in
 NOP_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 NOP_MUTATOR_API int FUNCNAME(help)(char ** help_str);
 
-#ifndef ALL_MUTATORS_IN_ONE
-NOP_MUTATOR_API void init(mutator_t * m);
-#endif
+NOP_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
@@ -24,6 +24,27 @@
 #include <unistd.h>
 #endif
 
+#ifdef _WIN32
+#define close_socket closesocket
+#else
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define close_socket close
+#endif
+
+//The default number of radamsa outputs to request at once.  radamsa's daemon hands out one output per
+//connection, so the connections for a batch are all opened before any of them are read.  This should stay
+//below the length of radamsa's listen queue, otherwise the extra connections stall until it is drained.
+#define DEFAULT_PREFETCH 4
+
+//An output that has been read from radamsa but not yet returned from the mutate function
+typedef struct radamsa_output
+{
+	char * buffer;
+	size_t length;
+	int radamsa_iteration; //The value of radamsa_iteration once this output has been consumed
+} radamsa_output_t;
+
 typedef struct radamsa_state
 {
 	char * input;
@@ -45,12 +66,22 @@ typedef struct radamsa_state
 	//The port to bind radamsa to
 	int port;
 
-	//The number of times we've connected to radamsa's port.  This is different from iteration
+	//The number of radamsa outputs that have been consumed.  This is different from iteration
 	//since sometimes radamsa doesn't return input, and we have to call radamsa again.  Thus,
 	//we need to keep track of radamsa's iteration count, so that we can later fast forward
 	//if asked to load a previous mutator state.
 	int radamsa_iteration;
 
+	//The number of times we've connected to radamsa's port.  This is ahead of radamsa_iteration
+	//by the number of connections whose outputs are still waiting in the prefetched ring buffer.
+	int fetched_iteration;
+
+	//A ring buffer of the outputs that have been read from radamsa ahead of time
+	int prefetch; //The number of outputs to read from radamsa at once
+	radamsa_output_t * prefetched;
+	int prefetched_start; //The index in prefetched of the next output to return
+	int prefetched_count; //The number of outputs in prefetched
+
 	//The handle/pid of the radamsa instance
 #ifdef _WIN32
 	HANDLE process;
@@ -58,12 +89,13 @@ typedef struct radamsa_state
 	int process;
 #endif
 
-	//A mutex used when doing thread safe mutations
-	mutex_t mutate_mutex;
+	//A lock used when doing thread safe mutations
+	lock_t mutate_mutex;
 } radamsa_state_t;
 
 static void cleanup_process(radamsa_state_t * state);
 static int start_process(radamsa_state_t * state);
+static void clear_prefetched(radamsa_state_t * state);
 
 mutator_t radamsa_mutator = {
 	FUNCNAME(create),
@@ -80,12 +112,10 @@ mutator_t radamsa_mutator = {
 	FUNCNAME(help)
 };
 
-#ifndef ALL_MUTATORS_IN_ONE
-RADAMSA_MUTATOR_API void init(mutator_t * m)
+RADAMSA_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &radamsa_mutator, sizeof(mutator_t));
 }
-#endif
 
 #ifdef _WIN32
 #define PATH_SEP "\\"
@@ -109,7 +139,8 @@ RADAMSA_MUTATOR_API radamsa_state_t * setup_options(char * options)
 	//Setup defaults
 	state->port = 10000 + (rand() % 50000);
 	state->seed = rand();
-	state->mutate_mutex = create_mutex();
+	state->prefetch = DEFAULT_PREFETCH;
+	state->mutate_mutex = create_lock();
 	if (!state->mutate_mutex) {
 		free(state);
 		return NULL;
@@ -120,6 +151,16 @@ RADAMSA_MUTATOR_API radamsa_state_t * setup_options(char * options)
 		PARSE_OPTION_INT(state, options, seed, "seed", FUNCNAME(cleanup));
 		PARSE_OPTION_INT(state, options, port, "port", FUNCNAME(cleanup));
 		PARSE_OPTION_INT(state, options, radamsa_iteration, "radamsa_iteration", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, prefetch, "prefetch", FUNCNAME(cleanup));
+	}
+	if (state->prefetch < 1) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+	state->prefetched = (radamsa_output_t *)calloc(state->prefetch, sizeof(radamsa_output_t));
+	if (!state->prefetched) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
 	}
 
 	if (!state->path) {
@@ -154,13 +195,12 @@ RADAMSA_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char *
 	if (!new_state)
 		return NULL;
 
-	new_state->input = (char *)malloc(input_length);
+	new_state->input = shared_input_get(input, input_length);
 	if (!new_state->input || !input_length)
 	{
 		FUNCNAME(cleanup)(new_state);
 		return NULL;
 	}
-	memcpy(new_state->input, input, input_length);
 	new_state->input_length = input_length;
 
 	if (FUNCNAME(set_state)(new_state, state))
@@ -175,30 +215,29 @@ RADAMSA_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 {
 	radamsa_state_t * state = (radamsa_state_t *)mutator_state;
 	cleanup_process(state);
-	destroy_mutex(state->mutate_mutex);
-	free(state->input);
+	clear_prefetched(state);
+	destroy_lock(state->mutate_mutex);
+	free(state->prefetched);
+	shared_input_release(state->input);
 	free(state->path);
 	free(state);
 }
 
-static int mutate_inner(radamsa_state_t * state, char * buffer, size_t buffer_length)
+/**
+ * Connects to the radamsa daemon, which writes one output to each connection and then closes it
+ * @param state - the radamsa_state_t with the port radamsa is listening on
+ * @return - the connected socket, or INVALID_SOCKET on failure
+ */
+static SOCKET connect_to_radamsa(radamsa_state_t * state)
 {
 	struct sockaddr_in addr;
-	int attempts, result, total_read = 0;
-#ifdef _WIN32
+	int attempts, result;
 	SOCKET sock;
-#else
-	int sock;
-#endif
 
 	//Create a socket for us to connect to the radamsa daemon
 	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-#ifdef _WIN32
 	if (sock == INVALID_SOCKET)
-#else
-	if (sock < 0)
-#endif
-		return -1;
+		return INVALID_SOCKET;
 
 	//connect to the radamsa daemon.  Sometimes it takes a bit to startup and bind to the port, so if we just
 	//started radamsa, we'll try multiple times with a little sleep in between if it fails.
@@ -218,34 +257,125 @@ static int mutate_inner(radamsa_state_t * state, char * buffer, size_t buffer_le
 		sleep(1);
 #endif
 	}
-	if(attempts >= 5)
-		return -1;
+	if (result < 0) {
+		close_socket(sock);
+		return INVALID_SOCKET;
+	}
 	state->radamsa_up = 1;
-	state->radamsa_iteration++;
+	state->fetched_iteration++;
+	return sock;
+}
 
-	//Read radamsa's response
-	result = 1;
-	while (total_read < (int)buffer_length && result > 0)
+/**
+ * Reads one of radamsa's outputs from a connection, until radamsa closes it
+ * @param sock - a socket returned by connect_to_radamsa
+ * @param max_length - the largest output to keep, anything after this is discarded
+ * @param output - a pointer used to return the output.  On success, the caller should free it.
+ * @return - the length of the output, or -1 on error
+ */
+static int read_output(SOCKET sock, size_t max_length, char ** output)
+{
+	char discard[4096];
+	int result = 1, total_read = 0;
+
+	*output = (char *)malloc(max_length);
+	if (!*output)
+		return -1;
+	while (result > 0)
 	{
-		result = recv(sock, buffer + total_read, buffer_length - total_read, 0);
-		if (result > 0)
+		if (total_read < (int)max_length)
+			result = recv(sock, *output + total_read, max_length - total_read, 0);
+		else
+			result = recv(sock, discard, sizeof(discard), 0);
+		if (result > 0 && total_read < (int)max_length)
 			total_read += result;
 		else if (result < 0) //Error, then break
 			total_read = -1;
 	}
+	if (total_read <= 0) {
+		free(*output);
+		*output = NULL;
+	}
+	return total_read;
+}
 
-#ifdef _WIN32
-	closesocket(sock);
-#else
-	close(sock);
-#endif
+/**
+ * Fills the prefetched ring buffer with the next prefetch outputs from radamsa.  All of the connections are
+ * opened before any of them are read, so radamsa can generate the later outputs while the earlier ones are
+ * being read, rather than waiting on a full connection round trip for each output.
+ * @param state - the radamsa_state_t to fill the prefetched ring buffer of.  It should be empty.
+ * @param max_length - the largest output to keep
+ * @return - 0 on success, or -1 on failure
+ */
+static int prefetch_outputs(radamsa_state_t * state, size_t max_length)
+{
+	SOCKET socks[64];
+	int num_socks, i, length, ret = 0;
+	char * buffer;
+
+	state->prefetched_start = 0;
+	num_socks = state->prefetch < (int)ARRAY_SIZE(socks) ? state->prefetch : (int)ARRAY_SIZE(socks);
+	for (i = 0; i < num_socks; i++) {
+		socks[i] = connect_to_radamsa(state);
+		if (socks[i] == INVALID_SOCKET)
+			break;
+	}
+	if (i == 0)
+		return -1;
+	num_socks = i;
+
+	for (i = 0; i < num_socks; i++) {
+		length = ret ? -1 : read_output(socks[i], max_length, &buffer);
+		close_socket(socks[i]);
+		if (length < 0) {
+			ret = -1;
+			continue;
+		}
+		//In some non-error cases, radamsa just returns 0 bytes.  Since we don't want to
+		//return an empty input, skip over it and let the mutator use the next one
+		if (length == 0)
+			continue;
+		state->prefetched[state->prefetched_count].buffer = buffer;
+		state->prefetched[state->prefetched_count].length = length;
+		state->prefetched[state->prefetched_count].radamsa_iteration = state->fetched_iteration - num_socks + i + 1;
+		state->prefetched_count++;
+	}
+	return ret;
+}
+
+/**
+ * Throws away any outputs in the prefetched ring buffer, so that the next output is read from radamsa
+ * @param state - the radamsa_state_t to clear the prefetched ring buffer of
+ */
+static void clear_prefetched(radamsa_state_t * state)
+{
+	int i;
+	for (i = 0; i < state->prefetched_count; i++)
+		free(state->prefetched[(state->prefetched_start + i) % state->prefetch].buffer);
+	state->prefetched_start = 0;
+	state->prefetched_count = 0;
+	state->fetched_iteration = state->radamsa_iteration;
+}
+
+static int mutate_inner(radamsa_state_t * state, char * buffer, size_t buffer_length)
+{
+	radamsa_output_t * output;
+	int length;
 
-	if (total_read == 0) //In some non-error cases, radamsa just returns 0 bytes
-	{ //Since we don't want to do this, just call the mutator again
-		total_read = mutate_inner(state, buffer, buffer_length);
+	while (!state->prefetched_count) {
+		if (prefetch_outputs(state, buffer_length) && !state->prefetched_count)
+			return -1;
 	}
 
-	return total_read;
+	output = &state->prefetched[state->prefetched_start];
+	length = (int)(output->length < buffer_length ? output->length : buffer_length);
+	memcpy(buffer, output->buffer, length);
+	free(output->buffer);
+	output->buffer = NULL;
+	state->radamsa_iteration = output->radamsa_iteration;
+	state->prefetched_start = (state->prefetched_start + 1) % state->prefetch;
+	state->prefetched_count--;
+	return length;
 }
 
 /**
@@ -307,6 +437,7 @@ RADAMSA_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state)
 		GET_INT(temp, state, current_state->seed, "seed", result);
 	}
 	cleanup_process(current_state);
+	clear_prefetched(current_state);
 	return start_process(current_state);
 }
 
@@ -339,16 +470,12 @@ RADAMSA_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * nu
 RADAMSA_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
 	radamsa_state_t * state = (radamsa_state_t *)mutator_state;
-	if (state->input) {
-		free(state->input);
-		state->input = NULL;
-	}
-	state->input = (char *)malloc(input_length);
-	if (!state->input) {
+	char * shared_input = shared_input_get(new_input, input_length);
+	if (!shared_input)
 		return -1;
-	}
+	shared_input_release(state->input);
+	state->input = shared_input;
 	state->input_length = input_length;
-	memcpy(state->input, new_input, input_length);
 	FUNCNAME(set_state)(mutator_state, NULL); //give the new input to radamsa.exe
 	return 0;
 }
@@ -365,6 +492,8 @@ RADAMSA_MUTATOR_API int FUNCNAME(help)(char** help_str)
 "radamsa - Radamsa mutator (Starts and calls radamsa to mutate input)\n"
 "Options:\n"
 "  path                  The path to radamsa.exe\n"
+"  prefetch              The number of outputs to request from radamsa at once\n"
+"                          (default 4)\n"
 "  port                  The port to tell radamsa to bind to when starting up\n"
 "  radamsa_iteration     The number of iterations to seek forward in the\n"
 "                          radamsa output\n"
@@ -396,6 +525,6 @@ static int start_process(radamsa_state_t * state)
 	char cmd_line[256];
 	snprintf(cmd_line, sizeof(cmd_line), "%s -o :%d -n inf -s %d ", state->path, state->port, state->seed);
 	if (state->radamsa_iteration != 0)
-		snprintf(cmd_line, sizeof(cmd_line), "%s -S %d ", cmd_line, state->radamsa_iteration + 1); //radamsa counts from 1
+		snprintf(cmd_line + strlen(cmd_line), sizeof(cmd_line) - strlen(cmd_line), "-S %d ", state->radamsa_iteration + 1); //radamsa counts from 1
 	return start_process_and_write_to_stdin(cmd_line, state->input, state->input_length, &state->process);
 }
@@ -28,6 +28,4 @@ RADAMSA_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * nu
 RADAMSA_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 RADAMSA_MUTATOR_API int FUNCNAME(help)(char **);
 
-#ifndef ALL_MUTATORS_IN_ONE
-RADAMSA_MUTATOR_API void init(mutator_t * m);
-#endif
+RADAMSA_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
@@ -0,0 +1,522 @@
+#include "redqueen_mutator.h"
+#include <mutators.h>
+#include <afl_config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <utils.h>
+#include <jansson.h>
+#include <jansson_helper.h>
+
+//The default number of seconds to let the target run while logging its compares
+#define DEFAULT_TIMEOUT 2
+
+//The most places in the input a single encoding of an operand is replaced at
+#define MAX_OCCURRENCES 16
+
+//The most replacements made for one input
+#define MAX_REPLACEMENTS 4096
+
+//A replacement of an observed compare operand in the input with the constant it was compared against
+typedef struct replacement
+{
+	size_t offset;
+	uint8_t old_length; //The number of bytes of the input that are replaced
+	uint8_t length;     //The number of bytes in data
+	uint8_t data[CMPLOG_MAX_LEN];
+} replacement_t;
+
+struct redqueen_state
+{
+	char * input;
+	size_t input_length;
+	int iteration;
+
+	//Options
+	char * path;      //The target built with AFL_LLVM_CMPLOG
+	char * arguments; //The arguments to pass to the target
+	int timeout;      //The number of seconds to let the target run
+
+	//The target's command line, split the first time the target is run
+	command_line_t command_line;
+
+	//The operand pair log the target fills in
+	int shm_id;
+	uint8_t * pairs;
+
+	//The replacements found for the current input, in the order they are tried
+	replacement_t * replacements;
+	size_t num_replacements;
+
+	lock_t mutate_mutex;
+};
+typedef struct redqueen_state redqueen_state_t;
+
+mutator_t redqueen_mutator = {
+	FUNCNAME(create),
+	FUNCNAME(cleanup),
+	FUNCNAME(mutate),
+	FUNCNAME(mutate_extended),
+	FUNCNAME(get_state),
+	redqueen_free_state,
+	FUNCNAME(set_state),
+	FUNCNAME(get_current_iteration),
+	FUNCNAME(get_total_iteration_count),
+	FUNCNAME(get_input_info),
+	FUNCNAME(set_input),
+	FUNCNAME(help)
+};
+
+/**
+ * This function fills in m with all of the function pointers for this mutator.
+ * @param m - a pointer to a mutator_t structure
+ * @return none
+ */
+REDQUEEN_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
+{
+	memcpy(m, &redqueen_mutator, sizeof(mutator_t));
+}
+
+static redqueen_state_t * setup_options(char * options)
+{
+	redqueen_state_t * state;
+	state = (redqueen_state_t *)malloc(sizeof(redqueen_state_t));
+	if (!state)
+		return NULL;
+	memset(state, 0, sizeof(redqueen_state_t));
+	state->shm_id = -1;
+
+	//Setup defaults
+	state->timeout = DEFAULT_TIMEOUT;
+	state->mutate_mutex = create_lock();
+	if (!state->mutate_mutex) {
+		free(state);
+		return NULL;
+	}
+
+	if (options && strlen(options)) {
+		PARSE_OPTION_STRING(state, options, path, "path", FUNCNAME(cleanup));
+		PARSE_OPTION_STRING(state, options, arguments, "arguments", FUNCNAME(cleanup));
+		PARSE_OPTION_INT(state, options, timeout, "timeout", FUNCNAME(cleanup));
+	}
+	if (!state->path || state->timeout <= 0) {
+		ERROR_MSG("The redqueen mutator needs the path of a target built with AFL_LLVM_CMPLOG and a positive timeout");
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+
+	state->replacements = (replacement_t *)malloc(MAX_REPLACEMENTS * sizeof(replacement_t));
+	state->shm_id = shmget(IPC_PRIVATE, CMPLOG_PAIRS_SHM_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+	if (!state->replacements || state->shm_id < 0) {
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+	state->pairs = shmat(state->shm_id, NULL, 0);
+	if (state->pairs == (void *)-1) {
+		state->pairs = NULL;
+		FUNCNAME(cleanup)(state);
+		return NULL;
+	}
+	return state;
+}
+
+/**
+ * Runs the target on the current input, with the operand pair log mapped, so
+ * that the log holds the compares the input reached.  The input is given to
+ * the target on stdin.
+ * @param state - the mutator state with the input to run
+ * @return 0 on success, non-zero on failure
+ */
+static int run_target(redqueen_state_t * state)
+{
+	char * cmd_line;
+	char shm_str[16];
+	FILE * input_file;
+	pid_t child;
+	int i, status, ret = 1;
+
+	memset(state->pairs, 0, CMPLOG_PAIRS_SHM_SIZE);
+
+	if (!state->command_line.argv) {
+		cmd_line = (char *)malloc(strlen(state->path) + (state->arguments ? strlen(state->arguments) : 0) + 2);
+		if (!cmd_line)
+			return 1;
+		sprintf(cmd_line, "%s %s", state->path, state->arguments ? state->arguments : "");
+		i = command_line_update(&state->command_line, cmd_line);
+		free(cmd_line);
+		if (i)
+			return 1;
+	}
+
+	//A file doesn't block when the target doesn't read all of the input, unlike a pipe
+	input_file = tmpfile();
+	if (!input_file || fwrite(state->input, 1, state->input_length, input_file) != state->input_length
+			|| fflush(input_file))
+		goto cleanup;
+	rewind(input_file);
+	snprintf(shm_str, sizeof(shm_str), "%d", state->shm_id);
+
+	child = fork();
+	if (child < 0)
+		goto cleanup;
+	if (child == 0) {
+		i = open("/dev/null", O_WRONLY);
+		dup2(fileno(input_file), STDIN_FILENO);
+		if (i >= 0) {
+			dup2(i, STDOUT_FILENO);
+			dup2(i, STDERR_FILENO);
+		}
+		//Make sure the target doesn't touch the coverage map or fork server of an afl instrumentation
+		close(FORKSRV_FD);
+		close(FORKSRV_FD + 1);
+		unsetenv(SHM_ENV_VAR);
+		setenv(CMPLOG_PAIRS_SHM_ENV_VAR, shm_str, 1);
+		execv(state->command_line.executable, state->command_line.argv);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (wait_for_process_exit(child, state->timeout * 1000) != 1)
+		kill(child, SIGKILL);
+	while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+	ret = 0;
+
+cleanup:
+	if (input_file)
+		fclose(input_file);
+	return ret;
+}
+
+/**
+ * Adds a replacement for each place in the input that the pattern is found,
+ * skipping any that are already in the list.
+ * @param state - the mutator state to add the replacements to
+ * @param pattern - the bytes of the observed operand to look for
+ * @param pattern_length - the length of the pattern
+ * @param data - the bytes of the constant to replace the pattern with
+ * @param length - the length of data
+ */
+static void add_replacements(redqueen_state_t * state, const uint8_t * pattern, size_t pattern_length,
+	const uint8_t * data, size_t length)
+{
+	const uint8_t * input = (const uint8_t *)state->input;
+	replacement_t * r;
+	size_t offset, i;
+	int occurrences = 0;
+
+	if (!pattern_length || pattern_length > state->input_length)
+		return;
+
+	for (offset = 0; offset + pattern_length <= state->input_length && occurrences < MAX_OCCURRENCES; offset++) {
+		if (memcmp(input + offset, pattern, pattern_length))
+			continue;
+		occurrences++;
+
+		for (i = 0; i < state->num_replacements; i++) {
+			r = &state->replacements[i];
+			if (r->offset == offset && r->old_length == pattern_length && r->length == length
+					&& !memcmp(r->data, data, length))
+				break;
+		}
+		if (i < state->num_replacements)
+			continue;
+		if (state->num_replacements == MAX_REPLACEMENTS)
+			return;
+
+		r = &state->replacements[state->num_replacements++];
+		r->offset = offset;
+		r->old_length = (uint8_t)pattern_length;
+		r->length = (uint8_t)length;
+		memcpy(r->data, data, length);
+	}
+}
+
+/**
+ * Stores an integer in size bytes, in either byte order.
+ * @param buffer - the buffer to store the value in
+ * @param value - the value to store
+ * @param size - the number of bytes to store
+ * @param big_endian - whether to store the most significant byte first
+ */
+static void store_int(uint8_t * buffer, uint64_t value, size_t size, int big_endian)
+{
+	size_t i;
+	for (i = 0; i < size; i++)
+		buffer[big_endian ? size - 1 - i : i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * Runs the target on the current input and turns the compares it logged into
+ * the list of replacements to try.  For integer compares, the observed value
+ * is looked for in both byte orders, and is replaced with the constant and the
+ * constant plus or minus one in the same byte order.  For string compares, the
+ * observed string is replaced with the constant.
+ * @param state - the mutator state to find the replacements for
+ * @return 0 on success, non-zero on failure
+ */
+static int find_replacements(redqueen_state_t * state)
+{
+	uint8_t pattern[8], data[8];
+	uint8_t * slot, * constant, * observed;
+	uint64_t constant_value, observed_value;
+	int i, big_endian, delta;
+	size_t j, size;
+
+	state->num_replacements = 0;
+	if (run_target(state))
+		return 1;
+
+	for (i = 0; i < CMPLOG_PAIR_SLOTS; i++) {
+		slot = state->pairs + i * CMPLOG_PAIR_SLOT_SIZE;
+		constant = slot + 3;
+		observed = slot + 3 + CMPLOG_MAX_LEN;
+		if (slot[1] > CMPLOG_MAX_LEN || slot[2] > CMPLOG_MAX_LEN)
+			continue;
+
+		if (slot[0] == CMPLOG_PAIR_STR)
+			add_replacements(state, observed, slot[2], constant, slot[1]);
+		else if (slot[0] == CMPLOG_PAIR_INT && slot[1] == slot[2] && slot[1] <= sizeof(pattern)) {
+			size = slot[1];
+			constant_value = observed_value = 0;
+			for (j = 0; j < size; j++) {
+				constant_value |= (uint64_t)constant[j] << (8 * j);
+				observed_value |= (uint64_t)observed[j] << (8 * j);
+			}
+			for (big_endian = 0; big_endian < 2; big_endian++) {
+				store_int(pattern, observed_value, size, big_endian);
+				for (delta = 0; delta <= 2; delta++) { //+0, +1, -1
+					store_int(data, constant_value + (delta == 2 ? -1 : delta), size, big_endian);
+					add_replacements(state, pattern, size, data, size);
+				}
+			}
+		}
+	}
+	DEBUG_MSG("Found %lu input-to-state replacements", (unsigned long)state->num_replacements);
+	return 0;
+}
+
+/**
+ * This function will allocate and initialize the mutator state used in the other Mutator API
+ * functions.  The target is run once on the input to find the replacements.
+ * @param options - a json string that contains the mutator specific string of options.
+ * @param state - Optionally, used to load a previously dumped state (with the get_state()
+ * function), that defines the current iteration of the mutator.
+ * @param input - used to produce new mutated inputs later when the mutate function is called
+ * @param input_length - the size of the input buffer
+ * @return a mutator specific structure or NULL on failure.
+ */
+REDQUEEN_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length)
+{
+	redqueen_state_t * new_state = setup_options(options);
+	if (!new_state)
+		return NULL;
+
+	new_state->input = shared_input_get(input, input_length);
+	if (!new_state->input || !input_length)
+	{
+		FUNCNAME(cleanup)(new_state);
+		return NULL;
+	}
+	new_state->input_length = input_length;
+	if (find_replacements(new_state) || (state && FUNCNAME(set_state)(new_state, state)))
+	{
+		FUNCNAME(cleanup)(new_state);
+		return NULL;
+	}
+	return new_state;
+}
+
+/**
+ * This function will release any resources that the mutator has open
+ * and free the mutator state structure.
+ * @param mutator_state - a mutator specific structure previously created by
+ * the create function.  This structure will be freed and should not be referenced afterwards.
+ */
+REDQUEEN_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
+{
+	redqueen_state_t * state = (redqueen_state_t *)mutator_state;
+	if (state->pairs)
+		shmdt(state->pairs);
+	if (state->shm_id >= 0)
+		shmctl(state->shm_id, IPC_RMID, NULL);
+	destroy_lock(state->mutate_mutex);
+	free(state->replacements);
+	command_line_free(&state->command_line);
+	free(state->path);
+	free(state->arguments);
+	shared_input_release(state->input);
+	free(state);
+}
+
+/**
+ * This function will mutate the input given in the create function and return it in the buffer argument.
+ * Each mutation makes one of the replacements found for the input.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a buffer that the mutated input will be written to
+ * @param buffer_length - the size of the passed in buffer argument.  It must be at least as large as
+ * the original input buffer.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
+{
+	redqueen_state_t * state = (redqueen_state_t *)mutator_state;
+	replacement_t * r;
+	size_t tail;
+
+	if (buffer_length < state->input_length)
+		return -1;
+	if ((size_t)state->iteration >= state->num_replacements)
+		return 0;
+
+	r = &state->replacements[state->iteration];
+	tail = state->input_length - r->offset - r->old_length;
+	if (r->offset + r->length + tail > buffer_length)
+		return -1;
+
+	state->iteration++;
+	memcpy(buffer, state->input, r->offset);
+	memcpy(buffer + r->offset, r->data, r->length);
+	memcpy(buffer + r->offset + r->length, state->input + r->offset + r->old_length, tail);
+	return (int)(r->offset + r->length + tail);
+}
+
+/**
+ * This function will mutate the input given in the create function and return it in the buffer argument.
+ * This function also accepts a set of flags which instruct it how to mutate the input.  See global_types.h
+ * for the list of available flags.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a buffer that the mutated input will be written to
+ * @param buffer_length - the size of the passed in buffer argument.  It must be at least as large as
+ * the original input buffer.
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_EXTENDED(redqueen_state_t, state->mutate_mutex);
+}
+
+/**
+ * This function will return the state of the mutator.  The returned value can be used to restart the
+ * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
+ * responsibility to free the memory allocated here by calling the free_state function.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return - a buffer that defines the current state of the mutator.
+ */
+REDQUEEN_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state)
+{
+	redqueen_state_t * state = (redqueen_state_t *)mutator_state;
+	json_t *state_obj, *temp;
+	char * ret;
+
+	state_obj = json_object();
+	ADD_INT(temp, state->iteration, state_obj, "iteration");
+	ret = json_dumps(state_obj, 0);
+	json_decref(state_obj);
+	return ret;
+}
+
+/**
+ * This function will set the current state of the mutator.
+ * This can be used to restart a mutator once from a previous run.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param state - a previously dumped state buffer obtained by the get_state function.
+ * @return 0 on success or non-zero on failure
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state)
+{
+	redqueen_state_t * current_state = (redqueen_state_t *)mutator_state;
+	int result, temp_int;
+	if (!state)
+		return 1;
+	GET_INT(temp_int, state, current_state->iteration, "iteration", result);
+	return 0;
+}
+
+/**
+ * This function will return the current iteration count of the mutator, i.e.
+ * how many mutations have been generated with it.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return value - the number of previously generated mutations
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state)
+{
+	GENERIC_MUTATOR_GET_ITERATION(redqueen_state_t);
+}
+
+/**
+ * Returns the total number of mutations possible with this mutator and the current input.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @return the number of replacements found for the current input
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(get_total_iteration_count)(void * mutator_state)
+{
+	redqueen_state_t * state = (redqueen_state_t *)mutator_state;
+	return (int)state->num_replacements;
+}
+
+/**
+ * Obtains information about the inputs that were given to the mutator when it was created
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param num_inputs - a pointer to an integer used to return the number of inputs given to this mutator
+ * when it was created.  This parameter is optional and can be NULL, if this information is not needed
+ * @param input_sizes - a pointer to a size_t array used to return the sizes of the inputs given to this
+ * mutator when it was created. This parameter is optional and can be NULL, if this information is not needed.
+ */
+REDQUEEN_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes)
+{
+	SINGLE_INPUT_GET_INFO(redqueen_state_t);
+}
+
+/**
+ * This function will set the mutator's input to something new, and run the target on it to find
+ * the replacements for it.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param new_input - The new input used to produce new mutated inputs later when the mutate function is called
+ * @param input_length - the size in bytes of the input buffer.
+ * @return 0 on success and -1 on failure
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
+{
+	redqueen_state_t * state = (redqueen_state_t *)mutator_state;
+	char * shared_input = shared_input_get(new_input, input_length);
+	if (!shared_input)
+		return -1;
+	shared_input_release(state->input);
+	state->input = shared_input;
+	state->input_length = input_length;
+	if (find_replacements(state))
+		return -1;
+	return 0;
+}
+
+/**
+ * This function sets a help message for the mutator.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+REDQUEEN_MUTATOR_API int FUNCNAME(help)(char **help_str)
+{
+	GENERIC_MUTATOR_HELP(
+"redqueen - input-to-state replacement mutator\n"
+"Runs a build of the target made with AFL_LLVM_CMPLOG on each input, and\n"
+"replaces the parts of the input that the target compared against a constant\n"
+"with that constant (in both byte orders, and plus or minus one for integers)\n"
+"Options:\n"
+"  path                  The path to the AFL_LLVM_CMPLOG build of the target,\n"
+"                          which reads the input from stdin (required)\n"
+"  arguments             The arguments to pass to the target\n"
+"  timeout               The number of seconds to let the target run while\n"
+"                          logging its compares (default 2)\n"
+"\n"
+	);
+}
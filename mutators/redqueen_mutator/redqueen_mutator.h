@@ -0,0 +1,31 @@
+#pragma once
+
+#include <global_types.h>
+#include <mutators.h>
+
+#ifdef _WIN32
+#ifdef REDQUEEN_MUTATOR_EXPORTS
+#define REDQUEEN_MUTATOR_API __declspec(dllexport)
+#else
+#define REDQUEEN_MUTATOR_API __declspec(dllimport)
+#endif
+#else //_WIN32
+#define REDQUEEN_MUTATOR_API
+#endif
+
+#define MUTATOR_NAME "redqueen"
+
+REDQUEEN_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * input, size_t input_length);
+REDQUEEN_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state);
+REDQUEEN_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length);
+REDQUEEN_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags);
+REDQUEEN_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state);
+#define redqueen_free_state default_free_state
+REDQUEEN_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state);
+REDQUEEN_MUTATOR_API int FUNCNAME(get_current_iteration)(void * mutator_state);
+REDQUEEN_MUTATOR_API int FUNCNAME(get_total_iteration_count)(void * mutator_state);
+REDQUEEN_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num_inputs, size_t **input_sizes);
+REDQUEEN_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
+REDQUEEN_MUTATOR_API int FUNCNAME(help)(char ** help_str);
+
+REDQUEEN_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
@@ -37,7 +37,12 @@ mutator_t splice_mutator = {
 	splice_get_total_iteration_count,
 	FUNCNAME(get_input_info),
 	FUNCNAME(set_input),
-	FUNCNAME(help)
+	FUNCNAME(help),
+	NULL, //report_result
+	NULL, //clone_state
+	NULL, //merge_state
+	NULL, //mutate_batch
+	FUNCNAME(mutate_growable)
 };
 
 /**
@@ -45,12 +50,10 @@ mutator_t splice_mutator = {
  * @param m - a pointer to a mutator_t structure
  * @return none
  */
-#ifndef ALL_MUTATORS_IN_ONE
-SPLICE_MUTATOR_API void init(mutator_t * m)
+SPLICE_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
 	memcpy(m, &splice_mutator, sizeof(mutator_t));
 }
-#endif
 
 static splice_state_t * setup_options(char * options)
 {
@@ -99,7 +102,8 @@ SPLICE_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
 	GENERIC_MUTATOR_CLEANUP(splice_state_t)
 }
 
-static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe)
+static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_length, int is_thread_safe,
+	growable_buffer_t * growable)
 {
 	splice_state_t * state = (splice_state_t *)mutator_state;
 	mutate_buffer_t buf;
@@ -110,9 +114,10 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	buf.buffer = (uint8_t *)buffer;
 	buf.length = MIN(buffer_length, state->input_length);
 	buf.max_length = buffer_length;
+	mutate_buffer_set_growable(&buf, growable);
 	memcpy(buf.buffer, state->input, buf.length);
 
-	if(is_thread_safe && take_mutex(state->info.mutate_mutex))
+	if(is_thread_safe && take_lock(state->info.mutate_mutex))
 		return -1;
 	if (state->info.stage_cur > MAX(HAVOC_MIN, SPLICE_HAVOC * (state->info.perf_score / state->info.havoc_div) / 100))
 	{
@@ -122,7 +127,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
 	}
 	state->iteration++;
 	ret = mutate_one(&state->info, &buf, mutate_funcs, ARRAY_SIZE(mutate_funcs));
-	if (is_thread_safe && release_mutex(state->info.mutate_mutex))
+	if (is_thread_safe && release_lock(state->info.mutate_mutex))
 		return -1;
 	return ret;
 }
@@ -137,7 +142,7 @@ static int mutate_inner(void * mutator_state, char * buffer, size_t buffer_lengt
  */
 SPLICE_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length)
 {
-	return mutate_inner(mutator_state, buffer, buffer_length, 0);
+	return mutate_inner(mutator_state, buffer, buffer_length, 0, NULL);
 }
 
 /**
@@ -156,6 +161,19 @@ SPLICE_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * bu
 	SINGLE_INPUT_MUTATE_EXTENDED(splice_state_t, state->info.mutate_mutex);
 }
 
+/**
+ * This function will mutate the input given in the create function into a growable buffer, growing the
+ * buffer when a mutation needs more room than it has.
+ * @param mutator_state - a mutator specific structure previously created by the create function.
+ * @param buffer - a growable buffer that the mutated input will be written to
+ * @param flags - A set of mutate flags that modify how this mutator mutates the input.
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+SPLICE_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	SINGLE_INPUT_MUTATE_GROWABLE(splice_state_t, state->info.mutate_mutex);
+}
+
 /**
  * This function will return the state of the mutator.  The returned value can be used to restart the
  * mutator at a later time, by passing it to the create or set_state function.  It is the caller's
@@ -230,6 +248,8 @@ SPLICE_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num
  */
 SPLICE_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length)
 {
+	//The splice candidates were picked for the old input
+	clear_splice_candidates(&((splice_state_t *)mutator_state)->info);
 	GENERIC_MUTATOR_SET_INPUT(splice_state_t);
 }
 
@@ -259,6 +279,9 @@ SPLICE_MUTATOR_API int FUNCNAME(help)(char **help_str)
 "                          generator\n"
 "  splice_filenames      An array of files to use during afl's splice stage,\n"
 "                          for mixing with the input\n"
+"  splice_directory      A directory of files, such as a corpus, to use during\n"
+"                          afl's splice stage along with splice_filenames.  The\n"
+"                          files are mapped read-only rather than copied\n"
 "\n"
 	);
 }
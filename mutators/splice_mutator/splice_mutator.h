@@ -19,6 +19,7 @@ SPLICE_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char *
 SPLICE_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state);
 SPLICE_MUTATOR_API int FUNCNAME(mutate)(void * mutator_state, char * buffer, size_t buffer_length);
 SPLICE_MUTATOR_API int FUNCNAME(mutate_extended)(void * mutator_state, char * buffer, size_t buffer_length, uint64_t flags);
+SPLICE_MUTATOR_API int FUNCNAME(mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
 SPLICE_MUTATOR_API char * FUNCNAME(get_state)(void * mutator_state);
 #define splice_free_state default_free_state
 SPLICE_MUTATOR_API int FUNCNAME(set_state)(void * mutator_state, char * state);
@@ -28,6 +29,4 @@ SPLICE_MUTATOR_API void FUNCNAME(get_input_info)(void * mutator_state, int * num
 SPLICE_MUTATOR_API int FUNCNAME(set_input)(void * mutator_state, char * new_input, size_t input_length);
 SPLICE_MUTATOR_API int FUNCNAME(help)(char **help_str);
 
-#ifndef ALL_MUTATORS_IN_ONE
-SPLICE_MUTATOR_API void init(mutator_t * m);
-#endif
+SPLICE_MUTATOR_API void FUNCNAME(init)(mutator_t * m);
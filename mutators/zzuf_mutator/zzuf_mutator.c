@@ -47,12 +47,18 @@ struct zzuf_state
   int64_t *ranges;            // Per-offset byte protection
 
   //Protects the fields below, i.e. the iteration count, data array, and random state
-  mutex_t mutate_mutex;
+  lock_t mutate_mutex;
 
   int iteration;
   unsigned long ctx;
   int current_chunk;
   uint8_t data[CHUNKBYTES];
+
+  //The offsets in data that have a nonzero bitmask, so that only those bytes need to be visited
+  //when applying it.  Usually only a handful of the bytes in a chunk are fuzzed.
+  uint16_t touched[CHUNKBYTES];
+  int num_touched;
+  uint8_t is_touched[CHUNKBYTES]; //Whether each offset in data is already in touched
 };
 typedef struct zzuf_state zzuf_state_t;
 
@@ -244,7 +250,7 @@ void _zz_fuzz(zzuf_state_t * state, char * buf, int64_t len)
   uint32_t chunkseed;
   int64_t i, j, start, stop;
   unsigned char byte, fuzzbyte;
-  int todo;
+  int todo, k;
   unsigned int idx;
   uint8_t bit;
 
@@ -261,7 +267,12 @@ void _zz_fuzz(zzuf_state_t * state, char * buf, int64_t len)
 
       zzuf_srand(state, chunkseed);
 
-      memset(state->data, 0, CHUNKBYTES);
+      //Only the bytes set by the last chunk need to be cleared
+      for (k = 0; k < state->num_touched; k++) {
+        state->data[state->touched[k]] = 0;
+        state->is_touched[state->touched[k]] = 0;
+      }
+      state->num_touched = 0;
 
       /* Add some random dithering to handle ratio < 1.0/CHUNKBYTES */
       todo = (int)((state->ratio * (8 * CHUNKBYTES) * 1000000.0 + zzuf_rand(state, 1000000)) / 1000000.0);
@@ -270,17 +281,30 @@ void _zz_fuzz(zzuf_state_t * state, char * buf, int64_t len)
         idx = zzuf_rand(state, CHUNKBYTES);
         bit = (1 << zzuf_rand(state, 8));
         state->data[idx] ^= bit;
+        if (!state->is_touched[idx]) {
+          state->is_touched[idx] = 1;
+          state->touched[state->num_touched++] = (uint16_t)idx;
+        }
       }
 
       state->current_chunk = i;
     }
 
-    // Apply our bitmask array to the buffer
+    // Apply our bitmask array to the buffer.  Each byte is fuzzed independently of
+    // the others, so only the bytes with a nonzero bitmask need to be visited.
     start = (i * CHUNKBYTES > 0) ? i * CHUNKBYTES : 0;
     stop = ((i + 1) * CHUNKBYTES < len) ? (i + 1) * CHUNKBYTES : len;
 
-    for (j = start; j < stop; ++j)
+    for (k = 0; k < state->num_touched; ++k)
     {
+      j = start + state->touched[k];
+      if (j >= stop)
+        continue;
+
+      fuzzbyte = state->data[state->touched[k]];
+      if(!fuzzbyte)
+        continue; // The bits flipped for this byte cancelled out
+
       if (state->ranges && !_zz_isinrange(j, state->ranges))
         continue; // Not in one of the ranges, skip byte
 
@@ -289,10 +313,6 @@ void _zz_fuzz(zzuf_state_t * state, char * buf, int64_t len)
       if(state->protect[byte])
         continue;
 
-      fuzzbyte = state->data[j % CHUNKBYTES];
-      if(!fuzzbyte)
-        continue;
-
       switch (state->mode)
       {
         case FUZZING_XOR:
@@ -318,20 +338,16 @@ void _zz_fuzz(zzuf_state_t * state, char * buf, int64_t len)
 //// API methods ///////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifndef ALL_MUTATORS_IN_ONE
-
 /**
  * This function fills in the supplied mutator_t with all of the function
  * pointers for this mutator.
  * @param m - a pointer to a mutator_t structure
  */
-ZZUF_MUTATOR_API void init(mutator_t * m)
+ZZUF_MUTATOR_API void FUNCNAME(init)(mutator_t * m)
 {
   memcpy(m, &zzuf_mutator, sizeof(mutator_t));
 }
 
-#endif
-
 /**
  * This function sets up the refuse, protect, and range tables from the associated strings in a
  * state.  Additionally, the fuzzing mode is set from the mode string.
@@ -382,7 +398,7 @@ static zzuf_state_t * setup_options(char * options)
   memset(state, 0, sizeof(zzuf_state_t));
 
   state->current_chunk = -1;
-  state->mutate_mutex = create_mutex();
+  state->mutate_mutex = create_lock();
   if (!state->mutate_mutex) {
     free(state);
     return NULL;
@@ -428,13 +444,12 @@ ZZUF_MUTATOR_API void * FUNCNAME(create)(char * options, char * state, char * in
   if (!zzuf_state)
     return NULL;
 
-  zzuf_state->input = (char *)malloc(input_length);
+  zzuf_state->input = shared_input_get(input, input_length);
   if (!zzuf_state->input || !input_length)
   {
     FUNCNAME(cleanup)(zzuf_state);
     return NULL;
   }
-  memcpy(zzuf_state->input, input, input_length);
   zzuf_state->input_length = input_length;
   if (state && FUNCNAME(set_state)(zzuf_state, state)) {
     FUNCNAME(cleanup)(zzuf_state);
@@ -454,9 +469,9 @@ ZZUF_MUTATOR_API void FUNCNAME(cleanup)(void * mutator_state)
   size_t i;
   zzuf_state_t * state = (zzuf_state_t *)mutator_state;
 
-  destroy_mutex(state->mutate_mutex);
+  destroy_lock(state->mutate_mutex);
   free_ranges(state);
-  free(state->input);
+  shared_input_release(state->input);
   free(state);
 }
 
@@ -12,8 +12,10 @@
 #include <instrumentation_factory.h>
 #include <utils.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /**
@@ -26,12 +28,16 @@ void usage(char * program_name)
 	printf(
 		"Usage: %s driver_name instrumentation_name seed_directory [options]\n"
 		"\n"
+		"The seed_directory can also be a packed corpus (see corpus_pack.h).\n"
+		"\n"
 		"Options:\n"
 		"\t -d driver_options             Set the options for the driver\n"
 		"\t -i instrumentation_options    Set the options for the instrumentation\n"
 		"\t -ib ignore_bytes_dir          The directory to write the list of bytes in the instrumentation to ignore\n"
 		"\t -l logging_options            Set the options for logging\n"
 		"\t -n num_iterations             The number of iterations to run per file [default 10 per file]\n"
+		"\t -w num_workers                The number of files to test in parallel, each with its own\n"
+		"\t                                driver and instrumentation state [default 1]\n"
 		"\n",
 		program_name
 	);
@@ -49,32 +55,221 @@ void usage(char * program_name)
 }
 
 
-int main(int argc, char ** argv)
+//The coverage that one module had while one of the seed files was tested
+struct module_trace
+{
+	char * name;
+	int info_size;
+	char * first;       //The module's instrumentation data from the first iteration of the file
+	char * previous;    //The module's instrumentation data from the last iteration of the file
+	char * unstable;    //Non-zero for each byte that changed between iterations of the file
+	int unstable_count;
+};
+typedef struct module_trace module_trace_t;
+
+//The coverage of each module while one of the seed files was tested
+struct file_result
+{
+	module_trace_t * modules;
+	int num_modules;
+};
+typedef struct file_result file_result_t;
+
+//A worker that tests seed files, with its own driver and instrumentation state
+struct picker_worker
 {
 	driver_t * driver;
-	instrumentation_t * instrumentation;
+	void * instrumentation_state;
+	thread_t thread;
+};
+typedef struct picker_worker picker_worker_t;
+
+static instrumentation_t * instrumentation = NULL;
+static char * instrumentation_name = NULL;
+static seed_directory_t * seeds = NULL;
+static file_result_t * file_results = NULL;
+static int num_iterations = 10;
+static int next_file = 0;
+static mutex_t next_file_mutex;
+
+/**
+ * This function gets the instrumentation data of one of the modules from the last run.  Instrumentations
+ * without per module coverage have a single module, named after the instrumentation, whose instrumentation
+ * data is the coverage bitmap.
+ * @param state - the instrumentation state that ran the target
+ * @param index - the index of the module to get
+ * @param name - a pointer used to return the module's name
+ * @param info - a pointer used to return the module's instrumentation data
+ * @param size - a pointer used to return the size of the module's instrumentation data
+ * @return - zero on success, or non-zero if there isn't a module with this index
+ */
+static int get_module_coverage(void * state, int index, char ** name, char ** info, int * size)
+{
+	const uint8_t * trace_bits;
+	size_t trace_size;
+	int new_path;
+
+	if (instrumentation->get_module_info)
+		return instrumentation->get_module_info(state, index, &new_path, name, info, size);
+	if (index || instrumentation->get_trace_bits(state, &trace_bits, &trace_size))
+		return 1;
+	*name = instrumentation_name;
+	*info = (char *)trace_bits;
+	*size = (int)trace_size;
+	return 0;
+}
+
+/**
+ * This function compares the instrumentation data from two iterations of a file a word at a time, and marks
+ * the bytes that differ as unstable.
+ * @param previous - the instrumentation data from the previous iteration
+ * @param current - the instrumentation data from this iteration
+ * @param size - the size of the instrumentation data
+ * @param unstable - the module's unstable bytes, which are set to 0xff for the bytes that differ
+ * @param new_unstable - a pointer used to return how many of the differing bytes weren't already unstable
+ * @return - the number of bytes that differ
+ */
+static int mark_unstable_bytes(const char * previous, const char * current, int size, char * unstable, int * new_unstable)
+{
+	uint64_t previous_word, current_word, diff;
+	int i, j, count = 0;
+
+	*new_unstable = 0;
+	for (i = 0; i < size; i += sizeof(uint64_t))
+	{
+		if (size - i >= (int)sizeof(uint64_t))
+		{
+			memcpy(&previous_word, previous + i, sizeof(uint64_t));
+			memcpy(&current_word, current + i, sizeof(uint64_t));
+			diff = previous_word ^ current_word;
+		}
+		else
+		{
+			diff = 0;
+			memcpy(&diff, current + i, size - i);
+			previous_word = 0;
+			memcpy(&previous_word, previous + i, size - i);
+			diff ^= previous_word;
+		}
+		if (!diff) //Most of the words are the same
+			continue;
+
+		for (j = 0; j < (int)sizeof(uint64_t); j++)
+		{
+			if (((uint8_t *)&diff)[j])
+			{
+				if (!unstable[i + j])
+					(*new_unstable)++;
+				unstable[i + j] = (char)0xff;
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * This function records the instrumentation data of a module from one iteration of a file.
+ * @param result - the results of the file being tested
+ * @param index - the index of the module
+ * @param name - the name of the module
+ * @param info - the module's instrumentation data
+ * @param size - the size of the info parameter
+ * @param filename - the name of the file being tested, for the debug messages
+ * @param iteration - the iteration of the file being tested
+ */
+static void record_module_coverage(file_result_t * result, int index, char * name, char * info, int size,
+	char * filename, int iteration)
+{
+	module_trace_t * trace;
+	int count, new_unstable;
+
+	if (index >= result->num_modules)
+	{
+		result->modules = (module_trace_t *)realloc(result->modules, (index + 1) * sizeof(module_trace_t));
+		if (!result->modules)
+			FATAL_MSG("Couldn't allocate the module coverage");
+		memset(result->modules + result->num_modules, 0, (index + 1 - result->num_modules) * sizeof(module_trace_t));
+		result->num_modules = index + 1;
+	}
+
+	trace = &result->modules[index];
+	if (!trace->name)
+	{
+		trace->name = strdup(name);
+		trace->info_size = size;
+		trace->first = (char *)memdup(info, size);
+		trace->previous = (char *)memdup(info, size);
+		trace->unstable = (char *)calloc(1, size);
+		if (!trace->name || !trace->first || !trace->previous || !trace->unstable)
+			FATAL_MSG("Couldn't allocate the module coverage");
+		return;
+	}
+
+	if (size != trace->info_size)
+		FATAL_MSG("Module %s instrumentation data varies in size, not supported (yet)", name);
+	count = mark_unstable_bytes(trace->previous, info, size, trace->unstable, &new_unstable);
+	trace->unstable_count += new_unstable;
+	memcpy(trace->previous, info, size);
+	DEBUG_MSG("Module %s File %s iteration (%d/%d) ignore count %d total ignore count %d", name, filename,
+		iteration - 1, iteration, count, trace->unstable_count);
+}
+
+/**
+ * This function is a picker worker thread, which tests the seed files until there aren't any left.
+ * @param arg - a pointer to the picker_worker_t to run
+ */
+static THREAD_FUNC(picker_worker_thread)
+{
+	picker_worker_t * worker = (picker_worker_t *)arg;
+	seed_file_t * seed;
+	char * module_name, * info;
+	int file, iteration, module_index, info_size;
+
+	while (1)
+	{
+		take_mutex(next_file_mutex);
+		file = next_file < (int)seeds->count ? next_file++ : -1;
+		release_mutex(next_file_mutex);
+		if (file < 0)
+			break;
+
+		seed = &seeds->seeds[file];
+		INFO_MSG("Testing file '%s'", seed->filename);
+		for (iteration = 0; iteration < num_iterations; iteration++)
+		{
+			worker->driver->test_input(worker->driver->state, (char *)seed->data, seed->length);
+
+			module_index = 0;
+			while (!get_module_coverage(worker->instrumentation_state, module_index, &module_name, &info, &info_size))
+			{
+				if (!info)
+					FATAL_MSG("Instrumentation data unavailable from the %s instrumentation.\n", instrumentation_name);
+				record_module_coverage(&file_results[file], module_index, module_name, info, info_size,
+					seed->filename, iteration);
+				module_index++;
+			}
+		}
+	}
+	THREAD_RETURN;
+}
+
+int main(int argc, char ** argv)
+{
+	picker_worker_t * workers;
+	module_trace_t * trace, * modules = NULL;
 	char *driver_name, *driver_options = NULL,
-		*seed_directory = NULL, *seed_buffer = NULL, * module_name = NULL, *logging_options = NULL,
-		*instrumentation_name = NULL, *instrumentation_options = NULL, *ignore_bytes_dir = NULL;
-	void * instrumentation_state = NULL;
-	int seed_length = 0, file_count, module_index, new_path, cur_index;
-	int iteration = 0;
-	WIN32_FIND_DATA fdFile;
-	HANDLE file_handle;
+		*seed_directory = NULL, *logging_options = NULL,
+		*instrumentation_options = NULL, *ignore_bytes_dir = NULL;
+	int file_count, module_index, j;
 	char filename[4096];
-	char ** module_names = NULL, ** filenames = NULL;
-	char * module_infos = NULL;
 	int * module_results = NULL;
-	char * info, * ignore_bytes;
-	int num_modules = 0, num_files = 0, info_size, module_info_size = -1, i;
+	int num_modules = 0, num_files = 0, num_workers = 1, i;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	//Default options
-	int num_iterations = 10;
-
 	if (argc < 4)
 	{
 		usage(argv[0]);
@@ -90,6 +285,7 @@ int main(int argc, char ** argv)
 		ELSE_IF_ARG_OPTION("-ib", ignore_bytes_dir)
 		ELSE_IF_ARG_OPTION("-l", logging_options)
 		ELSE_IF_ARGINT_OPTION("-n", num_iterations)
+		ELSE_IF_ARGINT_OPTION("-w", num_workers)
 		else
 		{
 			if (strcmp("-h", argv[i]))
@@ -106,6 +302,20 @@ int main(int argc, char ** argv)
 
 	if (num_iterations < 2)
 		FATAL_MSG("Bad iteration number (%d).  Must have a iteration count greater than 1.", num_iterations);
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have at least one worker.", num_workers);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Get the list of files to test /////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	
+	//Map each of the seed files once, skipping empty files
+	seeds = load_seed_directory(seed_directory);
+	if (!seeds)
+		FATAL_MSG("Could not find any non-empty seed files in %s", seed_directory);
+	num_files = (int)seeds->count;
+	if (num_workers > num_files)
+		num_workers = num_files;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
@@ -114,50 +324,45 @@ int main(int argc, char ** argv)
 	instrumentation = instrumentation_factory(instrumentation_name);
 	if (!instrumentation)
 		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
-	instrumentation_state = instrumentation->create(instrumentation_options, NULL);
-	if (!instrumentation_state)
-		FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
-	if (!instrumentation->get_module_info)
-		FATAL_MSG("Instrumentation '%s' does not support per module coverage", instrumentation_name);
-
-	//Create the driver
-	driver = driver_instrumentation_factory(driver_name, driver_options, instrumentation, instrumentation_state);
-	if (!driver)
-		FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options);
+	if (!instrumentation->get_module_info && !instrumentation->get_trace_bits)
+		FATAL_MSG("Instrumentation '%s' does not support per module coverage or a coverage bitmap", instrumentation_name);
+
+	//Each worker gets its own instrumentation state and driver, so the files can be tested in parallel
+	workers = (picker_worker_t *)calloc(num_workers, sizeof(picker_worker_t));
+	file_results = (file_result_t *)calloc(num_files, sizeof(file_result_t));
+	next_file_mutex = create_mutex();
+	if (!workers || !file_results || !next_file_mutex)
+		FATAL_MSG("Couldn't allocate the state for %d workers", num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].instrumentation_state = instrumentation->create(instrumentation_options, NULL);
+		if (!workers[i].instrumentation_state)
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		workers[i].driver = driver_worker_factory(driver_name, driver_options, i, instrumentation,
+			workers[i].instrumentation_state, NULL, NULL);
+		if (!workers[i].driver)
+			FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options);
+	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Get the list of files to test /////////////////////////////////////////////////////////////////////
+	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	
-	memset(filename, 0, sizeof(filename));
-	snprintf(filename, sizeof(filename) - 1, "%s\\*", seed_directory);
-	file_count = 0;
-
-	int success = 1;
-	for (file_handle = FindFirstFile(filename, &fdFile);
-		file_handle != INVALID_HANDLE_VALUE && success;
-		success = FindNextFile(file_handle, &fdFile))
-	{
-		//Skip directories
-		if (fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-			continue;
 
-		//Read the seed file
-		memset(filename, 0, sizeof(filename));
-		snprintf(filename, sizeof(filename) - 1, "%s\\%s", seed_directory, fdFile.cFileName);
-		seed_length = read_file(filename, &seed_buffer);
-		if (seed_length <= 0) //Couldn't read file, or empty file
-			continue;
-		free(seed_buffer);
-
-		num_files++;
-		filenames = (char **)realloc(filenames, num_files * sizeof(char *));
-		filenames[num_files - 1] = strdup(filename);
+	if (num_workers == 1)
+		picker_worker_thread(&workers[0]);
+	else
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			if (create_thread(&workers[i].thread, picker_worker_thread, &workers[i]))
+				FATAL_MSG("Failed to start worker %d", i);
+		}
+		for (i = 0; i < num_workers; i++)
+			join_thread(workers[i].thread);
 	}
-	FindClose(file_handle);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
+	// Combine the files' results and calculate ignore bytes /////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #define INITIAL_STATE 0
@@ -171,138 +376,75 @@ int main(int argc, char ** argv)
 		"one path for each file" //NEW_PATH_ON_DIFF_FILE
 	};
 
-	for(file_count = 0; file_count < num_files; file_count++)
+	//Logic:
+	//If any of the files took different paths through the module on different iterations, the module has
+	//  multiple paths for the same file, and the bytes that changed between the iterations are ignored.
+	//Otherwise, if the files' first iterations took different paths, the module has one path per file.
+	//Otherwise, every file took the same path through the module.
+	//
+	//The modules list holds each module's combined results, where first is the instrumentation data of the
+	//first file that ran the module, and unstable is the union of every file's unstable bytes.
+	for (file_count = 0; file_count < num_files; file_count++)
 	{
-		//Read the seed file
-		seed_length = read_file(filenames[file_count], &seed_buffer);
-		if (seed_length <= 0) //Couldn't read file, or empty file
-			continue;
-
-		INFO_MSG("Testing file '%s'", filenames[file_count]);
-		for (iteration = 0; iteration < num_iterations; iteration++)
+		for (i = 0; i < file_results[file_count].num_modules; i++)
 		{
-			driver->test_input(driver->state, seed_buffer, seed_length);
-
-			module_index = 0;
-			while (!instrumentation->get_module_info(instrumentation_state, module_index, &new_path, &module_name, &info, &info_size))
+			trace = &file_results[file_count].modules[i];
+			if (!trace->name)
+				continue;
+			for (module_index = 0; module_index < num_modules; module_index++)
 			{
-				cur_index = module_index;
-				module_index++;
+				if (!strcmp(modules[module_index].name, trace->name))
+					break;
+			}
 
-				if (module_info_size == -1)
-					module_info_size = info_size;
-				if (info_size != module_info_size)
-					FATAL_MSG("Module instrumentation data varies per size, not supported (yet)");
-				if (!info)
-					FATAL_MSG("Instrumentation data unavailable from the %s instrumentation.\n", instrumentation_name);
+			if (module_index == num_modules)
+			{
+				modules = (module_trace_t *)realloc(modules, (num_modules + 1) * sizeof(module_trace_t));
+				module_results = (int *)realloc(module_results, (num_modules + 1) * sizeof(int));
+				if (!modules || !module_results)
+					FATAL_MSG("Couldn't allocate the module results");
+				modules[module_index] = *trace;
+				modules[module_index].unstable_count = 0;
+				module_results[module_index] = PATH_SET;
+				num_modules++;
+			}
+			else if (modules[module_index].info_size != trace->info_size)
+				FATAL_MSG("Module %s instrumentation data varies in size, not supported (yet)", trace->name);
+			else if (module_results[module_index] == PATH_SET
+				&& memcmp(modules[module_index].first, trace->first, trace->info_size))
+				module_results[module_index] = NEW_PATH_ON_DIFF_FILE;
 
-				if (num_modules < module_index)
+			if (trace->unstable_count)
+			{
+				module_results[module_index] = NEW_PATH_ON_SAME_FILE;
+				if (modules[module_index].unstable != trace->unstable)
 				{
-					//module_infos is a dynamically allocated array that holds all of the instrumentation data for each of the
-					//instrumented modules.  While it is declared/used as a char *, it can be thought of as a 4-dimension array:
-					//char module_infos[NUM_MODULES_TRACED][NUM_FILES_TRACED][NUM_ITERATIONS_PER_FILE][MODULE_INFO_SIZE];
-
-					module_names = (char **)realloc(module_names, module_index * sizeof(char *));
-					module_names[cur_index] = module_name;
-					module_results = (int *)realloc(module_results, module_index * sizeof(int *));
-					module_results[cur_index] = INITIAL_STATE;
-					module_infos = (char *)realloc(module_infos, module_index * num_files * num_iterations * module_info_size);
-					num_modules = module_index;
+					for (j = 0; j < trace->info_size; j++)
+						modules[module_index].unstable[j] |= trace->unstable[j];
 				}
-
-				int pos = ((cur_index * num_files * num_iterations) + (file_count * num_iterations) + iteration) * module_info_size;
-				memcpy(module_infos + pos, info, module_info_size);
-
-				//Logic:
-				//If it's the first time we've run this module, mark that we've set the path
-				//If it's the first iteration that we've tried a new file and we found a new path, it has
-				//  at least one new path per file. So until we determine that it can take multiple
-				//  paths for the same file, mark it as having one path per file.
-				//Otherwise, we've found a new path, then it must be a new path for the same file.  Mark it as
-				//	such.  After we've decided that, there is no coming back from that state.
-				if (module_results[cur_index] == INITIAL_STATE)
-					module_results[cur_index] = PATH_SET;
-				else if (new_path && iteration == 0 && module_results[cur_index] != NEW_PATH_ON_SAME_FILE)
-					module_results[cur_index] = NEW_PATH_ON_DIFF_FILE;
-				else if (new_path)
-					module_results[cur_index] = NEW_PATH_ON_SAME_FILE;
 			}
 		}
-		free(seed_buffer);
 	}
 
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Compare the runs and calculate ignore bytes ///////////////////////////////////////////////////////
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
-
-	//In the next portion, we have the variables:
-	//module_index     = the module index (since you can use the picker on many different modules at once).
-	//num_files        = the number of files being tested
-	//num_iterations   = the number of times each file was traced
-	//file_count       = the iterator over the files for a specific module
-	//iteration        = the iterator over the individual traces for a specific file
-	//module_info_size = the size of the instrumentation data from the traced module (a constant value, that doesn't change per file/module/iteration)
-	//cur_pos          = an index into module_infos to the instrumentation data for the $iteration trace of the $file_count file
-	//prev_pos         = an index into module_infos to the instrumentation data for the ($iteration-1) trace of the $file_count file
-
-
-
-	ignore_bytes = (char *)malloc(module_info_size);
 	for (module_index = 0; module_index < num_modules; module_index++)
 	{
 		if (module_results[module_index] != NEW_PATH_ON_SAME_FILE)
 			continue;
 
-		memset(ignore_bytes, 0xff, module_info_size);
-		int total_ignore_count = 0;
-		for (file_count = 0; file_count < num_files; file_count++)
-		{
-			for (iteration = 1; iteration < num_iterations; iteration++)
-			{
-				int ignore_count = 0;
-
-				//The calculations for cur_pos and prev_pos are done as such:
-				//index * num_files * num_iterations = skip over the modules we've already checked
-				//file_count * num_iterations = skip over the files we've already checked for this module
-				//iteration = skip to the iteration that we're currently checking (prev_pos uses iteration - 1, since it's jumping to the previous iteration's instrumentation data)
-				//and then it's all multiplied by the module_info_size since each one of the instrumentation data records that we're skipping is that many bytes large
-				int prev_pos = ((module_index * num_files * num_iterations) + (file_count * num_iterations) + iteration - 1) * module_info_size;
-				int cur_pos = ((module_index * num_files * num_iterations) + (file_count * num_iterations) + iteration) * module_info_size;
-
-				for (i = 0; i < module_info_size; i++)
-				{
-					if (module_infos[prev_pos + i] != module_infos[cur_pos + i])
-					{
-						if (ignore_bytes[i])
-							total_ignore_count++;
-						ignore_bytes[i] = 0x00;
-						ignore_count++;
-					}
-				}
-				DEBUG_MSG("Module %s File %s iteration (%d/%d) ignore count %d total ignore count %d", module_names[module_index], filenames[file_count], iteration - 1, iteration, ignore_count, total_ignore_count);
-			}
-		}
+		//The ignore bytes are non-zero for each byte that should be ignored, as the instrumentations expect
+		trace = &modules[module_index];
+		for (j = 0; j < trace->info_size; j++)
+			trace->unstable_count += trace->unstable[j] != 0;
+		INFO_MSG("Module %s has %d bytes to ignore", trace->name, trace->unstable_count);
 
 		if (ignore_bytes_dir)
 		{
 			memset(filename, 0, sizeof(filename));
-			snprintf(filename, sizeof(filename) - 1, "%s\\%s.dat", ignore_bytes_dir, module_names[module_index]);
-
-/*
-			//Swap the byte ordering here, so we don't have to in the hashing function later
-#if defined(_M_X64) || defined(__x86_64__)
-			for (i = 0; i < sizeof(ignore_bytes); i += sizeof(u64))
-				*((u64 *)&ignore_bytes[i]) = _byteswap_uint64(*((u64 *)&ignore_bytes[i]));
-#else
-			for (i = 0; i < sizeof(ignore_bytes); i += sizeof(u32))
-				*((u32 *)&ignore_bytes[i]) = SWAP32(*((u32 *)&ignore_bytes[i]));
-#endif
-*/
-
-			write_buffer_to_file(filename, ignore_bytes, module_info_size);
+			snprintf(filename, sizeof(filename) - 1, "%s/%s.dat", ignore_bytes_dir, trace->name);
+			if (write_buffer_to_file(filename, trace->unstable, trace->info_size))
+				ERROR_MSG("Failed to write the ignore bytes file %s", filename);
 		}
 	}
-	free(ignore_bytes);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Print the results /////////////////////////////////////////////////////////////////////////////////
@@ -310,24 +452,39 @@ int main(int argc, char ** argv)
 
 	CRITICAL_MSG("Results:");
 	for (module_index = 0; module_index < num_modules; module_index++)
-		CRITICAL_MSG("Module %s had %s", module_names[module_index], module_results_descriptions[module_results[module_index]]);
+		CRITICAL_MSG("Module %s had %s", modules[module_index].name, module_results_descriptions[module_results[module_index]]);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	
-	//free the generated info
-	free(module_results);
-	free(module_names);
-	free(module_infos);
+	//free the generated info.  The combined module results point to the first file's module traces.
 	for (file_count = 0; file_count < num_files; file_count++)
-		free(filenames[file_count]);
-	free(filenames);
+	{
+		for (i = 0; i < file_results[file_count].num_modules; i++)
+		{
+			trace = &file_results[file_count].modules[i];
+			free(trace->name);
+			free(trace->first);
+			free(trace->previous);
+			free(trace->unstable);
+		}
+		free(file_results[file_count].modules);
+	}
+	free(file_results);
+	free(modules);
+	free(module_results);
+	free_seed_directory(seeds);
 
 	//Cleanup the objects and exit
-	driver->cleanup(driver->state);
-	instrumentation->cleanup(instrumentation_state);
-	free(driver);
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].driver->cleanup(workers[i].driver->state);
+		instrumentation->cleanup(workers[i].instrumentation_state);
+		free(workers[i].driver);
+	}
+	free(workers);
+	destroy_mutex(next_file_mutex);
 	free(instrumentation);
 	return 0;
 }
@@ -17,6 +17,7 @@ app.config['SQLALCHEMY_DATABASE_URI'] = config_file.DATABASE_URI
 app.config['SQLALCHEMY_TRACK_MODIFICATIONS'] = False
 app.config['RESTFUL_JSON'] = {'cls': JSONEncoder}
 app.config['ERROR_404_HELP'] = False
+app.config['WORKUNIT_DURATION'] = config_file.WORKUNIT_DURATION
 app.config['db'] = db = SQLAlchemy(app)
 
 # TODO verification of version via metadata table.
@@ -32,7 +33,10 @@ from controller.File import FileCtrl
 from controller.Job import JobCtrl
 from controller.Target import TargetCtrl
 from controller.Config import ConfigCtrl
-from controller.Results import ResultsCtrl
+from controller.Results import ResultsCtrl, TargetResultsCtrl
+from controller.Throughput import ThroughputCtrl
+from controller.Progress import ProgressCtrl
+from controller.Seeds import SeedsCtrl
 
 api = Api(app)
 api.add_resource(HelloCtrl, '/')
@@ -45,6 +49,12 @@ api.add_resource(JobCtrl, '/api/boinc_job/<int:boinc_id>', methods=['GET', 'PUT'
 api.add_resource(ResultsCtrl, '/api/results', methods=['GET'])
 api.add_resource(ResultsCtrl, '/api/job/<int:job_id>/results', endpoint='resultsctrl_job')
 api.add_resource(ResultsCtrl, '/api/boinc_job/<int:boinc_id>/results', endpoint='resultsctrl_boincjob')
+api.add_resource(TargetResultsCtrl, '/api/target/<int:target_id>/results', methods=['GET'])
+api.add_resource(ThroughputCtrl, '/api/boinc_job/<int:boinc_id>/throughput', methods=['POST'])
+api.add_resource(ThroughputCtrl, '/api/target/<int:target_id>/throughput', methods=['GET'], endpoint='throughputctrl_target')
+api.add_resource(ProgressCtrl, '/api/boinc_job/<int:boinc_id>/progress', methods=['POST'])
+api.add_resource(ProgressCtrl, '/api/job/<int:job_id>/progress', methods=['GET'], endpoint='progressctrl_job')
+api.add_resource(SeedsCtrl, '/api/target/<int:target_id>/seeds', methods=['GET'])
 
 api.add_resource(TargetCtrl, '/api/target', methods=['GET', 'POST'])
 api.add_resource(TargetCtrl, '/api/target/<int:id>', methods=['GET', 'PUT', 'DELETE'], endpoint='targetctrl_id')
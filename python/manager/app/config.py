@@ -5,3 +5,6 @@ DATABASE_URI = "sqlite:///../../../../moflow.db"
 MANAGER_VERSION = 0.1
 CLIENT_FOLDER = "client"
 UPLOAD_FOLDER = 'static' + os.sep + 'upload'
+# How many seconds a job fuzzes for when its iterations are sized from the
+# target's measured speed. A target's workunit_opts_duration config overrides it.
+WORKUNIT_DURATION = 3600
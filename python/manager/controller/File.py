@@ -26,7 +26,7 @@ class FileCtrl(Resource):
     def create(self, contents):
         try:
             filename = boinc.filename_to_download_path(
-                boinc.stage_file('input', contents))
+                boinc.stage_file('input', contents, compress=True))
         except errors.Error:
             logger.exception('unable to stage file')
             abort(400, err='unable to stage file')
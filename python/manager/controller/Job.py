@@ -1,9 +1,14 @@
 import datetime
+import os
 
+from flask import request
 from flask_restful import Resource, reqparse, fields, marshal_with, abort
 
 from lib import boinc
+from lib import errors
 from lib import fuzzer
+from lib import scheduler
+from controller.Throughput import target_execs_per_sec
 from model.FuzzingJob import fuzz_jobs
 from model.FuzzingTarget import targets
 from model.job_inputs import job_inputs
@@ -28,8 +33,13 @@ job_fields = {
     'end_time': fields.DateTime(dt_format='iso8601'),
     'input_ids': fields.List(fields.Integer(attribute='input_id'), attribute='inputs'),
     'seed_file': fields.String(),
+    'iterations': fields.Integer(),
 }
 
+# The attributes a new job can be given, which a list of jobs is read with
+JOB_ARGUMENTS = ('job_type', 'target_id', 'mutator', 'mutator_state', 'instrumentation_type',
+                 'driver', 'input_files', 'seed_file', 'iterations')
+
 class JobCtrl(Resource):
     def read(self, id=None, boinc_id=None):
         """
@@ -61,11 +71,33 @@ class JobCtrl(Resource):
         #jobs = [{'job': job} for job in jobs]
         return jobs, 200
 
-    def create(self, data):
+    def size_workunit(self, target):
         """
-        Create a new job.
+        Picks how many iterations a new job runs, so that it fuzzes for about
+        the target's workunit duration on a typical host. This keeps fast hosts
+        from spending most of their time waiting on the BOINC scheduler, and
+        slow hosts from overrunning their deadlines.
+        :param target: targets, the target the job fuzzes
+        :return: int, the number of iterations, or error on 400
+        """
+        duration = app.config['WORKUNIT_DURATION']
+        config = target.configs.get('workunit_opts_duration')
+        if config is not None:
+            try:
+                duration = int(config.value)
+            except ValueError:
+                abort(400, err="the target's workunit_opts_duration config must be a number of seconds")
+        execs_per_sec = target_execs_per_sec(target.target_id)
+        if execs_per_sec is None:
+            abort(400, err="iterations must be supplied until the target's speed has been measured")
+        return max(1, int(execs_per_sec * duration))
+
+    def build_job(self, data):
+        """
+        Checks the attributes of a new job, and fills in the ones that can be
+        picked for it.
         :param data: dictionary of attributes for the new job object
-        :return: newly created job object on 200, error dictionary on 400
+        :return: the new, uncommitted job object, or error on 400
         """
         type = data.job_type
         if type is None:
@@ -78,29 +110,44 @@ class JobCtrl(Resource):
             target = targets.query.filter_by(target_id=data.target_id).first()
             if target is None:
                 abort(400, err="supplied target_id not found")
+        if data.iterations is None:
+            data.iterations = self.size_workunit(target)
+        if data.seed_file is None:
+            data.seed_file = scheduler.pick_seed(data.target_id)
+            if data.seed_file is None:
+                abort(400, err="seed_file must be supplied until the target's seeds have been traced")
         if data.input_files:
             for input_file in data.input_files:
                 if not os.path.exists(boinc.path_for_file(input_file)):
                     abort(400, err="supplied input_file not found")
-        try:
-            job = fuzz_jobs(type, data.target_id,
-                            mutator=data.mutator,
-                            mutator_state=data.mutator_state,
-                            instrumentation_type=data.instrumentation_type,
-                            driver=data.driver, seed_file=data.seed_file,
-                            iterations=data.iterations
-                            )
-            if data.input_files:
-                job.inputs = [job_inputs(input_file=input_file) for input_file in data.input_files]
-            db.session.add(job)
-            db.session.commit()
-        except Exception as e:
-            logger.exception('failed to add job')
-            abort(400, err="invalid request")
+        job = fuzz_jobs(type, data.target_id,
+                        mutator=data.mutator,
+                        mutator_state=data.mutator_state,
+                        instrumentation_type=data.instrumentation_type,
+                        driver=data.driver, seed_file=data.seed_file,
+                        iterations=data.iterations
+                        )
+        if data.input_files:
+            job.inputs = [job_inputs(input_file=input_file) for input_file in data.input_files]
+        return job
+
+    def input_files(self, job):
+        """
+        Lists the inputs that a job's workunit ships along with its seed.
+        :param job: fuzz_jobs, a job that's been added to the session
+        :return: list of str, the input filenames
+        """
+        return [job_input.input_file for job_input in job.inputs]
 
-        mutator_options = job.lookup_config('mutator', data.mutator)
-        instrumentation_options = job.lookup_config('instrumentation', data.instrumentation_type)
-        driver_options = job.lookup_config('driver', data.driver)
+    def command_line(self, job):
+        """
+        Formats the fuzzer command line that a job's workunit runs.
+        :param job: fuzz_jobs, a job that's been added to the session
+        :return: str, the command line
+        """
+        mutator_options = job.lookup_config('mutator', job.mutator)
+        instrumentation_options = job.lookup_config('instrumentation', job.instrumentation_type)
+        driver_options = job.lookup_config('driver', job.driver)
         shell_format = job.lookup_config('platform', 'shell_format')
 
         command_line = fuzzer.format_cmdline(
@@ -108,14 +155,68 @@ class JobCtrl(Resource):
             shell_format,
             driver_options=driver_options,
             instrumentation_options=instrumentation_options,
-            mutator_options=mutator_options)
+            mutator_options=mutator_options,
+            packed_seeds=bool(job.inputs))
         logger.debug('Submitting job with command line: %s', command_line)
-        job_id = boinc.submit_job(str(target), command_line, seed_file=job.seed_file)
+        return command_line
+
+    def create(self, data):
+        """
+        Create a new job.
+        :param data: dictionary of attributes for the new job object
+        :return: newly created job object on 200, error dictionary on 400
+        """
+        job = self.build_job(data)
+        try:
+            db.session.add(job)
+            db.session.commit()
+        except Exception as e:
+            logger.exception('failed to add job')
+            abort(400, err="invalid request")
+
+        job_id = boinc.submit_job(str(job.target), self.command_line(job), seed_file=job.seed_file,
+                                  input_files=self.input_files(job))
         job.boinc_id = job_id
         db.session.commit()
 
         return job, 200
 
+    def create_many(self, data):
+        """
+        Create many jobs at once. The workunits of each target's jobs are
+        created with one call to BOINC, and the jobs are recorded in a single
+        transaction, so none of them are recorded if their workunits couldn't
+        be created.
+        :param data: list of dictionaries of attributes, one per new job
+        :return: list of the newly created job objects on 200, error dictionary on 400
+        """
+        jobs = [self.build_job(reqparse.Namespace((name, job_data.get(name)) for name in JOB_ARGUMENTS))
+                for job_data in data]
+        try:
+            db.session.add_all(jobs)
+            db.session.flush()
+
+            jobs_by_app = {}
+            for job in jobs:
+                jobs_by_app.setdefault(str(job.target), []).append(job)
+            for appname, app_jobs in jobs_by_app.items():
+                boinc_ids = boinc.submit_jobs(
+                    appname, [(self.command_line(job), job.seed_file, self.input_files(job))
+                              for job in app_jobs])
+                for job, boinc_id in zip(app_jobs, boinc_ids):
+                    job.boinc_id = boinc_id
+            db.session.commit()
+        except errors.Error:
+            # As with a single job, BOINC's errors are passed on
+            db.session.rollback()
+            raise
+        except Exception as e:
+            db.session.rollback()
+            logger.exception('failed to add jobs')
+            abort(400, err="invalid request")
+
+        return jobs, 200
+
 
     def update(self, data, id=None, boinc_id=None):
         query = fuzz_jobs.query
@@ -131,6 +232,9 @@ class JobCtrl(Resource):
             job.seed_file = data.seed_file
         if data.status is not None:
             job.status = data.status
+            # The seed scheduler orders a seed's jobs by when they completed
+            if data.status == 'completed' and job.end_time is None:
+                job.end_time = datetime.datetime.utcnow()
         db.session.commit()
         return job, 200
 
@@ -159,9 +263,13 @@ class JobCtrl(Resource):
     @marshal_with(job_fields)
     def post(self):
         """
-        Create a new job.
-        :return: The job created on 200, error on 400
+        Create a new job, or a list of jobs posted as {"jobs": [...]}.
+        :return: The job or jobs created on 200, error on 400
         """
+        body = request.get_json(silent=True)
+        if isinstance(body, dict) and isinstance(body.get('jobs'), list):
+            return self.create_many(body['jobs'])
+
         parser = reqparse.RequestParser()
         parser.add_argument("job_type", type=str)
         parser.add_argument("target_id", type=int, required=True)
@@ -170,8 +278,10 @@ class JobCtrl(Resource):
         parser.add_argument("instrumentation_type", type=str, required=True)
         parser.add_argument("driver", type=str, required=True)
         parser.add_argument("input_files", type=str, action='append', location='json')
-        parser.add_argument("seed_file", type=str, required=True)
-        parser.add_argument("iterations", type=int, required=True)
+        # If seed_file is omitted, the scheduler picks one of the target's seeds
+        parser.add_argument("seed_file", type=str)
+        # If iterations is omitted, it's sized from the target's measured speed
+        parser.add_argument("iterations", type=int)
         args = parser.parse_args()
         return self.create(args)
 
@@ -0,0 +1,64 @@
+from flask_restful import Resource, reqparse, fields, marshal_with, abort
+
+from model.FuzzingJob import fuzz_jobs
+from model.job_progress import job_progress
+
+from app import app
+import logging
+
+db = app.config['db']
+logger = logging.getLogger(__name__)
+
+progress_fields = {
+    'job_id': fields.Integer(),
+    'host_id': fields.Integer(),
+    'paths_found': fields.Integer(),
+    'execs_done': fields.Integer(),
+    'update_time': fields.DateTime(dt_format='iso8601'),
+}
+
+
+class ProgressCtrl(Resource):
+    def create(self, data, boinc_id):
+        """
+        Records the coverage that a running workunit streamed back
+        :param data: the host_id of the host running the workunit, and the
+        fuzzer's paths_found and execs_done so far
+        :param boinc_id: boinc_id of the job the workunit is running
+        :return: the host's updated progress on 200, or error on 400/404
+        """
+        job = fuzz_jobs.query.filter_by(boinc_id=boinc_id).first()
+        if job is None:
+            abort(404, err='Unknown job ID')
+        if data.paths_found < 0 or data.execs_done < 0:
+            abort(400, err='paths_found and execs_done must not be negative')
+
+        progress = job_progress.query.filter_by(job_id=job.job_id, host_id=data.host_id).first()
+        try:
+            if progress is None:
+                progress = job_progress(job.job_id, data.host_id, data.paths_found, data.execs_done)
+                db.session.add(progress)
+            else:
+                progress.update(data.paths_found, data.execs_done)
+            db.session.commit()
+        except Exception:
+            db.session.rollback()
+            logger.exception('failed to record progress')
+            abort(400, err="invalid request")
+        return progress, 200
+
+    @marshal_with(progress_fields)
+    def get(self, job_id):
+        """
+        Lists the latest coverage of each host that has run a job's workunit
+        """
+        return job_progress.query.filter_by(job_id=job_id).all(), 200
+
+    @marshal_with(progress_fields)
+    def post(self, boinc_id):
+        parser = reqparse.RequestParser()
+        parser.add_argument('host_id', type=int, required=True)
+        parser.add_argument('paths_found', type=int, required=True)
+        parser.add_argument('execs_done', type=int, required=True)
+        args = parser.parse_args()
+        return self.create(args, boinc_id)
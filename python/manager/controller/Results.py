@@ -1,3 +1,4 @@
+from flask import request, json, Response, stream_with_context
 from flask_restful import Resource, reqparse, fields, marshal_with, abort
 from model.FuzzingJob import fuzz_jobs
 from model.FuzzingResults import results
@@ -14,7 +15,7 @@ result_fields = {
 }
 
 class ResultsCtrl(Resource):
-    def create(self, data, job_id=None, boinc_id=None):
+    def find_job_id(self, job_id=None, boinc_id=None):
         if job_id is not None:
             job = fuzz_jobs.query.get(job_id)
             if job is None:
@@ -24,7 +25,10 @@ class ResultsCtrl(Resource):
             if job is None:
                 abort(404, err="boinc_job not found")
             job_id = job.job_id
+        return job_id
 
+    def create(self, data, job_id=None, boinc_id=None):
+        job_id = self.find_job_id(job_id, boinc_id)
         try:
             result = results(job_id, data['repro_file'], type=data['result_type'])
             db.session.add(result)
@@ -34,6 +38,28 @@ class ResultsCtrl(Resource):
 
         return result, 201
 
+    def create_many(self, data, job_id=None, boinc_id=None):
+        """Adds a list of results to a job in a single transaction.  Results the
+        job already has are skipped, since a workunit's final upload repeats the
+        ones it streamed back while it ran."""
+        job_id = self.find_job_id(job_id, boinc_id)
+        try:
+            existing = set(repro_file for repro_file, in
+                           db.session.query(results.repro_file).filter_by(job_id=job_id))
+            job_results = []
+            for result in data:
+                if result['repro_file'] in existing:
+                    continue
+                existing.add(result['repro_file'])
+                job_results.append(results(job_id, result['repro_file'], type=result['result_type']))
+            db.session.add_all(job_results)
+            db.session.commit()
+        except Exception as e:
+            db.session.rollback()
+            abort(400, err="invalid request")
+
+        return job_results, 201
+
     # TODO if needed
     def read(self, job_id=None):
         query = results.query
@@ -85,23 +111,32 @@ class ResultsCtrl(Resource):
 
         return {"msg" : "record removed successfully"}, 201
 
-    def list(self, offset=None, limit=None, job_id=None, boinc_id=None, repro_file=None):
+    def list(self, offset=None, limit=None, job_id=None, boinc_id=None, repro_file=None,
+             after=None, result_type=None):
         query = results.query
         # results filters
         if job_id:
             query = query.filter_by(job_id=job_id)
         if repro_file:
             query = query.filter_by(repro_file=repro_file)
+        if result_type:
+            query = query.filter_by(result_type=result_type)
 
         # filters requiring join with fuzz_jobs
         if boinc_id:
             query = query.join(fuzz_jobs).filter(fuzz_jobs.boinc_id == boinc_id)
 
-        if offset is None:
-            offset = 0
+        # Keyset pagination: each page starts after the last result_id of the
+        # previous one, which the index finds directly, rather than skipping
+        # past every earlier row like an offset does
+        query = query.order_by(results.result_id)
+        if after is not None:
+            query = query.filter(results.result_id > after)
+        elif offset:
+            query = query.offset(offset)
         if limit is None:
             limit = 20
-        crashes = query.offset(offset).limit(limit).all()
+        crashes = query.limit(limit).all()
         return crashes, 200
 
     @marshal_with(result_fields)
@@ -110,13 +145,44 @@ class ResultsCtrl(Resource):
         parser.add_argument('offset', type=int)
         parser.add_argument('limit', type=int)
         parser.add_argument('repro_file', type=str)
+        parser.add_argument('result_type', type=str)
+        parser.add_argument('after', type=int)
         args = parser.parse_args()
-        return self.list(args['offset'], args['limit'], job_id, boinc_id, args['repro_file'])
+        return self.list(args['offset'], args['limit'], job_id, boinc_id, args['repro_file'],
+                         args['after'], args['result_type'])
 
     @marshal_with(result_fields)
     def post(self, job_id=None, boinc_id=None):
+        # A list of results can be posted as {"results": [...]}
+        body = request.get_json(silent=True)
+        if isinstance(body, dict) and isinstance(body.get('results'), list):
+            return self.create_many(body['results'], job_id, boinc_id)
+
         parser = reqparse.RequestParser()
         parser.add_argument('repro_file', required=True, location='json')
         parser.add_argument('result_type', required=True, location='json')
         parser.add_argument('parent_file', location='json')
         return self.create(parser.parse_args(), job_id, boinc_id)
+
+
+# How many results are fetched from the database at a time while streaming
+STREAM_BATCH_SIZE = 1000
+
+class TargetResultsCtrl(Resource):
+    def get(self, target_id):
+        """
+        Streams every result for a target as a single JSON array, so that the
+        results don't all have to be loaded into memory at once
+        """
+        query = results.query.join(fuzz_jobs).filter(fuzz_jobs.target_id == target_id) \
+            .order_by(results.result_id).yield_per(STREAM_BATCH_SIZE)
+
+        def generate():
+            yield '['
+            separator = ''
+            for result in query:
+                yield separator + json.dumps({name: getattr(result, name) for name in result_fields})
+                separator = ','
+            yield ']'
+
+        return Response(stream_with_context(generate()), mimetype='application/json')
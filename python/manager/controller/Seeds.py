@@ -0,0 +1,19 @@
+from flask_restful import Resource, fields, marshal_with
+
+from lib import scheduler
+
+seed_fields = {
+    'seed_file': fields.String(),
+    'score': fields.Float(),
+    'rarity': fields.Float(),
+    'fruitless_jobs': fields.Integer(),
+    'active_jobs': fields.Integer(),
+}
+
+class SeedsCtrl(Resource):
+    @marshal_with(seed_fields)
+    def get(self, target_id):
+        """
+        Lists a target's traced seeds in the order new jobs will be given them
+        """
+        return [rank._asdict() for rank in scheduler.rank_seeds(target_id)], 200
@@ -0,0 +1,89 @@
+from flask_restful import Resource, reqparse, fields, marshal_with, abort
+
+from model.FuzzingJob import fuzz_jobs
+from model.host_throughput import host_throughput
+
+from app import app
+import logging
+
+db = app.config['db']
+logger = logging.getLogger(__name__)
+
+throughput_fields = {
+    'host_id': fields.Integer(),
+    'target_id': fields.Integer(),
+    'execs_per_sec': fields.Float(),
+    'run_time': fields.Integer(),
+    'workers': fields.Integer(),
+    'update_time': fields.DateTime(dt_format='iso8601'),
+}
+
+
+def target_execs_per_sec(target_id):
+    """
+    Estimates how fast a host fuzzes a target, from the speeds measured on the
+    hosts that have fuzzed it. Workunits are created before BOINC picks a host
+    for them, so this is the median of the hosts' speeds, rather than any one
+    host's.
+    :param target_id: int, the target to estimate the speed of
+    :return: float, the estimated execs per second, or None if the target's
+    speed hasn't been measured yet
+    """
+    speeds = sorted(throughput.execs_per_sec for throughput in
+                    host_throughput.query.filter_by(target_id=target_id).all())
+    if not speeds:
+        return None
+    middle = len(speeds) // 2
+    if len(speeds) % 2:
+        return speeds[middle]
+    return (speeds[middle - 1] + speeds[middle]) / 2
+
+
+class ThroughputCtrl(Resource):
+    def create(self, data, boinc_id):
+        """
+        Records a host's measured speed for a job's target
+        :param data: the host_id, execs_per_sec and run_time of the measurement,
+        and the number of workers the fuzzer's autotune picked, if it ran
+        :param boinc_id: boinc_id of the job that was measured
+        :return: the host's updated throughput on 200, or error on 400/404
+        """
+        job = fuzz_jobs.query.filter_by(boinc_id=boinc_id).first()
+        if job is None:
+            abort(404, err='Unknown job ID')
+        if data.execs_per_sec < 0 or data.run_time <= 0:
+            abort(400, err='execs_per_sec must not be negative and run_time must be positive')
+        if data.workers is not None and data.workers <= 0:
+            abort(400, err='workers must be positive')
+
+        throughput = host_throughput.query.filter_by(host_id=data.host_id, target_id=job.target_id).first()
+        try:
+            if throughput is None:
+                throughput = host_throughput(data.host_id, job.target_id, data.execs_per_sec, data.run_time,
+                                             data.workers)
+                db.session.add(throughput)
+            else:
+                throughput.add_measurement(data.execs_per_sec, data.run_time, data.workers)
+            db.session.commit()
+        except Exception:
+            db.session.rollback()
+            logger.exception('failed to record throughput')
+            abort(400, err="invalid request")
+        return throughput, 200
+
+    @marshal_with(throughput_fields)
+    def get(self, target_id):
+        """
+        Lists the measured speeds of the hosts that have fuzzed a target
+        """
+        return host_throughput.query.filter_by(target_id=target_id).all(), 200
+
+    @marshal_with(throughput_fields)
+    def post(self, boinc_id):
+        parser = reqparse.RequestParser()
+        parser.add_argument('host_id', type=int, required=True)
+        parser.add_argument('execs_per_sec', type=float, required=True)
+        parser.add_argument('run_time', type=int, required=True)
+        parser.add_argument('workers', type=int, required=False)
+        args = parser.parse_args()
+        return self.create(args, boinc_id)
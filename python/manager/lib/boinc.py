@@ -1,10 +1,13 @@
+import gzip
 import hashlib
 import os.path
 import re
 import subprocess
+import time
 import xml.etree.ElementTree as ET
 
 from app import app
+from lib import corpus_pack
 from lib import errors
 
 def clean_download_path(path):
@@ -39,20 +42,61 @@ def filename_to_download_path(filename):
     return clean_download_path(abspath)
 
 
-def stage_file(prefix, contents):
+def _write_staged_file(abspath, contents):
+    """Writes a file into the download tree all at once, so that BOINC never
+    serves a partially written file."""
+    temp_path = '{}.{}.tmp'.format(abspath, os.getpid())
+    with open(temp_path, 'wb') as new_file:
+        new_file.write(contents)
+    os.chmod(temp_path, 0o755)
+    os.replace(temp_path, abspath)
+
+
+def stage_gzipped_copy(abspath):
+    """Stages the gzipped copy of a staged file that BOINC sends in its place
+    when the input template marks the file <gzip/>, if it isn't staged yet."""
+    if not os.path.exists(abspath + '.gz'):
+        with open(abspath, 'rb') as staged:
+            _write_staged_file(abspath + '.gz', gzip.compress(staged.read()))
+
+
+def stage_file(prefix, contents, compress=False):
+    """Stages a file in the download tree under a name derived from its hash,
+    so each file is staged once no matter how many jobs use it.
+
+    With compress, a gzipped copy is staged too, for files that the input
+    templates send compressed.
+    """
     filename = _filename_for_contents(prefix, contents)
     abspath = dir_hier_path(filename)
     if os.path.exists(abspath):
-        with open(abspath, 'rb') as existing:
-            if existing.read() != contents:
-                raise errors.InternalError(
-                    'Attempted to stage {} with differing contents'.format(filename))
+        # The name is the hash of the contents, so the file doesn't need to be
+        # read back to check that it's the same one
+        if os.path.getsize(abspath) != len(contents):
+            raise errors.InternalError(
+                'Attempted to stage {} with differing contents'.format(filename))
     else:
-        with open(abspath, 'wb') as new_file:
-            new_file.write(contents)
-        os.chmod(abspath, 0o755)
+        _write_staged_file(abspath, contents)
+    if compress:
+        stage_gzipped_copy(abspath)
     return abspath
 
+def path_for_file(filename):
+    """Finds a file that was staged in the download tree by its filename."""
+    return dir_hier_path(os.path.basename(filename))
+
+
+def stage_pack(seed_file, input_files):
+    """Packs a job's seed and inputs into one packed corpus (see
+    lib/corpus_pack.py), and stages it, so the job downloads a single file
+    rather than one per input. The seed is the pack's first entry.
+    """
+    entries = []
+    for filename in [seed_file] + list(input_files):
+        with open(path_for_file(filename), 'rb') as f:
+            entries.append((os.path.basename(filename), f.read()))
+    return stage_file('pack', corpus_pack.pack_entries(entries), compress=True)
+
 def get_filename(prefix, hash):
     return dir_hier_path('{}_{}'.format(prefix, hash))
 
@@ -61,32 +105,87 @@ def _filename_for_contents(prefix, contents):
     return '{}_{}'.format(prefix, file_hash)
 
 
-def submit_job(appname, cmdline, seed_file=None, seed_contents=None):
+def _stage_job_files(cmdline, seed_file=None, seed_contents=None, input_files=None):
+    """Stages a job's seed and command line, returning the seed's path and the
+    command line's filename, which create_work takes as the job's files.
+
+    A job with input_files gets a packed corpus of its seed and inputs in place
+    of the seed, which its command line should read with -S.
+    """
     if seed_file and seed_contents:
         raise errors.InternalError(
             'Only one of seed_file and seed_contents can be specified')
 
     if seed_contents:
-        seed_file = stage_file('input', seed_contents)
+        seed_file = stage_file('input', seed_contents, compress=True)
     elif not seed_file:
         raise errors.InternalError('No seed specified')
+    elif input_files:
+        seed_file = stage_pack(seed_file, input_files)
+    else:
+        # The seed may have been staged before seeds were sent compressed
+        stage_gzipped_copy(dir_hier_path(os.path.basename(seed_file)))
 
     # TODO: should the cmdline files have guaranteed unique filenames?
     cmd_contents = cmdline.encode('utf8')
     cmd_file = os.path.basename(stage_file('cmdline', cmd_contents))
+    return seed_file, cmd_file
+
 
-    create_work_args = ['bin/create_work', '--appname', appname, '--verbose',
-                        seed_file, cmd_file]
+def _create_work(create_work_args, stdin=None):
     try:
-        result = subprocess.check_output(
-            create_work_args, cwd=app.config['BOINC_PROJECT_DIR'],
-            stderr=subprocess.STDOUT)
+        return subprocess.run(
+            create_work_args, cwd=app.config['BOINC_PROJECT_DIR'], input=stdin,
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, check=True).stdout
     except subprocess.CalledProcessError as e:
         raise errors.BoincError('create_work returned error: {}'.format(e.output))
 
+
+def submit_job(appname, cmdline, seed_file=None, seed_contents=None, input_files=None):
+    seed_file, cmd_file = _stage_job_files(cmdline, seed_file, seed_contents, input_files)
+    result = _create_work(['bin/create_work', '--appname', appname, '--verbose',
+                           seed_file, cmd_file])
+
     for line in result.splitlines():
         match = re.match(rb'created workunit; .*, ID ([0-9]+)', line)
         if match:
             return int(match.group(1))
 
     raise errors.BoincError('Could not find ID in create_work output: {}'.format(result))
+
+
+def submit_jobs(appname, jobs):
+    """Submits many jobs of an app at once. Every job's files are staged
+    first, and then the workunits are all created by a single create_work
+    call, which reads them from stdin and shares the app's templates between
+    them, rather than starting create_work and connecting to the BOINC
+    database once per job.
+
+    jobs is a list of (cmdline, seed_file, input_files) tuples, where
+    input_files may be empty. Returns the workunit IDs, in the same order.
+    """
+    if not jobs:
+        return []
+
+    # The workunits are named, so that each ID can be matched up with its job
+    batch_name = '{}_{}_{}'.format(appname, os.getpid(), int(time.time() * 1000))
+    names = []
+    stdin = []
+    for index, (cmdline, seed_file, input_files) in enumerate(jobs):
+        seed_file, cmd_file = _stage_job_files(cmdline, seed_file, input_files=input_files)
+        names.append('{}_{}'.format(batch_name, index))
+        stdin.append('--wu_name {} {} {}\n'.format(names[-1], seed_file, cmd_file))
+
+    result = _create_work(['bin/create_work', '--appname', appname, '--verbose', '--stdin'],
+                          ''.join(stdin).encode('utf8'))
+
+    ids = {}
+    for line in result.splitlines():
+        match = re.match(rb'created workunit; name ([^,]+), ID ([0-9]+)', line)
+        if match:
+            ids[match.group(1).decode('utf8')] = int(match.group(2))
+    missing = [name for name in names if name not in ids]
+    if missing:
+        raise errors.BoincError('Could not find the IDs of {} workunits in create_work output: {}'
+                                .format(len(missing), result))
+    return [ids[name] for name in names]
@@ -0,0 +1,112 @@
+"""Reads and writes packed corpora, which hold many inputs in a single file.
+
+The format is described in utils/corpus_pack.h. The file starts with a header
+pointing at an index, which gives each entry's offset, length and FNV-1a hash
+in the data before it, along with its optional metadata and name. The fuzzer
+(-S), tracer and minimizer map a pack in place of a directory of inputs.
+"""
+import collections
+import os
+import struct
+
+from lib.errors import InputError
+
+MAGIC = b'KBPACK\r\n'
+VERSION = 1
+
+_HEADER = struct.Struct('<8sIIQ')
+_ENTRY = struct.Struct('<QQQQQQII')
+
+PackEntry = collections.namedtuple(
+    'PackEntry', ['name', 'data', 'hash', 'parent_hash', 'coverage_hash', 'exec_us'])
+
+
+def fnv1a(data):
+    """The 64-bit FNV-1a hash of data, which the index records for each entry."""
+    value = 0xcbf29ce484222325
+    for byte in bytearray(data):
+        value = ((value ^ byte) * 0x100000001b3) & 0xffffffffffffffff
+    return value
+
+
+def pack_entries(entries):
+    """Packs a list of entries into a packed corpus's contents.
+
+    Each entry is a (name, data) pair, or a PackEntry, whose hash is ignored
+    and recomputed. A name of None leaves the entry unnamed.
+    """
+    index = []
+    names = []
+    parts = [b'']
+    offset = _HEADER.size
+    names_length = 0
+    for entry in entries:
+        if not isinstance(entry, PackEntry):
+            entry = PackEntry(entry[0], entry[1], 0, 0, 0, 0)
+        name = entry.name.encode('utf-8') if entry.name else b''
+        index.append(_ENTRY.pack(offset, len(entry.data), fnv1a(entry.data),
+                                 entry.parent_hash, entry.coverage_hash,
+                                 entry.exec_us, names_length, len(name)))
+        parts.append(entry.data)
+        names.append(name)
+        offset += len(entry.data)
+        names_length += len(name)
+    padding = -offset % 8
+    parts[0] = _HEADER.pack(MAGIC, VERSION, len(index), offset + padding)
+    parts.append(b'\0' * padding)
+    return b''.join(parts + index + names)
+
+
+def pack_directory(directory):
+    """Packs the files in a directory, sorted by name, naming each entry after
+    its file."""
+    entries = []
+    for filename in sorted(os.listdir(directory)):
+        path = os.path.join(directory, filename)
+        if os.path.isfile(path):
+            with open(path, 'rb') as f:
+                entries.append((filename, f.read()))
+    return pack_entries(entries)
+
+
+def read_pack(data):
+    """Yields a PackEntry for every entry in a packed corpus's contents."""
+    if len(data) < _HEADER.size:
+        raise InputError('Not a packed corpus')
+    magic, version, count, index_offset = _HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise InputError('Not a packed corpus')
+    if version != VERSION:
+        raise InputError('Unsupported packed corpus version %d' % version)
+    names_offset = index_offset + count * _ENTRY.size
+    if names_offset > len(data):
+        raise InputError('Truncated or corrupt packed corpus')
+    for i in range(count):
+        (offset, length, value, parent_hash, coverage_hash, exec_us,
+         name_offset, name_length) = _ENTRY.unpack_from(data, index_offset + i * _ENTRY.size)
+        name_offset += names_offset
+        if offset + length > index_offset or name_offset + name_length > len(data):
+            raise InputError('Truncated or corrupt packed corpus')
+        name = data[name_offset:name_offset + name_length].decode('utf-8', 'replace')
+        yield PackEntry(name or None, data[offset:offset + length], value,
+                        parent_hash, coverage_hash, exec_us)
+
+
+def read_pack_file(filename):
+    """Yields a PackEntry for every entry in a packed corpus."""
+    with open(filename, 'rb') as f:
+        data = f.read()
+    for entry in read_pack(data):
+        yield entry
+
+
+if __name__ == '__main__':
+    import argparse
+
+    parser = argparse.ArgumentParser(description='Pack a directory of inputs into a packed corpus')
+    parser.add_argument('directory', help='The directory of inputs to pack')
+    parser.add_argument('output_file', help='The packed corpus to write')
+    args = parser.parse_args()
+
+    with open(args.output_file, 'wb') as output:
+        output.write(pack_directory(args.directory))
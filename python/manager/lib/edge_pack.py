@@ -0,0 +1,89 @@
+"""Reads the compact edge files that the tracer writes with -c.
+
+The format is described in instrumentation/edge_pack.h. Each edge is a module
+id and a pair of offsets in the module, delta encoded against the edge before
+it and packed in LEB128 varints.
+"""
+import collections
+
+from lib.errors import InputError
+
+MAGIC = b'KBEDGES\n'
+VERSION = 1
+
+PackedEdge = collections.namedtuple(
+    'PackedEdge', ['input_id', 'module', 'from_edge', 'to_edge', 'count'])
+
+
+class _Cursor(object):
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def at_end(self):
+        return self.position == len(self.data)
+
+    def varint(self):
+        result = 0
+        shift = 0
+        while True:
+            if self.position >= len(self.data) or shift >= 70:
+                raise InputError('Truncated or corrupt compact edge file')
+            byte = self.data[self.position]
+            self.position += 1
+            result |= (byte & 0x7f) << shift
+            if not byte & 0x80:
+                return result
+            shift += 7
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def bytes(self, length):
+        if length > len(self.data) - self.position:
+            raise InputError('Truncated or corrupt compact edge file')
+        value = self.data[self.position:self.position + length]
+        self.position += length
+        return value
+
+
+def read_edges(data):
+    """Yields a PackedEdge for every edge in a compact edge file's contents.
+
+    The module of each edge is its name, or its id if the tracer wasn't given
+    module names (without -p).
+    """
+    data = bytearray(data)
+    if data[:len(MAGIC)] != MAGIC:
+        raise InputError('Not a compact edge file')
+    cursor = _Cursor(data)
+    cursor.position = len(MAGIC)
+    version = cursor.varint()
+    if version != VERSION:
+        raise InputError('Unsupported compact edge file version %d' % version)
+    names = []
+    for _ in range(cursor.varint()):
+        names.append(cursor.bytes(cursor.varint()).decode('utf-8', 'replace'))
+
+    input_id = 0
+    while not cursor.at_end():
+        input_id += cursor.zigzag()
+        module = 0
+        from_edge = 0
+        for _ in range(cursor.varint()):
+            module_delta = cursor.varint()
+            module += module_delta
+            from_edge = cursor.varint() + (0 if module_delta else from_edge)
+            to_edge = from_edge + cursor.zigzag()
+            count = cursor.varint()
+            name = names[module] if module < len(names) and names[module] else module
+            yield PackedEdge(input_id, name, from_edge, to_edge, count)
+
+
+def read_edge_file(filename):
+    """Yields a PackedEdge for every edge in a compact edge file."""
+    with open(filename, 'rb') as f:
+        data = f.read()
+    for edge in read_edges(data):
+        yield edge
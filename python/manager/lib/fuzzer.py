@@ -55,15 +55,21 @@ def sh_escape(args):
 def format_cmdline(
         driver, instrumentation, mutator, iterations, shell_format,
         driver_options=None, instrumentation_options=None,
-        mutator_options=None, instrumentation_state=None, mutator_state=None):
-    # BOINC takes care of renaming the seed file for us
-    args = [driver, instrumentation, mutator, '-sf', 'seed', '-n', str(iterations)]
+        mutator_options=None, instrumentation_state=None, mutator_state=None,
+        packed_seeds=False):
+    # BOINC takes care of renaming the seed file for us.  Jobs with inputs get
+    # a packed corpus of the seed and inputs in its place (see lib/boinc.py).
+    seed_args = ['-S', 'seed'] if packed_seeds else ['-sf', 'seed']
+    args = [driver, instrumentation, mutator] + seed_args + ['-n', str(iterations)]
     if instrumentation_options:
         args.extend(["-i", instrumentation_options])
     if mutator_options:
         args.extend(["-m", mutator_options])
     if driver_options:
         args.extend(["-d", driver_options])
+    # Dump the instrumentation state, so the host's tasks can merge their states
+    # before uploading them (see flatten_results in server/skel)
+    args.extend(["-b", "-j", "./instrumentation_state.dat"])
     # TODO - we can't create files client-side so we have to have a way to
     # bundle these
     # if instrumentation_state:
@@ -0,0 +1,98 @@
+"""Picks which of a target's seeds new jobs fuzz.
+
+Seeds are ranked like a power schedule, spread over the fleet. A seed is worth
+more the more rare edges it reaches, according to the edges the tracer
+recorded for the target's seeds. Its worth halves with each completed job that
+fuzzed it since it last produced a new path, so saturated seeds fall behind.
+Seeds that jobs are still fuzzing are discounted too, so new jobs spread out
+over the best seeds rather than piling onto the single best one.
+"""
+import collections
+
+from sqlalchemy import and_
+from sqlalchemy.sql.expression import func
+
+from app import app
+from model.FuzzingJob import fuzz_jobs
+from model.FuzzingResults import results
+from model.tracer_info import tracer_info
+
+db = app.config['db']
+
+# How much of a seed's worth is left after each completed job that didn't find
+# a new path on it
+SATURATION_DECAY = 0.5
+
+SeedRank = collections.namedtuple(
+    'SeedRank', ['seed_file', 'score', 'rarity', 'fruitless_jobs', 'active_jobs'])
+
+
+def _edge_rarity(target_id):
+    """
+    Scores each traced seed of a target by the rare edges it reaches. Each edge
+    is worth one over the number of seeds that reach it, so an edge only one
+    seed reaches counts fully, and one every seed reaches barely counts.
+    :return: dict mapping each seed to its rarity score
+    """
+    edge_seeds = db.session.query(
+        tracer_info.from_edge, tracer_info.to_edge, func.count().label('seeds')) \
+        .filter(tracer_info.target_id == target_id) \
+        .group_by(tracer_info.from_edge, tracer_info.to_edge).subquery()
+    query = db.session.query(tracer_info.input_file, func.sum(1.0 / edge_seeds.c.seeds)) \
+        .join(edge_seeds, and_(tracer_info.from_edge == edge_seeds.c.from_edge,
+                               tracer_info.to_edge == edge_seeds.c.to_edge)) \
+        .filter(tracer_info.target_id == target_id) \
+        .group_by(tracer_info.input_file)
+    return {input_file: float(rarity) for input_file, rarity in query}
+
+
+def _seed_history(target_id):
+    """
+    Counts, for each seed of a target, the completed jobs that fuzzed it since
+    it last produced a new path, and the jobs that are still fuzzing it.
+    :return: dict mapping each seed to a [fruitless jobs, active jobs] list
+    """
+    new_path_jobs = db.session.query(results.job_id) \
+        .filter(results.result_type == 'new_path').distinct().subquery()
+    query = db.session.query(fuzz_jobs.seed_file, fuzz_jobs.status, new_path_jobs.c.job_id) \
+        .outerjoin(new_path_jobs, fuzz_jobs.job_id == new_path_jobs.c.job_id) \
+        .filter(fuzz_jobs.target_id == target_id) \
+        .order_by(fuzz_jobs.end_time, fuzz_jobs.job_id)
+    history = collections.defaultdict(lambda: [0, 0])
+    for seed_file, status, new_path_job in query:
+        if status != 'completed':
+            history[seed_file][1] += 1
+        elif new_path_job is not None:
+            history[seed_file][0] = 0
+        else:
+            history[seed_file][0] += 1
+    return history
+
+
+def rank_seeds(target_id):
+    """
+    Ranks a target's traced seeds by how much fuzzing them is likely to find.
+    :param target_id: int, the target whose seeds should be ranked
+    :return: list of SeedRank, best first, or an empty list if none of the
+    target's seeds have been traced
+    """
+    history = _seed_history(target_id)
+    ranks = []
+    for seed_file, rarity in _edge_rarity(target_id).items():
+        fruitless_jobs, active_jobs = history.get(seed_file, (0, 0))
+        score = rarity * SATURATION_DECAY ** fruitless_jobs / (1 + active_jobs)
+        ranks.append(SeedRank(seed_file, score, rarity, fruitless_jobs, active_jobs))
+    ranks.sort(key=lambda rank: (-rank.score, rank.seed_file))
+    return ranks
+
+
+def pick_seed(target_id):
+    """
+    Picks the seed a new job for a target should fuzz.
+    :return: str, the seed file, or None if none of the target's seeds have
+    been traced
+    """
+    ranks = rank_seeds(target_id)
+    if not ranks:
+        return None
+    return ranks[0].seed_file
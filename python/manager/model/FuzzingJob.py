@@ -8,7 +8,7 @@ db = app.config['db']
 
 class fuzz_jobs(db.Model):
     job_id = db.Column(db.Integer(), primary_key=True, nullable=False)
-    boinc_id = db.Column(db.Integer())
+    boinc_id = db.Column(db.Integer(), index=True)
     job_type = db.Column(db.String())
     status = db.Column(db.String()) # unassigned, assigned, complete
     mutator_state = db.Column(db.String()) # json of the current state
@@ -17,7 +17,7 @@ class fuzz_jobs(db.Model):
     assign_time = db.Column(db.DateTime())
     end_time = db.Column(db.DateTime())
     driver = db.Column(db.String())
-    target_id = db.Column(db.Integer(), db.ForeignKey('targets.target_id'))
+    target_id = db.Column(db.Integer(), db.ForeignKey('targets.target_id'), index=True)
     seed_file = db.Column(db.String())
     iterations = db.Column(db.Integer())
 
@@ -12,9 +12,10 @@ the crash system to a bugzilla friendly format. Based on the decision on the des
 
 class results(db.Model):
     result_id = db.Column(db.Integer, primary_key=True)
-    job_id = db.Column(db.Integer, db.ForeignKey('fuzz_jobs.job_id'), nullable=False)
-    repro_file = db.Column(db.String, nullable=False)
-    result_type = db.Column(db.String) # 'hang' or 'crash'
+    job_id = db.Column(db.Integer, db.ForeignKey('fuzz_jobs.job_id'), nullable=False, index=True)
+    # The repro file's name ends with its hash, so this index also serves lookups by hash
+    repro_file = db.Column(db.String, nullable=False, index=True)
+    result_type = db.Column(db.String, index=True) # 'hang' or 'crash'
 
     def __init__(self, job_id, repro, type='crash'):
         self.job_id = job_id
@@ -0,0 +1,46 @@
+from app import app
+from datetime import datetime
+
+db = app.config['db']
+
+# How many seconds of past measurements a host's exec speed is averaged over, so
+# that the estimate follows changes to the host or the target
+THROUGHPUT_HISTORY_SECONDS = 24 * 60 * 60
+
+
+class host_throughput(db.Model):
+    host_id = db.Column(db.Integer, nullable=False, primary_key=True) # BOINC's host id
+    target_id = db.Column(db.Integer, db.ForeignKey('targets.target_id'), nullable=False, primary_key=True)
+    execs_per_sec = db.Column(db.Float, nullable=False)
+    run_time = db.Column(db.Integer, nullable=False) # Seconds of fuzzing the speed was measured over
+    workers = db.Column(db.Integer, nullable=True) # The workers the fuzzer's autotune picked last, if it ran
+    update_time = db.Column(db.DateTime())
+
+    target = db.relationship('targets')
+
+    def __init__(self, host_id, target_id, execs_per_sec, run_time, workers=None):
+        self.host_id = host_id
+        self.target_id = target_id
+        self.execs_per_sec = execs_per_sec
+        self.run_time = run_time
+        self.workers = workers
+        self.update_time = datetime.utcnow()
+
+    def add_measurement(self, execs_per_sec, run_time, workers=None):
+        """
+        Averages a new measurement into the host's exec speed, weighted by how
+        long each was measured over
+        :param execs_per_sec: float, the measured exec speed
+        :param run_time: int, how many seconds the speed was measured over
+        :param workers: int, the number of workers the fuzzer's autotune
+        picked, or None if it didn't run
+        """
+        history = min(self.run_time, THROUGHPUT_HISTORY_SECONDS)
+        self.execs_per_sec = (self.execs_per_sec * history + execs_per_sec * run_time) / (history + run_time)
+        self.run_time = history + run_time
+        if workers:
+            self.workers = workers
+        self.update_time = datetime.utcnow()
+
+    def as_dict(self):
+        return {c.name: str(getattr(self, c.name)) for c in self.__table__.columns}
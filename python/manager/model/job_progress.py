@@ -0,0 +1,34 @@
+from app import app
+from datetime import datetime
+
+db = app.config['db']
+
+
+class job_progress(db.Model):
+    job_id = db.Column(db.Integer, db.ForeignKey('fuzz_jobs.job_id'), nullable=False, primary_key=True)
+    host_id = db.Column(db.Integer, nullable=False, primary_key=True) # BOINC's host id
+    paths_found = db.Column(db.Integer, nullable=False)
+    execs_done = db.Column(db.BigInteger, nullable=False)
+    update_time = db.Column(db.DateTime())
+
+    job = db.relationship('fuzz_jobs')
+
+    def __init__(self, job_id, host_id, paths_found, execs_done):
+        self.job_id = job_id
+        self.host_id = host_id
+        self.paths_found = paths_found
+        self.execs_done = execs_done
+        self.update_time = datetime.utcnow()
+
+    def update(self, paths_found, execs_done):
+        """
+        Records the latest coverage that the host's workunit reported
+        :param paths_found: int, the paths the fuzzer has found so far
+        :param execs_done: int, the execs the fuzzer has run so far
+        """
+        self.paths_found = paths_found
+        self.execs_done = execs_done
+        self.update_time = datetime.utcnow()
+
+    def as_dict(self):
+        return {c.name: str(getattr(self, c.name)) for c in self.__table__.columns}
@@ -0,0 +1,386 @@
+//This program regenerates the inputs that the fuzzer saved as lineage records (-R) rather than in full.  Each
+//record names the input it was mutated from by its hash, which is either a seed, an input that was saved in
+//full, or another record's input, which is regenerated first.  The regenerated inputs are checked against the
+//hashes they were saved under, and written to a directory, named by their hashes like the fuzzer's findings.
+
+#include <jansson_helper.h>
+#include <utils.h>
+#include <fixup.h>
+#include "findings.h"
+#include "lineage.h"
+#include "xxhash.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(char * program_name)
+{
+	printf(
+		"Usage: %s output_directory regenerated_directory [options]\n"
+		"\n"
+		"Required:\n"
+		"\t output_directory              The fuzzer's output directory, with the lineage records to regenerate\n"
+		"\t regenerated_directory         Write the regenerated inputs to this existing directory\n"
+		"Options:\n"
+		"\t -d driver_options              JSON filename with the driver options the fuzzer used, for their fixups\n"
+		"\t -l logging_options            Set the options for logging\n"
+		"\t -p mutator_directory          The directory to look for mutator DLLs in\n"
+		"\t -s seed                       The seed file the fuzzer used\n"
+		"\t -S seed_directory             The seed directory or packed corpus the fuzzer used\n"
+		"\n"
+		"The inputs are regenerated by mutating the input they were mutated from once, with the mutator, options\n"
+		"and state the fuzzer recorded, so the seeds must be the same ones the fuzzer was started with.\n"
+		"\n",
+		program_name
+	);
+	exit(1);
+}
+
+//An input that is known or can be regenerated, by its hash
+struct replay_input
+{
+	uint64_t hash;
+	char * data;        //The input, or NULL if it hasn't been regenerated yet
+	size_t length;
+	char * record;      //The input's lineage record, or NULL if the input was saved in full or is a seed
+	char * filename;    //The file the input or its lineage record was read from, or NULL for a seed
+	int regenerating;   //Whether the input is being regenerated, to catch records that are their own ancestors
+	int failed;         //Whether the input couldn't be regenerated
+};
+typedef struct replay_input replay_input_t;
+
+static replay_input_t * inputs = NULL;
+static size_t num_inputs = 0, max_inputs = 0;
+static char * mutator_directory = NULL;
+static char * regenerated_directory = NULL;
+static fixups_t * fixups = NULL;
+
+/**
+ * This function adds an input to the known inputs.
+ * @param hash - the hash of the input
+ * @param data - the input, or NULL if it has to be regenerated.  The known inputs take ownership of it.
+ * @param length - the length of data
+ * @param record - the input's lineage record, or NULL.  The known inputs take ownership of it.
+ * @param filename - the file the input or record was read from, or NULL.  The known inputs take ownership of it.
+ * @return - zero on success, or non-zero if it couldn't be allocated
+ */
+static int add_input(uint64_t hash, char * data, size_t length, char * record, char * filename)
+{
+	replay_input_t * new_inputs;
+
+	if (num_inputs == max_inputs) {
+		max_inputs = max_inputs ? max_inputs * 2 : 256;
+		new_inputs = (replay_input_t *)realloc(inputs, max_inputs * sizeof(replay_input_t));
+		if (!new_inputs)
+			return 1;
+		inputs = new_inputs;
+	}
+	memset(&inputs[num_inputs], 0, sizeof(replay_input_t));
+	inputs[num_inputs].hash = hash;
+	inputs[num_inputs].data = data;
+	inputs[num_inputs].length = length;
+	inputs[num_inputs].record = record;
+	inputs[num_inputs].filename = filename;
+	num_inputs++;
+	return 0;
+}
+
+/**
+ * This function adds the inputs and lineage records in one of the directories of a findings store to the
+ * known inputs.
+ * @param directory - the directory to add the files of
+ * @return - zero on success, or non-zero if the files couldn't be allocated
+ */
+static int add_directory_files(char * directory)
+{
+	char ** filenames, * name, * end, * data;
+	size_t count, i, name_length, extension_length = strlen(LINEAGE_EXTENSION);
+	uint64_t hash;
+	int length, ret = 0;
+
+	filenames = list_directory_files(directory, &count);
+	for (i = 0; filenames && i < count; i++)
+	{
+		length = read_file(filenames[i], &data);
+		if (length <= 0) {
+			WARNING_MSG("Skipping the empty or unreadable file %s", filenames[i]);
+			free(filenames[i]);
+			continue;
+		}
+
+		//The lineage records are named by the hash of the input they regenerate
+		for (name = end = filenames[i]; *end; end++)
+		{
+			if (*end == '/' || *end == '\\')
+				name = end + 1;
+		}
+		name_length = strlen(name);
+		if (name_length > extension_length && !strcmp(name + name_length - extension_length, LINEAGE_EXTENSION)) {
+			hash = strtoull(name, &end, 16);
+			if (end != name + name_length - extension_length) {
+				WARNING_MSG("Skipping the lineage record %s, which isn't named by a hash", filenames[i]);
+				free(data);
+				free(filenames[i]);
+				continue;
+			}
+			ret = add_input(hash, NULL, 0, data, filenames[i]);
+		}
+		else
+			ret = add_input(XXH64(data, length, 0), data, length, NULL, filenames[i]);
+		if (ret) {
+			free(data);
+			free(filenames[i]);
+			break;
+		}
+	}
+	for (i++; filenames && i < count; i++)
+		free(filenames[i]);
+	free(filenames);
+	return ret;
+}
+
+//Orders the inputs by their hash, with the inputs that are already known before the ones that have to be regenerated
+static int compare_inputs(const void * a, const void * b)
+{
+	const replay_input_t * input_a = (const replay_input_t *)a, * input_b = (const replay_input_t *)b;
+	if (input_a->hash != input_b->hash)
+		return input_a->hash < input_b->hash ? -1 : 1;
+	return (input_a->data == NULL) - (input_b->data == NULL);
+}
+
+/**
+ * This function finds a known input by its hash, preferring an input that is already known over one that
+ * has to be regenerated.  The inputs must be sorted with compare_inputs.
+ * @param hash - the hash of the input to find
+ * @return - the input, or NULL if there isn't one with that hash
+ */
+static replay_input_t * find_input(uint64_t hash)
+{
+	size_t low = 0, high = num_inputs, middle;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		if (inputs[middle].hash < hash)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < num_inputs && inputs[low].hash == hash ? &inputs[low] : NULL;
+}
+
+/**
+ * This function regenerates an input from its lineage record, regenerating the input it was mutated from first
+ * if that is also a lineage record.
+ * @param input - the input to regenerate
+ * @return - zero on success, or non-zero if the input couldn't be regenerated
+ */
+static int regenerate_input(replay_input_t * input)
+{
+	replay_input_t * parent;
+	char * parent_name, * output, filename[MAX_PATH];
+	uint64_t parent_hash, output_hash;
+	int length;
+
+	if (input->data)
+		return 0;
+	if (input->failed)
+		return 1;
+	if (input->regenerating) {
+		ERROR_MSG("The lineage record %s is its own ancestor", input->filename);
+		input->failed = 1;
+		return 1;
+	}
+
+	parent_name = lineage_parent(input->record, &parent_hash);
+	if (!parent_name) {
+		ERROR_MSG("The lineage record %s doesn't name the input it was mutated from", input->filename);
+		input->failed = 1;
+		return 1;
+	}
+
+	parent = find_input(parent_hash);
+	if (!parent) {
+		ERROR_MSG("The input %s that %s was mutated from isn't a seed or a saved input", parent_name, input->filename);
+		free(parent_name);
+		input->failed = 1;
+		return 1;
+	}
+	free(parent_name);
+
+	input->regenerating = 1;
+	if (regenerate_input(parent)) {
+		input->regenerating = 0;
+		input->failed = 1;
+		return 1;
+	}
+	input->regenerating = 0;
+
+	output = lineage_replay(input->record, mutator_directory, parent->data, parent->length, &length);
+	if (!output) {
+		ERROR_MSG("Couldn't regenerate the input of %s", input->filename);
+		input->failed = 1;
+		return 1;
+	}
+
+	//The driver fixed up the input after the mutator changed it, so do the same before checking it
+	fixups_apply(fixups, output, length);
+	output_hash = XXH64(output, length, 0);
+	if (output_hash != input->hash) {
+		WARNING_MSG("The input regenerated from %s has the hash %016" PRIX64 ", the mutator may not be deterministic",
+			input->filename, output_hash);
+		free(output);
+		input->failed = 1;
+		return 1;
+	}
+
+	input->data = output;
+	input->length = length;
+	snprintf(filename, sizeof(filename), "%s/%016" PRIX64, regenerated_directory, input->hash);
+	if (write_buffer_to_file(filename, output, length)) {
+		ERROR_MSG("Couldn't write the regenerated input %s", filename);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	char * findings_types[FINDINGS_NUM_TYPES] = FINDINGS_TYPE_NAMES;
+	char *output_directory, *driver_options_file = NULL, *driver_options = NULL, *logging_options = NULL, *seed_file = NULL, *seed_directory = NULL,
+		*mutator_directory_cli = NULL, *seed_buffer, directory[MAX_PATH];
+	seed_directory_t * seeds = NULL;
+	int seed_length, type, i, regenerated = 0, failed = 0;
+	size_t j;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (argc < 3)
+	{
+		usage(argv[0]);
+	}
+
+	output_directory = argv[1];
+	regenerated_directory = argv[2];
+	for (i = 3; i < argc; i++)
+	{
+		IF_ARG_OPTION("-d", driver_options_file)
+		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARG_OPTION("-p", mutator_directory_cli)
+		ELSE_IF_ARG_OPTION("-s", seed_file)
+		ELSE_IF_ARG_OPTION("-S", seed_directory)
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+
+	if (mutator_directory_cli)
+		mutator_directory = strdup(mutator_directory_cli);
+	else
+	{
+#ifdef _WIN32
+		mutator_directory = filename_relative_to_binary_dir("..\\mutators\\");
+#else
+		mutator_directory = filename_relative_to_binary_dir("../mutators");
+#endif
+	}
+	if (!mutator_directory)
+		FATAL_MSG("Mutator directory was not found in default location. You may need to pass the -p flag.");
+	if (!is_directory(regenerated_directory))
+		FATAL_MSG("The regenerated directory %s isn't a directory", regenerated_directory);
+	if (driver_options_file && read_file(driver_options_file, &driver_options) <= 0)
+		FATAL_MSG("Could not read the driver options file: %s", driver_options_file);
+	if (fixups_create(driver_options, &fixups))
+		FATAL_MSG("Bad fixups in the driver options: %s", driver_options);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Find the inputs ///////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (seed_file)
+	{
+		seed_length = read_file(seed_file, &seed_buffer);
+		if (seed_length <= 0)
+			FATAL_MSG("Could not read seed file or empty seed file: %s", seed_file);
+		if (add_input(XXH64(seed_buffer, seed_length, 0), seed_buffer, seed_length, NULL, NULL))
+			FATAL_MSG("Couldn't allocate the list of inputs");
+	}
+	if (seed_directory)
+	{
+		seeds = load_seed_directory(seed_directory);
+		if (!seeds)
+			FATAL_MSG("Could not find any non-empty seed files in the seed directory: %s", seed_directory);
+		for (j = 0; j < seeds->count; j++)
+		{
+			seed_buffer = (char *)memdup((void *)seeds->seeds[j].data, seeds->seeds[j].length);
+			if (!seed_buffer || add_input(XXH64(seed_buffer, seeds->seeds[j].length, 0), seed_buffer,
+				seeds->seeds[j].length, NULL, NULL))
+				FATAL_MSG("Couldn't allocate the list of inputs");
+		}
+		free_seed_directory(seeds);
+	}
+
+	//Take the inputs and records from each type's directory, and from its fan out subdirectories
+	for (type = 0; type < FINDINGS_NUM_TYPES; type++)
+	{
+		snprintf(directory, sizeof(directory), "%s/%s", output_directory, findings_types[type]);
+		if (!is_directory(directory))
+			continue;
+		if (add_directory_files(directory))
+			FATAL_MSG("Couldn't allocate the list of inputs");
+		for (i = 0; i < FINDINGS_FANOUT_DIRS; i++)
+		{
+			snprintf(directory, sizeof(directory), "%s/%s/%0*X", output_directory, findings_types[type],
+				FINDINGS_FANOUT_CHARS, i);
+			if (is_directory(directory) && add_directory_files(directory))
+				FATAL_MSG("Couldn't allocate the list of inputs");
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Regenerate the inputs /////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (num_inputs)
+		qsort(inputs, num_inputs, sizeof(replay_input_t), compare_inputs);
+	for (j = 0; j < num_inputs; j++)
+	{
+		if (!inputs[j].record)
+			continue;
+		if (regenerate_input(&inputs[j]))
+			failed++;
+		else
+			regenerated++;
+	}
+	CRITICAL_MSG("Regenerated %d of the %d lineage records in %s", regenerated, regenerated + failed, output_directory);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	for (j = 0; j < num_inputs; j++)
+	{
+		free(inputs[j].data);
+		free(inputs[j].record);
+		free(inputs[j].filename);
+	}
+	free(inputs);
+	free(mutator_directory);
+	free(driver_options);
+	fixups_free(fixups);
+	return failed != 0;
+}
@@ -97,6 +97,12 @@ def add_daemons(config_file, name, platform):
     daemon.lock_file = 'killerbeez_assimilator_{}.lock'.format(app_name)
     daemon.output = 'killerbeez_assimilator_{}.log'.format(app_name)
 
+    daemon = config_file.daemons.make_node_and_append('daemon')
+    daemon.cmd = 'killerbeez_trickle_handler.py -app {}'.format(app_name)
+    daemon.pid_file = 'killerbeez_trickle_handler_{}.pid'.format(app_name)
+    daemon.lock_file = 'killerbeez_trickle_handler_{}.lock'.format(app_name)
+    daemon.output = 'killerbeez_trickle_handler_{}.log'.format(app_name)
+
     daemon = config_file.daemons.make_node_and_append('daemon')
     daemon.cmd = 'sample_trivial_validator --app {}'.format(app_name)
     daemon.pid_file = 'sample_trivial_validator_{}.pid'.format(app_name)
@@ -1,5 +1,6 @@
 #!/usr/bin/env python
 
+import collections
 import logging
 import os.path
 import re
@@ -11,11 +12,15 @@ import zipfile
 import requests
 
 import assimilator
+import killerbeez_merge
 import xml.etree.ElementTree as ET
 
 logger = logging.getLogger(__name__)
 
 API_SERVER = 'http://localhost:5000/api'
+# The Unix socket of the merge daemon that keeps the targets' global
+# instrumentation states, or None to only stage the hosts' states
+MERGE_SOCKET = os.environ.get('KILLERBEEZ_MERGE_SOCKET')
 
 
 def clean_download_path(path):
@@ -39,31 +44,63 @@ def dirname_to_result_type(dirname):
     return result_types[dirname]
 
 
+# The number of staged results whose names are remembered, so that results that
+# many workunits find aren't extracted and staged again
+STAGED_CACHE_SIZE = 100000
+# How much of a zip member is read at a time while it's copied
+COPY_CHUNK_SIZE = 1024 * 1024
+
+
 class KillerbeezAssimilator(assimilator.Assimilator):
     def __init__(self):
         assimilator.Assimilator.__init__(self)
+        self._staged = collections.OrderedDict() # result name -> staged path
+        self._merge_client = killerbeez_merge.MergeClient(MERGE_SOCKET) if MERGE_SOCKET else None
 
-    def _stage_file(self, filename):
-        logger.debug('Staging %s', filename)
+    def _stage_directory(self, dirname):
+        """Stages every file in a directory with a single call to stage_file.
+        Gzipped copies are staged too, since new paths can become the seeds of
+        later jobs, which are sent compressed.
+
+        Returns a dict mapping each file's name to the path it was staged to.
+        """
+        logger.debug('Staging the files in %s', dirname)
         process = subprocess.Popen(
-            ['bin/stage_file', '--verbose', filename],
+            ['bin/stage_file', '--gzip', '--verbose', dirname],
             cwd='..', stdout=subprocess.PIPE)
         stdout, stderr = process.communicate()
         if process.returncode:
-            self.logError('Error staging file: {} | {}\n'.format(stdout, stderr))
-            return None
+            self.logError('Error staging files: {} | {}\n'.format(stdout, stderr))
+            return {}
 
-        # Try to parse stdout to find out where the file was staged to
-        new_path = None
+        # Parse stdout to find out where each file was staged to
+        staged = {}
         for line in stdout.splitlines():
             if line.startswith(b'staging '):
-                _, _, path = line.partition(b' to ')
-                new_path = path.decode('utf8')
+                source, _, path = line[len(b'staging '):].partition(b' to ')
             elif b'already exists as' in line:
-                _, _, path = line.partition(b' as ')
-                new_path = path.decode('utf8')
+                source, _, path = line.partition(b' already exists as ')
+            else:
+                continue
+            name = os.path.basename(source.strip().decode('utf8'))
+            staged[name] = clean_download_path(path.strip().decode('utf8'))
+        return staged
 
-        return clean_download_path(new_path)
+    def _extract_member(self, results_file, result_name, tempdir):
+        """Copies a zip member into tempdir.
+
+        Returns the temporary file it was written to.
+        """
+        fd, filename = tempfile.mkstemp(dir=tempdir, prefix='.extract_')
+        with os.fdopen(fd, 'wb') as dest, results_file.open(result_name) as src:
+            shutil.copyfileobj(src, dest, COPY_CHUNK_SIZE)
+        return filename
+
+    def _remember_staged(self, name, path):
+        self._staged.pop(name, None)
+        self._staged[name] = path
+        while len(self._staged) > STAGED_CACHE_SIZE:
+            self._staged.popitem(last=False)
 
     def _record_job(self, wu):
         job_id = wu.id
@@ -77,28 +114,110 @@ class KillerbeezAssimilator(assimilator.Assimilator):
         requests.put('{}/boinc_job/{}'.format(API_SERVER, job_id),
                     json={'seed_file': seed_file, 'status': 'completed'})
 
-    def _record_result(self, file_path, result_type, job_id):
+    def _record_results(self, job_results, job_id):
+        """Records a workunit's results with one request, which the manager
+        commits in a single transaction."""
         # TODO: use client helper module, maybe
+        if not job_results:
+            return
         requests.post('{}/boinc_job/{}/results'.format(API_SERVER, job_id),
-                    json={'repro_file': file_path, 'result_type': result_type})
+                    json={'results': [{'repro_file': file_path, 'result_type': result_type}
+                                      for file_path, result_type in job_results]})
+
+    def _record_throughput(self, results_file, job_id, host_id):
+        """Reports the host's exec speed, averaged over the tasks it pooled
+        into this result, so the manager can size the target's workunits.
+        The number of workers the last task fuzzed with is reported too, if
+        the fuzzer recorded it."""
+        total_execs = 0
+        total_time = 0
+        workers = None
+        for line in results_file.read('killerbeez_throughput.txt').decode('utf-8').splitlines():
+            try:
+                fields = [int(field) for field in line.split()]
+                execs_per_sec, run_time = fields[:2]
+            except ValueError:
+                logger.warning('Ignoring a bad line in the throughput of job %d: %s', job_id, line)
+                continue
+            total_execs += execs_per_sec * run_time
+            total_time += run_time
+            if len(fields) > 2:
+                workers = fields[2]
+        if total_time <= 0:
+            return
+        throughput = {'host_id': host_id, 'execs_per_sec': total_execs / total_time, 'run_time': total_time}
+        if workers:
+            throughput['workers'] = workers
+        requests.post('{}/boinc_job/{}/throughput'.format(API_SERVER, job_id), json=throughput)
+
+    def _merge_state(self, instrumentation, filename):
+        """Merges a host's instrumentation state into the target's global
+        state, with the merge daemon."""
+        if not self._merge_client:
+            return
+        name = '{}_{}'.format(self.appname, instrumentation)
+        try:
+            bits = self._merge_client.merge(name, os.path.abspath(filename))
+            logger.info('Merged %s into %s, which now has %d bits of coverage', filename, name, bits)
+        except (killerbeez_merge.MergeError, IOError, OSError) as e:
+            logger.warning('Could not merge %s into %s: %s', filename, name, e)
 
-    def _process_zipfile(self, job_id, output_file):
+    def _process_zipfile(self, job_id, host_id, output_file):
         tempdir = tempfile.mkdtemp()
+        job_results = [] # [name, result type, staged path] of each result
+        state_names = []
         try:
             with zipfile.ZipFile(output_file, 'r') as results_file:
                 for result_name in results_file.namelist():
-                    match = re.match(r'killerbeez_result_([a-z]+)_([A-Za-z0-9]+)', result_name)
-                    if not match:
+                    if result_name == 'killerbeez_throughput.txt':
+                        self._record_throughput(results_file, job_id, host_id)
                         continue
-                    result_type = match.group(1)
-                    md5 = match.group(2)
 
-                    filename = os.path.join(tempdir, 'input_{}'.format(md5.lower()))
-                    with open(filename, 'wb') as dest, results_file.open(result_name) as src:
-                        dest.write(src.read())
+                    match = re.match(r'killerbeez_state_([A-Za-z0-9_]+)\.dat', result_name)
+                    if match:
+                        # The hosts merge the instrumentation states of their
+                        # tasks before uploading them, so there's at most one
+                        # state per result
+                        filename = self._extract_member(results_file, result_name, tempdir)
+                        state_name = 'instrumentation_state_{}_{}.dat'.format(job_id, match.group(1))
+                        os.rename(filename, os.path.join(tempdir, state_name))
+                        state_names.append(state_name)
+                        self._merge_state(match.group(1), os.path.join(tempdir, state_name))
+                        continue
 
-                    staged_path = self._stage_file(filename)
-                    self._record_result(staged_path, dirname_to_result_type(result_type), job_id)
+                    # The lineage records that the fuzzer saves in place of
+                    # some new paths (see fuzzer/lineage.h) are recorded as
+                    # the findings they regenerate
+                    match = re.match(r'killerbeez_result_([a-z_]+)_([A-Za-z0-9]+(?:\.lineage)?)$', result_name)
+                    if not match:
+                        continue
+                    result_type = dirname_to_result_type(match.group(1))
+
+                    # The fuzzer names results by their XXH64 hash, so ones
+                    # that were already staged can be skipped without reading
+                    # them
+                    name = match.group(2).lower()
+                    path = self._staged.get(name)
+                    if not path:
+                        staged_name = os.path.join(tempdir, 'input_{}'.format(name))
+                        if not os.path.exists(staged_name):
+                            os.rename(self._extract_member(results_file, result_name, tempdir), staged_name)
+                    job_results.append([name, result_type, path])
+
+            staged = self._stage_directory(tempdir) if os.listdir(tempdir) else {}
+            for job_result in job_results:
+                if not job_result[2]:
+                    job_result[2] = staged.get('input_{}'.format(job_result[0]))
+                if job_result[2]:
+                    self._remember_staged(job_result[0], job_result[2])
+            # The manager has no API for the states, so they're only staged.  The
+            # target's global state is kept by the merge daemon instead, if
+            # KILLERBEEZ_MERGE_SOCKET is set.
+            for state_name in state_names:
+                logger.info('Staged the instrumentation state %s at %s', state_name, staged.get(state_name))
+
+            self._record_results([(path, result_type) for _, result_type, path in job_results if path],
+                                 job_id)
         finally:
             shutil.rmtree(tempdir)
 
@@ -118,7 +237,7 @@ class KillerbeezAssimilator(assimilator.Assimilator):
         # TODO: handle error status, maybe
         self._record_job(wu)
         zipfile_name = self.get_file_path(canonical_result)
-        self._process_zipfile(wu.id, zipfile_name)
+        self._process_zipfile(wu.id, canonical_result.hostid, zipfile_name)
 
 
 if __name__ == '__main__':
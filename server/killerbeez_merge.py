@@ -0,0 +1,64 @@
+"""A client for the merge daemon (merger/merge_daemon.c), which keeps each
+target's global instrumentation state in memory and merges the states that
+the hosts send back into it."""
+
+import socket
+
+
+class MergeError(Exception):
+    pass
+
+
+class MergeClient(object):
+    def __init__(self, socket_path):
+        self._socket_path = socket_path
+        self._file = None
+
+    def _request(self, *args):
+        for arg in args:
+            if not arg or any(c.isspace() for c in arg):
+                raise MergeError('Bad argument to the merge daemon: {!r}'.format(arg))
+        if self._file is None:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(self._socket_path)
+            self._file = sock.makefile('rw')
+            sock.close()
+        try:
+            self._file.write(' '.join(args) + '\n')
+            self._file.flush()
+            reply = self._file.readline().strip()
+        except (IOError, OSError):
+            self.close()
+            raise
+        if not reply:
+            self.close()
+            raise MergeError('The merge daemon closed the connection')
+        status, _, value = reply.partition(' ')
+        if status != 'ok':
+            raise MergeError(value)
+        return value
+
+    def merge(self, name, path):
+        """Merges the binary state or delta in path into the named state, and
+        returns the number of cleared bits of the merged state's bitmaps."""
+        return int(self._request('merge', name, path))
+
+    def count(self, name, section=None):
+        """Returns the number of cleared bits of the named state's bitmaps, or
+        of just the named section."""
+        args = ['count', name] + ([section] if section else [])
+        return int(self._request(*args))
+
+    def diff(self, name, base_path, output_path):
+        """Writes the delta of the named state since the state in base_path,
+        and returns its length."""
+        return int(self._request('diff', name, base_path, output_path))
+
+    def get(self, name, output_path):
+        """Writes the named state, compressed, and returns its length."""
+        return int(self._request('get', name, output_path))
+
+    def close(self):
+        if self._file is not None:
+            self._file.close()
+            self._file = None
@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+
+import base64
+import logging
+import os.path
+import re
+import shutil
+import tempfile
+import xml.etree.ElementTree as ET
+
+import requests
+
+from Boinc import database, db_base
+
+import killerbeez_assimilator
+
+logger = logging.getLogger(__name__)
+
+# The prefix of the variety that trickle_results.sh sends its trickle-up
+# messages with.  The app's name follows it, so each app's handler only takes
+# its own messages.
+TRICKLE_VARIETY = 'killerbeez_'
+# How many trickle messages are handled in each pass.  The passes are spread
+# out by the daemon's sleep interval, so a burst of messages from many hosts
+# is ingested at an even rate, instead of all at once.
+BATCH_SIZE = 50
+
+
+class KillerbeezTrickleHandler(killerbeez_assimilator.KillerbeezAssimilator):
+    """Ingests the findings that running workunits stream back as trickle-up
+    messages, so they reach the manager without waiting for the workunit to
+    finish.  It runs in the assimilator's daemon loop, and stages and records
+    results the same way the assimilator does."""
+
+    def _find_job_id(self, msg_xml):
+        match = re.search(r'<result_name>([^<]+)</result_name>', msg_xml)
+        if not match:
+            return None
+        boinc_results = database.Results.find(name=match.group(1))
+        if not boinc_results:
+            return None
+        return boinc_results[0].workunit.id
+
+    def _record_progress(self, stats, job_id, host_id):
+        """Records the coverage that the workunit's fuzzer has reached so far
+        with the manager."""
+        try:
+            progress = {'host_id': host_id, 'paths_found': int(stats.get('paths_found')),
+                        'execs_done': int(stats.get('execs_done'))}
+        except (TypeError, ValueError):
+            logger.warning('Ignoring the bad stats of job %d from host %d', job_id, host_id)
+            return
+        requests.post('{}/boinc_job/{}/progress'.format(killerbeez_assimilator.API_SERVER, job_id),
+                      json=progress)
+
+    def _handle_message(self, msg_id, host_id, msg_xml):
+        job_id = self._find_job_id(msg_xml)
+        start = msg_xml.find('<killerbeez>')
+        end = msg_xml.find('</killerbeez>')
+        if job_id is None or start < 0 or end < 0:
+            logger.warning('Ignoring the malformed trickle message %d from host %d', msg_id, host_id)
+            return
+        message = ET.fromstring(msg_xml[start:end + len('</killerbeez>')])
+
+        stats = message.find('stats')
+        if stats is not None:
+            logger.info('Job %d on host %d found %s new paths in %s execs (%s paths, %s execs in total)',
+                        job_id, host_id, stats.get('new_paths'), stats.get('new_execs'),
+                        stats.get('paths_found'), stats.get('execs_done'))
+            self._record_progress(stats, job_id, host_id)
+
+        tempdir = tempfile.mkdtemp()
+        job_results = [] # [name, result type, staged path] of each result
+        try:
+            for result in message.findall('result'):
+                # Results are staged under their name, which is their hash, as
+                # the assimilator stages them, so the workunit's final upload
+                # matches the results it streamed back
+                name = (result.get('name') or '').lower()
+                try:
+                    result_type = killerbeez_assimilator.dirname_to_result_type(result.get('type'))
+                    data = base64.b64decode(result.text or '')
+                except (KeyError, TypeError, ValueError):
+                    data = None
+                if data is None or not re.match(r'[a-z0-9]+$', name):
+                    logger.warning('Ignoring a bad result in the trickle message %d', msg_id)
+                    continue
+                path = self._staged.get(name)
+                if not path:
+                    staged_name = os.path.join(tempdir, 'input_{}'.format(name))
+                    with open(staged_name, 'wb') as staged_file:
+                        staged_file.write(data)
+                job_results.append([name, result_type, path])
+
+            staged = self._stage_directory(tempdir) if os.listdir(tempdir) else {}
+            for job_result in job_results:
+                if not job_result[2]:
+                    job_result[2] = staged.get('input_{}'.format(job_result[0]))
+                if job_result[2]:
+                    self._remember_staged(job_result[0], job_result[2])
+
+            self._record_results([(path, result_type) for _, result_type, path in job_results if path],
+                                 job_id)
+        finally:
+            shutil.rmtree(tempdir)
+
+    def do_pass(self, app):
+        """Handles the oldest BATCH_SIZE unhandled trickle messages of the app."""
+        cursor = db_base.dbconnection.cursor()
+        cursor.execute('SELECT id, hostid, xml FROM msg_from_host WHERE variety = %s AND handled = 0 '
+                       'ORDER BY id LIMIT %s', (TRICKLE_VARIETY + app.name, BATCH_SIZE))
+        messages = cursor.fetchall()
+        for message in messages:
+            try:
+                self._handle_message(message['id'], message['hostid'], message['xml'])
+            except Exception as e:
+                self.logError('Error handling the trickle message {}: {}\n'.format(message['id'], e))
+            # Messages are marked handled even if they failed, since the
+            # workunit's final upload has the same findings to fall back on
+            if not self.noinsert:
+                cursor.execute('UPDATE msg_from_host SET handled = 1 WHERE id = %s', (message['id'],))
+        db_base.dbconnection.commit()
+        cursor.close()
+        # The daemon always sleeps between passes, even with messages left, to
+        # keep its load on the manager even
+        return False
+
+
+if __name__ == '__main__':
+    handler = KillerbeezTrickleHandler()
+    handler.run()
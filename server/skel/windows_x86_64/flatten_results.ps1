@@ -1,7 +1,112 @@
-echo "Results from a killerbeez run. This file ensures an empty zip file is not generated." > README.txt
-Foreach($type in "crashes", "hangs", "new_paths") {
-  Get-ChildItem output\$type |
-  Foreach-Object {
-    cp $_.FullName $('killerbeez_result_{0}_{1}' -f $type, $_.Name)
+param([switch]$start, [string]$project_dir = ".")
+
+# Rather than each task uploading its own results, the tasks on a host pool their results in a spool
+# shared by all of the host's tasks of the same job configuration (the same cmdline.bat).  Findings are
+# deduplicated by name, which is their hash, and the instrumentation states are merged into one host
+# state with the merger.  A task uploads the spool as its results once KILLERBEEZ_UPLOAD_INTERVAL
+# seconds have passed since the last upload, or when it's the last of the host's tasks of its job
+# configuration that's still running, so nothing is left behind in the spool.  Otherwise, it only
+# uploads the README.  Each task's average exec speed and run time is pooled too, and uploaded as
+# killerbeez_throughput.txt, which the manager sizes the target's later workunits with.
+# With -start, the task is registered as running, before the fuzzer starts.
+
+$killerbeez_dir = Join-Path $project_dir "killerbeez-x64\killerbeez"
+$state_file = "instrumentation_state.dat"
+$upload_interval = if ($env:KILLERBEEZ_UPLOAD_INTERVAL) { [int]$env:KILLERBEEZ_UPLOAD_INTERVAL } else { 3600 }
+$stale_task_hours = 24 # Tasks that haven't finished after a day are assumed to have died
+
+$job_key = if (Test-Path cmdline.bat) { (Get-FileHash cmdline.bat -Algorithm MD5).Hash } else { "default" }
+$spool = Join-Path $project_dir "killerbeez-spool\$job_key"
+$md5 = [System.Security.Cryptography.MD5]::Create()
+$task_id = [System.BitConverter]::ToString($md5.ComputeHash([System.Text.Encoding]::UTF8.GetBytes((Get-Location).Path))) -replace "-", ""
+
+New-Item -ItemType Directory -Force -Path "$spool\results", "$spool\active" | Out-Null
+
+# Only one task updates the spool at a time
+while ($true) {
+  try {
+    $lock = [System.IO.File]::Open("$spool\lock", "OpenOrCreate", "ReadWrite", "None")
+    break
+  } catch {
+    Start-Sleep -Milliseconds 200
   }
 }
+
+try {
+  if ($start) {
+    New-Item -ItemType File -Force -Path "$spool\active\$task_id" | Out-Null
+    exit 0
+  }
+  Remove-Item -Force -ErrorAction SilentlyContinue "$spool\active\$task_id"
+  Get-ChildItem "$spool\active" -File | Where-Object { $_.LastWriteTime -lt (Get-Date).AddHours(-$stale_task_hours) } | Remove-Item -Force
+
+  echo "Results from a killerbeez run. This file ensures an empty zip file is not generated." > README.txt
+  Foreach($type in "crashes", "hangs", "new_paths") {
+    Get-ChildItem output\$type -Recurse -File -ErrorAction SilentlyContinue |
+    Foreach-Object {
+      $dest = Join-Path "$spool\results" $('killerbeez_result_{0}_{1}' -f $type, $_.Name)
+      if (-not (Test-Path $dest)) {
+        cp $_.FullName $dest
+      }
+    }
+  }
+
+  # Record this task's exec speed, how long it fuzzed for, and with how many workers, from the fuzzer's
+  # final stats
+  if (Test-Path output\fuzzer_stats) {
+    $fuzzer_stats = @{}
+    Get-Content output\fuzzer_stats | Foreach-Object {
+      $name, $value = $_ -split '\s*:\s*', 2
+      $fuzzer_stats[$name] = [long]$value
+    }
+    if ($fuzzer_stats.ContainsKey("avg_execs_per_sec")) {
+      $run_time = $fuzzer_stats["last_update"] - $fuzzer_stats["start_time"]
+      $line = "{0} {1}" -f $fuzzer_stats["avg_execs_per_sec"], $run_time
+      if ($fuzzer_stats.ContainsKey("active_workers")) {
+        $line += " {0}" -f $fuzzer_stats["active_workers"]
+      }
+      Add-Content -Path "$spool\throughput" -Value $line
+    }
+  }
+
+  # Merge this task's instrumentation state into the host's.  Only binary states are merged, since they
+  # say which instrumentation wrote them (in the 16 bytes after the 24 byte header prefix).
+  if ((Test-Path $state_file) -and (Get-Item $state_file).Length -ge 40) {
+    $header = [System.IO.File]::ReadAllBytes((Resolve-Path $state_file).Path)[0..39]
+    if ([System.Text.Encoding]::ASCII.GetString($header, 0, 8) -eq "KBZSTATE") {
+      $instrumentation = [System.Text.Encoding]::ASCII.GetString($header, 24, 16).TrimEnd([char]0)
+      if (Test-Path "$spool\$state_file") {
+        & "$killerbeez_dir\merger.exe" $instrumentation "$spool\merged.dat" "$spool\$state_file" $state_file
+        if ($LASTEXITCODE -eq 0) {
+          Move-Item -Force "$spool\merged.dat" "$spool\$state_file"
+        } else {
+          echo "Couldn't merge $state_file into the host's instrumentation state"
+        }
+      } else {
+        cp $state_file "$spool\$state_file"
+      }
+      Set-Content -Path "$spool\instrumentation" -Value $instrumentation
+    }
+  }
+
+  # Decide whether this task uploads the spool
+  if (-not (Test-Path "$spool\last_upload")) {
+    New-Item -ItemType File -Path "$spool\last_upload" | Out-Null
+  }
+  $since_upload = ((Get-Date) - (Get-Item "$spool\last_upload").LastWriteTime).TotalSeconds
+  if ($since_upload -lt $upload_interval -and (Get-ChildItem "$spool\active" -File)) {
+    echo "Left this task's results in the host spool for a later upload"
+    exit 0
+  }
+
+  Get-ChildItem "$spool\results" -File | Move-Item -Destination .
+  if (Test-Path "$spool\$state_file") {
+    Move-Item -Force "$spool\$state_file" $('killerbeez_state_{0}.dat' -f (Get-Content "$spool\instrumentation"))
+  }
+  if (Test-Path "$spool\throughput") {
+    Move-Item -Force "$spool\throughput" killerbeez_throughput.txt
+  }
+  (Get-Item "$spool\last_upload").LastWriteTime = Get-Date
+} finally {
+  $lock.Close()
+}
@@ -1,9 +1,94 @@
 #!/bin/bash
 exec >&2 # Redirect stdout to stderr so that it's captured for BOINC
 
+# Rather than each task uploading its own results, the tasks on a host pool their results in a spool
+# shared by all of the host's tasks of the same job configuration (the same cmdline.sh).  Findings are
+# deduplicated by name, which is their hash, and the instrumentation states are merged into one host
+# state with the merger.  A task uploads the spool as its results once KILLERBEEZ_UPLOAD_INTERVAL
+# seconds have passed since the last upload, or when it's the last of the host's tasks of its job
+# configuration that's still running, so nothing is left behind in the spool.  Otherwise, it only
+# uploads the README.  Each task's average exec speed, run time, and the number of workers it fuzzed with
+# (which the fuzzer's -Z autotune picks) is pooled too, and uploaded as killerbeez_throughput.txt, which
+# the manager sizes the target's later workunits with.
+#
+# Usage: flatten_results.sh [start] PROJECT_DIR
+# The start mode registers the task as running, before the fuzzer starts.
+
+if [[ "$1" == "start" ]]; then
+  MODE=start
+  shift
+else
+  MODE=finish
+fi
+
+PROJECT_DIR=$(readlink -f ${1:-.})
+KILLERBEEZ_DIR=$PROJECT_DIR/killerbeez-Linux/killerbeez
+STATE_FILE=instrumentation_state.dat
+UPLOAD_INTERVAL=${KILLERBEEZ_UPLOAD_INTERVAL:-3600}
+STALE_TASK_MINUTES=1440 # Tasks that haven't finished after a day are assumed to have died
+
+JOB_KEY=$(md5sum cmdline.sh 2>/dev/null | cut -d ' ' -f 1)
+SPOOL=$PROJECT_DIR/killerbeez-spool/${JOB_KEY:-default}
+TASK_ID=$(pwd | md5sum | cut -d ' ' -f 1) # Each task runs in its own slot directory
+
+mkdir -p $SPOOL/results $SPOOL/active
+
+# Only one task updates the spool at a time
+exec 9>$SPOOL/lock
+flock 9
+
+if [[ "$MODE" == "start" ]]; then
+  touch $SPOOL/active/$TASK_ID
+  exit 0
+fi
+rm -f $SPOOL/active/$TASK_ID
+find $SPOOL/active -type f -mmin +$STALE_TASK_MINUTES -delete
+
 echo "Results from a killerbeez run. This file ensures an empty zip file is not generated." > README.txt
 for result_type in crashes hangs new_paths; do
-  for file in $(ls output/$result_type); do
-    cp output/$result_type/$file killerbeez_result_${result_type}_${file}
+  for file in $(find output/$result_type -type f 2>/dev/null); do
+    cp -n $file $SPOOL/results/killerbeez_result_${result_type}_$(basename $file)
   done
 done
+
+# Record this task's exec speed, how long it fuzzed for, and with how many workers, from the fuzzer's
+# final stats
+if [[ -s output/fuzzer_stats ]]; then
+  awk '$1 == "start_time" { start = $3 } $1 == "last_update" { end = $3 }
+    $1 == "avg_execs_per_sec" { speed = $3 } $1 == "active_workers" { workers = $3 }
+    END { if (speed != "") print speed, end - start, workers }' \
+    output/fuzzer_stats >> $SPOOL/throughput
+fi
+
+# Merge this task's instrumentation state into the host's.  Only binary states are merged, since they
+# say which instrumentation wrote them (in the 16 bytes after the 24 byte header prefix).
+if [[ -s $STATE_FILE && "$(head -c 8 $STATE_FILE)" == "KBZSTATE" ]]; then
+  instrumentation=$(head -c 40 $STATE_FILE | tail -c 16 | tr -d '\0')
+  if [[ -s $SPOOL/$STATE_FILE ]]; then
+    if $KILLERBEEZ_DIR/merger $instrumentation $SPOOL/merged.dat $SPOOL/$STATE_FILE $STATE_FILE; then
+      mv $SPOOL/merged.dat $SPOOL/$STATE_FILE
+    else
+      echo "Couldn't merge $STATE_FILE into the host's instrumentation state"
+    fi
+  else
+    cp $STATE_FILE $SPOOL/$STATE_FILE
+  fi
+  echo $instrumentation > $SPOOL/instrumentation
+fi
+
+# Decide whether this task uploads the spool
+[[ -e $SPOOL/last_upload ]] || touch $SPOOL/last_upload
+last_upload=$(stat -c %Y $SPOOL/last_upload)
+if [[ $(( $(date +%s) - last_upload )) -lt $UPLOAD_INTERVAL && -n "$(ls -A $SPOOL/active)" ]]; then
+  echo "Left this task's results in the host spool for a later upload"
+  exit 0
+fi
+
+find $SPOOL/results -type f -exec mv {} . \;
+if [[ -s $SPOOL/$STATE_FILE ]]; then
+  mv $SPOOL/$STATE_FILE killerbeez_state_$(cat $SPOOL/instrumentation).dat
+fi
+if [[ -s $SPOOL/throughput ]]; then
+  mv $SPOOL/throughput killerbeez_throughput.txt
+fi
+touch $SPOOL/last_upload
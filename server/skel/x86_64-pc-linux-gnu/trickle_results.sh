@@ -0,0 +1,70 @@
+#!/bin/bash
+exec >&2 # Redirect stdout to stderr so that it's captured for BOINC
+
+# Streams a task's findings back to the server while the fuzzer is still running, as BOINC trickle-up
+# messages, so long workunits don't hold their crashes back until they finish.  It runs as a daemon task
+# next to the fuzzer.  Every KILLERBEEZ_TRICKLE_INTERVAL seconds, it sends the findings it hasn't sent
+# yet, crashes and hangs before new paths, up to KILLERBEEZ_TRICKLE_BYTES bytes of inputs per message.
+# Findings are deduplicated by name, which is their hash, and ones that don't fit are left for a later
+# message, or the final upload that flatten_results.sh makes.  Each message also carries the fuzzer's
+# paths_found and execs_done, and how much they've grown since the last message.  A new message is only
+# written once the client has picked up the last one, so a slow client doesn't pile them up.
+#
+# Usage: trickle_results.sh
+
+TRICKLE_INTERVAL=${KILLERBEEZ_TRICKLE_INTERVAL:-300}
+TRICKLE_BYTES=${KILLERBEEZ_TRICKLE_BYTES:-65536}
+TRICKLE_FILE=trickle_up.xml
+SENT_FILE=killerbeez_trickle_sent # The names of the findings that have been sent
+STATS_FILE=killerbeez_trickle_stats # The paths_found and execs_done of the last message
+# The messages' variety names the app, so the server's trickle handler for the app picks them up
+APP_NAME=$(grep -o '<app_name>[^<]*' init_data.xml 2>/dev/null | cut -d '>' -f 2)
+
+touch $SENT_FILE
+[[ -s $STATS_FILE ]] || echo "0 0" > $STATS_FILE
+
+send_message() {
+  local budget=$TRICKLE_BYTES paths=0 execs=0 last_paths last_execs size name file result_type
+  read last_paths last_execs < $STATS_FILE
+  if [[ -s output/fuzzer_stats ]]; then
+    read paths execs < <(awk '$1 == "paths_found" { paths = $3 } $1 == "execs_done" { execs = $3 }
+      END { print paths + 0, execs + 0 }' output/fuzzer_stats)
+  fi
+
+  {
+    echo "<variety>killerbeez_$APP_NAME</variety>"
+    echo "<killerbeez>"
+    echo "<stats paths_found=\"$paths\" execs_done=\"$execs\"" \
+      "new_paths=\"$(( paths - last_paths ))\" new_execs=\"$(( execs - last_execs ))\"/>"
+    for result_type in crashes hangs new_paths; do
+      # Lineage records (which have an extension) aren't inputs, so they're left for the final upload
+      for file in $(find output/$result_type -type f ! -name '*.*' 2>/dev/null); do
+        name=$(basename $file)
+        grep -qx "$result_type $name" $SENT_FILE && continue
+        size=$(stat -c %s $file)
+        [[ $size -gt $budget ]] && continue
+        budget=$(( budget - size ))
+        echo "<result type=\"$result_type\" name=\"$name\">$(base64 -w 0 $file)</result>"
+        echo "$result_type $name" >> $SENT_FILE.new
+      done
+    done
+    echo "</killerbeez>"
+  } > $TRICKLE_FILE.tmp
+
+  # The client takes the message once it's in place under its final name
+  mv $TRICKLE_FILE.tmp $TRICKLE_FILE
+  if [[ -e $SENT_FILE.new ]]; then
+    cat $SENT_FILE.new >> $SENT_FILE
+    rm -f $SENT_FILE.new
+  fi
+  echo "$paths $execs" > $STATS_FILE
+}
+
+while true; do
+  sleep $TRICKLE_INTERVAL
+  if [[ -e $TRICKLE_FILE ]]; then
+    echo "The last trickle message hasn't been sent yet, skipping this one"
+    continue
+  fi
+  send_message
+done
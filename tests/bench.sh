@@ -0,0 +1,143 @@
+#!/bin/bash
+#
+# Benchmarks the fuzzer's executions per second with each of the driver and
+# instrumentation combinations, and writes the results, with the time spent
+# in each phase of the fuzz iterations, to a JSON file so that builds can be
+# compared.  It's run by the bench target (make bench), or by hand with:
+#
+#   tests/bench.sh build_directory [seconds_per_run] [output_file]
+#
+# The build directory must have the fuzzer, the havoc mutator, and the
+# test-linux and persist test programs built.  The afl instrumentation needs
+# targets compiled with AFL, so the afl runs compile corpus/afl_test with the
+# afl-gcc and afl-clang-fast in AFL_PATH (afl_progs by default, build them with
+# make -C afl_progs), and are skipped if they haven't been built.  The Intel PT
+# runs are skipped on systems without Intel PT.
+
+if [[ -z "$1" ]]; then
+	echo "Usage: $0 build_directory [seconds_per_run] [output_file]"
+	exit 1
+fi
+
+source_directory=$(cd "$(dirname "$0")/.." && pwd)
+build_directory=$(cd "$1" && pwd)
+seconds=${2:-5}
+output_file=${3:-$build_directory/bench.json}
+case "$output_file" in
+	/*) ;;
+	*) output_file="$(pwd)/$output_file" ;;
+esac
+
+cd "$build_directory/killerbeez" || exit 1
+if [[ ! -x ./fuzzer ]]; then
+	echo "The fuzzer hasn't been built in $build_directory"
+	exit 1
+fi
+
+work_directory=$(mktemp -d)
+trap 'rm -rf "$work_directory"' EXIT
+printf 'AAAA' > "$work_directory/seed"
+
+# The reasons that the runs that need each feature are skipped, or empty if they aren't
+afl_path=${AFL_PATH:-$source_directory/afl_progs}
+skip_afl=""
+skip_afl_persist=""
+skip_ipt=""
+if [[ ! -x "$afl_path/afl-gcc" ]] || ! "$afl_path/afl-gcc" -o "$work_directory/test-afl" \
+		"$source_directory/corpus/afl_test/test.c" > /dev/null 2>&1; then
+	skip_afl="afl-gcc is not built in $afl_path"
+fi
+if [[ ! -x "$afl_path/afl-clang-fast" ]] || ! "$afl_path/afl-clang-fast" -DPERSIST \
+		-o "$work_directory/test-afl-persist" "$source_directory/corpus/afl_test/test.c" > /dev/null 2>&1; then
+	skip_afl_persist="afl-clang-fast is not built in $afl_path"
+fi
+if [[ ! -d /sys/devices/intel_pt ]]; then
+	skip_ipt="Intel PT is not supported"
+fi
+
+# The runs, as name|driver|target|driver arguments|instrumentation|instrumentation options|skip reason
+test_afl="$work_directory/test-afl"
+test_afl_persist="$work_directory/test-afl-persist"
+runs=(
+	"file_return_code|file|corpus/test-linux|@@|return_code|{}|"
+	"file_return_code_no_forkserver|file|corpus/test-linux|@@|return_code|{\"use_fork_server\":0}|"
+	"file_afl|file|$test_afl|@@|afl|{}|$skip_afl"
+	"file_afl_no_forkserver|file|$test_afl|@@|afl|{\"use_fork_server\":0}|$skip_afl"
+	"file_ipt|file|corpus/test-linux|@@|ipt|{}|$skip_ipt"
+	"stdin_return_code|stdin|corpus/test-linux||return_code|{}|"
+	"stdin_return_code_no_forkserver|stdin|corpus/test-linux||return_code|{\"use_fork_server\":0}|"
+	"stdin_afl|stdin|$test_afl||afl|{}|$skip_afl"
+	"stdin_afl_no_forkserver|stdin|$test_afl||afl|{\"use_fork_server\":0}|$skip_afl"
+	"stdin_afl_no_persistence|stdin|$test_afl_persist||afl|{}|$skip_afl_persist"
+	"stdin_afl_persistence|stdin|$test_afl_persist||afl|{\"persistence_max_cnt\":1000}|$skip_afl_persist"
+	"stdin_ipt|stdin|corpus/test-linux||ipt|{}|$skip_ipt"
+	"stdin_ipt_no_persistence|stdin|corpus/persist||ipt|{}|$skip_ipt"
+	"stdin_ipt_persistence|stdin|corpus/persist||ipt|{\"persistence_max_cnt\":1000}|$skip_ipt"
+)
+
+# Read a value from a fuzzer_stats file
+function stats_value {
+	# $1 = fuzzer_stats file
+	# $2 = name of the value
+	sed -n "s/^$2 *: *//p" "$1"
+}
+
+results=""
+for run in "${runs[@]}"; do
+	IFS='|' read -r name driver target arguments instrumentation instrumentation_options skip <<< "$run"
+	run_directory="$work_directory/$name"
+	mkdir -p "$run_directory"
+
+	if [[ -n "$arguments" ]]; then
+		echo "{\"path\":\"$target\",\"arguments\":\"$arguments\"}" > "$run_directory/driver.json"
+	else
+		echo "{\"path\":\"$target\"}" > "$run_directory/driver.json"
+	fi
+	echo "$instrumentation_options" > "$run_directory/instrumentation.json"
+
+	result="{\"name\":\"$name\",\"driver\":\"$driver\",\"instrumentation\":\"$instrumentation\","
+	result="$result\"instrumentation_options\":$instrumentation_options,\"target\":\"$target\","
+	if [[ -n "$skip" ]]; then
+		echo "Skipping $name, $skip"
+		results="$results${results:+,}
+    ${result}\"skipped\":\"$skip\"}"
+		continue
+	fi
+
+	echo "Running $name for $seconds seconds"
+	start=$(date +%s%N)
+	./fuzzer -L "$seconds" -s "$work_directory/seed" -o "$run_directory/output" \
+		-d "$run_directory/driver.json" -i "$run_directory/instrumentation.json" \
+		-T "$run_directory/phases.json" \
+		"$driver" "$instrumentation" havoc > "$run_directory/log.txt" 2>&1
+	ret=$?
+	end=$(date +%s%N)
+
+	execs=$(stats_value "$run_directory/output/fuzzer_stats" execs_done)
+	if [[ $ret -ne 0 || -z "$execs" || ! -s "$run_directory/phases.json" ]]; then
+		echo "Failed to run $name:"
+		cat "$run_directory/log.txt"
+		results="$results${results:+,}
+    ${result}\"failed\":true}"
+		continue
+	fi
+
+	elapsed_ns=$((end - start))
+	execs_per_sec=$((execs * 1000000000 / elapsed_ns))
+	echo "  $execs executions, $execs_per_sec per second"
+	results="$results${results:+,}
+    ${result}\"seconds\":$((elapsed_ns / 1000000000)).$(printf '%03d' $((elapsed_ns / 1000000 % 1000))),"
+	results="$results\"execs\":$execs,\"execs_per_sec\":$execs_per_sec,\"phase_timing\":$(cat "$run_directory/phases.json")}"
+done
+
+commit=$(git -C "$source_directory" describe --always --dirty 2>/dev/null)
+cat > "$output_file" <<EOF
+{
+  "commit": "$commit",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "seconds_per_run": $seconds,
+  "results": [$results
+  ]
+}
+EOF
+echo "Wrote the benchmark results to $output_file"
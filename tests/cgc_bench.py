@@ -0,0 +1,304 @@
+#!/usr/bin/env python3
+"""Benchmarks how well the fuzzer finds the bugs in the CGC challenge programs
+in corpus/cgc.  Each target is fuzzed with each of the driver, instrumentation
+and mutator configurations for a number of trials, and the median time to the
+first crash, the coverage (the fuzzer's paths_found) over time, and the
+executions per second of each target and configuration are written to a JSON
+file, so that changes to the scheduling and the mutators can be compared by
+what they find and not just by their speed.  Run it with:
+
+  tests/cgc_bench.py build_directory [-t trials] [-s seconds_per_trial]
+      [-c configs.json] [-o output_file] [target ...]
+
+The targets are the subdirectories of corpus/cgc (or of the -d directory),
+each with an executable named after the directory (with .exe on Windows), and
+an inputs directory whose files, other than the crash*.txt ones, are the seeds.
+The CGC programs in the repository are Windows builds, so the default
+configurations use the DynamoRIO instrumentation on Windows, and only the
+return_code instrumentation elsewhere, for targets built for that platform.
+The -c option reads the configurations from a JSON list instead, e.g.:
+
+  [{"name": "stdin_dynamorio_havoc", "driver": "stdin",
+    "driver_options": {"path": "{target}"}, "instrumentation": "dynamorio",
+    "instrumentation_options": {"coverage_modules": ["{module}"]},
+    "mutator": "havoc", "mutator_options": {}}]
+
+The strings in the options have {target} replaced with the target's path,
+{module} with its filename, {offset} with its main function's offset from its
+notes.txt, and {trial} with the trial's number, e.g. for the mutators' seed
+options.  A trial's first crash is timed from when the fuzzer is started, and
+the median is null if fewer than half of the trials found a crash.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+WINDOWS = sys.platform == 'win32'
+
+if WINDOWS:
+    DEFAULT_CONFIGS = [
+        {'name': 'stdin_dynamorio_havoc', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'dynamorio',
+         'instrumentation_options': {'coverage_modules': ['{module}']},
+         'mutator': 'havoc', 'mutator_options': {}},
+        {'name': 'stdin_dynamorio_fast_coverage_havoc', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'dynamorio',
+         'instrumentation_options': {'coverage_modules': ['{module}'],
+                                     'client_params': '-fast_coverage'},
+         'mutator': 'havoc', 'mutator_options': {}},
+        {'name': 'stdin_dynamorio_afl', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'dynamorio',
+         'instrumentation_options': {'coverage_modules': ['{module}']},
+         'mutator': 'afl', 'mutator_options': {}},
+        {'name': 'stdin_return_code_havoc', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'return_code', 'instrumentation_options': {},
+         'mutator': 'havoc', 'mutator_options': {}},
+    ]
+else:
+    DEFAULT_CONFIGS = [
+        {'name': 'stdin_return_code_havoc', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'return_code', 'instrumentation_options': {},
+         'mutator': 'havoc', 'mutator_options': {}},
+        {'name': 'stdin_return_code_afl', 'driver': 'stdin',
+         'driver_options': {'path': '{target}', 'timeout': 2},
+         'instrumentation': 'return_code', 'instrumentation_options': {},
+         'mutator': 'afl', 'mutator_options': {}},
+    ]
+
+# How often a trial's fuzzer_stats file is read for the coverage over time.
+# The fuzzer rewrites it about once a second.
+SAMPLE_INTERVAL = 1.0
+
+
+def read_stats(path):
+    """Reads a fuzzer_stats file into a dict of ints, or returns None if it
+    hasn't been written yet."""
+    try:
+        with open(path) as f:
+            lines = f.readlines()
+    except (IOError, OSError):
+        return None
+    stats = {}
+    for line in lines:
+        name, _, value = line.partition(':')
+        try:
+            stats[name.strip()] = int(value.strip())
+        except ValueError:
+            pass
+    return stats
+
+
+def substitute(value, replacements):
+    """Replaces the {name} placeholders in the strings of an option value."""
+    if isinstance(value, str):
+        for name, replacement in replacements.items():
+            value = value.replace('{' + name + '}', replacement)
+        return value
+    if isinstance(value, list):
+        return [substitute(item, replacements) for item in value]
+    if isinstance(value, dict):
+        return {key: substitute(item, replacements) for key, item in value.items()}
+    return value
+
+
+def find_targets(corpus_directory, names):
+    """Returns the (name, executable, seeds, main offset) of each target."""
+    targets = []
+    for name in names or sorted(os.listdir(corpus_directory)):
+        directory = os.path.join(corpus_directory, name)
+        executable = os.path.join(directory, name + ('.exe' if WINDOWS else ''))
+        inputs = os.path.join(directory, 'inputs')
+        if not os.path.isdir(directory):
+            if names:
+                sys.exit('There is no target named {} in {}'.format(name, corpus_directory))
+            continue
+        if not os.path.isfile(executable) or not os.path.isdir(inputs):
+            print('Skipping {}, {} or its inputs are missing'.format(name, executable))
+            continue
+        seeds = [os.path.join(inputs, seed) for seed in sorted(os.listdir(inputs))
+                 if not seed.startswith('crash')]
+        offset = ''
+        try:
+            with open(os.path.join(directory, 'notes.txt')) as f:
+                match = re.search(r'offset\s+(0x[0-9a-fA-F]+)', f.read())
+                if match:
+                    offset = match.group(1)
+        except (IOError, OSError):
+            pass
+        targets.append((name, executable, seeds, offset))
+    return targets
+
+
+def first_crash_time(crashes_directory):
+    """Returns the modification time of the oldest file in a crashes
+    directory, or None if there aren't any."""
+    times = []
+    for root, _, files in os.walk(crashes_directory):
+        times += [os.path.getmtime(os.path.join(root, f)) for f in files]
+    return min(times) if times else None
+
+
+def run_trial(fuzzer, config, target, trial, seconds, directory):
+    """Fuzzes a target for one trial, and returns its result."""
+    name, executable, seeds, offset = target
+    replacements = {'target': executable, 'module': os.path.basename(executable),
+                    'offset': offset, 'trial': str(trial)}
+    os.makedirs(os.path.join(directory, 'seeds'))
+    for seed in seeds:
+        shutil.copy(seed, os.path.join(directory, 'seeds'))
+
+    args = [fuzzer, '-L', str(seconds), '-S', os.path.join(directory, 'seeds'),
+            '-o', os.path.join(directory, 'output')]
+    for option, key in (('-d', 'driver_options'), ('-i', 'instrumentation_options'),
+                        ('-m', 'mutator_options')):
+        filename = os.path.join(directory, key + '.json')
+        with open(filename, 'w') as f:
+            json.dump(substitute(config.get(key, {}), replacements), f)
+        args += [option, filename]
+    args += [config['driver'], config['instrumentation'], config['mutator']]
+
+    stats_file = os.path.join(directory, 'output', 'fuzzer_stats')
+    coverage = []
+    with open(os.path.join(directory, 'log.txt'), 'w') as log:
+        start = time.time()
+        process = subprocess.Popen(args, stdout=log, stderr=subprocess.STDOUT,
+                                   cwd=os.path.dirname(fuzzer))
+        while process.poll() is None:
+            time.sleep(SAMPLE_INTERVAL)
+            stats = read_stats(stats_file)
+            if stats:
+                coverage.append([round(time.time() - start, 1), stats.get('paths_found', 0),
+                                 stats.get('execs_done', 0), stats.get('crashes', 0)])
+        elapsed = time.time() - start
+
+    stats = read_stats(stats_file)
+    if process.returncode != 0 or not stats:
+        with open(os.path.join(directory, 'log.txt')) as f:
+            print('  Failed to run trial {}:\n{}'.format(trial, f.read()))
+        return {'trial': trial, 'failed': True}
+
+    crash_time = first_crash_time(os.path.join(directory, 'output', 'crashes'))
+    return {
+        'trial': trial,
+        'seconds': round(elapsed, 3),
+        'execs': stats.get('execs_done', 0),
+        'execs_per_sec': int(stats.get('execs_done', 0) / elapsed) if elapsed else 0,
+        'paths_found': stats.get('paths_found', 0),
+        'crashes': stats.get('crashes', 0),
+        'hangs': stats.get('hangs', 0),
+        'time_to_first_crash': round(max(crash_time - start, 0), 3) if crash_time else None,
+        # [seconds since the start, paths_found, execs_done, crashes] about once a second
+        'coverage': coverage,
+    }
+
+
+def median_coverage(trials, seconds):
+    """Returns the median paths_found of the trials at each second."""
+    result = []
+    for second in range(1, int(seconds) + 1):
+        values = []
+        for trial in trials:
+            earlier = [sample[1] for sample in trial['coverage'] if sample[0] <= second]
+            values.append(earlier[-1] if earlier else 0)
+        result.append([second, statistics.median(values)])
+    return result
+
+
+def summarize(trials, seconds):
+    """Returns the medians of a target and configuration's trials."""
+    completed = [trial for trial in trials if not trial.get('failed')]
+    if not completed:
+        return {'failed': True}
+    # The trials that didn't crash count as taking forever, so the median is
+    # only a time if at least half of them crashed
+    crash_times = sorted(trial['time_to_first_crash'] for trial in completed
+                         if trial['time_to_first_crash'] is not None)
+    crash_times += [float('inf')] * (len(completed) - len(crash_times))
+    time_to_first_crash = statistics.median(crash_times)
+    return {
+        'completed_trials': len(completed),
+        'crashing_trials': sum(1 for trial in completed if trial['time_to_first_crash'] is not None),
+        'median_time_to_first_crash': None if time_to_first_crash == float('inf') else time_to_first_crash,
+        'median_execs_per_sec': statistics.median(trial['execs_per_sec'] for trial in completed),
+        'median_paths_found': statistics.median(trial['paths_found'] for trial in completed),
+        'median_coverage': median_coverage(completed, seconds),
+    }
+
+
+def main():
+    source_directory = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description='Benchmarks the fuzzer on the CGC challenge programs')
+    parser.add_argument('build_directory')
+    parser.add_argument('targets', nargs='*', help='the targets to fuzz, all of them by default')
+    parser.add_argument('-t', '--trials', type=int, default=5, help='the number of trials of each run')
+    parser.add_argument('-s', '--seconds', type=int, default=60, help='the number of seconds to run each trial for')
+    parser.add_argument('-c', '--configs', help='a JSON file with the driver, instrumentation and mutator configurations')
+    parser.add_argument('-d', '--corpus', default=os.path.join(source_directory, 'corpus', 'cgc'),
+                        help='the directory with the targets')
+    parser.add_argument('-o', '--output', help='the file to write the results to, cgc_bench.json in the build directory by default')
+    args = parser.parse_args()
+
+    fuzzer = os.path.join(os.path.abspath(args.build_directory), 'killerbeez', 'fuzzer' + ('.exe' if WINDOWS else ''))
+    if not os.path.isfile(fuzzer):
+        sys.exit("The fuzzer hasn't been built in {}".format(args.build_directory))
+    configs = DEFAULT_CONFIGS
+    if args.configs:
+        with open(args.configs) as f:
+            configs = json.load(f)
+    targets = find_targets(args.corpus, args.targets)
+    output_file = os.path.abspath(args.output or os.path.join(args.build_directory, 'cgc_bench.json'))
+
+    results = []
+    work_directory = tempfile.mkdtemp()
+    try:
+        for target in targets:
+            for config in configs:
+                print('Running {} on {} for {} trials of {} seconds'.format(
+                    config['name'], target[0], args.trials, args.seconds))
+                trials = []
+                for trial in range(args.trials):
+                    directory = os.path.join(work_directory, target[0], config['name'], str(trial))
+                    trials.append(run_trial(fuzzer, config, target, trial, args.seconds, directory))
+                result = {'target': target[0], 'config': config}
+                result.update(summarize(trials, args.seconds))
+                result['trials'] = trials
+                if not result.get('failed'):
+                    print('  {} of {} trials crashed, median time to first crash {}, {} executions per second'.format(
+                        result['crashing_trials'], result['completed_trials'],
+                        result['median_time_to_first_crash'], result['median_execs_per_sec']))
+                results.append(result)
+    finally:
+        shutil.rmtree(work_directory, ignore_errors=True)
+
+    try:
+        commit = subprocess.check_output(['git', '-C', source_directory, 'describe', '--always', '--dirty'],
+                                         stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        commit = ''
+    with open(output_file, 'w') as f:
+        json.dump({
+            'commit': commit,
+            'date': datetime.datetime.utcnow().strftime('%Y-%m-%dT%H:%M:%SZ'),
+            'trials': args.trials,
+            'seconds_per_trial': args.seconds,
+            'results': results,
+        }, f, indent=2)
+    print('Wrote the benchmark results to {}'.format(output_file))
+
+
+if __name__ == '__main__':
+    main()
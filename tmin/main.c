@@ -0,0 +1,407 @@
+//This program minimizes a single test case, like afl-tmin.  It repeatedly deletes blocks of the input, and
+//keeps each deletion that still crashes the target, or, for inputs that don't crash, that still takes the
+//same path through the target.  The deletions are tested speculatively in parallel: each worker, with its
+//own driver and instrumentation state, tries deleting a different block of the current input, and the
+//first block that could be deleted is kept.
+
+#include <driver.h>
+#include <driver_factory.h>
+#include <instrumentation.h>
+#include <instrumentation_factory.h>
+#include <bitmap.h>
+#include <utils.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The first pass deletes blocks of this fraction of the input, and each pass after that halves the block size
+#define TMIN_INITIAL_BLOCK_DIVISOR 16
+//The most times the passes are repeated, while they keep making the input smaller
+#define TMIN_MAX_ROUNDS 8
+
+void usage(char * program_name)
+{
+	char * help_text;
+	printf(
+		"Usage: %s driver_name instrumentation_name input_file output_file [options]\n"
+		"\n"
+		"Required:\n"
+		"\t driver_name                   The driver framework used to run the target program\n"
+		"\t instrumentation_name          The instrumenation framework to use to determine the path a program took\n"
+		"\t input_file                    The input to minimize, such as a file from the crashes or new_paths directory\n"
+		"\t output_file                   Write the minimized input to this file\n"
+		"Options:\n"
+		"\t -d driver_options             Set the options for the driver\n"
+		"\t -i instrumentation_options    Set the options for the instrumentation\n"
+		"\t -l logging_options            Set the options for logging\n"
+		"\t -w num_workers                The number of deletions to test in parallel, each with its own\n"
+		"\t                                driver and instrumentation state [default 1]\n"
+		"\n"
+		"Inputs that crash the target are minimized to the smallest input that still crashes it.  Other\n"
+		"inputs are minimized to the smallest input that takes the same path, which requires an\n"
+		"instrumentation with a coverage bitmap or path hashes.\n"
+		"\n",
+		program_name
+	);
+
+#define PRINT_HELP(x, y) \
+	x = y;               \
+	if(x) {              \
+		puts(x);         \
+		free(x);         \
+	}
+
+	PRINT_HELP(help_text, logging_help());
+	PRINT_HELP(help_text, driver_help());
+	PRINT_HELP(help_text, instrumentation_help());
+	exit(1);
+}
+
+//A worker that tests one candidate input at a time, with its own driver and instrumentation state
+struct tmin_worker
+{
+	driver_t * driver;
+	void * instrumentation_state;
+	uint8_t * classified;  //The bucketed copy of the last run's bitmap
+	size_t classified_size;
+	thread_t thread;
+	semaphore_t start;     //Released when the worker has a candidate to test, or should stop
+	int stop;
+	char * candidate;      //The input with one block deleted
+	size_t candidate_length;
+	int kept;              //Whether the candidate still crashes or takes the same path
+};
+typedef struct tmin_worker tmin_worker_t;
+
+static instrumentation_t * instrumentation = NULL;
+static semaphore_t workers_done;
+static int crash_mode = 0;       //Whether the candidates must crash, rather than take the same path
+static uint64_t target_path = 0; //The path that the candidates must take, when they don't need to crash
+static uint64_t execs = 0;
+
+/**
+ * This function gets a hash of the path that the last run took.  For instrumentations with a coverage
+ * bitmap, it's a hash of the bucketed bitmap, so that small changes in the hit counts don't count as a
+ * different path.  Otherwise, it's the instrumentation's path hash.
+ * @param worker - the worker that ran the input
+ * @param hash - a pointer used to return the path's hash
+ * @return - zero on success, or non-zero if the instrumentation doesn't have a path for the run
+ */
+static int get_path(tmin_worker_t * worker, uint64_t * hash)
+{
+	const uint8_t * trace_bits;
+	size_t size;
+
+	if (instrumentation->get_trace_bits && !instrumentation->get_trace_bits(worker->instrumentation_state, &trace_bits, &size)
+		&& size && !(size % 64))
+	{
+		if (size > worker->classified_size)
+		{
+			free(worker->classified);
+			worker->classified = (uint8_t *)malloc(size);
+			if (!worker->classified)
+				FATAL_MSG("Couldn't allocate the coverage bitmap");
+			worker->classified_size = size;
+		}
+		memcpy(worker->classified, trace_bits, size);
+		bitmap_classify_counts(worker->classified, size);
+		*hash = bitmap_hash(worker->classified, size);
+		return 0;
+	}
+	if (instrumentation->get_path_hash)
+		return instrumentation->get_path_hash(worker->instrumentation_state, hash);
+	return 1;
+}
+
+/**
+ * This function runs an input, and gets whether it crashed and the path it took.
+ * @param worker - the worker to run the input with
+ * @param input - the input to run
+ * @param length - the length of the input
+ * @param has_path - a pointer used to return whether the instrumentation returned a path for the run
+ * @param path - a pointer used to return the path's hash
+ * @return - the fuzz result of the run (FUZZ_NONE, FUZZ_CRASH, FUZZ_HANG, or FUZZ_ERROR)
+ */
+static int run_input(tmin_worker_t * worker, char * input, size_t length, int * has_path, uint64_t * path)
+{
+	int result;
+
+	result = worker->driver->test_input(worker->driver->state, input, length);
+	*has_path = result == FUZZ_NONE && !get_path(worker, path);
+	return result;
+}
+
+/**
+ * This function tests a worker's candidate, and records whether the deletion can be kept.
+ * @param worker - the worker with the candidate to test
+ */
+static void test_candidate(tmin_worker_t * worker)
+{
+	uint64_t path;
+	int result, has_path;
+
+	result = run_input(worker, worker->candidate, worker->candidate_length, &has_path, &path);
+	if (result == FUZZ_ERROR)
+		FATAL_MSG("Failed to run a candidate input");
+	if (crash_mode)
+		worker->kept = result == FUZZ_CRASH;
+	else
+		worker->kept = has_path && path == target_path;
+}
+
+/**
+ * This function is a worker thread, which tests each candidate it's given until it's told to stop.
+ * @param arg - a pointer to the tmin_worker_t to run
+ */
+static THREAD_FUNC(tmin_worker_thread)
+{
+	tmin_worker_t * worker = (tmin_worker_t *)arg;
+
+	while (!take_semaphore(worker->start) && !worker->stop)
+	{
+		test_candidate(worker);
+		release_semaphore(workers_done);
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * This function runs one pass of block deletions over the input.  Each round of the pass gives each worker
+ * the deletion of one of the next blocks, and keeps the first deletion that still crashes or takes the same
+ * path.  The later deletions of the round were tested with the kept block still in the input, so they're
+ * thrown away and the next round starts from the kept block, which now holds the data after it.
+ * @param workers - the workers to test the deletions with
+ * @param num_workers - the number of workers
+ * @param input - the input to minimize, which is updated with the kept deletions
+ * @param length - a pointer to the length of the input, which is updated with the kept deletions
+ * @param block_length - the length of the blocks to delete
+ * @return - the number of bytes that were deleted
+ */
+static size_t deletion_pass(tmin_worker_t * workers, int num_workers, char * input, size_t * length, size_t block_length)
+{
+	size_t position = 0, start, end, deleted = 0;
+	int i, started, kept;
+
+	while (position < *length)
+	{
+		//Give each worker the deletion of the next block, without ever deleting the whole input
+		for (started = 0; started < num_workers; started++)
+		{
+			start = position + started * block_length;
+			if (start >= *length)
+				break;
+			end = block_length < *length - start ? start + block_length : *length;
+			if (end - start >= *length)
+				break;
+			memcpy(workers[started].candidate, input, start);
+			memcpy(workers[started].candidate + start, input + end, *length - end);
+			workers[started].candidate_length = *length - (end - start);
+		}
+		if (!started)
+			break;
+
+		if (num_workers == 1)
+			test_candidate(&workers[0]);
+		else
+		{
+			for (i = 0; i < started; i++)
+				release_semaphore(workers[i].start);
+			for (i = 0; i < started; i++)
+				take_semaphore(workers_done);
+		}
+		execs += started;
+
+		kept = -1;
+		for (i = 0; i < started && kept < 0; i++)
+		{
+			if (workers[i].kept)
+				kept = i;
+		}
+		if (kept < 0)
+		{
+			position += started * block_length;
+			continue;
+		}
+		deleted += *length - workers[kept].candidate_length;
+		*length = workers[kept].candidate_length;
+		memcpy(input, workers[kept].candidate, *length);
+		position += kept * block_length;
+	}
+	return deleted;
+}
+
+int main(int argc, char ** argv)
+{
+	tmin_worker_t * workers;
+	char *driver_name, *driver_options = NULL, *logging_options = NULL,
+		*instrumentation_name = NULL, *instrumentation_options = NULL,
+		*input_file, *output_file, *input = NULL;
+	int num_workers = 1, result, has_path, round, i;
+	size_t original_length, length, block_length, deleted;
+	uint64_t path;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (argc < 5)
+	{
+		usage(argv[0]);
+	}
+
+	driver_name = argv[1];
+	instrumentation_name = argv[2];
+	input_file = argv[3];
+	output_file = argv[4];
+	for (i = 5; i < argc; i++)
+	{
+		IF_ARG_OPTION("-d", driver_options)
+		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-w", num_workers)
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have at least one worker.", num_workers);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	original_length = read_file(input_file, &input);
+	if ((int)original_length <= 0)
+		FATAL_MSG("Could not read the input file %s, or it's empty", input_file);
+	length = original_length;
+
+	instrumentation = instrumentation_factory(instrumentation_name);
+	if (!instrumentation)
+		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
+
+	workers = (tmin_worker_t *)calloc(num_workers, sizeof(tmin_worker_t));
+	workers_done = create_semaphore(0, num_workers);
+	if (!workers || !workers_done)
+		FATAL_MSG("Couldn't allocate the state for %d workers", num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].candidate = (char *)malloc(length);
+		if (!workers[i].candidate)
+			FATAL_MSG("Couldn't allocate the candidate inputs");
+		workers[i].instrumentation_state = instrumentation->create(instrumentation_options, NULL);
+		if (!workers[i].instrumentation_state)
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		workers[i].driver = driver_worker_factory(driver_name, driver_options, i, instrumentation,
+			workers[i].instrumentation_state, NULL, NULL);
+		if (!workers[i].driver)
+			FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options ? driver_options : "none");
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Find what to preserve /////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	result = run_input(&workers[0], input, length, &has_path, &target_path);
+	execs++;
+	if (result == FUZZ_ERROR)
+		FATAL_MSG("Failed to run the input %s", input_file);
+	else if (result == FUZZ_HANG)
+		FATAL_MSG("The input %s hangs the target, so it can't be minimized", input_file);
+	else if (result == FUZZ_CRASH)
+	{
+		crash_mode = 1;
+		INFO_MSG("The input crashes the target, minimizing it to an input that still crashes");
+	}
+	else
+	{
+		if (!has_path)
+			FATAL_MSG("The input %s doesn't crash the target, and instrumentation '%s' can't tell which path it took",
+				input_file, instrumentation_name);
+
+		//A deletion can only be judged by the path it takes if the input takes the same path every time
+		result = run_input(&workers[num_workers - 1], input, length, &has_path, &path);
+		execs++;
+		if (result != FUZZ_NONE || !has_path || path != target_path)
+			FATAL_MSG("The input %s doesn't take the same path every time it's run, so it can't be minimized", input_file);
+		INFO_MSG("The input doesn't crash the target, minimizing it to an input that takes the same path");
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Minimize the input ////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (num_workers > 1)
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			workers[i].start = create_semaphore(0, 1);
+			if (!workers[i].start || create_thread(&workers[i].thread, tmin_worker_thread, &workers[i]))
+				FATAL_MSG("Failed to start worker %d", i);
+		}
+	}
+
+	//Delete blocks from a fraction of the input down to single bytes, and start over while that keeps
+	//deleting bytes, since the later deletions can make the earlier ones possible
+	for (round = 0; round < TMIN_MAX_ROUNDS && length > 1; round++)
+	{
+		deleted = 0;
+		block_length = 1;
+		while (block_length * TMIN_INITIAL_BLOCK_DIVISOR < length)
+			block_length *= 2;
+		for (; block_length; block_length /= 2)
+		{
+			deleted += deletion_pass(workers, num_workers, input, &length, block_length);
+			DEBUG_MSG("Deleted blocks of %lu bytes, the input is %lu bytes", (unsigned long)block_length,
+				(unsigned long)length);
+		}
+		if (!deleted)
+			break;
+	}
+
+	if (write_buffer_to_file(output_file, input, length))
+		FATAL_MSG("Couldn't write the minimized input to %s", output_file);
+	CRITICAL_MSG("Minimized %s from %lu to %lu bytes in %llu execs", input_file, (unsigned long)original_length,
+		(unsigned long)length, (unsigned long long)execs);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (num_workers > 1)
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			workers[i].stop = 1;
+			release_semaphore(workers[i].start);
+			join_thread(workers[i].thread);
+			destroy_semaphore(workers[i].start);
+		}
+	}
+
+	//Cleanup the objects and exit
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].driver->cleanup(workers[i].driver->state);
+		instrumentation->cleanup(workers[i].instrumentation_state);
+		free(workers[i].classified);
+		free(workers[i].candidate);
+		free(workers[i].driver);
+	}
+	free(workers);
+	destroy_semaphore(workers_done);
+	free(instrumentation);
+	free(input);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Write the basic block list that the breakpoint instrumentation reads.
+
+The blocks are found statically, by disassembling the executable's .text
+section with objdump: the start of every function, every direct jump or call
+target, and every instruction that follows a conditional jump.  Each address is
+written as hex on its own line, as objdump shows it.  The list only has to be
+generated once per build of the target, and can then be reused by every
+fuzzing job.
+
+Usage: find_basic_blocks.py <executable> <blocks_file>
+"""
+
+import re
+import subprocess
+import sys
+
+FUNCTION_RE = re.compile(r'^([0-9a-f]+) <[^>]+>:$')
+INSTRUCTION_RE = re.compile(r'^\s*([0-9a-f]+):\s+(\S+)\s*(.*)$')
+TARGET_RE = re.compile(r'^([0-9a-f]+)(?:\s+<[^>]+>)?$')
+UNCONDITIONAL = ('jmp', 'jmpq', 'call', 'callq', 'ret', 'retq', 'hlt', 'ud2')
+PREFIXES = ('bnd', 'notrack', 'rep', 'repz')
+
+
+def find_blocks(executable):
+    """Returns the sorted addresses of the basic blocks in an executable."""
+    output = subprocess.check_output(
+        ['objdump', '-d', '--no-show-raw-insn', '-j', '.text', executable],
+        universal_newlines=True)
+
+    instructions = []
+    blocks = set()
+    for line in output.splitlines():
+        match = FUNCTION_RE.match(line)
+        if match:
+            blocks.add(int(match.group(1), 16))
+            continue
+        match = INSTRUCTION_RE.match(line)
+        if match:
+            mnemonic, operands = match.group(2), match.group(3).strip()
+            while mnemonic in PREFIXES and operands:
+                mnemonic, _, operands = operands.partition(' ')
+                operands = operands.strip()
+            instructions.append((int(match.group(1), 16), mnemonic, operands))
+
+    addresses = set(address for address, _, _ in instructions)
+    for i, (address, mnemonic, operands) in enumerate(instructions):
+        if mnemonic.startswith('j') or mnemonic.startswith('call'):
+            target = TARGET_RE.match(operands)
+            if target:
+                blocks.add(int(target.group(1), 16))
+            if mnemonic not in UNCONDITIONAL and i + 1 < len(instructions):
+                blocks.add(instructions[i + 1][0])
+
+    # A breakpoint that isn't at the start of an instruction would corrupt it
+    return sorted(blocks & addresses)
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip().splitlines()[-1])
+        return 1
+    blocks = find_blocks(sys.argv[1])
+    with open(sys.argv[2], 'w') as blocks_file:
+        blocks_file.write('# Basic blocks of %s\n' % sys.argv[1])
+        for address in blocks:
+            blocks_file.write('%x\n' % address)
+    print('Found %d basic blocks' % len(blocks))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,5 +1,7 @@
+#include <corpus_pack.h>
 #include <driver.h>
 #include <driver_factory.h>
+#include <edge_pack.h>
 #include <instrumentation.h>
 #include <instrumentation_factory.h>
 #include <jansson_helper.h>
@@ -9,6 +11,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+//In batch mode, the edges of all the inputs are written as a single stream.  The binary stream is in
+//PostgreSQL's binary COPY format and the text stream is CSV with a header, so either can be loaded
+//straight into a table with COPY, rather than inserted a row at a time.  Each row is (input id, from,
+//to, count), where the input id is the input's line number in the output_file.inputs file, counting
+//from zero, and the count is the number of runs that had the edge.  The binary stream's columns are
+//int4, int8, int8, int4.
+#define PGCOPY_SIGNATURE "PGCOPY\n\377\r\n"
+#define INPUTS_FILE_SUFFIX ".inputs"
+
 void usage(char * program_name)
 {
 	char * help_text;
@@ -18,17 +29,31 @@ void usage(char * program_name)
 		"Required:\n"
 		"\t driver_name                   The driver framework used to run the target program\n"
 		"\t instrumentation_name          The instrumenation framework to use to determine the path a program took\n"
-		"\t input_file                    The input to the target program\n"
+		"\t input_file                    The input to the target program, or a directory or packed corpus (see corpus_pack.h) of\n"
+		"\t                                 inputs to trace in batch mode\n"
 		"\t output_file                   Write the edges to the given file.  The given path will be used as a prefix when recording multiple modules\n"
 		"Options:\n"
 		"\t -b                            When writing the edges to a file, write them in binary (rather than human readable text)\n"
+		"\t -c                            Write the edges of every module and input to output_file in the compact format (see edge_pack.h)\n"
 		"\t -d driver_options             Set the options for the driver\n"
+		"\t -f                            The input_file is a list of inputs to trace in batch mode, one per line\n"
 		"\t -i instrumentation_options    Set the options for the instrumentation\n"
 		"\t -l logging_options            Set the options for logging\n"
-		"\t -n num_iterations             The number of iterations to run [5 per file].  Edges which are only in one run will be excluded\n"
+		"\t -m min_runs                   Only record the edges which are in at least this many runs [all of them]\n"
+		"\t -n num_iterations             The number of iterations to run [5 per file].  Edges which are in fewer than min_runs runs will be excluded\n"
 		"\t -p                            Record the edges for each module independently\n"
+		"\n"
+		"In batch mode, one target process is used to trace all of the inputs, and the edges of every input\n"
+		"are written to the output file as rows of (input id, from, to, count), where the count is the number\n"
+		"of runs with the edge.  The rows are CSV, or PostgreSQL's binary COPY format with -b, so they can be\n"
+		"loaded with COPY.  The input ids are the line numbers (from zero) of output_file%s, which lists the inputs.\n"
+		"The entries of a packed corpus are listed as the pack's filename and the entry's name, e.g. corpus.pack:seed1.\n"
+		"\n"
+		"With -c, all of the edges go in output_file as lists of module relative (module, from, to, count) edges,\n"
+		"one list per input, delta encoded and packed in varints.  With -p, the module ids index the module names\n"
+		"stored in the file.  The input ids are the same as in batch mode.\n"
 		"\n",
-		program_name
+		program_name, INPUTS_FILE_SUFFIX
 	);
 
 #define PRINT_HELP(x, y) \
@@ -48,60 +73,282 @@ struct edge_counts
 {
 	instrumentation_edge_t edge;
 	int count;
+	int last_run; //The last run this edge was counted in, so each run only counts it once
 };
 
-void record_edges(instrumentation_edges_t * edges, struct edge_counts ** all_runs, int * all_runs_num_edges)
+//An open addressing hash table of the edges seen so far, keyed on (from, to).  The
+//entries are kept in insertion order in a single growing array, and the slots hold
+//indices into it (plus one, so zero can mark an empty slot).
+struct edge_table
+{
+	struct edge_counts * entries;
+	size_t num_entries;
+	size_t max_entries;
+	uint32_t * slots;
+	size_t num_slots; //Always a power of two
+};
+
+static size_t hash_edge(const instrumentation_edge_t * edge)
+{
+	uint64_t hash = ((uint64_t)edge->from * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)edge->to;
+	hash ^= hash >> 32;
+	hash *= 0xD6E8FEB86659FD93ULL;
+	hash ^= hash >> 32;
+	return (size_t)hash;
+}
+
+/**
+ * This function doubles the number of slots in an edge table, and rehashes the entries into them
+ * @param table - the table to grow
+ * @return - 0 on success, non-zero on failure
+ */
+static int grow_edge_table(struct edge_table * table)
+{
+	size_t num_slots = table->num_slots ? table->num_slots * 2 : 1024, i, slot;
+	uint32_t * slots;
+
+	slots = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+	if (!slots)
+		return 1;
+	for (i = 0; i < table->num_entries; i++)
+	{
+		slot = hash_edge(&table->entries[i].edge) & (num_slots - 1);
+		while (slots[slot])
+			slot = (slot + 1) & (num_slots - 1);
+		slots[slot] = (uint32_t)(i + 1);
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->num_slots = num_slots;
+	return 0;
+}
+
+/**
+ * This function finds an edge in an edge table, adding it if it isn't already there
+ * @param table - the table to look the edge up in
+ * @param edge - the edge to look up
+ * @return - the table's entry for the edge, or NULL on failure
+ */
+static struct edge_counts * find_or_add_edge(struct edge_table * table, const instrumentation_edge_t * edge)
 {
-	int this_run_num_edges;
-	instrumentation_edge_t *this_run;
-	int i, j, found;
+	struct edge_counts * entry;
+	size_t slot;
 
-	this_run = NULL;
-	this_run_num_edges = 0;
+	//Keep the load factor under 1/2
+	if ((table->num_entries + 1) * 2 > table->num_slots && grow_edge_table(table))
+		return NULL;
+
+	slot = hash_edge(edge) & (table->num_slots - 1);
+	while (table->slots[slot])
+	{
+		entry = &table->entries[table->slots[slot] - 1];
+		if (entry->edge.from == edge->from && entry->edge.to == edge->to)
+			return entry;
+		slot = (slot + 1) & (table->num_slots - 1);
+	}
+
+	if (table->num_entries == table->max_entries)
+	{
+		table->max_entries = table->max_entries ? table->max_entries * 2 : 1024;
+		entry = (struct edge_counts *)realloc(table->entries, table->max_entries * sizeof(struct edge_counts));
+		if (!entry)
+			return NULL;
+		table->entries = entry;
+	}
+	entry = &table->entries[table->num_entries++];
+	entry->edge.from = edge->from;
+	entry->edge.to = edge->to;
+	entry->count = 0;
+	entry->last_run = -1;
+	table->slots[slot] = (uint32_t)table->num_entries;
+	return entry;
+}
+
+void record_edges(instrumentation_edges_t * edges, struct edge_table * all_runs, int run)
+{
+	struct edge_counts * entry;
+	size_t i;
 
 	for (i = 0; i < edges->num_edges; i++)
 	{
-		//First check for the edge in this run
-		found = 0;
-		for (j = 0; j < this_run_num_edges; j++)
-		{
-			if (this_run[j].to == edges->edges[i].to && this_run[j].from == edges->edges[i].from)
-			{
-				found = 1;
-				break;
-			}
-		}
-		if (found) //If we've already recorded this one, just skip it
+		entry = find_or_add_edge(all_runs, &edges->edges[i]);
+		if (!entry)
+			FATAL_MSG("Couldn't allocate memory to record the program edges");
+		if (entry->last_run == run) //If we've already recorded this one in this run, just skip it
 			continue;
+		entry->last_run = run;
+		entry->count++;
+	}
+}
 
-		//If we haven't recorded this edge for this run before, add it to the this_run list
-		this_run_num_edges++;
-		this_run = (instrumentation_edge_t *)realloc(this_run, this_run_num_edges * sizeof(instrumentation_edge_t));
-		this_run[this_run_num_edges - 1].to = edges->edges[i].to;
-		this_run[this_run_num_edges - 1].from = edges->edges[i].from;
+/**
+ * This function empties an edge table, so it can be reused for the next input without freeing it
+ * @param table - the table to empty
+ */
+static void clear_edge_table(struct edge_table * table)
+{
+	if (table->slots)
+		memset(table->slots, 0, table->num_slots * sizeof(uint32_t));
+	table->num_entries = 0;
+}
 
-		//Now check to see if it's been recorded already in other runs
-		for (j = 0; j < *all_runs_num_edges; j++)
-		{
-			if ((*all_runs)[j].edge.to == edges->edges[i].to && (*all_runs)[j].edge.from == edges->edges[i].from)
-			{
-				(*all_runs)[j].count++;
-				found = 1;
-				break;
-			}
-		}
+static void write_be16(uint8_t * buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t)(value >> 8);
+	buffer[1] = (uint8_t)value;
+}
+
+static void write_be32(uint8_t * buffer, uint32_t value)
+{
+	write_be16(buffer, (uint16_t)(value >> 16));
+	write_be16(buffer + 2, (uint16_t)value);
+}
+
+static void write_be64(uint8_t * buffer, uint64_t value)
+{
+	write_be32(buffer, (uint32_t)(value >> 32));
+	write_be32(buffer + 4, (uint32_t)value);
+}
+
+/**
+ * This function writes the header of a batch mode edge stream
+ * @param fp - the file to write the header to
+ * @param binary_mode - whether the stream is binary, rather than CSV
+ */
+static void write_batch_header(FILE * fp, int binary_mode)
+{
+	uint8_t header[sizeof(PGCOPY_SIGNATURE) + 8];
+
+	if (!binary_mode)
+	{
+		fprintf(fp, "input_id,from_edge,to_edge,count\n");
+		return;
+	}
+	memcpy(header, PGCOPY_SIGNATURE, sizeof(PGCOPY_SIGNATURE)); //Including the NULL terminator
+	write_be32(header + sizeof(PGCOPY_SIGNATURE), 0);           //Flags
+	write_be32(header + sizeof(PGCOPY_SIGNATURE) + 4, 0);       //Header extension length
+	fwrite(header, sizeof(header), 1, fp);
+}
+
+/**
+ * This function writes one edge of an input to a batch mode edge stream
+ * @param fp - the file to write the edge to
+ * @param binary_mode - whether the stream is binary, rather than CSV
+ * @param input_id - the id of the input that had the edge
+ * @param entry - the edge, and the number of runs that had it
+ */
+static void write_batch_edge(FILE * fp, int binary_mode, uint32_t input_id, struct edge_counts * entry)
+{
+	uint8_t row[2 + 4 * 4 + 2 * 4 + 2 * 8]; //The field count, the four field lengths, and the fields
+	uint8_t * pos = row;
+
+	if (!binary_mode)
+	{
+		fprintf(fp, "%u,%llu,%llu,%d\n", input_id, (unsigned long long)entry->edge.from,
+			(unsigned long long)entry->edge.to, entry->count);
+		return;
+	}
+	write_be16(pos, 4); pos += 2; //The number of fields
+	write_be32(pos, 4); pos += 4;
+	write_be32(pos, input_id); pos += 4;
+	write_be32(pos, 8); pos += 4;
+	write_be64(pos, (uint64_t)entry->edge.from); pos += 8;
+	write_be32(pos, 8); pos += 4;
+	write_be64(pos, (uint64_t)entry->edge.to); pos += 8;
+	write_be32(pos, 4); pos += 4;
+	write_be32(pos, (uint32_t)entry->count);
+	fwrite(row, sizeof(row), 1, fp);
+}
+
+/**
+ * This function writes the trailer of a batch mode edge stream
+ * @param fp - the file to write the trailer to
+ * @param binary_mode - whether the stream is binary, rather than CSV
+ */
+static void write_batch_trailer(FILE * fp, int binary_mode)
+{
+	uint8_t trailer[2];
+
+	if (!binary_mode)
+		return;
+	write_be16(trailer, 0xffff);
+	fwrite(trailer, sizeof(trailer), 1, fp);
+}
+
+/**
+ * This function writes the edges of an input that were in enough runs, in every module, to a compact edge file
+ * @param writer - the compact edge file to write the edges to
+ * @param input_id - the id of the input that had the edges
+ * @param all_runs - the edge table of each module
+ * @param num_modules - the number of modules in the all_runs parameter
+ * @param min_runs - the number of runs an edge has to be in to be written
+ * @param packed - a buffer for the edges, which is grown as needed.  The caller should free it.
+ * @param max_packed - the number of edges that the packed buffer can hold
+ */
+static void write_packed_edges(edge_pack_writer_t * writer, uint32_t input_id, struct edge_table * all_runs,
+	int num_modules, int min_runs, packed_edge_t ** packed, size_t * max_packed)
+{
+	packed_edge_t * new_packed;
+	size_t num_packed = 0, total = 0, j;
+	int i;
+
+	for (i = 0; i < num_modules; i++)
+		total += all_runs[i].num_entries;
+	if (total > *max_packed)
+	{
+		new_packed = (packed_edge_t *)realloc(*packed, total * sizeof(packed_edge_t));
+		if (!new_packed)
+			FATAL_MSG("Couldn't allocate memory to write the program edges");
+		*packed = new_packed;
+		*max_packed = total;
+	}
 
-		//If we haven't found this edge before, add it to the all_runs list
-		if (!found)
+	for (i = 0; i < num_modules; i++)
+	{
+		for (j = 0; j < all_runs[i].num_entries; j++)
 		{
-			*all_runs_num_edges = *all_runs_num_edges + 1;
-			*all_runs = (struct edge_counts *)realloc(*all_runs, *all_runs_num_edges * sizeof(struct edge_counts));
-			(*all_runs)[*all_runs_num_edges - 1].edge.to = edges->edges[i].to;
-			(*all_runs)[*all_runs_num_edges - 1].edge.from = edges->edges[i].from;
-			(*all_runs)[*all_runs_num_edges - 1].count = 1;
+			if (all_runs[i].entries[j].count < min_runs)
+				continue;
+			(*packed)[num_packed].module = (uint32_t)i;
+			(*packed)[num_packed].from = (uint64_t)all_runs[i].entries[j].edge.from;
+			(*packed)[num_packed].to = (uint64_t)all_runs[i].entries[j].edge.to;
+			(*packed)[num_packed].count = (uint32_t)all_runs[i].entries[j].count;
+			num_packed++;
 		}
 	}
-	free(this_run);
+	if (edge_pack_write_list(writer, input_id, *packed, num_packed))
+		FATAL_MSG("Couldn't write the edges to the compact edge file");
+}
+
+/**
+ * This function reads a list of input files, one per line.  Blank lines are skipped.
+ * @param list_filename - the file containing the list
+ * @param count - A pointer to a size_t that will be assigned the number of input files
+ * @return - an array of the input files, or NULL on failure.  The caller should free each path and the array.
+ */
+static char ** read_input_list(char * list_filename, size_t * count)
+{
+	char * buffer = NULL, * line, * end, ** filenames;
+	size_t num_files = 0;
+	int length;
+
+	length = read_file(list_filename, &buffer);
+	if (length <= 0)
+		return NULL;
+	filenames = (char **)calloc(length, sizeof(char *)); //Can't be more files than bytes
+	for (line = buffer; filenames && line < buffer + length; line = end + 1)
+	{
+		for (end = line; end < buffer + length && *end != '\n'; end++)
+			;
+		*end = 0; //read_file NULL terminates the buffer, so this is safe on the last line
+		if (end > line && end[-1] == '\r')
+			end[-1] = 0;
+		if (*line)
+			filenames[num_files++] = strdup(line);
+	}
+	free(buffer);
+	*count = num_files;
+	return filenames;
 }
 
 #define MAX_MODULES 512
@@ -115,16 +362,21 @@ int main(int argc, char ** argv)
 		*instrumentation_name = NULL, *instrumentation_options = NULL,
 		*logging_options = NULL;
 	void * instrumentation_state = NULL;
-	int seed_length, iteration;
+	int iteration;
+	size_t seed_length;
 	instrumentation_edges_t * edges;
-	instrumentation_edge_t *deterministic_edges;
-	struct edge_counts * all_runs[MAX_MODULES];
-	int all_runs_num_edges[MAX_MODULES];
-	int i, j, deterministic_edges_num_edges, num_modules = 0;
+	struct edge_table all_runs[MAX_MODULES];
+	size_t j, input, num_inputs = 1;
+	int i, num_modules = 0;
 	char * module_name = NULL;
 	char * module_names[MAX_MODULES];
+	char ** input_filenames = NULL;
+	corpus_pack_t * input_pack = NULL;
 	char filename_buffer[MAX_PATH];
-	FILE * fp;
+	FILE * fp, * batch_files[MAX_MODULES];
+	edge_pack_writer_t * pack_writer = NULL;
+	packed_edge_t * packed = NULL;
+	size_t max_packed = 0;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
@@ -132,8 +384,13 @@ int main(int argc, char ** argv)
 
 	//Default options
 	int num_iterations = 5;
+	int min_runs = 0;
 	int binary_mode = 0;
 	int per_module_edges = 0;
+	int input_list = 0;
+	int batch_mode = 0;
+	int compact_mode = 0;
+	int ret = 0;
 
 	if (argc < 5)
 	{
@@ -147,9 +404,12 @@ int main(int argc, char ** argv)
 	for (int i = 5; i < argc; i++)
 	{
 		IF_ARG_SET_TRUE("-b", binary_mode)
+		ELSE_IF_ARG_SET_TRUE("-c", compact_mode)
 		ELSE_IF_ARG_OPTION("-d", driver_options)
+		ELSE_IF_ARG_SET_TRUE("-f", input_list)
 		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
 		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-m", min_runs)
 		ELSE_IF_ARGINT_OPTION("-n", num_iterations)
 		ELSE_IF_ARG_SET_TRUE("-p", per_module_edges)
 		else
@@ -168,6 +428,44 @@ int main(int argc, char ** argv)
 
 	if (num_iterations < 1)
 		FATAL_MSG("Bad iteration number (%d).  Must have a iteration count 1 or greater.", num_iterations);
+	if (!min_runs)
+		min_runs = num_iterations;
+	if (min_runs < 1 || min_runs > num_iterations)
+		FATAL_MSG("Bad minimum run count (%d).  Must be between 1 and the iteration count (%d).", min_runs, num_iterations);
+
+	//Find the inputs to trace
+	if (input_list)
+	{
+		input_filenames = read_input_list(input_filename, &num_inputs);
+		if (!input_filenames || !num_inputs)
+			FATAL_MSG("Unable to read any input files from the list \"%s\"", input_filename);
+		batch_mode = 1;
+	}
+	else if (is_directory(input_filename))
+	{
+		input_filenames = list_directory_files(input_filename, &num_inputs);
+		if (!input_filenames || !num_inputs)
+			FATAL_MSG("Unable to find any input files in the directory \"%s\"", input_filename);
+		batch_mode = 1;
+	}
+	else if (is_corpus_pack(input_filename))
+	{
+		//The pack is mapped once, and each input is traced from the mapping
+		input_pack = corpus_pack_open(input_filename);
+		if (!input_pack || !input_pack->count)
+			FATAL_MSG("Unable to find any inputs in the packed corpus \"%s\"", input_filename);
+		num_inputs = input_pack->count;
+		input_filenames = (char **)calloc(num_inputs, sizeof(char *));
+		for (input = 0; input < num_inputs; input++) {
+			if (input_filenames)
+				input_filenames[input] = corpus_pack_entry_filename(input_pack, input_filename, (uint32_t)input);
+			if (!input_filenames || !input_filenames[input])
+				FATAL_MSG("Failed to allocate the names of the inputs in \"%s\"", input_filename);
+		}
+		batch_mode = 1;
+	}
+	else
+		input_filenames = &input_filename;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
@@ -184,6 +482,8 @@ int main(int argc, char ** argv)
 	else
 		instrumentation_options = "{\"edges\": 1}";
 
+	//The driver and instrumentation are shared by all of the inputs, so the target (and its forkserver)
+	//is only started once
 	instrumentation_state = instrumentation->create(instrumentation_options, NULL);
 	if (!instrumentation_state)
 		FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
@@ -192,18 +492,9 @@ int main(int argc, char ** argv)
 	if (!driver)
 		FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options ? driver_options : "none");
 
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
-
-	//Read the seed file
-	seed_length = read_file(input_filename, &seed_buffer);
-	if (seed_length <= 0) //Couldn't read file, or empty file
-		FATAL_MSG("Unable to open the input file \"%s\"", input_filename);
-
 	memset(&all_runs, 0, sizeof(all_runs));
-	memset(&all_runs_num_edges, 0, sizeof(all_runs_num_edges));
 	memset(&module_names, 0, sizeof(module_names));
+	memset(&batch_files, 0, sizeof(batch_files));
 	if (!per_module_edges)
 	{
 		num_modules = 1;
@@ -219,67 +510,152 @@ int main(int argc, char ** argv)
 		}
 	}
 
-	for (iteration = 0; iteration < num_iterations; iteration++)
+	//In compact mode, all of the modules and inputs share one file
+	if (compact_mode)
 	{
-		driver->test_input(driver->state, seed_buffer, seed_length);
-		for (i = 0; i < num_modules; i++)
+		pack_writer = edge_pack_writer_create(output_file, module_names, (uint32_t)num_modules);
+		if (!pack_writer)
+			FATAL_MSG("Couldn't open the file %s to write the edges to", output_file);
+	}
+
+	//In batch mode, open the edge streams, and record which input each id refers to
+	if (batch_mode)
+	{
+		for (i = 0; !compact_mode && i < num_modules; i++)
 		{
-			edges = instrumentation->get_edges(instrumentation_state, i);
-			if (!edges)
-				FATAL_MSG("Instrumentation failed to get the program edges from the tested process.");
-			record_edges(edges, &all_runs[i], &all_runs_num_edges[i]);
+			if (!module_names[i])
+				snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s", output_file);
+			else
+				snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s_%s.%s", output_file, module_names[i], binary_mode ? "dat" : "csv");
+			batch_files[i] = fopen(filename_buffer, "wb+");
+			if (!batch_files[i])
+				FATAL_MSG("Couldn't open the file %s to write the edges to for %s", filename_buffer, module_names[i] ? module_names[i] : "the program");
+			write_batch_header(batch_files[i], binary_mode);
 		}
+
+		snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s%s", output_file, INPUTS_FILE_SUFFIX);
+		fp = fopen(filename_buffer, "wb+");
+		if (!fp)
+			FATAL_MSG("Couldn't open the file %s to write the input ids to", filename_buffer);
+		for (input = 0; input < num_inputs; input++)
+			fprintf(fp, "%s\n", input_filenames[input]);
+		fclose(fp);
 	}
-	free(seed_buffer);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Reduce the list of edges to just the ones in every run, and store it //////////////////////////////
+	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	for (i = 0; i < num_modules; i++)
+	for (input = 0; input < num_inputs; input++)
 	{
-		deterministic_edges = NULL;
-		deterministic_edges_num_edges = 0;
-		for (j = 0; j < all_runs_num_edges[i]; j++)
+		//Read the seed file
+		if (input_pack) {
+			seed_length = (size_t)input_pack->entries[input].length;
+			seed_buffer = seed_length ? (char *)CORPUS_PACK_ENTRY_DATA(input_pack, input) : NULL;
+		} else
+			seed_buffer = (char *)map_file(input_filenames[input], &seed_length);
+		if (!seed_buffer) //Couldn't map file, or empty file
+		{
+			if (!batch_mode)
+				FATAL_MSG("Unable to open the input file \"%s\"", input_filenames[input]);
+			WARNING_MSG("Unable to open the input file \"%s\", skipping it", input_filenames[input]);
+			continue;
+		}
+
+		for (i = 0; i < num_modules; i++)
+			clear_edge_table(&all_runs[i]);
+		for (iteration = 0; iteration < num_iterations; iteration++)
 		{
-			if (all_runs[i][j].count == num_iterations) //if the edge was found in all the iterations
+			driver->test_input(driver->state, seed_buffer, seed_length);
+			for (i = 0; i < num_modules; i++)
 			{
-				deterministic_edges_num_edges++;
-				deterministic_edges = (instrumentation_edge_t *)realloc(deterministic_edges, deterministic_edges_num_edges * sizeof(instrumentation_edge_t));
-				deterministic_edges[deterministic_edges_num_edges - 1].to = all_runs[i][j].edge.to;
-				deterministic_edges[deterministic_edges_num_edges - 1].from = all_runs[i][j].edge.from;
+				edges = instrumentation->get_edges(instrumentation_state, i);
+				if (!edges)
+					FATAL_MSG("Instrumentation failed to get the program edges from the tested process.");
+				record_edges(edges, &all_runs[i], iteration);
 			}
 		}
+		if (!input_pack)
+			unmap_file(seed_buffer, seed_length);
+		seed_buffer = NULL;
 
-		if (!module_names[i])
-			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s", output_file);
-		else
-			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s_%s.%s", output_file, module_names[i], binary_mode ? "dat" : "txt");
+		//////////////////////////////////////////////////////////////////////////////////////////////////
+		// Reduce the list of edges to just the ones in enough runs, and store it ////////////////////////
+		//////////////////////////////////////////////////////////////////////////////////////////////////
 
-		fp = fopen(filename_buffer, "wb+");
-		if (fp == NULL)
-			FATAL_MSG("Couldn't open the file %s to write the edges to for %s", filename_buffer, module_names[i] ? module_names[i] : "the program");
+		if (compact_mode)
+		{
+			write_packed_edges(pack_writer, (uint32_t)input, all_runs, num_modules, min_runs, &packed, &max_packed);
+			continue;
+		}
 
-		for (j = 0; j < deterministic_edges_num_edges; j++)
+		for (i = 0; i < num_modules; i++)
 		{
-			if (binary_mode)
-				fwrite(&deterministic_edges[j], sizeof(instrumentation_edge_t), 1, fp);
+			if (batch_mode)
+			{
+				for (j = 0; j < all_runs[i].num_entries; j++)
+				{
+					if (all_runs[i].entries[j].count >= min_runs)
+						write_batch_edge(batch_files[i], binary_mode, (uint32_t)input, &all_runs[i].entries[j]);
+				}
+				continue;
+			}
+
+			if (!module_names[i])
+				snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s", output_file);
 			else
-				fprintf(fp, "%016x:%016x\n", deterministic_edges[j].from, deterministic_edges[j].to);
-		}
-		fclose(fp);
+				snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s_%s.%s", output_file, module_names[i], binary_mode ? "dat" : "txt");
+
+			fp = fopen(filename_buffer, "wb+");
+			if (fp == NULL)
+				FATAL_MSG("Couldn't open the file %s to write the edges to for %s", filename_buffer, module_names[i] ? module_names[i] : "the program");
 
-		free(deterministic_edges);
+			//Stream out the edges that were found in enough of the iterations, in the order they were first seen
+			for (j = 0; j < all_runs[i].num_entries; j++)
+			{
+				if (all_runs[i].entries[j].count < min_runs)
+					continue;
+				if (binary_mode)
+					fwrite(&all_runs[i].entries[j].edge, sizeof(instrumentation_edge_t), 1, fp);
+				else
+					fprintf(fp, "%016x:%016x\n", all_runs[i].entries[j].edge.from, all_runs[i].entries[j].edge.to);
+			}
+			fclose(fp);
+		}
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
+	if (pack_writer && edge_pack_writer_close(pack_writer))
+	{
+		ERROR_MSG("Failed writing the edges to %s", output_file);
+		ret = 1;
+	}
+	free(packed);
+	for (i = 0; i < num_modules; i++)
+	{
+		if (batch_files[i])
+		{
+			write_batch_trailer(batch_files[i], binary_mode);
+			fclose(batch_files[i]);
+		}
+		free(all_runs[i].entries);
+		free(all_runs[i].slots);
+	}
+	if (batch_mode)
+	{
+		for (input = 0; input < num_inputs; input++)
+			free(input_filenames[input]);
+		free(input_filenames);
+	}
+	corpus_pack_close(input_pack);
+
 	//Cleanup the objects and exit
 	driver->cleanup(driver->state);
 	instrumentation->cleanup(instrumentation_state);
 	free(driver);
 	free(instrumentation);
-	return 0;
+	return ret;
 }
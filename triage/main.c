@@ -0,0 +1,444 @@
+//This program triages a directory of crashing inputs, such as the fuzzer's crashes directory.  Each input is
+//replayed, the details of how it crashed (its signal or exception code, the address that faulted, and the hash
+//of the crashed thread's stack, as far as the instrumentation can tell) are collected, and the crashes are
+//bucketed by them, so that each bug needs to be looked at once rather than once per input.  The inputs are
+//replayed in parallel, each worker with its own driver and instrumentation state.
+
+#include <driver.h>
+#include <driver_factory.h>
+#include <instrumentation.h>
+#include <instrumentation_factory.h>
+#include <utils.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The fuzzer's findings store puts each input in a subdirectory named by the first two hex characters of its hash
+#define TRIAGE_FANOUT_DIRS 256
+
+void usage(char * program_name)
+{
+	char * help_text;
+	printf(
+		"Usage: %s driver_name instrumentation_name crash_directory report_file [options]\n"
+		"\n"
+		"Required:\n"
+		"\t driver_name                   The driver framework used to run the target program\n"
+		"\t instrumentation_name          The instrumenation framework to use to tell how the target crashed, e.g.\n"
+		"\t                                return_code or afl on Linux, or debug on Windows\n"
+		"\t crash_directory               The directory of inputs to triage, such as the fuzzer's crashes directory\n"
+		"\t report_file                   Write the triage report to this file\n"
+		"Options:\n"
+		"\t -a                            List every input in the report, rather than only the smallest input of\n"
+		"\t                                each bucket\n"
+		"\t -d driver_options             Set the options for the driver\n"
+		"\t -i instrumentation_options    Set the options for the instrumentation\n"
+		"\t -l logging_options            Set the options for logging\n"
+		"\t -r retries                    The number of times to rerun an input that doesn't crash, since\n"
+		"\t                                some crashes don't happen every time [default 0]\n"
+		"\t -s report_directory           Have the sanitizer builds write full, symbolized reports to files\n"
+		"\t                                in this directory, rather than the fuzzer's fast unsymbolized ones\n"
+		"\t -w num_workers                The number of inputs to replay in parallel, each with its own\n"
+		"\t                                driver and instrumentation state [default 1]\n"
+		"\n"
+		"The crashes are bucketed by their signal and the hash of their stack if the instrumentation records\n"
+		"it (e.g. debug with the stack_depth option), otherwise by their signal and the address that faulted,\n"
+		"otherwise by the instrumentation's crash hash (e.g. afl's coverage), and otherwise only by their signal.\n"
+		"The report has a line for each bucket, with the most common buckets first.\n"
+		"\n",
+		program_name
+	);
+
+#define PRINT_HELP(x, y) \
+	x = y;               \
+	if(x) {              \
+		puts(x);         \
+		free(x);         \
+	}
+
+	PRINT_HELP(help_text, logging_help());
+	PRINT_HELP(help_text, driver_help());
+	PRINT_HELP(help_text, instrumentation_help());
+	exit(1);
+}
+
+//The result of replaying one input
+struct triage_result
+{
+	char * filename;
+	size_t length;
+	int result;                        //The fuzz result of the replay, or FUZZ_ERROR if it couldn't be replayed
+	instrumentation_crash_info_t info; //How the input crashed, when result is FUZZ_CRASH
+	uint64_t bucket;
+};
+typedef struct triage_result triage_result_t;
+
+//A bucket of crashes, as a run of the sorted crashes
+struct triage_bucket
+{
+	size_t first; //The index of the bucket's first crash in the sorted crashes, which is its smallest input
+	size_t count;
+};
+typedef struct triage_bucket triage_bucket_t;
+
+//A worker that replays the next input until all of them have been replayed
+struct triage_worker
+{
+	driver_t * driver;
+	void * instrumentation_state;
+	thread_t thread;
+};
+typedef struct triage_worker triage_worker_t;
+
+static instrumentation_t * instrumentation = NULL;
+static triage_result_t * results = NULL;
+static size_t num_results = 0;
+static size_t next_result = 0;
+static mutex_t results_mutex = NULL;
+static int retries = 0;
+
+/**
+ * This function adds the files in a directory to the inputs to triage.
+ * @param directory - the directory to add the files of
+ * @return - zero on success, non-zero on failure
+ */
+static int add_directory_files(char * directory)
+{
+	triage_result_t * new_results;
+	char ** filenames;
+	size_t count, i;
+
+	filenames = list_directory_files(directory, &count);
+	if (!filenames)
+		return 0;
+	new_results = (triage_result_t *)realloc(results, (num_results + count) * sizeof(triage_result_t));
+	if (!new_results) {
+		for (i = 0; i < count; i++)
+			free(filenames[i]);
+		free(filenames);
+		return 1;
+	}
+	results = new_results;
+	memset(results + num_results, 0, count * sizeof(triage_result_t));
+	for (i = 0; i < count; i++)
+		results[num_results++].filename = filenames[i];
+	free(filenames);
+	return 0;
+}
+
+/**
+ * This function picks the bucket of a crash, from the most specific details of the crash that are known.
+ * @param worker - the worker that replayed the crash
+ * @param info - the details of the crash
+ * @return - the crash's bucket
+ */
+static uint64_t crash_bucket(triage_worker_t * worker, instrumentation_crash_info_t * info)
+{
+	uint64_t hash, signal = 0x9E3779B97F4A7C15ULL * info->signal;
+
+	if (info->stack_hash)
+		return signal ^ info->stack_hash;
+	if (info->fault_address)
+		return signal ^ info->fault_address;
+	if (instrumentation->get_crash_hash && !instrumentation->get_crash_hash(worker->instrumentation_state, &hash))
+		return hash;
+	return info->signal;
+}
+
+/**
+ * This function replays an input, and records whether and how it crashed.
+ * @param worker - the worker to replay the input with
+ * @param result - the result to record, which holds the input's filename
+ */
+static void triage_input(triage_worker_t * worker, triage_result_t * result)
+{
+	char * buffer = NULL;
+	int length, i;
+
+	length = read_file(result->filename, &buffer);
+	if (length <= 0) {
+		WARNING_MSG("Could not read the input %s, or it's empty", result->filename);
+		result->result = FUZZ_ERROR;
+		free(buffer);
+		return;
+	}
+	result->length = length;
+
+	for (i = 0; i <= retries; i++) {
+		result->result = worker->driver->test_input(worker->driver->state, buffer, length);
+		if (result->result != FUZZ_NONE)
+			break;
+	}
+	if (result->result == FUZZ_CRASH) {
+		if (!instrumentation->get_crash_info
+			|| instrumentation->get_crash_info(worker->instrumentation_state, &result->info))
+			memset(&result->info, 0, sizeof(result->info));
+		result->bucket = crash_bucket(worker, &result->info);
+	}
+	else if (result->result == FUZZ_ERROR)
+		WARNING_MSG("Failed to replay the input %s", result->filename);
+	DEBUG_MSG("Replayed %s, fuzz result %d", result->filename, result->result);
+	free(buffer);
+}
+
+/**
+ * This function is a worker thread, which replays the next input that hasn't been replayed, until all of
+ * them have been.
+ * @param arg - a pointer to the triage_worker_t to run
+ */
+static THREAD_FUNC(triage_worker_thread)
+{
+	triage_worker_t * worker = (triage_worker_t *)arg;
+	size_t i;
+
+	while (1)
+	{
+		take_mutex(results_mutex);
+		i = next_result++;
+		release_mutex(results_mutex);
+		if (i >= num_results)
+			break;
+		triage_input(worker, &results[i]);
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * This function orders the crashes by bucket, and then with the smallest input first.
+ */
+static int compare_crashes(const void * a, const void * b)
+{
+	const triage_result_t * crash_a = *(const triage_result_t * const *)a, * crash_b = *(const triage_result_t * const *)b;
+
+	if (crash_a->bucket != crash_b->bucket)
+		return crash_a->bucket < crash_b->bucket ? -1 : 1;
+	if (crash_a->length != crash_b->length)
+		return crash_a->length < crash_b->length ? -1 : 1;
+	return strcmp(crash_a->filename, crash_b->filename);
+}
+
+/**
+ * This function orders the buckets with the most crashes first.
+ */
+static int compare_buckets(const void * a, const void * b)
+{
+	const triage_bucket_t * bucket_a = (const triage_bucket_t *)a, * bucket_b = (const triage_bucket_t *)b;
+
+	if (bucket_a->count != bucket_b->count)
+		return bucket_a->count > bucket_b->count ? -1 : 1;
+	return bucket_a->first < bucket_b->first ? -1 : bucket_a->first > bucket_b->first;
+}
+
+/**
+ * This function writes the triage report.  It starts with a summary line, followed by a line for each
+ * bucket, with the most common buckets first, e.g.
+ * "bucket 1A2B3C4D5E6F7A8B crashes 120 signal 11 fault 0x0 stack 0000000000000000 input crashes/1A/1A2B3C4D5E6F7A8B"
+ * The input is the bucket's smallest input, or with list_all, each of the bucket's inputs has a line after it.
+ * @param report_file - the file to write the report to
+ * @param list_all - whether to list every input, rather than only the smallest input of each bucket
+ * @return - zero on success, non-zero on failure
+ */
+static int write_report(char * report_file, int list_all)
+{
+	triage_result_t ** crashes;
+	triage_bucket_t * buckets;
+	size_t num_crashes = 0, num_buckets = 0, hangs = 0, clean = 0, errors = 0, i, j;
+	triage_result_t * crash;
+	FILE * fp;
+	int ret;
+
+	crashes = (triage_result_t **)malloc((num_results ? num_results : 1) * sizeof(triage_result_t *));
+	buckets = (triage_bucket_t *)malloc((num_results ? num_results : 1) * sizeof(triage_bucket_t));
+	if (!crashes || !buckets) {
+		free(crashes);
+		free(buckets);
+		return 1;
+	}
+
+	for (i = 0; i < num_results; i++) {
+		if (results[i].result == FUZZ_CRASH)
+			crashes[num_crashes++] = &results[i];
+		else if (results[i].result == FUZZ_HANG)
+			hangs++;
+		else if (results[i].result == FUZZ_NONE)
+			clean++;
+		else
+			errors++;
+	}
+	qsort(crashes, num_crashes, sizeof(triage_result_t *), compare_crashes);
+	for (i = 0; i < num_crashes; i++) {
+		if (!i || crashes[i]->bucket != crashes[i - 1]->bucket) {
+			buckets[num_buckets].first = i;
+			buckets[num_buckets++].count = 0;
+		}
+		buckets[num_buckets - 1].count++;
+	}
+	qsort(buckets, num_buckets, sizeof(triage_bucket_t), compare_buckets);
+
+	fp = fopen(report_file, "w");
+	if (!fp) {
+		free(crashes);
+		free(buckets);
+		return 1;
+	}
+	fprintf(fp, "inputs %lu crashes %lu buckets %lu hangs %lu no_crash %lu errors %lu\n", (unsigned long)num_results,
+		(unsigned long)num_crashes, (unsigned long)num_buckets, (unsigned long)hangs, (unsigned long)clean,
+		(unsigned long)errors);
+	for (i = 0; i < num_buckets; i++) {
+		crash = crashes[buckets[i].first];
+#ifdef _WIN32
+		fprintf(fp, "bucket %016" PRIX64 " crashes %lu signal 0x%08X fault 0x%" PRIx64 " stack %016" PRIX64 " input %s\n",
+#else
+		fprintf(fp, "bucket %016" PRIX64 " crashes %lu signal %u fault 0x%" PRIx64 " stack %016" PRIX64 " input %s\n",
+#endif
+			crash->bucket, (unsigned long)buckets[i].count, (unsigned int)crash->info.signal, crash->info.fault_address,
+			crash->info.stack_hash, crash->filename);
+		for (j = 0; list_all && j < buckets[i].count; j++)
+			fprintf(fp, "  %s\n", crashes[buckets[i].first + j]->filename);
+	}
+	ret = ferror(fp);
+	ret = fclose(fp) || ret;
+
+	INFO_MSG("Triaged %lu inputs: %lu crashes in %lu buckets, %lu hangs, %lu didn't crash, and %lu couldn't be replayed",
+		(unsigned long)num_results, (unsigned long)num_crashes, (unsigned long)num_buckets, (unsigned long)hangs,
+		(unsigned long)clean, (unsigned long)errors);
+	free(crashes);
+	free(buckets);
+	return ret;
+}
+
+int main(int argc, char ** argv)
+{
+	triage_worker_t * workers;
+	char *driver_name, *driver_options = NULL, *logging_options = NULL,
+		*instrumentation_name = NULL, *instrumentation_options = NULL,
+		*crash_directory, *report_file, *sanitizer_directory = NULL, subdirectory[MAX_PATH];
+	int num_workers = 1, list_all = 0, i;
+	size_t j;
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (argc < 5)
+	{
+		usage(argv[0]);
+	}
+
+	driver_name = argv[1];
+	instrumentation_name = argv[2];
+	crash_directory = argv[3];
+	report_file = argv[4];
+	for (i = 5; i < argc; i++)
+	{
+		IF_ARG_OPTION("-d", driver_options)
+		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-r", retries)
+		ELSE_IF_ARG_OPTION("-s", sanitizer_directory)
+		ELSE_IF_ARGINT_OPTION("-w", num_workers)
+		else if (!strcmp("-a", argv[i]))
+			list_all = 1;
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exiting\n");
+		return 1;
+	}
+
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have at least one worker.", num_workers);
+	if (retries < 0)
+		FATAL_MSG("Bad retry count (%d).  Must not be negative.", retries);
+	if (sanitizer_directory && (!is_directory(sanitizer_directory) || set_sanitizer_reports(sanitizer_directory)))
+		FATAL_MSG("The sanitizer report directory %s isn't a directory", sanitizer_directory);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	//Take the inputs from the directory, and from the fan out subdirectories of the fuzzer's findings store
+	if (!is_directory(crash_directory))
+		FATAL_MSG("The crash directory %s isn't a directory", crash_directory);
+	if (add_directory_files(crash_directory))
+		FATAL_MSG("Couldn't allocate the list of inputs");
+	for (i = 0; i < TRIAGE_FANOUT_DIRS; i++)
+	{
+		snprintf(subdirectory, sizeof(subdirectory), "%s/%02X", crash_directory, i);
+		if (is_directory(subdirectory) && add_directory_files(subdirectory))
+			FATAL_MSG("Couldn't allocate the list of inputs");
+	}
+	if (!num_results)
+		FATAL_MSG("The crash directory %s doesn't have any inputs", crash_directory);
+	INFO_MSG("Triaging %lu inputs from %s", (unsigned long)num_results, crash_directory);
+
+	instrumentation = instrumentation_factory(instrumentation_name);
+	if (!instrumentation)
+		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
+	if (!instrumentation->get_crash_info && !instrumentation->get_crash_hash)
+		WARNING_MSG("The %s instrumentation can't tell how the target crashed, so the crashes will all be in one bucket",
+			instrumentation_name);
+
+	workers = (triage_worker_t *)calloc(num_workers, sizeof(triage_worker_t));
+	results_mutex = create_mutex();
+	if (!workers || !results_mutex)
+		FATAL_MSG("Couldn't allocate the state for %d workers", num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].instrumentation_state = instrumentation->create(instrumentation_options, NULL);
+		if (!workers[i].instrumentation_state)
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		workers[i].driver = driver_worker_factory(driver_name, driver_options, i, instrumentation,
+			workers[i].instrumentation_state, NULL, NULL);
+		if (!workers[i].driver)
+			FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options ? driver_options : "none");
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Replay the inputs /////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	if (num_workers == 1)
+		triage_worker_thread(&workers[0]);
+	else
+	{
+		for (i = 0; i < num_workers; i++)
+		{
+			if (create_thread(&workers[i].thread, triage_worker_thread, &workers[i]))
+				FATAL_MSG("Failed to start worker %d", i);
+		}
+		for (i = 0; i < num_workers; i++)
+			join_thread(workers[i].thread);
+	}
+
+	if (write_report(report_file, list_all))
+		FATAL_MSG("Couldn't write the triage report to %s", report_file);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Cleanup ///////////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].driver->cleanup(workers[i].driver->state);
+		instrumentation->cleanup(workers[i].instrumentation_state);
+		free(workers[i].driver);
+	}
+	for (j = 0; j < num_results; j++)
+		free(results[j].filename);
+	free(results);
+	free(workers);
+	destroy_mutex(results_mutex);
+	free(instrumentation);
+	return 0;
+}
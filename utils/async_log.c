@@ -0,0 +1,683 @@
+#include "async_log.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#define MEMORY_BARRIER() MemoryBarrier()
+#define ATOMIC_INCREMENT64(ptr) ((uint64_t)InterlockedIncrement64((volatile LONG64 *)(ptr)))
+#define sleep_ms(ms) Sleep(ms)
+#else
+#include <unistd.h>
+#define THREAD_LOCAL __thread
+#define MEMORY_BARRIER() __sync_synchronize()
+#define ATOMIC_INCREMENT64(ptr) __sync_add_and_fetch((ptr), 1)
+#define sleep_ms(ms) usleep((ms) * 1000)
+#endif
+
+//The header of each message in a ring buffer.  It's followed by a copy of the format string, and
+//then the arguments, in the order that they're read by the format string.
+struct log_record
+{
+	uint32_t length;    //The length of the record, including the header, rounded up to RECORD_ALIGNMENT
+	uint32_t level;     //The log level, or RECORD_PADDING for the unused space at the end of the buffer
+	uint64_t sequence;  //The order that the messages were logged in, across all of the threads
+	int64_t time;
+};
+
+#define RECORD_ALIGNMENT 8
+#define RECORD_PADDING   0xffffffff
+#define ALIGN_RECORD(length) (((length) + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1))
+
+//A thread's ring buffer.  The thread that owns it is the only one that moves the tail, and the
+//background thread (or whichever thread holds consumer_mutex) is the only one that moves the head.
+//The head and tail only ever go up, and are masked to get the offset in the buffer.
+struct log_ring
+{
+	char * buffer;
+	volatile size_t head;
+	volatile size_t tail;
+	size_t drain_tail;        //The tail when the current drain started, only used while holding consumer_mutex
+	struct log_ring * next;
+};
+
+//The argument types in the printf conversions that can be queued
+enum format_length { LENGTH_NONE, LENGTH_HH, LENGTH_H, LENGTH_L, LENGTH_LL, LENGTH_Z, LENGTH_J, LENGTH_T, LENGTH_LONG_DOUBLE };
+
+//A parsed printf conversion
+struct format_spec
+{
+	const char * start;      //The '%' that starts the conversion
+	const char * end;        //The character after the conversion
+	int width_star;          //Whether the width is an argument
+	int precision_star;      //Whether the precision is an argument
+	int precision;           //The precision, if it isn't an argument, or -1 if there isn't one
+	enum format_length length;
+	char conversion;
+};
+
+//A growable buffer that the messages are formatted into
+struct text_buffer
+{
+	char * data;
+	size_t length;
+	size_t capacity;
+};
+
+static volatile int running = 0;
+static volatile int stopping = 0;
+static FILE * stdout_sink = NULL;
+static FILE * file_sink = NULL;
+static volatile uint64_t next_sequence = 0;
+
+static struct log_ring * volatile rings = NULL;   //All of the threads' ring buffers, which are never freed
+static THREAD_LOCAL struct log_ring * thread_ring = NULL;
+static mutex_t ring_list_mutex = NULL;     //Taken to add a ring buffer to rings
+static mutex_t consumer_mutex = NULL;      //Taken to write the queued messages
+static thread_t flusher_thread;
+static struct text_buffer message_text;   //Only used while holding consumer_mutex
+
+/**
+ * This function parses a printf conversion.
+ * @param format - the '%' that starts the conversion
+ * @param spec - a format_spec that's filled in with the parsed conversion
+ * @return - zero on success, or non-zero if the conversion can't be queued, e.g. %n, %ls, or a
+ * Microsoft specific length such as %I64d
+ */
+static int parse_format_spec(const char * format, struct format_spec * spec)
+{
+	const char * p = format + 1;
+
+	memset(spec, 0, sizeof(*spec));
+	spec->start = format;
+	spec->precision = -1;
+
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	if (*p == '*') {
+		spec->width_star = 1;
+		p++;
+	}
+	else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->precision_star = 1;
+			p++;
+		}
+		else {
+			spec->precision = 0;
+			while (*p >= '0' && *p <= '9')
+				spec->precision = spec->precision * 10 + (*p++ - '0');
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+		spec->length = p[1] == 'h' ? LENGTH_HH : LENGTH_H;
+		p += spec->length == LENGTH_HH ? 2 : 1;
+		break;
+	case 'l':
+		spec->length = p[1] == 'l' ? LENGTH_LL : LENGTH_L;
+		p += spec->length == LENGTH_LL ? 2 : 1;
+		break;
+	case 'z': spec->length = LENGTH_Z; p++; break;
+	case 'j': spec->length = LENGTH_J; p++; break;
+	case 't': spec->length = LENGTH_T; p++; break;
+	case 'L': spec->length = LENGTH_LONG_DOUBLE; p++; break;
+	}
+
+	spec->conversion = *p;
+	if (!*p)
+		return 1;
+	spec->end = p + 1;
+	switch (spec->conversion) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		return spec->length == LENGTH_LONG_DOUBLE;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		return spec->length != LENGTH_NONE && spec->length != LENGTH_L && spec->length != LENGTH_LONG_DOUBLE;
+	case 'c': case 's': case 'p':
+		return spec->length != LENGTH_NONE;
+	case '%':
+		return spec->width_star || spec->precision_star;
+	}
+	return 1;
+}
+
+//Copies an argument of the given type from args into the record, or fails if it doesn't fit
+#define CAPTURE_ARG(type, promoted_type)                           \
+	do {                                                           \
+		type value = (type)va_arg(args, promoted_type);            \
+		if (length + sizeof(value) > size)                         \
+			return 0;                                              \
+		memcpy(record + length, &value, sizeof(value));            \
+		length += sizeof(value);                                   \
+	} while (0)
+
+/**
+ * This function copies a message's format string and arguments into a record.
+ * @param record - the buffer to write the record to, starting with its log_record header
+ * @param size - the size of the record buffer
+ * @param msg - the printf style format string of the message
+ * @param args - the message's arguments
+ * @return - the length of the record, or 0 if the message can't be queued, because it has a
+ * conversion that isn't supported or doesn't fit in the record
+ */
+static size_t capture_message(char * record, size_t size, const char * msg, va_list args)
+{
+	struct format_spec spec;
+	size_t length, msg_length, string_length;
+	const char * p, * string;
+	int precision;
+
+	length = sizeof(struct log_record);
+	msg_length = strlen(msg) + 1;
+	if (length + msg_length > size)
+		return 0;
+	memcpy(record + length, msg, msg_length);
+	length += msg_length;
+
+	for (p = strchr(msg, '%'); p; p = strchr(spec.end, '%'))
+	{
+		if (parse_format_spec(p, &spec))
+			return 0;
+
+		precision = spec.precision;
+		if (spec.width_star)
+			CAPTURE_ARG(int, int);
+		if (spec.precision_star) {
+			precision = va_arg(args, int);
+			if (length + sizeof(precision) > size)
+				return 0;
+			memcpy(record + length, &precision, sizeof(precision));
+			length += sizeof(precision);
+		}
+
+		switch (spec.conversion) {
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+			switch (spec.length) {
+			case LENGTH_L: CAPTURE_ARG(long, long); break;
+			case LENGTH_LL: CAPTURE_ARG(long long, long long); break;
+			case LENGTH_Z: CAPTURE_ARG(size_t, size_t); break;
+			case LENGTH_J: CAPTURE_ARG(intmax_t, intmax_t); break;
+			case LENGTH_T: CAPTURE_ARG(ptrdiff_t, ptrdiff_t); break;
+			default: CAPTURE_ARG(int, int); break;
+			}
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if (spec.length == LENGTH_LONG_DOUBLE)
+				CAPTURE_ARG(long double, long double);
+			else
+				CAPTURE_ARG(double, double);
+			break;
+		case 'c':
+			CAPTURE_ARG(int, int);
+			break;
+		case 'p':
+			CAPTURE_ARG(void *, void *);
+			break;
+		case 's':
+			//The string is copied, since it may be freed before the message is written.  A string
+			//with a precision doesn't need to be terminated, so only the printed part is copied.
+			string = va_arg(args, const char *);
+			if (!string)
+				string = "(null)";
+			if (precision >= 0) {
+				for (string_length = 0; string_length < (size_t)precision && string[string_length]; string_length++);
+			}
+			else
+				string_length = strlen(string);
+			if (length + string_length + 1 > size)
+				return 0;
+			memcpy(record + length, string, string_length);
+			record[length + string_length] = 0;
+			length += string_length + 1;
+			break;
+		}
+	}
+	return length;
+}
+
+/**
+ * This function appends printf style formatted text to a text buffer, growing it if necessary.
+ * @param text - the text buffer to append to
+ * @param format - the printf style format string
+ * @param ... - the printf style arguments
+ */
+static void text_printf(struct text_buffer * text, const char * format, ...)
+{
+	va_list args;
+	char * new_data;
+	size_t new_capacity;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if ((size_t)length >= text->capacity - text->length) {
+		new_capacity = text->capacity * 2;
+		while (new_capacity - text->length <= (size_t)length)
+			new_capacity *= 2;
+		new_data = (char *)realloc(text->data, new_capacity);
+		if (!new_data)
+			return;
+		text->data = new_data;
+		text->capacity = new_capacity;
+		va_start(args, format);
+		vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+		va_end(args);
+	}
+	text->length += length;
+}
+
+//Reads an argument of the given type from the record and formats it with the conversion
+#define FORMAT_ARG(type)                                                                 \
+	do {                                                                                 \
+		type value;                                                                      \
+		memcpy(&value, args, sizeof(value));                                             \
+		args += sizeof(value);                                                           \
+		if (spec.width_star && spec.precision_star)                                      \
+			text_printf(text, conversion, width, precision, value);                      \
+		else if (spec.width_star)                                                        \
+			text_printf(text, conversion, width, value);                                 \
+		else if (spec.precision_star)                                                    \
+			text_printf(text, conversion, precision, value);                             \
+		else                                                                             \
+			text_printf(text, conversion, value);                                        \
+	} while (0)
+
+/**
+ * This function formats a queued message, by formatting each of its conversions with the copied arguments.
+ * @param text - the text buffer to format the message into.  Its length is reset first.
+ * @param record - the queued message's record
+ */
+static void format_message(struct text_buffer * text, const struct log_record * record)
+{
+	struct format_spec spec;
+	char conversion[64];
+	const char * msg, * p, * literal;
+	const char * args;
+	int width = 0, precision = 0;
+
+	text->length = 0;
+	text->data[0] = 0;
+	msg = (const char *)(record + 1);
+	args = msg + strlen(msg) + 1;
+
+	for (literal = msg, p = strchr(msg, '%'); p; literal = spec.end, p = strchr(spec.end, '%'))
+	{
+		text_printf(text, "%.*s", (int)(p - literal), literal);
+		parse_format_spec(p, &spec); //This succeeded when the message was captured
+		if ((size_t)(spec.end - spec.start) >= sizeof(conversion))
+			return;
+		memcpy(conversion, spec.start, spec.end - spec.start);
+		conversion[spec.end - spec.start] = 0;
+
+		if (spec.width_star) {
+			memcpy(&width, args, sizeof(width));
+			args += sizeof(width);
+		}
+		if (spec.precision_star) {
+			memcpy(&precision, args, sizeof(precision));
+			args += sizeof(precision);
+		}
+
+		switch (spec.conversion) {
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+			switch (spec.length) {
+			case LENGTH_L: FORMAT_ARG(long); break;
+			case LENGTH_LL: FORMAT_ARG(long long); break;
+			case LENGTH_Z: FORMAT_ARG(size_t); break;
+			case LENGTH_J: FORMAT_ARG(intmax_t); break;
+			case LENGTH_T: FORMAT_ARG(ptrdiff_t); break;
+			default: FORMAT_ARG(int); break;
+			}
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if (spec.length == LENGTH_LONG_DOUBLE)
+				FORMAT_ARG(long double);
+			else
+				FORMAT_ARG(double);
+			break;
+		case 'c':
+			FORMAT_ARG(int);
+			break;
+		case 'p':
+			FORMAT_ARG(void *);
+			break;
+		case 's':
+			if (spec.width_star && spec.precision_star)
+				text_printf(text, conversion, width, precision, args);
+			else if (spec.width_star)
+				text_printf(text, conversion, width, args);
+			else if (spec.precision_star)
+				text_printf(text, conversion, precision, args);
+			else
+				text_printf(text, conversion, args);
+			args += strlen(args) + 1;
+			break;
+		case '%':
+			text_printf(text, "%%");
+			break;
+		}
+	}
+	text_printf(text, "%s", literal);
+}
+
+/**
+ * This function writes a line to each of the sinks.  The sinks aren't flushed.
+ * @param level - the log level of the message
+ * @param time - the time that the message was logged
+ * @param text - the formatted message
+ */
+static void write_line(enum LOG_LEVEL level, time_t time, const char * text)
+{
+	char time_buf[64];
+
+	log_time_string(time, time_buf, sizeof(time_buf));
+	if (stdout_sink)
+		fprintf(stdout_sink, "%s - %-8s - %s\n", time_buf, log_level_names[level], text);
+	if (file_sink)
+		fprintf(file_sink, "%s - %-8s - %s\n", time_buf, log_level_names[level], text);
+}
+
+/**
+ * This function returns the next message in a ring buffer, skipping the padding at the end of the buffer.
+ * @param ring - the ring buffer to read from
+ * @return - the next message's record, or NULL if the ring buffer doesn't have any more messages
+ */
+static struct log_record * peek_record(struct log_ring * ring)
+{
+	struct log_record * record;
+
+	while (ring->head != ring->drain_tail)
+	{
+		record = (struct log_record *)(ring->buffer + (ring->head & (ASYNC_LOG_RING_SIZE - 1)));
+		if (record->level != RECORD_PADDING)
+			return record;
+		MEMORY_BARRIER();
+		ring->head += record->length;
+	}
+	return NULL;
+}
+
+/**
+ * This function writes all of the queued messages, in the order that they were logged, and then
+ * flushes the sinks.  The caller must hold consumer_mutex.
+ */
+static void drain_rings(void)
+{
+	struct log_ring * ring, * oldest_ring;
+	struct log_record * record, * oldest;
+	int wrote = 0;
+
+	//Only the messages that were queued before the drain started are written, so that threads that
+	//keep logging can't keep the drain going forever.
+	MEMORY_BARRIER();
+	for (ring = rings; ring; ring = ring->next)
+		ring->drain_tail = ring->tail;
+	MEMORY_BARRIER();
+
+	while (1)
+	{
+		oldest = NULL;
+		oldest_ring = NULL;
+		for (ring = rings; ring; ring = ring->next)
+		{
+			record = peek_record(ring);
+			if (record && (!oldest || record->sequence < oldest->sequence)) {
+				oldest = record;
+				oldest_ring = ring;
+			}
+		}
+		if (!oldest)
+			break;
+
+		format_message(&message_text, oldest);
+		write_line((enum LOG_LEVEL)oldest->level, (time_t)oldest->time, message_text.data);
+		wrote = 1;
+		MEMORY_BARRIER();
+		oldest_ring->head += oldest->length;
+	}
+
+	if (wrote) {
+		if (stdout_sink)
+			fflush(stdout_sink);
+		if (file_sink)
+			fflush(file_sink);
+	}
+}
+
+/**
+ * This function writes any queued messages, and waits for them to be written.
+ */
+void async_log_flush(void)
+{
+	if (!running)
+		return;
+	take_mutex(consumer_mutex);
+	drain_rings();
+	release_mutex(consumer_mutex);
+}
+
+/**
+ * This function is the background thread that periodically writes the queued messages.
+ */
+static THREAD_FUNC(flusher_thread_func)
+{
+	while (!stopping)
+	{
+		async_log_flush();
+		sleep_ms(ASYNC_LOG_FLUSH_INTERVAL_MS);
+	}
+	THREAD_RETURN;
+}
+
+/**
+ * This function creates the calling thread's ring buffer, and adds it to the ring buffers that are drained.
+ * @return - the new ring buffer, or NULL on failure
+ */
+static struct log_ring * create_thread_ring(void)
+{
+	struct log_ring * ring;
+
+	ring = (struct log_ring *)calloc(1, sizeof(struct log_ring));
+	if (!ring)
+		return NULL;
+	ring->buffer = (char *)malloc(ASYNC_LOG_RING_SIZE);
+	if (!ring->buffer) {
+		free(ring);
+		return NULL;
+	}
+
+	take_mutex(ring_list_mutex);
+	ring->next = rings;
+	MEMORY_BARRIER();
+	rings = ring;
+	release_mutex(ring_list_mutex);
+	thread_ring = ring;
+	return ring;
+}
+
+/**
+ * This function copies a record into a ring buffer.
+ * @param ring - the calling thread's ring buffer
+ * @param record - the record to copy
+ * @param length - the length of the record
+ * @return - zero on success, or non-zero if the ring buffer is full
+ */
+static int push_record(struct log_ring * ring, const char * record, size_t length)
+{
+	struct log_record * padding;
+	size_t aligned_length, offset, space_to_end, needed, tail;
+
+	aligned_length = ALIGN_RECORD(length);
+	tail = ring->tail;
+	offset = tail & (ASYNC_LOG_RING_SIZE - 1);
+	space_to_end = ASYNC_LOG_RING_SIZE - offset;
+
+	//Records don't wrap around the end of the buffer, so if this one doesn't fit, the rest of the
+	//buffer is skipped with a padding record.
+	needed = aligned_length + (space_to_end < aligned_length ? space_to_end : 0);
+	if (ASYNC_LOG_RING_SIZE - (tail - ring->head) < needed)
+		return 1;
+
+	if (space_to_end < aligned_length) {
+		padding = (struct log_record *)(ring->buffer + offset);
+		padding->length = (uint32_t)space_to_end;
+		padding->level = RECORD_PADDING;
+		tail += space_to_end;
+		offset = 0;
+	}
+	memcpy(ring->buffer + offset, record, length);
+	((struct log_record *)(ring->buffer + offset))->length = (uint32_t)aligned_length;
+	MEMORY_BARRIER();
+	ring->tail = tail + aligned_length;
+	return 0;
+}
+
+/**
+ * This function writes a message to the sinks immediately, after the messages that were queued
+ * before it.  It's used for the messages that can't be queued.
+ * @param level - the log level of the message
+ * @param time - the time that the message was logged
+ * @param msg - the printf style format string of the message
+ * @param args - the message's arguments
+ */
+static void write_message_now(enum LOG_LEVEL level, time_t time, const char * msg, va_list args)
+{
+	char time_buf[64];
+	va_list temp_args;
+
+	log_time_string(time, time_buf, sizeof(time_buf));
+	take_mutex(consumer_mutex);
+	drain_rings();
+	if (stdout_sink) {
+		va_copy(temp_args, args);
+		fprintf(stdout_sink, "%s - %-8s - ", time_buf, log_level_names[level]);
+		vfprintf(stdout_sink, msg, temp_args);
+		fwrite("\n", 1, 1, stdout_sink);
+		fflush(stdout_sink);
+		va_end(temp_args);
+	}
+	if (file_sink) {
+		va_copy(temp_args, args);
+		fprintf(file_sink, "%s - %-8s - ", time_buf, log_level_names[level]);
+		vfprintf(file_sink, msg, temp_args);
+		fwrite("\n", 1, 1, file_sink);
+		fflush(file_sink);
+		va_end(temp_args);
+	}
+	release_mutex(consumer_mutex);
+}
+
+/**
+ * This function queues a message to be written by the background thread.  The format string and
+ * arguments are copied, and the message is formatted when it's written.  If the calling thread's
+ * ring buffer is full, the queued messages are written first.  ERROR and higher messages are
+ * written before this function returns, so that they aren't lost if the process crashes.
+ * @param level - the log level of the message
+ * @param time - the time that the message was logged
+ * @param msg - the printf style format string of the message
+ * @param args - the message's arguments
+ * @return - zero if the message was logged, or non-zero if asynchronous logging isn't running, in
+ * which case the caller should write the message itself
+ */
+int async_log_msg(enum LOG_LEVEL level, time_t time, const char * msg, va_list args)
+{
+	char record[ASYNC_LOG_MAX_RECORD];
+	struct log_record * header = (struct log_record *)record;
+	struct log_ring * ring;
+	va_list temp_args;
+	size_t length;
+
+	if (!running)
+		return 1;
+	ring = thread_ring;
+	if (!ring && !(ring = create_thread_ring()))
+		return 1;
+
+	va_copy(temp_args, args);
+	length = capture_message(record, sizeof(record), msg, temp_args);
+	va_end(temp_args);
+	if (!length) {
+		write_message_now(level, time, msg, args);
+		return 0;
+	}
+
+	header->level = level;
+	header->sequence = ATOMIC_INCREMENT64(&next_sequence);
+	header->time = (int64_t)time;
+	if (push_record(ring, record, length)) {
+		async_log_flush();
+		push_record(ring, record, length); //The ring buffer is empty now, since only this thread adds to it
+	}
+
+	if (level >= ERROR_LEVEL)
+		async_log_flush();
+	return 0;
+}
+
+#ifndef _WIN32
+/**
+ * This function stops asynchronous logging in a forked child, which doesn't have the background thread.
+ */
+static void async_log_atfork_child(void)
+{
+	running = 0;
+}
+#endif
+
+/**
+ * This function starts asynchronous logging.  The background thread is stopped, after writing
+ * the queued messages, when the process exits.
+ * @param stdout_file - the file to write the messages to stdout with, or NULL to not log to stdout
+ * @param log_file - the log file to write the messages to, or NULL to not log to a file
+ * @return - zero on success, non-zero on failure
+ */
+int async_log_start(FILE * stdout_file, FILE * log_file)
+{
+	if (running)
+		return 0;
+
+	message_text.capacity = 1024;
+	message_text.data = (char *)malloc(message_text.capacity);
+	ring_list_mutex = create_mutex();
+	consumer_mutex = create_mutex();
+	if (!message_text.data || !ring_list_mutex || !consumer_mutex)
+		return 1;
+	stdout_sink = stdout_file;
+	file_sink = log_file;
+
+	stopping = 0;
+	if (create_thread(&flusher_thread, flusher_thread_func, NULL))
+		return 1;
+#ifndef _WIN32
+	pthread_atfork(NULL, NULL, async_log_atfork_child);
+#endif
+	running = 1;
+	atexit(async_log_stop);
+	return 0;
+}
+
+/**
+ * This function stops the background thread and writes any queued messages.  Messages that are
+ * logged afterwards are written synchronously.
+ */
+void async_log_stop(void)
+{
+	if (!running)
+		return;
+	stopping = 1;
+	join_thread(flusher_thread);
+	async_log_flush();
+	running = 0;
+}
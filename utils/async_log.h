@@ -0,0 +1,29 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+//The asynchronous logging backend, which log_msg uses when the async logging option is set.  Each
+//thread that logs gets its own single producer ring buffer, which log_msg copies the message's
+//format string and arguments into without taking a lock, and a background thread formats the
+//messages and writes them to the sinks in batches.
+
+//The size of each thread's ring buffer, which must be a power of two
+#define ASYNC_LOG_RING_SIZE (64 * 1024)
+//The largest message, with its format string and copied arguments, that's queued.  Larger messages
+//are written synchronously.
+#define ASYNC_LOG_MAX_RECORD 4096
+//How often the background thread writes the queued messages
+#define ASYNC_LOG_FLUSH_INTERVAL_MS 10
+
+int async_log_start(FILE * stdout_file, FILE * log_file);
+int async_log_msg(enum LOG_LEVEL level, time_t time, const char * msg, va_list args);
+void async_log_flush(void);
+void async_log_stop(void);
+
+//Defined in utils.c, and shared with the synchronous logging
+extern const char * log_level_names[];
+void log_time_string(time_t time, char * buffer, size_t size);
@@ -0,0 +1,273 @@
+#include "corpus_pack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function checks whether a file is a packed corpus, by reading its magic
+ * @param filename - the file to check
+ * @return - 1 if the file starts with the packed corpus magic, 0 otherwise
+ */
+UTILS_API int is_corpus_pack(const char * filename)
+{
+	char magic[CORPUS_PACK_MAGIC_SIZE];
+	FILE * fp;
+	int ret;
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return 0;
+	ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, CORPUS_PACK_MAGIC, sizeof(magic));
+	fclose(fp);
+	return ret;
+}
+
+/**
+ * This function maps a packed corpus into memory, and checks that its index and names lie within the file
+ * @param filename - the packed corpus to open
+ * @return - the mapped pack, which should be freed with corpus_pack_close, or NULL if the file couldn't be
+ * mapped or isn't a valid pack
+ */
+UTILS_API corpus_pack_t * corpus_pack_open(const char * filename)
+{
+	const corpus_pack_header_t * header;
+	const corpus_pack_entry_t * entry;
+	corpus_pack_t * pack;
+	uint64_t index_end;
+	uint32_t i;
+
+	pack = (corpus_pack_t *)calloc(1, sizeof(corpus_pack_t));
+	if (!pack)
+		return NULL;
+	pack->data = map_file(filename, &pack->length);
+	if (!pack->data || pack->length < sizeof(corpus_pack_header_t)) {
+		corpus_pack_close(pack);
+		return NULL;
+	}
+
+	header = (const corpus_pack_header_t *)pack->data;
+	index_end = header->index_offset + (uint64_t)header->count * sizeof(corpus_pack_entry_t);
+	if (memcmp(header->magic, CORPUS_PACK_MAGIC, CORPUS_PACK_MAGIC_SIZE) || header->version != CORPUS_PACK_VERSION
+		|| header->index_offset % 8 || header->index_offset < sizeof(corpus_pack_header_t)
+		|| header->index_offset > pack->length || index_end > pack->length) {
+		ERROR_MSG("%s isn't a valid packed corpus", filename);
+		corpus_pack_close(pack);
+		return NULL;
+	}
+	pack->count = header->count;
+	pack->entries = (const corpus_pack_entry_t *)(pack->data + header->index_offset);
+	pack->names = pack->data + index_end;
+	pack->names_length = pack->length - index_end;
+
+	for (i = 0; i < pack->count; i++)
+	{
+		entry = &pack->entries[i];
+		if (entry->offset > header->index_offset || entry->length > header->index_offset - entry->offset
+			|| entry->name_offset > pack->names_length || entry->name_length > pack->names_length - entry->name_offset) {
+			ERROR_MSG("Entry %u of the packed corpus %s lies outside of the file", i, filename);
+			corpus_pack_close(pack);
+			return NULL;
+		}
+	}
+	return pack;
+}
+
+/**
+ * This function unmaps and frees a packed corpus opened with corpus_pack_open
+ * @param pack - the pack to close
+ */
+UTILS_API void corpus_pack_close(corpus_pack_t * pack)
+{
+	if (!pack)
+		return;
+	if (pack->data)
+		unmap_file(pack->data, pack->length);
+	free(pack);
+}
+
+/**
+ * This function names an entry of a packed corpus for messages and output files, as the pack's filename
+ * followed by the entry's name, or its index if it doesn't have a name, e.g. "corpus.pack:seed1"
+ * @param pack - the pack the entry is in
+ * @param filename - the pack's filename
+ * @param index - the entry's index in the pack
+ * @return - the entry's name, which the caller should free, or NULL on failure
+ */
+UTILS_API char * corpus_pack_entry_filename(const corpus_pack_t * pack, const char * filename, uint32_t index)
+{
+	const corpus_pack_entry_t * entry = &pack->entries[index];
+	size_t length = strlen(filename) + entry->name_length + 16;
+	char * name;
+
+	name = (char *)malloc(length);
+	if (!name)
+		return NULL;
+	if (entry->name_length)
+		snprintf(name, length, "%s:%.*s", filename, (int)entry->name_length, pack->names + entry->name_offset);
+	else
+		snprintf(name, length, "%s:%u", filename, index);
+	return name;
+}
+
+/**
+ * This function writes a buffer to a pack that's being written, or does nothing if an earlier write failed
+ * @param writer - the pack writer
+ * @param data - the buffer to write
+ * @param length - the length of the data parameter
+ * @return - 0 on success, non-zero on failure
+ */
+static int write_pack(corpus_pack_writer_t * writer, const void * data, size_t length)
+{
+	if (!writer->fp || (length && fwrite(data, 1, length, writer->fp) != length))
+		return 1;
+	writer->end += length;
+	return 0;
+}
+
+/**
+ * This function opens a packed corpus to add entries to, creating it if it doesn't exist.  The new entries
+ * aren't part of the pack until corpus_pack_writer_close writes the index.
+ * @param filename - the packed corpus to write
+ * @return - the pack writer, which should be closed with corpus_pack_writer_close, or NULL on failure
+ */
+UTILS_API corpus_pack_writer_t * corpus_pack_writer_open(const char * filename)
+{
+	corpus_pack_writer_t * writer;
+	corpus_pack_header_t header;
+	corpus_pack_t * pack = NULL;
+
+	writer = (corpus_pack_writer_t *)calloc(1, sizeof(corpus_pack_writer_t));
+	if (!writer)
+		return NULL;
+
+	//Keep the existing entries, so the new index lists them too
+	if (file_exists((char *)filename)) {
+		pack = corpus_pack_open(filename);
+		if (!pack) {
+			free(writer);
+			return NULL;
+		}
+		writer->count = writer->capacity = pack->count;
+		writer->names_length = writer->names_capacity = pack->names_length;
+		writer->entries = (corpus_pack_entry_t *)memdup((void *)pack->entries, pack->count * sizeof(corpus_pack_entry_t));
+		writer->names = (char *)memdup((void *)pack->names, pack->names_length);
+		writer->end = pack->length;
+		corpus_pack_close(pack);
+		if ((writer->count && !writer->entries) || (writer->names_length && !writer->names)) {
+			corpus_pack_writer_close(writer);
+			return NULL;
+		}
+		writer->fp = fopen(filename, "r+b");
+		if (writer->fp && fseek(writer->fp, 0, SEEK_END)) {
+			fclose(writer->fp);
+			writer->fp = NULL;
+		}
+	} else {
+		writer->fp = fopen(filename, "w+b");
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CORPUS_PACK_MAGIC, CORPUS_PACK_MAGIC_SIZE);
+		header.version = CORPUS_PACK_VERSION;
+		header.index_offset = sizeof(header);
+		if (writer->fp && write_pack(writer, &header, sizeof(header))) {
+			fclose(writer->fp);
+			writer->fp = NULL;
+		}
+	}
+
+	if (!writer->fp) {
+		ERROR_MSG("Couldn't open the packed corpus %s for writing", filename);
+		corpus_pack_writer_close(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+/**
+ * This function appends an entry to a packed corpus
+ * @param writer - the pack writer, from corpus_pack_writer_open
+ * @param data - the entry's data
+ * @param length - the length of the data parameter
+ * @param name - the entry's name, such as the filename it came from, or NULL
+ * @param metadata - an entry with the parent_hash, coverage_hash, and exec_us to record, or NULL if they aren't
+ * known.  Its other fields are ignored.
+ * @return - 0 on success, non-zero on failure
+ */
+UTILS_API int corpus_pack_writer_add(corpus_pack_writer_t * writer, const char * data, size_t length, const char * name,
+	const corpus_pack_entry_t * metadata)
+{
+	corpus_pack_entry_t * entry, * new_entries;
+	size_t name_length = name ? strlen(name) : 0;
+	char * new_names;
+
+	if (writer->count == UINT32_MAX || writer->names_length + name_length > UINT32_MAX)
+		return 1;
+	if (writer->count == writer->capacity) {
+		new_entries = (corpus_pack_entry_t *)realloc(writer->entries,
+			(writer->capacity ? writer->capacity * 2 : 64) * sizeof(corpus_pack_entry_t));
+		if (!new_entries)
+			return 1;
+		writer->entries = new_entries;
+		writer->capacity = writer->capacity ? writer->capacity * 2 : 64;
+	}
+	if (writer->names_length + name_length > writer->names_capacity) {
+		new_names = (char *)realloc(writer->names, (writer->names_length + name_length) * 2);
+		if (!new_names)
+			return 1;
+		writer->names = new_names;
+		writer->names_capacity = (writer->names_length + name_length) * 2;
+	}
+
+	entry = &writer->entries[writer->count];
+	memset(entry, 0, sizeof(corpus_pack_entry_t));
+	if (metadata) {
+		entry->parent_hash = metadata->parent_hash;
+		entry->coverage_hash = metadata->coverage_hash;
+		entry->exec_us = metadata->exec_us;
+	}
+	entry->offset = writer->end;
+	entry->length = length;
+	entry->hash = fnv1a_hash(data, length);
+	entry->name_offset = (uint32_t)writer->names_length;
+	entry->name_length = (uint32_t)name_length;
+	if (write_pack(writer, data, length))
+		return 1;
+	if (name_length)
+		memcpy(writer->names + writer->names_length, name, name_length);
+	writer->names_length += name_length;
+	writer->count++;
+	return 0;
+}
+
+/**
+ * This function writes the index and names of a packed corpus after the entries' data, points the header at
+ * them, and frees the pack writer
+ * @param writer - the pack writer, from corpus_pack_writer_open
+ * @return - 0 on success, non-zero on failure
+ */
+UTILS_API int corpus_pack_writer_close(corpus_pack_writer_t * writer)
+{
+	static const char padding[8] = { 0 };
+	corpus_pack_header_t header;
+	int ret = 1;
+
+	if (writer->fp) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CORPUS_PACK_MAGIC, CORPUS_PACK_MAGIC_SIZE);
+		header.version = CORPUS_PACK_VERSION;
+		header.count = writer->count;
+		header.index_offset = (writer->end + 7) & ~(uint64_t)7;
+		//The header is only rewritten once the new index is on disk, so a failed write leaves the old pack intact
+		ret = write_pack(writer, padding, (size_t)(header.index_offset - writer->end))
+			|| write_pack(writer, writer->entries, writer->count * sizeof(corpus_pack_entry_t))
+			|| write_pack(writer, writer->names, writer->names_length)
+			|| fflush(writer->fp)
+			|| fseek(writer->fp, 0, SEEK_SET)
+			|| fwrite(&header, sizeof(header), 1, writer->fp) != 1;
+		if (fclose(writer->fp))
+			ret = 1;
+	}
+	free(writer->entries);
+	free(writer->names);
+	free(writer);
+	return ret;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+//A packed corpus holds many inputs in a single file, so a corpus can be copied, shipped to the fleet, and
+//opened as one file instead of thousands of small ones.  The fuzzer (-S), tracer, minimizer, picker, and
+//replay tool accept a pack anywhere they accept a directory of inputs, and map it in place.
+//
+//The layout is (all integers are little endian):
+//  corpus_pack_header_t
+//  the entries' data, in the order they were added
+//  padding, up to a multiple of 8 bytes
+//  corpus_pack_entry_t index[count]
+//  the entries' names, one after another, without NUL terminators
+//
+//The data is append only.  Adding entries to an existing pack writes their data after the end of the file,
+//then a new index and names after that, and finally points the header at the new index, so the pack is valid
+//at every step, and the old index is left behind as unused space.
+
+#define CORPUS_PACK_MAGIC      "KBPACK\r\n"
+#define CORPUS_PACK_MAGIC_SIZE 8
+#define CORPUS_PACK_VERSION    1
+
+typedef struct corpus_pack_header
+{
+	char magic[CORPUS_PACK_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t count;        //The number of entries in the index
+	uint64_t index_offset; //Where the index starts, from the start of the file
+} corpus_pack_header_t;
+
+//An entry of the index.  The metadata fields are 0 when they aren't known.
+typedef struct corpus_pack_entry
+{
+	uint64_t offset;        //Where the entry's data starts, from the start of the file
+	uint64_t length;        //The length of the entry's data
+	uint64_t hash;          //The FNV-1a hash of the entry's data, which load_seed_directory uses to skip duplicates
+	uint64_t parent_hash;   //The hash of the entry that this one was mutated from
+	uint64_t coverage_hash; //A hash of the coverage the entry hit
+	uint64_t exec_us;       //How long the target took to run the entry, in microseconds
+	uint32_t name_offset;   //Where the entry's name starts, from the start of the names
+	uint32_t name_length;   //The length of the entry's name, or 0 if it doesn't have one
+} corpus_pack_entry_t;
+
+//A pack that has been mapped into memory by corpus_pack_open
+typedef struct corpus_pack
+{
+	const char * data;                  //The read only mapping of the whole file
+	size_t length;
+	uint32_t count;
+	const corpus_pack_entry_t * entries;
+	const char * names;
+	size_t names_length;
+} corpus_pack_t;
+
+#define CORPUS_PACK_ENTRY_DATA(pack, i) ((pack)->data + (pack)->entries[i].offset)
+
+typedef struct corpus_pack_writer
+{
+	FILE * fp;
+	uint64_t end;                  //Where the next entry's data goes
+	corpus_pack_entry_t * entries; //The entries already in the pack, followed by the ones added to it
+	uint32_t count, capacity;
+	char * names;
+	size_t names_length, names_capacity;
+} corpus_pack_writer_t;
+
+UTILS_API int is_corpus_pack(const char * filename);
+UTILS_API corpus_pack_t * corpus_pack_open(const char * filename);
+UTILS_API void corpus_pack_close(corpus_pack_t * pack);
+UTILS_API char * corpus_pack_entry_filename(const corpus_pack_t * pack, const char * filename, uint32_t index);
+
+UTILS_API corpus_pack_writer_t * corpus_pack_writer_open(const char * filename);
+UTILS_API int corpus_pack_writer_add(corpus_pack_writer_t * writer, const char * data, size_t length, const char * name,
+	const corpus_pack_entry_t * metadata);
+UTILS_API int corpus_pack_writer_close(corpus_pack_writer_t * writer);
@@ -0,0 +1,504 @@
+#include "fixup.h"
+
+#include <jansson_helper.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)) \
+	&& (defined(__GNUC__) || defined(_MSC_VER))
+#define FIXUP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE42
+#define TARGET_PCLMUL
+#define ALIGN16 __declspec(align(16))
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_PCLMUL __attribute__((target("sse4.1,pclmul")))
+#define ALIGN16 __attribute__((aligned(16)))
+#endif
+#endif
+
+//The bit reflected CRC32 (zlib) and CRC32C (Castagnoli) polynomials
+#define CRC32_POLYNOMIAL  0xEDB88320
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+//The largest number of bytes Adler-32 can sum before its sums have to be reduced, so they don't overflow
+#define ADLER32_BASE 65521
+#define ADLER32_NMAX 5552
+
+//The shortest input that the PCLMULQDQ CRC32 is used for.  It folds 64 bytes at a time.
+#define CRC32_PCLMUL_MIN_LENGTH 64
+
+//The slicing by 8 lookup tables, which process 8 bytes per step
+static uint32_t crc32_table[8][256];
+static uint32_t crc32c_table[8][256];
+static int tables_ready = 0;
+static int use_pclmul = 0;
+static int use_sse42 = 0;
+
+#ifdef FIXUP_X86
+/**
+ * Checks whether the CPU has the SSE4.2 crc32 and the PCLMULQDQ instructions
+ * @param pclmul - used to return whether PCLMULQDQ can be used
+ * @return - 1 if SSE4.2 can be used, 0 otherwise
+ */
+static int cpu_supports_sse42(int * pclmul)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	*pclmul = (info[2] & (1 << 1)) && (info[2] & (1 << 19));
+	return (info[2] & (1 << 20)) != 0;
+#else
+	__builtin_cpu_init();
+	*pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+/**
+ * This function makes the slicing by 8 tables for a bit reflected CRC polynomial
+ * @param table - the tables to fill in
+ * @param polynomial - the polynomial to make the tables for
+ */
+static void make_crc_table(uint32_t table[8][256], uint32_t polynomial)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+		table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+	}
+}
+
+/**
+ * This function makes the CRC tables and picks the CRC implementations the first time they're needed.
+ * That's when the first driver with fix ups is created, before there are any other threads that
+ * could use them.
+ */
+static void init_tables(void)
+{
+	if (tables_ready)
+		return;
+	make_crc_table(crc32_table, CRC32_POLYNOMIAL);
+	make_crc_table(crc32c_table, CRC32C_POLYNOMIAL);
+#ifdef FIXUP_X86
+	use_sse42 = cpu_supports_sse42(&use_pclmul);
+#endif
+	tables_ready = 1;
+}
+
+/**
+ * This function updates a bit reflected CRC with the slicing by 8 tables.
+ * @param table - the polynomial's tables, from make_crc_table
+ * @param crc - the inverted CRC so far
+ * @param buffer - the bytes to add to the CRC
+ * @param length - the length of buffer
+ * @return - the updated inverted CRC
+ */
+static uint32_t crc_slicing_by_8(uint32_t table[8][256], uint32_t crc, const uint8_t * buffer, size_t length)
+{
+	uint32_t low, high;
+
+	while (length >= 8)
+	{
+		low = crc ^ ((uint32_t)buffer[0] | (uint32_t)buffer[1] << 8 | (uint32_t)buffer[2] << 16 | (uint32_t)buffer[3] << 24);
+		high = (uint32_t)buffer[4] | (uint32_t)buffer[5] << 8 | (uint32_t)buffer[6] << 16 | (uint32_t)buffer[7] << 24;
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+			^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		buffer += 8;
+		length -= 8;
+	}
+	while (length--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *buffer++) & 0xff];
+	return crc;
+}
+
+#ifdef FIXUP_X86
+/**
+ * This function updates a CRC32C with the SSE4.2 crc32 instruction.
+ * @param crc - the inverted CRC so far
+ * @param buffer - the bytes to add to the CRC
+ * @param length - the length of buffer
+ * @return - the updated inverted CRC
+ */
+static TARGET_SSE42 uint32_t crc32c_sse42(uint32_t crc, const uint8_t * buffer, size_t length)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc, value;
+
+	while (length >= 8)
+	{
+		memcpy(&value, buffer, sizeof(value));
+		crc64 = _mm_crc32_u64(crc64, value);
+		buffer += 8;
+		length -= 8;
+	}
+	crc = (uint32_t)crc64;
+#else
+	uint32_t value;
+
+	while (length >= 4)
+	{
+		memcpy(&value, buffer, sizeof(value));
+		crc = _mm_crc32_u32(crc, value);
+		buffer += 4;
+		length -= 4;
+	}
+#endif
+	while (length--)
+		crc = _mm_crc32_u8(crc, *buffer++);
+	return crc;
+}
+
+/**
+ * This function updates a CRC32 by folding the input with carry-less multiplication, as described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et al., Intel, 2009).
+ * @param crc - the inverted CRC so far
+ * @param buffer - the bytes to add to the CRC
+ * @param length - the length of buffer, which must be a multiple of 16 and at least CRC32_PCLMUL_MIN_LENGTH
+ * @return - the updated inverted CRC
+ */
+static TARGET_PCLMUL uint32_t crc32_pclmul(uint32_t crc, const uint8_t * buffer, size_t length)
+{
+	//The folding constants for the bit reflected CRC32 polynomial, and the polynomial and its Barrett constant
+	static const uint64_t ALIGN16 k1k2[] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t ALIGN16 k3k4[] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t ALIGN16 k5k0[] = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const uint64_t ALIGN16 poly[] = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buffer + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buffer + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buffer += 64;
+	length -= 64;
+
+	//Fold 64 bytes at a time into the four accumulators
+	while (length >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(buffer + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buffer + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buffer + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buffer + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buffer += 64;
+		length -= 64;
+	}
+
+	//Fold the accumulators into one, and then the rest 16 bytes at a time
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	while (length >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i *)buffer);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buffer += 16;
+		length -= 16;
+	}
+
+	//Fold the 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	//Barrett reduce the 64 bits to the 32 bit CRC
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+/**
+ * This function computes the CRC32 of a buffer, as zlib's crc32 function does.
+ * @param crc - the CRC of the data before the buffer, or 0 to start a new CRC
+ * @param buffer - the data to compute the CRC of
+ * @param length - the length of buffer
+ * @return - the CRC32 of the data so far
+ */
+UTILS_API uint32_t fixup_crc32(uint32_t crc, const char * buffer, size_t length)
+{
+	const uint8_t * data = (const uint8_t *)buffer;
+	size_t folded;
+
+	init_tables();
+	crc = ~crc;
+#ifdef FIXUP_X86
+	if (use_pclmul && length >= CRC32_PCLMUL_MIN_LENGTH) {
+		folded = length & ~(size_t)15;
+		crc = crc32_pclmul(crc, data, folded);
+		data += folded;
+		length -= folded;
+	}
+#endif
+	return ~crc_slicing_by_8(crc32_table, crc, data, length);
+}
+
+/**
+ * This function computes the CRC32C (Castagnoli) of a buffer.
+ * @param crc - the CRC of the data before the buffer, or 0 to start a new CRC
+ * @param buffer - the data to compute the CRC of
+ * @param length - the length of buffer
+ * @return - the CRC32C of the data so far
+ */
+UTILS_API uint32_t fixup_crc32c(uint32_t crc, const char * buffer, size_t length)
+{
+	init_tables();
+#ifdef FIXUP_X86
+	if (use_sse42)
+		return ~crc32c_sse42(~crc, (const uint8_t *)buffer, length);
+#endif
+	return ~crc_slicing_by_8(crc32c_table, ~crc, (const uint8_t *)buffer, length);
+}
+
+/**
+ * This function computes the Adler-32 checksum of a buffer, as zlib's adler32 function does.
+ * @param adler - the checksum of the data before the buffer, or 1 to start a new checksum
+ * @param buffer - the data to compute the checksum of
+ * @param length - the length of buffer
+ * @return - the Adler-32 checksum of the data so far
+ */
+UTILS_API uint32_t fixup_adler32(uint32_t adler, const char * buffer, size_t length)
+{
+	const uint8_t * data = (const uint8_t *)buffer;
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	size_t block;
+
+	//The sums are only reduced once per ADLER32_NMAX bytes, rather than for every byte
+	while (length)
+	{
+		block = length < ADLER32_NMAX ? length : ADLER32_NMAX;
+		length -= block;
+		while (block--)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= ADLER32_BASE;
+		b %= ADLER32_BASE;
+	}
+	return (b << 16) | a;
+}
+
+/**
+ * This function gets an integer attribute of a fix up's field.
+ * @param item - the field's JSON object
+ * @param name - the name of the attribute
+ * @param required - whether the field must have the attribute
+ * @param value - used to return the attribute's value, and left alone if the field doesn't have it
+ * @return - zero on success, or non-zero if the attribute isn't an integer or is missing when it's required
+ */
+static int get_field_integer(json_t * item, const char * name, int required, int64_t * value)
+{
+	int64_t temp;
+	int result;
+
+	temp = (int64_t)get_uint64t_options_from_json(item, name, &result);
+	if (result > 0)
+		*value = temp;
+	return result < 0 || (required && result == 0);
+}
+
+/**
+ * This function parses the "fixups" option of a driver's options.
+ * @param options - the driver's JSON options, or NULL
+ * @param fixups - used to return the fix ups, or NULL if the options don't have any.  They should be
+ * freed with fixups_free.
+ * @return - zero on success, or non-zero if the fix ups are invalid
+ */
+UTILS_API int fixups_create(const char * options, fixups_t ** fixups)
+{
+	static const char * type_names[] = { "length", "crc32", "crc32c", "adler32" };
+	fixups_t * new_fixups;
+	fixup_t * field;
+	json_t * root, * array, * item;
+	char * type;
+	int64_t value, big_endian;
+	size_t i, j;
+	int result, ret = 1;
+
+	*fixups = NULL;
+	if (!options)
+		return 0;
+	root = get_root_option_json_object(options);
+	if (!root)
+		return 1;
+	array = json_object_get(root, "fixups");
+	if (!array) {
+		json_decref(root);
+		return 0;
+	}
+
+	new_fixups = (fixups_t *)calloc(1, sizeof(fixups_t));
+	if (!new_fixups || !json_is_array(array) || !json_array_size(array))
+		goto cleanup;
+	new_fixups->count = json_array_size(array);
+	new_fixups->fields = (fixup_t *)calloc(new_fixups->count, sizeof(fixup_t));
+	if (!new_fixups->fields)
+		goto cleanup;
+
+	for (i = 0; i < new_fixups->count; i++)
+	{
+		item = json_array_get(array, i);
+		field = &new_fixups->fields[i];
+		value = 4;
+		big_endian = 0;
+
+		type = get_string_options_from_json(item, "type", &result);
+		if (result <= 0)
+			goto cleanup;
+		for (j = 0; j < ARRAY_SIZE(type_names) && strcmp(type, type_names[j]); j++);
+		free(type);
+		if (j == ARRAY_SIZE(type_names))
+			goto cleanup;
+		field->type = (enum fixup_type)j;
+
+		if (get_field_integer(item, "offset", 1, &field->offset)
+			|| get_field_integer(item, "start", 0, &field->start)
+			|| get_field_integer(item, "end", 0, &field->end)
+			|| get_field_integer(item, "adjust", 0, &field->adjust)
+			|| get_field_integer(item, "size", 0, &value)
+			|| (value != 1 && value != 2 && value != 4 && value != 8)
+			|| get_field_integer(item, "big_endian", 0, &big_endian))
+			goto cleanup;
+		field->size = (int)value;
+		field->big_endian = big_endian != 0;
+	}
+
+	init_tables();
+	*fixups = new_fixups;
+	new_fixups = NULL;
+	ret = 0;
+
+cleanup:
+	fixups_free(new_fixups);
+	json_decref(root);
+	return ret;
+}
+
+/**
+ * This function frees fix ups from fixups_create.
+ * @param fixups - the fix ups to free, or NULL
+ */
+UTILS_API void fixups_free(fixups_t * fixups)
+{
+	if (!fixups)
+		return;
+	free(fixups->fields);
+	free(fixups);
+}
+
+/**
+ * This function resolves a position of a fix up in an input, where negative positions count back from the end.
+ * @param position - the position to resolve
+ * @param length - the length of the input
+ * @param end - whether the position is the end of a range, in which case zero is the end of the input
+ * @param resolved - used to return the position from the start of the input
+ * @return - zero on success, or non-zero if the position is outside of the input
+ */
+static int resolve_position(int64_t position, size_t length, int end, size_t * resolved)
+{
+	if (position < 0 || (end && position == 0)) {
+		if ((uint64_t)-position > length)
+			return 1;
+		*resolved = length - (size_t)-position;
+	} else {
+		if ((uint64_t)position > length)
+			return 1;
+		*resolved = (size_t)position;
+	}
+	return 0;
+}
+
+/**
+ * This function rewrites the checksum and length fields of a mutated input.
+ * @param fixups - the fix ups to apply, or NULL
+ * @param buffer - the input to fix
+ * @param length - the length of buffer
+ */
+UTILS_API void fixups_apply(fixups_t * fixups, char * buffer, size_t length)
+{
+	fixup_t * field;
+	size_t i, offset, start, end;
+	uint64_t value;
+	int j;
+
+	for (i = 0; fixups && i < fixups->count; i++)
+	{
+		field = &fixups->fields[i];
+		if (resolve_position(field->offset, length, 0, &offset) || offset + field->size > length
+			|| resolve_position(field->start, length, 0, &start) || resolve_position(field->end, length, 1, &end)
+			|| start > end)
+			continue;
+
+		switch (field->type)
+		{
+		case FIXUP_LENGTH:
+			value = end - start;
+			break;
+		case FIXUP_CRC32:
+			value = fixup_crc32(0, buffer + start, end - start);
+			break;
+		case FIXUP_CRC32C:
+			value = fixup_crc32c(0, buffer + start, end - start);
+			break;
+		default:
+			value = fixup_adler32(1, buffer + start, end - start);
+			break;
+		}
+		value += (uint64_t)field->adjust;
+
+		for (j = 0; j < field->size; j++)
+		{
+			buffer[offset + (field->big_endian ? field->size - 1 - j : j)] = (char)(value & 0xff);
+			value >>= 8;
+		}
+	}
+}
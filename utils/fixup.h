@@ -0,0 +1,59 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//The fix ups rewrite the checksum and length fields of a mutated input, so that targets that check them
+//don't reject most of the mutations before they get to the interesting code.  They're given in a driver's
+//options as a "fixups" array, with an object for each field, e.g. for a zlib stream's Adler-32 trailer:
+//	"fixups": [{"type": "adler32", "offset": -4, "start": 2, "end": -4, "big_endian": 1}]
+//Each field has these attributes:
+//	type       - "crc32" (as in zlib, PNG and ZIP), "crc32c" (Castagnoli, as in iSCSI and ext4), "adler32",
+//	             or "length", the number of bytes in the range
+//	offset     - where the field is written
+//	start, end - the range of bytes the field covers, by default the whole input
+//	size       - the size of the field in bytes, 1, 2, 4 or 8 (optional, 4 by default)
+//	big_endian - whether the field is big endian (optional, 0 by default)
+//	adjust     - a value to add to the field (optional, 0 by default)
+//A negative offset, start or end counts back from the end of the input, as does an end of zero.  The fields
+//are fixed in order, so a length field should come before a checksum that covers it.  A field that doesn't
+//fit in a mutated input is left alone.
+//
+//CRC32 uses carry-less multiplication (PCLMULQDQ) and CRC32C uses the SSE4.2 crc32 instruction on x86 CPUs
+//that have them, and lookup tables otherwise.
+
+enum fixup_type
+{
+	FIXUP_LENGTH,
+	FIXUP_CRC32,
+	FIXUP_CRC32C,
+	FIXUP_ADLER32
+};
+
+struct fixup
+{
+	enum fixup_type type;
+	int64_t offset;
+	int64_t start;
+	int64_t end;
+	int size;
+	int big_endian;
+	int64_t adjust;
+};
+typedef struct fixup fixup_t;
+
+struct fixups
+{
+	fixup_t * fields;
+	size_t count;
+};
+typedef struct fixups fixups_t;
+
+UTILS_API int fixups_create(const char * options, fixups_t ** fixups);
+UTILS_API void fixups_free(fixups_t * fixups);
+UTILS_API void fixups_apply(fixups_t * fixups, char * buffer, size_t length);
+UTILS_API uint32_t fixup_crc32(uint32_t crc, const char * buffer, size_t length);
+UTILS_API uint32_t fixup_crc32c(uint32_t crc, const char * buffer, size_t length);
+UTILS_API uint32_t fixup_adler32(uint32_t adler, const char * buffer, size_t length);
@@ -18,6 +18,26 @@
  * This flag signifies that the mutations should be done in a thread safe way.
  */
 #define MUTATE_THREAD_SAFE (1 << 17)
+/**
+ * This flag signifies that the buffer hasn't been changed since the mutator last mutated
+ * into it, so a mutator that remembers which bytes its last mutation changed only needs to
+ * put those bytes back, rather than copying the whole input into the buffer again.
+ */
+#define MUTATE_BUFFER_UNCHANGED (1 << 18)
+
+/**
+ * A mutate buffer that can grow, which is passed to a mutator's mutate_growable function.  The reserve
+ * function makes room for at least length bytes, keeping the buffer's contents but possibly moving data,
+ * and returns zero on success, or non-zero if the buffer can't grow that large.
+ */
+typedef struct growable_buffer growable_buffer_t;
+struct growable_buffer
+{
+	char * data;
+	size_t capacity;
+	size_t max_capacity;
+	int(*reserve)(growable_buffer_t * buffer, size_t length);
+};
 
 typedef struct mutator
 {
@@ -37,4 +57,27 @@ typedef struct mutator
 
 	int(*set_input)(void * mutator_state, char * new_input, size_t input_length);
 	int(*help)(char **help_str);
+
+	//Optional, tells the mutator how the input it last generated fared, so it can adapt its mutations.
+	//fuzz_result is one of the FUZZ_ results and new_path is the instrumentation's is_new_path result.
+	//path_hash is the hash of the input's path, or NULL if the instrumentation doesn't provide one.
+	void(*report_result)(void * mutator_state, int fuzz_result, int new_path, uint64_t * path_hash);
+
+	//Optional, creates an independent copy of the mutator state that another thread can mutate with
+	//without locking.  The copy gets its own random stream, and the original's stream skips past it.
+	void * (*clone_state)(void * mutator_state);
+	//Optional, adds the progress made with a cloned state, such as its iterations, back into the original.
+	//The cloned state still needs to be freed with cleanup.
+	void(*merge_state)(void * mutator_state, void * cloned_state);
+
+	//Optional, generates up to count mutations in one call, packed one after another into the arena.  Each
+	//mutation's offset in the arena and length are returned in the offsets and lengths arrays.  It's thread
+	//safe, and returns the number of mutations generated, fewer than count once the mutator runs out of
+	//mutations, or -1 on error.  Use mutator_mutate_batch to call it.
+	int(*mutate_batch)(void * mutator_state, char * arena, size_t capacity, size_t * offsets, size_t * lengths, size_t count);
+
+	//Optional, mutates the input into a growable buffer, which the mutator grows with its reserve function when
+	//a mutation needs more room, rather than cutting the mutation short.  It takes the same flags and returns
+	//the same values as mutate_extended.  Use mutator_mutate_growable to call it.
+	int(*mutate_growable)(void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
 } mutator_t;
@@ -1,5 +1,6 @@
 #include "mutator_factory.h"
 #include "utils.h"
+#include "uring.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -14,13 +15,31 @@
 #include <sys/types.h>
 #endif
 
+//The mutators linked into the binary, which are used instead of loading the mutator libraries
+static builtin_mutator_t * builtin_mutators = NULL;
+static size_t builtin_mutators_count = 0;
+
+/**
+ * Registers the mutators that are linked into the binary.  Afterwards, mutator_factory_directory creates
+ * these mutators without loading a library, and mutator_help only describes these mutators.
+ * @param mutators - an array of the mutators linked into the binary, which must stay valid while the
+ * mutator factory functions are used
+ * @param count - the number of entries in the mutators parameter
+ */
+UTILS_API void mutator_factory_set_builtins(builtin_mutator_t * mutators, size_t count)
+{
+	builtin_mutators = mutators;
+	builtin_mutators_count = count;
+}
+
 /**
  * Looks in a directory and retrieves a list of filenames of library files in that directory
  * @param directory - the directory to look for the library files in
  * @param num_libraries - a pointer to an int in which to return the number of library files found
- * @return - a pointer to a list of library files on success, or NULL if no library files were found
+ * @return - a pointer to a list of library files on success, or NULL if no library files were found.
+ * The caller should free each of the filenames and the list.
  */
-static char ** get_mutator_library_filenames(char * directory, int * num_libraries)
+UTILS_API char ** get_mutator_library_filenames(char * directory, int * num_libraries)
 {
 	int num_files = 0;
 	char ** mutator_dlls = NULL;
@@ -80,8 +99,8 @@ static char ** get_mutator_library_filenames(char * directory, int * num_librari
 				mutator_dlls[num_files - 1] = strdup(filename);
 			}
 		}
+		closedir(dfd);
 	}
-	closedir(dfd);
 
 #endif
 
@@ -116,8 +135,9 @@ UTILS_API mutator_t * mutator_factory(char * mutator_filename)
 		return NULL;
 	}
 
-	//Call the mutator's init function to initailize the mutators struct
-	ret = (mutator_t *)malloc(sizeof(mutator_t));
+	//Call the mutator's init function to initailize the mutators struct.  It's zeroed first, so
+	//the optional functions are NULL for mutators built before they were added.
+	ret = (mutator_t *)calloc(1, sizeof(mutator_t));
 	init_ptr(ret);
 	return ret;
 }
@@ -146,8 +166,28 @@ static void generate_mutator_filename(char * mutator_directory, char * mutator_t
 	}
 }
 
+/**
+ * This function finds a mutator registered with mutator_factory_set_builtins.
+ * @param mutator_type - the name of the mutator, with or without the _mutator suffix
+ * @return - the builtin mutator, or NULL if there isn't one with that name
+ */
+static builtin_mutator_t * find_builtin_mutator(char * mutator_type)
+{
+	size_t i, length;
+
+	for (i = 0; i < builtin_mutators_count; i++)
+	{
+		length = strlen(builtin_mutators[i].name);
+		if (!strncmp(builtin_mutators[i].name, mutator_type, length)
+			&& (!mutator_type[length] || !strcmp(mutator_type + length, "_mutator")))
+			return &builtin_mutators[i];
+	}
+	return NULL;
+}
+
 /**
  * This function obtains a mutator_t object by calling the mutator specified by mutator's init method.
+ * Mutators registered with mutator_factory_set_builtins are used before looking in the mutator directory.
  * @param mutator_directory - the directory to load the mutator library file from.
  * @param mutator_type - the name of the mutator that should be created.
  * @return - a instrumentation_t object of the specified type on success or NULL on failure
@@ -155,8 +195,17 @@ static void generate_mutator_filename(char * mutator_directory, char * mutator_t
 UTILS_API mutator_t * mutator_factory_directory(char * mutator_directory, char * mutator_type)
 {
 	char filename[MAX_PATH];
+	builtin_mutator_t * builtin;
 	mutator_t * ret;
 
+	builtin = find_builtin_mutator(mutator_type);
+	if (builtin) {
+		ret = (mutator_t *)calloc(1, sizeof(mutator_t));
+		if (ret)
+			builtin->init(ret);
+		return ret;
+	}
+
 	generate_mutator_filename(mutator_directory, mutator_type, 0, filename, sizeof(filename));
 	ret = mutator_factory(filename);
 	if (!ret) {
@@ -167,22 +216,83 @@ UTILS_API mutator_t * mutator_factory_directory(char * mutator_directory, char *
 }
 
 /**
- * This function returns help text for all the mutators found in the specified mutator directory.  This help text will
- * describe the mutators and any options that can be passed to their create functions.
- * @param mutator_directory - The directory to look for mutator libraries in
- * @return - a newly allocated string containing the help text.
+ * This function appends a mutator's help text to a help string.
+ * @param text - the help string to append to
+ * @param help_ptr - the mutator's help function
+ * @return - the help string, which may have moved
  */
-UTILS_API char * mutator_help(char * mutator_directory)
+static char * append_mutator_help(char * text, int(*help_ptr)(char **))
+{
+	char * new_text = NULL;
+
+	if (!help_ptr(&new_text)) //Call help() and check for failure
+	{
+		text = (char *)realloc(text, strlen(text) + strlen(new_text) + 1);
+		strcat(text, new_text);
+		free(new_text);
+	}
+	return text;
+}
+
+/**
+ * This function loads a mutator library and appends its help text to a help string.
+ * @param text - the help string to append to
+ * @param filename - the mutator library to load
+ * @return - the help string, which may have moved
+ */
+static char * append_library_help(char * text, char * filename)
 {
 #ifdef _WIN32
 	HINSTANCE handle;
 #else
 	void * handle;
 #endif
+	int(*help_ptr)(char **);
+
+#ifdef _WIN32
+	handle = LoadLibrary(filename);
+#else
+	handle = dlopen(filename, RTLD_LAZY);
+#endif
+	if (!handle) //if we couldn't load the library, just continue
+		return text;
+#ifdef _WIN32
+	help_ptr = (int(*)(char **))GetProcAddress(handle, "help");
+#else
+	help_ptr = (int(*)(char **))dlsym(handle, "help");
+#endif
+	if (help_ptr) //The library has a help function
+		text = append_mutator_help(text, help_ptr);
+#ifdef _WIN32
+	FreeLibrary(handle);
+#else
+	dlclose(handle);
+#endif
+	return text;
+}
+
+/**
+ * This function returns help text for all the mutators found in the specified mutator directory.  This help text will
+ * describe the mutators and any options that can be passed to their create functions.
+ * @param mutator_directory - The directory to look for mutator libraries in
+ * @return - a newly allocated string containing the help text.
+ */
+UTILS_API char * mutator_help(char * mutator_directory)
+{
 	int num_libraries = 0, i;
 	char ** mutator_libraries;
-	int(*help_ptr)(char **);
-	char * text = NULL, * new_text = NULL;
+	char * text = NULL;
+	size_t j;
+
+	if (builtin_mutators_count)
+	{
+		text = strdup("\nMutator Options:\n\n");
+		for (j = 0; j < builtin_mutators_count; j++)
+			text = append_mutator_help(text, builtin_mutators[j].help);
+		text = (char *)realloc(text, strlen(text) + 2);
+		strcat(text, "\n");
+		return text;
+	}
 
 	mutator_libraries = get_mutator_library_filenames(mutator_directory, &num_libraries);
 	if (!num_libraries)
@@ -194,35 +304,199 @@ UTILS_API char * mutator_help(char * mutator_directory)
 	text = strdup("\nMutator Options:\n\n");
 	for (i = 0; i < num_libraries; i++)
 	{
-#ifdef _WIN32
-		handle = LoadLibrary(mutator_libraries[i]);
-#else
-		handle = dlopen(mutator_libraries[i], RTLD_LAZY);
-#endif
-		if (!handle) //if we couldn't load the library, just continue
-			continue;
-#ifdef _WIN32
-		help_ptr = (int(*)(char **))GetProcAddress(handle, "help");
-#else
-		help_ptr = (int(*)(char **))dlsym(handle, "help");
-#endif
-		if (help_ptr) {//The library has a help function
-			if (!help_ptr(&new_text)) //Call help() and check for failure
-			{
-				text = (char *)realloc(text, strlen(text) + strlen(new_text) + 1);
-				strcat(text, new_text);
-				free(new_text);
-			}
+		text = append_library_help(text, mutator_libraries[i]);
+		free(mutator_libraries[i]);
+	}
+	text = (char *)realloc(text, strlen(text) + 2);
+	strcat(text, "\n");
+	free(mutator_libraries);
+	return text;
+}
+
+/**
+ * This function returns help text for a single mutator, only loading that mutator's library, rather than
+ * every library in the mutator directory like mutator_help does.
+ * @param mutator_directory - The directory to look for the mutator library in
+ * @param mutator_type - the name of the mutator to describe
+ * @return - a newly allocated string containing the help text, or NULL if the mutator couldn't be found
+ */
+UTILS_API char * mutator_type_help(char * mutator_directory, char * mutator_type)
+{
+	char filename[MAX_PATH], * text;
+	builtin_mutator_t * builtin;
+	size_t length;
+
+	text = strdup("\nMutator Options:\n\n");
+	length = strlen(text);
+	builtin = find_builtin_mutator(mutator_type);
+	if (builtin)
+		text = append_mutator_help(text, builtin->help);
+	else {
+		generate_mutator_filename(mutator_directory, mutator_type, 0, filename, sizeof(filename));
+		text = append_library_help(text, filename);
+		if (strlen(text) == length) {
+			generate_mutator_filename(mutator_directory, mutator_type, 1, filename, sizeof(filename));
+			text = append_library_help(text, filename);
 		}
+	}
+	if (strlen(text) == length) {
+		printf("ERROR: Could not find the %s mutator in %s\n", mutator_type, mutator_directory);
+		free(text);
+		return NULL;
+	}
+	text = (char *)realloc(text, strlen(text) + 2);
+	strcat(text, "\n");
+	return text;
+}
+
+/**
+ * This function loads every mutator library in the mutator directory, and keeps them loaded, so that a
+ * process that's forked afterwards finds the library it needs already loaded and relocated.
+ * @param mutator_directory - The directory to look for mutator libraries in
+ * @return - the number of libraries that were loaded
+ */
+UTILS_API int mutator_factory_preload(char * mutator_directory)
+{
+	int num_libraries = 0, loaded = 0, i;
+	char ** mutator_libraries;
+
+	if (builtin_mutators_count)
+		return 0;
+	mutator_libraries = get_mutator_library_filenames(mutator_directory, &num_libraries);
+	for (i = 0; i < num_libraries; i++)
+	{
 #ifdef _WIN32
-		FreeLibrary(handle);
+		if (LoadLibrary(mutator_libraries[i]))
 #else
-		dlclose(handle);
+		if (dlopen(mutator_libraries[i], RTLD_NOW))
 #endif
-		handle = NULL;
+			loaded++;
+		free(mutator_libraries[i]);
 	}
-	text = (char *)realloc(text, strlen(text) + 2);
-	strcat(text, "\n");
 	free(mutator_libraries);
-	return text;
+	return loaded;
+}
+
+/**
+ * This function generates several mutations into an arena, using the mutator's mutate_batch function if it
+ * has one, so that the mutator can amortize its per mutation setup and locking across the batch.  Otherwise,
+ * the mutations are generated one at a time with mutate_extended.  Each mutation is given capacity / count
+ * bytes of room, but the mutations are packed one after another, so shorter ones leave room at the end.
+ * @param mutator - the mutator to generate the mutations with
+ * @param mutator_state - the mutator's state
+ * @param arena - the buffer to write the mutations to
+ * @param capacity - the size of the arena parameter
+ * @param offsets - an array of count size_ts, used to return each mutation's offset in the arena
+ * @param lengths - an array of count size_ts, used to return each mutation's length
+ * @param count - the number of mutations to generate
+ * @return - the number of mutations generated, which is fewer than count if the mutator ran out of
+ * mutations, or -1 on error
+ */
+UTILS_API int mutator_mutate_batch(mutator_t * mutator, void * mutator_state, char * arena, size_t capacity,
+	size_t * offsets, size_t * lengths, size_t count)
+{
+	size_t i, offset = 0, room;
+	int length;
+
+	if (mutator->mutate_batch)
+		return mutator->mutate_batch(mutator_state, arena, capacity, offsets, lengths, count);
+
+	if (!count)
+		return 0;
+	room = capacity / count;
+	for (i = 0; i < count; i++)
+	{
+		length = mutator->mutate_extended(mutator_state, arena + offset, room, MUTATE_THREAD_SAFE);
+		if (length < 0)
+			return -1;
+		if (length == 0)
+			break;
+		offsets[i] = offset;
+		lengths[i] = length;
+		offset += length;
+	}
+	return (int)i;
+}
+
+/**
+ * This function mutates an input into a growable buffer, using the mutator's mutate_growable function if it
+ * has one.  Otherwise, the input is mutated with mutate_extended into the buffer's current capacity.
+ * @param mutator - the mutator to mutate the input with
+ * @param mutator_state - the mutator's state
+ * @param buffer - the buffer to write the mutated input to, which is grown if the mutation needs more room
+ * @param flags - the mutate flags to pass to the mutator
+ * @return - the length of the mutated data, 0 when the mutator is out of mutations, or -1 on error
+ */
+UTILS_API int mutator_mutate_growable(mutator_t * mutator, void * mutator_state, growable_buffer_t * buffer, uint64_t flags)
+{
+	if (mutator->mutate_growable)
+		return mutator->mutate_growable(mutator_state, buffer, flags);
+	return mutator->mutate_extended(mutator_state, buffer->data, buffer->capacity, flags);
+}
+
+/**
+ * This function is a growable buffer's reserve function.  The buffer grows by at least half of its capacity
+ * each time, so that a run of slightly larger mutations doesn't reallocate it for each one.
+ * @param buffer - the buffer to grow
+ * @param length - the number of bytes the buffer needs room for
+ * @return - zero on success, or non-zero if the buffer would be larger than its max_capacity or it couldn't
+ * be reallocated
+ */
+static int growable_buffer_reserve(growable_buffer_t * buffer, size_t length)
+{
+	size_t capacity;
+	char * data;
+
+	if (length <= buffer->capacity)
+		return 0;
+	if (length > buffer->max_capacity)
+		return 1;
+
+	capacity = buffer->capacity + buffer->capacity / 2;
+	if (capacity < length)
+		capacity = length;
+	if (capacity > buffer->max_capacity)
+		capacity = buffer->max_capacity;
+
+	//The old buffer may have been registered for io_uring writes, and its pages may be reused
+	uring_unregister_buffer(buffer->data);
+	data = (char *)realloc(buffer->data, capacity);
+	if (!data)
+		return 1;
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return 0;
+}
+
+/**
+ * This function allocates a growable buffer.
+ * @param buffer - the growable_buffer_t to set up
+ * @param capacity - the buffer's starting size
+ * @param max_capacity - the largest that the buffer may grow to.  If it's less than capacity, the buffer
+ * can't grow.
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int growable_buffer_init(growable_buffer_t * buffer, size_t capacity, size_t max_capacity)
+{
+	if (!capacity)
+		return 1;
+	buffer->data = (char *)malloc(capacity);
+	if (!buffer->data)
+		return 1;
+	buffer->capacity = capacity;
+	buffer->max_capacity = max_capacity > capacity ? max_capacity : capacity;
+	buffer->reserve = growable_buffer_reserve;
+	return 0;
+}
+
+/**
+ * This function frees a growable buffer's memory.
+ * @param buffer - the buffer to free, which was set up with growable_buffer_init
+ */
+UTILS_API void growable_buffer_free(growable_buffer_t * buffer)
+{
+	uring_unregister_buffer(buffer->data);
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->capacity = 0;
 }
@@ -2,6 +2,24 @@
 #include <global_types.h>
 #include <utils.h>
 
+//A mutator that is linked into the binary, rather than loaded from a library in the mutator directory
+struct builtin_mutator
+{
+	char * name;
+	void (*init)(mutator_t * m);
+	int (*help)(char ** help_str);
+};
+typedef struct builtin_mutator builtin_mutator_t;
+
 UTILS_API mutator_t * mutator_factory(char * mutator_filename);
 UTILS_API mutator_t * mutator_factory_directory(char * mutator_directory, char * mutator_type);
 UTILS_API char * mutator_help(char * mutator_directory);
+UTILS_API char * mutator_type_help(char * mutator_directory, char * mutator_type);
+UTILS_API int mutator_factory_preload(char * mutator_directory);
+UTILS_API char ** get_mutator_library_filenames(char * directory, int * num_libraries);
+UTILS_API void mutator_factory_set_builtins(builtin_mutator_t * mutators, size_t count);
+UTILS_API int mutator_mutate_batch(mutator_t * mutator, void * mutator_state, char * arena, size_t capacity,
+	size_t * offsets, size_t * lengths, size_t count);
+UTILS_API int mutator_mutate_growable(mutator_t * mutator, void * mutator_state, growable_buffer_t * buffer, uint64_t flags);
+UTILS_API int growable_buffer_init(growable_buffer_t * buffer, size_t capacity, size_t max_capacity);
+UTILS_API void growable_buffer_free(growable_buffer_t * buffer);
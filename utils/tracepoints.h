@@ -0,0 +1,83 @@
+#pragma once
+
+#include "utils.h"
+
+//Static tracepoints on the fuzz loop's hot path, so profilers can be attached to a running fuzzer
+//without rebuilding it.  On Linux, these are USDT probes of the killerbeez provider, which can be
+//listed with `bpftrace -l 'usdt:/path/to/fuzzer:killerbeez:*'` or `perf list sdt_killerbeez:*`
+//(after `perf buildid-cache --add`).  They need <sys/sdt.h>, from the systemtap-sdt-dev or
+//systemtap-sdt-devel package, and are left out of builds without it.  On Windows, these are ETW
+//TraceLogging events of the Killerbeez provider, {8282f357-f0ee-52c2-c74e-cae74ebd169c}, which
+//WPR, xperf, or WPA can record as *Killerbeez.  Either way, a tracepoint that nothing is attached
+//to costs a NOP (USDT) or a test of the provider's enabled flag (ETW).  Defining
+//KILLERBEEZ_NO_TRACEPOINTS removes them entirely.
+//
+//The tracepoints and their arguments:
+//  iteration_start(worker, iteration)      - a worker started testing an input
+//  mutate_done(length)                     - the mutator produced an input, or returned 0 or -1
+//  target_spawned(pid)                     - the fork server or spawn started a target process
+//  target_exited(pid, status)              - the fork server reported a target's waitpid status
+//  novelty_decided(worker, result, new)    - the instrumentation decided if the input found a new path
+//  finding_saved(kind, length)             - an input was queued to be written to the crashes, hangs,
+//                                            or new_paths directory (kind is the directory's name)
+
+#if !defined(KILLERBEEZ_NO_TRACEPOINTS) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define KILLERBEEZ_USDT_TRACEPOINTS
+#endif
+#endif
+
+#if !defined(KILLERBEEZ_NO_TRACEPOINTS) && defined(_WIN32) && !defined(__MINGW32__)
+#define KILLERBEEZ_ETW_TRACEPOINTS
+#endif
+
+UTILS_API void tracepoints_register(void);
+UTILS_API void tracepoints_unregister(void);
+
+#if defined(KILLERBEEZ_USDT_TRACEPOINTS)
+
+#include <sys/sdt.h>
+
+#define TRACEPOINT_ITERATION_START(worker, iteration) DTRACE_PROBE2(killerbeez, iteration_start, worker, iteration)
+#define TRACEPOINT_MUTATE_DONE(length)                DTRACE_PROBE1(killerbeez, mutate_done, length)
+#define TRACEPOINT_TARGET_SPAWNED(pid)                DTRACE_PROBE1(killerbeez, target_spawned, pid)
+#define TRACEPOINT_TARGET_EXITED(pid, status)         DTRACE_PROBE2(killerbeez, target_exited, pid, status)
+#define TRACEPOINT_NOVELTY_DECIDED(worker, result, new_path) \
+	DTRACE_PROBE3(killerbeez, novelty_decided, worker, result, new_path)
+#define TRACEPOINT_FINDING_SAVED(kind, length)        DTRACE_PROBE2(killerbeez, finding_saved, kind, length)
+
+#elif defined(KILLERBEEZ_ETW_TRACEPOINTS)
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+
+//Defined in utils.c, and registered by tracepoints_register
+TRACELOGGING_DECLARE_PROVIDER(killerbeez_trace_provider);
+
+#define TRACEPOINT_ITERATION_START(worker, iteration) \
+	TraceLoggingWrite(killerbeez_trace_provider, "IterationStart", \
+		TraceLoggingInt32((int)(worker), "Worker"), TraceLoggingInt32((int)(iteration), "Iteration"))
+#define TRACEPOINT_MUTATE_DONE(length) \
+	TraceLoggingWrite(killerbeez_trace_provider, "MutateDone", TraceLoggingInt64((long long)(length), "Length"))
+#define TRACEPOINT_TARGET_SPAWNED(pid) \
+	TraceLoggingWrite(killerbeez_trace_provider, "TargetSpawned", TraceLoggingUInt32((unsigned long)(pid), "Pid"))
+#define TRACEPOINT_TARGET_EXITED(pid, status) \
+	TraceLoggingWrite(killerbeez_trace_provider, "TargetExited", \
+		TraceLoggingUInt32((unsigned long)(pid), "Pid"), TraceLoggingInt32((int)(status), "Status"))
+#define TRACEPOINT_NOVELTY_DECIDED(worker, result, new_path) \
+	TraceLoggingWrite(killerbeez_trace_provider, "NoveltyDecided", TraceLoggingInt32((int)(worker), "Worker"), \
+		TraceLoggingInt32((int)(result), "Result"), TraceLoggingInt32((int)(new_path), "NewPath"))
+#define TRACEPOINT_FINDING_SAVED(kind, length) \
+	TraceLoggingWrite(killerbeez_trace_provider, "FindingSaved", \
+		TraceLoggingString(kind, "Kind"), TraceLoggingInt64((long long)(length), "Length"))
+
+#else
+
+#define TRACEPOINT_ITERATION_START(worker, iteration)         do { } while (0)
+#define TRACEPOINT_MUTATE_DONE(length)                        do { } while (0)
+#define TRACEPOINT_TARGET_SPAWNED(pid)                        do { } while (0)
+#define TRACEPOINT_TARGET_EXITED(pid, status)                 do { } while (0)
+#define TRACEPOINT_NOVELTY_DECIDED(worker, result, new_path)  do { } while (0)
+#define TRACEPOINT_FINDING_SAVED(kind, length)                do { } while (0)
+
+#endif
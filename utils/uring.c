@@ -0,0 +1,516 @@
+#include "uring.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#define THREAD_LOCAL __thread
+
+//Added in Linux 6.9, after the io_uring.h that some distributions ship.  It's only used if the
+//kernel's probe says that it's supported.
+#define URING_OP_FTRUNCATE 55
+//The most buffers that are written with one writev request
+#define URING_MAX_IOV 1024
+
+//One thread's ring, and what's registered with it
+struct uring
+{
+	int fd;                        //The ring's file descriptor, or -1 if it isn't set up
+	int failed;                    //Whether setting up the ring failed, so it's not retried
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	struct io_uring_sqe * sqes;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+	void * sq_ring;
+	size_t sq_ring_size;
+	void * cq_ring;                //The same as sq_ring, if the kernel maps both rings at once
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	int has_ftruncate;             //Whether a file can be truncated in a chain of requests
+	int has_direct_files;          //Whether a file can be opened into the ring's file table
+	const char * registered;       //The registered buffer, or NULL if there isn't one
+	size_t registered_length;
+
+	struct uring * next;
+};
+
+static volatile int enabled = 0;
+static struct uring * rings = NULL;           //All of the threads' rings, which are never freed
+static THREAD_LOCAL struct uring * thread_ring = NULL;
+static mutex_t ring_list_mutex = NULL;         //Taken to add to or walk rings
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params * params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * This function unmaps a ring's queues and closes it.
+ * @param ring - the ring to close
+ */
+static void close_ring(struct uring * ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->sqes = NULL;
+	ring->cq_ring = ring->sq_ring = NULL;
+	ring->fd = -1;
+	ring->registered = NULL;
+	ring->registered_length = 0;
+}
+
+/**
+ * This function asks the kernel which of the operations that the backend uses it supports.
+ * @param ring - the ring to probe, whose has_ members are set
+ * @return - zero if the kernel supports the operations that every write needs, non-zero otherwise
+ */
+static int probe_ring(struct uring * ring)
+{
+	struct io_uring_probe * probe;
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	int fds[1] = { -1 };
+	int ret;
+
+#define SUPPORTED(op) ((op) < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+	probe = (struct io_uring_probe *)calloc(1, size);
+	if (!probe)
+		return 1;
+	if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		free(probe);
+		return 1;
+	}
+	ret = !SUPPORTED(IORING_OP_WRITE) || !SUPPORTED(IORING_OP_WRITE_FIXED);
+	ring->has_ftruncate = SUPPORTED(URING_OP_FTRUNCATE);
+	ring->has_direct_files = SUPPORTED(IORING_OP_OPENAT) && SUPPORTED(IORING_OP_WRITEV) && SUPPORTED(IORING_OP_CLOSE);
+	free(probe);
+#undef SUPPORTED
+
+	//New files are opened into the one, initially empty, slot of the ring's file table, so the
+	//chain of requests that writes them doesn't need a file descriptor in between
+	if (ring->has_direct_files && sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, fds, 1) < 0)
+		ring->has_direct_files = 0;
+	return ret;
+}
+
+/**
+ * This function sets up a ring, and maps its queues.
+ * @param ring - the ring to set up
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_ring(struct uring * ring)
+{
+	struct io_uring_params params;
+	char * sq;
+	char * cq;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+	if (ring->fd < 0)
+		return 1;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto error;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto error;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+
+	sq = (char *)ring->sq_ring;
+	cq = (char *)ring->cq_ring;
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	if (probe_ring(ring))
+		goto error;
+	return 0;
+
+error:
+	close_ring(ring);
+	return 1;
+}
+
+/**
+ * This function gets the calling thread's ring, setting it up if this is the first time the thread
+ * has used the backend.
+ * @return - the calling thread's ring, or NULL if the backend is off or the ring couldn't be set up
+ */
+static struct uring * get_thread_ring(void)
+{
+	struct uring * ring = thread_ring;
+
+	if (!enabled)
+		return NULL;
+	if (!ring) {
+		ring = (struct uring *)calloc(1, sizeof(struct uring));
+		if (!ring)
+			return NULL;
+		ring->fd = -1;
+		take_mutex(ring_list_mutex);
+		ring->next = rings;
+		rings = ring;
+		release_mutex(ring_list_mutex);
+		thread_ring = ring;
+	}
+	if (ring->fd < 0 && !ring->failed && setup_ring(ring)) {
+		WARNING_MSG("Couldn't set up an io_uring for this thread, using the regular system calls instead");
+		ring->failed = 1;
+	}
+	return ring->fd < 0 ? NULL : ring;
+}
+
+/**
+ * This function gets a cleared submission queue entry.  The ring's queue must have room for it,
+ * which it always does, since every chain of requests is waited on before the next is queued.
+ * @param ring - the ring to get the submission queue entry from
+ * @param queued - the number of entries that have been queued since the last submission
+ * @return - the submission queue entry
+ */
+static struct io_uring_sqe * get_sqe(struct uring * ring, unsigned queued)
+{
+	unsigned tail = *ring->sq_tail + queued;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe * sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	sqe->user_data = queued;
+	return sqe;
+}
+
+/**
+ * This function submits the queued requests, and waits for all of them to complete.
+ * @param ring - the ring to submit the requests to
+ * @param count - the number of requests that have been queued
+ * @param results - an array of count results, which is filled in with each request's result
+ * @return - zero on success, or non-zero if the requests couldn't be submitted or waited on
+ */
+static int submit_and_wait(struct uring * ring, unsigned count, int * results)
+{
+	struct io_uring_cqe * cqe;
+	unsigned head, completed = 0;
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+	ret = sys_io_uring_enter(ring->fd, count, count, IORING_ENTER_GETEVENTS);
+	if (ret < 0 && errno != EINTR)
+		return 1;
+
+	head = *ring->cq_head;
+	while (completed < count)
+	{
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				return 1;
+			continue;
+		}
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		if (cqe->user_data < count)
+			results[cqe->user_data] = cqe->res;
+		head++;
+		completed++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+/**
+ * This function turns the io_uring backend on.  Each thread's ring is set up the first time that
+ * thread writes a file.
+ * @return - zero on success, or non-zero if the kernel doesn't support io_uring
+ */
+UTILS_API int uring_enable(void)
+{
+	struct uring test;
+
+	if (enabled)
+		return 0;
+	if (!ring_list_mutex) {
+		ring_list_mutex = create_mutex();
+		if (!ring_list_mutex)
+			return 1;
+	}
+
+	//Make sure the kernel supports it, and it hasn't been turned off with the io_uring_disabled sysctl
+	memset(&test, 0, sizeof(test));
+	if (setup_ring(&test))
+		return 1;
+	close_ring(&test);
+	enabled = 1;
+	return 0;
+}
+
+/**
+ * This function turns the io_uring backend off, and closes every thread's ring.  It should only be
+ * called once the other threads that write files have stopped.
+ */
+UTILS_API void uring_disable(void)
+{
+	struct uring * ring;
+
+	if (!enabled)
+		return;
+	enabled = 0;
+	take_mutex(ring_list_mutex);
+	for (ring = rings; ring; ring = ring->next)
+	{
+		close_ring(ring);
+		ring->failed = 0;
+	}
+	release_mutex(ring_list_mutex);
+}
+
+/**
+ * This function returns whether the io_uring backend is on.
+ * @return - non-zero if uring_enable has been called successfully, zero otherwise
+ */
+UTILS_API int uring_enabled(void)
+{
+	return enabled;
+}
+
+/**
+ * This function registers a buffer with the calling thread's ring, so that writes from it don't
+ * have to map its pages each time.  It replaces the buffer that was registered before, if there
+ * was one, and does nothing if the buffer is already registered or the backend is off.  The buffer
+ * must be unregistered with uring_unregister_buffer before it's freed.
+ * @param buffer - the buffer to register
+ * @param length - the length of the buffer parameter
+ */
+UTILS_API void uring_register_buffer(const char * buffer, size_t length)
+{
+	struct uring * ring = get_thread_ring();
+	struct iovec iov;
+
+	if (!ring || (ring->registered == buffer && ring->registered_length == length) || !buffer || !length)
+		return;
+	if (ring->registered)
+		sys_io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	ring->registered = NULL;
+	ring->registered_length = 0;
+
+	iov.iov_base = (void *)buffer;
+	iov.iov_len = length;
+	//This can fail if the buffer is larger than the locked memory limit, in which case writes from
+	//it are still done with io_uring, just without the fixed buffer
+	if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+		return;
+	ring->registered = buffer;
+	ring->registered_length = length;
+}
+
+/**
+ * This function unregisters a buffer from every thread's ring it was registered with.
+ * @param buffer - the buffer to unregister, which was passed to uring_register_buffer
+ */
+UTILS_API void uring_unregister_buffer(const char * buffer)
+{
+	struct uring * ring;
+
+	if (!ring_list_mutex || !buffer)
+		return;
+	take_mutex(ring_list_mutex);
+	for (ring = rings; ring; ring = ring->next)
+	{
+		if (ring->fd >= 0 && ring->registered == buffer) {
+			sys_io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+			ring->registered = NULL;
+			ring->registered_length = 0;
+		}
+	}
+	release_mutex(ring_list_mutex);
+}
+
+/**
+ * This function replaces the contents of an open file with a buffer, with a write and a truncate
+ * that are submitted together.  The write uses the registered buffer if the buffer is inside of it.
+ * @param fd - the file to rewrite
+ * @param buffer - the file's new contents
+ * @param length - the length of the buffer parameter
+ * @return - zero on success, or URING_NOT_USED if the file wasn't rewritten, in which case the
+ * caller should rewrite it with the regular system calls
+ */
+UTILS_API int uring_rewrite_file(int fd, const char * buffer, size_t length)
+{
+	struct uring * ring = get_thread_ring();
+	struct io_uring_sqe * sqe;
+	int results[2] = { -ECANCELED, -ECANCELED };
+
+	if (!ring || !ring->has_ftruncate || length > 0x7fffffff)
+		return URING_NOT_USED;
+
+	sqe = get_sqe(ring, 0);
+	if (length && ring->registered && buffer >= ring->registered
+			&& buffer + length <= ring->registered + ring->registered_length) {
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->buf_index = 0;
+	}
+	else
+		sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = (uint32_t)length;
+	sqe->off = 0;
+	sqe->flags = IOSQE_IO_LINK;
+
+	//A short write breaks the chain, so the file is only truncated if all of the buffer was written
+	sqe = get_sqe(ring, 1);
+	sqe->opcode = URING_OP_FTRUNCATE;
+	sqe->fd = fd;
+	sqe->off = length;
+
+	if (submit_and_wait(ring, 2, results) || results[0] != (int)length || results[1] < 0)
+		return URING_NOT_USED;
+	return 0;
+}
+
+/**
+ * This function creates or truncates a file, and writes several buffers to it, with an open, a
+ * writev and a close that are submitted together.
+ * @param filename - the file to write
+ * @param buffers - the buffers to write, one after another
+ * @param count - the number of buffers in the buffers parameter
+ * @return - zero on success, or URING_NOT_USED if the file wasn't written, in which case the caller
+ * should write it with the regular system calls
+ */
+UTILS_API int uring_write_file(const char * filename, const file_buffer_t * buffers, size_t count)
+{
+	struct uring * ring = get_thread_ring();
+	struct io_uring_sqe * sqe;
+	struct iovec iov[URING_MAX_IOV];
+	int results[3] = { -ECANCELED, -ECANCELED, -ECANCELED };
+	size_t i, total = 0;
+
+	if (!ring || !ring->has_direct_files || count > URING_MAX_IOV)
+		return URING_NOT_USED;
+	for (i = 0; i < count; i++)
+	{
+		iov[i].iov_base = (void *)buffers[i].data;
+		iov[i].iov_len = buffers[i].length;
+		total += buffers[i].length;
+	}
+	if (total > 0x7fffffff)
+		return URING_NOT_USED;
+
+	sqe = get_sqe(ring, 0);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)(uintptr_t)filename;
+	sqe->len = 0666;
+	//O_CLOEXEC isn't allowed, since a file in the file table doesn't have a descriptor
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+	sqe->file_index = 1; //The file table's first slot, plus one
+	sqe->flags = IOSQE_IO_LINK;
+
+	sqe = get_sqe(ring, 1);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = 0;
+	sqe->addr = (uint64_t)(uintptr_t)iov;
+	sqe->len = (uint32_t)count;
+	sqe->off = 0;
+	//The file is closed even if the write fails, so it doesn't stay in the file table
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+	sqe = get_sqe(ring, 2);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = 1;
+
+	if (submit_and_wait(ring, 3, results) || results[0] < 0 || results[1] != (int)total)
+		return URING_NOT_USED;
+	return 0;
+}
+
+#else
+
+UTILS_API int uring_enable(void)
+{
+	return 1;
+}
+
+UTILS_API void uring_disable(void)
+{
+}
+
+UTILS_API int uring_enabled(void)
+{
+	return 0;
+}
+
+UTILS_API void uring_register_buffer(const char * buffer, size_t length)
+{
+}
+
+UTILS_API void uring_unregister_buffer(const char * buffer)
+{
+}
+
+UTILS_API int uring_rewrite_file(int fd, const char * buffer, size_t length)
+{
+	return URING_NOT_USED;
+}
+
+UTILS_API int uring_write_file(const char * filename, const file_buffer_t * buffers, size_t count)
+{
+	return URING_NOT_USED;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stddef.h>
+
+//An optional io_uring backend for the file writes done on each iteration: rewriting a driver's test
+//file or an instrumentation's stdin file, and writing a new file, such as a finding.  Each thread
+//gets its own ring, and each write is submitted as one chain of linked requests, so it takes one
+//system call rather than one per open, write, truncate and close.  A buffer that's written every
+//iteration, such as a driver's mutate buffer, can be registered with the calling thread's ring, so
+//the kernel doesn't have to map its pages on each write.
+//
+//The backend is off until uring_enable is called, and is only available on Linux.  When it's off,
+//or the kernel doesn't support an operation, the functions return URING_NOT_USED, and the caller
+//does the write with the regular system calls instead.
+
+//Returned by the write functions when the write wasn't done with io_uring
+#define URING_NOT_USED -1
+
+//The number of entries in each thread's submission queue
+#define URING_ENTRIES 8
+
+UTILS_API int uring_enable(void);
+UTILS_API void uring_disable(void);
+UTILS_API int uring_enabled(void);
+UTILS_API void uring_register_buffer(const char * buffer, size_t length);
+UTILS_API void uring_unregister_buffer(const char * buffer);
+UTILS_API int uring_rewrite_file(int fd, const char * buffer, size_t length);
+UTILS_API int uring_write_file(const char * filename, const file_buffer_t * buffers, size_t count);
@@ -1,4 +1,12 @@
+#ifdef __linux__
+#define _GNU_SOURCE // CPU_SET and friends
+#endif
+
 #include "utils.h"
+#include "async_log.h"
+#include "corpus_pack.h"
+#include "uring.h"
+#include "tracepoints.h"
 
 #include <jansson_helper.h>
 
@@ -31,12 +39,21 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <poll.h>
 #include <unistd.h>
 #include <wordexp.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h> // SYS_pidfd_open, SYS_futex
+#endif
 #endif
 
 #ifdef _WIN32
-static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * process_out, DWORD creation_flags);
+static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * process_out, HANDLE * thread_out, DWORD creation_flags);
 
 /**
 * This function converts a char * to a wchar *
@@ -91,8 +108,94 @@ UTILS_API char * convert_wchar_array_to_char(wchar_t * string, char * out_buffer
 
 #define MAX_CMD_LEN 10*4096
 #define MAX_STANDARD_IN_PIPE_SIZE 8*1024 *1024 //8MB
+#define MAX_WRITE_SIZE 8*1024*1024 //8MB
+
+//The part of an input that didn't fit in the stdin pipe, which a background thread writes once the target reads it
+struct stdin_writer
+{
+	HANDLE pipe_wr;
+	size_t length;
+	char data[1];
+};
+typedef struct stdin_writer stdin_writer_t;
+
+/**
+ * This function writes the rest of an input to a target's stdin pipe in the background, and then closes the pipe
+ * and frees the stdin_writer_t it was given.
+ * @param arg - a stdin_writer_t describing the data to write
+ * @return - zero
+ */
+static THREAD_FUNC(stdin_writer_thread)
+{
+	stdin_writer_t * writer = (stdin_writer_t *)arg;
+	size_t total_written = 0;
+	DWORD written;
+
+	//WriteFile fails once the target exits and the read end of the pipe is closed
+	while (total_written < writer->length)
+	{
+		if (!WriteFile(writer->pipe_wr, writer->data + total_written,
+			(DWORD)min(writer->length - total_written, MAX_WRITE_SIZE), &written, NULL))
+			break;
+		total_written += written;
+	}
+	CloseHandle(writer->pipe_wr);
+	free(writer);
+	return 0;
+}
+
+/**
+ * This function writes an input to a target's stdin pipe without waiting for the target to read it.  Whatever fits
+ * in the pipe is written right away, and the rest is copied and written by a background thread, which takes
+ * ownership of the write end of the pipe.
+ * @param pipe_wr - The write end of the pipe that will be written to, which this function closes.
+ * @param pipe_rd - The read end of the pipe being written to
+ * @param input - a buffer to write to the the pipe_wr parameter
+ * @param input_length - The length of the input parameter
+ * @return - 0 on success, 1 on failure
+ */
+static int WriteToPipeAsync(HANDLE pipe_wr, HANDLE pipe_rd, char * input, size_t input_length)
+{
+	DWORD out_size, total_in_pipe, written = 0;
+	stdin_writer_t * writer;
+	thread_t thread;
+	size_t write_size;
+
+	if (GetNamedPipeInfo(pipe_wr, NULL, &out_size, NULL, NULL) && PeekNamedPipe(pipe_rd, NULL, 0, NULL, &total_in_pipe, NULL))
+	{
+		write_size = min(input_length, (size_t)(out_size - total_in_pipe));
+		if (write_size && !WriteFile(pipe_wr, input, (DWORD)write_size, &written, NULL))
+		{
+			CloseHandle(pipe_wr);
+			return 1;
+		}
+	}
+	if (written == input_length)
+	{
+		CloseHandle(pipe_wr);
+		return 0;
+	}
+
+	writer = (stdin_writer_t *)malloc(sizeof(stdin_writer_t) + input_length - written);
+	if (!writer)
+	{
+		CloseHandle(pipe_wr);
+		return 1;
+	}
+	writer->pipe_wr = pipe_wr;
+	writer->length = input_length - written;
+	memcpy(writer->data, input + written, writer->length);
+	if (create_thread(&thread, stdin_writer_thread, writer))
+	{
+		CloseHandle(pipe_wr);
+		free(writer);
+		return 1;
+	}
+	CloseHandle(thread);
+	return 0;
+}
 
-static int start_process_and_write_to_stdin_inner(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * pipe_rd_ptr, HANDLE * pipe_wr_ptr, DWORD timeout_ms, DWORD creation_flags)
+static int start_process_and_write_to_stdin_inner(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * thread_out, HANDLE * pipe_rd_ptr, HANDLE * pipe_wr_ptr, DWORD timeout_ms, DWORD creation_flags)
 {
 	SECURITY_ATTRIBUTES saAttr;
 	int ret;
@@ -120,15 +223,21 @@ static int start_process_and_write_to_stdin_inner(char * cmd_line, char * input,
 	}
 
 	// Create the child process.
-	if (CreateChildProcess(cmd_line, pipe_rd, process_out, creation_flags))
+	if (CreateChildProcess(cmd_line, pipe_rd, process_out, thread_out, creation_flags))
 	{
 		CLOSE_PIPES();
 		return 1;
 	}
 
-	//Write the input buffer
+	//Write the input buffer.  When the caller doesn't need the pipes, the input is written in the background so
+	//that large inputs don't block until the target reads them.
 	ret = 0;
-	if (input && input_length > 0)
+	if (input && input_length > 0 && !pipe_wr_ptr)
+	{
+		ret = WriteToPipeAsync(pipe_wr, pipe_rd, input, input_length);
+		pipe_wr = NULL;
+	}
+	else if (input && input_length > 0)
 	{
 		if (WriteToPipe(*process_out, pipe_wr, pipe_rd, input, input_length, timeout_ms))
 			ret = 1;
@@ -141,7 +250,7 @@ static int start_process_and_write_to_stdin_inner(char * cmd_line, char * input,
 		CloseHandle(pipe_rd);
 	if (pipe_wr_ptr)
 		*pipe_wr_ptr = pipe_wr;
-	else
+	else if (pipe_wr)
 		CloseHandle(pipe_wr);
 	return ret;
 }
@@ -161,7 +270,7 @@ static int start_process_and_write_to_stdin_inner(char * cmd_line, char * input,
   */
 UTILS_API int start_process_and_write_to_stdin_and_save_pipes_timeout(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * pipe_rd_ptr, HANDLE * pipe_wr_ptr, DWORD timeout_ms)
 {
-	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, pipe_rd_ptr, pipe_wr_ptr, timeout_ms, 0);
+	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, NULL, pipe_rd_ptr, pipe_wr_ptr, timeout_ms, 0);
 }
 
 /**
@@ -174,7 +283,7 @@ UTILS_API int start_process_and_write_to_stdin_and_save_pipes_timeout(char * cmd
   */
 UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, HANDLE * process_out)
 {
-	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, NULL, NULL, 0, 0);
+	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, NULL, NULL, NULL, 0, 0);
 }
 
 /**
@@ -188,7 +297,233 @@ UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, si
   */
 UTILS_API int start_process_and_write_to_stdin_flags(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, DWORD creation_flags)
 {
-	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, NULL, NULL, 0, creation_flags);
+	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, NULL, NULL, NULL, 0, creation_flags);
+}
+
+/**
+  * This function starts a process with its main thread suspended, and writes to the stdin of the process.
+  * @param cmd_line - The command line of the new process to start
+  * @param input - a buffer that should be pasesd to the newly created process's stdin
+  * @param input_length - The length of the input parameter
+  * @param process_out - a pointer to a HANDLE that will be filled in with a handle to the newly created process
+  * @param thread_out - a pointer to a HANDLE that will be filled in with a handle to the suspended main thread, which
+  * the caller must resume and close
+  * @return - zero on success, non-zero on failure
+  */
+UTILS_API int start_process_and_write_to_stdin_suspended(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * thread_out)
+{
+	return start_process_and_write_to_stdin_inner(cmd_line, input, input_length, process_out, thread_out, NULL, NULL, 0, CREATE_SUSPENDED);
+}
+
+#define PROCESS_POOL_PIPE_SIZE 64*1024 //Inputs that don't fit are written in the background, as in WriteToPipeAsync
+
+//A suspended process in a process pool, waiting to be handed out
+struct pooled_process
+{
+	HANDLE process;
+	HANDLE thread;  //The suspended main thread
+	HANDLE job;     //The job object holding the process, or NULL if it couldn't be put in one
+	HANDLE pipe_rd; //The read end of the process's stdin pipe
+	HANDLE pipe_wr; //The write end of the process's stdin pipe
+};
+typedef struct pooled_process pooled_process_t;
+
+struct process_pool
+{
+	char * cmd_line;
+	DWORD creation_flags;
+	int size;
+	int next;                    //The index of the next process to hand out
+	pooled_process_t * processes;
+	HANDLE running_job;          //The job of the last process handed out
+};
+
+/**
+ * This function frees a pooled process's handles, killing the process if it hasn't been handed out.
+ * @param pooled - the pooled process to free
+ */
+static void free_pooled_process(pooled_process_t * pooled)
+{
+	if (pooled->process)
+	{
+		TerminateProcess(pooled->process, 0);
+		CloseHandle(pooled->process);
+	}
+	if (pooled->thread)
+		CloseHandle(pooled->thread);
+	if (pooled->job)
+		CloseHandle(pooled->job);
+	if (pooled->pipe_rd)
+		CloseHandle(pooled->pipe_rd);
+	if (pooled->pipe_wr)
+		CloseHandle(pooled->pipe_wr);
+	memset(pooled, 0, sizeof(pooled_process_t));
+}
+
+/**
+ * This function starts a suspended process for a process pool, with its stdin pipe, in its own job object.  The
+ * job kills the process, and any processes it starts, when the job's handle is closed.
+ * @param pool - the pool the process is being started for
+ * @param pooled - the pooled_process_t to fill in
+ * @return - zero on success, non-zero on failure
+ */
+static int spawn_pooled_process(process_pool_t * pool, pooled_process_t * pooled)
+{
+	SECURITY_ATTRIBUTES saAttr;
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+
+	memset(pooled, 0, sizeof(pooled_process_t));
+	saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+	saAttr.bInheritHandle = TRUE;
+	saAttr.lpSecurityDescriptor = NULL;
+	if (!CreatePipe(&pooled->pipe_rd, &pooled->pipe_wr, &saAttr, PROCESS_POOL_PIPE_SIZE)
+		|| !SetHandleInformation(pooled->pipe_wr, HANDLE_FLAG_INHERIT, 0)
+		|| CreateChildProcess(pool->cmd_line, pooled->pipe_rd, &pooled->process, &pooled->thread, pool->creation_flags | CREATE_SUSPENDED))
+	{
+		free_pooled_process(pooled);
+		return 1;
+	}
+
+	//The process hasn't run yet, so anything it starts will be in the job too.  Assigning the process fails if we're in a
+	//job that doesn't allow nested jobs or breaking away, in which case the process is just terminated directly.
+	pooled->job = CreateJobObject(NULL, NULL);
+	if (pooled->job)
+	{
+		memset(&limits, 0, sizeof(limits));
+		limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+		if (!SetInformationJobObject(pooled->job, JobObjectExtendedLimitInformation, &limits, sizeof(limits))
+			|| !AssignProcessToJobObject(pooled->job, pooled->process))
+		{
+			CloseHandle(pooled->job);
+			pooled->job = NULL;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function creates a pool of suspended processes for a command line, so that the time spent creating each
+ * process is hidden behind the previous process's run.  If the processes are debugged (i.e. DEBUG_ONLY_THIS_PROCESS
+ * is in creation_flags), the pool must only be used from the debugging thread.
+ * @param cmd_line - the command line of the processes to start
+ * @param size - the number of processes to keep ready
+ * @param creation_flags - the creation flags that should be passed to the CreateProcess Windows API
+ * @return - the new process pool, or NULL on failure
+ */
+UTILS_API process_pool_t * process_pool_create(char * cmd_line, int size, DWORD creation_flags)
+{
+	process_pool_t * pool;
+	int i;
+
+	if (size <= 0 || strlen(cmd_line) > MAX_CMD_LEN)
+		return NULL;
+	pool = (process_pool_t *)malloc(sizeof(process_pool_t));
+	if (!pool)
+		return NULL;
+	memset(pool, 0, sizeof(process_pool_t));
+	pool->cmd_line = strdup(cmd_line);
+	pool->processes = (pooled_process_t *)calloc(size, sizeof(pooled_process_t));
+	if (!pool->cmd_line || !pool->processes)
+	{
+		process_pool_destroy(pool);
+		return NULL;
+	}
+	pool->size = size;
+	pool->creation_flags = creation_flags;
+
+	//Processes that fail to start here are retried when they're needed
+	for (i = 0; i < size; i++)
+		spawn_pooled_process(pool, &pool->processes[i]);
+	return pool;
+}
+
+/**
+ * This function hands out one of a pool's processes.  The input is written to its stdin pipe before it's resumed, and
+ * then a replacement is started while it runs.  The last process handed out, and any processes it started, are killed
+ * when this is called again or the pool is destroyed, so the caller must be finished with it by then.
+ * @param pool - the pool to take the process from
+ * @param cmd_line - the command line of the process.  If it's not the pool's command line, the pool is refilled
+ * with processes for the new command line.
+ * @param input - a buffer that should be passed to the process's stdin
+ * @param input_length - The length of the input parameter
+ * @param process_out - a pointer to a HANDLE that will be filled in with a handle to the process, which the caller
+ * should close
+ * @return - zero on success, non-zero on failure
+ */
+UTILS_API int process_pool_start(process_pool_t * pool, char * cmd_line, char * input, size_t input_length, HANDLE * process_out)
+{
+	pooled_process_t * pooled;
+	char * new_cmd_line;
+	int ret = 0, i;
+
+	*process_out = NULL;
+	if (pool->running_job)
+	{
+		CloseHandle(pool->running_job);
+		pool->running_job = NULL;
+	}
+
+	if (strcmp(cmd_line, pool->cmd_line))
+	{
+		if (strlen(cmd_line) > MAX_CMD_LEN)
+			return 1;
+		new_cmd_line = strdup(cmd_line);
+		if (!new_cmd_line)
+			return 1;
+		free(pool->cmd_line);
+		pool->cmd_line = new_cmd_line;
+		for (i = 0; i < pool->size; i++)
+		{
+			free_pooled_process(&pool->processes[i]);
+			spawn_pooled_process(pool, &pool->processes[i]);
+		}
+	}
+
+	pooled = &pool->processes[pool->next];
+	pool->next = (pool->next + 1) % pool->size;
+	if (!pooled->process && spawn_pooled_process(pool, pooled))
+		return 1;
+
+	if (input && input_length > 0)
+		ret = WriteToPipeAsync(pooled->pipe_wr, pooled->pipe_rd, input, input_length);
+	else
+		CloseHandle(pooled->pipe_wr);
+	pooled->pipe_wr = NULL;
+	if (ret || ResumeThread(pooled->thread) == (DWORD)-1)
+	{
+		free_pooled_process(pooled);
+		return 1;
+	}
+
+	*process_out = pooled->process;
+	pool->running_job = pooled->job;
+	pooled->process = NULL;
+	pooled->job = NULL;
+	free_pooled_process(pooled);
+
+	//Start the replacement while the handed out process runs
+	spawn_pooled_process(pool, pooled);
+	return 0;
+}
+
+/**
+ * This function kills a pool's processes, including the last one handed out, and frees the pool.
+ * @param pool - the pool to destroy
+ */
+UTILS_API void process_pool_destroy(process_pool_t * pool)
+{
+	int i;
+
+	if (pool->processes)
+	{
+		for (i = 0; i < pool->size; i++)
+			free_pooled_process(&pool->processes[i]);
+		free(pool->processes);
+	}
+	if (pool->running_job)
+		CloseHandle(pool->running_job);
+	free(pool->cmd_line);
+	free(pool);
 }
 
 
@@ -197,10 +532,12 @@ UTILS_API int start_process_and_write_to_stdin_flags(char * cmd_line, char * inp
   * @param cmd_line - The command line for the process to create
   * @param read_pipe - A handle to the read end of a pipe that should be assigned to the newly created process's stdin
   * @param process_out - A pointer toa HANDLE that will be filled in with a handle to the newly created process
+  * @param thread_out - A pointer to a HANDLE that will be filled in with a handle to the newly created process's main
+  * thread, or NULL if the thread handle isn't needed
   * @param creation_flags - The creation flags that should be passed to the CreateProcess Windows API
   * @return - zero on success, non-zero on failure
   */
-static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * process_out, DWORD creation_flags)
+static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * process_out, HANDLE * thread_out, DWORD creation_flags)
 {
 	PROCESS_INFORMATION piProcInfo;
 	STARTUPINFO siStartInfo;
@@ -222,7 +559,8 @@ static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * proces
 	siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
 	siStartInfo.wShowWindow = 1;
 
-	// Create the child process.
+	// Create the child process, which inherits the sanitizer options
+	set_sanitizer_options();
 	bSuccess = CreateProcess(NULL,
 		cmd_line,      // command line
 		NULL,          // process security attributes
@@ -238,13 +576,14 @@ static int CreateChildProcess(char * cmd_line, HANDLE read_pipe, HANDLE * proces
 	if (!bSuccess)
 		return 1;
 
-	CloseHandle(piProcInfo.hThread); //We don't need the thread handle
+	if (thread_out)
+		*thread_out = piProcInfo.hThread;
+	else
+		CloseHandle(piProcInfo.hThread); //We don't need the thread handle
 	*process_out = piProcInfo.hProcess;
 	return 0;
 }
 
-#define MAX_WRITE_SIZE 8*1024*1024 //8MB
-
 #define GET_FILETIME_DIFF_IN_MILLISECONDS(x,y,z) \
 	ULARGE_INTEGER temp1##x##y, temp2##x##y; \
 	temp1##x##y.LowPart = x.dwLowDateTime; temp1##x##y.HighPart = x.dwHighDateTime; \
@@ -334,6 +673,22 @@ UTILS_API int get_process_status(HANDLE process)
 		return FUZZ_ERROR;
 	return exitCode == STILL_ACTIVE;
 }
+
+/**
+ * This function blocks until the given process exits or the timeout expires
+ * @param process - a HANDLE to the process to wait on
+ * @param timeout_ms - the maximum number of milliseconds to wait
+ * @return - 1 if the process has exited, 0 if it is still running after the timeout, or -1 on failure
+ */
+UTILS_API int wait_for_process_exit(HANDLE process, int timeout_ms)
+{
+	DWORD result = WaitForSingleObject(process, timeout_ms < 0 ? 0 : timeout_ms);
+	if (result == WAIT_OBJECT_0)
+		return 1;
+	if (result == WAIT_TIMEOUT)
+		return 0;
+	return -1;
+}
 #else
 /**
  * This function checks if a CHILD process is still alive
@@ -345,6 +700,21 @@ UTILS_API int get_process_status(HANDLE process)
  *
  */
 UTILS_API int get_process_status(pid_t pid)
+{
+	return get_process_status_signal(pid, NULL);
+}
+
+/**
+ * This function checks if a CHILD process is still alive, like get_process_status,
+ * and also returns the signal that a crashed process was killed with.
+ * @param pid - the process to check
+ * @param signal - a pointer used to return the signal that killed the process, or
+ * 0 if it didn't crash.  May be NULL.
+ * @return - FUZZ_CRASH (2) if the process exited by crash, FUZZ_RUNNING (1) if
+ * the process is alive, FUZZ_NONE (0) if it exited cleanly, FUZZ_ERROR (-1) on
+ * failure
+ */
+UTILS_API int get_process_status_signal(pid_t pid, int * signal)
 {
 
 	// We can't use kill here, because it'll return "alive" if the process is
@@ -353,6 +723,9 @@ UTILS_API int get_process_status(pid_t pid)
 	int status;
 	pid_t result;
 
+	if(signal)
+		*signal = 0;
+
 	// WNOHANG result: 0 means it exists and is alive, pid means it has exited,
 	// -1 means error
 	result = waitpid(pid, &status, WNOHANG);
@@ -362,15 +735,202 @@ UTILS_API int get_process_status(pid_t pid)
 	} else if (result > 0) {
 		if(WIFEXITED(status))
 			return FUZZ_NONE; // it exited normally
-		if(WIFSIGNALED(status))
+		if(WIFSIGNALED(status)) {
+			if(signal)
+				*signal = WTERMSIG(status);
 			return FUZZ_CRASH; // it crashed
+		}
 	}
 	// either waitpid failed, or the process is not running, did not exit
 	// normally, and was not signaled, in either case we don't know what
 	// went wrong
 	return FUZZ_ERROR;
 }
+
+/**
+ * This function blocks until a CHILD process exits or the timeout expires.  The
+ * child is not reaped, so a following call to waitpid (or get_process_status)
+ * will still retrieve its exit status.
+ *
+ * On Linux kernels that support pidfd_open, this sleeps in poll() on the process's
+ * pidfd.  Otherwise, it falls back to checking the child once a millisecond.
+ *
+ * @param pid - the pid of the child process to wait on
+ * @param timeout_ms - the maximum number of milliseconds to wait
+ * @return - 1 if the process has exited, 0 if it is still running after the timeout, or -1 on failure
+ */
+UTILS_API int wait_for_process_exit(pid_t pid, int timeout_ms)
+{
+	siginfo_t info;
+	uint64_t deadline;
+	int result;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	struct pollfd pfd;
+	pfd.fd = syscall(SYS_pidfd_open, pid, 0);
+	if (pfd.fd >= 0) {
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		do {
+			result = poll(&pfd, 1, timeout_ms < 0 ? 0 : timeout_ms);
+		} while (result < 0 && errno == EINTR);
+		close(pfd.fd);
+		if (result < 0)
+			return -1;
+		return result > 0;
+	}
+	// pidfd_open isn't supported by this kernel, fall back to polling
+#endif
+
+	deadline = get_time_ms() + (timeout_ms < 0 ? 0 : timeout_ms);
+	while (1) {
+		memset(&info, 0, sizeof(info));
+		result = waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT);
+		if (result < 0)
+			return -1;
+		if (info.si_pid == pid)
+			return 1;
+		if (get_time_ms() >= deadline)
+			return 0;
+		usleep(1000);
+	}
+}
+#endif
+
+/**
+ * This function gets the current time from a monotonic clock, suitable for measuring timeouts
+ * @return - a time, in milliseconds, from an unspecified starting point
+ */
+UTILS_API uint64_t get_time_ms(void)
+{
+#ifdef _WIN32
+	return GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+}
+
+/**
+ * This function gets the current time from a high resolution monotonic clock, suitable for timing
+ * short operations
+ * @return - a time, in nanoseconds, from an unspecified starting point
+ */
+UTILS_API uint64_t get_time_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000
+		+ (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+#endif
+}
+
+#ifdef KILLERBEEZ_ETW_TRACEPOINTS
+//The Killerbeez ETW provider, whose GUID is the one EventSource derives from the name, so it can be
+//enabled as *Killerbeez
+TRACELOGGING_DEFINE_PROVIDER(killerbeez_trace_provider, "Killerbeez",
+	(0x8282f357, 0xf0ee, 0x52c2, 0xc7, 0x4e, 0xca, 0xe7, 0x4e, 0xbd, 0x16, 0x9c));
+#endif
+
+/**
+ * This function registers the tracepoints in tracepoints.h with the OS, on the platforms that
+ * need it (the ETW provider on Windows).  The tracepoints are ignored until it's called.
+ */
+UTILS_API void tracepoints_register(void)
+{
+#ifdef KILLERBEEZ_ETW_TRACEPOINTS
+	TraceLoggingRegister(killerbeez_trace_provider);
+#endif
+}
+
+/**
+ * This function unregisters the tracepoints that were registered by tracepoints_register.
+ */
+UTILS_API void tracepoints_unregister(void)
+{
+#ifdef KILLERBEEZ_ETW_TRACEPOINTS
+	TraceLoggingUnregister(killerbeez_trace_provider);
+#endif
+}
+
+//The sanitizer options for fuzzing skip symbolizing and the allocation stacks, and make every sanitizer abort,
+//so a report costs little and each instrumentation sees it as a crash.  The report options are for triage.
+#define SANITIZER_ABORT_OPTIONS "abort_on_error=1:allocator_may_return_null=1:"
+#define SANITIZER_FAST_OPTIONS  "symbolize=0:malloc_context_size=0:"
+#define SANITIZER_REPORT_OPTIONS "symbolize=1:"
+#define SANITIZER_MSAN_EXIT_CODE "86" //AFL's MSAN_ERROR
+
+static char sanitizer_report_prefix[MAX_PATH]; //Where the full sanitizer reports are written, or empty for none
+
+/**
+ * This function sets an environment variable, unless it's already set, so the user's settings take precedence.
+ * @param name - the name of the environment variable
+ * @param value - the value to give it
+ */
+static void set_default_env(const char * name, const char * value)
+{
+	if (getenv(name))
+		return;
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 0);
+#endif
+}
+
+/**
+ * This function sets the ASAN_OPTIONS, MSAN_OPTIONS, and UBSAN_OPTIONS environment variables for the targets
+ * this process starts, if the user hasn't set them.  By default, they're set for fast fuzzing, so a sanitizer
+ * build's reports aren't symbolized and every sanitizer aborts the target with SIGABRT on an error.  After
+ * set_sanitizer_reports, they're set for full, symbolized reports instead.
+ */
+UTILS_API void set_sanitizer_options(void)
+{
+	char buffer[MAX_PATH + 512];
+	const char * profile, * log_path;
+
+	profile = sanitizer_report_prefix[0] ? SANITIZER_REPORT_OPTIONS : SANITIZER_FAST_OPTIONS;
+	log_path = sanitizer_report_prefix[0] ? ":log_path=" : "";
+
+	snprintf(buffer, sizeof(buffer), SANITIZER_ABORT_OPTIONS "%sdetect_leaks=0:detect_odr_violation=0%s%s",
+		profile, log_path, sanitizer_report_prefix);
+	set_default_env("ASAN_OPTIONS", buffer);
+#ifndef _WIN32
+	//MSAN's exit_code is only used if it can't abort
+	snprintf(buffer, sizeof(buffer), SANITIZER_ABORT_OPTIONS "%sexit_code=" SANITIZER_MSAN_EXIT_CODE ":msan_track_origins=0%s%s",
+		profile, log_path, sanitizer_report_prefix);
+	set_default_env("MSAN_OPTIONS", buffer);
+	snprintf(buffer, sizeof(buffer), SANITIZER_ABORT_OPTIONS "%shalt_on_error=1:print_stacktrace=%d%s%s",
+		profile, sanitizer_report_prefix[0] ? 1 : 0, log_path, sanitizer_report_prefix);
+	set_default_env("UBSAN_OPTIONS", buffer);
 #endif
+}
+
+/**
+ * This function switches the sanitizer options that set_sanitizer_options sets to full, symbolized reports with
+ * the allocation stacks, which the sanitizers write to files in the given directory.  It should be called before
+ * any targets are started, since the options are only set once.
+ * @param report_directory - the directory to write the reports to, each named by the sanitizer and the target's pid
+ * @return - zero on success, or non-zero if the directory's path is too long
+ */
+UTILS_API int set_sanitizer_reports(const char * report_directory)
+{
+	int length;
+
+	length = snprintf(sanitizer_report_prefix, sizeof(sanitizer_report_prefix), "%s/report", report_directory);
+	if (length < 0 || (size_t)length >= sizeof(sanitizer_report_prefix)) {
+		sanitizer_report_prefix[0] = 0;
+		return 1;
+	}
+	return 0;
+}
 
 /**
  * Generates a temporary filename
@@ -451,6 +1011,22 @@ UTILS_API int file_exists(char * path)
 	return !access(path,F_OK);
 }
 
+/**
+ * This function checks whether a path is a directory
+ * @param path - the path to check
+ * @return - non-zero if the path is a directory, 0 if it isn't or doesn't exist
+ */
+UTILS_API int is_directory(char * path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributes(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat info;
+	return !stat(path, &info) && S_ISDIR(info.st_mode);
+#endif
+}
+
 /**
  * This function writes a buffer to the specified file.
  * @param filename - The filename to write the buffer to
@@ -460,35 +1036,157 @@ UTILS_API int file_exists(char * path)
  */
 UTILS_API int write_buffer_to_file(char * filename, char * buffer, size_t length)
 {
-	int num_written;
-	size_t total = 0;
-	FILE * fp = NULL;
-	int error = EACCES;
+	file_buffer_t file_buffer;
+
+	file_buffer.data = buffer;
+	file_buffer.length = length;
+	return write_buffers_to_file(filename, &file_buffer, 1);
+}
 
 #ifdef _WIN32
-	//On Windows, we need to do this in a loop, since we may
-	//need to wait for a process to stop holding this file
-	while (!fp && error == EACCES)
+//Small buffers are gathered into a staging buffer, so that writing many of them
+//doesn't take a WriteFile call each
+#define WRITE_STAGING_SIZE (64 * 1024)
+
+/**
+ * This function writes all of a buffer to a file handle.
+ * @param file - the file handle to write to
+ * @param data - the buffer to write
+ * @param length - the length of the data parameter
+ * @return - 0 on success, non-zero otherwise
+ */
+static int write_all(HANDLE file, const char * data, size_t length)
+{
+	DWORD num_written, chunk;
+
+	while (length)
 	{
-		fp = fopen(filename, "wb+");
-		error = errno;
+		chunk = length > 0x40000000 ? 0x40000000 : (DWORD)length;
+		if (!WriteFile(file, data, chunk, &num_written, NULL) || !num_written)
+			return 1;
+		data += num_written;
+		length -= num_written;
 	}
+	return 0;
+}
 #else
-	fp = fopen(filename, "wb+");
+#ifndef IOV_MAX
+#define IOV_MAX 1024
 #endif
-	if (!fp)
+#endif
+
+/**
+ * This function writes several buffers, one after another, to the specified file.  The buffers
+ * are handed to the OS in batches (with writev on POSIX systems), rather than being copied into
+ * one buffer or written with a call each.
+ * @param filename - The filename to write the buffers to
+ * @param buffers - The buffers to write
+ * @param count - The number of buffers in the buffers parameter
+ * @param return - 0 on success, non-zero otherwise
+ */
+UTILS_API int write_buffers_to_file(char * filename, const file_buffer_t * buffers, size_t count)
+{
+	size_t i;
+	int ret = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	DWORD error = ERROR_SHARING_VIOLATION;
+	char * staging;
+	size_t staged = 0;
+
+	//On Windows, we need to do this in a loop, since we may
+	//need to wait for a process to stop holding this file
+	while (file == INVALID_HANDLE_VALUE && (error == ERROR_SHARING_VIOLATION || error == ERROR_ACCESS_DENIED))
+	{
+		file = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		error = GetLastError();
+	}
+	if (file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	staging = (char *)malloc(WRITE_STAGING_SIZE);
+	for (i = 0; !ret && i < count; i++)
+	{
+		if (staging && buffers[i].length <= WRITE_STAGING_SIZE - staged) {
+			memcpy(staging + staged, buffers[i].data, buffers[i].length);
+			staged += buffers[i].length;
+			continue;
+		}
+		if (staged) {
+			ret = write_all(file, staging, staged);
+			staged = 0;
+		}
+		if (!ret && staging && buffers[i].length < WRITE_STAGING_SIZE) {
+			memcpy(staging, buffers[i].data, buffers[i].length);
+			staged = buffers[i].length;
+		}
+		else if (!ret)
+			ret = write_all(file, buffers[i].data, buffers[i].length);
+	}
+	if (!ret && staged)
+		ret = write_all(file, staging, staged);
+	free(staging);
+	CloseHandle(file);
+#else
+	struct iovec iov[IOV_MAX];
+	size_t start = 0, offset = 0, num_iov;
+	ssize_t num_written;
+	int fd;
+
+	ret = uring_write_file(filename, buffers, count);
+	if (ret != URING_NOT_USED)
+		return ret;
+	ret = 0;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
 		return -1;
 
-	while (total < length)
+	//The buffers from start on are left to write, with the first offset bytes of buffers[start] already written
+	while (!ret)
 	{
-		num_written = fwrite(buffer + total, 1, length - total, fp);
-		if (num_written < 0 && errno != EAGAIN && errno != EINTR)
+		while (start < count && offset == buffers[start].length) {
+			start++;
+			offset = 0;
+		}
+		if (start == count)
 			break;
-		else if (num_written > 0)
-			total += num_written;
+
+		num_iov = 0;
+		for (i = start; i < count && num_iov < IOV_MAX; i++)
+		{
+			if (buffers[i].length == (i == start ? offset : 0))
+				continue;
+			iov[num_iov].iov_base = (void *)(buffers[i].data + (i == start ? offset : 0));
+			iov[num_iov].iov_len = buffers[i].length - (i == start ? offset : 0);
+			num_iov++;
+		}
+
+		num_written = writev(fd, iov, (int)num_iov);
+		if (!num_written)
+			ret = 1;
+		else if (num_written < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				ret = 1;
+			continue;
+		}
+
+		//Skip over whatever was written, which may end partway through a buffer
+		while (num_written > 0)
+		{
+			if ((size_t)num_written < buffers[start].length - offset) {
+				offset += num_written;
+				break;
+			}
+			num_written -= buffers[start].length - offset;
+			start++;
+			offset = 0;
+		}
 	}
-	fclose(fp);
-	return total != length;
+	if (close(fd))
+		ret = 1;
+#endif
+	return ret;
 }
 
 /**
@@ -678,7 +1376,11 @@ static struct logging_info {
 
 	int stdout_on:1;
 	int file_on:1;
-} logging = { .initialized = 0, .level = INFO, .log_file = NULL, .stdout_on = 1, .file_on = 1, };
+	int async_on:1;
+} logging = { .initialized = 0, .level = INFO, .log_file = NULL, .stdout_on = 1, .file_on = 1, .async_on = 0, };
+
+//Every level is passed to log_msg until logging is set up, so that log_msg can report that it isn't
+UTILS_DATA_API int log_level_threshold = DEBUG;
 
 const char * log_level_names[] = {
 	"DEBUG",
@@ -696,6 +1398,8 @@ UTILS_API char * logging_help(void)
 {
 	return strdup(
 "Logging Options:\n"
+"  async                 Enable/disable asynchronous logging, which writes the\n"
+"                          messages from a background thread (default disabled)\n"
 "  file                  Enable/disable file logging (default enabled)\n"
 "  filename              Set the filename of the logging file\n"
 "                          (default killerbeez.log)\n"
@@ -732,6 +1436,7 @@ UTILS_API int setup_logging(const char * log_options)
 		GET_OPTIONAL_ARG(temp_int, log_options, logging.level, "level", result, get_int_options);
 		GET_OPTIONAL_ARG(temp_int, log_options, logging.stdout_on, "stdout", result, get_int_options);
 		GET_OPTIONAL_ARG(temp_int, log_options, logging.file_on, "file", result, get_int_options);
+		GET_OPTIONAL_ARG(temp_int, log_options, logging.async_on, "async", result, get_int_options);
 		GET_OPTIONAL_ARG(temp_str, log_options, filename, "filename", result, get_string_options);
 	}
 
@@ -751,17 +1456,47 @@ UTILS_API int setup_logging(const char * log_options)
 		free(filename);
 	}
 
+	if (logging.async_on && async_log_start(logging.stdout_on ? stdout : NULL, logging.file_on ? logging.log_file : NULL))
+		printf("[LOGGING] WARNING: Failed to start asynchronous logging, logging synchronously instead\n");
+
 	logging.initialized = 1;
+	log_level_threshold = logging.level;
 	INFO_MSG("Logging Started");
 	return 0;
 }
 
+/**
+ * This function formats a time the way that it's written in the log messages.
+ * @param time - the time to format
+ * @param buffer - the buffer to write the formatted time to
+ * @param size - the size of buffer
+ */
+void log_time_string(time_t time, char * buffer, size_t size)
+{
+	struct tm new_time;
+
+#ifdef _WIN32
+	localtime_s(&new_time, &time);
+	if (asctime_s(buffer, size, &new_time))
+#else
+	localtime_r(&time, &new_time);
+	if (size < 26 || !asctime_r(&new_time, buffer))
+#endif
+	{ //If we couldn't get the time, NULL out time_buf, so we don't print garbage
+		strncpy(buffer, "TIME FAILURE", size);
+	}
+	else //asctime appends a newline to the end of the buffer,
+		buffer[strlen(buffer) - 1] = 0; //remove it
+}
+
 /**
   * This function takes a log level, a printf style format string, and printf style
   * arguments and outputs the message to any of the configured loggers.  Prior to
   * calling this function, logging must be initialized via the setup_logging
   * function prior to any calls to log_msg.  If the specified level is FATAL or
   * above, log_msg will exit(1) immediately after logging the specified message.
+  * With the async logging option, the message is queued and written by a background
+  * thread, except for ERROR and higher messages, which are written before log_msg returns.
   *
   * @param level - the log level of the message to log
   * @param msg - a printf style format string to log
@@ -771,7 +1506,6 @@ UTILS_API int setup_logging(const char * log_options)
 UTILS_API int log_msg(enum LOG_LEVEL level, const char * msg, ...)
 {
 	va_list args, temp_args;
-	struct tm new_time;
 	time_t aclock;
 	char time_buf[64];
 
@@ -781,20 +1515,15 @@ UTILS_API int log_msg(enum LOG_LEVEL level, const char * msg, ...)
 		return 0;
 
 	time(&aclock);
-#ifdef _WIN32
-	localtime_s(&new_time, &aclock);
-	if (asctime_s(time_buf, sizeof(time_buf), &new_time))
-#else
-	localtime_r(&aclock, &new_time);
-	if (!asctime_r(&new_time, time_buf))
-#endif
-	{ //If we couldn't get the time, NULL out time_buf, so we don't print garbage
-		strncpy(time_buf, "TIME FAILURE", sizeof(time_buf));
+	va_start(args, msg);
+	if (logging.async_on && !async_log_msg(level, aclock, msg, args)) {
+		va_end(args);
+		if (level >= FATAL)
+			exit(1);
+		return 0;
 	}
-	else //asctime appends a newline to the end of the buffer,
-		time_buf[strlen(time_buf) - 1] = 0; //remove it
 
-	va_start(args, msg);
+	log_time_string(aclock, time_buf, sizeof(time_buf));
 	if (logging.stdout_on) {
 		va_copy(temp_args, args);
 		fprintf(stdout, "%s - %-8s - ", time_buf, log_level_names[level]);
@@ -862,6 +1591,284 @@ UTILS_API int read_file(char * filename, char **buffer)
 	return fsize;
 }
 
+/**
+ * This function hashes a buffer with 64-bit FNV-1a
+ * @param data - the buffer to hash
+ * @param length - the length of the data parameter
+ * @return - the hash of the buffer
+ */
+UTILS_API uint64_t fnv1a_hash(const char * data, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i = 0; i < length; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+ * This function maps a file into memory read only
+ * @param filename - The filename of the file to map
+ * @param length - A pointer to a size_t that will be assigned the length of the file
+ * @return - the mapped file contents, or NULL on failure or if the file is empty
+ */
+UTILS_API const char * map_file(const char * filename, size_t * length)
+{
+	const char * data = NULL;
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+
+	file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			//The view keeps the mapping open after the handles are closed
+			data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			*length = (size_t)size.QuadPart;
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	struct stat st;
+	void * mapped;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			data = (const char *)mapped;
+			*length = st.st_size;
+		}
+	}
+	close(fd);
+#endif
+	return data;
+}
+
+/**
+ * This function unmaps a file that was mapped with map_file
+ * @param data - the mapped file contents
+ * @param length - the length of the mapped file
+ */
+UTILS_API void unmap_file(const char * data, size_t length)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void *)data, length);
+#endif
+}
+
+static int compare_strings(const void * a, const void * b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+//Orders seeds by their hash, and then by their position in the directory, so the first of any duplicates is kept
+static int compare_seeds(const void * a, const void * b)
+{
+	const seed_file_t * seed_a = *(seed_file_t * const *)a, * seed_b = *(seed_file_t * const *)b;
+	if (seed_a->hash != seed_b->hash)
+		return seed_a->hash < seed_b->hash ? -1 : 1;
+	return seed_a < seed_b ? -1 : seed_a > seed_b;
+}
+
+/**
+ * This function lists the regular files in a directory, sorted by name
+ * @param directory - the directory to list
+ * @param count - A pointer to a size_t that will be assigned the number of files found
+ * @return - an array of the paths of the files in the directory, or NULL if there aren't any.  The caller
+ * should free each path and the array.
+ */
+UTILS_API char ** list_directory_files(char * directory, size_t * count)
+{
+	char filename[MAX_PATH];
+	char ** filenames = NULL, ** new_filenames;
+	size_t num_files = 0, size = 0;
+#ifdef _WIN32
+	WIN32_FIND_DATA fdFile;
+	HANDLE file_handle;
+	int success = 1;
+
+	snprintf(filename, sizeof(filename), "%s\\*", directory);
+	for (file_handle = FindFirstFile(filename, &fdFile);
+		file_handle != INVALID_HANDLE_VALUE && success;
+		success = FindNextFile(file_handle, &fdFile))
+	{
+		if (fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		snprintf(filename, sizeof(filename), "%s\\%s", directory, fdFile.cFileName);
+#else
+	struct dirent * dp;
+	DIR * dfd;
+
+	dfd = opendir(directory);
+	while (dfd && (dp = readdir(dfd)) != NULL)
+	{
+		if (dp->d_type == DT_DIR)
+			continue;
+		snprintf(filename, sizeof(filename), "%s/%s", directory, dp->d_name);
+#endif
+		if (num_files == size) {
+			size = size ? size * 2 : 256;
+			new_filenames = (char **)realloc(filenames, size * sizeof(char *));
+			if (!new_filenames)
+				break;
+			filenames = new_filenames;
+		}
+		filenames[num_files] = strdup(filename);
+		if (filenames[num_files])
+			num_files++;
+	}
+#ifdef _WIN32
+	if (file_handle != INVALID_HANDLE_VALUE)
+		FindClose(file_handle);
+#else
+	if (dfd)
+		closedir(dfd);
+#endif
+
+	if (num_files)
+		qsort(filenames, num_files, sizeof(char *), compare_strings);
+	*count = num_files;
+	return filenames;
+}
+
+/**
+ * This function loads the entries of a packed corpus (see corpus_pack.h) as seeds.  The whole pack is mapped
+ * once, and the seeds point into it, using the hashes from the pack's index.
+ * @param filename - the packed corpus
+ * @return - the seeds, which may include empty entries and duplicates, or NULL on failure
+ */
+static seed_directory_t * load_seed_pack(char * filename)
+{
+	seed_directory_t * seeds;
+	seed_file_t * seed;
+	uint32_t i;
+
+	seeds = (seed_directory_t *)calloc(1, sizeof(seed_directory_t));
+	if (!seeds)
+		return NULL;
+	seeds->pack = corpus_pack_open(filename);
+	if (seeds->pack && seeds->pack->count)
+		seeds->seeds = (seed_file_t *)calloc(seeds->pack->count, sizeof(seed_file_t));
+	for (i = 0; seeds->seeds && i < seeds->pack->count; i++)
+	{
+		seed = &seeds->seeds[seeds->count];
+		seed->filename = corpus_pack_entry_filename(seeds->pack, filename, i);
+		if (!seed->filename)
+			continue;
+		seed->data = CORPUS_PACK_ENTRY_DATA(seeds->pack, i);
+		seed->length = (size_t)seeds->pack->entries[i].length;
+		seed->hash = seeds->pack->entries[i].hash;
+		seeds->count++;
+	}
+	return seeds;
+}
+
+/**
+ * This function maps every seed file in a directory into memory, reading each file only once.  Empty
+ * files, and files with the same contents as an earlier file, are skipped.  The directory can also be a
+ * packed corpus (see corpus_pack.h), whose entries are used as the seed files.
+ * @param directory - the directory containing the seed files, or a packed corpus
+ * @return - the seed files, or NULL on failure or if the directory has no usable seeds.  The caller should
+ * free it with free_seed_directory.
+ */
+UTILS_API seed_directory_t * load_seed_directory(char * directory)
+{
+	seed_directory_t * seeds;
+	seed_file_t * seed, ** sorted;
+	char ** filenames;
+	size_t num_files, i, j;
+
+	if (!is_directory(directory) && is_corpus_pack(directory))
+		seeds = load_seed_pack(directory);
+	else {
+		filenames = list_directory_files(directory, &num_files);
+		seeds = (seed_directory_t *)calloc(1, sizeof(seed_directory_t));
+		if (seeds && num_files)
+			seeds->seeds = (seed_file_t *)calloc(num_files, sizeof(seed_file_t));
+
+		for (i = 0; seeds && seeds->seeds && i < num_files; i++)
+		{
+			seed = &seeds->seeds[seeds->count];
+			seed->data = map_file(filenames[i], &seed->length);
+			if (!seed->data) {
+				free(filenames[i]);
+				continue;
+			}
+			seed->hash = fnv1a_hash(seed->data, seed->length);
+			seed->filename = filenames[i];
+			seeds->count++;
+		}
+		for (; i < num_files; i++)
+			free(filenames[i]);
+		free(filenames);
+	}
+
+	//Find the seeds with the same contents as an earlier one by sorting them by hash, and drop them
+	sorted = seeds && seeds->count ? (seed_file_t **)malloc(seeds->count * sizeof(seed_file_t *)) : NULL;
+	if (sorted) {
+		for (i = 0; i < seeds->count; i++)
+			sorted[i] = &seeds->seeds[i];
+		qsort(sorted, seeds->count, sizeof(seed_file_t *), compare_seeds);
+		for (i = 1; i < seeds->count; i++) {
+			for (j = i; j > 0 && sorted[j - 1]->hash == sorted[i]->hash; j--) {
+				if (sorted[j - 1]->data && sorted[j - 1]->length == sorted[i]->length
+					&& !memcmp(sorted[j - 1]->data, sorted[i]->data, sorted[i]->length)) {
+					if (!seeds->pack)
+						unmap_file(sorted[i]->data, sorted[i]->length);
+					sorted[i]->data = NULL;
+					break;
+				}
+			}
+		}
+		free(sorted);
+
+		for (i = j = 0; i < seeds->count; i++) {
+			if (seeds->seeds[i].data && seeds->seeds[i].length)
+				seeds->seeds[j++] = seeds->seeds[i];
+			else
+				free(seeds->seeds[i].filename);
+		}
+		seeds->count = j;
+	}
+
+	if (seeds && !seeds->count) {
+		free_seed_directory(seeds);
+		seeds = NULL;
+	}
+	return seeds;
+}
+
+/**
+ * This function unmaps and frees the seed files loaded by load_seed_directory
+ * @param seeds - the seed files to free
+ */
+UTILS_API void free_seed_directory(seed_directory_t * seeds)
+{
+	size_t i;
+	if (!seeds)
+		return;
+	for (i = 0; i < seeds->count; i++) {
+		if (!seeds->pack)
+			unmap_file(seeds->seeds[i].data, seeds->seeds[i].length);
+		free(seeds->seeds[i].filename);
+	}
+	corpus_pack_close(seeds->pack);
+	free(seeds->seeds);
+	free(seeds);
+}
+
 /**
  * This function prints a data buffer in hex
  * @param data - a char * data buffer
@@ -951,6 +1958,132 @@ UTILS_API void destroy_mutex(mutex_t mutex)
 	}
 }
 
+//The number of times take_lock tries to take a lock before it sleeps until the lock is released
+#define LOCK_SPIN_COUNT 200
+
+#ifdef _WIN32
+#define CPU_RELAX() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() __asm__ __volatile__("pause")
+#else
+#define CPU_RELAX()
+#endif
+
+#ifndef _WIN32
+struct lock
+{
+#ifdef __linux__
+	volatile int state; //0 if unlocked, 1 if locked, 2 if locked and another thread may be sleeping on it
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+#endif
+
+/**
+ * Creates a lock.  Locks are cheaper than mutexes when they aren't contended, since taking and releasing them
+ * doesn't make a system call unless another thread is waiting (an SRWLOCK on Windows, a futex on Linux).  Unlike
+ * mutexes, they can't be taken again by the thread that holds them.
+ * @return - the created lock on success, NULL on failure
+ */
+UTILS_API lock_t create_lock(void)
+{
+#ifdef _WIN32
+	SRWLOCK * lock = malloc(sizeof(SRWLOCK));
+	if (lock)
+		InitializeSRWLock(lock);
+	return lock;
+#else
+	struct lock * lock = malloc(sizeof(struct lock));
+	if (lock) {
+#ifdef __linux__
+		lock->state = 0;
+#else
+		pthread_mutex_init(&lock->mutex, NULL);
+#endif
+	}
+	return lock;
+#endif
+}
+
+/**
+ * Takes a lock.  If another thread holds it, this spins for a short time, since locks are usually held for less
+ * time than it takes to sleep and be woken, and then sleeps until the lock is released.
+ * @param lock - the lock to take
+ * @return - zero on success, nonzero on failure
+ */
+UTILS_API int take_lock(lock_t lock)
+{
+	int i;
+#if defined(__linux__)
+	int state;
+#endif
+
+	for (i = 0; i < LOCK_SPIN_COUNT; i++) {
+#ifdef _WIN32
+		if (TryAcquireSRWLockExclusive(lock))
+			return 0;
+#elif defined(__linux__)
+		if (lock->state == 0 && __sync_bool_compare_and_swap(&lock->state, 0, 1))
+			return 0;
+#else
+		if (!pthread_mutex_trylock(&lock->mutex))
+			return 0;
+#endif
+		CPU_RELAX();
+	}
+
+#ifdef _WIN32
+	AcquireSRWLockExclusive(lock);
+	return 0;
+#elif defined(__linux__)
+	//Mark the lock as having a sleeper, so the holder wakes us when it releases it
+	state = __sync_lock_test_and_set(&lock->state, 2);
+	while (state != 0) {
+		syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+		state = __sync_lock_test_and_set(&lock->state, 2);
+	}
+	return 0;
+#else
+	return pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+/**
+ * Releases a lock
+ * @param lock - the lock to release
+ * @return - zero on success, nonzero on failure
+ */
+UTILS_API int release_lock(lock_t lock)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(lock);
+	return 0;
+#elif defined(__linux__)
+	if (__sync_fetch_and_sub(&lock->state, 1) != 1) { //there may be a sleeper
+		__sync_lock_release(&lock->state);
+		syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+	return 0;
+#else
+	return pthread_mutex_unlock(&lock->mutex);
+#endif
+}
+
+/**
+ * Cleans up the resources associated with a lock
+ * @param lock - the lock to clean up
+ */
+UTILS_API void destroy_lock(lock_t lock)
+{
+	if (lock) {
+#if !defined(_WIN32) && !defined(__linux__)
+		pthread_mutex_destroy(&lock->mutex);
+#endif
+		free(lock);
+	}
+}
+
 /**
  * Creates a semaphore with the specified initial value and max value (max value
  * only used on Windows)
@@ -1024,11 +2157,385 @@ UTILS_API void destroy_semaphore(semaphore_t semaphore)
 	}
 }
 
+/**
+ * Starts a new thread running the specified function
+ * @param thread - a pointer to a thread_t that will be filled in with the newly created thread
+ * @param func - the function to run in the new thread, declared with the THREAD_FUNC macro
+ * @param arg - the argument to pass to func
+ * @return - zero on success, nonzero on failure
+ */
+UTILS_API int create_thread(thread_t * thread, thread_func_t func, void * arg)
+{
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+	return *thread == NULL;
+#else
+	return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+/**
+ * Waits for a thread to exit and cleans up the resources associated with it
+ * @param thread - the thread to wait for
+ * @return - zero on success, nonzero on failure
+ */
+UTILS_API int join_thread(thread_t thread)
+{
+#ifdef _WIN32
+	int ret = WaitForSingleObject(thread, INFINITE) == WAIT_FAILED;
+	CloseHandle(thread);
+	return ret;
+#else
+	return pthread_join(thread, NULL);
+#endif
+}
+
+/**
+ * Gets the number of processors available to run threads on
+ * @return - the number of processors, or 1 if it can't be determined
+ */
+UTILS_API int get_processor_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+//The processors the process was allowed to run on before any threads were pinned, which
+//pin_thread_to_cpu picks from, and restores threads to
+#ifdef _WIN32
+static DWORD_PTR original_affinity = 0;
+#elif defined(__linux__)
+static cpu_set_t original_affinity;
+static int original_affinity_count = 0;
+#endif
+
+/**
+ * Pins the calling thread to one of the processors the process may run on, so that the memory it
+ * touches first is allocated on that processor's NUMA node, and stays in that processor's caches.
+ * The first call records the processors the process may run on, and later calls pick from them,
+ * so this respects affinity restrictions such as taskset.
+ * @param index - which of the allowed processors to pin the thread to, modulo the number of them,
+ * or -1 to let the thread run on all of them again
+ * @return - zero on success, non-zero on failure or if pinning isn't supported on this platform
+ */
+UTILS_API int pin_thread_to_cpu(int index)
+{
+#ifdef _WIN32
+	DWORD_PTR system_affinity, mask;
+	int count = 0, i;
+
+	if (!original_affinity && !GetProcessAffinityMask(GetCurrentProcess(), &original_affinity, &system_affinity))
+		return 1;
+	if (index < 0)
+		return !SetThreadAffinityMask(GetCurrentThread(), original_affinity);
+
+	for (mask = original_affinity; mask; mask &= mask - 1)
+		count++;
+	index %= count;
+	for (i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++)
+	{
+		mask = (DWORD_PTR)1 << i;
+		if ((original_affinity & mask) && !index--)
+			return !SetThreadAffinityMask(GetCurrentThread(), mask);
+	}
+	return 1;
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	int i;
+
+	if (!original_affinity_count) {
+		if (sched_getaffinity(0, sizeof(original_affinity), &original_affinity))
+			return 1;
+		original_affinity_count = CPU_COUNT(&original_affinity);
+		if (!original_affinity_count)
+			return 1;
+	}
+	if (index < 0)
+		return sched_setaffinity(0, sizeof(original_affinity), &original_affinity) != 0;
+
+	index %= original_affinity_count;
+	for (i = 0; i < CPU_SETSIZE; i++)
+	{
+		if (CPU_ISSET(i, &original_affinity) && !index--) {
+			CPU_ZERO(&cpus);
+			CPU_SET(i, &cpus);
+			return sched_setaffinity(0, sizeof(cpus), &cpus) != 0;
+		}
+	}
+	return 1;
+#else
+	return 1;
+#endif
+}
+
+#if defined(_WIN32) || defined(__linux__)
+/**
+ * Orders processors by how many of their core's SMT siblings come before them: the first processor of each
+ * core, then the second of each core, and so on.
+ * @param ranks - the number of siblings that come before each processor
+ * @param count - the number of entries in the ranks parameter
+ * @param max_rank - the largest entry in the ranks parameter
+ * @param order - used to return the indices of the processors, in order
+ * @param max_count - the number of entries in the order parameter
+ * @return - the number of indices written to order
+ */
+static int order_by_sibling_rank(const int * ranks, int count, int max_rank, int * order, int max_count)
+{
+	int written = 0, rank, i;
+
+	for (rank = 0; rank <= max_rank; rank++)
+	{
+		for (i = 0; i < count && written < max_count; i++)
+		{
+			if (ranks[i] == rank)
+				order[written++] = i;
+		}
+	}
+	return written;
+}
+#endif
+
+/**
+ * Orders the processors that pin_thread_to_cpu picks from so that each physical core comes up once before
+ * any core comes up again for one of its SMT siblings.  Threads pinned in this order only share a core once
+ * every core has a thread.
+ * @param order - used to return the pin_thread_to_cpu indices of the processors, in the order to use them
+ * @param max_count - the number of entries in the order parameter
+ * @return - the number of indices written to order, or 0 if the processors' cores can't be determined
+ */
+UTILS_API int get_cpu_core_order(int * order, int max_count)
+{
+#ifdef _WIN32
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION * info;
+	DWORD_PTR system_affinity, bit;
+	DWORD length = 0;
+	int count = 0, rank, found, max_rank = 0, i, j, k;
+	int ranks[sizeof(DWORD_PTR) * 8];
+
+	if (!original_affinity && !GetProcessAffinityMask(GetCurrentProcess(), &original_affinity, &system_affinity))
+		return 0;
+	GetLogicalProcessorInformation(NULL, &length);
+	info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(length);
+	if (!info)
+		return 0;
+	if (!GetLogicalProcessorInformation(info, &length)) {
+		free(info);
+		return 0;
+	}
+
+	//Find each allowed processor's core, and how many of its siblings come before it
+	for (i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++)
+	{
+		bit = (DWORD_PTR)1 << i;
+		if (!(original_affinity & bit))
+			continue;
+		found = 0;
+		for (j = 0; j < (int)(length / sizeof(*info)) && !found; j++)
+		{
+			if (info[j].Relationship != RelationProcessorCore || !(info[j].ProcessorMask & bit))
+				continue;
+			rank = 0;
+			for (k = 0; k < i; k++)
+				rank += (info[j].ProcessorMask & original_affinity & ((DWORD_PTR)1 << k)) != 0;
+			ranks[count] = rank;
+			found = 1;
+		}
+		if (!found) {
+			free(info);
+			return 0;
+		}
+		if (ranks[count] > max_rank)
+			max_rank = ranks[count];
+		count++;
+	}
+	free(info);
+	return order_by_sibling_rank(ranks, count, max_rank, order, max_count);
+#elif defined(__linux__)
+	char path[128];
+	int package, core_id, count = 0, written, max_rank = 0, i, j;
+	int * core, * ranks;
+	FILE * fp;
+
+	if (!original_affinity_count) {
+		if (sched_getaffinity(0, sizeof(original_affinity), &original_affinity))
+			return 0;
+		original_affinity_count = CPU_COUNT(&original_affinity);
+		if (!original_affinity_count)
+			return 0;
+	}
+	core = (int *)malloc(original_affinity_count * sizeof(int));
+	ranks = (int *)malloc(original_affinity_count * sizeof(int));
+	if (!core || !ranks) {
+		free(core);
+		free(ranks);
+		return 0;
+	}
+
+	//Find each allowed processor's core, and how many of its siblings come before it
+	for (i = 0; i < CPU_SETSIZE && count < original_affinity_count; i++)
+	{
+		if (!CPU_ISSET(i, &original_affinity))
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+		fp = fopen(path, "r");
+		package = fp && fscanf(fp, "%d", &package) == 1 ? package : -1;
+		if (fp)
+			fclose(fp);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+		fp = fopen(path, "r");
+		core_id = fp && fscanf(fp, "%d", &core_id) == 1 ? core_id : -1;
+		if (fp)
+			fclose(fp);
+		if (package < 0 || core_id < 0) {
+			free(core);
+			free(ranks);
+			return 0;
+		}
+
+		core[count] = (package << 16) | core_id;
+		ranks[count] = 0;
+		for (j = 0; j < count; j++)
+			ranks[count] += core[j] == core[count];
+		if (ranks[count] > max_rank)
+			max_rank = ranks[count];
+		count++;
+	}
+	written = order_by_sibling_rank(ranks, count, max_rank, order, max_count);
+	free(core);
+	free(ranks);
+	return written;
+#else
+	return 0;
+#endif
+}
+
+//The size that alloc_huge_buffer rounds its allocations up to
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * This function rounds a buffer size up to a whole number of huge pages
+ * @param size - the size to round up
+ * @return - the rounded size
+ */
+static size_t huge_buffer_size(size_t size)
+{
+#ifdef _WIN32
+	size_t page_size = GetLargePageMinimum();
+	if (!page_size)
+		page_size = HUGE_PAGE_SIZE;
+#else
+	size_t page_size = HUGE_PAGE_SIZE;
+#endif
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Allocates a zeroed buffer backed by huge pages where possible, so that walking it takes a fraction of
+ * the TLB entries that regular pages would.  Explicit huge pages (MAP_HUGETLB or MEM_LARGE_PAGES) are
+ * tried first, since they're guaranteed, but they have to be reserved by the administrator.  Otherwise,
+ * on Linux, the buffer is mapped normally and marked for transparent huge pages.  The buffer's pages
+ * are fresh, so they're allocated on the NUMA node of the thread that first touches them.
+ * @param size - the size of the buffer to allocate.  It's rounded up to a whole number of huge pages.
+ * @return - the buffer, which should be freed with free_huge_buffer, or NULL on failure
+ */
+UTILS_API void * alloc_huge_buffer(size_t size)
+{
+	void * buffer;
+
+	size = huge_buffer_size(size);
+#ifdef _WIN32
+	buffer = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (!buffer)
+		buffer = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	return buffer;
+#else
+#ifdef MAP_HUGETLB
+	buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buffer != MAP_FAILED)
+		return buffer;
+#endif
+	buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+	return buffer;
+#endif
+}
+
+/**
+ * Frees a buffer allocated with alloc_huge_buffer
+ * @param buffer - the buffer to free, or NULL
+ * @param size - the size the buffer was allocated with
+ */
+UTILS_API void free_huge_buffer(void * buffer, size_t size)
+{
+	if (!buffer)
+		return;
+#ifdef _WIN32
+	VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+	munmap(buffer, huge_buffer_size(size));
+#endif
+}
+
 #ifndef _WIN32
 
+//Command lines without any of these characters don't need the shell's quoting, expansion, or
+//substitution, so they're split on whitespace instead of with wordexp
+#define SHELL_SPECIAL_CHARS "\\'\"$`*?[~{}()<>|&;#\n"
+
+/**
+ * This function splits a command line that doesn't need any shell expansion on its whitespace.
+ * @param cmd_line - the command line to split
+ * @param num_words - A pointer that will be assigned the number of words in the command line
+ * @return - a NULL terminated array of the words on success, or NULL on failure.  The array and
+ * each item in it should be freed by the caller.
+ */
+static char ** split_plain_command_line(char * cmd_line, size_t * num_words)
+{
+	char ** words;
+	char * pos, * end;
+	size_t count = 0, max_words = 1, i;
+
+	for (pos = cmd_line; *pos; pos++)
+		max_words += *pos == ' ' || *pos == '\t';
+	words = calloc(max_words + 1, sizeof(char *));
+	if (!words)
+		return NULL;
+
+	for (pos = cmd_line; *pos; pos = end)
+	{
+		while (*pos == ' ' || *pos == '\t')
+			pos++;
+		if (!*pos)
+			break;
+		for (end = pos; *end && *end != ' ' && *end != '\t'; end++)
+			;
+		words[count] = strndup(pos, end - pos);
+		if (!words[count]) {
+			for (i = 0; i < count; i++)
+				free(words[i]);
+			free(words);
+			return NULL;
+		}
+		count++;
+	}
+	*num_words = count;
+	return words;
+}
+
 /**
  * This function takes a command line and splits it into the executable filename and
- * the argv-array style arguments.
+ * the argv-array style arguments.  Command lines that need the shell's quoting or expansion
+ * are split with wordexp, and the rest are split on whitespace without it, since wordexp is slow.
  * @param cmd_line - the command line to split
  * @param executable - A pointer that will be assigned the filename of the executable
  * in the command line.  The assigned pointer should be freed by the caller.
@@ -1039,14 +2546,34 @@ UTILS_API void destroy_semaphore(semaphore_t semaphore)
 UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***argv)
 {
 	wordexp_t wordexp_result;
-	size_t i, j;
+	size_t i, j, num_words;
 	char * target_executable, **target_argv;
 
+	if (!strpbrk(cmd_line, SHELL_SPECIAL_CHARS)) {
+		target_argv = split_plain_command_line(cmd_line, &num_words);
+		if (!target_argv)
+			return -1;
+		target_executable = num_words ? strdup(target_argv[0]) : NULL;
+		if (!target_executable) {
+			for (i = 0; i < num_words; i++)
+				free(target_argv[i]);
+			free(target_argv);
+			return -1;
+		}
+		*executable = target_executable;
+		*argv = target_argv;
+		return 0;
+	}
+
 	// Expand the command line into the program and arguments
 	if(wordexp(cmd_line, &wordexp_result, 0)) {
 		wordfree(&wordexp_result);
 		return -1;
 	}
+	if(!wordexp_result.we_wordc) {
+		wordfree(&wordexp_result);
+		return -1;
+	}
 
 	target_executable = strdup(wordexp_result.we_wordv[0]);
 	target_argv = malloc(sizeof(char *) * (wordexp_result.we_wordc+1));
@@ -1076,6 +2603,49 @@ UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***ar
 	return 0;
 }
 
+/**
+ * This function frees a command line split by command_line_update, and resets it, so it can be updated again
+ * @param split - the command_line_t structure to free the split command line of
+ */
+UTILS_API void command_line_free(command_line_t * split)
+{
+	int i;
+
+	if (split->argv) {
+		for (i = 0; split->argv[i]; i++)
+			free(split->argv[i]);
+		free(split->argv);
+	}
+	free(split->executable);
+	free(split->cmd_line);
+	split->argv = NULL;
+	split->executable = NULL;
+	split->cmd_line = NULL;
+}
+
+/**
+ * This function splits a command line into a command_line_t structure, unless the structure already holds
+ * the same command line, so that a target that's started over and over doesn't have its command line split
+ * for each start.
+ * @param split - a command_line_t structure that should be zeroed before the first call, and freed with
+ * command_line_free
+ * @param cmd_line - the command line to split
+ * @return - 0 on success, non-zero on failure
+ */
+UTILS_API int command_line_update(command_line_t * split, char * cmd_line)
+{
+	if (split->cmd_line && !strcmp(split->cmd_line, cmd_line))
+		return 0;
+
+	command_line_free(split);
+	split->cmd_line = strdup(cmd_line);
+	if (!split->cmd_line || split_command_line(cmd_line, &split->executable, &split->argv)) {
+		command_line_free(split);
+		return 1;
+	}
+	return 0;
+}
+
 /**
  * This function starts a process and writes to the stdin of the process.
  * @param cmd_line - The command line of the new process to start.  The command line must start with the
@@ -1122,6 +2692,7 @@ UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, si
 		// fd 1/2 now point to /dev/null, so it stays open.
 		close(dev_null);
 
+		set_sanitizer_options();
 		execv(executable, argv);
 		exit(EXIT_FAILURE);
 	} // back to parent code
@@ -34,53 +34,131 @@
 #define MAX_PATH PATH_MAX
 #endif
 
+//A seed file that has been mapped into memory by load_seed_directory
+typedef struct seed_file
+{
+	char * filename;
+	const char * data;  //The read only mapping of the file's contents
+	size_t length;
+	uint64_t hash;      //A hash of the file's contents, used to skip duplicate seeds
+} seed_file_t;
+
+//The seed files in a directory, sorted by filename, or the entries of a packed corpus in the pack's order,
+//without any empty files or duplicates
+typedef struct seed_directory
+{
+	seed_file_t * seeds;
+	size_t count;
+	struct corpus_pack * pack; //The packed corpus the seeds point into, or NULL if they're mapped one by one
+} seed_directory_t;
+
+//One of the buffers that write_buffers_to_file writes, in order, to a file
+typedef struct file_buffer
+{
+	const char * data;
+	size_t length;
+} file_buffer_t;
+
 #define FUZZ_ERROR -1
 #define FUZZ_NONE  0
 #define FUZZ_RUNNING 1
 #define FUZZ_CRASH 2
 #define FUZZ_HANG  3
+#define FUZZ_OOM   4 //The target was killed for going over its memory limit
 
 #ifdef _WIN32
 typedef HANDLE mutex_t;
+typedef SRWLOCK * lock_t;
 typedef HANDLE semaphore_t;
+typedef HANDLE thread_t;
+typedef LPTHREAD_START_ROUTINE thread_func_t;
+#define THREAD_FUNC(name) DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN return 0
 #else
 typedef pthread_mutex_t * mutex_t;
+typedef struct lock * lock_t;
 typedef sem_t * semaphore_t;
+typedef pthread_t thread_t;
+typedef void * (*thread_func_t)(void *);
+#define THREAD_FUNC(name) void * name(void * arg)
+#define THREAD_RETURN return NULL
 #endif
 
 #ifdef _WIN32
 UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, HANDLE * process_out);
 UTILS_API int start_process_and_write_to_stdin_flags(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, DWORD creation_flags);
+UTILS_API int start_process_and_write_to_stdin_suspended(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * thread_out);
 UTILS_API int start_process_and_write_to_stdin_and_save_pipes_timeout(char * cmd_line, char * input, size_t input_length, HANDLE * process_out, HANDLE * pipe_rd_ptr, HANDLE * pipe_wr_ptr, DWORD timeout_ms);
 UTILS_API int WriteToPipe(HANDLE process, HANDLE pipe_wr, HANDLE pipe_rd, char * input, size_t input_length, DWORD timeout_ms);
 UTILS_API int FlushPipe(HANDLE pipe_rd);
+
+typedef struct process_pool process_pool_t;
+UTILS_API process_pool_t * process_pool_create(char * cmd_line, int size, DWORD creation_flags);
+UTILS_API int process_pool_start(process_pool_t * pool, char * cmd_line, char * input, size_t input_length, HANDLE * process_out);
+UTILS_API void process_pool_destroy(process_pool_t * pool);
 UTILS_API wchar_t * convert_char_array_to_wchar(char * string, wchar_t * out_buffer);
 UTILS_API char * convert_wchar_array_to_char(wchar_t * string, char * out_buffer);
 UTILS_API int get_process_status(HANDLE process);
+UTILS_API int wait_for_process_exit(HANDLE process, int timeout_ms);
 #else
 UTILS_API int get_process_status(pid_t process);
+UTILS_API int get_process_status_signal(pid_t pid, int * signal);
+UTILS_API int wait_for_process_exit(pid_t pid, int timeout_ms);
 #endif
+UTILS_API uint64_t get_time_ms(void);
+UTILS_API uint64_t get_time_ns(void);
 
 UTILS_API char * get_temp_filename(char * suffix);
 UTILS_API int file_exists(char * path);
+UTILS_API int is_directory(char * path);
 UTILS_API int write_buffer_to_file(char * filename, char * buffer, size_t length);
+UTILS_API int write_buffers_to_file(char * filename, const file_buffer_t * buffers, size_t count);
 UTILS_API char * filename_relative_to_binary_dir(char * relative_path);
 UTILS_API int read_file(char * filename, char **buffer);
+UTILS_API const char * map_file(const char * filename, size_t * length);
+UTILS_API void unmap_file(const char * data, size_t length);
+UTILS_API char ** list_directory_files(char * directory, size_t * count);
+UTILS_API seed_directory_t * load_seed_directory(char * directory);
+UTILS_API void free_seed_directory(seed_directory_t * seeds);
 UTILS_API void print_hex(char * data, size_t size);
 UTILS_API void md5(uint8_t *initial_msg, size_t initial_len, char * output, size_t output_size);
 UTILS_API void * memdup(void * src, size_t length);
+UTILS_API uint64_t fnv1a_hash(const char * data, size_t length);
 
 UTILS_API mutex_t create_mutex(void);
 UTILS_API int take_mutex(mutex_t mutex);
 UTILS_API int release_mutex(mutex_t mutex);
 UTILS_API void destroy_mutex(mutex_t mutex);
+UTILS_API lock_t create_lock(void);
+UTILS_API int take_lock(lock_t lock);
+UTILS_API int release_lock(lock_t lock);
+UTILS_API void destroy_lock(lock_t lock);
 UTILS_API semaphore_t create_semaphore(int initial, int max);
 UTILS_API int take_semaphore(semaphore_t semaphore);
 UTILS_API int release_semaphore(semaphore_t semaphore);
 UTILS_API void destroy_semaphore(semaphore_t semaphore);
+UTILS_API int create_thread(thread_t * thread, thread_func_t func, void * arg);
+UTILS_API int join_thread(thread_t thread);
+UTILS_API int get_processor_count(void);
+UTILS_API int pin_thread_to_cpu(int index);
+UTILS_API int get_cpu_core_order(int * order, int max_count);
+UTILS_API void * alloc_huge_buffer(size_t size);
+UTILS_API void free_huge_buffer(void * buffer, size_t size);
+UTILS_API void set_sanitizer_options(void);
+UTILS_API int set_sanitizer_reports(const char * report_directory);
 
 #ifndef _WIN32
+//A command line split into the executable and argv, which is only split again when the command line changes
+typedef struct command_line
+{
+	char * cmd_line;    //The command line that executable and argv were split from
+	char * executable;
+	char ** argv;
+} command_line_t;
+
 UTILS_API int split_command_line(char * cmd_line, char ** executable, char ***argv);
+UTILS_API int command_line_update(command_line_t * split, char * cmd_line);
+UTILS_API void command_line_free(command_line_t * split);
 UTILS_API int start_process_and_write_to_stdin(char * cmd_line, char * input, size_t input_length, pid_t * process_out);
 #endif
 
@@ -95,16 +173,38 @@ enum LOG_LEVEL {
 	MAX_LOG_LEVEL,
 };
 
+//The lowest level that is logged.  The logging macros compare against it before calling log_msg,
+//so a message at a disabled level costs one branch, without evaluating its arguments.
+#ifdef _WIN32
+#if defined(UTILS_EXPORTS)
+#define UTILS_DATA_API __declspec(dllexport)
+#elif defined(UTILS_NO_IMPORT)
+#define UTILS_DATA_API
+#else
+#define UTILS_DATA_API __declspec(dllimport)
+#endif
+#else
+#define UTILS_DATA_API
+#endif
+#ifdef __cplusplus
+extern "C" UTILS_DATA_API int log_level_threshold;
+#else
+extern UTILS_DATA_API int log_level_threshold;
+#endif
+
+#define LOG_MSG_IF_ENABLED(level, msg, ...) \
+	((level) >= log_level_threshold ? log_msg(level, msg, ##__VA_ARGS__) : 0)
+
 #if defined(_DEBUG)
-#define DEBUG_MSG(msg, ...) log_msg(DEBUG, msg, ##__VA_ARGS__)
+#define DEBUG_MSG(msg, ...) LOG_MSG_IF_ENABLED(DEBUG, msg, ##__VA_ARGS__)
 #else
 #define DEBUG_MSG(msg, ...)
 #endif
 
-#define INFO_MSG(msg, ...) log_msg(INFO, msg, ##__VA_ARGS__)
-#define WARNING_MSG(msg, ...) log_msg(WARNING, msg, ##__VA_ARGS__)
-#define ERROR_MSG(msg, ...) log_msg(ERROR_LEVEL, msg, ##__VA_ARGS__)
-#define CRITICAL_MSG(msg, ...) log_msg(CRITICAL, msg, ##__VA_ARGS__)
+#define INFO_MSG(msg, ...) LOG_MSG_IF_ENABLED(INFO, msg, ##__VA_ARGS__)
+#define WARNING_MSG(msg, ...) LOG_MSG_IF_ENABLED(WARNING, msg, ##__VA_ARGS__)
+#define ERROR_MSG(msg, ...) LOG_MSG_IF_ENABLED(ERROR_LEVEL, msg, ##__VA_ARGS__)
+#define CRITICAL_MSG(msg, ...) LOG_MSG_IF_ENABLED(CRITICAL, msg, ##__VA_ARGS__)
 #define FATAL_MSG(msg, ...) log_msg(FATAL, msg, ##__VA_ARGS__)
 
 UTILS_API char * logging_help(void);
@@ -40,6 +40,9 @@
 #include "modules.h"
 #include "utils.h"
 #include <winafl_config.h>
+#include <winafl_control.h>
+#include <winafl_arena.h>
+#include <winafl_input.h>
 
 
 #define NOTIFY(level, fmt, ...) do {          \
@@ -81,6 +84,8 @@ typedef struct _winafl_option_t {
 	char fuzz_method[MAXIMUM_PATH];
 	char pipe_name[MAXIMUM_PATH];
 	char shm_name[MAXIMUM_PATH];
+	char fuzzer_id[MAXIMUM_PATH];
+	char control_id[MAXIMUM_PATH]; //Names the pipe and control block, which are the fuzzer id's unless -control_id is given
 	unsigned long fuzz_offset;
 	int fuzz_iterations;
 	void **func_args;
@@ -88,6 +93,10 @@ typedef struct _winafl_option_t {
 	drwrap_callconv_t callconv;
 	bool thread_coverage;
 	bool per_module_coverage;
+	bool fast_coverage;
+	bool shm_input;
+	int input_buffer_arg;
+	int input_length_arg;
 } winafl_option_t;
 
 typedef struct _winafl_data_t {
@@ -104,6 +113,9 @@ typedef struct _winafl_data_t {
 
 	//The real coverage info area (when per-module coverage is off)
 	unsigned char *afl_area;
+
+	//The region holding each target module's coverage info (when per-module coverage is on, without verbose edges)
+	winafl_arena_t *arena;
 } winafl_data_t;
 
 typedef struct _debug_data_t {
@@ -134,8 +146,29 @@ static winafl_data_t winafl_data;
 
 static int winafl_tls_field;
 
+//In fast_coverage mode, the thread local data is mirrored into DynamoRIO raw TLS slots, which the instrumentation
+//can address directly off of the TLS segment register, rather than loading the TLS field into a register first.
+static reg_id_t raw_tls_seg;
+static uint raw_tls_offs;
+static int raw_tls_slots;
+
 static fuzz_target_t fuzz_target;
 
+//In verbose edge mode, the edges that have already been written to the edges regions in this iteration.  It's an
+//open addressing hash set, where the slots that weren't filled in the current generation (iteration) are empty.
+typedef struct _verbose_edge_slot_t {
+	uint generation;
+	uint module;
+	uint from;
+	uint to;
+} verbose_edge_slot_t;
+
+static verbose_edge_slot_t *verbose_edge_set;
+static uint verbose_edge_generation = 1;
+static uint verbose_edge_count;    //The number of unique edges hit in this iteration
+static uint verbose_edge_capacity; //The number of edges that fit in the set and the edges regions
+static void *verbose_edge_lock;
+
 static debug_data_t debug_data;
 
 static module_table_t *module_table;
@@ -145,6 +178,14 @@ static volatile bool go_native;
 
 static HANDLE pipe = NULL;
 
+//The control block used to get commands from the fuzzer and report results to it
+static winafl_control_t * control = NULL;
+static HANDLE command_event = NULL;
+static HANDLE result_event = NULL;
+
+//The shared memory region the fuzzer writes each input to, when -shm_input is set
+static winafl_input_t * input_region = NULL;
+
 //////////////////////////////////////////////////////////////////////////////////////
 // Function Prototypes ///////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////
@@ -154,6 +195,7 @@ static void event_thread_exit(void *drcontext);
 
 static void setup_shm_and_tls_regions_for_coverage(void *drcontext);
 static void read_start_fuzz_command();
+static void set_raw_tls_slot(int slot, void * value);
 
 //////////////////////////////////////////////////////////////////////////////////////
 // Function Definitions //////////////////////////////////////////////////////////////
@@ -248,7 +290,6 @@ static void dump_winafl_data()
  * @return - whether the exception should be passed on to the client
  */
 static bool onexception(void *drcontext, dr_exception_t *excpt) {
-	DWORD num_written;
 	DWORD exception_code = excpt->record->ExceptionCode;
 
 	if (options.debug_mode || options.write_log)
@@ -264,7 +305,7 @@ static bool onexception(void *drcontext, dr_exception_t *excpt) {
 		}
 		else {
 			winafl_data.exception_hit = true;
-			WriteFile(pipe, "C", 1, &num_written, NULL);
+			winafl_control_post(&control->result, 'C', result_event);
 		}
 		dr_exit_process(1);
 	}
@@ -299,6 +340,8 @@ static void event_thread_init(void *drcontext)
 			thread_data[1] = winafl_data.fake_afl_area;
 	}
 	drmgr_set_tls_field(drcontext, winafl_tls_field, thread_data);
+	for (i = 0; i < raw_tls_slots && i <= num_modules; i++)
+		set_raw_tls_slot(i, thread_data[i]);
 
 	//If we haven't set a target module, then just enable instrumentation now
 	if (!options.fuzz_module[0]) {
@@ -346,6 +389,92 @@ static target_module_t * find_target_module(const char * module_name)
 	return NULL;
 }
 
+/**
+ * This function sets one of the current thread's raw TLS slots, in fast_coverage mode.  The slots mirror the
+ * thread local data, so slot 0 holds the previous basic block offset, and the rest hold the coverage map pointers.
+ * @param slot - the index of the slot to set
+ * @param value - the value to store in the slot
+ */
+static void set_raw_tls_slot(int slot, void * value)
+{
+	if (slot < raw_tls_slots)
+		((void **)(dr_get_dr_segment_base(raw_tls_seg) + raw_tls_offs))[slot] = value;
+}
+
+/**
+ * This function creates an operand that refers to one the current thread's raw TLS slots
+ * @param slot - the index of the slot to refer to
+ * @return - the operand for the slot
+ */
+static opnd_t raw_tls_opnd(int slot)
+{
+	return opnd_create_far_base_disp(raw_tls_seg, DR_REG_NULL, DR_REG_NULL, 0, raw_tls_offs + slot * sizeof(void *), OPSZ_PTR);
+}
+
+/**
+ * This function determines whether the arithmetic flags are dead at an instruction, i.e. they're all written by
+ * it or a later instruction in the basic block before any of them are read.
+ * @param where - the instruction to check
+ * @return - true if the flags are dead at the instruction, false otherwise
+ */
+static bool aflags_dead_at(instr_t * where)
+{
+	instr_t * instr;
+	uint flags, written = 0;
+
+	for (instr = where; instr; instr = instr_get_next_app(instr)) {
+		flags = instr_get_arith_flags(instr, DR_QUERY_DEFAULT);
+		if ((flags & EFLAGS_READ_6) & ~written)
+			return false;
+		written |= EFLAGS_WRITE_TO_READ(flags & EFLAGS_WRITE_6);
+		if ((written & EFLAGS_READ_6) == EFLAGS_READ_6)
+			return true;
+	}
+	return false; //The flags may be read after the basic block
+}
+
+/**
+ * This function is a callback for DynamoRIO's analysis phase, when fast_coverage is enabled.  It picks the first
+ * instruction in the basic block where the arithmetic flags are dead, so the coverage instrumentation can be
+ * inserted there without saving and restoring the flags.  If there isn't one, the first instruction is used.
+ * @param drcontext - a pointer to the input program's machine context.
+ * @param tag - tag is a unique identifier for the basic block fragment
+ * @param bb - the basic block being analyzed
+ * @param for_trace - indicates whether this callback is for a new basic block (false) or for adding a basic block
+ * to a trace being created (true)
+ * @param translating - whether this callback is for basic block creation (false) or is for address translation (true).
+ * @param user_data - Used to return the instruction to insert the coverage instrumentation at
+ * @return - emit flags that control the behavior of basic blocks and traces when emitted into the code cache
+ */
+static dr_emit_flags_t analyze_coverage_bb(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+	bool translating, void **user_data)
+{
+	instr_t * instr;
+
+	*user_data = instrlist_first_app(bb);
+	for (instr = instrlist_first_app(bb); instr; instr = instr_get_next_app(instr)) {
+		if (aflags_dead_at(instr)) {
+			*user_data = instr;
+			break;
+		}
+	}
+	return DR_EMIT_DEFAULT;
+}
+
+/**
+ * This function determines whether the coverage instrumentation should be inserted before an instruction
+ * @param drcontext - a pointer to the input program's machine context.
+ * @param inst - The current instruction being instrumented
+ * @param user_data - User data passed from the analysis phase
+ * @return - true if the instrumentation should be inserted before this instruction, false otherwise
+ */
+static bool is_coverage_insertion_point(void *drcontext, instr_t *inst, void *user_data)
+{
+	if (options.fast_coverage)
+		return inst == (instr_t *)user_data;
+	return drmgr_is_first_instr(drcontext, inst);
+}
+
 /**
  * This function adds a module to the linked list of target modules.
  * @param the name of the module to add
@@ -361,6 +490,31 @@ static void add_target_module(const char * name)
 	strncpy(options.target_modules->module_name, name, BUFFER_SIZE_ELEMENTS(options.target_modules->module_name));
 }
 
+/**
+ * This function inserts the instrumentation that marks a target module's coverage map as dirty, so the fuzzer
+ * doesn't skip the module when looking for new coverage.  It only inserts anything when the maps are in a coverage
+ * arena.
+ * @param drcontext - a pointer to the input program's machine context.
+ * @param bb - the basic block being instrumented
+ * @param inst - the instruction to insert the instrumentation before
+ * @param map_reg - a register holding the module's coverage map pointer, or DR_REG_NULL to address the module's
+ * dirty flag directly
+ * @param afl_map - the module's coverage map, used when map_reg is DR_REG_NULL
+ */
+static void insert_dirty_flag_store(void *drcontext, instrlist_t *bb, instr_t *inst, reg_id_t map_reg,
+	unsigned char *afl_map)
+{
+	opnd_t flag;
+
+	if (!winafl_data.arena)
+		return;
+	if (map_reg != DR_REG_NULL)
+		flag = OPND_CREATE_MEM8(map_reg, -WINAFL_ARENA_DIRTY_DISP);
+	else
+		flag = OPND_CREATE_ABSMEM((void *)winafl_arena_dirty(afl_map), OPSZ_1);
+	instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_st(drcontext, flag, OPND_CREATE_INT8(1)));
+}
+
 /**
  * This function is a callback for DynamoRIO's instrumentation insertion phase.  Depending on the module of the
  * passed in instruction, it will instrument the application's code to track the hit count for each
@@ -387,7 +541,7 @@ static dr_emit_flags_t instrument_bb_coverage(void *drcontext, void *tag, instrl
 	target_module_t *target_module;
 	unsigned char *afl_map;
 
-	if (!drmgr_is_first_instr(drcontext, inst))
+	if (!is_coverage_insertion_point(drcontext, inst, user_data))
 		return DR_EMIT_DEFAULT;
 
 	//Find the module
@@ -416,15 +570,19 @@ static dr_emit_flags_t instrument_bb_coverage(void *drcontext, void *tag, instrl
 
 		drreg_reserve_register(drcontext, bb, inst, NULL, &reg);
 
-		drmgr_insert_read_tls_field(drcontext, winafl_tls_field, bb, inst, reg);
-
 		opnd1 = opnd_create_reg(reg);
-		if (options.per_module_coverage)
-			opnd2 = OPND_CREATE_MEMPTR(reg, (target_module->index + 1) * sizeof(void *));
-		else
-			opnd2 = OPND_CREATE_MEMPTR(reg, sizeof(void *));
+		if (options.fast_coverage)
+			opnd2 = raw_tls_opnd(options.per_module_coverage ? target_module->index + 1 : 1);
+		else {
+			drmgr_insert_read_tls_field(drcontext, winafl_tls_field, bb, inst, reg);
+			if (options.per_module_coverage)
+				opnd2 = OPND_CREATE_MEMPTR(reg, (target_module->index + 1) * sizeof(void *));
+			else
+				opnd2 = OPND_CREATE_MEMPTR(reg, sizeof(void *));
+		}
 		new_instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
 		instrlist_meta_preinsert(bb, inst, new_instr);
+		insert_dirty_flag_store(drcontext, bb, inst, reg, NULL);
 
 		opnd1 = OPND_CREATE_MEM8(reg, offset);
 		new_instr = INSTR_CREATE_inc(drcontext, opnd1);
@@ -440,6 +598,7 @@ static dr_emit_flags_t instrument_bb_coverage(void *drcontext, void *tag, instrl
 		instrlist_meta_preinsert(bb, inst,
 			INSTR_CREATE_inc(drcontext, OPND_CREATE_ABSMEM
 			(&(afl_map[offset]), OPSZ_1)));
+		insert_dirty_flag_store(drcontext, bb, inst, DR_REG_NULL, afl_map);
 	}
 
 	drreg_unreserve_aflags(drcontext, bb, inst);
@@ -447,6 +606,65 @@ static dr_emit_flags_t instrument_bb_coverage(void *drcontext, void *tag, instrl
 	return DR_EMIT_DEFAULT;
 }
 
+/**
+ * This function inserts the edge coverage instrumentation in fast_coverage mode.  The previous offset and the
+ * coverage map pointer are addressed directly in their raw TLS slots, so only one register is needed to hold the
+ * previous offset (and one more to hold the map pointer on 64-bit, or when tracking coverage per thread).
+ * @param drcontext - a pointer to the input program's machine context.
+ * @param bb - the basic block being instrumented
+ * @param inst - the instruction to insert the instrumentation before
+ * @param target_module - the target module the basic block belongs to
+ * @param offset - the basic block's offset in the coverage map
+ */
+static void instrument_fast_edge_coverage(void *drcontext, instrlist_t *bb, instr_t *inst,
+	target_module_t *target_module, uint offset)
+{
+	reg_id_t reg, map_reg = DR_REG_NULL;
+	unsigned char *afl_map;
+	opnd_t counter;
+
+	afl_map = options.per_module_coverage ? target_module->afl_area : winafl_data.afl_area;
+
+	drreg_reserve_aflags(drcontext, bb, inst);
+	drreg_reserve_register(drcontext, bb, inst, NULL, &reg);
+
+	//load the thread's coverage map pointer, unless it can be used as a displacement
+	if (options.thread_coverage) {
+		drreg_reserve_register(drcontext, bb, inst, NULL, &map_reg);
+		instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(map_reg),
+			raw_tls_opnd(options.per_module_coverage ? target_module->index + 1 : 1)));
+	}
+#ifdef _M_X64
+	else {
+		drreg_reserve_register(drcontext, bb, inst, NULL, &map_reg);
+		instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(map_reg),
+			OPND_CREATE_INTPTR((ptr_int_t)afl_map)));
+	}
+#endif
+
+	insert_dirty_flag_store(drcontext, bb, inst, map_reg, afl_map);
+
+	//reg = previous offset ^ offset
+	instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(reg), raw_tls_opnd(0)));
+	instrlist_meta_preinsert(bb, inst, INSTR_CREATE_xor(drcontext, opnd_create_reg(reg), OPND_CREATE_INT32(offset)));
+
+	//increase the counter at the map + reg
+	if (map_reg != DR_REG_NULL)
+		counter = opnd_create_base_disp(map_reg, reg, 1, 0, OPSZ_1);
+	else
+		counter = opnd_create_base_disp(reg, DR_REG_NULL, 0, (int)(ptr_int_t)afl_map, OPSZ_1);
+	instrlist_meta_preinsert(bb, inst, INSTR_CREATE_inc(drcontext, counter));
+
+	//store the new previous offset value
+	instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_st(drcontext, raw_tls_opnd(0),
+		OPND_CREATE_INT32((offset >> 1) & (MAP_SIZE - 1))));
+
+	if (map_reg != DR_REG_NULL)
+		drreg_unreserve_register(drcontext, bb, inst, map_reg);
+	drreg_unreserve_register(drcontext, bb, inst, reg);
+	drreg_unreserve_aflags(drcontext, bb, inst);
+}
+
 /**
  * This function is a callback for DynamoRIO's instrumentation insertion phase.  Depending on the module of the
  * passed in instruction, it will instrument the application's code to track the hit count for each
@@ -476,7 +694,7 @@ static dr_emit_flags_t instrument_edge_coverage(void *drcontext, void *tag, inst
 	uint offset;
 	target_module_t *target_module;
 
-	if (!drmgr_is_first_instr(drcontext, inst))
+	if (!is_coverage_insertion_point(drcontext, inst, user_data))
 		return DR_EMIT_DEFAULT;
 
 	//Find the module
@@ -496,6 +714,11 @@ static dr_emit_flags_t instrument_edge_coverage(void *drcontext, void *tag, inst
 		dr_fprintf(winafl_data.log, "Instrumenting module %s for edge coverage at offset %lx\n", module_name, offset);
 	offset &= MAP_SIZE - 1;
 
+	if (options.fast_coverage) {
+		instrument_fast_edge_coverage(drcontext, bb, inst, target_module, offset);
+		return DR_EMIT_DEFAULT;
+	}
+
 	drreg_reserve_aflags(drcontext, bb, inst);
 	drreg_reserve_register(drcontext, bb, inst, NULL, &reg);
 	drreg_reserve_register(drcontext, bb, inst, NULL, &reg2);
@@ -525,6 +748,7 @@ static dr_emit_flags_t instrument_edge_coverage(void *drcontext, void *tag, inst
 		new_instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
 		instrlist_meta_preinsert(bb, inst, new_instr);
 	}
+	insert_dirty_flag_store(drcontext, bb, inst, reg2, NULL);
 
 	//load previous offset into register
 	opnd1 = opnd_create_reg(reg);
@@ -558,16 +782,89 @@ static dr_emit_flags_t instrument_edge_coverage(void *drcontext, void *tag, inst
 	return DR_EMIT_DEFAULT;
 }
 
+/**
+ * This function clears the edges that were recorded in the last iteration in verbose edge mode.  Only the edge count
+ * needs to be reset, as the edges after it are never read.  Every slot of the edge set that was filled in a previous
+ * iteration counts as empty once the generation is bumped, so the set doesn't need clearing either.
+ */
+static void clear_verbose_edges(void)
+{
+	target_module_t *cur;
+
+	if (++verbose_edge_generation == 0) {
+		memset(verbose_edge_set, 0, VERBOSE_EDGE_SET_SLOTS * sizeof(verbose_edge_slot_t));
+		verbose_edge_generation = 1;
+	}
+	verbose_edge_count = 0;
+
+	if (options.per_module_coverage) {
+		for (cur = options.target_modules; cur; cur = cur->next) {
+			if (cur->afl_area)
+				*(ptr_uint_t *)cur->afl_area = 0;
+		}
+	}
+	else if (winafl_data.afl_area)
+		*(ptr_uint_t *)winafl_data.afl_area = 0;
+}
+
+/**
+ * This function is the clean call that records an edge in verbose edge mode.  Each edge is only written to the
+ * module's edges region the first time it's hit in an iteration, so the region holds the set of edges the iteration
+ * hit, rather than every edge it took, and it can't overflow on a long running iteration.
+ * @param module - the index of the target module (plus one) the basic block is in
+ * @param offset - the offset of the basic block in the module
+ */
+static void record_verbose_edge(uint module, uint offset)
+{
+	void **thread_data = (void **)drmgr_get_tls_field(dr_get_current_drcontext(), winafl_tls_field);
+	ptr_uint_t *area = (ptr_uint_t *)thread_data[options.per_module_coverage ? module : 1];
+	ptr_uint_t previous = (ptr_uint_t)thread_data[0], num_edges;
+	verbose_edge_slot_t *slot;
+	uint index;
+
+	thread_data[0] = (void *)(ptr_uint_t)offset;
+	if ((unsigned char *)area == winafl_data.fake_afl_area) //A thread that isn't being recorded
+		return;
+
+	//Find the edge in the set, or the empty slot to add it in
+	index = (uint)((((uint64)previous * 0x9E3779B1) ^ offset ^ ((uint64)module << 27)) * 0x9E3779B97F4A7C15ULL >> 40);
+	dr_mutex_lock(verbose_edge_lock);
+	for (;; index++) {
+		slot = &verbose_edge_set[index & (VERBOSE_EDGE_SET_SLOTS - 1)];
+		if (slot->generation != verbose_edge_generation)
+			break;
+		if (slot->module == module && slot->from == (uint)previous && slot->to == offset) {
+			dr_mutex_unlock(verbose_edge_lock);
+			return;
+		}
+	}
+
+	//Once the set is half full, new edges are dropped
+	if (verbose_edge_count < verbose_edge_capacity) {
+		slot->generation = verbose_edge_generation;
+		slot->module = module;
+		slot->from = (uint)previous;
+		slot->to = offset;
+		verbose_edge_count++;
+
+		//The region is laid out like instrumentation_edges_t: the number of edges, followed by the from/to pairs
+		num_edges = area[0];
+		area[1 + 2 * num_edges] = previous;
+		area[2 + 2 * num_edges] = offset;
+		area[0] = num_edges + 1;
+	}
+	else if (options.write_log && verbose_edge_count++ == verbose_edge_capacity)
+		dr_fprintf(winafl_data.log, "Too many unique edges in this iteration, only recording the first %u\n",
+			verbose_edge_capacity);
+	dr_mutex_unlock(verbose_edge_lock);
+}
+
 static dr_emit_flags_t
 instrument_verbose_edge_coverage(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
 	bool for_trace, bool translating, void *user_data)
 {
-	static bool debug_information_output = false;
 	app_pc start_pc;
 	module_entry_t *mod_entry;
-	reg_id_t index_register, shm_reg, tls_reg, previous_reg;
-	opnd_t opnd1, opnd2;
-	instr_t *new_instr;
 	const char *module_name;
 	uint offset;
 	target_module_t *target_module;
@@ -591,107 +888,9 @@ instrument_verbose_edge_coverage(void *drcontext, void *tag, instrlist_t *bb, in
 	if(options.write_log)
 		dr_fprintf(winafl_data.log, "Instrumenting module %s for verbose edge recording at offset %lx\n", module_name, offset);
 
-	drreg_reserve_aflags(drcontext, bb, inst);
-	drreg_reserve_register(drcontext, bb, inst, NULL, &index_register); //used to hold the offset to the current index in the from/to array
-	drreg_reserve_register(drcontext, bb, inst, NULL, &previous_reg); //used to hold the previous basic block's offset
-	drreg_reserve_register(drcontext, bb, inst, NULL, &shm_reg); //used to hold the pointer to the shm region
-	drreg_reserve_register(drcontext, bb, inst, NULL, &tls_reg); //used to hold the pointer to the tls structure
-
-	//shm_reg stores AFL area, previous_reg stores previous offset
-
-	//the thread local area when in non-per module coverage mode is of the form:
-	//  void * previous_block_address;
-	//  void * shm pointer;
-	//
-	//the thread local area when in per module coverage mode is of the form:
-	//  void * previous_block_address;
-	//  void * shm pointer for first target module;
-	//  void * shm pointer for second target module;
-	//  ...
-	//
-	//And the shm area is of the form (depending on whether we're compiled to 32/64-bit):
-	//  uint32_t/uint64_t num_items
-	//  void * from1
-	//  void * to1
-	//  void * from2
-	//  void * to2
-	//  ...
-
-	//load the address of the thread local storage in tls_reg
-	drmgr_insert_read_tls_field(drcontext, winafl_tls_field, bb, inst, tls_reg);
-
-	//Get the address of the shm region into shm_reg
-	opnd1 = opnd_create_reg(shm_reg);
-	if (options.per_module_coverage)
-		opnd2 = OPND_CREATE_MEMPTR(tls_reg, (target_module->index + 1) * sizeof(void *));
-	else
-		opnd2 = OPND_CREATE_MEMPTR(tls_reg, sizeof(void *));
-	new_instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-
-	//load index to write to into a register and increment it atomically
-	
-	//First we set index_register to 1
-	opnd1 = opnd_create_reg(index_register);
-	opnd2 = OPND_CREATE_INTPTR(1);
-	new_instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-	
-	//Then we use xadd with a lock to atomically read the index and increment it
-	opnd1 = OPND_CREATE_MEMPTR(shm_reg, 0);
-	opnd2 = opnd_create_reg(index_register);
-	new_instr = LOCK(INSTR_CREATE_xadd(drcontext, opnd1, opnd2));
-	instrlist_meta_preinsert(bb, inst, new_instr);
-	
-	//load previous offset into register
-	opnd1 = opnd_create_reg(previous_reg);
-	opnd2 = OPND_CREATE_MEMPTR(tls_reg, 0);
-	new_instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-	
-	//times the index register by 2
-	opnd1 = opnd_create_reg(index_register);
-	opnd2 = OPND_CREATE_INT8(1);
-	new_instr = INSTR_CREATE_shl(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-
-	//Now index_register contains the offset in the array to write to and previous_reg contains the previous basic block's offset
-	//Let's write the previous basic basic block's edge to the array
-#ifdef _M_X64
-	opnd1 = opnd_create_base_disp(shm_reg, index_register, 8, 8, OPSZ_8);
-#else
-	opnd1 = opnd_create_base_disp(shm_reg, index_register, 4, 4, OPSZ_4);
-#endif
-	opnd2 = opnd_create_reg(previous_reg);
-	new_instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-
-	//Now let's write the current basic block's offset to the array
-#ifdef _M_X64
-	opnd1 = opnd_create_base_disp(shm_reg, index_register, 8, 0x10, OPSZ_8);
-	opnd2 = OPND_CREATE_INT64(offset);
-#else
-	opnd1 = opnd_create_base_disp(shm_reg, index_register, 4, 8, OPSZ_4);
-	opnd2 = OPND_CREATE_INT32(offset);
-#endif
-	new_instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-
-	//store the current basic block's offset to the previous slot
-	opnd1 = OPND_CREATE_MEMPTR(tls_reg, 0);
-#ifdef _M_X64
-	opnd2 = OPND_CREATE_INT64(offset);
-#else
-	opnd2 = OPND_CREATE_INT32(offset);
-#endif
-	new_instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
-	instrlist_meta_preinsert(bb, inst, new_instr);
-	
-	drreg_unreserve_register(drcontext, bb, inst, tls_reg);
-	drreg_unreserve_register(drcontext, bb, inst, shm_reg);
-	drreg_unreserve_register(drcontext, bb, inst, previous_reg);
-	drreg_unreserve_register(drcontext, bb, inst, index_register);
-	drreg_unreserve_aflags(drcontext, bb, inst);
+	//Checking whether the edge was already recorded needs the edge set, so it's done in a clean call rather than inline
+	dr_insert_clean_call(drcontext, bb, inst, (void *)record_verbose_edge, false, 2,
+		OPND_CREATE_INT32(target_module->index + 1), OPND_CREATE_INT32(offset));
 
 	return DR_EMIT_DEFAULT;
 }
@@ -736,6 +935,13 @@ static void pre_fuzz_handler(void *wrapcxt, INOUT void **user_data)
 	//Wait for the fuzzer to tell us to start
 	read_start_fuzz_command();
 
+	//The fuzzer has written this iteration's input by the time it sends the command, so hand it to the target function
+	if (input_region) {
+		drwrap_set_arg(wrapcxt, options.input_buffer_arg, input_region->data);
+		if (options.input_length_arg >= 0)
+			drwrap_set_arg(wrapcxt, options.input_length_arg, (void *)(ptr_uint_t)input_region->length);
+	}
+
 	//Setup the SHM and TLS regions before we start tracking coverage
 	setup_shm_and_tls_regions_for_coverage(drcontext);
 
@@ -746,13 +952,12 @@ static void pre_fuzz_handler(void *wrapcxt, INOUT void **user_data)
 static void read_start_fuzz_command()
 {
 	char command = 0;
-	DWORD num_read;
 	char buffer[256];
 
 	//Wait for orders from the fuzzer
 	if (!options.debug_mode) {
-		DR_ASSERT_MSG(ReadFile(pipe, &command, 1, &num_read, NULL), "Failed to read from comms pipe");
-		dr_fprintf(winafl_data.log, "Got %c from pipe\n", command);
+		command = (char)winafl_control_wait(&control->command, command_event, INFINITE);
+		dr_fprintf(winafl_data.log, "Got %c from the control block\n", command);
 
 		if (command != 'F') {
 			if (command == 'Q') {
@@ -760,7 +965,7 @@ static void read_start_fuzz_command()
 			}
 			else if (command != 0) {
 				memset(buffer, 0, sizeof(buffer));
-				snprintf(buffer, sizeof(buffer) - 1, "unrecognized command received over pipe: %02x (%c)", command, command);
+				snprintf(buffer, sizeof(buffer) - 1, "unrecognized command received from the control block: %02x (%c)", command, command);
 				DR_ASSERT_MSG(false, buffer);
 			}
 		}
@@ -778,16 +983,29 @@ static void setup_shm_and_tls_regions_for_coverage(void *drcontext)
 		dr_fprintf(winafl_data.log, "Initializing shm area\n");
 
 	//Zeroize the shm memory area
-	if (options.per_module_coverage)
+	if (options.verbose_edges)
+		clear_verbose_edges();
+	else if (winafl_data.arena)
+	{
+		//Only the maps that were written to in the last iteration need to be cleared
+		for (cur = options.target_modules; cur; cur = cur->next)
+		{
+			if (*winafl_arena_dirty(cur->afl_area)) {
+				memset(cur->afl_area, 0, MAP_SIZE);
+				*winafl_arena_dirty(cur->afl_area) = 0;
+			}
+		}
+	}
+	else if (options.per_module_coverage)
 	{
 		for (cur = options.target_modules; cur; cur = cur->next)
 		{
 			if (cur->afl_area)
-				memset(cur->afl_area, 0, options.verbose_edges ? EDGES_SHM_SIZE : MAP_SIZE);
+				memset(cur->afl_area, 0, MAP_SIZE);
 		}
 	}
 	else if (winafl_data.afl_area)
-		memset(winafl_data.afl_area, 0, options.verbose_edges ? EDGES_SHM_SIZE : MAP_SIZE);
+		memset(winafl_data.afl_area, 0, MAP_SIZE);
 
 	if(options.write_log)
 		dr_fprintf(winafl_data.log, "initializing thread local data\n");
@@ -796,13 +1014,18 @@ static void setup_shm_and_tls_regions_for_coverage(void *drcontext)
 	if (options.coverage_kind == COVERAGE_EDGE || options.thread_coverage || options.verbose_edges) {
 		void **thread_data = (void **)drmgr_get_tls_field(drcontext, winafl_tls_field);
 		thread_data[0] = 0; //previous basic block offset
+		set_raw_tls_slot(0, 0);
 		if (options.per_module_coverage)
 		{
-			for (cur = options.target_modules; cur; cur = cur->next)
+			for (cur = options.target_modules; cur; cur = cur->next) {
 				thread_data[cur->index + 1] = cur->afl_area;
+				set_raw_tls_slot(cur->index + 1, cur->afl_area);
+			}
 		}
-		else
+		else {
 			thread_data[1] = winafl_data.afl_area;
+			set_raw_tls_slot(1, winafl_data.afl_area);
+		}
 	}
 }
 
@@ -816,7 +1039,6 @@ static void setup_shm_and_tls_regions_for_coverage(void *drcontext)
  */
 static void post_fuzz_handler(void *wrapcxt, void *user_data)
 {
-	DWORD num_written;
 	DWORD num_bytes = 0;
 	dr_mcontext_t *mc;
 
@@ -824,7 +1046,7 @@ static void post_fuzz_handler(void *wrapcxt, void *user_data)
 		dr_fprintf(winafl_data.log, "post_fuzz_handler started\n");
 
 	if (!options.debug_mode) {
-		WriteFile(pipe, "K", 1, &num_written, NULL);
+		winafl_control_post(&control->result, 'K', result_event);
 	} else {
 		debug_data.post_handler_called++;
 	}
@@ -962,7 +1184,6 @@ static void event_module_load(void *drcontext, const module_data_t *info, bool l
  */
 static void event_exit(void)
 {
-	DWORD num_written;
 	if (options.debug_mode) {
 		if (debug_data.pre_hanlder_called == 0) {
 			dr_fprintf(winafl_data.log, "WARNING: Target function was never called. Incorrect target_offset?\n");
@@ -979,14 +1200,22 @@ static void event_exit(void)
 		dr_close_file(winafl_data.log);
 	}
 
-	if (!options.fuzz_module[0] && !winafl_data.exception_hit) {
+	if (!options.fuzz_module[0] && !winafl_data.exception_hit && control) {
 		//if we're not using the pre/post fuzz handler functions, we should let the fuzzer know we didn't crash
-		WriteFile(pipe, "K", 1, &num_written, NULL);
+		winafl_control_post(&control->result, 'K', result_event);
 	}
 
+	if (raw_tls_slots)
+		dr_raw_tls_cfree(raw_tls_offs, raw_tls_slots);
+
 	/* destroy module table */
 	module_table_destroy(module_table);
 
+	if (verbose_edge_set) {
+		dr_global_free(verbose_edge_set, VERBOSE_EDGE_SET_SLOTS * sizeof(verbose_edge_slot_t));
+		dr_mutex_destroy(verbose_edge_lock);
+	}
+
 	drx_exit();
 	drmgr_exit();
 }
@@ -1016,19 +1245,23 @@ static void event_init(void)
 	module_table = module_table_create();
 
 	memset(winafl_data.cache, 0, sizeof(winafl_data.cache));
-	if (options.per_module_coverage)
+	if (options.verbose_edges)
+		clear_verbose_edges();
+	else if (options.per_module_coverage)
 	{
 		target_module_t * target_module;
 		for (target_module = options.target_modules; target_module; target_module = target_module->next)
 		{
 			DR_ASSERT_MSG(target_module->afl_area != NULL, "afl_area not properly setup");
-			memset(target_module->afl_area, 0, options.verbose_edges  ? EDGES_SHM_SIZE : MAP_SIZE);
+			memset(target_module->afl_area, 0, MAP_SIZE);
+			if (winafl_data.arena)
+				*winafl_arena_dirty(target_module->afl_area) = 0;
 		}
 	}
 	else
 	{
 		DR_ASSERT_MSG(winafl_data.afl_area != NULL, "afl_area not properly setup");
-		memset(winafl_data.afl_area, 0, options.verbose_edges ? EDGES_SHM_SIZE : MAP_SIZE);
+		memset(winafl_data.afl_area, 0, MAP_SIZE);
 	}
 
 	fuzz_target.iteration = 0;
@@ -1064,30 +1297,64 @@ static HANDLE setup_pipe(const char * pipe_name, DWORD access)
 }
 
 /**
- * Sets up the pipe used for communication to the main fuzzing process
+ * This function opens one of the control block's events.
+ * @param name_format - the format of the event's name, which takes the control id
+ * @return - a HANDLE to the event
+ */
+static HANDLE open_control_event(const char * name_format)
+{
+	char name[MAXIMUM_PATH], buffer[512];
+	HANDLE event;
+
+	snprintf(name, sizeof(name) - 1, name_format, options.control_id);
+	name[sizeof(name) - 1] = 0;
+	event = OpenEvent(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name);
+	if (!event)
+	{
+		snprintf(buffer, sizeof(buffer) - 1, "OpenEvent Failed for event %s (GLE=%d)", name, GetLastError());
+		buffer[sizeof(buffer) - 1] = 0;
+		DR_ASSERT_MSG(false, buffer);
+	}
+	return event;
+}
+
+/**
+ * Sets up the pipe and control block used for communication to the main fuzzing process.  The pipe is only
+ * used to tell the fuzzer that we've started, the commands and results go through the control block.
  */
 static void setup_comms_pipe()
 {
+	char name[MAXIMUM_PATH], buffer[512];
+	HANDLE map_file;
+
 	pipe = setup_pipe(options.pipe_name, GENERIC_READ | GENERIC_WRITE);
+
+	snprintf(name, sizeof(name) - 1, WINAFL_CONTROL_NAME, options.control_id);
+	name[sizeof(name) - 1] = 0;
+	map_file = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (map_file)
+		control = (winafl_control_t *)MapViewOfFile(map_file, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(winafl_control_t));
+	if (!control)
+	{
+		snprintf(buffer, sizeof(buffer) - 1, "Mapping the control block %s Failed (GLE=%d)", name, GetLastError());
+		buffer[sizeof(buffer) - 1] = 0;
+		DR_ASSERT_MSG(false, buffer);
+	}
+	command_event = open_control_event(WINAFL_COMMAND_EVENT_NAME);
+	result_event = open_control_event(WINAFL_RESULT_EVENT_NAME);
 }
 
 /**
  * This function maps a shared memory region and returns a pointer it
  * @param name - the name of the shared memory region to map
- * @param for_edges - whether the shm region is for the full edge recording or not
+ * @param size - the number of bytes of the shared memory region to map, or 0 to map all of it
  * @return - a pointer to the shared memory region
  */
-static unsigned char * get_shmem_region(char * name, int for_edges)
+static unsigned char * get_shmem_region(char * name, SIZE_T size)
 {
 	HANDLE map_file;
 	char buffer[512];
 	char * ret;
-	DWORD size;
-
-	if (for_edges)
-		size = EDGES_SHM_SIZE;
-	else
-		size = MAP_SIZE;
 
 	map_file = OpenFileMapping(
 		FILE_MAP_ALL_ACCESS,   // read/write access
@@ -1124,11 +1391,21 @@ static void setup_per_module_shmem() {
 	char name[512];
 
 	DR_ASSERT_MSG(options.per_module_coverage, "setup_per_module_shmem should only be called when options.per_module_coverage is true");
+	if (!options.verbose_edges) {
+		//The coverage maps are all in one region, laid out by the fuzzer
+		winafl_data.arena = (winafl_arena_t *)get_shmem_region(options.shm_name, 0);
+		DR_ASSERT_MSG(winafl_data.arena->num_modules >= (DWORD)get_target_modules_length(options.target_modules)
+			&& winafl_data.arena->map_size == MAP_SIZE, "coverage arena doesn't match the target modules");
+		for (cur = options.target_modules; cur; cur = cur->next)
+			cur->afl_area = winafl_arena_map(winafl_data.arena, cur->index);
+		return;
+	}
+
 	for (cur = options.target_modules; cur; cur = cur->next)
 	{
 		memset(name, 0, sizeof(name));
 		snprintf(name, sizeof(name) - 1, "%s_%d", options.shm_name, cur->index);
-		cur->afl_area = get_shmem_region(name, options.verbose_edges);
+		cur->afl_area = get_shmem_region(name, EDGES_SHM_SIZE);
 	}
 }
 
@@ -1138,7 +1415,19 @@ static void setup_per_module_shmem() {
 static void
 setup_shmem() {
 	DR_ASSERT_MSG(!options.per_module_coverage, "setup_shmem should only be called when options.per_module_coverage is false");
-	winafl_data.afl_area = get_shmem_region(options.shm_name, options.verbose_edges);
+	winafl_data.afl_area = get_shmem_region(options.shm_name, options.verbose_edges ? EDGES_SHM_SIZE : MAP_SIZE);
+}
+
+/**
+ * Sets up the shared memory region the fuzzer writes the inputs to.
+ */
+static void
+setup_input_shmem() {
+	char name[MAXIMUM_PATH];
+
+	memset(name, 0, sizeof(name));
+	snprintf(name, sizeof(name) - 1, WINAFL_INPUT_NAME, options.fuzzer_id);
+	input_region = (winafl_input_t *)get_shmem_region(name, 0);
 }
 
 /**
@@ -1191,10 +1480,15 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 	options.func_args = NULL;
 	options.num_fuz_args = 0;
 	options.callconv = DRWRAP_CALLCONV_DEFAULT;
+	options.shm_input = false;
+	options.input_buffer_arg = -1;
+	options.input_length_arg = -1;
 	dr_snprintf(options.logdir, BUFFER_SIZE_ELEMENTS(options.logdir), ".");
 
 	strcpy(options.pipe_name, "\\\\.\\pipe\\afl_pipe_default");
 	strcpy(options.shm_name, "afl_shm_default");
+	strcpy(options.fuzzer_id, "default");
+	options.control_id[0] = 0;
 
 	for (i = 1/*skip client*/; i < argc; i++) {
 		token = argv[i];
@@ -1210,6 +1504,8 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 			options.nudge_kills = true;
 		else if (strcmp(token, "-no_thread_coverage") == 0)
 			options.thread_coverage = false;
+		else if (strcmp(token, "-fast_coverage") == 0)
+			options.fast_coverage = true;
 		else if (strcmp(token, "-per_module_coverage") == 0)
 			options.per_module_coverage = true;
 		else if (strcmp(token, "-debug") == 0)
@@ -1226,8 +1522,14 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 			strcat(options.pipe_name, argv[i + 1]);
 			strcpy(options.shm_name, "afl_shm_");
 			strcat(options.shm_name, argv[i + 1]);
+			strncpy(options.fuzzer_id, argv[i + 1], BUFFER_SIZE_ELEMENTS(options.fuzzer_id) - 1);
 			i++;
 		}
+		else if (strcmp(token, "-control_id") == 0) {
+			//The processes the fuzzer starts ahead of time share its coverage map, but each has its own control block
+			USAGE_CHECK((i + 1) < argc, "missing control id");
+			strncpy(options.control_id, argv[++i], BUFFER_SIZE_ELEMENTS(options.control_id) - 1);
+		}
 		else if (strcmp(token, "-covtype") == 0) {
 			USAGE_CHECK((i + 1) < argc, "missing coverage type");
 			token = argv[++i];
@@ -1259,6 +1561,16 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 			USAGE_CHECK((i + 1) < argc, "missing number of arguments");
 			options.num_fuz_args = atoi(argv[++i]);
 		}
+		else if (strcmp(token, "-shm_input") == 0)
+			options.shm_input = true;
+		else if (strcmp(token, "-input_buffer_arg") == 0) {
+			USAGE_CHECK((i + 1) < argc, "missing input buffer argument index");
+			options.input_buffer_arg = atoi(argv[++i]);
+		}
+		else if (strcmp(token, "-input_length_arg") == 0) {
+			USAGE_CHECK((i + 1) < argc, "missing input length argument index");
+			options.input_length_arg = atoi(argv[++i]);
+		}
 		else if (strcmp(token, "-target_offset") == 0) {
 			USAGE_CHECK((i + 1) < argc, "missing offset");
 			options.fuzz_offset = strtoul(argv[++i], NULL, 0);
@@ -1292,6 +1604,13 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 		}
 	}
 
+	if (options.control_id[0]) {
+		strcpy(options.pipe_name, "\\\\.\\pipe\\afl_pipe_");
+		strcat(options.pipe_name, options.control_id);
+	}
+	else
+		strcpy(options.control_id, options.fuzzer_id);
+
 	if (options.verbose_edges && (options.coverage_kind != COVERAGE_EDGE || options.thread_coverage != true)) {
 		USAGE_CHECK(false, "If verbose_edges is specified, then the coverage kind must be edge and thread coverage must be on");
 	}
@@ -1300,6 +1619,10 @@ static void options_init(client_id_t id, int argc, const char *argv[])
 		USAGE_CHECK(false, "If fuzz_module is specified, then either fuzz_method or fuzz_offset must be as well");
 	}
 
+	if (options.shm_input && (options.input_buffer_arg < 0 || (options.fuzz_offset == 0 && options.fuzz_method[0] == 0))) {
+		USAGE_CHECK(false, "If shm_input is specified, then input_buffer_arg and either fuzz_method or fuzz_offset must be as well");
+	}
+
 	if (options.num_fuz_args) {
 		options.func_args = (void **)dr_global_alloc(options.num_fuz_args * sizeof(void *));
 	}
@@ -1321,6 +1644,7 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 	target_module_t * cur;
 	drreg_options_t ops = { sizeof(ops), 2 /*max slots needed: aflags*/, false };
 	size_t size;
+	int num_modules;
 
 	dr_set_client_name("WinAFL", "");
 
@@ -1339,10 +1663,12 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 		drmgr_register_bb_instrumentation_event(NULL, instrument_verbose_edge_coverage, NULL);
 	}
 	else  if (options.coverage_kind == COVERAGE_BB) {
-		drmgr_register_bb_instrumentation_event(NULL, instrument_bb_coverage, NULL);
+		drmgr_register_bb_instrumentation_event(options.fast_coverage ? analyze_coverage_bb : NULL,
+			instrument_bb_coverage, NULL);
 	}
 	else if (options.coverage_kind == COVERAGE_EDGE) {
-		drmgr_register_bb_instrumentation_event(NULL, instrument_edge_coverage, NULL);
+		drmgr_register_bb_instrumentation_event(options.fast_coverage ? analyze_coverage_bb : NULL,
+			instrument_edge_coverage, NULL);
 	}
 
 	drmgr_register_module_load_event(event_module_load);
@@ -1358,11 +1684,12 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 	winafl_data.exception_hit = false;
 
 	if (options.thread_coverage || options.coverage_kind == COVERAGE_EDGE) {
+		//The verbose edge instrumentation never writes to the fake area, so it doesn't need to be any bigger
 		size = MAP_SIZE;
-		if (options.verbose_edges)
-			size = EDGES_SHM_SIZE;
-		winafl_data.fake_afl_area = (unsigned char *)dr_global_alloc(size);
-		memset(winafl_data.fake_afl_area, 0, size);
+		//Leave room for the dirty flag the instrumentation sets before per module coverage maps
+		winafl_data.fake_afl_area = (unsigned char *)dr_global_alloc(size + WINAFL_ARENA_DIRTY_DISP);
+		memset(winafl_data.fake_afl_area, 0, size + WINAFL_ARENA_DIRTY_DISP);
+		winafl_data.fake_afl_area += WINAFL_ARENA_DIRTY_DISP;
 	}
 
 	//Allocate the afl area
@@ -1372,18 +1699,35 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 			setup_per_module_shmem();
 		else
 			setup_shmem();
+		if (options.shm_input)
+			setup_input_shmem();
 	}
 	else
 	{
 		if (options.per_module_coverage)
 		{
+			num_modules = get_target_modules_length(options.target_modules);
+			size = winafl_arena_size(num_modules, MAP_SIZE);
+			winafl_data.arena = (winafl_arena_t *)dr_global_alloc(size);
+			memset(winafl_data.arena, 0, size);
+			winafl_arena_init(winafl_data.arena, num_modules, MAP_SIZE);
 			for (cur = options.target_modules; cur; cur = cur->next)
-				cur->afl_area = (unsigned char *)dr_global_alloc(MAP_SIZE);
+				cur->afl_area = winafl_arena_map(winafl_data.arena, cur->index);
 		}
 		else
 			winafl_data.afl_area = (unsigned char *)dr_global_alloc(MAP_SIZE);
 	}
 
+	if (options.verbose_edges) {
+		verbose_edge_set = (verbose_edge_slot_t *)dr_global_alloc(VERBOSE_EDGE_SET_SLOTS * sizeof(verbose_edge_slot_t));
+		memset(verbose_edge_set, 0, VERBOSE_EDGE_SET_SLOTS * sizeof(verbose_edge_slot_t));
+		verbose_edge_lock = dr_mutex_create();
+		//Each edges region holds the edge count, followed by a from/to pair for each edge
+		verbose_edge_capacity = (uint)((options.debug_mode ? MAP_SIZE : EDGES_SHM_SIZE) / (2 * sizeof(ptr_uint_t))) - 1;
+		if (verbose_edge_capacity > VERBOSE_EDGE_MAX)
+			verbose_edge_capacity = VERBOSE_EDGE_MAX;
+	}
+
 	if (options.coverage_kind == COVERAGE_EDGE || options.thread_coverage) {
 		winafl_tls_field = drmgr_register_tls_field();
 		if (winafl_tls_field == -1) {
@@ -1391,6 +1735,13 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 		}
 		drmgr_register_thread_init_event(event_thread_init);
 		drmgr_register_thread_exit_event(event_thread_exit);
+
+		//Mirror the thread local data into raw TLS slots, so the instrumentation can address it directly
+		if (options.fast_coverage && !options.verbose_edges) {
+			raw_tls_slots = get_target_modules_length(options.target_modules) + 1;
+			if (!dr_raw_tls_calloc(&raw_tls_seg, &raw_tls_offs, raw_tls_slots, 0))
+				DR_ASSERT_MSG(false, "error reserving raw TLS slots for fast_coverage");
+		}
 	}
 
 	event_init();